@@ -36,6 +36,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -67,6 +68,28 @@ struct drm_amdgpu_bo_list_entry;
  */
 #define AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE     (1 << 0)
 
+/**
+ * Used in amdgpu_cs_submit(), meaning that consecutive requests to the same
+ * ring with the same resources may be merged into a single submission, up
+ * to AMDGPU_CS_MAX_IBS_PER_SUBMIT IBs and one user fence. Merged requests
+ * share the same sequence number.
+ */
+#define AMDGPU_CS_SUBMIT_COALESCE		(1 << 0)
+
+/**
+ * Maximum number of sensors sampled by a telemetry sampler
+ *
+ * \sa amdgpu_telemetry_create()
+ */
+#define AMDGPU_TELEMETRY_MAX_SENSORS		16
+
+/**
+ * Maximum number of register fields counted by a register sampler
+ *
+ * \sa amdgpu_reg_sampler_create()
+ */
+#define AMDGPU_REG_SAMPLER_MAX_FIELDS		32
+
 /*--------------------------------------------------------------------------*/
 /* ----------------------------- Enums ------------------------------------ */
 /*--------------------------------------------------------------------------*/
@@ -143,6 +166,51 @@ typedef struct amdgpu_va *amdgpu_va_handle;
  */
 typedef struct amdgpu_semaphore *amdgpu_semaphore_handle;
 
+/**
+ * Define handle for a sub-allocator of small buffers
+ */
+typedef struct amdgpu_bo_suballocator *amdgpu_bo_suballocator_handle;
+
+/**
+ * Define handle for a sub-allocation
+ */
+typedef struct amdgpu_bo_suballoc *amdgpu_bo_suballoc_handle;
+
+/**
+ * Define handle for a command submission template
+ */
+typedef struct amdgpu_cs_template *amdgpu_cs_template_handle;
+
+/**
+ * Define handle for a pool of command buffers
+ */
+typedef struct amdgpu_cs_ib_pool *amdgpu_cs_ib_pool_handle;
+
+/**
+ * Define handle for a command submission scheduler
+ */
+typedef struct amdgpu_cs_scheduler *amdgpu_cs_scheduler_handle;
+
+/**
+ * Define handle for a telemetry sampler
+ */
+typedef struct amdgpu_telemetry *amdgpu_telemetry_handle;
+
+/**
+ * Define handle for a register sampler
+ */
+typedef struct amdgpu_reg_sampler *amdgpu_reg_sampler_handle;
+
+/**
+ * Define handle for a memory budget tracker
+ */
+typedef struct amdgpu_budget_tracker *amdgpu_budget_tracker_handle;
+
+/**
+ * Define handle for the SDMA copies and fills of a device
+ */
+typedef struct amdgpu_sdma *amdgpu_sdma_handle;
+
 /*--------------------------------------------------------------------------*/
 /* -------------------------- Structures ---------------------------------- */
 /*--------------------------------------------------------------------------*/
@@ -421,6 +489,158 @@ struct amdgpu_heap_info {
 	uint64_t max_allocation;
 };
 
+/**
+ * Structure describing a VA operation
+ *
+ * \sa amdgpu_bo_va_op_batch()
+ *
+ */
+struct amdgpu_va_op {
+	/** BO handle, may be NULL for PRT mappings and AMDGPU_VA_OP_CLEAR */
+	amdgpu_bo_handle bo;
+
+	/** Start offset in the BO */
+	uint64_t offset;
+
+	/** Size of the range, used as is */
+	uint64_t size;
+
+	/** Start virtual address */
+	uint64_t addr;
+
+	/** AMDGPU_VM_* flags */
+	uint64_t flags;
+
+	/** AMDGPU_VA_OP_* */
+	uint32_t op;
+};
+
+/**
+ * Structure describing a telemetry sample
+ *
+ * \sa amdgpu_telemetry_read()
+ *
+ */
+struct amdgpu_telemetry_sample {
+	/** CLOCK_MONOTONIC time of the sample, in nanoseconds */
+	uint64_t timestamp_ns;
+
+	/** Bit i is set if sensors[i] could be read */
+	uint32_t sensors_valid;
+
+	/**
+	 * Sensor values in the order they were passed to
+	 * amdgpu_telemetry_create(), see amdgpu_query_sensor_info()
+	 */
+	uint32_t sensors[AMDGPU_TELEMETRY_MAX_SENSORS];
+
+	/** Memory usage, in bytes */
+	uint64_t vram_usage;
+	uint64_t vis_vram_usage;
+	uint64_t gtt_usage;
+
+	/** Counters of buffer moves since the driver was loaded */
+	uint64_t bytes_moved;
+	uint64_t evictions;
+
+	/**
+	 * Rates since the previous sample, per second, 0 for the first one:
+	 * the VRAM and GTT usage changes, the bytes moved and the evictions.
+	 */
+	int64_t vram_usage_rate;
+	int64_t gtt_usage_rate;
+	uint64_t bytes_moved_rate;
+	uint64_t eviction_rate;
+};
+
+/**
+ * Structure describing consecutive memory-mapped registers to read
+ *
+ * \sa amdgpu_read_mm_register_ranges(), amdgpu_read_mm_registers()
+ *
+ */
+struct amdgpu_mm_register_range {
+	/** Register offset in dwords */
+	uint32_t dword_offset;
+	/** Number of registers */
+	uint32_t count;
+	/** GRBM_GFX_INDEX selector, 0xffffffff if unsure */
+	uint32_t instance;
+	uint32_t flags;
+};
+
+/**
+ * Structure describing a register field telling whether a block is busy
+ *
+ * \sa amdgpu_reg_sampler_create()
+ *
+ */
+struct amdgpu_reg_sampler_field {
+	/** Index of the register among those of all the ranges */
+	uint32_t reg;
+	/** Bits of the field */
+	uint32_t mask;
+	/** Value of the bits while the block is idle, usually 0 */
+	uint32_t idle_value;
+};
+
+/**
+ * Structure describing the counters of a register sampler
+ *
+ * The counters only grow, the utilization over a window is the difference
+ * of the busy counts of two queries over that of their sample counts.
+ *
+ * \sa amdgpu_reg_sampler_query()
+ *
+ */
+struct amdgpu_reg_sampler_stats {
+	/** Samples taken */
+	uint64_t samples;
+	/** Samples dropped because a register couldn't be read */
+	uint64_t failed;
+	/** Samples in which each field wasn't idle */
+	uint64_t busy[AMDGPU_REG_SAMPLER_MAX_FIELDS];
+};
+
+/**
+ * Structure describing the memory budget of the process in a heap
+ *
+ * \sa amdgpu_query_budget()
+ *
+ */
+struct amdgpu_heap_budget {
+	/** Size of the heap */
+	uint64_t heap_size;
+
+	/**
+	 * Bytes used in the heap: those of the other processes and of the
+	 * kernel as of the last refresh, plus the current process usage
+	 */
+	uint64_t heap_usage;
+
+	/** Bytes of the buffers of the process, kept up to date */
+	uint64_t process_usage;
+
+	/**
+	 * Bytes the process can use without evictions: the heap size minus
+	 * the usage of the others
+	 */
+	uint64_t budget;
+};
+
+/**
+ * Called by a budget tracker when the usage of a heap goes over its high
+ * watermark, over set, or back under the low one.
+ *
+ * \param   data   - \c [in] Pointer passed to amdgpu_budget_tracker_create()
+ * \param   heap   - \c [in] AMDGPU_GEM_DOMAIN_VRAM or AMDGPU_GEM_DOMAIN_GTT
+ * \param   budget - \c [in] Budget of the heap
+ * \param   over   - \c [in] Whether the usage is over the watermarks
+ */
+typedef void (*amdgpu_budget_callback)(void *data, uint32_t heap,
+				       const struct amdgpu_heap_budget *budget,
+				       bool over);
+
 /**
  * Describe GPU h/w info needed for UMD correct initialization
  *
@@ -569,6 +789,133 @@ int amdgpu_bo_alloc(amdgpu_device_handle dev,
 		    struct amdgpu_bo_alloc_request *alloc_buffer,
 		    amdgpu_bo_handle *buf_handle);
 
+/**
+ * Allocate memory and map it into the GPU virtual address space
+ *
+ * The VA range and the mapping belong to the buffer and are released by
+ * amdgpu_bo_free(), they must not be unmapped or freed by the caller.
+ * With the buffer cache enabled, both are kept while the buffer sits in the
+ * cache, so reusing it skips the VA allocation and the mapping.
+ *
+ * \param   dev	      - \c [in] Device handle.
+ *				 See #amdgpu_device_initialize()
+ * \param   alloc_buffer - \c [in] Pointer to the structure describing an
+ *				 allocation request
+ * \param   va_flags     - \c [in] AMDGPU_VA_RANGE_* flags for the VA range
+ * \param   vm_flags     - \c [in] AMDGPU_VM_PAGE_* and AMDGPU_VM_MTYPE_*
+ *				 flags for the mapping
+ * \param   buf_handle   - \c [out] Allocated buffer handle
+ * \param   va_address   - \c [out] GPU virtual address of the buffer
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_alloc(), amdgpu_bo_cache_enable()
+*/
+int amdgpu_bo_alloc_mapped(amdgpu_device_handle dev,
+			   struct amdgpu_bo_alloc_request *alloc_buffer,
+			   uint64_t va_flags, uint64_t vm_flags,
+			   amdgpu_bo_handle *buf_handle,
+			   uint64_t *va_address);
+
+/**
+ * Enable reuse of freed buffers
+ *
+ * Once enabled, buffers allocated by amdgpu_bo_alloc() or
+ * amdgpu_bo_alloc_mapped() that were never exported are kept in a cache
+ * when their last reference is dropped, instead of being closed. A later
+ * allocation with the same heap, flags and alignment and a size in the same
+ * bucket gets a cached buffer, as long as the GPU is done with it. Sizes are
+ * rounded up to the bucket size, up to 25% more, while the cache is on.
+ * Buffers requiring AMDGPU_GEM_CREATE_VRAM_CLEARED are never cached since
+ * recycled buffers keep their contents.
+ *
+ * \param   dev	    - \c [in] Device handle.
+ *			       See #amdgpu_device_initialize()
+ * \param   max_size   - \c [in] Maximum total size of the cached buffers,
+ *			       0 disables the cache and frees its buffers
+ * \param   max_age_ms - \c [in] Time after which an unused cached buffer is
+ *			       freed, 0 for the default of one second
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_bo_cache_enable(amdgpu_device_handle dev, uint64_t max_size,
+			   uint32_t max_age_ms);
+
+/**
+ * Create a sub-allocator for small buffers
+ *
+ * Small allocations are carved out of large parent buffers, one power of
+ * two size class from 64 bytes to 64 KiB per parent, so they share the GEM
+ * handle, the GPU mapping and the BO list entry of the parent.
+ *
+ * \param   dev	   - \c [in] Device handle.
+ *			      See #amdgpu_device_initialize()
+ * \param   heap      - \c [in] AMDGPU_GEM_DOMAIN_* of the parent buffers
+ * \param   flags     - \c [in] AMDGPU_GEM_CREATE_* flags of the parents
+ * \param   vm_flags  - \c [in] AMDGPU_VM_PAGE_* flags of their mapping
+ * \param   slab_size - \c [in] Size of the parent buffers, a power of two
+ *			      of at least 128 KiB, or 0 for 1 MiB
+ * \param   allocator - \c [out] Sub-allocator handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_suballoc_alloc(), amdgpu_bo_suballocator_destroy()
+*/
+int amdgpu_bo_suballocator_create(amdgpu_device_handle dev, uint32_t heap,
+				  uint64_t flags, uint64_t vm_flags,
+				  uint64_t slab_size,
+				  amdgpu_bo_suballocator_handle *allocator);
+
+/**
+ * Destroy a sub-allocator and free all of its parent buffers
+ *
+ * \param   allocator - \c [in] Sub-allocator handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note Sub-allocations still in use by the GPU must be waited for first.
+*/
+int amdgpu_bo_suballocator_destroy(amdgpu_bo_suballocator_handle allocator);
+
+/**
+ * Allocate a small buffer
+ *
+ * \param   allocator - \c [in] Sub-allocator handle
+ * \param   size      - \c [in] Size in bytes, at most 64 KiB
+ * \param   alignment - \c [in] Required alignment, at most 64 KiB
+ * \param   suballoc  - \c [out] Sub-allocation handle
+ * \param   bo        - \c [out] Parent buffer, don't free it
+ * \param   offset    - \c [out] Offset of the allocation in the parent
+ * \param   va        - \c [out] GPU virtual address of the allocation
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_bo_suballoc_alloc(amdgpu_bo_suballocator_handle allocator,
+			     uint64_t size, uint64_t alignment,
+			     amdgpu_bo_suballoc_handle *suballoc,
+			     amdgpu_bo_handle *bo, uint64_t *offset,
+			     uint64_t *va);
+
+/**
+ * Free a small buffer
+ *
+ * \param   suballoc - \c [in] Sub-allocation handle
+ * \param   fence    - \c [in] Last submission using the allocation, which
+ *			     is only reused once that fence signaled, or NULL
+ *			     if the GPU is done with it already. The context of
+ *			     the fence must stay alive until then.
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_bo_suballoc_free(amdgpu_bo_suballoc_handle suballoc,
+			    const struct amdgpu_cs_fence *fence);
+
 /**
  * Associate opaque data with buffer to be queried by another UMD
  *
@@ -599,6 +946,22 @@ int amdgpu_bo_set_metadata(amdgpu_bo_handle buf_handle,
 int amdgpu_bo_query_info(amdgpu_bo_handle buf_handle,
 			 struct amdgpu_bo_info *info);
 
+/**
+ * Whether amdgpu_bo_query_info() may answer from its cache for shared buffers
+ *
+ * The information of a buffer is kept by its first query until
+ * amdgpu_bo_set_metadata() is called on it. Buffers which were imported or
+ * exported are queried from the kernel every time by default, since another
+ * process may set their metadata.
+ *
+ * \param   dev   - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   trust - \c [in] true if only this process sets the metadata of the
+ *			  buffers it shares, or it is never changed
+ *
+ * \sa amdgpu_bo_query_info(), amdgpu_bo_import()
+*/
+void amdgpu_device_trust_shared_bo_info(amdgpu_device_handle dev, bool trust);
+
 /**
  * Allow others to get access to buffer
  *
@@ -673,11 +1036,31 @@ int amdgpu_bo_import(amdgpu_device_handle dev,
  *
  * It is responsibility of caller to correctly specify access rights
  * on VA assignment.
+ *
+ * Registering the exact range of a buffer still alive, or of one of the
+ * last freed ones, returns that buffer instead of registering the memory
+ * again. Call amdgpu_bo_userptr_invalidate() before the memory is freed.
 */
 int amdgpu_create_bo_from_user_mem(amdgpu_device_handle dev,
 				    void *cpu, uint64_t size,
 				    amdgpu_bo_handle *buf_handle);
 
+/**
+ * Forget the freed userptr buffers of a range of user memory
+ *
+ * The buffers amdgpu_create_bo_from_user_mem() keeps for reuse once freed
+ * which overlap the range are closed. Buffers still in use are left alone.
+ *
+ * \param dev  - [in] Device handle. See #amdgpu_device_initialize()
+ * \param cpu  - [in] Start of the user memory about to be freed
+ * \param size - [in] Size of the memory
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_bo_userptr_invalidate(amdgpu_device_handle dev, void *cpu,
+				 uint64_t size);
+
 /**
  * Validate if the user memory comes from BO
  *
@@ -721,6 +1104,72 @@ int amdgpu_find_bo_by_cpu_mapping(amdgpu_device_handle dev,
 */
 int amdgpu_bo_free(amdgpu_bo_handle buf_handle);
 
+/* Heaps of struct amdgpu_bo_label_stats, by the preferred heap of the
+ * allocation. Imported buffers are accounted to the other heap. */
+#define AMDGPU_BO_LABEL_HEAP_VRAM	0
+#define AMDGPU_BO_LABEL_HEAP_GTT	1
+#define AMDGPU_BO_LABEL_HEAP_CPU	2
+#define AMDGPU_BO_LABEL_HEAP_OTHER	3
+#define AMDGPU_BO_LABEL_HEAPS		4
+
+struct amdgpu_bo_label_stats {
+	char name[32];
+	/* Live buffers of the label per heap, the cached ones not counted */
+	uint64_t buffers[AMDGPU_BO_LABEL_HEAPS];
+	uint64_t bytes[AMDGPU_BO_LABEL_HEAPS];
+	uint64_t peak_bytes;
+	/* Allocations since the device was initialized, and the bytes
+	 * allocated per second lately */
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+	uint64_t alloc_rate;
+};
+
+/**
+ * Account a buffer to a debug label
+ *
+ * The label sticks until the buffer is freed or reused from the cache.
+ * Buffers never labeled are accounted to label 0, "unlabeled".
+ *
+ * \param   buf_handle - \c [in] Buffer handle
+ * \param   label      - \c [in] Label, up to 31 characters, NULL for none
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_query_bo_label_stats(), amdgpu_dump_bo_usage()
+*/
+int amdgpu_bo_set_label(amdgpu_bo_handle buf_handle, const char *label);
+
+/**
+ * Query the live buffers of a label
+ *
+ * Setting LIBDRM_BO_LABEL_STATS in the environment prints all the labels
+ * when the device is deinitialized.
+ *
+ * \param   dev   - \c [in] Device handle.
+ *			  See #amdgpu_device_initialize()
+ * \param   index - \c [in] Label index, 0 for the unlabeled buffers
+ * \param   stats - \c [out] Statistics of the label
+ *
+ * \return   0 on success\n
+ *          -ENOENT past the last label
+ *
+ * \sa amdgpu_bo_set_label()
+*/
+int amdgpu_query_bo_label_stats(amdgpu_device_handle dev, unsigned index,
+				struct amdgpu_bo_label_stats *stats);
+
+/**
+ * Print the live bytes of each label per heap, and the bytes of the idle
+ * buffers cached
+ *
+ * \param   dev  - \c [in] Device handle.
+ *			 See #amdgpu_device_initialize()
+ * \param   file - \c [in] Where to print
+*/
+void amdgpu_dump_bo_usage(amdgpu_device_handle dev, FILE *file);
+
 /**
  * Increase the reference count of a buffer object
  *
@@ -745,6 +1194,28 @@ void amdgpu_bo_inc_ref(amdgpu_bo_handle bo);
 */
 int amdgpu_bo_cpu_map(amdgpu_bo_handle buf_handle, void **cpu);
 
+/**
+ * Request CPU access to GPU accessible memory for the lifetime of the buffer
+ *
+ * Like amdgpu_bo_cpu_map(), but the mapping is kept when the number of
+ * amdgpu_bo_cpu_unmap() calls catches up with the number of map calls and
+ * only goes away when the buffer is freed. Further map and unmap calls on
+ * the buffer then don't need to take any lock.
+ *
+ * Calling it again on the same buffer doesn't add another reference, so it
+ * needs no matching amdgpu_bo_cpu_unmap() call.
+ *
+ * \param   buf_handle - \c [in] Buffer handle
+ * \param   cpu        - \c [out] CPU address to be used for access
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_cpu_map(), amdgpu_bo_free()
+ *
+*/
+int amdgpu_bo_cpu_map_persistent(amdgpu_bo_handle buf_handle, void **cpu);
+
 /**
  * Release CPU access to GPU memory
  *
@@ -827,6 +1298,47 @@ int amdgpu_bo_list_create(amdgpu_device_handle dev,
 			  uint8_t *resource_prios,
 			  amdgpu_bo_list_handle *result);
 
+/**
+ * Returns a BO list handle for a set of buffers, reusing the list of an
+ * earlier call with the same buffers and priorities in any order.
+ *
+ * The device keeps the few most recently used lists, so a list may keep
+ * freed buffers alive in the kernel until it gets evicted. The returned list can't be passed to amdgpu_bo_list_update().
+ *
+ * \param   dev			- \c [in] Device handle.
+ *				   See #amdgpu_device_initialize()
+ * \param   number_of_resources	- \c [in] Number of BOs in the list
+ * \param   resources		- \c [in] List of BO handles
+ * \param   resource_prios	- \c [in] Optional priority for each handle
+ * \param   result		- \c [out] BO list handle, to be released with
+ *				   amdgpu_bo_list_destroy()
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_list_create(), amdgpu_bo_list_cache_query()
+*/
+int amdgpu_bo_list_create_cached(amdgpu_device_handle dev,
+				 uint32_t number_of_resources,
+				 amdgpu_bo_handle *resources,
+				 uint8_t *resource_prios,
+				 amdgpu_bo_list_handle *result);
+
+/**
+ * Query how often amdgpu_bo_list_create_cached() found an existing list.
+ *
+ * \param   dev	- \c [in] Device handle.
+ * \param   hits	- \c [out] Calls that returned an existing list
+ * \param   misses	- \c [out] Calls that created a new list
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_list_create_cached()
+*/
+int amdgpu_bo_list_cache_query(amdgpu_device_handle dev,
+			       uint64_t *hits, uint64_t *misses);
+
 /**
  * Destroys a BO list handle.
  *
@@ -842,6 +1354,9 @@ int amdgpu_bo_list_destroy(amdgpu_bo_list_handle handle);
 /**
  * Update resources for existing BO list
  *
+ * Nothing is sent to the kernel if the list already has the same buffers
+ * and priorities.
+ *
  * \param   handle              - \c [in] BO list handle
  * \param   number_of_resources - \c [in] Number of BOs in the list
  * \param   resources           - \c [in] List of BO handles
@@ -912,41 +1427,120 @@ int amdgpu_cs_ctx_create(amdgpu_device_handle dev,
 int amdgpu_cs_ctx_free(amdgpu_context_handle context);
 
 /**
- * Override the submission priority for the given context using a master fd.
- *
- * \param   dev        - \c [in] device handle
- * \param   context    - \c [in] context handle for context id
- * \param   master_fd  - \c [in] The master fd to authorize the override.
- * \param   priority   - \c [in] The priority to assign to the context.
+ * Get an execution context from the pool of the device
  *
- * \return 0 on success or a a negative Posix error code on failure.
- */
-int amdgpu_cs_ctx_override_priority(amdgpu_device_handle dev,
-                                    amdgpu_context_handle context,
-                                    int master_fd,
-                                    unsigned priority);
-
-/**
- * Query reset state for the specific GPU Context
+ * Returns an idle context of the priority put back by
+ * amdgpu_cs_ctx_pool_put(), or creates one like amdgpu_cs_ctx_create2().
+ * Idle contexts which saw a GPU reset are freed instead of handed out.
  *
- * \param   context - \c [in]  GPU Context handle
- * \param   state   - \c [out] One of AMDGPU_CTX_*_RESET
- * \param   hangs   - \c [out] Number of hangs caused by the context.
+ * \param   dev      - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   priority - \c [in] Context creation flags. See AMDGPU_CTX_PRIORITY_*
+ * \param   context  - \c [out] GPU Context handle
  *
  * \return   0 on success\n
  *          <0 - Negative POSIX Error code
  *
- * \sa amdgpu_cs_ctx_create()
+ * \note A context from the pool may have submitted work already, so
+ *	 amdgpu_cs_ctx_enable_timelines() can fail on it.
  *
+ * \sa amdgpu_cs_ctx_pool_put()
 */
-int amdgpu_cs_query_reset_state(amdgpu_context_handle context,
-				uint32_t *state, uint32_t *hangs);
+int amdgpu_cs_ctx_pool_get(amdgpu_device_handle dev, uint32_t priority,
+			   amdgpu_context_handle *context);
 
 /**
- * Query reset state for the specific GPU Context.
+ * Put an execution context back into the pool of its device
  *
- * \param   context - \c [in]  GPU Context handle
- * \param   flags   - \c [out] A combination of AMDGPU_CTX_QUERY2_FLAGS_*
+ * The semaphores the context still waits on are dropped and the user
+ * fence spin time is reset. Contexts with timelines enabled, and those
+ * past the size of the pool, are freed.
+ *
+ * \param   context - \c [in] GPU Context handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_ctx_pool_get(), amdgpu_cs_ctx_free()
+*/
+int amdgpu_cs_ctx_pool_put(amdgpu_context_handle context);
+
+/**
+ * Back the sequence numbers of a context with timeline syncobjs
+ *
+ * Every submission then signals the next point on a timeline syncobj of
+ * its ring and returns that point as its sequence number. Fences of the
+ * context passed as dependencies become timeline waits, and the syncobj of
+ * a ring can be exported once to share all of its fences with other
+ * processes.
+ *
+ * User fences are not polled and semaphores can't be used with such a
+ * context. Fences of timeline and other contexts can't be mixed in
+ * amdgpu_cs_wait_fences().
+ *
+ * \param   context - \c [in] GPU Context handle, without any submission yet
+ *
+ * \return   0 on success\n
+ *          -EBUSY - The context was already used\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_ctx_get_timeline()
+*/
+int amdgpu_cs_ctx_enable_timelines(amdgpu_context_handle context);
+
+/**
+ * Get the timeline syncobj of a ring
+ *
+ * \param   context     - \c [in] GPU Context handle using timelines
+ * \param   ip_type     - \c [in] Hardware IP block type = AMDGPU_HW_IP_*
+ * \param   ip_instance - \c [in] Index of the IP block of the same type
+ * \param   ring        - \c [in] Specify ring index of the IP
+ * \param   syncobj     - \c [out] Syncobj handle, owned by the context
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_ctx_enable_timelines(), amdgpu_cs_export_syncobj()
+*/
+int amdgpu_cs_ctx_get_timeline(amdgpu_context_handle context,
+			       uint32_t ip_type, uint32_t ip_instance,
+			       uint32_t ring, uint32_t *syncobj);
+
+/**
+ * Override the submission priority for the given context using a master fd.
+ *
+ * \param   dev        - \c [in] device handle
+ * \param   context    - \c [in] context handle for context id
+ * \param   master_fd  - \c [in] The master fd to authorize the override.
+ * \param   priority   - \c [in] The priority to assign to the context.
+ *
+ * \return 0 on success or a a negative Posix error code on failure.
+ */
+int amdgpu_cs_ctx_override_priority(amdgpu_device_handle dev,
+                                    amdgpu_context_handle context,
+                                    int master_fd,
+                                    unsigned priority);
+
+/**
+ * Query reset state for the specific GPU Context
+ *
+ * \param   context - \c [in]  GPU Context handle
+ * \param   state   - \c [out] One of AMDGPU_CTX_*_RESET
+ * \param   hangs   - \c [out] Number of hangs caused by the context.
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_ctx_create()
+ *
+*/
+int amdgpu_cs_query_reset_state(amdgpu_context_handle context,
+				uint32_t *state, uint32_t *hangs);
+
+/**
+ * Query reset state for the specific GPU Context.
+ *
+ * \param   context - \c [in]  GPU Context handle
+ * \param   flags   - \c [out] A combination of AMDGPU_CTX_QUERY2_FLAGS_*
  *
  * \return   0 on success\n
  *          <0 - Negative POSIX Error code
@@ -979,7 +1573,8 @@ int amdgpu_cs_query_reset_state2(amdgpu_context_handle context,
  * \param   dev		       - \c [in]  Device handle.
  *					  See #amdgpu_device_initialize()
  * \param   context            - \c [in]  GPU Context
- * \param   flags              - \c [in]  Global submission flags
+ * \param   flags              - \c [in]  Global submission flags,
+ *					  see #AMDGPU_CS_SUBMIT_COALESCE
  * \param   ibs_request        - \c [in/out] Pointer to submission requests.
  *					  We could submit to the several
  *					  engines/rings simulteniously as
@@ -1003,6 +1598,276 @@ int amdgpu_cs_submit(amdgpu_context_handle context,
 		     struct amdgpu_cs_request *ibs_request,
 		     uint32_t number_of_requests);
 
+/**
+ * Create a template for submissions repeating the same layout.
+ *
+ * The chunks passed to the kernel are built once from \c request: the
+ * ring, resource list, IB count and flags, and the user fence. Submitting
+ * through the template then only patches the IB addresses and sizes and
+ * the dependencies, without allocating anything.
+ *
+ * \param   context  - \c [in]  GPU Context
+ * \param   request  - \c [in]  Layout of the submissions. Its
+ *				     number_of_dependencies is the most a
+ *				     submission may pass.
+ * \param   cs_template - \c [out] Template handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note The resource list and the fence buffer must outlive the template.
+ *	 A template must not be used by several threads at the same time.
+ *
+ * \sa amdgpu_cs_template_submit(), amdgpu_cs_template_destroy()
+*/
+int amdgpu_cs_template_create(amdgpu_context_handle context,
+			      const struct amdgpu_cs_request *request,
+			      amdgpu_cs_template_handle *cs_template);
+
+/**
+ * Destroy a submission template.
+ *
+ * \param   cs_template - \c [in] Template handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_template_create()
+*/
+int amdgpu_cs_template_destroy(amdgpu_cs_template_handle cs_template);
+
+/**
+ * Submit command buffers laid out as described by a template.
+ *
+ * Semaphores waited on for the ring are consumed like amdgpu_cs_submit()
+ * does.
+ *
+ * \param   cs_template - \c [in]  Template handle
+ * \param   ibs        - \c [in]  The template's number_of_ibs IBs, whose
+ *				       address, size and flags replace the
+ *				       ones of the previous submission, or
+ *				       NULL to submit them again
+ * \param   number_of_dependencies - \c [in] Number of dependencies
+ * \param   dependencies - \c [in] Fences to wait for before execution
+ * \param   seq_no     - \c [out] Sequence number of the submission
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_template_create(), amdgpu_cs_submit()
+*/
+int amdgpu_cs_template_submit(amdgpu_cs_template_handle cs_template,
+			      const struct amdgpu_cs_ib_info *ibs,
+			      uint32_t number_of_dependencies,
+			      const struct amdgpu_cs_fence *dependencies,
+			      uint64_t *seq_no);
+
+/**
+ * Create a pool of command buffers.
+ *
+ * The IBs are carved out of a ring of CPU mapped GTT chunks mapped in the
+ * GPU VM, a chunk being reused once the last submission reading it
+ * signaled its fence. The submissions using IBs of one pool must go to the
+ * same ring, so that they complete in order.
+ *
+ * \param   dev	       - \c [in] Device handle.
+ *			      See #amdgpu_device_initialize()
+ * \param   chunk_size - \c [in] Size of the chunks, 0 for 64 KiB
+ * \param   pool       - \c [out] Pool handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_ib_pool_alloc(), amdgpu_cs_ib_pool_destroy()
+*/
+int amdgpu_cs_ib_pool_create(amdgpu_device_handle dev, uint64_t chunk_size,
+			     amdgpu_cs_ib_pool_handle *pool);
+
+/**
+ * Destroy a pool of command buffers and free its chunks.
+ *
+ * \param   pool - \c [in] Pool handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note The submissions using IBs of the pool must be waited for first.
+*/
+int amdgpu_cs_ib_pool_destroy(amdgpu_cs_ib_pool_handle pool);
+
+/**
+ * Take space for the next IB of a pool.
+ *
+ * \param   pool    - \c [in]  Pool handle
+ * \param   size_dw - \c [in]  Size of the IB in dwords
+ * \param   ib_info - \c [out] Address and size of the IB, with no flags
+ * \param   cpu     - \c [out] CPU mapping of the IB to write it
+ * \param   bo      - \c [out] Buffer of the IB to add to the resource list
+ *			       of the submission, or NULL. Don't free it.
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_ib_pool_submitted()
+*/
+int amdgpu_cs_ib_pool_alloc(amdgpu_cs_ib_pool_handle pool, uint32_t size_dw,
+			    struct amdgpu_cs_ib_info *ib_info, void **cpu,
+			    amdgpu_bo_handle *bo);
+
+/**
+ * Tell the pool the IBs taken since the last call were submitted.
+ *
+ * Their space is reused once the fence signaled, checked through the user
+ * fence of the submission when there is one.
+ *
+ * \param   pool  - \c [in] Pool handle
+ * \param   fence - \c [in] Fence of the submission. Its context must stay
+ *			     alive as long as the pool.
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_cs_ib_pool_submitted(amdgpu_cs_ib_pool_handle pool,
+				const struct amdgpu_cs_fence *fence);
+
+/**
+ * Create the state of the buffer copies and fills done by the SDMA engine.
+ *
+ * The packets of each copy or fill are written to an IB of an internal pool
+ * and submitted on the first SDMA ring of an internal context, so that the
+ * copies and fills of one handle complete in order.
+ *
+ * \param   dev  - \c [in]  Device handle.
+ *			  See #amdgpu_device_initialize()
+ * \param   sdma - \c [out] SDMA handle
+ *
+ * \return   0 on success\n
+ *          -ENODEV if the device has no SDMA ring\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_copy_async(), amdgpu_bo_fill_async(), amdgpu_sdma_destroy()
+*/
+int amdgpu_sdma_create(amdgpu_device_handle dev, amdgpu_sdma_handle *sdma);
+
+/**
+ * Destroy the state created by amdgpu_sdma_create().
+ *
+ * \param   sdma - \c [in] SDMA handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note The fences of the copies and fills must be waited for first.
+*/
+int amdgpu_sdma_destroy(amdgpu_sdma_handle sdma);
+
+/**
+ * Copy bytes between buffers with the SDMA engine, without mapping them for
+ * the CPU.
+ *
+ * \param   sdma	   - \c [in]  SDMA handle
+ * \param   dst	   - \c [in]  Destination buffer
+ * \param   dst_address - \c [in]  GPU virtual address to copy to, in dst
+ * \param   src	   - \c [in]  Source buffer, may be dst
+ * \param   src_address - \c [in]  GPU virtual address to copy from, in src
+ * \param   size	   - \c [in]  Bytes to copy
+ * \param   fence	   - \c [out] Fence of the copy
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note Nothing orders the copy with the other submissions using the
+ * buffers, wait for their fences first.
+*/
+int amdgpu_bo_copy_async(amdgpu_sdma_handle sdma,
+			 amdgpu_bo_handle dst, uint64_t dst_address,
+			 amdgpu_bo_handle src, uint64_t src_address,
+			 uint64_t size, struct amdgpu_cs_fence *fence);
+
+/**
+ * Fill a buffer range with a 32 bit value with the SDMA engine, without
+ * mapping it for the CPU.
+ *
+ * \param   sdma	   - \c [in]  SDMA handle
+ * \param   dst	   - \c [in]  Buffer to fill
+ * \param   dst_address - \c [in]  GPU virtual address of the range in dst,
+ *				    aligned to 4 bytes
+ * \param   size	   - \c [in]  Bytes to fill, a multiple of 4
+ * \param   value	   - \c [in]  Value of each dword
+ * \param   fence	   - \c [out] Fence of the fill
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_copy_async()
+*/
+int amdgpu_bo_fill_async(amdgpu_sdma_handle sdma,
+			 amdgpu_bo_handle dst, uint64_t dst_address,
+			 uint64_t size, uint32_t value,
+			 struct amdgpu_cs_fence *fence);
+
+/**
+ * Create a submission scheduler running its own submit thread.
+ *
+ * Submissions through the scheduler are queued by the priority their
+ * context was created with and handed to the kernel by the submit thread,
+ * highest priority first. A submission waiting for more than 50 ms goes
+ * before the higher priority ones so that none is starved.
+ *
+ * Submissions of the same context and flags arriving within \c window_us of
+ * each other are passed to the kernel together, combined into fewer
+ * submissions with #AMDGPU_CS_SUBMIT_COALESCE. Once \c max_in_flight
+ * submissions are executing, the submit thread waits for the oldest one
+ * before submitting more.
+ *
+ * \param   dev           - \c [in] Device handle.
+ *                                  See #amdgpu_device_initialize()
+ * \param   max_in_flight - \c [in] Most submissions executing at once
+ * \param   window_us     - \c [in] How long a submission may be held back
+ *                                  for others to join it, 0 for no delay
+ * \param   scheduler     - \c [out] Scheduler handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_scheduler_submit(), amdgpu_cs_scheduler_destroy()
+*/
+int amdgpu_cs_scheduler_create(amdgpu_device_handle dev,
+			       uint32_t max_in_flight, uint32_t window_us,
+			       amdgpu_cs_scheduler_handle *scheduler);
+
+/**
+ * Submit the queued submissions and destroy the scheduler.
+ *
+ * \param   scheduler - \c [in] Scheduler handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_cs_scheduler_destroy(amdgpu_cs_scheduler_handle scheduler);
+
+/**
+ * Submit command buffers through a scheduler.
+ *
+ * Works like amdgpu_cs_submit() and returns once the submit thread passed
+ * the requests to the kernel, with their sequence numbers set.
+ *
+ * \param   scheduler          - \c [in] Scheduler handle
+ * \param   context            - \c [in] GPU Context of the scheduler device
+ * \param   flags              - \c [in] See amdgpu_cs_submit()
+ * \param   ibs_request        - \c [in/out] Pointer to submission requests
+ * \param   number_of_requests - \c [in] Number of submission requests
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_submit()
+*/
+int amdgpu_cs_scheduler_submit(amdgpu_cs_scheduler_handle scheduler,
+			       amdgpu_context_handle context, uint64_t flags,
+			       struct amdgpu_cs_request *ibs_request,
+			       uint32_t number_of_requests);
+
 /**
  *  Query status of Command Buffer Submission
  *
@@ -1021,13 +1886,38 @@ int amdgpu_cs_submit(amdgpu_context_handle context,
  *	 returned in the case if submission was completed or timeout error
  *	 code.
  *
- * \sa amdgpu_cs_submit()
+ * \note When the submissions to the ring since the fence all wrote the same
+ *	 user fence, see amdgpu_cs_fence_info, that memory is read instead of
+ *	 asking the kernel, first for at most the time set with
+ *	 amdgpu_cs_ctx_set_fence_spin(). A zero timeout then never waits in
+ *	 the kernel. A submission lost in a GPU reset doesn't write the user
+ *	 fence, use amdgpu_cs_query_reset_state2() to detect that.
+ *
+ * \sa amdgpu_cs_submit(), amdgpu_cs_ctx_set_fence_spin()
 */
 int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 				 uint64_t timeout_ns,
 				 uint64_t flags,
 				 uint32_t *expired);
 
+/**
+ * Set how long fence waits poll user fences before waiting in the kernel
+ *
+ * Busy waiting on the user fence memory avoids the wakeup latency of the
+ * kernel wait for submissions that are about to complete, at the cost of a
+ * CPU core. It is off by default.
+ *
+ * \param   context - \c [in] GPU Context handle
+ * \param   spin_ns - \c [in] Maximum polling time in nanoseconds, 0 for none
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_cs_query_fence_status(), amdgpu_cs_wait_fences()
+*/
+int amdgpu_cs_ctx_set_fence_spin(amdgpu_context_handle context,
+				 uint64_t spin_ns);
+
 /**
  *  Wait for multiple fences
  *
@@ -1044,6 +1934,9 @@ int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
  *
  * \note    Currently it supports only one amdgpu_device. All fences come from
  *          the same amdgpu_device with the same fd.
+ *
+ * \note    User fences are polled like in amdgpu_cs_query_fence_status(),
+ *          for the time set on the context of the first fence.
 */
 int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
 			  uint32_t fence_count,
@@ -1237,6 +2130,145 @@ int amdgpu_query_gds_info(amdgpu_device_handle dev,
 int amdgpu_query_sensor_info(amdgpu_device_handle dev, unsigned sensor_type,
 			     unsigned size, void *value);
 
+/**
+ * Start sampling sensors and memory usage on a background thread
+ *
+ * Every period, the sensors and the memory usage counters are read into a
+ * ring buffer keeping the last samples, which amdgpu_telemetry_read()
+ * returns without any system call or lock.
+ *
+ * \param   dev         - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   sensors     - \c [in] AMDGPU_INFO_SENSOR_* types to sample
+ * \param   num_sensors - \c [in] Number of sensors, at most
+ *                                AMDGPU_TELEMETRY_MAX_SENSORS
+ * \param   period_us   - \c [in] Sampling period in microseconds
+ * \param   history     - \c [in] Number of samples to keep
+ * \param   telemetry   - \c [out] Telemetry sampler handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_telemetry_read(), amdgpu_telemetry_destroy()
+*/
+int amdgpu_telemetry_create(amdgpu_device_handle dev,
+			    const uint32_t *sensors, uint32_t num_sensors,
+			    uint32_t period_us, uint32_t history,
+			    amdgpu_telemetry_handle *telemetry);
+
+/**
+ * Stop sampling and free the sampler
+ *
+ * \param   telemetry - \c [in] Telemetry sampler handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_telemetry_destroy(amdgpu_telemetry_handle telemetry);
+
+/**
+ * Read a sample
+ *
+ * \param   telemetry - \c [in] Telemetry sampler handle
+ * \param   age       - \c [in] 0 for the latest sample, 1 for the one
+ *                              before and so on
+ * \param   sample    - \c [out] Sample
+ *
+ * \return   0 on success\n
+ *          -ENODATA - No such sample, not taken yet or already dropped\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_telemetry_read(amdgpu_telemetry_handle telemetry, uint32_t age,
+			  struct amdgpu_telemetry_sample *sample);
+
+/**
+ * Start tracking the VRAM and GTT budgets of the process
+ *
+ * The heap usage is refreshed on a background thread every period, while
+ * the usage of the process is counted as its buffers are created and
+ * closed, so amdgpu_query_budget() needs no system call or lock.
+ *
+ * \param   dev          - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   period_us    - \c [in] Refresh period in microseconds
+ * \param   high_percent - \c [in] Watermark of the process usage, in percent
+ *                                 of the budget, going over which calls
+ *                                 callback
+ * \param   low_percent  - \c [in] Watermark to go back under before callback
+ *                                 is called again, at most high_percent
+ * \param   callback     - \c [in] Function called from the refresh thread on
+ *                                 crossing the watermarks, or NULL
+ * \param   data         - \c [in] Passed to callback
+ * \param   tracker      - \c [out] Budget tracker handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note The first refresh and its callbacks happen before this returns.
+ *
+ * \sa amdgpu_query_budget(), amdgpu_budget_tracker_destroy()
+*/
+int amdgpu_budget_tracker_create(amdgpu_device_handle dev, uint32_t period_us,
+				 uint32_t high_percent, uint32_t low_percent,
+				 amdgpu_budget_callback callback, void *data,
+				 amdgpu_budget_tracker_handle *tracker);
+
+/**
+ * Stop tracking and free the tracker
+ *
+ * \param   tracker - \c [in] Budget tracker handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_budget_tracker_destroy(amdgpu_budget_tracker_handle tracker);
+
+/**
+ * Query the budget of the process in a heap
+ *
+ * \param   tracker - \c [in] Budget tracker handle
+ * \param   heap    - \c [in] AMDGPU_GEM_DOMAIN_VRAM or AMDGPU_GEM_DOMAIN_GTT
+ * \param   budget  - \c [out] Budget of the heap
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_query_heap_info()
+*/
+int amdgpu_query_budget(amdgpu_budget_tracker_handle tracker, uint32_t heap,
+			struct amdgpu_heap_budget *budget);
+
+/**
+ * Enable or disable tracing of submissions, fence waits and allocations
+ *
+ * While enabled, amdgpu_cs_submit(), amdgpu_cs_submit_raw2(),
+ * amdgpu_cs_wait_fences() and amdgpu_bo_alloc() record their duration and
+ * arguments in a buffer of the calling thread. Each thread keeps up to 4096
+ * events, later ones are dropped until amdgpu_trace_drain() is called.
+ *
+ * \param   dev    - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   enable - \c [in] true to start tracing, false to stop it
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_trace_drain()
+*/
+int amdgpu_trace_enable(amdgpu_device_handle dev, bool enable);
+
+/**
+ * Take the recorded events out of the trace buffers
+ *
+ * The events are returned in the Chrome trace event JSON format, which
+ * chrome://tracing and Perfetto load. The number of dropped events is
+ * reported as "dropped_events" in "otherData".
+ *
+ * \param   dev  - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   json - \c [out] NUL terminated JSON, to free() by the caller
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_trace_drain(amdgpu_device_handle dev, char **json);
+
 /**
  * Query information about video capabilities
  *
@@ -1275,12 +2307,92 @@ int amdgpu_read_mm_registers(amdgpu_device_handle dev, unsigned dword_offset,
 			     unsigned count, uint32_t instance, uint32_t flags,
 			     uint32_t *values);
 
+/**
+ * Read several sets of consecutive memory-mapped registers.
+ *
+ * The kernel reads one range per request, so this saves the caller the
+ * loop rather than system calls.
+ *
+ * \param   dev        - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   ranges     - \c [in] Registers to read
+ * \param   num_ranges - \c [in] Number of ranges
+ * \param   values     - \c [out] The values of the registers of all the
+ *                               ranges, one range after the other
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX error code
+ *
+ * \sa amdgpu_read_mm_registers()
+*/
+int amdgpu_read_mm_register_ranges(amdgpu_device_handle dev,
+			const struct amdgpu_mm_register_range *ranges,
+			unsigned num_ranges, uint32_t *values);
+
+/**
+ * Start sampling registers on a background thread
+ *
+ * Every period, the registers of the ranges are read as by
+ * amdgpu_read_mm_register_ranges() and each field which isn't idle has its
+ * busy count increased, giving the utilization of the block it belongs to.
+ * Status registers such as GRBM_STATUS, SRBM_STATUS and GRBM_STATUS_SE*
+ * must be allowed to be read by the kernel, at their offsets for the ASIC.
+ *
+ * \param   dev        - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   ranges     - \c [in] Registers to read
+ * \param   num_ranges - \c [in] Number of ranges
+ * \param   fields     - \c [in] Fields to count
+ * \param   num_fields - \c [in] Number of fields, at most
+ *                               AMDGPU_REG_SAMPLER_MAX_FIELDS
+ * \param   period_us  - \c [in] Sampling period in microseconds
+ * \param   sampler    - \c [out] Register sampler handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_reg_sampler_query(), amdgpu_reg_sampler_destroy()
+*/
+int amdgpu_reg_sampler_create(amdgpu_device_handle dev,
+			      const struct amdgpu_mm_register_range *ranges,
+			      unsigned num_ranges,
+			      const struct amdgpu_reg_sampler_field *fields,
+			      unsigned num_fields, uint32_t period_us,
+			      amdgpu_reg_sampler_handle *sampler);
+
+/**
+ * Stop sampling and free the sampler
+ *
+ * \param   sampler - \c [in] Register sampler handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_reg_sampler_destroy(amdgpu_reg_sampler_handle sampler);
+
+/**
+ * Read the counters of a register sampler, without any system call or lock
+ *
+ * \param   sampler - \c [in] Register sampler handle
+ * \param   stats   - \c [out] Counters
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+*/
+int amdgpu_reg_sampler_query(amdgpu_reg_sampler_handle sampler,
+			     struct amdgpu_reg_sampler_stats *stats);
+
 /**
  * Flag to request VA address range in the 32bit address space
 */
 #define AMDGPU_VA_RANGE_32_BIT		0x1
 #define AMDGPU_VA_RANGE_HIGH		0x2
 #define AMDGPU_VA_RANGE_REPLAYABLE	0x4
+/**
+ * Round the range size and alignment up to the PTE fragment size of the
+ * device, or to 2 MiB for ranges at least that large, so that it can be
+ * mapped with large pages. amdgpu_bo_alloc_mapped() also rounds the buffer
+ * size and, for VRAM, its physical alignment.
+*/
+#define AMDGPU_VA_RANGE_FRAGMENT	0x8
 
 /**
  * Allocate virtual address range
@@ -1411,6 +2523,28 @@ int amdgpu_bo_va_op_raw(amdgpu_device_handle dev,
 			uint64_t flags,
 			uint32_t ops);
 
+/**
+ *  Apply a sequence of VA operations
+ *
+ * Same as calling amdgpu_bo_va_op_raw() for each operation in order, with
+ * everything validated up front. Adjacent AMDGPU_VA_OP_CLEAR ranges are
+ * merged, and the part of a cleared range that the following
+ * AMDGPU_VA_OP_REPLACE operations map anyway isn't cleared first.
+ *
+ * \param  dev		- \c [in] device handle
+ * \param  ops		- \c [in] Operations to apply
+ * \param  count	- \c [in] Number of operations
+ * \param  completed	- \c [out] Number of operations applied, may be NULL
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code of the first failed operation
+ *
+ * \sa amdgpu_bo_va_op_raw()
+*/
+int amdgpu_bo_va_op_batch(amdgpu_device_handle dev,
+			  const struct amdgpu_va_op *ops, uint32_t count,
+			  uint32_t *completed);
+
 /**
  *  create semaphore
  *
@@ -1720,6 +2854,31 @@ int amdgpu_cs_syncobj_export_sync_file2(amdgpu_device_handle dev,
 					uint32_t flags,
 					int *sync_file_fd);
 
+/**
+ *  Export points of kernel sync objects to sync_files.
+ *
+ * Like amdgpu_cs_syncobj_export_sync_file2() for each handle, with the
+ * points moved through one binary sync object.
+ *
+ * \param   dev		- \c [in] device handle
+ * \param   syncobjs	- \c [in] sync object handles
+ * \param   points	- \c [in] timeline points, 0 for binary sync objects.
+ *			  May be NULL if all are binary.
+ * \param   num_handles	- \c [in] number of handles
+ * \param   flags	- \c [in] flags
+ * \param   sync_file_fds - \c [out] sync_file file descriptors
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, with no sync_file left open
+ *
+ */
+int amdgpu_cs_syncobj_export_sync_files(amdgpu_device_handle dev,
+					const uint32_t *syncobjs,
+					const uint64_t *points,
+					unsigned num_handles,
+					uint32_t flags,
+					int *sync_file_fds);
+
 /**
  *  Import kernel timeline sync object from a sync_file.
  *
@@ -1737,6 +2896,31 @@ int amdgpu_cs_syncobj_import_sync_file2(amdgpu_device_handle dev,
 					uint64_t point,
 					int sync_file_fd);
 
+/**
+ *  Get a pollable file descriptor for a set of sync objects.
+ *
+ * The returned sync_file becomes readable once the fences of all the
+ * given sync objects (or timeline points) have signaled, so it can be
+ * added to an event loop instead of blocking in amdgpu_cs_syncobj_wait().
+ *
+ * \param   dev		- \c [in] device handle
+ * \param   handles	- \c [in] array of sync object handles
+ * \param   points	- \c [in] array of timeline points, or NULL if all
+ *                        sync objects are binary (0 selects binary too)
+ * \param   num_handles	- \c [in] number of handles
+ * \param   wait_fd	- \c [out] sync_file file descriptor
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note The fences must already be submitted.
+ */
+int amdgpu_cs_syncobj_wait_fd(amdgpu_device_handle dev,
+			      const uint32_t *handles,
+			      const uint64_t *points,
+			      unsigned num_handles,
+			      int *wait_fd);
+
 /**
  *  transfer between syncbojs.
  *
@@ -34,6 +34,65 @@
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
 
+#ifdef AMDGPU_ASIC_ID_BUILTIN
+struct amdgpu_asic_id {
+	/* device id << 8 | revision id */
+	uint32_t id;
+	/* offset in amdgpu_asic_id_names */
+	uint32_t name;
+};
+
+#include "generated_amdgpu_ids.h"
+
+/* Look the device up in the table generated from amdgpu.ids at build
+ * time, returns -EAGAIN if it's not there. */
+static int amdgpu_find_builtin_asic_id(struct amdgpu_device *dev)
+{
+	uint32_t id = dev->info.asic_id << 8 | (dev->info.pci_rev_id & 0xff);
+	unsigned lo = 0;
+	unsigned hi = sizeof(amdgpu_asic_id_table) / sizeof(amdgpu_asic_id_table[0]);
+
+	if (dev->info.asic_id > 0xffff || dev->info.pci_rev_id > 0xff)
+		return -EAGAIN;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (amdgpu_asic_id_table[mid].id < id) {
+			lo = mid + 1;
+		} else if (amdgpu_asic_id_table[mid].id > id) {
+			hi = mid;
+		} else {
+			dev->marketing_name =
+				strdup(&amdgpu_asic_id_names[amdgpu_asic_id_table[mid].name]);
+			return dev->marketing_name ? 0 : -ENOMEM;
+		}
+	}
+
+	return -EAGAIN;
+}
+
+/* Whether the dotted version a of a file is newer than b. */
+static bool amdgpu_asic_id_version_newer(const char *a, const char *b)
+{
+	while (*a || *b) {
+		char *end_a, *end_b;
+		unsigned long va = strtoul(a, &end_a, 10);
+		unsigned long vb = strtoul(b, &end_b, 10);
+
+		if (va != vb)
+			return va > vb;
+		if (end_a == a && end_b == b)
+			break;
+
+		a = *end_a == '.' ? end_a + 1 : end_a;
+		b = *end_b == '.' ? end_b + 1 : end_b;
+	}
+
+	return false;
+}
+#endif
+
 static int parse_one_line(struct amdgpu_device *dev, const char *line)
 {
 	char *buf, *saveptr;
@@ -115,6 +174,12 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 
 	fp = fopen(AMDGPU_ASIC_ID_TABLE, "r");
 	if (!fp) {
+#ifdef AMDGPU_ASIC_ID_BUILTIN
+		if (errno == ENOENT) {
+			amdgpu_find_builtin_asic_id(dev);
+			return;
+		}
+#endif
 		fprintf(stderr, "%s: %s\n", AMDGPU_ASIC_ID_TABLE,
 			strerror(errno));
 		return;
@@ -133,6 +198,14 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 		}
 
 		drmMsg("%s version: %s\n", AMDGPU_ASIC_ID_TABLE, line);
+#ifdef AMDGPU_ASIC_ID_BUILTIN
+		/* The installed file wins only when it was updated after the
+		 * library was built. */
+		if (!amdgpu_asic_id_version_newer(line, amdgpu_asic_id_version)) {
+			amdgpu_find_builtin_asic_id(dev);
+			goto out;
+		}
+#endif
 		break;
 	}
 
@@ -156,6 +229,9 @@ void amdgpu_parse_asic_ids(struct amdgpu_device *dev)
 			__func__, strerror(-r));
 	}
 
+#ifdef AMDGPU_ASIC_ID_BUILTIN
+out:
+#endif
 	free(line);
 	fclose(fp);
 }
@@ -29,6 +29,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sched.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/time.h>
@@ -43,13 +44,26 @@ static int amdgpu_close_kms_handle(int fd, uint32_t handle)
 {
 	struct drm_gem_close args = {};
 
+	drmPrimeCacheHandleClosed(fd, handle);
 	args.handle = handle;
 	return drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &args);
 }
 
+static unsigned amdgpu_bo_label_heap(uint32_t domains)
+{
+	if (domains & AMDGPU_GEM_DOMAIN_VRAM)
+		return AMDGPU_BO_LABEL_HEAP_VRAM;
+	if (domains & AMDGPU_GEM_DOMAIN_GTT)
+		return AMDGPU_BO_LABEL_HEAP_GTT;
+	if (domains & AMDGPU_GEM_DOMAIN_CPU)
+		return AMDGPU_BO_LABEL_HEAP_CPU;
+	return AMDGPU_BO_LABEL_HEAP_OTHER;
+}
+
 static int amdgpu_bo_create(amdgpu_device_handle dev,
 			    uint64_t size,
 			    uint32_t handle,
+			    unsigned label_heap,
 			    amdgpu_bo_handle *buf_handle)
 {
 	struct amdgpu_bo *bo;
@@ -69,21 +83,27 @@ static int amdgpu_bo_create(amdgpu_device_handle dev,
 	bo->dev = dev;
 	bo->alloc_size = size;
 	bo->handle = handle;
+	bo->unique_id = ++dev->next_bo_id;
+	bo->label_heap = label_heap;
 	pthread_mutex_init(&bo->cpu_access_mutex, NULL);
+	util_bo_labels_alloc(&dev->bo_labels, 0, label_heap, size);
+	__atomic_add_fetch(&dev->heap_bytes[label_heap], size, __ATOMIC_RELAXED);
 
 	*buf_handle = bo;
 	return 0;
 }
 
-drm_public int amdgpu_bo_alloc(amdgpu_device_handle dev,
+static int amdgpu_bo_alloc_key(amdgpu_device_handle dev,
 			       struct amdgpu_bo_alloc_request *alloc_buffer,
+			       const struct amdgpu_bo_cache_key *key,
+			       bool reusable,
 			       amdgpu_bo_handle *buf_handle)
 {
 	union drm_amdgpu_gem_create args;
 	int r;
 
 	memset(&args, 0, sizeof(args));
-	args.in.bo_size = alloc_buffer->alloc_size;
+	args.in.bo_size = key->size;
 	args.in.alignment = alloc_buffer->phys_alignment;
 
 	/* Set the placement. */
@@ -97,21 +117,120 @@ drm_public int amdgpu_bo_alloc(amdgpu_device_handle dev,
 		goto out;
 
 	pthread_mutex_lock(&dev->bo_table_mutex);
-	r = amdgpu_bo_create(dev, alloc_buffer->alloc_size, args.out.handle,
+	r = amdgpu_bo_create(dev, key->size, args.out.handle,
+			     amdgpu_bo_label_heap(alloc_buffer->preferred_heap),
 			     buf_handle);
 	pthread_mutex_unlock(&dev->bo_table_mutex);
 	if (r) {
 		amdgpu_close_kms_handle(dev->fd, args.out.handle);
+		goto out;
 	}
+	UTIL_TRACE_EVENT("bo_create", "amdgpu handle=%u size=%" PRIu64,
+			 args.out.handle, key->size);
+
+	(*buf_handle)->reusable = reusable;
+	(*buf_handle)->cache_key = *key;
 
 out:
 	return r;
 }
 
+drm_public int amdgpu_bo_alloc(amdgpu_device_handle dev,
+			       struct amdgpu_bo_alloc_request *alloc_buffer,
+			       amdgpu_bo_handle *buf_handle)
+{
+	uint64_t trace_start;
+	struct amdgpu_bo_cache_key key;
+	bool reusable;
+	int r = 0;
+
+	trace_start = amdgpu_trace_begin(dev);
+	reusable = amdgpu_bo_cache_init_key(dev, &key, alloc_buffer,
+					    false, 0, 0);
+	if (reusable)
+		*buf_handle = amdgpu_bo_cache_take(dev, &key);
+	if (!reusable || !*buf_handle)
+		r = amdgpu_bo_alloc_key(dev, alloc_buffer, &key, reusable,
+					buf_handle);
+
+	if (trace_start) {
+		struct amdgpu_trace_event trace = {
+			.start_ns = trace_start,
+			.type = AMDGPU_TRACE_BO_ALLOC,
+			.result = r,
+			.size = alloc_buffer->alloc_size,
+		};
+
+		amdgpu_trace_record(dev, &trace);
+	}
+	return r;
+}
+
+drm_public int amdgpu_bo_alloc_mapped(amdgpu_device_handle dev,
+				      struct amdgpu_bo_alloc_request *alloc_buffer,
+				      uint64_t va_flags, uint64_t vm_flags,
+				      amdgpu_bo_handle *buf_handle,
+				      uint64_t *va_address)
+{
+	struct amdgpu_bo_alloc_request request = *alloc_buffer;
+	struct amdgpu_bo_cache_key key;
+	struct amdgpu_bo *bo;
+	uint64_t fragment;
+	bool reusable;
+	int r;
+
+	/* Contiguous VRAM lets the kernel use large fragments. */
+	if (va_flags & AMDGPU_VA_RANGE_FRAGMENT) {
+		fragment = amdgpu_va_fragment_size(dev, request.alloc_size);
+		request.alloc_size = ALIGN(request.alloc_size, fragment);
+		if (request.preferred_heap & AMDGPU_GEM_DOMAIN_VRAM)
+			request.phys_alignment = MAX2(request.phys_alignment,
+						      fragment);
+	}
+	alloc_buffer = &request;
+
+	reusable = amdgpu_bo_cache_init_key(dev, &key, alloc_buffer,
+					    true, va_flags, vm_flags);
+	if (reusable) {
+		bo = amdgpu_bo_cache_take(dev, &key);
+		if (bo)
+			goto done;
+	}
+
+	r = amdgpu_bo_alloc_key(dev, alloc_buffer, &key, reusable, &bo);
+	if (r)
+		return r;
+
+	r = amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general,
+				  key.size, alloc_buffer->phys_alignment, 0,
+				  &bo->va_address, &bo->va_handle, va_flags);
+	if (r)
+		goto error_free;
+
+	r = amdgpu_bo_va_op_raw(dev, bo, 0, ALIGN(key.size, getpagesize()),
+				bo->va_address, vm_flags, AMDGPU_VA_OP_MAP);
+	if (r) {
+		amdgpu_va_range_free(bo->va_handle);
+		bo->va_handle = NULL;
+		goto error_free;
+	}
+
+done:
+	*buf_handle = bo;
+	*va_address = bo->va_address;
+	return 0;
+
+error_free:
+	bo->reusable = false;
+	amdgpu_bo_free(bo);
+	return r;
+}
+
 drm_public int amdgpu_bo_set_metadata(amdgpu_bo_handle bo,
 				      struct amdgpu_bo_metadata *info)
 {
 	struct drm_amdgpu_gem_metadata args = {};
+	int r;
 
 	args.handle = bo->handle;
 	args.op = AMDGPU_GEM_METADATA_OP_SET_METADATA;
@@ -126,9 +245,16 @@ drm_public int amdgpu_bo_set_metadata(amdgpu_bo_handle bo,
 		memcpy(args.data.data, info->umd_metadata, info->size_metadata);
 	}
 
-	return drmCommandWriteRead(bo->dev->fd,
-				   DRM_AMDGPU_GEM_METADATA,
-				   &args, sizeof(args));
+	r = drmCommandWriteRead(bo->dev->fd,
+				DRM_AMDGPU_GEM_METADATA,
+				&args, sizeof(args));
+
+	pthread_mutex_lock(&bo->cpu_access_mutex);
+	bo->info_gen++;
+	free(bo->info);
+	bo->info = NULL;
+	pthread_mutex_unlock(&bo->cpu_access_mutex);
+	return r;
 }
 
 drm_public int amdgpu_bo_query_info(amdgpu_bo_handle bo,
@@ -137,12 +263,23 @@ drm_public int amdgpu_bo_query_info(amdgpu_bo_handle bo,
 	struct drm_amdgpu_gem_metadata metadata = {};
 	struct drm_amdgpu_gem_create_in bo_info = {};
 	struct drm_amdgpu_gem_op gem_op = {};
+	bool cache = !bo->shared || bo->dev->trust_shared_bo_info;
+	uint32_t gen;
 	int r;
 
 	/* Validate the BO passed in */
 	if (!bo->handle)
 		return -EINVAL;
 
+	pthread_mutex_lock(&bo->cpu_access_mutex);
+	if (cache && bo->info) {
+		*info = *bo->info;
+		pthread_mutex_unlock(&bo->cpu_access_mutex);
+		return 0;
+	}
+	gen = bo->info_gen;
+	pthread_mutex_unlock(&bo->cpu_access_mutex);
+
 	/* Query metadata. */
 	metadata.handle = bo->handle;
 	metadata.op = AMDGPU_GEM_METADATA_OP_GET_METADATA;
@@ -179,9 +316,26 @@ drm_public int amdgpu_bo_query_info(amdgpu_bo_handle bo,
 		memcpy(info->metadata.umd_metadata, metadata.data.data,
 		       metadata.data.data_size_bytes);
 
+	if (!cache)
+		return 0;
+
+	/* Not kept if the metadata was set meanwhile. */
+	pthread_mutex_lock(&bo->cpu_access_mutex);
+	if (gen == bo->info_gen && !bo->info) {
+		bo->info = malloc(sizeof(*bo->info));
+		if (bo->info)
+			*bo->info = *info;
+	}
+	pthread_mutex_unlock(&bo->cpu_access_mutex);
 	return 0;
 }
 
+drm_public void amdgpu_device_trust_shared_bo_info(amdgpu_device_handle dev,
+						   bool trust)
+{
+	dev->trust_shared_bo_info = trust;
+}
+
 static int amdgpu_bo_export_flink(amdgpu_bo_handle bo)
 {
 	struct drm_gem_flink flink;
@@ -231,6 +385,10 @@ drm_public int amdgpu_bo_export(amdgpu_bo_handle bo,
 {
 	int r;
 
+	/* Whoever holds the shared buffer doesn't expect it to be recycled. */
+	bo->reusable = false;
+	bo->shared = true;
+
 	switch (type) {
 	case amdgpu_bo_handle_type_gem_flink_name:
 		r = amdgpu_bo_export_flink(bo);
@@ -253,6 +411,40 @@ drm_public int amdgpu_bo_export(amdgpu_bo_handle bo,
 	return -EINVAL;
 }
 
+/*
+ * Look up a buffer without bo_table_mutex and take a reference to it if it
+ * is still alive. amdgpu_bo_wait_lookups() makes sure the buffer memory
+ * stays valid until the lookups that could have seen it are done.
+ */
+static struct amdgpu_bo *amdgpu_bo_lookup_unlocked(struct amdgpu_device *dev,
+						   struct handle_table *table,
+						   uint32_t key)
+{
+	unsigned phase = atomic_read(&dev->bo_lookup_phase) & 1;
+	struct amdgpu_bo *bo;
+
+	atomic_inc(&dev->bo_lookups[phase]);
+	/* the count has to be seen before the buffer is looked up */
+	atomic_mb();
+	bo = handle_table_lookup(table, key);
+	if (bo && atomic_add_unless(&bo->refcount, 1, 0))
+		bo = NULL;
+	atomic_dec(&dev->bo_lookups[phase], 1);
+
+	return bo;
+}
+
+/* Wait for the unlocked lookups that may still see buffers removed from
+ * the tables. Called with bo_table_mutex held, new lookups go to the other
+ * phase so that they can't hold this up forever. */
+static void amdgpu_bo_wait_lookups(struct amdgpu_device *dev)
+{
+	unsigned phase = (atomic_inc_return(&dev->bo_lookup_phase) - 1) & 1;
+
+	while (atomic_read(&dev->bo_lookups[phase]))
+		sched_yield();
+}
+
 drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 				enum amdgpu_bo_handle_type type,
 				uint32_t shared_handle,
@@ -266,6 +458,22 @@ drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 	int dma_fd;
 	uint64_t dma_buf_size = 0;
 
+	/* Fast path for buffers imported before. Holding a reference keeps
+	 * the KMS handle from being closed under us, otherwise the handle is
+	 * looked up again with the lock held below. */
+	if (type == amdgpu_bo_handle_type_gem_flink_name)
+		bo = amdgpu_bo_lookup_unlocked(dev, &dev->bo_flink_names,
+					       shared_handle);
+	else if (type == amdgpu_bo_handle_type_dma_buf_fd &&
+		 !drmPrimeFDToHandleCached(dev->fd, shared_handle, &handle))
+		bo = amdgpu_bo_lookup_unlocked(dev, &dev->bo_handles, handle);
+
+	if (bo) {
+		output->buf_handle = bo;
+		output->alloc_size = bo->alloc_size;
+		return 0;
+	}
+
 	/* We must maintain a list of pairs <handle, bo>, so that we always
 	 * return the same amdgpu_bo instance for the same handle. */
 	pthread_mutex_lock(&dev->bo_table_mutex);
@@ -275,7 +483,7 @@ drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 		off_t size;
 
 		/* Get a KMS handle. */
-		r = drmPrimeFDToHandle(dev->fd, shared_handle, &handle);
+		r = drmPrimeFDToHandleCached(dev->fd, shared_handle, &handle);
 		if (r)
 			goto unlock;
 
@@ -361,9 +569,13 @@ drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 	}
 
 	/* Initialize it. */
-	r = amdgpu_bo_create(dev, alloc_size, handle, &bo);
+	r = amdgpu_bo_create(dev, alloc_size, handle,
+			     AMDGPU_BO_LABEL_HEAP_OTHER, &bo);
 	if (r)
 		goto free_bo_handle;
+	bo->shared = true;
+	UTIL_TRACE_EVENT("bo_import", "amdgpu handle=%u size=%" PRIu64,
+			 handle, alloc_size);
 
 	if (flink_name) {
 		bo->flink_name = flink_name;
@@ -392,6 +604,28 @@ unlock:
 	return r;
 }
 
+/* Keeps an indexed userptr buffer for the next registration of its range,
+ * freeing the oldest one past AMDGPU_USERPTR_CACHE_SIZE.
+ * Called with bo_table_mutex held. */
+static bool amdgpu_userptr_put(struct amdgpu_bo *bo)
+{
+	struct amdgpu_device *dev = bo->dev;
+	struct amdgpu_bo *oldest;
+
+	if (!bo->user_ptr)
+		return false;
+
+	list_addtail(&bo->userptr_lru, &dev->userptr_idle);
+	if (++dev->num_userptr_idle > AMDGPU_USERPTR_CACHE_SIZE) {
+		oldest = LIST_ENTRY(struct amdgpu_bo, dev->userptr_idle.next,
+				    userptr_lru);
+		list_del(&oldest->userptr_lru);
+		dev->num_userptr_idle--;
+		amdgpu_bo_destroy_locked(oldest);
+	}
+	return true;
+}
+
 drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 {
 	struct amdgpu_device *dev;
@@ -402,6 +636,11 @@ drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 	pthread_mutex_lock(&dev->bo_table_mutex);
 
 	if (update_references(&bo->refcount, NULL)) {
+		util_bo_labels_remove(&dev->bo_labels, bo->label,
+				      bo->label_heap, bo->alloc_size);
+		UTIL_TRACE_EVENT("bo_free", "amdgpu handle=%u size=%" PRIu64,
+				 bo->handle, bo->alloc_size);
+
 		/* Remove the buffer from the hash tables. */
 		handle_table_remove(&dev->bo_handles, bo->handle);
 
@@ -412,12 +651,12 @@ drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 		/* Release CPU access. */
 		if (bo->cpu_map_count > 0) {
 			bo->cpu_map_count = 1;
+			bo->cpu_map_persistent = false;
 			amdgpu_bo_cpu_unmap(bo);
 		}
 
-		amdgpu_close_kms_handle(dev->fd, bo->handle);
-		pthread_mutex_destroy(&bo->cpu_access_mutex);
-		free(bo);
+		if (!amdgpu_userptr_put(bo) && !amdgpu_bo_cache_put(bo))
+			amdgpu_bo_destroy_locked(bo);
 	}
 
 	pthread_mutex_unlock(&dev->bo_table_mutex);
@@ -425,29 +664,195 @@ drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 	return 0;
 }
 
+/* Called with bo_table_mutex held, once the buffer is out of the tables. */
+static void amdgpu_cpu_map_remove(struct amdgpu_bo *bo, uintptr_t start);
+
+drm_private void amdgpu_bo_destroy_locked(struct amdgpu_bo *bo)
+{
+	amdgpu_device_handle dev = bo->dev;
+
+	if (bo->user_ptr)
+		amdgpu_cpu_map_remove(bo, (uintptr_t)bo->user_ptr);
+
+	if (bo->va_handle) {
+		amdgpu_bo_va_op_raw(dev, bo, 0,
+				    ALIGN(bo->alloc_size, getpagesize()),
+				    bo->va_address, 0, AMDGPU_VA_OP_UNMAP);
+		amdgpu_va_range_free(bo->va_handle);
+	}
+
+	amdgpu_close_kms_handle(dev->fd, bo->handle);
+	__atomic_sub_fetch(&dev->heap_bytes[bo->label_heap], bo->alloc_size,
+			   __ATOMIC_RELAXED);
+	pthread_mutex_destroy(&bo->cpu_access_mutex);
+	amdgpu_bo_wait_lookups(dev);
+	free(bo->info);
+	free(bo);
+}
+
+drm_public int amdgpu_bo_set_label(amdgpu_bo_handle bo, const char *label)
+{
+	struct amdgpu_device *dev = bo->dev;
+	unsigned index;
+
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	index = util_bo_labels_find(&dev->bo_labels, label);
+	util_bo_labels_move(&dev->bo_labels, bo->label, index, bo->label_heap,
+			    bo->alloc_size);
+	bo->label = index;
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+	return 0;
+}
+
+drm_public int amdgpu_query_bo_label_stats(amdgpu_device_handle dev,
+					   unsigned index,
+					   struct amdgpu_bo_label_stats *stats)
+{
+	struct util_bo_label *label;
+	unsigned heap;
+
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	if (index >= dev->bo_labels.num_labels) {
+		pthread_mutex_unlock(&dev->bo_table_mutex);
+		return -ENOENT;
+	}
+	label = &dev->bo_labels.labels[index];
+	memcpy(stats->name, label->name, sizeof(stats->name));
+	for (heap = 0; heap < AMDGPU_BO_LABEL_HEAPS; heap++) {
+		stats->buffers[heap] = label->buffers[heap];
+		stats->bytes[heap] = label->bytes[heap];
+	}
+	stats->peak_bytes = label->peak_bytes;
+	stats->allocs = label->allocs;
+	stats->alloc_bytes = label->alloc_bytes;
+	stats->alloc_rate = util_bo_labels_rate(&dev->bo_labels, index);
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+	return 0;
+}
+
+/* Called with bo_table_mutex held. */
+drm_private void amdgpu_dump_bo_usage_locked(amdgpu_device_handle dev,
+					     FILE *file)
+{
+	static const char *const heaps[AMDGPU_BO_LABEL_HEAPS] = {
+		"vram", "gtt", "cpu", "other",
+	};
+
+	util_bo_labels_dump(&dev->bo_labels, heaps, dev->bo_cache.size,
+			    "amdgpu", file);
+}
+
 drm_public void amdgpu_bo_inc_ref(amdgpu_bo_handle bo)
 {
 	atomic_inc(&bo->refcount);
 }
 
-drm_public int amdgpu_bo_cpu_map(amdgpu_bo_handle bo, void **cpu)
+/* Index of the first mapping starting above addr.
+ * Called with cpu_map_mutex held. */
+static unsigned amdgpu_cpu_map_upper_bound(struct amdgpu_device *dev,
+					   uintptr_t addr)
+{
+	unsigned lo = 0, hi = dev->num_cpu_maps;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (dev->cpu_maps[mid].start <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int amdgpu_cpu_map_insert(struct amdgpu_bo *bo, uintptr_t start)
+{
+	struct amdgpu_device *dev = bo->dev;
+	unsigned i;
+
+	pthread_mutex_lock(&dev->cpu_map_mutex);
+	if (dev->num_cpu_maps == dev->max_cpu_maps) {
+		unsigned max = MAX2(dev->max_cpu_maps * 2, 64);
+		struct amdgpu_cpu_mapping *maps;
+
+		maps = realloc(dev->cpu_maps, max * sizeof(*maps));
+		if (!maps) {
+			pthread_mutex_unlock(&dev->cpu_map_mutex);
+			return -ENOMEM;
+		}
+		dev->cpu_maps = maps;
+		dev->max_cpu_maps = max;
+	}
+
+	i = amdgpu_cpu_map_upper_bound(dev, start);
+	memmove(&dev->cpu_maps[i + 1], &dev->cpu_maps[i],
+		(dev->num_cpu_maps - i) * sizeof(dev->cpu_maps[0]));
+	dev->cpu_maps[i].start = start;
+	dev->cpu_maps[i].end = start + bo->alloc_size;
+	dev->cpu_maps[i].bo = bo;
+	dev->num_cpu_maps++;
+	pthread_mutex_unlock(&dev->cpu_map_mutex);
+	return 0;
+}
+
+static void amdgpu_cpu_map_remove(struct amdgpu_bo *bo, uintptr_t start)
+{
+	struct amdgpu_device *dev = bo->dev;
+	unsigned i;
+
+	pthread_mutex_lock(&dev->cpu_map_mutex);
+	i = amdgpu_cpu_map_upper_bound(dev, start);
+	assert(i > 0 && dev->cpu_maps[i - 1].bo == bo);
+	memmove(&dev->cpu_maps[i - 1], &dev->cpu_maps[i],
+		(dev->num_cpu_maps - i) * sizeof(dev->cpu_maps[0]));
+	dev->num_cpu_maps--;
+	pthread_mutex_unlock(&dev->cpu_map_mutex);
+}
+
+/* Add a reference to an existing mapping, only the transitions from and
+ * to zero need cpu_access_mutex. */
+static bool amdgpu_bo_cpu_map_get(struct amdgpu_bo *bo)
+{
+	int64_t count = __atomic_load_n(&bo->cpu_map_count, __ATOMIC_ACQUIRE);
+
+	while (count > 0) {
+		if (__atomic_compare_exchange_n(&bo->cpu_map_count, &count,
+						count + 1, true,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_ACQUIRE))
+			return true;
+	}
+	return false;
+}
+
+/* Drop a reference to a mapping unless it is the last one. */
+static bool amdgpu_bo_cpu_map_put(struct amdgpu_bo *bo)
+{
+	int64_t count = __atomic_load_n(&bo->cpu_map_count, __ATOMIC_RELAXED);
+
+	while (count > 1) {
+		if (__atomic_compare_exchange_n(&bo->cpu_map_count, &count,
+						count - 1, true,
+						__ATOMIC_RELEASE,
+						__ATOMIC_RELAXED))
+			return true;
+	}
+	return false;
+}
+
+static int amdgpu_bo_cpu_map_locked(amdgpu_bo_handle bo, void **cpu)
 {
 	union drm_amdgpu_gem_mmap args;
 	void *ptr;
 	int r;
 
-	pthread_mutex_lock(&bo->cpu_access_mutex);
-
-	if (bo->cpu_ptr) {
+	if (amdgpu_bo_cpu_map_get(bo)) {
 		/* already mapped */
-		assert(bo->cpu_map_count > 0);
-		bo->cpu_map_count++;
 		*cpu = bo->cpu_ptr;
-		pthread_mutex_unlock(&bo->cpu_access_mutex);
 		return 0;
 	}
 
-	assert(bo->cpu_map_count == 0);
+	assert(__atomic_load_n(&bo->cpu_map_count, __ATOMIC_RELAXED) == 0);
 
 	memset(&args, 0, sizeof(args));
 
@@ -457,47 +862,91 @@ drm_public int amdgpu_bo_cpu_map(amdgpu_bo_handle bo, void **cpu)
 
 	r = drmCommandWriteRead(bo->dev->fd, DRM_AMDGPU_GEM_MMAP, &args,
 				sizeof(args));
-	if (r) {
-		pthread_mutex_unlock(&bo->cpu_access_mutex);
+	if (r)
 		return r;
-	}
 
 	/* Map the buffer. */
 	ptr = drm_mmap(NULL, bo->alloc_size, PROT_READ | PROT_WRITE, MAP_SHARED,
 		       bo->dev->fd, args.out.addr_ptr);
-	if (ptr == MAP_FAILED) {
-		pthread_mutex_unlock(&bo->cpu_access_mutex);
+	if (ptr == MAP_FAILED)
 		return -errno;
-	}
 
 	bo->cpu_ptr = ptr;
-	bo->cpu_map_count = 1;
-	pthread_mutex_unlock(&bo->cpu_access_mutex);
+	r = amdgpu_cpu_map_insert(bo, (uintptr_t)ptr);
+	if (r) {
+		drm_munmap(ptr, bo->alloc_size);
+		bo->cpu_ptr = NULL;
+		return r;
+	}
+	/* Publishes cpu_ptr to amdgpu_bo_cpu_map_get(). */
+	__atomic_store_n(&bo->cpu_map_count, 1, __ATOMIC_RELEASE);
 
 	*cpu = ptr;
 	return 0;
 }
 
-drm_public int amdgpu_bo_cpu_unmap(amdgpu_bo_handle bo)
+drm_public int amdgpu_bo_cpu_map(amdgpu_bo_handle bo, void **cpu)
 {
 	int r;
 
+	if (amdgpu_bo_cpu_map_get(bo)) {
+		*cpu = bo->cpu_ptr;
+		return 0;
+	}
+
 	pthread_mutex_lock(&bo->cpu_access_mutex);
-	assert(bo->cpu_map_count >= 0);
+	r = amdgpu_bo_cpu_map_locked(bo, cpu);
+	pthread_mutex_unlock(&bo->cpu_access_mutex);
+	return r;
+}
 
-	if (bo->cpu_map_count == 0) {
-		/* not mapped */
-		pthread_mutex_unlock(&bo->cpu_access_mutex);
-		return -EINVAL;
+drm_public int amdgpu_bo_cpu_map_persistent(amdgpu_bo_handle bo, void **cpu)
+{
+	int r;
+
+	pthread_mutex_lock(&bo->cpu_access_mutex);
+	r = amdgpu_bo_cpu_map_locked(bo, cpu);
+	if (!r && bo->cpu_map_persistent) {
+		/* The buffer already holds its reference. */
+		amdgpu_bo_cpu_map_put(bo);
 	}
+	bo->cpu_map_persistent |= !r;
+	pthread_mutex_unlock(&bo->cpu_access_mutex);
+	return r;
+}
+
+drm_public int amdgpu_bo_cpu_unmap(amdgpu_bo_handle bo)
+{
+	int64_t count;
+	int r;
 
-	bo->cpu_map_count--;
-	if (bo->cpu_map_count > 0) {
-		/* mapped multiple times */
+	/* mapped multiple times */
+	if (amdgpu_bo_cpu_map_put(bo))
+		return 0;
+
+	pthread_mutex_lock(&bo->cpu_access_mutex);
+	count = __atomic_load_n(&bo->cpu_map_count, __ATOMIC_RELAXED);
+	do {
+		assert(count >= 0);
+
+		/* The last reference of a persistent mapping is the buffer's. */
+		if (count == 0 || (count == 1 && bo->cpu_map_persistent)) {
+			/* not mapped */
+			pthread_mutex_unlock(&bo->cpu_access_mutex);
+			return -EINVAL;
+		}
+		/* Other threads may still add and drop nested mappings. */
+	} while (!__atomic_compare_exchange_n(&bo->cpu_map_count, &count,
+					      count - 1, true,
+					      __ATOMIC_ACQ_REL,
+					      __ATOMIC_RELAXED));
+
+	if (count > 1) {
 		pthread_mutex_unlock(&bo->cpu_access_mutex);
 		return 0;
 	}
 
+	amdgpu_cpu_map_remove(bo, (uintptr_t)bo->cpu_ptr);
 	r = drm_munmap(bo->cpu_ptr, bo->alloc_size) == 0 ? 0 : -errno;
 	bo->cpu_ptr = NULL;
 	pthread_mutex_unlock(&bo->cpu_access_mutex);
@@ -541,8 +990,9 @@ drm_public int amdgpu_find_bo_by_cpu_mapping(amdgpu_device_handle dev,
 					     amdgpu_bo_handle *buf_handle,
 					     uint64_t *offset_in_bo)
 {
-	struct amdgpu_bo *bo;
-	uint32_t i;
+	struct amdgpu_cpu_mapping *map = NULL;
+	uintptr_t addr = (uintptr_t)cpu;
+	unsigned i;
 	int r = 0;
 
 	if (cpu == NULL || size == 0)
@@ -553,30 +1003,111 @@ drm_public int amdgpu_find_bo_by_cpu_mapping(amdgpu_device_handle dev,
 	 * exposed CPU pointers. If we find a real world use case we should
 	 * improve that by asking the kernel for the right handle.
 	 */
-	pthread_mutex_lock(&dev->bo_table_mutex);
-	for (i = 0; i < dev->bo_handles.max_key; i++) {
-		bo = handle_table_lookup(&dev->bo_handles, i);
-		if (!bo || !bo->cpu_ptr || size > bo->alloc_size)
-			continue;
-		if (cpu >= bo->cpu_ptr &&
-		    cpu < (void*)((uintptr_t)bo->cpu_ptr + bo->alloc_size))
-			break;
-	}
-
-	if (i < dev->bo_handles.max_key) {
-		atomic_inc(&bo->refcount);
-		*buf_handle = bo;
-		*offset_in_bo = (uintptr_t)cpu - (uintptr_t)bo->cpu_ptr;
+	pthread_mutex_lock(&dev->cpu_map_mutex);
+	i = amdgpu_cpu_map_upper_bound(dev, addr);
+	if (i > 0 && addr < dev->cpu_maps[i - 1].end &&
+	    size <= dev->cpu_maps[i - 1].bo->alloc_size)
+		map = &dev->cpu_maps[i - 1];
+
+	/* The buffer may be on its way out, amdgpu_bo_free() drops the last
+	 * reference before it unmaps it. */
+	if (map && !atomic_add_unless(&map->bo->refcount, 1, 0)) {
+		*buf_handle = map->bo;
+		*offset_in_bo = addr - map->start;
 	} else {
 		*buf_handle = NULL;
 		*offset_in_bo = 0;
 		r = -ENXIO;
 	}
-	pthread_mutex_unlock(&dev->bo_table_mutex);
+	pthread_mutex_unlock(&dev->cpu_map_mutex);
 
 	return r;
 }
 
+/* The userptr buffer registered for exactly [start, end), with a new
+ * reference, or NULL. Called with bo_table_mutex held, so that the
+ * references can't drop to 0 meanwhile. */
+static struct amdgpu_bo *amdgpu_userptr_find(struct amdgpu_device *dev,
+					     uintptr_t start, uintptr_t end)
+{
+	struct amdgpu_cpu_mapping *map;
+	struct amdgpu_bo *bo = NULL;
+	unsigned i;
+
+	pthread_mutex_lock(&dev->cpu_map_mutex);
+	i = amdgpu_cpu_map_upper_bound(dev, start);
+	map = i > 0 ? &dev->cpu_maps[i - 1] : NULL;
+	if (map && map->start == start && map->end == end && map->bo->user_ptr)
+		bo = map->bo;
+	pthread_mutex_unlock(&dev->cpu_map_mutex);
+
+	if (!bo)
+		return NULL;
+
+	if (atomic_read(&bo->refcount)) {
+		atomic_inc(&bo->refcount);
+		return bo;
+	}
+
+	/* Idle, the table never shrinks so this can't run out of memory. */
+	if (handle_table_insert(&dev->bo_handles, bo->handle, bo))
+		return NULL;
+	list_del(&bo->userptr_lru);
+	dev->num_userptr_idle--;
+	atomic_set(&bo->refcount, 1);
+	bo->label = 0;
+	util_bo_labels_alloc(&dev->bo_labels, 0, bo->label_heap,
+			     bo->alloc_size);
+	return bo;
+}
+
+/* Indexes a new userptr buffer, unless its range overlaps the one of
+ * another, which bo_table_mutex keeps from changing. */
+static void amdgpu_userptr_insert(struct amdgpu_bo *bo, void *cpu)
+{
+	struct amdgpu_device *dev = bo->dev;
+	uintptr_t start = (uintptr_t)cpu, end = start + bo->alloc_size;
+	bool overlap;
+	unsigned i;
+
+	pthread_mutex_lock(&dev->cpu_map_mutex);
+	i = amdgpu_cpu_map_upper_bound(dev, start);
+	overlap = (i > 0 && dev->cpu_maps[i - 1].end > start) ||
+		  (i < dev->num_cpu_maps && dev->cpu_maps[i].start < end);
+	pthread_mutex_unlock(&dev->cpu_map_mutex);
+
+	if (!overlap && !amdgpu_cpu_map_insert(bo, start))
+		bo->user_ptr = cpu;
+}
+
+drm_private void amdgpu_userptr_cache_fini(struct amdgpu_device *dev)
+{
+	amdgpu_bo_userptr_invalidate(dev, NULL, UINTPTR_MAX);
+}
+
+drm_public int amdgpu_bo_userptr_invalidate(amdgpu_device_handle dev,
+					    void *cpu, uint64_t size)
+{
+	uintptr_t addr = (uintptr_t)cpu;
+	struct amdgpu_bo *bo, *tmp;
+
+	if (!dev)
+		return -EINVAL;
+
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &dev->userptr_idle, userptr_lru) {
+		uintptr_t start = (uintptr_t)bo->user_ptr;
+
+		if (start - addr >= size && addr - start >= bo->alloc_size)
+			continue;
+		list_del(&bo->userptr_lru);
+		dev->num_userptr_idle--;
+		amdgpu_bo_destroy_locked(bo);
+	}
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+	return 0;
+}
+
 drm_public int amdgpu_create_bo_from_user_mem(amdgpu_device_handle dev,
 					      void *cpu,
 					      uint64_t size,
@@ -585,6 +1116,16 @@ drm_public int amdgpu_create_bo_from_user_mem(amdgpu_device_handle dev,
 	int r;
 	struct drm_amdgpu_gem_userptr args;
 
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	*buf_handle = amdgpu_userptr_find(dev, (uintptr_t)cpu,
+					  (uintptr_t)cpu + size);
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+	if (*buf_handle) {
+		UTIL_TRACE_EVENT("bo_cache_hit", "amdgpu handle=%u size=%" PRIu64,
+				 (*buf_handle)->handle, size);
+		return 0;
+	}
+
 	args.addr = (uintptr_t)cpu;
 	args.flags = AMDGPU_GEM_USERPTR_ANONONLY | AMDGPU_GEM_USERPTR_REGISTER |
 		AMDGPU_GEM_USERPTR_VALIDATE;
@@ -595,11 +1136,17 @@ drm_public int amdgpu_create_bo_from_user_mem(amdgpu_device_handle dev,
 		goto out;
 
 	pthread_mutex_lock(&dev->bo_table_mutex);
-	r = amdgpu_bo_create(dev, size, args.handle, buf_handle);
+	r = amdgpu_bo_create(dev, size, args.handle, AMDGPU_BO_LABEL_HEAP_GTT,
+			     buf_handle);
+	if (!r)
+		amdgpu_userptr_insert(*buf_handle, cpu);
 	pthread_mutex_unlock(&dev->bo_table_mutex);
 	if (r) {
 		amdgpu_close_kms_handle(dev->fd, args.handle);
+		goto out;
 	}
+	UTIL_TRACE_EVENT("bo_create", "amdgpu handle=%u size=%" PRIu64,
+			 args.handle, size);
 
 out:
 	return r;
@@ -639,36 +1186,76 @@ drm_public int amdgpu_bo_list_destroy_raw(amdgpu_device_handle dev,
 				   &args, sizeof(args));
 }
 
-drm_public int amdgpu_bo_list_create(amdgpu_device_handle dev,
-				     uint32_t number_of_resources,
-				     amdgpu_bo_handle *resources,
-				     uint8_t *resource_prios,
-				     amdgpu_bo_list_handle *result)
+static int amdgpu_bo_list_key_compare(const void *a, const void *b)
+{
+	const struct amdgpu_bo_list_key *ka = a, *kb = b;
+
+	if (ka->bo_id != kb->bo_id)
+		return ka->bo_id < kb->bo_id ? -1 : 1;
+	if (ka->priority != kb->priority)
+		return ka->priority < kb->priority ? -1 : 1;
+	return 0;
+}
+
+/* Describe a buffer set independently of its order, the kernel sorts the
+ * list by priority anyway. */
+static struct amdgpu_bo_list_key *
+amdgpu_bo_list_make_keys(uint32_t number_of_resources,
+			 amdgpu_bo_handle *resources, uint8_t *resource_prios,
+			 uint32_t *hash)
+{
+	struct amdgpu_bo_list_key *keys;
+	uint32_t i, h = 2166136261u;
+
+	keys = malloc(number_of_resources * sizeof(*keys));
+	if (!keys)
+		return NULL;
+
+	for (i = 0; i < number_of_resources; i++) {
+		keys[i].bo_id = resources[i]->unique_id;
+		keys[i].priority = resource_prios ? resource_prios[i] : 0;
+	}
+	qsort(keys, number_of_resources, sizeof(*keys),
+	      amdgpu_bo_list_key_compare);
+
+	/* FNV-1a */
+	for (i = 0; i < number_of_resources; i++) {
+		h = (h ^ (uint32_t)keys[i].bo_id) * 16777619u;
+		h = (h ^ (uint32_t)(keys[i].bo_id >> 32)) * 16777619u;
+		h = (h ^ keys[i].priority) * 16777619u;
+	}
+	*hash = h;
+	return keys;
+}
+
+static bool amdgpu_bo_list_match(struct amdgpu_bo_list *list,
+				 uint32_t num_keys,
+				 const struct amdgpu_bo_list_key *keys,
+				 uint32_t hash)
+{
+	return list->keys && list->hash == hash && list->num_keys == num_keys &&
+	       !memcmp(list->keys, keys, num_keys * sizeof(*keys));
+}
+
+static int amdgpu_bo_list_ioctl(amdgpu_device_handle dev, uint32_t operation,
+				uint32_t list_handle,
+				uint32_t number_of_resources,
+				amdgpu_bo_handle *resources,
+				uint8_t *resource_prios,
+				uint32_t *result)
 {
 	struct drm_amdgpu_bo_list_entry *list;
 	union drm_amdgpu_bo_list args;
 	unsigned i;
 	int r;
 
-	if (!number_of_resources)
-		return -EINVAL;
-
-	/* overflow check for multiplication */
-	if (number_of_resources > UINT32_MAX / sizeof(struct drm_amdgpu_bo_list_entry))
-		return -EINVAL;
-
 	list = malloc(number_of_resources * sizeof(struct drm_amdgpu_bo_list_entry));
 	if (!list)
 		return -ENOMEM;
 
-	*result = malloc(sizeof(struct amdgpu_bo_list));
-	if (!*result) {
-		free(list);
-		return -ENOMEM;
-	}
-
 	memset(&args, 0, sizeof(args));
-	args.in.operation = AMDGPU_BO_LIST_OP_CREATE;
+	args.in.operation = operation;
+	args.in.list_handle = list_handle;
 	args.in.bo_number = number_of_resources;
 	args.in.bo_info_size = sizeof(struct drm_amdgpu_bo_list_entry);
 	args.in.bo_info_ptr = (uint64_t)(uintptr_t)list;
@@ -684,21 +1271,164 @@ drm_public int amdgpu_bo_list_create(amdgpu_device_handle dev,
 	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_BO_LIST,
 				&args, sizeof(args));
 	free(list);
+	if (!r && result)
+		*result = args.out.list_handle;
+	return r;
+}
+
+drm_public int amdgpu_bo_list_create(amdgpu_device_handle dev,
+				     uint32_t number_of_resources,
+				     amdgpu_bo_handle *resources,
+				     uint8_t *resource_prios,
+				     amdgpu_bo_list_handle *result)
+{
+	struct amdgpu_bo_list *list;
+	int r;
+
+	if (!number_of_resources)
+		return -EINVAL;
+
+	/* overflow check for multiplication */
+	if (number_of_resources > UINT32_MAX / sizeof(struct drm_amdgpu_bo_list_entry))
+		return -EINVAL;
+
+	list = calloc(1, sizeof(struct amdgpu_bo_list));
+	if (!list)
+		return -ENOMEM;
+
+	r = amdgpu_bo_list_ioctl(dev, AMDGPU_BO_LIST_OP_CREATE, 0,
+				 number_of_resources, resources,
+				 resource_prios, &list->handle);
+	if (r) {
+		free(list);
+		return r;
+	}
+
+	list->dev = dev;
+	atomic_set(&list->refcount, 1);
+	/* Only needed to skip identical updates, so failing is fine. */
+	list->keys = amdgpu_bo_list_make_keys(number_of_resources, resources,
+					      resource_prios, &list->hash);
+	list->num_keys = number_of_resources;
+	*result = list;
+	return 0;
+}
+
+drm_public int amdgpu_bo_list_create_cached(amdgpu_device_handle dev,
+					    uint32_t number_of_resources,
+					    amdgpu_bo_handle *resources,
+					    uint8_t *resource_prios,
+					    amdgpu_bo_list_handle *result)
+{
+	struct amdgpu_bo_list *list, *evict = NULL;
+	struct amdgpu_bo_list_key *keys;
+	uint32_t hash;
+	int r;
+
+	if (NULL == dev || !number_of_resources)
+		return -EINVAL;
+
+	if (number_of_resources > UINT32_MAX / sizeof(struct drm_amdgpu_bo_list_entry))
+		return -EINVAL;
+
+	keys = amdgpu_bo_list_make_keys(number_of_resources, resources,
+					resource_prios, &hash);
+	if (!keys)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&dev->bo_list_mutex);
+	LIST_FOR_EACH_ENTRY(list, &dev->bo_lists, cache_list) {
+		if (!amdgpu_bo_list_match(list, number_of_resources, keys, hash))
+			continue;
+
+		list_del(&list->cache_list);
+		list_add(&list->cache_list, &dev->bo_lists);
+		atomic_inc(&list->refcount);
+		dev->bo_list_hits++;
+		pthread_mutex_unlock(&dev->bo_list_mutex);
+
+		free(keys);
+		*result = list;
+		return 0;
+	}
+	dev->bo_list_misses++;
+	pthread_mutex_unlock(&dev->bo_list_mutex);
+
+	list = calloc(1, sizeof(struct amdgpu_bo_list));
+	if (!list) {
+		free(keys);
+		return -ENOMEM;
+	}
+
+	r = amdgpu_bo_list_ioctl(dev, AMDGPU_BO_LIST_OP_CREATE, 0,
+				 number_of_resources, resources,
+				 resource_prios, &list->handle);
 	if (r) {
-		free(*result);
+		free(keys);
+		free(list);
 		return r;
 	}
 
-	(*result)->dev = dev;
-	(*result)->handle = args.out.list_handle;
+	list->dev = dev;
+	list->shared = true;
+	list->keys = keys;
+	list->num_keys = number_of_resources;
+	list->hash = hash;
+	atomic_set(&list->refcount, 2);
+
+	pthread_mutex_lock(&dev->bo_list_mutex);
+	list_add(&list->cache_list, &dev->bo_lists);
+	if (++dev->num_bo_lists > AMDGPU_BO_LIST_CACHE_SIZE) {
+		evict = LIST_ENTRY(struct amdgpu_bo_list, dev->bo_lists.prev,
+				   cache_list);
+		list_del(&evict->cache_list);
+		dev->num_bo_lists--;
+	}
+	pthread_mutex_unlock(&dev->bo_list_mutex);
+
+	if (evict)
+		amdgpu_bo_list_destroy(evict);
+
+	*result = list;
 	return 0;
 }
 
+drm_public int amdgpu_bo_list_cache_query(amdgpu_device_handle dev,
+					  uint64_t *hits, uint64_t *misses)
+{
+	if (NULL == dev)
+		return -EINVAL;
+
+	pthread_mutex_lock(&dev->bo_list_mutex);
+	if (hits)
+		*hits = dev->bo_list_hits;
+	if (misses)
+		*misses = dev->bo_list_misses;
+	pthread_mutex_unlock(&dev->bo_list_mutex);
+	return 0;
+}
+
+drm_private void amdgpu_bo_list_cache_fini(struct amdgpu_device *dev)
+{
+	struct amdgpu_bo_list *list, *tmp;
+
+	pthread_mutex_lock(&dev->bo_list_mutex);
+	LIST_FOR_EACH_ENTRY_SAFE(list, tmp, &dev->bo_lists, cache_list) {
+		list_del(&list->cache_list);
+		amdgpu_bo_list_destroy(list);
+	}
+	dev->num_bo_lists = 0;
+	pthread_mutex_unlock(&dev->bo_list_mutex);
+}
+
 drm_public int amdgpu_bo_list_destroy(amdgpu_bo_list_handle list)
 {
 	union drm_amdgpu_bo_list args;
 	int r;
 
+	if (!atomic_dec_and_test(&list->refcount))
+		return 0;
+
 	memset(&args, 0, sizeof(args));
 	args.in.operation = AMDGPU_BO_LIST_OP_DESTROY;
 	args.in.list_handle = list->handle;
@@ -706,8 +1436,12 @@ drm_public int amdgpu_bo_list_destroy(amdgpu_bo_list_handle list)
 	r = drmCommandWriteRead(list->dev->fd, DRM_AMDGPU_BO_LIST,
 				&args, sizeof(args));
 
-	if (!r)
+	if (!r) {
+		free(list->keys);
 		free(list);
+	} else {
+		atomic_set(&list->refcount, 1);
+	}
 
 	return r;
 }
@@ -717,40 +1451,44 @@ drm_public int amdgpu_bo_list_update(amdgpu_bo_list_handle handle,
 				     amdgpu_bo_handle *resources,
 				     uint8_t *resource_prios)
 {
-	struct drm_amdgpu_bo_list_entry *list;
-	union drm_amdgpu_bo_list args;
-	unsigned i;
+	struct amdgpu_bo_list_key *keys;
+	uint32_t hash;
 	int r;
 
 	if (!number_of_resources)
 		return -EINVAL;
 
+	/* Other users of the same set may hold it. */
+	if (handle->shared)
+		return -EINVAL;
+
 	/* overflow check for multiplication */
 	if (number_of_resources > UINT32_MAX / sizeof(struct drm_amdgpu_bo_list_entry))
 		return -EINVAL;
 
-	list = malloc(number_of_resources * sizeof(struct drm_amdgpu_bo_list_entry));
-	if (!list)
-		return -ENOMEM;
-
-	args.in.operation = AMDGPU_BO_LIST_OP_UPDATE;
-	args.in.list_handle = handle->handle;
-	args.in.bo_number = number_of_resources;
-	args.in.bo_info_size = sizeof(struct drm_amdgpu_bo_list_entry);
-	args.in.bo_info_ptr = (uintptr_t)list;
+	/* The kernel can only replace the whole list, but often the set
+	 * didn't change at all. */
+	keys = amdgpu_bo_list_make_keys(number_of_resources, resources,
+					resource_prios, &hash);
+	if (keys && amdgpu_bo_list_match(handle, number_of_resources, keys,
+					 hash)) {
+		free(keys);
+		return 0;
+	}
 
-	for (i = 0; i < number_of_resources; i++) {
-		list[i].bo_handle = resources[i]->handle;
-		if (resource_prios)
-			list[i].bo_priority = resource_prios[i];
-		else
-			list[i].bo_priority = 0;
+	r = amdgpu_bo_list_ioctl(handle->dev, AMDGPU_BO_LIST_OP_UPDATE,
+				 handle->handle, number_of_resources,
+				 resources, resource_prios, NULL);
+	if (r) {
+		free(keys);
+		return r;
 	}
 
-	r = drmCommandWriteRead(handle->dev->fd, DRM_AMDGPU_BO_LIST,
-				&args, sizeof(args));
-	free(list);
-	return r;
+	free(handle->keys);
+	handle->keys = keys;
+	handle->num_keys = number_of_resources;
+	handle->hash = hash;
+	return 0;
 }
 
 drm_public int amdgpu_bo_va_op(amdgpu_bo_handle bo,
@@ -797,3 +1535,72 @@ drm_public int amdgpu_bo_va_op_raw(amdgpu_device_handle dev,
 
 	return r;
 }
+
+drm_public int amdgpu_bo_va_op_batch(amdgpu_device_handle dev,
+				     const struct amdgpu_va_op *ops,
+				     uint32_t count, uint32_t *completed)
+{
+	struct drm_amdgpu_gem_va va;
+	uint32_t i, j, next;
+	uint64_t addr, size;
+	int r = 0;
+
+	if (completed)
+		*completed = 0;
+	if (NULL == dev || (count && !ops))
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		if (ops[i].op != AMDGPU_VA_OP_MAP &&
+		    ops[i].op != AMDGPU_VA_OP_UNMAP &&
+		    ops[i].op != AMDGPU_VA_OP_REPLACE &&
+		    ops[i].op != AMDGPU_VA_OP_CLEAR)
+			return -EINVAL;
+	}
+
+	memset(&va, 0, sizeof(va));
+	for (i = 0; i < count; i = next) {
+		addr = ops[i].addr;
+		size = ops[i].size;
+		next = i + 1;
+
+		if (ops[i].op == AMDGPU_VA_OP_CLEAR) {
+			/* Clears only deal with ranges, not mappings. */
+			while (next < count &&
+			       ops[next].op == AMDGPU_VA_OP_CLEAR &&
+			       ops[next].addr == addr + size &&
+			       ops[next].flags == ops[i].flags) {
+				size += ops[next].size;
+				next++;
+			}
+
+			/* Replacing a range clears it anyway. */
+			for (j = next; j < count && size; j++) {
+				if (ops[j].op != AMDGPU_VA_OP_REPLACE ||
+				    ops[j].addr != addr || ops[j].size > size)
+					break;
+				addr += ops[j].size;
+				size -= ops[j].size;
+			}
+		}
+
+		/* Unless the replaces took all of the clear. */
+		if (size || addr == ops[i].addr) {
+			va.handle = ops[i].bo ? ops[i].bo->handle : 0;
+			va.operation = ops[i].op;
+			va.flags = ops[i].flags;
+			va.va_address = addr;
+			va.offset_in_bo = ops[i].offset;
+			va.map_size = size;
+
+			r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_GEM_VA, &va,
+						sizeof(va));
+			if (r)
+				break;
+		}
+		if (completed)
+			*completed = next;
+	}
+
+	return r;
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright © 2014 Advanced Micro Devices, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+#define AMDGPU_BO_CACHE_DEFAULT_AGE_MS 1000
+
+static void amdgpu_bo_cache_add_bucket(struct amdgpu_bo_cache *cache,
+				       uint64_t size)
+{
+	unsigned i = cache->num_buckets;
+
+	assert(i < AMDGPU_BO_CACHE_BUCKETS);
+
+	list_inithead(&cache->buckets[i].list);
+	cache->buckets[i].size = size;
+	cache->num_buckets++;
+}
+
+/* Same bucket sizes as the freedreno cache: powers of two would waste too
+ * much memory, so there are three more sizes in between each of them. */
+static void amdgpu_bo_cache_init_buckets(struct amdgpu_bo_cache *cache)
+{
+	uint64_t size;
+
+	list_inithead(&cache->lru);
+	amdgpu_bo_cache_add_bucket(cache, 4096);
+	amdgpu_bo_cache_add_bucket(cache, 4096 * 2);
+	amdgpu_bo_cache_add_bucket(cache, 4096 * 3);
+
+	for (size = 4 * 4096; size <= 64 * 1024 * 1024; size *= 2) {
+		amdgpu_bo_cache_add_bucket(cache, size);
+		amdgpu_bo_cache_add_bucket(cache, size + size * 1 / 4);
+		amdgpu_bo_cache_add_bucket(cache, size + size * 2 / 4);
+		amdgpu_bo_cache_add_bucket(cache, size + size * 3 / 4);
+	}
+}
+
+static struct amdgpu_bo_cache_bucket *
+amdgpu_bo_cache_get_bucket(struct amdgpu_bo_cache *cache, uint64_t size)
+{
+	unsigned i;
+
+	for (i = 0; i < cache->num_buckets; i++) {
+		if (cache->buckets[i].size >= size)
+			return &cache->buckets[i];
+	}
+
+	return NULL;
+}
+
+static uint64_t amdgpu_bo_cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void amdgpu_bo_cache_evict(struct amdgpu_bo_cache *cache,
+				  struct amdgpu_bo *bo)
+{
+	list_del(&bo->cache_list);
+	list_del(&bo->cache_lru);
+	cache->size -= bo->alloc_size;
+	amdgpu_bo_destroy_locked(bo);
+}
+
+/* Free the buffers that stayed idle for too long or don't fit anymore.
+ * Called with bo_table_mutex held. */
+static void amdgpu_bo_cache_cleanup(struct amdgpu_bo_cache *cache,
+				    uint64_t now)
+{
+	struct amdgpu_bo *bo, *tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &cache->lru, cache_lru) {
+		if (cache->size <= cache->max_size &&
+		    now - bo->cache_time <= cache->max_age_ms)
+			break;
+		amdgpu_bo_cache_evict(cache, bo);
+	}
+}
+
+/**
+ * Fill in the cache key of an allocation, rounding its size up to the
+ * bucket size. Returns false if the buffer is not eligible for caching,
+ * e.g. because the cache is off or it has to be cleared, in which case the
+ * key still describes it but with the size unchanged.
+ */
+drm_private bool amdgpu_bo_cache_init_key(struct amdgpu_device *dev,
+					  struct amdgpu_bo_cache_key *key,
+					  struct amdgpu_bo_alloc_request *request,
+					  bool mapped, uint64_t va_flags,
+					  uint64_t vm_flags)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+	struct amdgpu_bo_cache_bucket *bucket;
+	bool reusable;
+
+	memset(key, 0, sizeof(*key));
+	key->size = request->alloc_size;
+	key->alignment = request->phys_alignment;
+	key->flags = request->flags;
+	key->heap = request->preferred_heap;
+	key->mapped = mapped;
+	key->va_flags = va_flags;
+	key->vm_flags = vm_flags;
+
+	/* A recycled buffer keeps its old contents. */
+	if (key->flags & AMDGPU_GEM_CREATE_VRAM_CLEARED ||
+	    key->heap & ~(AMDGPU_GEM_DOMAIN_CPU | AMDGPU_GEM_DOMAIN_GTT |
+			  AMDGPU_GEM_DOMAIN_VRAM))
+		return false;
+
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	reusable = cache->max_size != 0;
+	bucket = reusable ? amdgpu_bo_cache_get_bucket(cache, key->size) : NULL;
+	if (bucket)
+		key->size = bucket->size;
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+
+	return bucket != NULL;
+}
+
+static bool amdgpu_bo_cache_key_equal(const struct amdgpu_bo_cache_key *a,
+				      const struct amdgpu_bo_cache_key *b)
+{
+	return a->size == b->size && a->alignment == b->alignment &&
+	       a->flags == b->flags && a->heap == b->heap &&
+	       a->mapped == b->mapped && a->va_flags == b->va_flags &&
+	       a->vm_flags == b->vm_flags;
+}
+
+/**
+ * Take an idle buffer matching key out of the cache, or return NULL.
+ */
+drm_private struct amdgpu_bo *
+amdgpu_bo_cache_take(struct amdgpu_device *dev,
+		     const struct amdgpu_bo_cache_key *key)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+	struct amdgpu_bo_cache_bucket *bucket;
+	struct amdgpu_bo *bo, *found = NULL;
+	bool busy;
+
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	if (!cache->max_size)
+		goto out;
+
+	amdgpu_bo_cache_cleanup(cache, amdgpu_bo_cache_now());
+
+	bucket = amdgpu_bo_cache_get_bucket(cache, key->size);
+	if (!bucket)
+		goto out;
+
+	/* The least recently freed buffer is the most likely to be idle, if
+	 * even that one is busy the others are as well. */
+	LIST_FOR_EACH_ENTRY(bo, &bucket->list, cache_list) {
+		if (!amdgpu_bo_cache_key_equal(&bo->cache_key, key))
+			continue;
+		if (amdgpu_bo_wait_for_idle(bo, 0, &busy) || busy)
+			break;
+		found = bo;
+		break;
+	}
+	if (!found)
+		goto out;
+
+	list_del(&found->cache_list);
+	list_del(&found->cache_lru);
+	cache->size -= found->alloc_size;
+
+	/* The table never shrinks, so this can't run out of memory. */
+	if (handle_table_insert(&dev->bo_handles, found->handle, found)) {
+		amdgpu_bo_destroy_locked(found);
+		found = NULL;
+		goto out;
+	}
+	atomic_set(&found->refcount, 1);
+	found->label = 0;
+	util_bo_labels_alloc(&dev->bo_labels, 0, found->label_heap,
+			     found->alloc_size);
+
+out:
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+	if (found)
+		UTIL_TRACE_EVENT("bo_cache_hit", "amdgpu handle=%u size=%" PRIu64,
+				 found->handle, found->alloc_size);
+	return found;
+}
+
+/**
+ * Keep a buffer whose last reference is gone for reuse, returns false if
+ * it has to be freed instead. Called with bo_table_mutex held, after the
+ * buffer was removed from the handle tables and unmapped from the CPU.
+ */
+drm_private bool amdgpu_bo_cache_put(struct amdgpu_bo *bo)
+{
+	struct amdgpu_bo_cache *cache = &bo->dev->bo_cache;
+	struct amdgpu_bo_cache_bucket *bucket;
+
+	if (!cache->max_size || !bo->reusable || bo->flink_name ||
+	    bo->alloc_size > cache->max_size)
+		return false;
+
+	bucket = amdgpu_bo_cache_get_bucket(cache, bo->alloc_size);
+	if (!bucket || bucket->size != bo->alloc_size)
+		return false;
+
+	bo->cache_time = amdgpu_bo_cache_now();
+	list_addtail(&bo->cache_list, &bucket->list);
+	list_addtail(&bo->cache_lru, &cache->lru);
+	cache->size += bo->alloc_size;
+	amdgpu_bo_cache_cleanup(cache, bo->cache_time);
+	return true;
+}
+
+drm_private void amdgpu_bo_cache_fini(struct amdgpu_device *dev)
+{
+	struct amdgpu_bo_cache *cache = &dev->bo_cache;
+	struct amdgpu_bo *bo, *tmp;
+
+	if (!cache->num_buckets)
+		return;
+
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &cache->lru, cache_lru)
+		amdgpu_bo_cache_evict(cache, bo);
+	cache->max_size = 0;
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+}
+
+drm_public int amdgpu_bo_cache_enable(amdgpu_device_handle dev,
+				      uint64_t max_size, uint32_t max_age_ms)
+{
+	struct amdgpu_bo_cache *cache;
+
+	if (NULL == dev)
+		return -EINVAL;
+
+	cache = &dev->bo_cache;
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	if (!cache->num_buckets)
+		amdgpu_bo_cache_init_buckets(cache);
+	cache->max_size = max_size;
+	cache->max_age_ms = max_age_ms ? max_age_ms :
+				AMDGPU_BO_CACHE_DEFAULT_AGE_MS;
+	amdgpu_bo_cache_cleanup(cache, amdgpu_bo_cache_now());
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+	return 0;
+}
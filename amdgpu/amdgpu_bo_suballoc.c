@@ -0,0 +1,334 @@
+/*
+ * Copyright © 2014 Advanced Micro Devices, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libdrm_macros.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+/* Power of two size classes from 64 bytes to 64 KiB. */
+#define AMDGPU_SUBALLOC_MIN_SHIFT	6
+#define AMDGPU_SUBALLOC_CLASSES		11
+/* Bounds the bookkeeping of the small classes. */
+#define AMDGPU_SUBALLOC_MAX_ENTRIES	512
+#define AMDGPU_SUBALLOC_DEFAULT_SLAB	(1024 * 1024)
+
+struct amdgpu_bo_slab;
+
+struct amdgpu_bo_suballoc {
+	struct amdgpu_bo_slab *slab;
+	/* Next free or pending entry. */
+	struct amdgpu_bo_suballoc *next;
+	/* Fence to wait for while pending. */
+	struct amdgpu_cs_fence fence;
+};
+
+struct amdgpu_bo_slab {
+	struct list_head list;
+	struct amdgpu_bo_suballocator *allocator;
+	amdgpu_bo_handle bo;
+	uint64_t va;
+	unsigned class;
+	unsigned num_entries;
+	unsigned num_free;
+	struct amdgpu_bo_suballoc *free;
+	struct amdgpu_bo_suballoc entries[];
+};
+
+struct amdgpu_bo_suballocator {
+	amdgpu_device_handle dev;
+	pthread_mutex_t lock;
+	uint32_t heap;
+	uint64_t flags;
+	uint64_t vm_flags;
+	uint64_t slab_size;
+	/* Slabs with free entries first, full ones at the tail. */
+	struct list_head slabs[AMDGPU_SUBALLOC_CLASSES];
+	/* Entries freed with a fence, oldest first. */
+	struct amdgpu_bo_suballoc *pending;
+	struct amdgpu_bo_suballoc **pending_tail;
+};
+
+static uint64_t amdgpu_suballoc_class_size(unsigned class)
+{
+	return 1ull << (AMDGPU_SUBALLOC_MIN_SHIFT + class);
+}
+
+static uint64_t amdgpu_suballoc_slab_size(struct amdgpu_bo_suballocator *sa,
+					  unsigned class)
+{
+	return MIN2(sa->slab_size,
+		    amdgpu_suballoc_class_size(class) *
+		    AMDGPU_SUBALLOC_MAX_ENTRIES);
+}
+
+static void amdgpu_suballoc_put(struct amdgpu_bo_suballocator *sa,
+				struct amdgpu_bo_suballoc *entry)
+{
+	struct amdgpu_bo_slab *slab = entry->slab;
+
+	entry->next = slab->free;
+	slab->free = entry;
+
+	/* Back among the slabs with room. */
+	if (!slab->num_free++) {
+		list_del(&slab->list);
+		list_add(&slab->list, &sa->slabs[slab->class]);
+	}
+}
+
+static bool amdgpu_suballoc_same_fence(const struct amdgpu_cs_fence *a,
+				       const struct amdgpu_cs_fence *b)
+{
+	return a->context == b->context && a->ip_type == b->ip_type &&
+	       a->ip_instance == b->ip_instance && a->ring == b->ring &&
+	       a->fence == b->fence;
+}
+
+static void amdgpu_suballoc_free_slab(struct amdgpu_bo_slab *slab)
+{
+	list_del(&slab->list);
+	amdgpu_bo_free(slab->bo);
+	free(slab);
+}
+
+/* Release the pending entries whose fence signaled, keeping at most one
+ * completely free slab per class. */
+static void amdgpu_suballoc_reclaim(struct amdgpu_bo_suballocator *sa)
+{
+	struct amdgpu_bo_suballoc *entry, **link = &sa->pending;
+	struct amdgpu_cs_fence last = {0};
+	uint32_t expired = 0;
+	unsigned class;
+
+	while ((entry = *link)) {
+		/* Consecutive frees usually wait for the same submission. */
+		if (!amdgpu_suballoc_same_fence(&entry->fence, &last)) {
+			last = entry->fence;
+			if (amdgpu_cs_query_fence_status(&last, 0, 0, &expired))
+				expired = 0;
+		}
+		if (!expired) {
+			link = &entry->next;
+			continue;
+		}
+		*link = entry->next;
+		amdgpu_suballoc_put(sa, entry);
+	}
+	sa->pending_tail = link;
+
+	for (class = 0; class < AMDGPU_SUBALLOC_CLASSES; class++) {
+		struct amdgpu_bo_slab *slab, *tmp;
+		bool have_empty = false;
+
+		LIST_FOR_EACH_ENTRY_SAFE(slab, tmp, &sa->slabs[class], list) {
+			if (!slab->num_free)
+				break;
+			if (slab->num_free != slab->num_entries)
+				continue;
+			if (have_empty)
+				amdgpu_suballoc_free_slab(slab);
+			have_empty = true;
+		}
+	}
+}
+
+static struct amdgpu_bo_slab *
+amdgpu_suballoc_new_slab(struct amdgpu_bo_suballocator *sa, unsigned class)
+{
+	struct amdgpu_bo_alloc_request request = {};
+	uint64_t entry_size = amdgpu_suballoc_class_size(class);
+	struct amdgpu_bo_slab *slab;
+	unsigned i, num_entries;
+	int r;
+
+	request.alloc_size = amdgpu_suballoc_slab_size(sa, class);
+	request.phys_alignment = MAX2(entry_size, 4096);
+	request.preferred_heap = sa->heap;
+	request.flags = sa->flags;
+	num_entries = request.alloc_size / entry_size;
+
+	slab = calloc(1, sizeof(*slab) + num_entries * sizeof(slab->entries[0]));
+	if (!slab)
+		return NULL;
+
+	r = amdgpu_bo_alloc_mapped(sa->dev, &request, 0, sa->vm_flags,
+				   &slab->bo, &slab->va);
+	if (r) {
+		free(slab);
+		return NULL;
+	}
+
+	slab->allocator = sa;
+	slab->class = class;
+	slab->num_entries = num_entries;
+	slab->num_free = num_entries;
+	for (i = num_entries; i-- > 0;) {
+		slab->entries[i].slab = slab;
+		slab->entries[i].next = slab->free;
+		slab->free = &slab->entries[i];
+	}
+	list_add(&slab->list, &sa->slabs[class]);
+	return slab;
+}
+
+drm_public int
+amdgpu_bo_suballocator_create(amdgpu_device_handle dev, uint32_t heap,
+			      uint64_t flags, uint64_t vm_flags,
+			      uint64_t slab_size,
+			      amdgpu_bo_suballocator_handle *allocator)
+{
+	struct amdgpu_bo_suballocator *sa;
+	unsigned class;
+
+	if (NULL == dev)
+		return -EINVAL;
+
+	if (!slab_size)
+		slab_size = AMDGPU_SUBALLOC_DEFAULT_SLAB;
+	/* The largest class needs at least two entries per slab. */
+	if (slab_size & (slab_size - 1) ||
+	    slab_size < 2 * amdgpu_suballoc_class_size(AMDGPU_SUBALLOC_CLASSES - 1))
+		return -EINVAL;
+
+	sa = calloc(1, sizeof(*sa));
+	if (!sa)
+		return -ENOMEM;
+
+	sa->dev = dev;
+	sa->heap = heap;
+	sa->flags = flags;
+	sa->vm_flags = vm_flags;
+	sa->slab_size = slab_size;
+	pthread_mutex_init(&sa->lock, NULL);
+	for (class = 0; class < AMDGPU_SUBALLOC_CLASSES; class++)
+		list_inithead(&sa->slabs[class]);
+	sa->pending_tail = &sa->pending;
+
+	*allocator = sa;
+	return 0;
+}
+
+drm_public int
+amdgpu_bo_suballocator_destroy(amdgpu_bo_suballocator_handle allocator)
+{
+	struct amdgpu_bo_slab *slab, *tmp;
+	unsigned class;
+
+	if (!allocator)
+		return -EINVAL;
+
+	for (class = 0; class < AMDGPU_SUBALLOC_CLASSES; class++) {
+		LIST_FOR_EACH_ENTRY_SAFE(slab, tmp, &allocator->slabs[class],
+					 list)
+			amdgpu_suballoc_free_slab(slab);
+	}
+	pthread_mutex_destroy(&allocator->lock);
+	free(allocator);
+	return 0;
+}
+
+drm_public int
+amdgpu_bo_suballoc_alloc(amdgpu_bo_suballocator_handle allocator,
+			 uint64_t size, uint64_t alignment,
+			 amdgpu_bo_suballoc_handle *suballoc,
+			 amdgpu_bo_handle *bo, uint64_t *offset,
+			 uint64_t *va)
+{
+	struct amdgpu_bo_suballoc *entry;
+	struct amdgpu_bo_slab *slab;
+	unsigned class;
+	uint64_t entry_size;
+
+	if (!allocator || !size)
+		return -EINVAL;
+
+	/* Entries are naturally aligned to their size. */
+	size = MAX2(size, alignment);
+	for (class = 0; class < AMDGPU_SUBALLOC_CLASSES; class++) {
+		if (amdgpu_suballoc_class_size(class) >= size)
+			break;
+	}
+	if (class == AMDGPU_SUBALLOC_CLASSES)
+		return -EINVAL;
+	entry_size = amdgpu_suballoc_class_size(class);
+
+	pthread_mutex_lock(&allocator->lock);
+	slab = LIST_ENTRY(struct amdgpu_bo_slab,
+			  allocator->slabs[class].next, list);
+	if (LIST_IS_EMPTY(&allocator->slabs[class]) || !slab->num_free) {
+		amdgpu_suballoc_reclaim(allocator);
+		slab = LIST_ENTRY(struct amdgpu_bo_slab,
+				  allocator->slabs[class].next, list);
+		if (LIST_IS_EMPTY(&allocator->slabs[class]) || !slab->num_free)
+			slab = amdgpu_suballoc_new_slab(allocator, class);
+		if (!slab) {
+			pthread_mutex_unlock(&allocator->lock);
+			return -ENOMEM;
+		}
+	}
+
+	entry = slab->free;
+	slab->free = entry->next;
+	entry->next = NULL;
+
+	/* Full slabs go to the tail, so the head always has room if any. */
+	if (!--slab->num_free) {
+		list_del(&slab->list);
+		list_addtail(&slab->list, &allocator->slabs[class]);
+	}
+	pthread_mutex_unlock(&allocator->lock);
+
+	*suballoc = entry;
+	*bo = slab->bo;
+	*offset = (entry - slab->entries) * entry_size;
+	*va = slab->va + *offset;
+	return 0;
+}
+
+drm_public int amdgpu_bo_suballoc_free(amdgpu_bo_suballoc_handle suballoc,
+				       const struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_bo_suballocator *sa;
+
+	if (!suballoc)
+		return -EINVAL;
+
+	sa = suballoc->slab->allocator;
+	pthread_mutex_lock(&sa->lock);
+	if (fence && fence->fence != AMDGPU_NULL_SUBMIT_SEQ) {
+		suballoc->fence = *fence;
+		suballoc->next = NULL;
+		*sa->pending_tail = suballoc;
+		sa->pending_tail = &suballoc->next;
+	} else {
+		amdgpu_suballoc_put(sa, suballoc);
+	}
+	pthread_mutex_unlock(&sa->lock);
+	return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * Copyright © 2014 Advanced Micro Devices, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+/* The heaps tracked, in AMDGPU_BO_LABEL_HEAP_* order. */
+#define AMDGPU_BUDGET_HEAPS	2
+
+struct amdgpu_budget_heap {
+	uint64_t heap_size;
+	uint64_t heap_usage;
+	/* dev->heap_bytes when heap_usage was read. */
+	uint64_t process_usage;
+};
+
+struct amdgpu_budget_tracker {
+	amdgpu_device_handle dev;
+	uint64_t period_ns;
+	uint32_t high_percent;
+	uint32_t low_percent;
+	amdgpu_budget_callback callback;
+	void *data;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+
+	/* Seqlock of the heaps, written by the refresh thread only. */
+	uint32_t seq;
+	struct amdgpu_budget_heap heaps[AMDGPU_BUDGET_HEAPS];
+	/* Heaps past the high watermark, only used by the refresh thread. */
+	uint32_t over;
+};
+
+static uint64_t amdgpu_budget_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t amdgpu_budget_domain(unsigned heap)
+{
+	return heap == AMDGPU_BO_LABEL_HEAP_VRAM ? AMDGPU_GEM_DOMAIN_VRAM :
+						   AMDGPU_GEM_DOMAIN_GTT;
+}
+
+/* The other processes and the kernel keep the usage they had at the last
+ * refresh, the process usage is current. */
+static void amdgpu_budget_compute(struct amdgpu_budget_tracker *t,
+				  const struct amdgpu_budget_heap *heap,
+				  unsigned index,
+				  struct amdgpu_heap_budget *budget)
+{
+	uint64_t others = heap->heap_usage > heap->process_usage ?
+			  heap->heap_usage - heap->process_usage : 0;
+
+	budget->heap_size = heap->heap_size;
+	budget->process_usage =
+		__atomic_load_n(&t->dev->heap_bytes[index], __ATOMIC_RELAXED);
+	budget->heap_usage = others + budget->process_usage;
+	budget->budget = heap->heap_size > others ? heap->heap_size - others : 0;
+}
+
+static void amdgpu_budget_refresh(struct amdgpu_budget_tracker *t)
+{
+	struct amdgpu_budget_heap heaps[AMDGPU_BUDGET_HEAPS];
+	struct amdgpu_heap_budget budget;
+	struct amdgpu_heap_info info;
+	uint32_t seq = t->seq;
+	unsigned i;
+	bool over;
+
+	memcpy(heaps, t->heaps, sizeof(heaps));
+	for (i = 0; i < AMDGPU_BUDGET_HEAPS; i++) {
+		/* The process usage is read first, so that a buffer allocated
+		 * meanwhile is at worst counted twice, never missed. */
+		heaps[i].process_usage =
+			__atomic_load_n(&t->dev->heap_bytes[i], __ATOMIC_RELAXED);
+		if (amdgpu_query_heap_info(t->dev, amdgpu_budget_domain(i), 0,
+					   &info))
+			continue;
+		heaps[i].heap_size = info.heap_size;
+		heaps[i].heap_usage = info.heap_usage;
+	}
+
+	__atomic_store_n(&t->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(t->heaps, heaps, sizeof(heaps));
+	__atomic_store_n(&t->seq, seq + 2, __ATOMIC_RELEASE);
+
+	if (!t->callback)
+		return;
+
+	for (i = 0; i < AMDGPU_BUDGET_HEAPS; i++) {
+		amdgpu_budget_compute(t, &heaps[i], i, &budget);
+		if (!budget.budget)
+			continue;
+
+		if (t->over & (1u << i))
+			over = budget.process_usage * 100 >
+			       budget.budget * t->low_percent;
+		else
+			over = budget.process_usage * 100 >
+			       budget.budget * t->high_percent;
+		if (over == !!(t->over & (1u << i)))
+			continue;
+
+		t->over ^= 1u << i;
+		t->callback(t->data, amdgpu_budget_domain(i), &budget, over);
+	}
+}
+
+static void *amdgpu_budget_thread(void *data)
+{
+	struct amdgpu_budget_tracker *t = data;
+	uint64_t next = amdgpu_budget_now();
+	struct timespec ts;
+
+	pthread_mutex_lock(&t->lock);
+	while (!t->stop) {
+		pthread_mutex_unlock(&t->lock);
+		amdgpu_budget_refresh(t);
+
+		/* Don't try to catch up after falling behind. */
+		next = MAX2(next + t->period_ns, amdgpu_budget_now());
+		ts.tv_sec = next / 1000000000ull;
+		ts.tv_nsec = next % 1000000000ull;
+
+		pthread_mutex_lock(&t->lock);
+		while (!t->stop &&
+		       pthread_cond_timedwait(&t->cond, &t->lock, &ts) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&t->lock);
+	return NULL;
+}
+
+drm_public int
+amdgpu_budget_tracker_create(amdgpu_device_handle dev, uint32_t period_us,
+			     uint32_t high_percent, uint32_t low_percent,
+			     amdgpu_budget_callback callback, void *data,
+			     amdgpu_budget_tracker_handle *tracker)
+{
+	struct amdgpu_budget_tracker *t;
+	pthread_condattr_t attr;
+	int r;
+
+	if (NULL == dev || !tracker || !period_us ||
+	    (callback && (low_percent > high_percent || !high_percent)))
+		return -EINVAL;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	t->dev = dev;
+	t->period_ns = period_us * 1000ull;
+	t->high_percent = high_percent;
+	t->low_percent = low_percent;
+	t->callback = callback;
+	t->data = data;
+
+	/* Budgets are valid as soon as the tracker exists. */
+	amdgpu_budget_refresh(t);
+
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	r = -pthread_create(&t->thread, NULL, amdgpu_budget_thread, t);
+	if (r) {
+		pthread_cond_destroy(&t->cond);
+		pthread_mutex_destroy(&t->lock);
+		free(t);
+		return r;
+	}
+
+	*tracker = t;
+	return 0;
+}
+
+drm_public int
+amdgpu_budget_tracker_destroy(amdgpu_budget_tracker_handle tracker)
+{
+	if (!tracker)
+		return -EINVAL;
+
+	pthread_mutex_lock(&tracker->lock);
+	tracker->stop = true;
+	pthread_cond_signal(&tracker->cond);
+	pthread_mutex_unlock(&tracker->lock);
+	pthread_join(tracker->thread, NULL);
+
+	pthread_cond_destroy(&tracker->cond);
+	pthread_mutex_destroy(&tracker->lock);
+	free(tracker);
+	return 0;
+}
+
+drm_public int amdgpu_query_budget(amdgpu_budget_tracker_handle tracker,
+				   uint32_t heap,
+				   struct amdgpu_heap_budget *budget)
+{
+	struct amdgpu_budget_heap snapshot;
+	unsigned index;
+	uint32_t seq;
+
+	if (!tracker || !budget)
+		return -EINVAL;
+
+	switch (heap) {
+	case AMDGPU_GEM_DOMAIN_VRAM:
+		index = AMDGPU_BO_LABEL_HEAP_VRAM;
+		break;
+	case AMDGPU_GEM_DOMAIN_GTT:
+		index = AMDGPU_BO_LABEL_HEAP_GTT;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	do {
+		seq = __atomic_load_n(&tracker->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		snapshot = tracker->heaps[index];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq & 1 ||
+		 __atomic_load_n(&tracker->seq, __ATOMIC_RELAXED) != seq);
+
+	amdgpu_budget_compute(tracker, &snapshot, index, budget);
+	return 0;
+}
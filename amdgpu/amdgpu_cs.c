@@ -28,6 +28,7 @@
 #include <pthread.h>
 #include <sched.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
 #if HAVE_ALLOCA_H
 # include <alloca.h>
 #endif
@@ -35,10 +36,32 @@
 #include "xf86drm.h"
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
+#include "util_math.h"
 
 static int amdgpu_cs_unreference_sem(amdgpu_semaphore_handle sem);
 static int amdgpu_cs_reset_sem(amdgpu_semaphore_handle sem);
 
+/* Drop the semaphores waited on for a ring. The lists are only
+ * initialized when a first semaphore is added, see amdgpu_cs_wait_semaphore(). */
+static void amdgpu_cs_drop_sems(amdgpu_context_handle context,
+				unsigned ip_type, unsigned ip_instance,
+				uint32_t ring)
+{
+	amdgpu_semaphore_handle sem, tmp;
+
+	if (!context->sem_count[ip_type][ip_instance][ring])
+		return;
+
+	LIST_FOR_EACH_ENTRY_SAFE(sem, tmp,
+				 &context->sem_list[ip_type][ip_instance][ring],
+				 list) {
+		list_del(&sem->list);
+		amdgpu_cs_reset_sem(sem);
+		amdgpu_cs_unreference_sem(sem);
+	}
+	context->sem_count[ip_type][ip_instance][ring] = 0;
+}
+
 /**
  * Create command submission context
  *
@@ -54,7 +77,6 @@ drm_public int amdgpu_cs_ctx_create2(amdgpu_device_handle dev,
 {
 	struct amdgpu_context *gpu_context;
 	union drm_amdgpu_ctx args;
-	int i, j, k;
 	int r;
 
 	if (!dev || !context)
@@ -80,10 +102,7 @@ drm_public int amdgpu_cs_ctx_create2(amdgpu_device_handle dev,
 		goto error;
 
 	gpu_context->id = args.out.alloc.ctx_id;
-	for (i = 0; i < AMDGPU_HW_IP_NUM; i++)
-		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++)
-			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++)
-				list_inithead(&gpu_context->sem_list[i][j][k]);
+	gpu_context->priority = priority;
 	*context = (amdgpu_context_handle)gpu_context;
 
 	return 0;
@@ -128,11 +147,13 @@ drm_public int amdgpu_cs_ctx_free(amdgpu_context_handle context)
 	for (i = 0; i < AMDGPU_HW_IP_NUM; i++) {
 		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++) {
 			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++) {
-				amdgpu_semaphore_handle sem;
-				LIST_FOR_EACH_ENTRY(sem, &context->sem_list[i][j][k], list) {
-					list_del(&sem->list);
-					amdgpu_cs_reset_sem(sem);
-					amdgpu_cs_unreference_sem(sem);
+				amdgpu_cs_drop_sems(context, i, j, k);
+				if (context->timeline[i][j][k])
+					drmSyncobjDestroy(context->dev->fd,
+							  context->timeline[i][j][k]);
+				if (context->user_fence[i][j][k].bo) {
+					amdgpu_bo_cpu_unmap(context->user_fence[i][j][k].bo);
+					amdgpu_bo_free(context->user_fence[i][j][k].bo);
 				}
 			}
 		}
@@ -142,6 +163,93 @@ drm_public int amdgpu_cs_ctx_free(amdgpu_context_handle context)
 	return r;
 }
 
+/* Whether the GPU was reset since the context was created, which the
+ * context keeps reporting. */
+static bool amdgpu_cs_ctx_reset_seen(amdgpu_context_handle context)
+{
+	uint64_t flags;
+
+	if (amdgpu_cs_query_reset_state2(context, &flags))
+		return true;
+	return flags & (AMDGPU_CTX_QUERY2_FLAGS_RESET |
+			AMDGPU_CTX_QUERY2_FLAGS_VRAMLOST |
+			AMDGPU_CTX_QUERY2_FLAGS_GUILTY);
+}
+
+drm_public int amdgpu_cs_ctx_pool_get(amdgpu_device_handle dev,
+				      uint32_t priority,
+				      amdgpu_context_handle *context)
+{
+	struct amdgpu_context *ctx, *found;
+
+	if (!dev || !context)
+		return -EINVAL;
+
+	do {
+		found = NULL;
+		pthread_mutex_lock(&dev->ctx_pool_mutex);
+		LIST_FOR_EACH_ENTRY(ctx, &dev->ctx_pool, pool_link) {
+			if (ctx->priority == (int32_t)priority) {
+				list_del(&ctx->pool_link);
+				dev->num_ctx_pool--;
+				found = ctx;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&dev->ctx_pool_mutex);
+
+		if (found && !amdgpu_cs_ctx_reset_seen(found)) {
+			*context = found;
+			return 0;
+		}
+		if (found)
+			amdgpu_cs_ctx_free(found);
+	} while (found);
+
+	return amdgpu_cs_ctx_create2(dev, priority, context);
+}
+
+drm_public int amdgpu_cs_ctx_pool_put(amdgpu_context_handle context)
+{
+	struct amdgpu_device *dev;
+	int i, j, k;
+
+	if (!context)
+		return -EINVAL;
+
+	/* Points of the timelines can't be restarted. */
+	if (context->timelines)
+		return amdgpu_cs_ctx_free(context);
+
+	for (i = 0; i < AMDGPU_HW_IP_NUM; i++)
+		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++)
+			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++)
+				amdgpu_cs_drop_sems(context, i, j, k);
+	context->fence_spin_ns = 0;
+
+	dev = context->dev;
+	pthread_mutex_lock(&dev->ctx_pool_mutex);
+	if (dev->num_ctx_pool >= AMDGPU_CTX_POOL_SIZE) {
+		pthread_mutex_unlock(&dev->ctx_pool_mutex);
+		return amdgpu_cs_ctx_free(context);
+	}
+	list_add(&context->pool_link, &dev->ctx_pool);
+	dev->num_ctx_pool++;
+	pthread_mutex_unlock(&dev->ctx_pool_mutex);
+	return 0;
+}
+
+drm_private void amdgpu_cs_ctx_pool_fini(struct amdgpu_device *dev)
+{
+	struct amdgpu_context *ctx, *tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(ctx, tmp, &dev->ctx_pool, pool_link) {
+		list_del(&ctx->pool_link);
+		amdgpu_cs_ctx_free(ctx);
+	}
+	dev->num_ctx_pool = 0;
+}
+
 drm_public int amdgpu_cs_ctx_override_priority(amdgpu_device_handle dev,
                                                amdgpu_context_handle context,
                                                int master_fd,
@@ -207,73 +315,338 @@ drm_public int amdgpu_cs_query_reset_state2(amdgpu_context_handle context,
 	return r;
 }
 
+static void amdgpu_cs_fill_dep(struct drm_amdgpu_cs_chunk_dep *dep,
+			       const struct amdgpu_cs_fence *info)
+{
+	dep->ip_type = info->ip_type;
+	dep->ip_instance = info->ip_instance;
+	dep->ring = info->ring;
+	dep->ctx_id = info->context->id;
+	dep->handle = info->fence;
+}
+
+/* Turn the semaphores waited on for a ring into dependencies, deps must
+ * have room for the number counted in sem_count. Called with
+ * sequence_mutex held. */
+static uint32_t amdgpu_cs_take_sems(amdgpu_context_handle context,
+				    unsigned ip_type, unsigned ip_instance,
+				    uint32_t ring,
+				    struct drm_amdgpu_cs_chunk_dep *deps)
+{
+	struct list_head *sem_list = &context->sem_list[ip_type][ip_instance][ring];
+	amdgpu_semaphore_handle sem;
+	uint32_t count = 0;
+
+	LIST_FOR_EACH_ENTRY(sem, sem_list, list)
+		amdgpu_cs_fill_dep(&deps[count++], &sem->signal_fence);
+	amdgpu_cs_drop_sems(context, ip_type, ip_instance, ring);
+
+	return count;
+}
+
+/* Timeline syncobj of the ring a fence belongs to, 0 if it has none yet. */
+static uint32_t amdgpu_cs_fence_timeline(const struct amdgpu_cs_fence *fence)
+{
+	if (fence->ip_type >= AMDGPU_HW_IP_NUM ||
+	    fence->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT ||
+	    fence->ring >= AMDGPU_CS_MAX_RINGS)
+		return 0;
+
+	return __atomic_load_n(&fence->context->timeline[fence->ip_type][fence->ip_instance][fence->ring],
+			       __ATOMIC_ACQUIRE);
+}
+
+/* Turn fences into dependencies, those of contexts using timelines are
+ * waited for as timeline points. */
+static void amdgpu_cs_fill_deps(const struct amdgpu_cs_fence *fences,
+				uint32_t count,
+				struct drm_amdgpu_cs_chunk_dep *deps,
+				uint32_t *num_deps,
+				struct drm_amdgpu_cs_chunk_syncobj *waits,
+				uint32_t *num_waits)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		if (fences[i].context->timelines) {
+			struct drm_amdgpu_cs_chunk_syncobj *wait =
+				&waits[(*num_waits)++];
+
+			wait->handle = amdgpu_cs_fence_timeline(&fences[i]);
+			wait->flags = 0;
+			wait->point = fences[i].fence;
+		} else {
+			amdgpu_cs_fill_dep(&deps[(*num_deps)++], &fences[i]);
+		}
+	}
+}
+
+/* Timeline syncobj of a ring, created on first use. Called with
+ * sequence_mutex held. */
+static int amdgpu_cs_get_timeline_locked(amdgpu_context_handle context,
+					 unsigned ip_type,
+					 unsigned ip_instance, uint32_t ring,
+					 uint32_t *syncobj)
+{
+	uint32_t *timeline = &context->timeline[ip_type][ip_instance][ring];
+	int r;
+
+	if (!*timeline) {
+		r = drmSyncobjCreate(context->dev->fd, 0, syncobj);
+		if (r)
+			return r;
+		__atomic_store_n(timeline, *syncobj, __ATOMIC_RELEASE);
+	}
+	*syncobj = *timeline;
+	return 0;
+}
+
+/* Fill in the next point to signal on the timeline of a ring, the
+ * submission has to be made before sequence_mutex is dropped so that the
+ * points are added in order. */
+static int amdgpu_cs_timeline_signal(amdgpu_context_handle context,
+				     unsigned ip_type, unsigned ip_instance,
+				     uint32_t ring,
+				     struct drm_amdgpu_cs_chunk_syncobj *signal)
+{
+	int r;
+
+	r = amdgpu_cs_get_timeline_locked(context, ip_type, ip_instance, ring,
+					  &signal->handle);
+	if (r)
+		return r;
+
+	signal->flags = 0;
+	signal->point = context->last_seq[ip_type][ip_instance][ring] + 1;
+	return 0;
+}
+
+drm_public int amdgpu_cs_ctx_enable_timelines(amdgpu_context_handle context)
+{
+	int i, j, k;
+	int r = 0;
+
+	if (!context)
+		return -EINVAL;
+
+	pthread_mutex_lock(&context->sequence_mutex);
+	/* Sequence numbers and points can't be told apart. */
+	for (i = 0; i < AMDGPU_HW_IP_NUM; i++)
+		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++)
+			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++)
+				if (context->last_seq[i][j][k] ||
+				    context->sem_count[i][j][k])
+					r = -EBUSY;
+	if (!r)
+		context->timelines = true;
+	pthread_mutex_unlock(&context->sequence_mutex);
+	return r;
+}
+
+drm_public int amdgpu_cs_ctx_get_timeline(amdgpu_context_handle context,
+					  uint32_t ip_type,
+					  uint32_t ip_instance,
+					  uint32_t ring,
+					  uint32_t *syncobj)
+{
+	int r;
+
+	if (!context || !syncobj || !context->timelines)
+		return -EINVAL;
+	if (ip_type >= AMDGPU_HW_IP_NUM ||
+	    ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT ||
+	    ring >= AMDGPU_CS_MAX_RINGS)
+		return -EINVAL;
+
+	pthread_mutex_lock(&context->sequence_mutex);
+	r = amdgpu_cs_get_timeline_locked(context, ip_type, ip_instance, ring,
+					  syncobj);
+	pthread_mutex_unlock(&context->sequence_mutex);
+	return r;
+}
+
+static int amdgpu_cs_submit_chunk_array(amdgpu_context_handle context,
+					uint32_t bo_list_handle,
+					uint32_t num_chunks,
+					uint64_t *chunk_array,
+					uint64_t *seq_no)
+{
+	union drm_amdgpu_cs cs;
+	int r;
+
+	memset(&cs, 0, sizeof(cs));
+	cs.in.chunks = (uint64_t)(uintptr_t)chunk_array;
+	cs.in.ctx_id = context->id;
+	cs.in.bo_list_handle = bo_list_handle;
+	cs.in.num_chunks = num_chunks;
+	UTIL_TRACE_BEGIN("amdgpu_cs_submit", "ctx=%u chunks=%u", context->id,
+			 num_chunks);
+	r = drmCommandWriteRead(context->dev->fd, DRM_AMDGPU_CS,
+				&cs, sizeof(cs));
+	UTIL_TRACE_END();
+	if (!r && seq_no)
+		*seq_no = cs.out.handle;
+	return r;
+}
+
+/* Submissions to the same ring may complete the ioctl in any order once
+ * the mutex isn't held across it, so only ever move last_seq forward.
+ *
+ * Sequence numbers of a ring are consecutive, so the user fence covers a
+ * range as long as each submission that extends it directly follows the
+ * previous one. Anything else starts a new range, or ends it. */
+static void amdgpu_cs_update_last_seq(amdgpu_context_handle context,
+				      unsigned ip_type, unsigned ip_instance,
+				      uint32_t ring, uint64_t seq_no,
+				      const struct amdgpu_cs_fence_info *fence_info)
+{
+	uint64_t *last_seq = &context->last_seq[ip_type][ip_instance][ring];
+	struct amdgpu_cs_user_fence *uf =
+		&context->user_fence[ip_type][ip_instance][ring];
+	amdgpu_bo_handle bo = NULL;
+	void *cpu;
+
+	pthread_mutex_lock(&context->sequence_mutex);
+	if (*last_seq < seq_no)
+		*last_seq = seq_no;
+
+	if (fence_info && fence_info->handle == uf->bo) {
+		if (uf->first_seq && fence_info->offset == uf->offset &&
+		    seq_no == uf->last_seq + 1) {
+			uf->last_seq = seq_no;
+		} else if (seq_no == *last_seq) {
+			uf->offset = fence_info->offset;
+			uf->first_seq = uf->last_seq = seq_no;
+		} else {
+			uf->first_seq = 0;
+		}
+		pthread_mutex_unlock(&context->sequence_mutex);
+		return;
+	}
+
+	/* Switch to the new fence BO, mapping it outside of the lock. */
+	uf->first_seq = 0;
+	if (fence_info) {
+		bo = uf->bo;
+		uf->bo = NULL;
+	}
+	pthread_mutex_unlock(&context->sequence_mutex);
+
+	if (bo) {
+		amdgpu_bo_cpu_unmap(bo);
+		amdgpu_bo_free(bo);
+	}
+	if (!fence_info)
+		return;
+
+	bo = fence_info->handle;
+	if (amdgpu_bo_cpu_map(bo, &cpu))
+		return;
+	amdgpu_bo_inc_ref(bo);
+
+	pthread_mutex_lock(&context->sequence_mutex);
+	if (!uf->bo) {
+		uf->bo = bo;
+		uf->cpu = cpu;
+		uf->offset = fence_info->offset;
+		if (seq_no == *last_seq)
+			uf->first_seq = uf->last_seq = seq_no;
+		bo = NULL;
+	}
+	pthread_mutex_unlock(&context->sequence_mutex);
+
+	/* Some other submission got there first. */
+	if (bo) {
+		amdgpu_bo_cpu_unmap(bo);
+		amdgpu_bo_free(bo);
+	}
+}
+
 /**
  * Submit command to kernel DRM
  * \param   dev - \c [in]  Device handle
  * \param   context - \c [in]  GPU Context
  * \param   ibs_request - \c [in]  Pointer to submission requests
+ * \param   count - \c [in]  Number of requests, all to the same ring with
+ *			    the same resources and at most one user fence
  * \param   fence - \c [out] return fence for this submission
  *
  * \return  0 on success otherwise POSIX Error code
  * \sa amdgpu_cs_submit()
 */
 static int amdgpu_cs_submit_one(amdgpu_context_handle context,
-				struct amdgpu_cs_request *ibs_request)
+				struct amdgpu_cs_request *ibs_request,
+				uint32_t count)
 {
 	struct drm_amdgpu_cs_chunk *chunks;
 	struct drm_amdgpu_cs_chunk_data *chunk_data;
 	struct drm_amdgpu_cs_chunk_dep *dependencies = NULL;
 	struct drm_amdgpu_cs_chunk_dep *sem_dependencies = NULL;
-	amdgpu_device_handle dev = context->dev;
-	struct list_head *sem_list;
-	amdgpu_semaphore_handle sem, tmp;
-	uint32_t i, size, num_chunks, bo_list_handle = 0, sem_count = 0;
+	struct drm_amdgpu_cs_chunk_syncobj *timeline_waits = NULL;
+	struct drm_amdgpu_cs_chunk_syncobj timeline_signal;
+	struct amdgpu_cs_fence_info *fence_info = NULL;
+	uint64_t *chunk_array;
+	uint32_t i, j, size, num_chunks, bo_list_handle = 0, sem_count;
+	uint32_t number_of_ibs = 0, number_of_dependencies = 0, num_waits = 0;
+	bool timelines = context->timelines;
+	uint64_t trace_start;
 	uint64_t seq_no;
-	bool user_fence;
 	int r = 0;
 
+	trace_start = amdgpu_trace_begin(context->dev);
+
 	if (ibs_request->ip_type >= AMDGPU_HW_IP_NUM)
 		return -EINVAL;
+	if (ibs_request->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return -EINVAL;
 	if (ibs_request->ring >= AMDGPU_CS_MAX_RINGS)
 		return -EINVAL;
-	if (ibs_request->number_of_ibs == 0) {
+
+	for (i = 0; i < count; i++) {
+		number_of_ibs += ibs_request[i].number_of_ibs;
+		number_of_dependencies += ibs_request[i].number_of_dependencies;
+		if (ibs_request[i].fence_info.handle)
+			fence_info = &ibs_request[i].fence_info;
+	}
+	if (number_of_ibs == 0) {
 		ibs_request->seq_no = AMDGPU_NULL_SUBMIT_SEQ;
 		return 0;
 	}
-	user_fence = (ibs_request->fence_info.handle != NULL);
 
-	size = ibs_request->number_of_ibs + (user_fence ? 2 : 1) + 1;
+	/* IBs, fence, dependencies, semaphores and the two timeline chunks */
+	size = number_of_ibs + (fence_info ? 1 : 0) + 4;
 
 	chunks = alloca(sizeof(struct drm_amdgpu_cs_chunk) * size);
+	chunk_array = alloca(sizeof(uint64_t) * size);
 
-	size = ibs_request->number_of_ibs + (user_fence ? 1 : 0);
+	size = number_of_ibs + (fence_info ? 1 : 0);
 
 	chunk_data = alloca(sizeof(struct drm_amdgpu_cs_chunk_data) * size);
 
 	if (ibs_request->resources)
 		bo_list_handle = ibs_request->resources->handle;
-	num_chunks = ibs_request->number_of_ibs;
+	num_chunks = 0;
 	/* IB chunks */
-	for (i = 0; i < ibs_request->number_of_ibs; i++) {
-		struct amdgpu_cs_ib_info *ib;
-		chunks[i].chunk_id = AMDGPU_CHUNK_ID_IB;
-		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_ib) / 4;
-		chunks[i].chunk_data = (uint64_t)(uintptr_t)&chunk_data[i];
-
-		ib = &ibs_request->ibs[i];
-
-		chunk_data[i].ib_data._pad = 0;
-		chunk_data[i].ib_data.va_start = ib->ib_mc_address;
-		chunk_data[i].ib_data.ib_bytes = ib->size * 4;
-		chunk_data[i].ib_data.ip_type = ibs_request->ip_type;
-		chunk_data[i].ib_data.ip_instance = ibs_request->ip_instance;
-		chunk_data[i].ib_data.ring = ibs_request->ring;
-		chunk_data[i].ib_data.flags = ib->flags;
+	for (j = 0; j < count; j++) {
+		for (i = 0; i < ibs_request[j].number_of_ibs; i++) {
+			struct amdgpu_cs_ib_info *ib = &ibs_request[j].ibs[i];
+			uint32_t n = num_chunks++;
+
+			chunks[n].chunk_id = AMDGPU_CHUNK_ID_IB;
+			chunks[n].length_dw = sizeof(struct drm_amdgpu_cs_chunk_ib) / 4;
+			chunks[n].chunk_data = (uint64_t)(uintptr_t)&chunk_data[n];
+
+			chunk_data[n].ib_data._pad = 0;
+			chunk_data[n].ib_data.va_start = ib->ib_mc_address;
+			chunk_data[n].ib_data.ib_bytes = ib->size * 4;
+			chunk_data[n].ib_data.ip_type = ibs_request->ip_type;
+			chunk_data[n].ib_data.ip_instance = ibs_request->ip_instance;
+			chunk_data[n].ib_data.ring = ibs_request->ring;
+			chunk_data[n].ib_data.flags = ib->flags;
+		}
 	}
 
-	pthread_mutex_lock(&context->sequence_mutex);
-
-	if (user_fence) {
+	if (fence_info) {
 		i = num_chunks++;
 
 		/* fence chunk */
@@ -282,62 +655,76 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 		chunks[i].chunk_data = (uint64_t)(uintptr_t)&chunk_data[i];
 
 		/* fence bo handle */
-		chunk_data[i].fence_data.handle = ibs_request->fence_info.handle->handle;
+		chunk_data[i].fence_data.handle = fence_info->handle->handle;
 		/* offset */
-		chunk_data[i].fence_data.offset = 
-			ibs_request->fence_info.offset * sizeof(uint64_t);
+		chunk_data[i].fence_data.offset =
+			fence_info->offset * sizeof(uint64_t);
 	}
 
-	if (ibs_request->number_of_dependencies) {
+	if (number_of_dependencies) {
 		dependencies = alloca(sizeof(struct drm_amdgpu_cs_chunk_dep) *
-			ibs_request->number_of_dependencies);
-		if (!dependencies) {
-			r = -ENOMEM;
-			goto error_unlock;
-		}
-
-		for (i = 0; i < ibs_request->number_of_dependencies; ++i) {
-			struct amdgpu_cs_fence *info = &ibs_request->dependencies[i];
-			struct drm_amdgpu_cs_chunk_dep *dep = &dependencies[i];
-			dep->ip_type = info->ip_type;
-			dep->ip_instance = info->ip_instance;
-			dep->ring = info->ring;
-			dep->ctx_id = info->context->id;
-			dep->handle = info->fence;
-		}
+			number_of_dependencies);
+		timeline_waits = alloca(sizeof(struct drm_amdgpu_cs_chunk_syncobj) *
+			number_of_dependencies);
+
+		number_of_dependencies = 0;
+		for (j = 0; j < count; j++)
+			amdgpu_cs_fill_deps(ibs_request[j].dependencies,
+					    ibs_request[j].number_of_dependencies,
+					    dependencies, &number_of_dependencies,
+					    timeline_waits, &num_waits);
+	}
 
+	if (number_of_dependencies) {
 		i = num_chunks++;
 
 		/* dependencies chunk */
 		chunks[i].chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
 		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4
-			* ibs_request->number_of_dependencies;
+			* number_of_dependencies;
 		chunks[i].chunk_data = (uint64_t)(uintptr_t)dependencies;
 	}
 
-	sem_list = &context->sem_list[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring];
-	LIST_FOR_EACH_ENTRY(sem, sem_list, list)
-		sem_count++;
+	if (num_waits) {
+		i = num_chunks++;
+
+		chunks[i].chunk_id = AMDGPU_CHUNK_ID_SYNCOBJ_TIMELINE_WAIT;
+		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_syncobj) / 4
+			* num_waits;
+		chunks[i].chunk_data = (uint64_t)(uintptr_t)timeline_waits;
+	}
+
+	/* Only the semaphores need the lock, the submission itself is
+	 * ordered by the kernel. Timeline points are not, so those hold it
+	 * across the submission. */
+	pthread_mutex_lock(&context->sequence_mutex);
+	sem_count = context->sem_count[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring];
 	if (sem_count) {
 		sem_dependencies = alloca(sizeof(struct drm_amdgpu_cs_chunk_dep) * sem_count);
-		if (!sem_dependencies) {
-			r = -ENOMEM;
-			goto error_unlock;
-		}
-		sem_count = 0;
-		LIST_FOR_EACH_ENTRY_SAFE(sem, tmp, sem_list, list) {
-			struct amdgpu_cs_fence *info = &sem->signal_fence;
-			struct drm_amdgpu_cs_chunk_dep *dep = &sem_dependencies[sem_count++];
-			dep->ip_type = info->ip_type;
-			dep->ip_instance = info->ip_instance;
-			dep->ring = info->ring;
-			dep->ctx_id = info->context->id;
-			dep->handle = info->fence;
-
-			list_del(&sem->list);
-			amdgpu_cs_reset_sem(sem);
-			amdgpu_cs_unreference_sem(sem);
+		sem_count = amdgpu_cs_take_sems(context, ibs_request->ip_type,
+						ibs_request->ip_instance,
+						ibs_request->ring,
+						sem_dependencies);
+	}
+	if (timelines) {
+		r = amdgpu_cs_timeline_signal(context, ibs_request->ip_type,
+					      ibs_request->ip_instance,
+					      ibs_request->ring,
+					      &timeline_signal);
+		if (r) {
+			pthread_mutex_unlock(&context->sequence_mutex);
+			return r;
 		}
+
+		i = num_chunks++;
+		chunks[i].chunk_id = AMDGPU_CHUNK_ID_SYNCOBJ_TIMELINE_SIGNAL;
+		chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_syncobj) / 4;
+		chunks[i].chunk_data = (uint64_t)(uintptr_t)&timeline_signal;
+	} else {
+		pthread_mutex_unlock(&context->sequence_mutex);
+	}
+
+	if (sem_count) {
 		i = num_chunks++;
 
 		/* dependencies chunk */
@@ -346,16 +733,78 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 		chunks[i].chunk_data = (uint64_t)(uintptr_t)sem_dependencies;
 	}
 
-	r = amdgpu_cs_submit_raw2(dev, context, bo_list_handle, num_chunks,
-				  chunks, &seq_no);
+	for (i = 0; i < num_chunks; i++)
+		chunk_array[i] = (uint64_t)(uintptr_t)&chunks[i];
+
+	r = amdgpu_cs_submit_chunk_array(context, bo_list_handle, num_chunks,
+					 chunk_array, &seq_no);
+	if (trace_start) {
+		struct amdgpu_trace_event trace = {
+			.start_ns = trace_start,
+			.type = AMDGPU_TRACE_CS_SUBMIT,
+			.result = r,
+			.ip_type = ibs_request->ip_type,
+			.ip_instance = ibs_request->ip_instance,
+			.ring = ibs_request->ring,
+			.count = num_chunks,
+			.num_bos = ibs_request->resources ?
+				   ibs_request->resources->num_keys : 0,
+		};
+
+		if (!r)
+			trace.seq_no = timelines ? timeline_signal.point : seq_no;
+		amdgpu_trace_record(context->dev, &trace);
+	}
+	if (timelines) {
+		if (!r) {
+			seq_no = timeline_signal.point;
+			context->last_seq[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring] = seq_no;
+		}
+		pthread_mutex_unlock(&context->sequence_mutex);
+	}
 	if (r)
-		goto error_unlock;
+		return r;
 
-	ibs_request->seq_no = seq_no;
-	context->last_seq[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring] = ibs_request->seq_no;
-error_unlock:
-	pthread_mutex_unlock(&context->sequence_mutex);
-	return r;
+	for (i = 0; i < count; i++)
+		ibs_request[i].seq_no = seq_no;
+	/* User fences hold sequence numbers, not timeline points. */
+	if (!timelines)
+		amdgpu_cs_update_last_seq(context, ibs_request->ip_type,
+					  ibs_request->ip_instance,
+					  ibs_request->ring, seq_no,
+					  fence_info);
+	return 0;
+}
+
+/* Number of requests from the first one that can go in a single
+ * submission. */
+static uint32_t amdgpu_cs_coalesce(struct amdgpu_cs_request *ibs_request,
+				   uint32_t number_of_requests)
+{
+	struct amdgpu_cs_request *first = ibs_request;
+	bool user_fence = first->fence_info.handle != NULL;
+	uint32_t i, number_of_ibs = first->number_of_ibs;
+
+	if (!number_of_ibs)
+		return 1;
+
+	for (i = 1; i < number_of_requests; i++) {
+		struct amdgpu_cs_request *req = &ibs_request[i];
+
+		if (!req->number_of_ibs ||
+		    req->ip_type != first->ip_type ||
+		    req->ip_instance != first->ip_instance ||
+		    req->ring != first->ring ||
+		    req->resources != first->resources ||
+		    (user_fence && req->fence_info.handle) ||
+		    number_of_ibs + req->number_of_ibs > AMDGPU_CS_MAX_IBS_PER_SUBMIT)
+			break;
+
+		user_fence |= req->fence_info.handle != NULL;
+		number_of_ibs += req->number_of_ibs;
+	}
+
+	return i;
 }
 
 drm_public int amdgpu_cs_submit(amdgpu_context_handle context,
@@ -363,23 +812,237 @@ drm_public int amdgpu_cs_submit(amdgpu_context_handle context,
 				struct amdgpu_cs_request *ibs_request,
 				uint32_t number_of_requests)
 {
-	uint32_t i;
+	uint32_t i, count;
 	int r;
 
 	if (!context || !ibs_request)
 		return -EINVAL;
 
 	r = 0;
-	for (i = 0; i < number_of_requests; i++) {
-		r = amdgpu_cs_submit_one(context, ibs_request);
+	for (i = 0; i < number_of_requests; i += count) {
+		count = 1;
+		if (flags & AMDGPU_CS_SUBMIT_COALESCE)
+			count = amdgpu_cs_coalesce(ibs_request,
+						   number_of_requests - i);
+		r = amdgpu_cs_submit_one(context, ibs_request, count);
 		if (r)
 			break;
-		ibs_request++;
+		ibs_request += count;
 	}
 
 	return r;
 }
 
+static void amdgpu_cs_template_set_ibs(struct amdgpu_cs_template *tmpl,
+				      const struct amdgpu_cs_ib_info *ibs)
+{
+	uint32_t i;
+
+	for (i = 0; i < tmpl->number_of_ibs; i++) {
+		tmpl->chunk_data[i].ib_data.va_start = ibs[i].ib_mc_address;
+		tmpl->chunk_data[i].ib_data.ib_bytes = ibs[i].size * 4;
+		tmpl->chunk_data[i].ib_data.flags = ibs[i].flags;
+	}
+}
+
+drm_public int amdgpu_cs_template_create(amdgpu_context_handle context,
+					 const struct amdgpu_cs_request *request,
+					 amdgpu_cs_template_handle *cs_template)
+{
+	struct amdgpu_cs_template *tmpl;
+	uint32_t i, num_chunks, num_data;
+	bool user_fence;
+
+	if (!context || !request || !cs_template)
+		return -EINVAL;
+	if (request->ip_type >= AMDGPU_HW_IP_NUM ||
+	    request->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT ||
+	    request->ring >= AMDGPU_CS_MAX_RINGS ||
+	    request->number_of_ibs == 0)
+		return -EINVAL;
+
+	user_fence = (request->fence_info.handle != NULL);
+	num_data = request->number_of_ibs + (user_fence ? 1 : 0);
+	num_chunks = num_data + 4;
+
+	tmpl = calloc(1, sizeof(*tmpl));
+	if (!tmpl)
+		return -ENOMEM;
+
+	tmpl->chunks = calloc(num_chunks, sizeof(*tmpl->chunks));
+	tmpl->chunk_array = calloc(num_chunks, sizeof(*tmpl->chunk_array));
+	tmpl->chunk_data = calloc(num_data, sizeof(*tmpl->chunk_data));
+	if (request->number_of_dependencies) {
+		tmpl->dependencies = calloc(request->number_of_dependencies,
+					    sizeof(*tmpl->dependencies));
+		tmpl->timeline_waits = calloc(request->number_of_dependencies,
+					      sizeof(*tmpl->timeline_waits));
+	}
+	if (!tmpl->chunks || !tmpl->chunk_array || !tmpl->chunk_data ||
+	    (request->number_of_dependencies &&
+	     (!tmpl->dependencies || !tmpl->timeline_waits))) {
+		amdgpu_cs_template_destroy(tmpl);
+		return -ENOMEM;
+	}
+
+	tmpl->context = context;
+	tmpl->ip_type = request->ip_type;
+	tmpl->ip_instance = request->ip_instance;
+	tmpl->ring = request->ring;
+	tmpl->bo_list_handle = request->resources ? request->resources->handle : 0;
+	tmpl->fence_info = request->fence_info;
+	tmpl->number_of_ibs = request->number_of_ibs;
+	tmpl->num_fixed_chunks = num_data;
+	tmpl->max_dependencies = request->number_of_dependencies;
+
+	for (i = 0; i < request->number_of_ibs; i++) {
+		tmpl->chunks[i].chunk_id = AMDGPU_CHUNK_ID_IB;
+		tmpl->chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_ib) / 4;
+		tmpl->chunks[i].chunk_data = (uint64_t)(uintptr_t)&tmpl->chunk_data[i];
+		tmpl->chunk_data[i].ib_data.ip_type = request->ip_type;
+		tmpl->chunk_data[i].ib_data.ip_instance = request->ip_instance;
+		tmpl->chunk_data[i].ib_data.ring = request->ring;
+	}
+	amdgpu_cs_template_set_ibs(tmpl, request->ibs);
+
+	if (user_fence) {
+		i = request->number_of_ibs;
+		tmpl->chunks[i].chunk_id = AMDGPU_CHUNK_ID_FENCE;
+		tmpl->chunks[i].length_dw = sizeof(struct drm_amdgpu_cs_chunk_fence) / 4;
+		tmpl->chunks[i].chunk_data = (uint64_t)(uintptr_t)&tmpl->chunk_data[i];
+		tmpl->chunk_data[i].fence_data.handle =
+			request->fence_info.handle->handle;
+		tmpl->chunk_data[i].fence_data.offset =
+			request->fence_info.offset * sizeof(uint64_t);
+	}
+
+	for (i = 0; i < num_chunks; i++)
+		tmpl->chunk_array[i] = (uint64_t)(uintptr_t)&tmpl->chunks[i];
+
+	*cs_template = tmpl;
+	return 0;
+}
+
+drm_public int amdgpu_cs_template_destroy(amdgpu_cs_template_handle cs_template)
+{
+	if (!cs_template)
+		return -EINVAL;
+
+	free(cs_template->chunks);
+	free(cs_template->chunk_array);
+	free(cs_template->chunk_data);
+	free(cs_template->dependencies);
+	free(cs_template->sem_dependencies);
+	free(cs_template->timeline_waits);
+	free(cs_template);
+	return 0;
+}
+
+drm_public int amdgpu_cs_template_submit(amdgpu_cs_template_handle cs_template,
+					 const struct amdgpu_cs_ib_info *ibs,
+					 uint32_t number_of_dependencies,
+					 const struct amdgpu_cs_fence *dependencies,
+					 uint64_t *seq_no)
+{
+	struct amdgpu_cs_template *tmpl = cs_template;
+	amdgpu_context_handle context;
+	struct drm_amdgpu_cs_chunk *chunk;
+	uint32_t num_chunks, sem_count, num_deps = 0, num_waits = 0;
+	bool timelines;
+	uint64_t seq;
+	int r;
+
+	if (!tmpl || number_of_dependencies > tmpl->max_dependencies)
+		return -EINVAL;
+
+	context = tmpl->context;
+	timelines = context->timelines;
+	if (ibs)
+		amdgpu_cs_template_set_ibs(tmpl, ibs);
+	num_chunks = tmpl->num_fixed_chunks;
+
+	amdgpu_cs_fill_deps(dependencies, number_of_dependencies,
+			    tmpl->dependencies, &num_deps,
+			    tmpl->timeline_waits, &num_waits);
+	if (num_deps) {
+		chunk = &tmpl->chunks[num_chunks++];
+		chunk->chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
+		chunk->length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4 *
+				   num_deps;
+		chunk->chunk_data = (uint64_t)(uintptr_t)tmpl->dependencies;
+	}
+	if (num_waits) {
+		chunk = &tmpl->chunks[num_chunks++];
+		chunk->chunk_id = AMDGPU_CHUNK_ID_SYNCOBJ_TIMELINE_WAIT;
+		chunk->length_dw = sizeof(struct drm_amdgpu_cs_chunk_syncobj) / 4 *
+				   num_waits;
+		chunk->chunk_data = (uint64_t)(uintptr_t)tmpl->timeline_waits;
+	}
+
+	pthread_mutex_lock(&context->sequence_mutex);
+	sem_count = context->sem_count[tmpl->ip_type][tmpl->ip_instance][tmpl->ring];
+	if (sem_count > tmpl->max_sem_dependencies) {
+		struct drm_amdgpu_cs_chunk_dep *deps;
+
+		deps = realloc(tmpl->sem_dependencies, sem_count * sizeof(*deps));
+		if (!deps) {
+			pthread_mutex_unlock(&context->sequence_mutex);
+			return -ENOMEM;
+		}
+		tmpl->sem_dependencies = deps;
+		tmpl->max_sem_dependencies = sem_count;
+	}
+	if (sem_count)
+		sem_count = amdgpu_cs_take_sems(context, tmpl->ip_type,
+						tmpl->ip_instance, tmpl->ring,
+						tmpl->sem_dependencies);
+	if (timelines) {
+		r = amdgpu_cs_timeline_signal(context, tmpl->ip_type,
+					      tmpl->ip_instance, tmpl->ring,
+					      &tmpl->timeline_signal);
+		if (r) {
+			pthread_mutex_unlock(&context->sequence_mutex);
+			return r;
+		}
+
+		chunk = &tmpl->chunks[num_chunks++];
+		chunk->chunk_id = AMDGPU_CHUNK_ID_SYNCOBJ_TIMELINE_SIGNAL;
+		chunk->length_dw = sizeof(struct drm_amdgpu_cs_chunk_syncobj) / 4;
+		chunk->chunk_data = (uint64_t)(uintptr_t)&tmpl->timeline_signal;
+	} else {
+		pthread_mutex_unlock(&context->sequence_mutex);
+	}
+
+	if (sem_count) {
+		chunk = &tmpl->chunks[num_chunks++];
+		chunk->chunk_id = AMDGPU_CHUNK_ID_DEPENDENCIES;
+		chunk->length_dw = sizeof(struct drm_amdgpu_cs_chunk_dep) / 4 *
+				   sem_count;
+		chunk->chunk_data = (uint64_t)(uintptr_t)tmpl->sem_dependencies;
+	}
+
+	r = amdgpu_cs_submit_chunk_array(context, tmpl->bo_list_handle,
+					 num_chunks, tmpl->chunk_array, &seq);
+	if (timelines) {
+		if (!r) {
+			seq = tmpl->timeline_signal.point;
+			context->last_seq[tmpl->ip_type][tmpl->ip_instance][tmpl->ring] = seq;
+		}
+		pthread_mutex_unlock(&context->sequence_mutex);
+	}
+	if (r)
+		return r;
+
+	if (!timelines)
+		amdgpu_cs_update_last_seq(context, tmpl->ip_type,
+					  tmpl->ip_instance, tmpl->ring, seq,
+					  tmpl->fence_info.handle ?
+					  &tmpl->fence_info : NULL);
+	if (seq_no)
+		*seq_no = seq;
+	return 0;
+}
+
 /**
  * Calculate absolute timeout.
  *
@@ -442,11 +1105,117 @@ static int amdgpu_ioctl_wait_cs(amdgpu_context_handle context,
 	return 0;
 }
 
+/* Wait for fences of contexts using timelines. */
+static int amdgpu_cs_wait_timelines(const struct amdgpu_cs_fence *fences,
+				    uint32_t fence_count, bool wait_all,
+				    uint64_t abs_timeout_ns, uint32_t *status,
+				    uint32_t *first)
+{
+	amdgpu_device_handle dev = fences[0].context->dev;
+	uint32_t *handles;
+	uint64_t *points;
+	uint32_t i, count = 0, signaled = 0;
+	int r;
+
+	handles = alloca(sizeof(*handles) * fence_count);
+	points = alloca(sizeof(*points) * fence_count);
+	for (i = 0; i < fence_count; i++) {
+		if (fences[i].fence == AMDGPU_NULL_SUBMIT_SEQ) {
+			if (!wait_all) {
+				*status = 1;
+				if (first)
+					*first = i;
+				return 0;
+			}
+			continue;
+		}
+		handles[count] = amdgpu_cs_fence_timeline(&fences[i]);
+		points[count++] = fences[i].fence;
+	}
+	if (!count) {
+		*status = 1;
+		return 0;
+	}
+
+	r = drmSyncobjTimelineWait(dev->fd, handles, points, count,
+				   MIN2(abs_timeout_ns, INT64_MAX),
+				   wait_all ? DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL : 0,
+				   &signaled);
+	if (r == -ETIME) {
+		*status = 0;
+		return 0;
+	}
+	if (r)
+		return r;
+
+	*status = 1;
+	if (first) {
+		/* Count the skipped null fences back in. */
+		for (i = 0; fences[i].fence == AMDGPU_NULL_SUBMIT_SEQ ||
+			    signaled--; i++)
+			;
+		*first = i;
+	}
+	return 0;
+}
+
+/* Check a fence against the user fence memory of its ring, returns false
+ * if that doesn't tell whether it signaled. */
+static bool amdgpu_cs_user_fence_busy(const struct amdgpu_cs_fence *fence,
+				      bool *busy)
+{
+	amdgpu_context_handle context = fence->context;
+	struct amdgpu_cs_user_fence *uf;
+	bool known;
+
+	if (fence->ip_instance >= AMDGPU_HW_IP_INSTANCE_MAX_COUNT)
+		return false;
+
+	uf = &context->user_fence[fence->ip_type][fence->ip_instance][fence->ring];
+	pthread_mutex_lock(&context->sequence_mutex);
+	known = uf->first_seq && fence->fence >= uf->first_seq &&
+		fence->fence <= uf->last_seq;
+	if (known)
+		*busy = __atomic_load_n(&uf->cpu[uf->offset],
+					__ATOMIC_ACQUIRE) < fence->fence;
+	pthread_mutex_unlock(&context->sequence_mutex);
+	return known;
+}
+
+/* Deadline for polling the user fences before waiting in the kernel. */
+static uint64_t amdgpu_cs_spin_deadline(amdgpu_context_handle context,
+					uint64_t timeout_ns, uint64_t flags)
+{
+	uint64_t spin_ns = __atomic_load_n(&context->fence_spin_ns,
+					   __ATOMIC_RELAXED);
+	uint64_t deadline;
+
+	if (!spin_ns || !timeout_ns)
+		return 0;
+
+	deadline = amdgpu_cs_calculate_timeout(spin_ns);
+	if (!(flags & AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE) &&
+	    timeout_ns != AMDGPU_TIMEOUT_INFINITE)
+		timeout_ns = amdgpu_cs_calculate_timeout(timeout_ns);
+	return MIN2(deadline, timeout_ns);
+}
+
+drm_public int amdgpu_cs_ctx_set_fence_spin(amdgpu_context_handle context,
+					    uint64_t spin_ns)
+{
+	if (!context)
+		return -EINVAL;
+
+	__atomic_store_n(&context->fence_spin_ns, spin_ns, __ATOMIC_RELAXED);
+	return 0;
+}
+
 drm_public int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 					    uint64_t timeout_ns,
 					    uint64_t flags,
 					    uint32_t *expired)
 {
+	uint64_t deadline;
 	bool busy = true;
 	int r;
 
@@ -463,6 +1232,26 @@ drm_public int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 
 	*expired = false;
 
+	if (fence->context->timelines) {
+		if (!(flags & AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE))
+			timeout_ns = amdgpu_cs_calculate_timeout(timeout_ns);
+		return amdgpu_cs_wait_timelines(fence, 1, true, timeout_ns,
+						expired, NULL);
+	}
+
+	if (amdgpu_cs_user_fence_busy(fence, &busy)) {
+		deadline = amdgpu_cs_spin_deadline(fence->context, timeout_ns,
+						   flags);
+		while (busy && deadline &&
+		       amdgpu_cs_calculate_timeout(0) < deadline)
+			amdgpu_cs_user_fence_busy(fence, &busy);
+
+		if (!busy || !timeout_ns) {
+			*expired = !busy;
+			return 0;
+		}
+	}
+
 	r = amdgpu_ioctl_wait_cs(fence->context, fence->ip_type,
 				fence->ip_instance, fence->ring,
 			       	fence->fence, timeout_ns, flags, &busy);
@@ -513,6 +1302,50 @@ static int amdgpu_ioctl_wait_fences(struct amdgpu_cs_fence *fences,
 	return 0;
 }
 
+/* Poll the user fences, returns true if that decided the wait. */
+static bool amdgpu_cs_user_fences_signaled(struct amdgpu_cs_fence *fences,
+					   uint32_t fence_count,
+					   bool wait_all,
+					   uint64_t timeout_ns,
+					   uint32_t *status,
+					   uint32_t *first)
+{
+	uint64_t deadline = amdgpu_cs_spin_deadline(fences[0].context,
+						    timeout_ns, 0);
+	uint32_t i, signaled;
+	bool busy, unknown;
+
+	do {
+		signaled = 0;
+		unknown = false;
+		for (i = 0; i < fence_count; i++) {
+			if (fences[i].fence == AMDGPU_NULL_SUBMIT_SEQ) {
+				busy = false;
+			} else if (!amdgpu_cs_user_fence_busy(&fences[i], &busy)) {
+				unknown = true;
+				continue;
+			}
+
+			if (!busy && !wait_all) {
+				*status = 1;
+				if (first)
+					*first = i;
+				return true;
+			}
+			signaled += !busy;
+		}
+		if (unknown)
+			return false;
+		if (signaled == fence_count) {
+			*status = 1;
+			return true;
+		}
+	} while (deadline && amdgpu_cs_calculate_timeout(0) < deadline);
+
+	/* Nothing left to wait for in the kernel. */
+	return !timeout_ns;
+}
+
 drm_public int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
 				     uint32_t fence_count,
 				     bool wait_all,
@@ -520,7 +1353,9 @@ drm_public int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
 				     uint32_t *status,
 				     uint32_t *first)
 {
-	uint32_t i;
+	uint64_t trace_start;
+	uint32_t i, timelines = 0;
+	int r;
 
 	/* Sanity check */
 	if (!fences || !status || !fence_count)
@@ -533,12 +1368,36 @@ drm_public int amdgpu_cs_wait_fences(struct amdgpu_cs_fence *fences,
 			return -EINVAL;
 		if (fences[i].ring >= AMDGPU_CS_MAX_RINGS)
 			return -EINVAL;
+		timelines += fences[i].context->timelines;
 	}
 
 	*status = 0;
-
-	return amdgpu_ioctl_wait_fences(fences, fence_count, wait_all,
-					timeout_ns, status, first);
+	trace_start = amdgpu_trace_begin(fences[0].context->dev);
+
+	/* The kernel can't wait for both kinds at once. */
+	if (timelines)
+		r = timelines == fence_count ?
+			amdgpu_cs_wait_timelines(fences, fence_count, wait_all,
+						 amdgpu_cs_calculate_timeout(timeout_ns),
+						 status, first) : -EINVAL;
+	else if (amdgpu_cs_user_fences_signaled(fences, fence_count, wait_all,
+						timeout_ns, status, first))
+		r = 0;
+	else
+		r = amdgpu_ioctl_wait_fences(fences, fence_count, wait_all,
+					     timeout_ns, status, first);
+
+	if (trace_start) {
+		struct amdgpu_trace_event trace = {
+			.start_ns = trace_start,
+			.type = AMDGPU_TRACE_CS_WAIT_FENCES,
+			.result = r,
+			.count = fence_count,
+		};
+
+		amdgpu_trace_record(fences[0].context->dev, &trace);
+	}
+	return r;
 }
 
 drm_public int amdgpu_cs_create_semaphore(amdgpu_semaphore_handle *sem)
@@ -573,6 +1432,9 @@ drm_public int amdgpu_cs_signal_semaphore(amdgpu_context_handle ctx,
 	/* sem has been signaled */
 	if (sem->signal_fence.context)
 		return -EINVAL;
+	/* fences of timelines are waited for directly */
+	if (ctx->timelines)
+		return -EINVAL;
 	pthread_mutex_lock(&ctx->sequence_mutex);
 	sem->signal_fence.context = ctx;
 	sem->signal_fence.ip_type = ip_type;
@@ -599,9 +1461,14 @@ drm_public int amdgpu_cs_wait_semaphore(amdgpu_context_handle ctx,
 	/* must signal first */
 	if (!sem->signal_fence.context)
 		return -EINVAL;
+	if (ctx->timelines)
+		return -EINVAL;
 
 	pthread_mutex_lock(&ctx->sequence_mutex);
+	if (!ctx->sem_count[ip_type][ip_instance][ring])
+		list_inithead(&ctx->sem_list[ip_type][ip_instance][ring]);
 	list_add(&sem->list, &ctx->sem_list[ip_type][ip_instance][ring]);
+	ctx->sem_count[ip_type][ip_instance][ring]++;
 	pthread_mutex_unlock(&ctx->sequence_mutex);
 	return 0;
 }
@@ -780,6 +1647,43 @@ drm_public int amdgpu_cs_syncobj_import_sync_file(amdgpu_device_handle dev,
 	return drmSyncobjImportSyncFile(dev->fd, syncobj, sync_file_fd);
 }
 
+/* A binary syncobj to move the fence of a timeline point through. Its
+ * fence is replaced by the next transfer or import, so it is reused as is. */
+static int amdgpu_cs_get_scratch_syncobj(amdgpu_device_handle dev,
+					 uint32_t *handle)
+{
+	pthread_mutex_lock(&dev->scratch_syncobj_mutex);
+	if (dev->num_scratch_syncobjs) {
+		*handle = dev->scratch_syncobjs[--dev->num_scratch_syncobjs];
+		pthread_mutex_unlock(&dev->scratch_syncobj_mutex);
+		return 0;
+	}
+	pthread_mutex_unlock(&dev->scratch_syncobj_mutex);
+
+	return drmSyncobjCreate(dev->fd, 0, handle);
+}
+
+static void amdgpu_cs_put_scratch_syncobj(amdgpu_device_handle dev,
+					  uint32_t handle)
+{
+	pthread_mutex_lock(&dev->scratch_syncobj_mutex);
+	if (dev->num_scratch_syncobjs < AMDGPU_SCRATCH_SYNCOBJS) {
+		dev->scratch_syncobjs[dev->num_scratch_syncobjs++] = handle;
+		handle = 0;
+	}
+	pthread_mutex_unlock(&dev->scratch_syncobj_mutex);
+
+	if (handle)
+		drmSyncobjDestroy(dev->fd, handle);
+}
+
+drm_private void amdgpu_cs_scratch_syncobj_fini(struct amdgpu_device *dev)
+{
+	while (dev->num_scratch_syncobjs)
+		drmSyncobjDestroy(dev->fd,
+				  dev->scratch_syncobjs[--dev->num_scratch_syncobjs]);
+}
+
 drm_public int amdgpu_cs_syncobj_export_sync_file2(amdgpu_device_handle dev,
 						   uint32_t syncobj,
 						   uint64_t point,
@@ -795,7 +1699,7 @@ drm_public int amdgpu_cs_syncobj_export_sync_file2(amdgpu_device_handle dev,
 	if (!point)
 		return drmSyncobjExportSyncFile(dev->fd, syncobj, sync_file_fd);
 
-	ret = drmSyncobjCreate(dev->fd, 0, &binary_handle);
+	ret = amdgpu_cs_get_scratch_syncobj(dev, &binary_handle);
 	if (ret)
 		return ret;
 
@@ -805,7 +1709,56 @@ drm_public int amdgpu_cs_syncobj_export_sync_file2(amdgpu_device_handle dev,
 		goto out;
 	ret = drmSyncobjExportSyncFile(dev->fd, binary_handle, sync_file_fd);
 out:
-	drmSyncobjDestroy(dev->fd, binary_handle);
+	amdgpu_cs_put_scratch_syncobj(dev, binary_handle);
+	return ret;
+}
+
+drm_public int amdgpu_cs_syncobj_export_sync_files(amdgpu_device_handle dev,
+						   const uint32_t *syncobjs,
+						   const uint64_t *points,
+						   unsigned num_handles,
+						   uint32_t flags,
+						   int *sync_file_fds)
+{
+	uint32_t binary_handle = 0;
+	unsigned i;
+	int ret = 0;
+
+	if (NULL == dev || (num_handles && (!syncobjs || !sync_file_fds)))
+		return -EINVAL;
+
+	for (i = 0; i < num_handles; i++) {
+		if (!points || !points[i]) {
+			ret = drmSyncobjExportSyncFile(dev->fd, syncobjs[i],
+						       &sync_file_fds[i]);
+			if (ret)
+				break;
+			continue;
+		}
+
+		if (!binary_handle) {
+			ret = amdgpu_cs_get_scratch_syncobj(dev, &binary_handle);
+			if (ret)
+				break;
+		}
+		ret = drmSyncobjTransfer(dev->fd, binary_handle, 0,
+					 syncobjs[i], points[i], flags);
+		if (ret)
+			break;
+		ret = drmSyncobjExportSyncFile(dev->fd, binary_handle,
+					       &sync_file_fds[i]);
+		if (ret)
+			break;
+	}
+
+	if (binary_handle)
+		amdgpu_cs_put_scratch_syncobj(dev, binary_handle);
+	if (ret) {
+		while (i--) {
+			close(sync_file_fds[i]);
+			sync_file_fds[i] = -1;
+		}
+	}
 	return ret;
 }
 
@@ -823,7 +1776,7 @@ drm_public int amdgpu_cs_syncobj_import_sync_file2(amdgpu_device_handle dev,
 	if (!point)
 		return drmSyncobjImportSyncFile(dev->fd, syncobj, sync_file_fd);
 
-	ret = drmSyncobjCreate(dev->fd, 0, &binary_handle);
+	ret = amdgpu_cs_get_scratch_syncobj(dev, &binary_handle);
 	if (ret)
 		return ret;
 	ret = drmSyncobjImportSyncFile(dev->fd, binary_handle, sync_file_fd);
@@ -832,10 +1785,23 @@ drm_public int amdgpu_cs_syncobj_import_sync_file2(amdgpu_device_handle dev,
 	ret = drmSyncobjTransfer(dev->fd, syncobj, point,
 				 binary_handle, 0, 0);
 out:
-	drmSyncobjDestroy(dev->fd, binary_handle);
+	amdgpu_cs_put_scratch_syncobj(dev, binary_handle);
 	return ret;
 }
 
+drm_public int amdgpu_cs_syncobj_wait_fd(amdgpu_device_handle dev,
+					 const uint32_t *handles,
+					 const uint64_t *points,
+					 unsigned num_handles,
+					 int *wait_fd)
+{
+	if (NULL == dev)
+		return -EINVAL;
+
+	return drmSyncobjGetWaitFd(dev->fd, handles, points, num_handles,
+				   wait_fd);
+}
+
 drm_public int amdgpu_cs_syncobj_transfer(amdgpu_device_handle dev,
 					  uint32_t dst_handle,
 					  uint64_t dst_point,
@@ -873,8 +1839,11 @@ drm_public int amdgpu_cs_submit_raw(amdgpu_device_handle dev,
 	cs.in.ctx_id = context->id;
 	cs.in.bo_list_handle = bo_list_handle ? bo_list_handle->handle : 0;
 	cs.in.num_chunks = num_chunks;
+	UTIL_TRACE_BEGIN("amdgpu_cs_submit_raw", "ctx=%u chunks=%d",
+			 context->id, num_chunks);
 	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_CS,
 				&cs, sizeof(cs));
+	UTIL_TRACE_END();
 	if (r)
 		return r;
 
@@ -890,22 +1859,27 @@ drm_public int amdgpu_cs_submit_raw2(amdgpu_device_handle dev,
 				     struct drm_amdgpu_cs_chunk *chunks,
 				     uint64_t *seq_no)
 {
-	union drm_amdgpu_cs cs;
+	uint64_t trace_start;
 	uint64_t *chunk_array;
 	int i, r;
 
-	memset(&cs, 0, sizeof(cs));
+	trace_start = amdgpu_trace_begin(context->dev);
 	chunk_array = alloca(sizeof(uint64_t) * num_chunks);
 	for (i = 0; i < num_chunks; i++)
 		chunk_array[i] = (uint64_t)(uintptr_t)&chunks[i];
-	cs.in.chunks = (uint64_t)(uintptr_t)chunk_array;
-	cs.in.ctx_id = context->id;
-	cs.in.bo_list_handle = bo_list_handle;
-	cs.in.num_chunks = num_chunks;
-	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_CS,
-				&cs, sizeof(cs));
-	if (!r && seq_no)
-		*seq_no = cs.out.handle;
+	r = amdgpu_cs_submit_chunk_array(context, bo_list_handle, num_chunks,
+					 chunk_array, seq_no);
+	if (trace_start) {
+		struct amdgpu_trace_event trace = {
+			.start_ns = trace_start,
+			.type = AMDGPU_TRACE_CS_SUBMIT_RAW2,
+			.result = r,
+			.count = num_chunks,
+			.seq_no = !r && seq_no ? *seq_no : 0,
+		};
+
+		amdgpu_trace_record(context->dev, &trace);
+	}
 	return r;
 }
 
@@ -926,6 +1900,45 @@ drm_public void amdgpu_cs_chunk_fence_to_dep(struct amdgpu_cs_fence *fence,
 	dep->handle = fence->fence;
 }
 
+/* Copy a timeline point into a new binary syncobj to hand it out. */
+static int amdgpu_cs_timeline_to_handle(amdgpu_device_handle dev,
+					struct amdgpu_cs_fence *fence,
+					uint32_t what,
+					uint32_t *out_handle)
+{
+	uint32_t syncobj;
+	int fd, r;
+
+	r = drmSyncobjCreate(dev->fd, 0, &syncobj);
+	if (r)
+		return r;
+
+	r = drmSyncobjTransfer(dev->fd, syncobj, 0,
+			       amdgpu_cs_fence_timeline(fence), fence->fence, 0);
+	if (r)
+		goto out;
+
+	switch (what) {
+	case AMDGPU_FENCE_TO_HANDLE_GET_SYNCOBJ:
+		*out_handle = syncobj;
+		return 0;
+	case AMDGPU_FENCE_TO_HANDLE_GET_SYNCOBJ_FD:
+		r = drmSyncobjHandleToFD(dev->fd, syncobj, &fd);
+		break;
+	case AMDGPU_FENCE_TO_HANDLE_GET_SYNC_FILE_FD:
+		r = drmSyncobjExportSyncFile(dev->fd, syncobj, &fd);
+		break;
+	default:
+		r = -EINVAL;
+		break;
+	}
+	if (!r)
+		*out_handle = fd;
+out:
+	drmSyncobjDestroy(dev->fd, syncobj);
+	return r;
+}
+
 drm_public int amdgpu_cs_fence_to_handle(amdgpu_device_handle dev,
 					 struct amdgpu_cs_fence *fence,
 					 uint32_t what,
@@ -934,6 +1947,10 @@ drm_public int amdgpu_cs_fence_to_handle(amdgpu_device_handle dev,
 	union drm_amdgpu_fence_to_handle fth;
 	int r;
 
+	if (fence->context->timelines)
+		return amdgpu_cs_timeline_to_handle(dev, fence, what,
+						    out_handle);
+
 	memset(&fth, 0, sizeof(fth));
 	fth.in.fence.ctx_id = fence->context->id;
 	fth.in.fence.ip_type = fence->ip_type;
@@ -0,0 +1,238 @@
+/*
+ * Copyright © 2014 Advanced Micro Devices, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libdrm_macros.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+/* IBs start on a 256 byte boundary, which every ring accepts. */
+#define AMDGPU_IB_POOL_ALIGNMENT	256
+#define AMDGPU_IB_POOL_DEFAULT_CHUNK	(64 * 1024)
+/* Idle chunks kept beyond the one in use. */
+#define AMDGPU_IB_POOL_MAX_IDLE		4
+
+struct amdgpu_ib_chunk {
+	struct list_head list;
+	amdgpu_bo_handle bo;
+	uint64_t va;
+	void *cpu;
+	uint64_t size;
+	/* Bytes handed out since the chunk was last recycled. */
+	uint64_t used;
+	/* Handed out space since the last amdgpu_cs_ib_pool_submitted(). */
+	bool unfenced;
+	/* Last submission reading the chunk. */
+	struct amdgpu_cs_fence fence;
+};
+
+struct amdgpu_cs_ib_pool {
+	amdgpu_device_handle dev;
+	pthread_mutex_t lock;
+	uint64_t chunk_size;
+	/* Chunks in the order they were filled, the current one last. */
+	struct list_head chunks;
+};
+
+static void amdgpu_ib_pool_free_chunk(struct amdgpu_ib_chunk *chunk)
+{
+	list_del(&chunk->list);
+	amdgpu_bo_free(chunk->bo);
+	free(chunk);
+}
+
+static struct amdgpu_ib_chunk *
+amdgpu_ib_pool_new_chunk(struct amdgpu_cs_ib_pool *pool, uint64_t size)
+{
+	struct amdgpu_bo_alloc_request request = {};
+	struct amdgpu_ib_chunk *chunk;
+	int r;
+
+	chunk = calloc(1, sizeof(*chunk));
+	if (!chunk)
+		return NULL;
+
+	request.alloc_size = MAX2(size, pool->chunk_size);
+	request.phys_alignment = 4096;
+	request.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	request.flags = AMDGPU_GEM_CREATE_CPU_GTT_USWC;
+
+	r = amdgpu_bo_alloc_mapped(pool->dev, &request, 0,
+				   AMDGPU_VM_PAGE_READABLE |
+				   AMDGPU_VM_PAGE_EXECUTABLE,
+				   &chunk->bo, &chunk->va);
+	if (r) {
+		free(chunk);
+		return NULL;
+	}
+
+	r = amdgpu_bo_cpu_map_persistent(chunk->bo, &chunk->cpu);
+	if (r) {
+		amdgpu_bo_free(chunk->bo);
+		free(chunk);
+		return NULL;
+	}
+
+	chunk->size = request.alloc_size;
+	list_addtail(&chunk->list, &pool->chunks);
+	return chunk;
+}
+
+/* The oldest chunk the GPU is done with, holding at least size bytes, moved
+ * to the tail of the ring. Idle chunks past the first few are freed, the
+ * ring grows by one chunk if none is idle. */
+static struct amdgpu_ib_chunk *
+amdgpu_ib_pool_next_chunk(struct amdgpu_cs_ib_pool *pool, uint64_t size)
+{
+	struct amdgpu_ib_chunk *chunk, *tmp, *found = NULL;
+	struct amdgpu_ib_chunk *current = NULL;
+	unsigned idle = 0;
+	uint32_t expired;
+
+	if (!LIST_IS_EMPTY(&pool->chunks))
+		current = LIST_ENTRY(struct amdgpu_ib_chunk,
+				     pool->chunks.prev, list);
+
+	LIST_FOR_EACH_ENTRY_SAFE(chunk, tmp, &pool->chunks, list) {
+		if (chunk == current || chunk->unfenced)
+			break;
+		/* Submissions of a pool complete in order. */
+		if (amdgpu_cs_query_fence_status(&chunk->fence, 0, 0,
+						 &expired) || !expired)
+			break;
+
+		if (!found && chunk->size >= size) {
+			found = chunk;
+		} else if (++idle > AMDGPU_IB_POOL_MAX_IDLE) {
+			amdgpu_ib_pool_free_chunk(chunk);
+		}
+	}
+
+	if (!found)
+		return amdgpu_ib_pool_new_chunk(pool, size);
+
+	list_del(&found->list);
+	list_addtail(&found->list, &pool->chunks);
+	found->used = 0;
+	return found;
+}
+
+drm_public int amdgpu_cs_ib_pool_create(amdgpu_device_handle dev,
+					uint64_t chunk_size,
+					amdgpu_cs_ib_pool_handle *pool)
+{
+	struct amdgpu_cs_ib_pool *p;
+
+	if (!dev || !pool)
+		return -EINVAL;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+
+	p->dev = dev;
+	p->chunk_size = chunk_size ? ALIGN(chunk_size, 4096) :
+				     AMDGPU_IB_POOL_DEFAULT_CHUNK;
+	pthread_mutex_init(&p->lock, NULL);
+	list_inithead(&p->chunks);
+
+	*pool = p;
+	return 0;
+}
+
+drm_public int amdgpu_cs_ib_pool_destroy(amdgpu_cs_ib_pool_handle pool)
+{
+	struct amdgpu_ib_chunk *chunk, *tmp;
+
+	if (!pool)
+		return -EINVAL;
+
+	LIST_FOR_EACH_ENTRY_SAFE(chunk, tmp, &pool->chunks, list)
+		amdgpu_ib_pool_free_chunk(chunk);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+	return 0;
+}
+
+drm_public int amdgpu_cs_ib_pool_alloc(amdgpu_cs_ib_pool_handle pool,
+				       uint32_t size_dw,
+				       struct amdgpu_cs_ib_info *ib_info,
+				       void **cpu, amdgpu_bo_handle *bo)
+{
+	struct amdgpu_ib_chunk *chunk = NULL;
+	uint64_t size = (uint64_t)size_dw * 4;
+	uint64_t offset;
+
+	if (!pool || !size_dw || !ib_info || !cpu)
+		return -EINVAL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!LIST_IS_EMPTY(&pool->chunks))
+		chunk = LIST_ENTRY(struct amdgpu_ib_chunk,
+				   pool->chunks.prev, list);
+	if (!chunk || chunk->used + size > chunk->size) {
+		chunk = amdgpu_ib_pool_next_chunk(pool, size);
+		if (!chunk) {
+			pthread_mutex_unlock(&pool->lock);
+			return -ENOMEM;
+		}
+	}
+
+	offset = chunk->used;
+	chunk->used = ALIGN(offset + size, AMDGPU_IB_POOL_ALIGNMENT);
+	chunk->unfenced = true;
+	pthread_mutex_unlock(&pool->lock);
+
+	memset(ib_info, 0, sizeof(*ib_info));
+	ib_info->ib_mc_address = chunk->va + offset;
+	ib_info->size = size_dw;
+	*cpu = (char *)chunk->cpu + offset;
+	if (bo)
+		*bo = chunk->bo;
+	return 0;
+}
+
+drm_public int amdgpu_cs_ib_pool_submitted(amdgpu_cs_ib_pool_handle pool,
+					   const struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_ib_chunk *chunk;
+
+	if (!pool || !fence)
+		return -EINVAL;
+
+	pthread_mutex_lock(&pool->lock);
+	LIST_FOR_EACH_ENTRY(chunk, &pool->chunks, list) {
+		if (!chunk->unfenced)
+			continue;
+		chunk->fence = *fence;
+		chunk->unfenced = false;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
@@ -0,0 +1,416 @@
+/*
+ * Copyright © 2014 Advanced Micro Devices, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "xf86drm.h"
+#include "libdrm_macros.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+/* One queue per AMDGPU_CTX_PRIORITY_* level. */
+#define AMDGPU_CS_SCHED_LEVELS		5
+/* A queue head waiting longer than this goes before higher levels. */
+#define AMDGPU_CS_SCHED_STARVE_NS	(50 * 1000 * 1000)
+/* Most requests submitted in one go. */
+#define AMDGPU_CS_SCHED_MAX_BATCH	64
+
+struct amdgpu_cs_sched_job {
+	struct amdgpu_cs_sched_job *next;
+	amdgpu_context_handle context;
+	uint64_t flags;
+	struct amdgpu_cs_request *requests;
+	uint32_t number_of_requests;
+	uint64_t queued_ns;
+	int result;
+	bool done;
+};
+
+/* What the submit thread needs to wait for a submission. The context
+ * pointer isn't kept, the context may be gone by then. */
+struct amdgpu_cs_sched_fence {
+	uint32_t ctx_id;
+	uint32_t ip_type;
+	uint32_t ip_instance;
+	uint32_t ring;
+	uint64_t seq_no;
+};
+
+struct amdgpu_cs_scheduler {
+	amdgpu_device_handle dev;
+	uint64_t window_ns;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/* Wakes the submit thread. */
+	pthread_cond_t cond;
+	/* Wakes the threads waiting for their jobs. */
+	pthread_cond_t done_cond;
+	bool stop;
+
+	struct amdgpu_cs_sched_job *queue[AMDGPU_CS_SCHED_LEVELS];
+	struct amdgpu_cs_sched_job **queue_tail[AMDGPU_CS_SCHED_LEVELS];
+
+	/* Only used by the submit thread, a ring of the submissions that
+	 * may still be executing. */
+	struct amdgpu_cs_sched_fence *in_flight;
+	uint32_t max_in_flight;
+	uint32_t in_flight_head;
+	uint32_t in_flight_count;
+};
+
+static uint64_t amdgpu_cs_sched_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned amdgpu_cs_sched_level(amdgpu_context_handle context)
+{
+	int32_t priority = context->priority;
+
+	if (priority <= AMDGPU_CTX_PRIORITY_VERY_LOW)
+		return 0;
+	if (priority < AMDGPU_CTX_PRIORITY_NORMAL)
+		return 1;
+	if (priority == AMDGPU_CTX_PRIORITY_NORMAL)
+		return 2;
+	if (priority < AMDGPU_CTX_PRIORITY_VERY_HIGH)
+		return 3;
+	return 4;
+}
+
+static bool amdgpu_cs_sched_fence_busy(amdgpu_device_handle dev,
+				       const struct amdgpu_cs_sched_fence *fence,
+				       uint64_t timeout)
+{
+	union drm_amdgpu_wait_cs args;
+
+	memset(&args, 0, sizeof(args));
+	args.in.handle = fence->seq_no;
+	args.in.ip_type = fence->ip_type;
+	args.in.ip_instance = fence->ip_instance;
+	args.in.ring = fence->ring;
+	args.in.ctx_id = fence->ctx_id;
+	args.in.timeout = timeout;
+
+	/* Errors mean the context is gone or the GPU was reset, nothing to
+	 * wait for either way. */
+	if (drmCommandWriteRead(dev->fd, DRM_AMDGPU_WAIT_CS,
+				&args, sizeof(args)))
+		return false;
+	return args.out.status;
+}
+
+/* Drop the completed submissions from the head of the ring and, while it
+ * is full, wait for the oldest one. */
+static void amdgpu_cs_sched_throttle(struct amdgpu_cs_scheduler *sched,
+				     uint32_t room)
+{
+	room = MIN2(room, sched->max_in_flight);
+
+	while (sched->in_flight_count) {
+		struct amdgpu_cs_sched_fence *oldest =
+			&sched->in_flight[sched->in_flight_head];
+		bool full = sched->in_flight_count + room > sched->max_in_flight;
+
+		if (amdgpu_cs_sched_fence_busy(sched->dev, oldest,
+					       full ? AMDGPU_TIMEOUT_INFINITE : 0))
+			break;
+		sched->in_flight_head = (sched->in_flight_head + 1) %
+					sched->max_in_flight;
+		sched->in_flight_count--;
+	}
+}
+
+static void amdgpu_cs_sched_add_fence(struct amdgpu_cs_scheduler *sched,
+				      amdgpu_context_handle context,
+				      const struct amdgpu_cs_request *request)
+{
+	struct amdgpu_cs_sched_fence *fence;
+
+	/* Timeline points aren't sequence numbers the kernel can wait for. */
+	if (context->timelines || !request->seq_no)
+		return;
+
+	amdgpu_cs_sched_throttle(sched, 1);
+	fence = &sched->in_flight[(sched->in_flight_head +
+				   sched->in_flight_count) %
+				  sched->max_in_flight];
+	fence->ctx_id = context->id;
+	fence->ip_type = request->ip_type;
+	fence->ip_instance = request->ip_instance;
+	fence->ring = request->ring;
+	fence->seq_no = request->seq_no;
+	sched->in_flight_count++;
+}
+
+/* Level of the queue to serve next, the highest one unless a lower one
+ * waited for too long. */
+static int amdgpu_cs_sched_pick(struct amdgpu_cs_scheduler *sched,
+				uint64_t now)
+{
+	int level, pick = -1;
+
+	for (level = AMDGPU_CS_SCHED_LEVELS - 1; level >= 0; level--) {
+		struct amdgpu_cs_sched_job *job = sched->queue[level];
+
+		if (!job)
+			continue;
+		if (pick < 0)
+			pick = level;
+		else if (now - job->queued_ns > AMDGPU_CS_SCHED_STARVE_NS &&
+			 job->queued_ns < sched->queue[pick]->queued_ns)
+			pick = level;
+	}
+	return pick;
+}
+
+/* Take the head job of the level and the following ones it can be
+ * submitted together with. Returns the number of jobs taken. */
+static uint32_t amdgpu_cs_sched_take(struct amdgpu_cs_scheduler *sched,
+				     unsigned level,
+				     struct amdgpu_cs_sched_job **jobs,
+				     uint32_t *number_of_requests)
+{
+	struct amdgpu_cs_sched_job *first = sched->queue[level];
+	struct amdgpu_cs_sched_job *job, **link = &sched->queue[level];
+	uint32_t count = 0, total = 0;
+
+	while ((job = *link)) {
+		if (count && (job->context != first->context ||
+			      job->flags != first->flags ||
+			      total + job->number_of_requests >
+			      AMDGPU_CS_SCHED_MAX_BATCH)) {
+			/* Later jobs of the context must not go first. */
+			if (job->context == first->context)
+				break;
+			link = &job->next;
+			continue;
+		}
+		*link = job->next;
+		jobs[count++] = job;
+		total += job->number_of_requests;
+	}
+	sched->queue_tail[level] = link;
+	while (*sched->queue_tail[level])
+		sched->queue_tail[level] = &(*sched->queue_tail[level])->next;
+
+	*number_of_requests = total;
+	return count;
+}
+
+static void amdgpu_cs_sched_run(struct amdgpu_cs_scheduler *sched,
+				struct amdgpu_cs_sched_job **jobs,
+				uint32_t count, uint32_t number_of_requests)
+{
+	struct amdgpu_cs_request requests[AMDGPU_CS_SCHED_MAX_BATCH];
+	amdgpu_context_handle context = jobs[0]->context;
+	uint32_t i, j, n = 0;
+	int r;
+
+	amdgpu_cs_sched_throttle(sched, number_of_requests);
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < jobs[i]->number_of_requests; j++) {
+			requests[n] = jobs[i]->requests[j];
+			requests[n++].seq_no = 0;
+		}
+	}
+
+	r = amdgpu_cs_submit(context, jobs[0]->flags, requests, n);
+
+	/* Submission stops at the first failure, the ones before it went
+	 * through and have their sequence number. */
+	for (i = 0, n = 0; i < count; i++) {
+		jobs[i]->result = 0;
+		for (j = 0; j < jobs[i]->number_of_requests; j++, n++) {
+			jobs[i]->requests[j].seq_no = requests[n].seq_no;
+			if (!requests[n].seq_no)
+				jobs[i]->result = r ? r : -EINVAL;
+			else
+				amdgpu_cs_sched_add_fence(sched, context,
+							  &requests[n]);
+		}
+	}
+}
+
+static void *amdgpu_cs_sched_thread(void *data)
+{
+	struct amdgpu_cs_scheduler *sched = data;
+	struct amdgpu_cs_sched_job *jobs[AMDGPU_CS_SCHED_MAX_BATCH];
+	uint32_t i, count, number_of_requests;
+	uint64_t now, deadline;
+	struct timespec ts;
+	int level;
+
+	pthread_mutex_lock(&sched->lock);
+	for (;;) {
+		now = amdgpu_cs_sched_now();
+		level = amdgpu_cs_sched_pick(sched, now);
+		if (level < 0) {
+			if (sched->stop)
+				break;
+			pthread_cond_wait(&sched->cond, &sched->lock);
+			continue;
+		}
+
+		/* Give the other submissions of the window a chance to
+		 * join the oldest one. */
+		deadline = sched->queue[level]->queued_ns + sched->window_ns;
+		if (!sched->stop && now < deadline) {
+			ts.tv_sec = deadline / 1000000000ull;
+			ts.tv_nsec = deadline % 1000000000ull;
+			pthread_cond_timedwait(&sched->cond, &sched->lock, &ts);
+			continue;
+		}
+
+		count = amdgpu_cs_sched_take(sched, level, jobs,
+					     &number_of_requests);
+		pthread_mutex_unlock(&sched->lock);
+
+		amdgpu_cs_sched_run(sched, jobs, count, number_of_requests);
+
+		pthread_mutex_lock(&sched->lock);
+		for (i = 0; i < count; i++)
+			jobs[i]->done = true;
+		pthread_cond_broadcast(&sched->done_cond);
+	}
+	pthread_mutex_unlock(&sched->lock);
+	return NULL;
+}
+
+drm_public int amdgpu_cs_scheduler_create(amdgpu_device_handle dev,
+					  uint32_t max_in_flight,
+					  uint32_t window_us,
+					  amdgpu_cs_scheduler_handle *scheduler)
+{
+	struct amdgpu_cs_scheduler *sched;
+	pthread_condattr_t attr;
+	unsigned level;
+	int r;
+
+	if (NULL == dev || !max_in_flight || !scheduler)
+		return -EINVAL;
+
+	sched = calloc(1, sizeof(*sched));
+	if (!sched)
+		return -ENOMEM;
+
+	sched->in_flight = calloc(max_in_flight, sizeof(*sched->in_flight));
+	if (!sched->in_flight) {
+		free(sched);
+		return -ENOMEM;
+	}
+
+	sched->dev = dev;
+	sched->window_ns = window_us * 1000ull;
+	sched->max_in_flight = max_in_flight;
+	for (level = 0; level < AMDGPU_CS_SCHED_LEVELS; level++)
+		sched->queue_tail[level] = &sched->queue[level];
+
+	pthread_mutex_init(&sched->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sched->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_cond_init(&sched->done_cond, NULL);
+
+	r = -pthread_create(&sched->thread, NULL, amdgpu_cs_sched_thread, sched);
+	if (r) {
+		pthread_cond_destroy(&sched->done_cond);
+		pthread_cond_destroy(&sched->cond);
+		pthread_mutex_destroy(&sched->lock);
+		free(sched->in_flight);
+		free(sched);
+		return r;
+	}
+
+	*scheduler = sched;
+	return 0;
+}
+
+drm_public int amdgpu_cs_scheduler_destroy(amdgpu_cs_scheduler_handle scheduler)
+{
+	if (!scheduler)
+		return -EINVAL;
+
+	/* The queued jobs are still submitted before the thread exits. */
+	pthread_mutex_lock(&scheduler->lock);
+	scheduler->stop = true;
+	pthread_cond_signal(&scheduler->cond);
+	pthread_mutex_unlock(&scheduler->lock);
+	pthread_join(scheduler->thread, NULL);
+
+	pthread_cond_destroy(&scheduler->done_cond);
+	pthread_cond_destroy(&scheduler->cond);
+	pthread_mutex_destroy(&scheduler->lock);
+	free(scheduler->in_flight);
+	free(scheduler);
+	return 0;
+}
+
+drm_public int amdgpu_cs_scheduler_submit(amdgpu_cs_scheduler_handle scheduler,
+					  amdgpu_context_handle context,
+					  uint64_t flags,
+					  struct amdgpu_cs_request *ibs_request,
+					  uint32_t number_of_requests)
+{
+	struct amdgpu_cs_sched_job job = {};
+	unsigned level;
+
+	if (!scheduler || !context || !ibs_request ||
+	    context->dev != scheduler->dev)
+		return -EINVAL;
+	if (!number_of_requests)
+		return 0;
+	/* Too large to be merged with anything, don't queue it. */
+	if (number_of_requests > AMDGPU_CS_SCHED_MAX_BATCH)
+		return amdgpu_cs_submit(context, flags, ibs_request,
+					number_of_requests);
+
+	job.context = context;
+	job.flags = flags;
+	job.requests = ibs_request;
+	job.number_of_requests = number_of_requests;
+	job.queued_ns = amdgpu_cs_sched_now();
+	level = amdgpu_cs_sched_level(context);
+
+	pthread_mutex_lock(&scheduler->lock);
+	*scheduler->queue_tail[level] = &job;
+	scheduler->queue_tail[level] = &job.next;
+	pthread_cond_signal(&scheduler->cond);
+	while (!job.done)
+		pthread_cond_wait(&scheduler->done_cond, &scheduler->lock);
+	pthread_mutex_unlock(&scheduler->lock);
+
+	return job.result;
+}
@@ -46,23 +46,45 @@
 static pthread_mutex_t dev_mutex = PTHREAD_MUTEX_INITIALIZER;
 static amdgpu_device_handle dev_list;
 
-static int fd_compare(int fd1, int fd2)
+static bool amdgpu_name_match(const char *name1, const char *name2)
 {
-	char *name1 = drmGetPrimaryDeviceNameFromFd(fd1);
-	char *name2 = drmGetPrimaryDeviceNameFromFd(fd2);
-	int result;
+	/* Devices whose names can't be resolved are all the same one. */
+	return name1 == NULL || name2 == NULL || strcmp(name1, name2) == 0;
+}
 
-	if (name1 == NULL || name2 == NULL) {
-		free(name1);
-		free(name2);
-		return 0;
+/**
+ * Find the device an fd opens, called with dev_mutex held.
+ *
+ * Each device remembers the device numbers of the nodes it was opened
+ * through, so the primary node name of fd only has to be resolved through
+ * sysfs for a node seen for the first time. It is then returned in
+ * primary_name for the caller to keep.
+ */
+static amdgpu_device_handle amdgpu_find_device(int fd, char **primary_name)
+{
+	amdgpu_device_handle dev;
+	struct stat sbuf;
+	int type;
+
+	*primary_name = NULL;
+
+	type = drmGetNodeTypeFromFd(fd);
+	if (type >= 0 && type < DRM_NODE_MAX && !fstat(fd, &sbuf)) {
+		for (dev = dev_list; dev; dev = dev->next)
+			if (dev->node_rdev[type] == sbuf.st_rdev)
+				return dev;
+	} else {
+		type = -1;
 	}
 
-	result = strcmp(name1, name2);
-	free(name1);
-	free(name2);
+	*primary_name = drmGetPrimaryDeviceNameFromFd(fd);
+	for (dev = dev_list; dev; dev = dev->next)
+		if (amdgpu_name_match(dev->primary_name, *primary_name))
+			break;
 
-	return result;
+	if (dev && type >= 0)
+		dev->node_rdev[type] = sbuf.st_rdev;
+	return dev;
 }
 
 /**
@@ -103,9 +125,21 @@ static void amdgpu_device_free_internal(amdgpu_device_handle dev)
 	*node = (*node)->next;
 	pthread_mutex_unlock(&dev_mutex);
 
+	amdgpu_cs_ctx_pool_fini(dev);
+	if (util_bo_labels_dump_enabled())
+		amdgpu_dump_bo_usage_locked(dev, stderr);
+	amdgpu_bo_cache_fini(dev);
+	amdgpu_userptr_cache_fini(dev);
+	amdgpu_bo_list_cache_fini(dev);
+	amdgpu_cs_scratch_syncobj_fini(dev);
+	amdgpu_trace_fini(dev);
+	/* The fd number may be reused for another device. */
+	drmInvalidateMetadataCache(dev->fd);
 	close(dev->fd);
-	if ((dev->flink_fd >= 0) && (dev->fd != dev->flink_fd))
+	if ((dev->flink_fd >= 0) && (dev->fd != dev->flink_fd)) {
+		drmInvalidateMetadataCache(dev->flink_fd);
 		close(dev->flink_fd);
+	}
 
 	amdgpu_vamgr_deinit(&dev->vamgr_32);
 	amdgpu_vamgr_deinit(&dev->vamgr);
@@ -114,7 +148,15 @@ static void amdgpu_device_free_internal(amdgpu_device_handle dev)
 	handle_table_fini(&dev->bo_handles);
 	handle_table_fini(&dev->bo_flink_names);
 	pthread_mutex_destroy(&dev->bo_table_mutex);
+	free(dev->cpu_maps);
+	pthread_mutex_destroy(&dev->cpu_map_mutex);
+	pthread_mutex_destroy(&dev->bo_list_mutex);
+	pthread_mutex_destroy(&dev->trace_mutex);
+	pthread_mutex_destroy(&dev->info_mutex);
+	pthread_mutex_destroy(&dev->ctx_pool_mutex);
+	pthread_mutex_destroy(&dev->scratch_syncobj_mutex);
 	free(dev->marketing_name);
+	free(dev->primary_name);
 	free(dev);
 }
 
@@ -147,6 +189,8 @@ drm_public int amdgpu_device_initialize(int fd,
 {
 	struct amdgpu_device *dev;
 	drmVersionPtr version;
+	char *primary_name;
+	struct stat sbuf;
 	int r;
 	int flag_auth = 0;
 	int flag_authexist=0;
@@ -164,12 +208,13 @@ drm_public int amdgpu_device_initialize(int fd,
 		return r;
 	}
 
-	for (dev = dev_list; dev; dev = dev->next)
-		if (fd_compare(dev->fd, fd) == 0)
-			break;
-
+	dev = amdgpu_find_device(fd, &primary_name);
 	if (dev) {
-		r = amdgpu_get_auth(dev->fd, &flag_authexist);
+		free(primary_name);
+
+		/* Only a legacy fd may have to replace the flink fd. */
+		if (flag_auth)
+			r = amdgpu_get_auth(dev->fd, &flag_authexist);
 		if (r) {
 			fprintf(stderr, "%s: amdgpu_get_auth (2) failed (%i)\n",
 				__func__, r);
@@ -189,12 +234,17 @@ drm_public int amdgpu_device_initialize(int fd,
 	dev = calloc(1, sizeof(struct amdgpu_device));
 	if (!dev) {
 		fprintf(stderr, "%s: calloc failed\n", __func__);
+		free(primary_name);
 		pthread_mutex_unlock(&dev_mutex);
 		return -ENOMEM;
 	}
 
 	dev->fd = -1;
 	dev->flink_fd = -1;
+	dev->primary_name = primary_name;
+	r = drmGetNodeTypeFromFd(fd);
+	if (r >= 0 && r < DRM_NODE_MAX && !fstat(fd, &sbuf))
+		dev->node_rdev[r] = sbuf.st_rdev;
 
 	atomic_set(&dev->refcount, 1);
 
@@ -218,6 +268,17 @@ drm_public int amdgpu_device_initialize(int fd,
 	drmFreeVersion(version);
 
 	pthread_mutex_init(&dev->bo_table_mutex, NULL);
+	util_bo_labels_init(&dev->bo_labels, AMDGPU_BO_LABEL_HEAPS);
+	pthread_mutex_init(&dev->cpu_map_mutex, NULL);
+	pthread_mutex_init(&dev->bo_list_mutex, NULL);
+	list_inithead(&dev->bo_lists);
+	list_inithead(&dev->userptr_idle);
+	list_inithead(&dev->ctx_pool);
+	pthread_mutex_init(&dev->ctx_pool_mutex, NULL);
+	pthread_mutex_init(&dev->scratch_syncobj_mutex, NULL);
+	pthread_mutex_init(&dev->trace_mutex, NULL);
+	list_inithead(&dev->trace_buffers);
+	pthread_mutex_init(&dev->info_mutex, NULL);
 
 	/* Check if acceleration is working. */
 	r = amdgpu_query_info(dev, AMDGPU_INFO_ACCEL_WORKING, 4, &accel_working);
@@ -247,6 +308,7 @@ drm_public int amdgpu_device_initialize(int fd,
 	max = MAX2(dev->dev_info.virtual_address_max, 0x100000000ULL);
 	amdgpu_vamgr_init(&dev->vamgr, start, max,
 			  dev->dev_info.virtual_address_alignment);
+	amdgpu_vamgr_init_magazines(&dev->vamgr);
 
 	start = dev->dev_info.high_va_offset;
 	max = MIN2(dev->dev_info.high_va_max, (start & ~0xffffffffULL) +
@@ -259,6 +321,7 @@ drm_public int amdgpu_device_initialize(int fd,
 		   0x100000000ULL);
 	amdgpu_vamgr_init(&dev->vamgr_high, start, max,
 			  dev->dev_info.virtual_address_alignment);
+	amdgpu_vamgr_init_magazines(&dev->vamgr_high);
 
 	amdgpu_parse_asic_ids(dev);
 
@@ -272,8 +335,11 @@ drm_public int amdgpu_device_initialize(int fd,
 	return 0;
 
 cleanup:
-	if (dev->fd >= 0)
+	if (dev->fd >= 0) {
+		drmInvalidateMetadataCache(dev->fd);
 		close(dev->fd);
+	}
+	free(dev->primary_name);
 	free(dev);
 	pthread_mutex_unlock(&dev_mutex);
 	return r;
@@ -306,3 +372,10 @@ drm_public int amdgpu_query_sw_info(amdgpu_device_handle dev,
 	}
 	return -EINVAL;
 }
+
+drm_public void amdgpu_dump_bo_usage(amdgpu_device_handle dev, FILE *file)
+{
+	pthread_mutex_lock(&dev->bo_table_mutex);
+	amdgpu_dump_bo_usage_locked(dev, file);
+	pthread_mutex_unlock(&dev->bo_table_mutex);
+}
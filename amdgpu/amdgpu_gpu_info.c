@@ -78,11 +78,41 @@ drm_public int amdgpu_read_mm_registers(amdgpu_device_handle dev,
 			       sizeof(struct drm_amdgpu_info));
 }
 
+drm_public int amdgpu_read_mm_register_ranges(amdgpu_device_handle dev,
+			const struct amdgpu_mm_register_range *ranges,
+			unsigned num_ranges, uint32_t *values)
+{
+	unsigned i;
+	int r;
+
+	for (i = 0; i < num_ranges; i++) {
+		r = amdgpu_read_mm_registers(dev, ranges[i].dword_offset,
+					     ranges[i].count,
+					     ranges[i].instance,
+					     ranges[i].flags, values);
+		if (r)
+			return r;
+		values += ranges[i].count;
+	}
+	return 0;
+}
+
 drm_public int amdgpu_query_hw_ip_count(amdgpu_device_handle dev,
 					unsigned type,
 					uint32_t *count)
 {
 	struct drm_amdgpu_info request;
+	int r;
+
+	if (type < AMDGPU_HW_IP_NUM) {
+		pthread_mutex_lock(&dev->info_mutex);
+		if (dev->hw_ip_count_valid & (1u << type)) {
+			*count = dev->hw_ip_count[type];
+			pthread_mutex_unlock(&dev->info_mutex);
+			return 0;
+		}
+		pthread_mutex_unlock(&dev->info_mutex);
+	}
 
 	memset(&request, 0, sizeof(request));
 	request.return_pointer = (uintptr_t)count;
@@ -90,8 +120,16 @@ drm_public int amdgpu_query_hw_ip_count(amdgpu_device_handle dev,
 	request.query = AMDGPU_INFO_HW_IP_COUNT;
 	request.query_hw_ip.type = type;
 
-	return drmCommandWrite(dev->fd, DRM_AMDGPU_INFO, &request,
-			       sizeof(struct drm_amdgpu_info));
+	r = drmCommandWrite(dev->fd, DRM_AMDGPU_INFO, &request,
+			    sizeof(struct drm_amdgpu_info));
+	if (r || type >= AMDGPU_HW_IP_NUM)
+		return r;
+
+	pthread_mutex_lock(&dev->info_mutex);
+	dev->hw_ip_count[type] = *count;
+	dev->hw_ip_count_valid |= 1u << type;
+	pthread_mutex_unlock(&dev->info_mutex);
+	return 0;
 }
 
 drm_public int amdgpu_query_hw_ip_info(amdgpu_device_handle dev, unsigned type,
@@ -99,6 +137,18 @@ drm_public int amdgpu_query_hw_ip_info(amdgpu_device_handle dev, unsigned type,
 				       struct drm_amdgpu_info_hw_ip *info)
 {
 	struct drm_amdgpu_info request;
+	bool cached = type < AMDGPU_HW_IP_NUM && ip_instance == 0;
+	int r;
+
+	if (cached) {
+		pthread_mutex_lock(&dev->info_mutex);
+		if (dev->hw_ip_info_valid & (1u << type)) {
+			*info = dev->hw_ip_info[type];
+			pthread_mutex_unlock(&dev->info_mutex);
+			return 0;
+		}
+		pthread_mutex_unlock(&dev->info_mutex);
+	}
 
 	memset(&request, 0, sizeof(request));
 	request.return_pointer = (uintptr_t)info;
@@ -107,8 +157,16 @@ drm_public int amdgpu_query_hw_ip_info(amdgpu_device_handle dev, unsigned type,
 	request.query_hw_ip.type = type;
 	request.query_hw_ip.ip_instance = ip_instance;
 
-	return drmCommandWrite(dev->fd, DRM_AMDGPU_INFO, &request,
-			       sizeof(struct drm_amdgpu_info));
+	r = drmCommandWrite(dev->fd, DRM_AMDGPU_INFO, &request,
+			    sizeof(struct drm_amdgpu_info));
+	if (r || !cached)
+		return r;
+
+	pthread_mutex_lock(&dev->info_mutex);
+	dev->hw_ip_info[type] = *info;
+	dev->hw_ip_info_valid |= 1u << type;
+	pthread_mutex_unlock(&dev->info_mutex);
+	return 0;
 }
 
 drm_public int amdgpu_query_firmware_version(amdgpu_device_handle dev,
@@ -117,8 +175,24 @@ drm_public int amdgpu_query_firmware_version(amdgpu_device_handle dev,
 {
 	struct drm_amdgpu_info request;
 	struct drm_amdgpu_info_firmware firmware = {};
+	struct amdgpu_fw_cache_entry *entry;
+	unsigned i;
 	int r;
 
+	pthread_mutex_lock(&dev->info_mutex);
+	for (i = 0; i < dev->num_fw_cache; i++) {
+		entry = &dev->fw_cache[i];
+		if (entry->fw_type == fw_type &&
+		    entry->ip_instance == ip_instance &&
+		    entry->index == index) {
+			*version = entry->version;
+			*feature = entry->feature;
+			pthread_mutex_unlock(&dev->info_mutex);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&dev->info_mutex);
+
 	memset(&request, 0, sizeof(request));
 	request.return_pointer = (uintptr_t)&firmware;
 	request.return_size = sizeof(firmware);
@@ -134,6 +208,19 @@ drm_public int amdgpu_query_firmware_version(amdgpu_device_handle dev,
 
 	*version = firmware.ver;
 	*feature = firmware.feature;
+
+	/* Racing queries of the same firmware may both add it, which is
+	 * harmless. */
+	pthread_mutex_lock(&dev->info_mutex);
+	if (dev->num_fw_cache < AMDGPU_FW_CACHE_SIZE) {
+		entry = &dev->fw_cache[dev->num_fw_cache++];
+		entry->fw_type = fw_type;
+		entry->ip_instance = ip_instance;
+		entry->index = index;
+		entry->version = firmware.ver;
+		entry->feature = firmware.feature;
+	}
+	pthread_mutex_unlock(&dev->info_mutex);
 	return 0;
 }
 
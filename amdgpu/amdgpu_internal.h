@@ -30,9 +30,12 @@
 
 #include "libdrm_macros.h"
 #include "xf86atomic.h"
+#include "xf86drm.h"
 #include "amdgpu.h"
+#include "util_bo_labels.h"
 #include "util_double_list.h"
-#include "handle_table.h"
+#include "util_handle_table.h"
+#include "util_trace.h"
 
 #define AMDGPU_CS_MAX_RINGS 8
 /* do not use below macro if b is not power of 2 aligned value */
@@ -42,18 +45,54 @@
 
 #define AMDGPU_INVALID_VA_ADDRESS	0xffffffffffffffff
 #define AMDGPU_NULL_SUBMIT_SEQ		0
+/* Size of the GPU page table entries covering a whole page directory. */
+#define AMDGPU_VA_HUGE_PAGE_SIZE	(2ull * 1024 * 1024)
 
 struct amdgpu_bo_va_hole {
-	struct list_head list;
+	struct amdgpu_bo_va_hole *left;
+	struct amdgpu_bo_va_hole *right;
 	uint64_t offset;
 	uint64_t size;
+	/* Largest hole in the subtree rooted here. */
+	uint64_t max_size;
+	int height;
+};
+
+/* Per-thread caches of freed ranges, one per power of two size class from
+ * 64 KiB to 2 MiB, each range aligned to its size. */
+#define AMDGPU_VA_MAGAZINE_MIN_SHIFT	16
+#define AMDGPU_VA_MAGAZINE_CLASSES	6
+#define AMDGPU_VA_MAGAZINE_SIZE		16
+#define AMDGPU_VA_MAGAZINE_BATCH	8
+
+struct amdgpu_va_magazine_entry {
+	uint64_t address;
+	struct amdgpu_bo_va_hole *spare;
+};
+
+struct amdgpu_va_magazine {
+	struct list_head list;
+	struct amdgpu_bo_va_mgr *mgr;
+	/* Only contended when another thread has to drain all magazines. */
+	pthread_mutex_t lock;
+	unsigned count[AMDGPU_VA_MAGAZINE_CLASSES];
+	struct amdgpu_va_magazine_entry
+		entries[AMDGPU_VA_MAGAZINE_CLASSES][AMDGPU_VA_MAGAZINE_SIZE];
 };
 
 struct amdgpu_bo_va_mgr {
 	uint64_t va_max;
-	struct list_head va_holes;
+	/* AVL tree of the holes, sorted by offset. */
+	struct amdgpu_bo_va_hole *va_holes;
 	pthread_mutex_t bo_va_mutex;
 	uint32_t va_alignment;
+
+	bool use_magazines;
+	pthread_key_t magazine_key;
+	/** List of the magazines of all threads. Protected by magazines_mutex,
+	 * which is taken before any magazine lock and bo_va_mutex. */
+	struct list_head magazines;
+	pthread_mutex_t magazines_mutex;
 };
 
 struct amdgpu_va {
@@ -62,6 +101,59 @@ struct amdgpu_va {
 	uint64_t size;
 	enum amdgpu_gpu_va_range range;
 	struct amdgpu_bo_va_mgr *vamgr;
+	/* Hole node for returning the range, so that freeing can't fail. */
+	struct amdgpu_bo_va_hole *spare;
+};
+
+/* Buffers that may be reused must agree on all of these. */
+struct amdgpu_bo_cache_key {
+	uint64_t size;
+	uint64_t alignment;
+	uint64_t flags;
+	uint32_t heap;
+	bool mapped;
+	uint64_t va_flags;
+	uint64_t vm_flags;
+};
+
+/* 4 KiB to 12 KiB, then four buckets per power of two up to 64 MiB */
+#define AMDGPU_BO_CACHE_BUCKETS 55
+
+/* Firmware versions remembered by amdgpu_query_firmware_version(). */
+#define AMDGPU_FW_CACHE_SIZE 32
+
+/* Binary syncobjs kept for the transfers of timeline points. */
+#define AMDGPU_SCRATCH_SYNCOBJS 4
+
+struct amdgpu_fw_cache_entry {
+	unsigned fw_type;
+	unsigned ip_instance;
+	unsigned index;
+	uint32_t version;
+	uint32_t feature;
+};
+
+struct amdgpu_bo_cache_bucket {
+	uint64_t size;
+	struct list_head list;
+};
+
+struct amdgpu_bo_cache {
+	/* Total size of the idle buffers kept, 0 when the cache is off. */
+	uint64_t max_size;
+	uint64_t size;
+	uint32_t max_age_ms;
+	unsigned num_buckets;
+	struct amdgpu_bo_cache_bucket buckets[AMDGPU_BO_CACHE_BUCKETS];
+	/* All idle buffers, least recently freed first. */
+	struct list_head lru;
+};
+
+/* A CPU mapping of a buffer, [start, end) never overlaps another one. */
+struct amdgpu_cpu_mapping {
+	uintptr_t start;
+	uintptr_t end;
+	struct amdgpu_bo *bo;
 };
 
 struct amdgpu_device {
@@ -73,14 +165,79 @@ struct amdgpu_device {
 	unsigned minor_version;
 
 	char *marketing_name;
+	/** Primary node name and device number of the nodes this device
+	 * was opened through. Protected by dev_mutex. */
+	char *primary_name;
+	dev_t node_rdev[DRM_NODE_MAX];
 	/** List of buffer handles. Protected by bo_table_mutex. */
 	struct handle_table bo_handles;
 	/** List of buffer GEM flink names. Protected by bo_table_mutex. */
 	struct handle_table bo_flink_names;
+	/** Idle buffers for reuse. Protected by bo_table_mutex. */
+	struct amdgpu_bo_cache bo_cache;
 	/** This protects all hash tables. */
 	pthread_mutex_t bo_table_mutex;
+	/** Source of amdgpu_bo::unique_id. Protected by bo_table_mutex. */
+	uint64_t next_bo_id;
+	/** Live buffers by label and AMDGPU_BO_LABEL_HEAP_*. Protected by
+	 * bo_table_mutex. */
+	struct util_bo_labels bo_labels;
+	/** Bytes of the buffers with a handle, cached ones included, by
+	 * AMDGPU_BO_LABEL_HEAP_*. Changed atomically, see amdgpu_budget.c. */
+	uint64_t heap_bytes[AMDGPU_BO_LABEL_HEAPS];
+	/** Idle userptr buffers, least recently freed first. Protected by
+	 * bo_table_mutex. */
+	struct list_head userptr_idle;
+	unsigned num_userptr_idle;
+	/** Idle contexts for amdgpu_cs_ctx_pool_get(), most recently put
+	 * first. Protected by ctx_pool_mutex. */
+	struct list_head ctx_pool;
+	unsigned num_ctx_pool;
+	pthread_mutex_t ctx_pool_mutex;
+	/** Idle binary syncobjs for the sync_file export and import of
+	 * timeline points. Protected by scratch_syncobj_mutex. */
+	uint32_t scratch_syncobjs[AMDGPU_SCRATCH_SYNCOBJS];
+	unsigned num_scratch_syncobjs;
+	pthread_mutex_t scratch_syncobj_mutex;
+	/** Whether amdgpu_bo_query_info() answers from the cache for
+	 * buffers shared with another process. */
+	bool trust_shared_bo_info;
+	/** Cached BO lists, most recently used first. Protected by
+	 * bo_list_mutex. */
+	struct list_head bo_lists;
+	unsigned num_bo_lists;
+	uint64_t bo_list_hits;
+	uint64_t bo_list_misses;
+	pthread_mutex_t bo_list_mutex;
+	/** Unlocked lookups in progress in each phase, see
+	 * amdgpu_bo_wait_lookups(). */
+	atomic_t bo_lookups[2];
+	atomic_t bo_lookup_phase;
+	/** CPU mappings of the buffers sorted by address. Protected by
+	 * cpu_map_mutex, which is taken after any cpu_access_mutex. */
+	struct amdgpu_cpu_mapping *cpu_maps;
+	unsigned num_cpu_maps;
+	unsigned max_cpu_maps;
+	pthread_mutex_t cpu_map_mutex;
+	/** Tracing, see amdgpu_trace.c. The buffers are protected by
+	 * trace_mutex. */
+	bool trace_enabled;
+	bool trace_key_valid;
+	pthread_key_t trace_key;
+	struct list_head trace_buffers;
+	uint32_t trace_next_tid;
+	pthread_mutex_t trace_mutex;
 	struct drm_amdgpu_info_device dev_info;
 	struct amdgpu_gpu_info info;
+	/** Answers of the kernel which don't change, kept on first query.
+	 * Only instance 0 of the IP info is kept. Protected by info_mutex. */
+	uint32_t hw_ip_count_valid;
+	uint32_t hw_ip_count[AMDGPU_HW_IP_NUM];
+	uint32_t hw_ip_info_valid;
+	struct drm_amdgpu_info_hw_ip hw_ip_info[AMDGPU_HW_IP_NUM];
+	struct amdgpu_fw_cache_entry fw_cache[AMDGPU_FW_CACHE_SIZE];
+	unsigned num_fw_cache;
+	pthread_mutex_t info_mutex;
 	/** The VA manager for the lower virtual address space */
 	struct amdgpu_bo_va_mgr vamgr;
 	/** The VA manager for the 32bit address space */
@@ -99,16 +256,112 @@ struct amdgpu_bo {
 
 	uint32_t handle;
 	uint32_t flink_name;
+	/* Never reused, unlike handles and pointers. */
+	uint64_t unique_id;
+	/* Index in dev->bo_labels and AMDGPU_BO_LABEL_HEAP_*. */
+	unsigned label;
+	unsigned label_heap;
 
 	pthread_mutex_t cpu_access_mutex;
 	void *cpu_ptr;
+	/* Changed atomically so that nested mappings don't need the mutex,
+	 * which is still taken for the first and the last one. */
 	int64_t cpu_map_count;
+	/* One of the mappings is held until the buffer is freed. */
+	bool cpu_map_persistent;
+
+	/* GPU mapping made by amdgpu_bo_alloc_mapped(). */
+	amdgpu_va_handle va_handle;
+	uint64_t va_address;
+
+	/* Allocated by us and never exported, so it may be cached. */
+	bool reusable;
+	struct amdgpu_bo_cache_key cache_key;
+	struct list_head cache_list;
+	struct list_head cache_lru;
+	uint64_t cache_time;
+
+	/* Memory of a userptr buffer indexed in dev->cpu_maps, which stays
+	 * in dev->userptr_idle once freed. */
+	void *user_ptr;
+	struct list_head userptr_lru;
+
+	/* Imported or exported, so others may change the metadata. */
+	bool shared;
+	/* Answer of the last amdgpu_bo_query_info(), and the count of
+	 * amdgpu_bo_set_metadata() calls it must match to be kept. Protected
+	 * by cpu_access_mutex. */
+	struct amdgpu_bo_info *info;
+	uint32_t info_gen;
+};
+
+/* Entry of the sorted buffer set a list was made from. */
+struct amdgpu_bo_list_key {
+	uint64_t bo_id;
+	uint32_t priority;
+};
+
+enum amdgpu_trace_type {
+	AMDGPU_TRACE_CS_SUBMIT,
+	AMDGPU_TRACE_CS_SUBMIT_RAW2,
+	AMDGPU_TRACE_CS_WAIT_FENCES,
+	AMDGPU_TRACE_BO_ALLOC,
+};
+
+/* What amdgpu_trace_record() keeps of a call. */
+struct amdgpu_trace_event {
+	uint64_t start_ns;
+	uint64_t end_ns;
+	enum amdgpu_trace_type type;
+	int result;
+	/* Set by amdgpu_trace_record(), buffers outlive their threads. */
+	uint32_t tid;
+	uint32_t ip_type;
+	uint32_t ip_instance;
+	uint32_t ring;
+	/* Chunks submitted, or fences waited for. */
+	uint32_t count;
+	uint32_t num_bos;
+	uint64_t seq_no;
+	uint64_t size;
 };
 
+/* Idle userptr buffers kept by amdgpu_create_bo_from_user_mem(). */
+#define AMDGPU_USERPTR_CACHE_SIZE 16
+
+/* Idle contexts kept by amdgpu_cs_ctx_pool_put(). */
+#define AMDGPU_CTX_POOL_SIZE 8
+
+/* Size of the cache of amdgpu_bo_list_create_cached(). */
+#define AMDGPU_BO_LIST_CACHE_SIZE 32
+
 struct amdgpu_bo_list {
 	struct amdgpu_device *dev;
 
 	uint32_t handle;
+
+	/* One reference for the cache while the list is in it. */
+	atomic_t refcount;
+	/* Made by amdgpu_bo_list_create_cached(), so it can't be updated. */
+	bool shared;
+	struct list_head cache_list;
+
+	/* NULL if it couldn't be allocated. */
+	struct amdgpu_bo_list_key *keys;
+	uint32_t num_keys;
+	uint32_t hash;
+};
+
+/* User fence memory of a ring as the CPU sees it. */
+struct amdgpu_cs_user_fence {
+	/* Fence BO last used by submissions to the ring, kept mapped. */
+	amdgpu_bo_handle bo;
+	uint64_t *cpu;
+	uint64_t offset;
+	/* All of the submissions from first_seq to last_seq write their
+	 * sequence number there, none do if first_seq is 0. */
+	uint64_t first_seq;
+	uint64_t last_seq;
 };
 
 struct amdgpu_context {
@@ -118,8 +371,45 @@ struct amdgpu_context {
 	pthread_mutex_t sequence_mutex;
 	/* context id*/
 	uint32_t id;
+	/* AMDGPU_CTX_PRIORITY_* it was created with. */
+	int32_t priority;
 	uint64_t last_seq[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
 	struct list_head sem_list[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+	/* Number of entries in each sem_list, which is only initialized
+	 * while not 0. */
+	uint32_t sem_count[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+	struct amdgpu_cs_user_fence user_fence[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+	/* How long to poll user fences before waiting in the kernel. */
+	uint64_t fence_spin_ns;
+	/* Sequence numbers are points on a timeline syncobj per ring,
+	 * created on first use. */
+	bool timelines;
+	uint32_t timeline[AMDGPU_HW_IP_NUM][AMDGPU_HW_IP_INSTANCE_MAX_COUNT][AMDGPU_CS_MAX_RINGS];
+	/* Link in dev->ctx_pool while idle. */
+	struct list_head pool_link;
+};
+
+/* Prebuilt chunks for repeated submissions to the same ring. */
+struct amdgpu_cs_template {
+	amdgpu_context_handle context;
+	unsigned ip_type;
+	unsigned ip_instance;
+	uint32_t ring;
+	uint32_t bo_list_handle;
+	struct amdgpu_cs_fence_info fence_info;
+	uint32_t number_of_ibs;
+	/* IB chunks and the fence chunk, always submitted. */
+	uint32_t num_fixed_chunks;
+	uint32_t max_dependencies;
+	uint32_t max_sem_dependencies;
+	/* Room for the dependency and timeline chunks after the fixed ones. */
+	struct drm_amdgpu_cs_chunk *chunks;
+	uint64_t *chunk_array;
+	struct drm_amdgpu_cs_chunk_data *chunk_data;
+	struct drm_amdgpu_cs_chunk_dep *dependencies;
+	struct drm_amdgpu_cs_chunk_dep *sem_dependencies;
+	struct drm_amdgpu_cs_chunk_syncobj *timeline_waits;
+	struct drm_amdgpu_cs_chunk_syncobj timeline_signal;
 };
 
 /**
@@ -139,18 +429,63 @@ struct amdgpu_semaphore {
 drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 		       uint64_t max, uint64_t alignment);
 
+drm_private void amdgpu_vamgr_init_magazines(struct amdgpu_bo_va_mgr *mgr);
+
 drm_private void amdgpu_vamgr_deinit(struct amdgpu_bo_va_mgr *mgr);
 
+drm_private uint64_t amdgpu_va_fragment_size(struct amdgpu_device *dev,
+					     uint64_t size);
+
 drm_private void amdgpu_parse_asic_ids(struct amdgpu_device *dev);
 
+drm_private void amdgpu_bo_list_cache_fini(struct amdgpu_device *dev);
+
+drm_private void amdgpu_cs_ctx_pool_fini(struct amdgpu_device *dev);
+
+drm_private void amdgpu_cs_scratch_syncobj_fini(struct amdgpu_device *dev);
+
+drm_private void amdgpu_bo_destroy_locked(struct amdgpu_bo *bo);
+
+drm_private void amdgpu_dump_bo_usage_locked(amdgpu_device_handle dev,
+					     FILE *file);
+
+drm_private bool amdgpu_bo_cache_init_key(struct amdgpu_device *dev,
+					  struct amdgpu_bo_cache_key *key,
+					  struct amdgpu_bo_alloc_request *request,
+					  bool mapped, uint64_t va_flags,
+					  uint64_t vm_flags);
+drm_private struct amdgpu_bo *
+amdgpu_bo_cache_take(struct amdgpu_device *dev,
+		     const struct amdgpu_bo_cache_key *key);
+drm_private bool amdgpu_bo_cache_put(struct amdgpu_bo *bo);
+drm_private void amdgpu_bo_cache_fini(struct amdgpu_device *dev);
+drm_private void amdgpu_userptr_cache_fini(struct amdgpu_device *dev);
+
 drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev);
 
 drm_private uint64_t amdgpu_cs_calculate_timeout(uint64_t timeout);
 
+drm_private uint64_t amdgpu_trace_now(void);
+drm_private void amdgpu_trace_record(struct amdgpu_device *dev,
+				     struct amdgpu_trace_event *event);
+drm_private void amdgpu_trace_fini(struct amdgpu_device *dev);
+
 /**
  * Inline functions.
  */
 
+/**
+ * Start time of a traced call, 0 when tracing is off so that the hooks
+ * only cost a predictable branch.
+ */
+static inline uint64_t amdgpu_trace_begin(struct amdgpu_device *dev)
+{
+	if (__builtin_expect(__atomic_load_n(&dev->trace_enabled,
+					     __ATOMIC_RELAXED), 0))
+		return amdgpu_trace_now();
+	return 0;
+}
+
 /**
  * Increment src and decrement dst as if we were updating references
  * for an assignment between 2 pointers of some objects.
@@ -0,0 +1,224 @@
+/*
+ * Copyright © 2014 Advanced Micro Devices, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+/* Registers a sampler reads, over all of its ranges. */
+#define AMDGPU_REG_SAMPLER_MAX_REGS 256
+
+struct amdgpu_reg_sampler {
+	amdgpu_device_handle dev;
+	struct amdgpu_mm_register_range *ranges;
+	unsigned num_ranges;
+	struct amdgpu_reg_sampler_field fields[AMDGPU_REG_SAMPLER_MAX_FIELDS];
+	unsigned num_fields;
+	uint32_t *values;
+	uint64_t period_ns;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+
+	/* Odd while the stats are written by the sampling thread. */
+	uint32_t seq;
+	struct amdgpu_reg_sampler_stats stats;
+};
+
+static uint64_t amdgpu_reg_sampler_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void amdgpu_reg_sampler_take(struct amdgpu_reg_sampler *s)
+{
+	struct amdgpu_reg_sampler_field *field;
+	bool failed;
+	unsigned i;
+
+	failed = amdgpu_read_mm_register_ranges(s->dev, s->ranges,
+						s->num_ranges, s->values) != 0;
+
+	/* The stats are a seqlock with a single writer. */
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	if (failed) {
+		s->stats.failed++;
+	} else {
+		s->stats.samples++;
+		for (i = 0; i < s->num_fields; i++) {
+			field = &s->fields[i];
+			if ((s->values[field->reg] & field->mask) !=
+			    field->idle_value)
+				s->stats.busy[i]++;
+		}
+	}
+	__atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void *amdgpu_reg_sampler_thread(void *data)
+{
+	struct amdgpu_reg_sampler *s = data;
+	uint64_t next = amdgpu_reg_sampler_now();
+	struct timespec ts;
+
+	pthread_mutex_lock(&s->lock);
+	while (!s->stop) {
+		pthread_mutex_unlock(&s->lock);
+		amdgpu_reg_sampler_take(s);
+
+		/* Don't try to catch up after falling behind. */
+		next = MAX2(next + s->period_ns, amdgpu_reg_sampler_now());
+		ts.tv_sec = next / 1000000000ull;
+		ts.tv_nsec = next % 1000000000ull;
+
+		pthread_mutex_lock(&s->lock);
+		while (!s->stop &&
+		       pthread_cond_timedwait(&s->cond, &s->lock, &ts) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+drm_public int amdgpu_reg_sampler_create(amdgpu_device_handle dev,
+			const struct amdgpu_mm_register_range *ranges,
+			unsigned num_ranges,
+			const struct amdgpu_reg_sampler_field *fields,
+			unsigned num_fields, uint32_t period_us,
+			amdgpu_reg_sampler_handle *sampler)
+{
+	struct amdgpu_reg_sampler *s;
+	pthread_condattr_t attr;
+	unsigned i, num_regs = 0;
+	int r;
+
+	if (NULL == dev || !sampler || !period_us || !num_ranges || !ranges ||
+	    num_fields > AMDGPU_REG_SAMPLER_MAX_FIELDS ||
+	    (num_fields && !fields))
+		return -EINVAL;
+
+	for (i = 0; i < num_ranges; i++) {
+		if (!ranges[i].count ||
+		    ranges[i].count > AMDGPU_REG_SAMPLER_MAX_REGS - num_regs)
+			return -EINVAL;
+		num_regs += ranges[i].count;
+	}
+	for (i = 0; i < num_fields; i++) {
+		if (fields[i].reg >= num_regs)
+			return -EINVAL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+
+	s->ranges = malloc(num_ranges * sizeof(*ranges));
+	s->values = calloc(num_regs, sizeof(*s->values));
+	if (!s->ranges || !s->values) {
+		r = -ENOMEM;
+		goto error;
+	}
+
+	s->dev = dev;
+	memcpy(s->ranges, ranges, num_ranges * sizeof(*ranges));
+	s->num_ranges = num_ranges;
+	memcpy(s->fields, fields, num_fields * sizeof(*fields));
+	s->num_fields = num_fields;
+	s->period_ns = period_us * 1000ull;
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&s->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	r = -pthread_create(&s->thread, NULL, amdgpu_reg_sampler_thread, s);
+	if (r) {
+		pthread_cond_destroy(&s->cond);
+		pthread_mutex_destroy(&s->lock);
+		goto error;
+	}
+
+	*sampler = s;
+	return 0;
+
+error:
+	free(s->values);
+	free(s->ranges);
+	free(s);
+	return r;
+}
+
+drm_public int amdgpu_reg_sampler_destroy(amdgpu_reg_sampler_handle sampler)
+{
+	if (!sampler)
+		return -EINVAL;
+
+	pthread_mutex_lock(&sampler->lock);
+	sampler->stop = true;
+	pthread_cond_signal(&sampler->cond);
+	pthread_mutex_unlock(&sampler->lock);
+	pthread_join(sampler->thread, NULL);
+
+	pthread_cond_destroy(&sampler->cond);
+	pthread_mutex_destroy(&sampler->lock);
+	free(sampler->values);
+	free(sampler->ranges);
+	free(sampler);
+	return 0;
+}
+
+drm_public int amdgpu_reg_sampler_query(amdgpu_reg_sampler_handle sampler,
+					struct amdgpu_reg_sampler_stats *stats)
+{
+	uint32_t seq;
+
+	if (!sampler || !stats)
+		return -EINVAL;
+
+	do {
+		seq = __atomic_load_n(&sampler->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		*stats = sampler->stats;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq & 1 ||
+		 __atomic_load_n(&sampler->seq, __ATOMIC_RELAXED) != seq);
+
+	return 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright © 2014 Advanced Micro Devices, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libdrm_macros.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+/* SDMA packets, the same as the kernel emits for its buffer moves. */
+#define SDMA_PACKET(op, sub_op, e)	((((e) & 0xFFFF) << 16) |	\
+					 (((sub_op) & 0xFF) << 8) |	\
+					 (((op) & 0xFF) << 0))
+#define SDMA_OPCODE_NOP			0
+#define SDMA_OPCODE_COPY		1
+#define SDMA_COPY_SUB_OPCODE_LINEAR	0
+#define SDMA_OPCODE_CONSTANT_FILL	11
+#define SDMA_CONSTANT_FILL_DWORD	(2 << 14)	/* fill size of the value */
+
+#define SDMA_PACKET_SI(op, b, t, s, cnt)	((((op) & 0xF) << 28) |	\
+						 (((b) & 0x1) << 26) |	\
+						 (((t) & 0x1) << 23) |	\
+						 (((s) & 0x1) << 22) |	\
+						 (((cnt) & 0xFFFFF) << 0))
+#define SDMA_OPCODE_COPY_SI		3
+#define SDMA_OPCODE_CONSTANT_FILL_SI	13
+#define SDMA_OPCODE_NOP_SI		15
+
+#define AMDGPU_SDMA_COPY_DW		7
+#define AMDGPU_SDMA_FILL_DW		5
+#define AMDGPU_SDMA_COPY_DW_SI		5
+#define AMDGPU_SDMA_FILL_DW_SI		4
+/* IBs of the SDMA ring are padded to 8 dwords. */
+#define AMDGPU_SDMA_IB_ALIGN_DW		8
+
+struct amdgpu_sdma {
+	amdgpu_device_handle dev;
+	amdgpu_context_handle context;
+	amdgpu_cs_ib_pool_handle pool;
+	uint32_t family;
+	/* Most bytes one packet moves, rounded down to a dword. */
+	uint64_t max_bytes;
+	/* Keeps the IBs handed out and the fences given to the pool in the
+	 * order of the submissions. */
+	pthread_mutex_t lock;
+	/* Fence of the last submission, under lock. */
+	struct amdgpu_cs_fence last;
+};
+
+drm_public int amdgpu_sdma_create(amdgpu_device_handle dev,
+				  amdgpu_sdma_handle *sdma)
+{
+	struct drm_amdgpu_info_hw_ip ip = {};
+	struct amdgpu_sdma *s;
+	int r;
+
+	if (!dev || !sdma)
+		return -EINVAL;
+
+	r = amdgpu_query_hw_ip_info(dev, AMDGPU_HW_IP_DMA, 0, &ip);
+	if (r)
+		return r;
+	if (!ip.available_rings)
+		return -ENODEV;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+
+	s->dev = dev;
+	s->family = dev->info.family_id;
+	if (s->family == AMDGPU_FAMILY_SI)
+		s->max_bytes = 0xffff8;
+	else if (s->family < AMDGPU_FAMILY_VI)
+		s->max_bytes = 0x1ffffc;
+	else if (s->family < AMDGPU_FAMILY_AI)
+		s->max_bytes = 0x3fffe0;
+	else
+		s->max_bytes = 0x400000;
+
+	r = amdgpu_cs_ctx_create(dev, &s->context);
+	if (r) {
+		free(s);
+		return r;
+	}
+
+	r = amdgpu_cs_ib_pool_create(dev, 0, &s->pool);
+	if (r) {
+		amdgpu_cs_ctx_free(s->context);
+		free(s);
+		return r;
+	}
+
+	s->last.context = s->context;
+	s->last.ip_type = AMDGPU_HW_IP_DMA;
+	s->last.fence = AMDGPU_NULL_SUBMIT_SEQ;
+	pthread_mutex_init(&s->lock, NULL);
+	*sdma = s;
+	return 0;
+}
+
+drm_public int amdgpu_sdma_destroy(amdgpu_sdma_handle sdma)
+{
+	if (!sdma)
+		return -EINVAL;
+
+	amdgpu_cs_ctx_free(sdma->context);
+	amdgpu_cs_ib_pool_destroy(sdma->pool);
+	pthread_mutex_destroy(&sdma->lock);
+	free(sdma);
+	return 0;
+}
+
+static uint32_t amdgpu_sdma_count(struct amdgpu_sdma *sdma, uint64_t bytes)
+{
+	/* AI and later take the count minus one. */
+	return sdma->family >= AMDGPU_FAMILY_AI ? bytes - 1 : bytes;
+}
+
+static uint32_t *amdgpu_sdma_emit_copy(struct amdgpu_sdma *sdma, uint32_t *cs,
+				       uint64_t dst, uint64_t src,
+				       uint64_t bytes)
+{
+	if (sdma->family == AMDGPU_FAMILY_SI) {
+		*cs++ = SDMA_PACKET_SI(SDMA_OPCODE_COPY_SI, 1, 0, 0, bytes);
+		*cs++ = dst;
+		*cs++ = src;
+		*cs++ = (dst >> 32) & 0xff;
+		*cs++ = (src >> 32) & 0xff;
+		return cs;
+	}
+
+	*cs++ = SDMA_PACKET(SDMA_OPCODE_COPY, SDMA_COPY_SUB_OPCODE_LINEAR, 0);
+	*cs++ = amdgpu_sdma_count(sdma, bytes);
+	*cs++ = 0;
+	*cs++ = src;
+	*cs++ = src >> 32;
+	*cs++ = dst;
+	*cs++ = dst >> 32;
+	return cs;
+}
+
+static uint32_t *amdgpu_sdma_emit_fill(struct amdgpu_sdma *sdma, uint32_t *cs,
+				       uint64_t dst, uint32_t value,
+				       uint64_t bytes)
+{
+	if (sdma->family == AMDGPU_FAMILY_SI) {
+		*cs++ = SDMA_PACKET_SI(SDMA_OPCODE_CONSTANT_FILL_SI, 0, 0, 0,
+				       bytes / 4);
+		*cs++ = dst;
+		*cs++ = value;
+		*cs++ = ((dst >> 32) & 0xff) << 16;
+		return cs;
+	}
+
+	*cs++ = SDMA_PACKET(SDMA_OPCODE_CONSTANT_FILL, 0,
+			    SDMA_CONSTANT_FILL_DWORD);
+	*cs++ = dst;
+	*cs++ = dst >> 32;
+	*cs++ = value;
+	*cs++ = amdgpu_sdma_count(sdma, bytes);
+	return cs;
+}
+
+/* Writes the packets of a copy, or of a fill when src is NULL, to one IB
+ * of the pool and submits it with the buffers in its resource list. */
+static int amdgpu_sdma_submit(struct amdgpu_sdma *sdma, amdgpu_bo_handle dst,
+			      uint64_t dst_address, amdgpu_bo_handle src,
+			      uint64_t src_address, uint32_t value,
+			      uint64_t size, struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_cs_request request = {};
+	struct amdgpu_cs_ib_info ib_info;
+	amdgpu_bo_handle resources[3];
+	uint32_t packet_dw, size_dw, nop;
+	uint32_t *cs, *start;
+	void *cpu;
+	uint64_t packets, done, bytes;
+	int r;
+
+	if (sdma->family == AMDGPU_FAMILY_SI) {
+		packet_dw = src ? AMDGPU_SDMA_COPY_DW_SI :
+				  AMDGPU_SDMA_FILL_DW_SI;
+		nop = SDMA_PACKET_SI(SDMA_OPCODE_NOP_SI, 0, 0, 0, 0);
+	} else {
+		packet_dw = src ? AMDGPU_SDMA_COPY_DW : AMDGPU_SDMA_FILL_DW;
+		nop = SDMA_PACKET(SDMA_OPCODE_NOP, 0, 0);
+	}
+
+	packets = (size + sdma->max_bytes - 1) / sdma->max_bytes;
+	if (packets * packet_dw > UINT32_MAX - AMDGPU_SDMA_IB_ALIGN_DW)
+		return -EINVAL;
+	size_dw = ALIGN(packets * packet_dw, AMDGPU_SDMA_IB_ALIGN_DW);
+
+	pthread_mutex_lock(&sdma->lock);
+	r = amdgpu_cs_ib_pool_alloc(sdma->pool, size_dw, &ib_info, &cpu,
+				    &resources[0]);
+	if (r)
+		goto out;
+
+	start = cs = cpu;
+	for (done = 0; done < size; done += bytes) {
+		bytes = MIN2(size - done, sdma->max_bytes);
+		if (src)
+			cs = amdgpu_sdma_emit_copy(sdma, cs, dst_address + done,
+						   src_address + done, bytes);
+		else
+			cs = amdgpu_sdma_emit_fill(sdma, cs, dst_address + done,
+						   value, bytes);
+	}
+	while (cs - start < size_dw)
+		*cs++ = nop;
+
+	resources[1] = dst;
+	resources[2] = src;
+	r = amdgpu_bo_list_create_cached(sdma->dev, src && src != dst ? 3 : 2,
+					 resources, NULL, &request.resources);
+	if (r) {
+		amdgpu_cs_ib_pool_submitted(sdma->pool, &sdma->last);
+		goto out;
+	}
+
+	request.ip_type = AMDGPU_HW_IP_DMA;
+	request.number_of_ibs = 1;
+	request.ibs = &ib_info;
+	r = amdgpu_cs_submit(sdma->context, 0, &request, 1);
+	amdgpu_bo_list_destroy(request.resources);
+
+	if (!r) {
+		sdma->last.fence = request.seq_no;
+		*fence = sdma->last;
+	}
+	/* An IB that failed to be submitted gets the previous fence, the GPU
+	 * never reads it. */
+	amdgpu_cs_ib_pool_submitted(sdma->pool, &sdma->last);
+out:
+	pthread_mutex_unlock(&sdma->lock);
+	return r;
+}
+
+drm_public int amdgpu_bo_copy_async(amdgpu_sdma_handle sdma,
+				    amdgpu_bo_handle dst, uint64_t dst_address,
+				    amdgpu_bo_handle src, uint64_t src_address,
+				    uint64_t size, struct amdgpu_cs_fence *fence)
+{
+	if (!sdma || !dst || !src || !size || !fence)
+		return -EINVAL;
+
+	return amdgpu_sdma_submit(sdma, dst, dst_address, src, src_address, 0,
+				  size, fence);
+}
+
+drm_public int amdgpu_bo_fill_async(amdgpu_sdma_handle sdma,
+				    amdgpu_bo_handle dst, uint64_t dst_address,
+				    uint64_t size, uint32_t value,
+				    struct amdgpu_cs_fence *fence)
+{
+	if (!sdma || !dst || !size || !fence)
+		return -EINVAL;
+	if ((dst_address | size) & 3)
+		return -EINVAL;
+
+	return amdgpu_sdma_submit(sdma, dst, dst_address, NULL, 0, value,
+				  size, fence);
+}
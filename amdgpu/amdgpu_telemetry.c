@@ -0,0 +1,266 @@
+/*
+ * Copyright © 2014 Advanced Micro Devices, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+struct amdgpu_telemetry_slot {
+	/* Odd while the sample is written. */
+	uint32_t seq;
+	/* Number of the sample, counting from 0. */
+	uint64_t index;
+	struct amdgpu_telemetry_sample sample;
+};
+
+struct amdgpu_telemetry {
+	amdgpu_device_handle dev;
+	uint32_t sensors[AMDGPU_TELEMETRY_MAX_SENSORS];
+	uint32_t num_sensors;
+	uint64_t period_ns;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+
+	/* Only used by the sampling thread to compute the rates. */
+	struct amdgpu_telemetry_sample last;
+
+	/* Number of samples written, the slots are a ring of the last ones. */
+	uint64_t count;
+	uint32_t history;
+	struct amdgpu_telemetry_slot *slots;
+};
+
+static uint64_t amdgpu_telemetry_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int64_t amdgpu_telemetry_rate(uint64_t cur, uint64_t prev,
+				     uint64_t delta_ns)
+{
+	return (double)(int64_t)(cur - prev) * 1000000000.0 / delta_ns;
+}
+
+static void amdgpu_telemetry_take(struct amdgpu_telemetry *t,
+				  struct amdgpu_telemetry_sample *sample)
+{
+	amdgpu_device_handle dev = t->dev;
+	struct amdgpu_telemetry_sample *last = &t->last;
+	uint64_t delta_ns;
+	uint32_t i;
+
+	memset(sample, 0, sizeof(*sample));
+	sample->timestamp_ns = amdgpu_telemetry_now();
+
+	for (i = 0; i < t->num_sensors; i++) {
+		if (!amdgpu_query_sensor_info(dev, t->sensors[i],
+					      sizeof(sample->sensors[i]),
+					      &sample->sensors[i]))
+			sample->sensors_valid |= 1u << i;
+	}
+
+	/* Counters the kernel doesn't have stay 0. */
+	amdgpu_query_info(dev, AMDGPU_INFO_VRAM_USAGE,
+			  sizeof(sample->vram_usage), &sample->vram_usage);
+	amdgpu_query_info(dev, AMDGPU_INFO_VIS_VRAM_USAGE,
+			  sizeof(sample->vis_vram_usage),
+			  &sample->vis_vram_usage);
+	amdgpu_query_info(dev, AMDGPU_INFO_GTT_USAGE,
+			  sizeof(sample->gtt_usage), &sample->gtt_usage);
+	amdgpu_query_info(dev, AMDGPU_INFO_NUM_BYTES_MOVED,
+			  sizeof(sample->bytes_moved), &sample->bytes_moved);
+	amdgpu_query_info(dev, AMDGPU_INFO_NUM_EVICTIONS,
+			  sizeof(sample->evictions), &sample->evictions);
+
+	delta_ns = sample->timestamp_ns - last->timestamp_ns;
+	if (t->count && delta_ns) {
+		sample->vram_usage_rate =
+			amdgpu_telemetry_rate(sample->vram_usage,
+					      last->vram_usage, delta_ns);
+		sample->gtt_usage_rate =
+			amdgpu_telemetry_rate(sample->gtt_usage,
+					      last->gtt_usage, delta_ns);
+		sample->bytes_moved_rate = MAX2(0,
+			amdgpu_telemetry_rate(sample->bytes_moved,
+					      last->bytes_moved, delta_ns));
+		sample->eviction_rate = MAX2(0,
+			amdgpu_telemetry_rate(sample->evictions,
+					      last->evictions, delta_ns));
+	}
+	*last = *sample;
+}
+
+/* The slots are seqlocks with a single writer, the sampling thread. */
+static void amdgpu_telemetry_publish(struct amdgpu_telemetry *t,
+				     const struct amdgpu_telemetry_sample *sample)
+{
+	struct amdgpu_telemetry_slot *slot = &t->slots[t->count % t->history];
+	uint32_t seq = slot->seq;
+
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->index = t->count;
+	slot->sample = *sample;
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&t->count, t->count + 1, __ATOMIC_RELEASE);
+}
+
+static void *amdgpu_telemetry_thread(void *data)
+{
+	struct amdgpu_telemetry *t = data;
+	struct amdgpu_telemetry_sample sample;
+	uint64_t next = amdgpu_telemetry_now();
+	struct timespec ts;
+
+	pthread_mutex_lock(&t->lock);
+	while (!t->stop) {
+		pthread_mutex_unlock(&t->lock);
+		amdgpu_telemetry_take(t, &sample);
+		amdgpu_telemetry_publish(t, &sample);
+
+		/* Don't try to catch up after falling behind. */
+		next = MAX2(next + t->period_ns, amdgpu_telemetry_now());
+		ts.tv_sec = next / 1000000000ull;
+		ts.tv_nsec = next % 1000000000ull;
+
+		pthread_mutex_lock(&t->lock);
+		while (!t->stop &&
+		       pthread_cond_timedwait(&t->cond, &t->lock, &ts) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&t->lock);
+	return NULL;
+}
+
+drm_public int amdgpu_telemetry_create(amdgpu_device_handle dev,
+				       const uint32_t *sensors,
+				       uint32_t num_sensors,
+				       uint32_t period_us, uint32_t history,
+				       amdgpu_telemetry_handle *telemetry)
+{
+	struct amdgpu_telemetry *t;
+	pthread_condattr_t attr;
+	int r;
+
+	if (NULL == dev || !telemetry || !period_us || !history ||
+	    num_sensors > AMDGPU_TELEMETRY_MAX_SENSORS ||
+	    (num_sensors && !sensors))
+		return -EINVAL;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	t->slots = calloc(history, sizeof(*t->slots));
+	if (!t->slots) {
+		free(t);
+		return -ENOMEM;
+	}
+
+	t->dev = dev;
+	memcpy(t->sensors, sensors, num_sensors * sizeof(*sensors));
+	t->num_sensors = num_sensors;
+	t->period_ns = period_us * 1000ull;
+	t->history = history;
+
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&t->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	r = -pthread_create(&t->thread, NULL, amdgpu_telemetry_thread, t);
+	if (r) {
+		pthread_cond_destroy(&t->cond);
+		pthread_mutex_destroy(&t->lock);
+		free(t->slots);
+		free(t);
+		return r;
+	}
+
+	*telemetry = t;
+	return 0;
+}
+
+drm_public int amdgpu_telemetry_destroy(amdgpu_telemetry_handle telemetry)
+{
+	if (!telemetry)
+		return -EINVAL;
+
+	pthread_mutex_lock(&telemetry->lock);
+	telemetry->stop = true;
+	pthread_cond_signal(&telemetry->cond);
+	pthread_mutex_unlock(&telemetry->lock);
+	pthread_join(telemetry->thread, NULL);
+
+	pthread_cond_destroy(&telemetry->cond);
+	pthread_mutex_destroy(&telemetry->lock);
+	free(telemetry->slots);
+	free(telemetry);
+	return 0;
+}
+
+drm_public int amdgpu_telemetry_read(amdgpu_telemetry_handle telemetry,
+				     uint32_t age,
+				     struct amdgpu_telemetry_sample *sample)
+{
+	struct amdgpu_telemetry_slot *slot;
+	uint64_t count, index;
+	uint32_t seq;
+
+	if (!telemetry || !sample)
+		return -EINVAL;
+
+	count = __atomic_load_n(&telemetry->count, __ATOMIC_ACQUIRE);
+	if (age >= count || age >= telemetry->history)
+		return -ENODATA;
+
+	index = count - 1 - age;
+	slot = &telemetry->slots[index % telemetry->history];
+	do {
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		*sample = slot->sample;
+		/* Overwritten by a newer sample meanwhile. */
+		if (slot->index != index)
+			return -ENODATA;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (seq & 1 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq);
+
+	return 0;
+}
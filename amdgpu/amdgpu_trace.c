@@ -0,0 +1,224 @@
+/*
+ * Copyright © 2014 Advanced Micro Devices, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libdrm_macros.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+#define AMDGPU_TRACE_EVENTS 4096
+
+/* Events of one thread, written only by it and drained under
+ * trace_mutex. */
+struct amdgpu_trace_buffer {
+	struct list_head list;
+	uint32_t tid;
+	/* The thread is gone, another one may take the buffer over. */
+	bool exited;
+	uint64_t head;
+	uint64_t tail;
+	uint64_t dropped;
+	struct amdgpu_trace_event events[AMDGPU_TRACE_EVENTS];
+};
+
+static const char *amdgpu_trace_names[] = {
+	[AMDGPU_TRACE_CS_SUBMIT] = "amdgpu_cs_submit",
+	[AMDGPU_TRACE_CS_SUBMIT_RAW2] = "amdgpu_cs_submit_raw2",
+	[AMDGPU_TRACE_CS_WAIT_FENCES] = "amdgpu_cs_wait_fences",
+	[AMDGPU_TRACE_BO_ALLOC] = "amdgpu_bo_alloc",
+};
+
+drm_private uint64_t amdgpu_trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void amdgpu_trace_thread_exit(void *data)
+{
+	struct amdgpu_trace_buffer *buf = data;
+
+	__atomic_store_n(&buf->exited, true, __ATOMIC_RELEASE);
+}
+
+static struct amdgpu_trace_buffer *
+amdgpu_trace_get_buffer(struct amdgpu_device *dev)
+{
+	struct amdgpu_trace_buffer *buf;
+
+	buf = pthread_getspecific(dev->trace_key);
+	if (buf)
+		return buf;
+
+	pthread_mutex_lock(&dev->trace_mutex);
+	LIST_FOR_EACH_ENTRY(buf, &dev->trace_buffers, list) {
+		if (__atomic_load_n(&buf->exited, __ATOMIC_ACQUIRE)) {
+			buf->exited = false;
+			buf->tid = ++dev->trace_next_tid;
+			goto out;
+		}
+	}
+
+	buf = calloc(1, sizeof(*buf));
+	if (buf) {
+		buf->tid = ++dev->trace_next_tid;
+		list_addtail(&buf->list, &dev->trace_buffers);
+	}
+out:
+	pthread_mutex_unlock(&dev->trace_mutex);
+	if (buf)
+		pthread_setspecific(dev->trace_key, buf);
+	return buf;
+}
+
+/**
+ * Add an event started at event->start_ns, which amdgpu_trace_begin()
+ * returned, to the buffer of the calling thread.
+ */
+drm_private void amdgpu_trace_record(struct amdgpu_device *dev,
+				     struct amdgpu_trace_event *event)
+{
+	struct amdgpu_trace_buffer *buf = amdgpu_trace_get_buffer(dev);
+	uint64_t tail;
+
+	if (!buf)
+		return;
+
+	event->end_ns = amdgpu_trace_now();
+	event->tid = buf->tid;
+	tail = __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE);
+	if (buf->head - tail >= AMDGPU_TRACE_EVENTS) {
+		__atomic_add_fetch(&buf->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	buf->events[buf->head % AMDGPU_TRACE_EVENTS] = *event;
+	__atomic_store_n(&buf->head, buf->head + 1, __ATOMIC_RELEASE);
+}
+
+drm_private void amdgpu_trace_fini(struct amdgpu_device *dev)
+{
+	struct amdgpu_trace_buffer *buf, *tmp;
+
+	if (!dev->trace_key_valid)
+		return;
+
+	pthread_key_delete(dev->trace_key);
+	LIST_FOR_EACH_ENTRY_SAFE(buf, tmp, &dev->trace_buffers, list) {
+		list_del(&buf->list);
+		free(buf);
+	}
+}
+
+drm_public int amdgpu_trace_enable(amdgpu_device_handle dev, bool enable)
+{
+	int r = 0;
+
+	if (NULL == dev)
+		return -EINVAL;
+
+	pthread_mutex_lock(&dev->trace_mutex);
+	if (enable && !dev->trace_key_valid) {
+		r = -pthread_key_create(&dev->trace_key,
+					amdgpu_trace_thread_exit);
+		dev->trace_key_valid = !r;
+	}
+	if (!r)
+		__atomic_store_n(&dev->trace_enabled, enable, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&dev->trace_mutex);
+	return r;
+}
+
+static void amdgpu_trace_print(FILE *f, const struct amdgpu_trace_event *e,
+			       bool *first)
+{
+	fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"amdgpu\",\"ph\":\"X\","
+		"\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+		*first ? "" : ",", amdgpu_trace_names[e->type], (int)getpid(),
+		e->tid, e->start_ns / 1000.0, (e->end_ns - e->start_ns) / 1000.0);
+	*first = false;
+
+	switch (e->type) {
+	case AMDGPU_TRACE_CS_SUBMIT:
+	case AMDGPU_TRACE_CS_SUBMIT_RAW2:
+		if (e->type == AMDGPU_TRACE_CS_SUBMIT)
+			fprintf(f, "\"ip_type\":%u,\"ip_instance\":%u,"
+				"\"ring\":%u,\"bo_list_size\":%u,",
+				e->ip_type, e->ip_instance, e->ring,
+				e->num_bos);
+		fprintf(f, "\"chunks\":%u,\"seq_no\":%llu,", e->count,
+			(unsigned long long)e->seq_no);
+		break;
+	case AMDGPU_TRACE_CS_WAIT_FENCES:
+		fprintf(f, "\"fences\":%u,", e->count);
+		break;
+	case AMDGPU_TRACE_BO_ALLOC:
+		fprintf(f, "\"size\":%llu,", (unsigned long long)e->size);
+		break;
+	}
+	fprintf(f, "\"result\":%d}}", e->result);
+}
+
+drm_public int amdgpu_trace_drain(amdgpu_device_handle dev, char **json)
+{
+	struct amdgpu_trace_buffer *buf;
+	uint64_t head, tail, dropped = 0;
+	bool first = true;
+	size_t size;
+	FILE *f;
+
+	if (NULL == dev || !json)
+		return -EINVAL;
+
+	f = open_memstream(json, &size);
+	if (!f)
+		return -errno;
+
+	fputs("{\"traceEvents\":[", f);
+	pthread_mutex_lock(&dev->trace_mutex);
+	LIST_FOR_EACH_ENTRY(buf, &dev->trace_buffers, list) {
+		head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+		for (tail = buf->tail; tail < head; tail++)
+			amdgpu_trace_print(f, &buf->events[tail % AMDGPU_TRACE_EVENTS],
+					   &first);
+		__atomic_store_n(&buf->tail, head, __ATOMIC_RELEASE);
+		dropped += __atomic_exchange_n(&buf->dropped, 0,
+					       __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&dev->trace_mutex);
+	fprintf(f, "\n],\"otherData\":{\"dropped_events\":%llu}}\n",
+		(unsigned long long)dropped);
+
+	if (fclose(f))
+		return -errno;
+	return 0;
+}
@@ -41,6 +41,145 @@ drm_public int amdgpu_va_range_query(amdgpu_device_handle dev,
 	return 0;
 }
 
+static int amdgpu_vamgr_height(struct amdgpu_bo_va_hole *n)
+{
+	return n ? n->height : 0;
+}
+
+static void amdgpu_vamgr_update(struct amdgpu_bo_va_hole *n)
+{
+	n->height = 1 + MAX2(amdgpu_vamgr_height(n->left),
+			     amdgpu_vamgr_height(n->right));
+	n->max_size = n->size;
+	if (n->left)
+		n->max_size = MAX2(n->max_size, n->left->max_size);
+	if (n->right)
+		n->max_size = MAX2(n->max_size, n->right->max_size);
+}
+
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_rotate_right(struct amdgpu_bo_va_hole *n)
+{
+	struct amdgpu_bo_va_hole *l = n->left;
+
+	n->left = l->right;
+	l->right = n;
+	amdgpu_vamgr_update(n);
+	amdgpu_vamgr_update(l);
+	return l;
+}
+
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_rotate_left(struct amdgpu_bo_va_hole *n)
+{
+	struct amdgpu_bo_va_hole *r = n->right;
+
+	n->right = r->left;
+	r->left = n;
+	amdgpu_vamgr_update(n);
+	amdgpu_vamgr_update(r);
+	return r;
+}
+
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_balance(struct amdgpu_bo_va_hole *n)
+{
+	int diff = amdgpu_vamgr_height(n->left) - amdgpu_vamgr_height(n->right);
+
+	if (diff > 1) {
+		if (amdgpu_vamgr_height(n->left->left) <
+		    amdgpu_vamgr_height(n->left->right))
+			n->left = amdgpu_vamgr_rotate_left(n->left);
+		return amdgpu_vamgr_rotate_right(n);
+	}
+	if (diff < -1) {
+		if (amdgpu_vamgr_height(n->right->right) <
+		    amdgpu_vamgr_height(n->right->left))
+			n->right = amdgpu_vamgr_rotate_right(n->right);
+		return amdgpu_vamgr_rotate_left(n);
+	}
+
+	amdgpu_vamgr_update(n);
+	return n;
+}
+
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_insert(struct amdgpu_bo_va_hole *root, struct amdgpu_bo_va_hole *n)
+{
+	if (!root) {
+		n->left = n->right = NULL;
+		amdgpu_vamgr_update(n);
+		return n;
+	}
+
+	if (n->offset < root->offset)
+		root->left = amdgpu_vamgr_insert(root->left, n);
+	else
+		root->right = amdgpu_vamgr_insert(root->right, n);
+	return amdgpu_vamgr_balance(root);
+}
+
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_remove_min(struct amdgpu_bo_va_hole *root,
+			struct amdgpu_bo_va_hole **min)
+{
+	if (!root->left) {
+		*min = root;
+		return root->right;
+	}
+
+	root->left = amdgpu_vamgr_remove_min(root->left, min);
+	return amdgpu_vamgr_balance(root);
+}
+
+/* Unlink the hole at offset from the tree, the caller frees it. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_remove(struct amdgpu_bo_va_hole *root, uint64_t offset)
+{
+	struct amdgpu_bo_va_hole *min;
+
+	if (!root)
+		return NULL;
+
+	if (offset < root->offset) {
+		root->left = amdgpu_vamgr_remove(root->left, offset);
+	} else if (offset > root->offset) {
+		root->right = amdgpu_vamgr_remove(root->right, offset);
+	} else {
+		if (!root->right)
+			return root->left;
+		root->right = amdgpu_vamgr_remove_min(root->right, &min);
+		min->left = root->left;
+		min->right = root->right;
+		root = min;
+	}
+	return amdgpu_vamgr_balance(root);
+}
+
+/* Refresh max_size on the path to the hole at offset after its offset or
+ * size changed in place, which must not have changed the ordering. */
+static void amdgpu_vamgr_fixup(struct amdgpu_bo_va_hole *root, uint64_t offset)
+{
+	if (!root)
+		return;
+
+	if (offset < root->offset)
+		amdgpu_vamgr_fixup(root->left, offset);
+	else if (offset > root->offset)
+		amdgpu_vamgr_fixup(root->right, offset);
+	amdgpu_vamgr_update(root);
+}
+
+static void amdgpu_vamgr_destroy(struct amdgpu_bo_va_hole *n)
+{
+	if (!n)
+		return;
+
+	amdgpu_vamgr_destroy(n->left);
+	amdgpu_vamgr_destroy(n->right);
+	free(n);
+}
+
 drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 				   uint64_t max, uint64_t alignment)
 {
@@ -49,63 +188,182 @@ drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
 	mgr->va_max = max;
 	mgr->va_alignment = alignment;
 
-	list_inithead(&mgr->va_holes);
+	mgr->va_holes = NULL;
 	pthread_mutex_init(&mgr->bo_va_mutex, NULL);
 	pthread_mutex_lock(&mgr->bo_va_mutex);
 	n = calloc(1, sizeof(struct amdgpu_bo_va_hole));
-	n->size = mgr->va_max - start;
-	n->offset = start;
-	list_add(&n->list, &mgr->va_holes);
+	if (n) {
+		n->size = mgr->va_max - start;
+		n->offset = start;
+		mgr->va_holes = amdgpu_vamgr_insert(NULL, n);
+	}
 	pthread_mutex_unlock(&mgr->bo_va_mutex);
 }
 
+static void amdgpu_vamgr_fini_magazines(struct amdgpu_bo_va_mgr *mgr);
+
 drm_private void amdgpu_vamgr_deinit(struct amdgpu_bo_va_mgr *mgr)
 {
-	struct amdgpu_bo_va_hole *hole, *tmp;
-	LIST_FOR_EACH_ENTRY_SAFE(hole, tmp, &mgr->va_holes, list) {
-		list_del(&hole->list);
-		free(hole);
-	}
+	amdgpu_vamgr_fini_magazines(mgr);
+	amdgpu_vamgr_destroy(mgr->va_holes);
+	mgr->va_holes = NULL;
 	pthread_mutex_destroy(&mgr->bo_va_mutex);
 }
 
-static drm_private int
-amdgpu_vamgr_subtract_hole(struct amdgpu_bo_va_hole *hole, uint64_t start_va,
-			   uint64_t end_va)
+/* Carve [start_va, end_va) out of hole, using *spare if it has to be split. */
+static void
+amdgpu_vamgr_subtract_hole(struct amdgpu_bo_va_mgr *mgr,
+			   struct amdgpu_bo_va_hole *hole, uint64_t start_va,
+			   uint64_t end_va, struct amdgpu_bo_va_hole **spare)
 {
 	if (start_va > hole->offset && end_va - hole->offset < hole->size) {
-		struct amdgpu_bo_va_hole *n = calloc(1, sizeof(struct amdgpu_bo_va_hole));
-		if (!n)
-			return -ENOMEM;
+		struct amdgpu_bo_va_hole *n = *spare;
 
+		*spare = NULL;
 		n->size = start_va - hole->offset;
 		n->offset = hole->offset;
-		list_add(&n->list, &hole->list);
 
 		hole->size -= (end_va - hole->offset);
 		hole->offset = end_va;
+		amdgpu_vamgr_fixup(mgr->va_holes, hole->offset);
+		mgr->va_holes = amdgpu_vamgr_insert(mgr->va_holes, n);
 	} else if (start_va > hole->offset) {
 		hole->size = start_va - hole->offset;
+		amdgpu_vamgr_fixup(mgr->va_holes, hole->offset);
 	} else if (end_va - hole->offset < hole->size) {
 		hole->size -= (end_va - hole->offset);
 		hole->offset = end_va;
+		amdgpu_vamgr_fixup(mgr->va_holes, hole->offset);
 	} else {
-		list_del(&hole->list);
+		mgr->va_holes = amdgpu_vamgr_remove(mgr->va_holes, hole->offset);
 		free(hole);
 	}
+}
 
-	return 0;
+/* Lowest hole that can hold an aligned range of size, subtrees whose
+ * largest hole is too small are skipped altogether. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_first_fit(struct amdgpu_bo_va_hole *n, uint64_t size,
+		       uint64_t alignment, uint64_t *offset)
+{
+	struct amdgpu_bo_va_hole *found;
+	uint64_t waste;
+
+	if (!n || n->max_size < size)
+		return NULL;
+
+	found = amdgpu_vamgr_first_fit(n->left, size, alignment, offset);
+	if (found)
+		return found;
+
+	waste = n->offset % alignment;
+	waste = waste ? alignment - waste : 0;
+	*offset = n->offset + waste;
+	if (*offset < (n->offset + n->size) &&
+	    size <= (n->offset + n->size) - *offset)
+		return n;
+
+	return amdgpu_vamgr_first_fit(n->right, size, alignment, offset);
+}
+
+/* Highest hole that can hold an aligned range of size at its top. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_last_fit(struct amdgpu_bo_va_hole *n, uint64_t size,
+		      uint64_t alignment, uint64_t *offset)
+{
+	struct amdgpu_bo_va_hole *found;
+
+	if (!n || n->max_size < size)
+		return NULL;
+
+	found = amdgpu_vamgr_last_fit(n->right, size, alignment, offset);
+	if (found)
+		return found;
+
+	if (size <= n->size) {
+		*offset = n->offset + n->size - size;
+		*offset -= *offset % alignment;
+		if (*offset >= n->offset)
+			return n;
+	}
+
+	return amdgpu_vamgr_last_fit(n->left, size, alignment, offset);
+}
+
+/* Hole with the largest offset <= va, if any. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_floor(struct amdgpu_bo_va_hole *n, uint64_t va)
+{
+	struct amdgpu_bo_va_hole *floor = NULL;
+
+	while (n) {
+		if (n->offset <= va) {
+			floor = n;
+			n = n->right;
+		} else {
+			n = n->left;
+		}
+	}
+	return floor;
+}
+
+/* Hole with the smallest offset >= va, if any. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_ceil(struct amdgpu_bo_va_hole *n, uint64_t va)
+{
+	struct amdgpu_bo_va_hole *ceil = NULL;
+
+	while (n) {
+		if (n->offset >= va) {
+			ceil = n;
+			n = n->left;
+		} else {
+			n = n->right;
+		}
+	}
+	return ceil;
 }
 
-static drm_private int
+/* Find and take a range, *spare is consumed if a hole has to be split.
+ * Called with bo_va_mutex held. */
+static bool
+amdgpu_vamgr_find_va_locked(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
+			    uint64_t alignment, uint64_t base_required,
+			    bool search_from_top, uint64_t *va_out,
+			    struct amdgpu_bo_va_hole **spare)
+{
+	struct amdgpu_bo_va_hole *hole;
+	uint64_t offset = 0;
+
+	if (base_required) {
+		hole = amdgpu_vamgr_floor(mgr->va_holes, base_required);
+		if (hole &&
+		    (hole->offset + hole->size) < (base_required + size))
+			hole = NULL;
+		offset = base_required;
+	} else if (!search_from_top) {
+		hole = amdgpu_vamgr_first_fit(mgr->va_holes, size,
+					      alignment, &offset);
+	} else {
+		hole = amdgpu_vamgr_last_fit(mgr->va_holes, size,
+					     alignment, &offset);
+	}
+
+	if (!hole)
+		return false;
+
+	amdgpu_vamgr_subtract_hole(mgr, hole, offset, offset + size, spare);
+	*va_out = offset;
+	return true;
+}
+
+static int
 amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 		     uint64_t alignment, uint64_t base_required,
 		     bool search_from_top, uint64_t *va_out)
 {
-	struct amdgpu_bo_va_hole *hole, *n;
-	uint64_t offset = 0;
-	int ret;
-
+	struct amdgpu_bo_va_hole *spare;
+	bool found;
 
 	alignment = MAX2(alignment, mgr->va_alignment);
 	size = ALIGN(size, mgr->va_alignment);
@@ -113,111 +371,363 @@ amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 	if (base_required % alignment)
 		return -EINVAL;
 
+	/* Allocated up front, a split then can't fail with the lock held. */
+	spare = calloc(1, sizeof(struct amdgpu_bo_va_hole));
+	if (!spare)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&mgr->bo_va_mutex);
+	found = amdgpu_vamgr_find_va_locked(mgr, size, alignment, base_required,
+					    search_from_top, va_out, &spare);
+	pthread_mutex_unlock(&mgr->bo_va_mutex);
+	free(spare);
+
+	return found ? 0 : -ENOMEM;
+}
+
+/* Give [va, va + size) back, merging it with the adjacent holes. spare is
+ * consumed if a new hole is needed, otherwise it is returned to be freed.
+ * Called with bo_va_mutex held. */
+static struct amdgpu_bo_va_hole *
+amdgpu_vamgr_free_va_locked(struct amdgpu_bo_va_mgr *mgr, uint64_t va,
+			    uint64_t size, struct amdgpu_bo_va_hole *spare)
+{
+	struct amdgpu_bo_va_hole *prev, *next;
+
+	prev = va ? amdgpu_vamgr_floor(mgr->va_holes, va - 1) : NULL;
+	next = amdgpu_vamgr_ceil(mgr->va_holes, va + size);
+
+	if (prev && prev->offset + prev->size != va)
+		prev = NULL;
+	if (next && next->offset != va + size)
+		next = NULL;
+
+	if (prev && next) {
+		/* Merge lower hole, the range and the upper hole */
+		prev->size += size + next->size;
+		mgr->va_holes = amdgpu_vamgr_remove(mgr->va_holes, next->offset);
+		free(next);
+		amdgpu_vamgr_fixup(mgr->va_holes, prev->offset);
+	} else if (prev) {
+		/* Grow lower hole */
+		prev->size += size;
+		amdgpu_vamgr_fixup(mgr->va_holes, prev->offset);
+	} else if (next) {
+		/* Grow upper hole */
+		next->offset = va;
+		next->size += size;
+		amdgpu_vamgr_fixup(mgr->va_holes, next->offset);
+	} else if (spare || (spare = malloc(sizeof(*spare)))) {
+		spare->offset = va;
+		spare->size = size;
+		mgr->va_holes = amdgpu_vamgr_insert(mgr->va_holes, spare);
+		spare = NULL;
+	}
+
+	return spare;
+}
+
+/* spare is a preallocated node that is consumed or freed, so this never
+ * fails. */
+static void
+amdgpu_vamgr_free_va(struct amdgpu_bo_va_mgr *mgr, uint64_t va, uint64_t size,
+		     struct amdgpu_bo_va_hole *spare)
+{
+	if (va == AMDGPU_INVALID_VA_ADDRESS) {
+		free(spare);
+		return;
+	}
+
+	size = ALIGN(size, mgr->va_alignment);
+
+	pthread_mutex_lock(&mgr->bo_va_mutex);
+	spare = amdgpu_vamgr_free_va_locked(mgr, va, size, spare);
+	pthread_mutex_unlock(&mgr->bo_va_mutex);
+	free(spare);
+}
+
+/* Return the first count ranges of a size class to the manager, with a
+ * single acquisition of bo_va_mutex. Called with the magazine lock held. */
+static void
+amdgpu_vamgr_magazine_flush(struct amdgpu_va_magazine *mag, unsigned class,
+			    unsigned count)
+{
+	struct amdgpu_bo_va_mgr *mgr = mag->mgr;
+	uint64_t size = 1ull << (AMDGPU_VA_MAGAZINE_MIN_SHIFT + class);
+	unsigned i;
+
+	if (!count)
+		return;
+
 	pthread_mutex_lock(&mgr->bo_va_mutex);
-	if (!search_from_top) {
-		LIST_FOR_EACH_ENTRY_SAFE_REV(hole, n, &mgr->va_holes, list) {
-			if (base_required) {
-				if (hole->offset > base_required ||
-				   (hole->offset + hole->size) < (base_required + size))
-					continue;
-				offset = base_required;
-			} else {
-				uint64_t waste = hole->offset % alignment;
-				waste = waste ? alignment - waste : 0;
-				offset = hole->offset + waste;
-				if (offset >= (hole->offset + hole->size) ||
-				    size > (hole->offset + hole->size) - offset) {
-					continue;
-				}
-			}
-			ret = amdgpu_vamgr_subtract_hole(hole, offset, offset + size);
-			pthread_mutex_unlock(&mgr->bo_va_mutex);
-			*va_out = offset;
-			return ret;
+	for (i = 0; i < count; i++)
+		free(amdgpu_vamgr_free_va_locked(mgr,
+						 mag->entries[class][i].address,
+						 size,
+						 mag->entries[class][i].spare));
+	pthread_mutex_unlock(&mgr->bo_va_mutex);
+
+	mag->count[class] -= count;
+	memmove(mag->entries[class], mag->entries[class] + count,
+		mag->count[class] * sizeof(mag->entries[class][0]));
+}
+
+static void amdgpu_vamgr_magazine_destroy(void *data)
+{
+	struct amdgpu_va_magazine *mag = data;
+	struct amdgpu_bo_va_mgr *mgr = mag->mgr;
+	unsigned class;
+
+	pthread_mutex_lock(&mgr->magazines_mutex);
+	pthread_mutex_lock(&mag->lock);
+	for (class = 0; class < AMDGPU_VA_MAGAZINE_CLASSES; class++)
+		amdgpu_vamgr_magazine_flush(mag, class, mag->count[class]);
+	list_del(&mag->list);
+	pthread_mutex_unlock(&mag->lock);
+	pthread_mutex_unlock(&mgr->magazines_mutex);
+
+	pthread_mutex_destroy(&mag->lock);
+	free(mag);
+}
+
+/* Hand the ranges cached by every thread back, so that a failing
+ * allocation can't be caused by ranges sitting in magazines. */
+static void amdgpu_vamgr_magazine_drain(struct amdgpu_bo_va_mgr *mgr)
+{
+	struct amdgpu_va_magazine *mag;
+	unsigned class;
+
+	pthread_mutex_lock(&mgr->magazines_mutex);
+	LIST_FOR_EACH_ENTRY(mag, &mgr->magazines, list) {
+		pthread_mutex_lock(&mag->lock);
+		for (class = 0; class < AMDGPU_VA_MAGAZINE_CLASSES; class++)
+			amdgpu_vamgr_magazine_flush(mag, class,
+						    mag->count[class]);
+		pthread_mutex_unlock(&mag->lock);
+	}
+	pthread_mutex_unlock(&mgr->magazines_mutex);
+}
+
+static struct amdgpu_va_magazine *
+amdgpu_vamgr_magazine_get(struct amdgpu_bo_va_mgr *mgr)
+{
+	struct amdgpu_va_magazine *mag;
+
+	mag = pthread_getspecific(mgr->magazine_key);
+	if (mag)
+		return mag;
+
+	mag = calloc(1, sizeof(*mag));
+	if (!mag)
+		return NULL;
+	mag->mgr = mgr;
+	pthread_mutex_init(&mag->lock, NULL);
+
+	if (pthread_setspecific(mgr->magazine_key, mag)) {
+		pthread_mutex_destroy(&mag->lock);
+		free(mag);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&mgr->magazines_mutex);
+	list_add(&mag->list, &mgr->magazines);
+	pthread_mutex_unlock(&mgr->magazines_mutex);
+	return mag;
+}
+
+/* Size class of an allocation that magazines can serve, or -1. */
+static int
+amdgpu_vamgr_magazine_class(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
+			    uint64_t alignment)
+{
+	int class;
+
+	if (!mgr->use_magazines)
+		return -1;
+
+	for (class = 0; class < AMDGPU_VA_MAGAZINE_CLASSES; class++) {
+		uint64_t class_size = 1ull << (AMDGPU_VA_MAGAZINE_MIN_SHIFT + class);
+
+		if (size <= class_size)
+			return alignment <= class_size &&
+			       !(class_size % mgr->va_alignment) ? class : -1;
+	}
+	return -1;
+}
+
+/* Take a range of the size class from the calling thread's magazine,
+ * refilling it with a batch from the manager when it is empty. */
+static int
+amdgpu_vamgr_magazine_alloc(struct amdgpu_bo_va_mgr *mgr, int class,
+			    uint64_t *va_out, struct amdgpu_bo_va_hole **spare)
+{
+	struct amdgpu_bo_va_hole *nodes[2 * AMDGPU_VA_MAGAZINE_BATCH] = { NULL };
+	uint64_t size = 1ull << (AMDGPU_VA_MAGAZINE_MIN_SHIFT + class);
+	struct amdgpu_va_magazine_entry *entry;
+	struct amdgpu_va_magazine *mag;
+	unsigned i, n;
+
+	mag = amdgpu_vamgr_magazine_get(mgr);
+	if (!mag)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&mag->lock);
+	if (!mag->count[class]) {
+		/* One node per range for freeing it and one per possible
+		 * split, all allocated before taking bo_va_mutex. */
+		for (n = 0; n < 2 * AMDGPU_VA_MAGAZINE_BATCH; n++) {
+			nodes[n] = calloc(1, sizeof(struct amdgpu_bo_va_hole));
+			if (!nodes[n])
+				break;
 		}
-	} else {
-		LIST_FOR_EACH_ENTRY_SAFE(hole, n, &mgr->va_holes, list) {
-			if (base_required) {
-				if (hole->offset > base_required ||
-				   (hole->offset + hole->size) < (base_required + size))
-					continue;
-				offset = base_required;
-			} else {
-				if (size > hole->size)
-					continue;
-
-				offset = hole->offset + hole->size - size;
-				offset -= offset % alignment;
-				if (offset < hole->offset) {
-					continue;
-				}
-			}
-
-			ret = amdgpu_vamgr_subtract_hole(hole, offset, offset + size);
-			pthread_mutex_unlock(&mgr->bo_va_mutex);
-			*va_out = offset;
-			return ret;
+
+		pthread_mutex_lock(&mgr->bo_va_mutex);
+		for (i = 0; i + 1 < n; i += 2) {
+			entry = &mag->entries[class][mag->count[class]];
+			if (!amdgpu_vamgr_find_va_locked(mgr, size, size, 0,
+							 false, &entry->address,
+							 &nodes[i + 1]))
+				break;
+			entry->spare = nodes[i];
+			nodes[i] = NULL;
+			mag->count[class]++;
 		}
+		pthread_mutex_unlock(&mgr->bo_va_mutex);
+
+		for (i = 0; i < n; i++)
+			free(nodes[i]);
 	}
 
-	pthread_mutex_unlock(&mgr->bo_va_mutex);
-	return -ENOMEM;
+	if (!mag->count[class]) {
+		pthread_mutex_unlock(&mag->lock);
+		return -ENOMEM;
+	}
+
+	/* Hand out the most recently freed range, it is the most likely to
+	 * still be in the TLBs. */
+	entry = &mag->entries[class][--mag->count[class]];
+	*va_out = entry->address;
+	*spare = entry->spare;
+	pthread_mutex_unlock(&mag->lock);
+	return 0;
 }
 
-static drm_private void
-amdgpu_vamgr_free_va(struct amdgpu_bo_va_mgr *mgr, uint64_t va, uint64_t size)
+/* Cache a freed range, returns false if it has to go back to the manager. */
+static bool
+amdgpu_vamgr_magazine_free(struct amdgpu_bo_va_mgr *mgr, uint64_t va,
+			   uint64_t size, struct amdgpu_bo_va_hole *spare)
 {
-	struct amdgpu_bo_va_hole *hole, *next;
+	struct amdgpu_va_magazine_entry *entry;
+	struct amdgpu_va_magazine *mag;
+	int class;
+
+	class = amdgpu_vamgr_magazine_class(mgr, size, size);
+	if (class < 0 ||
+	    size != 1ull << (AMDGPU_VA_MAGAZINE_MIN_SHIFT + class) ||
+	    va % size || !spare)
+		return false;
+
+	mag = amdgpu_vamgr_magazine_get(mgr);
+	if (!mag)
+		return false;
+
+	pthread_mutex_lock(&mag->lock);
+	if (mag->count[class] == AMDGPU_VA_MAGAZINE_SIZE)
+		amdgpu_vamgr_magazine_flush(mag, class,
+					    AMDGPU_VA_MAGAZINE_BATCH);
+	entry = &mag->entries[class][mag->count[class]++];
+	entry->address = va;
+	entry->spare = spare;
+	pthread_mutex_unlock(&mag->lock);
+	return true;
+}
 
-	if (va == AMDGPU_INVALID_VA_ADDRESS)
+drm_private void amdgpu_vamgr_init_magazines(struct amdgpu_bo_va_mgr *mgr)
+{
+	if (!mgr->va_max)
 		return;
 
-	size = ALIGN(size, mgr->va_alignment);
+	list_inithead(&mgr->magazines);
+	pthread_mutex_init(&mgr->magazines_mutex, NULL);
+	mgr->use_magazines = !pthread_key_create(&mgr->magazine_key,
+						 amdgpu_vamgr_magazine_destroy);
+	if (!mgr->use_magazines)
+		pthread_mutex_destroy(&mgr->magazines_mutex);
+}
 
-	pthread_mutex_lock(&mgr->bo_va_mutex);
-	hole = container_of(&mgr->va_holes, hole, list);
-	LIST_FOR_EACH_ENTRY(next, &mgr->va_holes, list) {
-		if (next->offset < va)
-			break;
-		hole = next;
+static void amdgpu_vamgr_fini_magazines(struct amdgpu_bo_va_mgr *mgr)
+{
+	struct amdgpu_va_magazine *mag, *tmp;
+	unsigned class, i;
+
+	if (!mgr->use_magazines)
+		return;
+
+	/* Deleting the key first means no thread exit runs the destructor
+	 * on a magazine freed here. The ranges die with the manager. */
+	pthread_key_delete(mgr->magazine_key);
+	LIST_FOR_EACH_ENTRY_SAFE(mag, tmp, &mgr->magazines, list) {
+		for (class = 0; class < AMDGPU_VA_MAGAZINE_CLASSES; class++)
+			for (i = 0; i < mag->count[class]; i++)
+				free(mag->entries[class][i].spare);
+		pthread_mutex_destroy(&mag->lock);
+		free(mag);
 	}
+	pthread_mutex_destroy(&mgr->magazines_mutex);
+	mgr->use_magazines = false;
+}
 
-	if (&hole->list != &mgr->va_holes) {
-		/* Grow upper hole if it's adjacent */
-		if (hole->offset == (va + size)) {
-			hole->offset = va;
-			hole->size += size;
-			/* Merge lower hole if it's adjacent */
-			if (next != hole &&
-			    &next->list != &mgr->va_holes &&
-			    (next->offset + next->size) == va) {
-				next->size += hole->size;
-				list_del(&hole->list);
-				free(hole);
-			}
-			goto out;
+static int
+amdgpu_vamgr_alloc(struct amdgpu_bo_va_mgr *mgr, uint64_t *size,
+		   uint64_t alignment, uint64_t base_required,
+		   bool search_from_top, uint64_t *va_out,
+		   struct amdgpu_bo_va_hole **spare)
+{
+	int class = -1;
+	int ret;
+
+	if (!base_required && !search_from_top)
+		class = amdgpu_vamgr_magazine_class(mgr, *size, alignment);
+	if (class >= 0) {
+		free(*spare);
+		*spare = NULL;
+		ret = amdgpu_vamgr_magazine_alloc(mgr, class, va_out, spare);
+		if (!ret) {
+			*size = 1ull << (AMDGPU_VA_MAGAZINE_MIN_SHIFT + class);
+			return 0;
 		}
 	}
 
-	/* Grow lower hole if it's adjacent */
-	if (next != hole && &next->list != &mgr->va_holes &&
-	    (next->offset + next->size) == va) {
-		next->size += size;
-		goto out;
+	if (!*spare) {
+		*spare = calloc(1, sizeof(struct amdgpu_bo_va_hole));
+		if (!*spare)
+			return -ENOMEM;
 	}
 
-	/* FIXME on allocation failure we just lose virtual address space
-	 * maybe print a warning
-	 */
-	next = calloc(1, sizeof(struct amdgpu_bo_va_hole));
-	if (next) {
-		next->size = size;
-		next->offset = va;
-		list_add(&next->list, &hole->list);
+	ret = amdgpu_vamgr_find_va(mgr, *size, alignment, base_required,
+				   search_from_top, va_out);
+	if (ret == -ENOMEM && mgr->use_magazines) {
+		amdgpu_vamgr_magazine_drain(mgr);
+		ret = amdgpu_vamgr_find_va(mgr, *size, alignment,
+					   base_required, search_from_top,
+					   va_out);
 	}
+	return ret;
+}
 
-out:
-	pthread_mutex_unlock(&mgr->bo_va_mutex);
+/* Largest of the PTE fragment and 2 MiB page sizes not above size, which
+ * size and alignment are rounded to so that the range uses large pages. */
+drm_private uint64_t amdgpu_va_fragment_size(struct amdgpu_device *dev,
+					     uint64_t size)
+{
+	uint64_t fragment = dev->dev_info.pte_fragment_size;
+	uint64_t granule = 1;
+
+	if (fragment && fragment <= size)
+		granule = fragment;
+	if (size >= AMDGPU_VA_HUGE_PAGE_SIZE)
+		granule = MAX2(granule, AMDGPU_VA_HUGE_PAGE_SIZE);
+	return granule;
 }
 
 drm_public int amdgpu_va_range_alloc(amdgpu_device_handle dev,
@@ -230,6 +740,7 @@ drm_public int amdgpu_va_range_alloc(amdgpu_device_handle dev,
 				     uint64_t flags)
 {
 	struct amdgpu_bo_va_mgr *vamgr;
+	struct amdgpu_va *va;
 	bool search_from_top = !!(flags & AMDGPU_VA_RANGE_REPLAYABLE);
 	int ret;
 
@@ -251,10 +762,20 @@ drm_public int amdgpu_va_range_alloc(amdgpu_device_handle dev,
 
 	va_base_alignment = MAX2(va_base_alignment, vamgr->va_alignment);
 	size = ALIGN(size, vamgr->va_alignment);
+	if (flags & AMDGPU_VA_RANGE_FRAGMENT) {
+		uint64_t fragment = amdgpu_va_fragment_size(dev, size);
+
+		va_base_alignment = MAX2(va_base_alignment, fragment);
+		size = ALIGN(size, fragment);
+	}
 
-	ret = amdgpu_vamgr_find_va(vamgr, size,
-				   va_base_alignment, va_base_required,
-				   search_from_top, va_base_allocated);
+	va = calloc(1, sizeof(struct amdgpu_va));
+	if (!va)
+		return -ENOMEM;
+
+	ret = amdgpu_vamgr_alloc(vamgr, &size,
+				 va_base_alignment, va_base_required,
+				 search_from_top, va_base_allocated, &va->spare);
 
 	if (!(flags & AMDGPU_VA_RANGE_32_BIT) && ret) {
 		/* fallback to 32bit address */
@@ -262,27 +783,25 @@ drm_public int amdgpu_va_range_alloc(amdgpu_device_handle dev,
 			vamgr = &dev->vamgr_high_32;
 		else
 			vamgr = &dev->vamgr_32;
-		ret = amdgpu_vamgr_find_va(vamgr, size,
-					   va_base_alignment, va_base_required,
-					   search_from_top, va_base_allocated);
+		ret = amdgpu_vamgr_alloc(vamgr, &size,
+					 va_base_alignment, va_base_required,
+					 search_from_top, va_base_allocated,
+					 &va->spare);
 	}
 
-	if (!ret) {
-		struct amdgpu_va* va;
-		va = calloc(1, sizeof(struct amdgpu_va));
-		if(!va){
-			amdgpu_vamgr_free_va(vamgr, *va_base_allocated, size);
-			return -ENOMEM;
-		}
-		va->dev = dev;
-		va->address = *va_base_allocated;
-		va->size = size;
-		va->range = va_range_type;
-		va->vamgr = vamgr;
-		*va_range_handle = va;
+	if (ret) {
+		free(va->spare);
+		free(va);
+		return ret;
 	}
 
-	return ret;
+	va->dev = dev;
+	va->address = *va_base_allocated;
+	va->size = size;
+	va->range = va_range_type;
+	va->vamgr = vamgr;
+	*va_range_handle = va;
+	return 0;
 }
 
 drm_public int amdgpu_va_range_free(amdgpu_va_handle va_range_handle)
@@ -290,9 +809,14 @@ drm_public int amdgpu_va_range_free(amdgpu_va_handle va_range_handle)
 	if(!va_range_handle || !va_range_handle->address)
 		return 0;
 
-	amdgpu_vamgr_free_va(va_range_handle->vamgr,
-			va_range_handle->address,
-			va_range_handle->size);
+	if (!amdgpu_vamgr_magazine_free(va_range_handle->vamgr,
+					va_range_handle->address,
+					va_range_handle->size,
+					va_range_handle->spare))
+		amdgpu_vamgr_free_va(va_range_handle->vamgr,
+				     va_range_handle->address,
+				     va_range_handle->size,
+				     va_range_handle->spare);
 	free(va_range_handle);
 	return 0;
 }
@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+
+# Copyright © 2021 Advanced Micro Devices, Inc.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+# OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+# ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+# OTHER DEALINGS IN THE SOFTWARE.
+
+# Helper script that reads amdgpu.ids and writes a table sorted by device
+# and revision id, parsed the same way as amdgpu_parse_asic_ids() does
+
+import sys
+
+filename = sys.argv[1]
+towrite = sys.argv[2]
+
+entries = {}
+names = {}
+strings = []
+size = 0
+version = None
+
+with open(filename, "r", encoding="utf-8") as f:
+    for num, line in enumerate(f, 1):
+        line = line.rstrip('\n')
+        if not line or line.startswith('#'):
+            continue
+        # 1st valid line is file version
+        if version is None:
+            version = line
+            continue
+
+        fields = [s for s in line.split(',') if s]
+        try:
+            did = int(fields[0].strip(), 16)
+            rid = int(fields[1].strip(), 16)
+            name = fields[2].lstrip(' \t')
+        except (IndexError, ValueError):
+            name = ''
+        if not name or did > 0xffff or rid > 0xff:
+            sys.exit('Invalid format: {}: line {}: {}'.format(filename, num, line))
+
+        # the first match wins
+        key = (did << 8) | rid
+        if key in entries:
+            continue
+        if name not in names:
+            names[name] = size
+            strings.append(name)
+            size += len(name.encode('utf-8')) + 1
+        entries[key] = names[name]
+
+def c_string(s):
+    return '"{}\\0"'.format(s.replace('\\', '\\\\').replace('"', '\\"'))
+
+with open(towrite, "w", encoding="utf-8") as f:
+    f.write('''\
+/* AUTOMATICALLY GENERATED by gen_amdgpu_ids.py. You should modify
+   amdgpu.ids instead of adding here entries manually! */
+''')
+    f.write('static const char amdgpu_asic_id_version[] = {};\n\n'.format(
+        c_string(version or '').replace('\\0"', '"')))
+    f.write('static const char amdgpu_asic_id_names[] =\n')
+    for s in strings:
+        f.write('    {}\n'.format(c_string(s)))
+    f.write('    ;\n\n')
+    f.write('static const struct amdgpu_asic_id amdgpu_asic_id_table[] = {\n')
+    for key in sorted(entries):
+        f.write('    {{ 0x{:06x}, {} }},\n'.format(key, entries[key]))
+    f.write('};\n')
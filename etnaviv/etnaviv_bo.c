@@ -27,7 +27,6 @@
 #include "etnaviv_priv.h"
 #include "etnaviv_drmif.h"
 
-drm_private pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
 drm_private void bo_del(struct etna_bo *bo);
 
 /* set buffer name, and add to table, call w/ table_lock held: */
@@ -35,7 +34,8 @@ static void set_name(struct etna_bo *bo, uint32_t name)
 {
 	bo->name = name;
 	/* add ourself into the name table: */
-	drmHashInsert(bo->dev->name_table, name, bo);
+	if (handle_table_insert(&bo->dev->name_table, name, bo))
+		ERROR_MSG("out of memory for name %u", name);
 }
 
 /* Called under table_lock */
@@ -45,14 +45,15 @@ drm_private void bo_del(struct etna_bo *bo)
 		drm_munmap(bo->map, bo->size);
 
 	if (bo->name)
-		drmHashDelete(bo->dev->name_table, bo->name);
+		handle_table_remove(&bo->dev->name_table, bo->name);
 
 	if (bo->handle) {
 		struct drm_gem_close req = {
 			.handle = bo->handle,
 		};
 
-		drmHashDelete(bo->dev->handle_table, bo->handle);
+		handle_table_remove(&bo->dev->handle_table, bo->handle);
+		drmPrimeCacheHandleClosed(bo->dev->fd, bo->handle);
 		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
 	}
 
@@ -60,16 +61,21 @@ drm_private void bo_del(struct etna_bo *bo)
 }
 
 /* lookup a buffer from it's handle, call w/ table_lock held: */
-static struct etna_bo *lookup_bo(void *tbl, uint32_t handle)
+static struct etna_bo *lookup_bo(struct handle_table *tbl, uint32_t handle)
 {
-	struct etna_bo *bo = NULL;
+	struct etna_bo *bo = handle_table_lookup(tbl, handle);
 
-	if (!drmHashLookup(tbl, handle, (void **)&bo)) {
+	if (bo) {
 		/* found, incr refcnt and return: */
 		bo = etna_bo_ref(bo);
 
 		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
+		if (bo->cache_entry.cache) {
+			util_bo_cache_remove(&bo->cache_entry);
+			bo->label = 0;
+			util_bo_labels_alloc(&bo->dev->bo_labels, 0, 0,
+					bo->size);
+		}
 	}
 
 	return bo;
@@ -86,19 +92,26 @@ static struct etna_bo *bo_from_handle(struct etna_device *dev,
 			.handle = handle,
 		};
 
+		drmPrimeCacheHandleClosed(dev->fd, handle);
 		drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
 
 		return NULL;
 	}
 
-	bo->dev = etna_device_ref(dev);
+	bo->dev = dev;
 	bo->size = size;
 	bo->handle = handle;
 	bo->flags = flags;
 	atomic_set(&bo->refcnt, 1);
-	list_inithead(&bo->list);
+	util_bo_cache_entry_init(&bo->cache_entry);
 	/* add ourselves to the handle table: */
-	drmHashInsert(dev->handle_table, handle, bo);
+	if (handle_table_insert(&dev->handle_table, handle, bo)) {
+		bo_del(bo);
+		return NULL;
+	}
+	/* the caller holds a ref too, so this one never is the first: */
+	etna_device_ref(dev);
+	util_bo_labels_alloc(&dev->bo_labels, 0, 0, size);
 
 	return bo;
 }
@@ -113,9 +126,12 @@ drm_public struct etna_bo *etna_bo_new(struct etna_device *dev, uint32_t size,
 			.flags = flags,
 	};
 
-	bo = etna_bo_cache_alloc(&dev->bo_cache, &size, flags);
-	if (bo)
+	bo = etna_bo_cache_alloc(dev, &dev->bo_cache, &size, flags);
+	if (bo) {
+		UTIL_TRACE_EVENT("bo_cache_hit", "etnaviv handle=%u size=%u",
+				bo->handle, bo->size);
 		return bo;
+	}
 
 	req.size = size;
 	ret = drmCommandWriteRead(dev->fd, DRM_ETNAVIV_GEM_NEW,
@@ -123,10 +139,13 @@ drm_public struct etna_bo *etna_bo_new(struct etna_device *dev, uint32_t size,
 	if (ret)
 		return NULL;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 	bo = bo_from_handle(dev, size, req.handle, flags);
 	bo->reuse = 1;
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
+
+	UTIL_TRACE_EVENT("bo_create", "etnaviv handle=%u size=%u", req.handle,
+			size);
 
 	return bo;
 }
@@ -167,10 +186,10 @@ drm_public struct etna_bo *etna_bo_from_name(struct etna_device *dev,
 		.name = name,
 	};
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 
 	/* check name table first, to see if bo is already open: */
-	bo = lookup_bo(dev->name_table, name);
+	bo = lookup_bo(&dev->name_table, name);
 	if (bo)
 		goto out_unlock;
 
@@ -179,16 +198,19 @@ drm_public struct etna_bo *etna_bo_from_name(struct etna_device *dev,
 		goto out_unlock;
 	}
 
-	bo = lookup_bo(dev->handle_table, req.handle);
+	bo = lookup_bo(&dev->handle_table, req.handle);
 	if (bo)
 		goto out_unlock;
 
 	bo = bo_from_handle(dev, req.size, req.handle, 0);
-	if (bo)
+	if (bo) {
 		set_name(bo, name);
+		UTIL_TRACE_EVENT("bo_import", "etnaviv handle=%u size=%u",
+				req.handle, bo->size);
+	}
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -207,15 +229,15 @@ drm_public struct etna_bo *etna_bo_from_dmabuf(struct etna_device *dev, int fd)
 	 * racing against etna_bo_del, which might invalidate the
 	 * returned handle.
 	 */
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 
-	ret = drmPrimeFDToHandle(dev->fd, fd, &handle);
+	ret = drmPrimeFDToHandleCached(dev->fd, fd, &handle);
 	if (ret) {
-		pthread_mutex_unlock(&table_lock);
+		pthread_mutex_unlock(&dev->table_lock);
 		return NULL;
 	}
 
-	bo = lookup_bo(dev->handle_table, handle);
+	bo = lookup_bo(&dev->handle_table, handle);
 	if (bo)
 		goto out_unlock;
 
@@ -224,9 +246,12 @@ drm_public struct etna_bo *etna_bo_from_dmabuf(struct etna_device *dev, int fd)
 	lseek(fd, 0, SEEK_CUR);
 
 	bo = bo_from_handle(dev, size, handle, 0);
+	if (bo)
+		UTIL_TRACE_EVENT("bo_import", "etnaviv handle=%u size=%u",
+				handle, size);
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -242,15 +267,66 @@ drm_public void etna_bo_del(struct etna_bo *bo)
 	if (!atomic_dec_and_test(&bo->refcnt))
 		return;
 
-	pthread_mutex_lock(&table_lock);
+	UTIL_TRACE_EVENT("bo_free", "etnaviv handle=%u size=%u", bo->handle,
+			bo->size);
+
+	pthread_mutex_lock(&dev->table_lock);
+
+	util_bo_labels_remove(&dev->bo_labels, bo->label, 0, bo->size);
 
 	if (bo->reuse && (etna_bo_cache_free(&dev->bo_cache, bo) == 0))
 		goto out;
 
 	bo_del(bo);
-	etna_device_del_locked(dev);
 out:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
+
+	/* bo's in the bucket cache don't hold a ref to the dev either: */
+	etna_device_del(dev);
+}
+
+drm_public void etna_bo_set_label(struct etna_bo *bo, const char *label)
+{
+	struct etna_device *dev = bo->dev;
+	unsigned index;
+
+	pthread_mutex_lock(&dev->table_lock);
+	index = util_bo_labels_find(&dev->bo_labels, label);
+	util_bo_labels_move(&dev->bo_labels, bo->label, index, 0, bo->size);
+	bo->label = index;
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+drm_public int etna_device_get_bo_label_stats(struct etna_device *dev,
+		unsigned index, struct etna_bo_label_stats *stats)
+{
+	struct util_bo_label *label;
+
+	pthread_mutex_lock(&dev->table_lock);
+	if (index >= dev->bo_labels.num_labels) {
+		pthread_mutex_unlock(&dev->table_lock);
+		return -1;
+	}
+	label = &dev->bo_labels.labels[index];
+	memcpy(stats->name, label->name, sizeof(stats->name));
+	stats->buffers = label->buffers[0];
+	stats->bytes = label->bytes[0];
+	stats->peak_bytes = label->peak_bytes;
+	stats->allocs = label->allocs;
+	stats->alloc_bytes = label->alloc_bytes;
+	stats->alloc_rate = util_bo_labels_rate(&dev->bo_labels, index);
+	pthread_mutex_unlock(&dev->table_lock);
+	return 0;
+}
+
+/* Called under table_lock */
+drm_private void etna_device_dump_bo_usage_locked(struct etna_device *dev,
+		FILE *file)
+{
+	static const char *const heaps[] = { "bytes" };
+
+	util_bo_labels_dump(&dev->bo_labels, heaps, dev->bo_cache.stats.bytes,
+			"etnaviv", file);
 }
 
 /* get the global flink/DRI2 buffer name */
@@ -267,9 +343,9 @@ drm_public int etna_bo_get_name(struct etna_bo *bo, uint32_t *name)
 			return ret;
 		}
 
-		pthread_mutex_lock(&table_lock);
+		pthread_mutex_lock(&bo->dev->table_lock);
 		set_name(bo, req.name);
-		pthread_mutex_unlock(&table_lock);
+		pthread_mutex_unlock(&bo->dev->table_lock);
 		bo->reuse = 0;
 	}
 
@@ -26,25 +26,12 @@
 
 #include "etnaviv_priv.h"
 #include "etnaviv_drmif.h"
+#include "util_mem_pressure.h"
 
 drm_private void bo_del(struct etna_bo *bo);
-drm_private extern pthread_mutex_t table_lock;
 
-static void add_bucket(struct etna_bo_cache *cache, int size)
+drm_private void etna_bo_cache_init(struct util_bo_cache *cache)
 {
-	unsigned i = cache->num_buckets;
-
-	assert(i < ARRAY_SIZE(cache->cache_bucket));
-
-	list_inithead(&cache->cache_bucket[i].list);
-	cache->cache_bucket[i].size = size;
-	cache->num_buckets++;
-}
-
-drm_private void etna_bo_cache_init(struct etna_bo_cache *cache)
-{
-	unsigned long size, cache_max_size = 64 * 1024 * 1024;
-
 	/* OK, so power of two buckets was too wasteful of memory.
 	 * Give 3 other sizes between each power of two, to hopefully
 	 * cover things accurately enough.  (The alternative is
@@ -53,61 +40,29 @@ drm_private void etna_bo_cache_init(struct etna_bo_cache *cache)
 	 * width/height alignment and rounding of sizes to pages will
 	 * get us useful cache hit rates anyway)
 	 */
-	add_bucket(cache, 4096);
-	add_bucket(cache, 4096 * 2);
-	add_bucket(cache, 4096 * 3);
-
-	/* Initialize the linked lists for BO reuse cache. */
-	for (size = 4 * 4096; size <= cache_max_size; size *= 2) {
-		add_bucket(cache, size);
-		add_bucket(cache, size + size * 1 / 4);
-		add_bucket(cache, size + size * 2 / 4);
-		add_bucket(cache, size + size * 3 / 4);
-	}
+	util_bo_cache_init(cache, 2, UTIL_BO_CACHE_DEFAULT_MAX_SIZE, 0,
+			   UTIL_BO_CACHE_DEFAULT_MAX_AGE);
 }
 
 /* Frees older cached buffers.  Called under table_lock */
-drm_private void etna_bo_cache_cleanup(struct etna_bo_cache *cache, time_t time)
+drm_private void etna_bo_cache_cleanup(struct util_bo_cache *cache, uint64_t now)
 {
-	unsigned i;
-
-	if (cache->time == time)
-		return;
-
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct etna_bo_bucket *bucket = &cache->cache_bucket[i];
-		struct etna_bo *bo;
-
-		while (!LIST_IS_EMPTY(&bucket->list)) {
-			bo = LIST_ENTRY(struct etna_bo, bucket->list.next, list);
-
-			/* keep things in cache for at least 1 second: */
-			if (time && ((time - bo->free_time) <= 1))
-				break;
-
-			list_del(&bo->list);
-			bo_del(bo);
-		}
-	}
+	struct util_bo_cache_entry *entry;
 
-	cache->time = time;
+	while ((entry = util_bo_cache_evict(cache, now)))
+		bo_del(LIST_ENTRY(struct etna_bo, entry, cache_entry));
 }
 
-static struct etna_bo_bucket *get_bucket(struct etna_bo_cache *cache, uint32_t size)
+/* Frees older cached buffers and the oldest others until level percent of
+ * the cached memory is released.  Called under table_lock */
+drm_private void etna_bo_cache_trim(struct util_bo_cache *cache, unsigned level)
 {
-	unsigned i;
+	uint64_t bytes = util_bo_cache_trim_bytes(cache, level);
+	uint64_t now = util_bo_cache_now();
+	struct util_bo_cache_entry *entry;
 
-	/* hmm, this is what intel does, but I suppose we could calculate our
-	 * way to the correct bucket size rather than looping..
-	 */
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct etna_bo_bucket *bucket = &cache->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
-	}
-
-	return NULL;
+	while ((entry = util_bo_cache_evict_to(cache, now, bytes)))
+		bo_del(LIST_ENTRY(struct etna_bo, entry, cache_entry));
 }
 
 static int is_idle(struct etna_bo *bo)
@@ -118,35 +73,42 @@ static int is_idle(struct etna_bo *bo)
 			DRM_ETNA_PREP_NOSYNC) == 0;
 }
 
-static struct etna_bo *find_in_bucket(struct etna_bo_bucket *bucket, uint32_t flags)
+static struct etna_bo *find_in_bucket(struct etna_device *dev,
+		struct util_bo_cache *cache, struct util_bo_cache_bucket *bucket,
+		uint32_t flags)
 {
+	enum util_bo_cache_miss reason = UTIL_BO_CACHE_MISS_EMPTY;
 	struct etna_bo *bo = NULL, *tmp;
 
-	pthread_mutex_lock(&table_lock);
-
-	if (LIST_IS_EMPTY(&bucket->list))
-		goto out_unlock;
+	pthread_mutex_lock(&dev->table_lock);
 
-	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &bucket->list, list) {
+	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &bucket->list, cache_entry.bucket_link) {
 		/* skip BOs with different flags */
-		if (bo->flags != flags)
+		if (bo->flags != flags) {
+			reason = UTIL_BO_CACHE_MISS_FLAGS;
 			continue;
+		}
 
 		/* check if the first BO with matching flags is idle */
 		if (is_idle(bo)) {
-			list_delinit(&bo->list);
+			util_bo_cache_take(&bo->cache_entry);
+			bo->label = 0;
+			util_bo_labels_alloc(&bo->dev->bo_labels, 0, 0,
+					bo->size);
 			goto out_unlock;
 		}
 
 		/* If the oldest BO is still busy, don't try younger ones */
+		reason = UTIL_BO_CACHE_MISS_BUSY;
 		break;
 	}
 
 	/* There was no matching buffer found */
 	bo = NULL;
+	util_bo_cache_bucket_miss(cache, bucket, reason);
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -155,22 +117,22 @@ out_unlock:
  *
  * NOTE: size is potentially rounded up to bucket size
  */
-drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache, uint32_t *size,
-    uint32_t flags)
+drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_device *dev,
+		struct util_bo_cache *cache, uint32_t *size, uint32_t flags)
 {
 	struct etna_bo *bo;
-	struct etna_bo_bucket *bucket;
+	struct util_bo_cache_bucket *bucket;
 
 	*size = ALIGN(*size, 4096);
-	bucket = get_bucket(cache, *size);
+	bucket = util_bo_cache_get_bucket(cache, *size);
 
 	/* see if we can be green and recycle: */
 	if (bucket) {
 		*size = bucket->size;
-		bo = find_in_bucket(bucket, flags);
+		bo = find_in_bucket(dev, cache, bucket, flags);
 		if (bo) {
 			atomic_set(&bo->refcnt, 1);
-			etna_device_ref(bo->dev);
+			etna_device_ref(dev);
 			return bo;
 		}
 	}
@@ -178,27 +140,116 @@ drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache, uin
 	return NULL;
 }
 
-drm_private int etna_bo_cache_free(struct etna_bo_cache *cache, struct etna_bo *bo)
+drm_private int etna_bo_cache_free(struct util_bo_cache *cache, struct etna_bo *bo)
 {
-	struct etna_bo_bucket *bucket = get_bucket(cache, bo->size);
-
-	/* see if we can be green and recycle: */
-	if (bucket) {
-		struct timespec time;
-
-		clock_gettime(CLOCK_MONOTONIC, &time);
+	struct util_bo_cache_bucket *bucket = util_bo_cache_get_bucket(cache, bo->size);
 
-		bo->free_time = time.tv_sec;
-		list_addtail(&bo->list, &bucket->list);
-		etna_bo_cache_cleanup(cache, time.tv_sec);
+	/* see if we can be green and recycle, unless the buckets changed
+	 * since the bo was allocated: */
+	if (bucket && bucket->size == bo->size) {
+		uint64_t now = util_bo_cache_now();
 
-		/* bo's in the bucket cache don't have a ref and
-		 * don't hold a ref to the dev:
-		 */
-		etna_device_del_locked(bo->dev);
+		util_bo_cache_add(cache, bucket, &bo->cache_entry, now);
+		etna_bo_cache_cleanup(cache, now);
 
 		return 0;
 	}
 
 	return -1;
 }
+
+/* Changing the buckets needs an empty cache, so the cached buffers are
+ * dropped, as are the statistics. */
+drm_public void etna_device_set_bo_cache(struct etna_device *dev,
+		unsigned bucket_shift, uint64_t max_size, uint64_t max_bytes,
+		uint32_t max_age_ms)
+{
+	pthread_mutex_lock(&dev->table_lock);
+	etna_bo_cache_cleanup(&dev->bo_cache, UTIL_BO_CACHE_PURGE);
+	util_bo_cache_init(&dev->bo_cache, bucket_shift, max_size, max_bytes,
+			   max_age_ms * 1000000ull);
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+drm_public void etna_device_get_bo_cache_stats(struct etna_device *dev,
+		uint64_t *hits, uint64_t *misses, uint64_t *evictions)
+{
+	pthread_mutex_lock(&dev->table_lock);
+	*hits = dev->bo_cache.stats.hits;
+	*misses = dev->bo_cache.stats.misses;
+	*evictions = dev->bo_cache.stats.evictions;
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+drm_public int etna_device_get_bo_cache_bucket_stats(struct etna_device *dev,
+		unsigned index, struct etna_bo_cache_bucket_stats *stats)
+{
+	struct util_bo_cache_bucket *bucket;
+
+	pthread_mutex_lock(&dev->table_lock);
+	if (index >= dev->bo_cache.num_buckets) {
+		pthread_mutex_unlock(&dev->table_lock);
+		return -1;
+	}
+	bucket = &dev->bo_cache.buckets[index];
+	stats->size = bucket->size;
+	stats->allocs = bucket->stats.allocs;
+	stats->hits = bucket->stats.hits;
+	stats->busy_misses = bucket->stats.busy_misses;
+	stats->flags_misses = bucket->stats.flags_misses;
+	stats->expired = bucket->stats.expired;
+	stats->dropped = bucket->stats.dropped;
+	stats->buffers = bucket->stats.buffers;
+	stats->bytes = bucket->stats.bytes;
+	pthread_mutex_unlock(&dev->table_lock);
+	return 0;
+}
+
+drm_public void etna_device_trim_bo_cache(struct etna_device *dev,
+		unsigned level)
+{
+	pthread_mutex_lock(&dev->table_lock);
+	etna_bo_cache_trim(&dev->bo_cache, level);
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+static void etna_bo_cache_pressure(struct util_mem_pressure *pressure,
+		unsigned level)
+{
+	struct etna_device *dev = pressure->data;
+
+	/* the watcher is stopped without table_lock held: */
+	pthread_mutex_lock(&dev->table_lock);
+	etna_bo_cache_trim(&dev->bo_cache, level);
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+drm_public int etna_device_watch_memory_pressure(struct etna_device *dev,
+		int enable)
+{
+	struct util_mem_pressure *pressure = NULL;
+	int ret = 0;
+
+	pthread_mutex_lock(&dev->table_lock);
+	if (enable && !dev->pressure) {
+		dev->pressure = util_mem_pressure_start(etna_bo_cache_pressure, dev);
+		if (!dev->pressure)
+			ret = -errno;
+	} else if (!enable) {
+		pressure = dev->pressure;
+		dev->pressure = NULL;
+	}
+	pthread_mutex_unlock(&dev->table_lock);
+
+	if (pressure)
+		util_mem_pressure_stop(pressure);
+
+	return ret;
+}
+
+/* Called when the device goes away */
+drm_private void etna_bo_cache_unwatch_pressure(struct etna_device *dev)
+{
+	if (dev->pressure)
+		util_mem_pressure_stop(dev->pressure);
+}
@@ -29,19 +29,17 @@
 #include "etnaviv_drmif.h"
 #include "etnaviv_priv.h"
 
-static pthread_mutex_t idx_lock = PTHREAD_MUTEX_INITIALIZER;
+#define BO_TABLE_INIT_SIZE 64
+
+/* The kernel copies the stream into a suballocation of its 256 KiB
+ * cmdbuf buffer, which other submits in flight also use, so keep well
+ * below that:
+ */
+#define MAX_STREAM_SIZE (128 * 1024 / 4)
 
 static void *grow(void *ptr, uint32_t nr, uint32_t *max, uint32_t sz)
 {
-	if ((nr + 1) > *max) {
-		if ((*max * 2) < (nr + 1))
-			*max = nr + 5;
-		else
-			*max = *max * 2;
-		ptr = realloc(ptr, *max * sz);
-	}
-
-	return ptr;
+	return util_grow_array(ptr, max, nr + 1, sz);
 }
 
 #define APPEND(x, name) ({ \
@@ -83,7 +81,10 @@ drm_public struct etna_cmd_stream *etna_cmd_stream_new(struct etna_pipe *pipe,
 	}
 
 	stream->base.size = size;
+	stream->max_size = size;
 	stream->pipe = pipe;
+	stream->seqno = __atomic_add_fetch(&pipe->gpu->dev->stream_cnt, 1,
+			__ATOMIC_RELAXED);
 	stream->reset_notify = reset_notify;
 	stream->reset_notify_priv = priv;
 
@@ -101,11 +102,58 @@ drm_public void etna_cmd_stream_del(struct etna_cmd_stream *stream)
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
 
 	free(stream->buffer);
+	free(priv->submit.bos);
 	free(priv->submit.relocs);
 	free(priv->submit.pmrs);
+	free(priv->bos);
+	free(priv->bo_table);
 	free(priv);
 }
 
+/* Let the buffer grow up to max_size words (up to the kernel's limit) to
+ * fit one frame in one submit, rather than forcing a flush when full.  The
+ * grown buffer is kept for the next submits.
+ */
+drm_public void etna_cmd_stream_set_max_size(struct etna_cmd_stream *stream,
+		uint32_t max_size)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+
+	max_size = ALIGN(max_size, 2);
+	if (max_size > MAX_STREAM_SIZE)
+		max_size = MAX_STREAM_SIZE;
+
+	priv->max_size = max_size > stream->size ? max_size : stream->size;
+}
+
+/* Make room for n more words, growing the buffer if allowed, otherwise
+ * flushing it:
+ */
+drm_public void etna_cmd_stream_make_room(struct etna_cmd_stream *stream,
+		uint32_t n)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	uint32_t size = stream->size;
+	uint32_t *buffer;
+
+	while (size - stream->offset - 2 < n && size < priv->max_size)
+		size = size * 2 < priv->max_size ? size * 2 : priv->max_size;
+
+	if (size - stream->offset - 2 < n) {
+		etna_cmd_stream_flush(stream);
+		return;
+	}
+
+	buffer = realloc(stream->buffer, size * sizeof(uint32_t));
+	if (!buffer) {
+		etna_cmd_stream_flush(stream);
+		return;
+	}
+
+	stream->buffer = buffer;
+	stream->size = size;
+}
+
 static void reset_buffer(struct etna_cmd_stream *stream)
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
@@ -116,6 +164,11 @@ static void reset_buffer(struct etna_cmd_stream *stream)
 	priv->submit.nr_pmrs = 0;
 	priv->nr_bos = 0;
 
+	/* the tables keep their size, so the next submit only grows them
+	 * past the largest one so far: */
+	if (priv->bo_table)
+		memset(priv->bo_table, 0, priv->bo_table_size * sizeof(uint32_t));
+
 	if (priv->reset_notify)
 		priv->reset_notify(stream, priv->reset_notify_priv);
 }
@@ -141,30 +194,72 @@ static uint32_t append_bo(struct etna_cmd_stream *stream, struct etna_bo *bo)
 	return idx;
 }
 
+/* slot of the bo handle in the bo table, free if not in the stream: */
+static uint32_t *bo_table_slot(struct etna_cmd_stream_priv *priv,
+		uint32_t handle)
+{
+	uint32_t mask = priv->bo_table_size - 1;
+	uint32_t i = (handle * 2654435761u) & mask;
+
+	while (priv->bo_table[i] &&
+			priv->submit.bos[priv->bo_table[i] - 1].handle != handle)
+		i = (i + 1) & mask;
+
+	return &priv->bo_table[i];
+}
+
+static int bo_table_grow(struct etna_cmd_stream_priv *priv)
+{
+	uint32_t *old = priv->bo_table;
+	uint32_t i, old_size = priv->bo_table_size;
+
+	priv->bo_table_size = old_size ? old_size * 2 : BO_TABLE_INIT_SIZE;
+	priv->bo_table = calloc(priv->bo_table_size, sizeof(uint32_t));
+	if (!priv->bo_table) {
+		priv->bo_table = old;
+		priv->bo_table_size = old_size;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i]) {
+			uint32_t handle = priv->submit.bos[old[i] - 1].handle;
+			*bo_table_slot(priv, handle) = old[i];
+		}
+	}
+	free(old);
+
+	return 0;
+}
+
 /* add (if needed) bo, return idx: */
 static uint32_t bo2idx(struct etna_cmd_stream *stream, struct etna_bo *bo,
 		uint32_t flags)
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
-	uint32_t idx;
+	uint64_t cached;
+	uint32_t idx, *slot;
 
-	pthread_mutex_lock(&idx_lock);
-
-	if (bo->current_stream == stream) {
-		idx = bo->idx;
+	cached = __atomic_load_n(&bo->current_stream_idx, __ATOMIC_RELAXED);
+	if ((cached >> 32) == priv->seqno) {
+		idx = (uint32_t)cached;
 	} else {
 		/* slow-path: */
-		for (idx = 0; idx < priv->nr_bos; idx++)
-			if (priv->bos[idx] == bo)
-				break;
-		if (idx == priv->nr_bos) {
-			/* not found */
+		if ((priv->nr_bos + 1) * 2 > priv->bo_table_size)
+			bo_table_grow(priv);
+
+		slot = bo_table_slot(priv, bo->handle);
+		if (*slot) {
+			/* found */
+			idx = *slot - 1;
+		} else {
 			idx = append_bo(stream, bo);
+			*slot = idx + 1;
 		}
-		bo->current_stream = stream;
-		bo->idx = idx;
+		__atomic_store_n(&bo->current_stream_idx,
+				((uint64_t)priv->seqno << 32) | idx,
+				__ATOMIC_RELAXED);
 	}
-	pthread_mutex_unlock(&idx_lock);
 
 	if (flags & ETNA_RELOC_READ)
 		priv->submit.bos[idx].flags |= ETNA_SUBMIT_BO_READ;
@@ -194,6 +289,16 @@ static void flush(struct etna_cmd_stream *stream, int in_fence_fd,
 		.stream_size = stream->offset * 4, /* in bytes */
 	};
 
+	if (priv->perfmon_session) {
+		etna_perfmon_session_emit(priv->perfmon_session);
+
+		/* which may have grown the tables: */
+		req.bos = VOID2U64(priv->submit.bos);
+		req.nr_bos = priv->submit.nr_bos;
+		req.pmrs = VOID2U64(priv->submit.pmrs);
+		req.nr_pmrs = priv->submit.nr_pmrs;
+	}
+
 	if (in_fence_fd != -1) {
 		req.flags |= ETNA_SUBMIT_FENCE_FD_IN | ETNA_SUBMIT_NO_IMPLICIT;
 		req.fence_fd = in_fence_fd;
@@ -202,18 +307,27 @@ static void flush(struct etna_cmd_stream *stream, int in_fence_fd,
 	if (out_fence_fd)
 		req.flags |= ETNA_SUBMIT_FENCE_FD_OUT;
 
+	UTIL_TRACE_BEGIN("etna_cmd_stream_flush", "pipe=%d bos=%u size=%u",
+			id, req.nr_bos, req.stream_size);
 	ret = drmCommandWriteRead(gpu->dev->fd, DRM_ETNAVIV_GEM_SUBMIT,
 			&req, sizeof(req));
+	UTIL_TRACE_END();
 
 	if (ret)
 		ERROR_MSG("submit failed: %d (%s)", ret, strerror(errno));
 	else
 		priv->last_timestamp = req.fence;
 
+	if (priv->perfmon_session)
+		etna_perfmon_session_submitted(priv->perfmon_session, ret, req.fence);
+
 	for (uint32_t i = 0; i < priv->nr_bos; i++) {
 		struct etna_bo *bo = priv->bos[i];
+		uint64_t cached = ((uint64_t)priv->seqno << 32) | i;
 
-		bo->current_stream = NULL;
+		/* unless another stream took it over since: */
+		__atomic_compare_exchange_n(&bo->current_stream_idx, &cached, 0,
+				false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
 		etna_bo_del(bo);
 	}
 
@@ -235,6 +349,19 @@ drm_public void etna_cmd_stream_flush2(struct etna_cmd_stream *stream,
 	reset_buffer(stream);
 }
 
+/* flush, returning a fence for the submit, with a sync file: */
+drm_public struct etna_fence *
+etna_cmd_stream_flush_fence(struct etna_cmd_stream *stream, int in_fence_fd)
+{
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	int fence_fd = -1;
+
+	flush(stream, in_fence_fd, &fence_fd);
+	reset_buffer(stream);
+
+	return etna_fence_new(priv->pipe, priv->last_timestamp, fence_fd);
+}
+
 drm_public void etna_cmd_stream_finish(struct etna_cmd_stream *stream)
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
@@ -39,8 +39,6 @@
 #include "etnaviv_priv.h"
 #include "etnaviv_drmif.h"
 
-static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
-
 drm_public struct etna_device *etna_device_new(int fd)
 {
 	struct etna_device *dev = calloc(sizeof(*dev), 1);
@@ -49,10 +47,10 @@ drm_public struct etna_device *etna_device_new(int fd)
 		return NULL;
 
 	atomic_set(&dev->refcnt, 1);
+	pthread_mutex_init(&dev->table_lock, NULL);
 	dev->fd = fd;
-	dev->handle_table = drmHashCreate();
-	dev->name_table = drmHashCreate();
 	etna_bo_cache_init(&dev->bo_cache);
+	util_bo_labels_init(&dev->bo_labels, 1);
 
 	return dev;
 }
@@ -79,37 +77,44 @@ drm_public struct etna_device *etna_device_ref(struct etna_device *dev)
 	return dev;
 }
 
-static void etna_device_del_impl(struct etna_device *dev)
+/* The last ref may be the one of a bo, so it is dropped after releasing
+ * table_lock, which goes away with the device.
+ */
+drm_public void etna_device_del(struct etna_device *dev)
 {
-	etna_bo_cache_cleanup(&dev->bo_cache, 0);
-	drmHashDestroy(dev->handle_table);
-	drmHashDestroy(dev->name_table);
+	if (!atomic_dec_and_test(&dev->refcnt))
+		return;
 
-	if (dev->closefd)
+	etna_bo_cache_unwatch_pressure(dev);
+
+	pthread_mutex_lock(&dev->table_lock);
+	if (util_bo_cache_dump_enabled())
+		util_bo_cache_dump(&dev->bo_cache, "etnaviv");
+	if (util_bo_labels_dump_enabled())
+		etna_device_dump_bo_usage_locked(dev, stderr);
+	etna_bo_cache_cleanup(&dev->bo_cache, UTIL_BO_CACHE_PURGE);
+	handle_table_fini(&dev->handle_table);
+	handle_table_fini(&dev->name_table);
+	pthread_mutex_unlock(&dev->table_lock);
+	pthread_mutex_destroy(&dev->table_lock);
+
+	if (dev->closefd) {
+		/* The fd number may be reused for another device. */
+		drmInvalidateMetadataCache(dev->fd);
 		close(dev->fd);
+	}
 
 	free(dev);
 }
 
-drm_private void etna_device_del_locked(struct etna_device *dev)
-{
-	if (!atomic_dec_and_test(&dev->refcnt))
-		return;
-
-	etna_device_del_impl(dev);
-}
-
-drm_public void etna_device_del(struct etna_device *dev)
+drm_public int etna_device_fd(struct etna_device *dev)
 {
-	if (!atomic_dec_and_test(&dev->refcnt))
-		return;
-
-	pthread_mutex_lock(&table_lock);
-	etna_device_del_impl(dev);
-	pthread_mutex_unlock(&table_lock);
+   return dev->fd;
 }
 
-drm_public int etna_device_fd(struct etna_device *dev)
+drm_public void etna_device_dump_bo_usage(struct etna_device *dev, FILE *file)
 {
-   return dev->fd;
+	pthread_mutex_lock(&dev->table_lock);
+	etna_device_dump_bo_usage_locked(dev, file);
+	pthread_mutex_unlock(&dev->table_lock);
 }
@@ -29,6 +29,7 @@
 
 #include <xf86drm.h>
 #include <stdint.h>
+#include <stdio.h>
 
 struct etna_bo;
 struct etna_pipe;
@@ -38,6 +39,8 @@ struct etna_cmd_stream;
 struct etna_perfmon;
 struct etna_perfmon_domain;
 struct etna_perfmon_signal;
+struct etna_perfmon_session;
+struct etna_fence;
 
 enum etna_pipe_id {
 	ETNA_PIPE_3D = 0,
@@ -92,6 +95,69 @@ struct etna_device *etna_device_ref(struct etna_device *dev);
 void etna_device_del(struct etna_device *dev);
 int etna_device_fd(struct etna_device *dev);
 
+/* Buffers freed to the cache go in 2^bucket_shift buckets per power of two
+ * up to max_size, and stay there for max_age_ms, or until the cache holds
+ * more than max_bytes (0 for no limit).  The cached buffers are dropped.
+ */
+void etna_device_set_bo_cache(struct etna_device *dev, unsigned bucket_shift,
+		uint64_t max_size, uint64_t max_bytes, uint32_t max_age_ms);
+void etna_device_get_bo_cache_stats(struct etna_device *dev, uint64_t *hits,
+		uint64_t *misses, uint64_t *evictions);
+struct etna_bo_cache_bucket_stats {
+	/* Buffer size of the bucket. */
+	uint64_t size;
+	/* Allocations of that size, and those served from the cache. */
+	uint64_t allocs;
+	uint64_t hits;
+	/* Misses because the cached buffers were busy, or had other flags. */
+	uint64_t busy_misses;
+	uint64_t flags_misses;
+	/* Buffers evicted for their age, and for the memory cap, a trim or
+	 * the cache being dropped. */
+	uint64_t expired;
+	uint64_t dropped;
+	/* Currently cached. */
+	uint64_t buffers;
+	uint64_t bytes;
+};
+/* Statistics of the bucket index of the bo cache, counting from 0 for the
+ * smallest size.  Returns -1 past the last bucket.  Setting
+ * LIBDRM_BO_CACHE_STATS in the environment prints them when the device is
+ * destroyed.
+ */
+int etna_device_get_bo_cache_bucket_stats(struct etna_device *dev,
+		unsigned index, struct etna_bo_cache_bucket_stats *stats);
+/* Frees the cached buffers past their age, and the oldest others until
+ * level percent of the cached memory is released, 100 empties the cache.
+ */
+void etna_device_trim_bo_cache(struct etna_device *dev, unsigned level);
+struct etna_bo_label_stats {
+	char name[32];
+	/* Live buffers of the label, those in the bo cache not counted. */
+	uint64_t buffers;
+	uint64_t bytes;
+	uint64_t peak_bytes;
+	/* Allocations since the device was created, and the bytes allocated
+	 * per second lately. */
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+	uint64_t alloc_rate;
+};
+/* Statistics of the label index of the device, 0 being the buffers never
+ * labeled with etna_bo_set_label().  Returns -1 past the last label.
+ * Setting LIBDRM_BO_LABEL_STATS in the environment prints them when the
+ * device is destroyed.
+ */
+int etna_device_get_bo_label_stats(struct etna_device *dev, unsigned index,
+		struct etna_bo_label_stats *stats);
+/* Prints the live bytes of each label and the idle bytes cached. */
+void etna_device_dump_bo_usage(struct etna_device *dev, FILE *file);
+/* Trims the cache from a thread when the kernel reports memory pressure,
+ * through PSI or the cgroup memory events.  Returns -ENOTSUP if it has
+ * neither.
+ */
+int etna_device_watch_memory_pressure(struct etna_device *dev, int enable);
+
 /* gpu functions:
  */
 
@@ -109,6 +175,17 @@ void etna_pipe_del(struct etna_pipe *pipe);
 int etna_pipe_wait(struct etna_pipe *pipe, uint32_t timestamp, uint32_t ms);
 int etna_pipe_wait_ns(struct etna_pipe *pipe, uint32_t timestamp, uint64_t ns);
 
+/* fence objects, of a flush, or of a timestamp and sync file fd (which
+ * the fence takes over) for waiting from an event loop:
+ */
+struct etna_fence *etna_fence_new(struct etna_pipe *pipe, uint32_t timestamp,
+		int fence_fd);
+void etna_fence_del(struct etna_fence *fence);
+int etna_fence_get_fd(struct etna_fence *fence);
+int etna_fence_is_signaled(struct etna_fence *fence);
+int etna_fence_wait(struct etna_fence **fences, unsigned count, int wait_all,
+		uint64_t ns);
+
 
 /* buffer-object functions:
  */
@@ -122,6 +199,9 @@ void etna_bo_del(struct etna_bo *bo);
 int etna_bo_get_name(struct etna_bo *bo, uint32_t *name);
 uint32_t etna_bo_handle(struct etna_bo *bo);
 int etna_bo_dmabuf(struct etna_bo *bo);
+/* Accounts the bo to a debug label, up to 31 characters, until it is freed
+ * or reused from the bo cache. */
+void etna_bo_set_label(struct etna_bo *bo, const char *label);
 uint32_t etna_bo_size(struct etna_bo *bo);
 void * etna_bo_map(struct etna_bo *bo);
 int etna_bo_cpu_prep(struct etna_bo *bo, uint32_t op);
@@ -141,8 +221,12 @@ struct etna_cmd_stream *etna_cmd_stream_new(struct etna_pipe *pipe, uint32_t siz
 		void (*reset_notify)(struct etna_cmd_stream *stream, void *priv),
 		void *priv);
 void etna_cmd_stream_del(struct etna_cmd_stream *stream);
+void etna_cmd_stream_set_max_size(struct etna_cmd_stream *stream, uint32_t max_size);
+void etna_cmd_stream_make_room(struct etna_cmd_stream *stream, uint32_t n);
 uint32_t etna_cmd_stream_timestamp(struct etna_cmd_stream *stream);
 void etna_cmd_stream_flush(struct etna_cmd_stream *stream);
+struct etna_fence *etna_cmd_stream_flush_fence(struct etna_cmd_stream *stream,
+		int in_fence_fd);
 void etna_cmd_stream_flush2(struct etna_cmd_stream *stream, int in_fence_fd,
 			    int *out_fence_fd);
 void etna_cmd_stream_finish(struct etna_cmd_stream *stream);
@@ -157,7 +241,7 @@ static inline uint32_t etna_cmd_stream_avail(struct etna_cmd_stream *stream)
 static inline void etna_cmd_stream_reserve(struct etna_cmd_stream *stream, size_t n)
 {
 	if (etna_cmd_stream_avail(stream) < n)
-		etna_cmd_stream_flush(stream);
+		etna_cmd_stream_make_room(stream, n);
 }
 
 static inline void etna_cmd_stream_emit(struct etna_cmd_stream *stream, uint32_t data)
@@ -211,4 +295,17 @@ struct etna_perf {
 
 void etna_cmd_stream_perf(struct etna_cmd_stream *stream, const struct etna_perf *p);
 
+/* continuous sampling of a set of signals around each flush of a stream,
+ * reported as the per-submit deltas, in the order of the signals, along
+ * with the submit's fence:
+ */
+typedef void (*etna_perfmon_sample_func)(void *data, uint32_t fence,
+		const uint32_t *deltas, unsigned nr_signals);
+
+struct etna_perfmon_session *etna_perfmon_session_new(struct etna_cmd_stream *stream,
+		struct etna_perfmon_signal **signals, unsigned nr_signals,
+		unsigned nr_slots, etna_perfmon_sample_func func, void *data);
+void etna_perfmon_session_poll(struct etna_perfmon_session *session);
+void etna_perfmon_session_del(struct etna_perfmon_session *session);
+
 #endif /* ETNAVIV_DRMIF_H_ */
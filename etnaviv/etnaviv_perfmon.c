@@ -183,3 +183,184 @@ drm_public struct etna_perfmon_signal *etna_perfmon_get_sig_by_name(struct etna_
 
 	return NULL;
 }
+
+/* offsets in the sample bo, past the sequence: */
+#define PRE_OFFSET(i)  (4 * (1 + 2 * (i)))
+#define POST_OFFSET(i) (4 * (2 + 2 * (i)))
+
+/* Report the samples of the submits that are done, oldest first, waiting
+ * for them if asked to:
+ */
+static void etna_perfmon_session_reap(struct etna_perfmon_session *session,
+		int wait)
+{
+	uint32_t op = DRM_ETNA_PREP_READ | (wait ? 0 : DRM_ETNA_PREP_NOSYNC);
+
+	while (session->count && &session->slots[session->tail] != session->current) {
+		struct etna_perfmon_slot *slot = &session->slots[session->tail];
+
+		if (!slot->failed) {
+			uint32_t *map;
+			unsigned i;
+
+			if (etna_bo_cpu_prep(slot->bo, op))
+				break;
+
+			/* the kernel writes the sequence once the post samples are in: */
+			map = etna_bo_map(slot->bo);
+			if (map && map[0] == slot->sequence) {
+				for (i = 0; i < session->nr_signals; i++)
+					session->deltas[i] = map[POST_OFFSET(i) / 4] -
+							map[PRE_OFFSET(i) / 4];
+				session->func(session->data, slot->fence,
+						session->deltas, session->nr_signals);
+			}
+			etna_bo_cpu_fini(slot->bo);
+		}
+
+		session->tail = (session->tail + 1) % session->nr_slots;
+		session->count--;
+	}
+}
+
+/* Called before each flush of the stream, to sample it into the next free
+ * slot.  When all slots are still in flight the submit goes unsampled,
+ * rather than stalling the flush.
+ */
+drm_private void etna_perfmon_session_emit(struct etna_perfmon_session *session)
+{
+	struct etna_perfmon_slot *slot;
+	unsigned i;
+
+	etna_perfmon_session_reap(session, 0);
+
+	if (session->count == session->nr_slots)
+		return;
+
+	slot = &session->slots[session->head];
+	session->head = (session->head + 1) % session->nr_slots;
+	session->count++;
+
+	slot->sequence = ++session->sequence;
+	slot->failed = 0;
+
+	for (i = 0; i < session->nr_signals; i++) {
+		etna_cmd_stream_perf(session->stream, &(struct etna_perf){
+			.flags = ETNA_PM_PROCESS_PRE,
+			.sequence = slot->sequence,
+			.signal = session->signals[i],
+			.bo = slot->bo,
+			.offset = PRE_OFFSET(i),
+		});
+		etna_cmd_stream_perf(session->stream, &(struct etna_perf){
+			.flags = ETNA_PM_PROCESS_POST,
+			.sequence = slot->sequence,
+			.signal = session->signals[i],
+			.bo = slot->bo,
+			.offset = POST_OFFSET(i),
+		});
+	}
+
+	session->current = slot;
+}
+
+drm_private void etna_perfmon_session_submitted(struct etna_perfmon_session *session,
+		int ret, uint32_t fence)
+{
+	struct etna_perfmon_slot *slot = session->current;
+
+	if (!slot)
+		return;
+
+	slot->failed = !!ret;
+	slot->fence = fence;
+	session->current = NULL;
+}
+
+drm_public struct etna_perfmon_session *
+etna_perfmon_session_new(struct etna_cmd_stream *stream,
+		struct etna_perfmon_signal **signals, unsigned nr_signals,
+		unsigned nr_slots, etna_perfmon_sample_func func, void *data)
+{
+	struct etna_cmd_stream_priv *priv = (struct etna_cmd_stream_priv *)stream;
+	struct etna_device *dev = priv->pipe->gpu->dev;
+	struct etna_perfmon_session *session;
+	unsigned i;
+
+	if (!nr_signals || !nr_slots || priv->perfmon_session) {
+		ERROR_MSG("invalid session");
+		return NULL;
+	}
+
+	session = calloc(1, sizeof(*session));
+	if (!session) {
+		ERROR_MSG("allocation failed");
+		return NULL;
+	}
+
+	session->stream = stream;
+	session->nr_signals = nr_signals;
+	session->nr_slots = nr_slots;
+	session->func = func;
+	session->data = data;
+	session->signals = malloc(nr_signals * sizeof(*session->signals));
+	session->deltas = malloc(nr_signals * sizeof(*session->deltas));
+	session->slots = calloc(nr_slots, sizeof(*session->slots));
+	if (!session->signals || !session->deltas || !session->slots) {
+		ERROR_MSG("allocation failed");
+		goto fail;
+	}
+
+	memcpy(session->signals, signals, nr_signals * sizeof(*signals));
+
+	for (i = 0; i < nr_slots; i++) {
+		session->slots[i].bo = etna_bo_new(dev, POST_OFFSET(nr_signals) + 4,
+				DRM_ETNA_GEM_CACHE_CACHED);
+		if (!session->slots[i].bo)
+			goto fail;
+	}
+
+	priv->perfmon_session = session;
+
+	return session;
+
+fail:
+	etna_perfmon_session_del(session);
+	return NULL;
+}
+
+/* report the samples of the submits done so far: */
+drm_public void etna_perfmon_session_poll(struct etna_perfmon_session *session)
+{
+	etna_perfmon_session_reap(session, 0);
+}
+
+/* waits for the submits in flight and reports them, to be called before
+ * the stream is deleted:
+ */
+drm_public void etna_perfmon_session_del(struct etna_perfmon_session *session)
+{
+	struct etna_cmd_stream_priv *priv;
+	unsigned i;
+
+	if (!session)
+		return;
+
+	priv = (struct etna_cmd_stream_priv *)session->stream;
+	if (priv->perfmon_session == session) {
+		etna_perfmon_session_reap(session, 1);
+		priv->perfmon_session = NULL;
+	}
+
+	if (session->slots) {
+		for (i = 0; i < session->nr_slots; i++) {
+			if (session->slots[i].bo)
+				etna_bo_del(session->slots[i].bo);
+		}
+	}
+
+	free(session->slots);
+	free(session->deltas);
+	free(session->signals);
+	free(session);
+}
@@ -25,13 +25,32 @@
  */
 
 #include "etnaviv_priv.h"
+#include "util_sync_file.h"
 
 drm_public int etna_pipe_wait(struct etna_pipe *pipe, uint32_t timestamp, uint32_t ms)
 {
 	return etna_pipe_wait_ns(pipe, timestamp, ms * 1000000);
 }
 
-drm_public int etna_pipe_wait_ns(struct etna_pipe *pipe, uint32_t timestamp, uint64_t ns)
+static int fence_passed(struct etna_pipe *pipe, uint32_t timestamp)
+{
+	uint32_t completed = __atomic_load_n(&pipe->completed_fence, __ATOMIC_ACQUIRE);
+
+	return (int32_t)(timestamp - completed) <= 0;
+}
+
+/* fences complete in order, so this one covers the older ones too: */
+static void fence_completed(struct etna_pipe *pipe, uint32_t timestamp)
+{
+	uint32_t completed = __atomic_load_n(&pipe->completed_fence, __ATOMIC_ACQUIRE);
+
+	while ((int32_t)(timestamp - completed) > 0 &&
+			!__atomic_compare_exchange_n(&pipe->completed_fence, &completed,
+					timestamp, 1, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+		;
+}
+
+static int wait_fence(struct etna_pipe *pipe, uint32_t timestamp, uint64_t ns)
 {
 	struct etna_device *dev = pipe->gpu->dev;
 	int ret;
@@ -41,20 +60,33 @@ drm_public int etna_pipe_wait_ns(struct etna_pipe *pipe, uint32_t timestamp, uin
 		.fence = timestamp,
 	};
 
+	if (fence_passed(pipe, timestamp))
+		return 0;
+
 	if (ns == 0)
 		req.flags |= ETNA_WAIT_NONBLOCK;
 
 	get_abs_timeout(&req.timeout, ns);
 
 	ret = drmCommandWrite(dev->fd, DRM_ETNAVIV_WAIT_FENCE, &req, sizeof(req));
-	if (ret) {
-		ERROR_MSG("wait-fence failed! %d (%s)", ret, strerror(errno));
+	if (ret)
 		return ret;
-	}
+
+	fence_completed(pipe, timestamp);
 
 	return 0;
 }
 
+drm_public int etna_pipe_wait_ns(struct etna_pipe *pipe, uint32_t timestamp, uint64_t ns)
+{
+	int ret = wait_fence(pipe, timestamp, ns);
+
+	if (ret)
+		ERROR_MSG("wait-fence failed! %d (%s)", ret, strerror(errno));
+
+	return ret;
+}
+
 drm_public void etna_pipe_del(struct etna_pipe *pipe)
 {
 	free(pipe);
@@ -77,3 +109,118 @@ drm_public struct etna_pipe *etna_pipe_new(struct etna_gpu *gpu, enum etna_pipe_
 fail:
 	return NULL;
 }
+
+drm_public struct etna_fence *etna_fence_new(struct etna_pipe *pipe,
+		uint32_t timestamp, int fence_fd)
+{
+	struct etna_fence *fence;
+
+	fence = calloc(1, sizeof(*fence));
+	if (!fence) {
+		ERROR_MSG("allocation failed");
+		if (fence_fd >= 0)
+			close(fence_fd);
+		return NULL;
+	}
+
+	fence->pipe = pipe;
+	fence->timestamp = timestamp;
+	fence->fd = fence_fd;
+
+	return fence;
+}
+
+drm_public void etna_fence_del(struct etna_fence *fence)
+{
+	if (!fence)
+		return;
+
+	if (fence->fd >= 0)
+		close(fence->fd);
+	free(fence);
+}
+
+/* the sync file, -1 if none, still owned by the fence: */
+drm_public int etna_fence_get_fd(struct etna_fence *fence)
+{
+	return fence->fd;
+}
+
+static void fence_signaled(struct etna_fence *fence)
+{
+	fence->signaled = 1;
+	fence_completed(fence->pipe, fence->timestamp);
+}
+
+/* Check without waiting, from the fences the pipe has seen completed
+ * first, then from the sync file, or the kernel if there is none:
+ */
+drm_public int etna_fence_is_signaled(struct etna_fence *fence)
+{
+	if (fence->signaled)
+		return 1;
+
+	if (fence_passed(fence->pipe, fence->timestamp) ||
+			(fence->fd >= 0 ? util_sync_file_signaled(fence->fd) :
+			 !wait_fence(fence->pipe, fence->timestamp, 0)))
+		fence_signaled(fence);
+
+	return fence->signaled;
+}
+
+/* Wait for all or any of the fences, polling their sync files.  Fences
+ * without one are waited for with the kernel first, so these are better
+ * left out of waits for any.
+ *
+ * Returns 0, -ETIMEDOUT or another negative errno.
+ */
+drm_public int etna_fence_wait(struct etna_fence **fences, unsigned count,
+		int wait_all, uint64_t ns)
+{
+	uint64_t end = util_sync_file_now() + ns;
+	int *fds, *signaled;
+	unsigned i;
+	int ret = 0;
+
+	if (end < ns)
+		end = UINT64_MAX;
+
+	fds = malloc(2 * count * sizeof(int));
+	if (!fds)
+		return -ENOMEM;
+	signaled = &fds[count];
+
+	for (i = 0; i < count; i++) {
+		struct etna_fence *fence = fences[i];
+
+		fds[i] = fence->fd;
+		signaled[i] = etna_fence_is_signaled(fence);
+		if (!signaled[i] && fence->fd < 0) {
+			uint64_t now = util_sync_file_now();
+
+			ret = wait_fence(fence->pipe, fence->timestamp,
+					end > now ? end - now : 0);
+			if (ret)
+				goto out;
+			fence_signaled(fence);
+			signaled[i] = 1;
+		}
+	}
+
+	if (end == UINT64_MAX) {
+		ns = UINT64_MAX;
+	} else {
+		uint64_t now = util_sync_file_now();
+		ns = end > now ? end - now : 0;
+	}
+	ret = util_sync_file_wait(fds, signaled, count, wait_all, ns);
+
+	for (i = 0; i < count; i++) {
+		if (signaled[i] && !fences[i]->signaled)
+			fence_signaled(fences[i]);
+	}
+
+out:
+	free(fds);
+	return ret < 0 ? ret : 0;
+}
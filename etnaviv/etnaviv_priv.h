@@ -42,26 +42,23 @@
 #include "xf86drm.h"
 #include "xf86atomic.h"
 
+#include "util_bo_cache.h"
+#include "util_bo_labels.h"
 #include "util_double_list.h"
+#include "util_grow.h"
+#include "util_handle_table.h"
+#include "util_trace.h"
 
 #include "etnaviv_drmif.h"
 #include "etnaviv_drm.h"
 
-struct etna_bo_bucket {
-	uint32_t size;
-	struct list_head list;
-};
-
-struct etna_bo_cache {
-	struct etna_bo_bucket cache_bucket[14 * 4];
-	unsigned num_buckets;
-	time_t time;
-};
-
 struct etna_device {
 	int fd;
 	atomic_t refcnt;
 
+	/* protects the tables, the bo cache and labels, and the bo's names: */
+	pthread_mutex_t table_lock;
+
 	/* tables to keep track of bo's, to avoid "evil-twin" etna_bo objects:
 	 *
 	 *   handle_table: maps handle to etna_bo
@@ -71,21 +68,31 @@ struct etna_device {
 	 * returns a new handle.  So we need to figure out if the bo is already
 	 * open in the process first, before calling gem-open.
 	 */
-	void *handle_table, *name_table;
+	struct handle_table handle_table, name_table;
+
+	struct util_bo_cache bo_cache;
+	struct util_mem_pressure *pressure;
+
+	/* live bo's by debug label, under table_lock: */
+	struct util_bo_labels bo_labels;
 
-	struct etna_bo_cache bo_cache;
+	/* for handing out the cmd stream seqno's, see bo2idx(): */
+	uint32_t stream_cnt;
 
 	int closefd;        /* call close(fd) upon destruction */
 };
 
-drm_private void etna_bo_cache_init(struct etna_bo_cache *cache);
-drm_private void etna_bo_cache_cleanup(struct etna_bo_cache *cache, time_t time);
-drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache,
-		uint32_t *size, uint32_t flags);
-drm_private int etna_bo_cache_free(struct etna_bo_cache *cache, struct etna_bo *bo);
+drm_private void etna_bo_cache_init(struct util_bo_cache *cache);
+drm_private void etna_bo_cache_cleanup(struct util_bo_cache *cache, uint64_t now);
+drm_private void etna_bo_cache_trim(struct util_bo_cache *cache, unsigned level);
+drm_private void etna_bo_cache_unwatch_pressure(struct etna_device *dev);
+drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_device *dev,
+		struct util_bo_cache *cache, uint32_t *size, uint32_t flags);
+drm_private int etna_bo_cache_free(struct util_bo_cache *cache, struct etna_bo *bo);
 
 /* for where @table_lock is already held: */
-drm_private void etna_device_del_locked(struct etna_device *dev);
+drm_private void etna_device_dump_bo_usage_locked(struct etna_device *dev,
+		FILE *file);
 
 /* a GEM buffer object allocated from the DRM device */
 struct etna_bo {
@@ -103,14 +110,18 @@ struct etna_bo {
 	 * reloc table to find the idx of a bo that might already be in the
 	 * table, we cache the idx in the bo.  But in order to detect the
 	 * slow-path where bo is ref'd in multiple streams, we also must track
-	 * the current_stream for which the idx is valid.  See bo2idx().
+	 * the current_stream for which the idx is valid, as the stream seqno
+	 * in the upper 32 bits and the idx in the lower ones.  Streams on
+	 * other threads may overwrite it at any time, so it is only accessed
+	 * atomically, as a whole.  See bo2idx().
 	 */
-	struct etna_cmd_stream *current_stream;
-	uint32_t idx;
+	uint64_t current_stream_idx;
 
 	int reuse;
-	struct list_head list;   /* bucket-list entry */
-	time_t free_time;        /* time when added to bucket-list */
+	struct util_bo_cache_entry cache_entry;
+
+	/* index in dev->bo_labels, under table_lock: */
+	unsigned label;
 };
 
 struct etna_gpu {
@@ -118,11 +129,24 @@ struct etna_gpu {
 	uint32_t core;
 	uint32_t model;
 	uint32_t revision;
+
+	/* all the params are static, so queried once, by etna_param_id: */
+	uint64_t params[ETNA_GPU_NUM_VARYINGS + 1];
 };
 
 struct etna_pipe {
 	enum etna_pipe_id id;
 	struct etna_gpu *gpu;
+
+	/* last fence seen completed, to not wait on older ones: */
+	uint32_t completed_fence;
+};
+
+struct etna_fence {
+	struct etna_pipe *pipe;
+	uint32_t timestamp;
+	int fd;
+	int signaled;
 };
 
 struct etna_cmd_stream_priv {
@@ -131,6 +155,11 @@ struct etna_cmd_stream_priv {
 
 	uint32_t last_timestamp;
 
+	uint32_t seqno;
+
+	/* the buffer grows up to this many words before a flush is forced: */
+	uint32_t max_size;
+
 	/* submit ioctl related tables: */
 	struct {
 		/* bo's table: */
@@ -150,6 +179,14 @@ struct etna_cmd_stream_priv {
 	struct etna_bo **bos;
 	uint32_t nr_bos, max_bos;
 
+	/* open addressing hash of the idx + 1 by bo handle, 0 if free, kept
+	 * at most half full: */
+	uint32_t *bo_table;
+	uint32_t bo_table_size;
+
+	/* continuous sampling around each flush, if any: */
+	struct etna_perfmon_session *perfmon_session;
+
 	/* notify callback if buffer reset happened */
 	void (*reset_notify)(struct etna_cmd_stream *stream, void *priv);
 	void *reset_notify_priv;
@@ -176,6 +213,39 @@ struct etna_perfmon_signal
 	char name[64];
 };
 
+/* Sample bo of one submit, holding the sequence written by the kernel
+ * after the submit, and the pre and post values of each signal:
+ */
+struct etna_perfmon_slot
+{
+	struct etna_bo *bo;
+	uint32_t sequence;
+	uint32_t fence;
+	int failed;
+};
+
+struct etna_perfmon_session
+{
+	struct etna_cmd_stream *stream;
+	struct etna_perfmon_signal **signals;
+	unsigned nr_signals;
+
+	/* ring of sample bo's, the count in flight from tail on: */
+	struct etna_perfmon_slot *slots;
+	unsigned nr_slots, head, tail, count;
+	/* the slot sampled by the submit being flushed, if any: */
+	struct etna_perfmon_slot *current;
+	uint32_t sequence;
+
+	uint32_t *deltas;
+	etna_perfmon_sample_func func;
+	void *data;
+};
+
+drm_private void etna_perfmon_session_emit(struct etna_perfmon_session *session);
+drm_private void etna_perfmon_session_submitted(struct etna_perfmon_session *session,
+		int ret, uint32_t fence);
+
 #define ALIGN(v,a) (((v) + (a) - 1) & ~((a) - 1))
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
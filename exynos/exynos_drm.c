@@ -29,6 +29,7 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <sys/mman.h>
 #include <linux/stddef.h>
@@ -36,11 +37,124 @@
 #include <xf86drm.h>
 
 #include "libdrm_macros.h"
+#include "util_bo_cache.h"
+#include "util_handle_table.h"
 #include "exynos_drm.h"
 #include "exynos_drmif.h"
 
 #define U642VOID(x) ((void *)(unsigned long)(x))
 
+/*
+ * The private parts of the device and buffer objects, behind the public
+ * structures whose layout is part of the ABI.
+ *
+ * @lock: protects the tables, the cache and the buffer refcounts.
+ * @handles: buffers by gem handle, so that importing a buffer again
+ *	returns the same object.
+ * @names: buffers by gem global object name.
+ * @bo_cache: buffers freed, once enabled by exynos_device_set_bo_cache().
+ */
+struct exynos_device_priv {
+	struct exynos_device	base;
+	pthread_mutex_t		lock;
+	struct handle_table	handles;
+	struct handle_table	names;
+	int			bo_cache_enabled;
+	struct util_bo_cache	bo_cache;
+};
+
+/*
+ * @refcnt: references, under the device lock.
+ * @reuse: allocated here and never shared, so it may be cached.
+ */
+struct exynos_bo_priv {
+	struct exynos_bo		base;
+	unsigned int			refcnt;
+	int				reuse;
+	struct util_bo_cache_entry	cache_entry;
+};
+
+static inline struct exynos_device_priv *
+to_device_priv(struct exynos_device *dev)
+{
+	return (struct exynos_device_priv *)dev;
+}
+
+static inline struct exynos_bo_priv *to_bo_priv(struct exynos_bo *bo)
+{
+	return (struct exynos_bo_priv *)bo;
+}
+
+/*
+ * Free a exynos buffer object, called with the device lock held.
+ */
+static void exynos_bo_free_locked(struct exynos_bo *bo)
+{
+	struct exynos_device_priv *priv = to_device_priv(bo->dev);
+
+	if (bo->vaddr)
+		munmap(bo->vaddr, bo->size);
+
+	if (bo->name)
+		handle_table_remove(&priv->names, bo->name);
+
+	if (bo->handle) {
+		struct drm_gem_close req = {
+			.handle = bo->handle,
+		};
+
+		handle_table_remove(&priv->handles, bo->handle);
+		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	}
+
+	free(bo);
+}
+
+/*
+ * Free the cached buffers older than the cache allows, called with the
+ * device lock held.
+ */
+static void exynos_bo_cache_cleanup(struct exynos_device_priv *priv,
+				    uint64_t now)
+{
+	struct util_bo_cache_entry *entry;
+
+	while ((entry = util_bo_cache_evict(&priv->bo_cache, now)))
+		exynos_bo_free_locked(&LIST_ENTRY(struct exynos_bo_priv, entry,
+						  cache_entry)->base);
+}
+
+/*
+ * Create a exynos buffer object for a gem handle, called with the device
+ * lock held.  The handle is closed on failure.
+ */
+static struct exynos_bo *
+exynos_bo_from_handle(struct exynos_device *dev, uint32_t handle)
+{
+	struct exynos_device_priv *priv = to_device_priv(dev);
+	struct exynos_bo_priv *bo;
+
+	bo = calloc(sizeof(*bo), 1);
+	if (!bo || handle_table_insert(&priv->handles, handle, bo)) {
+		struct drm_gem_close req = {
+			.handle = handle,
+		};
+
+		fprintf(stderr, "failed to allocate bo[%s].\n",
+				strerror(ENOMEM));
+		drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+		free(bo);
+		return NULL;
+	}
+
+	bo->base.dev = dev;
+	bo->base.handle = handle;
+	bo->refcnt = 1;
+	util_bo_cache_entry_init(&bo->cache_entry);
+
+	return &bo->base;
+}
+
 /*
  * Create exynos drm device object.
  *
@@ -50,18 +164,20 @@
  */
 drm_public struct exynos_device * exynos_device_create(int fd)
 {
-	struct exynos_device *dev;
+	struct exynos_device_priv *priv;
 
-	dev = calloc(sizeof(*dev), 1);
-	if (!dev) {
+	priv = calloc(sizeof(*priv), 1);
+	if (!priv) {
 		fprintf(stderr, "failed to create device[%s].\n",
 				strerror(errno));
 		return NULL;
 	}
 
-	dev->fd = fd;
+	priv->base.fd = fd;
+	pthread_mutex_init(&priv->lock, NULL);
+	util_bo_cache_init(&priv->bo_cache, 0, 0, 0, 0);
 
-	return dev;
+	return &priv->base;
 }
 
 /*
@@ -71,7 +187,122 @@ drm_public struct exynos_device * exynos_device_create(int fd)
  */
 drm_public void exynos_device_destroy(struct exynos_device *dev)
 {
-	free(dev);
+	struct exynos_device_priv *priv = to_device_priv(dev);
+
+	if (!dev)
+		return;
+
+	pthread_mutex_lock(&priv->lock);
+	exynos_bo_cache_cleanup(priv, UTIL_BO_CACHE_PURGE);
+	pthread_mutex_unlock(&priv->lock);
+
+	handle_table_fini(&priv->handles);
+	handle_table_fini(&priv->names);
+	pthread_mutex_destroy(&priv->lock);
+	free(priv);
+}
+
+/*
+ * Set up the cache of buffers freed by exynos_bo_destroy().
+ *
+ * @dev: exynos drm device object.
+ * @bucket_shift: log2 of the buckets per power of two.
+ * @max_size: largest size cached, 0 to disable the cache as by default.
+ * @max_bytes: total size cached before the oldest buffers are freed, 0 for
+ *	no limit.
+ * @max_age_ms: time a buffer stays cached.
+ *
+ * only buffers created by exynos_bo_create() and never shared are cached,
+ * and reused for the same flags.  nothing tells whether a buffer is still
+ * in use by a device, so buffers must only be destroyed once idle.
+ * the cached buffers are freed.
+ */
+drm_public void
+exynos_device_set_bo_cache(struct exynos_device *dev, unsigned int bucket_shift,
+			   uint64_t max_size, uint64_t max_bytes,
+			   uint32_t max_age_ms)
+{
+	struct exynos_device_priv *priv = to_device_priv(dev);
+
+	pthread_mutex_lock(&priv->lock);
+	exynos_bo_cache_cleanup(priv, UTIL_BO_CACHE_PURGE);
+	util_bo_cache_init(&priv->bo_cache, bucket_shift, max_size, max_bytes,
+			   max_age_ms * 1000000ull);
+	priv->bo_cache_enabled = max_size != 0;
+	pthread_mutex_unlock(&priv->lock);
+}
+
+/*
+ * Get the statistics of the buffer cache.
+ *
+ * @dev: exynos drm device object.
+ * @hits: buffers created from the cache.
+ * @misses: buffers created while the cache had none fitting.
+ * @evictions: cached buffers freed for their age or the size limit.
+ */
+drm_public void
+exynos_device_get_bo_cache_stats(struct exynos_device *dev, uint64_t *hits,
+				 uint64_t *misses, uint64_t *evictions)
+{
+	struct exynos_device_priv *priv = to_device_priv(dev);
+
+	pthread_mutex_lock(&priv->lock);
+	*hits = priv->bo_cache.stats.hits;
+	*misses = priv->bo_cache.stats.misses;
+	*evictions = priv->bo_cache.stats.evictions;
+	pthread_mutex_unlock(&priv->lock);
+}
+
+/*
+ * Free the cached buffers past their age, and the oldest others until
+ * level percent of the cached memory is released, 100 empties the cache.
+ *
+ * @dev: exynos drm device object.
+ * @level: percent of the cached memory to release.
+ */
+drm_public void exynos_device_trim_bo_cache(struct exynos_device *dev,
+					    unsigned int level)
+{
+	struct exynos_device_priv *priv = to_device_priv(dev);
+	struct util_bo_cache_entry *entry;
+	uint64_t bytes, now;
+
+	pthread_mutex_lock(&priv->lock);
+	bytes = util_bo_cache_trim_bytes(&priv->bo_cache, level);
+	now = util_bo_cache_now();
+	while ((entry = util_bo_cache_evict_to(&priv->bo_cache, now, bytes)))
+		exynos_bo_free_locked(&LIST_ENTRY(struct exynos_bo_priv, entry,
+						  cache_entry)->base);
+	pthread_mutex_unlock(&priv->lock);
+}
+
+/*
+ * Take a cached buffer of the bucket of size with the same flags, called
+ * with the device lock held.  size is rounded up to the bucket size.
+ */
+static struct exynos_bo *
+exynos_bo_cache_alloc(struct exynos_device_priv *priv, size_t *size,
+		      uint32_t flags)
+{
+	struct util_bo_cache_bucket *bucket;
+	struct exynos_bo_priv *bo;
+
+	bucket = util_bo_cache_get_bucket(&priv->bo_cache, *size);
+	if (!bucket)
+		return NULL;
+
+	*size = bucket->size;
+
+	LIST_FOR_EACH_ENTRY(bo, &bucket->list, cache_entry.bucket_link) {
+		if (bo->base.flags == flags) {
+			util_bo_cache_take(&bo->cache_entry);
+			bo->refcnt = 1;
+			return &bo->base;
+		}
+	}
+
+	util_bo_cache_miss(&priv->bo_cache);
+	return NULL;
 }
 
 /*
@@ -90,42 +321,61 @@ drm_public void exynos_device_destroy(struct exynos_device *dev)
 drm_public struct exynos_bo * exynos_bo_create(struct exynos_device *dev,
                                                size_t size, uint32_t flags)
 {
-	struct exynos_bo *bo;
-	struct drm_exynos_gem_create req = {
-		.size = size,
-		.flags = flags,
-	};
+	struct exynos_device_priv *priv = to_device_priv(dev);
+	struct exynos_bo *bo = NULL;
+	struct drm_exynos_gem_create req;
 
 	if (size == 0) {
 		fprintf(stderr, "invalid size.\n");
-		goto fail;
+		return NULL;
 	}
 
-	bo = calloc(sizeof(*bo), 1);
-	if (!bo) {
-		fprintf(stderr, "failed to create bo[%s].\n",
-				strerror(errno));
-		goto err_free_bo;
-	}
+	pthread_mutex_lock(&priv->lock);
+	if (priv->bo_cache_enabled)
+		bo = exynos_bo_cache_alloc(priv, &size, flags);
+	pthread_mutex_unlock(&priv->lock);
 
-	bo->dev = dev;
+	if (bo)
+		return bo;
+
+	memset(&req, 0, sizeof(req));
+	req.size = size;
+	req.flags = flags;
 
 	if (drmIoctl(dev->fd, DRM_IOCTL_EXYNOS_GEM_CREATE, &req)){
 		fprintf(stderr, "failed to create gem object[%s].\n",
 				strerror(errno));
-		goto err_free_bo;
+		return NULL;
 	}
 
-	bo->handle = req.handle;
-	bo->size = size;
-	bo->flags = flags;
+	pthread_mutex_lock(&priv->lock);
+	bo = exynos_bo_from_handle(dev, req.handle);
+	if (bo) {
+		bo->size = size;
+		bo->flags = flags;
+		to_bo_priv(bo)->reuse = 1;
+	}
+	pthread_mutex_unlock(&priv->lock);
 
 	return bo;
+}
 
-err_free_bo:
-	free(bo);
-fail:
-	return NULL;
+/*
+ * Take a reference to a exynos buffer object.
+ *
+ * @bo: a exynos buffer object.
+ *
+ * each reference is dropped by exynos_bo_destroy().
+ */
+drm_public struct exynos_bo *exynos_bo_ref(struct exynos_bo *bo)
+{
+	struct exynos_device_priv *priv = to_device_priv(bo->dev);
+
+	pthread_mutex_lock(&priv->lock);
+	to_bo_priv(bo)->refcnt++;
+	pthread_mutex_unlock(&priv->lock);
+
+	return bo;
 }
 
 /*
@@ -166,24 +416,42 @@ drm_public int exynos_bo_get_info(struct exynos_device *dev, uint32_t handle,
  * Destroy a exynos buffer object.
  *
  * @bo: a exynos buffer object to be destroyed.
+ *
+ * this drops a reference, the buffer is freed, or cached, with the last.
  */
 drm_public void exynos_bo_destroy(struct exynos_bo *bo)
 {
+	struct exynos_device_priv *priv;
+	struct exynos_bo_priv *bo_priv = to_bo_priv(bo);
+	struct util_bo_cache_bucket *bucket;
+	uint64_t now;
+
 	if (!bo)
 		return;
 
-	if (bo->vaddr)
-		munmap(bo->vaddr, bo->size);
+	priv = to_device_priv(bo->dev);
 
-	if (bo->handle) {
-		struct drm_gem_close req = {
-			.handle = bo->handle,
-		};
+	pthread_mutex_lock(&priv->lock);
 
-		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	if (--bo_priv->refcnt)
+		goto out_unlock;
+
+	/* unless the buckets changed since the bo was allocated: */
+	if (priv->bo_cache_enabled && bo_priv->reuse) {
+		bucket = util_bo_cache_get_bucket(&priv->bo_cache, bo->size);
+		if (bucket && bucket->size == bo->size) {
+			now = util_bo_cache_now();
+			util_bo_cache_add(&priv->bo_cache, bucket,
+					  &bo_priv->cache_entry, now);
+			exynos_bo_cache_cleanup(priv, now);
+			goto out_unlock;
+		}
 	}
 
-	free(bo);
+	exynos_bo_free_locked(bo);
+
+out_unlock:
+	pthread_mutex_unlock(&priv->lock);
 }
 
 
@@ -195,6 +463,8 @@ drm_public void exynos_bo_destroy(struct exynos_bo *bo)
  *
  * this interface is used to get a exynos buffer object from a gem
  * global object name sent by another process for buffer sharing.
+ * a name imported before returns the same buffer object, with one more
+ * reference.
  *
  * if true, return a exynos buffer object else NULL.
  *
@@ -202,33 +472,88 @@ drm_public void exynos_bo_destroy(struct exynos_bo *bo)
 drm_public struct exynos_bo *
 exynos_bo_from_name(struct exynos_device *dev, uint32_t name)
 {
+	struct exynos_device_priv *priv = to_device_priv(dev);
 	struct exynos_bo *bo;
 	struct drm_gem_open req = {
 		.name = name,
 	};
 
-	bo = calloc(sizeof(*bo), 1);
-	if (!bo) {
-		fprintf(stderr, "failed to allocate bo[%s].\n",
-				strerror(errno));
-		return NULL;
+	pthread_mutex_lock(&priv->lock);
+
+	bo = handle_table_lookup(&priv->names, name);
+	if (bo) {
+		to_bo_priv(bo)->refcnt++;
+		goto out_unlock;
 	}
 
 	if (drmIoctl(dev->fd, DRM_IOCTL_GEM_OPEN, &req)) {
 		fprintf(stderr, "failed to open gem object[%s].\n",
 				strerror(errno));
-		goto err_free_bo;
+		goto out_unlock;
 	}
 
-	bo->dev = dev;
-	bo->name = name;
-	bo->handle = req.handle;
+	bo = handle_table_lookup(&priv->handles, req.handle);
+	if (bo) {
+		to_bo_priv(bo)->refcnt++;
+	} else {
+		bo = exynos_bo_from_handle(dev, req.handle);
+		if (!bo)
+			goto out_unlock;
+	}
+
+	to_bo_priv(bo)->reuse = 0;
+	if (!bo->name && !handle_table_insert(&priv->names, name, bo))
+		bo->name = name;
+
+out_unlock:
+	pthread_mutex_unlock(&priv->lock);
 
 	return bo;
+}
 
-err_free_bo:
-	free(bo);
-	return NULL;
+/*
+ * Get a exynos buffer object from a dmabuf file descriptor.
+ *
+ * @dev: a exynos device object.
+ * @fd: file descriptor of dmabuf to import, still owned by the caller.
+ *
+ * a dmabuf imported before returns the same buffer object, with one more
+ * reference.
+ *
+ * if true, return a exynos buffer object else NULL.
+ */
+drm_public struct exynos_bo *
+exynos_bo_from_fd(struct exynos_device *dev, int fd)
+{
+	struct exynos_device_priv *priv = to_device_priv(dev);
+	struct exynos_bo *bo = NULL;
+	uint32_t handle;
+	off_t size;
+
+	pthread_mutex_lock(&priv->lock);
+
+	if (drmPrimeFDToHandle(dev->fd, fd, &handle)) {
+		fprintf(stderr, "failed to import dmabuf[%s].\n",
+				strerror(errno));
+		goto out_unlock;
+	}
+
+	bo = handle_table_lookup(&priv->handles, handle);
+	if (bo) {
+		to_bo_priv(bo)->refcnt++;
+		goto out_unlock;
+	}
+
+	bo = exynos_bo_from_handle(dev, handle);
+	if (bo) {
+		size = lseek(fd, 0, SEEK_END);
+		bo->size = size > 0 ? (size_t)size : 0;
+	}
+
+out_unlock:
+	pthread_mutex_unlock(&priv->lock);
+
+	return bo;
 }
 
 /*
@@ -248,6 +573,7 @@ drm_public int exynos_bo_get_name(struct exynos_bo *bo, uint32_t *name)
 		struct drm_gem_flink req = {
 			.handle = bo->handle,
 		};
+		struct exynos_device_priv *priv = to_device_priv(bo->dev);
 		int ret;
 
 		ret = drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_FLINK, &req);
@@ -257,7 +583,15 @@ drm_public int exynos_bo_get_name(struct exynos_bo *bo, uint32_t *name)
 			return ret;
 		}
 
-		bo->name = req.name;
+		pthread_mutex_lock(&priv->lock);
+		to_bo_priv(bo)->reuse = 0;
+		if (!bo->name &&
+		    !handle_table_insert(&priv->names, req.name, bo))
+			bo->name = req.name;
+		pthread_mutex_unlock(&priv->lock);
+
+		if (!bo->name)
+			return -ENOMEM;
 	}
 
 	*name = bo->name;
@@ -318,6 +652,16 @@ drm_public void *exynos_bo_map(struct exynos_bo *bo)
 drm_public int
 exynos_prime_handle_to_fd(struct exynos_device *dev, uint32_t handle, int *fd)
 {
+	struct exynos_device_priv *priv = to_device_priv(dev);
+	struct exynos_bo *bo;
+
+	/* a shared buffer is not cached: */
+	pthread_mutex_lock(&priv->lock);
+	bo = handle_table_lookup(&priv->handles, handle);
+	if (bo)
+		to_bo_priv(bo)->reuse = 0;
+	pthread_mutex_unlock(&priv->lock);
+
 	return drmPrimeHandleToFD(dev->fd, handle, 0, fd);
 }
 
@@ -82,6 +82,13 @@ struct exynos_event_context {
  */
 struct exynos_device * exynos_device_create(int fd);
 void exynos_device_destroy(struct exynos_device *dev);
+void exynos_device_set_bo_cache(struct exynos_device *dev,
+		unsigned int bucket_shift, uint64_t max_size,
+		uint64_t max_bytes, uint32_t max_age_ms);
+void exynos_device_get_bo_cache_stats(struct exynos_device *dev,
+		uint64_t *hits, uint64_t *misses, uint64_t *evictions);
+void exynos_device_trim_bo_cache(struct exynos_device *dev,
+		unsigned int level);
 
 /*
  * buffer-object related functions:
@@ -90,8 +97,10 @@ struct exynos_bo * exynos_bo_create(struct exynos_device *dev,
 		size_t size, uint32_t flags);
 int exynos_bo_get_info(struct exynos_device *dev, uint32_t handle,
 			size_t *size, uint32_t *flags);
+struct exynos_bo * exynos_bo_ref(struct exynos_bo *bo);
 void exynos_bo_destroy(struct exynos_bo *bo);
 struct exynos_bo * exynos_bo_from_name(struct exynos_device *dev, uint32_t name);
+struct exynos_bo * exynos_bo_from_fd(struct exynos_device *dev, int fd);
 int exynos_bo_get_name(struct exynos_bo *bo, uint32_t *name);
 uint32_t exynos_bo_handle(struct exynos_bo *bo);
 void * exynos_bo_map(struct exynos_bo *bo);
@@ -29,6 +29,8 @@
 #include <errno.h>
 #include <assert.h>
 
+#include <poll.h>
+#include <unistd.h>
 #include <sys/mman.h>
 #include <linux/stddef.h>
 
@@ -36,6 +38,7 @@
 
 #include "libdrm_macros.h"
 #include "exynos_drm.h"
+#include "exynos_drmif.h"
 #include "fimg2d_reg.h"
 #include "exynos_fimg2d.h"
 
@@ -50,12 +53,27 @@
 			val.data.dst_coeff_dst_a = dcda;
 
 #define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define U642VOID(x)	((void *)(unsigned long)(x))
 
 #define MSG_PREFIX "exynos/fimg2d: "
 
 #define G2D_MAX_CMD_NR		64
 #define G2D_MAX_GEM_CMD_NR	64
 #define G2D_MAX_CMD_LIST_NR	64
+#define G2D_MAX_BATCH_NR	16
+
+/*
+ * A batch run by g2d_exec_async(), completed by the event of its last
+ * command list.  The event user_data points to the batch.
+ */
+struct g2d_batch {
+	uint32_t			token;
+	unsigned int			cmdlist_nr;
+	g2d_complete_func		func;
+	void				*data;
+	/* userdata of g2d_config_event() the token event replaced. */
+	void				*event_userdata;
+};
 
 struct g2d_context {
 	int				fd;
@@ -67,6 +85,22 @@ struct g2d_context {
 	unsigned int			cmd_buf_nr;
 	unsigned int			cmdlist_nr;
 	void				*event_userdata;
+	/*
+	 * The last flushed command list is held back in cmd/cmd_buf until
+	 * the next operation or exec, so that a batch run by g2d_exec_async()
+	 * flags only its last list with an event.
+	 */
+	int				held;
+	void				*held_userdata;
+	/* Batches in flight, in submission order. */
+	struct g2d_batch		batch[G2D_MAX_BATCH_NR];
+	unsigned int			batch_head;
+	unsigned int			batch_nr;
+	unsigned int			inflight_cmdlist_nr;
+	uint32_t			last_token;
+	uint32_t			completed_token;
+	/* Handlers of the other events read by g2d_handle_event(). */
+	struct exynos_event_context	*evctx;
 };
 
 enum g2d_base_addr_reg {
@@ -167,16 +201,23 @@ static unsigned int g2d_get_blend_op(enum e_g2d_op op)
 	return val.val;
 }
 
+static int g2d_submit(struct g2d_context *ctx, void *userdata);
+
 /*
  * g2d_check_space - check if command buffers have enough space left.
  *
  * @ctx: a pointer to g2d_context structure.
  * @num_cmds: number of (regular) commands.
  * @num_gem_cmds: number of GEM commands.
+ *
+ * The command list held back by g2d_flush() is submitted first.
  */
-static unsigned int g2d_check_space(const struct g2d_context *ctx,
+static unsigned int g2d_check_space(struct g2d_context *ctx,
 	unsigned int num_cmds, unsigned int num_gem_cmds)
 {
+	if (ctx->held && g2d_submit(ctx, ctx->held_userdata) < 0)
+		return 1;
+
 	if (ctx->cmd_nr + num_cmds >= G2D_MAX_CMD_NR ||
 	    ctx->cmd_buf_nr + num_gem_cmds >= G2D_MAX_GEM_CMD_NR)
 		return 1;
@@ -274,6 +315,11 @@ static void g2d_add_cmd(struct g2d_context *ctx, unsigned long cmd,
  * @ctx: a pointer to g2d_context structure.
  * @img: a pointer to the dst/src g2d_image structure.
  * @reg: the register that should be set.
+ *
+ * A userptr image is handed to the kernel as its address and size. The
+ * kernel keeps the user pages it pinned for a cmdlist per file, and reuses
+ * them for a later image of the same address and size, so blitting from
+ * the same buffer every frame only pays the pinning once.
  */
 static void g2d_add_base_addr(struct g2d_context *ctx, struct g2d_image *img,
 			enum g2d_base_addr_reg reg)
@@ -301,26 +347,63 @@ static void g2d_set_direction(struct g2d_context *ctx,
 	g2d_add_cmd(ctx, DST_PAT_DIRECT_REG, dir->val[1]);
 }
 
+static int g2d_run(struct g2d_context *ctx, int async);
+static int g2d_wait_event(struct g2d_context *ctx);
+
 /*
- * g2d_flush - submit all commands and values in user side command buffer
- *		to command queue aware of fimg2d dma.
+ * g2d_flush - end the command list of an operation in user side command
+ *		buffer.
  *
  * @ctx: a pointer to g2d_context structure.
  *
  * This function should be called after all commands and values to user
- * side command buffer are set. It submits that buffer to the kernel side driver.
+ * side command buffer are set.  The list is held back in the buffer, and
+ * submitted to the kernel side driver by g2d_submit() when the next
+ * operation starts or the lists are run.
  */
 static int g2d_flush(struct g2d_context *ctx)
 {
-	int ret;
-	struct drm_exynos_g2d_set_cmdlist cmdlist = {0};
-
 	if (ctx->cmd_nr == 0 && ctx->cmd_buf_nr == 0)
 		return 0;
 
-	if (ctx->cmdlist_nr >= G2D_MAX_CMD_LIST_NR) {
-		fprintf(stderr, MSG_PREFIX "command list overflow.\n");
-		return -EINVAL;
+	ctx->held = 1;
+	ctx->held_userdata = ctx->event_userdata;
+	ctx->event_userdata = NULL;
+
+	return 0;
+}
+
+/*
+ * g2d_submit - submit the command list held in user side command buffer
+ *		to command queue aware of fimg2d dma.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @userdata: the user data of a nonstop event for the list, or NULL.
+ *
+ * The kernel resets the registers at the start of each command list and
+ * runs one operation per list, so a list can be neither shared between
+ * operations nor rely on registers set by an earlier one.  When the queue
+ * of lists is full, the queued ones are run first, or when lists are in
+ * flight, their completion is waited for, and the batch goes on.
+ */
+static int g2d_submit(struct g2d_context *ctx, void *userdata)
+{
+	int ret;
+	struct drm_exynos_g2d_set_cmdlist cmdlist = {0};
+
+	while (ctx->cmdlist_nr + ctx->inflight_cmdlist_nr >=
+	       G2D_MAX_CMD_LIST_NR) {
+		if (ctx->inflight_cmdlist_nr)
+			ret = g2d_wait_event(ctx);
+		else
+			ret = g2d_run(ctx, 0);
+		if (ret < 0) {
+			fprintf(stderr, MSG_PREFIX "command list overflow.\n");
+			ctx->held = 0;
+			ctx->cmd_nr = 0;
+			ctx->cmd_buf_nr = 0;
+			return ret;
+		}
 	}
 
 	cmdlist.cmd = (uint64_t)(uintptr_t)&ctx->cmd[0];
@@ -328,15 +411,15 @@ static int g2d_flush(struct g2d_context *ctx)
 	cmdlist.cmd_nr = ctx->cmd_nr;
 	cmdlist.cmd_buf_nr = ctx->cmd_buf_nr;
 
-	if (ctx->event_userdata) {
+	if (userdata) {
 		cmdlist.event_type = G2D_EVENT_NONSTOP;
-		cmdlist.user_data = (uint64_t)(uintptr_t)(ctx->event_userdata);
-		ctx->event_userdata = NULL;
+		cmdlist.user_data = (uint64_t)(uintptr_t)userdata;
 	} else {
 		cmdlist.event_type = G2D_EVENT_NOT;
 		cmdlist.user_data = 0;
 	}
 
+	ctx->held = 0;
 	ctx->cmd_nr = 0;
 	ctx->cmd_buf_nr = 0;
 
@@ -386,6 +469,10 @@ drm_public struct g2d_context *g2d_init(int fd)
 
 drm_public void g2d_fini(struct g2d_context *ctx)
 {
+	/* The events of the batches in flight point into the context. */
+	while (ctx->batch_nr && g2d_wait_event(ctx) >= 0)
+		;
+
 	free(ctx);
 }
 
@@ -394,7 +481,8 @@ drm_public void g2d_fini(struct g2d_context *ctx)
  *		The next invocation of a g2d call (e.g. g2d_solid_fill) is
  *		then going to flag the command buffer as 'nonstop'.
  *		Completion of the command buffer execution can then be
- *		determined by using drmHandleEvent on the DRM fd.
+ *		determined by using exynos_handle_event on the DRM fd, or
+ *		g2d_handle_event when batches are run by g2d_exec_async.
  *		The userdata is 'consumed' in the process.
  *
  * @ctx: a pointer to g2d_context structure.
@@ -406,19 +494,97 @@ drm_public void g2d_config_event(struct g2d_context *ctx, void *userdata)
 }
 
 /**
- * g2d_exec - start the dma to process all commands summited by g2d_flush().
+ * g2d_exec - start the dma to process all commands summited by g2d_flush(),
+ *		and wait for them.
  *
  * @ctx: a pointer to g2d_context structure.
  */
 drm_public int g2d_exec(struct g2d_context *ctx)
 {
-	struct drm_exynos_g2d_exec exec;
 	int ret;
 
+	if (ctx->held) {
+		ret = g2d_submit(ctx, ctx->held_userdata);
+		if (ret < 0)
+			return ret;
+	}
+
 	if (ctx->cmdlist_nr == 0)
 		return -EINVAL;
 
-	exec.async = 0;
+	return g2d_run(ctx, 0);
+}
+
+/**
+ * g2d_exec_async - start the dma to process all commands summited by
+ *		g2d_flush(), without waiting for them.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @func: called by g2d_handle_event() when the batch completes, or NULL.
+ * @data: passed to func.
+ * @token: returns the completion token of the batch, for g2d_wait() and
+ *	g2d_token_done(), if not NULL.
+ *
+ * The last command list of the batch is flagged with a nonstop event,
+ * which replaces an event set by g2d_config_event() for the last
+ * operation: its userdata is then passed to the g2d_event_handler of the
+ * exynos_event_context given to g2d_handle_event().  Up to
+ * G2D_MAX_BATCH_NR batches are kept in flight, after which this waits
+ * for the oldest one.
+ */
+drm_public int g2d_exec_async(struct g2d_context *ctx, g2d_complete_func func,
+			void *data, uint32_t *token)
+{
+	struct g2d_batch *batch;
+	int ret;
+
+	if (!ctx->held)
+		return -EINVAL;
+
+	while (ctx->batch_nr == G2D_MAX_BATCH_NR) {
+		ret = g2d_wait_event(ctx);
+		if (ret < 0)
+			return ret;
+	}
+
+	/* Waiting in g2d_submit() retires batches, keeping this slot free. */
+	batch = &ctx->batch[(ctx->batch_head + ctx->batch_nr) %
+			    G2D_MAX_BATCH_NR];
+	batch->func = func;
+	batch->data = data;
+	batch->event_userdata = ctx->held_userdata;
+
+	ret = g2d_submit(ctx, batch);
+	if (ret < 0)
+		return ret;
+
+	batch->cmdlist_nr = ctx->cmdlist_nr;
+	ret = g2d_run(ctx, 1);
+	if (ret < 0)
+		return ret;
+
+	batch->token = ++ctx->last_token;
+	ctx->batch_nr++;
+	ctx->inflight_cmdlist_nr += batch->cmdlist_nr;
+
+	if (token)
+		*token = batch->token;
+
+	return 0;
+}
+
+/*
+ * g2d_run - run the queued command lists.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @async: whether to return without waiting for the lists.
+ */
+static int g2d_run(struct g2d_context *ctx, int async)
+{
+	struct drm_exynos_g2d_exec exec;
+	int ret;
+
+	exec.async = async;
 
 	ret = drmIoctl(ctx->fd, DRM_IOCTL_EXYNOS_G2D_EXEC, &exec);
 	if (ret < 0) {
@@ -431,6 +597,179 @@ drm_public int g2d_exec(struct g2d_context *ctx)
 	return ret;
 }
 
+/*
+ * g2d_complete - retire the batches in flight up to the one of an event,
+ *		the kernel running the command lists in order.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @e: the event of the last command list of the batch.
+ */
+static void g2d_complete(struct g2d_context *ctx,
+			const struct drm_exynos_g2d_event *e)
+{
+	struct exynos_event_context *evctx = ctx->evctx;
+	struct g2d_batch *last = U642VOID(e->user_data);
+	struct g2d_batch batch;
+	int done = 0;
+
+	while (ctx->batch_nr && !done) {
+		done = &ctx->batch[ctx->batch_head] == last;
+		batch = ctx->batch[ctx->batch_head];
+		ctx->batch_head = (ctx->batch_head + 1) % G2D_MAX_BATCH_NR;
+		ctx->batch_nr--;
+		ctx->inflight_cmdlist_nr -= batch.cmdlist_nr;
+		ctx->completed_token = batch.token;
+
+		/* The callbacks may run new batches. */
+		if (batch.event_userdata && evctx && evctx->version >= 1 &&
+		    evctx->g2d_event_handler)
+			evctx->g2d_event_handler(ctx->fd, e->cmdlist_no,
+						 e->tv_sec, e->tv_usec,
+						 batch.event_userdata);
+		if (batch.func)
+			batch.func(ctx, batch.token, batch.data);
+	}
+}
+
+/*
+ * g2d_dispatch_event - pass an event read from the DRM fd to its handler.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @e: the event.
+ */
+static void g2d_dispatch_event(struct g2d_context *ctx, struct drm_event *e)
+{
+	struct exynos_event_context *evctx = ctx->evctx;
+	struct drm_exynos_g2d_event *g2d;
+	struct drm_event_vblank *vblank;
+	uintptr_t batch;
+
+	switch (e->type) {
+	case DRM_EXYNOS_G2D_EVENT:
+		g2d = (struct drm_exynos_g2d_event *)e;
+		batch = (uintptr_t)g2d->user_data;
+		if (batch >= (uintptr_t)&ctx->batch[0] &&
+		    batch < (uintptr_t)&ctx->batch[G2D_MAX_BATCH_NR]) {
+			g2d_complete(ctx, g2d);
+			break;
+		}
+		if (!evctx || evctx->version < 1 ||
+		    evctx->g2d_event_handler == NULL)
+			break;
+		evctx->g2d_event_handler(ctx->fd, g2d->cmdlist_no,
+					 g2d->tv_sec, g2d->tv_usec,
+					 U642VOID(g2d->user_data));
+		break;
+	case DRM_EVENT_VBLANK:
+		if (!evctx || evctx->base.version < 1 ||
+		    evctx->base.vblank_handler == NULL)
+			break;
+		vblank = (struct drm_event_vblank *)e;
+		evctx->base.vblank_handler(ctx->fd, vblank->sequence,
+					   vblank->tv_sec, vblank->tv_usec,
+					   U642VOID(vblank->user_data));
+		break;
+	case DRM_EVENT_FLIP_COMPLETE:
+		if (!evctx || evctx->base.version < 2 ||
+		    evctx->base.page_flip_handler == NULL)
+			break;
+		vblank = (struct drm_event_vblank *)e;
+		evctx->base.page_flip_handler(ctx->fd, vblank->sequence,
+					      vblank->tv_sec, vblank->tv_usec,
+					      U642VOID(vblank->user_data));
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * g2d_handle_event - read the events of the DRM fd, completing the
+ *		batches run by g2d_exec_async().
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @evctx: the handlers of the other events, or NULL to keep the ones
+ *	last given.  They are also used when g2d calls wait for events.
+ *
+ * To be called in place of exynos_handle_event() when the fd is readable.
+ */
+drm_public int g2d_handle_event(struct g2d_context *ctx,
+			struct exynos_event_context *evctx)
+{
+	char buffer[1024];
+	struct drm_event *e;
+	int len, i;
+
+	if (evctx)
+		ctx->evctx = evctx;
+
+	/* The DRM read semantics guarantees that we always get only
+	 * complete events. */
+	len = read(ctx->fd, buffer, sizeof buffer);
+	if (len == 0)
+		return 0;
+	if (len < (int)sizeof *e)
+		return -1;
+
+	for (i = 0; i < len; i += e->length) {
+		e = (struct drm_event *)(buffer + i);
+		g2d_dispatch_event(ctx, e);
+	}
+
+	return 0;
+}
+
+/*
+ * g2d_wait_event - wait for the DRM fd to be readable and handle its
+ *		events.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ */
+static int g2d_wait_event(struct g2d_context *ctx)
+{
+	struct pollfd pfd = { .fd = ctx->fd, .events = POLLIN };
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, -1);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+
+	return g2d_handle_event(ctx, NULL);
+}
+
+/**
+ * g2d_token_done - check whether a batch run by g2d_exec_async() has
+ *		completed, as of the events handled so far.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @token: the completion token of the batch.
+ */
+drm_public int g2d_token_done(struct g2d_context *ctx, uint32_t token)
+{
+	return (int32_t)(ctx->completed_token - token) >= 0;
+}
+
+/**
+ * g2d_wait - wait for a batch run by g2d_exec_async() to complete.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @token: the completion token of the batch.
+ */
+drm_public int g2d_wait(struct g2d_context *ctx, uint32_t token)
+{
+	int ret;
+
+	while (!g2d_token_done(ctx, token)) {
+		ret = g2d_wait_event(ctx);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
 /**
  * g2d_solid_fill - fill given buffer with given color data.
  *
@@ -656,6 +995,265 @@ g2d_move(struct g2d_context *ctx, struct g2d_image *img,
 	return g2d_flush(ctx);
 }
 
+static int g2d_cmp_rect_rows(const void *a, const void *b)
+{
+	const struct g2d_rect *r = a, *s = b;
+
+	if (r->y != s->y)
+		return r->y < s->y ? -1 : 1;
+	if (r->h != s->h)
+		return r->h < s->h ? -1 : 1;
+	return r->x < s->x ? -1 : r->x > s->x;
+}
+
+static int g2d_cmp_rect_columns(const void *a, const void *b)
+{
+	const struct g2d_rect *r = a, *s = b;
+
+	if (r->x != s->x)
+		return r->x < s->x ? -1 : 1;
+	if (r->w != s->w)
+		return r->w < s->w ? -1 : 1;
+	return r->y < s->y ? -1 : r->y > s->y;
+}
+
+static int g2d_cmp_rect_top_left(const void *a, const void *b)
+{
+	const struct g2d_rect *r = a, *s = b;
+
+	if (r->y != s->y)
+		return r->y < s->y ? -1 : 1;
+	return r->x < s->x ? -1 : r->x > s->x;
+}
+
+static void g2d_reverse_rects(struct g2d_rect *rects, unsigned int num_rects)
+{
+	struct g2d_rect tmp;
+	unsigned int i;
+
+	for (i = 0; i < num_rects / 2; i++) {
+		tmp = rects[i];
+		rects[i] = rects[num_rects - 1 - i];
+		rects[num_rects - 1 - i] = tmp;
+	}
+}
+
+/*
+ * g2d_order_move - order the rects of a move so that the ones whose
+ *		source it has not written yet come first: from the bottom
+ *		when moving down, and from the right when moving right.
+ */
+static void g2d_order_move(struct g2d_rect *rects, unsigned int num_rects,
+			int dx, int dy)
+{
+	unsigned int i, j;
+
+	qsort(rects, num_rects, sizeof(*rects), g2d_cmp_rect_top_left);
+	if (dy > 0)
+		g2d_reverse_rects(rects, num_rects);
+	if ((dx > 0) == (dy > 0))
+		return;
+
+	/* Flip the order inside the rows back. */
+	for (i = 0; i < num_rects; i = j) {
+		for (j = i + 1; j < num_rects && rects[j].y == rects[i].y; j++)
+			;
+		g2d_reverse_rects(&rects[i], j - i);
+	}
+}
+
+/*
+ * g2d_merge_rects - sort rects and merge the ones sharing an edge.
+ *
+ * @rects: the rects, merged in place.
+ * @num_rects: the number of rects.
+ *
+ * Returns the number of rects left.
+ */
+static unsigned int g2d_merge_rects(struct g2d_rect *rects,
+			unsigned int num_rects)
+{
+	unsigned int i, n;
+
+	if (num_rects < 2)
+		return num_rects;
+
+	/* Rects of the same rows side by side. */
+	qsort(rects, num_rects, sizeof(*rects), g2d_cmp_rect_rows);
+	for (i = 1, n = 0; i < num_rects; i++) {
+		if (rects[i].y == rects[n].y && rects[i].h == rects[n].h &&
+		    rects[i].x == rects[n].x + rects[n].w)
+			rects[n].w += rects[i].w;
+		else
+			rects[++n] = rects[i];
+	}
+	num_rects = n + 1;
+
+	/* Then rects of the same columns on top of each other. */
+	qsort(rects, num_rects, sizeof(*rects), g2d_cmp_rect_columns);
+	for (i = 1, n = 0; i < num_rects; i++) {
+		if (rects[i].x == rects[n].x && rects[i].w == rects[n].w &&
+		    rects[i].y == rects[n].y + rects[n].h)
+			rects[n].h += rects[i].h;
+		else
+			rects[++n] = rects[i];
+	}
+
+	return n + 1;
+}
+
+/*
+ * g2d_clip_rect - clip a rect to the source and destination images.
+ *
+ * Returns zero when nothing is left to copy.
+ */
+static int g2d_clip_rect(struct g2d_rect *r, const struct g2d_image *src,
+			const struct g2d_image *dst, int dx, int dy)
+{
+	int64_t x0 = r->x, y0 = r->y;
+	int64_t x1 = x0 + r->w, y1 = y0 + r->h;
+
+	if (x0 < -(int64_t)dx)
+		x0 = -(int64_t)dx;
+	if (y0 < -(int64_t)dy)
+		y0 = -(int64_t)dy;
+	if (x1 > src->width)
+		x1 = src->width;
+	if (y1 > src->height)
+		y1 = src->height;
+	if (x1 + dx > dst->width)
+		x1 = (int64_t)dst->width - dx;
+	if (y1 + dy > dst->height)
+		y1 = (int64_t)dst->height - dy;
+
+	if (x1 <= x0 || y1 <= y0)
+		return 0;
+
+	r->x = x0;
+	r->y = y0;
+	r->w = x1 - x0;
+	r->h = y1 - y0;
+	return 1;
+}
+
+/**
+ * g2d_copy_rects - copy a set of rectangles from source buffer to
+ *	destination buffer, at a common offset.
+ *	Meant for damage regions: the rects are sorted and the ones
+ *	sharing an edge merged, so fewer operations are run.  When source
+ *	and destination are the same buffer, the rects are ordered and the
+ *	direction set like g2d_move() does, so that the rects, which must
+ *	not overlap each other, may overlap their destinations.
+ *
+ * @ctx: a pointer to g2d_context structure.
+ * @src: a pointer to g2d_image structure including image and buffer
+ *	information to source.
+ * @dst: a pointer to g2d_image structure including image and buffer
+ *	information to destination.
+ * @rects: the source rects, which are clipped, merged and reordered
+ *	in place.
+ * @num_rects: the number of rects.
+ * @dx: x offset of the destination of the rects.
+ * @dy: y offset of the destination of the rects.
+ *
+ * The kernel runs one operation per command list, so every rect still
+ * gets a full list: the commands common to all are set up once, and
+ * copied from the first list into the next ones.
+ */
+drm_public int
+g2d_copy_rects(struct g2d_context *ctx, struct g2d_image *src,
+		struct g2d_image *dst, struct g2d_rect *rects,
+		unsigned int num_rects, int dx, int dy)
+{
+	struct drm_exynos_g2d_cmd cmd[16], cmd_buf[2];
+	unsigned int cmd_nr = 0, cmd_buf_nr = 0;
+	union g2d_rop4_val rop4;
+	union g2d_point_val pt;
+	union g2d_direction_val dir;
+	unsigned int i, n;
+	int move, ret;
+
+	move = src == dst || (src->buf_type == dst->buf_type &&
+			      (src->buf_type == G2D_IMGBUF_USERPTR ?
+			       src->user_ptr[0].userptr ==
+			       dst->user_ptr[0].userptr :
+			       src->bo[0] == dst->bo[0]));
+
+	for (i = 0, n = 0; i < num_rects; i++) {
+		if (g2d_clip_rect(&rects[i], src, dst, dx, dy))
+			rects[n++] = rects[i];
+	}
+	num_rects = g2d_merge_rects(rects, n);
+
+	if (move)
+		g2d_order_move(rects, num_rects, dx, dy);
+
+	for (i = 0; i < num_rects; i++) {
+		if (g2d_check_space(ctx, 14, 2))
+			return -ENOSPC;
+
+		if (i == 0) {
+			g2d_add_cmd(ctx, DST_SELECT_REG,
+					G2D_SELECT_MODE_BGCOLOR);
+			g2d_add_cmd(ctx, DST_COLOR_MODE_REG, dst->color_mode);
+			g2d_add_base_addr(ctx, dst, g2d_dst);
+			g2d_add_cmd(ctx, DST_STRIDE_REG, dst->stride);
+
+			g2d_add_cmd(ctx, SRC_SELECT_REG, G2D_SELECT_MODE_NORMAL);
+			g2d_add_cmd(ctx, SRC_COLOR_MODE_REG, src->color_mode);
+			g2d_add_base_addr(ctx, src, g2d_src);
+			g2d_add_cmd(ctx, SRC_STRIDE_REG, src->stride);
+
+			if (move) {
+				dir.val[0] = dir.val[1] = 0;
+				if (dx >= 0)
+					dir.data.src_x_direction =
+						dir.data.dst_x_direction = 1;
+				if (dy >= 0)
+					dir.data.src_y_direction =
+						dir.data.dst_y_direction = 1;
+				g2d_set_direction(ctx, &dir);
+			}
+
+			rop4.val = 0;
+			rop4.data.unmasked_rop3 = G2D_ROP3_SRC;
+			g2d_add_cmd(ctx, ROP4_REG, rop4.val);
+
+			cmd_nr = ctx->cmd_nr;
+			cmd_buf_nr = ctx->cmd_buf_nr;
+			memcpy(cmd, ctx->cmd, cmd_nr * sizeof(cmd[0]));
+			memcpy(cmd_buf, ctx->cmd_buf,
+			       cmd_buf_nr * sizeof(cmd_buf[0]));
+		} else {
+			memcpy(ctx->cmd, cmd, cmd_nr * sizeof(cmd[0]));
+			memcpy(ctx->cmd_buf, cmd_buf,
+			       cmd_buf_nr * sizeof(cmd_buf[0]));
+			ctx->cmd_nr = cmd_nr;
+			ctx->cmd_buf_nr = cmd_buf_nr;
+		}
+
+		pt.data.x = rects[i].x;
+		pt.data.y = rects[i].y;
+		g2d_add_cmd(ctx, SRC_LEFT_TOP_REG, pt.val);
+		pt.data.x = rects[i].x + rects[i].w;
+		pt.data.y = rects[i].y + rects[i].h;
+		g2d_add_cmd(ctx, SRC_RIGHT_BOTTOM_REG, pt.val);
+
+		pt.data.x = rects[i].x + dx;
+		pt.data.y = rects[i].y + dy;
+		g2d_add_cmd(ctx, DST_LEFT_TOP_REG, pt.val);
+		pt.data.x = rects[i].x + rects[i].w + dx;
+		pt.data.y = rects[i].y + rects[i].h + dy;
+		g2d_add_cmd(ctx, DST_RIGHT_BOTTOM_REG, pt.val);
+
+		ret = g2d_flush(ctx);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
 /**
  * g2d_copy_with_scale - copy contents in source buffer to destination buffer
  *	scaling up or down properly.
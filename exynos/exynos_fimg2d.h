@@ -26,6 +26,8 @@
 #ifndef _FIMG2D_H_
 #define _FIMG2D_H_
 
+#include <stdint.h>
+
 #define G2D_PLANE_MAX_NR	2
 
 enum e_g2d_color_mode {
@@ -299,12 +301,29 @@ struct g2d_image {
 	void				*mapped_ptr[G2D_PLANE_MAX_NR];
 };
 
+struct g2d_rect {
+	unsigned int			x;
+	unsigned int			y;
+	unsigned int			w;
+	unsigned int			h;
+};
+
 struct g2d_context;
+struct exynos_event_context;
+
+typedef void (*g2d_complete_func)(struct g2d_context *ctx, uint32_t token,
+				  void *data);
 
 struct g2d_context *g2d_init(int fd);
 void g2d_fini(struct g2d_context *ctx);
 void g2d_config_event(struct g2d_context *ctx, void *userdata);
 int g2d_exec(struct g2d_context *ctx);
+int g2d_exec_async(struct g2d_context *ctx, g2d_complete_func func,
+			void *data, uint32_t *token);
+int g2d_handle_event(struct g2d_context *ctx,
+			struct exynos_event_context *evctx);
+int g2d_token_done(struct g2d_context *ctx, uint32_t token);
+int g2d_wait(struct g2d_context *ctx, uint32_t token);
 int g2d_solid_fill(struct g2d_context *ctx, struct g2d_image *img,
 			unsigned int x, unsigned int y, unsigned int w,
 			unsigned int h);
@@ -315,6 +334,9 @@ int g2d_copy(struct g2d_context *ctx, struct g2d_image *src,
 int g2d_move(struct g2d_context *ctx, struct g2d_image *img,
 		unsigned int src_x, unsigned int src_y, unsigned int dst_x,
 		unsigned dst_y, unsigned int w, unsigned int h);
+int g2d_copy_rects(struct g2d_context *ctx, struct g2d_image *src,
+		struct g2d_image *dst, struct g2d_rect *rects,
+		unsigned int num_rects, int dx, int dy);
 int g2d_copy_with_scale(struct g2d_context *ctx, struct g2d_image *src,
 				struct g2d_image *dst, unsigned int src_x,
 				unsigned int src_y, unsigned int src_w,
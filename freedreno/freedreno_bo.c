@@ -29,7 +29,6 @@
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
 
-drm_private pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
 drm_private void bo_del(struct fd_bo *bo);
 
 /* set buffer name, and add to table, call w/ table_lock held: */
@@ -37,19 +36,25 @@ static void set_name(struct fd_bo *bo, uint32_t name)
 {
 	bo->name = name;
 	/* add ourself into the handle table: */
-	drmHashInsert(bo->dev->name_table, name, bo);
+	if (handle_table_insert(&bo->dev->name_table, name, bo))
+		ERROR_MSG("out of memory for name %u", name);
 }
 
 /* lookup a buffer, call w/ table_lock held: */
-static struct fd_bo * lookup_bo(void *tbl, uint32_t key)
+static struct fd_bo * lookup_bo(struct handle_table *tbl, uint32_t key)
 {
-	struct fd_bo *bo = NULL;
-	if (!drmHashLookup(tbl, key, (void **)&bo)) {
+	struct fd_bo *bo = handle_table_lookup(tbl, key);
+	if (bo) {
 		/* found, incr refcnt and return: */
 		bo = fd_bo_ref(bo);
 
 		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
+		if (bo->cache_entry.cache) {
+			util_bo_cache_remove(&bo->cache_entry);
+			bo->label = 0;
+			util_bo_labels_alloc(&bo->dev->bo_labels, 0, 0,
+					bo->size);
+		}
 	}
 	return bo;
 }
@@ -65,40 +70,54 @@ static struct fd_bo * bo_from_handle(struct fd_device *dev,
 		struct drm_gem_close req = {
 				.handle = handle,
 		};
+		drmPrimeCacheHandleClosed(dev->fd, handle);
 		drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
 		return NULL;
 	}
-	bo->dev = fd_device_ref(dev);
+	bo->dev = dev;
 	bo->size = size;
 	bo->handle = handle;
 	atomic_set(&bo->refcnt, 1);
-	list_inithead(&bo->list);
+	util_bo_cache_entry_init(&bo->cache_entry);
 	/* add ourself into the handle table: */
-	drmHashInsert(dev->handle_table, handle, bo);
+	if (handle_table_insert(&dev->handle_table, handle, bo)) {
+		bo_del(bo);
+		return NULL;
+	}
+	/* the caller holds a ref too, so this one never is the first: */
+	fd_device_ref(dev);
+	util_bo_labels_alloc(&dev->bo_labels, 0, 0, size);
 	return bo;
 }
 
 static struct fd_bo *
 bo_new(struct fd_device *dev, uint32_t size, uint32_t flags,
-		struct fd_bo_cache *cache)
+		struct util_bo_cache *cache)
 {
 	struct fd_bo *bo = NULL;
 	uint32_t handle;
 	int ret;
 
-	bo = fd_bo_cache_alloc(cache, &size, flags);
-	if (bo)
+	bo = fd_bo_cache_alloc(dev, cache, &size, flags);
+	if (bo) {
+		UTIL_TRACE_EVENT("bo_cache_hit", "freedreno handle=%u size=%u",
+				bo->handle, bo->size);
 		return bo;
+	}
+
+	flags &= ~DRM_FREEDRENO_GEM_BUSY_OK;
 
 	ret = dev->funcs->bo_new_handle(dev, size, flags, &handle);
 	if (ret)
 		return NULL;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 	bo = bo_from_handle(dev, size, handle);
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	VG_BO_ALLOC(bo);
+	UTIL_TRACE_EVENT("bo_create", "freedreno handle=%u size=%u", handle,
+			size);
 
 	return bo;
 }
@@ -131,18 +150,20 @@ fd_bo_from_handle(struct fd_device *dev, uint32_t handle, uint32_t size)
 {
 	struct fd_bo *bo = NULL;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 
-	bo = lookup_bo(dev->handle_table, handle);
+	bo = lookup_bo(&dev->handle_table, handle);
 	if (bo)
 		goto out_unlock;
 
 	bo = bo_from_handle(dev, size, handle);
 
 	VG_BO_ALLOC(bo);
+	UTIL_TRACE_EVENT("bo_import", "freedreno handle=%u size=%u", handle,
+			size);
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -154,14 +175,14 @@ fd_bo_from_dmabuf(struct fd_device *dev, int fd)
 	uint32_t handle;
 	struct fd_bo *bo;
 
-	pthread_mutex_lock(&table_lock);
-	ret = drmPrimeFDToHandle(dev->fd, fd, &handle);
+	pthread_mutex_lock(&dev->table_lock);
+	ret = drmPrimeFDToHandleCached(dev->fd, fd, &handle);
 	if (ret) {
-		pthread_mutex_unlock(&table_lock);
+		pthread_mutex_unlock(&dev->table_lock);
 		return NULL;
 	}
 
-	bo = lookup_bo(dev->handle_table, handle);
+	bo = lookup_bo(&dev->handle_table, handle);
 	if (bo)
 		goto out_unlock;
 
@@ -172,9 +193,11 @@ fd_bo_from_dmabuf(struct fd_device *dev, int fd)
 	bo = bo_from_handle(dev, size, handle);
 
 	VG_BO_ALLOC(bo);
+	UTIL_TRACE_EVENT("bo_import", "freedreno handle=%u size=%u", handle,
+			size);
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -186,10 +209,10 @@ drm_public struct fd_bo * fd_bo_from_name(struct fd_device *dev, uint32_t name)
 	};
 	struct fd_bo *bo;
 
-	pthread_mutex_lock(&table_lock);
+	pthread_mutex_lock(&dev->table_lock);
 
 	/* check name table first, to see if bo is already open: */
-	bo = lookup_bo(dev->name_table, name);
+	bo = lookup_bo(&dev->name_table, name);
 	if (bo)
 		goto out_unlock;
 
@@ -198,7 +221,7 @@ drm_public struct fd_bo * fd_bo_from_name(struct fd_device *dev, uint32_t name)
 		goto out_unlock;
 	}
 
-	bo = lookup_bo(dev->handle_table, req.handle);
+	bo = lookup_bo(&dev->handle_table, req.handle);
 	if (bo)
 		goto out_unlock;
 
@@ -206,10 +229,12 @@ drm_public struct fd_bo * fd_bo_from_name(struct fd_device *dev, uint32_t name)
 	if (bo) {
 		set_name(bo, name);
 		VG_BO_ALLOC(bo);
+		UTIL_TRACE_EVENT("bo_import", "freedreno handle=%u size=%u",
+				req.handle, bo->size);
 	}
 
 out_unlock:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
@@ -237,7 +262,12 @@ drm_public void fd_bo_del(struct fd_bo *bo)
 	if (!atomic_dec_and_test(&bo->refcnt))
 		return;
 
-	pthread_mutex_lock(&table_lock);
+	UTIL_TRACE_EVENT("bo_free", "freedreno handle=%u size=%u", bo->handle,
+			bo->size);
+
+	pthread_mutex_lock(&dev->table_lock);
+
+	util_bo_labels_remove(&dev->bo_labels, bo->label, 0, bo->size);
 
 	if ((bo->bo_reuse == BO_CACHE) && (fd_bo_cache_free(&dev->bo_cache, bo) == 0))
 		goto out;
@@ -245,9 +275,11 @@ drm_public void fd_bo_del(struct fd_bo *bo)
 		goto out;
 
 	bo_del(bo);
-	fd_device_del_locked(dev);
 out:
-	pthread_mutex_unlock(&table_lock);
+	pthread_mutex_unlock(&dev->table_lock);
+
+	/* bo's in the bucket cache don't hold a ref to the dev either: */
+	fd_device_del(dev);
 }
 
 /* Called under table_lock */
@@ -266,15 +298,62 @@ drm_private void bo_del(struct fd_bo *bo)
 		struct drm_gem_close req = {
 				.handle = bo->handle,
 		};
-		drmHashDelete(bo->dev->handle_table, bo->handle);
+		handle_table_remove(&bo->dev->handle_table, bo->handle);
 		if (bo->name)
-			drmHashDelete(bo->dev->name_table, bo->name);
+			handle_table_remove(&bo->dev->name_table, bo->name);
+		drmPrimeCacheHandleClosed(bo->dev->fd, bo->handle);
 		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
 	}
 
 	bo->funcs->destroy(bo);
 }
 
+drm_public void fd_bo_set_label(struct fd_bo *bo, const char *label)
+{
+	struct fd_device *dev = bo->dev;
+	unsigned index;
+
+	pthread_mutex_lock(&dev->table_lock);
+	index = util_bo_labels_find(&dev->bo_labels, label);
+	util_bo_labels_move(&dev->bo_labels, bo->label, index, 0, bo->size);
+	bo->label = index;
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+drm_public int
+fd_device_get_bo_label_stats(struct fd_device *dev, unsigned index,
+		struct fd_bo_label_stats *stats)
+{
+	struct util_bo_label *label;
+
+	pthread_mutex_lock(&dev->table_lock);
+	if (index >= dev->bo_labels.num_labels) {
+		pthread_mutex_unlock(&dev->table_lock);
+		return -1;
+	}
+	label = &dev->bo_labels.labels[index];
+	memcpy(stats->name, label->name, sizeof(stats->name));
+	stats->buffers = label->buffers[0];
+	stats->bytes = label->bytes[0];
+	stats->peak_bytes = label->peak_bytes;
+	stats->allocs = label->allocs;
+	stats->alloc_bytes = label->alloc_bytes;
+	stats->alloc_rate = util_bo_labels_rate(&dev->bo_labels, index);
+	pthread_mutex_unlock(&dev->table_lock);
+	return 0;
+}
+
+/* Called under table_lock */
+drm_private void fd_device_dump_bo_usage_locked(struct fd_device *dev,
+		FILE *file)
+{
+	static const char *const heaps[] = { "bytes" };
+
+	util_bo_labels_dump(&dev->bo_labels, heaps,
+			dev->bo_cache.stats.bytes + dev->ring_cache.stats.bytes,
+			"freedreno", file);
+}
+
 drm_public int fd_bo_get_name(struct fd_bo *bo, uint32_t *name)
 {
 	if (!bo->name) {
@@ -288,9 +367,9 @@ drm_public int fd_bo_get_name(struct fd_bo *bo, uint32_t *name)
 			return ret;
 		}
 
-		pthread_mutex_lock(&table_lock);
+		pthread_mutex_lock(&bo->dev->table_lock);
 		set_name(bo, req.name);
-		pthread_mutex_unlock(&table_lock);
+		pthread_mutex_unlock(&bo->dev->table_lock);
 		bo->bo_reuse = NO_CACHE;
 	}
 
@@ -28,31 +28,17 @@
 
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
+#include "util_mem_pressure.h"
 
 drm_private void bo_del(struct fd_bo *bo);
-drm_private extern pthread_mutex_t table_lock;
-
-static void
-add_bucket(struct fd_bo_cache *cache, int size)
-{
-	unsigned int i = cache->num_buckets;
-
-	assert(i < ARRAY_SIZE(cache->cache_bucket));
-
-	list_inithead(&cache->cache_bucket[i].list);
-	cache->cache_bucket[i].size = size;
-	cache->num_buckets++;
-}
 
 /**
  * @coarse: if true, only power-of-two bucket sizes, otherwise
  *    fill in for a bit smoother size curve..
  */
 drm_private void
-fd_bo_cache_init(struct fd_bo_cache *cache, int coarse)
+fd_bo_cache_init(struct util_bo_cache *cache, int coarse)
 {
-	unsigned long size, cache_max_size = 64 * 1024 * 1024;
-
 	/* OK, so power of two buckets was too wasteful of memory.
 	 * Give 3 other sizes between each power of two, to hopefully
 	 * cover things accurately enough.  (The alternative is
@@ -61,128 +47,130 @@ fd_bo_cache_init(struct fd_bo_cache *cache, int coarse)
 	 * width/height alignment and rounding of sizes to pages will
 	 * get us useful cache hit rates anyway)
 	 */
-	add_bucket(cache, 4096);
-	add_bucket(cache, 4096 * 2);
-	if (!coarse)
-		add_bucket(cache, 4096 * 3);
-
-	/* Initialize the linked lists for BO reuse cache. */
-	for (size = 4 * 4096; size <= cache_max_size; size *= 2) {
-		add_bucket(cache, size);
-		if (!coarse) {
-			add_bucket(cache, size + size * 1 / 4);
-			add_bucket(cache, size + size * 2 / 4);
-			add_bucket(cache, size + size * 3 / 4);
-		}
-	}
+	util_bo_cache_init(cache, coarse ? 0 : 2,
+			UTIL_BO_CACHE_DEFAULT_MAX_SIZE, 0,
+			UTIL_BO_CACHE_DEFAULT_MAX_AGE);
 }
 
 /* Frees older cached buffers.  Called under table_lock */
 drm_private void
-fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time)
+fd_bo_cache_cleanup(struct util_bo_cache *cache, uint64_t now)
 {
-	int i;
-
-	if (cache->time == time)
-		return;
-
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
-		struct fd_bo *bo;
-
-		while (!LIST_IS_EMPTY(&bucket->list)) {
-			bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
+	struct util_bo_cache_entry *entry;
 
-			/* keep things in cache for at least 1 second: */
-			if (time && ((time - bo->free_time) <= 1))
-				break;
+	while ((entry = util_bo_cache_evict(cache, now))) {
+		struct fd_bo *bo = LIST_ENTRY(struct fd_bo, entry, cache_entry);
 
-			VG_BO_OBTAIN(bo);
-			list_del(&bo->list);
-			bo_del(bo);
-		}
+		VG_BO_OBTAIN(bo);
+		bo_del(bo);
 	}
-
-	cache->time = time;
 }
 
-static struct fd_bo_bucket * get_bucket(struct fd_bo_cache *cache, uint32_t size)
+/* Frees older cached buffers and the oldest others until level percent of
+ * the cached memory is released.  Called under table_lock */
+drm_private void
+fd_bo_cache_trim(struct util_bo_cache *cache, unsigned level)
 {
-	int i;
+	uint64_t bytes = util_bo_cache_trim_bytes(cache, level);
+	uint64_t now = util_bo_cache_now();
+	struct util_bo_cache_entry *entry;
 
-	/* hmm, this is what intel does, but I suppose we could calculate our
-	 * way to the correct bucket size rather than looping..
-	 */
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
-	}
+	while ((entry = util_bo_cache_evict_to(cache, now, bytes))) {
+		struct fd_bo *bo = LIST_ENTRY(struct fd_bo, entry, cache_entry);
 
-	return NULL;
+		VG_BO_OBTAIN(bo);
+		bo_del(bo);
+	}
 }
 
 static int is_idle(struct fd_bo *bo)
 {
-	return fd_bo_cpu_prep(bo, NULL,
+	uint64_t last = bo->last_fence;
+
+	if (fd_bo_fence_retired(bo))
+		return TRUE;
+
+	if (fd_bo_cpu_prep(bo, NULL,
 			DRM_FREEDRENO_PREP_READ |
 			DRM_FREEDRENO_PREP_WRITE |
-			DRM_FREEDRENO_PREP_NOSYNC) == 0;
+			DRM_FREEDRENO_PREP_NOSYNC) != 0)
+		return FALSE;
+
+	/* the submit the bo was last used in has retired, and so have the
+	 * earlier ones on its timeline:
+	 */
+	if (last != FD_BO_FENCE_UNKNOWN)
+		fd_timeline_retire(bo->dev, (last >> 32) - 1, last);
+	bo->last_fence = 0;
+
+	return TRUE;
 }
 
-static struct fd_bo *find_in_bucket(struct fd_bo_bucket *bucket, uint32_t flags)
+static struct fd_bo *find_in_bucket(struct fd_device *dev,
+		struct util_bo_cache *cache, struct util_bo_cache_bucket *bucket,
+		uint32_t flags)
 {
+	enum util_bo_cache_miss reason = UTIL_BO_CACHE_MISS_EMPTY;
 	struct fd_bo *bo = NULL;
 
-	/* TODO .. if we had an ALLOC_FOR_RENDER flag like intel, we could
-	 * skip the busy check.. if it is only going to be a render target
-	 * then we probably don't need to stall..
-	 *
-	 * NOTE that intel takes ALLOC_FOR_RENDER bo's from the list tail
-	 * (MRU, since likely to be in GPU cache), rather than head (LRU)..
+	/* Like intel's ALLOC_FOR_RENDER, BUSY_OK bo's skip the busy check
+	 * and come from the list tail (MRU, since likely to be in GPU cache),
+	 * rather than head (LRU)..
 	 */
-	pthread_mutex_lock(&table_lock);
-	if (!LIST_IS_EMPTY(&bucket->list)) {
-		bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
+	pthread_mutex_lock(&dev->table_lock);
+	if (!LIST_IS_EMPTY(&bucket->list) && (flags & DRM_FREEDRENO_GEM_BUSY_OK)) {
+		bo = LIST_ENTRY(struct fd_bo, bucket->list.prev,
+				cache_entry.bucket_link);
+		util_bo_cache_take(&bo->cache_entry);
+	} else if (!LIST_IS_EMPTY(&bucket->list)) {
+		bo = LIST_ENTRY(struct fd_bo, bucket->list.next,
+				cache_entry.bucket_link);
 		/* TODO check for compatible flags? */
 		if (is_idle(bo)) {
-			list_del(&bo->list);
+			util_bo_cache_take(&bo->cache_entry);
 		} else {
 			bo = NULL;
+			reason = UTIL_BO_CACHE_MISS_BUSY;
 		}
 	}
-	pthread_mutex_unlock(&table_lock);
+	if (bo) {
+		bo->label = 0;
+		util_bo_labels_alloc(&bo->dev->bo_labels, 0, 0, bo->size);
+	} else {
+		util_bo_cache_bucket_miss(cache, bucket, reason);
+	}
+	pthread_mutex_unlock(&dev->table_lock);
 
 	return bo;
 }
 
 /* NOTE: size is potentially rounded up to bucket size: */
 drm_private struct fd_bo *
-fd_bo_cache_alloc(struct fd_bo_cache *cache, uint32_t *size, uint32_t flags)
+fd_bo_cache_alloc(struct fd_device *dev, struct util_bo_cache *cache,
+		uint32_t *size, uint32_t flags)
 {
 	struct fd_bo *bo = NULL;
-	struct fd_bo_bucket *bucket;
+	struct util_bo_cache_bucket *bucket;
 
 	*size = ALIGN(*size, 4096);
-	bucket = get_bucket(cache, *size);
+	bucket = util_bo_cache_get_bucket(cache, *size);
 
 	/* see if we can be green and recycle: */
 retry:
 	if (bucket) {
 		*size = bucket->size;
-		bo = find_in_bucket(bucket, flags);
+		bo = find_in_bucket(dev, cache, bucket, flags);
 		if (bo) {
 			VG_BO_OBTAIN(bo);
 			if (bo->funcs->madvise(bo, TRUE) <= 0) {
 				/* we've lost the backing pages, delete and try again: */
-				pthread_mutex_lock(&table_lock);
+				pthread_mutex_lock(&dev->table_lock);
 				bo_del(bo);
-				pthread_mutex_unlock(&table_lock);
+				pthread_mutex_unlock(&dev->table_lock);
 				goto retry;
 			}
 			atomic_set(&bo->refcnt, 1);
-			fd_device_ref(bo->dev);
+			fd_device_ref(dev);
 			return bo;
 		}
 	}
@@ -191,30 +179,125 @@ retry:
 }
 
 drm_private int
-fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo)
+fd_bo_cache_free(struct util_bo_cache *cache, struct fd_bo *bo)
 {
-	struct fd_bo_bucket *bucket = get_bucket(cache, bo->size);
+	struct util_bo_cache_bucket *bucket =
+		util_bo_cache_get_bucket(cache, bo->size);
 
-	/* see if we can be green and recycle: */
-	if (bucket) {
-		struct timespec time;
+	/* see if we can be green and recycle, unless the buckets changed
+	 * since the bo was allocated: */
+	if (bucket && bucket->size == bo->size) {
+		uint64_t now = util_bo_cache_now();
 
 		bo->funcs->madvise(bo, FALSE);
 
-		clock_gettime(CLOCK_MONOTONIC, &time);
-
-		bo->free_time = time.tv_sec;
+		util_bo_cache_add(cache, bucket, &bo->cache_entry, now);
 		VG_BO_RELEASE(bo);
-		list_addtail(&bo->list, &bucket->list);
-		fd_bo_cache_cleanup(cache, time.tv_sec);
-
-		/* bo's in the bucket cache don't have a ref and
-		 * don't hold a ref to the dev:
-		 */
-		fd_device_del_locked(bo->dev);
+		fd_bo_cache_cleanup(cache, now);
 
 		return 0;
 	}
 
 	return -1;
 }
+
+/* Changing the buckets needs an empty cache, so the cached buffers are
+ * dropped, as are the statistics. */
+drm_public void
+fd_device_set_bo_cache(struct fd_device *dev, unsigned bucket_shift,
+		uint64_t max_size, uint64_t max_bytes, uint32_t max_age_ms)
+{
+	pthread_mutex_lock(&dev->table_lock);
+	fd_bo_cache_cleanup(&dev->bo_cache, UTIL_BO_CACHE_PURGE);
+	util_bo_cache_init(&dev->bo_cache, bucket_shift, max_size, max_bytes,
+			max_age_ms * 1000000ull);
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+drm_public void
+fd_device_get_bo_cache_stats(struct fd_device *dev, uint64_t *hits,
+		uint64_t *misses, uint64_t *evictions)
+{
+	pthread_mutex_lock(&dev->table_lock);
+	*hits = dev->bo_cache.stats.hits;
+	*misses = dev->bo_cache.stats.misses;
+	*evictions = dev->bo_cache.stats.evictions;
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+drm_public int
+fd_device_get_bo_cache_bucket_stats(struct fd_device *dev, unsigned index,
+		struct fd_bo_cache_bucket_stats *stats)
+{
+	struct util_bo_cache_bucket *bucket;
+
+	pthread_mutex_lock(&dev->table_lock);
+	if (index >= dev->bo_cache.num_buckets) {
+		pthread_mutex_unlock(&dev->table_lock);
+		return -1;
+	}
+	bucket = &dev->bo_cache.buckets[index];
+	stats->size = bucket->size;
+	stats->allocs = bucket->stats.allocs;
+	stats->hits = bucket->stats.hits;
+	stats->busy_misses = bucket->stats.busy_misses;
+	stats->flags_misses = bucket->stats.flags_misses;
+	stats->expired = bucket->stats.expired;
+	stats->dropped = bucket->stats.dropped;
+	stats->buffers = bucket->stats.buffers;
+	stats->bytes = bucket->stats.bytes;
+	pthread_mutex_unlock(&dev->table_lock);
+	return 0;
+}
+
+drm_public void
+fd_device_trim_bo_cache(struct fd_device *dev, unsigned level)
+{
+	pthread_mutex_lock(&dev->table_lock);
+	fd_bo_cache_trim(&dev->bo_cache, level);
+	fd_bo_cache_trim(&dev->ring_cache, level);
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+static void
+fd_bo_cache_pressure(struct util_mem_pressure *pressure, unsigned level)
+{
+	struct fd_device *dev = pressure->data;
+
+	/* the watcher is stopped without table_lock held: */
+	pthread_mutex_lock(&dev->table_lock);
+	fd_bo_cache_trim(&dev->bo_cache, level);
+	fd_bo_cache_trim(&dev->ring_cache, level);
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+drm_public int
+fd_device_watch_memory_pressure(struct fd_device *dev, int enable)
+{
+	struct util_mem_pressure *pressure = NULL;
+	int ret = 0;
+
+	pthread_mutex_lock(&dev->table_lock);
+	if (enable && !dev->pressure) {
+		dev->pressure = util_mem_pressure_start(fd_bo_cache_pressure, dev);
+		if (!dev->pressure)
+			ret = -errno;
+	} else if (!enable) {
+		pressure = dev->pressure;
+		dev->pressure = NULL;
+	}
+	pthread_mutex_unlock(&dev->table_lock);
+
+	if (pressure)
+		util_mem_pressure_stop(pressure);
+
+	return ret;
+}
+
+/* Called when the device goes away */
+drm_private void
+fd_bo_cache_unwatch_pressure(struct fd_device *dev)
+{
+	if (dev->pressure)
+		util_mem_pressure_stop(dev->pressure);
+}
@@ -33,8 +33,6 @@
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
 
-static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
-
 struct fd_device * kgsl_device_new(int fd);
 struct fd_device * msm_device_new(int fd);
 
@@ -78,11 +76,11 @@ out:
 		return NULL;
 
 	atomic_set(&dev->refcnt, 1);
+	pthread_mutex_init(&dev->table_lock, NULL);
 	dev->fd = fd;
-	dev->handle_table = drmHashCreate();
-	dev->name_table = drmHashCreate();
 	fd_bo_cache_init(&dev->bo_cache, FALSE);
 	fd_bo_cache_init(&dev->ring_cache, TRUE);
+	util_bo_labels_init(&dev->bo_labels, 1);
 
 	return dev;
 }
@@ -107,31 +105,38 @@ drm_public struct fd_device * fd_device_ref(struct fd_device *dev)
 	return dev;
 }
 
-static void fd_device_del_impl(struct fd_device *dev)
+/* The last ref may be the one of a bo, so it is dropped after releasing
+ * table_lock, which goes away with the device.
+ */
+drm_public void fd_device_del(struct fd_device *dev)
 {
 	int close_fd = dev->closefd ? dev->fd : -1;
-	fd_bo_cache_cleanup(&dev->bo_cache, 0);
-	drmHashDestroy(dev->handle_table);
-	drmHashDestroy(dev->name_table);
-	dev->funcs->destroy(dev);
-	if (close_fd >= 0)
-		close(close_fd);
-}
 
-drm_private void fd_device_del_locked(struct fd_device *dev)
-{
 	if (!atomic_dec_and_test(&dev->refcnt))
 		return;
-	fd_device_del_impl(dev);
-}
 
-drm_public void fd_device_del(struct fd_device *dev)
-{
-	if (!atomic_dec_and_test(&dev->refcnt))
-		return;
-	pthread_mutex_lock(&table_lock);
-	fd_device_del_impl(dev);
-	pthread_mutex_unlock(&table_lock);
+	fd_bo_cache_unwatch_pressure(dev);
+
+	pthread_mutex_lock(&dev->table_lock);
+	if (util_bo_cache_dump_enabled()) {
+		util_bo_cache_dump(&dev->bo_cache, "freedreno");
+		util_bo_cache_dump(&dev->ring_cache, "freedreno ring");
+	}
+	if (util_bo_labels_dump_enabled())
+		fd_device_dump_bo_usage_locked(dev, stderr);
+	fd_bo_cache_cleanup(&dev->bo_cache, UTIL_BO_CACHE_PURGE);
+	fd_bo_cache_cleanup(&dev->ring_cache, UTIL_BO_CACHE_PURGE);
+	handle_table_fini(&dev->handle_table);
+	handle_table_fini(&dev->name_table);
+	pthread_mutex_unlock(&dev->table_lock);
+	pthread_mutex_destroy(&dev->table_lock);
+
+	dev->funcs->destroy(dev);
+	if (close_fd >= 0) {
+		/* The fd number may be reused for another device. */
+		drmInvalidateMetadataCache(close_fd);
+		close(close_fd);
+	}
 }
 
 drm_public int fd_device_fd(struct fd_device *dev)
@@ -143,3 +148,10 @@ drm_public enum fd_version fd_device_version(struct fd_device *dev)
 {
 	return dev->version;
 }
+
+drm_public void fd_device_dump_bo_usage(struct fd_device *dev, FILE *file)
+{
+	pthread_mutex_lock(&dev->table_lock);
+	fd_device_dump_bo_usage_locked(dev, file);
+	pthread_mutex_unlock(&dev->table_lock);
+}
@@ -31,6 +31,7 @@
 
 #include <xf86drm.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #if defined(__GNUC__)
 #  define drm_deprecated __attribute__((__deprecated__))
@@ -75,6 +76,10 @@ enum fd_param_id {
 #define DRM_FREEDRENO_GEM_CACHE_WBACKWA   0x00800000
 #define DRM_FREEDRENO_GEM_CACHE_MASK      0x00f00000
 #define DRM_FREEDRENO_GEM_GPUREADONLY     0x01000000
+/* the bo will only be accessed by the gpu, after the submits it is used
+ * in, so a recycled bo that is still busy will do (not passed to kernel):
+ */
+#define DRM_FREEDRENO_GEM_BUSY_OK         0x80000000
 
 /* bo access flags: (keep aligned to MSM_PREP_x) */
 #define DRM_FREEDRENO_PREP_READ           0x01
@@ -99,6 +104,70 @@ enum fd_version {
 };
 enum fd_version fd_device_version(struct fd_device *dev);
 
+/* Buffers freed to the bo cache are kept in 1 << bucket_shift buckets per
+ * power of two up to max_size, and stay there for max_age_ms, or until the
+ * cache holds more than max_bytes (0 for no limit).  The cached buffers are
+ * dropped.
+ */
+void fd_device_set_bo_cache(struct fd_device *dev, unsigned bucket_shift,
+		uint64_t max_size, uint64_t max_bytes, uint32_t max_age_ms);
+void fd_device_get_bo_cache_stats(struct fd_device *dev, uint64_t *hits,
+		uint64_t *misses, uint64_t *evictions);
+struct fd_bo_cache_bucket_stats {
+	/* Buffer size of the bucket. */
+	uint64_t size;
+	/* Allocations of that size, and those served from the cache. */
+	uint64_t allocs;
+	uint64_t hits;
+	/* Misses because the cached buffers were busy, or had other flags. */
+	uint64_t busy_misses;
+	uint64_t flags_misses;
+	/* Buffers evicted for their age, and for the memory cap, a trim or
+	 * the cache being dropped. */
+	uint64_t expired;
+	uint64_t dropped;
+	/* Currently cached. */
+	uint64_t buffers;
+	uint64_t bytes;
+};
+/* Statistics of the bucket index of the bo cache, counting from 0 for the
+ * smallest size.  Returns -1 past the last bucket.  Setting
+ * LIBDRM_BO_CACHE_STATS in the environment prints them when the device is
+ * destroyed.
+ */
+int fd_device_get_bo_cache_bucket_stats(struct fd_device *dev, unsigned index,
+		struct fd_bo_cache_bucket_stats *stats);
+/* Frees the cached buffers past their age, and the oldest others until
+ * level percent of the cached memory is released, 100 empties the cache.
+ */
+void fd_device_trim_bo_cache(struct fd_device *dev, unsigned level);
+struct fd_bo_label_stats {
+	char name[32];
+	/* Live buffers of the label, those in the bo cache not counted. */
+	uint64_t buffers;
+	uint64_t bytes;
+	uint64_t peak_bytes;
+	/* Allocations since the device was created, and the bytes allocated
+	 * per second lately. */
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+	uint64_t alloc_rate;
+};
+/* Statistics of the label index of the device, 0 being the buffers never
+ * labeled with fd_bo_set_label().  Returns -1 past the last label.  Setting
+ * LIBDRM_BO_LABEL_STATS in the environment prints them when the device is
+ * destroyed.
+ */
+int fd_device_get_bo_label_stats(struct fd_device *dev, unsigned index,
+		struct fd_bo_label_stats *stats);
+/* Prints the live bytes of each label and the idle bytes cached. */
+void fd_device_dump_bo_usage(struct fd_device *dev, FILE *file);
+/* Trims the cache from a thread when the kernel reports memory pressure,
+ * through PSI or the cgroup memory events.  Returns -ENOTSUP if it has
+ * neither.
+ */
+int fd_device_watch_memory_pressure(struct fd_device *dev, int enable);
+
 /* pipe functions:
  */
 
@@ -113,6 +182,20 @@ int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp);
 int fd_pipe_wait_timeout(struct fd_pipe *pipe, uint32_t timestamp,
 		uint64_t timeout);
 
+/* fence objects, of a flush, or of a timestamp and sync file fd (which
+ * the fence takes over) for waiting from an event loop:
+ */
+struct fd_fence;
+
+struct fd_fence * fd_fence_new(struct fd_pipe *pipe, uint32_t timestamp,
+		int fence_fd);
+void fd_fence_del(struct fd_fence *fence);
+int fd_fence_get_fd(struct fd_fence *fence);
+int fd_fence_is_signaled(struct fd_fence *fence);
+/* timeout in nanosec */
+int fd_fence_wait(struct fd_fence **fences, unsigned count, int wait_all,
+		uint64_t timeout);
+
 
 /* buffer-object functions:
  */
@@ -132,6 +215,9 @@ void fd_bo_del(struct fd_bo *bo);
 int fd_bo_get_name(struct fd_bo *bo, uint32_t *name);
 uint32_t fd_bo_handle(struct fd_bo *bo);
 int fd_bo_dmabuf(struct fd_bo *bo);
+/* Accounts the bo to a debug label, up to 31 characters, until it is freed
+ * or reused from the bo cache. */
+void fd_bo_set_label(struct fd_bo *bo, const char *label);
 uint32_t fd_bo_size(struct fd_bo *bo);
 void * fd_bo_map(struct fd_bo *bo);
 int fd_bo_cpu_prep(struct fd_bo *bo, struct fd_pipe *pipe, uint32_t op);
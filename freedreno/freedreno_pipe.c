@@ -28,6 +28,7 @@
 
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
+#include "util_sync_file.h"
 
 /**
  * priority of zero is highest priority, and higher numeric values are
@@ -59,6 +60,11 @@ fd_pipe_new2(struct fd_device *dev, enum fd_pipe_id id, uint32_t prio)
 	pipe->id = id;
 	atomic_set(&pipe->refcnt, 1);
 
+	pipe->timeline = __atomic_fetch_add(&dev->nr_timelines, 1,
+			__ATOMIC_RELAXED);
+	if (pipe->timeline >= FD_MAX_TIMELINES)
+		pipe->timeline = -1;
+
 	fd_pipe_get_param(pipe, FD_GPU_ID, &val);
 	pipe->gpu_id = val;
 
@@ -98,5 +104,139 @@ drm_public int fd_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp)
 drm_public int fd_pipe_wait_timeout(struct fd_pipe *pipe, uint32_t timestamp,
 		uint64_t timeout)
 {
+	if (pipe->timeline >= 0 &&
+			fd_timeline_retired(pipe->dev, pipe->timeline, timestamp))
+		return 0;
+
 	return pipe->funcs->wait(pipe, timestamp, timeout);
 }
+
+drm_public struct fd_fence *
+fd_fence_new(struct fd_pipe *pipe, uint32_t timestamp, int fence_fd)
+{
+	struct fd_fence *fence;
+
+	fence = calloc(1, sizeof(*fence));
+	if (!fence) {
+		ERROR_MSG("allocation failed");
+		if (fence_fd >= 0)
+			close(fence_fd);
+		return NULL;
+	}
+
+	fence->pipe = fd_pipe_ref(pipe);
+	fence->timestamp = timestamp;
+	fence->fd = fence_fd;
+
+	return fence;
+}
+
+drm_public void fd_fence_del(struct fd_fence *fence)
+{
+	if (!fence)
+		return;
+
+	if (fence->fd >= 0)
+		close(fence->fd);
+	fd_pipe_del(fence->pipe);
+	free(fence);
+}
+
+/* the sync file, -1 if none, still owned by the fence: */
+drm_public int fd_fence_get_fd(struct fd_fence *fence)
+{
+	return fence->fd;
+}
+
+static void fence_signaled(struct fd_fence *fence)
+{
+	struct fd_pipe *pipe = fence->pipe;
+
+	fence->signaled = TRUE;
+	if (pipe->timeline >= 0)
+		fd_timeline_retire(pipe->dev, pipe->timeline, fence->timestamp);
+}
+
+static int fence_passed(struct fd_fence *fence)
+{
+	struct fd_pipe *pipe = fence->pipe;
+
+	if (pipe->timeline >= 0 &&
+			fd_timeline_retired(pipe->dev, pipe->timeline, fence->timestamp))
+		return TRUE;
+
+	if (fence->fd >= 0)
+		return util_sync_file_signaled(fence->fd);
+
+	if (pipe->funcs->fence_retired)
+		return pipe->funcs->fence_retired(pipe, fence->timestamp);
+
+	return !pipe->funcs->wait(pipe, fence->timestamp, 0);
+}
+
+/* Check without waiting, from the fences the pipe has seen retired
+ * first, then from the sync file, or the kernel if there is none:
+ */
+drm_public int fd_fence_is_signaled(struct fd_fence *fence)
+{
+	if (!fence->signaled && fence_passed(fence))
+		fence_signaled(fence);
+
+	return fence->signaled;
+}
+
+/* Wait for all or any of the fences, polling their sync files.  Fences
+ * without one are waited for with the kernel first, so these are better
+ * left out of waits for any.
+ *
+ * Returns 0, -ETIMEDOUT or another negative errno.
+ */
+drm_public int fd_fence_wait(struct fd_fence **fences, unsigned count,
+		int wait_all, uint64_t timeout)
+{
+	uint64_t now, end = util_sync_file_now() + timeout;
+	int *fds, *signaled;
+	unsigned i;
+	int ret = 0;
+
+	if (end < timeout)
+		end = UINT64_MAX;
+
+	fds = malloc(2 * count * sizeof(int));
+	if (!fds)
+		return -ENOMEM;
+	signaled = &fds[count];
+
+	for (i = 0; i < count; i++) {
+		struct fd_fence *fence = fences[i];
+
+		fds[i] = fence->fd;
+		signaled[i] = fd_fence_is_signaled(fence);
+		if (!signaled[i] && fence->fd < 0) {
+			now = util_sync_file_now();
+			ret = fd_pipe_wait_timeout(fence->pipe, fence->timestamp,
+					end > now ? end - now : 0);
+			if (ret)
+				goto out;
+			fence_signaled(fence);
+			signaled[i] = TRUE;
+		}
+	}
+
+	if (end == UINT64_MAX) {
+		timeout = UINT64_MAX;
+	} else {
+		now = util_sync_file_now();
+		timeout = end > now ? end - now : 0;
+	}
+	ret = util_sync_file_wait(fds, signaled, count, wait_all, timeout);
+
+	for (i = 0; i < count; i++) {
+		if (signaled[i] && !fences[i]->signaled)
+			fence_signaled(fences[i]);
+	}
+
+out:
+	free(fds);
+	return ret < 0 ? ret : 0;
+}
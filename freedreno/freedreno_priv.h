@@ -44,7 +44,12 @@
 #include "xf86drm.h"
 #include "xf86atomic.h"
 
+#include "util_bo_cache.h"
+#include "util_bo_labels.h"
 #include "util_double_list.h"
+#include "util_grow.h"
+#include "util_handle_table.h"
+#include "util_trace.h"
 #include "util_math.h"
 
 #include "freedreno_drmif.h"
@@ -68,22 +73,19 @@ struct fd_device_funcs {
 	void (*destroy)(struct fd_device *dev);
 };
 
-struct fd_bo_bucket {
-	uint32_t size;
-	struct list_head list;
-};
-
-struct fd_bo_cache {
-	struct fd_bo_bucket cache_bucket[14 * 4];
-	int num_buckets;
-	time_t time;
-};
+/* number of pipes whose fences the bo's keep track of, later pipes'
+ * bo's get checked for idleness with the kernel:
+ */
+#define FD_MAX_TIMELINES 16
 
 struct fd_device {
 	int fd;
 	enum fd_version version;
 	atomic_t refcnt;
 
+	/* protects the tables, the bo caches and labels, and the bo's names: */
+	pthread_mutex_t table_lock;
+
 	/* tables to keep track of bo's, to avoid "evil-twin" fd_bo objects:
 	 *
 	 *   handle_table: maps handle to fd_bo
@@ -93,12 +95,22 @@ struct fd_device {
 	 * returns a new handle.  So we need to figure out if the bo is already
 	 * open in the process first, before calling gem-open.
 	 */
-	void *handle_table, *name_table;
+	struct handle_table handle_table, name_table;
 
 	const struct fd_device_funcs *funcs;
 
-	struct fd_bo_cache bo_cache;
-	struct fd_bo_cache ring_cache;
+	struct util_bo_cache bo_cache;
+	struct util_bo_cache ring_cache;
+	struct util_mem_pressure *pressure;
+
+	/* live bo's by debug label, under table_lock: */
+	struct util_bo_labels bo_labels;
+
+	/* last fence known to be retired on each pipe's timeline, see
+	 * fd_bo_mark_submitted():
+	 */
+	uint32_t retired_fence[FD_MAX_TIMELINES];
+	unsigned nr_timelines;
 
 	int closefd;        /* call close(fd) upon destruction */
 
@@ -106,20 +118,21 @@ struct fd_device {
 	int bo_size;
 };
 
-drm_private void fd_bo_cache_init(struct fd_bo_cache *cache, int coarse);
-drm_private void fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time);
-drm_private struct fd_bo * fd_bo_cache_alloc(struct fd_bo_cache *cache,
-		uint32_t *size, uint32_t flags);
-drm_private int fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo);
-
-/* for where @table_lock is already held: */
-drm_private void fd_device_del_locked(struct fd_device *dev);
+drm_private void fd_bo_cache_init(struct util_bo_cache *cache, int coarse);
+drm_private void fd_bo_cache_cleanup(struct util_bo_cache *cache, uint64_t now);
+drm_private void fd_bo_cache_trim(struct util_bo_cache *cache, unsigned level);
+drm_private void fd_bo_cache_unwatch_pressure(struct fd_device *dev);
+drm_private struct fd_bo * fd_bo_cache_alloc(struct fd_device *dev,
+		struct util_bo_cache *cache, uint32_t *size, uint32_t flags);
+drm_private int fd_bo_cache_free(struct util_bo_cache *cache, struct fd_bo *bo);
 
 struct fd_pipe_funcs {
 	struct fd_ringbuffer * (*ringbuffer_new)(struct fd_pipe *pipe, uint32_t size,
 			enum fd_ringbuffer_flags flags);
 	int (*get_param)(struct fd_pipe *pipe, enum fd_param_id param, uint64_t *value);
 	int (*wait)(struct fd_pipe *pipe, uint32_t timestamp, uint64_t timeout);
+	/* optional, like wait() with no timeout, and quiet: */
+	int (*fence_retired)(struct fd_pipe *pipe, uint32_t timestamp);
 	void (*destroy)(struct fd_pipe *pipe);
 };
 
@@ -128,17 +141,32 @@ struct fd_pipe {
 	enum fd_pipe_id id;
 	uint32_t gpu_id;
 	atomic_t refcnt;
+	/* index in dev->retired_fence, or -1: */
+	int timeline;
 	const struct fd_pipe_funcs *funcs;
 };
 
+struct fd_fence {
+	struct fd_pipe *pipe;
+	uint32_t timestamp;
+	int fd;
+	int signaled;
+};
+
 struct fd_ringbuffer_funcs {
 	void * (*hostptr)(struct fd_ringbuffer *ring);
 	int (*flush)(struct fd_ringbuffer *ring, uint32_t *last_start,
 			int in_fence_fd, int *out_fence_fd);
+	/* optional, else each of the rings is flushed on its own: */
+	int (*flush_group)(struct fd_ringbuffer **rings, uint32_t count,
+			int in_fence_fd, int *out_fence_fd);
 	void (*grow)(struct fd_ringbuffer *ring, uint32_t size);
 	void (*reset)(struct fd_ringbuffer *ring);
 	void (*emit_reloc)(struct fd_ringbuffer *ring,
 			const struct fd_reloc *reloc);
+	/* optional, else emit_reloc is called for each of the relocs: */
+	void (*emit_relocs)(struct fd_ringbuffer *ring,
+			const struct fd_reloc *relocs, uint32_t count);
 	uint32_t (*emit_reloc_ring)(struct fd_ringbuffer *ring,
 			struct fd_ringbuffer *target, uint32_t cmd_idx);
 	uint32_t (*cmd_count)(struct fd_ringbuffer *ring);
@@ -169,13 +197,84 @@ struct fd_bo {
 		RING_CACHE = 2,
 	} bo_reuse;
 
-	struct list_head list;   /* bucket-list entry */
-	time_t free_time;        /* time when added to bucket-list */
+	struct util_bo_cache_entry cache_entry;
+
+	/* index in dev->bo_labels, under table_lock: */
+	unsigned label;
+
+	/* (timeline + 1) << 32 | fence of the last submit using the bo, zero
+	 * if none, or FD_BO_FENCE_UNKNOWN:
+	 */
+	uint64_t last_fence;
 };
 
+#define FD_BO_FENCE_UNKNOWN (~0ull)
+
+drm_private void fd_device_dump_bo_usage_locked(struct fd_device *dev,
+		FILE *file);
+
 drm_private struct fd_bo *fd_bo_new_ring(struct fd_device *dev,
 		uint32_t size, uint32_t flags);
 
+static inline int
+fd_timeline_retired(struct fd_device *dev, int timeline, uint32_t fence)
+{
+	uint32_t retired = __atomic_load_n(&dev->retired_fence[timeline],
+			__ATOMIC_ACQUIRE);
+	return (int32_t)(fence - retired) <= 0;
+}
+
+static inline void
+fd_timeline_retire(struct fd_device *dev, int timeline, uint32_t fence)
+{
+	uint32_t retired = __atomic_load_n(&dev->retired_fence[timeline],
+			__ATOMIC_RELAXED);
+
+	do {
+		if ((int32_t)(fence - retired) <= 0)
+			return;
+	} while (!__atomic_compare_exchange_n(&dev->retired_fence[timeline],
+			&retired, fence, TRUE, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Record the fence of a submit the bo is in.  A bo used on another
+ * timeline while still busy on the first one can't be followed anymore,
+ * and gets checked with the kernel from then on:
+ */
+static inline void
+fd_bo_mark_submitted(struct fd_bo *bo, int timeline, uint32_t fence)
+{
+	uint64_t old = __atomic_load_n(&bo->last_fence, __ATOMIC_RELAXED);
+	uint64_t last;
+
+	do {
+		unsigned old_timeline = old >> 32;
+
+		if (old == FD_BO_FENCE_UNKNOWN)
+			return;
+
+		if (timeline < 0 || (old_timeline && old_timeline != timeline + 1u &&
+				!fd_timeline_retired(bo->dev, old_timeline - 1, old)))
+			last = FD_BO_FENCE_UNKNOWN;
+		else
+			last = ((uint64_t)(timeline + 1) << 32) | fence;
+	} while (!__atomic_compare_exchange_n(&bo->last_fence, &old, last,
+			TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* Whether the bo is known to be idle, without asking the kernel: */
+static inline int
+fd_bo_fence_retired(struct fd_bo *bo)
+{
+	uint64_t last = __atomic_load_n(&bo->last_fence, __ATOMIC_RELAXED);
+
+	if (!last)
+		return TRUE;
+	if (last == FD_BO_FENCE_UNKNOWN)
+		return FALSE;
+	return fd_timeline_retired(bo->dev, (last >> 32) - 1, last);
+}
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 #define enable_debug 0  /* TODO make dynamic */
@@ -110,15 +110,64 @@ drm_public void fd_ringbuffer_reset(struct fd_ringbuffer *ring)
 		ring->funcs->reset(ring);
 }
 
+static int ring_flush(struct fd_ringbuffer *ring, int in_fence_fd,
+		int *out_fence_fd)
+{
+	int ret;
+
+	UTIL_TRACE_BEGIN("fd_ringbuffer_flush", "ring=%p", ring);
+	ret = ring->funcs->flush(ring, ring->last_start, in_fence_fd,
+			out_fence_fd);
+	UTIL_TRACE_END();
+	return ret;
+}
+
 drm_public int fd_ringbuffer_flush(struct fd_ringbuffer *ring)
 {
-	return ring->funcs->flush(ring, ring->last_start, -1, NULL);
+	return ring_flush(ring, -1, NULL);
 }
 
 drm_public int fd_ringbuffer_flush2(struct fd_ringbuffer *ring, int in_fence_fd,
 		int *out_fence_fd)
 {
-	return ring->funcs->flush(ring, ring->last_start, in_fence_fd, out_fence_fd);
+	return ring_flush(ring, in_fence_fd, out_fence_fd);
+}
+
+drm_public int fd_ringbuffer_flush_group(struct fd_ringbuffer **rings,
+		uint32_t count, int in_fence_fd, int *out_fence_fd)
+{
+	uint32_t i;
+	int ret;
+
+	if (count == 1 || !rings[0]->funcs->flush_group) {
+		/* submits to a pipe retire in order, so the out-fence of the
+		 * last one covers all of them:
+		 */
+		for (i = 0; i < count; i++) {
+			ret = ring_flush(rings[i], i ? -1 : in_fence_fd,
+					i == count - 1 ? out_fence_fd : NULL);
+			if (ret)
+				return ret;
+		}
+		return 0;
+	}
+
+	UTIL_TRACE_BEGIN("fd_ringbuffer_flush_group", "rings=%u", count);
+	ret = rings[0]->funcs->flush_group(rings, count, in_fence_fd,
+			out_fence_fd);
+	UTIL_TRACE_END();
+	return ret;
+}
+
+drm_public struct fd_fence *
+fd_ringbuffer_flush_fence(struct fd_ringbuffer *ring, int in_fence_fd)
+{
+	int fence_fd = -1;
+
+	if (fd_ringbuffer_flush2(ring, in_fence_fd, &fence_fd))
+		return NULL;
+
+	return fd_fence_new(ring->pipe, ring->last_timestamp, fence_fd);
 }
 
 drm_public void fd_ringbuffer_grow(struct fd_ringbuffer *ring, uint32_t ndwords)
@@ -155,6 +204,21 @@ drm_public void fd_ringbuffer_reloc2(struct fd_ringbuffer *ring,
 	ring->funcs->emit_reloc(ring, reloc);
 }
 
+drm_public void fd_ringbuffer_relocs(struct fd_ringbuffer *ring,
+				     const struct fd_reloc *relocs,
+				     uint32_t count)
+{
+	uint32_t i;
+
+	if (ring->funcs->emit_relocs) {
+		ring->funcs->emit_relocs(ring, relocs, count);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		ring->funcs->emit_reloc(ring, &relocs[i]);
+}
+
 drm_public uint32_t fd_ringbuffer_cmd_count(struct fd_ringbuffer *ring)
 {
 	if (!ring->funcs->cmd_count)
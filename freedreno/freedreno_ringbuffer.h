@@ -110,6 +110,16 @@ int fd_ringbuffer_flush(struct fd_ringbuffer *ring);
  */
 int fd_ringbuffer_flush2(struct fd_ringbuffer *ring, int in_fence_fd,
 		int *out_fence_fd);
+/* like fd_ringbuffer_flush2(), returning a fence with the out-fence: */
+struct fd_fence * fd_ringbuffer_flush_fence(struct fd_ringbuffer *ring,
+		int in_fence_fd);
+/* like fd_ringbuffer_flush2() on each of count parent rings of the same
+ * pipe, in order, but in a single submit where the backend supports it, with
+ * the bo tables merged.  The in-fence is waited for before the first ring,
+ * and the out-fence signals once all of them are done:
+ */
+int fd_ringbuffer_flush_group(struct fd_ringbuffer **rings, uint32_t count,
+		int in_fence_fd, int *out_fence_fd);
 void fd_ringbuffer_grow(struct fd_ringbuffer *ring, uint32_t ndwords);
 uint32_t fd_ringbuffer_timestamp(struct fd_ringbuffer *ring);
 
@@ -133,6 +143,25 @@ struct fd_reloc {
 /* NOTE: relocs are 2 dwords on a5xx+ */
 
 void fd_ringbuffer_reloc2(struct fd_ringbuffer *ring, const struct fd_reloc *reloc);
+/* like fd_ringbuffer_reloc2() on each of the relocs, in one call, looking up
+ * the bo of a run of relocs into the same bo once:
+ */
+void fd_ringbuffer_relocs(struct fd_ringbuffer *ring,
+		const struct fd_reloc *relocs, uint32_t count);
+
+/* reloc of a bo at an offset, with no shift or or'ing in: */
+static inline void fd_ringbuffer_reloc_bo(struct fd_ringbuffer *ring,
+		struct fd_bo *bo, uint32_t offset, uint32_t flags)
+{
+	const struct fd_reloc reloc = {
+		.bo = bo,
+		.flags = flags,
+		.offset = offset,
+	};
+
+	fd_ringbuffer_reloc2(ring, &reloc);
+}
+
 will_be_deprecated void fd_ringbuffer_reloc(struct fd_ringbuffer *ring, const struct fd_reloc *reloc);
 uint32_t fd_ringbuffer_cmd_count(struct fd_ringbuffer *ring);
 uint32_t fd_ringbuffer_emit_reloc_ring_full(struct fd_ringbuffer *ring,
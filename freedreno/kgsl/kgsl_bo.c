@@ -102,7 +102,7 @@ static int kgsl_bo_cpu_prep(struct fd_bo *bo, struct fd_pipe *pipe, uint32_t op)
 		return 0;
 	}
 
-	if (timestamp)
+	if (timestamp && !kgsl_pipe_retired(to_kgsl_pipe(pipe), timestamp))
 		fd_pipe_wait(pipe, timestamp);
 
 	return 0;
@@ -67,6 +67,11 @@ static int kgsl_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp,
 	};
 	int ret;
 
+	if (kgsl_pipe_retired(kgsl_pipe, timestamp)) {
+		kgsl_pipe_process_pending(kgsl_pipe, *kgsl_pipe->retired);
+		return 0;
+	}
+
 	do {
 		ret = ioctl(kgsl_pipe->fd, IOCTL_KGSL_DEVICE_WAITTIMESTAMP, &req);
 	} while ((ret == -1) && ((errno == EINTR) || (errno == EAGAIN)));
@@ -83,7 +88,14 @@ drm_private int kgsl_pipe_timestamp(struct kgsl_pipe *kgsl_pipe,
 	struct kgsl_cmdstream_readtimestamp req = {
 			.type = KGSL_TIMESTAMP_RETIRED
 	};
-	int ret = ioctl(kgsl_pipe->fd, IOCTL_KGSL_CMDSTREAM_READTIMESTAMP, &req);
+	int ret;
+
+	if (kgsl_pipe->memstore) {
+		*timestamp = *kgsl_pipe->retired;
+		return 0;
+	}
+
+	ret = ioctl(kgsl_pipe->fd, IOCTL_KGSL_CMDSTREAM_READTIMESTAMP, &req);
 	if (ret) {
 		ERROR_MSG("readtimestamp failed! %d (%s)",
 				ret, strerror(errno));
@@ -93,6 +105,14 @@ drm_private int kgsl_pipe_timestamp(struct kgsl_pipe *kgsl_pipe,
 	return 0;
 }
 
+/* whether the timestamp is known to have retired, without an ioctl: */
+drm_private int kgsl_pipe_retired(struct kgsl_pipe *kgsl_pipe,
+		uint32_t timestamp)
+{
+	return kgsl_pipe->memstore && timestamp <= *kgsl_pipe->retired;
+}
+
+
 static void kgsl_pipe_destroy(struct fd_pipe *pipe)
 {
 	struct kgsl_pipe *kgsl_pipe = to_kgsl_pipe(pipe);
@@ -100,6 +120,9 @@ static void kgsl_pipe_destroy(struct fd_pipe *pipe)
 			.drawctxt_id = kgsl_pipe->drawctxt_id,
 	};
 
+	if (kgsl_pipe->memstore)
+		drm_munmap(kgsl_pipe->memstore, kgsl_pipe->memstore_size);
+
 	if (kgsl_pipe->drawctxt_id)
 		ioctl(kgsl_pipe->fd, IOCTL_KGSL_DRAWCTXT_DESTROY, &req);
 
@@ -168,7 +191,11 @@ drm_private void kgsl_pipe_post_submit(struct kgsl_pipe *kgsl_pipe,
 		kgsl_bo_set_timestamp(kgsl_bo, timestamp);
 	}
 
-	if (!kgsl_pipe_timestamp(kgsl_pipe, &timestamp))
+	/* the bo's just added are not retired yet, so the pending_list only
+	 * needs a walk once the retired timestamp moved:
+	 */
+	if (!kgsl_pipe_timestamp(kgsl_pipe, &timestamp) &&
+			timestamp != kgsl_pipe->processed)
 		kgsl_pipe_process_pending(kgsl_pipe, timestamp);
 }
 
@@ -178,6 +205,8 @@ drm_private void kgsl_pipe_process_pending(struct kgsl_pipe *kgsl_pipe,
 	struct fd_pipe *pipe = &kgsl_pipe->base;
 	struct kgsl_bo *kgsl_bo = NULL, *tmp;
 
+	kgsl_pipe->processed = timestamp;
+
 	LIST_FOR_EACH_ENTRY_SAFE(kgsl_bo, tmp, &kgsl_pipe->pending_list, list[pipe->id]) {
 		struct list_head *list = &kgsl_bo->list[pipe->id];
 		if (kgsl_bo->timestamp[pipe->id] > timestamp)
@@ -205,6 +234,36 @@ static int getprop(int fd, enum kgsl_property_type type,
 		goto fail;                                              \
 	} } while (0)
 
+/* map the memstore, to read the retired timestamp of our context from it: */
+static void kgsl_pipe_map_memstore(struct kgsl_pipe *kgsl_pipe)
+{
+	struct kgsl_shadowprop shadow;
+	size_t offset;
+	void *map;
+
+	if (getprop(kgsl_pipe->fd, KGSL_PROP_DEVICE_SHADOW,
+			&shadow, sizeof(shadow)) || !shadow.size)
+		return;
+
+	if (shadow.flags & KGSL_FLAGS_PER_CONTEXT_TIMESTAMPS)
+		offset = KGSL_MEMSTORE_OFFSET(kgsl_pipe->drawctxt_id, eoptimestamp);
+	else
+		offset = KGSL_MEMSTORE_OFFSET(0, eoptimestamp);
+	if (offset + sizeof(unsigned int) > shadow.size)
+		return;
+
+	map = drm_mmap(NULL, shadow.size, PROT_READ, MAP_SHARED,
+			kgsl_pipe->fd, shadow.gpuaddr);
+	if (map == MAP_FAILED) {
+		DEBUG_MSG("memstore mmap failed: %s", strerror(errno));
+		return;
+	}
+
+	kgsl_pipe->memstore = map;
+	kgsl_pipe->memstore_size = shadow.size;
+	kgsl_pipe->retired = (volatile unsigned int *)((char *)map + offset);
+}
+
 
 drm_private struct fd_pipe * kgsl_pipe_new(struct fd_device *dev,
 		enum fd_pipe_id id, uint32_t prio)
@@ -252,6 +311,8 @@ drm_private struct fd_pipe * kgsl_pipe_new(struct fd_device *dev,
 	GETPROP(fd, VERSION,     kgsl_pipe->version);
 	GETPROP(fd, DEVICE_INFO, kgsl_pipe->devinfo);
 
+	kgsl_pipe_map_memstore(kgsl_pipe);
+
 	if (kgsl_pipe->devinfo.gpu_id >= 500) {
 		ERROR_MSG("64b unsupported with kgsl");
 		goto fail;
@@ -269,6 +330,7 @@ drm_private struct fd_pipe * kgsl_pipe_new(struct fd_device *dev,
 	INFO_MSG(" MMU enabled:     %d", kgsl_pipe->devinfo.mmu_enabled);
 	INFO_MSG(" GMEM Base addr:  0x%08x", kgsl_pipe->devinfo.gmem_gpubaseaddr);
 	INFO_MSG(" GMEM size:       0x%08x", kgsl_pipe->devinfo.gmem_sizebytes);
+	INFO_MSG(" Memstore mapped: %d", kgsl_pipe->memstore != NULL);
 	INFO_MSG(" Driver version:  %d.%d",
 			kgsl_pipe->version.drv_major, kgsl_pipe->version.drv_minor);
 	INFO_MSG(" Device version:  %d.%d",
@@ -62,6 +62,16 @@ struct kgsl_pipe {
 	 */
 	struct list_head pending_list;
 
+	/* read-only mapping of the memstore the GPU writes the retired
+	 * timestamps to, or NULL if the timestamp is read with an ioctl:
+	 */
+	void *memstore;
+	uint32_t memstore_size;
+	volatile unsigned int *retired;
+
+	/* retired timestamp the pending_list was last processed for: */
+	uint32_t processed;
+
 	/* if we are the 2d pipe, and want to wait on a timestamp
 	 * from 3d, we need to also internally open the 3d pipe:
 	 */
@@ -95,6 +105,8 @@ drm_private struct fd_device * kgsl_device_new(int fd);
 
 drm_private int kgsl_pipe_timestamp(struct kgsl_pipe *kgsl_pipe,
 		uint32_t *timestamp);
+drm_private int kgsl_pipe_retired(struct kgsl_pipe *kgsl_pipe,
+		uint32_t timestamp);
 drm_private void kgsl_pipe_add_submit(struct kgsl_pipe *pipe,
 		struct kgsl_bo *bo);
 drm_private void kgsl_pipe_pre_submit(struct kgsl_pipe *pipe);
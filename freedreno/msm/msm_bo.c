@@ -106,11 +106,15 @@ static int msm_bo_madvise(struct fd_bo *bo, int willneed)
 
 static uint64_t msm_bo_iova(struct fd_bo *bo)
 {
+	struct msm_bo *msm_bo = to_msm_bo(bo);
 	struct drm_msm_gem_info req = {
 			.handle = bo->handle,
 			.flags = MSM_INFO_IOVA,
 	};
 
+	if (msm_bo->presumed_valid)
+		return msm_bo->presumed;
+
 	drmCommandWriteRead(bo->dev->fd, DRM_MSM_GEM_INFO, &req, sizeof(req));
 
 	return req.offset;
@@ -119,6 +123,12 @@ static uint64_t msm_bo_iova(struct fd_bo *bo)
 static void msm_bo_destroy(struct fd_bo *bo)
 {
 	struct msm_bo *msm_bo = to_msm_bo(bo);
+
+	/* the handle is closed already, so the kernel has let go of the
+	 * range, or will once the last submit using the bo retires: */
+	if (msm_bo->userspace_iova)
+		msm_va_free(bo->dev, msm_bo->presumed, bo->size);
+
 	free(msm_bo);
 
 }
@@ -132,6 +142,39 @@ static const struct fd_bo_funcs funcs = {
 		.destroy = msm_bo_destroy,
 };
 
+/* Assign the bo an iova of our own, or the one the kernel picked when
+ * that fails (ie. an imported bo already mapped, or the range is still
+ * held by a freed bo that is busy).  Either way relocs can then be
+ * written directly.  Called under table_lock.
+ */
+static void set_iova(struct msm_bo *msm_bo, struct fd_device *dev,
+		uint32_t size, uint32_t handle)
+{
+	struct drm_msm_gem_info req = {
+			.handle = handle,
+			.flags = MSM_INFO_SET_IOVA,
+	};
+
+	req.offset = msm_va_alloc(dev, size);
+	if (req.offset) {
+		if (!drmCommandWriteRead(dev->fd, DRM_MSM_GEM_INFO,
+				&req, sizeof(req))) {
+			msm_bo->presumed = req.offset;
+			msm_bo->presumed_valid = TRUE;
+			msm_bo->userspace_iova = TRUE;
+			return;
+		}
+		msm_va_free(dev, req.offset, size);
+	}
+
+	req.flags = MSM_INFO_IOVA;
+	req.offset = 0;
+	if (!drmCommandWriteRead(dev->fd, DRM_MSM_GEM_INFO, &req, sizeof(req))) {
+		msm_bo->presumed = req.offset;
+		msm_bo->presumed_valid = TRUE;
+	}
+}
+
 /* allocate a buffer handle: */
 drm_private int msm_bo_new_handle(struct fd_device *dev,
 		uint32_t size, uint32_t flags, uint32_t *handle)
@@ -166,5 +209,8 @@ drm_private struct fd_bo * msm_bo_from_handle(struct fd_device *dev,
 	bo = &msm_bo->base;
 	bo->funcs = &funcs;
 
+	if (to_msm_device(dev)->userspace_iova)
+		set_iova(msm_bo, dev, size, handle);
+
 	return bo;
 }
@@ -35,9 +35,125 @@
 static void msm_device_destroy(struct fd_device *dev)
 {
 	struct msm_device *msm_dev = to_msm_device(dev);
+	struct msm_va_hole *hole, *tmp;
+
+	if (msm_dev->userspace_iova) {
+		LIST_FOR_EACH_ENTRY_SAFE(hole, tmp, &msm_dev->va_holes, list)
+			free(hole);
+	}
+
 	free(msm_dev);
 }
 
+/* First fit allocation of size bytes of gpu address space, 0 on failure.
+ * Called under table_lock.
+ */
+drm_private uint64_t msm_va_alloc(struct fd_device *dev, uint64_t size)
+{
+	struct msm_device *msm_dev = to_msm_device(dev);
+	struct msm_va_hole *hole;
+	uint64_t offset;
+
+	size = ALIGN(size, 4096);
+
+	LIST_FOR_EACH_ENTRY(hole, &msm_dev->va_holes, list) {
+		if (hole->size < size)
+			continue;
+
+		offset = hole->offset;
+		hole->offset += size;
+		hole->size -= size;
+		if (!hole->size) {
+			list_del(&hole->list);
+			free(hole);
+		}
+		return offset;
+	}
+
+	return 0;
+}
+
+/* Called under table_lock */
+drm_private void msm_va_free(struct fd_device *dev, uint64_t offset,
+		uint64_t size)
+{
+	struct msm_device *msm_dev = to_msm_device(dev);
+	struct msm_va_hole *hole, *prev = NULL, *next = NULL;
+
+	size = ALIGN(size, 4096);
+
+	LIST_FOR_EACH_ENTRY(hole, &msm_dev->va_holes, list) {
+		if (hole->offset > offset) {
+			next = hole;
+			break;
+		}
+		prev = hole;
+	}
+
+	if (prev && prev->offset + prev->size == offset) {
+		prev->size += size;
+		if (next && offset + size == next->offset) {
+			prev->size += next->size;
+			list_del(&next->list);
+			free(next);
+		}
+		return;
+	}
+
+	if (next && offset + size == next->offset) {
+		next->offset = offset;
+		next->size += size;
+		return;
+	}
+
+	hole = malloc(sizeof(*hole));
+	if (!hole)
+		return;     /* leak the range */
+
+	hole->offset = offset;
+	hole->size = size;
+	list_addtail(&hole->list, next ? &next->list : &msm_dev->va_holes);
+}
+
+static int get_param(int fd, uint32_t param, uint64_t *value)
+{
+	struct drm_msm_param req = {
+			.pipe = MSM_PIPE_3D0,
+			.param = param,
+	};
+	int ret;
+
+	ret = drmCommandWriteRead(fd, DRM_MSM_GET_PARAM, &req, sizeof(req));
+	if (ret)
+		return ret;
+
+	*value = req.value;
+
+	return 0;
+}
+
+/* Kernels that report the iova range let userspace assign the iovas: */
+static void init_userspace_iova(struct msm_device *msm_dev, int fd)
+{
+	struct msm_va_hole *hole;
+	uint64_t va_start, va_size;
+
+	if (get_param(fd, MSM_PARAM_VA_START, &va_start) ||
+			get_param(fd, MSM_PARAM_VA_SIZE, &va_size) ||
+			!va_start || !va_size)
+		return;
+
+	hole = malloc(sizeof(*hole));
+	if (!hole)
+		return;
+
+	hole->offset = va_start;
+	hole->size = va_size;
+	list_inithead(&msm_dev->va_holes);
+	list_addtail(&hole->list, &msm_dev->va_holes);
+	msm_dev->userspace_iova = TRUE;
+}
+
 static const struct fd_device_funcs funcs = {
 		.bo_new_handle = msm_bo_new_handle,
 		.bo_from_handle = msm_bo_from_handle,
@@ -59,5 +175,7 @@ drm_private struct fd_device * msm_device_new(int fd)
 
 	dev->bo_size = sizeof(struct msm_bo);
 
+	init_userspace_iova(msm_dev, fd);
+
 	return dev;
 }
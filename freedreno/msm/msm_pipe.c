@@ -93,9 +93,34 @@ static int msm_pipe_wait(struct fd_pipe *pipe, uint32_t timestamp,
 		return ret;
 	}
 
+	if (pipe->timeline >= 0)
+		fd_timeline_retire(dev, pipe->timeline, timestamp);
+
 	return 0;
 }
 
+/* like msm_pipe_wait() without waiting, and quiet when not retired yet: */
+drm_private int msm_pipe_fence_retired(struct fd_pipe *pipe, uint32_t fence)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	struct drm_msm_wait_fence req = {
+			.fence = fence,
+			.queueid = msm_pipe->queue_id,
+	};
+
+	if (pipe->timeline >= 0 && fd_timeline_retired(pipe->dev, pipe->timeline, fence))
+		return TRUE;
+
+	get_abs_timeout(&req.timeout, 0);
+
+	if (drmCommandWrite(pipe->dev->fd, DRM_MSM_WAIT_FENCE, &req, sizeof(req)))
+		return FALSE;
+
+	if (pipe->timeline >= 0)
+		fd_timeline_retire(pipe->dev, pipe->timeline, fence);
+	return TRUE;
+}
+
 static int open_submitqueue(struct fd_pipe *pipe, uint32_t prio)
 {
 	struct drm_msm_submitqueue req = {
@@ -144,6 +169,8 @@ static void msm_pipe_destroy(struct fd_pipe *pipe)
 		msm_pipe->suballoc_ring = NULL;
 	}
 
+	msm_pipe_cmd_pool_fini(pipe);
+	pthread_mutex_destroy(&msm_pipe->cmd_pool_lock);
 	free(msm_pipe);
 }
 
@@ -151,6 +178,7 @@ static const struct fd_pipe_funcs funcs = {
 		.ringbuffer_new = msm_ringbuffer_new,
 		.get_param = msm_pipe_get_param,
 		.wait = msm_pipe_wait,
+		.fence_retired = msm_pipe_fence_retired,
 		.destroy = msm_pipe_destroy,
 };
 
@@ -184,6 +212,9 @@ drm_private struct fd_pipe * msm_pipe_new(struct fd_device *dev,
 	pipe = &msm_pipe->base;
 	pipe->funcs = &funcs;
 
+	pthread_mutex_init(&msm_pipe->cmd_pool_lock, NULL);
+	list_inithead(&msm_pipe->cmd_pool);
+
 	/* initialize before get_param(): */
 	pipe->dev = dev;
 	msm_pipe->pipe = pipe_id[id];
@@ -39,8 +39,21 @@
 
 struct msm_device {
 	struct fd_device base;
-	struct fd_bo_cache ring_cache;
+	struct util_bo_cache ring_cache;
 	unsigned ring_cnt;
+
+	/* When the kernel lets us pick the bo's iovas, the free ranges of
+	 * the gpu address space (msm_va_hole's sorted by offset), under
+	 * table_lock:
+	 */
+	int userspace_iova;
+	struct list_head va_holes;
+};
+
+struct msm_va_hole {
+	struct list_head list;
+	uint64_t offset;
+	uint64_t size;
 };
 
 static inline struct msm_device * to_msm_device(struct fd_device *x)
@@ -49,6 +62,9 @@ static inline struct msm_device * to_msm_device(struct fd_device *x)
 }
 
 drm_private struct fd_device * msm_device_new(int fd);
+drm_private uint64_t msm_va_alloc(struct fd_device *dev, uint64_t size);
+drm_private void msm_va_free(struct fd_device *dev, uint64_t offset,
+		uint64_t size);
 
 struct msm_pipe {
 	struct fd_pipe base;
@@ -68,6 +84,14 @@ struct msm_pipe {
 	 * so we can reclaim extra space at it's end.
 	 */
 	struct fd_ringbuffer *suballoc_ring;
+
+	/* Cmdstream buffers of the deleted rings (msm_cmd's, with their
+	 * mapped bo and relocs table), oldest first, to be taken back once
+	 * the last submit using them has retired:
+	 */
+	pthread_mutex_t cmd_pool_lock;
+	struct list_head cmd_pool;
+	unsigned cmd_pool_count;
 };
 
 static inline struct msm_pipe * to_msm_pipe(struct fd_pipe *x)
@@ -77,6 +101,8 @@ static inline struct msm_pipe * to_msm_pipe(struct fd_pipe *x)
 
 drm_private struct fd_pipe * msm_pipe_new(struct fd_device *dev,
 		enum fd_pipe_id id, uint32_t prio);
+drm_private int msm_pipe_fence_retired(struct fd_pipe *pipe, uint32_t fence);
+drm_private void msm_pipe_cmd_pool_fini(struct fd_pipe *pipe);
 
 drm_private struct fd_ringbuffer * msm_ringbuffer_new(struct fd_pipe *pipe,
 		uint32_t size, enum fd_ringbuffer_flags flags);
@@ -84,13 +110,20 @@ drm_private struct fd_ringbuffer * msm_ringbuffer_new(struct fd_pipe *pipe,
 struct msm_bo {
 	struct fd_bo base;
 	uint64_t offset;
+	/* the iova, once known; always known with userspace iova, from
+	 * which point relocs are written directly:
+	 */
 	uint64_t presumed;
+	int presumed_valid;
+	/* set when the iova comes from msm_va_alloc(): */
+	int userspace_iova;
 	/* to avoid excess hashtable lookups, cache the ring this bo was
 	 * last emitted on (since that will probably also be the next ring
-	 * it is emitted on)
+	 * it is emitted on), as the ring seqno in the upper 32 bits and the
+	 * idx in the lower ones.  Rings on other threads may overwrite it at
+	 * any time, so it is only accessed atomically, as a whole.
 	 */
-	unsigned current_ring_seqno;
-	uint32_t idx;
+	uint64_t current_ring_idx;
 };
 
 static inline struct msm_bo * to_msm_bo(struct fd_bo *x)
@@ -119,14 +152,7 @@ static inline void get_abs_timeout(struct drm_msm_timespec *tv, uint64_t ns)
 static inline void *
 grow(void *ptr, uint32_t nr, uint32_t *max, uint32_t sz)
 {
-	if ((nr + 1) > *max) {
-		if ((*max * 2) < (nr + 1))
-			*max = nr + 5;
-		else
-			*max = *max * 2;
-		ptr = realloc(ptr, *max * sz);
-	}
-	return ptr;
+	return util_grow_array(ptr, max, nr + 1, sz);
 }
 
 #define DECLARE_ARRAY(type, name) \
@@ -49,6 +49,12 @@ struct msm_cmd {
 
 	/* has cmd already been added to parent rb's submit.cmds table? */
 	int is_appended_to_submit;
+
+	/* own ring_bo, to go back to the pipe's pool when the ring is done
+	 * with it, and the fence of the last submit using it once there:
+	 */
+	int is_pooled;
+	uint32_t fence;
 };
 
 struct msm_ringbuffer {
@@ -92,8 +98,10 @@ struct msm_ringbuffer {
 
 	unsigned seqno;
 
-	/* maps fd_bo to idx: */
-	void *bo_table;
+	/* open addressing hash of the idx + 1 by bo handle, 0 if free, kept
+	 * at most half full: */
+	uint32_t *bo_table;
+	unsigned bo_table_size;
 
 	/* maps msm_cmd to drm_msm_gem_submit_cmd in parent rb.  Each rb has a
 	 * list of msm_cmd's which correspond to each chunk of cmdstream in
@@ -114,8 +122,11 @@ static inline struct msm_ringbuffer * to_msm_ringbuffer(struct fd_ringbuffer *x)
 }
 
 #define INIT_SIZE 0x1000
-
-static pthread_mutex_t idx_lock = PTHREAD_MUTEX_INITIALIZER;
+#define BO_TABLE_INIT_SIZE 64
+/* larger pooled cmds make the first cmd of a growable ring larger, up to
+ * the upper bound on IB size */
+#define MAX_CMD_SIZE 0x100000
+#define MAX_POOLED_CMDS 16
 
 static struct msm_cmd *current_cmd(struct fd_ringbuffer *ring)
 {
@@ -124,21 +135,98 @@ static struct msm_cmd *current_cmd(struct fd_ringbuffer *ring)
 	return LIST_LAST_ENTRY(&msm_ring->cmd_list, struct msm_cmd, list);
 }
 
-static void ring_cmd_del(struct msm_cmd *cmd)
+static void ring_cmd_free(struct msm_cmd *cmd)
 {
 	fd_bo_del(cmd->ring_bo);
-	list_del(&cmd->list);
-	to_msm_ringbuffer(cmd->ring)->cmd_count--;
 	free(cmd->relocs);
 	free(cmd);
 }
 
+static void ring_cmd_del(struct msm_cmd *cmd)
+{
+	struct fd_ringbuffer *ring = cmd->ring;
+	struct msm_pipe *msm_pipe = to_msm_pipe(ring->pipe);
+	struct msm_cmd *old = NULL;
+
+	list_del(&cmd->list);
+	to_msm_ringbuffer(ring)->cmd_count--;
+
+	if (!cmd->is_pooled) {
+		ring_cmd_free(cmd);
+		return;
+	}
+
+	cmd->fence = ring->last_timestamp;
+	cmd->ring = NULL;
+
+	pthread_mutex_lock(&msm_pipe->cmd_pool_lock);
+	list_addtail(&cmd->list, &msm_pipe->cmd_pool);
+	if (++msm_pipe->cmd_pool_count > MAX_POOLED_CMDS) {
+		old = LIST_FIRST_ENTRY(&msm_pipe->cmd_pool, struct msm_cmd, list);
+		list_del(&old->list);
+		msm_pipe->cmd_pool_count--;
+	}
+	pthread_mutex_unlock(&msm_pipe->cmd_pool_lock);
+
+	if (old)
+		ring_cmd_free(old);
+}
+
+/* Take a pooled cmd of at least size bytes whose last submit retired: */
+static struct msm_cmd * ring_cmd_get_pooled(struct fd_pipe *pipe, uint32_t size)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	struct msm_cmd *cmd;
+
+	pthread_mutex_lock(&msm_pipe->cmd_pool_lock);
+	LIST_FOR_EACH_ENTRY(cmd, &msm_pipe->cmd_pool, list) {
+		if (cmd->ring_bo->size < size)
+			continue;
+		/* fences retire in order, so the newer ones are no better: */
+		if (!msm_pipe_fence_retired(pipe, cmd->fence))
+			break;
+		list_del(&cmd->list);
+		msm_pipe->cmd_pool_count--;
+		pthread_mutex_unlock(&msm_pipe->cmd_pool_lock);
+
+		cmd->nr_relocs = 0;
+		cmd->size = 0;
+		cmd->is_appended_to_submit = 0;
+		return cmd;
+	}
+	pthread_mutex_unlock(&msm_pipe->cmd_pool_lock);
+
+	return NULL;
+}
+
+drm_private void msm_pipe_cmd_pool_fini(struct fd_pipe *pipe)
+{
+	struct msm_pipe *msm_pipe = to_msm_pipe(pipe);
+	struct msm_cmd *cmd, *tmp;
+
+	LIST_FOR_EACH_ENTRY_SAFE(cmd, tmp, &msm_pipe->cmd_pool, list) {
+		list_del(&cmd->list);
+		ring_cmd_free(cmd);
+	}
+	msm_pipe->cmd_pool_count = 0;
+}
+
 static struct msm_cmd * ring_cmd_new(struct fd_ringbuffer *ring, uint32_t size,
 		enum fd_ringbuffer_flags flags)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
-	struct msm_cmd *cmd = calloc(1, sizeof(*cmd));
+	struct msm_cmd *cmd = NULL;
 
+	if (!(flags & FD_RINGBUFFER_STREAMING))
+		cmd = ring_cmd_get_pooled(ring->pipe, size);
+	if (cmd) {
+		cmd->ring = ring;
+		list_addtail(&cmd->list, &msm_ring->cmd_list);
+		msm_ring->cmd_count++;
+		return cmd;
+	}
+
+	cmd = calloc(1, sizeof(*cmd));
 	if (!cmd)
 		return NULL;
 
@@ -184,6 +272,7 @@ static struct msm_cmd * ring_cmd_new(struct fd_ringbuffer *ring, uint32_t size,
 		msm_pipe->suballoc_ring = fd_ringbuffer_ref(ring);
 	} else {
 		cmd->ring_bo = fd_bo_new_ring(ring->pipe->dev, size, 0);
+		cmd->is_pooled = TRUE;
 	}
 	if (!cmd->ring_bo)
 		goto fail;
@@ -194,7 +283,7 @@ static struct msm_cmd * ring_cmd_new(struct fd_ringbuffer *ring, uint32_t size,
 	return cmd;
 
 fail:
-	ring_cmd_del(cmd);
+	free(cmd);
 	return NULL;
 }
 
@@ -215,37 +304,99 @@ static uint32_t append_bo(struct fd_ringbuffer *ring, struct fd_bo *bo)
 	return idx;
 }
 
+/* slot of the bo handle in the bo table, free if not in the ring: */
+static uint32_t * bo_table_slot(struct msm_ringbuffer *msm_ring, uint32_t handle)
+{
+	unsigned mask = msm_ring->bo_table_size - 1;
+	unsigned i = (handle * 2654435761u) & mask;
+
+	while (msm_ring->bo_table[i] &&
+			msm_ring->submit.bos[msm_ring->bo_table[i] - 1].handle != handle)
+		i = (i + 1) & mask;
+
+	return &msm_ring->bo_table[i];
+}
+
+/* grow the bo table to keep it at most half full with one more bo, the
+ * bos being put back from the submit, as a table dropped by bo2idx() on
+ * failure misses some:
+ */
+static int bo_table_grow(struct msm_ringbuffer *msm_ring)
+{
+	uint32_t *table;
+	unsigned i, size = msm_ring->bo_table_size;
+
+	size = size ? size * 2 : BO_TABLE_INIT_SIZE;
+	while ((msm_ring->nr_bos + 1) * 2 > size)
+		size *= 2;
+
+	table = calloc(size, sizeof(uint32_t));
+	if (!table)
+		return -ENOMEM;
+
+	free(msm_ring->bo_table);
+	msm_ring->bo_table = table;
+	msm_ring->bo_table_size = size;
+
+	for (i = 0; i < msm_ring->nr_bos; i++)
+		*bo_table_slot(msm_ring, msm_ring->submit.bos[i].handle) = i + 1;
+
+	return 0;
+}
+
+static void set_bo_flags(struct msm_ringbuffer *msm_ring, uint32_t idx,
+		uint32_t flags)
+{
+	if (flags & FD_RELOC_READ)
+		msm_ring->submit.bos[idx].flags |= MSM_SUBMIT_BO_READ;
+	if (flags & FD_RELOC_WRITE)
+		msm_ring->submit.bos[idx].flags |= MSM_SUBMIT_BO_WRITE;
+}
+
 /* add (if needed) bo, return idx: */
 static uint32_t bo2idx(struct fd_ringbuffer *ring, struct fd_bo *bo, uint32_t flags)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
 	struct msm_bo *msm_bo = to_msm_bo(bo);
-	uint32_t idx;
-	pthread_mutex_lock(&idx_lock);
-	if (msm_bo->current_ring_seqno == msm_ring->seqno) {
-		idx = msm_bo->idx;
-	} else {
-		void *val;
+	uint64_t cached;
+	uint32_t idx, *slot;
 
-		if (!msm_ring->bo_table)
-			msm_ring->bo_table = drmHashCreate();
+	cached = __atomic_load_n(&msm_bo->current_ring_idx, __ATOMIC_RELAXED);
+	if ((cached >> 32) == msm_ring->seqno) {
+		idx = (uint32_t)cached;
+	} else {
+		/* a table that can't grow still works as long as it keeps a
+		 * free slot, else it is dropped for a search of the bos until
+		 * it can: */
+		if ((msm_ring->nr_bos + 1) * 2 > msm_ring->bo_table_size &&
+				bo_table_grow(msm_ring) &&
+				msm_ring->nr_bos + 1 >= msm_ring->bo_table_size) {
+			free(msm_ring->bo_table);
+			msm_ring->bo_table = NULL;
+			msm_ring->bo_table_size = 0;
+		}
 
-		if (!drmHashLookup(msm_ring->bo_table, bo->handle, &val)) {
-			/* found */
-			idx = (uint32_t)(uintptr_t)val;
+		if (msm_ring->bo_table) {
+			slot = bo_table_slot(msm_ring, bo->handle);
+			if (*slot) {
+				/* found */
+				idx = *slot - 1;
+			} else {
+				idx = append_bo(ring, bo);
+				*slot = idx + 1;
+			}
 		} else {
-			idx = append_bo(ring, bo);
-			val = (void *)(uintptr_t)idx;
-			drmHashInsert(msm_ring->bo_table, bo->handle, val);
+			for (idx = 0; idx < msm_ring->nr_bos; idx++)
+				if (msm_ring->submit.bos[idx].handle == bo->handle)
+					break;
+			if (idx == msm_ring->nr_bos)
+				idx = append_bo(ring, bo);
 		}
-		msm_bo->current_ring_seqno = msm_ring->seqno;
-		msm_bo->idx = idx;
+		__atomic_store_n(&msm_bo->current_ring_idx,
+				((uint64_t)msm_ring->seqno << 32) | idx,
+				__ATOMIC_RELAXED);
 	}
-	pthread_mutex_unlock(&idx_lock);
-	if (flags & FD_RELOC_READ)
-		msm_ring->submit.bos[idx].flags |= MSM_SUBMIT_BO_READ;
-	if (flags & FD_RELOC_WRITE)
-		msm_ring->submit.bos[idx].flags |= MSM_SUBMIT_BO_WRITE;
+	set_bo_flags(msm_ring, idx, flags);
 	return idx;
 }
 
@@ -334,9 +485,12 @@ static void flush_reset(struct fd_ringbuffer *ring)
 
 	for (i = 0; i < msm_ring->nr_bos; i++) {
 		struct msm_bo *msm_bo = to_msm_bo(msm_ring->bos[i]);
+		uint64_t cached = ((uint64_t)msm_ring->seqno << 32) | i;
 		if (!msm_bo)
 			continue;
-		msm_bo->current_ring_seqno = 0;
+		/* unless another ring took it over since: */
+		__atomic_compare_exchange_n(&msm_bo->current_ring_idx, &cached, 0,
+				false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
 		fd_bo_del(&msm_bo->base);
 	}
 
@@ -355,10 +509,9 @@ static void flush_reset(struct fd_ringbuffer *ring)
 	msm_ring->nr_cmds = 0;
 	msm_ring->nr_bos = 0;
 
-	if (msm_ring->bo_table) {
-		drmHashDestroy(msm_ring->bo_table);
-		msm_ring->bo_table = NULL;
-	}
+	if (msm_ring->bo_table)
+		memset(msm_ring->bo_table, 0,
+				msm_ring->bo_table_size * sizeof(uint32_t));
 
 	if (msm_ring->cmd_table) {
 		drmHashDestroy(msm_ring->cmd_table);
@@ -414,28 +567,55 @@ static void dump_submit(struct msm_ringbuffer *msm_ring)
 	}
 }
 
+/* the ring whose bos table the relocs of a cmd index: */
+static struct fd_ringbuffer * reloc_owner(struct msm_cmd *msm_cmd)
+{
+	struct fd_ringbuffer *ring = msm_cmd->ring;
+
+	if (ring->flags & FD_RINGBUFFER_OBJECT)
+		return ring;
+	return ring->parent ? ring->parent : ring;
+}
+
+/* also used for the cmds of the other parent rings of a merged submit, which
+ * have their own bos table just like stateobjs:
+ */
 static struct drm_msm_gem_submit_reloc *
 handle_stateobj_relocs(struct fd_ringbuffer *parent, struct fd_ringbuffer *stateobj,
 		struct drm_msm_gem_submit_reloc *orig_relocs, unsigned nr_relocs)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(stateobj);
-	struct drm_msm_gem_submit_reloc *relocs = malloc(nr_relocs * sizeof(*relocs));
+	struct msm_ringbuffer *msm_parent = to_msm_ringbuffer(parent);
+	struct drm_msm_gem_submit_reloc *relocs;
+	uint32_t *parent_idx;
 	unsigned i;
 
-	for (i = 0; i < nr_relocs; i++) {
-		unsigned idx = orig_relocs[i].reloc_idx;
-		struct fd_bo *bo = msm_ring->bos[idx];
-		unsigned flags = 0;
+	/* the stateobj's bos table already is its set of distinct bos with
+	 * their access flags, so merge that into the parent's table once and
+	 * remap the relocs through it, rather than a bo2idx() per reloc.  The
+	 * mapping lives past the relocs, and is freed with them:
+	 */
+	relocs = malloc(nr_relocs * sizeof(*relocs) +
+			msm_ring->nr_bos * sizeof(*parent_idx));
+	parent_idx = (uint32_t *)&relocs[nr_relocs];
 
-		if (msm_ring->submit.bos[idx].flags & MSM_SUBMIT_BO_READ)
-			flags |= FD_RELOC_READ;
-		if (msm_ring->submit.bos[idx].flags & MSM_SUBMIT_BO_WRITE)
-			flags |= FD_RELOC_WRITE;
+	for (i = 0; i < msm_ring->nr_bos; i++) {
+		uint32_t idx = bo2idx(parent, msm_ring->bos[i], 0);
 
+		msm_parent->submit.bos[idx].flags |= msm_ring->submit.bos[i].flags &
+				(MSM_SUBMIT_BO_READ | MSM_SUBMIT_BO_WRITE);
+		parent_idx[i] = idx;
+	}
+
+	for (i = 0; i < nr_relocs; i++) {
 		relocs[i] = orig_relocs[i];
-		relocs[i].reloc_idx = bo2idx(parent, bo, flags);
+		relocs[i].reloc_idx = parent_idx[orig_relocs[i].reloc_idx];
 	}
 
+	/* the cmds of a merged ring were all added by merge_ring(): */
+	if (!(stateobj->flags & FD_RINGBUFFER_OBJECT))
+		return relocs;
+
 	/* stateobj rb's could have reloc's to other stateobj rb's which didn't
 	 * get propagated to the parent rb at _emit_reloc_ring() time (because
 	 * the parent wasn't known then), so fix that up now:
@@ -457,7 +637,32 @@ handle_stateobj_relocs(struct fd_ringbuffer *parent, struct fd_ringbuffer *state
 	return relocs;
 }
 
-static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start,
+/* Add the cmds of another parent ring, and those of the rings it targets, to
+ * the submit of ring, for all of them to go in the same submit ioctl:
+ */
+static void merge_ring(struct fd_ringbuffer *ring, struct fd_ringbuffer *other)
+{
+	struct msm_ringbuffer *msm_other = to_msm_ringbuffer(other);
+	uint32_t i;
+
+	assert(!other->parent && other != ring);
+	assert(other->pipe == ring->pipe);
+
+	finalize_current_cmd(other, other->last_start);
+
+	for (i = 0; i < msm_other->submit.nr_cmds; i++) {
+		struct msm_cmd *msm_cmd = msm_other->cmds[i];
+		struct drm_msm_gem_submit_cmd *cmd = &msm_other->submit.cmds[i];
+
+		/* stateobjs are unref'd for each cmd of theirs in the submit: */
+		if (get_cmd(ring, msm_cmd, cmd->submit_offset, cmd->size, cmd->type) &&
+				(msm_cmd->ring->flags & FD_RINGBUFFER_OBJECT))
+			fd_ringbuffer_ref(msm_cmd->ring);
+	}
+}
+
+static int submit_rings(struct fd_ringbuffer *ring, uint32_t *last_start,
+		struct fd_ringbuffer **others, uint32_t nr_others,
 		int in_fence_fd, int *out_fence_fd)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
@@ -482,6 +687,9 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 
 	finalize_current_cmd(ring, last_start);
 
+	for (i = 0; i < nr_others; i++)
+		merge_ring(ring, others[i]);
+
 	/* for each of the cmd's fix up their reloc's: */
 	for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
 		struct msm_cmd *msm_cmd = msm_ring->cmds[i];
@@ -489,13 +697,13 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 		struct drm_msm_gem_submit_cmd *cmd;
 		unsigned nr_relocs = msm_cmd->nr_relocs;
 
-		/* for reusable stateobjs, the reloc table has reloc_idx that
-		 * points into it's own private bos table, rather than the global
-		 * bos table used for the submit, so we need to add the stateobj's
-		 * bos to the global table and construct new relocs table with
-		 * corresponding reloc_idx
+		/* for reusable stateobjs, and the cmds of merged rings, the reloc
+		 * table has reloc_idx that points into it's own private bos table,
+		 * rather than the global bos table used for the submit, so we need
+		 * to add the stateobj's bos to the global table and construct new
+		 * relocs table with corresponding reloc_idx
 		 */
-		if (msm_cmd->ring->flags & FD_RINGBUFFER_OBJECT) {
+		if (reloc_owner(msm_cmd) != ring) {
 			relocs = handle_stateobj_relocs(ring, msm_cmd->ring,
 					relocs, nr_relocs);
 		}
@@ -525,6 +733,10 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 			msm_cmd->ring->last_timestamp = req.fence;
 		}
 
+		/* and on the bo's, for the bo cache to tell when they're idle: */
+		for (i = 0; i < msm_ring->nr_bos; i++)
+			fd_bo_mark_submitted(msm_ring->bos[i], ring->pipe->timeline, req.fence);
+
 		if (out_fence_fd) {
 			*out_fence_fd = req.fence_fd;
 		}
@@ -534,21 +746,43 @@ static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start
 	for (i = 0; i < msm_ring->submit.nr_cmds; i++) {
 		struct drm_msm_gem_submit_cmd *cmd = &msm_ring->submit.cmds[i];
 		struct msm_cmd *msm_cmd = msm_ring->cmds[i];
-		if (msm_cmd->ring->flags & FD_RINGBUFFER_OBJECT) {
+		if (reloc_owner(msm_cmd) != ring) {
 			free(U642VOID(cmd->relocs));
 		}
 	}
 
 	flush_reset(ring);
+	for (i = 0; i < nr_others; i++)
+		flush_reset(others[i]);
 
 	return ret;
 }
 
+static int msm_ringbuffer_flush(struct fd_ringbuffer *ring, uint32_t *last_start,
+		int in_fence_fd, int *out_fence_fd)
+{
+	return submit_rings(ring, last_start, NULL, 0, in_fence_fd, out_fence_fd);
+}
+
+static int msm_ringbuffer_flush_group(struct fd_ringbuffer **rings,
+		uint32_t count, int in_fence_fd, int *out_fence_fd)
+{
+	return submit_rings(rings[0], rings[0]->last_start, &rings[1], count - 1,
+			in_fence_fd, out_fence_fd);
+}
+
+/* A pooled cmd may be larger than asked for, let the ring use all of it: */
+static void use_whole_cmd(struct fd_ringbuffer *ring, struct msm_cmd *cmd)
+{
+	if (cmd && cmd->is_pooled && cmd->ring_bo->size > (uint32_t)ring->size)
+		ring->size = MIN2(cmd->ring_bo->size, MAX_CMD_SIZE);
+}
+
 static void msm_ringbuffer_grow(struct fd_ringbuffer *ring, uint32_t size)
 {
 	assert(to_msm_ringbuffer(ring)->is_growable);
 	finalize_current_cmd(ring, ring->last_start);
-	ring_cmd_new(ring, size, 0);
+	use_whole_cmd(ring, ring_cmd_new(ring, size, 0));
 }
 
 static void msm_ringbuffer_reset(struct fd_ringbuffer *ring)
@@ -556,19 +790,41 @@ static void msm_ringbuffer_reset(struct fd_ringbuffer *ring)
 	flush_reset(ring);
 }
 
-static void msm_ringbuffer_emit_reloc(struct fd_ringbuffer *ring,
-		const struct fd_reloc *r)
+/* what the kernel would patch in for the reloc: */
+static uint32_t reloc_addr(uint64_t iova, int32_t shift, uint32_t or)
+{
+	if (shift < 0)
+		iova >>= -shift;
+	else
+		iova <<= shift;
+	return (uint32_t)iova | or;
+}
+
+/* emit the reloc of a bo already at bo_idx of the parent's bos table: */
+static void emit_reloc_idx(struct fd_ringbuffer *ring,
+		const struct fd_reloc *r, uint32_t bo_idx)
 {
-	struct fd_ringbuffer *parent = ring->parent ? ring->parent : ring;
 	struct msm_bo *msm_bo = to_msm_bo(r->bo);
 	struct drm_msm_gem_submit_reloc *reloc;
-	struct msm_cmd *cmd = current_cmd(ring);
-	uint32_t idx = APPEND(cmd, relocs);
+	struct msm_cmd *cmd;
+	uint32_t idx;
 	uint32_t addr;
 
+	/* with the iova known up front, just write the address: */
+	if (msm_bo->presumed_valid) {
+		uint64_t iova = msm_bo->presumed + r->offset;
+
+		(*ring->cur++) = reloc_addr(iova, r->shift, r->or);
+		if (ring->pipe->gpu_id >= 500)
+			(*ring->cur++) = reloc_addr(iova, r->shift - 32, r->orhi);
+		return;
+	}
+
+	cmd = current_cmd(ring);
+	idx = APPEND(cmd, relocs);
 	reloc = &cmd->relocs[idx];
 
-	reloc->reloc_idx = bo2idx(parent, r->bo, r->flags);
+	reloc->reloc_idx = bo_idx;
 	reloc->reloc_offset = r->offset;
 	reloc->or = r->or;
 	reloc->shift = r->shift;
@@ -610,6 +866,36 @@ static void msm_ringbuffer_emit_reloc(struct fd_ringbuffer *ring,
 	}
 }
 
+static void msm_ringbuffer_emit_reloc(struct fd_ringbuffer *ring,
+		const struct fd_reloc *r)
+{
+	struct fd_ringbuffer *parent = ring->parent ? ring->parent : ring;
+
+	emit_reloc_idx(ring, r, bo2idx(parent, r->bo, r->flags));
+}
+
+static void msm_ringbuffer_emit_relocs(struct fd_ringbuffer *ring,
+		const struct fd_reloc *relocs, uint32_t count)
+{
+	struct fd_ringbuffer *parent = ring->parent ? ring->parent : ring;
+	struct msm_ringbuffer *msm_parent = to_msm_ringbuffer(parent);
+	struct fd_bo *last_bo = NULL;
+	uint32_t i, idx = 0;
+
+	for (i = 0; i < count; i++) {
+		const struct fd_reloc *r = &relocs[i];
+
+		/* runs of relocs into the same bo only look it up once: */
+		if (r->bo != last_bo) {
+			idx = bo2idx(parent, r->bo, r->flags);
+			last_bo = r->bo;
+		} else {
+			set_bo_flags(msm_parent, idx, r->flags);
+		}
+		emit_reloc_idx(ring, r, idx);
+	}
+}
+
 static uint32_t msm_ringbuffer_emit_reloc_ring(struct fd_ringbuffer *ring,
 		struct fd_ringbuffer *target, uint32_t cmd_idx)
 {
@@ -673,6 +959,7 @@ static void msm_ringbuffer_destroy(struct fd_ringbuffer *ring)
 
 	free(msm_ring->submit.cmds);
 	free(msm_ring->submit.bos);
+	free(msm_ring->bo_table);
 	free(msm_ring->bos);
 	free(msm_ring->cmds);
 	free(msm_ring);
@@ -681,9 +968,11 @@ static void msm_ringbuffer_destroy(struct fd_ringbuffer *ring)
 static const struct fd_ringbuffer_funcs funcs = {
 		.hostptr = msm_ringbuffer_hostptr,
 		.flush = msm_ringbuffer_flush,
+		.flush_group = msm_ringbuffer_flush_group,
 		.grow = msm_ringbuffer_grow,
 		.reset = msm_ringbuffer_reset,
 		.emit_reloc = msm_ringbuffer_emit_reloc,
+		.emit_relocs = msm_ringbuffer_emit_relocs,
 		.emit_reloc_ring = msm_ringbuffer_emit_reloc_ring,
 		.cmd_count = msm_ringbuffer_cmd_count,
 		.destroy = msm_ringbuffer_destroy,
@@ -694,6 +983,7 @@ drm_private struct fd_ringbuffer * msm_ringbuffer_new(struct fd_pipe *pipe,
 {
 	struct msm_ringbuffer *msm_ring;
 	struct fd_ringbuffer *ring;
+	struct msm_cmd *cmd;
 
 	msm_ring = calloc(1, sizeof(*msm_ring));
 	if (!msm_ring) {
@@ -708,7 +998,8 @@ drm_private struct fd_ringbuffer * msm_ringbuffer_new(struct fd_pipe *pipe,
 	}
 
 	list_inithead(&msm_ring->cmd_list);
-	msm_ring->seqno = ++to_msm_device(pipe->dev)->ring_cnt;
+	msm_ring->seqno = __atomic_add_fetch(&to_msm_device(pipe->dev)->ring_cnt,
+			1, __ATOMIC_RELAXED);
 
 	ring = &msm_ring->base;
 	atomic_set(&ring->refcnt, 1);
@@ -717,7 +1008,9 @@ drm_private struct fd_ringbuffer * msm_ringbuffer_new(struct fd_pipe *pipe,
 	ring->size = size;
 	ring->pipe = pipe;   /* needed in ring_cmd_new() */
 
-	ring_cmd_new(ring, size, flags);
+	cmd = ring_cmd_new(ring, size, flags);
+	if (msm_ring->is_growable)
+		use_whole_cmd(ring, cmd);
 
 	return ring;
 }
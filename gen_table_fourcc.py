@@ -24,8 +24,10 @@
 # SOFTWARE.
 
 # Helper script that reads drm_fourcc.h and writes a static table with the
-# simpler format token modifiers
+# simpler format token modifiers, and the descriptors of the formats with
+# their perfect hash
 
+import random
 import sys
 import re
 
@@ -38,6 +40,142 @@ fm_re = {
     'vendors': r'^#define DRM_FORMAT_MOD_VENDOR_(\w+)'
 }
 
+# The layout of the formats is only described in the comments of
+# drm_fourcc.h, so it is kept here, as in the kernel's drm_format_info
+# table: (depth, cpp of each plane, hsub, vsub, has_alpha, is_yuv). The
+# formats packed in blocks of pixels have no cpp.
+Y, N = True, False
+formats = {
+    'C8':                   (8,  (1,),       1, 1, N, N),
+    'R8':                   (8,  (1,),       1, 1, N, N),
+    'R16':                  (16, (2,),       1, 1, N, N),
+    'RG88':                 (16, (2,),       1, 1, N, N),
+    'GR88':                 (16, (2,),       1, 1, N, N),
+    'RG1616':               (32, (4,),       1, 1, N, N),
+    'GR1616':               (32, (4,),       1, 1, N, N),
+    'RGB332':               (8,  (1,),       1, 1, N, N),
+    'BGR233':               (8,  (1,),       1, 1, N, N),
+    'XRGB4444':             (0,  (2,),       1, 1, N, N),
+    'XBGR4444':             (0,  (2,),       1, 1, N, N),
+    'RGBX4444':             (0,  (2,),       1, 1, N, N),
+    'BGRX4444':             (0,  (2,),       1, 1, N, N),
+    'ARGB4444':             (0,  (2,),       1, 1, Y, N),
+    'ABGR4444':             (0,  (2,),       1, 1, Y, N),
+    'RGBA4444':             (0,  (2,),       1, 1, Y, N),
+    'BGRA4444':             (0,  (2,),       1, 1, Y, N),
+    'XRGB1555':             (15, (2,),       1, 1, N, N),
+    'XBGR1555':             (15, (2,),       1, 1, N, N),
+    'RGBX5551':             (15, (2,),       1, 1, N, N),
+    'BGRX5551':             (15, (2,),       1, 1, N, N),
+    'ARGB1555':             (15, (2,),       1, 1, Y, N),
+    'ABGR1555':             (15, (2,),       1, 1, Y, N),
+    'RGBA5551':             (15, (2,),       1, 1, Y, N),
+    'BGRA5551':             (15, (2,),       1, 1, Y, N),
+    'RGB565':               (16, (2,),       1, 1, N, N),
+    'BGR565':               (16, (2,),       1, 1, N, N),
+    'RGB888':               (24, (3,),       1, 1, N, N),
+    'BGR888':               (24, (3,),       1, 1, N, N),
+    'XRGB8888':             (24, (4,),       1, 1, N, N),
+    'XBGR8888':             (24, (4,),       1, 1, N, N),
+    'RGBX8888':             (24, (4,),       1, 1, N, N),
+    'BGRX8888':             (24, (4,),       1, 1, N, N),
+    'ARGB8888':             (32, (4,),       1, 1, Y, N),
+    'ABGR8888':             (32, (4,),       1, 1, Y, N),
+    'RGBA8888':             (32, (4,),       1, 1, Y, N),
+    'BGRA8888':             (32, (4,),       1, 1, Y, N),
+    'XRGB2101010':          (30, (4,),       1, 1, N, N),
+    'XBGR2101010':          (30, (4,),       1, 1, N, N),
+    'RGBX1010102':          (30, (4,),       1, 1, N, N),
+    'BGRX1010102':          (30, (4,),       1, 1, N, N),
+    'ARGB2101010':          (30, (4,),       1, 1, Y, N),
+    'ABGR2101010':          (30, (4,),       1, 1, Y, N),
+    'RGBA1010102':          (30, (4,),       1, 1, Y, N),
+    'BGRA1010102':          (30, (4,),       1, 1, Y, N),
+    'XRGB16161616':         (0,  (8,),       1, 1, N, N),
+    'XBGR16161616':         (0,  (8,),       1, 1, N, N),
+    'ARGB16161616':         (0,  (8,),       1, 1, Y, N),
+    'ABGR16161616':         (0,  (8,),       1, 1, Y, N),
+    'XRGB16161616F':        (0,  (8,),       1, 1, N, N),
+    'XBGR16161616F':        (0,  (8,),       1, 1, N, N),
+    'ARGB16161616F':        (0,  (8,),       1, 1, Y, N),
+    'ABGR16161616F':        (0,  (8,),       1, 1, Y, N),
+    'AXBXGXRX106106106106': (0,  (8,),       1, 1, Y, N),
+    'YUYV':                 (0,  (2,),       2, 1, N, Y),
+    'YVYU':                 (0,  (2,),       2, 1, N, Y),
+    'UYVY':                 (0,  (2,),       2, 1, N, Y),
+    'VYUY':                 (0,  (2,),       2, 1, N, Y),
+    'AYUV':                 (0,  (4,),       1, 1, Y, Y),
+    'XYUV8888':             (0,  (4,),       1, 1, N, Y),
+    'VUY888':               (0,  (3,),       1, 1, N, Y),
+    'VUY101010':            (0,  (0,),       1, 1, N, Y),
+    'Y210':                 (0,  (4,),       2, 1, N, Y),
+    'Y212':                 (0,  (4,),       2, 1, N, Y),
+    'Y216':                 (0,  (4,),       2, 1, N, Y),
+    'Y410':                 (0,  (4,),       1, 1, Y, Y),
+    'Y412':                 (0,  (8,),       1, 1, Y, Y),
+    'Y416':                 (0,  (8,),       1, 1, Y, Y),
+    'XVYU2101010':          (0,  (4,),       1, 1, N, Y),
+    'XVYU12_16161616':      (0,  (8,),       1, 1, N, Y),
+    'XVYU16161616':         (0,  (8,),       1, 1, N, Y),
+    'Y0L0':                 (0,  (0,),       2, 2, Y, Y),
+    'X0L0':                 (0,  (0,),       2, 2, N, Y),
+    'Y0L2':                 (0,  (0,),       2, 2, Y, Y),
+    'X0L2':                 (0,  (0,),       2, 2, N, Y),
+    'YUV420_8BIT':          (0,  (0,),       2, 2, N, Y),
+    'YUV420_10BIT':         (0,  (0,),       2, 2, N, Y),
+    'XRGB8888_A8':          (24, (4, 1),     1, 1, Y, N),
+    'XBGR8888_A8':          (24, (4, 1),     1, 1, Y, N),
+    'RGBX8888_A8':          (24, (4, 1),     1, 1, Y, N),
+    'BGRX8888_A8':          (24, (4, 1),     1, 1, Y, N),
+    'RGB888_A8':            (32, (3, 1),     1, 1, Y, N),
+    'BGR888_A8':            (32, (3, 1),     1, 1, Y, N),
+    'RGB565_A8':            (24, (2, 1),     1, 1, Y, N),
+    'BGR565_A8':            (24, (2, 1),     1, 1, Y, N),
+    'NV12':                 (0,  (1, 2),     2, 2, N, Y),
+    'NV21':                 (0,  (1, 2),     2, 2, N, Y),
+    'NV16':                 (0,  (1, 2),     2, 1, N, Y),
+    'NV61':                 (0,  (1, 2),     2, 1, N, Y),
+    'NV24':                 (0,  (1, 2),     1, 1, N, Y),
+    'NV42':                 (0,  (1, 2),     1, 1, N, Y),
+    'NV15':                 (0,  (0, 0),     2, 2, N, Y),
+    'P210':                 (0,  (2, 4),     2, 1, N, Y),
+    'P010':                 (0,  (2, 4),     2, 2, N, Y),
+    'P012':                 (0,  (2, 4),     2, 2, N, Y),
+    'P016':                 (0,  (2, 4),     2, 2, N, Y),
+    'Q410':                 (0,  (2, 2, 2),  1, 1, N, Y),
+    'Q401':                 (0,  (2, 2, 2),  1, 1, N, Y),
+    'YUV410':               (0,  (1, 1, 1),  4, 4, N, Y),
+    'YVU410':               (0,  (1, 1, 1),  4, 4, N, Y),
+    'YUV411':               (0,  (1, 1, 1),  4, 1, N, Y),
+    'YVU411':               (0,  (1, 1, 1),  4, 1, N, Y),
+    'YUV420':               (0,  (1, 1, 1),  2, 2, N, Y),
+    'YVU420':               (0,  (1, 1, 1),  2, 2, N, Y),
+    'YUV422':               (0,  (1, 1, 1),  2, 1, N, Y),
+    'YVU422':               (0,  (1, 1, 1),  2, 1, N, Y),
+    'YUV444':               (0,  (1, 1, 1),  1, 1, N, Y),
+    'YVU444':               (0,  (1, 1, 1),  1, 1, N, Y),
+}
+
+fourcc_re = r"^#define DRM_FORMAT_(\w+)\s+fourcc_code\('(.)', *'(.)', *'(.)', *'(.)'\)"
+
+def fourcc(chars):
+    return sum(ord(c) << (8 * i) for i, c in enumerate(chars))
+
+# Find a multiplier hashing the codes to distinct slots of the smallest
+# table it can, trying the same sequence of candidates every time so that
+# the output is reproducible.
+def perfect_hash(codes):
+    bits = max(len(codes) - 1, 1).bit_length() + 1
+    rng = random.Random(0)
+    while True:
+        for _ in range(100000):
+            mul = rng.getrandbits(32) | 1
+            slots = {((code * mul) & 0xffffffff) >> (32 - bits)
+                     for code in codes}
+            if len(slots) == len(codes):
+                return mul, bits
+        bits += 1
+
 def print_fm_intel(f, f_mod):
     f.write('    {{ DRM_MODIFIER_INTEL({}, {}) }},\n'.format(f_mod, f_mod))
 
@@ -49,6 +187,15 @@ with open(filename, "r") as f:
     data = f.read()
     for k, v in fm_re.items():
         fm_re[k] = re.findall(v, data, flags=re.M)
+    fourccs = [(name, fourcc(chars)) for (name, *chars)
+               in re.findall(fourcc_re, data, flags=re.M)]
+
+for (name, code) in fourccs:
+    if name not in formats:
+        print('gen_table_fourcc.py: no descriptor for DRM_FORMAT_{}'.format(name),
+              file=sys.stderr)
+fourccs = [(name, code) for (name, code) in fourccs if name in formats]
+assert len(fourccs) < 256
 
 with open(towrite, "w") as f:
     f.write('''\
@@ -81,4 +228,37 @@ static const struct drmFormatModifierVendorInfo drm_format_modifier_vendor_table
 
     f.write('''\
 };
+''')
+
+    f.write('''\
+static const drmFormatInfo drm_format_info_table[] = {
+''')
+
+    for (name, code) in fourccs:
+        (depth, cpp, hsub, vsub, alpha, yuv) = formats[name]
+        f.write('    {{ DRM_FORMAT_{}, {}, {}, {{ {} }}, {}, {}, {}, {} }},\n'.format(
+            name, depth, len(cpp), ', '.join(str(c) for c in cpp), hsub, vsub,
+            int(alpha), int(yuv)))
+
+    f.write('''\
+};
+''')
+
+    (mul, bits) = perfect_hash([code for (name, code) in fourccs])
+    slots = [0] * (1 << bits)
+    for (index, (name, code)) in enumerate(fourccs):
+        slots[((code * mul) & 0xffffffff) >> (32 - bits)] = index + 1
+
+    f.write('''\
+/* index + 1 in drm_format_info_table of the format at its hash, or 0 */
+#define DRM_FORMAT_INFO_HASH(format) \\
+    ((uint32_t)((format) * {:#010x}u) >> {})
+static const uint8_t drm_format_info_hash[{}] = {{
+'''.format(mul, 32 - bits, len(slots)))
+
+    for i in range(0, len(slots), 16):
+        f.write('    {},\n'.format(', '.join(str(x) for x in slots[i:i + 16])))
+
+    f.write('''\
+};
 ''')
@@ -74,6 +74,8 @@ struct drm_msm_timespec {
 #define MSM_PARAM_TIMESTAMP  0x05
 #define MSM_PARAM_GMEM_BASE  0x06
 #define MSM_PARAM_NR_RINGS   0x07
+#define MSM_PARAM_VA_START   0x0e  /* RO: start of valid GPU iova range */
+#define MSM_PARAM_VA_SIZE    0x0f  /* RO: size of valid GPU iova range (bytes) */
 
 struct drm_msm_param {
 	__u32 pipe;           /* in, MSM_PIPE_x */
@@ -106,13 +108,14 @@ struct drm_msm_gem_new {
 };
 
 #define MSM_INFO_IOVA	0x01
+#define MSM_INFO_SET_IOVA	0x04	/* set the iova, passed in 'offset' */
 
-#define MSM_INFO_FLAGS (MSM_INFO_IOVA)
+#define MSM_INFO_FLAGS (MSM_INFO_IOVA | MSM_INFO_SET_IOVA)
 
 struct drm_msm_gem_info {
 	__u32 handle;         /* in */
 	__u32 flags;	      /* in - combination of MSM_INFO_* flags */
-	__u64 offset;         /* out, mmap() offset or iova */
+	__u64 offset;         /* in/out, mmap() offset or iova */
 };
 
 #define MSM_PREP_READ        0x01
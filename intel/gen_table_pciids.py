@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+
+# Copyright © 2018 Intel Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+
+# Helper script that expands the id lists of i915_pciids.h named in the
+# pciids[] table of intel_chipset.c, and writes them sorted by device id.
+# A device listed twice keeps the first, that is the latest, gen.
+
+import re
+import sys
+
+pciids_h = sys.argv[1]
+chipset_c = sys.argv[2]
+towrite = sys.argv[3]
+
+macros = {}
+with open(pciids_h, 'r') as f:
+    text = f.read().replace('\\\n', ' ')
+for m in re.finditer(r'^#define\s+(INTEL_\w+_IDS)\(info\)(.*)$', text, re.M):
+    macros[m.group(1)] = m.group(2)
+
+def expand(name, stack=()):
+    if name not in macros or name in stack:
+        sys.exit('{}: cannot expand {}'.format(pciids_h, name))
+    ids = []
+    for m in re.finditer(r'(INTEL_VGA_DEVICE\((0x[0-9a-fA-F]+),\s*info\))|'
+                         r'(INTEL_\w+_IDS)\(info\)', macros[name]):
+        if m.group(1):
+            ids.append(int(m.group(2), 16))
+        else:
+            ids.extend(expand(m.group(3), stack + (name,)))
+    return ids
+
+with open(chipset_c, 'r') as f:
+    text = f.read()
+m = re.search(r'pciids\[\] = \{(.*?)\};', text, re.S)
+if not m:
+    sys.exit('{}: no pciids[] table'.format(chipset_c))
+
+entries = {}
+for m in re.finditer(r'(INTEL_\w+_IDS)\((\d+)\)', m.group(1)):
+    for device in expand(m.group(1)):
+        entries.setdefault(device, int(m.group(2)))
+
+with open(towrite, 'w') as f:
+    f.write('''\
+/* AUTOMATICALLY GENERATED by gen_table_pciids.py. You should modify
+   intel_chipset.c or i915_pciids.h instead of adding here entries manually! */
+''')
+    f.write('static const struct pci_device pciids_sorted[] = {\n')
+    for device in sorted(entries):
+        f.write('\t{{ 0x{:04x}, {} }},\n'.format(device, entries[device]))
+    f.write('};\n')
@@ -103,6 +103,13 @@ enum aub_dump_bmp_format {
 	AUB_DUMP_BMP_FORMAT_ARGB_8888 = 7,
 };
 
+/* Mappings of a buffer, cached separately after it is unmapped. */
+enum drm_intel_vma_type {
+	DRM_INTEL_VMA_CPU,
+	DRM_INTEL_VMA_WC,
+	DRM_INTEL_VMA_GTT,
+};
+
 typedef struct _drm_intel_aub_annotation {
 	uint32_t type;
 	uint32_t subtype;
@@ -178,8 +185,71 @@ drm_intel_bo *drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 						unsigned int handle);
 void drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr);
+int drm_intel_bufmgr_gem_enable_softpin_va(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr,
 					     int limit);
+int drm_intel_bufmgr_gem_set_vma_cache_budget(drm_intel_bufmgr *bufmgr,
+					      enum drm_intel_vma_type type,
+					      uint64_t bytes);
+int drm_intel_bufmgr_gem_get_vma_cache_stats(drm_intel_bufmgr *bufmgr,
+					     enum drm_intel_vma_type type,
+					     int *mapped, int *cached,
+					     uint64_t *cached_bytes,
+					     uint64_t *evictions);
+int drm_intel_bufmgr_gem_set_vma_cache_threshold(drm_intel_bufmgr *bufmgr,
+						 uint64_t bytes);
+void drm_intel_bufmgr_gem_set_bo_cache(drm_intel_bufmgr *bufmgr,
+				       unsigned int bucket_shift,
+				       uint64_t max_size, uint64_t max_bytes,
+				       uint32_t max_age_ms);
+void drm_intel_bufmgr_gem_get_bo_cache_stats(drm_intel_bufmgr *bufmgr,
+					     uint64_t *hits, uint64_t *misses,
+					     uint64_t *evictions);
+
+/* Statistics of one bucket of the bo cache. */
+struct drm_intel_bo_cache_bucket_stats {
+	/* Buffer size of the bucket. */
+	uint64_t size;
+	/* Allocations of that size, and those served from the cache. */
+	uint64_t allocs;
+	uint64_t hits;
+	/* Misses because the cached buffers were busy, or had other flags. */
+	uint64_t busy_misses;
+	uint64_t flags_misses;
+	/* Buffers evicted for their age, and for the memory cap, a trim or
+	 * the cache being dropped. */
+	uint64_t expired;
+	uint64_t dropped;
+	/* Currently cached. */
+	uint64_t buffers;
+	uint64_t bytes;
+};
+int drm_intel_bufmgr_gem_get_bo_cache_bucket_stats(drm_intel_bufmgr *bufmgr,
+		unsigned int index, struct drm_intel_bo_cache_bucket_stats *stats);
+void drm_intel_bufmgr_gem_trim_bo_cache(drm_intel_bufmgr *bufmgr,
+					unsigned int level);
+
+/* Statistics of the live buffers of one label. */
+struct drm_intel_bo_label_stats {
+	char name[32];
+	/* Live buffers, those in the bo cache not counted. */
+	uint64_t buffers;
+	uint64_t bytes;
+	uint64_t peak_bytes;
+	/* Allocations since the bufmgr was created, and the bytes allocated
+	 * per second lately. */
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+	uint64_t alloc_rate;
+};
+int drm_intel_bufmgr_gem_get_bo_label_stats(drm_intel_bufmgr *bufmgr,
+		unsigned int index, struct drm_intel_bo_label_stats *stats);
+void drm_intel_bufmgr_gem_dump_bo_usage(drm_intel_bufmgr *bufmgr, FILE *file);
+void drm_intel_gem_bo_set_label(drm_intel_bo *bo, const char *label);
+void drm_intel_bufmgr_gem_invalidate_userptr(drm_intel_bufmgr *bufmgr,
+					     void *addr, unsigned long size);
+int drm_intel_bufmgr_gem_watch_memory_pressure(drm_intel_bufmgr *bufmgr,
+					       int enable);
 int drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo);
 int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo);
 int drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo);
@@ -196,6 +266,9 @@ void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo);
 int drm_intel_gem_bo_get_reloc_count(drm_intel_bo *bo);
 void drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start);
 void drm_intel_gem_bo_start_gtt_access(drm_intel_bo *bo, int write_enable);
+int drm_intel_gem_bo_subdata_async(drm_intel_bo *bo, unsigned long offset,
+				   unsigned long size, const void *data,
+				   int *out_fence);
 
 void
 drm_intel_bufmgr_gem_set_aub_filename(drm_intel_bufmgr *bufmgr,
@@ -229,6 +302,24 @@ int drm_intel_gem_bo_fence_exec(drm_intel_bo *bo,
 				int *out_fence,
 				unsigned int flags);
 
+/* Runs an I915_EXEC_BSD batch on the least busy video engine, or on
+ * *engine when it is 0 or 1, and returns the engine used in *engine. */
+int drm_intel_gem_bo_balanced_exec(drm_intel_bo *bo,
+				   drm_intel_context *ctx,
+				   int used,
+				   int *engine,
+				   unsigned int flags);
+
+struct drm_i915_gem_exec_fence;
+/* Waits on and signals the syncobjs of fences per their
+ * I915_EXEC_FENCE_WAIT and I915_EXEC_FENCE_SIGNAL flags. */
+int drm_intel_gem_bo_syncobj_exec(drm_intel_bo *bo,
+				  drm_intel_context *ctx,
+				  int used,
+				  const struct drm_i915_gem_exec_fence *fences,
+				  unsigned int num_fences,
+				  unsigned int flags);
+
 int drm_intel_bo_gem_export_to_prime(drm_intel_bo *bo, int *prime_fd);
 drm_intel_bo *drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr,
 						int prime_fd, int size);
@@ -266,6 +357,9 @@ void drm_intel_bo_fake_disable_backing_store(drm_intel_bo *bo,
 void drm_intel_bufmgr_fake_contended_lock_take(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_fake_evict_all(drm_intel_bufmgr *bufmgr);
 
+typedef void (*drm_intel_decode_output_func)(void *data, const char *text,
+					     size_t len);
+
 struct drm_intel_decode *drm_intel_decode_context_alloc(uint32_t devid);
 void drm_intel_decode_context_free(struct drm_intel_decode *ctx);
 void drm_intel_decode_set_batch_pointer(struct drm_intel_decode *ctx,
@@ -276,7 +370,11 @@ void drm_intel_decode_set_dump_past_end(struct drm_intel_decode *ctx,
 void drm_intel_decode_set_head_tail(struct drm_intel_decode *ctx,
 				    uint32_t head, uint32_t tail);
 void drm_intel_decode_set_output_file(struct drm_intel_decode *ctx, FILE *out);
+void drm_intel_decode_set_output_func(struct drm_intel_decode *ctx,
+				      drm_intel_decode_output_func func,
+				      void *data);
 void drm_intel_decode(struct drm_intel_decode *ctx);
+int drm_intel_decode_incremental(struct drm_intel_decode *ctx);
 
 int drm_intel_reg_read(drm_intel_bufmgr *bufmgr,
 		       uint32_t offset,
@@ -286,6 +384,11 @@ int drm_intel_get_reset_stats(drm_intel_context *ctx,
 			      uint32_t *reset_count,
 			      uint32_t *active,
 			      uint32_t *pending);
+int drm_intel_bufmgr_gem_enable_hang_capture(drm_intel_bufmgr *bufmgr,
+					     unsigned int batches,
+					     unsigned int batch_size);
+int drm_intel_bufmgr_gem_dump_hang_capture(drm_intel_bufmgr *bufmgr,
+					   FILE *file);
 
 int drm_intel_get_subslice_total(int fd, unsigned int *subslice_total);
 int drm_intel_get_eu_total(int fd, unsigned int *eu_total);
@@ -457,7 +457,8 @@ free_block(drm_intel_bufmgr_fake *bufmgr_fake, struct block *block,
 	   int skip_dirty_copy)
 {
 	drm_intel_bo_fake *bo_fake;
-	DBG("free block %p %08x %d %d\n", block, block->mem->ofs,
+	DBG("free block %p %08llx %d %d\n", block,
+	    (unsigned long long)block->mem->ofs,
 	    block->on_hardware, block->fenced);
 
 	if (!block)
@@ -600,14 +601,16 @@ clear_fenced(drm_intel_bufmgr_fake *bufmgr_fake, unsigned int fence_cookie)
 			block->fenced = 0;
 
 			if (!block->bo) {
-				DBG("delayed free: offset %x sz %x\n",
-				    block->mem->ofs, block->mem->size);
+				DBG("delayed free: offset %llx sz %llx\n",
+				    (unsigned long long)block->mem->ofs,
+				    (unsigned long long)block->mem->size);
 				DRMLISTDEL(block);
 				mmFreeMem(block->mem);
 				free(block);
 			} else {
-				DBG("return to lru: offset %x sz %x\n",
-				    block->mem->ofs, block->mem->size);
+				DBG("return to lru: offset %llx sz %llx\n",
+				    (unsigned long long)block->mem->ofs,
+				    (unsigned long long)block->mem->size);
 				DRMLISTDEL(block);
 				DRMLISTADDTAIL(block, &bufmgr_fake->lru);
 			}
@@ -617,8 +620,9 @@ clear_fenced(drm_intel_bufmgr_fake *bufmgr_fake, unsigned int fence_cookie)
 			/* Blocks are ordered by fence, so if one fails, all
 			 * from here will fail also:
 			 */
-			DBG("fence not passed: offset %x sz %x %d %d \n",
-			    block->mem->ofs, block->mem->size, block->fence,
+			DBG("fence not passed: offset %llx sz %llx %d %d \n",
+			    (unsigned long long)block->mem->ofs,
+			    (unsigned long long)block->mem->size, block->fence,
 			    bufmgr_fake->last_fence);
 			break;
 		}
@@ -634,8 +638,9 @@ fence_blocks(drm_intel_bufmgr_fake *bufmgr_fake, unsigned fence)
 	struct block *block, *tmp;
 
 	DRMLISTFOREACHSAFE(block, tmp, &bufmgr_fake->on_hardware) {
-		DBG("Fence block %p (sz 0x%x ofs %x buf %p) with fence %d\n",
-		    block, block->mem->size, block->mem->ofs, block->bo, fence);
+		DBG("Fence block %p (sz 0x%llx ofs %llx buf %p) with fence %d\n",
+		    block, (unsigned long long)block->mem->size,
+		    (unsigned long long)block->mem->ofs, block->bo, fence);
 		block->fence = fence;
 
 		block->on_hardware = 0;
@@ -1190,8 +1195,9 @@ static int
 
 	/* Upload the buffer contents if necessary */
 	if (bo_fake->dirty) {
-		DBG("Upload dirty buf %d:%s, sz %lu offset 0x%x\n", bo_fake->id,
-		    bo_fake->name, bo->size, bo_fake->block->mem->ofs);
+		DBG("Upload dirty buf %d:%s, sz %lu offset 0x%llx\n", bo_fake->id,
+		    bo_fake->name, bo->size,
+		    (unsigned long long)bo_fake->block->mem->ofs);
 
 		assert(!(bo_fake->flags & (BM_NO_BACKING_STORE | BM_PINNED)));
 
@@ -37,6 +37,7 @@
 #include <xf86drm.h>
 #include <xf86atomic.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -57,10 +58,17 @@
 #include "intel_bufmgr.h"
 #include "intel_bufmgr_priv.h"
 #include "intel_chipset.h"
+#include "mm.h"
 #include "string.h"
+#include "libsync.h"
 
 #include "i915_drm.h"
 #include "uthash.h"
+#include "util_bo_cache.h"
+#include "util_bo_labels.h"
+#include "util_grow.h"
+#include "util_mem_pressure.h"
+#include "util_trace.h"
 
 #if HAVE_VALGRIND
 #include <valgrind.h>
@@ -98,9 +106,35 @@
 
 typedef struct _drm_intel_bo_gem drm_intel_bo_gem;
 
-struct drm_intel_gem_bo_bucket {
-	drmMMListHead head;
-	unsigned long size;
+#define VMA_TYPES (DRM_INTEL_VMA_GTT + 1)
+
+/* CPU and WC mappings from this size are advised to use huge pages. */
+#define VMA_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* Bytes of each batch kept by LIBDRM_INTEL_HANG_CAPTURE */
+#define CAPTURE_BATCH_SIZE (64 * 1024)
+
+/* Batches tracked per engine to estimate its load */
+#define ENGINE_BATCHES 4
+
+/* Staging buffers of drm_intel_gem_bo_subdata_async(), larger uploads get
+ * a buffer of their own. */
+#define UPLOAD_RING_SIZE 4
+#define UPLOAD_BO_SIZE (256 * 1024)
+#define UPLOAD_ALIGNMENT 64
+
+#define XY_SRC_COPY_BLT_CMD	((2 << 29) | (0x53 << 22))
+#define BR13_ROP_COPY		(0xcc << 16)
+#define MI_BATCH_BUFFER_END	(0xa << 23)
+/* Largest DWORD aligned pitch and height of a linear 8bpp blit. */
+#define BLT_MAX_PITCH		((1 << 15) - 4)
+#define BLT_MAX_HEIGHT		((1 << 15) - 1)
+
+/* Range a userptr buffer wraps, the key of the bufmgr userptr_table */
+struct drm_intel_userptr_key {
+	uint64_t addr;
+	uint64_t size;
+	uint64_t flags;
 };
 
 typedef struct _drm_intel_bufmgr_gem {
@@ -119,25 +153,59 @@ typedef struct _drm_intel_bufmgr_gem {
 	drm_intel_bo **exec_bos;
 	int exec_size;
 	int exec_count;
+	/** Last aperture_serial given to a bo_gem */
+	atomic_t aperture_serial;
 
-	/** Array of lists of cached gem objects of power-of-two sizes */
-	struct drm_intel_gem_bo_bucket cache_bucket[14 * 4];
-	int num_buckets;
-	time_t time;
+	/** Lists of cached gem objects in buckets of their sizes */
+	struct util_bo_cache bo_cache;
+	/** Watcher trimming bo_cache under memory pressure, if enabled */
+	struct util_mem_pressure *pressure;
+
+	/** Addresses handed out to softpin the buffers, if enabled */
+	struct mem_block *va_heap;
 
 	drmMMListHead managers;
 
 	drm_intel_bo_gem *name_table;
 	drm_intel_bo_gem *handle_table;
 
-	drmMMListHead vma_cache;
-	int vma_count, vma_open, vma_max;
+	/** Unreferenced userptr buffers kept for wrapping the range again */
+	struct util_bo_cache userptr_cache;
+	drm_intel_bo_gem *userptr_table;
+
+	/** Live buffers by label, the name they were allocated with */
+	struct util_bo_labels bo_labels;
+
+	/**
+	 * Protects the mapping caches and counts below, and the mappings of
+	 * the buffers while cached. Taken after lock and the map_lock of a
+	 * buffer.
+	 */
+	pthread_mutex_t vma_lock;
+	/** Mappings of the unmapped buffers by type, oldest first */
+	drmMMListHead vma_cache[VMA_TYPES];
+	struct {
+		/** Mappings alive, cached or in use, and cached only */
+		int mapped, cached;
+		uint64_t cached_bytes;
+		/** Cached bytes before the oldest are unmapped, 0 for no limit */
+		uint64_t budget;
+		uint64_t evictions;
+	} vma[VMA_TYPES];
+	int vma_open, vma_max;
+	/** Process mapped bytes unmapping all the cached mappings, 0 for none */
+	uint64_t vma_threshold;
+	/** Set when that threshold was crossed with vma_lock held elsewhere */
+	atomic_t vma_pressure;
+	/** Ticks of drm_intel_gem_bo_close_vma(), ordering the caches */
+	uint64_t vma_stamp;
 
 	uint64_t gtt_size;
 	int available_fences;
 	int pci_device;
 	int gen;
 	unsigned int has_bsd : 1;
+	unsigned int has_bsd2 : 1;
 	unsigned int has_blt : 1;
 	unsigned int has_relaxed_fencing : 1;
 	unsigned int has_llc : 1;
@@ -146,8 +214,45 @@ typedef struct _drm_intel_bufmgr_gem {
 	unsigned int no_exec : 1;
 	unsigned int has_vebox : 1;
 	unsigned int has_exec_async : 1;
+	unsigned int has_exec_no_reloc : 1;
+	unsigned int has_exec_handle_lut : 1;
+	unsigned int has_exec_fence_array : 1;
 	bool fenced_relocs;
 
+	/** Ring of staging buffers of drm_intel_gem_bo_subdata_async() */
+	pthread_mutex_t upload_lock;
+	drm_intel_bo *upload_bo[UPLOAD_RING_SIZE];
+	unsigned int upload_index;
+	unsigned long upload_used;
+
+	/**
+	 * Ring of the last batches executed, dumped when a context hangs.
+	 * Protected by lock.
+	 */
+	struct drm_intel_gem_capture {
+		uint64_t seqno;
+		uint32_t handle, ctx_id, flags;
+		uint64_t offset;
+		/** Bytes of the batch, and of those copied into batch */
+		uint32_t batch_used, used;
+		uint32_t *batch;
+		struct drm_intel_gem_capture_target {
+			uint32_t handle;
+			uint64_t offset, size;
+		} *targets;
+		uint32_t num_targets, max_targets;
+	} *capture;
+	unsigned int capture_count, capture_next, capture_size;
+	uint64_t capture_seqno;
+
+	/** Recent batches of the BSD engines, by drm_intel_gem_bo_balanced_exec() */
+	pthread_mutex_t engine_lock;
+	struct drm_intel_gem_engine {
+		drm_intel_bo *batches[ENGINE_BATCHES];
+		unsigned int next;
+	} bsd_engines[2];
+	unsigned int bsd_next;
+
 	struct {
 		void *ptr;
 		uint32_t handle;
@@ -178,6 +283,7 @@ struct _drm_intel_bo_gem {
 
 	UT_hash_handle handle_hh;
 	UT_hash_handle name_hh;
+	UT_hash_handle userptr_hh;
 
 	/**
 	 * Index of the buffer within the validation list while preparing a
@@ -194,8 +300,6 @@ struct _drm_intel_bo_gem {
 
 	unsigned long kflags;
 
-	time_t free_time;
-
 	/** Array passed to the DRM containing relocation information. */
 	struct drm_i915_gem_relocation_entry *relocs;
 	/**
@@ -204,6 +308,8 @@ struct _drm_intel_bo_gem {
 	drm_intel_reloc_target *reloc_target_info;
 	/** Number of entries in relocs */
 	int reloc_count;
+	/** Number of entries relocs and reloc_target_info have room for */
+	uint32_t reloc_size;
 	/** Array of BOs that are referenced by this buffer and will be softpinned */
 	drm_intel_bo **softpin_target;
 	/** Number softpinned BOs that are referenced by this buffer */
@@ -222,11 +328,20 @@ struct _drm_intel_bo_gem {
 	 * objects only.
 	 */
 	void *user_virtual;
+	/**
+	 * Serializes the map and unmap functions of the buffer, which take
+	 * neither the bufmgr lock nor hold this one across the waits on the
+	 * GPU.
+	 */
+	pthread_mutex_t map_lock;
 	int map_count;
-	drmMMListHead vma_list;
+	/** Links in the bufmgr vma_cache of the mappings, when unmapped */
+	drmMMListHead vma_list[VMA_TYPES];
+	/** bufmgr vma_stamp when last unmapped */
+	uint64_t vma_stamp;
 
-	/** BO cache list */
-	drmMMListHead head;
+	/** BO cache entry */
+	struct util_bo_cache_entry cache_entry;
 
 	/**
 	 * Boolean of whether this BO and its children have been included in
@@ -264,6 +379,17 @@ struct _drm_intel_bo_gem {
 	 * Boolean of whether this buffer was allocated with userptr
 	 */
 	bool is_userptr;
+	/** Whether it is in the userptr_table, keyed by userptr_key */
+	bool userptr_cached;
+	struct drm_intel_userptr_key userptr_key;
+
+	/** Index in bufmgr_gem->bo_labels */
+	unsigned int label;
+
+	/** Softpin address from bufmgr_gem->va_heap */
+	struct mem_block *va;
+	/** Whether va made us set EXEC_OBJECT_SUPPORTS_48B_ADDRESS */
+	bool va_48b;
 
 	/**
 	 * Size in bytes of this buffer and its relocation descendents.
@@ -273,12 +399,29 @@ struct _drm_intel_bo_gem {
 	 */
 	int reloc_tree_size;
 
+	/** Size in bytes of this buffer with its worst-case alignment. */
+	unsigned int in_aperture_size;
+
 	/**
 	 * Number of potential fence registers required by this buffer and its
 	 * relocations.
 	 */
 	int reloc_tree_fences;
 
+	/**
+	 * Running totals of the aperture space and the fences needed by this
+	 * buffer and its relocation tree, counting each buffer once.
+	 *
+	 * Kept as relocations are added for the tree numbered
+	 * aperture_serial, 0 when it has none yet. The buffers counted in it
+	 * have that aperture_mark. A buffer in trees built at the same time
+	 * may be counted twice, which only makes the totals conservative.
+	 */
+	unsigned int aperture_serial;
+	unsigned int aperture_mark;
+	unsigned int aperture_size;
+	unsigned int aperture_fences;
+
 	/** Flags that we may need to do the SW_FINISH ioctl on unmap. */
 	bool mapped_cpu_write;
 };
@@ -299,7 +442,7 @@ drm_intel_gem_bo_set_tiling_internal(drm_intel_bo *bo,
 				     uint32_t stride);
 
 static void drm_intel_gem_bo_unreference_locked_timed(drm_intel_bo *bo,
-						      time_t time);
+						      uint64_t time);
 
 static void drm_intel_gem_bo_unreference(drm_intel_bo *bo);
 
@@ -310,6 +453,62 @@ static inline drm_intel_bo_gem *to_bo_gem(drm_intel_bo *bo)
         return (drm_intel_bo_gem *)bo;
 }
 
+static void
+drm_intel_gem_bo_release_va(drm_intel_bo_gem *bo_gem)
+{
+	if (!bo_gem->va)
+		return;
+
+	mmFreeMem(bo_gem->va);
+	bo_gem->va = NULL;
+	bo_gem->kflags &= ~EXEC_OBJECT_PINNED;
+	if (bo_gem->va_48b)
+		bo_gem->kflags &= ~EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+	bo_gem->va_48b = false;
+}
+
+/**
+ * Softpins the buffer at an address of its own when the heap is enabled and
+ * has room, so that execbuf never needs to relocate it.  Otherwise it stays
+ * relocated by the kernel.  Called with the lock held.
+ */
+static void
+drm_intel_gem_bo_assign_va(drm_intel_bufmgr_gem *bufmgr_gem,
+			   drm_intel_bo_gem *bo_gem)
+{
+	drm_intel_bo *bo = &bo_gem->bo;
+	uint64_t alignment = bo->align > 4096 ? bo->align : 4096;
+
+	if (!bufmgr_gem->va_heap)
+		return;
+
+	/* A buffer out of the cache keeps its address, unless it is asked
+	 * for a larger alignment now.
+	 */
+	if (bo_gem->va && (bo_gem->va->ofs & (alignment - 1)))
+		drm_intel_gem_bo_release_va(bo_gem);
+
+	if (!bo_gem->va) {
+		if (bo_gem->kflags & EXEC_OBJECT_PINNED)
+			return;
+
+		bo_gem->va = mmAllocMem(bufmgr_gem->va_heap,
+					ROUND_UP_TO(bo->size, 4096),
+					ffsll(alignment) - 1, 0);
+		if (!bo_gem->va)
+			return;
+	}
+
+	bo->offset64 = bo_gem->va->ofs;
+	bo->offset = bo_gem->va->ofs;
+	bo_gem->kflags |= EXEC_OBJECT_PINNED;
+	if (bo_gem->va->ofs + bo_gem->va->size > 1ull << 32 &&
+	    !(bo_gem->kflags & EXEC_OBJECT_SUPPORTS_48B_ADDRESS)) {
+		bo_gem->kflags |= EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
+		bo_gem->va_48b = true;
+	}
+}
+
 static unsigned long
 drm_intel_gem_bo_tile_size(drm_intel_bufmgr_gem *bufmgr_gem, unsigned long size,
 			   uint32_t *tiling_mode)
@@ -392,23 +591,6 @@ drm_intel_gem_bo_tile_pitch(drm_intel_bufmgr_gem *bufmgr_gem,
 	return i;
 }
 
-static struct drm_intel_gem_bo_bucket *
-drm_intel_gem_bo_bucket_for_size(drm_intel_bufmgr_gem *bufmgr_gem,
-				 unsigned long size)
-{
-	int i;
-
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
-	}
-
-	return NULL;
-}
-
 static void
 drm_intel_gem_dump_validation_list(drm_intel_bufmgr_gem *bufmgr_gem)
 {
@@ -491,17 +673,17 @@ drm_intel_add_validate_buffer(drm_intel_bo *bo)
 
 	/* Extend the array of validation entries as necessary. */
 	if (bufmgr_gem->exec_count == bufmgr_gem->exec_size) {
-		int new_size = bufmgr_gem->exec_size * 2;
-
-		if (new_size == 0)
-			new_size = 5;
+		uint32_t new_size = bufmgr_gem->exec_size;
 
 		bufmgr_gem->exec_objects =
-		    realloc(bufmgr_gem->exec_objects,
-			    sizeof(*bufmgr_gem->exec_objects) * new_size);
+		    util_grow_array(bufmgr_gem->exec_objects, &new_size,
+				    bufmgr_gem->exec_count + 1,
+				    sizeof(*bufmgr_gem->exec_objects));
+		new_size = bufmgr_gem->exec_size;
 		bufmgr_gem->exec_bos =
-		    realloc(bufmgr_gem->exec_bos,
-			    sizeof(*bufmgr_gem->exec_bos) * new_size);
+		    util_grow_array(bufmgr_gem->exec_bos, &new_size,
+				    bufmgr_gem->exec_count + 1,
+				    sizeof(*bufmgr_gem->exec_bos));
 		bufmgr_gem->exec_size = new_size;
 	}
 
@@ -536,17 +718,17 @@ drm_intel_add_validate_buffer2(drm_intel_bo *bo, int need_fence)
 
 	/* Extend the array of validation entries as necessary. */
 	if (bufmgr_gem->exec_count == bufmgr_gem->exec_size) {
-		int new_size = bufmgr_gem->exec_size * 2;
-
-		if (new_size == 0)
-			new_size = 5;
+		uint32_t new_size = bufmgr_gem->exec_size;
 
 		bufmgr_gem->exec2_objects =
-			realloc(bufmgr_gem->exec2_objects,
-				sizeof(*bufmgr_gem->exec2_objects) * new_size);
+			util_grow_array(bufmgr_gem->exec2_objects, &new_size,
+					bufmgr_gem->exec_count + 1,
+					sizeof(*bufmgr_gem->exec2_objects));
+		new_size = bufmgr_gem->exec_size;
 		bufmgr_gem->exec_bos =
-			realloc(bufmgr_gem->exec_bos,
-				sizeof(*bufmgr_gem->exec_bos) * new_size);
+			util_grow_array(bufmgr_gem->exec_bos, &new_size,
+					bufmgr_gem->exec_count + 1,
+					sizeof(*bufmgr_gem->exec_bos));
 		bufmgr_gem->exec_size = new_size;
 	}
 
@@ -602,36 +784,40 @@ drm_intel_bo_gem_set_in_aperture_size(drm_intel_bufmgr_gem *bufmgr_gem,
 		alignment = MAX2(alignment, min_size);
 	}
 
-	bo_gem->reloc_tree_size = size + alignment;
+	bo_gem->in_aperture_size = size + alignment;
+	bo_gem->reloc_tree_size = bo_gem->in_aperture_size;
 }
 
 static int
-drm_intel_setup_reloc_list(drm_intel_bo *bo)
+drm_intel_grow_reloc_list(drm_intel_bo *bo)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
-	unsigned int max_relocs = bufmgr_gem->max_relocs;
-
-	if (bo->size / 4 < max_relocs)
-		max_relocs = bo->size / 4;
-
-	bo_gem->relocs = malloc(max_relocs *
-				sizeof(struct drm_i915_gem_relocation_entry));
-	bo_gem->reloc_target_info = malloc(max_relocs *
-					   sizeof(drm_intel_reloc_target));
-	if (bo_gem->relocs == NULL || bo_gem->reloc_target_info == NULL) {
-		bo_gem->has_error = true;
+	uint32_t size = bo_gem->reloc_size;
+	void *relocs, *reloc_target_info;
 
-		free (bo_gem->relocs);
-		bo_gem->relocs = NULL;
-
-		free (bo_gem->reloc_target_info);
-		bo_gem->reloc_target_info = NULL;
+	/* Batches mostly take a few dozen relocs, so start small and grow
+	 * rather than allocating max_relocs for every buffer.
+	 */
+	relocs = util_grow_array(bo_gem->relocs, &size, bo_gem->reloc_count + 1,
+				 sizeof(struct drm_i915_gem_relocation_entry));
+	if (relocs == NULL)
+		goto err;
+	bo_gem->relocs = relocs;
 
-		return 1;
-	}
+	size = bo_gem->reloc_size;
+	reloc_target_info = util_grow_array(bo_gem->reloc_target_info, &size,
+					    bo_gem->reloc_count + 1,
+					    sizeof(drm_intel_reloc_target));
+	if (reloc_target_info == NULL)
+		goto err;
+	bo_gem->reloc_target_info = reloc_target_info;
+	bo_gem->reloc_size = size;
 
 	return 0;
+
+err:
+	bo_gem->has_error = true;
+	return 1;
 }
 
 static int
@@ -681,25 +867,154 @@ drm_intel_gem_bo_madvise(drm_intel_bo *bo, int madv)
 		 madv);
 }
 
+static void
+drm_intel_gem_bo_init_vma(drm_intel_bo_gem *bo_gem)
+{
+	int type;
+
+	pthread_mutex_init(&bo_gem->map_lock, NULL);
+	for (type = 0; type < VMA_TYPES; type++)
+		DRMINITLISTHEAD(&bo_gem->vma_list[type]);
+}
+
+static void **
+drm_intel_gem_bo_vma(drm_intel_bo_gem *bo_gem, int type)
+{
+	switch (type) {
+	case DRM_INTEL_VMA_CPU:
+		return &bo_gem->mem_virtual;
+	case DRM_INTEL_VMA_WC:
+		return &bo_gem->wc_virtual;
+	default:
+		return &bo_gem->gtt_virtual;
+	}
+}
+
+/* Account a mapping just created by one of the map functions. */
+static void
+drm_intel_gem_bo_add_vma(drm_intel_bufmgr_gem *bufmgr_gem,
+			 drm_intel_bo_gem *bo_gem, int type)
+{
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
+	bufmgr_gem->vma[type].mapped++;
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+
+	/* drm_mmap() already accounted the GTT ones, the kernel created the
+	 * others. */
+	if (type != DRM_INTEL_VMA_GTT)
+		drmMapTrack(bufmgr_gem->fd, *drm_intel_gem_bo_vma(bo_gem, type),
+			    bo_gem->bo.size);
+
+#ifdef MADV_HUGEPAGE
+	/* The GTT mappings are faulted in through the aperture, but the CPU
+	 * ones are shmem pages that the kernel may back with huge pages, which
+	 * saves most of the page faults and TLB misses of the large buffers
+	 * over the lifetime of the cached mapping.
+	 */
+	if (type != DRM_INTEL_VMA_GTT && bo_gem->bo.size >= VMA_HUGEPAGE_SIZE)
+		madvise(*drm_intel_gem_bo_vma(bo_gem, type), bo_gem->bo.size,
+			MADV_HUGEPAGE);
+#endif
+}
+
+static void
+drm_intel_gem_bo_unmap_vma(drm_intel_bufmgr_gem *bufmgr_gem,
+			   drm_intel_bo_gem *bo_gem, int type)
+{
+	void **virtual = drm_intel_gem_bo_vma(bo_gem, type);
+
+	if (!*virtual)
+		return;
+
+	if (!DRMLISTEMPTY(&bo_gem->vma_list[type])) {
+		DRMLISTDELINIT(&bo_gem->vma_list[type]);
+		bufmgr_gem->vma[type].cached--;
+		bufmgr_gem->vma[type].cached_bytes -= bo_gem->bo.size;
+	}
+	if (type != DRM_INTEL_VMA_GTT) {
+		VG(VALGRIND_FREELIKE_BLOCK(*virtual, 0));
+	}
+	drm_munmap(*virtual, bo_gem->bo.size);
+	*virtual = NULL;
+	bufmgr_gem->vma[type].mapped--;
+}
+
 /* drop the oldest entries that have been purged by the kernel */
 static void
 drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
-				    struct drm_intel_gem_bo_bucket *bucket)
+				    struct util_bo_cache_bucket *bucket)
 {
-	while (!DRMLISTEMPTY(&bucket->head)) {
+	while (!DRMLISTEMPTY(&bucket->list)) {
 		drm_intel_bo_gem *bo_gem;
 
 		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-				      bucket->head.next, head);
+				      bucket->list.next, cache_entry.bucket_link);
 		if (drm_intel_gem_bo_madvise_internal
 		    (bufmgr_gem, bo_gem, I915_MADV_DONTNEED))
 			break;
 
-		DRMLISTDEL(&bo_gem->head);
+		util_bo_cache_remove(&bo_gem->cache_entry);
 		drm_intel_gem_bo_free(&bo_gem->bo);
 	}
 }
 
+/* Take the cached buffer of a bucket to reuse for the tiling asked for, with
+ * the lock held.  Only buffers already of that tiling and stride are looked
+ * at, since changing it on reuse means a set_tiling ioctl, which may unbind
+ * the buffer, steal its fence register and zap its GTT mmaps.
+ *
+ * Render targets are taken from the tail (MRU) of the list, as they will
+ * likely be hot in the GPU cache and in the aperture for us.  Other buffers
+ * are probably going to be mapped first thing in order to fill them with
+ * data, so the oldest one is only reused if it is unbusy: allocating a new
+ * buffer is probably faster than waiting for the GPU to finish.
+ */
+static drm_intel_bo_gem *
+drm_intel_gem_bo_cache_find(struct util_bo_cache_bucket *bucket,
+			    bool for_render, uint32_t tiling_mode,
+			    unsigned long stride, enum util_bo_cache_miss *miss)
+{
+	struct list_head *link;
+	drm_intel_bo_gem *bo_gem;
+
+	*miss = UTIL_BO_CACHE_MISS_EMPTY;
+	for (link = for_render ? bucket->list.prev : bucket->list.next;
+	     link != &bucket->list;
+	     link = for_render ? link->prev : link->next) {
+		bo_gem = DRMLISTENTRY(drm_intel_bo_gem, link,
+				      cache_entry.bucket_link);
+		/* The kernel keeps no stride for untiled buffers. */
+		if (bo_gem->tiling_mode != tiling_mode ||
+		    (tiling_mode != I915_TILING_NONE &&
+		     bo_gem->stride != stride)) {
+			*miss = UTIL_BO_CACHE_MISS_FLAGS;
+			continue;
+		}
+
+		/* If the oldest one is still busy, the younger ones are too. */
+		if (!for_render && drm_intel_gem_bo_busy(&bo_gem->bo)) {
+			*miss = UTIL_BO_CACHE_MISS_BUSY;
+			return NULL;
+		}
+
+		util_bo_cache_take(&bo_gem->cache_entry);
+		return bo_gem;
+	}
+
+	return NULL;
+}
+
+/* Account a buffer just allocated or reused, under the label of its name. */
+static void
+drm_intel_gem_bo_label_alloc(drm_intel_bufmgr_gem *bufmgr_gem,
+			     drm_intel_bo_gem *bo_gem)
+{
+	bo_gem->label = util_bo_labels_find(&bufmgr_gem->bo_labels,
+					    bo_gem->name);
+	util_bo_labels_alloc(&bufmgr_gem->bo_labels, bo_gem->label, 0,
+			     bo_gem->bo.size);
+}
+
 static drm_intel_bo *
 drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 				const char *name,
@@ -713,7 +1028,8 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 	drm_intel_bo_gem *bo_gem;
 	unsigned int page_size = getpagesize();
 	int ret;
-	struct drm_intel_gem_bo_bucket *bucket;
+	struct util_bo_cache_bucket *bucket;
+	enum util_bo_cache_miss miss;
 	bool alloc_from_cache;
 	unsigned long bo_size;
 	bool for_render = false;
@@ -722,7 +1038,7 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 		for_render = true;
 
 	/* Round the allocated size up to a power of two number of pages. */
-	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, size);
+	bucket = util_bo_cache_get_bucket(&bufmgr_gem->bo_cache, size);
 
 	/* If we don't have caching at this size, don't actually round the
 	 * allocation up.
@@ -739,35 +1055,17 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 	/* Get a buffer out of the cache if available */
 retry:
 	alloc_from_cache = false;
-	if (bucket != NULL && !DRMLISTEMPTY(&bucket->head)) {
-		if (for_render) {
-			/* Allocate new render-target BOs from the tail (MRU)
-			 * of the list, as it will likely be hot in the GPU
-			 * cache and in the aperture for us.
-			 */
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.prev, head);
-			DRMLISTDEL(&bo_gem->head);
+	miss = UTIL_BO_CACHE_MISS_EMPTY;
+	if (bucket != NULL && !DRMLISTEMPTY(&bucket->list)) {
+		assert(for_render || alignment == 0);
+		bo_gem = drm_intel_gem_bo_cache_find(bucket, for_render,
+						     tiling_mode, stride,
+						     &miss);
+		if (bo_gem) {
 			alloc_from_cache = true;
-			bo_gem->bo.align = alignment;
-		} else {
-			assert(alignment == 0);
-			/* For non-render-target BOs (where we're probably
-			 * going to map it first thing in order to fill it
-			 * with data), check if the last BO in the cache is
-			 * unbusy, and only reuse in that case. Otherwise,
-			 * allocating a new buffer is probably faster than
-			 * waiting for the GPU to finish.
-			 */
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			if (!drm_intel_gem_bo_busy(&bo_gem->bo)) {
-				alloc_from_cache = true;
-				DRMLISTDEL(&bo_gem->head);
-			}
-		}
+			if (for_render)
+				bo_gem->bo.align = alignment;
 
-		if (alloc_from_cache) {
 			if (!drm_intel_gem_bo_madvise_internal
 			    (bufmgr_gem, bo_gem, I915_MADV_WILLNEED)) {
 				drm_intel_gem_bo_free(&bo_gem->bo);
@@ -775,26 +1073,28 @@ retry:
 								    bucket);
 				goto retry;
 			}
-
-			if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
-								 tiling_mode,
-								 stride)) {
-				drm_intel_gem_bo_free(&bo_gem->bo);
-				goto retry;
-			}
 		}
 	}
 
 	if (!alloc_from_cache) {
 		struct drm_i915_gem_create create;
 
+		if (bucket != NULL)
+			util_bo_cache_bucket_miss(&bufmgr_gem->bo_cache,
+						  bucket, miss);
+
+		/* The new buffer is ours alone until it is in the handle
+		 * table, so create it without the lock.
+		 */
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+
 		bo_gem = calloc(1, sizeof(*bo_gem));
 		if (!bo_gem)
-			goto err;
+			return NULL;
 
-		/* drm_intel_gem_bo_free calls DRMLISTDEL() for an uninitialized
-		   list (vma_list), so better set the list head here */
-		DRMINITLISTHEAD(&bo_gem->vma_list);
+		/* drm_intel_gem_bo_free walks the mappings for an uninitialized
+		   list (vma_list), so better set the list heads here */
+		drm_intel_gem_bo_init_vma(bo_gem);
 
 		bo_gem->bo.size = bo_size;
 
@@ -805,15 +1105,12 @@ retry:
 			       DRM_IOCTL_I915_GEM_CREATE,
 			       &create);
 		if (ret != 0) {
+			pthread_mutex_destroy(&bo_gem->map_lock);
 			free(bo_gem);
-			goto err;
+			return NULL;
 		}
 
 		bo_gem->gem_handle = create.handle;
-		HASH_ADD(handle_hh, bufmgr_gem->handle_table,
-			 gem_handle, sizeof(bo_gem->gem_handle),
-			 bo_gem);
-
 		bo_gem->bo.handle = bo_gem->gem_handle;
 		bo_gem->bo.bufmgr = bufmgr;
 		bo_gem->bo.align = alignment;
@@ -822,9 +1119,15 @@ retry:
 		bo_gem->swizzle_mode = I915_BIT_6_SWIZZLE_NONE;
 		bo_gem->stride = 0;
 
-		if (drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
-							 tiling_mode,
-							 stride))
+		ret = drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
+							   tiling_mode,
+							   stride);
+
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		HASH_ADD(handle_hh, bufmgr_gem->handle_table,
+			 gem_handle, sizeof(bo_gem->gem_handle),
+			 bo_gem);
+		if (ret)
 			goto err_free;
 	}
 
@@ -836,9 +1139,15 @@ retry:
 	bo_gem->has_error = false;
 	bo_gem->reusable = true;
 
+	drm_intel_gem_bo_assign_va(bufmgr_gem, bo_gem);
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, alignment);
+	drm_intel_gem_bo_label_alloc(bufmgr_gem, bo_gem);
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
+	UTIL_TRACE_EVENT(alloc_from_cache ? "bo_cache_hit" : "bo_create",
+			 "i915 handle=%u size=%lu", bo_gem->gem_handle,
+			 bo_gem->bo.size);
+
 	DBG("bo_create: buf %d (%s) %ldb\n",
 	    bo_gem->gem_handle, bo_gem->name, size);
 
@@ -846,7 +1155,6 @@ retry:
 
 err_free:
 	drm_intel_gem_bo_free(&bo_gem->bo);
-err:
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 	return NULL;
 }
@@ -938,6 +1246,7 @@ drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
 	drm_intel_bo_gem *bo_gem;
 	int ret;
 	struct drm_i915_gem_userptr userptr;
+	struct drm_intel_userptr_key key;
 
 	/* Tiling with userptr surfaces is not supported
 	 * on all hardware so refuse it for time being.
@@ -945,12 +1254,48 @@ drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
 	if (tiling_mode != I915_TILING_NONE)
 		return NULL;
 
+	memclear(key);
+	key.addr = (uintptr_t)addr;
+	key.size = size;
+	key.flags = flags;
+
+	/* Wrap the range again with the buffer it was last wrapped in, whose
+	 * pages the kernel keeps pinned until the range is unmapped.
+	 */
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	HASH_FIND(userptr_hh, bufmgr_gem->userptr_table,
+		  &key, sizeof(key), bo_gem);
+	if (bo_gem) {
+		HASH_DELETE(userptr_hh, bufmgr_gem->userptr_table, bo_gem);
+		bo_gem->userptr_cached = false;
+		util_bo_cache_take(&bo_gem->cache_entry);
+
+		atomic_set(&bo_gem->refcount, 1);
+		bo_gem->bo.virtual = addr;
+		bo_gem->name = name;
+		bo_gem->reloc_tree_fences = 0;
+		bo_gem->used_as_reloc_target = false;
+		bo_gem->has_error = false;
+		drm_intel_gem_bo_assign_va(bufmgr_gem, bo_gem);
+		drm_intel_gem_bo_label_alloc(bufmgr_gem, bo_gem);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+
+		UTIL_TRACE_EVENT("bo_cache_hit", "i915 handle=%u size=%lu",
+				 bo_gem->gem_handle, bo_gem->bo.size);
+		DBG("bo_create_userptr: reused buf %d for ptr %p size %ldb\n",
+		    bo_gem->gem_handle, addr, size);
+		return &bo_gem->bo;
+	}
+	if (bufmgr_gem->bo_reuse)
+		util_bo_cache_miss(&bufmgr_gem->userptr_cache);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
 	bo_gem = calloc(1, sizeof(*bo_gem));
 	if (!bo_gem)
 		return NULL;
 
 	atomic_set(&bo_gem->refcount, 1);
-	DRMINITLISTHEAD(&bo_gem->vma_list);
+	drm_intel_gem_bo_init_vma(bo_gem);
 
 	bo_gem->bo.size = size;
 
@@ -992,11 +1337,19 @@ drm_intel_gem_bo_alloc_userptr(drm_intel_bufmgr *bufmgr,
 	bo_gem->reloc_tree_fences = 0;
 	bo_gem->used_as_reloc_target = false;
 	bo_gem->has_error = false;
-	bo_gem->reusable = false;
+	/* Without the MMU notifier, the kernel would keep the pages of the
+	 * range after it is unmapped. */
+	bo_gem->reusable = !(flags & I915_USERPTR_UNSYNCHRONIZED);
+	bo_gem->userptr_key = key;
 
+	drm_intel_gem_bo_assign_va(bufmgr_gem, bo_gem);
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
+	drm_intel_gem_bo_label_alloc(bufmgr_gem, bo_gem);
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
+	UTIL_TRACE_EVENT("bo_create", "i915 handle=%u size=%lu",
+			 bo_gem->gem_handle, bo_gem->bo.size);
+
 	DBG("bo_create_userptr: "
 	    "ptr %p buf %d (%s) size %ldb, stride 0x%x, tile mode %d\n",
 		addr, bo_gem->gem_handle, bo_gem->name,
@@ -1148,7 +1501,7 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 		goto out;
 
 	atomic_set(&bo_gem->refcount, 1);
-	DRMINITLISTHEAD(&bo_gem->vma_list);
+	drm_intel_gem_bo_init_vma(bo_gem);
 
 	bo_gem->bo.size = open_arg.size;
 	bo_gem->bo.offset = 0;
@@ -1173,7 +1526,11 @@ drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 		goto err_unref;
 
 	/* XXX stride is unknown */
+	drm_intel_gem_bo_assign_va(bufmgr_gem, bo_gem);
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
+	drm_intel_gem_bo_label_alloc(bufmgr_gem, bo_gem);
+	UTIL_TRACE_EVENT("bo_import", "i915 handle=%u size=%lu", handle,
+			 bo_gem->bo.size);
 	DBG("bo_create_from_handle: %d (%s)\n", handle, bo_gem->name);
 
 out:
@@ -1192,27 +1549,19 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	struct drm_gem_close close;
-	int ret;
+	int ret, type;
 
-	DRMLISTDEL(&bo_gem->vma_list);
-	if (bo_gem->mem_virtual) {
-		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->mem_virtual, 0));
-		drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
-		bufmgr_gem->vma_count--;
-	}
-	if (bo_gem->wc_virtual) {
-		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->wc_virtual, 0));
-		drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
-		bufmgr_gem->vma_count--;
-	}
-	if (bo_gem->gtt_virtual) {
-		drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
-		bufmgr_gem->vma_count--;
-	}
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
+	for (type = 0; type < VMA_TYPES; type++)
+		drm_intel_gem_bo_unmap_vma(bufmgr_gem, bo_gem, type);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 
 	if (bo_gem->global_name)
 		HASH_DELETE(name_hh, bufmgr_gem->name_table, bo_gem);
+	if (bo_gem->userptr_cached)
+		HASH_DELETE(userptr_hh, bufmgr_gem->userptr_table, bo_gem);
 	HASH_DELETE(handle_hh, bufmgr_gem->handle_table, bo_gem);
+	drm_intel_gem_bo_release_va(bo_gem);
 
 	/* Close this object */
 	memclear(close);
@@ -1222,6 +1571,7 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 		DBG("DRM_IOCTL_GEM_CLOSE %d failed (%s): %s\n",
 		    bo_gem->gem_handle, bo_gem->name, strerror(errno));
 	}
+	pthread_mutex_destroy(&bo_gem->map_lock);
 	free(bo);
 }
 
@@ -1242,112 +1592,179 @@ drm_intel_gem_bo_mark_mmaps_incoherent(drm_intel_bo *bo)
 #endif
 }
 
-/** Frees all cached buffers significantly older than @time. */
+/** Frees all cached buffers past the cache's age or size limit at @time. */
 static void
-drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
+drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, uint64_t time)
 {
-	int i;
+	struct util_bo_cache_entry *entry;
 
-	if (bufmgr_gem->time == time)
-		return;
+	while ((entry = util_bo_cache_evict(&bufmgr_gem->bo_cache, time)) ||
+	       (entry = util_bo_cache_evict(&bufmgr_gem->userptr_cache, time))) {
+		drm_intel_bo_gem *bo_gem =
+			DRMLISTENTRY(drm_intel_bo_gem, entry, cache_entry);
 
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
+		drm_intel_gem_bo_free(&bo_gem->bo);
+	}
+}
 
-		while (!DRMLISTEMPTY(&bucket->head)) {
-			drm_intel_bo_gem *bo_gem;
+/* Oldest cached mapping of any type, or -1 when none is cached. */
+static int
+drm_intel_gem_oldest_vma(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	uint64_t stamp = UINT64_MAX;
+	int type, oldest = -1;
 
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			if (time - bo_gem->free_time <= 1)
-				break;
+	for (type = 0; type < VMA_TYPES; type++) {
+		drm_intel_bo_gem *bo_gem;
 
-			DRMLISTDEL(&bo_gem->head);
+		if (DRMLISTEMPTY(&bufmgr_gem->vma_cache[type]))
+			continue;
 
-			drm_intel_gem_bo_free(&bo_gem->bo);
+		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+				      bufmgr_gem->vma_cache[type].next,
+				      vma_list[type]);
+		if (bo_gem->vma_stamp < stamp) {
+			stamp = bo_gem->vma_stamp;
+			oldest = type;
 		}
 	}
+	return oldest;
+}
 
-	bufmgr_gem->time = time;
+static void
+drm_intel_gem_evict_vma(drm_intel_bufmgr_gem *bufmgr_gem, int type)
+{
+	drm_intel_bo_gem *bo_gem;
+
+	bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+			      bufmgr_gem->vma_cache[type].next,
+			      vma_list[type]);
+	assert(bo_gem->map_count == 0);
+	drm_intel_gem_bo_unmap_vma(bufmgr_gem, bo_gem, type);
+	bufmgr_gem->vma[type].evictions++;
 }
 
-static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
+/**
+ * Unmaps the oldest cached mappings of each type past the budget of the
+ * type, then the oldest of any type while the mappings alive, cached or
+ * not, and the reserve ones about to be created exceed vma_max.
+ *
+ * Only the mapping over the limit goes, so the GTT mappings of a buffer
+ * survive the churn of its CPU mappings and conversely. Called with
+ * vma_lock held.
+ */
+static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem,
+					     int reserve)
 {
-	int limit;
+	int type, mapped = 0;
+
+	DBG("%s: open=%d, limit=%d\n", __FUNCTION__,
+	    bufmgr_gem->vma_open, bufmgr_gem->vma_max);
 
-	DBG("%s: cached=%d, open=%d, limit=%d\n", __FUNCTION__,
-	    bufmgr_gem->vma_count, bufmgr_gem->vma_open, bufmgr_gem->vma_max);
+	if (atomic_read(&bufmgr_gem->vma_pressure)) {
+		atomic_set(&bufmgr_gem->vma_pressure, 0);
+		while ((type = drm_intel_gem_oldest_vma(bufmgr_gem)) >= 0)
+			drm_intel_gem_evict_vma(bufmgr_gem, type);
+	}
+
+	for (type = 0; type < VMA_TYPES; type++) {
+		uint64_t budget = bufmgr_gem->vma[type].budget;
+
+		while (budget && bufmgr_gem->vma[type].cached_bytes > budget)
+			drm_intel_gem_evict_vma(bufmgr_gem, type);
+		mapped += bufmgr_gem->vma[type].mapped;
+	}
 
 	if (bufmgr_gem->vma_max < 0)
 		return;
 
 	/* We may need to evict a few entries in order to create new mmaps */
-	limit = bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open;
-	if (limit < 0)
-		limit = 0;
-
-	while (bufmgr_gem->vma_count > limit) {
-		drm_intel_bo_gem *bo_gem;
-
-		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-				      bufmgr_gem->vma_cache.next,
-				      vma_list);
-		assert(bo_gem->map_count == 0);
-		DRMLISTDELINIT(&bo_gem->vma_list);
-
-		if (bo_gem->mem_virtual) {
-			drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
-			bo_gem->mem_virtual = NULL;
-			bufmgr_gem->vma_count--;
-		}
-		if (bo_gem->wc_virtual) {
-			drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
-			bo_gem->wc_virtual = NULL;
-			bufmgr_gem->vma_count--;
-		}
-		if (bo_gem->gtt_virtual) {
-			drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
-			bo_gem->gtt_virtual = NULL;
-			bufmgr_gem->vma_count--;
-		}
+	while (mapped + reserve > bufmgr_gem->vma_max) {
+		type = drm_intel_gem_oldest_vma(bufmgr_gem);
+		if (type < 0)
+			break;
+		drm_intel_gem_evict_vma(bufmgr_gem, type);
+		mapped--;
 	}
 }
 
 static void drm_intel_gem_bo_close_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 				       drm_intel_bo_gem *bo_gem)
 {
+	int type;
+
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 	bufmgr_gem->vma_open--;
-	DRMLISTADDTAIL(&bo_gem->vma_list, &bufmgr_gem->vma_cache);
-	if (bo_gem->mem_virtual)
-		bufmgr_gem->vma_count++;
-	if (bo_gem->wc_virtual)
-		bufmgr_gem->vma_count++;
-	if (bo_gem->gtt_virtual)
-		bufmgr_gem->vma_count++;
-	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	bo_gem->vma_stamp = bufmgr_gem->vma_stamp++;
+	for (type = 0; type < VMA_TYPES; type++) {
+		if (!*drm_intel_gem_bo_vma(bo_gem, type))
+			continue;
+		DRMLISTADDTAIL(&bo_gem->vma_list[type],
+			       &bufmgr_gem->vma_cache[type]);
+		bufmgr_gem->vma[type].cached++;
+		bufmgr_gem->vma[type].cached_bytes += bo_gem->bo.size;
+	}
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem, 0);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
 }
 
 static void drm_intel_gem_bo_open_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 				      drm_intel_bo_gem *bo_gem)
 {
+	int type;
+
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 	bufmgr_gem->vma_open++;
-	DRMLISTDEL(&bo_gem->vma_list);
-	if (bo_gem->mem_virtual)
-		bufmgr_gem->vma_count--;
-	if (bo_gem->wc_virtual)
-		bufmgr_gem->vma_count--;
-	if (bo_gem->gtt_virtual)
-		bufmgr_gem->vma_count--;
-	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	for (type = 0; type < VMA_TYPES; type++) {
+		if (DRMLISTEMPTY(&bo_gem->vma_list[type]))
+			continue;
+		DRMLISTDELINIT(&bo_gem->vma_list[type]);
+		bufmgr_gem->vma[type].cached--;
+		bufmgr_gem->vma[type].cached_bytes -= bo_gem->bo.size;
+	}
+	/* Room for the mapping the caller is about to create. */
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem, 1);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+}
+
+/* Keep an unreferenced userptr buffer for wrapping its range again. */
+static void
+drm_intel_gem_bo_cache_userptr(drm_intel_bufmgr_gem *bufmgr_gem,
+			       drm_intel_bo_gem *bo_gem, uint64_t time)
+{
+	struct util_bo_cache_bucket *bucket;
+	drm_intel_bo_gem *cached;
+
+	bucket = util_bo_cache_get_bucket(&bufmgr_gem->userptr_cache,
+					  bo_gem->bo.size);
+	if (!bufmgr_gem->bo_reuse || !bo_gem->reusable || bucket == NULL) {
+		drm_intel_gem_bo_free(&bo_gem->bo);
+		return;
+	}
+
+	/* The range was wrapped more than once, keep the most recent. */
+	HASH_FIND(userptr_hh, bufmgr_gem->userptr_table,
+		  &bo_gem->userptr_key, sizeof(bo_gem->userptr_key), cached);
+	if (cached) {
+		util_bo_cache_remove(&cached->cache_entry);
+		drm_intel_gem_bo_free(&cached->bo);
+	}
+
+	bo_gem->name = NULL;
+	bo_gem->validate_index = -1;
+	bo_gem->userptr_cached = true;
+	HASH_ADD(userptr_hh, bufmgr_gem->userptr_table,
+		 userptr_key, sizeof(bo_gem->userptr_key), bo_gem);
+	util_bo_cache_add(&bufmgr_gem->userptr_cache, bucket,
+			  &bo_gem->cache_entry, time);
 }
 
 static void
-drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
+drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, uint64_t time)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-	struct drm_intel_gem_bo_bucket *bucket;
+	struct util_bo_cache_bucket *bucket;
 	int i;
 
 	/* Unreference all the target buffers */
@@ -1363,11 +1780,16 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 								  time);
 	bo_gem->kflags = 0;
 	bo_gem->reloc_count = 0;
+	bo_gem->aperture_serial = 0;
 	bo_gem->used_as_reloc_target = false;
 	bo_gem->softpin_target_count = 0;
 
 	DBG("bo_unreference final: %d (%s)\n",
 	    bo_gem->gem_handle, bo_gem->name);
+	util_bo_labels_remove(&bufmgr_gem->bo_labels, bo_gem->label, 0,
+			      bo->size);
+	UTIL_TRACE_EVENT("bo_free", "i915 handle=%u size=%lu",
+			 bo_gem->gem_handle, bo->size);
 
 	/* release memory associated with this object */
 	if (bo_gem->reloc_target_info) {
@@ -1378,6 +1800,7 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 		free(bo_gem->relocs);
 		bo_gem->relocs = NULL;
 	}
+	bo_gem->reloc_size = 0;
 	if (bo_gem->softpin_target) {
 		free(bo_gem->softpin_target);
 		bo_gem->softpin_target = NULL;
@@ -1392,24 +1815,29 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 	}
 
-	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, bo->size);
+	if (bo_gem->is_userptr) {
+		drm_intel_gem_bo_cache_userptr(bufmgr_gem, bo_gem, time);
+		return;
+	}
+
+	bucket = util_bo_cache_get_bucket(&bufmgr_gem->bo_cache, bo->size);
 	/* Put the buffer into our internal cache for reuse if we can. */
 	if (bufmgr_gem->bo_reuse && bo_gem->reusable && bucket != NULL &&
+	    bucket->size == bo->size &&
 	    drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
 					      I915_MADV_DONTNEED)) {
-		bo_gem->free_time = time;
-
 		bo_gem->name = NULL;
 		bo_gem->validate_index = -1;
 
-		DRMLISTADDTAIL(&bo_gem->head, &bucket->head);
+		util_bo_cache_add(&bufmgr_gem->bo_cache, bucket,
+				  &bo_gem->cache_entry, time);
 	} else {
 		drm_intel_gem_bo_free(bo);
 	}
 }
 
 static void drm_intel_gem_bo_unreference_locked_timed(drm_intel_bo *bo,
-						      time_t time)
+						      uint64_t time)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
@@ -1427,15 +1855,13 @@ static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
 	if (atomic_add_unless(&bo_gem->refcount, -1, 1)) {
 		drm_intel_bufmgr_gem *bufmgr_gem =
 		    (drm_intel_bufmgr_gem *) bo->bufmgr;
-		struct timespec time;
-
-		clock_gettime(CLOCK_MONOTONIC, &time);
+		uint64_t time = util_bo_cache_now();
 
 		pthread_mutex_lock(&bufmgr_gem->lock);
 
 		if (atomic_dec_and_test(&bo_gem->refcount)) {
-			drm_intel_gem_bo_unreference_final(bo, time.tv_sec);
-			drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time.tv_sec);
+			drm_intel_gem_bo_unreference_final(bo, time);
+			drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time);
 		}
 
 		pthread_mutex_unlock(&bufmgr_gem->lock);
@@ -1455,10 +1881,11 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 		return 0;
 	}
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bo_gem->map_lock);
 
-	if (bo_gem->map_count++ == 0)
+	if (bo_gem->map_count == 0)
 		drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
+	bo_gem->map_count++;
 
 	if (!bo_gem->mem_virtual) {
 		struct drm_i915_gem_mmap mmap_arg;
@@ -1479,16 +1906,22 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 			    bo_gem->name, strerror(errno));
 			if (--bo_gem->map_count == 0)
 				drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
-			pthread_mutex_unlock(&bufmgr_gem->lock);
+			pthread_mutex_unlock(&bo_gem->map_lock);
 			return ret;
 		}
 		VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
 		bo_gem->mem_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+		drm_intel_gem_bo_add_vma(bufmgr_gem, bo_gem, DRM_INTEL_VMA_CPU);
 	}
 	DBG("bo_map: %d (%s) -> %p\n", bo_gem->gem_handle, bo_gem->name,
 	    bo_gem->mem_virtual);
 	bo->virtual = bo_gem->mem_virtual;
 
+	if (write_enable)
+		bo_gem->mapped_cpu_write = true;
+	pthread_mutex_unlock(&bo_gem->map_lock);
+
+	/* The map count keeps the mapping, so wait for the GPU unlocked. */
 	memclear(set_domain);
 	set_domain.handle = bo_gem->gem_handle;
 	set_domain.read_domains = I915_GEM_DOMAIN_CPU;
@@ -1505,12 +1938,8 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 		    strerror(errno));
 	}
 
-	if (write_enable)
-		bo_gem->mapped_cpu_write = true;
-
 	drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 	VG(VALGRIND_MAKE_MEM_DEFINED(bo_gem->mem_virtual, bo->size));
-	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	return 0;
 }
@@ -1525,8 +1954,9 @@ map_gtt(drm_intel_bo *bo)
 	if (bo_gem->is_userptr)
 		return -EINVAL;
 
-	if (bo_gem->map_count++ == 0)
+	if (bo_gem->map_count == 0)
 		drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
+	bo_gem->map_count++;
 
 	/* Get a mapping of the buffer if we haven't before. */
 	if (bo_gem->gtt_virtual == NULL) {
@@ -1568,6 +1998,7 @@ map_gtt(drm_intel_bo *bo)
 				drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
 			return ret;
 		}
+		drm_intel_gem_bo_add_vma(bufmgr_gem, bo_gem, DRM_INTEL_VMA_GTT);
 	}
 
 	bo->virtual = bo_gem->gtt_virtual;
@@ -1586,13 +2017,11 @@ drm_intel_gem_bo_map_gtt(drm_intel_bo *bo)
 	struct drm_i915_gem_set_domain set_domain;
 	int ret;
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
-
+	pthread_mutex_lock(&bo_gem->map_lock);
 	ret = map_gtt(bo);
-	if (ret) {
-		pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bo_gem->map_lock);
+	if (ret)
 		return ret;
-	}
 
 	/* Now move it to the GTT domain so that the GPU and CPU
 	 * caches are flushed and the GPU isn't actively using the
@@ -1618,7 +2047,6 @@ drm_intel_gem_bo_map_gtt(drm_intel_bo *bo)
 
 	drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 	VG(VALGRIND_MAKE_MEM_DEFINED(bo_gem->gtt_virtual, bo->size));
-	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	return 0;
 }
@@ -1641,9 +2069,7 @@ drm_public int
 drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
-#if HAVE_VALGRIND
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
-#endif
 	int ret;
 
 	/* If the CPU cache isn't coherent with the GTT, then use a
@@ -1656,7 +2082,7 @@ drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo)
 	if (!bufmgr_gem->has_llc)
 		return drm_intel_gem_bo_map_gtt(bo);
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bo_gem->map_lock);
 
 	ret = map_gtt(bo);
 	if (ret == 0) {
@@ -1664,7 +2090,7 @@ drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo)
 		VG(VALGRIND_MAKE_MEM_DEFINED(bo_gem->gtt_virtual, bo->size));
 	}
 
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bo_gem->map_lock);
 
 	return ret;
 }
@@ -1673,6 +2099,7 @@ static int drm_intel_gem_bo_unmap(drm_intel_bo *bo)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	bool sw_finish = false;
 	int ret = 0;
 
 	if (bo == NULL)
@@ -1683,11 +2110,11 @@ static int drm_intel_gem_bo_unmap(drm_intel_bo *bo)
 
 	bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bo_gem->map_lock);
 
 	if (bo_gem->map_count <= 0) {
 		DBG("attempted to unmap an unmapped bo\n");
-		pthread_mutex_unlock(&bufmgr_gem->lock);
+		pthread_mutex_unlock(&bo_gem->map_lock);
 		/* Preserve the old behaviour of just treating this as a
 		 * no-op rather than reporting the error.
 		 */
@@ -1695,20 +2122,7 @@ static int drm_intel_gem_bo_unmap(drm_intel_bo *bo)
 	}
 
 	if (bo_gem->mapped_cpu_write) {
-		struct drm_i915_gem_sw_finish sw_finish;
-
-		/* Cause a flush to happen if the buffer's pinned for
-		 * scanout, so the results show up in a timely manner.
-		 * Unlike GTT set domains, this only does work if the
-		 * buffer should be scanout-related.
-		 */
-		memclear(sw_finish);
-		sw_finish.handle = bo_gem->gem_handle;
-		ret = drmIoctl(bufmgr_gem->fd,
-			       DRM_IOCTL_I915_GEM_SW_FINISH,
-			       &sw_finish);
-		ret = ret == -1 ? -errno : 0;
-
+		sw_finish = true;
 		bo_gem->mapped_cpu_write = false;
 	}
 
@@ -1721,14 +2135,30 @@ static int drm_intel_gem_bo_unmap(drm_intel_bo *bo)
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 		bo->virtual = NULL;
 	}
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bo_gem->map_lock);
 
-	return ret;
-}
+	if (sw_finish) {
+		struct drm_i915_gem_sw_finish finish;
 
-drm_public int
-drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo)
-{
+		/* Cause a flush to happen if the buffer's pinned for
+		 * scanout, so the results show up in a timely manner.
+		 * Unlike GTT set domains, this only does work if the
+		 * buffer should be scanout-related.
+		 */
+		memclear(finish);
+		finish.handle = bo_gem->gem_handle;
+		ret = drmIoctl(bufmgr_gem->fd,
+			       DRM_IOCTL_I915_GEM_SW_FINISH,
+			       &finish);
+		ret = ret == -1 ? -errno : 0;
+	}
+
+	return ret;
+}
+
+drm_public int
+drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo)
+{
 	return drm_intel_gem_bo_unmap(bo);
 }
 
@@ -1998,33 +2428,66 @@ drm_intel_gem_bo_start_gtt_access(drm_intel_bo *bo, int write_enable)
 	}
 }
 
+static void
+drm_intel_gem_vma_threshold(uint64_t bytes, uint64_t count, void *data);
+static void
+drm_intel_gem_dump_bo_usage_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				   FILE *file);
+
+static void
+drm_intel_gem_free_capture(struct drm_intel_gem_capture *capture,
+			   unsigned int count)
+{
+	unsigned int i;
+
+	if (!capture)
+		return;
+
+	for (i = 0; i < count; i++)
+		free(capture[i].targets);
+	free(capture[0].batch);
+	free(capture);
+}
+
 static void
 drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
 	struct drm_gem_close close_bo;
-	int i, ret;
+	int ret, i;
+
+	/* Cached below with the other buffers */
+	for (i = 0; i < UPLOAD_RING_SIZE; i++)
+		drm_intel_bo_unreference(bufmgr_gem->upload_bo[i]);
+	pthread_mutex_destroy(&bufmgr_gem->upload_lock);
+
+	for (i = 0; i < ENGINE_BATCHES; i++) {
+		drm_intel_bo_unreference(bufmgr_gem->bsd_engines[0].batches[i]);
+		drm_intel_bo_unreference(bufmgr_gem->bsd_engines[1].batches[i]);
+	}
+	pthread_mutex_destroy(&bufmgr_gem->engine_lock);
+
+	drm_intel_gem_free_capture(bufmgr_gem->capture,
+				   bufmgr_gem->capture_count);
 
 	free(bufmgr_gem->exec2_objects);
 	free(bufmgr_gem->exec_objects);
 	free(bufmgr_gem->exec_bos);
 
+	if (bufmgr_gem->pressure)
+		util_mem_pressure_stop(bufmgr_gem->pressure);
+	if (bufmgr_gem->vma_threshold)
+		drmRemoveMapThreshold(drm_intel_gem_vma_threshold, bufmgr_gem);
+
 	pthread_mutex_destroy(&bufmgr_gem->lock);
 
 	/* Free any cached buffer objects we were going to reuse */
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		drm_intel_bo_gem *bo_gem;
-
-		while (!DRMLISTEMPTY(&bucket->head)) {
-			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
-					      bucket->head.next, head);
-			DRMLISTDEL(&bo_gem->head);
-
-			drm_intel_gem_bo_free(&bo_gem->bo);
-		}
-	}
+	if (util_bo_cache_dump_enabled())
+		util_bo_cache_dump(&bufmgr_gem->bo_cache, "intel");
+	if (util_bo_labels_dump_enabled())
+		drm_intel_gem_dump_bo_usage_locked(bufmgr_gem, stderr);
+	drm_intel_gem_cleanup_bo_cache(bufmgr_gem, UTIL_BO_CACHE_PURGE);
+	mmDestroy(bufmgr_gem->va_heap);
 
 	/* Release userptr bo kept hanging around for optimisation. */
 	if (bufmgr_gem->userptr_active.ptr) {
@@ -2038,9 +2501,45 @@ drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 				"i915 kernel driver may not be sane!\n", errno);
 	}
 
+	pthread_mutex_destroy(&bufmgr_gem->vma_lock);
 	free(bufmgr);
 }
 
+/* Start the running aperture totals of a new relocation tree. */
+static void
+drm_intel_gem_bo_start_aperture(drm_intel_bufmgr_gem *bufmgr_gem,
+				drm_intel_bo_gem *bo_gem)
+{
+	do {
+		bo_gem->aperture_serial =
+			atomic_inc_return(&bufmgr_gem->aperture_serial);
+	} while (bo_gem->aperture_serial == 0);
+
+	bo_gem->aperture_mark = bo_gem->aperture_serial;
+	bo_gem->aperture_size = bo_gem->in_aperture_size;
+	bo_gem->aperture_fences = 0;
+}
+
+/* Count the buffers of the tree of bo_gem not yet counted in root's. */
+static void
+drm_intel_gem_bo_add_aperture(drm_intel_bo_gem *root,
+			      drm_intel_bo_gem *bo_gem)
+{
+	int i;
+
+	if (bo_gem->aperture_mark == root->aperture_serial)
+		return;
+
+	bo_gem->aperture_mark = root->aperture_serial;
+	root->aperture_size += bo_gem->in_aperture_size;
+	if (bo_gem->reloc_count == 0)
+		root->aperture_fences += bo_gem->reloc_tree_fences;
+
+	for (i = 0; i < bo_gem->reloc_count; i++)
+		drm_intel_gem_bo_add_aperture(root, (drm_intel_bo_gem *)
+					      bo_gem->reloc_target_info[i].bo);
+}
+
 /**
  * Adds the target buffer to the validation list and adds the relocation
  * to the reloc_buffer's relocation list.
@@ -2077,13 +2576,14 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	if (target_bo_gem->tiling_mode == I915_TILING_NONE)
 		need_fence = false;
 
-	/* Create a new relocation list if needed */
-	if (bo_gem->relocs == NULL && drm_intel_setup_reloc_list(bo))
-		return -ENOMEM;
-
 	/* Check overflow */
 	assert(bo_gem->reloc_count < bufmgr_gem->max_relocs);
 
+	/* Grow the relocation list if needed */
+	if ((uint32_t)bo_gem->reloc_count == bo_gem->reloc_size &&
+	    drm_intel_grow_reloc_list(bo))
+		return -ENOMEM;
+
 	/* Check args */
 	assert(offset <= bo->size - 4);
 	assert((write_domain & (write_domain - 1)) == 0);
@@ -2093,6 +2593,11 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	 */
 	if (need_fence) {
 		assert(target_bo_gem->reloc_count == 0);
+		/* Already counted in our tree without its fence */
+		if (bo_gem->aperture_serial &&
+		    target_bo_gem->aperture_mark == bo_gem->aperture_serial &&
+		    !target_bo_gem->reloc_tree_fences)
+			bo_gem->aperture_fences++;
 		target_bo_gem->reloc_tree_fences = 1;
 	}
 
@@ -2104,6 +2609,10 @@ do_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 		target_bo_gem->used_as_reloc_target = true;
 		bo_gem->reloc_tree_size += target_bo_gem->reloc_tree_size;
 		bo_gem->reloc_tree_fences += target_bo_gem->reloc_tree_fences;
+
+		if (!bo_gem->aperture_serial)
+			drm_intel_gem_bo_start_aperture(bufmgr_gem, bo_gem);
+		drm_intel_gem_bo_add_aperture(bo_gem, target_bo_gem);
 	}
 
 	bo_gem->reloc_target_info[bo_gem->reloc_count].bo = target_bo;
@@ -2132,6 +2641,16 @@ drm_intel_gem_bo_use_48b_address_range(drm_intel_bo *bo, uint32_t enable)
 {
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
+	/* Leave an address above 4GiB to the kernel to relocate. */
+	if (!enable && bo_gem->va_48b) {
+		drm_intel_bufmgr_gem *bufmgr_gem =
+			(drm_intel_bufmgr_gem *) bo->bufmgr;
+
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_release_va(bo_gem);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
 	if (enable)
 		bo_gem->kflags |= EXEC_OBJECT_SUPPORTS_48B_ADDRESS;
 	else
@@ -2141,7 +2660,6 @@ drm_intel_gem_bo_use_48b_address_range(drm_intel_bo *bo, uint32_t enable)
 static int
 drm_intel_gem_bo_add_softpin_target(drm_intel_bo *bo, drm_intel_bo *target_bo)
 {
-	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) target_bo;
 	if (bo_gem->has_error)
@@ -2158,15 +2676,17 @@ drm_intel_gem_bo_add_softpin_target(drm_intel_bo *bo, drm_intel_bo *target_bo)
 		return -EINVAL;
 
 	if (bo_gem->softpin_target_count == bo_gem->softpin_target_size) {
-		int new_size = bo_gem->softpin_target_size * 2;
-		if (new_size == 0)
-			new_size = bufmgr_gem->max_relocs;
-
-		bo_gem->softpin_target = realloc(bo_gem->softpin_target, new_size *
-				sizeof(drm_intel_bo *));
-		if (!bo_gem->softpin_target)
+		uint32_t new_size = bo_gem->softpin_target_size;
+		drm_intel_bo **softpin_target;
+
+		softpin_target = util_grow_array(bo_gem->softpin_target,
+						 &new_size,
+						 bo_gem->softpin_target_count + 1,
+						 sizeof(drm_intel_bo *));
+		if (!softpin_target)
 			return -ENOMEM;
 
+		bo_gem->softpin_target = softpin_target;
 		bo_gem->softpin_target_size = new_size;
 	}
 	bo_gem->softpin_target[bo_gem->softpin_target_count] = target_bo;
@@ -2184,6 +2704,17 @@ drm_intel_gem_bo_emit_reloc(drm_intel_bo *bo, uint32_t offset,
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
 	drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *)target_bo;
 
+	if (target_bo_gem->va) {
+		/* The address written into bo is the right one already, the
+		 * target only needs to go on the validation list.  Writes stay
+		 * tracked for the implicit synchronisation.
+		 */
+		if (target_bo == bo)
+			return 0;
+		if (write_domain)
+			target_bo_gem->kflags |= EXEC_OBJECT_WRITE;
+	}
+
 	if (target_bo_gem->kflags & EXEC_OBJECT_PINNED)
 		return drm_intel_gem_bo_add_softpin_target(bo, target_bo);
 	else
@@ -2231,9 +2762,7 @@ drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 	int i;
-	struct timespec time;
-
-	clock_gettime(CLOCK_MONOTONIC, &time);
+	uint64_t time = util_bo_cache_now();
 
 	assert(bo_gem->reloc_count >= start);
 
@@ -2245,14 +2774,25 @@ drm_intel_gem_bo_clear_relocs(drm_intel_bo *bo, int start)
 		if (&target_bo_gem->bo != bo) {
 			bo_gem->reloc_tree_fences -= target_bo_gem->reloc_tree_fences;
 			drm_intel_gem_bo_unreference_locked_timed(&target_bo_gem->bo,
-								  time.tv_sec);
+								  time);
 		}
 	}
 	bo_gem->reloc_count = start;
 
+	/* Recount the running totals for the relocations left */
+	bo_gem->aperture_serial = 0;
+	for (i = 0; i < start; i++) {
+		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) bo_gem->reloc_target_info[i].bo;
+		if (&target_bo_gem->bo == bo)
+			continue;
+		if (!bo_gem->aperture_serial)
+			drm_intel_gem_bo_start_aperture(bufmgr_gem, bo_gem);
+		drm_intel_gem_bo_add_aperture(bo_gem, target_bo_gem);
+	}
+
 	for (i = 0; i < bo_gem->softpin_target_count; i++) {
 		drm_intel_bo_gem *target_bo_gem = (drm_intel_bo_gem *) bo_gem->softpin_target[i];
-		drm_intel_gem_bo_unreference_locked_timed(&target_bo_gem->bo, time.tv_sec);
+		drm_intel_gem_bo_unreference_locked_timed(&target_bo_gem->bo, time);
 	}
 	bo_gem->softpin_target_count = 0;
 
@@ -2308,8 +2848,11 @@ drm_intel_gem_bo_process_reloc2(drm_intel_bo *bo)
 
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
 
-		/* Continue walking the tree depth-first. */
-		drm_intel_gem_bo_process_reloc2(target_bo);
+		/* Continue walking the tree depth-first, unless the target
+		 * and so its own targets are on the list already.
+		 */
+		if (to_bo_gem(target_bo)->validate_index == -1)
+			drm_intel_gem_bo_process_reloc2(target_bo);
 
 		need_fence = (bo_gem->reloc_target_info[i].flags &
 			      DRM_INTEL_RELOC_FENCE);
@@ -2325,11 +2868,53 @@ drm_intel_gem_bo_process_reloc2(drm_intel_bo *bo)
 			continue;
 
 		drm_intel_gem_bo_mark_mmaps_incoherent(bo);
-		drm_intel_gem_bo_process_reloc2(target_bo);
+		if (to_bo_gem(target_bo)->validate_index == -1)
+			drm_intel_gem_bo_process_reloc2(target_bo);
 		drm_intel_add_validate_buffer2(target_bo, false);
 	}
 }
 
+/*
+ * With I915_EXEC_HANDLE_LUT the relocations name their target by its index
+ * in the validation list instead of its handle, saving the kernel a handle
+ * lookup per relocation.  I915_EXEC_NO_RELOC lets the kernel skip the
+ * relocations while no buffer moved, which needs every presumed offset
+ * written into the buffers to still be the offset of its target.
+ */
+static unsigned int
+drm_intel_gem_bo_exec2_reloc_flags(drm_intel_bufmgr_gem *bufmgr_gem)
+{
+	bool no_reloc = bufmgr_gem->has_exec_no_reloc;
+	bool handle_lut = bufmgr_gem->has_exec_handle_lut;
+	unsigned int flags = 0;
+	int i, j;
+
+	if (!no_reloc && !handle_lut)
+		return 0;
+
+	for (i = 0; i < bufmgr_gem->exec_count; i++) {
+		drm_intel_bo_gem *bo_gem = to_bo_gem(bufmgr_gem->exec_bos[i]);
+
+		for (j = 0; j < bo_gem->reloc_count; j++) {
+			drm_intel_bo *target_bo = bo_gem->reloc_target_info[j].bo;
+			struct drm_i915_gem_relocation_entry *reloc =
+				&bo_gem->relocs[j];
+
+			if (reloc->presumed_offset != target_bo->offset64)
+				no_reloc = false;
+			if (handle_lut)
+				reloc->target_handle =
+					to_bo_gem(target_bo)->validate_index;
+		}
+	}
+
+	if (no_reloc)
+		flags |= I915_EXEC_NO_RELOC;
+	if (handle_lut)
+		flags |= I915_EXEC_HANDLE_LUT;
+	return flags;
+}
+
 
 static void
 drm_intel_update_buffer_offsets(drm_intel_bufmgr_gem *bufmgr_gem)
@@ -2456,6 +3041,55 @@ drm_intel_gem_bo_exec(drm_intel_bo *bo, int used,
 	return ret;
 }
 
+/*
+ * Copies a batch about to be executed and the list of its buffers into
+ * the capture ring. Called with the lock held.
+ */
+static void
+drm_intel_gem_capture_batch(drm_intel_bufmgr_gem *bufmgr_gem,
+			    drm_intel_bo *bo, int used,
+			    drm_intel_context *ctx, unsigned int flags)
+{
+	struct drm_intel_gem_capture *capture =
+		&bufmgr_gem->capture[bufmgr_gem->capture_next];
+	struct drm_intel_gem_capture_target *targets;
+	uint32_t size = used;
+	int i;
+
+	bufmgr_gem->capture_next =
+		(bufmgr_gem->capture_next + 1) % bufmgr_gem->capture_count;
+
+	capture->seqno = ++bufmgr_gem->capture_seqno;
+	capture->handle = to_bo_gem(bo)->gem_handle;
+	capture->ctx_id = ctx ? ctx->ctx_id : 0;
+	capture->flags = flags;
+	capture->offset = bo->offset64;
+	capture->batch_used = used;
+
+	if (size > bufmgr_gem->capture_size)
+		size = bufmgr_gem->capture_size;
+	if (drm_intel_gem_bo_get_subdata(bo, 0, size, capture->batch) == 0)
+		capture->used = size;
+	else
+		capture->used = 0;
+
+	targets = util_grow_array(capture->targets, &capture->max_targets,
+				  bufmgr_gem->exec_count, sizeof(*targets));
+	if (targets)
+		capture->targets = targets;
+	capture->num_targets = 0;
+	for (i = 0; i < bufmgr_gem->exec_count; i++) {
+		drm_intel_bo *target = bufmgr_gem->exec_bos[i];
+
+		if (capture->num_targets == capture->max_targets)
+			break;
+		targets = &capture->targets[capture->num_targets++];
+		targets->handle = to_bo_gem(target)->gem_handle;
+		targets->offset = target->offset64;
+		targets->size = target->size;
+	}
+}
+
 static int
 do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	 drm_clip_rect_t *cliprects, int num_cliprects, int DR4,
@@ -2499,6 +3133,9 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	 */
 	drm_intel_add_validate_buffer2(bo, 0);
 
+	if (bufmgr_gem->capture_count)
+		drm_intel_gem_capture_batch(bufmgr_gem, bo, used, ctx, flags);
+
 	memclear(execbuf);
 	execbuf.buffers_ptr = (uintptr_t)bufmgr_gem->exec2_objects;
 	execbuf.buffer_count = bufmgr_gem->exec_count;
@@ -2508,7 +3145,7 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	execbuf.num_cliprects = num_cliprects;
 	execbuf.DR1 = 0;
 	execbuf.DR4 = DR4;
-	execbuf.flags = flags;
+	execbuf.flags = flags | drm_intel_gem_bo_exec2_reloc_flags(bufmgr_gem);
 	if (ctx == NULL)
 		i915_execbuffer2_set_context_id(execbuf, 0);
 	else
@@ -2526,9 +3163,13 @@ do_exec2(drm_intel_bo *bo, int used, drm_intel_context *ctx,
 	if (bufmgr_gem->no_exec)
 		goto skip_execution;
 
+	UTIL_TRACE_BEGIN("drm_intel_gem_bo_exec2", "batch=%u bos=%u ring=%u",
+			 to_bo_gem(bo)->gem_handle, execbuf.buffer_count,
+			 (unsigned)(flags & I915_EXEC_RING_MASK));
 	ret = drmIoctl(bufmgr_gem->fd,
 		       DRM_IOCTL_I915_GEM_EXECBUFFER2_WR,
 		       &execbuf);
+	UTIL_TRACE_END();
 	if (ret != 0) {
 		ret = -errno;
 		if (ret == -ENOSPC) {
@@ -2601,6 +3242,369 @@ drm_intel_gem_bo_fence_exec(drm_intel_bo *bo,
 	return do_exec2(bo, used, ctx, NULL, 0, 0, in_fence, out_fence, flags);
 }
 
+/* Batches still running on the engine, forgetting those done. Called with
+ * the engine_lock held. */
+static unsigned int
+drm_intel_gem_engine_load(struct drm_intel_gem_engine *engine)
+{
+	unsigned int i, load = 0;
+
+	for (i = 0; i < ENGINE_BATCHES; i++) {
+		drm_intel_bo *batch = engine->batches[i];
+
+		if (!batch)
+			continue;
+		if (drm_intel_gem_bo_busy(batch)) {
+			load++;
+			continue;
+		}
+		drm_intel_gem_bo_unreference(batch);
+		engine->batches[i] = NULL;
+	}
+	return load;
+}
+
+drm_public int
+drm_intel_gem_bo_balanced_exec(drm_intel_bo *bo,
+			       drm_intel_context *ctx,
+			       int used,
+			       int *engine,
+			       unsigned int flags)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
+	struct drm_intel_gem_engine *e;
+	unsigned int i, idx, load, best_load;
+	drm_intel_bo *old;
+	int ret;
+
+	if ((flags & I915_EXEC_RING_MASK) != I915_EXEC_BSD ||
+	    !bufmgr_gem->has_bsd2) {
+		if (engine)
+			*engine = 0;
+		return do_exec2(bo, used, ctx, NULL, 0, 0, -1, NULL, flags);
+	}
+
+	pthread_mutex_lock(&bufmgr_gem->engine_lock);
+	if (engine && (*engine == 0 || *engine == 1)) {
+		idx = *engine;
+	} else {
+		/* The least loaded engine, the next one in turn on a tie */
+		idx = bufmgr_gem->bsd_next;
+		best_load = ENGINE_BATCHES + 1;
+		for (i = 0; i < 2; i++) {
+			unsigned int n = (bufmgr_gem->bsd_next + i) % 2;
+
+			load = drm_intel_gem_engine_load(&bufmgr_gem->bsd_engines[n]);
+			if (load < best_load) {
+				best_load = load;
+				idx = n;
+			}
+		}
+		bufmgr_gem->bsd_next = (idx + 1) % 2;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->engine_lock);
+
+	flags &= ~I915_EXEC_BSD_MASK;
+	flags |= idx ? I915_EXEC_BSD_RING2 : I915_EXEC_BSD_RING1;
+	ret = do_exec2(bo, used, ctx, NULL, 0, 0, -1, NULL, flags);
+	if (ret)
+		return ret;
+
+	if (engine)
+		*engine = idx;
+
+	drm_intel_gem_bo_reference(bo);
+	pthread_mutex_lock(&bufmgr_gem->engine_lock);
+	e = &bufmgr_gem->bsd_engines[idx];
+	old = e->batches[e->next];
+	e->batches[e->next] = bo;
+	e->next = (e->next + 1) % ENGINE_BATCHES;
+	pthread_mutex_unlock(&bufmgr_gem->engine_lock);
+	drm_intel_bo_unreference(old);
+
+	return 0;
+}
+
+/*
+ * Without I915_EXEC_FENCE_ARRAY, waits on the merged sync files of the
+ * syncobjs and signals each of them with the out fence.
+ */
+static int
+drm_intel_gem_bo_syncobj_exec_fallback(drm_intel_bo *bo,
+				       drm_intel_context *ctx, int used,
+				       const struct drm_i915_gem_exec_fence *fences,
+				       unsigned int num_fences,
+				       unsigned int flags)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
+	int in_fence = -1, out_fence = -1, fd, ret = 0;
+	bool signal = false;
+	unsigned int i;
+
+	for (i = 0; i < num_fences; i++) {
+		if (fences[i].flags & I915_EXEC_FENCE_SIGNAL)
+			signal = true;
+		if (!(fences[i].flags & I915_EXEC_FENCE_WAIT))
+			continue;
+
+		ret = drmSyncobjExportSyncFile(bufmgr_gem->fd,
+					       fences[i].handle, &fd);
+		if (ret == 0) {
+			ret = sync_accumulate("drm_intel", &in_fence, fd);
+			close(fd);
+		}
+		if (ret) {
+			ret = -errno;
+			goto out;
+		}
+	}
+
+	ret = do_exec2(bo, used, ctx, NULL, 0, 0, in_fence,
+		       signal ? &out_fence : NULL, flags);
+	if (ret || !signal)
+		goto out;
+
+	for (i = 0; i < num_fences; i++) {
+		if (!(fences[i].flags & I915_EXEC_FENCE_SIGNAL))
+			continue;
+		if (drmSyncobjImportSyncFile(bufmgr_gem->fd, fences[i].handle,
+					     out_fence) && ret == 0)
+			ret = -errno;
+	}
+	close(out_fence);
+
+out:
+	if (in_fence >= 0)
+		close(in_fence);
+	return ret;
+}
+
+drm_public int
+drm_intel_gem_bo_syncobj_exec(drm_intel_bo *bo,
+			      drm_intel_context *ctx,
+			      int used,
+			      const struct drm_i915_gem_exec_fence *fences,
+			      unsigned int num_fences,
+			      unsigned int flags)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bo->bufmgr;
+
+	if (num_fences == 0)
+		return do_exec2(bo, used, ctx, NULL, 0, 0, -1, NULL, flags);
+
+	if (!bufmgr_gem->has_exec_fence_array)
+		return drm_intel_gem_bo_syncobj_exec_fallback(bo, ctx, used,
+							      fences,
+							      num_fences,
+							      flags);
+
+	/* With I915_EXEC_FENCE_ARRAY the cliprects carry the fences. */
+	return do_exec2(bo, used, ctx, (drm_clip_rect_t *)fences, num_fences,
+			0, -1, NULL, flags | I915_EXEC_FENCE_ARRAY);
+}
+
+/*
+ * Takes the room for size bytes in a staging buffer the CPU can write
+ * without waiting, with a reference for the caller. Called with the
+ * upload_lock held.
+ */
+static drm_intel_bo *
+drm_intel_gem_get_upload_bo(drm_intel_bufmgr_gem *bufmgr_gem,
+			    unsigned long size, unsigned long *offset)
+{
+	drm_intel_bo *bo;
+
+	*offset = 0;
+	if (size > UPLOAD_BO_SIZE)
+		return drm_intel_bo_alloc(&bufmgr_gem->bufmgr, "upload", size,
+					  4096);
+
+	bo = bufmgr_gem->upload_bo[bufmgr_gem->upload_index];
+	if (!bo || bufmgr_gem->upload_used + size > UPLOAD_BO_SIZE) {
+		bufmgr_gem->upload_index =
+			(bufmgr_gem->upload_index + 1) % UPLOAD_RING_SIZE;
+		bufmgr_gem->upload_used = 0;
+
+		/* Still read by the blits queued a ring ago, leave it to the
+		 * BO cache for a fresh one. */
+		bo = bufmgr_gem->upload_bo[bufmgr_gem->upload_index];
+		if (bo && drm_intel_bo_busy(bo)) {
+			drm_intel_bo_unreference(bo);
+			bo = NULL;
+		}
+		if (!bo)
+			bo = drm_intel_bo_alloc(&bufmgr_gem->bufmgr, "upload",
+						UPLOAD_BO_SIZE, 4096);
+		bufmgr_gem->upload_bo[bufmgr_gem->upload_index] = bo;
+		if (!bo)
+			return NULL;
+	}
+
+	*offset = bufmgr_gem->upload_used;
+	bufmgr_gem->upload_used += ALIGN(size, UPLOAD_ALIGNMENT);
+	drm_intel_bo_reference(bo);
+	return bo;
+}
+
+static int
+drm_intel_gem_emit_reloc64(drm_intel_bufmgr_gem *bufmgr_gem,
+			   drm_intel_bo *batch, uint32_t *cmd, int *n,
+			   drm_intel_bo *target, unsigned long delta,
+			   uint32_t write_domain)
+{
+	uint64_t address = target->offset64 + delta;
+	int ret;
+
+	ret = drm_intel_bo_emit_reloc(batch, *n * 4, target, delta,
+				      I915_GEM_DOMAIN_RENDER, write_domain);
+	cmd[(*n)++] = lower_32_bits(address);
+	if (bufmgr_gem->gen >= 8)
+		cmd[(*n)++] = upper_32_bits(address);
+	return ret;
+}
+
+/* Copy width bytes of height rows of pitch bytes with an 8bpp blit. */
+static int
+drm_intel_gem_emit_linear_blit(drm_intel_bufmgr_gem *bufmgr_gem,
+			       drm_intel_bo *batch, uint32_t *cmd, int *n,
+			       drm_intel_bo *dst, unsigned long dst_offset,
+			       drm_intel_bo *src, unsigned long src_offset,
+			       uint32_t pitch, uint32_t width, uint32_t height)
+{
+	int ret;
+
+	cmd[(*n)++] = XY_SRC_COPY_BLT_CMD |
+		      (bufmgr_gem->gen >= 8 ? 8 : 6);
+	cmd[(*n)++] = BR13_ROP_COPY | pitch;
+	cmd[(*n)++] = 0;
+	cmd[(*n)++] = height << 16 | width;
+	ret = drm_intel_gem_emit_reloc64(bufmgr_gem, batch, cmd, n,
+					 dst, dst_offset,
+					 I915_GEM_DOMAIN_RENDER);
+	cmd[(*n)++] = 0;
+	cmd[(*n)++] = pitch;
+	if (ret == 0)
+		ret = drm_intel_gem_emit_reloc64(bufmgr_gem, batch, cmd, n,
+						 src, src_offset, 0);
+	return ret;
+}
+
+/**
+ * Writes data to a buffer without waiting for the GPU to be done with it.
+ *
+ * The data is written to a staging buffer, from which a blit queued on the
+ * blitter ring copies it to the buffer once the GPU work queued before on
+ * the buffer is done. Buffers already idle are written synchronously as
+ * with drm_intel_bo_subdata(), which remains the way to write a buffer that
+ * the GPU or the CPU reads next without waiting for that blit.
+ *
+ * \param out_fence - If not NULL, set to a sync file signaled when the copy
+ *                    is done, or -1 when the buffer was written synchronously
+ * \return 0 on success, negative errno on failure
+ */
+drm_public int
+drm_intel_gem_bo_subdata_async(drm_intel_bo *bo, unsigned long offset,
+			       unsigned long size, const void *data,
+			       int *out_fence)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	drm_intel_bo *upload, *batch;
+	unsigned long upload_offset, batch_size, done;
+	uint32_t *cmd;
+	void *map;
+	int n = 0, ret;
+
+	if (out_fence)
+		*out_fence = -1;
+
+	if (bo_gem->is_userptr)
+		return -EINVAL;
+
+	if (size == 0)
+		return 0;
+
+	/* The blitter goes through the fences before gen4, and has a ring of
+	 * its own from gen6. */
+	if (bufmgr_gem->gen < 4 ||
+	    (bufmgr_gem->gen >= 6 && !bufmgr_gem->has_blt) ||
+	    !drm_intel_bo_busy(bo))
+		return drm_intel_bo_subdata(bo, offset, size, data);
+
+	pthread_mutex_lock(&bufmgr_gem->upload_lock);
+	upload = drm_intel_gem_get_upload_bo(bufmgr_gem, size, &upload_offset);
+	pthread_mutex_unlock(&bufmgr_gem->upload_lock);
+	if (!upload)
+		return -ENOMEM;
+
+	/* Only the blits read the staging buffers, so they are coherent through
+	 * the CPU caches with LLC, and written around them otherwise. */
+	if (bufmgr_gem->has_llc)
+		map = drm_intel_gem_bo_map__cpu(upload);
+	else
+		map = drm_intel_gem_bo_map__wc(upload);
+	if (!map) {
+		drm_intel_bo_unreference(upload);
+		return drm_intel_bo_subdata(bo, offset, size, data);
+	}
+	memcpy((char *)map + upload_offset, data, size);
+	__sync_synchronize();
+
+	/* A blit of up to BLT_MAX_HEIGHT rows at a time and one for the last
+	 * partial row, 10 dwords each, and the end of the batch. */
+	batch_size = ((size / (BLT_MAX_PITCH * BLT_MAX_HEIGHT) + 2) * 10 + 2) * 4;
+	cmd = malloc(batch_size);
+	batch = drm_intel_bo_alloc(&bufmgr_gem->bufmgr, "upload batch",
+				   batch_size, 4096);
+	if (!cmd || !batch) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = 0;
+	for (done = 0; ret == 0 && done < size; ) {
+		unsigned long left = size - done;
+		uint32_t pitch, width, height;
+
+		if (left >= BLT_MAX_PITCH) {
+			pitch = width = BLT_MAX_PITCH;
+			height = left / BLT_MAX_PITCH;
+			if (height > BLT_MAX_HEIGHT)
+				height = BLT_MAX_HEIGHT;
+		} else {
+			pitch = ALIGN(left, 4);
+			width = left;
+			height = 1;
+		}
+
+		ret = drm_intel_gem_emit_linear_blit(bufmgr_gem, batch, cmd, &n,
+						     bo, offset + done,
+						     upload,
+						     upload_offset + done,
+						     pitch, width, height);
+		done += (unsigned long)width * height;
+	}
+	cmd[n++] = MI_BATCH_BUFFER_END;
+	if (n & 1)
+		cmd[n++] = 0;
+
+	if (ret == 0)
+		ret = drm_intel_bo_subdata(batch, 0, n * 4, cmd);
+	if (ret == 0)
+		ret = drm_intel_gem_bo_fence_exec(batch, NULL, n * 4, -1,
+						  out_fence,
+						  bufmgr_gem->gen >= 6 ?
+						  I915_EXEC_BLT :
+						  I915_EXEC_RENDER);
+
+out:
+	/* The kernel keeps them alive until the blits are done. */
+	drm_intel_bo_unreference(batch);
+	drm_intel_bo_unreference(upload);
+	free(cmd);
+	return ret;
+}
+
 static int
 drm_intel_gem_bo_pin(drm_intel_bo *bo, uint32_t alignment)
 {
@@ -2722,8 +3726,16 @@ drm_intel_gem_bo_get_tiling(drm_intel_bo *bo, uint32_t * tiling_mode,
 static int
 drm_intel_gem_bo_set_softpin_offset(drm_intel_bo *bo, uint64_t offset)
 {
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
+	/* The caller manages the address from now on. */
+	if (bo_gem->va) {
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_release_va(bo_gem);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
 	bo->offset64 = offset;
 	bo->offset = offset;
 	bo_gem->kflags |= EXEC_OBJECT_PINNED;
@@ -2764,7 +3776,7 @@ drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int s
 		goto out;
 
 	atomic_set(&bo_gem->refcount, 1);
-	DRMINITLISTHEAD(&bo_gem->vma_list);
+	drm_intel_gem_bo_init_vma(bo_gem);
 
 	/* Determine size of bo.  The fd-to-handle ioctl really should
 	 * return the size, but it doesn't.  If we have kernel 3.12 or
@@ -2797,7 +3809,11 @@ drm_intel_bo_gem_create_from_prime(drm_intel_bufmgr *bufmgr, int prime_fd, int s
 		goto err;
 
 	/* XXX stride is unknown */
+	drm_intel_gem_bo_assign_va(bufmgr_gem, bo_gem);
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, 0);
+	drm_intel_gem_bo_label_alloc(bufmgr_gem, bo_gem);
+	UTIL_TRACE_EVENT("bo_import", "i915 handle=%u size=%lu", handle,
+			 bo_gem->bo.size);
 
 out:
 	pthread_mutex_unlock(&bufmgr_gem->lock);
@@ -2923,14 +3939,66 @@ drm_intel_bufmgr_gem_can_disable_implicit_sync(drm_intel_bufmgr *bufmgr)
 }
 
 /**
- * Enable use of fenced reloc type.
+ * Softpin every buffer allocated or imported from now on at an address
+ * handed out by the buffer manager, so that execbuf never needs to relocate
+ * them.  Relocations emitted against those buffers only add them to the
+ * validation list, and the addresses to write into the batch are the
+ * buffers' offset64, which stays the same during their lifetime, including
+ * when reused from the cache.
  *
- * New code should enable this to avoid unnecessary fence register
- * allocation.  If this option is not enabled, all relocs will have fence
- * register allocated.
+ * This needs softpin support and a full per-process GTT, where the
+ * addresses may go above 4GiB.  Buffers later limited to 32-bit addresses
+ * with drm_intel_bo_use_48b_address_range() are handed back to the
+ * kernel's relocation.
+ *
+ * Returns 0 on success, -ENODEV when the kernel doesn't allow it.
  */
-drm_public void
-drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr)
+drm_public int
+drm_intel_bufmgr_gem_enable_softpin_va(drm_intel_bufmgr *bufmgr)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct drm_i915_gem_context_param cp;
+	struct drm_i915_getparam gp;
+	int ppgtt = 0;
+	int ret = 0;
+
+	if (bufmgr_gem->bufmgr.bo_set_softpin_offset == NULL)
+		return -ENODEV;
+
+	memclear(gp);
+	gp.param = I915_PARAM_HAS_ALIASING_PPGTT;
+	gp.value = &ppgtt;
+	if (drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp) ||
+	    ppgtt < I915_GEM_PPGTT_FULL)
+		return -ENODEV;
+
+	memclear(cp);
+	cp.param = I915_CONTEXT_PARAM_GTT_SIZE;
+	if (drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GEM_CONTEXT_GETPARAM, &cp) ||
+	    cp.value <= 2 * 4096)
+		return -ENODEV;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	/* Keep address 0 and the last page unused. */
+	if (!bufmgr_gem->va_heap) {
+		bufmgr_gem->va_heap = mmInit(4096, cp.value - 2 * 4096);
+		if (!bufmgr_gem->va_heap)
+			ret = -ENOMEM;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return ret;
+}
+
+/**
+ * Enable use of fenced reloc type.
+ *
+ * New code should enable this to avoid unnecessary fence register
+ * allocation.  If this option is not enabled, all relocs will have fence
+ * register allocated.
+ */
+drm_public void
+drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
 
@@ -2963,31 +4031,6 @@ drm_intel_gem_bo_get_aperture_space(drm_intel_bo *bo)
 	return total;
 }
 
-/**
- * Count the number of buffers in this list that need a fence reg
- *
- * If the count is greater than the number of available regs, we'll have
- * to ask the caller to resubmit a batch with fewer tiled buffers.
- *
- * This function over-counts if the same buffer is used multiple times.
- */
-static unsigned int
-drm_intel_gem_total_fences(drm_intel_bo ** bo_array, int count)
-{
-	int i;
-	unsigned int total = 0;
-
-	for (i = 0; i < count; i++) {
-		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo_array[i];
-
-		if (bo_gem == NULL)
-			continue;
-
-		total += bo_gem->reloc_tree_fences;
-	}
-	return total;
-}
-
 /**
  * Clear the flag set by drm_intel_gem_bo_get_aperture_space() so we're ready
  * for the next drm_intel_bufmgr_check_aperture_space() call.
@@ -3075,25 +4118,47 @@ drm_intel_gem_compute_batch_space(drm_intel_bo **bo_array, int count)
  * waiting to evict a buffer from the last rendering, and we get synchronous
  * performance.  By emitting smaller batchbuffers, we eat some CPU overhead to
  * get better parallelism.
+ *
+ * The first buffer, usually the batch, brings the running totals of its
+ * relocation tree, and the others are added unless they are already in it,
+ * so the check doesn't walk the trees unless the estimate overflows.
  */
 static int
 drm_intel_gem_check_aperture_space(drm_intel_bo **bo_array, int count)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem =
 	    (drm_intel_bufmgr_gem *) bo_array[0]->bufmgr;
+	drm_intel_bo_gem *root = (drm_intel_bo_gem *) bo_array[0];
 	unsigned int total = 0;
 	unsigned int threshold = bufmgr_gem->gtt_size * 3 / 4;
-	int total_fences;
+	int total_fences = 0;
+	int i;
 
-	/* Check for fence reg constraints if necessary */
-	if (bufmgr_gem->available_fences) {
-		total_fences = drm_intel_gem_total_fences(bo_array, count);
-		if (total_fences > bufmgr_gem->available_fences)
-			return -ENOSPC;
+	for (i = 0; i < count; i++) {
+		drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo_array[i];
+
+		if (bo_gem == NULL)
+			continue;
+		if (i > 0 && root->aperture_serial &&
+		    bo_gem->aperture_mark == root->aperture_serial)
+			continue;
+
+		if (bo_gem->aperture_serial) {
+			total += bo_gem->aperture_size;
+			total_fences += bo_gem->aperture_fences;
+		} else {
+			total += bo_gem->in_aperture_size;
+			total_fences += bo_gem->reloc_tree_fences;
+		}
 	}
 
-	total = drm_intel_gem_estimate_batch_space(bo_array, count);
+	/* Check for fence reg constraints if necessary */
+	if (bufmgr_gem->available_fences &&
+	    total_fences > bufmgr_gem->available_fences)
+		return -ENOSPC;
 
+	/* The totals count the worst-case alignment, and the trees of the
+	 * other buffers may overlap the first one's. */
 	if (total > threshold)
 		total = drm_intel_gem_compute_batch_space(bo_array, count);
 
@@ -3169,23 +4234,9 @@ drm_intel_gem_bo_references(drm_intel_bo *bo, drm_intel_bo *target_bo)
 	return 0;
 }
 
-static void
-add_bucket(drm_intel_bufmgr_gem *bufmgr_gem, int size)
-{
-	unsigned int i = bufmgr_gem->num_buckets;
-
-	assert(i < ARRAY_SIZE(bufmgr_gem->cache_bucket));
-
-	DRMINITLISTHEAD(&bufmgr_gem->cache_bucket[i].head);
-	bufmgr_gem->cache_bucket[i].size = size;
-	bufmgr_gem->num_buckets++;
-}
-
 static void
 init_cache_buckets(drm_intel_bufmgr_gem *bufmgr_gem)
 {
-	unsigned long size, cache_max_size = 64 * 1024 * 1024;
-
 	/* OK, so power of two buckets was too wasteful of memory.
 	 * Give 3 other sizes between each power of two, to hopefully
 	 * cover things accurately enough.  (The alternative is
@@ -3194,28 +4245,383 @@ init_cache_buckets(drm_intel_bufmgr_gem *bufmgr_gem)
 	 * width/height alignment and rounding of sizes to pages will
 	 * get us useful cache hit rates anyway)
 	 */
-	add_bucket(bufmgr_gem, 4096);
-	add_bucket(bufmgr_gem, 4096 * 2);
-	add_bucket(bufmgr_gem, 4096 * 3);
+	util_bo_cache_init(&bufmgr_gem->bo_cache, 2,
+			   UTIL_BO_CACHE_DEFAULT_MAX_SIZE, 0,
+			   UTIL_BO_CACHE_DEFAULT_MAX_AGE);
+
+	/* The userptr buffers are looked up by range, the buckets only keep
+	 * the account of their sizes. */
+	util_bo_cache_init(&bufmgr_gem->userptr_cache, 0,
+			   UTIL_BO_CACHE_MAX_SIZE, 0,
+			   UTIL_BO_CACHE_DEFAULT_MAX_AGE);
+}
+
+/**
+ * Sets up the BO reuse cache with 1 << bucket_shift buckets per power of
+ * two up to max_size.  Buffers stay cached for max_age_ms, or until the
+ * cache holds more than max_bytes (0 for no limit).  The cached buffers
+ * are freed.
+ */
+drm_public void
+drm_intel_bufmgr_gem_set_bo_cache(drm_intel_bufmgr *bufmgr,
+				  unsigned int bucket_shift, uint64_t max_size,
+				  uint64_t max_bytes, uint32_t max_age_ms)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	drm_intel_gem_cleanup_bo_cache(bufmgr_gem, UTIL_BO_CACHE_PURGE);
+	util_bo_cache_init(&bufmgr_gem->bo_cache, bucket_shift, max_size,
+			   max_bytes, max_age_ms * 1000000ull);
+	bufmgr_gem->userptr_cache.max_age = max_age_ms * 1000000ull;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+drm_public void
+drm_intel_bufmgr_gem_get_bo_cache_stats(drm_intel_bufmgr *bufmgr,
+					uint64_t *hits, uint64_t *misses,
+					uint64_t *evictions)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	*hits = bufmgr_gem->bo_cache.stats.hits;
+	*misses = bufmgr_gem->bo_cache.stats.misses;
+	*evictions = bufmgr_gem->bo_cache.stats.evictions;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Fills the statistics of the bucket index of the bo cache, counting from 0
+ * for the smallest size.  Returns -1 past the last bucket.
+ *
+ * Setting LIBDRM_BO_CACHE_STATS in the environment prints them when the
+ * bufmgr is destroyed.
+ */
+drm_public int
+drm_intel_bufmgr_gem_get_bo_cache_bucket_stats(drm_intel_bufmgr *bufmgr,
+		unsigned int index, struct drm_intel_bo_cache_bucket_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct util_bo_cache_bucket *bucket;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (index >= bufmgr_gem->bo_cache.num_buckets) {
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return -1;
+	}
+	bucket = &bufmgr_gem->bo_cache.buckets[index];
+	stats->size = bucket->size;
+	stats->allocs = bucket->stats.allocs;
+	stats->hits = bucket->stats.hits;
+	stats->busy_misses = bucket->stats.busy_misses;
+	stats->flags_misses = bucket->stats.flags_misses;
+	stats->expired = bucket->stats.expired;
+	stats->dropped = bucket->stats.dropped;
+	stats->buffers = bucket->stats.buffers;
+	stats->bytes = bucket->stats.bytes;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+	return 0;
+}
+
+/**
+ * Accounts the buffer to a debug label, up to 31 characters, instead of the
+ * name it was allocated with, until it is unreferenced.
+ */
+drm_public void
+drm_intel_gem_bo_set_label(drm_intel_bo *bo, const char *label)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+	unsigned int index;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	index = util_bo_labels_find(&bufmgr_gem->bo_labels, label);
+	util_bo_labels_move(&bufmgr_gem->bo_labels, bo_gem->label, index, 0,
+			    bo->size);
+	bo_gem->label = index;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Returns the statistics of the label index of the live buffers, labeled by
+ * the name they were allocated with or drm_intel_gem_bo_set_label(), 0
+ * being those without a name. Returns -1 past the last label.
+ * Setting LIBDRM_BO_LABEL_STATS in the environment prints them when the
+ * bufmgr is destroyed.
+ */
+drm_public int
+drm_intel_bufmgr_gem_get_bo_label_stats(drm_intel_bufmgr *bufmgr,
+		unsigned int index, struct drm_intel_bo_label_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct util_bo_label *label;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (index >= bufmgr_gem->bo_labels.num_labels) {
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return -1;
+	}
+	label = &bufmgr_gem->bo_labels.labels[index];
+	memcpy(stats->name, label->name, sizeof(stats->name));
+	stats->buffers = label->buffers[0];
+	stats->bytes = label->bytes[0];
+	stats->peak_bytes = label->peak_bytes;
+	stats->allocs = label->allocs;
+	stats->alloc_bytes = label->alloc_bytes;
+	stats->alloc_rate = util_bo_labels_rate(&bufmgr_gem->bo_labels, index);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+	return 0;
+}
+
+static void
+drm_intel_gem_dump_bo_usage_locked(drm_intel_bufmgr_gem *bufmgr_gem,
+				   FILE *file)
+{
+	static const char *const heaps[] = { "bytes" };
+
+	util_bo_labels_dump(&bufmgr_gem->bo_labels, heaps,
+			    bufmgr_gem->bo_cache.stats.bytes +
+			    bufmgr_gem->userptr_cache.stats.bytes,
+			    "intel", file);
+}
+
+/**
+ * Prints the live bytes of each label and the idle bytes cached.
+ */
+drm_public void
+drm_intel_bufmgr_gem_dump_bo_usage(drm_intel_bufmgr *bufmgr, FILE *file)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	drm_intel_gem_dump_bo_usage_locked(bufmgr_gem, file);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Frees the userptr buffers kept after their last unreference for wrapping
+ * their range again, which overlap the range.  To be called before the
+ * memory is unmapped, or remapped to something else, so that the pages are
+ * not kept pinned until the buffers age out of the cache.
+ */
+drm_public void
+drm_intel_bufmgr_gem_invalidate_userptr(drm_intel_bufmgr *bufmgr,
+					void *addr, unsigned long size)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	uint64_t start = (uintptr_t)addr, end = start + size;
+	drm_intel_bo_gem *bo_gem, *tmp;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	HASH_ITER(userptr_hh, bufmgr_gem->userptr_table, bo_gem, tmp) {
+		if (bo_gem->userptr_key.addr >= end ||
+		    bo_gem->userptr_key.addr + bo_gem->userptr_key.size <= start)
+			continue;
+
+		util_bo_cache_remove(&bo_gem->cache_entry);
+		drm_intel_gem_bo_free(&bo_gem->bo);
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+static void
+drm_intel_gem_trim_cache(drm_intel_bufmgr_gem *bufmgr_gem,
+			 struct util_bo_cache *cache, unsigned int level)
+{
+	uint64_t bytes = util_bo_cache_trim_bytes(cache, level);
+	uint64_t time = util_bo_cache_now();
+	struct util_bo_cache_entry *entry;
+
+	while ((entry = util_bo_cache_evict_to(cache, time, bytes))) {
+		drm_intel_bo_gem *bo_gem =
+			DRMLISTENTRY(drm_intel_bo_gem, entry, cache_entry);
+
+		drm_intel_gem_bo_free(&bo_gem->bo);
+	}
+}
+
+static void
+drm_intel_gem_trim_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, unsigned int level)
+{
+	drm_intel_gem_trim_cache(bufmgr_gem, &bufmgr_gem->bo_cache, level);
+	drm_intel_gem_trim_cache(bufmgr_gem, &bufmgr_gem->userptr_cache, level);
+}
+
+/**
+ * Frees the cached buffers past their age, and the oldest others until
+ * level percent of the cached memory is released.  100 empties the cache.
+ */
+drm_public void
+drm_intel_bufmgr_gem_trim_bo_cache(drm_intel_bufmgr *bufmgr,
+				   unsigned int level)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	drm_intel_gem_trim_bo_cache(bufmgr_gem, level);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
 
-	/* Initialize the linked lists for BO reuse cache. */
-	for (size = 4 * 4096; size <= cache_max_size; size *= 2) {
-		add_bucket(bufmgr_gem, size);
+static void
+drm_intel_gem_bo_cache_pressure(struct util_mem_pressure *pressure,
+				unsigned int level)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = pressure->data;
 
-		add_bucket(bufmgr_gem, size + size * 1 / 4);
-		add_bucket(bufmgr_gem, size + size * 2 / 4);
-		add_bucket(bufmgr_gem, size + size * 3 / 4);
+	/* The watcher may be stopped with the lock held. */
+	while (pthread_mutex_trylock(&bufmgr_gem->lock)) {
+		if (util_mem_pressure_stopping(pressure))
+			return;
+		usleep(1000);
 	}
+	drm_intel_gem_trim_bo_cache(bufmgr_gem, level);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 }
 
+/**
+ * Trims the BO reuse cache from a thread when the kernel reports memory
+ * pressure, through PSI or the cgroup memory events.
+ *
+ * Returns -ENOTSUP when the kernel has neither.
+ */
+drm_public int
+drm_intel_bufmgr_gem_watch_memory_pressure(drm_intel_bufmgr *bufmgr,
+					   int enable)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct util_mem_pressure *pressure = NULL;
+	int ret = 0;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (enable && !bufmgr_gem->pressure) {
+		bufmgr_gem->pressure =
+			util_mem_pressure_start(drm_intel_gem_bo_cache_pressure,
+						bufmgr_gem);
+		if (!bufmgr_gem->pressure)
+			ret = -errno;
+	} else if (!enable) {
+		pressure = bufmgr_gem->pressure;
+		bufmgr_gem->pressure = NULL;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	if (pressure)
+		util_mem_pressure_stop(pressure);
+
+	return ret;
+}
+
+/**
+ * Limits the number of mappings alive, in use or cached for reuse after the
+ * buffers are unmapped, evicting the oldest cached ones. A negative limit,
+ * the default, caches all the mappings.
+ */
 drm_public void
 drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr, int limit)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
 
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
 	bufmgr_gem->vma_max = limit;
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem, 0);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+}
+
+/**
+ * Sets the address space the cached mappings of a type may take, on top of
+ * the limit on all the mappings of drm_intel_bufmgr_gem_set_vma_cache_size().
+ * The oldest mappings of the type past the budget are unmapped.
+ *
+ * \param type  - DRM_INTEL_VMA_CPU, DRM_INTEL_VMA_WC or DRM_INTEL_VMA_GTT
+ * \param bytes - Budget in bytes, 0 for no limit, the default
+ */
+drm_public int
+drm_intel_bufmgr_gem_set_vma_cache_budget(drm_intel_bufmgr *bufmgr,
+					  enum drm_intel_vma_type type,
+					  uint64_t bytes)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	if ((unsigned)type >= VMA_TYPES)
+		return -EINVAL;
 
-	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
+	bufmgr_gem->vma[type].budget = bytes;
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem, 0);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+
+	return 0;
+}
+
+/**
+ * Returns the counts of the mappings of a type: alive, cached or not, those
+ * cached and their bytes, and those unmapped for the cache limits.
+ */
+drm_public int
+drm_intel_bufmgr_gem_get_vma_cache_stats(drm_intel_bufmgr *bufmgr,
+					 enum drm_intel_vma_type type,
+					 int *mapped, int *cached,
+					 uint64_t *cached_bytes,
+					 uint64_t *evictions)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	if ((unsigned)type >= VMA_TYPES)
+		return -EINVAL;
+
+	pthread_mutex_lock(&bufmgr_gem->vma_lock);
+	*mapped = bufmgr_gem->vma[type].mapped;
+	*cached = bufmgr_gem->vma[type].cached;
+	*cached_bytes = bufmgr_gem->vma[type].cached_bytes;
+	*evictions = bufmgr_gem->vma[type].evictions;
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+
+	return 0;
+}
+
+/*
+ * Called by libdrm when the mappings of the process cross the threshold,
+ * possibly with vma_lock held by this thread or another, so the cached
+ * mappings go now or on the next purge of the cache.
+ */
+static void
+drm_intel_gem_vma_threshold(uint64_t bytes, uint64_t count, void *data)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = data;
+
+	atomic_set(&bufmgr_gem->vma_pressure, 1);
+	if (pthread_mutex_trylock(&bufmgr_gem->vma_lock))
+		return;
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem, 0);
+	pthread_mutex_unlock(&bufmgr_gem->vma_lock);
+}
+
+/**
+ * Unmaps all the cached mappings each time the mappings of the process,
+ * through libdrm and of all the devices, grow past a number of bytes.
+ *
+ * \param bytes - Threshold in bytes, 0 to remove it, the default
+ */
+drm_public int
+drm_intel_bufmgr_gem_set_vma_cache_threshold(drm_intel_bufmgr *bufmgr,
+					     uint64_t bytes)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	int ret = 0;
+
+	if (bufmgr_gem->vma_threshold)
+		drmRemoveMapThreshold(drm_intel_gem_vma_threshold, bufmgr_gem);
+	bufmgr_gem->vma_threshold = 0;
+
+	if (bytes) {
+		ret = drmAddMapThreshold(bytes, 0, drm_intel_gem_vma_threshold,
+					 bufmgr_gem);
+		if (ret == 0)
+			bufmgr_gem->vma_threshold = bytes;
+	}
+
+	return ret;
 }
 
 static int
@@ -3405,11 +4811,118 @@ drm_intel_get_reset_stats(drm_intel_context *ctx,
 
 		if (pending != NULL)
 			*pending = stats.batch_pending;
+
+		/* A new hang of the context, show what led to it */
+		if (stats.batch_active > ctx->batch_active) {
+			ctx->batch_active = stats.batch_active;
+			drm_intel_bufmgr_gem_dump_hang_capture(ctx->bufmgr,
+							       stderr);
+		}
 	}
 
 	return ret;
 }
 
+/**
+ * Keeps a copy of the first batch_size bytes of the last batches executed,
+ * with the buffers they used, for drm_intel_bufmgr_gem_dump_hang_capture().
+ * drm_intel_get_reset_stats() dumps them to stderr when it first sees the
+ * context guilty of a hang. 0 batches stops capturing.
+ *
+ * Setting LIBDRM_INTEL_HANG_CAPTURE to a number of batches in the
+ * environment enables it for every bufmgr.
+ */
+drm_public int
+drm_intel_bufmgr_gem_enable_hang_capture(drm_intel_bufmgr *bufmgr,
+					 unsigned int batches,
+					 unsigned int batch_size)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct drm_intel_gem_capture *capture = NULL, *old;
+	unsigned int i, old_count;
+	uint32_t *data;
+
+	batch_size = ALIGN(batch_size, sizeof(uint32_t));
+	if (batches) {
+		capture = calloc(batches, sizeof(*capture));
+		data = malloc((size_t)batches * batch_size);
+		if (!capture || !data) {
+			free(capture);
+			free(data);
+			return -ENOMEM;
+		}
+		for (i = 0; i < batches; i++)
+			capture[i].batch = data + (size_t)i * batch_size / 4;
+	}
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	old = bufmgr_gem->capture;
+	old_count = bufmgr_gem->capture_count;
+	bufmgr_gem->capture = capture;
+	bufmgr_gem->capture_count = batches;
+	bufmgr_gem->capture_next = 0;
+	bufmgr_gem->capture_size = batch_size;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	drm_intel_gem_free_capture(old, old_count);
+	return 0;
+}
+
+/**
+ * Prints the batches captured since the last dump, oldest first, decoded
+ * as intel_decode does, and forgets them.
+ */
+drm_public int
+drm_intel_bufmgr_gem_dump_hang_capture(drm_intel_bufmgr *bufmgr, FILE *file)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+	struct drm_intel_decode *decode;
+	unsigned int i, j;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	if (!bufmgr_gem->capture_count) {
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		return -EINVAL;
+	}
+
+	decode = drm_intel_decode_context_alloc(bufmgr_gem->pci_device);
+	if (decode)
+		drm_intel_decode_set_output_file(decode, file);
+
+	for (i = 0; i < bufmgr_gem->capture_count; i++) {
+		struct drm_intel_gem_capture *capture =
+			&bufmgr_gem->capture[(bufmgr_gem->capture_next + i) %
+					     bufmgr_gem->capture_count];
+
+		if (!capture->seqno)
+			continue;
+
+		fprintf(file, "batch %" PRIu64 ": bo %u at 0x%08" PRIx64
+			", context %u, flags 0x%x, %u of %u bytes\n",
+			capture->seqno, capture->handle, capture->offset,
+			capture->ctx_id, capture->flags, capture->used,
+			capture->batch_used);
+		for (j = 0; j < capture->num_targets; j++)
+			fprintf(file, "  bo %u at 0x%08" PRIx64 ", %" PRIu64
+				" bytes\n", capture->targets[j].handle,
+				capture->targets[j].offset,
+				capture->targets[j].size);
+
+		if (decode && capture->used) {
+			drm_intel_decode_set_batch_pointer(decode, capture->batch,
+							   capture->offset,
+							   capture->used / 4);
+			drm_intel_decode(decode);
+		}
+		capture->seqno = 0;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	if (decode)
+		drm_intel_decode_context_free(decode);
+	return 0;
+}
+
 drm_public int
 drm_intel_reg_read(drm_intel_bufmgr *bufmgr,
 		   uint32_t offset,
@@ -3563,7 +5076,7 @@ drm_public void *drm_intel_gem_bo_map__gtt(drm_intel_bo *bo)
 	if (bo_gem->is_userptr)
 		return NULL;
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bo_gem->map_lock);
 	if (bo_gem->gtt_virtual == NULL) {
 		struct drm_i915_gem_mmap_gtt mmap_arg;
 		void *ptr;
@@ -3571,8 +5084,9 @@ drm_public void *drm_intel_gem_bo_map__gtt(drm_intel_bo *bo)
 		DBG("bo_map_gtt: mmap %d (%s), map_count=%d\n",
 		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
 
-		if (bo_gem->map_count++ == 0)
+		if (bo_gem->map_count == 0)
 			drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
+		bo_gem->map_count++;
 
 		memclear(mmap_arg);
 		mmap_arg.handle = bo_gem->gem_handle;
@@ -3594,8 +5108,11 @@ drm_public void *drm_intel_gem_bo_map__gtt(drm_intel_bo *bo)
 		}
 
 		bo_gem->gtt_virtual = ptr;
+		if (ptr)
+			drm_intel_gem_bo_add_vma(bufmgr_gem, bo_gem,
+						 DRM_INTEL_VMA_GTT);
 	}
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bo_gem->map_lock);
 
 	return bo_gem->gtt_virtual;
 }
@@ -3613,12 +5130,13 @@ drm_public void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo)
 		return bo_gem->user_virtual;
 	}
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bo_gem->map_lock);
 	if (!bo_gem->mem_virtual) {
 		struct drm_i915_gem_mmap mmap_arg;
 
-		if (bo_gem->map_count++ == 0)
+		if (bo_gem->map_count == 0)
 			drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
+		bo_gem->map_count++;
 
 		DBG("bo_map: %d (%s), map_count=%d\n",
 		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
@@ -3637,9 +5155,11 @@ drm_public void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo)
 		} else {
 			VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
 			bo_gem->mem_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+			drm_intel_gem_bo_add_vma(bufmgr_gem, bo_gem,
+						 DRM_INTEL_VMA_CPU);
 		}
 	}
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bo_gem->map_lock);
 
 	return bo_gem->mem_virtual;
 }
@@ -3655,12 +5175,13 @@ drm_public void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo)
 	if (bo_gem->is_userptr)
 		return NULL;
 
-	pthread_mutex_lock(&bufmgr_gem->lock);
+	pthread_mutex_lock(&bo_gem->map_lock);
 	if (!bo_gem->wc_virtual) {
 		struct drm_i915_gem_mmap mmap_arg;
 
-		if (bo_gem->map_count++ == 0)
+		if (bo_gem->map_count == 0)
 			drm_intel_gem_bo_open_vma(bufmgr_gem, bo_gem);
+		bo_gem->map_count++;
 
 		DBG("bo_map: %d (%s), map_count=%d\n",
 		    bo_gem->gem_handle, bo_gem->name, bo_gem->map_count);
@@ -3680,9 +5201,11 @@ drm_public void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo)
 		} else {
 			VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
 			bo_gem->wc_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+			drm_intel_gem_bo_add_vma(bufmgr_gem, bo_gem,
+						 DRM_INTEL_VMA_WC);
 		}
 	}
-	pthread_mutex_unlock(&bufmgr_gem->lock);
+	pthread_mutex_unlock(&bo_gem->map_lock);
 
 	return bo_gem->wc_virtual;
 }
@@ -3699,7 +5222,8 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	drm_intel_bufmgr_gem *bufmgr_gem;
 	struct drm_i915_gem_get_aperture aperture;
 	drm_i915_getparam_t gp;
-	int ret, tmp;
+	const char *env;
+	int ret, tmp, i;
 	bool exec2 = false;
 
 	pthread_mutex_lock(&bufmgr_list_mutex);
@@ -3721,6 +5245,30 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 		goto exit;
 	}
 
+	if (pthread_mutex_init(&bufmgr_gem->upload_lock, NULL) != 0) {
+		pthread_mutex_destroy(&bufmgr_gem->lock);
+		free(bufmgr_gem);
+		bufmgr_gem = NULL;
+		goto exit;
+	}
+
+	if (pthread_mutex_init(&bufmgr_gem->vma_lock, NULL) != 0) {
+		pthread_mutex_destroy(&bufmgr_gem->upload_lock);
+		pthread_mutex_destroy(&bufmgr_gem->lock);
+		free(bufmgr_gem);
+		bufmgr_gem = NULL;
+		goto exit;
+	}
+
+	if (pthread_mutex_init(&bufmgr_gem->engine_lock, NULL) != 0) {
+		pthread_mutex_destroy(&bufmgr_gem->vma_lock);
+		pthread_mutex_destroy(&bufmgr_gem->upload_lock);
+		pthread_mutex_destroy(&bufmgr_gem->lock);
+		free(bufmgr_gem);
+		bufmgr_gem = NULL;
+		goto exit;
+	}
+
 	memclear(aperture);
 	ret = drmIoctl(bufmgr_gem->fd,
 		       DRM_IOCTL_I915_GEM_GET_APERTURE,
@@ -3781,6 +5329,10 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
 	bufmgr_gem->has_bsd = ret == 0;
 
+	gp.param = I915_PARAM_HAS_BSD2;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
+	bufmgr_gem->has_bsd2 = ret == 0 && *gp.value > 0;
+
 	gp.param = I915_PARAM_HAS_BLT;
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
 	bufmgr_gem->has_blt = ret == 0;
@@ -3793,6 +5345,18 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
 	bufmgr_gem->has_exec_async = ret == 0;
 
+	gp.param = I915_PARAM_HAS_EXEC_FENCE_ARRAY;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
+	bufmgr_gem->has_exec_fence_array = ret == 0 && *gp.value > 0;
+
+	gp.param = I915_PARAM_HAS_EXEC_NO_RELOC;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
+	bufmgr_gem->has_exec_no_reloc = ret == 0 && *gp.value > 0;
+
+	gp.param = I915_PARAM_HAS_EXEC_HANDLE_LUT;
+	ret = drmIoctl(bufmgr_gem->fd, DRM_IOCTL_I915_GETPARAM, &gp);
+	bufmgr_gem->has_exec_handle_lut = ret == 0 && *gp.value > 0;
+
 	bufmgr_gem->bufmgr.bo_alloc_userptr = check_bo_alloc_userptr;
 
 	gp.param = I915_PARAM_HAS_WAIT_TIMEOUT;
@@ -3898,8 +5462,16 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 
 	init_cache_buckets(bufmgr_gem);
 
-	DRMINITLISTHEAD(&bufmgr_gem->vma_cache);
+	for (i = 0; i < VMA_TYPES; i++)
+		DRMINITLISTHEAD(&bufmgr_gem->vma_cache[i]);
 	bufmgr_gem->vma_max = -1; /* unlimited by default */
+	util_bo_labels_init(&bufmgr_gem->bo_labels, 1);
+
+	env = getenv("LIBDRM_INTEL_HANG_CAPTURE");
+	if (env)
+		drm_intel_bufmgr_gem_enable_hang_capture(&bufmgr_gem->bufmgr,
+							 strtoul(env, NULL, 0),
+							 CAPTURE_BATCH_SIZE);
 
 	DRMLISTADD(&bufmgr_gem->managers, &bufmgr_list);
 
@@ -316,6 +316,8 @@ struct _drm_intel_bufmgr {
 struct _drm_intel_context {
 	unsigned int ctx_id;
 	struct _drm_intel_bufmgr *bufmgr;
+	/** batch_active last seen by drm_intel_get_reset_stats() */
+	uint32_t batch_active;
 };
 
 #define ALIGN(value, alignment)	((value + alignment - 1) & ~(alignment - 1))
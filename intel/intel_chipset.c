@@ -24,16 +24,43 @@
 
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
 
+struct pci_device {
+	uint16_t device;
+	uint16_t gen;
+};
+
+#ifdef INTEL_PCIIDS_SORTED
+#include "generated_intel_pciids.h"
+
+static const struct pci_device *intel_find_device(unsigned int devid)
+{
+	unsigned lo = 0;
+	unsigned hi = sizeof(pciids_sorted) / sizeof(pciids_sorted[0]);
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+
+		if (pciids_sorted[mid].device < devid)
+			lo = mid + 1;
+		else if (pciids_sorted[mid].device > devid)
+			hi = mid;
+		else
+			return &pciids_sorted[mid];
+	}
+
+	return NULL;
+}
+#else
 #include "i915_pciids.h"
 
 #undef INTEL_VGA_DEVICE
 #define INTEL_VGA_DEVICE(id, gen) { id, gen }
 
-static const struct pci_device {
-	uint16_t device;
-	uint16_t gen;
-} pciids[] = {
+/* gen_table_pciids.py reads this table, the meson build looks the ids up
+ * in the sorted table it generates. */
+static const struct pci_device pciids[] = {
 	/* Keep ids sorted by gen; latest gen first */
 	INTEL_ADLP_IDS(12),
 	INTEL_ADLS_IDS(12),
@@ -51,42 +78,37 @@ static const struct pci_device {
 	INTEL_SKL_IDS(9),
 };
 
-drm_private bool intel_is_genx(unsigned int devid, int gen)
+static const struct pci_device *intel_find_device(unsigned int devid)
 {
 	const struct pci_device *p,
 		  *pend = pciids + sizeof(pciids) / sizeof(pciids[0]);
 
+	/* The first match has the latest gen */
 	for (p = pciids; p < pend; p++) {
-		/* PCI IDs are sorted */
-		if (p->gen < gen)
-			break;
-
-		if (p->device != devid)
-			continue;
+		if (p->device == devid)
+			return p;
+	}
 
-		if (gen == p->gen)
-			return true;
+	return NULL;
+}
+#endif
 
-		break;
-	}
+drm_private bool intel_is_genx(unsigned int devid, int gen)
+{
+	const struct pci_device *p = intel_find_device(devid);
 
-	return false;
+	return p && p->gen == gen;
 }
 
 drm_private bool intel_get_genx(unsigned int devid, int *gen)
 {
-	const struct pci_device *p,
-		  *pend = pciids + sizeof(pciids) / sizeof(pciids[0]);
+	const struct pci_device *p = intel_find_device(devid);
 
-	for (p = pciids; p < pend; p++) {
-		if (p->device != devid)
-			continue;
-
-		if (gen)
-			*gen = p->gen;
+	if (!p)
+		return false;
 
-		return true;
-	}
+	if (gen)
+		*gen = p->gen;
 
-	return false;
+	return true;
 }
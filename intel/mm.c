@@ -29,79 +29,144 @@
 #include "libdrm_macros.h"
 #include "mm.h"
 
+/* Free blocks are kept in lists by the power of two of their size, and a
+ * bit is set in the mask of the heap for each list that isn't empty. */
+#define MM_NUM_BINS 64
+
+struct mem_heap {
+	/* The list of all the blocks, by offset. Must be first. */
+	struct mem_block head;
+	uint64_t bin_mask;
+	struct mem_block bins[MM_NUM_BINS];
+};
+
+static inline struct mem_heap *to_heap(struct mem_block *heap)
+{
+	return (struct mem_heap *)heap;
+}
+
+static inline int mmBin(uint64_t size)
+{
+	return 63 - __builtin_clzll(size);
+}
+
+static void mmAddFree(struct mem_block *p)
+{
+	struct mem_heap *heap = to_heap(p->heap);
+	int bin = mmBin(p->size);
+	struct mem_block *list = &heap->bins[bin];
+
+	p->next_free = list->next_free;
+	p->prev_free = list;
+	list->next_free->prev_free = p;
+	list->next_free = p;
+	heap->bin_mask |= 1ull << bin;
+}
+
+static void mmRemoveFree(struct mem_block *p)
+{
+	struct mem_heap *heap = to_heap(p->heap);
+	int bin = mmBin(p->size);
+
+	p->next_free->prev_free = p->prev_free;
+	p->prev_free->next_free = p->next_free;
+	p->next_free = NULL;
+	p->prev_free = NULL;
+	if (heap->bins[bin].next_free == &heap->bins[bin])
+		heap->bin_mask &= ~(1ull << bin);
+}
+
 drm_private void mmDumpMemInfo(const struct mem_block *heap)
 {
 	drmMsg("Memory heap %p:\n", (void *)heap);
 	if (heap == 0) {
 		drmMsg("  heap == 0\n");
 	} else {
+		const struct mem_heap *mem_heap = (const struct mem_heap *)heap;
 		const struct mem_block *p;
+		int bin;
 
 		for (p = heap->next; p != heap; p = p->next) {
-			drmMsg("  Offset:%08x, Size:%08x, %c%c\n", p->ofs,
-			       p->size, p->free ? 'F' : '.',
+			drmMsg("  Offset:%08llx, Size:%08llx, %c%c\n",
+			       (unsigned long long)p->ofs,
+			       (unsigned long long)p->size, p->free ? 'F' : '.',
 			       p->reserved ? 'R' : '.');
 		}
 
 		drmMsg("\nFree list:\n");
 
-		for (p = heap->next_free; p != heap; p = p->next_free) {
-			drmMsg(" FREE Offset:%08x, Size:%08x, %c%c\n", p->ofs,
-			       p->size, p->free ? 'F' : '.',
-			       p->reserved ? 'R' : '.');
+		for (bin = 0; bin < MM_NUM_BINS; bin++) {
+			const struct mem_block *list = &mem_heap->bins[bin];
+
+			for (p = list->next_free; p != list; p = p->next_free) {
+				drmMsg(" FREE Offset:%08llx, Size:%08llx, %c%c\n",
+				       (unsigned long long)p->ofs,
+				       (unsigned long long)p->size,
+				       p->free ? 'F' : '.',
+				       p->reserved ? 'R' : '.');
+			}
 		}
 
 	}
 	drmMsg("End of memory blocks\n");
 }
 
-drm_private struct mem_block *mmInit(int ofs, int size)
+drm_private struct mem_block *mmInit(uint64_t ofs, uint64_t size)
 {
+	struct mem_heap *mem_heap;
 	struct mem_block *heap, *block;
+	int bin;
 
-	if (size <= 0)
+	if (size == 0)
 		return NULL;
 
-	heap = (struct mem_block *)calloc(1, sizeof(struct mem_block));
-	if (!heap)
+	mem_heap = (struct mem_heap *)calloc(1, sizeof(struct mem_heap));
+	if (!mem_heap)
 		return NULL;
 
 	block = (struct mem_block *)calloc(1, sizeof(struct mem_block));
 	if (!block) {
-		free(heap);
+		free(mem_heap);
 		return NULL;
 	}
 
+	for (bin = 0; bin < MM_NUM_BINS; bin++) {
+		mem_heap->bins[bin].next_free = &mem_heap->bins[bin];
+		mem_heap->bins[bin].prev_free = &mem_heap->bins[bin];
+	}
+
+	heap = &mem_heap->head;
 	heap->next = block;
 	heap->prev = block;
-	heap->next_free = block;
-	heap->prev_free = block;
 
 	block->heap = heap;
 	block->next = heap;
 	block->prev = heap;
-	block->next_free = heap;
-	block->prev_free = heap;
 
 	block->ofs = ofs;
 	block->size = size;
 	block->free = 1;
+	mmAddFree(block);
 
 	return heap;
 }
 
 static struct mem_block *SliceBlock(struct mem_block *p,
-				    int startofs, int size,
-				    int reserved, int alignment)
+				    uint64_t startofs, uint64_t size,
+				    int reserved, uint64_t alignment)
 {
 	struct mem_block *newblock;
 
+	mmRemoveFree(p);
+
 	/* break left  [p, newblock, p->next], then p = newblock */
 	if (startofs > p->ofs) {
 		newblock =
 		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+		if (!newblock) {
+			mmAddFree(p);
 			return NULL;
+		}
 		newblock->ofs = startofs;
 		newblock->size = p->size - (startofs - p->ofs);
 		newblock->free = 1;
@@ -112,12 +177,8 @@ static struct mem_block *SliceBlock(struct mem_block *p,
 		p->next->prev = newblock;
 		p->next = newblock;
 
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
-
 		p->size -= newblock->size;
+		mmAddFree(p);
 		p = newblock;
 	}
 
@@ -125,8 +186,10 @@ static struct mem_block *SliceBlock(struct mem_block *p,
 	if (size < p->size) {
 		newblock =
 		    (struct mem_block *)calloc(1, sizeof(struct mem_block));
-		if (!newblock)
+		if (!newblock) {
+			mmAddFree(p);
 			return NULL;
+		}
 		newblock->ofs = startofs + size;
 		newblock->size = p->size - size;
 		newblock->free = 1;
@@ -136,54 +199,62 @@ static struct mem_block *SliceBlock(struct mem_block *p,
 		newblock->prev = p;
 		p->next->prev = newblock;
 		p->next = newblock;
-
-		newblock->next_free = p->next_free;
-		newblock->prev_free = p;
-		p->next_free->prev_free = newblock;
-		p->next_free = newblock;
+		mmAddFree(newblock);
 
 		p->size = size;
 	}
 
 	/* p = middle block */
 	p->free = 0;
-
-	/* Remove p from the free list: 
-	 */
-	p->next_free->prev_free = p->prev_free;
-	p->prev_free->next_free = p->next_free;
-
-	p->next_free = 0;
-	p->prev_free = 0;
-
 	p->reserved = reserved;
 	return p;
 }
 
-drm_private struct mem_block *mmAllocMem(struct mem_block *heap, int size,
-					 int align2, int startSearch)
+/* The first block of the list fitting the allocation, if any. */
+static struct mem_block *mmFindFree(struct mem_block *list, uint64_t size,
+				    uint64_t mask, uint64_t startSearch,
+				    uint64_t *startofs)
 {
 	struct mem_block *p;
-	const int mask = (1 << align2) - 1;
-	int startofs = 0;
-	int endofs;
-
-	if (!heap || align2 < 0 || size <= 0)
-		return NULL;
 
-	for (p = heap->next_free; p != heap; p = p->next_free) {
+	for (p = list->next_free; p != list; p = p->next_free) {
 		assert(p->free);
 
-		startofs = (p->ofs + mask) & ~mask;
-		if (startofs < startSearch) {
-			startofs = startSearch;
+		*startofs = (p->ofs + mask) & ~mask;
+		if (*startofs < startSearch) {
+			*startofs = startSearch;
 		}
-		endofs = startofs + size;
-		if (endofs <= (p->ofs + p->size))
-			break;
+		if (*startofs + size <= (p->ofs + p->size))
+			return p;
+	}
+	return NULL;
+}
+
+drm_private struct mem_block *mmAllocMem(struct mem_block *heap, uint64_t size,
+					 int align2, uint64_t startSearch)
+{
+	struct mem_heap *mem_heap = to_heap(heap);
+	struct mem_block *p = NULL;
+	uint64_t mask, bins;
+	uint64_t startofs = 0;
+	int bin;
+
+	if (!heap || align2 < 0 || align2 > 63 || size == 0)
+		return NULL;
+
+	mask = (1ull << align2) - 1;
+
+	/* Take from the smallest sizes that may fit, any block of a list
+	 * above size + mask fitting unless startSearch is in the way. */
+	bins = mem_heap->bin_mask & ~((1ull << mmBin(size)) - 1);
+	while (bins && !p) {
+		bin = __builtin_ctzll(bins);
+		bins &= bins - 1;
+		p = mmFindFree(&mem_heap->bins[bin], size, mask, startSearch,
+			       &startofs);
 	}
 
-	if (p == heap)
+	if (!p)
 		return NULL;
 
 	assert(p->free);
@@ -202,14 +273,14 @@ static int Join2Blocks(struct mem_block *p)
 		struct mem_block *q = p->next;
 
 		assert(p->ofs + p->size == q->ofs);
+		mmRemoveFree(p);
+		mmRemoveFree(q);
 		p->size += q->size;
 
 		p->next = q->next;
 		q->next->prev = p;
 
-		q->next_free->prev_free = q->prev_free;
-		q->prev_free->next_free = q->next_free;
-
+		mmAddFree(p);
 		free(q);
 		return 1;
 	}
@@ -231,10 +302,7 @@ drm_private int mmFreeMem(struct mem_block *b)
 	}
 
 	b->free = 1;
-	b->next_free = b->heap->next_free;
-	b->prev_free = b->heap;
-	b->next_free->prev_free = b;
-	b->prev_free->next_free = b;
+	mmAddFree(b);
 
 	Join2Blocks(b);
 	if (b->prev != b->heap)
@@ -256,5 +324,5 @@ drm_private void mmDestroy(struct mem_block *heap)
 		p = next;
 	}
 
-	free(heap);
+	free(to_heap(heap));
 }
@@ -24,6 +24,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
@@ -42,6 +43,7 @@ usage(void)
 	fprintf(stderr, "usage:\n");
 	fprintf(stderr, "  test_decode <batch>\n");
 	fprintf(stderr, "  test_decode <batch> -dump\n");
+	fprintf(stderr, "  test_decode -bench <iterations> [-size <MiB>] <batch>...\n");
 	exit(1);
 }
 
@@ -82,6 +84,51 @@ dump_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 	drm_intel_decode(ctx);
 }
 
+struct output {
+	char *ptr;
+	size_t size;
+};
+
+static void
+append_output(void *data, const char *text, size_t len)
+{
+	struct output *output = data;
+
+	output->ptr = realloc(output->ptr, output->size + len + 1);
+	if (!output->ptr)
+		errx(1, "out of memory");
+	memcpy(output->ptr + output->size, text, len);
+	output->size += len;
+	output->ptr[output->size] = '\0';
+}
+
+/* Decodes the batch as if it were written a few dwords at a time. */
+static void
+compare_batch_incremental(struct drm_intel_decode *ctx, void *batch_ptr,
+			  size_t batch_size, const char *ref_ptr,
+			  const char *ref_filename)
+{
+	struct output output = { NULL, 0 };
+	int count, total = batch_size / 4;
+
+	drm_intel_decode_set_output_func(ctx, append_output, &output);
+	for (count = 0; count < total; count += 7) {
+		drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET,
+						   count);
+		drm_intel_decode_incremental(ctx);
+	}
+	drm_intel_decode_set_batch_pointer(ctx, batch_ptr, HW_OFFSET, total);
+	drm_intel_decode_incremental(ctx);
+
+	if (!output.ptr || strcmp(ref_ptr, output.ptr) != 0) {
+		fprintf(stderr, "Incremental decode mismatch with reference "
+			"`%s'.\n", ref_filename);
+		exit(1);
+	}
+
+	free(output.ptr);
+}
+
 static void
 compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 {
@@ -127,12 +174,15 @@ compare_batch(struct drm_intel_decode *ctx, const char *batch_filename)
 	}
 
 	fclose(out);
-	free(ref_filename);
 	free(ptr);
+
+	compare_batch_incremental(ctx, batch_ptr, batch_size, ref_ptr,
+				  ref_filename);
+	free(ref_filename);
 }
 
 static uint16_t
-infer_devid(const char *batch_filename)
+infer_devid(const char *batch_filename, const char **chipset)
 {
 	struct {
 		const char *name;
@@ -152,8 +202,11 @@ infer_devid(const char *batch_filename)
 	int i;
 
 	for (i = 0; chipsets[i].name != NULL; i++) {
-		if (strstr(batch_filename, chipsets[i].name))
+		if (strstr(batch_filename, chipsets[i].name)) {
+			if (chipset)
+				*chipset = chipsets[i].name;
 			return chipsets[i].devid;
+		}
 	}
 
 	fprintf(stderr, "Couldn't guess chipset id from batch filename `%s'.\n",
@@ -165,6 +218,104 @@ infer_devid(const char *batch_filename)
 	exit(1);
 }
 
+static void
+discard_output(void *data, const char *text, size_t len)
+{
+}
+
+static double
+get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Decodes the batch iterations times into a null sink and reports the
+ * throughput. With a size, the batch is first repeated up to that many
+ * bytes and decoded past its MI_BATCH_BUFFER_ENDs, as a large batch of
+ * the generation's packets.
+ */
+static void
+bench_batch(const char *batch_filename, int iterations, size_t size)
+{
+	struct drm_intel_decode *ctx;
+	const char *chipset;
+	void *batch_ptr, *ptr;
+	size_t batch_size, offset;
+	uint32_t dwords;
+	double start, elapsed;
+	uint16_t devid;
+	int i;
+
+	devid = infer_devid(batch_filename, &chipset);
+	read_file(batch_filename, &batch_ptr, &batch_size);
+	batch_size &= ~(size_t)3;
+	if (!batch_size)
+		errx(1, "`%s' is empty", batch_filename);
+
+	ptr = batch_ptr;
+	if (size) {
+		size = (size + batch_size - 1) / batch_size * batch_size;
+		ptr = malloc(size);
+		if (!ptr)
+			errx(1, "out of memory");
+		for (offset = 0; offset < size; offset += batch_size)
+			memcpy((char *)ptr + offset, batch_ptr, batch_size);
+		batch_size = size;
+	}
+	dwords = batch_size / 4;
+
+	ctx = drm_intel_decode_context_alloc(devid);
+	drm_intel_decode_set_output_func(ctx, discard_output, NULL);
+	drm_intel_decode_set_dump_past_end(ctx, size != 0);
+	drm_intel_decode_set_batch_pointer(ctx, ptr, HW_OFFSET, dwords);
+
+	start = get_time();
+	for (i = 0; i < iterations; i++)
+		drm_intel_decode(ctx);
+	elapsed = get_time() - start;
+
+	printf("%-5s %-40s %9u dwords x %d: %8.3f s, %8.2f Mdwords/s\n",
+	       chipset, batch_filename, dwords, iterations, elapsed,
+	       elapsed > 0 ? (double)dwords * iterations / elapsed / 1e6 : 0);
+
+	drm_intel_decode_context_free(ctx);
+	if (ptr != batch_ptr)
+		free(ptr);
+}
+
+static int
+bench(int argc, char **argv)
+{
+	int iterations, i = 2;
+	size_t size = 0;
+	char *end;
+
+	if (argc < 4)
+		usage();
+
+	iterations = strtol(argv[i++], &end, 10);
+	if (*end || iterations <= 0)
+		usage();
+
+	if (strcmp(argv[i], "-size") == 0) {
+		if (argc < 6)
+			usage();
+		size = strtoul(argv[i + 1], &end, 10) << 20;
+		if (*end || !size)
+			usage();
+		i += 2;
+	}
+
+	for (; i < argc; i++)
+		bench_batch(argv[i], iterations, size);
+
+	return 0;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -174,8 +325,10 @@ main(int argc, char **argv)
 	if (argc < 2)
 		usage();
 
+	if (strcmp(argv[1], "-bench") == 0)
+		return bench(argc, argv);
 
-	devid = infer_devid(argv[1]);
+	devid = infer_devid(argv[1], NULL);
 
 	ctx = drm_intel_decode_context_alloc(devid);
 
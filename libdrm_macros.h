@@ -45,6 +45,10 @@
 
 #include <sys/mman.h>
 
+/* Accounting of the mappings, in xf86drm.c. */
+extern void drmMapTrack(int fd, void *addr, size_t size);
+extern void drmMapUntrack(void *addr);
+
 #if defined(ANDROID) && !defined(__LP64__)
 #include <errno.h> /* for EINVAL */
 
@@ -57,18 +61,30 @@ static inline void *drm_mmap(void *addr, size_t length, int prot, int flags,
       return MAP_FAILED;
    }
 
-   return mmap64(addr, length, prot, flags, fd, offset);
+   addr = mmap64(addr, length, prot, flags, fd, offset);
+   if (addr != MAP_FAILED)
+      drmMapTrack(fd, addr, length);
+   return addr;
 }
 
-#  define drm_munmap(addr, length) \
-              munmap(addr, length)
+static inline int drm_munmap(void *addr, size_t length)
+{
+   drmMapUntrack(addr);
+   return munmap(addr, length);
+}
 
 
 #else
 
 /* assume large file support exists */
-#  define drm_mmap(addr, length, prot, flags, fd, offset) \
-              mmap(addr, length, prot, flags, fd, offset)
+static inline void *drm_mmap(void *addr, size_t length, int prot, int flags,
+                             int fd, off_t offset)
+{
+   addr = mmap(addr, length, prot, flags, fd, offset);
+   if (addr != MAP_FAILED)
+      drmMapTrack(fd, addr, length);
+   return addr;
+}
 
 
 static inline int drm_munmap(void *addr, size_t length)
@@ -80,6 +96,7 @@ static inline int drm_munmap(void *addr, size_t length)
                  LARGE_OFF_T % 2147483647 == 1);
 #undef LARGE_OFF_T
 
+   drmMapUntrack(addr);
    return munmap(addr, length);
 }
 #endif
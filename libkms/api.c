@@ -64,7 +64,9 @@ drm_public int kms_bo_create(struct kms_driver *kms, const unsigned *attr, struc
 	unsigned width = 0;
 	unsigned height = 0;
 	enum kms_bo_type type = KMS_BO_TYPE_SCANOUT_X8R8G8B8;
-	int i;
+	unsigned persistent_map = 0;
+	unsigned prefault = 0;
+	int i, ret;
 
 	for (i = 0; attr[i];) {
 		unsigned key = attr[i++];
@@ -80,6 +82,12 @@ drm_public int kms_bo_create(struct kms_driver *kms, const unsigned *attr, struc
 		case KMS_BO_TYPE:
 			type = value;
 			break;
+		case KMS_BO_PERSISTENT_MAP:
+			persistent_map = !!value;
+			break;
+		case KMS_BO_PREFAULT:
+			prefault = !!value;
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -94,7 +102,13 @@ drm_public int kms_bo_create(struct kms_driver *kms, const unsigned *attr, struc
 	    (width != 64 || height != 64))
 		return -EINVAL;
 
-	return kms->bo_create(kms, width, height, type, attr, out);
+	ret = kms->bo_create(kms, width, height, type, attr, out);
+	if (ret)
+		return ret;
+
+	(*out)->persistent_map = persistent_map;
+	(*out)->prefault = prefault;
+	return 0;
 }
 
 drm_public int kms_bo_get_prop(struct kms_bo *bo, unsigned key, unsigned *out)
@@ -106,6 +120,12 @@ drm_public int kms_bo_get_prop(struct kms_bo *bo, unsigned key, unsigned *out)
 	case KMS_HANDLE:
 		*out = bo->handle;
 		break;
+	case KMS_BO_PERSISTENT_MAP:
+		*out = bo->persistent_map;
+		break;
+	case KMS_BO_PREFAULT:
+		*out = bo->prefault;
+		break;
 	default:
 		return -EINVAL;
 	}
@@ -80,6 +80,8 @@ exynos_bo_create(struct kms_driver *kms,
 		case KMS_WIDTH:
 		case KMS_HEIGHT:
 		case KMS_BO_TYPE:
+		case KMS_BO_PERSISTENT_MAP:
+		case KMS_BO_PREFAULT:
 			break;
 		default:
 			return -EINVAL;
@@ -153,7 +155,8 @@ exynos_bo_map(struct kms_bo *_bo, void **out)
 	if (ret)
 		return ret;
 
-	map = drm_mmap(0, bo->base.size, PROT_READ | PROT_WRITE, MAP_SHARED, bo->base.kms->fd, arg.offset);
+	map = drm_mmap(0, bo->base.size, PROT_READ | PROT_WRITE,
+		       kms_bo_map_flags(&bo->base), bo->base.kms->fd, arg.offset);
 	if (map == MAP_FAILED)
 		return -errno;
 
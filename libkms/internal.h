@@ -61,8 +61,21 @@ struct kms_bo
 	size_t offset;
 	size_t pitch;
 	unsigned handle;
+	/* keep the mapping from the last unmap until destroy */
+	unsigned persistent_map;
+	/* fault the pages in when mapping */
+	unsigned prefault;
 };
 
+static inline int kms_bo_map_flags(struct kms_bo *bo)
+{
+#ifdef MAP_POPULATE
+	if (bo->prefault)
+		return MAP_SHARED | MAP_POPULATE;
+#endif
+	return MAP_SHARED;
+}
+
 drm_private int linux_create(int fd, struct kms_driver **out);
 
 drm_private int vmwgfx_create(int fd, struct kms_driver **out);
@@ -29,6 +29,8 @@
 #ifndef _LIBKMS_H_
 #define _LIBKMS_H_
 
+#include <stdint.h>
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -40,6 +42,8 @@ extern "C" {
 
 struct kms_driver;
 struct kms_bo;
+struct kms_swapchain;
+struct _drmModeModeInfo;
 
 enum kms_attrib
 {
@@ -55,6 +59,10 @@ enum kms_attrib
 #define KMS_PITCH KMS_PITCH
 	KMS_HANDLE,
 #define KMS_HANDLE KMS_HANDLE
+	KMS_BO_PERSISTENT_MAP,
+#define KMS_BO_PERSISTENT_MAP KMS_BO_PERSISTENT_MAP
+	KMS_BO_PREFAULT,
+#define KMS_BO_PREFAULT KMS_BO_PREFAULT
 };
 
 enum kms_bo_type
@@ -75,6 +83,61 @@ int kms_bo_map(struct kms_bo *bo, void **out);
 int kms_bo_unmap(struct kms_bo *bo);
 int kms_bo_destroy(struct kms_bo **bo);
 
+/**
+ * Scanout buffers, created and mapped once, and flipped to in turn on a
+ * crtc. A buffer is acquired to draw to, then presented or released; age
+ * is the number of frames since it was last presented, 0 if its contents
+ * are undefined, for partial redraws.
+ *
+ * The first present sets the mode, the others queue a page flip with the
+ * swapchain as user_data. The swapchain reads the events of the fd while
+ * it waits for a flip, so no other page flip may be queued on the fd, and
+ * vblank events are dropped; a caller polling the fd itself calls
+ * kms_swapchain_handle_event() once it is readable.
+ *
+ * A mode change needs a new swapchain.
+ */
+#define KMS_SWAPCHAIN_MAX_BUFFERS 4
+
+int kms_swapchain_create(struct kms_driver *kms, uint32_t crtc_id,
+			 uint32_t connector_id,
+			 const struct _drmModeModeInfo *mode, unsigned count,
+			 struct kms_swapchain **out);
+int kms_swapchain_destroy(struct kms_swapchain **sc);
+int kms_swapchain_acquire(struct kms_swapchain *sc, unsigned *index,
+			  void **ptr, unsigned *pitch, unsigned *age);
+int kms_swapchain_release(struct kms_swapchain *sc, unsigned index);
+int kms_swapchain_present(struct kms_swapchain *sc, unsigned index);
+int kms_swapchain_handle_event(struct kms_swapchain *sc);
+int kms_swapchain_get_fb(struct kms_swapchain *sc, unsigned index,
+			 uint32_t *fb_id);
+
+/**
+ * Software rendering to mapped buffers, such as the ones of a swapchain.
+ * The rectangles are given by the address of their first pixel and the
+ * pitch in bytes of their lines, their formats by DRM_FORMAT_* codes:
+ * XRGB8888, ARGB8888, XRGB2101010, ARGB2101010 or RGB565.
+ *
+ * kms_blend() draws premultiplied ARGB8888 over an 8888 destination.
+ * kms_convert() converts between 8888 and the others, the alpha of alpha
+ * formats being opaque when the source has none. kms_convert_nv12() writes
+ * the BT.601 limited range luma and the interleaved chroma planes of an
+ * 8888 source, each chroma sample from the average of a 2x2 block.
+ */
+int kms_fill(void *dst, unsigned pitch, uint32_t format, unsigned width,
+	     unsigned height, uint32_t pixel);
+int kms_copy(void *dst, unsigned dst_pitch, const void *src,
+	     unsigned src_pitch, uint32_t format, unsigned width,
+	     unsigned height);
+int kms_blend(void *dst, unsigned dst_pitch, const void *src,
+	      unsigned src_pitch, unsigned width, unsigned height);
+int kms_convert(void *dst, unsigned dst_pitch, uint32_t dst_format,
+		const void *src, unsigned src_pitch, uint32_t src_format,
+		unsigned width, unsigned height);
+int kms_convert_nv12(void *y, unsigned y_pitch, void *uv, unsigned uv_pitch,
+		     const void *src, unsigned src_pitch, unsigned width,
+		     unsigned height);
+
 #if defined(__cplusplus)
 };
 #endif
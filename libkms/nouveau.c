@@ -81,6 +81,8 @@ nouveau_bo_create(struct kms_driver *kms,
 		case KMS_WIDTH:
 		case KMS_HEIGHT:
 		case KMS_BO_TYPE:
+		case KMS_BO_PERSISTENT_MAP:
+		case KMS_BO_PREFAULT:
 			break;
 		default:
 			return -EINVAL;
@@ -151,7 +153,8 @@ nouveau_bo_map(struct kms_bo *_bo, void **out)
 		return 0;
 	}
 
-	map = drm_mmap(0, bo->base.size, PROT_READ | PROT_WRITE, MAP_SHARED, bo->base.kms->fd, bo->map_handle);
+	map = drm_mmap(0, bo->base.size, PROT_READ | PROT_WRITE,
+		       kms_bo_map_flags(&bo->base), bo->base.kms->fd, bo->map_handle);
 	if (map == MAP_FAILED)
 		return -errno;
 
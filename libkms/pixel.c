@@ -0,0 +1,555 @@
+/**************************************************************************
+ *
+ * Copyright © 2009 VMware, Inc., Palo Alto, CA., USA
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Software rendering helpers for mapped buffers.
+ *
+ * The pixels are processed 4 or 8 at a time with SSE2 or NEON when the
+ * compiler targets them, which x86-64 and aarch64 always do, the ends of the
+ * lines and the other targets one at a time.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "libdrm_macros.h"
+#include "drm_fourcc.h"
+#include "internal.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define KMS_PIXEL_SIMD 1
+
+typedef __m128i vec32;
+#define vec_load(p)		_mm_loadu_si128((const __m128i *)(p))
+#define vec_store(p, v)		_mm_storeu_si128((__m128i *)(p), v)
+#define vec_dup(x)		_mm_set1_epi32(x)
+#define vec_and(a, b)		_mm_and_si128(a, b)
+#define vec_or(a, b)		_mm_or_si128(a, b)
+#define vec_shr(v, n)		_mm_srli_epi32(v, n)
+#define vec_shl(v, n)		_mm_slli_epi32(v, n)
+
+/* 8 values below 65536 of two vectors to 16 bits, signed saturation
+ * being exact for them once sign extended. */
+static inline void vec_store16(void *p, vec32 lo, vec32 hi)
+{
+	lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+	hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+	_mm_storeu_si128((__m128i *)p, _mm_packs_epi32(lo, hi));
+}
+
+static inline void vec_load16(const void *p, vec32 *lo, vec32 *hi)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+	*lo = _mm_unpacklo_epi16(v, _mm_setzero_si128());
+	*hi = _mm_unpackhi_epi16(v, _mm_setzero_si128());
+}
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KMS_PIXEL_SIMD 1
+
+typedef uint32x4_t vec32;
+#define vec_load(p)		vld1q_u32((const uint32_t *)(p))
+#define vec_store(p, v)		vst1q_u32((uint32_t *)(p), v)
+#define vec_dup(x)		vdupq_n_u32(x)
+#define vec_and(a, b)		vandq_u32(a, b)
+#define vec_or(a, b)		vorrq_u32(a, b)
+#define vec_shr(v, n)		vshrq_n_u32(v, n)
+#define vec_shl(v, n)		vshlq_n_u32(v, n)
+
+static inline void vec_store16(void *p, vec32 lo, vec32 hi)
+{
+	vst1q_u16((uint16_t *)p, vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+}
+
+static inline void vec_load16(const void *p, vec32 *lo, vec32 *hi)
+{
+	uint16x8_t v = vld1q_u16((const uint16_t *)p);
+
+	*lo = vmovl_u16(vget_low_u16(v));
+	*hi = vmovl_u16(vget_high_u16(v));
+}
+#endif
+
+static int pixel_cpp(uint32_t format)
+{
+	switch (format) {
+	case DRM_FORMAT_XRGB8888:
+	case DRM_FORMAT_ARGB8888:
+	case DRM_FORMAT_XRGB2101010:
+	case DRM_FORMAT_ARGB2101010:
+		return 4;
+	case DRM_FORMAT_RGB565:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+static void fill_line32(uint32_t *dst, unsigned width, uint32_t pixel)
+{
+	unsigned x = 0;
+#ifdef KMS_PIXEL_SIMD
+	vec32 v = vec_dup(pixel);
+
+	for (; x + 4 <= width; x += 4)
+		vec_store(&dst[x], v);
+#endif
+	for (; x < width; x++)
+		dst[x] = pixel;
+}
+
+static void fill_line16(uint16_t *dst, unsigned width, uint16_t pixel)
+{
+	unsigned x = 0;
+#ifdef KMS_PIXEL_SIMD
+	vec32 v = vec_dup(pixel | (uint32_t)pixel << 16);
+
+	for (; x + 8 <= width; x += 8)
+		vec_store(&dst[x], v);
+#endif
+	for (; x < width; x++)
+		dst[x] = pixel;
+}
+
+drm_public int
+kms_fill(void *dst, unsigned pitch, uint32_t format, unsigned width,
+	 unsigned height, uint32_t pixel)
+{
+	int cpp = pixel_cpp(format);
+	unsigned y;
+
+	if (!cpp)
+		return -EINVAL;
+
+	for (y = 0; y < height; y++) {
+		void *line = (char *)dst + (size_t)y * pitch;
+
+		if (cpp == 4)
+			fill_line32(line, width, pixel);
+		else
+			fill_line16(line, width, pixel);
+	}
+
+	return 0;
+}
+
+drm_public int
+kms_copy(void *dst, unsigned dst_pitch, const void *src, unsigned src_pitch,
+	 uint32_t format, unsigned width, unsigned height)
+{
+	int cpp = pixel_cpp(format);
+	unsigned y;
+
+	if (!cpp)
+		return -EINVAL;
+
+	/* libc's copies are vectorized already */
+	if (dst_pitch == src_pitch && dst_pitch == width * cpp) {
+		memcpy(dst, src, (size_t)height * dst_pitch);
+		return 0;
+	}
+
+	for (y = 0; y < height; y++)
+		memcpy((char *)dst + (size_t)y * dst_pitch,
+		       (const char *)src + (size_t)y * src_pitch, width * cpp);
+
+	return 0;
+}
+
+/* (x * a) / 255 rounded, exact for 16 bit x * a */
+static inline uint32_t mul_div255(uint32_t x, uint32_t a)
+{
+	uint32_t t = x * a + 128;
+
+	return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32_t blend_pixel(uint32_t d, uint32_t s)
+{
+	uint32_t ia = 255 - (s >> 24), r = 0;
+	int shift;
+
+	for (shift = 0; shift < 32; shift += 8) {
+		uint32_t c = ((s >> shift) & 0xff) +
+			     mul_div255((d >> shift) & 0xff, ia);
+
+		r |= (c > 255 ? 255 : c) << shift;
+	}
+
+	return r;
+}
+
+static void blend_line(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+	unsigned x = 0;
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c255 = _mm_set1_epi16(255);
+	const __m128i c128 = _mm_set1_epi16(128);
+
+	for (; x + 4 <= width; x += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i *)&src[x]);
+		__m128i d = _mm_loadu_si128((const __m128i *)&dst[x]);
+		__m128i r[2];
+		int i;
+
+		for (i = 0; i < 2; i++) {
+			__m128i s16 = i ? _mm_unpackhi_epi8(s, zero) :
+					  _mm_unpacklo_epi8(s, zero);
+			__m128i d16 = i ? _mm_unpackhi_epi8(d, zero) :
+					  _mm_unpacklo_epi8(d, zero);
+			__m128i a, t;
+
+			a = _mm_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3));
+			a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+			t = _mm_add_epi16(_mm_mullo_epi16(d16,
+					_mm_sub_epi16(c255, a)), c128);
+			t = _mm_srli_epi16(_mm_add_epi16(t,
+					_mm_srli_epi16(t, 8)), 8);
+			r[i] = _mm_add_epi16(s16, t);
+		}
+		_mm_storeu_si128((__m128i *)&dst[x],
+				 _mm_packus_epi16(r[0], r[1]));
+	}
+#elif defined(__ARM_NEON)
+	for (; x + 8 <= width; x += 8) {
+		uint8x8x4_t s = vld4_u8((const uint8_t *)&src[x]);
+		uint8x8x4_t d = vld4_u8((const uint8_t *)&dst[x]);
+		uint8x8_t ia = vmvn_u8(s.val[3]);
+		int i;
+
+		for (i = 0; i < 4; i++) {
+			uint16x8_t t = vmull_u8(d.val[i], ia);
+
+			t = vaddq_u16(t, vrshrq_n_u16(t, 8));
+			d.val[i] = vqadd_u8(s.val[i], vrshrn_n_u16(t, 8));
+		}
+		vst4_u8((uint8_t *)&dst[x], d);
+	}
+#endif
+	for (; x < width; x++)
+		dst[x] = blend_pixel(dst[x], src[x]);
+}
+
+drm_public int
+kms_blend(void *dst, unsigned dst_pitch, const void *src, unsigned src_pitch,
+	  unsigned width, unsigned height)
+{
+	unsigned y;
+
+	for (y = 0; y < height; y++)
+		blend_line((uint32_t *)((char *)dst + (size_t)y * dst_pitch),
+			   (const uint32_t *)((const char *)src +
+					      (size_t)y * src_pitch), width);
+
+	return 0;
+}
+
+/*
+ * The conversions of one pixel in 32 bit lanes, for both the vectors and the
+ * scalar ends of the lines: channels are truncated when narrowed and their
+ * bits replicated when widened, the X of the destination is all ones.
+ */
+#define TO_RGB565(v, SHR, AND, OR, DUP)				\
+	OR(OR(AND(SHR(v, 8), DUP(0xf800)), AND(SHR(v, 5), DUP(0x07e0))),	\
+	   AND(SHR(v, 3), DUP(0x001f)))
+
+#define FROM_RGB565(v, SHR, SHL, AND, OR, DUP)			\
+	OR(OR(DUP(0xff000000),						\
+	      OR(AND(SHL(v, 8), DUP(0xf80000)),				\
+		 AND(SHL(v, 3), DUP(0x070000)))),				\
+	   OR(OR(AND(SHL(v, 5), DUP(0xfc00)), AND(SHR(v, 1), DUP(0x0300))),	\
+	      OR(AND(SHL(v, 3), DUP(0xf8)), AND(SHR(v, 2), DUP(0x07)))))
+
+/* the alpha is given separately, as it differs between X and A formats */
+#define TO_2101010(v, SHR, SHL, AND, OR, DUP)				\
+	OR(OR(OR(AND(SHL(v, 6), DUP(0x3fc00000)),			\
+		 AND(SHR(v, 2), DUP(0x00300000))),			\
+	      OR(AND(SHL(v, 4), DUP(0x000ff000)),			\
+		 AND(SHR(v, 4), DUP(0x00000c00)))),			\
+	   OR(AND(SHL(v, 2), DUP(0x000003fc)),				\
+	      AND(SHR(v, 6), DUP(0x00000003))))
+
+#define FROM_2101010(v, SHR, SHL, AND, OR, DUP)			\
+	OR(AND(SHR(v, 6), DUP(0x00ff0000)),				\
+	   OR(AND(SHR(v, 4), DUP(0x0000ff00)), AND(SHR(v, 2), DUP(0xff))))
+
+#define S_SHR(v, n)	((v) >> (n))
+#define S_SHL(v, n)	((v) << (n))
+#define S_AND(a, b)	((a) & (b))
+#define S_OR(a, b)	((a) | (b))
+#define S_DUP(x)	((uint32_t)(x))
+
+/* 2 bit alpha to 8 bits and back */
+#define A8_TO_A2(v)	(((v) >> 30) << 30)
+#define A2_TO_A8(v)	(((v) >> 30) * 0x55000000u)
+
+static void to_rgb565(uint16_t *dst, const uint32_t *src, unsigned width)
+{
+	unsigned x = 0;
+#ifdef KMS_PIXEL_SIMD
+	for (; x + 8 <= width; x += 8) {
+		vec32 lo = vec_load(&src[x]), hi = vec_load(&src[x + 4]);
+
+		vec_store16(&dst[x],
+			TO_RGB565(lo, vec_shr, vec_and, vec_or, vec_dup),
+			TO_RGB565(hi, vec_shr, vec_and, vec_or, vec_dup));
+	}
+#endif
+	for (; x < width; x++)
+		dst[x] = TO_RGB565(src[x], S_SHR, S_AND, S_OR, S_DUP);
+}
+
+static void from_rgb565(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+	unsigned x = 0;
+#ifdef KMS_PIXEL_SIMD
+	for (; x + 8 <= width; x += 8) {
+		vec32 lo, hi;
+
+		vec_load16(&src[x], &lo, &hi);
+		vec_store(&dst[x], FROM_RGB565(lo, vec_shr, vec_shl,
+					       vec_and, vec_or, vec_dup));
+		vec_store(&dst[x + 4], FROM_RGB565(hi, vec_shr, vec_shl,
+						   vec_and, vec_or, vec_dup));
+	}
+#endif
+	for (; x < width; x++) {
+		uint32_t v = src[x];
+
+		dst[x] = FROM_RGB565(v, S_SHR, S_SHL, S_AND, S_OR,
+				     S_DUP);
+	}
+}
+
+/* alpha: the alpha bits or'ed in, opaque when ~0 */
+static void to_2101010(uint32_t *dst, const uint32_t *src, unsigned width,
+		       uint32_t alpha)
+{
+	unsigned x = 0;
+#ifdef KMS_PIXEL_SIMD
+	vec32 a = vec_dup(alpha & 0xc0000000);
+	vec32 amask = vec_dup(alpha ? 0 : 0xc0000000);
+
+	for (; x + 4 <= width; x += 4) {
+		vec32 v = vec_load(&src[x]);
+
+		v = vec_or(TO_2101010(v, vec_shr, vec_shl, vec_and,
+				      vec_or, vec_dup),
+			   vec_or(a, vec_and(v, amask)));
+		vec_store(&dst[x], v);
+	}
+#endif
+	for (; x < width; x++) {
+		uint32_t v = src[x];
+
+		dst[x] = TO_2101010(v, S_SHR, S_SHL, S_AND, S_OR,
+				    S_DUP) |
+			 (alpha ? alpha & 0xc0000000 : A8_TO_A2(v));
+	}
+}
+
+static void from_2101010(uint32_t *dst, const uint32_t *src, unsigned width,
+			 uint32_t alpha)
+{
+	unsigned x;
+
+	/* the 2 to 8 bit alpha takes a multiply, left to the compiler */
+	for (x = 0; x < width; x++) {
+		uint32_t v = src[x];
+
+		dst[x] = FROM_2101010(v, S_SHR, S_SHL, S_AND, S_OR,
+				      S_DUP) |
+			 (alpha ? alpha & 0xff000000 : A2_TO_A8(v));
+	}
+}
+
+static void set_alpha(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+	unsigned x = 0;
+#ifdef KMS_PIXEL_SIMD
+	vec32 a = vec_dup(0xff000000);
+
+	for (; x + 4 <= width; x += 4)
+		vec_store(&dst[x], vec_or(vec_load(&src[x]), a));
+#endif
+	for (; x < width; x++)
+		dst[x] = src[x] | 0xff000000;
+}
+
+drm_public int
+kms_convert(void *dst, unsigned dst_pitch, uint32_t dst_format,
+	    const void *src, unsigned src_pitch, uint32_t src_format,
+	    unsigned width, unsigned height)
+{
+	bool src_8888 = src_format == DRM_FORMAT_XRGB8888 ||
+			src_format == DRM_FORMAT_ARGB8888;
+	bool dst_8888 = dst_format == DRM_FORMAT_XRGB8888 ||
+			dst_format == DRM_FORMAT_ARGB8888;
+	bool src_alpha = src_format == DRM_FORMAT_ARGB8888 ||
+			 src_format == DRM_FORMAT_ARGB2101010;
+	bool dst_alpha = dst_format == DRM_FORMAT_ARGB8888 ||
+			 dst_format == DRM_FORMAT_ARGB2101010;
+	/* the alpha of the destination, if not that of the source */
+	uint32_t alpha = dst_alpha && src_alpha ? 0 : ~0u;
+	unsigned y;
+
+	if (!pixel_cpp(dst_format) || !pixel_cpp(src_format))
+		return -EINVAL;
+	if (!src_8888 && !dst_8888)
+		return -EINVAL;
+	if (src_8888 && dst_8888 && !(dst_alpha && !src_alpha))
+		return kms_copy(dst, dst_pitch, src, src_pitch, dst_format,
+				width, height);
+
+	for (y = 0; y < height; y++) {
+		void *d = (char *)dst + (size_t)y * dst_pitch;
+		const void *s = (const char *)src + (size_t)y * src_pitch;
+
+		if (src_8888 && dst_8888)
+			set_alpha(d, s, width);
+		else if (dst_format == DRM_FORMAT_RGB565)
+			to_rgb565(d, s, width);
+		else if (src_format == DRM_FORMAT_RGB565)
+			from_rgb565(d, s, width);
+		else if (src_8888)
+			to_2101010(d, s, width, alpha);
+		else
+			from_2101010(d, s, width, alpha);
+	}
+
+	return 0;
+}
+
+/* BT.601 limited range, what NV12 consumers assume by default */
+#define RGB_TO_Y(r, g, b) \
+	(((66 * (r) + 129 * (g) + 25 * (b) + 128) >> 8) + 16)
+#define RGB_TO_U(r, g, b) \
+	(((-38 * (r) - 74 * (g) + 112 * (b) + 128) >> 8) + 128)
+#define RGB_TO_V(r, g, b) \
+	(((112 * (r) - 94 * (g) - 18 * (b) + 128) >> 8) + 128)
+
+static void to_y(uint8_t *dst, const uint32_t *src, unsigned width)
+{
+	unsigned x = 0;
+#if defined(__SSE2__)
+	/* the b and r, then the g and a of each pixel in 16 bit lanes are
+	 * multiplied and summed by pairs into 32 bits */
+	const __m128i kbr = _mm_set1_epi32(66 << 16 | 25);
+	const __m128i kga = _mm_set1_epi32(129);
+	const __m128i mask = _mm_set1_epi32(0x00ff00ff);
+	const __m128i c128 = _mm_set1_epi32(128);
+	const __m128i c16 = _mm_set1_epi16(16);
+
+	for (; x + 8 <= width; x += 8) {
+		__m128i y[2];
+		int i;
+
+		for (i = 0; i < 2; i++) {
+			__m128i v, br, ga, t;
+
+			v = _mm_loadu_si128((const __m128i *)&src[x + 4 * i]);
+			br = _mm_and_si128(v, mask);
+			ga = _mm_and_si128(_mm_srli_epi32(v, 8), mask);
+			t = _mm_add_epi32(_mm_madd_epi16(br, kbr),
+					  _mm_madd_epi16(ga, kga));
+			y[i] = _mm_srli_epi32(_mm_add_epi32(t, c128), 8);
+		}
+		y[0] = _mm_add_epi16(_mm_packs_epi32(y[0], y[1]), c16);
+		_mm_storel_epi64((__m128i *)&dst[x],
+				 _mm_packus_epi16(y[0], y[0]));
+	}
+#elif defined(__ARM_NEON)
+	for (; x + 8 <= width; x += 8) {
+		uint8x8x4_t v = vld4_u8((const uint8_t *)&src[x]);
+		uint16x8_t t;
+
+		t = vmull_u8(v.val[2], vdup_n_u8(66));
+		t = vmlal_u8(t, v.val[1], vdup_n_u8(129));
+		t = vmlal_u8(t, v.val[0], vdup_n_u8(25));
+		vst1_u8(&dst[x], vadd_u8(vrshrn_n_u16(t, 8), vdup_n_u8(16)));
+	}
+#endif
+	for (; x < width; x++) {
+		uint32_t v = src[x];
+
+		dst[x] = RGB_TO_Y((v >> 16) & 0xff, (v >> 8) & 0xff, v & 0xff);
+	}
+}
+
+/* the chroma of each 2x2 block from its average, the last column and line
+ * of odd sizes standing for the missing ones */
+static void to_uv(uint8_t *dst, const uint32_t *src0, const uint32_t *src1,
+		  unsigned width)
+{
+	unsigned x;
+
+	for (x = 0; x < width; x += 2) {
+		unsigned x1 = x + 1 < width ? x + 1 : x;
+		uint32_t p[4] = { src0[x], src0[x1], src1[x], src1[x1] };
+		int r = 0, g = 0, b = 0, i;
+
+		for (i = 0; i < 4; i++) {
+			r += (p[i] >> 16) & 0xff;
+			g += (p[i] >> 8) & 0xff;
+			b += p[i] & 0xff;
+		}
+		r = (r + 2) >> 2;
+		g = (g + 2) >> 2;
+		b = (b + 2) >> 2;
+		dst[x] = RGB_TO_U(r, g, b);
+		dst[x + 1] = RGB_TO_V(r, g, b);
+	}
+}
+
+drm_public int
+kms_convert_nv12(void *y, unsigned y_pitch, void *uv, unsigned uv_pitch,
+		 const void *src, unsigned src_pitch, unsigned width,
+		 unsigned height)
+{
+	unsigned line;
+
+	for (line = 0; line < height; line++) {
+		const uint32_t *s = (const uint32_t *)((const char *)src +
+						       (size_t)line * src_pitch);
+
+		to_y((uint8_t *)y + (size_t)line * y_pitch, s, width);
+		if (!(line & 1)) {
+			const uint32_t *s1 = line + 1 < height ?
+				(const uint32_t *)((const char *)s + src_pitch) : s;
+
+			to_uv((uint8_t *)uv + (size_t)(line / 2) * uv_pitch, s,
+			      s1, width);
+		}
+	}
+
+	return 0;
+}
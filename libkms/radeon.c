@@ -83,6 +83,8 @@ radeon_bo_create(struct kms_driver *kms,
 		case KMS_WIDTH:
 		case KMS_HEIGHT:
 		case KMS_BO_TYPE:
+		case KMS_BO_PERSISTENT_MAP:
+		case KMS_BO_PREFAULT:
 			break;
 		default:
 			return -EINVAL;
@@ -168,7 +170,8 @@ radeon_bo_map(struct kms_bo *_bo, void **out)
 	if (ret)
 		return -errno;
 
-	map = drm_mmap(0, arg.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	map = drm_mmap(0, arg.size, PROT_READ | PROT_WRITE,
+		       kms_bo_map_flags(&bo->base),
 	           bo->base.kms->fd, arg.addr_ptr);
 	if (map == MAP_FAILED)
 		return -errno;
@@ -184,7 +187,7 @@ static int
 radeon_bo_unmap(struct kms_bo *_bo)
 {
 	struct radeon_bo *bo = (struct radeon_bo *)_bo;
-	if (--bo->map_count == 0) {
+	if (--bo->map_count == 0 && !bo->base.persistent_map) {
 		drm_munmap(bo->base.ptr, bo->base.size);
 		bo->base.ptr = NULL;
 	}
@@ -0,0 +1,334 @@
+/**************************************************************************
+ *
+ * Copyright © 2009 VMware, Inc., Palo Alto, CA., USA
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "libdrm_macros.h"
+#include "internal.h"
+
+enum kms_swapchain_state
+{
+	KMS_SWAPCHAIN_FREE,
+	KMS_SWAPCHAIN_ACQUIRED,
+	KMS_SWAPCHAIN_PENDING,	/* flip queued */
+	KMS_SWAPCHAIN_SCANOUT,
+};
+
+struct kms_swapchain_buffer
+{
+	struct kms_bo *bo;
+	void *ptr;
+	unsigned pitch;
+	uint32_t fb_id;
+	enum kms_swapchain_state state;
+	/* frame it was last presented at, 0 if never */
+	uint64_t frame;
+};
+
+struct kms_swapchain
+{
+	struct kms_driver *kms;
+	uint32_t crtc_id;
+	uint32_t connector_id;
+	drmModeModeInfo mode;
+	/* the crtc shows a buffer of the swapchain */
+	int mode_set;
+	uint64_t frame;
+	unsigned count;
+	struct kms_swapchain_buffer buffers[];
+};
+
+static void
+kms_swapchain_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec,
+			   unsigned int tv_usec, void *user_data)
+{
+	struct kms_swapchain *sc = user_data;
+	unsigned i;
+
+	for (i = 0; i < sc->count; i++) {
+		if (sc->buffers[i].state == KMS_SWAPCHAIN_SCANOUT)
+			sc->buffers[i].state = KMS_SWAPCHAIN_FREE;
+	}
+	for (i = 0; i < sc->count; i++) {
+		if (sc->buffers[i].state == KMS_SWAPCHAIN_PENDING)
+			sc->buffers[i].state = KMS_SWAPCHAIN_SCANOUT;
+	}
+}
+
+static int kms_swapchain_flip_pending(struct kms_swapchain *sc)
+{
+	unsigned i;
+
+	for (i = 0; i < sc->count; i++) {
+		if (sc->buffers[i].state == KMS_SWAPCHAIN_PENDING)
+			return 1;
+	}
+	return 0;
+}
+
+static int kms_swapchain_wait_event(struct kms_swapchain *sc)
+{
+	struct pollfd pfd = {
+		.fd = sc->kms->fd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	do {
+		ret = poll(&pfd, 1, -1);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -errno;
+
+	return kms_swapchain_handle_event(sc);
+}
+
+static void kms_swapchain_free_buffers(struct kms_swapchain *sc)
+{
+	struct kms_swapchain_buffer *buf;
+	unsigned i;
+
+	for (i = 0; i < sc->count; i++) {
+		buf = &sc->buffers[i];
+		if (buf->fb_id)
+			drmModeRmFB(sc->kms->fd, buf->fb_id);
+		if (buf->ptr)
+			kms_bo_unmap(buf->bo);
+		kms_bo_destroy(&buf->bo);
+	}
+}
+
+drm_public int
+kms_swapchain_create(struct kms_driver *kms, uint32_t crtc_id,
+		     uint32_t connector_id, const drmModeModeInfo *mode,
+		     unsigned count, struct kms_swapchain **out)
+{
+	unsigned attr[] = {
+		KMS_BO_TYPE, KMS_BO_TYPE_SCANOUT_X8R8G8B8,
+		KMS_WIDTH, mode->hdisplay,
+		KMS_HEIGHT, mode->vdisplay,
+		KMS_BO_PERSISTENT_MAP, 1,
+		KMS_BO_PREFAULT, 1,
+		KMS_TERMINATE_PROP_LIST
+	};
+	struct kms_swapchain_buffer *buf;
+	struct kms_swapchain *sc;
+	unsigned handle, i;
+	int ret;
+
+	if (count < 2 || count > KMS_SWAPCHAIN_MAX_BUFFERS)
+		return -EINVAL;
+
+	sc = calloc(1, sizeof(*sc) + count * sizeof(sc->buffers[0]));
+	if (!sc)
+		return -ENOMEM;
+
+	sc->kms = kms;
+	sc->crtc_id = crtc_id;
+	sc->connector_id = connector_id;
+	sc->mode = *mode;
+	sc->count = count;
+
+	for (i = 0; i < count; i++) {
+		buf = &sc->buffers[i];
+
+		ret = kms_bo_create(kms, attr, &buf->bo);
+		if (ret)
+			goto err_free;
+
+		ret = kms_bo_map(buf->bo, &buf->ptr);
+		if (ret)
+			goto err_free;
+
+		kms_bo_get_prop(buf->bo, KMS_PITCH, &buf->pitch);
+		kms_bo_get_prop(buf->bo, KMS_HANDLE, &handle);
+
+		ret = drmModeAddFB(kms->fd, mode->hdisplay, mode->vdisplay,
+				   24, 32, buf->pitch, handle, &buf->fb_id);
+		if (ret)
+			goto err_free;
+	}
+
+	*out = sc;
+	return 0;
+
+err_free:
+	kms_swapchain_free_buffers(sc);
+	free(sc);
+	return ret;
+}
+
+drm_public int kms_swapchain_destroy(struct kms_swapchain **sc)
+{
+	int ret;
+
+	if (!(*sc))
+		return 0;
+
+	/* the buffer being flipped to must not be freed under the crtc */
+	while (kms_swapchain_flip_pending(*sc)) {
+		ret = kms_swapchain_wait_event(*sc);
+		if (ret)
+			return ret;
+	}
+
+	kms_swapchain_free_buffers(*sc);
+	free(*sc);
+	*sc = NULL;
+	return 0;
+}
+
+drm_public int kms_swapchain_handle_event(struct kms_swapchain *sc)
+{
+	drmEventContext evctx = {
+		.version = 2,
+		.page_flip_handler = kms_swapchain_flip_handler,
+	};
+
+	/* the flip handler gets the swapchain as user_data */
+	if (drmHandleEvent(sc->kms->fd, &evctx))
+		return -errno;
+
+	return 0;
+}
+
+drm_public int
+kms_swapchain_acquire(struct kms_swapchain *sc, unsigned *index, void **ptr,
+		      unsigned *pitch, unsigned *age)
+{
+	struct kms_swapchain_buffer *buf;
+	unsigned i;
+	int ret;
+
+	for (;;) {
+		for (i = 0; i < sc->count; i++) {
+			if (sc->buffers[i].state == KMS_SWAPCHAIN_FREE)
+				goto found;
+		}
+
+		/* all but the acquired ones are on screen or flipped to */
+		if (!kms_swapchain_flip_pending(sc))
+			return -EBUSY;
+
+		ret = kms_swapchain_wait_event(sc);
+		if (ret)
+			return ret;
+	}
+
+found:
+	buf = &sc->buffers[i];
+	buf->state = KMS_SWAPCHAIN_ACQUIRED;
+
+	*index = i;
+	*ptr = buf->ptr;
+	*pitch = buf->pitch;
+	/* as EGL_EXT_buffer_age: 1 for the contents of the last frame */
+	if (age)
+		*age = buf->frame ? (unsigned)(sc->frame - buf->frame + 1) : 0;
+
+	return 0;
+}
+
+drm_public int kms_swapchain_release(struct kms_swapchain *sc, unsigned index)
+{
+	struct kms_swapchain_buffer *buf;
+
+	if (index >= sc->count)
+		return -EINVAL;
+
+	buf = &sc->buffers[index];
+	if (buf->state != KMS_SWAPCHAIN_ACQUIRED)
+		return -EINVAL;
+
+	buf->state = KMS_SWAPCHAIN_FREE;
+	return 0;
+}
+
+drm_public int kms_swapchain_present(struct kms_swapchain *sc, unsigned index)
+{
+	struct kms_swapchain_buffer *buf;
+	unsigned i;
+	int ret;
+
+	if (index >= sc->count)
+		return -EINVAL;
+
+	buf = &sc->buffers[index];
+	if (buf->state != KMS_SWAPCHAIN_ACQUIRED)
+		return -EINVAL;
+
+	/* a single flip may be queued on the crtc */
+	while (kms_swapchain_flip_pending(sc)) {
+		ret = kms_swapchain_wait_event(sc);
+		if (ret)
+			return ret;
+	}
+
+	if (!sc->mode_set) {
+		ret = drmModeSetCrtc(sc->kms->fd, sc->crtc_id, buf->fb_id, 0, 0,
+				     &sc->connector_id, 1, &sc->mode);
+		if (ret)
+			return ret;
+
+		/* the buffer is on screen once the modeset returns */
+		for (i = 0; i < sc->count; i++) {
+			if (sc->buffers[i].state == KMS_SWAPCHAIN_SCANOUT)
+				sc->buffers[i].state = KMS_SWAPCHAIN_FREE;
+		}
+		buf->state = KMS_SWAPCHAIN_SCANOUT;
+		sc->mode_set = 1;
+	} else {
+		ret = drmModePageFlip(sc->kms->fd, sc->crtc_id, buf->fb_id,
+				      DRM_MODE_PAGE_FLIP_EVENT, sc);
+		if (ret)
+			return ret;
+
+		buf->state = KMS_SWAPCHAIN_PENDING;
+	}
+
+	buf->frame = ++sc->frame;
+	return 0;
+}
+
+drm_public int
+kms_swapchain_get_fb(struct kms_swapchain *sc, unsigned index, uint32_t *fb_id)
+{
+	if (index >= sc->count)
+		return -EINVAL;
+
+	*fb_id = sc->buffers[index].fb_id;
+	return 0;
+}
@@ -31,9 +31,11 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <time.h>
 #include <unistd.h>
 
 #if defined(__cplusplus)
@@ -57,6 +59,27 @@ struct sync_merge_data {
 #define SYNC_IOC_MERGE		_IOWR(SYNC_IOC_MAGIC, 3, struct sync_merge_data)
 #endif
 
+#ifndef SYNC_IOC_FILE_INFO
+/* duplicated from linux/sync_file.h, see above */
+struct sync_fence_info {
+	char	obj_name[32];
+	char	driver_name[32];
+	int32_t	status;
+	uint32_t	flags;
+	uint64_t	timestamp_ns;
+};
+
+struct sync_file_info {
+	char	name[32];
+	int32_t	status;
+	uint32_t	flags;
+	uint32_t	num_fences;
+	uint32_t	pad;
+	uint64_t	sync_fence_info;
+};
+#define SYNC_IOC_FILE_INFO	_IOWR(SYNC_IOC_MAGIC, 4, struct sync_file_info)
+#endif
+
 
 static inline int sync_wait(int fd, int timeout)
 {
@@ -141,6 +164,174 @@ static inline int sync_accumulate(const char *name, int *fd1, int fd2)
 	return 0;
 }
 
+/* 1 if the fence has signaled, 0 if not yet, -1 with errno set on error,
+ * which is EIO if the fence signaled an error.  Never blocks. */
+static inline int sync_fence_status(int fd)
+{
+	struct sync_file_info info = {0};
+	int ret;
+
+	do {
+		ret = ioctl(fd, SYNC_IOC_FILE_INFO, &info);
+	} while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+
+	if (ret < 0)
+		return ret;
+
+	if (info.status < 0) {
+		errno = EIO;
+		return -1;
+	}
+	return info.status > 0;
+}
+
+static inline int sync_merge_range(const char *name, const int *fds,
+				   int count, int *owned)
+{
+	int half = count / 2, fd1, fd2, owned1, owned2, ret;
+
+	if (count == 1) {
+		*owned = 0;
+		return fds[0];
+	}
+
+	fd1 = sync_merge_range(name, fds, half, &owned1);
+	if (fd1 < 0)
+		return fd1;
+
+	fd2 = sync_merge_range(name, fds + half, count - half, &owned2);
+	if (fd2 < 0) {
+		if (owned1)
+			close(fd1);
+		return fd2;
+	}
+
+	ret = sync_merge(name, fd1, fd2);
+	if (owned1)
+		close(fd1);
+	if (owned2)
+		close(fd2);
+
+	*owned = 1;
+	return ret;
+}
+
+/* merge count fences into a new fd, in a balanced tree so that each
+ * merge only handles a fraction of the fences.  Does *NOT* take ownership
+ * of the fds, the intermediate fences are closed. */
+static inline int sync_merge_many(const char *name, const int *fds, int count)
+{
+	int owned, ret;
+
+	if (count <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ret = sync_merge_range(name, fds, count, &owned);
+	if (ret >= 0 && !owned)
+		ret = dup(ret);
+	return ret;
+}
+
+static inline int64_t sync_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* poll the fences until all, or any, of them signaled, or timeout ms have
+ * passed (-1 for ever).  Returns the index of a signaled fence for any,
+ * 0 for all, or -1 with errno set, ETIME on timeout as sync_wait(). */
+static inline int sync_wait_many(const int *fds, int count, int timeout,
+				 int any)
+{
+	struct pollfd stack_pfds[16], *pfds = stack_pfds;
+	int64_t end = timeout < 0 ? -1 : sync_now_ms() + timeout;
+	int i, n, left, ret = -1;
+
+	if (count <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (count > 16) {
+		pfds = (struct pollfd *)malloc(count * sizeof(*pfds));
+		if (!pfds) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		pfds[i].fd = fds[i];
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+	}
+	left = count;
+
+	for (;;) {
+		int wait = -1;
+
+		if (end >= 0) {
+			int64_t now = sync_now_ms();
+
+			wait = now < end ? (int)(end - now) : 0;
+		}
+
+		n = poll(pfds, count, wait);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			break;
+		}
+		if (n == 0) {
+			errno = ETIME;
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			if (!pfds[i].revents)
+				continue;
+			if (pfds[i].revents & (POLLERR | POLLNVAL)) {
+				errno = EINVAL;
+				n = -1;
+				break;
+			}
+			if (any) {
+				ret = i;
+				break;
+			}
+			/* signaled for good, stop polling it */
+			pfds[i].fd = -1;
+			pfds[i].revents = 0;
+			left--;
+		}
+		if (n < 0 || ret >= 0)
+			break;
+		if (!left) {
+			ret = 0;
+			break;
+		}
+	}
+
+	if (pfds != stack_pfds)
+		free(pfds);
+	return ret;
+}
+
+static inline int sync_wait_any(const int *fds, int count, int timeout)
+{
+	return sync_wait_many(fds, count, timeout, 1);
+}
+
+static inline int sync_wait_all(const int *fds, int count, int timeout)
+{
+	return sync_wait_many(fds, count, timeout, 0);
+}
+
 #if defined(__cplusplus)
 }
 #endif
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <assert.h>
 #include <errno.h>
 
@@ -34,20 +35,34 @@
 #include "nouveau.h"
 #include "private.h"
 
+/* bufrefs are handed out to the driver and linked on the bufctx lists, so
+ * they are allocated in slabs that never move */
+#define NOUVEAU_BUFREF_SLAB 64
+
 struct nouveau_bufref_priv {
 	struct nouveau_bufref base;
-	struct nouveau_bufref_priv *next;
 	struct nouveau_bufctx *bufctx;
 };
 
+struct nouveau_bufref_slab {
+	struct nouveau_bufref_slab *next;
+	struct nouveau_bufref_priv refs[NOUVEAU_BUFREF_SLAB];
+};
+
 struct nouveau_bufbin_priv {
-	struct nouveau_bufref_priv *list;
+	struct nouveau_bufref_priv **refs;
+	int nr_refs;
+	int max_refs;
 	int relocs;
 };
 
 struct nouveau_bufctx_priv {
 	struct nouveau_bufctx base;
-	struct nouveau_bufref_priv *free;
+	struct nouveau_bufref_slab *slabs;
+	int nr_slabs;
+	/* unused bufrefs, with room for all of them */
+	struct nouveau_bufref_priv **free;
+	int nr_free;
 	int nr_bins;
 	struct nouveau_bufbin_priv bins[];
 };
@@ -58,6 +73,34 @@ nouveau_bufctx(struct nouveau_bufctx *bctx)
 	return (struct nouveau_bufctx_priv *)bctx;
 }
 
+static struct nouveau_bufref_priv *
+bufctx_ref_get(struct nouveau_bufctx_priv *pctx)
+{
+	struct nouveau_bufref_slab *slab;
+	struct nouveau_bufref_priv **free;
+	int i;
+
+	if (pctx->nr_free)
+		return pctx->free[--pctx->nr_free];
+
+	free = realloc(pctx->free, sizeof(*free) * NOUVEAU_BUFREF_SLAB *
+				   (pctx->nr_slabs + 1));
+	if (!free)
+		return NULL;
+	pctx->free = free;
+
+	slab = malloc(sizeof(*slab));
+	if (!slab)
+		return NULL;
+	slab->next = pctx->slabs;
+	pctx->slabs = slab;
+	pctx->nr_slabs++;
+
+	for (i = NOUVEAU_BUFREF_SLAB - 1; i > 0; i--)
+		pctx->free[pctx->nr_free++] = &slab->refs[i];
+	return &slab->refs[0];
+}
+
 drm_public int
 nouveau_bufctx_new(struct nouveau_client *client, int bins,
 		   struct nouveau_bufctx **pbctx)
@@ -82,14 +125,17 @@ drm_public void
 nouveau_bufctx_del(struct nouveau_bufctx **pbctx)
 {
 	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(*pbctx);
-	struct nouveau_bufref_priv *pref;
+	struct nouveau_bufref_slab *slab;
 	if (pctx) {
-		while (pctx->nr_bins--)
+		while (pctx->nr_bins--) {
 			nouveau_bufctx_reset(&pctx->base, pctx->nr_bins);
-		while ((pref = pctx->free)) {
-			pctx->free = pref->next;
-			free(pref);
+			free(pctx->bins[pctx->nr_bins].refs);
+		}
+		while ((slab = pctx->slabs)) {
+			pctx->slabs = slab->next;
+			free(slab);
 		}
+		free(pctx->free);
 		free(pctx);
 		*pbctx = NULL;
 	}
@@ -100,13 +146,17 @@ nouveau_bufctx_reset(struct nouveau_bufctx *bctx, int bin)
 {
 	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(bctx);
 	struct nouveau_bufbin_priv *pbin = &pctx->bins[bin];
-	struct nouveau_bufref_priv *pref;
+	int i;
+
+	if (pbin->nr_refs) {
+		for (i = 0; i < pbin->nr_refs; i++)
+			DRMLISTDELINIT(&pbin->refs[i]->base.thead);
 
-	while ((pref = pbin->list)) {
-		DRMLISTDELINIT(&pref->base.thead);
-		pbin->list = pref->next;
-		pref->next = pctx->free;
-		pctx->free = pref;
+		/* the free array has room for every bufref */
+		memcpy(&pctx->free[pctx->nr_free], pbin->refs,
+		       sizeof(*pbin->refs) * pbin->nr_refs);
+		pctx->nr_free += pbin->nr_refs;
+		pbin->nr_refs = 0;
 	}
 
 	bctx->relocs -= pbin->relocs;
@@ -119,13 +169,19 @@ nouveau_bufctx_refn(struct nouveau_bufctx *bctx, int bin,
 {
 	struct nouveau_bufctx_priv *pctx = nouveau_bufctx(bctx);
 	struct nouveau_bufbin_priv *pbin = &pctx->bins[bin];
-	struct nouveau_bufref_priv *pref = pctx->free;
+	struct nouveau_bufref_priv *pref, **refs;
 
-	if (!pref)
-		pref = malloc(sizeof(*pref));
-	else
-		pctx->free = pref->next;
+	if (pbin->nr_refs == pbin->max_refs) {
+		int max = pbin->max_refs ? pbin->max_refs * 2 : 16;
+
+		refs = realloc(pbin->refs, sizeof(*refs) * max);
+		if (!refs)
+			return NULL;
+		pbin->refs = refs;
+		pbin->max_refs = max;
+	}
 
+	pref = bufctx_ref_get(pctx);
 	if (pref) {
 		pref->base.bo = bo;
 		pref->base.flags = flags;
@@ -133,8 +189,7 @@ nouveau_bufctx_refn(struct nouveau_bufctx *bctx, int bin,
 
 		DRMLISTADDTAIL(&pref->base.thead, &bctx->pending);
 		pref->bufctx = bctx;
-		pref->next = pbin->list;
-		pbin->list = pref;
+		pbin->refs[pbin->nr_refs++] = pref;
 	}
 
 	return &pref->base;
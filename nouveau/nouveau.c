@@ -31,6 +31,8 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
 
 #include <xf86drm.h>
 #include <xf86atomic.h>
@@ -146,9 +148,9 @@ nouveau_object_sclass_put(struct nouveau_sclass **psclass)
 	*psclass = NULL;
 }
 
-drm_public int
-nouveau_object_sclass_get(struct nouveau_object *obj,
-			  struct nouveau_sclass **psclass)
+static int
+nouveau_object_sclass_query(struct nouveau_object *obj,
+			    struct nouveau_sclass **psclass)
 {
 	struct nouveau_drm *drm = nouveau_drm(obj);
 	struct {
@@ -196,17 +198,121 @@ nouveau_object_sclass_get(struct nouveau_object *obj,
 	return ret;
 }
 
+static struct nouveau_sclass_cache *
+nouveau_sclass_cache_find(struct nouveau_drm_priv *pdrm,
+			  struct nouveau_object *obj)
+{
+	struct nouveau_sclass_cache *cache;
+
+	for (cache = pdrm->sclass; cache; cache = cache->next) {
+		if (cache->obj == obj && cache->handle == obj->handle &&
+		    cache->oclass == obj->oclass)
+			return cache;
+	}
+	return NULL;
+}
+
+/* The classes of an object, queried the first time only.  The entry lives
+ * until the object is deleted.
+ */
+static int
+nouveau_sclass_cache_get(struct nouveau_object *obj,
+			 struct nouveau_sclass_cache **pcache)
+{
+	struct nouveau_drm_priv *pdrm = nouveau_drm_priv(nouveau_drm(obj));
+	struct nouveau_sclass_cache *cache, *found;
+	struct nouveau_sclass *sclass;
+	int cnt;
+
+	pthread_mutex_lock(&pdrm->lock);
+	cache = nouveau_sclass_cache_find(pdrm, obj);
+	pthread_mutex_unlock(&pdrm->lock);
+	if (cache) {
+		*pcache = cache;
+		return cache->count;
+	}
+
+	cnt = nouveau_object_sclass_query(obj, &sclass);
+	if (cnt < 0)
+		return cnt;
+
+	cache = malloc(sizeof(*cache) + cnt * sizeof(*sclass));
+	if (!cache) {
+		nouveau_object_sclass_put(&sclass);
+		return -ENOMEM;
+	}
+	cache->obj = obj;
+	cache->handle = obj->handle;
+	cache->oclass = obj->oclass;
+	cache->count = cnt;
+	memcpy(cache->sclass, sclass, cnt * sizeof(*sclass));
+	nouveau_object_sclass_put(&sclass);
+
+	pthread_mutex_lock(&pdrm->lock);
+	found = nouveau_sclass_cache_find(pdrm, obj);
+	if (found) {
+		free(cache);
+		cache = found;
+	} else {
+		cache->next = pdrm->sclass;
+		pdrm->sclass = cache;
+	}
+	pthread_mutex_unlock(&pdrm->lock);
+
+	*pcache = cache;
+	return cache->count;
+}
+
+static void
+nouveau_sclass_cache_drop(struct nouveau_object *obj)
+{
+	struct nouveau_drm_priv *pdrm = nouveau_drm_priv(nouveau_drm(obj));
+	struct nouveau_sclass_cache **pcache, *cache;
+
+	pthread_mutex_lock(&pdrm->lock);
+	for (pcache = &pdrm->sclass; (cache = *pcache); ) {
+		if (cache->obj == obj) {
+			*pcache = cache->next;
+			free(cache);
+		} else {
+			pcache = &cache->next;
+		}
+	}
+	pthread_mutex_unlock(&pdrm->lock);
+}
+
+drm_public int
+nouveau_object_sclass_get(struct nouveau_object *obj,
+			  struct nouveau_sclass **psclass)
+{
+	struct nouveau_sclass_cache *cache;
+	struct nouveau_sclass *sclass;
+	int cnt;
+
+	cnt = nouveau_sclass_cache_get(obj, &cache);
+	if (cnt < 0)
+		return cnt;
+
+	if (!(sclass = calloc(cnt ? cnt : 1, sizeof(*sclass))))
+		return -ENOMEM;
+	memcpy(sclass, cache->sclass, cnt * sizeof(*sclass));
+	*psclass = sclass;
+	return cnt;
+}
+
 drm_public int
 nouveau_object_mclass(struct nouveau_object *obj,
 		      const struct nouveau_mclass *mclass)
 {
+	struct nouveau_sclass_cache *cache;
 	struct nouveau_sclass *sclass;
 	int ret = -ENODEV;
 	int cnt, i, j;
 
-	cnt = nouveau_object_sclass_get(obj, &sclass);
+	cnt = nouveau_sclass_cache_get(obj, &cache);
 	if (cnt < 0)
 		return cnt;
+	sclass = cache->sclass;
 
 	for (i = 0; ret < 0 && mclass[i].oclass; i++) {
 		for (j = 0; j < cnt; j++) {
@@ -219,7 +325,6 @@ nouveau_object_mclass(struct nouveau_object *obj,
 		}
 	}
 
-	nouveau_object_sclass_put(&sclass);
 	return ret;
 }
 
@@ -233,6 +338,8 @@ nouveau_object_fini(struct nouveau_object *obj)
 		.ioctl.type = NVIF_IOCTL_V0_DEL,
 	};
 
+	nouveau_sclass_cache_drop(obj);
+
 	if (obj->data) {
 		abi16_delete(obj);
 		free(obj->data);
@@ -333,20 +440,33 @@ nouveau_object_del(struct nouveau_object **pobj)
 drm_public void
 nouveau_drm_del(struct nouveau_drm **pdrm)
 {
-	free(*pdrm);
+	struct nouveau_drm_priv *priv = nouveau_drm_priv(*pdrm);
+	struct nouveau_sclass_cache *cache;
+
+	if (priv) {
+		while ((cache = priv->sclass)) {
+			priv->sclass = cache->next;
+			free(cache);
+		}
+		pthread_mutex_destroy(&priv->lock);
+		free(priv);
+	}
 	*pdrm = NULL;
 }
 
 drm_public int
 nouveau_drm_new(int fd, struct nouveau_drm **pdrm)
 {
+	struct nouveau_drm_priv *priv;
 	struct nouveau_drm *drm;
 	drmVersionPtr ver;
 
 	debug_init();
 
-	if (!(drm = calloc(1, sizeof(*drm))))
+	if (!(priv = calloc(1, sizeof(*priv))))
 		return -ENOMEM;
+	pthread_mutex_init(&priv->lock, NULL);
+	drm = &priv->base;
 	drm->fd = fd;
 
 	if (!(ver = drmGetVersion(fd))) {
@@ -461,13 +581,39 @@ nouveau_device_new(struct nouveau_object *parent, int32_t oclass,
 		(nvdev->base.gart_size * nvdev->gart_limit_percent) / 100;
 
 	ret = pthread_mutex_init(&nvdev->lock, NULL);
+	if (ret == 0)
+		ret = pthread_cond_init(&nvdev->submit_cond, NULL);
 	DRMINITLISTHEAD(&nvdev->bo_list);
+	util_bo_cache_init(&nvdev->cache, 2, UTIL_BO_CACHE_DEFAULT_MAX_SIZE,
+			   0, UTIL_BO_CACHE_DEFAULT_MAX_AGE);
 done:
 	if (ret)
 		nouveau_device_del(pdev);
 	return ret;
 }
 
+static void nouveau_bo_cache_evict(struct nouveau_device_priv *, uint64_t);
+
+drm_public int
+nouveau_device_bo_cache_enable(struct nouveau_device *dev, uint64_t max_size,
+			       uint32_t max_age_ms)
+{
+	struct nouveau_device_priv *nvdev = nouveau_device(dev);
+
+	if (!nvdev)
+		return -EINVAL;
+
+	pthread_mutex_lock(&nvdev->lock);
+	nvdev->reuse = max_size != 0;
+	nvdev->cache.max_bytes = max_size;
+	nvdev->cache.max_age = max_age_ms ?
+		max_age_ms * 1000000ull : UTIL_BO_CACHE_DEFAULT_MAX_AGE;
+	nouveau_bo_cache_evict(nvdev, nvdev->reuse ? util_bo_cache_now() :
+			       UTIL_BO_CACHE_PURGE);
+	pthread_mutex_unlock(&nvdev->lock);
+	return 0;
+}
+
 drm_public int
 nouveau_device_wrap(int fd, int close, struct nouveau_device **pdev)
 {
@@ -513,7 +659,14 @@ nouveau_device_del(struct nouveau_device **pdev)
 {
 	struct nouveau_device_priv *nvdev = nouveau_device(*pdev);
 	if (nvdev) {
+		if (nvdev->reuse)
+			nouveau_bo_cache_evict(nvdev, UTIL_BO_CACHE_PURGE);
+		if (nvdev->base.object.parent)
+			nouveau_sclass_cache_drop(&nvdev->base.object);
 		free(nvdev->client);
+		handle_table_fini(&nvdev->handles);
+		handle_table_fini(&nvdev->names);
+		pthread_cond_destroy(&nvdev->submit_cond);
 		pthread_mutex_destroy(&nvdev->lock);
 		if (nvdev->base.fd >= 0) {
 			struct nouveau_drm *drm =
@@ -596,11 +749,93 @@ nouveau_client_del(struct nouveau_client **pclient)
 		pthread_mutex_lock(&nvdev->lock);
 		nvdev->client[id / 32] &= ~(1 << (id % 32));
 		pthread_mutex_unlock(&nvdev->lock);
+		if (dbg_on(2)) {
+			struct nouveau_pushbuf_stats *s = &pcli->push_stats;
+			fprintf(nouveau_out, "nouveau: client %d pushbufs: "
+				"%" PRIu64 " kicks, %" PRIu64 " from bo waits, "
+				"%" PRIu64 " flushes, %" PRIu64 " validate "
+				"retries, %" PRIu64 " krecs, %.1f buffers and "
+				"%.0f bytes per krec, %" PRIu64 " us in pushbuf "
+				"ioctls\n", id, s->kicks, s->wait_kicks,
+				s->flushes, s->validate_retries, s->krecs,
+				s->krecs ? (double)s->buffers / s->krecs : 0.0,
+				s->krecs ? (double)s->push_bytes / s->krecs : 0.0,
+				s->ioctl_ns / 1000);
+		}
 		free(pcli->kref);
 		free(pcli);
 	}
 }
 
+static void
+nouveau_bo_free(struct nouveau_bo *bo)
+{
+	struct nouveau_drm *drm = nouveau_drm(&bo->device->object);
+	struct drm_gem_close req = { .handle = bo->handle };
+
+	drmIoctl(drm->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	if (bo->map)
+		drm_munmap(bo->map, bo->size);
+	free(nouveau_bo(bo));
+}
+
+/* Free the cached bos too old or over the memory cap, with the lock held. */
+static void
+nouveau_bo_cache_evict(struct nouveau_device_priv *nvdev, uint64_t now)
+{
+	struct util_bo_cache_entry *entry;
+
+	while ((entry = util_bo_cache_evict(&nvdev->cache, now)))
+		nouveau_bo_free(&LIST_ENTRY(struct nouveau_bo_priv, entry,
+					    cache_entry)->base);
+}
+
+/*
+ * Take an idle bo from the cache for the allocation, or NULL.  Only the
+ * oldest bo of the bucket made for the same flags, alignment and config
+ * is checked, allocating a new one being faster than waiting for it.
+ */
+static struct nouveau_bo_priv *
+nouveau_bo_cache_get(struct nouveau_device_priv *nvdev,
+		     struct util_bo_cache_bucket *bucket, uint32_t flags,
+		     uint32_t align, union nouveau_bo_config *config)
+{
+	struct nouveau_bo_priv *nvbo = NULL, *tmp;
+
+	pthread_mutex_lock(&nvdev->lock);
+	nouveau_bo_cache_evict(nvdev, util_bo_cache_now());
+	LIST_FOR_EACH_ENTRY(tmp, &bucket->list, cache_entry.bucket_link) {
+		if (tmp->new_flags != flags || tmp->new_align != align ||
+		    tmp->new_has_config != !!config ||
+		    (config && memcmp(&tmp->new_config, config,
+				      sizeof(*config))))
+			continue;
+
+		if (!nouveau_bo_wait(&tmp->base,
+				     NOUVEAU_BO_WR | NOUVEAU_BO_NOBLOCK, NULL)) {
+			util_bo_cache_take(&tmp->cache_entry);
+			nvbo = tmp;
+		}
+		break;
+	}
+	if (!nvbo)
+		util_bo_cache_miss(&nvdev->cache);
+	pthread_mutex_unlock(&nvdev->lock);
+	return nvbo;
+}
+
+/* Drop a shared bo from the list and its indexes, with the lock held. */
+static void
+nouveau_bo_unlist(struct nouveau_device_priv *nvdev,
+		  struct nouveau_bo_priv *nvbo)
+{
+	DRMLISTDEL(&nvbo->head);
+	handle_table_remove(&nvdev->handles, nvbo->base.handle);
+	if (nvbo->name &&
+	    handle_table_lookup(&nvdev->names, nvbo->name) == nvbo)
+		handle_table_remove(&nvdev->names, nvbo->name);
+}
+
 static void
 nouveau_bo_del(struct nouveau_bo *bo)
 {
@@ -608,11 +843,26 @@ nouveau_bo_del(struct nouveau_bo *bo)
 	struct nouveau_device_priv *nvdev = nouveau_device(bo->device);
 	struct nouveau_bo_priv *nvbo = nouveau_bo(bo);
 	struct drm_gem_close req = { .handle = bo->handle };
+	struct util_bo_cache_bucket *bucket = NULL;
+	uint64_t now;
+
+	/* keep the bo and its mapping for reuse, unless it was shared */
+	if (!nvbo->head.next && nvdev->reuse && nvbo->reusable)
+		bucket = util_bo_cache_get_bucket(&nvdev->cache, bo->size);
+	if (bucket && bucket->size == bo->size) {
+		now = util_bo_cache_now();
+		pthread_mutex_lock(&nvdev->lock);
+		util_bo_cache_add(&nvdev->cache, bucket, &nvbo->cache_entry,
+				  now);
+		nouveau_bo_cache_evict(nvdev, now);
+		pthread_mutex_unlock(&nvdev->lock);
+		return;
+	}
 
 	if (nvbo->head.next) {
 		pthread_mutex_lock(&nvdev->lock);
 		if (atomic_read(&nvbo->refcnt) == 0) {
-			DRMLISTDEL(&nvbo->head);
+			nouveau_bo_unlist(nvdev, nvbo);
 			/*
 			 * This bo has to be closed with the lock held because
 			 * gem handles are not refcounted. If a shared bo is
@@ -637,16 +887,35 @@ nouveau_bo_new(struct nouveau_device *dev, uint32_t flags, uint32_t align,
 	       uint64_t size, union nouveau_bo_config *config,
 	       struct nouveau_bo **pbo)
 {
-	struct nouveau_bo_priv *nvbo = calloc(1, sizeof(*nvbo));
-	struct nouveau_bo *bo = &nvbo->base;
+	struct nouveau_device_priv *nvdev = nouveau_device(dev);
+	struct util_bo_cache_bucket *bucket = NULL;
+	struct nouveau_bo_priv *nvbo;
+	struct nouveau_bo *bo;
 	int ret;
 
+	if (nvdev->reuse)
+		bucket = util_bo_cache_get_bucket(&nvdev->cache, size);
+	if (bucket) {
+		size = bucket->size;
+		nvbo = nouveau_bo_cache_get(nvdev, bucket, flags, align,
+					    config);
+		if (nvbo) {
+			atomic_set(&nvbo->refcnt, 1);
+			nvbo->access = 0;
+			*pbo = &nvbo->base;
+			return 0;
+		}
+	}
+
+	nvbo = calloc(1, sizeof(*nvbo));
 	if (!nvbo)
 		return -ENOMEM;
+	bo = &nvbo->base;
 	atomic_set(&nvbo->refcnt, 1);
 	bo->device = dev;
 	bo->flags = flags;
 	bo->size = size;
+	util_bo_cache_entry_init(&nvbo->cache_entry);
 
 	ret = abi16_bo_init(bo, align, config);
 	if (ret) {
@@ -654,6 +923,14 @@ nouveau_bo_new(struct nouveau_device *dev, uint32_t flags, uint32_t align,
 		return ret;
 	}
 
+	nvbo->reusable = true;
+	nvbo->new_flags = flags;
+	nvbo->new_align = align;
+	if (config) {
+		nvbo->new_has_config = true;
+		nvbo->new_config = *config;
+	}
+
 	*pbo = bo;
 	return 0;
 }
@@ -668,25 +945,23 @@ nouveau_bo_wrap_locked(struct nouveau_device *dev, uint32_t handle,
 	struct nouveau_bo_priv *nvbo;
 	int ret;
 
-	DRMLISTFOREACHENTRY(nvbo, &nvdev->bo_list, head) {
-		if (nvbo->base.handle == handle) {
-			if (atomic_inc_return(&nvbo->refcnt) == 1) {
-				/*
-				 * Uh oh, this bo is dead and someone else
-				 * will free it, but because refcnt is
-				 * now non-zero fortunately they won't
-				 * call the ioctl to close the bo.
-				 *
-				 * Remove this bo from the list so other
-				 * calls to nouveau_bo_wrap_locked will
-				 * see our replacement nvbo.
-				 */
-				DRMLISTDEL(&nvbo->head);
-				if (!name)
-					name = nvbo->name;
-				break;
-			}
-
+	nvbo = handle_table_lookup(&nvdev->handles, handle);
+	if (nvbo) {
+		if (atomic_inc_return(&nvbo->refcnt) == 1) {
+			/*
+			 * Uh oh, this bo is dead and someone else
+			 * will free it, but because refcnt is
+			 * now non-zero fortunately they won't
+			 * call the ioctl to close the bo.
+			 *
+			 * Remove this bo from the list so other
+			 * calls to nouveau_bo_wrap_locked will
+			 * see our replacement nvbo.
+			 */
+			nouveau_bo_unlist(nvdev, nvbo);
+			if (!name)
+				name = nvbo->name;
+		} else {
 			*pbo = &nvbo->base;
 			return 0;
 		}
@@ -703,6 +978,12 @@ nouveau_bo_wrap_locked(struct nouveau_device *dev, uint32_t handle,
 		nvbo->base.device = dev;
 		abi16_bo_info(&nvbo->base, &req);
 		nvbo->name = name;
+		if (handle_table_insert(&nvdev->handles, handle, nvbo) ||
+		    (name && handle_table_insert(&nvdev->names, name, nvbo))) {
+			handle_table_remove(&nvdev->handles, handle);
+			free(nvbo);
+			return -ENOMEM;
+		}
 		DRMLISTADD(&nvbo->head, &nvdev->bo_list);
 		*pbo = &nvbo->base;
 		return 0;
@@ -711,16 +992,28 @@ nouveau_bo_wrap_locked(struct nouveau_device *dev, uint32_t handle,
 	return -ENOMEM;
 }
 
-static void
+static int
 nouveau_bo_make_global(struct nouveau_bo_priv *nvbo)
 {
+	struct nouveau_device_priv *nvdev = nouveau_device(nvbo->base.device);
+	int ret = 0;
+
+	if (nvbo->head.next &&
+	    (!nvbo->name ||
+	     handle_table_lookup(&nvdev->names, nvbo->name) == nvbo))
+		return 0;
+
+	pthread_mutex_lock(&nvdev->lock);
 	if (!nvbo->head.next) {
-		struct nouveau_device_priv *nvdev = nouveau_device(nvbo->base.device);
-		pthread_mutex_lock(&nvdev->lock);
-		if (!nvbo->head.next)
+		ret = handle_table_insert(&nvdev->handles, nvbo->base.handle,
+					  nvbo);
+		if (!ret)
 			DRMLISTADD(&nvbo->head, &nvdev->bo_list);
-		pthread_mutex_unlock(&nvdev->lock);
 	}
+	if (!ret && nvbo->name)
+		ret = handle_table_insert(&nvdev->names, nvbo->name, nvbo);
+	pthread_mutex_unlock(&nvdev->lock);
+	return ret;
 }
 
 drm_public int
@@ -746,13 +1039,11 @@ nouveau_bo_name_ref(struct nouveau_device *dev, uint32_t name,
 	int ret;
 
 	pthread_mutex_lock(&nvdev->lock);
-	DRMLISTFOREACHENTRY(nvbo, &nvdev->bo_list, head) {
-		if (nvbo->name == name) {
-			ret = nouveau_bo_wrap_locked(dev, nvbo->base.handle,
-						     pbo, name);
-			pthread_mutex_unlock(&nvdev->lock);
-			return ret;
-		}
+	nvbo = handle_table_lookup(&nvdev->names, name);
+	if (nvbo) {
+		ret = nouveau_bo_wrap_locked(dev, nvbo->base.handle, pbo, name);
+		pthread_mutex_unlock(&nvdev->lock);
+		return ret;
 	}
 
 	ret = drmIoctl(drm->fd, DRM_IOCTL_GEM_OPEN, &req);
@@ -781,7 +1072,11 @@ nouveau_bo_name_get(struct nouveau_bo *bo, uint32_t *name)
 		}
 		nvbo->name = *name = req.name;
 
-		nouveau_bo_make_global(nvbo);
+		ret = nouveau_bo_make_global(nvbo);
+		if (ret) {
+			nvbo->name = *name = 0;
+			return ret;
+		}
 	}
 	return 0;
 }
@@ -831,8 +1126,36 @@ nouveau_bo_set_prime(struct nouveau_bo *bo, int *prime_fd)
 	if (ret)
 		return ret;
 
-	nouveau_bo_make_global(nvbo);
-	return 0;
+	ret = nouveau_bo_make_global(nvbo);
+	if (ret) {
+		close(*prime_fd);
+		*prime_fd = -1;
+	}
+	return ret;
+}
+
+drm_private void
+nouveau_bo_queue_submit(struct nouveau_bo *bo)
+{
+	struct nouveau_device_priv *nvdev = nouveau_device(bo->device);
+	struct nouveau_bo_priv *nvbo = nouveau_bo(bo);
+
+	pthread_mutex_lock(&nvdev->lock);
+	__atomic_store_n(&nvbo->pending, nvbo->pending + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&nvdev->lock);
+}
+
+drm_private void
+nouveau_bo_submitted(struct nouveau_bo *bo)
+{
+	struct nouveau_device_priv *nvdev = nouveau_device(bo->device);
+	struct nouveau_bo_priv *nvbo = nouveau_bo(bo);
+
+	pthread_mutex_lock(&nvdev->lock);
+	__atomic_store_n(&nvbo->pending, nvbo->pending - 1, __ATOMIC_RELEASE);
+	if (!nvbo->pending)
+		pthread_cond_broadcast(&nvdev->submit_cond);
+	pthread_mutex_unlock(&nvdev->lock);
 }
 
 drm_public int
@@ -840,20 +1163,39 @@ nouveau_bo_wait(struct nouveau_bo *bo, uint32_t access,
 		struct nouveau_client *client)
 {
 	struct nouveau_drm *drm = nouveau_drm(&bo->device->object);
+	struct nouveau_device_priv *nvdev = nouveau_device(bo->device);
 	struct nouveau_bo_priv *nvbo = nouveau_bo(bo);
 	struct drm_nouveau_gem_cpu_prep req;
 	struct nouveau_pushbuf *push;
+	uint32_t busy;
 	int ret = 0;
 
 	if (!(access & NOUVEAU_BO_RDWR))
 		return 0;
 
-	push = cli_push_get(client, bo);
-	if (push && push->channel)
-		nouveau_pushbuf_kick(push, push->channel);
+	/* a cpu write has to wait for any gpu access, a read only for the
+	 * gpu writes, so only kick the pushbuf when it conflicts */
+	busy = (access & NOUVEAU_BO_WR) ? NOUVEAU_BO_RDWR : NOUVEAU_BO_WR;
+	push = client ? cli_push_get(client, bo) : NULL;
+	if (push && push->channel &&
+	    (nouveau_pushbuf_refd(push, bo) & busy))
+		nouveau_pushbuf_wait_kick(push);
+
+	/* the kernel doesn't know yet about the krecs still queued */
+	if (__atomic_load_n(&nvbo->pending, __ATOMIC_ACQUIRE)) {
+		if (access & NOUVEAU_BO_NOBLOCK)
+			return -EBUSY;
+		pthread_mutex_lock(&nvdev->lock);
+		while (nvbo->pending)
+			pthread_cond_wait(&nvdev->submit_cond, &nvdev->lock);
+		pthread_mutex_unlock(&nvdev->lock);
+	}
 
-	if (!nvbo->head.next && !(nvbo->access & NOUVEAU_BO_WR) &&
-				!(access & NOUVEAU_BO_WR))
+	/*
+	 * nvbo->access has the gpu accesses submitted since the last wait
+	 * for them, only other processes can use a bo that was not shared.
+	 */
+	if (!nvbo->head.next && !(nvbo->access & busy))
 		return 0;
 
 	req.handle = bo->handle;
@@ -866,7 +1208,7 @@ nouveau_bo_wait(struct nouveau_bo *bo, uint32_t access,
 	ret = drmCommandWrite(drm->fd, DRM_NOUVEAU_GEM_CPU_PREP,
 			      &req, sizeof(req));
 	if (ret == 0)
-		nvbo->access = 0;
+		nvbo->access &= ~busy;
 	return ret;
 }
 
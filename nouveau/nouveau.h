@@ -78,6 +78,15 @@ void nouveau_device_del(struct nouveau_device **);
 int nouveau_getparam(struct nouveau_device *, uint64_t param, uint64_t *value);
 int nouveau_setparam(struct nouveau_device *, uint64_t param, uint64_t value);
 
+/* Keep the bos freed and never shared for reuse by nouveau_bo_new() calls
+ * with the same flags, alignment and config once they are idle, up to
+ * max_size bytes and for max_age_ms (0 for one second).  Sizes are rounded
+ * up to the cache buckets, reused bos keep their content and mapping.  A
+ * max_size of 0 disables the cache and frees the bos in it.
+ */
+int nouveau_device_bo_cache_enable(struct nouveau_device *, uint64_t max_size,
+				   uint32_t max_age_ms);
+
 /* deprecated */
 int nouveau_device_wrap(int fd, int close, struct nouveau_device **);
 int nouveau_device_open(const char *busid, struct nouveau_device **);
@@ -206,6 +215,25 @@ struct nouveau_pushbuf_refn {
 	uint32_t flags;
 };
 
+/* Counters since the pushbuf was created.  The averages per krec are
+ * buffers / krecs and push_bytes / krecs. */
+struct nouveau_pushbuf_stats {
+	/* nouveau_pushbuf_kick() calls, those of nouveau_bo_wait() included
+	 * and also counted by wait_kicks */
+	uint64_t kicks;
+	uint64_t wait_kicks;
+	/* krecs ended, by a kick or when one ran out of room */
+	uint64_t flushes;
+	/* validations which didn't fit and were retried in a new krec */
+	uint64_t validate_retries;
+	/* DRM_NOUVEAU_GEM_PUSHBUF ioctls, with their buffers, bytes pushed
+	 * and time spent */
+	uint64_t krecs;
+	uint64_t buffers;
+	uint64_t push_bytes;
+	uint64_t ioctl_ns;
+};
+
 int nouveau_pushbuf_new(struct nouveau_client *, struct nouveau_object *chan,
 			int nr, uint32_t size, bool immediate,
 			struct nouveau_pushbuf **);
@@ -226,8 +254,44 @@ void nouveau_pushbuf_reloc(struct nouveau_pushbuf *, struct nouveau_bo *,
 int nouveau_pushbuf_validate(struct nouveau_pushbuf *);
 uint32_t nouveau_pushbuf_refd(struct nouveau_pushbuf *, struct nouveau_bo *);
 int nouveau_pushbuf_kick(struct nouveau_pushbuf *, struct nouveau_object *chan);
+/* With a depth above 0, kicks of an immediate pushbuf hand the krec to a
+ * submit thread and go on building in one of depth spare krecs, waiting
+ * only when depth krecs are already queued.  The results of the pushbuf
+ * ioctl are passed to done, in order, from the kicking thread, and the
+ * first error is kept for nouveau_pushbuf_finish().
+ * nouveau_bo_wait() on a bo of a queued krec waits for its submission.
+ * A depth of 0 submits what is queued and goes back to synchronous kicks.
+ */
+int nouveau_pushbuf_async(struct nouveau_pushbuf *, int depth,
+			  void (*done)(struct nouveau_pushbuf *, int ret));
+/* Wait for the queued krecs to be submitted and report them, the first
+ * error is returned. */
+int nouveau_pushbuf_finish(struct nouveau_pushbuf *);
 struct nouveau_bufctx *
 nouveau_pushbuf_bufctx(struct nouveau_pushbuf *, struct nouveau_bufctx *);
+/* The counters of the krecs submitted so far, including those the submit
+ * thread is submitting.  With NOUVEAU_LIBDRM_DEBUG & 0x4, those of all the
+ * pushbufs of a client are printed when the client is deleted. */
+void nouveau_pushbuf_stats(struct nouveau_pushbuf *,
+			   struct nouveau_pushbuf_stats *);
+
+/* Streaming uploads of a client, suballocated linearly from a ring of
+ * persistently mapped GART chunks of size bytes.  A chunk is reused once
+ * the pushbufs that read it completed, new chunks are added while the gpu
+ * still reads the older ones, and the oldest is waited for only once the
+ * ring has 8 of them. */
+struct nouveau_upload;
+
+int nouveau_upload_new(struct nouveau_client *, uint32_t size,
+		       struct nouveau_upload **);
+void nouveau_upload_del(struct nouveau_upload **);
+/* Takes size bytes, aligned to align (a power of two, or 0), at offset of
+ * bo and mapped at map.  When bufctx isn't NULL, bo is referenced for
+ * reading in bin, for the pushbuf reading the data to validate it.  That
+ * pushbuf has to be validated before the ring wraps back to the chunk. */
+int nouveau_upload_alloc(struct nouveau_upload *, uint32_t size,
+			 uint32_t align, struct nouveau_bufctx *, int bin,
+			 struct nouveau_bo **, uint32_t *offset, void **map);
 
 #define NOUVEAU_DEVICE_CLASS       0x80000000
 #define NOUVEAU_FIFO_CHANNEL_CLASS 0x80000001
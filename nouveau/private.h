@@ -8,12 +8,15 @@
 #include <xf86atomic.h>
 #include <pthread.h>
 #include "nouveau_drm.h"
+#include "util_bo_cache.h"
+#include "util_handle_table.h"
 
 #include "nouveau.h"
 
 /*
  * 0x00000001 dump all pushbuffers
  * 0x00000002 submit pushbuffers synchronously
+ * 0x00000004 print the pushbuf statistics of a client when it is deleted
  * 0x80000000 if compiled with SIMULATE return -EINVAL for all pb submissions
  */
 drm_private extern uint32_t nouveau_debug;
@@ -34,6 +37,8 @@ struct nouveau_client_priv {
 	struct nouveau_client base;
 	struct nouveau_client_kref *kref;
 	unsigned kref_nr;
+	/* of the pushbufs deleted already */
+	struct nouveau_pushbuf_stats push_stats;
 };
 
 static inline struct nouveau_client_priv *
@@ -81,6 +86,29 @@ cli_kref_set(struct nouveau_client *client, struct nouveau_bo *bo,
 	pcli->kref[bo->handle].push = push;
 }
 
+/* The classes an object supports, fixed for its lifetime. */
+struct nouveau_sclass_cache {
+	struct nouveau_sclass_cache *next;
+	struct nouveau_object *obj;
+	uint64_t handle;
+	uint32_t oclass;
+	int count;
+	struct nouveau_sclass sclass[];
+};
+
+struct nouveau_drm_priv {
+	struct nouveau_drm base;
+	pthread_mutex_t lock;
+	/* of the live objects queried, under lock */
+	struct nouveau_sclass_cache *sclass;
+};
+
+static inline struct nouveau_drm_priv *
+nouveau_drm_priv(struct nouveau_drm *drm)
+{
+	return (struct nouveau_drm_priv *)drm;
+}
+
 struct nouveau_bo_priv {
 	struct nouveau_bo base;
 	struct nouveau_list head;
@@ -88,6 +116,17 @@ struct nouveau_bo_priv {
 	uint64_t map_handle;
 	uint32_t name;
 	uint32_t access;
+	/* made by nouveau_bo_new(), so it may go to the cache when not
+	 * shared, with the arguments it was made for */
+	bool reusable;
+	uint32_t new_flags;
+	uint32_t new_align;
+	bool new_has_config;
+	union nouveau_bo_config new_config;
+	struct util_bo_cache_entry cache_entry;
+	/* krecs referencing the bo queued to a pushbuf submit thread and
+	 * not submitted yet, under the device lock */
+	uint32_t pending;
 };
 
 static inline struct nouveau_bo_priv *
@@ -100,11 +139,19 @@ struct nouveau_device_priv {
 	struct nouveau_device base;
 	int close;
 	pthread_mutex_t lock;
+	/* shared bos, also indexed by gem handle and flink name */
 	struct nouveau_list bo_list;
+	struct handle_table handles;
+	struct handle_table names;
 	uint32_t *client;
 	int nr_client;
 	bool have_bo_usage;
 	int gart_limit_percent, vram_limit_percent;
+	/* freed bos never shared, kept for reuse when enabled, under lock */
+	bool reuse;
+	struct util_bo_cache cache;
+	/* signaled when the last pending krec of a bo was submitted */
+	pthread_cond_t submit_cond;
 };
 
 static inline struct nouveau_device_priv *
@@ -116,6 +163,15 @@ nouveau_device(struct nouveau_device *dev)
 int
 nouveau_device_open_existing(struct nouveau_device **, int, int, drm_context_t);
 
+/* nouveau.c */
+drm_private void nouveau_bo_queue_submit(struct nouveau_bo *);
+drm_private void nouveau_bo_submitted(struct nouveau_bo *);
+
+/* pushbuf.c */
+drm_private int nouveau_pushbuf_wait_kick(struct nouveau_pushbuf *);
+drm_private void nouveau_pushbuf_stats_add(struct nouveau_pushbuf_stats *,
+					   const struct nouveau_pushbuf_stats *);
+
 /* abi16.c */
 drm_private bool abi16_object(struct nouveau_object *, int (**)(struct nouveau_object *));
 drm_private void abi16_delete(struct nouveau_object *);
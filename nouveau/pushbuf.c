@@ -29,10 +29,13 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <xf86drm.h>
 #include <xf86atomic.h>
 #include "libdrm_lists.h"
+#include "util_trace.h"
 #include "nouveau_drm.h"
 
 #include "nouveau.h"
@@ -48,6 +51,14 @@ struct nouveau_pushbuf_krec {
 	int nr_push;
 	uint64_t vram_used;
 	uint64_t gart_used;
+	/* buffers below this one can't be moved from GART to VRAM, they
+	 * are VRAM already, GART only or didn't fit in VRAM */
+	int nr_gart_checked;
+	/* queued to the submit thread, in order */
+	struct nouveau_pushbuf_krec *queue_next;
+	struct drm_nouveau_gem_pushbuf req;
+	bool submitted;
+	int ret;
 };
 
 struct nouveau_pushbuf_priv {
@@ -63,6 +74,25 @@ struct nouveau_pushbuf_priv {
 	uint32_t *bgn;
 	int bo_next;
 	int bo_nr;
+	/* asynchronous kicks, see nouveau_pushbuf_async() */
+	int async_depth;
+	void (*async_done)(struct nouveau_pushbuf *, int ret);
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	/* signaled when a krec is queued, submitted or the thread stops */
+	pthread_cond_t cond;
+	bool stop;
+	/* oldest krec not reaped yet, next for the thread, last queued */
+	struct nouveau_pushbuf_krec *queue;
+	struct nouveau_pushbuf_krec *queue_submit;
+	struct nouveau_pushbuf_krec *queue_tail;
+	int nr_queued;
+	/* first error since the last nouveau_pushbuf_finish() */
+	int async_ret;
+	/* krecs to build the next ones in, linked by queue_next */
+	struct nouveau_pushbuf_krec *spare;
+	/* the krec counters are also updated by the submit thread */
+	struct nouveau_pushbuf_stats stats;
 	struct nouveau_bo *bos[];
 };
 
@@ -74,6 +104,7 @@ nouveau_pushbuf(struct nouveau_pushbuf *push)
 
 static int pushbuf_validate(struct nouveau_pushbuf *, bool);
 static int pushbuf_flush(struct nouveau_pushbuf *);
+static void pushbuf_reap(struct nouveau_pushbuf *, int);
 
 static bool
 pushbuf_kref_fits(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
@@ -118,10 +149,13 @@ pushbuf_kref_fits(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 
 	/* Still couldn't fit the buffer in anywhere, so as a last resort;
 	 * scan the buffer list for VRAM|GART buffers and turn them into
-	 * VRAM buffers until we have enough space in GART for this one
+	 * VRAM buffers until we have enough space in GART for this one.
+	 * VRAM usage only grows, so a buffer that didn't fit won't fit in
+	 * later calls, and the scan carries on from where it stopped.
 	 */
-	kref = krec->buffer;
-	for (i = 0; i < krec->nr_buffer; i++, kref++) {
+	kref = krec->buffer + krec->nr_gart_checked;
+	for (i = krec->nr_gart_checked; i < krec->nr_buffer; i++, kref++) {
+		krec->nr_gart_checked = i + 1;
 		if (!(kref->valid_domains & NOUVEAU_GEM_DOMAIN_GART))
 			continue;
 
@@ -167,8 +201,12 @@ pushbuf_kref(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 	 * the correct ordering of commands
 	 */
 	fpush = cli_push_get(push->client, bo);
-	if (fpush && fpush != push)
+	if (fpush && fpush != push) {
 		pushbuf_flush(fpush);
+		/* and for it to reach the kernel before ours */
+		if (nouveau_pushbuf(fpush)->async_depth)
+			pushbuf_reap(fpush, 0);
+	}
 
 	kref = cli_kref_get(push->client, bo);
 	if (kref) {
@@ -305,20 +343,117 @@ pushbuf_dump(struct nouveau_pushbuf_krec *krec, int krec_id, int chid)
 	}
 }
 
+static void
+pushbuf_krec_req(struct nouveau_pushbuf_priv *nvpb,
+		 struct nouveau_pushbuf_krec *krec, struct nouveau_fifo *fifo,
+		 struct drm_nouveau_gem_pushbuf *req)
+{
+	req->channel = fifo->channel;
+	req->nr_buffers = krec->nr_buffer;
+	req->buffers = (uint64_t)(unsigned long)krec->buffer;
+	req->nr_relocs = krec->nr_reloc;
+	req->nr_push = krec->nr_push;
+	req->relocs = (uint64_t)(unsigned long)krec->reloc;
+	req->push = (uint64_t)(unsigned long)krec->push;
+	req->suffix0 = nvpb->suffix0;
+	req->suffix1 = nvpb->suffix1;
+	req->vram_available = 0; /* for valgrind */
+	if (dbg_on(1))
+		req->vram_available |= NOUVEAU_GEM_PUSHBUF_SYNC;
+	req->gart_available = 0;
+}
+
+static uint64_t
+pushbuf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+pushbuf_krec_ioctl(struct nouveau_pushbuf_priv *nvpb,
+		   struct drm_nouveau_gem_pushbuf *req)
+{
+	struct drm_nouveau_gem_pushbuf_push *push =
+		(void *)(unsigned long)req->push;
+	struct nouveau_pushbuf_stats *stats = &nvpb->stats;
+	uint64_t start = pushbuf_now(), bytes = 0;
+	int ret = 0;
+	uint32_t i;
+#ifndef SIMULATE
+	struct nouveau_drm *drm =
+		nouveau_drm(&nvpb->base.client->device->object);
+
+	ret = drmCommandWriteRead(drm->fd, DRM_NOUVEAU_GEM_PUSHBUF,
+				  req, sizeof(*req));
+#else
+	if (dbg_on(31))
+		ret = -EINVAL;
+#endif
+
+	for (i = 0; i < req->nr_push; i++)
+		bytes += push[i].length & 0x7fffff;
+	__atomic_fetch_add(&stats->ioctl_ns, pushbuf_now() - start,
+			   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->krecs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->buffers, req->nr_buffers, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->push_bytes, bytes, __ATOMIC_RELAXED);
+	return ret;
+}
+
+/* Take in what the kernel returned for the krec. */
+static void
+pushbuf_krec_result(struct nouveau_pushbuf_priv *nvpb,
+		    struct nouveau_pushbuf_krec *krec,
+		    struct drm_nouveau_gem_pushbuf *req)
+{
+	struct nouveau_device *dev = nvpb->base.client->device;
+	struct drm_nouveau_gem_pushbuf_bo_presumed *info;
+	struct drm_nouveau_gem_pushbuf_bo *kref;
+	struct nouveau_bo *bo;
+	int i;
+
+#ifndef SIMULATE
+	nvpb->suffix0 = req->suffix0;
+	nvpb->suffix1 = req->suffix1;
+	dev->vram_limit = (req->vram_available *
+			nouveau_device(dev)->vram_limit_percent) / 100;
+	dev->gart_limit = (req->gart_available *
+			nouveau_device(dev)->gart_limit_percent) / 100;
+#endif
+
+	kref = krec->buffer;
+	for (i = 0; i < krec->nr_buffer; i++, kref++) {
+		bo = (void *)(unsigned long)kref->user_priv;
+
+		info = &kref->presumed;
+		if (!info->valid) {
+			bo->flags &= ~NOUVEAU_BO_APER;
+			if (info->domain == NOUVEAU_GEM_DOMAIN_VRAM)
+				bo->flags |= NOUVEAU_BO_VRAM;
+			else
+				bo->flags |= NOUVEAU_BO_GART;
+			bo->offset = info->offset;
+		}
+
+		if (kref->write_domains)
+			nouveau_bo(bo)->access |= NOUVEAU_BO_WR;
+		if (kref->read_domains)
+			nouveau_bo(bo)->access |= NOUVEAU_BO_RD;
+	}
+}
+
 static int
 pushbuf_submit(struct nouveau_pushbuf *push, struct nouveau_object *chan)
 {
 	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
 	struct nouveau_pushbuf_krec *krec = nvpb->list;
-	struct nouveau_device *dev = push->client->device;
-	struct nouveau_drm *drm = nouveau_drm(&dev->object);
-	struct drm_nouveau_gem_pushbuf_bo_presumed *info;
-	struct drm_nouveau_gem_pushbuf_bo *kref;
 	struct drm_nouveau_gem_pushbuf req;
 	struct nouveau_fifo *fifo = chan->data;
-	struct nouveau_bo *bo;
 	int krec_id = 0;
-	int ret = 0, i;
+	int ret = 0;
 
 	if (chan->oclass != NOUVEAU_FIFO_CHANNEL_CLASS)
 		return -EINVAL;
@@ -329,67 +464,168 @@ pushbuf_submit(struct nouveau_pushbuf *push, struct nouveau_object *chan)
 	nouveau_pushbuf_data(push, NULL, 0, 0);
 
 	while (krec && krec->nr_push) {
-		req.channel = fifo->channel;
-		req.nr_buffers = krec->nr_buffer;
-		req.buffers = (uint64_t)(unsigned long)krec->buffer;
-		req.nr_relocs = krec->nr_reloc;
-		req.nr_push = krec->nr_push;
-		req.relocs = (uint64_t)(unsigned long)krec->reloc;
-		req.push = (uint64_t)(unsigned long)krec->push;
-		req.suffix0 = nvpb->suffix0;
-		req.suffix1 = nvpb->suffix1;
-		req.vram_available = 0; /* for valgrind */
-		if (dbg_on(1))
-			req.vram_available |= NOUVEAU_GEM_PUSHBUF_SYNC;
-		req.gart_available = 0;
+		pushbuf_krec_req(nvpb, krec, fifo, &req);
 
 		if (dbg_on(0))
 			pushbuf_dump(krec, krec_id++, fifo->channel);
 
-#ifndef SIMULATE
-		ret = drmCommandWriteRead(drm->fd, DRM_NOUVEAU_GEM_PUSHBUF,
-					  &req, sizeof(req));
-		nvpb->suffix0 = req.suffix0;
-		nvpb->suffix1 = req.suffix1;
-		dev->vram_limit = (req.vram_available *
-				nouveau_device(dev)->vram_limit_percent) / 100;
-		dev->gart_limit = (req.gart_available *
-				nouveau_device(dev)->gart_limit_percent) / 100;
-#else
-		if (dbg_on(31))
-			ret = -EINVAL;
-#endif
-
+		ret = pushbuf_krec_ioctl(nvpb, &req);
 		if (ret) {
 			err("kernel rejected pushbuf: %s\n", strerror(-ret));
 			pushbuf_dump(krec, krec_id++, fifo->channel);
 			break;
 		}
+		pushbuf_krec_result(nvpb, krec, &req);
 
-		kref = krec->buffer;
-		for (i = 0; i < krec->nr_buffer; i++, kref++) {
-			bo = (void *)(unsigned long)kref->user_priv;
-
-			info = &kref->presumed;
-			if (!info->valid) {
-				bo->flags &= ~NOUVEAU_BO_APER;
-				if (info->domain == NOUVEAU_GEM_DOMAIN_VRAM)
-					bo->flags |= NOUVEAU_BO_VRAM;
-				else
-					bo->flags |= NOUVEAU_BO_GART;
-				bo->offset = info->offset;
-			}
+		krec = krec->next;
+	}
+
+	return ret;
+}
+
+static void *
+pushbuf_thread(void *data)
+{
+	struct nouveau_pushbuf_priv *nvpb = data;
+	struct nouveau_pushbuf_krec *krec;
+	int ret, i;
+
+	pthread_mutex_lock(&nvpb->mutex);
+	for (;;) {
+		while (!nvpb->queue_submit && !nvpb->stop)
+			pthread_cond_wait(&nvpb->cond, &nvpb->mutex);
+		/* what was queued before stopping is still submitted */
+		krec = nvpb->queue_submit;
+		if (!krec)
+			break;
+		pthread_mutex_unlock(&nvpb->mutex);
+
+		ret = pushbuf_krec_ioctl(nvpb, &krec->req);
+		for (i = 0; i < krec->nr_buffer; i++)
+			nouveau_bo_submitted((void *)(unsigned long)
+					     krec->buffer[i].user_priv);
+
+		pthread_mutex_lock(&nvpb->mutex);
+		krec->ret = ret;
+		krec->submitted = true;
+		nvpb->queue_submit = krec->queue_next;
+		pthread_cond_broadcast(&nvpb->cond);
+	}
+	pthread_mutex_unlock(&nvpb->mutex);
+	return NULL;
+}
+
+/*
+ * Take in the results of the submitted krecs and release their buffers, in
+ * order, until at most max are left queued.
+ */
+static void
+pushbuf_reap(struct nouveau_pushbuf *push, int max)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_fifo *fifo = push->channel->data;
+	struct nouveau_pushbuf_krec *krec;
+	struct nouveau_bo *bo;
+	int i;
+
+	pthread_mutex_lock(&nvpb->mutex);
+	for (;;) {
+		krec = nvpb->queue;
+		if (!krec || !krec->submitted) {
+			if (nvpb->nr_queued <= max)
+				break;
+			pthread_cond_wait(&nvpb->cond, &nvpb->mutex);
+			continue;
+		}
+		nvpb->queue = krec->queue_next;
+		if (!nvpb->queue)
+			nvpb->queue_tail = NULL;
+		nvpb->nr_queued--;
+		pthread_mutex_unlock(&nvpb->mutex);
+
+		if (krec->ret) {
+			err("kernel rejected pushbuf: %s\n",
+			    strerror(-krec->ret));
+			pushbuf_dump(krec, 0, fifo->channel);
+			if (!nvpb->async_ret)
+				nvpb->async_ret = krec->ret;
+		} else {
+			pushbuf_krec_result(nvpb, krec, &krec->req);
+		}
 
-			if (kref->write_domains)
-				nouveau_bo(bo)->access |= NOUVEAU_BO_WR;
-			if (kref->read_domains)
-				nouveau_bo(bo)->access |= NOUVEAU_BO_RD;
+		for (i = 0; i < krec->nr_buffer; i++) {
+			bo = (void *)(unsigned long)krec->buffer[i].user_priv;
+			nouveau_bo_ref(NULL, &bo);
 		}
+		krec->nr_buffer = 0;
+		if (nvpb->async_done)
+			nvpb->async_done(push, krec->ret);
 
-		krec = krec->next;
+		pthread_mutex_lock(&nvpb->mutex);
+		krec->queue_next = nvpb->spare;
+		nvpb->spare = krec;
 	}
+	pthread_mutex_unlock(&nvpb->mutex);
+}
 
-	return ret;
+/* Hand the current krec to the submit thread and build in a spare one. */
+static int
+pushbuf_queue(struct nouveau_pushbuf *push, struct nouveau_object *chan)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_pushbuf_krec *krec = nvpb->krec;
+	struct drm_nouveau_gem_pushbuf_bo *kref;
+	struct nouveau_fifo *fifo = chan->data;
+	struct nouveau_bo *bo;
+	int i;
+
+	if (chan->oclass != NOUVEAU_FIFO_CHANNEL_CLASS)
+		return -EINVAL;
+
+	if (push->kick_notify)
+		push->kick_notify(push);
+
+	nouveau_pushbuf_data(push, NULL, 0, 0);
+
+	if (!krec->nr_push)
+		return 0;
+
+	/* wait for room, there are as many spare krecs as can be queued */
+	pushbuf_reap(push, nvpb->async_depth - 1);
+
+	pushbuf_krec_req(nvpb, krec, fifo, &krec->req);
+	if (dbg_on(0))
+		pushbuf_dump(krec, 0, fifo->channel);
+
+	kref = krec->buffer;
+	for (i = 0; i < krec->nr_buffer; i++, kref++) {
+		bo = (void *)(unsigned long)kref->user_priv;
+		nouveau_bo_queue_submit(bo);
+		/* for nouveau_bo_wait() to know until the krec is reaped */
+		if (kref->write_domains)
+			nouveau_bo(bo)->access |= NOUVEAU_BO_WR;
+		if (kref->read_domains)
+			nouveau_bo(bo)->access |= NOUVEAU_BO_RD;
+	}
+
+	pthread_mutex_lock(&nvpb->mutex);
+	nvpb->krec = nvpb->list = nvpb->spare;
+	nvpb->spare = nvpb->spare->queue_next;
+	krec->queue_next = NULL;
+	krec->submitted = false;
+	if (nvpb->queue_tail)
+		nvpb->queue_tail->queue_next = krec;
+	else
+		nvpb->queue = krec;
+	nvpb->queue_tail = krec;
+	if (!nvpb->queue_submit)
+		nvpb->queue_submit = krec;
+	nvpb->nr_queued++;
+	pthread_cond_broadcast(&nvpb->cond);
+	pthread_mutex_unlock(&nvpb->mutex);
+
+	nvpb->krec->next = NULL;
+	return 0;
 }
 
 static int
@@ -402,6 +638,11 @@ pushbuf_flush(struct nouveau_pushbuf *push)
 	struct nouveau_bo *bo;
 	int ret = 0, i;
 
+	if (push->channel)
+		nvpb->stats.flushes++;
+	if (push->channel && nvpb->async_depth) {
+		ret = pushbuf_queue(push, push->channel);
+	} else
 	if (push->channel) {
 		ret = pushbuf_submit(push, push->channel);
 	} else {
@@ -414,13 +655,15 @@ pushbuf_flush(struct nouveau_pushbuf *push)
 	for (i = 0; i < krec->nr_buffer; i++, kref++) {
 		bo = (void *)(unsigned long)kref->user_priv;
 		cli_kref_set(push->client, bo, NULL, NULL);
-		if (push->channel)
+		/* a queued krec keeps its references until it is reaped */
+		if (push->channel && krec == nvpb->krec)
 			nouveau_bo_ref(NULL, &bo);
 	}
 
 	krec = nvpb->krec;
 	krec->vram_used = 0;
 	krec->gart_used = 0;
+	krec->nr_gart_checked = 0;
 	krec->nr_buffer = 0;
 	krec->nr_reloc = 0;
 	krec->nr_push = 0;
@@ -444,12 +687,19 @@ pushbuf_refn_fail(struct nouveau_pushbuf *push, int sref, int srel)
 	kref = krec->buffer + sref;
 	while (krec->nr_buffer-- > sref) {
 		struct nouveau_bo *bo = (void *)(unsigned long)kref->user_priv;
+		/* give back the space, accounted as in pushbuf_kref_fits() */
+		if (kref->valid_domains & NOUVEAU_GEM_DOMAIN_GART)
+			krec->gart_used -= bo->size;
+		else
+			krec->vram_used -= bo->size;
 		cli_kref_set(push->client, bo, NULL, NULL);
 		nouveau_bo_ref(NULL, &bo);
 		kref++;
 	}
 	krec->nr_buffer = sref;
 	krec->nr_reloc = srel;
+	/* with less VRAM used, the buffers that didn't fit may now */
+	krec->nr_gart_checked = 0;
 }
 
 static int
@@ -473,6 +723,7 @@ pushbuf_refn(struct nouveau_pushbuf *push, bool retry,
 	if (ret) {
 		pushbuf_refn_fail(push, sref, krec->nr_reloc);
 		if (retry) {
+			nvpb->stats.validate_retries++;
 			pushbuf_flush(push);
 			nouveau_pushbuf_space(push, 0, 0, 0);
 			return pushbuf_refn(push, false, refs, nr);
@@ -525,6 +776,7 @@ pushbuf_validate(struct nouveau_pushbuf *push, bool retry)
 	if (ret) {
 		pushbuf_refn_fail(push, sref, srel);
 		if (retry) {
+			nvpb->stats.validate_retries++;
 			pushbuf_flush(push);
 			return pushbuf_validate(push, false);
 		}
@@ -604,6 +856,93 @@ nouveau_pushbuf_new(struct nouveau_client *client, struct nouveau_object *chan,
 	return 0;
 }
 
+drm_public int
+nouveau_pushbuf_finish(struct nouveau_pushbuf *push)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	int ret;
+
+	if (!nvpb->async_depth)
+		return 0;
+	pushbuf_reap(push, 0);
+	ret = nvpb->async_ret;
+	nvpb->async_ret = 0;
+	return ret;
+}
+
+/* Submit what is queued and stop the submit thread. */
+static int
+pushbuf_async_stop(struct nouveau_pushbuf *push)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_pushbuf_krec *krec;
+	int ret;
+
+	ret = nouveau_pushbuf_finish(push);
+
+	pthread_mutex_lock(&nvpb->mutex);
+	nvpb->stop = true;
+	pthread_cond_broadcast(&nvpb->cond);
+	pthread_mutex_unlock(&nvpb->mutex);
+	pthread_join(nvpb->thread, NULL);
+
+	while ((krec = nvpb->spare)) {
+		nvpb->spare = krec->queue_next;
+		free(krec);
+	}
+	pthread_cond_destroy(&nvpb->cond);
+	pthread_mutex_destroy(&nvpb->mutex);
+	nvpb->async_depth = 0;
+	nvpb->stop = false;
+	return ret;
+}
+
+drm_public int
+nouveau_pushbuf_async(struct nouveau_pushbuf *push, int depth,
+		      void (*done)(struct nouveau_pushbuf *, int ret))
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_pushbuf_krec *krec;
+	int ret = 0, i;
+
+	if (!push->channel)
+		return -EINVAL;
+
+	if (nvpb->async_depth)
+		ret = pushbuf_async_stop(push);
+	if (depth <= 0)
+		return ret;
+
+	for (i = 0; i < depth; i++) {
+		krec = malloc(sizeof(*krec));
+		if (!krec) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+		krec->queue_next = nvpb->spare;
+		nvpb->spare = krec;
+	}
+
+	nvpb->async_done = done;
+	pthread_mutex_init(&nvpb->mutex, NULL);
+	pthread_cond_init(&nvpb->cond, NULL);
+	ret = -pthread_create(&nvpb->thread, NULL, pushbuf_thread, nvpb);
+	if (ret) {
+		pthread_cond_destroy(&nvpb->cond);
+		pthread_mutex_destroy(&nvpb->mutex);
+		goto fail;
+	}
+	nvpb->async_depth = depth;
+	return 0;
+
+fail:
+	while ((krec = nvpb->spare)) {
+		nvpb->spare = krec->queue_next;
+		free(krec);
+	}
+	return ret;
+}
+
 drm_public void
 nouveau_pushbuf_del(struct nouveau_pushbuf **ppush)
 {
@@ -611,6 +950,11 @@ nouveau_pushbuf_del(struct nouveau_pushbuf **ppush)
 	if (nvpb) {
 		struct drm_nouveau_gem_pushbuf_bo *kref;
 		struct nouveau_pushbuf_krec *krec;
+		if (nvpb->async_depth)
+			pushbuf_async_stop(&nvpb->base);
+		nouveau_pushbuf_stats_add(
+			&nouveau_client(nvpb->base.client)->push_stats,
+			&nvpb->stats);
 		while ((krec = nvpb->list)) {
 			kref = krec->buffer;
 			while (krec->nr_buffer--) {
@@ -775,8 +1119,53 @@ nouveau_pushbuf_refd(struct nouveau_pushbuf *push, struct nouveau_bo *bo)
 drm_public int
 nouveau_pushbuf_kick(struct nouveau_pushbuf *push, struct nouveau_object *chan)
 {
-	if (!push->channel)
-		return pushbuf_submit(push, chan);
-	pushbuf_flush(push);
-	return pushbuf_validate(push, false);
+	int ret;
+
+	nouveau_pushbuf(push)->stats.kicks++;
+	UTIL_TRACE_BEGIN("nouveau_pushbuf_kick", "push=%p", push);
+	if (!push->channel) {
+		ret = pushbuf_submit(push, chan);
+	} else {
+		pushbuf_flush(push);
+		ret = pushbuf_validate(push, false);
+	}
+	UTIL_TRACE_END();
+	return ret;
+}
+
+drm_private int
+nouveau_pushbuf_wait_kick(struct nouveau_pushbuf *push)
+{
+	nouveau_pushbuf(push)->stats.wait_kicks++;
+	return nouveau_pushbuf_kick(push, push->channel);
+}
+
+drm_private void
+nouveau_pushbuf_stats_add(struct nouveau_pushbuf_stats *sum,
+			  const struct nouveau_pushbuf_stats *stats)
+{
+	sum->kicks += stats->kicks;
+	sum->wait_kicks += stats->wait_kicks;
+	sum->flushes += stats->flushes;
+	sum->validate_retries += stats->validate_retries;
+	sum->krecs += stats->krecs;
+	sum->buffers += stats->buffers;
+	sum->push_bytes += stats->push_bytes;
+	sum->ioctl_ns += stats->ioctl_ns;
+}
+
+drm_public void
+nouveau_pushbuf_stats(struct nouveau_pushbuf *push,
+		      struct nouveau_pushbuf_stats *stats)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+
+	*stats = nvpb->stats;
+	stats->krecs = __atomic_load_n(&nvpb->stats.krecs, __ATOMIC_RELAXED);
+	stats->buffers = __atomic_load_n(&nvpb->stats.buffers,
+					 __ATOMIC_RELAXED);
+	stats->push_bytes = __atomic_load_n(&nvpb->stats.push_bytes,
+					    __ATOMIC_RELAXED);
+	stats->ioctl_ns = __atomic_load_n(&nvpb->stats.ioctl_ns,
+					  __ATOMIC_RELAXED);
 }
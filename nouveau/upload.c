@@ -0,0 +1,184 @@
+/*
+ * Copyright 2012 Red Hat Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "nouveau.h"
+#include "private.h"
+
+/* chunks the ring grows to while the gpu still reads the older ones */
+#define NOUVEAU_UPLOAD_MAX_CHUNKS 8
+
+struct nouveau_upload {
+	struct nouveau_client *client;
+	uint32_t size;
+	/* in ring order, the one being filled is chunk[cur] */
+	struct nouveau_bo *chunk[NOUVEAU_UPLOAD_MAX_CHUNKS];
+	int nr_chunks;
+	int cur;
+	uint32_t used;
+};
+
+static int
+upload_chunk_new(struct nouveau_upload *up, struct nouveau_bo **pbo)
+{
+	struct nouveau_bo *bo = NULL;
+	int ret;
+
+	ret = nouveau_bo_new(up->client->device, NOUVEAU_BO_GART |
+			     NOUVEAU_BO_MAP, 0, up->size, NULL, &bo);
+	if (ret)
+		return ret;
+
+	ret = nouveau_bo_map(bo, 0, up->client);
+	if (ret) {
+		nouveau_bo_ref(NULL, &bo);
+		return ret;
+	}
+
+	*pbo = bo;
+	return 0;
+}
+
+/* the gpu is done with a chunk once the fences of the pushbufs that read
+ * it signaled, which the kernel answers without blocking; a chunk still
+ * referenced by the pushbuf being built is busy, and isn't kicked for it */
+static bool
+upload_chunk_idle(struct nouveau_upload *up, struct nouveau_bo *bo)
+{
+	struct nouveau_pushbuf *push = cli_push_get(up->client, bo);
+
+	if (push && nouveau_pushbuf_refd(push, bo))
+		return false;
+	return !nouveau_bo_wait(bo, NOUVEAU_BO_WR | NOUVEAU_BO_NOBLOCK,
+				up->client);
+}
+
+/* move on to the oldest chunk when idle, or else to a new one, waiting
+ * for the oldest only once the ring can't grow */
+static int
+upload_next_chunk(struct nouveau_upload *up)
+{
+	int next = (up->cur + 1) % up->nr_chunks;
+	int ret;
+
+	if (next != up->cur && upload_chunk_idle(up, up->chunk[next]))
+		goto out;
+
+	if (up->nr_chunks < NOUVEAU_UPLOAD_MAX_CHUNKS) {
+		next = up->cur + 1;
+		memmove(&up->chunk[next + 1], &up->chunk[next],
+			sizeof(up->chunk[0]) * (up->nr_chunks - next));
+		ret = upload_chunk_new(up, &up->chunk[next]);
+		if (ret) {
+			memmove(&up->chunk[next], &up->chunk[next + 1],
+				sizeof(up->chunk[0]) * (up->nr_chunks - next));
+			return ret;
+		}
+		up->nr_chunks++;
+		goto out;
+	}
+
+	ret = nouveau_bo_wait(up->chunk[next], NOUVEAU_BO_WR, up->client);
+	if (ret)
+		return ret;
+out:
+	up->cur = next;
+	up->used = 0;
+	return 0;
+}
+
+drm_public int
+nouveau_upload_new(struct nouveau_client *client, uint32_t size,
+		   struct nouveau_upload **pup)
+{
+	struct nouveau_upload *up;
+	int ret;
+
+	if (!size)
+		return -EINVAL;
+
+	up = calloc(1, sizeof(*up));
+	if (!up)
+		return -ENOMEM;
+
+	up->client = client;
+	up->size = (size + 4095) & ~4095;
+
+	ret = upload_chunk_new(up, &up->chunk[0]);
+	if (ret) {
+		free(up);
+		return ret;
+	}
+
+	up->nr_chunks = 1;
+	*pup = up;
+	return 0;
+}
+
+drm_public void
+nouveau_upload_del(struct nouveau_upload **pup)
+{
+	struct nouveau_upload *up = *pup;
+
+	if (up) {
+		while (up->nr_chunks--)
+			nouveau_bo_ref(NULL, &up->chunk[up->nr_chunks]);
+		free(up);
+		*pup = NULL;
+	}
+}
+
+drm_public int
+nouveau_upload_alloc(struct nouveau_upload *up, uint32_t size,
+		     uint32_t align, struct nouveau_bufctx *bctx, int bin,
+		     struct nouveau_bo **pbo, uint32_t *offset, void **map)
+{
+	uint32_t start;
+	int ret;
+
+	if (!size || size > up->size || (align & (align - 1)))
+		return -EINVAL;
+	if (!align)
+		align = 1;
+
+	start = (up->used + align - 1) & ~(align - 1);
+	if (start < up->used || start > up->size - size) {
+		ret = upload_next_chunk(up);
+		if (ret)
+			return ret;
+		start = 0;
+	}
+
+	if (bctx && !nouveau_bufctx_refn(bctx, bin, up->chunk[up->cur],
+					 NOUVEAU_BO_GART | NOUVEAU_BO_RD))
+		return -ENOMEM;
+
+	up->used = start + size;
+	*pbo = up->chunk[up->cur];
+	*offset = start;
+	*map = (char *)up->chunk[up->cur]->map + start;
+	return 0;
+}
@@ -34,11 +34,15 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 
 #include <libdrm_macros.h>
 #include <xf86drm.h>
 #include <xf86atomic.h>
 
+#include "util_bo_cache.h"
+#include "util_handle_table.h"
+
 #include "omap_drm.h"
 #include "omap_drmif.h"
 
@@ -53,16 +57,31 @@ struct omap_device {
 	int fd;
 	atomic_t refcnt;
 
-	/* The handle_table is used to track GEM bo handles associated w/
+	/* The handles table is used to track GEM bo handles associated w/
 	 * this fd.  This is needed, in particular, when importing
 	 * dmabuf's because we don't want multiple 'struct omap_bo's
 	 * floating around with the same handle.  Otherwise, when the
 	 * first one is omap_bo_del()'d the handle becomes no longer
 	 * valid, and the remaining 'struct omap_bo's are left pointing
 	 * to an invalid handle (and possible a GEM bo that is already
-	 * free'd).
+	 * free'd).  The names table does the same for flink names.
+	 *
+	 * Both are changed under table_lock, but looked up without it.
+	 */
+	struct handle_table handles;
+	struct handle_table names;
+
+	/* Unlocked lookups in progress in each phase, see
+	 * omap_bo_wait_lookups().
+	 */
+	atomic_t lookups[2];
+	atomic_t lookup_phase;
+
+	/* Freed buffers, once enabled by omap_device_set_bo_cache(),
+	 * protected by table_lock.
 	 */
-	void *handle_table;
+	int bo_cache_enabled;
+	struct util_bo_cache bo_cache;
 };
 
 /* a GEM buffer object allocated from the DRM device */
@@ -75,8 +94,19 @@ struct omap_bo {
 	uint64_t	offset;		/* offset to mmap() */
 	int		fd;		/* dmabuf handle */
 	atomic_t	refcnt;
+
+	/* allocation parameters, for reuse from the cache: */
+	uint32_t	flags;
+	union omap_gem_size gsize;
+	int		reuse;		/* allocated here and never shared */
+	struct util_bo_cache_entry cache_entry;
+
+	/* cpu_prep's done without the ioctl, for cpu_fini to match: */
+	atomic_t	cpu_ops_skipped;
 };
 
+static void bo_free_locked(struct omap_bo *bo);
+
 static struct omap_device * omap_device_new_impl(int fd)
 {
 	struct omap_device *dev = calloc(sizeof(*dev), 1);
@@ -84,7 +114,7 @@ static struct omap_device * omap_device_new_impl(int fd)
 		return NULL;
 	dev->fd = fd;
 	atomic_set(&dev->refcnt, 1);
-	dev->handle_table = drmHashCreate();
+	util_bo_cache_init(&dev->bo_cache, 0, 0, 0, 0);
 	return dev;
 }
 
@@ -117,15 +147,80 @@ drm_public struct omap_device * omap_device_ref(struct omap_device *dev)
 	return dev;
 }
 
+/* Frees older cached buffers.  Called under table_lock */
+static void omap_bo_cache_cleanup(struct omap_device *dev, uint64_t now)
+{
+	struct util_bo_cache_entry *entry;
+
+	while ((entry = util_bo_cache_evict(&dev->bo_cache, now)))
+		bo_free_locked(LIST_ENTRY(struct omap_bo, entry, cache_entry));
+}
+
+/* call w/ table_lock held, after the last reference is dropped: */
+static void omap_device_del_locked(struct omap_device *dev)
+{
+	/* found by omap_device_new() meanwhile: */
+	if (atomic_read(&dev->refcnt))
+		return;
+	omap_bo_cache_cleanup(dev, UTIL_BO_CACHE_PURGE);
+	handle_table_fini(&dev->handles);
+	handle_table_fini(&dev->names);
+	drmHashDelete(dev_table, dev->fd);
+	free(dev);
+}
+
 drm_public void omap_device_del(struct omap_device *dev)
 {
 	if (!atomic_dec_and_test(&dev->refcnt))
 		return;
 	pthread_mutex_lock(&table_lock);
-	drmHashDestroy(dev->handle_table);
-	drmHashDelete(dev_table, dev->fd);
+	omap_device_del_locked(dev);
+	pthread_mutex_unlock(&table_lock);
+}
+
+/* Buffers freed to the cache go in 2^bucket_shift buckets per power of
+ * two up to max_size (0 disables the cache, the default), and stay there
+ * for max_age_ms, or until the cache holds more than max_bytes (0 for no
+ * limit).  Changing the buckets needs an empty cache, so the cached
+ * buffers are dropped, as are the statistics.
+ */
+drm_public void omap_device_set_bo_cache(struct omap_device *dev,
+		unsigned bucket_shift, uint64_t max_size, uint64_t max_bytes,
+		uint32_t max_age_ms)
+{
+	pthread_mutex_lock(&table_lock);
+	omap_bo_cache_cleanup(dev, UTIL_BO_CACHE_PURGE);
+	util_bo_cache_init(&dev->bo_cache, bucket_shift, max_size, max_bytes,
+			max_age_ms * 1000000ull);
+	dev->bo_cache_enabled = max_size != 0;
+	pthread_mutex_unlock(&table_lock);
+}
+
+drm_public void omap_device_get_bo_cache_stats(struct omap_device *dev,
+		uint64_t *hits, uint64_t *misses, uint64_t *evictions)
+{
+	pthread_mutex_lock(&table_lock);
+	*hits = dev->bo_cache.stats.hits;
+	*misses = dev->bo_cache.stats.misses;
+	*evictions = dev->bo_cache.stats.evictions;
+	pthread_mutex_unlock(&table_lock);
+}
+
+/* Frees the cached buffers past their age, and the oldest others until
+ * level percent of the cached memory is released.
+ */
+drm_public void omap_device_trim_bo_cache(struct omap_device *dev,
+		unsigned level)
+{
+	struct util_bo_cache_entry *entry;
+	uint64_t bytes, now;
+
+	pthread_mutex_lock(&table_lock);
+	bytes = util_bo_cache_trim_bytes(&dev->bo_cache, level);
+	now = util_bo_cache_now();
+	while ((entry = util_bo_cache_evict_to(&dev->bo_cache, now, bytes)))
+		bo_free_locked(LIST_ENTRY(struct omap_bo, entry, cache_entry));
 	pthread_mutex_unlock(&table_lock);
-	free(dev);
 }
 
 drm_public int
@@ -156,53 +251,166 @@ omap_set_param(struct omap_device *dev, uint64_t param, uint64_t value)
 	return drmCommandWrite(dev->fd, DRM_OMAP_SET_PARAM, &req, sizeof(req));
 }
 
-/* lookup a buffer from it's handle, call w/ table_lock held: */
-static struct omap_bo * lookup_bo(struct omap_device *dev,
-		uint32_t handle)
+/* lookup a buffer, call w/ table_lock held.  A buffer whose last
+ * reference is being dropped is revived, omap_bo_del() checks for it:
+ */
+static struct omap_bo * lookup_bo(struct handle_table *table, uint32_t key)
 {
-	struct omap_bo *bo = NULL;
-	if (!drmHashLookup(dev->handle_table, handle, (void **)&bo)) {
+	struct omap_bo *bo = handle_table_lookup(table, key);
+	if (bo) {
 		/* found, incr refcnt and return: */
 		bo = omap_bo_ref(bo);
 	}
 	return bo;
 }
 
+/* lookup a buffer without table_lock, taking a reference only if it is
+ * still alive.  omap_bo_wait_lookups() keeps the buffer memory valid
+ * until the lookups that could have seen it are done.
+ */
+static struct omap_bo * lookup_bo_unlocked(struct omap_device *dev,
+		struct handle_table *table, uint32_t key)
+{
+	unsigned phase = atomic_read(&dev->lookup_phase) & 1;
+	struct omap_bo *bo;
+
+	atomic_inc(&dev->lookups[phase]);
+	/* the count has to be seen before the buffer is looked up */
+	atomic_mb();
+	bo = handle_table_lookup(table, key);
+	if (bo && atomic_add_unless(&bo->refcnt, 1, 0))
+		bo = NULL;
+	atomic_dec(&dev->lookups[phase], 1);
+
+	return bo;
+}
+
+/* wait for the unlocked lookups that may still see buffers removed from
+ * the tables, call w/ table_lock held.  New lookups go to the other phase
+ * so that they can't hold this up forever.
+ */
+static void omap_bo_wait_lookups(struct omap_device *dev)
+{
+	unsigned phase = (atomic_inc_return(&dev->lookup_phase) - 1) & 1;
+
+	while (atomic_read(&dev->lookups[phase]))
+		sched_yield();
+}
+
 /* allocate a new buffer object, call w/ table_lock held */
 static struct omap_bo * bo_from_handle(struct omap_device *dev,
 		uint32_t handle)
 {
 	struct omap_bo *bo = calloc(sizeof(*bo), 1);
-	if (!bo) {
+	if (!bo || handle_table_insert(&dev->handles, handle, bo)) {
 		struct drm_gem_close req = {
 				.handle = handle,
 		};
 		drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+		free(bo);
 		return NULL;
 	}
 	bo->dev = omap_device_ref(dev);
 	bo->handle = handle;
 	bo->fd = -1;
 	atomic_set(&bo->refcnt, 1);
-	/* add ourselves to the handle table: */
-	drmHashInsert(dev->handle_table, handle, bo);
+	util_bo_cache_entry_init(&bo->cache_entry);
 	return bo;
 }
 
+/* take a cached buffer allocated with the same parameters, call w/
+ * table_lock held
+ */
+static struct omap_bo * omap_bo_cache_alloc(struct omap_device *dev,
+		union omap_gem_size size, uint32_t bytes, uint32_t flags)
+{
+	struct util_bo_cache_bucket *bucket;
+	struct omap_bo *bo;
+
+	bucket = util_bo_cache_get_bucket(&dev->bo_cache, bytes);
+	if (!bucket)
+		return NULL;
+
+	LIST_FOR_EACH_ENTRY(bo, &bucket->list, cache_entry.bucket_link) {
+		if (bo->flags != flags)
+			continue;
+		if (flags & OMAP_BO_TILED ?
+				bo->gsize.tiled.width != size.tiled.width ||
+				bo->gsize.tiled.height != size.tiled.height :
+				bo->size < bytes)
+			continue;
+
+		util_bo_cache_take(&bo->cache_entry);
+		atomic_set(&bo->refcnt, 1);
+		/* bo's in the cache don't hold a ref to the dev: */
+		omap_device_ref(dev);
+		return bo;
+	}
+
+	util_bo_cache_miss(&dev->bo_cache);
+	return NULL;
+}
+
+/* put a buffer in the cache, call w/ table_lock held */
+static int omap_bo_cache_free(struct omap_bo *bo)
+{
+	struct omap_device *dev = bo->dev;
+	struct util_bo_cache_bucket *bucket;
+	uint64_t now;
+
+	if (!dev->bo_cache_enabled || !bo->reuse)
+		return 0;
+
+	bucket = util_bo_cache_get_bucket(&dev->bo_cache, bo->size);
+	if (!bucket)
+		return 0;
+
+	now = util_bo_cache_now();
+	util_bo_cache_add(&dev->bo_cache, bucket, &bo->cache_entry, now);
+	omap_bo_cache_cleanup(dev, now);
+
+	return 1;
+}
+
 /* allocate a new buffer object */
 static struct omap_bo * omap_bo_new_impl(struct omap_device *dev,
 		union omap_gem_size size, uint32_t flags)
 {
 	struct omap_bo *bo = NULL;
+	struct util_bo_cache_bucket *bucket;
 	struct drm_omap_gem_new req = {
 			.size = size,
 			.flags = flags,
 	};
+	uint32_t bytes;
 
 	if (size.bytes == 0) {
 		goto fail;
 	}
 
+	if (flags & OMAP_BO_TILED) {
+		bytes = round_up(size.tiled.width, PAGE_SIZE) * size.tiled.height;
+	} else {
+		bytes = size.bytes;
+	}
+
+	pthread_mutex_lock(&table_lock);
+	if (dev->bo_cache_enabled) {
+		bo = omap_bo_cache_alloc(dev, size, bytes, flags);
+		if (bo) {
+			pthread_mutex_unlock(&table_lock);
+			return bo;
+		}
+
+		/* round up to the bucket, for reuse by other sizes in it: */
+		bucket = util_bo_cache_get_bucket(&dev->bo_cache, bytes);
+		if (bucket && !(flags & OMAP_BO_TILED)) {
+			bytes = bucket->size;
+			req.size.bytes = bytes;
+		}
+	}
+	pthread_mutex_unlock(&table_lock);
+
 	if (drmCommandWriteRead(dev->fd, DRM_OMAP_GEM_NEW, &req, sizeof(req))) {
 		goto fail;
 	}
@@ -211,12 +419,15 @@ static struct omap_bo * omap_bo_new_impl(struct omap_device *dev,
 	bo = bo_from_handle(dev, req.handle);
 	pthread_mutex_unlock(&table_lock);
 
-	if (flags & OMAP_BO_TILED) {
-		bo->size = round_up(size.tiled.width, PAGE_SIZE) * size.tiled.height;
-	} else {
-		bo->size = size.bytes;
+	if (!bo) {
+		goto fail;
 	}
 
+	bo->size = bytes;
+	bo->flags = flags;
+	bo->gsize = req.size;
+	bo->reuse = 1;
+
 	return bo;
 
 fail:
@@ -224,7 +435,6 @@ fail:
 	return NULL;
 }
 
-
 /* allocate a new (un-tiled) buffer object */
 drm_public struct omap_bo *
 omap_bo_new(struct omap_device *dev, uint32_t size, uint32_t flags)
@@ -289,26 +499,37 @@ omap_bo_from_name(struct omap_device *dev, uint32_t name)
 			.name = name,
 	};
 
+	/* fast path for names imported before: */
+	bo = lookup_bo_unlocked(dev, &dev->names, name);
+	if (bo) {
+		return bo;
+	}
+
 	pthread_mutex_lock(&table_lock);
 
+	bo = lookup_bo(&dev->names, name);
+	if (bo) {
+		goto out_unlock;
+	}
+
 	if (drmIoctl(dev->fd, DRM_IOCTL_GEM_OPEN, &req)) {
-		goto fail;
+		goto out_unlock;
 	}
 
-	bo = lookup_bo(dev, req.handle);
+	bo = lookup_bo(&dev->handles, req.handle);
 	if (!bo) {
 		bo = bo_from_handle(dev, req.handle);
+	}
+	if (bo && !bo->name &&
+			!handle_table_insert(&dev->names, name, bo)) {
 		bo->name = name;
+		bo->reuse = 0;
 	}
 
+out_unlock:
 	pthread_mutex_unlock(&table_lock);
 
 	return bo;
-
-fail:
-	pthread_mutex_unlock(&table_lock);
-	free(bo);
-	return NULL;
 }
 
 /* import a buffer from dmabuf fd, does not take ownership of the
@@ -324,6 +545,18 @@ omap_bo_from_dmabuf(struct omap_device *dev, int fd)
 	};
 	int ret;
 
+	/* fast path for buffers imported before.  Holding a reference
+	 * keeps the handle from being closed under us, otherwise the
+	 * handle is looked up again with the lock held below.
+	 */
+	ret = drmIoctl(dev->fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &req);
+	if (!ret) {
+		bo = lookup_bo_unlocked(dev, &dev->handles, req.handle);
+		if (bo) {
+			return bo;
+		}
+	}
+
 	pthread_mutex_lock(&table_lock);
 
 	ret = drmIoctl(dev->fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &req);
@@ -331,7 +564,7 @@ omap_bo_from_dmabuf(struct omap_device *dev, int fd)
 		goto fail;
 	}
 
-	bo = lookup_bo(dev, req.handle);
+	bo = lookup_bo(&dev->handles, req.handle);
 	if (!bo) {
 		bo = bo_from_handle(dev, req.handle);
 	}
@@ -342,19 +575,13 @@ omap_bo_from_dmabuf(struct omap_device *dev, int fd)
 
 fail:
 	pthread_mutex_unlock(&table_lock);
-	free(bo);
 	return NULL;
 }
 
-/* destroy a buffer object */
-drm_public void omap_bo_del(struct omap_bo *bo)
+/* free a buffer object, call w/ table_lock held */
+static void bo_free_locked(struct omap_bo *bo)
 {
-	if (!bo) {
-		return;
-	}
-
-	if (!atomic_dec_and_test(&bo->refcnt))
-		return;
+	struct omap_device *dev = bo->dev;
 
 	if (bo->map) {
 		munmap(bo->map, bo->size);
@@ -364,19 +591,54 @@ drm_public void omap_bo_del(struct omap_bo *bo)
 		close(bo->fd);
 	}
 
+	if (bo->name) {
+		handle_table_remove(&dev->names, bo->name);
+	}
+
 	if (bo->handle) {
 		struct drm_gem_close req = {
 				.handle = bo->handle,
 		};
-		pthread_mutex_lock(&table_lock);
-		drmHashDelete(bo->dev->handle_table, bo->handle);
-		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+		handle_table_remove(&dev->handles, bo->handle);
+		drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	}
+
+	omap_bo_wait_lookups(dev);
+	free(bo);
+}
+
+/* destroy a buffer object */
+drm_public void omap_bo_del(struct omap_bo *bo)
+{
+	struct omap_device *dev;
+
+	if (!bo) {
+		return;
+	}
+
+	if (!atomic_dec_and_test(&bo->refcnt))
+		return;
+
+	dev = bo->dev;
+
+	pthread_mutex_lock(&table_lock);
+
+	/* revived by a locked lookup meanwhile: */
+	if (atomic_read(&bo->refcnt)) {
 		pthread_mutex_unlock(&table_lock);
+		return;
 	}
 
-	omap_device_del(bo->dev);
+	/* bo's in the cache don't hold a ref to the dev: */
+	if (!omap_bo_cache_free(bo)) {
+		bo_free_locked(bo);
+	}
 
-	free(bo);
+	if (atomic_dec_and_test(&dev->refcnt)) {
+		omap_device_del_locked(dev);
+	}
+
+	pthread_mutex_unlock(&table_lock);
 }
 
 /* get the global flink/DRI2 buffer name */
@@ -393,7 +655,17 @@ drm_public int omap_bo_get_name(struct omap_bo *bo, uint32_t *name)
 			return ret;
 		}
 
-		bo->name = req.name;
+		pthread_mutex_lock(&table_lock);
+		if (!bo->name &&
+				!handle_table_insert(&bo->dev->names, req.name, bo)) {
+			bo->name = req.name;
+		}
+		bo->reuse = 0;
+		pthread_mutex_unlock(&table_lock);
+
+		if (!bo->name) {
+			return -ENOMEM;
+		}
 	}
 
 	*name = bo->name;
@@ -424,6 +696,7 @@ drm_public int omap_bo_dmabuf(struct omap_bo *bo)
 		}
 
 		bo->fd = req.fd;
+		bo->reuse = 0;
 	}
 	return dup(bo->fd);
 }
@@ -452,12 +725,28 @@ drm_public void *omap_bo_map(struct omap_bo *bo)
 	return bo->map;
 }
 
+/* The kernel only waits in cpu_prep for the accesses of other devices,
+ * which need a flink name or dma-buf of the buffer, or of the display.
+ * A buffer allocated here, never shared and not for scanout has none,
+ * so the ioctls can be skipped.
+ */
+static int bo_unshared(struct omap_bo *bo)
+{
+	return bo->reuse && !(bo->flags & OMAP_BO_SCANOUT);
+}
+
 drm_public int omap_bo_cpu_prep(struct omap_bo *bo, enum omap_gem_op op)
 {
 	struct drm_omap_gem_cpu_prep req = {
 			.handle = bo->handle,
 			.op = op,
 	};
+
+	if (bo_unshared(bo)) {
+		atomic_inc(&bo->cpu_ops_skipped);
+		return 0;
+	}
+
 	return drmCommandWrite(bo->dev->fd,
 			DRM_OMAP_GEM_CPU_PREP, &req, sizeof(req));
 }
@@ -469,6 +758,12 @@ drm_public int omap_bo_cpu_fini(struct omap_bo *bo, enum omap_gem_op op)
 			.op = op,
 			.nregions = 0,
 	};
+
+	/* matches a cpu_prep without the ioctl, even if shared since: */
+	if (!atomic_add_unless(&bo->cpu_ops_skipped, -1, 0)) {
+		return 0;
+	}
+
 	return drmCommandWrite(bo->dev->fd,
 			DRM_OMAP_GEM_CPU_FINI, &req, sizeof(req));
 }
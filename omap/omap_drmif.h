@@ -43,6 +43,22 @@ void omap_device_del(struct omap_device *dev);
 int omap_get_param(struct omap_device *dev, uint64_t param, uint64_t *value);
 int omap_set_param(struct omap_device *dev, uint64_t param, uint64_t value);
 
+/* Buffers allocated by omap_bo_new() and omap_bo_new_tiled() and freed
+ * before being shared go to a cache, in 2^bucket_shift buckets per power
+ * of two up to max_size, and stay there for max_age_ms, or until the cache
+ * holds more than max_bytes (0 for no limit).  The cache is off until a
+ * max_size is set: nothing tells whether a buffer is still used by the
+ * display or another device, so buffers must only be freed once done.
+ */
+void omap_device_set_bo_cache(struct omap_device *dev, unsigned bucket_shift,
+		uint64_t max_size, uint64_t max_bytes, uint32_t max_age_ms);
+void omap_device_get_bo_cache_stats(struct omap_device *dev, uint64_t *hits,
+		uint64_t *misses, uint64_t *evictions);
+/* Frees the cached buffers past their age, and the oldest others until
+ * level percent of the cached memory is released, 100 empties the cache.
+ */
+void omap_device_trim_bo_cache(struct omap_device *dev, unsigned level);
+
 /* buffer-object related functions:
  */
 
@@ -58,7 +74,14 @@ int omap_bo_get_name(struct omap_bo *bo, uint32_t *name);
 uint32_t omap_bo_handle(struct omap_bo *bo);
 int omap_bo_dmabuf(struct omap_bo *bo);
 uint32_t omap_bo_size(struct omap_bo *bo);
+/* The mapping stays until the buffer is freed, also while it is cached.
+ * Its caching is the one of the OMAP_BO_CACHE_MASK flags the buffer was
+ * allocated with, except for tiled buffers, for which the kernel picks.
+ */
 void * omap_bo_map(struct omap_bo *bo);
+/* Without ioctls for buffers allocated here, not for scanout and never
+ * given a flink name or dma-buf, which nothing else can access.
+ */
 int omap_bo_cpu_prep(struct omap_bo *bo, enum omap_gem_op op);
 int omap_bo_cpu_fini(struct omap_bo *bo, enum omap_gem_op op);
 
@@ -24,8 +24,10 @@
  *      Jerome Glisse
  */
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "bof.h"
 
 /*
@@ -475,3 +477,108 @@ out_err:
 	bof->file = NULL;
 	return r;
 }
+
+/*
+ * stream
+ */
+bof_stream_t *bof_stream_open(const char *filename)
+{
+	bof_stream_t *stream;
+
+	stream = calloc(1, sizeof(bof_stream_t));
+	if (stream == NULL)
+		return NULL;
+	stream->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (stream->fd < 0) {
+		fprintf(stderr, "%s failed to open file %s\n", __func__, filename);
+		free(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+static void bof_stream_write_fd(bof_stream_t *stream, const void *data, size_t size)
+{
+	const uint8_t *ptr = data;
+	ssize_t r;
+
+	while (size && !stream->error) {
+		r = write(stream->fd, ptr, size);
+		if (r < 0) {
+			if (errno != EINTR)
+				stream->error = -errno;
+			continue;
+		}
+		ptr += r;
+		size -= r;
+	}
+}
+
+static void bof_stream_flush(bof_stream_t *stream)
+{
+	bof_stream_write_fd(stream, stream->buffer, stream->used);
+	stream->used = 0;
+}
+
+static void bof_stream_write(bof_stream_t *stream, const void *data, size_t size)
+{
+	if (stream->used + size > BOF_STREAM_BUFFER_SIZE) {
+		bof_stream_flush(stream);
+		/* large blobs skip the buffer */
+		if (size >= BOF_STREAM_BUFFER_SIZE) {
+			bof_stream_write_fd(stream, data, size);
+			return;
+		}
+	}
+	memcpy(stream->buffer + stream->used, data, size);
+	stream->used += size;
+}
+
+static void bof_stream_header(bof_stream_t *stream, uint32_t type,
+			      uint32_t size, uint32_t array_size)
+{
+	uint32_t header[3] = { type, size, array_size };
+
+	bof_stream_write(stream, header, sizeof(header));
+}
+
+void bof_stream_object(bof_stream_t *stream, uint32_t size, uint32_t nkeys)
+{
+	bof_stream_header(stream, BOF_TYPE_OBJECT, size, nkeys * 2);
+}
+
+void bof_stream_array(bof_stream_t *stream, uint32_t size, uint32_t nentries)
+{
+	bof_stream_header(stream, BOF_TYPE_ARRAY, size, nentries);
+}
+
+void bof_stream_blob(bof_stream_t *stream, unsigned size, const void *value)
+{
+	bof_stream_header(stream, BOF_TYPE_BLOB, bof_blob_stream_size(size), 0);
+	bof_stream_write(stream, value, size);
+}
+
+void bof_stream_string(bof_stream_t *stream, const char *value)
+{
+	bof_stream_header(stream, BOF_TYPE_STRING, bof_string_stream_size(value), 0);
+	bof_stream_write(stream, value, strlen(value) + 1);
+}
+
+void bof_stream_int32(bof_stream_t *stream, int32_t value)
+{
+	bof_stream_header(stream, BOF_TYPE_INT32, BOF_INT32_SIZE, 0);
+	bof_stream_write(stream, &value, 4);
+}
+
+/* Returns the first error writing the stream, if any. */
+int bof_stream_close(bof_stream_t *stream)
+{
+	int r;
+
+	bof_stream_flush(stream);
+	r = stream->error;
+	if (close(stream->fd) && !r)
+		r = -errno;
+	free(stream);
+	return r;
+}
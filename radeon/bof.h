@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #define BOF_TYPE_STRING		0
 #define BOF_TYPE_NULL		1
@@ -80,6 +81,32 @@ extern bof_t *bof_load_file(const char *filename);
 extern int bof_dump_file(bof_t *bof, const char *filename);
 extern void bof_print(bof_t *bof);
 
+/*
+ * Streaming writer, writing each entry as it comes instead of building the
+ * tree first. The size of objects and arrays, header included, must be
+ * known when they begin, from the *_size() helpers of their entries.
+ */
+#define BOF_STREAM_BUFFER_SIZE	(64 * 1024)
+#define BOF_HEADER_SIZE		12
+#define BOF_INT32_SIZE		(BOF_HEADER_SIZE + 4)
+
+typedef struct bof_stream {
+	int		fd;
+	int		error;
+	unsigned	used;
+	uint8_t		buffer[BOF_STREAM_BUFFER_SIZE];
+} bof_stream_t;
+
+extern bof_stream_t *bof_stream_open(const char *filename);
+extern int bof_stream_close(bof_stream_t *stream);
+extern void bof_stream_object(bof_stream_t *stream, uint32_t size, uint32_t nkeys);
+extern void bof_stream_array(bof_stream_t *stream, uint32_t size, uint32_t nentries);
+extern void bof_stream_blob(bof_stream_t *stream, unsigned size, const void *value);
+extern void bof_stream_string(bof_stream_t *stream, const char *value);
+extern void bof_stream_int32(bof_stream_t *stream, int32_t value);
+static inline uint32_t bof_blob_stream_size(unsigned size){return BOF_HEADER_SIZE + size;}
+static inline uint32_t bof_string_stream_size(const char *value){return BOF_HEADER_SIZE + strlen(value) + 1;}
+
 static inline int bof_is_object(bof_t *bof){return (bof->type == BOF_TYPE_OBJECT);}
 static inline int bof_is_blob(bof_t *bof){return (bof->type == BOF_TYPE_BLOB);}
 static inline int bof_is_null(bof_t *bof){return (bof->type == BOF_TYPE_NULL);}
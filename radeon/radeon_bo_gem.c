@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include "libdrm_macros.h"
 #include "xf86drm.h"
 #include "xf86atomic.h"
@@ -42,6 +43,9 @@
 #include "radeon_bo.h"
 #include "radeon_bo_int.h"
 #include "radeon_bo_gem.h"
+#include "radeon_bo_gem_private.h"
+#include "util_bo_cache.h"
+#include "util_handle_table.h"
 #include <fcntl.h>
 struct radeon_bo_gem {
     struct radeon_bo_int    base;
@@ -49,14 +53,109 @@ struct radeon_bo_gem {
     int                     map_count;
     atomic_t                reloc_in_cs;
     void                    *priv_ptr;
+    /* created by us and never shared, so it may go to the cache */
+    bool                    reusable;
+    /* tiling was set, to be cleared when reused */
+    bool                    tiled;
+    struct util_bo_cache_entry cache_entry;
+    /* CS referencing the bo queued and not submitted yet, under
+     * submit_mutex */
+    unsigned                pending_submits;
 };
 
 struct bo_manager_gem {
     struct radeon_bo_manager    base;
+    pthread_mutex_t             lock;
+    /* freed bos kept for reuse, when enabled */
+    bool                        reuse;
+    struct util_bo_cache        cache;
+    /* the bos by GEM handle, cached ones included, inserted and removed
+     * under lock, so that importing a buffer twice gives the same bo */
+    struct handle_table         handles;
 };
 
+/* The CS submit threads of all the managers signal submit_cond when the
+ * last queued CS of a bo went through the kernel. */
+static pthread_mutex_t submit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t submit_cond = PTHREAD_COND_INITIALIZER;
+
 static int bo_wait(struct radeon_bo_int *boi);
-    
+static int bo_is_busy(struct radeon_bo_int *boi, uint32_t *domain);
+static int bo_set_tiling(struct radeon_bo_int *boi, uint32_t tiling_flags,
+                         uint32_t pitch);
+
+static void bo_free(struct radeon_bo_gem *bo_gem)
+{
+    struct radeon_bo_int *boi = &bo_gem->base;
+    struct drm_gem_close args;
+
+    if (bo_gem->priv_ptr) {
+        drm_munmap(bo_gem->priv_ptr, boi->size);
+    }
+
+    /* Zero out args to make valgrind happy */
+    memset(&args, 0, sizeof(args));
+
+    /* close object */
+    args.handle = boi->handle;
+    drmIoctl(boi->bom->fd, DRM_IOCTL_GEM_CLOSE, &args);
+    memset(bo_gem, 0, sizeof(struct radeon_bo_gem));
+    free(bo_gem);
+}
+
+/* Free the cached bos too old or over the memory cap, with the lock held. */
+static void bo_cache_evict(struct bo_manager_gem *bomg, uint64_t now)
+{
+    struct util_bo_cache_entry *entry;
+
+    struct radeon_bo_gem *bo_gem;
+
+    while ((entry = util_bo_cache_evict(&bomg->cache, now))) {
+        bo_gem = LIST_ENTRY(struct radeon_bo_gem, entry, cache_entry);
+        handle_table_remove(&bomg->handles, bo_gem->base.handle);
+        bo_free(bo_gem);
+    }
+}
+
+/**
+ * Take an idle bo from the cache for the allocation, or NULL. Only the
+ * oldest bo of the bucket with the same placement is checked, allocating
+ * a new one being faster than waiting for the GPU.
+ */
+static struct radeon_bo_gem *bo_cache_get(struct bo_manager_gem *bomg,
+                                          struct util_bo_cache_bucket *bucket,
+                                          uint32_t alignment,
+                                          uint32_t domains,
+                                          uint32_t flags)
+{
+    struct radeon_bo_gem *bo_gem = NULL, *tmp;
+    uint32_t busy_domain;
+
+    pthread_mutex_lock(&bomg->lock);
+    bo_cache_evict(bomg, util_bo_cache_now());
+    LIST_FOR_EACH_ENTRY(tmp, &bucket->list, cache_entry.bucket_link) {
+        if (tmp->base.alignment != alignment ||
+            tmp->base.domains != domains || tmp->base.flags != flags) {
+            continue;
+        }
+        if (!bo_is_busy(&tmp->base, &busy_domain)) {
+            util_bo_cache_take(&tmp->cache_entry);
+            bo_gem = tmp;
+        }
+        break;
+    }
+    if (bo_gem == NULL) {
+        util_bo_cache_miss(&bomg->cache);
+    }
+    pthread_mutex_unlock(&bomg->lock);
+
+    if (bo_gem && bo_gem->tiled) {
+        bo_set_tiling(&bo_gem->base, 0, 0);
+        bo_gem->tiled = false;
+    }
+    return bo_gem;
+}
+
 static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
                                  uint32_t handle,
                                  uint32_t size,
@@ -64,9 +163,29 @@ static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
                                  uint32_t domains,
                                  uint32_t flags)
 {
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
+    struct util_bo_cache_bucket *bucket = NULL;
     struct radeon_bo_gem *bo;
     int r;
 
+    if (!handle && bomg->reuse) {
+        bucket = util_bo_cache_get_bucket(&bomg->cache, size);
+    }
+    if (bucket) {
+        size = bucket->size;
+        bo = bo_cache_get(bomg, bucket, alignment, domains, flags);
+        if (bo) {
+            bo->base.ptr = NULL;
+            bo->base.cref = 0;
+            bo->base.space_accounted = 0;
+            bo->base.referenced_in_cs = 0;
+            atomic_set(&bo->reloc_in_cs, 0);
+            bo->map_count = 0;
+            radeon_bo_ref((struct radeon_bo*)bo);
+            return (struct radeon_bo*)bo;
+        }
+    }
+
     bo = (struct radeon_bo_gem*)calloc(1, sizeof(struct radeon_bo_gem));
     if (bo == NULL) {
         return NULL;
@@ -81,6 +200,7 @@ static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
     bo->base.ptr = NULL;
     atomic_set(&bo->reloc_in_cs, 0);
     bo->map_count = 0;
+    util_bo_cache_entry_init(&bo->cache_entry);
     if (handle) {
         struct drm_gem_open open_arg;
 
@@ -113,6 +233,15 @@ static struct radeon_bo *bo_open(struct radeon_bo_manager *bom,
             free(bo);
             return NULL;
         }
+        bo->reusable = true;
+    }
+
+    pthread_mutex_lock(&bomg->lock);
+    r = handle_table_insert(&bomg->handles, bo->base.handle, bo);
+    pthread_mutex_unlock(&bomg->lock);
+    if (r) {
+        bo_free(bo);
+        return NULL;
     }
     radeon_bo_ref((struct radeon_bo*)bo);
     return (struct radeon_bo*)bo;
@@ -125,23 +254,37 @@ static void bo_ref(struct radeon_bo_int *boi)
 static struct radeon_bo *bo_unref(struct radeon_bo_int *boi)
 {
     struct radeon_bo_gem *bo_gem = (struct radeon_bo_gem*)boi;
-    struct drm_gem_close args;
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)boi->bom;
+    struct util_bo_cache_bucket *bucket = NULL;
+    uint64_t now;
 
     if (boi->cref) {
         return (struct radeon_bo *)boi;
     }
-    if (bo_gem->priv_ptr) {
-        drm_munmap(bo_gem->priv_ptr, boi->size);
+
+    /* keep the bo and its mapping for reuse */
+    if (bo_gem->reusable && bomg->reuse) {
+        bucket = util_bo_cache_get_bucket(&bomg->cache, boi->size);
+    }
+    if (bucket && bucket->size == boi->size) {
+        now = util_bo_cache_now();
+        pthread_mutex_lock(&bomg->lock);
+        util_bo_cache_add(&bomg->cache, bucket, &bo_gem->cache_entry, now);
+        bo_cache_evict(bomg, now);
+        pthread_mutex_unlock(&bomg->lock);
+        return NULL;
     }
 
-    /* Zero out args to make valgrind happy */
-    memset(&args, 0, sizeof(args));
+    pthread_mutex_lock(&bomg->lock);
+    /* imported again meanwhile */
+    if (boi->cref) {
+        pthread_mutex_unlock(&bomg->lock);
+        return (struct radeon_bo *)boi;
+    }
+    handle_table_remove(&bomg->handles, boi->handle);
+    pthread_mutex_unlock(&bomg->lock);
 
-    /* close object */
-    args.handle = boi->handle;
-    drmIoctl(boi->bom->fd, DRM_IOCTL_GEM_CLOSE, &args);
-    memset(bo_gem, 0, sizeof(struct radeon_bo_gem));
-    free(bo_gem);
+    bo_free(bo_gem);
     return NULL;
 }
 
@@ -199,11 +342,25 @@ static int bo_unmap(struct radeon_bo_int *boi)
     return 0;
 }
 
+static bool bo_submit_pending(struct radeon_bo_gem *bo_gem)
+{
+    return __atomic_load_n(&bo_gem->pending_submits, __ATOMIC_ACQUIRE) != 0;
+}
+
 static int bo_wait(struct radeon_bo_int *boi)
 {
+    struct radeon_bo_gem *bo_gem = (struct radeon_bo_gem*)boi;
     struct drm_radeon_gem_wait_idle args;
     int ret;
 
+    /* the kernel does not know about the CS still queued */
+    if (bo_submit_pending(bo_gem)) {
+        pthread_mutex_lock(&submit_mutex);
+        while (bo_gem->pending_submits)
+            pthread_cond_wait(&submit_cond, &submit_mutex);
+        pthread_mutex_unlock(&submit_mutex);
+    }
+
     /* Zero out args to make valgrind happy */
     memset(&args, 0, sizeof(args));
     args.handle = boi->handle;
@@ -219,6 +376,11 @@ static int bo_is_busy(struct radeon_bo_int *boi, uint32_t *domain)
     struct drm_radeon_gem_busy args;
     int ret;
 
+    if (bo_submit_pending((struct radeon_bo_gem*)boi)) {
+        *domain = 0;
+        return -EBUSY;
+    }
+
     args.handle = boi->handle;
     args.domain = 0;
 
@@ -243,6 +405,9 @@ static int bo_set_tiling(struct radeon_bo_int *boi, uint32_t tiling_flags,
                             DRM_RADEON_GEM_SET_TILING,
                             &args,
                             sizeof(args));
+    if (!r && (tiling_flags || pitch)) {
+        ((struct radeon_bo_gem*)boi)->tiled = true;
+    }
     return r;
 }
 
@@ -291,6 +456,9 @@ drm_public struct radeon_bo_manager *radeon_bo_manager_gem_ctor(int fd)
     }
     bomg->base.funcs = &bo_gem_funcs;
     bomg->base.fd = fd;
+    pthread_mutex_init(&bomg->lock, NULL);
+    util_bo_cache_init(&bomg->cache, 2, UTIL_BO_CACHE_DEFAULT_MAX_SIZE,
+                       0, UTIL_BO_CACHE_DEFAULT_MAX_AGE);
     return (struct radeon_bo_manager*)bomg;
 }
 
@@ -301,9 +469,33 @@ drm_public void radeon_bo_manager_gem_dtor(struct radeon_bo_manager *bom)
     if (bom == NULL) {
         return;
     }
+    bo_cache_evict(bomg, UTIL_BO_CACHE_PURGE);
+    handle_table_fini(&bomg->handles);
+    pthread_mutex_destroy(&bomg->lock);
     free(bomg);
 }
 
+drm_public int
+radeon_bo_manager_gem_cache_enable(struct radeon_bo_manager *bom,
+                                   uint64_t max_size, uint32_t max_age_ms)
+{
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
+
+    if (bom == NULL) {
+        return -EINVAL;
+    }
+
+    pthread_mutex_lock(&bomg->lock);
+    bomg->reuse = max_size != 0;
+    bomg->cache.max_bytes = max_size;
+    bomg->cache.max_age = max_age_ms ?
+        max_age_ms * 1000000ull : UTIL_BO_CACHE_DEFAULT_MAX_AGE;
+    bo_cache_evict(bomg, bomg->reuse ? util_bo_cache_now() :
+                   UTIL_BO_CACHE_PURGE);
+    pthread_mutex_unlock(&bomg->lock);
+    return 0;
+}
+
 drm_public uint32_t
 radeon_gem_name_bo(struct radeon_bo *bo)
 {
@@ -318,6 +510,28 @@ radeon_gem_get_reloc_in_cs(struct radeon_bo *bo)
     return &bo_gem->reloc_in_cs;
 }
 
+drm_private void radeon_gem_bo_queue_submit(struct radeon_bo *bo)
+{
+    struct radeon_bo_gem *bo_gem = (struct radeon_bo_gem*)bo;
+
+    pthread_mutex_lock(&submit_mutex);
+    __atomic_store_n(&bo_gem->pending_submits, bo_gem->pending_submits + 1,
+                     __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&submit_mutex);
+}
+
+drm_private void radeon_gem_bo_submitted(struct radeon_bo *bo)
+{
+    struct radeon_bo_gem *bo_gem = (struct radeon_bo_gem*)bo;
+
+    pthread_mutex_lock(&submit_mutex);
+    __atomic_store_n(&bo_gem->pending_submits, bo_gem->pending_submits - 1,
+                     __ATOMIC_RELEASE);
+    if (!bo_gem->pending_submits)
+        pthread_cond_broadcast(&submit_cond);
+    pthread_mutex_unlock(&submit_mutex);
+}
+
 drm_public int
 radeon_gem_get_kernel_name(struct radeon_bo *bo, uint32_t *name)
 {
@@ -335,6 +549,7 @@ radeon_gem_get_kernel_name(struct radeon_bo *bo, uint32_t *name)
     if (r) {
         return r;
     }
+    bo_gem->reusable = false;
     bo_gem->name = flink.name;
     *name = flink.name;
     return 0;
@@ -364,18 +579,38 @@ drm_public int radeon_gem_prime_share_bo(struct radeon_bo *bo, int *handle)
     int ret;
 
     ret = drmPrimeHandleToFD(bo_gem->base.bom->fd, bo->handle, DRM_CLOEXEC, handle);
+    if (!ret) {
+        bo_gem->reusable = false;
+    }
     return ret;
 }
 
 drm_public struct radeon_bo *
 radeon_gem_bo_open_prime(struct radeon_bo_manager *bom, int fd_handle, uint32_t size)
 {
+    struct bo_manager_gem *bomg = (struct bo_manager_gem*)bom;
     struct radeon_bo_gem *bo;
     int r;
     uint32_t handle;
 
+    r = drmPrimeFDToHandle(bom->fd, fd_handle, &handle);
+    if (r != 0) {
+        return NULL;
+    }
+
+    /* the kernel gives the same handle for a buffer imported again, or
+     * one of ours exported, so hand out the bo we already have */
+    pthread_mutex_lock(&bomg->lock);
+    bo = handle_table_lookup(&bomg->handles, handle);
+    if (bo) {
+        radeon_bo_ref((struct radeon_bo *)bo);
+        pthread_mutex_unlock(&bomg->lock);
+        return (struct radeon_bo *)bo;
+    }
+
     bo = (struct radeon_bo_gem*)calloc(1, sizeof(struct radeon_bo_gem));
     if (bo == NULL) {
+        pthread_mutex_unlock(&bomg->lock);
         return NULL;
     }
 
@@ -388,16 +623,18 @@ radeon_gem_bo_open_prime(struct radeon_bo_manager *bom, int fd_handle, uint32_t
     bo->base.ptr = NULL;
     atomic_set(&bo->reloc_in_cs, 0);
     bo->map_count = 0;
-
-    r = drmPrimeFDToHandle(bom->fd, fd_handle, &handle);
-    if (r != 0) {
-	free(bo);
-	return NULL;
-    }
+    util_bo_cache_entry_init(&bo->cache_entry);
 
     bo->base.handle = handle;
     bo->name = handle;
 
+    r = handle_table_insert(&bomg->handles, handle, bo);
+    pthread_mutex_unlock(&bomg->lock);
+    if (r) {
+        bo_free(bo);
+        return NULL;
+    }
+
     radeon_bo_ref((struct radeon_bo *)bo);
     return (struct radeon_bo *)bo;
 
@@ -36,6 +36,13 @@
 
 struct radeon_bo_manager *radeon_bo_manager_gem_ctor(int fd);
 void radeon_bo_manager_gem_dtor(struct radeon_bo_manager *bom);
+/* Keep the freed bos and their mappings for reuse by allocations of the
+ * same bucket size, alignment, domains and flags once they are idle, up to
+ * max_size bytes in total and for max_age_ms (0 for one second). Reused bos
+ * keep their old content. A max_size of 0 disables the cache and frees the
+ * bos in it. */
+int radeon_bo_manager_gem_cache_enable(struct radeon_bo_manager *bom,
+                                       uint64_t max_size, uint32_t max_age_ms);
 
 uint32_t radeon_gem_name_bo(struct radeon_bo *bo);
 void *radeon_gem_get_reloc_in_cs(struct radeon_bo *bo);
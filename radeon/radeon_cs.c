@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include "radeon_cs.h"
 #include "radeon_cs_int.h"
+#include "util_trace.h"
 
 drm_public struct radeon_cs *
 radeon_cs_create(struct radeon_cs_manager *csm, uint32_t ndw)
@@ -43,7 +44,13 @@ radeon_cs_end(struct radeon_cs *cs,
 drm_public int radeon_cs_emit(struct radeon_cs *cs)
 {
     struct radeon_cs_int *csi = (struct radeon_cs_int *)cs;
-    return csi->csm->funcs->cs_emit(csi);
+    int ret;
+
+    UTIL_TRACE_BEGIN("radeon_cs_emit", "cs=%u dw=%u relocs=%u", csi->id,
+                     csi->cdw, csi->crelocs);
+    ret = csi->csm->funcs->cs_emit(csi);
+    UTIL_TRACE_END();
+    return ret;
 }
 
 drm_public int radeon_cs_destroy(struct radeon_cs *cs)
@@ -31,6 +31,8 @@
  */
 #include <assert.h>
 #include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
@@ -40,23 +42,15 @@
 #include "radeon_bo_int.h"
 #include "radeon_cs_gem.h"
 #include "radeon_bo_gem.h"
+#include "radeon_bo_gem_private.h"
 #include "drm.h"
 #include "libdrm_macros.h"
 #include "xf86drm.h"
 #include "xf86atomic.h"
 #include "radeon_drm.h"
+#include "util_grow.h"
 
-/* Add LIBDRM_RADEON_BOF_FILES to libdrm_radeon_la_SOURCES when building with BOF_DUMP */
-#define CS_BOF_DUMP 0
-#if CS_BOF_DUMP
 #include "bof.h"
-#endif
-
-struct radeon_cs_manager_gem {
-    struct radeon_cs_manager    base;
-    uint32_t                    device_id;
-    unsigned                    nbof;
-};
 
 #pragma pack(1)
 struct cs_reloc_gem {
@@ -69,15 +63,83 @@ struct cs_reloc_gem {
 #pragma pack()
 #define RELOC_SIZE (sizeof(struct cs_reloc_gem) / sizeof(uint32_t))
 
+/* copy of an emitted CS, without the bo contents */
+struct cs_gem_capture {
+    uint32_t                    *pm4;
+    unsigned                    cdw;
+    unsigned                    pm4_size;
+    struct cs_reloc_gem         *relocs;
+    uint32_t                    *bo_sizes;
+    unsigned                    crelocs;
+    unsigned                    relocs_size;
+};
+
+struct radeon_cs_manager_gem {
+    struct radeon_cs_manager    base;
+    uint32_t                    device_id;
+    unsigned                    nbof;
+    /* RADEON_CS_DUMP=all dumps every CS with its bos, RADEON_CS_DUMP=<n>
+     * keeps the last n CS to dump them when an emit fails */
+    bool                        dump_all;
+    pthread_mutex_t             dump_mutex;
+    struct cs_gem_capture       *dump_ring;
+    unsigned                    dump_ring_size;
+    unsigned                    dump_ring_count;
+};
+
+/* buffers of a CS handed to the submit thread, or spare ones */
+struct cs_gem_submit {
+    struct drm_radeon_cs_chunk  chunks[3];
+    unsigned                    nchunks;
+    uint32_t                    flags[3];
+    uint32_t                    *packets;
+    unsigned                    nrelocs;
+    uint32_t                    *relocs;
+    struct radeon_bo_int        **relocs_bo;
+    unsigned                    crelocs;
+    int                         result;
+};
+
+/* Ring of the submissions of an asynchronous CS. The slot of a counter is
+ * the counter modulo nsubmits, and reaped <= done <= queued. */
+struct cs_gem_async {
+    pthread_t                   thread;
+    pthread_mutex_t             mutex;
+    /* signaled when a CS is queued, submitted or the thread is stopped */
+    pthread_cond_t              cond;
+    struct cs_gem_submit        *submits;
+    unsigned                    nsubmits;
+    /* bumped by the CS thread when queuing */
+    unsigned                    queued;
+    /* bumped by the submit thread after the ioctl */
+    unsigned                    done;
+    /* bumped by the CS thread after releasing the bos */
+    unsigned                    reaped;
+    bool                        stop;
+    radeon_cs_gem_done_func     done_func;
+    void                        *done_data;
+};
+
 struct cs_gem {
     struct radeon_cs_int        base;
-    struct drm_radeon_cs        cs;
-    struct drm_radeon_cs_chunk  chunks[2];
+    /* the flags chunk is only sent once a ring is set */
+    struct drm_radeon_cs_chunk  chunks[3];
+    unsigned                    nchunks;
+    uint32_t                    flags[3];
+    /* the DMA ring patches the relocations in order, no NOP packets */
+    bool                        dma;
     unsigned                    nrelocs;
     uint32_t                    *relocs;
     struct radeon_bo_int        **relocs_bo;
+    /* open addressing hash of the reloc index + 1 by bo handle, 0 if free */
+    uint32_t                    *reloc_hash;
+    unsigned                    reloc_hash_size;
+    /* NULL unless emitting from a submit thread */
+    struct cs_gem_async         *async;
 };
 
+#define RELOC_HASH_INIT_SIZE 512
+
 static pthread_mutex_t id_mutex = PTHREAD_MUTEX_INITIALIZER;
 static uint32_t cs_id_source = 0;
 
@@ -160,15 +222,89 @@ static struct radeon_cs_int *cs_gem_create(struct radeon_cs_manager *csm,
         free(csg);
         return NULL;
     }
+    csg->reloc_hash_size = RELOC_HASH_INIT_SIZE;
+    csg->reloc_hash = (uint32_t*)calloc(csg->reloc_hash_size, sizeof(uint32_t));
+    if (csg->reloc_hash == NULL) {
+        free(csg->relocs);
+        free(csg->relocs_bo);
+        free(csg->base.packets);
+        free(csg);
+        return NULL;
+    }
     csg->chunks[0].chunk_id = RADEON_CHUNK_ID_IB;
     csg->chunks[0].length_dw = 0;
     csg->chunks[0].chunk_data = (uint64_t)(uintptr_t)csg->base.packets;
     csg->chunks[1].chunk_id = RADEON_CHUNK_ID_RELOCS;
     csg->chunks[1].length_dw = 0;
     csg->chunks[1].chunk_data = (uint64_t)(uintptr_t)csg->relocs;
+    csg->chunks[2].chunk_id = RADEON_CHUNK_ID_FLAGS;
+    csg->chunks[2].length_dw = 3;
+    csg->chunks[2].chunk_data = (uint64_t)(uintptr_t)csg->flags;
+    csg->nchunks = 2;
     return (struct radeon_cs_int*)csg;
 }
 
+static inline unsigned cs_gem_reloc_hash(struct cs_gem *csg, uint32_t handle)
+{
+    return (handle * 2654435761u) & (csg->reloc_hash_size - 1);
+}
+
+/**
+ * Returns the slot of the handle in the reloc hash, or the free slot for
+ * adding it.
+ **/
+static uint32_t *cs_gem_find_reloc(struct cs_gem *csg, uint32_t handle)
+{
+    unsigned i = cs_gem_reloc_hash(csg, handle);
+    struct cs_reloc_gem *reloc;
+
+    for (;; i = (i + 1) & (csg->reloc_hash_size - 1)) {
+        if (!csg->reloc_hash[i])
+            return &csg->reloc_hash[i];
+        reloc = (struct cs_reloc_gem*)
+            &csg->relocs[(csg->reloc_hash[i] - 1) * RELOC_SIZE];
+        if (reloc->handle == handle)
+            return &csg->reloc_hash[i];
+    }
+}
+
+/**
+ * Whether the reloc is the first of its bo, the others being the repeats
+ * of the DMA ring, which hold a reference but are not counted in the
+ * reloc_in_cs of the bo.
+ **/
+static bool cs_gem_reloc_is_first(struct cs_gem *csg, unsigned i)
+{
+    return !csg->dma ||
+        *cs_gem_find_reloc(csg, csg->relocs_bo[i]->handle) == i + 1;
+}
+
+/**
+ * Doubles the reloc hash, keeping it at most half full.
+ **/
+static int cs_gem_grow_reloc_hash(struct cs_gem *csg)
+{
+    uint32_t *old = csg->reloc_hash;
+    unsigned old_size = csg->reloc_hash_size, i;
+
+    csg->reloc_hash = (uint32_t*)calloc(old_size * 2, sizeof(uint32_t));
+    if (csg->reloc_hash == NULL) {
+        csg->reloc_hash = old;
+        return -ENOMEM;
+    }
+    csg->reloc_hash_size = old_size * 2;
+    for (i = 0; i < old_size; i++) {
+        struct cs_reloc_gem *reloc;
+
+        if (!old[i])
+            continue;
+        reloc = (struct cs_reloc_gem*)&csg->relocs[(old[i] - 1) * RELOC_SIZE];
+        *cs_gem_find_reloc(csg, reloc->handle) = old[i];
+    }
+    free(old);
+    return 0;
+}
+
 static int cs_gem_write_reloc(struct radeon_cs_int *cs,
                               struct radeon_bo *bo,
                               uint32_t read_domain,
@@ -178,8 +314,7 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     struct radeon_bo_int *boi = (struct radeon_bo_int *)bo;
     struct cs_gem *csg = (struct cs_gem*)cs;
     struct cs_reloc_gem *reloc;
-    uint32_t idx;
-    unsigned i;
+    uint32_t idx, *slot;
 
     assert(boi->space_accounted);
 
@@ -196,80 +331,88 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     if (write_domain == RADEON_GEM_DOMAIN_CPU) {
         return -EINVAL;
     }
-    /* use bit field hash function to determine
-       if this bo is for sure not in this cs.*/
-    if ((atomic_read((atomic_t *)radeon_gem_get_reloc_in_cs(bo)) & cs->id)) {
-        /* check if bo is already referenced.
-         * Scanning from end to begin reduces cycles with mesa because
-         * it often relocates same shared dma bo again. */
-        for(i = cs->crelocs; i != 0;) {
-            --i;
-            idx = i * RELOC_SIZE;
-            reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
-            if (reloc->handle == bo->handle) {
-                /* Check domains must be in read or write. As we check already
-                 * checked that in argument one of the read or write domain was
-                 * set we only need to check that if previous reloc as the read
-                 * domain set then the read_domain should also be set for this
-                 * new relocation.
-                 */
-                /* the DDX expects to read and write from same pixmap */
-                if (write_domain && (reloc->read_domain & write_domain)) {
-                    reloc->read_domain = 0;
-                    reloc->write_domain = write_domain;
-                } else if (read_domain & reloc->write_domain) {
-                    reloc->read_domain = 0;
-                } else {
-                    if (write_domain != reloc->write_domain)
-                        return -EINVAL;
-                    if (read_domain != reloc->read_domain)
-                        return -EINVAL;
-                }
-
-                reloc->read_domain |= read_domain;
-                reloc->write_domain |= write_domain;
-                /* update flags */
-                reloc->flags |= (flags & reloc->flags);
-                /* write relocation packet */
-                radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
-                radeon_cs_write_dword((struct radeon_cs *)cs, idx);
-                return 0;
-            }
+    /* check if bo is already referenced */
+    slot = cs_gem_find_reloc(csg, bo->handle);
+    if (*slot && !csg->dma) {
+        idx = (*slot - 1) * RELOC_SIZE;
+        reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
+        /* Check domains must be in read or write. As we check already
+         * checked that in argument one of the read or write domain was
+         * set we only need to check that if previous reloc as the read
+         * domain set then the read_domain should also be set for this
+         * new relocation.
+         */
+        /* the DDX expects to read and write from same pixmap */
+        if (write_domain && (reloc->read_domain & write_domain)) {
+            reloc->read_domain = 0;
+            reloc->write_domain = write_domain;
+        } else if (read_domain & reloc->write_domain) {
+            reloc->read_domain = 0;
+        } else {
+            if (write_domain != reloc->write_domain)
+                return -EINVAL;
+            if (read_domain != reloc->read_domain)
+                return -EINVAL;
         }
+
+        reloc->read_domain |= read_domain;
+        reloc->write_domain |= write_domain;
+        /* update flags */
+        reloc->flags |= (flags & reloc->flags);
+        /* write relocation packet */
+        radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
+        radeon_cs_write_dword((struct radeon_cs *)cs, idx);
+        return 0;
     }
     /* new relocation */
+    if ((csg->base.crelocs + 1) * 2 > csg->reloc_hash_size) {
+        if (cs_gem_grow_reloc_hash(csg))
+            return -ENOMEM;
+        slot = cs_gem_find_reloc(csg, bo->handle);
+    }
     if (csg->base.crelocs >= csg->nrelocs) {
-        /* allocate more memory (TODO: should use a slab allocator maybe) */
-        uint32_t *tmp, size;
-        size = ((csg->nrelocs + 1) * sizeof(struct radeon_bo*));
-        tmp = (uint32_t*)realloc(csg->relocs_bo, size);
+        /* both arrays hold nrelocs entries */
+        uint32_t nrelocs = csg->nrelocs;
+        void *tmp;
+
+        tmp = util_grow_array(csg->relocs_bo, &nrelocs, csg->base.crelocs + 1,
+                              sizeof(*csg->relocs_bo));
         if (tmp == NULL) {
             return -ENOMEM;
         }
-        csg->relocs_bo = (struct radeon_bo_int **)tmp;
-        size = ((csg->nrelocs + 1) * RELOC_SIZE * 4);
-        tmp = (uint32_t*)realloc(csg->relocs, size);
+        csg->relocs_bo = tmp;
+        nrelocs = csg->nrelocs;
+        tmp = util_grow_array(csg->relocs, &nrelocs, csg->base.crelocs + 1,
+                              RELOC_SIZE * 4);
         if (tmp == NULL) {
             return -ENOMEM;
         }
         cs->relocs = csg->relocs = tmp;
-        csg->nrelocs += 1;
+        csg->nrelocs = nrelocs;
         csg->chunks[1].chunk_data = (uint64_t)(uintptr_t)csg->relocs;
     }
     csg->relocs_bo[csg->base.crelocs] = boi;
-    idx = (csg->base.crelocs++) * RELOC_SIZE;
-    reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
+    idx = csg->base.crelocs++;
+    reloc = (struct cs_reloc_gem*)&csg->relocs[idx * RELOC_SIZE];
     reloc->handle = bo->handle;
     reloc->read_domain = read_domain;
     reloc->write_domain = write_domain;
     reloc->flags = flags;
     csg->chunks[1].length_dw += RELOC_SIZE;
     radeon_bo_ref(bo);
+    if (csg->dma) {
+        /* a repeat of a bo already in the relocations */
+        if (*slot)
+            return 0;
+        *slot = idx + 1;
+    } else {
+        *slot = idx + 1;
+        radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
+        radeon_cs_write_dword((struct radeon_cs *)cs, idx * RELOC_SIZE);
+    }
     /* bo might be referenced from another context so have to use atomic operations */
     atomic_add((atomic_t *)radeon_gem_get_reloc_in_cs(bo), cs->id);
     cs->relocs_total_size += boi->size;
-    radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
-    radeon_cs_write_dword((struct radeon_cs *)cs, idx);
     return 0;
 }
 
@@ -294,16 +437,15 @@ static int cs_gem_begin(struct radeon_cs_int *cs,
     cs->section_line = line;
 
     if (cs->cdw + ndw > cs->ndw) {
-        uint32_t tmp, *ptr;
+        struct cs_gem *csg = (struct cs_gem*)cs;
+        uint32_t *ptr;
 
-        /* round up the required size to a multiple of 1024 */
-        tmp = (cs->cdw + ndw + 0x3FF) & (~0x3FF);
-        ptr = (uint32_t*)realloc(cs->packets, 4 * tmp);
+        ptr = util_grow_array(cs->packets, &cs->ndw, cs->cdw + ndw, 4);
         if (ptr == NULL) {
             return -ENOMEM;
         }
         cs->packets = ptr;
-        cs->ndw = tmp;
+        csg->chunks[0].chunk_data = (uint64_t)(uintptr_t)ptr;
     }
     return 0;
 }
@@ -333,136 +475,387 @@ static int cs_gem_end(struct radeon_cs_int *cs,
     return 0;
 }
 
-#if CS_BOF_DUMP
-static void cs_gem_dump_bof(struct radeon_cs_int *cs)
+static uint32_t cs_gem_bof_key_size(const char *key, uint32_t value_size)
 {
-    struct cs_gem *csg = (struct cs_gem*)cs;
-    struct radeon_cs_manager_gem *csm;
-    bof_t *bcs, *blob, *array, *bo, *size, *handle, *device_id, *root;
+    return bof_string_stream_size(key) + value_size;
+}
+
+/**
+ * Writes a CS to the next BOF file, with the bo contents if bos is not
+ * NULL, and the bo sizes coming from bo_sizes else.
+ **/
+static void cs_gem_write_bof(struct radeon_cs_manager_gem *csm,
+                             const uint32_t *pm4, unsigned cdw,
+                             const struct cs_reloc_gem *relocs,
+                             unsigned crelocs, const uint32_t *bo_sizes,
+                             struct radeon_bo_int **bos)
+{
+    bof_stream_t *stream;
+    uint32_t bo_size, bos_size, root_size, size;
     char tmp[256];
     unsigned i;
+    int r;
 
-    csm = (struct radeon_cs_manager_gem *)cs->csm;
-    root = device_id = bcs = blob = array = bo = size = handle = NULL;
-    root = bof_object();
-    if (root == NULL)
-        goto out_err;
-    device_id = bof_int32(csm->device_id);
-    if (device_id == NULL)
+    bo_size = BOF_HEADER_SIZE + cs_gem_bof_key_size("size", BOF_INT32_SIZE) +
+              cs_gem_bof_key_size("handle", BOF_INT32_SIZE);
+    bos_size = BOF_HEADER_SIZE + crelocs * bo_size;
+    for (i = 0; bos && i < crelocs; i++) {
+        bos_size += cs_gem_bof_key_size("data",
+                                        bof_blob_stream_size(bos[i]->size));
+    }
+    root_size = BOF_HEADER_SIZE +
+                cs_gem_bof_key_size("device_id", BOF_INT32_SIZE) +
+                cs_gem_bof_key_size("reloc", bof_blob_stream_size(crelocs * 16)) +
+                cs_gem_bof_key_size("pm4", bof_blob_stream_size(cdw * 4)) +
+                cs_gem_bof_key_size("bo", bos_size);
+
+    sprintf(tmp, "d-0x%04X-%08d.bof", csm->device_id, csm->nbof++);
+    stream = bof_stream_open(tmp);
+    if (stream == NULL)
         return;
-    if (bof_object_set(root, "device_id", device_id))
-        goto out_err;
-    bof_decref(device_id);
-    device_id = NULL;
+
+    bof_stream_object(stream, root_size, 4);
+    bof_stream_string(stream, "device_id");
+    bof_stream_int32(stream, csm->device_id);
     /* dump relocs */
-    blob = bof_blob(csg->nrelocs * 16, csg->relocs);
-    if (blob == NULL)
-        goto out_err;
-    if (bof_object_set(root, "reloc", blob))
-        goto out_err;
-    bof_decref(blob);
-    blob = NULL;
+    bof_stream_string(stream, "reloc");
+    bof_stream_blob(stream, crelocs * 16, relocs);
     /* dump cs */
-    blob = bof_blob(cs->cdw * 4, cs->packets);
-    if (blob == NULL)
-        goto out_err;
-    if (bof_object_set(root, "pm4", blob))
-        goto out_err;
-    bof_decref(blob);
-    blob = NULL;
+    bof_stream_string(stream, "pm4");
+    bof_stream_blob(stream, cdw * 4, pm4);
     /* dump bo */
-    array = bof_array();
-    if (array == NULL)
-        goto out_err;
-    for (i = 0; i < csg->base.crelocs; i++) {
-        bo = bof_object();
-        if (bo == NULL)
-            goto out_err;
-        size = bof_int32(csg->relocs_bo[i]->size);
-        if (size == NULL)
-            goto out_err;
-        if (bof_object_set(bo, "size", size))
-            goto out_err;
-        bof_decref(size);
-        size = NULL;
-        handle = bof_int32(csg->relocs_bo[i]->handle);
-        if (handle == NULL)
-            goto out_err;
-        if (bof_object_set(bo, "handle", handle))
-            goto out_err;
-        bof_decref(handle);
-        handle = NULL;
-        radeon_bo_map((struct radeon_bo*)csg->relocs_bo[i], 0);
-        blob = bof_blob(csg->relocs_bo[i]->size, csg->relocs_bo[i]->ptr);
-        radeon_bo_unmap((struct radeon_bo*)csg->relocs_bo[i]);
-        if (blob == NULL)
-            goto out_err;
-        if (bof_object_set(bo, "data", blob))
-            goto out_err;
-        bof_decref(blob);
-        blob = NULL;
-        if (bof_array_append(array, bo))
-            goto out_err;
-        bof_decref(bo);
-        bo = NULL;
-    }
-    if (bof_object_set(root, "bo", array))
-        goto out_err;
-    sprintf(tmp, "d-0x%04X-%08d.bof", csm->device_id, csm->nbof++);
-    bof_dump_file(root, tmp);
-out_err:
-    bof_decref(blob);
-    bof_decref(array);
-    bof_decref(bo);
-    bof_decref(size);
-    bof_decref(handle);
-    bof_decref(device_id);
-    bof_decref(root);
-}
-#endif
+    bof_stream_string(stream, "bo");
+    bof_stream_array(stream, bos_size, crelocs);
+    for (i = 0; i < crelocs; i++) {
+        size = bos ? bos[i]->size : bo_sizes[i];
+        if (bos) {
+            bof_stream_object(stream, bo_size + cs_gem_bof_key_size("data",
+                              bof_blob_stream_size(size)), 3);
+        } else {
+            bof_stream_object(stream, bo_size, 2);
+        }
+        bof_stream_string(stream, "size");
+        bof_stream_int32(stream, size);
+        bof_stream_string(stream, "handle");
+        bof_stream_int32(stream, relocs[i].handle);
+        if (bos) {
+            radeon_bo_map((struct radeon_bo*)bos[i], 0);
+            bof_stream_string(stream, "data");
+            bof_stream_blob(stream, size, bos[i]->ptr);
+            radeon_bo_unmap((struct radeon_bo*)bos[i]);
+        }
+    }
+    r = bof_stream_close(stream);
+    if (r)
+        fprintf(stderr, "radeon: failed to write %s (%d)\n", tmp, r);
+}
+
+static void cs_gem_dump_bof(struct radeon_cs_int *cs)
+{
+    struct cs_gem *csg = (struct cs_gem*)cs;
+
+    cs_gem_write_bof((struct radeon_cs_manager_gem *)cs->csm, cs->packets,
+                     cs->cdw, (struct cs_reloc_gem *)csg->relocs,
+                     cs->crelocs, NULL, csg->relocs_bo);
+}
+
+/**
+ * Keeps a copy of the CS in the ring of the last ones, reusing the
+ * memory of the one it replaces.
+ **/
+static void cs_gem_capture(struct radeon_cs_int *cs)
+{
+    struct cs_gem *csg = (struct cs_gem*)cs;
+    struct radeon_cs_manager_gem *csm = (struct radeon_cs_manager_gem *)cs->csm;
+    struct cs_gem_capture *capture;
+    unsigned i;
+    void *tmp;
+
+    pthread_mutex_lock(&csm->dump_mutex);
+    capture = &csm->dump_ring[csm->dump_ring_count++ % csm->dump_ring_size];
+    capture->cdw = 0;
+    capture->crelocs = 0;
+    if (cs->cdw > capture->pm4_size) {
+        tmp = realloc(capture->pm4, cs->cdw * 4);
+        if (tmp == NULL)
+            goto out;
+        capture->pm4 = tmp;
+        capture->pm4_size = cs->cdw;
+    }
+    if (cs->crelocs > capture->relocs_size) {
+        tmp = realloc(capture->relocs, cs->crelocs * sizeof(struct cs_reloc_gem));
+        if (tmp == NULL)
+            goto out;
+        capture->relocs = tmp;
+        tmp = realloc(capture->bo_sizes, cs->crelocs * sizeof(uint32_t));
+        if (tmp == NULL)
+            goto out;
+        capture->bo_sizes = tmp;
+        capture->relocs_size = cs->crelocs;
+    }
+    memcpy(capture->pm4, cs->packets, cs->cdw * 4);
+    capture->cdw = cs->cdw;
+    memcpy(capture->relocs, csg->relocs, cs->crelocs * sizeof(struct cs_reloc_gem));
+    for (i = 0; i < cs->crelocs; i++)
+        capture->bo_sizes[i] = csg->relocs_bo[i]->size;
+    capture->crelocs = cs->crelocs;
+out:
+    pthread_mutex_unlock(&csm->dump_mutex);
+}
+
+/**
+ * Dumps the captured CS, oldest first.
+ **/
+static void cs_gem_dump_ring(struct radeon_cs_manager_gem *csm)
+{
+    struct cs_gem_capture *capture;
+    unsigned i, first = 0;
+
+    pthread_mutex_lock(&csm->dump_mutex);
+    if (csm->dump_ring_count > csm->dump_ring_size)
+        first = csm->dump_ring_count - csm->dump_ring_size;
+    for (i = first; i < csm->dump_ring_count; i++) {
+        capture = &csm->dump_ring[i % csm->dump_ring_size];
+        if (capture->cdw == 0)
+            continue;
+        cs_gem_write_bof(csm, capture->pm4, capture->cdw, capture->relocs,
+                         capture->crelocs, capture->bo_sizes, NULL);
+    }
+    pthread_mutex_unlock(&csm->dump_mutex);
+}
+
+static int cs_gem_submit(struct radeon_cs_manager_gem *csm,
+                         struct drm_radeon_cs_chunk *chunks, unsigned nchunks)
+{
+    struct drm_radeon_cs cs;
+    uint64_t chunk_array[3];
+    unsigned i;
+    int r;
+
+    for (i = 0; i < nchunks; i++)
+        chunk_array[i] = (uint64_t)(uintptr_t)&chunks[i];
+
+    memset(&cs, 0, sizeof(cs));
+    cs.num_chunks = nchunks;
+    cs.chunks = (uint64_t)(uintptr_t)chunk_array;
+
+    r = drmCommandWriteRead(csm->base.fd, DRM_RADEON_CS,
+                            &cs, sizeof(struct drm_radeon_cs));
+    /* keep what led to a lockup or a rejected CS */
+    if (r && csm->dump_ring)
+        cs_gem_dump_ring(csm);
+    return r;
+}
+
+static void *cs_gem_submit_thread(void *data)
+{
+    struct cs_gem *csg = data;
+    struct cs_gem_async *async = csg->async;
+    struct radeon_cs_manager_gem *csm =
+        (struct radeon_cs_manager_gem *)csg->base.csm;
+    struct cs_gem_submit *submit;
+    unsigned i;
+    int r;
+
+    pthread_mutex_lock(&async->mutex);
+    for (;;) {
+        while (async->done == async->queued && !async->stop)
+            pthread_cond_wait(&async->cond, &async->mutex);
+        /* what was queued before stopping is still submitted */
+        if (async->done == async->queued)
+            break;
+        submit = &async->submits[async->done % async->nsubmits];
+        pthread_mutex_unlock(&async->mutex);
+
+        r = cs_gem_submit(csm, submit->chunks, submit->nchunks);
+        for (i = 0; i < submit->crelocs; i++)
+            radeon_gem_bo_submitted((struct radeon_bo *)submit->relocs_bo[i]);
+
+        pthread_mutex_lock(&async->mutex);
+        submit->result = r;
+        async->done++;
+        pthread_cond_broadcast(&async->cond);
+    }
+    pthread_mutex_unlock(&async->mutex);
+    return NULL;
+}
+
+/**
+ * Release the bos of the submitted CS and report them, in order, until at
+ * most max_queued are left in the ring. Returns the first error of the
+ * CS ioctl.
+ */
+static int cs_gem_async_reap(struct cs_gem *csg, unsigned max_queued)
+{
+    struct cs_gem_async *async = csg->async;
+    struct cs_gem_submit *submit;
+    unsigned i;
+    int r = 0;
+
+    pthread_mutex_lock(&async->mutex);
+    for (;;) {
+        if (async->reaped == async->done) {
+            if (async->queued - async->reaped <= max_queued)
+                break;
+            pthread_cond_wait(&async->cond, &async->mutex);
+            continue;
+        }
+        submit = &async->submits[async->reaped % async->nsubmits];
+        pthread_mutex_unlock(&async->mutex);
+
+        for (i = 0; i < submit->crelocs; i++) {
+            radeon_bo_unref((struct radeon_bo *)submit->relocs_bo[i]);
+            submit->relocs_bo[i] = NULL;
+        }
+        submit->crelocs = 0;
+        if (async->done_func)
+            async->done_func(async->done_data, submit->result);
+        if (!r)
+            r = submit->result;
+
+        pthread_mutex_lock(&async->mutex);
+        async->reaped++;
+    }
+    pthread_mutex_unlock(&async->mutex);
+    return r;
+}
+
+/* Hand the buffers of the CS to the submit thread and take spare ones. */
+static int cs_gem_emit_async(struct cs_gem *csg)
+{
+    struct cs_gem_async *async = csg->async;
+    struct cs_gem_submit *submit, tmp;
+    unsigned i;
+    int r;
+
+    r = cs_gem_async_reap(csg, async->nsubmits - 1);
+
+    for (i = 0; i < csg->base.crelocs; i++)
+        radeon_gem_bo_queue_submit((struct radeon_bo *)csg->relocs_bo[i]);
+
+    submit = &async->submits[async->queued % async->nsubmits];
+    tmp = *submit;
+    submit->chunks[0] = csg->chunks[0];
+    submit->chunks[1] = csg->chunks[1];
+    submit->nchunks = csg->nchunks;
+    memcpy(submit->flags, csg->flags, sizeof(submit->flags));
+    submit->packets = csg->base.packets;
+    submit->nrelocs = csg->nrelocs;
+    submit->relocs = csg->relocs;
+    submit->relocs_bo = csg->relocs_bo;
+    submit->crelocs = csg->base.crelocs;
+
+    csg->base.packets = tmp.packets;
+    csg->nrelocs = tmp.nrelocs;
+    csg->base.relocs = csg->relocs = tmp.relocs;
+    csg->relocs_bo = tmp.relocs_bo;
+    csg->chunks[0].chunk_data = (uint64_t)(uintptr_t)csg->base.packets;
+    csg->chunks[1].chunk_data = (uint64_t)(uintptr_t)csg->relocs;
+
+    pthread_mutex_lock(&async->mutex);
+    async->queued++;
+    pthread_cond_broadcast(&async->cond);
+    pthread_mutex_unlock(&async->mutex);
+    return r;
+}
 
 static int cs_gem_emit(struct radeon_cs_int *cs)
 {
     struct cs_gem *csg = (struct cs_gem*)cs;
-    uint64_t chunk_array[2];
+    struct radeon_cs_manager_gem *csm = (struct radeon_cs_manager_gem *)cs->csm;
     unsigned i;
     int r;
 
+    /* the NOP of the DMA ring before CIK, or a type 2 packet */
     while (cs->cdw & 7)
-	radeon_cs_write_dword((struct radeon_cs *)cs, 0x80000000);
+	radeon_cs_write_dword((struct radeon_cs *)cs,
+                              csg->dma ? 0xf0000000 : 0x80000000);
 
-#if CS_BOF_DUMP
-    cs_gem_dump_bof(cs);
-#endif
+    if (csm->dump_all)
+        cs_gem_dump_bof(cs);
+    else if (csm->dump_ring)
+        cs_gem_capture(cs);
     csg->chunks[0].length_dw = cs->cdw;
 
-    chunk_array[0] = (uint64_t)(uintptr_t)&csg->chunks[0];
-    chunk_array[1] = (uint64_t)(uintptr_t)&csg->chunks[1];
-
-    csg->cs.num_chunks = 2;
-    csg->cs.chunks = (uint64_t)(uintptr_t)chunk_array;
+    if (csg->async) {
+        for (i = 0; i < csg->base.crelocs; i++) {
+            csg->relocs_bo[i]->space_accounted = 0;
+            if (cs_gem_reloc_is_first(csg, i))
+                atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
+        }
+        r = cs_gem_emit_async(csg);
+        /* the spare buffers are empty */
+        memset(csg->reloc_hash, 0, csg->reloc_hash_size * sizeof(uint32_t));
+        cs->relocs_total_size = 0;
+        cs->cdw = 0;
+        cs->section_ndw = 0;
+        cs->crelocs = 0;
+        csg->chunks[0].length_dw = 0;
+        csg->chunks[1].length_dw = 0;
+        goto out;
+    }
 
-    r = drmCommandWriteRead(cs->csm->fd, DRM_RADEON_CS,
-                            &csg->cs, sizeof(struct drm_radeon_cs));
+    r = cs_gem_submit(csm, csg->chunks, csg->nchunks);
     for (i = 0; i < csg->base.crelocs; i++) {
         csg->relocs_bo[i]->space_accounted = 0;
         /* bo might be referenced from another context so have to use atomic operations */
-        atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
+        if (cs_gem_reloc_is_first(csg, i))
+            atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
         radeon_bo_unref((struct radeon_bo *)csg->relocs_bo[i]);
         csg->relocs_bo[i] = NULL;
     }
+    memset(csg->reloc_hash, 0, csg->reloc_hash_size * sizeof(uint32_t));
 
+out:
     cs->csm->read_used = 0;
+    cs->csm->space_epoch++;
     cs->csm->vram_write_used = 0;
     cs->csm->gart_write_used = 0;
     return r;
 }
 
+static void cs_gem_async_free(struct cs_gem_async *async)
+{
+    unsigned i;
+
+    for (i = 0; i < async->nsubmits; i++) {
+        free(async->submits[i].packets);
+        free(async->submits[i].relocs);
+        free(async->submits[i].relocs_bo);
+    }
+    free(async->submits);
+    pthread_cond_destroy(&async->cond);
+    pthread_mutex_destroy(&async->mutex);
+    free(async);
+}
+
+/* Submit what was queued and stop the submit thread. */
+static int cs_gem_async_stop(struct cs_gem *csg)
+{
+    struct cs_gem_async *async = csg->async;
+    int r;
+
+    r = cs_gem_async_reap(csg, 0);
+
+    pthread_mutex_lock(&async->mutex);
+    async->stop = true;
+    pthread_cond_broadcast(&async->cond);
+    pthread_mutex_unlock(&async->mutex);
+    pthread_join(async->thread, NULL);
+
+    cs_gem_async_free(async);
+    csg->async = NULL;
+    return r;
+}
+
 static int cs_gem_destroy(struct radeon_cs_int *cs)
 {
     struct cs_gem *csg = (struct cs_gem*)cs;
 
+    if (csg->async)
+        cs_gem_async_stop(csg);
     free_id(cs->id);
+    free(csg->reloc_hash);
     free(csg->relocs_bo);
     free(cs->relocs);
     free(cs->packets);
@@ -479,12 +872,14 @@ static int cs_gem_erase(struct radeon_cs_int *cs)
         for (i = 0; i < csg->base.crelocs; i++) {
             if (csg->relocs_bo[i]) {
                 /* bo might be referenced from another context so have to use atomic operations */
-                atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
+                if (cs_gem_reloc_is_first(csg, i))
+                    atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
                 radeon_bo_unref((struct radeon_bo *)csg->relocs_bo[i]);
                 csg->relocs_bo[i] = NULL;
             }
         }
     }
+    memset(csg->reloc_hash, 0, csg->reloc_hash_size * sizeof(uint32_t));
     cs->relocs_total_size = 0;
     cs->cdw = 0;
     cs->section_ndw = 0;
@@ -539,6 +934,7 @@ static int radeon_get_device_id(int fd, uint32_t *device_id)
 drm_public struct radeon_cs_manager *radeon_cs_manager_gem_ctor(int fd)
 {
     struct radeon_cs_manager_gem *csm;
+    const char *dump;
 
     csm = calloc(1, sizeof(struct radeon_cs_manager_gem));
     if (csm == NULL) {
@@ -547,10 +943,117 @@ drm_public struct radeon_cs_manager *radeon_cs_manager_gem_ctor(int fd)
     csm->base.funcs = &radeon_cs_gem_funcs;
     csm->base.fd = fd;
     radeon_get_device_id(fd, &csm->device_id);
+
+    pthread_mutex_init(&csm->dump_mutex, NULL);
+    dump = getenv("RADEON_CS_DUMP");
+    if (dump && !strcmp(dump, "all")) {
+        csm->dump_all = true;
+    } else if (dump) {
+        csm->dump_ring_size = strtoul(dump, NULL, 0);
+        if (csm->dump_ring_size)
+            csm->dump_ring = calloc(csm->dump_ring_size,
+                                    sizeof(struct cs_gem_capture));
+    }
     return &csm->base;
 }
 
+drm_public int radeon_cs_gem_set_async(struct radeon_cs *cs, unsigned nbuffers,
+                                       radeon_cs_gem_done_func done_func,
+                                       void *data)
+{
+    struct cs_gem *csg = (struct cs_gem*)cs;
+    struct cs_gem_async *async;
+    int r = 0;
+    unsigned i;
+
+    if (csg->async)
+        r = cs_gem_async_stop(csg);
+    if (nbuffers < 2)
+        return r;
+
+    async = calloc(1, sizeof(struct cs_gem_async));
+    if (async == NULL)
+        return -ENOMEM;
+    pthread_mutex_init(&async->mutex, NULL);
+    pthread_cond_init(&async->cond, NULL);
+    async->done_func = done_func;
+    async->done_data = data;
+    /* the CS itself holds one set of buffers */
+    async->nsubmits = nbuffers - 1;
+    async->submits = calloc(async->nsubmits, sizeof(struct cs_gem_submit));
+    if (async->submits == NULL) {
+        async->nsubmits = 0;
+        cs_gem_async_free(async);
+        return -ENOMEM;
+    }
+    for (i = 0; i < async->nsubmits; i++) {
+        struct cs_gem_submit *submit = &async->submits[i];
+
+        submit->chunks[0].chunk_id = RADEON_CHUNK_ID_IB;
+        submit->chunks[1].chunk_id = RADEON_CHUNK_ID_RELOCS;
+        submit->chunks[2].chunk_id = RADEON_CHUNK_ID_FLAGS;
+        submit->chunks[2].length_dw = 3;
+        submit->chunks[2].chunk_data = (uint64_t)(uintptr_t)submit->flags;
+        submit->nrelocs = 4096 / (4 * 4);
+        submit->packets = calloc(1, 64 * 1024);
+        submit->relocs = calloc(1, 4096);
+        submit->relocs_bo = calloc(submit->nrelocs, sizeof(void*));
+        if (!submit->packets || !submit->relocs || !submit->relocs_bo) {
+            cs_gem_async_free(async);
+            return -ENOMEM;
+        }
+    }
+
+    csg->async = async;
+    r = pthread_create(&async->thread, NULL, cs_gem_submit_thread, csg);
+    if (r) {
+        csg->async = NULL;
+        cs_gem_async_free(async);
+        return -r;
+    }
+    return 0;
+}
+
+drm_public int radeon_cs_gem_set_ring(struct radeon_cs *cs, uint32_t ring,
+                                      uint32_t flags)
+{
+    struct cs_gem *csg = (struct cs_gem*)cs;
+
+    if (csg->base.cdw || csg->base.crelocs)
+        return -EBUSY;
+    csg->flags[0] = flags;
+    csg->flags[1] = ring;
+    csg->flags[2] = 0;
+    csg->nchunks = 3;
+    csg->dma = ring == RADEON_CS_RING_DMA;
+    return 0;
+}
+
+drm_public int radeon_cs_gem_finish(struct radeon_cs *cs)
+{
+    struct cs_gem *csg = (struct cs_gem*)cs;
+
+    if (csg->async == NULL)
+        return 0;
+    return cs_gem_async_reap(csg, 0);
+}
+
 drm_public void radeon_cs_manager_gem_dtor(struct radeon_cs_manager *csm)
 {
+    struct radeon_cs_manager_gem *csm_gem = (struct radeon_cs_manager_gem *)csm;
+    unsigned i;
+
+    if (csm == NULL)
+        return;
+
+    if (csm_gem->dump_ring) {
+        for (i = 0; i < csm_gem->dump_ring_size; i++) {
+            free(csm_gem->dump_ring[i].pm4);
+            free(csm_gem->dump_ring[i].relocs);
+            free(csm_gem->dump_ring[i].bo_sizes);
+        }
+        free(csm_gem->dump_ring);
+    }
+    pthread_mutex_destroy(&csm_gem->dump_mutex);
     free(csm);
 }
@@ -38,4 +38,26 @@
 struct radeon_cs_manager *radeon_cs_manager_gem_ctor(int fd);
 void radeon_cs_manager_gem_dtor(struct radeon_cs_manager *csm);
 
+/* Called with the result of the CS ioctl of each asynchronous emit, in
+ * order, from the thread emitting the CS. */
+typedef void (*radeon_cs_gem_done_func)(void *data, int result);
+/* With nbuffers >= 2, radeon_cs_emit() hands the filled buffers to a
+ * submit thread and returns with the next of nbuffers sets of buffers,
+ * blocking only when all of them are queued. Errors of the CS ioctl are
+ * passed to done_func, and returned by the next emit or finish. Waiting
+ * for or mapping a bo of a queued CS blocks until it is submitted. A
+ * nbuffers below 2 submits what is queued and goes back to synchronous
+ * emits. */
+int radeon_cs_gem_set_async(struct radeon_cs *cs, unsigned nbuffers,
+                            radeon_cs_gem_done_func done_func, void *data);
+/* Wait for the queued CS to be submitted and report them, the first error
+ * is returned. */
+int radeon_cs_gem_finish(struct radeon_cs *cs);
+/* Send the CS to a RADEON_CS_RING_* ring with the RADEON_CS_* flags,
+ * before anything is written to it. The DMA ring patches the addresses in
+ * the order of the relocations, so there radeon_cs_write_reloc() adds the
+ * bo again for each address to patch and writes no packet. */
+int radeon_cs_gem_set_ring(struct radeon_cs *cs, uint32_t ring,
+                           uint32_t flags);
+
 #endif
@@ -26,6 +26,9 @@ struct radeon_cs_int {
     int                         section_line;
     struct radeon_cs_space_check bos[MAX_SPACE_BOS];
     int                         bo_count;
+    /* bos accounted by the last space check, as of csm space_epoch */
+    int                         bos_accounted;
+    uint32_t                    space_epoch;
     void                        (*space_flush_fn)(void *);
     void                        *space_flush_data;
     uint32_t                    id;
@@ -63,5 +66,7 @@ struct radeon_cs_manager {
     int32_t vram_limit, gart_limit;
     int32_t vram_write_used, gart_write_used;
     int32_t read_used;
+    /* bumped when the space accounted is reset by an emit */
+    uint32_t space_epoch;
 };
 #endif
@@ -109,7 +109,7 @@ static inline int radeon_cs_setup_bo(struct radeon_cs_space_check *sc, struct ra
 static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_space_check *new_tmp)
 {
     struct radeon_cs_manager *csm = cs->csm;
-    int i;
+    int i, first;
     struct radeon_bo_int *bo;
     struct rad_sizes sizes;
     int ret;
@@ -121,8 +121,15 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
 
     memset(&sizes, 0, sizeof(struct rad_sizes));
 
+    /* The persistent bos accounted by the last check are still as long as
+     * no emit reset their space_accounted, so only the new ones are set up.
+     */
+    first = 0;
+    if (cs->space_epoch == csm->space_epoch)
+        first = cs->bos_accounted;
+
     /* prepare */
-    for (i = 0; i < cs->bo_count; i++) {
+    for (i = first; i < cs->bo_count; i++) {
         ret = radeon_cs_setup_bo(&cs->bos[i], &sizes);
         if (ret)
             return ret;
@@ -152,10 +159,12 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
     csm->vram_write_used += sizes.op_vram_write;
     csm->read_used += sizes.op_read;
     /* commit */
-    for (i = 0; i < cs->bo_count; i++) {
+    for (i = first; i < cs->bo_count; i++) {
         bo = cs->bos[i].bo;
         bo->space_accounted = cs->bos[i].new_accounted;
     }
+    cs->bos_accounted = cs->bo_count;
+    cs->space_epoch = csm->space_epoch;
     if (new_tmp)
         new_tmp->bo->space_accounted = new_tmp->new_accounted;
 
@@ -245,4 +254,5 @@ drm_public void radeon_cs_space_reset_bos(struct radeon_cs *cs)
         csi->bos[i].new_accounted = 0;
     }
     csi->bo_count = 0;
+    csi->bos_accounted = 0;
 }
@@ -0,0 +1,339 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NON-INFRINGEMENT. IN NO EVENT SHALL THE COPYRIGHT HOLDERS, AUTHORS
+ * AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include "libdrm_macros.h"
+#include "xf86drm.h"
+#include "radeon_drm.h"
+#include "radeon_bo.h"
+#include "radeon_bo_int.h"
+#include "radeon_cs.h"
+#include "radeon_cs_gem.h"
+#include "radeon_dma.h"
+#include "radeon_family.h"
+
+#define MIN2(A, B)              ((A) < (B) ? (A) : (B))
+
+/* DMA packets of r6xx and r7xx, with a 16 bits dword count */
+#define R600_DMA_PACKET(cmd, n)         (((uint32_t)(cmd) << 28) | (n))
+/* DMA packets of evergreen and cayman, with a 20 bits dword count */
+#define EG_DMA_PACKET(cmd, sub_cmd, n)  (((uint32_t)(cmd) << 28) | \
+                                         ((sub_cmd) << 20) | (n))
+#define DMA_PACKET_WRITE                0x2
+#define DMA_PACKET_COPY                 0x3
+#define DMA_PACKET_CONSTANT_FILL        0xd /* r7xx and later */
+
+/* the CS is emitted at its initial size, keeping room for the fence
+ * packet and the padding to 8 dwords */
+#define DMA_CS_DW                       (16 * 1024)
+#define DMA_CS_RESERVED_DW              (4 + 7)
+
+enum radeon_dma_gen {
+    DMA_GEN_R6XX,
+    DMA_GEN_R7XX,
+    DMA_GEN_EG,
+};
+
+struct radeon_dma {
+    struct radeon_bo_manager    *bom;
+    struct radeon_cs_manager    *csm;
+    struct radeon_cs            *cs;
+    enum radeon_dma_gen         gen;
+};
+
+static int radeon_dma_get_value(int fd, unsigned req, uint32_t *value)
+{
+    struct drm_radeon_info info = {};
+
+    info.request = req;
+    info.value = (uintptr_t)value;
+    return drmCommandWriteRead(fd, DRM_RADEON_INFO, &info,
+                               sizeof(struct drm_radeon_info));
+}
+
+/* The packets are not split, a check failing only when they don't fit. */
+static void radeon_dma_space_flush(void *data)
+{
+}
+
+drm_public struct radeon_dma *radeon_dma_create(struct radeon_bo_manager *bom)
+{
+    struct drm_radeon_gem_info mminfo = {};
+    enum radeon_family family;
+    struct radeon_dma *dma;
+    uint32_t value = 0;
+
+    if (radeon_dma_get_value(bom->fd, RADEON_INFO_DEVICE_ID, &value))
+        return NULL;
+    family = radeon_family_from_device_id(value);
+    /* SI and later only take a DMA CS with a virtual memory */
+    if (family == CHIP_UNKNOWN || family >= CHIP_TAHITI)
+        return NULL;
+    /* the ring to query is passed in the value */
+    value = RADEON_CS_RING_DMA;
+    if (radeon_dma_get_value(bom->fd, RADEON_INFO_RING_WORKING, &value) ||
+        !value)
+        return NULL;
+    if (drmCommandWriteRead(bom->fd, DRM_RADEON_GEM_INFO, &mminfo,
+                            sizeof(mminfo)))
+        return NULL;
+
+    dma = calloc(1, sizeof(struct radeon_dma));
+    if (dma == NULL)
+        return NULL;
+    dma->bom = bom;
+    if (family < CHIP_RV770)
+        dma->gen = DMA_GEN_R6XX;
+    else if (family < CHIP_CEDAR)
+        dma->gen = DMA_GEN_R7XX;
+    else
+        dma->gen = DMA_GEN_EG;
+
+    dma->csm = radeon_cs_manager_gem_ctor(bom->fd);
+    if (dma->csm)
+        dma->cs = radeon_cs_create(dma->csm, DMA_CS_DW);
+    if (dma->cs == NULL ||
+        radeon_cs_gem_set_ring(dma->cs, RADEON_CS_RING_DMA, 0)) {
+        radeon_dma_destroy(dma);
+        return NULL;
+    }
+    radeon_cs_set_limit(dma->cs, RADEON_GEM_DOMAIN_VRAM,
+                        MIN2(mminfo.vram_size, INT32_MAX));
+    radeon_cs_set_limit(dma->cs, RADEON_GEM_DOMAIN_GTT,
+                        MIN2(mminfo.gart_size, INT32_MAX));
+    radeon_cs_space_set_flush(dma->cs, radeon_dma_space_flush, dma);
+    return dma;
+}
+
+drm_public void radeon_dma_destroy(struct radeon_dma *dma)
+{
+    if (dma == NULL)
+        return;
+    if (dma->cs)
+        radeon_cs_destroy(dma->cs);
+    radeon_cs_manager_gem_dtor(dma->csm);
+    free(dma);
+}
+
+static uint32_t radeon_dma_domains(struct radeon_bo *bo)
+{
+    uint32_t domains = ((struct radeon_bo_int *)bo)->domains &
+        (RADEON_GEM_DOMAIN_VRAM | RADEON_GEM_DOMAIN_GTT);
+
+    return domains ? domains : RADEON_GEM_DOMAIN_VRAM | RADEON_GEM_DOMAIN_GTT;
+}
+
+static int radeon_dma_space_check(struct radeon_dma *dma,
+                                  struct radeon_bo *dst, struct radeon_bo *src,
+                                  struct radeon_bo *fence)
+{
+    radeon_cs_space_reset_bos(dma->cs);
+    if (src)
+        radeon_cs_space_add_persistent_bo(dma->cs, src,
+                                          radeon_dma_domains(src), 0);
+    radeon_cs_space_add_persistent_bo(dma->cs, dst, 0, radeon_dma_domains(dst));
+    if (fence)
+        radeon_cs_space_add_persistent_bo(dma->cs, fence, 0,
+                                          RADEON_GEM_DOMAIN_GTT);
+    return radeon_cs_space_check(dma->cs) ? -ENOSPC : 0;
+}
+
+/* The dwords left for the packets of the copy or fill in the CS. */
+static unsigned radeon_dma_room(struct radeon_dma *dma)
+{
+    unsigned cdw = dma->cs->cdw + DMA_CS_RESERVED_DW;
+
+    return cdw < DMA_CS_DW ? DMA_CS_DW - cdw : 0;
+}
+
+/* Writes a copy packet, of at most *size bytes, set to what it copies. */
+static int radeon_dma_copy_packet(struct radeon_dma *dma,
+                                  struct radeon_bo *dst, uint32_t dst_offset,
+                                  struct radeon_bo *src, uint32_t src_offset,
+                                  uint32_t *size)
+{
+    struct radeon_cs *cs = dma->cs;
+    uint32_t ndw = *size / 4, packet[5];
+    unsigned n = 5;
+    int r;
+
+    switch (dma->gen) {
+    case DMA_GEN_R6XX:
+        ndw = MIN2(ndw, 0xfffe);
+        packet[0] = R600_DMA_PACKET(DMA_PACKET_COPY, ndw);
+        /* the high bits of the destination at 16, of the source at 0 */
+        packet[3] = 0;
+        n = 4;
+        break;
+    case DMA_GEN_R7XX:
+        ndw = MIN2(ndw, 0xffff);
+        packet[0] = R600_DMA_PACKET(DMA_PACKET_COPY, ndw);
+        packet[3] = packet[4] = 0;
+        break;
+    case DMA_GEN_EG:
+        ndw = MIN2(ndw, 0xfffff);
+        /* a linear copy, dword aligned */
+        packet[0] = EG_DMA_PACKET(DMA_PACKET_COPY, 0, ndw);
+        packet[3] = packet[4] = 0;
+        break;
+    }
+    packet[1] = dst_offset;
+    packet[2] = src_offset;
+
+    /* the kernel patches the source, then the destination */
+    r = radeon_cs_write_reloc(cs, src, radeon_dma_domains(src), 0, 0);
+    if (r)
+        return r;
+    r = radeon_cs_write_reloc(cs, dst, 0, radeon_dma_domains(dst), 0);
+    if (r)
+        return r;
+    r = radeon_cs_begin(cs, n, __FILE__, __func__, __LINE__);
+    if (r)
+        return r;
+    radeon_cs_write_table(cs, packet, n);
+    *size = ndw * 4;
+    return radeon_cs_end(cs, __FILE__, __func__, __LINE__);
+}
+
+/* Writes a fill packet, of at most *size bytes, set to what it fills. */
+static int radeon_dma_fill_packet(struct radeon_dma *dma,
+                                  struct radeon_bo *dst, uint32_t offset,
+                                  uint32_t value, uint32_t *size)
+{
+    struct radeon_cs *cs = dma->cs;
+    uint32_t ndw = *size / 4, packet[4], i;
+    unsigned n = 4;
+    int r;
+
+    switch (dma->gen) {
+    case DMA_GEN_R6XX:
+        /* no constant fill, the dwords follow the packet */
+        ndw = MIN2(MIN2(ndw, 0xffff), radeon_dma_room(dma) - 3);
+        packet[0] = R600_DMA_PACKET(DMA_PACKET_WRITE, ndw);
+        packet[2] = 0;
+        n = 3;
+        break;
+    case DMA_GEN_R7XX:
+        ndw = MIN2(ndw, 0xffff);
+        packet[0] = R600_DMA_PACKET(DMA_PACKET_CONSTANT_FILL, ndw);
+        packet[2] = value;
+        /* the high bits of the destination at 16 */
+        packet[3] = 0;
+        break;
+    case DMA_GEN_EG:
+        ndw = MIN2(ndw, 0xfffff);
+        packet[0] = EG_DMA_PACKET(DMA_PACKET_CONSTANT_FILL, 0, ndw);
+        packet[2] = value;
+        packet[3] = 0;
+        break;
+    }
+    packet[1] = offset;
+
+    r = radeon_cs_write_reloc(cs, dst, 0, radeon_dma_domains(dst), 0);
+    if (r)
+        return r;
+    r = radeon_cs_begin(cs, dma->gen == DMA_GEN_R6XX ? n + ndw : n,
+                        __FILE__, __func__, __LINE__);
+    if (r)
+        return r;
+    radeon_cs_write_table(cs, packet, n);
+    if (dma->gen == DMA_GEN_R6XX) {
+        for (i = 0; i < ndw; i++)
+            radeon_cs_write_dword(cs, value);
+    }
+    *size = ndw * 4;
+    return radeon_cs_end(cs, __FILE__, __func__, __LINE__);
+}
+
+/* Copies from src, or fills with value without src, a CS at a time. */
+static int radeon_dma_run(struct radeon_dma *dma,
+                          struct radeon_bo *dst, uint32_t dst_offset,
+                          struct radeon_bo *src, uint32_t src_offset,
+                          uint32_t size, uint32_t value,
+                          struct radeon_bo **fence)
+{
+    struct radeon_bo *fence_bo = NULL;
+    uint32_t done;
+    int r;
+
+    if (!size || ((dst_offset | src_offset | size) & 3))
+        return -EINVAL;
+    if ((uint64_t)dst_offset + size > dst->size ||
+        (src && (uint64_t)src_offset + size > src->size))
+        return -EINVAL;
+
+    if (fence) {
+        fence_bo = radeon_bo_open(dma->bom, 0, 4096, 4096,
+                                  RADEON_GEM_DOMAIN_GTT, 0);
+        if (fence_bo == NULL)
+            return -ENOMEM;
+    }
+
+    do {
+        r = radeon_dma_space_check(dma, dst, src, fence_bo);
+        while (!r && size && radeon_dma_room(dma) >= 8) {
+            done = size;
+            if (src)
+                r = radeon_dma_copy_packet(dma, dst, dst_offset,
+                                           src, src_offset, &done);
+            else
+                r = radeon_dma_fill_packet(dma, dst, dst_offset, value, &done);
+            dst_offset += done;
+            src_offset += done;
+            size -= done;
+        }
+        /* the last CS writes the fence after the copy */
+        if (!r && !size && fence_bo) {
+            done = 4;
+            r = radeon_dma_fill_packet(dma, fence_bo, 0, 1, &done);
+        }
+        if (r)
+            radeon_cs_erase(dma->cs);
+        else
+            r = radeon_cs_emit(dma->cs);
+    } while (!r && size);
+    radeon_cs_space_reset_bos(dma->cs);
+
+    if (fence_bo && r)
+        radeon_bo_unref(fence_bo);
+    else if (fence)
+        *fence = fence_bo;
+    return r;
+}
+
+drm_public int radeon_bo_copy_async(struct radeon_dma *dma,
+                                    struct radeon_bo *dst, uint32_t dst_offset,
+                                    struct radeon_bo *src, uint32_t src_offset,
+                                    uint32_t size, struct radeon_bo **fence)
+{
+    return radeon_dma_run(dma, dst, dst_offset, src, src_offset, size, 0,
+                          fence);
+}
+
+drm_public int radeon_bo_fill_async(struct radeon_dma *dma,
+                                    struct radeon_bo *dst, uint32_t offset,
+                                    uint32_t size, uint32_t value,
+                                    struct radeon_bo **fence)
+{
+    return radeon_dma_run(dma, dst, offset, NULL, 0, size, value, fence);
+}
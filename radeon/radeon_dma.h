@@ -0,0 +1,54 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NON-INFRINGEMENT. IN NO EVENT SHALL THE COPYRIGHT HOLDERS, AUTHORS
+ * AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ */
+#ifndef RADEON_DMA_H
+#define RADEON_DMA_H
+
+#include <stdint.h>
+#include "radeon_bo.h"
+
+/*
+ * Copies and fills of bos on the DMA ring, for the r6xx to cayman
+ * families, which the kernel lets patch the bo addresses without a
+ * virtual memory. The offsets and sizes are in bytes, multiples of 4.
+ *
+ * A call returns once its CS is submitted, with a new fence bo the DMA
+ * writes last, to radeon_bo_wait() or radeon_bo_is_busy() on, unless
+ * fence is NULL. The DMA ring runs in order, so the fence of a copy also
+ * covers the ones before. A radeon_dma is not thread safe.
+ */
+struct radeon_dma;
+
+/* NULL if the DMA ring is not working, or is SI and later. */
+struct radeon_dma *radeon_dma_create(struct radeon_bo_manager *bom);
+void radeon_dma_destroy(struct radeon_dma *dma);
+
+int radeon_bo_copy_async(struct radeon_dma *dma,
+                         struct radeon_bo *dst, uint32_t dst_offset,
+                         struct radeon_bo *src, uint32_t src_offset,
+                         uint32_t size, struct radeon_bo **fence);
+int radeon_bo_fill_async(struct radeon_dma *dma,
+                         struct radeon_bo *dst, uint32_t offset,
+                         uint32_t size, uint32_t value,
+                         struct radeon_bo **fence);
+
+#endif
@@ -29,6 +29,8 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,6 +40,7 @@
 #include "xf86drm.h"
 #include "radeon_drm.h"
 #include "radeon_surface.h"
+#include "radeon_family.h"
 
 #define CIK_TILE_MODE_COLOR_2D			14
 #define CIK_TILE_MODE_COLOR_2D_SCANOUT		10
@@ -51,47 +54,6 @@
 #define MAX2(A, B)              ((A) > (B) ? (A) : (B))
 #define MIN2(A, B)              ((A) < (B) ? (A) : (B))
 
-/* keep this private */
-enum radeon_family {
-    CHIP_UNKNOWN,
-    CHIP_R600,
-    CHIP_RV610,
-    CHIP_RV630,
-    CHIP_RV670,
-    CHIP_RV620,
-    CHIP_RV635,
-    CHIP_RS780,
-    CHIP_RS880,
-    CHIP_RV770,
-    CHIP_RV730,
-    CHIP_RV710,
-    CHIP_RV740,
-    CHIP_CEDAR,
-    CHIP_REDWOOD,
-    CHIP_JUNIPER,
-    CHIP_CYPRESS,
-    CHIP_HEMLOCK,
-    CHIP_PALM,
-    CHIP_SUMO,
-    CHIP_SUMO2,
-    CHIP_BARTS,
-    CHIP_TURKS,
-    CHIP_CAICOS,
-    CHIP_CAYMAN,
-    CHIP_ARUBA,
-    CHIP_TAHITI,
-    CHIP_PITCAIRN,
-    CHIP_VERDE,
-    CHIP_OLAND,
-    CHIP_HAINAN,
-    CHIP_BONAIRE,
-    CHIP_KAVERI,
-    CHIP_KABINI,
-    CHIP_HAWAII,
-    CHIP_MULLINS,
-    CHIP_LAST,
-};
-
 typedef int (*hw_init_surface_t)(struct radeon_surface_manager *surf_man,
                                  struct radeon_surface *surf);
 typedef int (*hw_best_surface_t)(struct radeon_surface_manager *surf_man,
@@ -111,6 +73,17 @@ struct radeon_hw_info {
     uint32_t                        macrotile_mode_array[16];
 };
 
+/* Surfaces computed by a manager, by hash of the fields before level */
+#define SURFACE_CACHE_SIZE      32
+#define SURFACE_KEY_SIZE        offsetof(struct radeon_surface, level)
+
+struct radeon_surface_cache_entry {
+    bool                        valid;
+    bool                        best;
+    uint8_t                     key[SURFACE_KEY_SIZE];
+    struct radeon_surface       surf;
+};
+
 struct radeon_surface_manager {
     int                         fd;
     uint32_t                    device_id;
@@ -118,6 +91,8 @@ struct radeon_surface_manager {
     unsigned                    family;
     hw_init_surface_t           surface_init;
     hw_best_surface_t           surface_best;
+    pthread_mutex_t             cache_mutex;
+    struct radeon_surface_cache_entry cache[SURFACE_CACHE_SIZE];
 };
 
 /* helper */
@@ -136,13 +111,9 @@ static int radeon_get_value(int fd, unsigned req, uint32_t *value)
 
 static int radeon_get_family(struct radeon_surface_manager *surf_man)
 {
-    switch (surf_man->device_id) {
-#define CHIPSET(pci_id, name, fam) case pci_id: surf_man->family = CHIP_##fam; break;
-#include "r600_pci_ids.h"
-#undef CHIPSET
-    default:
+    surf_man->family = radeon_family_from_device_id(surf_man->device_id);
+    if (surf_man->family == CHIP_UNKNOWN)
         return -EINVAL;
-    }
     return 0;
 }
 
@@ -2418,6 +2389,7 @@ radeon_surface_manager_new(int fd)
         return NULL;
     }
     surf_man->fd = fd;
+    pthread_mutex_init(&surf_man->cache_mutex, NULL);
     if (radeon_get_value(fd, RADEON_INFO_DEVICE_ID, &surf_man->device_id)) {
         goto out_err;
     }
@@ -2453,6 +2425,7 @@ radeon_surface_manager_new(int fd)
 
     return surf_man;
 out_err:
+    pthread_mutex_destroy(&surf_man->cache_mutex);
     free(surf_man);
     return NULL;
 }
@@ -2460,6 +2433,10 @@ out_err:
 drm_public void
 radeon_surface_manager_free(struct radeon_surface_manager *surf_man)
 {
+    if (surf_man == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&surf_man->cache_mutex);
     free(surf_man);
 }
 
@@ -2531,10 +2508,27 @@ static int radeon_surface_sanity(struct radeon_surface_manager *surf_man,
     return 0;
 }
 
-drm_public int
-radeon_surface_init(struct radeon_surface_manager *surf_man,
-                    struct radeon_surface *surf)
+/* The computed surfaces depend only on the fields up to level, the
+ * others being filled by the allocator, so they are the key of the cache.
+ */
+static struct radeon_surface_cache_entry *
+radeon_surface_cache_entry(struct radeon_surface_manager *surf_man,
+                           const uint8_t *key)
 {
+    uint32_t hash = 2166136261u;
+    unsigned i;
+
+    for (i = 0; i < SURFACE_KEY_SIZE; i++) {
+        hash = (hash ^ key[i]) * 16777619u;
+    }
+    return &surf_man->cache[hash % SURFACE_CACHE_SIZE];
+}
+
+static int radeon_surface_compute(struct radeon_surface_manager *surf_man,
+                                  struct radeon_surface *surf, bool best)
+{
+    struct radeon_surface_cache_entry *entry;
+    uint8_t key[SURFACE_KEY_SIZE];
     unsigned mode, type;
     int r;
 
@@ -2545,22 +2539,62 @@ radeon_surface_init(struct radeon_surface_manager *surf_man,
     if (r) {
         return r;
     }
-    return surf_man->surface_init(surf_man, surf);
+
+    memcpy(key, surf, SURFACE_KEY_SIZE);
+    entry = radeon_surface_cache_entry(surf_man, key);
+    pthread_mutex_lock(&surf_man->cache_mutex);
+    if (entry->valid && entry->best == best &&
+        !memcmp(entry->key, key, SURFACE_KEY_SIZE)) {
+        *surf = entry->surf;
+        pthread_mutex_unlock(&surf_man->cache_mutex);
+        return 0;
+    }
+    pthread_mutex_unlock(&surf_man->cache_mutex);
+
+    if (best) {
+        r = surf_man->surface_best(surf_man, surf);
+    } else {
+        r = surf_man->surface_init(surf_man, surf);
+    }
+    if (r) {
+        return r;
+    }
+
+    pthread_mutex_lock(&surf_man->cache_mutex);
+    entry->valid = true;
+    entry->best = best;
+    memcpy(entry->key, key, SURFACE_KEY_SIZE);
+    entry->surf = *surf;
+    pthread_mutex_unlock(&surf_man->cache_mutex);
+    return 0;
+}
+
+drm_public int
+radeon_surface_init(struct radeon_surface_manager *surf_man,
+                    struct radeon_surface *surf)
+{
+    return radeon_surface_compute(surf_man, surf, false);
 }
 
 drm_public int
 radeon_surface_best(struct radeon_surface_manager *surf_man,
                     struct radeon_surface *surf)
 {
-    unsigned mode, type;
-    int r;
+    return radeon_surface_compute(surf_man, surf, true);
+}
 
-    type = RADEON_SURF_GET(surf->flags, TYPE);
-    mode = RADEON_SURF_GET(surf->flags, MODE);
+drm_public int
+radeon_surface_init_array(struct radeon_surface_manager *surf_man,
+                          struct radeon_surface *surfs, unsigned count)
+{
+    unsigned i;
+    int r;
 
-    r = radeon_surface_sanity(surf_man, surf, type, mode);
-    if (r) {
-        return r;
+    for (i = 0; i < count; i++) {
+        r = radeon_surface_compute(surf_man, &surfs[i], false);
+        if (r) {
+            return r;
+        }
     }
-    return surf_man->surface_best(surf_man, surf);
+    return 0;
 }
@@ -145,5 +145,10 @@ int radeon_surface_init(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf);
 int radeon_surface_best(struct radeon_surface_manager *surf_man,
                         struct radeon_surface *surf);
+/* Same as radeon_surface_init() on each of count surfaces, stopping at the
+ * first error.
+ */
+int radeon_surface_init_array(struct radeon_surface_manager *surf_man,
+                              struct radeon_surface *surfs, unsigned count);
 
 #endif
@@ -0,0 +1,315 @@
+/*
+ * Copyright © 2012, 2013 Thierry Reding
+ * Copyright © 2013 Erik Faye-Lund
+ * Copyright © 2014 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <xf86drm.h>
+
+#include "private.h"
+
+drm_public int drm_tegra_channel_open(struct drm_tegra_channel **channelp,
+				      struct drm_tegra *drm,
+				      enum drm_tegra_class client)
+{
+	struct drm_tegra_open_channel open;
+	struct drm_tegra_get_syncpt syncpt;
+	struct drm_tegra_close_channel close_args;
+	struct drm_tegra_syncpt_read read;
+	struct drm_tegra_channel *channel;
+	int err;
+
+	if (!drm || !channelp)
+		return -EINVAL;
+
+	memset(&open, 0, sizeof(open));
+
+	switch (client) {
+	case DRM_TEGRA_GR2D:
+		open.client = HOST1X_CLASS_GR2D;
+		break;
+
+	case DRM_TEGRA_GR3D:
+		open.client = HOST1X_CLASS_GR3D;
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	channel = calloc(1, sizeof(*channel));
+	if (!channel)
+		return -ENOMEM;
+
+	channel->drm = drm;
+	channel->client = client;
+	pthread_mutex_init(&channel->lock, NULL);
+
+	err = drmCommandWriteRead(drm->fd, DRM_TEGRA_OPEN_CHANNEL, &open,
+				  sizeof(open));
+	if (err < 0) {
+		err = -errno;
+		goto fail;
+	}
+
+	channel->context = open.context;
+
+	memset(&syncpt, 0, sizeof(syncpt));
+	syncpt.context = open.context;
+	syncpt.index = 0;
+
+	err = drmCommandWriteRead(drm->fd, DRM_TEGRA_GET_SYNCPT, &syncpt,
+				  sizeof(syncpt));
+	if (err < 0) {
+		err = -errno;
+		goto close_channel;
+	}
+
+	channel->syncpt = syncpt.id;
+
+	memset(&read, 0, sizeof(read));
+	read.id = syncpt.id;
+
+	err = drmCommandWriteRead(drm->fd, DRM_TEGRA_SYNCPT_READ, &read,
+				  sizeof(read));
+	if (err < 0) {
+		err = -errno;
+		goto close_channel;
+	}
+
+	channel->completed = read.value;
+
+	*channelp = channel;
+
+	return 0;
+
+close_channel:
+	memset(&close_args, 0, sizeof(close_args));
+	close_args.context = open.context;
+	drmCommandWriteRead(drm->fd, DRM_TEGRA_CLOSE_CHANNEL, &close_args,
+			    sizeof(close_args));
+fail:
+	pthread_mutex_destroy(&channel->lock);
+	free(channel);
+	return err;
+}
+
+drm_public int drm_tegra_channel_close(struct drm_tegra_channel *channel)
+{
+	struct drm_tegra_close_channel args;
+	struct drm_tegra *drm;
+	unsigned int i;
+	int err;
+
+	if (!channel)
+		return -EINVAL;
+
+	drm = channel->drm;
+
+	for (i = 0; i < channel->pool_count; i++)
+		drm_tegra_bo_unref(channel->pool[i].bo);
+
+	memset(&args, 0, sizeof(args));
+	args.context = channel->context;
+
+	err = drmCommandWriteRead(drm->fd, DRM_TEGRA_CLOSE_CHANNEL, &args,
+				  sizeof(args));
+	if (err < 0)
+		err = -errno;
+
+	pthread_mutex_destroy(&channel->lock);
+	free(channel);
+
+	return err;
+}
+
+/* Raise the value of the syncpoint last seen, never lowering it. */
+static void drm_tegra_channel_retire(struct drm_tegra_channel *channel,
+				     uint32_t value)
+{
+	uint32_t completed = __atomic_load_n(&channel->completed,
+					     __ATOMIC_ACQUIRE);
+
+	while (!drm_tegra_syncpt_passed(completed, value) &&
+	       !__atomic_compare_exchange_n(&channel->completed, &completed,
+					    value, false, __ATOMIC_RELEASE,
+					    __ATOMIC_ACQUIRE))
+		;
+}
+
+/*
+ * Whether the syncpoint of the channel reached value, reading it back
+ * only when the value last seen is behind.
+ */
+drm_private bool drm_tegra_channel_completed(struct drm_tegra_channel *channel,
+					     uint32_t value)
+{
+	struct drm_tegra_syncpt_read args;
+	int err;
+
+	if (drm_tegra_syncpt_passed(__atomic_load_n(&channel->completed,
+						    __ATOMIC_ACQUIRE), value))
+		return true;
+
+	memset(&args, 0, sizeof(args));
+	args.id = channel->syncpt;
+
+	err = drmCommandWriteRead(channel->drm->fd, DRM_TEGRA_SYNCPT_READ,
+				  &args, sizeof(args));
+	if (err < 0)
+		return false;
+
+	drm_tegra_channel_retire(channel, args.value);
+
+	return drm_tegra_syncpt_passed(args.value, value);
+}
+
+/*
+ * Take the oldest idle command buffer of the pool holding size bytes, or
+ * allocate one.  It comes mapped.
+ */
+drm_private int drm_tegra_channel_get_bo(struct drm_tegra_channel *channel,
+					 unsigned int size,
+					 struct drm_tegra_bo **bop)
+{
+	struct drm_tegra_bo *bo = NULL;
+	unsigned int i;
+	int err;
+
+	pthread_mutex_lock(&channel->lock);
+
+	for (i = 0; i < channel->pool_count; i++) {
+		struct drm_tegra_pool_entry *entry = &channel->pool[i];
+
+		if (entry->bo->size < size)
+			continue;
+
+		/* Younger entries are not idle if this one is not. */
+		if (!drm_tegra_channel_completed(channel, entry->fence))
+			break;
+
+		bo = entry->bo;
+		channel->pool_count--;
+		memmove(entry, entry + 1,
+			(channel->pool_count - i) * sizeof(*entry));
+		break;
+	}
+
+	pthread_mutex_unlock(&channel->lock);
+
+	if (!bo) {
+		err = drm_tegra_bo_new(&bo, channel->drm, 0, size);
+		if (err < 0)
+			return err;
+	}
+
+	err = drm_tegra_bo_map(bo, NULL);
+	if (err < 0) {
+		drm_tegra_bo_unref(bo);
+		return err;
+	}
+
+	*bop = bo;
+
+	return 0;
+}
+
+/*
+ * Give a command buffer back to the pool, idle once the syncpoint reaches
+ * fence.  The oldest one is dropped when the pool is full.
+ */
+drm_private void drm_tegra_channel_put_bo(struct drm_tegra_channel *channel,
+					  struct drm_tegra_bo *bo,
+					  uint32_t fence)
+{
+	struct drm_tegra_bo *drop = NULL;
+
+	pthread_mutex_lock(&channel->lock);
+
+	if (channel->pool_count == DRM_TEGRA_POOL_SIZE) {
+		drop = channel->pool[0].bo;
+		channel->pool_count--;
+		memmove(&channel->pool[0], &channel->pool[1],
+			channel->pool_count * sizeof(channel->pool[0]));
+	}
+
+	channel->pool[channel->pool_count].bo = bo;
+	channel->pool[channel->pool_count].fence = fence;
+	channel->pool_count++;
+
+	pthread_mutex_unlock(&channel->lock);
+
+	drm_tegra_bo_unref(drop);
+}
+
+drm_public int drm_tegra_fence_wait_timeout(struct drm_tegra_fence *fence,
+					    unsigned long timeout)
+{
+	struct drm_tegra_channel *channel;
+	struct drm_tegra_syncpt_wait args;
+	int err;
+
+	if (!fence)
+		return -EINVAL;
+
+	channel = fence->channel;
+
+	if (drm_tegra_syncpt_passed(__atomic_load_n(&channel->completed,
+						    __ATOMIC_ACQUIRE),
+				    fence->value))
+		return 0;
+
+	memset(&args, 0, sizeof(args));
+	args.id = channel->syncpt;
+	args.thresh = fence->value;
+	args.timeout = timeout == (unsigned long)-1 ? DRM_TEGRA_NO_TIMEOUT :
+		       (uint32_t)timeout;
+
+	err = drmCommandWriteRead(channel->drm->fd, DRM_TEGRA_SYNCPT_WAIT,
+				  &args, sizeof(args));
+	if (err < 0)
+		return -errno;
+
+	drm_tegra_channel_retire(channel, fence->value);
+
+	return 0;
+}
+
+drm_public int drm_tegra_fence_wait(struct drm_tegra_fence *fence)
+{
+	return drm_tegra_fence_wait_timeout(fence, -1);
+}
+
+drm_public int drm_tegra_fence_is_signaled(struct drm_tegra_fence *fence)
+{
+	if (!fence)
+		return -EINVAL;
+
+	return drm_tegra_channel_completed(fence->channel, fence->value);
+}
+
+drm_public void drm_tegra_fence_free(struct drm_tegra_fence *fence)
+{
+	free(fence);
+}
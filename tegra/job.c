@@ -0,0 +1,237 @@
+/*
+ * Copyright © 2012, 2013 Thierry Reding
+ * Copyright © 2013 Erik Faye-Lund
+ * Copyright © 2014 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <xf86drm.h>
+
+#include "private.h"
+
+/*
+ * Make room for one more element of an array grown by doubling.  Returns
+ * the array, or NULL leaving it untouched.
+ */
+static void *drm_tegra_grow(void *array, unsigned int num, unsigned int *max,
+			    size_t size)
+{
+	unsigned int count;
+	void *ptr;
+
+	if (num < *max)
+		return array;
+
+	count = *max ? *max * 2 : 8;
+	ptr = realloc(array, count * size);
+	if (!ptr)
+		return NULL;
+
+	*max = count;
+
+	return ptr;
+}
+
+drm_private int drm_tegra_job_add_bo(struct drm_tegra_job *job,
+				     struct drm_tegra_bo *bo)
+{
+	struct drm_tegra_bo **bos;
+
+	bos = drm_tegra_grow(job->bos, job->num_bos, &job->max_bos,
+			     sizeof(*bos));
+	if (!bos)
+		return -ENOMEM;
+
+	job->bos = bos;
+
+	job->bos[job->num_bos++] = bo;
+
+	return 0;
+}
+
+drm_private int drm_tegra_job_add_cmdbuf(struct drm_tegra_job *job,
+					 struct drm_tegra_bo *bo,
+					 uint32_t offset, uint32_t words)
+{
+	struct drm_tegra_cmdbuf *cmdbuf;
+
+	/* Extend the last range when it ends where this one starts. */
+	if (job->num_cmdbufs) {
+		cmdbuf = &job->cmdbufs[job->num_cmdbufs - 1];
+		if (cmdbuf->handle == bo->handle &&
+		    cmdbuf->offset + cmdbuf->words * 4 == offset) {
+			cmdbuf->words += words;
+			return 0;
+		}
+	}
+
+	cmdbuf = drm_tegra_grow(job->cmdbufs, job->num_cmdbufs,
+				&job->max_cmdbufs, sizeof(*cmdbuf));
+	if (!cmdbuf)
+		return -ENOMEM;
+
+	job->cmdbufs = cmdbuf;
+	cmdbuf = &job->cmdbufs[job->num_cmdbufs++];
+	memset(cmdbuf, 0, sizeof(*cmdbuf));
+	cmdbuf->handle = bo->handle;
+	cmdbuf->offset = offset;
+	cmdbuf->words = words;
+
+	return 0;
+}
+
+drm_private int drm_tegra_job_add_reloc(struct drm_tegra_job *job,
+					const struct drm_tegra_reloc *reloc)
+{
+	struct drm_tegra_reloc *relocs;
+
+	relocs = drm_tegra_grow(job->relocs, job->num_relocs,
+				&job->max_relocs, sizeof(*relocs));
+	if (!relocs)
+		return -ENOMEM;
+
+	job->relocs = relocs;
+
+	job->relocs[job->num_relocs++] = *reloc;
+
+	return 0;
+}
+
+drm_public int drm_tegra_job_new(struct drm_tegra_job **jobp,
+				 struct drm_tegra_channel *channel)
+{
+	struct drm_tegra_job *job;
+
+	if (!jobp || !channel)
+		return -EINVAL;
+
+	job = calloc(1, sizeof(*job));
+	if (!job)
+		return -ENOMEM;
+
+	job->channel = channel;
+
+	*jobp = job;
+
+	return 0;
+}
+
+/*
+ * The command buffers of the job go back to the pool of the channel, to be
+ * reused once the job completed.
+ */
+drm_public int drm_tegra_job_free(struct drm_tegra_job *job)
+{
+	struct drm_tegra_channel *channel;
+	uint32_t fence;
+	unsigned int i;
+
+	if (!job)
+		return -EINVAL;
+
+	channel = job->channel;
+
+	if (job->pushbuf)
+		drm_tegra_pushbuf_free(&job->pushbuf->base);
+
+	fence = job->submitted ? job->fence :
+		__atomic_load_n(&channel->completed, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < job->num_bos; i++)
+		drm_tegra_channel_put_bo(channel, job->bos[i], fence);
+
+	free(job->relocs);
+	free(job->cmdbufs);
+	free(job->bos);
+	free(job);
+
+	return 0;
+}
+
+/*
+ * Submit all the words of the pushbuf of the job, in a single ioctl however
+ * many command buffers they span.
+ */
+drm_public int drm_tegra_job_submit(struct drm_tegra_job *job,
+				    struct drm_tegra_fence **fencep)
+{
+	struct drm_tegra_channel *channel;
+	struct drm_tegra_fence *fence = NULL;
+	struct drm_tegra_submit args;
+	struct drm_tegra_syncpt syncpt;
+	int err;
+
+	if (!job || job->submitted)
+		return -EINVAL;
+
+	channel = job->channel;
+
+	if (job->pushbuf) {
+		err = drm_tegra_pushbuf_queue(job->pushbuf);
+		if (err < 0)
+			return err;
+	}
+
+	if (fencep) {
+		fence = calloc(1, sizeof(*fence));
+		if (!fence)
+			return -ENOMEM;
+	}
+
+	memset(&syncpt, 0, sizeof(syncpt));
+	syncpt.id = channel->syncpt;
+	syncpt.incrs = job->increments;
+
+	memset(&args, 0, sizeof(args));
+	args.context = channel->context;
+	args.num_syncpts = 1;
+	args.num_cmdbufs = job->num_cmdbufs;
+	args.num_relocs = job->num_relocs;
+	args.num_waitchks = 0;
+	args.waitchk_mask = 0;
+	args.timeout = 1000;
+
+	args.syncpts = (uintptr_t)&syncpt;
+	args.cmdbufs = (uintptr_t)job->cmdbufs;
+	args.relocs = (uintptr_t)job->relocs;
+	args.waitchks = 0;
+
+	err = drmCommandWriteRead(channel->drm->fd, DRM_TEGRA_SUBMIT, &args,
+				  sizeof(args));
+	if (err < 0) {
+		err = -errno;
+		free(fence);
+		return err;
+	}
+
+	job->submitted = true;
+	job->fence = args.fence;
+
+	if (fence) {
+		fence->channel = channel;
+		fence->value = args.fence;
+		*fencep = fence;
+	}
+
+	return 0;
+}
@@ -25,17 +25,31 @@
 #ifndef __DRM_TEGRA_PRIVATE_H__
 #define __DRM_TEGRA_PRIVATE_H__ 1
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 #include <libdrm_macros.h>
 #include <xf86atomic.h>
 
+#include <tegra_drm.h>
+
+#include "util_bo_cache.h"
+#include "util_handle_table.h"
+
 #include "tegra.h"
 
 struct drm_tegra {
 	bool close;
 	int fd;
+
+	/* Freed buffers, once enabled by drm_tegra_set_bo_cache(). */
+	bool bo_cache_enabled;
+	struct util_bo_cache bo_cache;
+
+	/* Live and cached buffers by handle, so that wrapping a handle twice
+	 * gives the same buffer. */
+	struct handle_table handles;
 };
 
 struct drm_tegra_bo {
@@ -46,6 +60,107 @@ struct drm_tegra_bo {
 	uint32_t size;
 	atomic_t ref;
 	void *map;
+
+	/* Created here with its flags and tiling untouched, so cacheable. */
+	bool reuse;
+	struct util_bo_cache_entry cache_entry;
+};
+
+#define HOST1X_CLASS_GR2D 0x51
+#define HOST1X_CLASS_GR3D 0x60
+
+#define HOST1X_OPCODE_NONINCR(offset, count) \
+	((0x2 << 28) | (((offset) & 0xfff) << 16) | ((count) & 0xffff))
+
+/* Command buffers of pushbufs, idle or waiting for their job. */
+#define DRM_TEGRA_POOL_SIZE 8
+/* Words of the command buffers allocated by pushbufs. */
+#define DRM_TEGRA_PUSHBUF_WORDS 1024
+
+struct drm_tegra_pool_entry {
+	struct drm_tegra_bo *bo;
+	/* Syncpoint value reached once the last job using it completed. */
+	uint32_t fence;
+};
+
+struct drm_tegra_channel {
+	struct drm_tegra *drm;
+	enum drm_tegra_class client;
+	uint64_t context;
+	uint32_t syncpt;
+
+	/* Highest value of the syncpoint seen, accessed atomically. */
+	uint32_t completed;
+
+	pthread_mutex_t lock;
+	/* Oldest first. */
+	struct drm_tegra_pool_entry pool[DRM_TEGRA_POOL_SIZE];
+	unsigned int pool_count;
+};
+
+struct drm_tegra_fence {
+	struct drm_tegra_channel *channel;
+	uint32_t value;
+};
+
+struct drm_tegra_pushbuf_private {
+	struct drm_tegra_pushbuf base;
+	struct drm_tegra_job *job;
+	struct drm_tegra_bo *bo;
+	/* Start of the words not queued to the job yet, and end of bo. */
+	uint32_t *start;
+	uint32_t *end;
+};
+
+static inline struct drm_tegra_pushbuf_private *
+drm_tegra_pushbuf(struct drm_tegra_pushbuf *pushbuf)
+{
+	return (struct drm_tegra_pushbuf_private *)pushbuf;
+}
+
+struct drm_tegra_job {
+	struct drm_tegra_channel *channel;
+	unsigned int increments;
+	bool submitted;
+	uint32_t fence;
+
+	struct drm_tegra_pushbuf_private *pushbuf;
+
+	/* Command buffers of the pushbuf, grown by doubling. */
+	struct drm_tegra_bo **bos;
+	unsigned int num_bos;
+	unsigned int max_bos;
+
+	struct drm_tegra_cmdbuf *cmdbufs;
+	unsigned int num_cmdbufs;
+	unsigned int max_cmdbufs;
+
+	struct drm_tegra_reloc *relocs;
+	unsigned int num_relocs;
+	unsigned int max_relocs;
 };
 
+/* Whether the syncpoint of the channel reached value, wrapping around. */
+static inline bool drm_tegra_syncpt_passed(uint32_t completed, uint32_t value)
+{
+	return (int32_t)(completed - value) >= 0;
+}
+
+drm_private bool drm_tegra_channel_completed(struct drm_tegra_channel *channel,
+					     uint32_t value);
+drm_private int drm_tegra_channel_get_bo(struct drm_tegra_channel *channel,
+					 unsigned int size,
+					 struct drm_tegra_bo **bop);
+drm_private void drm_tegra_channel_put_bo(struct drm_tegra_channel *channel,
+					  struct drm_tegra_bo *bo,
+					  uint32_t fence);
+drm_private int drm_tegra_job_add_cmdbuf(struct drm_tegra_job *job,
+					 struct drm_tegra_bo *bo,
+					 uint32_t offset, uint32_t words);
+drm_private int drm_tegra_job_add_bo(struct drm_tegra_job *job,
+				     struct drm_tegra_bo *bo);
+drm_private int drm_tegra_job_add_reloc(struct drm_tegra_job *job,
+					const struct drm_tegra_reloc *reloc);
+drm_private int drm_tegra_pushbuf_queue(struct drm_tegra_pushbuf_private *pushbuf);
+
 #endif /* __DRM_TEGRA_PRIVATE_H__ */
@@ -0,0 +1,195 @@
+/*
+ * Copyright © 2012, 2013 Thierry Reding
+ * Copyright © 2013 Erik Faye-Lund
+ * Copyright © 2014 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "private.h"
+
+/* Queue the words written since the last time to the job. */
+drm_private int drm_tegra_pushbuf_queue(struct drm_tegra_pushbuf_private *pushbuf)
+{
+	uint32_t *map;
+	int err;
+
+	if (!pushbuf->bo || pushbuf->base.ptr == pushbuf->start)
+		return 0;
+
+	map = pushbuf->bo->map;
+	err = drm_tegra_job_add_cmdbuf(pushbuf->job, pushbuf->bo,
+				       (pushbuf->start - map) * 4,
+				       pushbuf->base.ptr - pushbuf->start);
+	if (err < 0)
+		return err;
+
+	pushbuf->start = pushbuf->base.ptr;
+
+	return 0;
+}
+
+drm_public int drm_tegra_pushbuf_new(struct drm_tegra_pushbuf **pushbufp,
+				     struct drm_tegra_job *job)
+{
+	struct drm_tegra_pushbuf_private *pushbuf;
+
+	if (!pushbufp || !job)
+		return -EINVAL;
+
+	if (job->pushbuf)
+		return -EBUSY;
+
+	pushbuf = calloc(1, sizeof(*pushbuf));
+	if (!pushbuf)
+		return -ENOMEM;
+
+	pushbuf->job = job;
+	job->pushbuf = pushbuf;
+
+	*pushbufp = &pushbuf->base;
+
+	return 0;
+}
+
+/* The words written stay queued to the job. */
+drm_public int drm_tegra_pushbuf_free(struct drm_tegra_pushbuf *pushbuf)
+{
+	struct drm_tegra_pushbuf_private *priv;
+	int err;
+
+	if (!pushbuf)
+		return -EINVAL;
+
+	priv = drm_tegra_pushbuf(pushbuf);
+	err = drm_tegra_pushbuf_queue(priv);
+
+	priv->job->pushbuf = NULL;
+	free(priv);
+
+	return err;
+}
+
+/*
+ * Make room for words more words.  When the command buffer is full, the
+ * words written go to the job and the next ones to another command buffer
+ * from the pool of the channel.
+ */
+drm_public int drm_tegra_pushbuf_prepare(struct drm_tegra_pushbuf *pushbuf,
+					 unsigned int words)
+{
+	struct drm_tegra_pushbuf_private *priv;
+	struct drm_tegra_bo *bo;
+	unsigned int size;
+	int err;
+
+	if (!pushbuf)
+		return -EINVAL;
+
+	priv = drm_tegra_pushbuf(pushbuf);
+
+	if (priv->bo && words <= (unsigned int)(priv->end - pushbuf->ptr))
+		return 0;
+
+	err = drm_tegra_pushbuf_queue(priv);
+	if (err < 0)
+		return err;
+
+	size = (words > DRM_TEGRA_PUSHBUF_WORDS ? words :
+		DRM_TEGRA_PUSHBUF_WORDS) * 4;
+	size = (size + 4095) & ~4095;
+
+	err = drm_tegra_channel_get_bo(priv->job->channel, size, &bo);
+	if (err < 0)
+		return err;
+
+	err = drm_tegra_job_add_bo(priv->job, bo);
+	if (err < 0) {
+		drm_tegra_bo_unref(bo);
+		return err;
+	}
+
+	priv->bo = bo;
+	priv->start = pushbuf->ptr = bo->map;
+	priv->end = priv->start + bo->size / 4;
+
+	return 0;
+}
+
+/*
+ * Write the placeholder of the address of target, at offset bytes and
+ * shifted right by shift bits, for the kernel to patch in the job.
+ */
+drm_public int drm_tegra_pushbuf_relocate(struct drm_tegra_pushbuf *pushbuf,
+					  struct drm_tegra_bo *target,
+					  unsigned long offset,
+					  unsigned long shift)
+{
+	struct drm_tegra_pushbuf_private *priv;
+	struct drm_tegra_reloc reloc;
+	int err;
+
+	if (!pushbuf || !target)
+		return -EINVAL;
+
+	priv = drm_tegra_pushbuf(pushbuf);
+	if (!priv->bo || pushbuf->ptr >= priv->end)
+		return -ENOSPC;
+
+	memset(&reloc, 0, sizeof(reloc));
+	reloc.cmdbuf.handle = priv->bo->handle;
+	reloc.cmdbuf.offset = (pushbuf->ptr - (uint32_t *)priv->bo->map) * 4;
+	reloc.target.handle = target->handle;
+	reloc.target.offset = offset;
+	reloc.shift = shift;
+
+	err = drm_tegra_job_add_reloc(priv->job, &reloc);
+	if (err < 0)
+		return err;
+
+	*pushbuf->ptr++ = 0xdeadbeef;
+
+	return 0;
+}
+
+/* Increment the syncpoint of the job when cond is met. */
+drm_public int drm_tegra_pushbuf_sync(struct drm_tegra_pushbuf *pushbuf,
+				      enum drm_tegra_syncpt_cond cond)
+{
+	struct drm_tegra_pushbuf_private *priv;
+	int err;
+
+	if (!pushbuf || cond >= DRM_TEGRA_SYNCPT_COND_MAX)
+		return -EINVAL;
+
+	err = drm_tegra_pushbuf_prepare(pushbuf, 2);
+	if (err < 0)
+		return err;
+
+	priv = drm_tegra_pushbuf(pushbuf);
+
+	*pushbuf->ptr++ = HOST1X_OPCODE_NONINCR(0x0, 0x1);
+	*pushbuf->ptr++ = cond << 8 | priv->job->channel->syncpt;
+	priv->job->increments++;
+
+	return 0;
+}
@@ -24,6 +24,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -35,6 +36,10 @@
 
 #include "private.h"
 
+/* Protects the buffer caches and handle tables. */
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Called under table_lock */
 static void drm_tegra_bo_free(struct drm_tegra_bo *bo)
 {
 	struct drm_tegra *drm = bo->drm;
@@ -43,6 +48,8 @@ static void drm_tegra_bo_free(struct drm_tegra_bo *bo)
 	if (bo->map)
 		munmap(bo->map, bo->size);
 
+	handle_table_remove(&drm->handles, bo->handle);
+
 	memset(&args, 0, sizeof(args));
 	args.handle = bo->handle;
 
@@ -51,6 +58,78 @@ static void drm_tegra_bo_free(struct drm_tegra_bo *bo)
 	free(bo);
 }
 
+/* Frees older cached buffers.  Called under table_lock */
+static void drm_tegra_bo_cache_cleanup(struct drm_tegra *drm, uint64_t now)
+{
+	struct util_bo_cache_entry *entry;
+
+	while ((entry = util_bo_cache_evict(&drm->bo_cache, now)))
+		drm_tegra_bo_free(LIST_ENTRY(struct drm_tegra_bo, entry,
+					     cache_entry));
+}
+
+/*
+ * Takes the oldest cached buffer of the bucket of the size with the same
+ * flags, keeping its handle, mmap offset and mapping.  Rounds the size up
+ * to the one of the bucket.
+ */
+static struct drm_tegra_bo *
+drm_tegra_bo_cache_alloc(struct drm_tegra *drm, uint32_t *size,
+			 uint32_t flags)
+{
+	struct util_bo_cache_bucket *bucket;
+	struct drm_tegra_bo *bo;
+
+	if (!drm->bo_cache_enabled)
+		return NULL;
+
+	pthread_mutex_lock(&table_lock);
+
+	bucket = util_bo_cache_get_bucket(&drm->bo_cache, *size);
+	if (!bucket) {
+		pthread_mutex_unlock(&table_lock);
+		return NULL;
+	}
+	*size = bucket->size;
+
+	LIST_FOR_EACH_ENTRY(bo, &bucket->list, cache_entry.bucket_link) {
+		if (bo->flags == flags) {
+			util_bo_cache_take(&bo->cache_entry);
+			pthread_mutex_unlock(&table_lock);
+			atomic_set(&bo->ref, 1);
+			return bo;
+		}
+	}
+
+	util_bo_cache_miss(&drm->bo_cache);
+	pthread_mutex_unlock(&table_lock);
+
+	return NULL;
+}
+
+/* Returns false when the buffer is not cacheable. Called under
+ * table_lock */
+static bool drm_tegra_bo_cache_free(struct drm_tegra_bo *bo)
+{
+	struct drm_tegra *drm = bo->drm;
+	struct util_bo_cache_bucket *bucket;
+	uint64_t now;
+
+	if (!bo->reuse)
+		return false;
+
+	/* unless the buckets changed since the bo was allocated: */
+	bucket = util_bo_cache_get_bucket(&drm->bo_cache, bo->size);
+	if (!drm->bo_cache_enabled || !bucket || bucket->size != bo->size)
+		return false;
+
+	now = util_bo_cache_now();
+	util_bo_cache_add(&drm->bo_cache, bucket, &bo->cache_entry, now);
+	drm_tegra_bo_cache_cleanup(drm, now);
+
+	return true;
+}
+
 static int drm_tegra_wrap(struct drm_tegra **drmp, int fd, bool close)
 {
 	struct drm_tegra *drm;
@@ -95,12 +174,73 @@ drm_public void drm_tegra_close(struct drm_tegra *drm)
 	if (!drm)
 		return;
 
+	pthread_mutex_lock(&table_lock);
+	drm_tegra_bo_cache_cleanup(drm, UTIL_BO_CACHE_PURGE);
+	handle_table_fini(&drm->handles);
+	pthread_mutex_unlock(&table_lock);
+
 	if (drm->close)
 		close(drm->fd);
 
 	free(drm);
 }
 
+/* Changing the buckets needs an empty cache, so the cached buffers are
+ * dropped, as are the statistics. */
+drm_public int drm_tegra_set_bo_cache(struct drm_tegra *drm,
+				      unsigned bucket_shift,
+				      uint64_t max_size, uint64_t max_bytes,
+				      uint32_t max_age_ms)
+{
+	if (!drm)
+		return -EINVAL;
+
+	pthread_mutex_lock(&table_lock);
+	drm_tegra_bo_cache_cleanup(drm, UTIL_BO_CACHE_PURGE);
+	util_bo_cache_init(&drm->bo_cache, bucket_shift, max_size, max_bytes,
+			   max_age_ms * 1000000ull);
+	drm->bo_cache_enabled = max_size != 0;
+	pthread_mutex_unlock(&table_lock);
+
+	return 0;
+}
+
+drm_public int drm_tegra_get_bo_cache_stats(struct drm_tegra *drm,
+					    uint64_t *hits, uint64_t *misses,
+					    uint64_t *evictions)
+{
+	if (!drm)
+		return -EINVAL;
+
+	pthread_mutex_lock(&table_lock);
+	if (hits)
+		*hits = drm->bo_cache.stats.hits;
+	if (misses)
+		*misses = drm->bo_cache.stats.misses;
+	if (evictions)
+		*evictions = drm->bo_cache.stats.evictions;
+	pthread_mutex_unlock(&table_lock);
+
+	return 0;
+}
+
+drm_public void drm_tegra_trim_bo_cache(struct drm_tegra *drm, unsigned level)
+{
+	uint64_t bytes, now;
+	struct util_bo_cache_entry *entry;
+
+	if (!drm)
+		return;
+
+	pthread_mutex_lock(&table_lock);
+	bytes = util_bo_cache_trim_bytes(&drm->bo_cache, level);
+	now = util_bo_cache_now();
+	while ((entry = util_bo_cache_evict_to(&drm->bo_cache, now, bytes)))
+		drm_tegra_bo_free(LIST_ENTRY(struct drm_tegra_bo, entry,
+					     cache_entry));
+	pthread_mutex_unlock(&table_lock);
+}
+
 drm_public int drm_tegra_bo_new(struct drm_tegra_bo **bop, struct drm_tegra *drm,
 		     uint32_t flags, uint32_t size)
 {
@@ -111,6 +251,12 @@ drm_public int drm_tegra_bo_new(struct drm_tegra_bo **bop, struct drm_tegra *drm
 	if (!drm || size == 0 || !bop)
 		return -EINVAL;
 
+	bo = drm_tegra_bo_cache_alloc(drm, &size, flags);
+	if (bo) {
+		*bop = bo;
+		return 0;
+	}
+
 	bo = calloc(1, sizeof(*bo));
 	if (!bo)
 		return -ENOMEM;
@@ -119,6 +265,8 @@ drm_public int drm_tegra_bo_new(struct drm_tegra_bo **bop, struct drm_tegra *drm
 	bo->flags = flags;
 	bo->size = size;
 	bo->drm = drm;
+	bo->reuse = true;
+	util_bo_cache_entry_init(&bo->cache_entry);
 
 	memset(&args, 0, sizeof(args));
 	args.flags = flags;
@@ -134,6 +282,17 @@ drm_public int drm_tegra_bo_new(struct drm_tegra_bo **bop, struct drm_tegra *drm
 
 	bo->handle = args.handle;
 
+	pthread_mutex_lock(&table_lock);
+	err = handle_table_insert(&drm->handles, bo->handle, bo);
+	pthread_mutex_unlock(&table_lock);
+	if (err < 0) {
+		struct drm_gem_close close_args = { .handle = bo->handle };
+
+		drmIoctl(drm->fd, DRM_IOCTL_GEM_CLOSE, &close_args);
+		free(bo);
+		return err;
+	}
+
 	*bop = bo;
 
 	return 0;
@@ -147,15 +306,36 @@ drm_public int drm_tegra_bo_wrap(struct drm_tegra_bo **bop, struct drm_tegra *dr
 	if (!drm || !bop)
 		return -EINVAL;
 
+	pthread_mutex_lock(&table_lock);
+
+	/* the handle may already have a buffer, live or cached: */
+	bo = handle_table_lookup(&drm->handles, handle);
+	if (bo) {
+		util_bo_cache_remove(&bo->cache_entry);
+		atomic_inc(&bo->ref);
+		goto out;
+	}
+
 	bo = calloc(1, sizeof(*bo));
 	if (!bo)
-		return -ENOMEM;
+		goto out;
 
 	atomic_set(&bo->ref, 1);
 	bo->handle = handle;
 	bo->flags = flags;
 	bo->size = size;
 	bo->drm = drm;
+	util_bo_cache_entry_init(&bo->cache_entry);
+
+	if (handle_table_insert(&drm->handles, handle, bo)) {
+		free(bo);
+		bo = NULL;
+	}
+
+out:
+	pthread_mutex_unlock(&table_lock);
+	if (!bo)
+		return -ENOMEM;
 
 	*bop = bo;
 
@@ -172,8 +352,14 @@ drm_public struct drm_tegra_bo *drm_tegra_bo_ref(struct drm_tegra_bo *bo)
 
 drm_public void drm_tegra_bo_unref(struct drm_tegra_bo *bo)
 {
-	if (bo && atomic_dec_and_test(&bo->ref))
+	if (!bo || !atomic_dec_and_test(&bo->ref))
+		return;
+
+	pthread_mutex_lock(&table_lock);
+	/* unless drm_tegra_bo_wrap() found it again meanwhile: */
+	if (atomic_read(&bo->ref) == 0 && !drm_tegra_bo_cache_free(bo))
 		drm_tegra_bo_free(bo);
+	pthread_mutex_unlock(&table_lock);
 }
 
 drm_public int drm_tegra_bo_get_handle(struct drm_tegra_bo *bo, uint32_t *handle)
@@ -191,18 +377,21 @@ drm_public int drm_tegra_bo_map(struct drm_tegra_bo *bo, void **ptr)
 	struct drm_tegra *drm = bo->drm;
 
 	if (!bo->map) {
-		struct drm_tegra_gem_mmap args;
-		int err;
+		/* The fake offset stays valid after an unmap. */
+		if (!bo->offset) {
+			struct drm_tegra_gem_mmap args;
+			int err;
 
-		memset(&args, 0, sizeof(args));
-		args.handle = bo->handle;
+			memset(&args, 0, sizeof(args));
+			args.handle = bo->handle;
 
-		err = drmCommandWriteRead(drm->fd, DRM_TEGRA_GEM_MMAP, &args,
-					  sizeof(args));
-		if (err < 0)
-			return -errno;
+			err = drmCommandWriteRead(drm->fd, DRM_TEGRA_GEM_MMAP,
+						  &args, sizeof(args));
+			if (err < 0)
+				return -errno;
 
-		bo->offset = args.offset;
+			bo->offset = args.offset;
+		}
 
 		bo->map = mmap(0, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED,
 			       drm->fd, bo->offset);
@@ -275,6 +464,8 @@ drm_public int drm_tegra_bo_set_flags(struct drm_tegra_bo *bo, uint32_t flags)
 	if (err < 0)
 		return -errno;
 
+	bo->reuse = false;
+
 	return 0;
 }
 
@@ -324,5 +515,7 @@ drm_public int drm_tegra_bo_set_tiling(struct drm_tegra_bo *bo,
 	if (err < 0)
 		return -errno;
 
+	bo->reuse = false;
+
 	return 0;
 }
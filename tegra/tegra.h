@@ -30,10 +30,52 @@
 
 struct drm_tegra_bo;
 struct drm_tegra;
+struct drm_tegra_channel;
+struct drm_tegra_job;
+struct drm_tegra_fence;
+
+enum drm_tegra_class {
+	DRM_TEGRA_GR2D,
+	DRM_TEGRA_GR3D,
+};
+
+enum drm_tegra_syncpt_cond {
+	DRM_TEGRA_SYNCPT_COND_IMMEDIATE,
+	DRM_TEGRA_SYNCPT_COND_OP_DONE,
+	DRM_TEGRA_SYNCPT_COND_RD_DONE,
+	DRM_TEGRA_SYNCPT_COND_WR_SAFE,
+	DRM_TEGRA_SYNCPT_COND_MAX,
+};
+
+/* Words are written at ptr, after drm_tegra_pushbuf_prepare() made room. */
+struct drm_tegra_pushbuf {
+	uint32_t *ptr;
+};
 
 int drm_tegra_new(struct drm_tegra **drmp, int fd);
 void drm_tegra_close(struct drm_tegra *drm);
 
+/*
+ * Buffers freed to the cache go in 2^bucket_shift buckets per power of two
+ * up to max_size, and stay there for max_age_ms, or until the cache holds
+ * more than max_bytes (0 for no limit).  A max_size of 0 disables the
+ * cache, which is the default.  The cached buffers are dropped.
+ *
+ * The kernel cannot tell whether a buffer is still used by a job, so once
+ * the cache is enabled, buffers must only be freed after the jobs using
+ * them have completed.
+ */
+int drm_tegra_set_bo_cache(struct drm_tegra *drm, unsigned bucket_shift,
+			   uint64_t max_size, uint64_t max_bytes,
+			   uint32_t max_age_ms);
+int drm_tegra_get_bo_cache_stats(struct drm_tegra *drm, uint64_t *hits,
+				 uint64_t *misses, uint64_t *evictions);
+/*
+ * Frees the cached buffers past their age, and the oldest others until
+ * level percent of the cached memory is released, 100 empties the cache.
+ */
+void drm_tegra_trim_bo_cache(struct drm_tegra *drm, unsigned level);
+
 int drm_tegra_bo_new(struct drm_tegra_bo **bop, struct drm_tegra *drm,
 		     uint32_t flags, uint32_t size);
 int drm_tegra_bo_wrap(struct drm_tegra_bo **bop, struct drm_tegra *drm,
@@ -57,4 +99,61 @@ int drm_tegra_bo_get_tiling(struct drm_tegra_bo *bo,
 int drm_tegra_bo_set_tiling(struct drm_tegra_bo *bo,
 			    const struct drm_tegra_bo_tiling *tiling);
 
+/*
+ * CPU access to tiled surfaces, such as the mapping of a buffer: copies of
+ * a rectangle between the surface in the layout of a tiling and linear
+ * memory.  x and width are in bytes, the pitch of a tiled surface is a
+ * multiple of its tiles or GOBs.  Copies of disjoint line ranges of a
+ * surface may run concurrently, to split a large surface across threads.
+ */
+int drm_tegra_tiling_from_modifier(uint64_t modifier,
+				   struct drm_tegra_bo_tiling *tiling);
+int drm_tegra_tile(void *tiled, unsigned int tiled_pitch,
+		   const struct drm_tegra_bo_tiling *tiling,
+		   const void *linear, unsigned int linear_pitch,
+		   unsigned int x, unsigned int y, unsigned int width,
+		   unsigned int height);
+int drm_tegra_detile(void *linear, unsigned int linear_pitch,
+		     const void *tiled, unsigned int tiled_pitch,
+		     const struct drm_tegra_bo_tiling *tiling,
+		     unsigned int x, unsigned int y, unsigned int width,
+		     unsigned int height);
+
+/*
+ * A channel runs the jobs of a host1x client, which increment its
+ * syncpoint.  A job is built with a pushbuf, its command buffers coming
+ * from a pool of the channel, and submitted as one ioctl.  The fence of
+ * a job checks the value of the syncpoint the channel last saw before
+ * asking the kernel, and must not outlive the channel.
+ */
+int drm_tegra_channel_open(struct drm_tegra_channel **channelp,
+			   struct drm_tegra *drm,
+			   enum drm_tegra_class client);
+int drm_tegra_channel_close(struct drm_tegra_channel *channel);
+
+int drm_tegra_job_new(struct drm_tegra_job **jobp,
+		      struct drm_tegra_channel *channel);
+int drm_tegra_job_free(struct drm_tegra_job *job);
+int drm_tegra_job_submit(struct drm_tegra_job *job,
+			 struct drm_tegra_fence **fencep);
+
+int drm_tegra_pushbuf_new(struct drm_tegra_pushbuf **pushbufp,
+			  struct drm_tegra_job *job);
+int drm_tegra_pushbuf_free(struct drm_tegra_pushbuf *pushbuf);
+int drm_tegra_pushbuf_prepare(struct drm_tegra_pushbuf *pushbuf,
+			      unsigned int words);
+int drm_tegra_pushbuf_relocate(struct drm_tegra_pushbuf *pushbuf,
+			       struct drm_tegra_bo *target,
+			       unsigned long offset,
+			       unsigned long shift);
+int drm_tegra_pushbuf_sync(struct drm_tegra_pushbuf *pushbuf,
+			   enum drm_tegra_syncpt_cond cond);
+
+/* timeout in milliseconds, or -1 for none */
+int drm_tegra_fence_wait_timeout(struct drm_tegra_fence *fence,
+				 unsigned long timeout);
+int drm_tegra_fence_wait(struct drm_tegra_fence *fence);
+int drm_tegra_fence_is_signaled(struct drm_tegra_fence *fence);
+void drm_tegra_fence_free(struct drm_tegra_fence *fence);
+
 #endif /* __DRM_TEGRA_H__ */
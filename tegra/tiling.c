@@ -0,0 +1,255 @@
+/*
+ * Copyright © 2014 NVIDIA Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <drm_fourcc.h>
+
+#include "private.h"
+
+/*
+ * Both tiled layouts keep 16 bytes of a line together: the lines of the
+ * 16x16 byte tiles, and the lines of the 16 byte x 2 line sectors of the
+ * 64x8 byte GOBs of block linear, laid in a Z shape.  So a line of a
+ * rectangle is copied 16 bytes at a time, which the compilers turn into
+ * single NEON or SSE moves, each from an offset that is the sum of one
+ * for the line and one for the column.
+ */
+#define TILE_BYTES 16
+#define GOB_WIDTH 64
+#define GOB_HEIGHT 8
+#define GOB_SIZE (GOB_WIDTH * GOB_HEIGHT)
+
+struct drm_tegra_tiled {
+	uint8_t *ptr;
+	unsigned int pitch;
+	uint32_t mode;
+	/* log2 of the GOBs in a block */
+	uint32_t block_height;
+};
+
+static size_t line_offset(const struct drm_tegra_tiled *t, unsigned int y)
+{
+	size_t block_size, block_lines;
+
+	switch (t->mode) {
+	case DRM_TEGRA_GEM_TILING_MODE_TILED:
+		return (size_t)(y / TILE_BYTES) * t->pitch * TILE_BYTES +
+		       (y % TILE_BYTES) * TILE_BYTES;
+
+	case DRM_TEGRA_GEM_TILING_MODE_BLOCK:
+		block_size = (size_t)GOB_SIZE << t->block_height;
+		block_lines = GOB_HEIGHT << t->block_height;
+
+		return y / block_lines * (t->pitch / GOB_WIDTH) * block_size +
+		       (y % block_lines / GOB_HEIGHT) * GOB_SIZE +
+		       (y % GOB_HEIGHT / 2) * 64 + (y % 2) * 16;
+
+	default:
+		return (size_t)y * t->pitch;
+	}
+}
+
+static size_t column_offset(const struct drm_tegra_tiled *t, unsigned int x)
+{
+	switch (t->mode) {
+	case DRM_TEGRA_GEM_TILING_MODE_TILED:
+		return (size_t)(x / TILE_BYTES) * TILE_BYTES * TILE_BYTES +
+		       x % TILE_BYTES;
+
+	case DRM_TEGRA_GEM_TILING_MODE_BLOCK:
+		return (size_t)(x / GOB_WIDTH) * (GOB_SIZE << t->block_height) +
+		       (x % GOB_WIDTH / 32) * 256 + (x % 32 / 16) * 32 + x % 16;
+
+	default:
+		return x;
+	}
+}
+
+static int drm_tegra_tiled_init(struct drm_tegra_tiled *t, void *ptr,
+				unsigned int pitch,
+				const struct drm_tegra_bo_tiling *tiling,
+				unsigned int x, unsigned int width)
+{
+	unsigned int align;
+
+	if (!ptr || !tiling)
+		return -EINVAL;
+
+	switch (tiling->mode) {
+	case DRM_TEGRA_GEM_TILING_MODE_PITCH:
+		align = 1;
+		break;
+
+	case DRM_TEGRA_GEM_TILING_MODE_TILED:
+		align = TILE_BYTES;
+		break;
+
+	case DRM_TEGRA_GEM_TILING_MODE_BLOCK:
+		if (tiling->value > 5)
+			return -EINVAL;
+
+		align = GOB_WIDTH;
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	if (pitch % align || x > pitch || width > pitch - x)
+		return -EINVAL;
+
+	t->ptr = ptr;
+	t->pitch = pitch;
+	t->mode = tiling->mode;
+	t->block_height = tiling->value;
+
+	return 0;
+}
+
+static void drm_tegra_tiled_copy(const struct drm_tegra_tiled *t,
+				 uint8_t *linear, unsigned int linear_pitch,
+				 unsigned int x, unsigned int y,
+				 unsigned int width, unsigned int height,
+				 bool to_tiled)
+{
+	unsigned int line, i, n;
+
+	for (line = y; line < y + height; line++) {
+		uint8_t *tiled = t->ptr + line_offset(t, line);
+
+		if (t->mode == DRM_TEGRA_GEM_TILING_MODE_PITCH) {
+			if (to_tiled)
+				memcpy(tiled + x, linear, width);
+			else
+				memcpy(linear, tiled + x, width);
+
+			linear += linear_pitch;
+			continue;
+		}
+
+		for (i = x; i < x + width; i += n) {
+			uint8_t *chunk = tiled + column_offset(t, i);
+			uint8_t *l = linear + (i - x);
+
+			n = TILE_BYTES - i % TILE_BYTES;
+			if (n > x + width - i)
+				n = x + width - i;
+
+			/* the constant size gets the vector moves */
+			if (n == TILE_BYTES) {
+				if (to_tiled)
+					memcpy(chunk, l, TILE_BYTES);
+				else
+					memcpy(l, chunk, TILE_BYTES);
+			} else {
+				if (to_tiled)
+					memcpy(chunk, l, n);
+				else
+					memcpy(l, chunk, n);
+			}
+		}
+
+		linear += linear_pitch;
+	}
+}
+
+drm_public int drm_tegra_tiling_from_modifier(uint64_t modifier,
+				struct drm_tegra_bo_tiling *tiling)
+{
+	uint64_t value = modifier & (((uint64_t)1 << 56) - 1);
+
+	if (!tiling)
+		return -EINVAL;
+
+	if (modifier == DRM_FORMAT_MOD_LINEAR) {
+		tiling->mode = DRM_TEGRA_GEM_TILING_MODE_PITCH;
+		tiling->value = 0;
+		return 0;
+	}
+
+	if (modifier == DRM_FORMAT_MOD_NVIDIA_TEGRA_TILED) {
+		tiling->mode = DRM_TEGRA_GEM_TILING_MODE_TILED;
+		tiling->value = 0;
+		return 0;
+	}
+
+	/*
+	 * Block linear with the GOBs and sectors of Tegra, uncompressed, of
+	 * any page kind, which are the 16Bx2 modifiers once canonicalized.
+	 */
+	if (modifier >> 56 == DRM_FORMAT_MOD_VENDOR_NVIDIA &&
+	    (value & 0x10) && !(value & ~(uint64_t)(0x1f | 0xff << 12)) &&
+	    (value & 0xf) <= 5) {
+		tiling->mode = DRM_TEGRA_GEM_TILING_MODE_BLOCK;
+		tiling->value = value & 0xf;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+drm_public int drm_tegra_tile(void *tiled, unsigned int tiled_pitch,
+			      const struct drm_tegra_bo_tiling *tiling,
+			      const void *linear, unsigned int linear_pitch,
+			      unsigned int x, unsigned int y,
+			      unsigned int width, unsigned int height)
+{
+	struct drm_tegra_tiled t;
+	int err;
+
+	if (!linear)
+		return -EINVAL;
+
+	err = drm_tegra_tiled_init(&t, tiled, tiled_pitch, tiling, x, width);
+	if (err < 0)
+		return err;
+
+	drm_tegra_tiled_copy(&t, (uint8_t *)linear, linear_pitch, x, y, width,
+			     height, true);
+
+	return 0;
+}
+
+drm_public int drm_tegra_detile(void *linear, unsigned int linear_pitch,
+				const void *tiled, unsigned int tiled_pitch,
+				const struct drm_tegra_bo_tiling *tiling,
+				unsigned int x, unsigned int y,
+				unsigned int width, unsigned int height)
+{
+	struct drm_tegra_tiled t;
+	int err;
+
+	if (!linear)
+		return -EINVAL;
+
+	err = drm_tegra_tiled_init(&t, (void *)tiled, tiled_pitch, tiling, x,
+				   width);
+	if (err < 0)
+		return err;
+
+	drm_tegra_tiled_copy(&t, linear, linear_pitch, x, y, width, height,
+			     false);
+
+	return 0;
+}
@@ -0,0 +1,1691 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/*
+ * Microbenchmarks of libdrm_amdgpu, printing JSON for the results to be
+ * compared between libdrm versions. Each benchmark runs its loop on a
+ * number of threads sharing the device, and reports the operations done
+ * by all threads over the wall time. The syncobj wake and priority
+ * benchmarks report the distribution of their latency instead, and the
+ * video decode benchmark both.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "util_math.h"
+#include "xf86drm.h"
+
+#include "decode_messages.h"
+
+#define BENCH_MAX_THREADS	64
+
+#define GFX_COMPUTE_NOP		0xffff1000
+#define GFX_COMPUTE_NOP_SI	0x80000000
+
+#define PACKET3(op, n)		((3u << 30) | (((op) & 0xff) << 8) | \
+				 (((n) & 0x3fff) << 16))
+#define PACKET3_WAIT_REG_MEM	0x3c
+#define PACKET3_WRITE_DATA	0x37
+#define SDMA_OP_WRITE		2
+#define SDMA_OP_POLL_REGMEM	8
+
+static amdgpu_device_handle device_handle;
+/* The fd given to the device, of the same DRM file as its syncobjs. */
+static int device_fd;
+static struct amdgpu_gpu_info gpu_info;
+static unsigned num_threads = 1;
+static unsigned iterations = 1000;
+static const char *filter;
+static bool first_result = true;
+
+/* What a benchmark loop is given on each thread. */
+struct bench_thread {
+	pthread_t thread;
+	unsigned index;
+	void *(*func)(struct bench_thread *t);
+	void *arg;
+	/* Operations done, and the first error. */
+	uint64_t ops;
+	int r;
+};
+
+static pthread_barrier_t start_barrier;
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *bench_thread_main(void *data)
+{
+	struct bench_thread *t = data;
+
+	pthread_barrier_wait(&start_barrier);
+	return t->func(t);
+}
+
+static bool bench_enabled(const char *name)
+{
+	return !filter || strstr(name, filter);
+}
+
+static void bench_report(const char *name, const char *params, uint64_t ops,
+			 uint64_t ns, int r)
+{
+	printf("%s\n    {\"name\": \"%s\"%s%s, \"threads\": %u, ",
+	       first_result ? "" : ",", name, params ? ", " : "",
+	       params ? params : "", num_threads);
+	if (r)
+		printf("\"error\": %d}", r);
+	else
+		printf("\"ops\": %" PRIu64 ", \"ns\": %" PRIu64 ", "
+		       "\"ns_per_op\": %.1f, \"ops_per_sec\": %.0f}",
+		       ops, ns, ops ? (double)ns / ops : 0.0,
+		       ns ? ops * 1e9 / ns : 0.0);
+	first_result = false;
+	fflush(stdout);
+}
+
+/* Run func on every thread and report the total. */
+static void bench_run(const char *name, const char *params,
+		      void *(*func)(struct bench_thread *t), void *arg)
+{
+	struct bench_thread threads[BENCH_MAX_THREADS];
+	uint64_t start, ops = 0;
+	unsigned i;
+	int r = 0;
+
+	memset(threads, 0, sizeof(threads));
+	pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+
+	for (i = 0; i < num_threads; i++) {
+		threads[i].index = i;
+		threads[i].func = func;
+		threads[i].arg = arg;
+		if (pthread_create(&threads[i].thread, NULL,
+				   bench_thread_main, &threads[i])) {
+			fprintf(stderr, "failed to create thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	start = bench_now();
+	for (i = 0; i < num_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		ops += threads[i].ops;
+		if (threads[i].r && !r)
+			r = threads[i].r;
+	}
+	bench_report(name, params, ops, bench_now() - start, r);
+
+	pthread_barrier_destroy(&start_barrier);
+}
+
+static int bench_bo_alloc(uint64_t size, uint32_t heap, uint64_t flags,
+			  amdgpu_bo_handle *bo)
+{
+	struct amdgpu_bo_alloc_request req = {
+		.alloc_size = size,
+		.phys_alignment = 4096,
+		.preferred_heap = heap,
+		.flags = flags,
+	};
+
+	return amdgpu_bo_alloc(device_handle, &req, bo);
+}
+
+/* BO alloc/free */
+
+struct bo_alloc_params {
+	uint64_t size;
+	uint32_t heap;
+	uint64_t flags;
+};
+
+static void *bo_alloc_free_loop(struct bench_thread *t)
+{
+	struct bo_alloc_params *p = t->arg;
+	amdgpu_bo_handle bo;
+	unsigned i;
+
+	for (i = 0; i < iterations; i++) {
+		t->r = bench_bo_alloc(p->size, p->heap, p->flags, &bo);
+		if (t->r)
+			break;
+		amdgpu_bo_free(bo);
+		t->ops++;
+	}
+	return NULL;
+}
+
+static void bench_bo_alloc_free(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t heap;
+		uint64_t flags;
+	} heaps[] = {
+		{ "gtt", AMDGPU_GEM_DOMAIN_GTT, 0 },
+		{ "gtt_wc", AMDGPU_GEM_DOMAIN_GTT, AMDGPU_GEM_CREATE_CPU_GTT_USWC },
+		{ "vram", AMDGPU_GEM_DOMAIN_VRAM,
+		  AMDGPU_GEM_CREATE_NO_CPU_ACCESS },
+		{ "vram_visible", AMDGPU_GEM_DOMAIN_VRAM,
+		  AMDGPU_GEM_CREATE_CPU_ACCESS_REQUIRED },
+	};
+	static const uint64_t sizes[] = { 4096, 65536, 2 << 20 };
+	struct bo_alloc_params p;
+	char params[128];
+	unsigned i, j;
+
+	if (!bench_enabled("bo_alloc_free"))
+		return;
+
+	for (i = 0; i < sizeof(heaps) / sizeof(heaps[0]); i++) {
+		for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+			p.size = sizes[j];
+			p.heap = heaps[i].heap;
+			p.flags = heaps[i].flags;
+			snprintf(params, sizeof(params),
+				 "\"heap\": \"%s\", \"size\": %" PRIu64,
+				 heaps[i].name, p.size);
+			bench_run("bo_alloc_free", params, bo_alloc_free_loop,
+				  &p);
+		}
+	}
+}
+
+/* VA range alloc/free */
+
+enum va_pattern {
+	/* free in allocation order */
+	VA_FIFO,
+	/* free in reverse order, the best case of a stack */
+	VA_LIFO,
+	/* free every other range, then realloc into the holes */
+	VA_HOLES,
+};
+
+#define VA_BATCH	64
+
+static int va_alloc(struct bench_thread *t, uint64_t size,
+		    amdgpu_va_handle *handle)
+{
+	uint64_t addr;
+
+	t->r = amdgpu_va_range_alloc(device_handle,
+				     amdgpu_gpu_va_range_general, size, 0, 0,
+				     &addr, handle, 0);
+	if (t->r) {
+		*handle = NULL;
+		return t->r;
+	}
+	t->ops++;
+	return 0;
+}
+
+static void va_free(amdgpu_va_handle *handle)
+{
+	if (*handle) {
+		amdgpu_va_range_free(*handle);
+		*handle = NULL;
+	}
+}
+
+static void *va_alloc_free_loop(struct bench_thread *t)
+{
+	enum va_pattern pattern = (uintptr_t)t->arg;
+	amdgpu_va_handle handles[VA_BATCH] = { NULL };
+	unsigned i, j;
+
+	for (i = 0; i < iterations; i += VA_BATCH) {
+		/* mixed sizes, from 4 KiB to 1 MiB */
+		for (j = 0; j < VA_BATCH; j++) {
+			if (va_alloc(t, 4096ull << (j % 9), &handles[j]))
+				goto out;
+		}
+
+		switch (pattern) {
+		case VA_FIFO:
+			for (j = 0; j < VA_BATCH; j++)
+				va_free(&handles[j]);
+			break;
+		case VA_LIFO:
+			for (j = VA_BATCH; j--;)
+				va_free(&handles[j]);
+			break;
+		case VA_HOLES:
+			for (j = 0; j < VA_BATCH; j += 2)
+				va_free(&handles[j]);
+			for (j = 0; j < VA_BATCH; j += 2) {
+				if (va_alloc(t, 4096, &handles[j]))
+					goto out;
+			}
+			for (j = 0; j < VA_BATCH; j++)
+				va_free(&handles[j]);
+			break;
+		}
+	}
+out:
+	for (j = 0; j < VA_BATCH; j++)
+		va_free(&handles[j]);
+	return NULL;
+}
+
+static void bench_va_alloc_free(void)
+{
+	static const char *patterns[] = { "fifo", "lifo", "holes" };
+	char params[64];
+	uintptr_t i;
+
+	if (!bench_enabled("va_alloc_free"))
+		return;
+
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		snprintf(params, sizeof(params), "\"pattern\": \"%s\"",
+			 patterns[i]);
+		bench_run("va_alloc_free", params, va_alloc_free_loop,
+			  (void *)i);
+	}
+}
+
+/* CPU map/unmap */
+
+static void *cpu_map_loop(struct bench_thread *t)
+{
+	amdgpu_bo_handle bo;
+	unsigned i;
+	void *cpu;
+
+	t->r = bench_bo_alloc(65536, AMDGPU_GEM_DOMAIN_GTT, 0, &bo);
+	if (t->r)
+		return NULL;
+
+	for (i = 0; i < iterations; i++) {
+		t->r = amdgpu_bo_cpu_map(bo, &cpu);
+		if (t->r)
+			break;
+		amdgpu_bo_cpu_unmap(bo);
+		t->ops++;
+	}
+
+	amdgpu_bo_free(bo);
+	return NULL;
+}
+
+static void bench_cpu_map(void)
+{
+	if (bench_enabled("cpu_map_unmap"))
+		bench_run("cpu_map_unmap", NULL, cpu_map_loop, NULL);
+}
+
+/* BO import of a dma-buf, of the same buffer on every thread */
+
+static void *bo_import_loop(struct bench_thread *t)
+{
+	struct amdgpu_bo_import_result res;
+	uint32_t fd = *(uint32_t *)t->arg;
+	unsigned i;
+
+	for (i = 0; i < iterations; i++) {
+		t->r = amdgpu_bo_import(device_handle,
+					amdgpu_bo_handle_type_dma_buf_fd, fd,
+					&res);
+		if (t->r)
+			break;
+		amdgpu_bo_free(res.buf_handle);
+		t->ops++;
+	}
+	return NULL;
+}
+
+static void bench_bo_import(void)
+{
+	amdgpu_bo_handle bo = NULL;
+	uint32_t fd;
+	int r;
+
+	if (!bench_enabled("bo_import"))
+		return;
+
+	r = bench_bo_alloc(4096, AMDGPU_GEM_DOMAIN_GTT, 0, &bo);
+	if (!r)
+		r = amdgpu_bo_export(bo, amdgpu_bo_handle_type_dma_buf_fd,
+				     &fd);
+	if (r) {
+		bench_report("bo_import", NULL, 0, 0, r);
+		if (bo)
+			amdgpu_bo_free(bo);
+		return;
+	}
+
+	bench_run("bo_import", NULL, bo_import_loop, &fd);
+
+	close(fd);
+	amdgpu_bo_free(bo);
+}
+
+/* Null IB submission and fences */
+
+struct nop_ib {
+	amdgpu_context_handle context;
+	amdgpu_bo_handle bo;
+	amdgpu_va_handle va;
+	uint64_t mc_address;
+	amdgpu_bo_list_handle list;
+	struct amdgpu_cs_ib_info ib;
+};
+
+static int nop_ib_init(struct nop_ib *nop)
+{
+	uint32_t *ptr;
+	void *cpu;
+	unsigned i;
+	int r;
+
+	memset(nop, 0, sizeof(*nop));
+
+	r = amdgpu_cs_ctx_create(device_handle, &nop->context);
+	if (r)
+		return r;
+
+	r = bench_bo_alloc(4096, AMDGPU_GEM_DOMAIN_GTT, 0, &nop->bo);
+	if (r)
+		goto err_ctx;
+
+	r = amdgpu_va_range_alloc(device_handle, amdgpu_gpu_va_range_general,
+				  4096, 4096, 0, &nop->mc_address, &nop->va, 0);
+	if (r)
+		goto err_bo;
+
+	r = amdgpu_bo_va_op(nop->bo, 0, 4096, nop->mc_address, 0,
+			    AMDGPU_VA_OP_MAP);
+	if (r)
+		goto err_va;
+
+	r = amdgpu_bo_cpu_map(nop->bo, &cpu);
+	if (r)
+		goto err_unmap;
+	ptr = cpu;
+	for (i = 0; i < 16; i++)
+		ptr[i] = gpu_info.family_id == AMDGPU_FAMILY_SI ?
+			 GFX_COMPUTE_NOP_SI : GFX_COMPUTE_NOP;
+	amdgpu_bo_cpu_unmap(nop->bo);
+
+	r = amdgpu_bo_list_create(device_handle, 1, &nop->bo, NULL,
+				  &nop->list);
+	if (r)
+		goto err_unmap;
+
+	nop->ib.ib_mc_address = nop->mc_address;
+	nop->ib.size = 16;
+	return 0;
+
+err_unmap:
+	amdgpu_bo_va_op(nop->bo, 0, 4096, nop->mc_address, 0,
+			AMDGPU_VA_OP_UNMAP);
+err_va:
+	amdgpu_va_range_free(nop->va);
+err_bo:
+	amdgpu_bo_free(nop->bo);
+err_ctx:
+	amdgpu_cs_ctx_free(nop->context);
+	return r;
+}
+
+static void nop_ib_fini(struct nop_ib *nop)
+{
+	amdgpu_bo_list_destroy(nop->list);
+	amdgpu_bo_va_op(nop->bo, 0, 4096, nop->mc_address, 0,
+			AMDGPU_VA_OP_UNMAP);
+	amdgpu_va_range_free(nop->va);
+	amdgpu_bo_free(nop->bo);
+	amdgpu_cs_ctx_free(nop->context);
+}
+
+static int nop_submit(struct nop_ib *nop, struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_cs_request req = {
+		.ip_type = AMDGPU_HW_IP_COMPUTE,
+		.resources = nop->list,
+		.number_of_ibs = 1,
+		.ibs = &nop->ib,
+	};
+	int r;
+
+	r = amdgpu_cs_submit(nop->context, 0, &req, 1);
+	if (r)
+		return r;
+
+	memset(fence, 0, sizeof(*fence));
+	fence->context = nop->context;
+	fence->ip_type = AMDGPU_HW_IP_COMPUTE;
+	fence->fence = req.seq_no;
+	return 0;
+}
+
+enum fence_mode {
+	/* submit without waiting, wait for the last at the end */
+	FENCE_NONE,
+	/* submit and wait for each */
+	FENCE_WAIT,
+	/* query a signaled fence without waiting */
+	FENCE_QUERY,
+};
+
+static void *cs_submit_loop(struct bench_thread *t)
+{
+	enum fence_mode mode = (uintptr_t)t->arg;
+	struct amdgpu_cs_fence fence;
+	struct nop_ib nop;
+	uint32_t expired;
+	unsigned i;
+
+	t->r = nop_ib_init(&nop);
+	if (t->r)
+		return NULL;
+
+	if (mode == FENCE_QUERY) {
+		t->r = nop_submit(&nop, &fence);
+		if (!t->r)
+			t->r = amdgpu_cs_query_fence_status(&fence,
+					AMDGPU_TIMEOUT_INFINITE, 0, &expired);
+	}
+
+	for (i = 0; i < iterations && !t->r; i++) {
+		if (mode != FENCE_QUERY) {
+			t->r = nop_submit(&nop, &fence);
+			if (t->r)
+				break;
+		}
+		if (mode != FENCE_NONE) {
+			t->r = amdgpu_cs_query_fence_status(&fence,
+					mode == FENCE_WAIT ?
+					AMDGPU_TIMEOUT_INFINITE : 0,
+					0, &expired);
+			if (t->r)
+				break;
+		}
+		t->ops++;
+	}
+
+	if (mode == FENCE_NONE && t->ops)
+		amdgpu_cs_query_fence_status(&fence, AMDGPU_TIMEOUT_INFINITE,
+					     0, &expired);
+
+	nop_ib_fini(&nop);
+	return NULL;
+}
+
+static void bench_cs(void)
+{
+	if (bench_enabled("cs_submit_nop"))
+		bench_run("cs_submit_nop", NULL, cs_submit_loop,
+			  (void *)(uintptr_t)FENCE_NONE);
+	if (bench_enabled("fence_wait"))
+		bench_run("fence_wait", NULL, cs_submit_loop,
+			  (void *)(uintptr_t)FENCE_WAIT);
+	if (bench_enabled("fence_query"))
+		bench_run("fence_query", NULL, cs_submit_loop,
+			  (void *)(uintptr_t)FENCE_QUERY);
+}
+
+/* amdgpu_find_bo_by_cpu_mapping() among many mapped BOs */
+
+struct find_bo_params {
+	unsigned count;
+	void **cpu;
+};
+
+static void *find_bo_loop(struct bench_thread *t)
+{
+	struct find_bo_params *p = t->arg;
+	unsigned seed = t->index + 1;
+	uint64_t offset;
+	amdgpu_bo_handle bo;
+	unsigned i;
+
+	for (i = 0; i < iterations; i++) {
+		seed = seed * 1103515245 + 12345;
+		t->r = amdgpu_find_bo_by_cpu_mapping(device_handle,
+				(char *)p->cpu[seed % p->count] + 64, 64,
+				&bo, &offset);
+		if (t->r)
+			break;
+		amdgpu_bo_free(bo);
+		t->ops++;
+	}
+	return NULL;
+}
+
+static void bench_find_bo(void)
+{
+	static const unsigned counts[] = { 1000, 10000, 100000 };
+	struct find_bo_params p;
+	amdgpu_bo_handle *bos;
+	char params[64];
+	unsigned i, j;
+	int r = 0;
+
+	if (!bench_enabled("find_bo_by_cpu_mapping"))
+		return;
+
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		p.count = counts[i];
+		p.cpu = calloc(p.count, sizeof(*p.cpu));
+		bos = calloc(p.count, sizeof(*bos));
+		snprintf(params, sizeof(params), "\"bos\": %u", p.count);
+		if (!p.cpu || !bos) {
+			bench_report("find_bo_by_cpu_mapping", params, 0, 0,
+				     -ENOMEM);
+			free(p.cpu);
+			free(bos);
+			return;
+		}
+
+		for (j = 0; j < p.count; j++) {
+			r = bench_bo_alloc(4096, AMDGPU_GEM_DOMAIN_GTT, 0,
+					   &bos[j]);
+			if (r)
+				break;
+			r = amdgpu_bo_cpu_map(bos[j], &p.cpu[j]);
+			if (r) {
+				amdgpu_bo_free(bos[j]);
+				break;
+			}
+		}
+
+		if (r)
+			bench_report("find_bo_by_cpu_mapping", params, 0, 0, r);
+		else
+			bench_run("find_bo_by_cpu_mapping", params,
+				  find_bo_loop, &p);
+
+		while (j--) {
+			amdgpu_bo_cpu_unmap(bos[j]);
+			amdgpu_bo_free(bos[j]);
+		}
+		free(p.cpu);
+		free(bos);
+		if (r)
+			return;
+	}
+}
+
+/* Syncobj signal to wake latency, transfers and wait fan-in */
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Report the distribution of the latencies of count samples. */
+static void bench_report_latency(const char *name, const char *params,
+				 uint64_t *samples, unsigned count, int r)
+{
+	uint64_t sum = 0;
+	unsigned i;
+
+	printf("%s\n    {\"name\": \"%s\"%s%s, ", first_result ? "" : ",",
+	       name, params ? ", " : "", params ? params : "");
+	first_result = false;
+	if (r || !count) {
+		printf("\"error\": %d}", r ? r : -ENODATA);
+		fflush(stdout);
+		return;
+	}
+
+	qsort(samples, count, sizeof(*samples), compare_u64);
+	for (i = 0; i < count; i++)
+		sum += samples[i];
+
+	printf("\"samples\": %u, \"min_ns\": %" PRIu64 ", \"avg_ns\": %.0f, "
+	       "\"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64 ", "
+	       "\"max_ns\": %" PRIu64 "}", count, samples[0],
+	       (double)sum / count, samples[count / 2],
+	       samples[(uint64_t)count * 99 / 100], samples[count - 1]);
+	fflush(stdout);
+}
+
+struct cpu_wake {
+	uint32_t syncobj;
+	/* The iteration the waiter is about to wait for. */
+	unsigned ready;
+	/* When the point of the current iteration was signaled. */
+	uint64_t signal_ns;
+	uint64_t *latency;
+	int r;
+};
+
+static void *cpu_wake_waiter(void *data)
+{
+	struct cpu_wake *w = data;
+	uint64_t point;
+	unsigned i;
+	int r;
+
+	for (i = 0; i < iterations; i++) {
+		point = i + 1;
+		__atomic_store_n(&w->ready, i + 1, __ATOMIC_RELEASE);
+		r = drmSyncobjTimelineWait(device_fd, &w->syncobj, &point,
+					   1, INT64_MAX,
+					   DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT,
+					   NULL);
+		if (r) {
+			w->r = r;
+			break;
+		}
+		w->latency[i] = bench_now() -
+			__atomic_load_n(&w->signal_ns, __ATOMIC_ACQUIRE);
+	}
+	return NULL;
+}
+
+/*
+ * drmSyncobjTimelineSignal() on this thread to the return of
+ * drmSyncobjTimelineWait() on a thread blocked on the point. The signal
+ * comes 50 us after the waiter said it was about to wait, for it to be
+ * asleep in the kernel.
+ */
+static void bench_syncobj_cpu_wake(void)
+{
+	const struct timespec delay = { 0, 50000 };
+	struct cpu_wake w;
+	pthread_t thread;
+	uint64_t point, cap = 0;
+	unsigned i;
+	int r;
+
+	if (!bench_enabled("syncobj_cpu_signal_wake"))
+		return;
+
+	memset(&w, 0, sizeof(w));
+	w.latency = calloc(iterations, sizeof(*w.latency));
+	if (!w.latency) {
+		bench_report_latency("syncobj_cpu_signal_wake", NULL, NULL, 0,
+				     -ENOMEM);
+		return;
+	}
+
+	r = drmGetCap(device_fd, DRM_CAP_SYNCOBJ_TIMELINE, &cap);
+	if (r || !cap) {
+		r = -EOPNOTSUPP;
+		goto out;
+	}
+
+	r = drmSyncobjCreate(device_fd, 0, &w.syncobj);
+	if (r)
+		goto out;
+
+	if (pthread_create(&thread, NULL, cpu_wake_waiter, &w)) {
+		r = -EAGAIN;
+		goto out_destroy;
+	}
+
+	for (i = 0; i < iterations && !r; i++) {
+		while (__atomic_load_n(&w.ready, __ATOMIC_ACQUIRE) != i + 1 &&
+		       !__atomic_load_n(&w.r, __ATOMIC_RELAXED))
+			sched_yield();
+		if (w.r)
+			break;
+		nanosleep(&delay, NULL);
+
+		point = i + 1;
+		__atomic_store_n(&w.signal_ns, bench_now(), __ATOMIC_RELEASE);
+		r = drmSyncobjTimelineSignal(device_fd, &w.syncobj, &point, 1);
+	}
+
+	/* Let the waiter out if signaling failed. */
+	if (r) {
+		point = iterations;
+		drmSyncobjTimelineSignal(device_fd, &w.syncobj, &point, 1);
+	}
+	pthread_join(thread, NULL);
+	if (!r)
+		r = w.r;
+
+out_destroy:
+	drmSyncobjDestroy(device_fd, w.syncobj);
+out:
+	bench_report_latency("syncobj_cpu_signal_wake", NULL, w.latency,
+			     r ? 0 : iterations, r);
+	free(w.latency);
+}
+
+/*
+ * A NOP IB submission to the return of drmSyncobjWait() on the syncobj of
+ * its fence, the GPU side of the wake latency. The GPU signal is not
+ * timestamped on the CPU clock, so this includes the submission and the
+ * execution of the IB.
+ */
+static void bench_syncobj_gpu_wake(void)
+{
+	struct amdgpu_cs_fence fence;
+	struct nop_ib nop;
+	uint64_t *latency, start;
+	uint32_t syncobj;
+	unsigned i;
+	int r;
+
+	if (!bench_enabled("syncobj_gpu_signal_wake"))
+		return;
+
+	latency = calloc(iterations, sizeof(*latency));
+	if (!latency) {
+		bench_report_latency("syncobj_gpu_signal_wake", NULL, NULL, 0,
+				     -ENOMEM);
+		return;
+	}
+
+	r = nop_ib_init(&nop);
+	if (r)
+		goto out;
+
+	for (i = 0; i < iterations && !r; i++) {
+		start = bench_now();
+		r = nop_submit(&nop, &fence);
+		if (r)
+			break;
+		r = amdgpu_cs_fence_to_handle(device_handle, &fence,
+					      AMDGPU_FENCE_TO_HANDLE_GET_SYNCOBJ,
+					      &syncobj);
+		if (r)
+			break;
+		r = drmSyncobjWait(device_fd, &syncobj, 1, INT64_MAX, 0,
+				   NULL);
+		latency[i] = bench_now() - start;
+		drmSyncobjDestroy(device_fd, syncobj);
+	}
+	nop_ib_fini(&nop);
+
+out:
+	bench_report_latency("syncobj_gpu_signal_wake", NULL, latency,
+			     r ? 0 : iterations, r);
+	free(latency);
+}
+
+static void *syncobj_transfer_loop(struct bench_thread *t)
+{
+	uint32_t src, dst;
+	uint64_t point = 1;
+	unsigned i;
+
+	t->r = drmSyncobjCreate(device_fd, 0, &src);
+	if (t->r)
+		return NULL;
+	t->r = drmSyncobjCreate(device_fd, 0, &dst);
+	if (t->r)
+		goto out_src;
+	t->r = drmSyncobjTimelineSignal(device_fd, &src, &point, 1);
+
+	/* Each transfer adds the next point of the destination timeline. */
+	for (i = 0; i < iterations && !t->r; i++) {
+		t->r = drmSyncobjTransfer(device_fd, dst, i + 1, src, 1, 0);
+		if (!t->r)
+			t->ops++;
+	}
+
+	drmSyncobjDestroy(device_fd, dst);
+out_src:
+	drmSyncobjDestroy(device_fd, src);
+	return NULL;
+}
+
+struct syncobj_wait_params {
+	uint32_t *handles;
+	unsigned count;
+};
+
+static void *syncobj_wait_loop(struct bench_thread *t)
+{
+	struct syncobj_wait_params *p = t->arg;
+	unsigned i;
+
+	for (i = 0; i < iterations; i++) {
+		t->r = drmSyncobjWait(device_fd, p->handles, p->count,
+				      INT64_MAX, DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL,
+				      NULL);
+		if (t->r)
+			break;
+		t->ops++;
+	}
+	return NULL;
+}
+
+/* Waits for all of 1 to 1024 signaled syncobjs, shared by the threads. */
+static void bench_syncobj_wait(void)
+{
+	struct syncobj_wait_params p;
+	uint32_t handles[1024];
+	char params[64];
+	unsigned i;
+	int r = 0;
+
+	if (!bench_enabled("syncobj_wait_all"))
+		return;
+
+	for (i = 0; i < 1024; i++) {
+		r = drmSyncobjCreate(device_fd, DRM_SYNCOBJ_CREATE_SIGNALED,
+				     &handles[i]);
+		if (r)
+			break;
+	}
+
+	p.handles = handles;
+	for (p.count = 1; p.count <= 1024; p.count *= 4) {
+		snprintf(params, sizeof(params), "\"handles\": %u", p.count);
+		if (r)
+			bench_report("syncobj_wait_all", params, 0, 0, r);
+		else
+			bench_run("syncobj_wait_all", params,
+				  syncobj_wait_loop, &p);
+	}
+
+	while (i--)
+		drmSyncobjDestroy(device_fd, handles[i]);
+}
+
+static void bench_syncobj(void)
+{
+	bench_syncobj_cpu_wake();
+	bench_syncobj_gpu_wake();
+	if (bench_enabled("syncobj_transfer"))
+		bench_run("syncobj_transfer", NULL, syncobj_transfer_loop,
+			  NULL);
+	bench_syncobj_wait();
+}
+
+/*
+ * High priority submissions while a low priority IB runs
+ *
+ * As in the deadlock tests, the low priority IB blocks its ring on a
+ * WAIT_REG_MEM of a dword the CPU only writes PRIO_HOLD_MS after the high
+ * priority IB was submitted. The high priority IB writes a dword that the
+ * CPU polls for, which times its start, and its fence times its completion.
+ * Starts within the hold time are the ones the scheduler or the hardware
+ * let ahead of the low priority work.
+ */
+
+#define PRIO_HOLD_MS		5
+/* Samples per ring and priority, since each takes the hold time. */
+#define PRIO_MAX_SAMPLES	200
+/* Dword offsets in the BO of the IBs and of the dwords they access. */
+#define PRIO_LOW_IB		0
+#define PRIO_HIGH_IB		64
+#define PRIO_IB_SIZE		16
+#define PRIO_GATE		256
+#define PRIO_START		320
+
+struct prio_bench {
+	unsigned ip_type;
+	uint32_t ring;
+	amdgpu_context_handle low, high;
+	amdgpu_bo_handle bo;
+	amdgpu_va_handle va;
+	uint64_t mc_address;
+	volatile uint32_t *ptr;
+	amdgpu_bo_list_handle list;
+};
+
+static void prio_write_ibs(struct prio_bench *b)
+{
+	uint32_t nop = b->ip_type == AMDGPU_HW_IP_DMA ? 0 :
+		       gpu_info.family_id == AMDGPU_FAMILY_SI ?
+		       GFX_COMPUTE_NOP_SI : GFX_COMPUTE_NOP;
+	uint64_t gate = b->mc_address + PRIO_GATE * 4;
+	uint64_t start = b->mc_address + PRIO_START * 4;
+	volatile uint32_t *low = b->ptr + PRIO_LOW_IB;
+	volatile uint32_t *high = b->ptr + PRIO_HIGH_IB;
+	unsigned i = 0, j = 0;
+
+	if (b->ip_type == AMDGPU_HW_IP_DMA) {
+		/* POLL_REGMEM of memory until == 1 */
+		low[i++] = SDMA_OP_POLL_REGMEM | (3u << 28) | (1u << 31);
+		low[i++] = gate & 0xfffffffc;
+		low[i++] = gate >> 32;
+		low[i++] = 1;
+		low[i++] = 0xffffffff;
+		low[i++] = 4 | (0xfff << 16);
+
+		high[j++] = SDMA_OP_WRITE;
+		high[j++] = start & 0xfffffffc;
+		high[j++] = start >> 32;
+		high[j++] = gpu_info.family_id >= AMDGPU_FAMILY_AI ? 0 : 1;
+		high[j++] = 1;
+	} else {
+		/* WAIT_REG_MEM of memory until == 1 */
+		low[i++] = PACKET3(PACKET3_WAIT_REG_MEM, 5);
+		low[i++] = (1 << 4) | 3;
+		low[i++] = gate & 0xfffffffc;
+		low[i++] = gate >> 32;
+		low[i++] = 1;
+		low[i++] = 0xffffffff;
+		low[i++] = 4;
+
+		/* WRITE_DATA to memory with confirmation */
+		high[j++] = PACKET3(PACKET3_WRITE_DATA, 3);
+		high[j++] = (5 << 8) | (1 << 20);
+		high[j++] = start & 0xfffffffc;
+		high[j++] = start >> 32;
+		high[j++] = 1;
+	}
+
+	while (i < PRIO_IB_SIZE)
+		low[i++] = nop;
+	while (j < PRIO_IB_SIZE)
+		high[j++] = nop;
+}
+
+static int prio_bench_init(struct prio_bench *b, unsigned ip_type,
+			   uint32_t ring, int32_t priority)
+{
+	void *cpu;
+	int r;
+
+	memset(b, 0, sizeof(*b));
+	b->ip_type = ip_type;
+	b->ring = ring;
+
+	r = amdgpu_cs_ctx_create2(device_handle, AMDGPU_CTX_PRIORITY_LOW,
+				  &b->low);
+	if (r)
+		return r;
+	r = amdgpu_cs_ctx_create2(device_handle, priority, &b->high);
+	if (r)
+		goto err_low;
+
+	r = bench_bo_alloc(4096, AMDGPU_GEM_DOMAIN_GTT, 0, &b->bo);
+	if (r)
+		goto err_high;
+	r = amdgpu_va_range_alloc(device_handle, amdgpu_gpu_va_range_general,
+				  4096, 4096, 0, &b->mc_address, &b->va, 0);
+	if (r)
+		goto err_bo;
+	r = amdgpu_bo_va_op(b->bo, 0, 4096, b->mc_address, 0,
+			    AMDGPU_VA_OP_MAP);
+	if (r)
+		goto err_va;
+	r = amdgpu_bo_cpu_map(b->bo, &cpu);
+	if (r)
+		goto err_unmap;
+	b->ptr = cpu;
+	prio_write_ibs(b);
+
+	r = amdgpu_bo_list_create(device_handle, 1, &b->bo, NULL, &b->list);
+	if (r)
+		goto err_cpu;
+	return 0;
+
+err_cpu:
+	amdgpu_bo_cpu_unmap(b->bo);
+err_unmap:
+	amdgpu_bo_va_op(b->bo, 0, 4096, b->mc_address, 0, AMDGPU_VA_OP_UNMAP);
+err_va:
+	amdgpu_va_range_free(b->va);
+err_bo:
+	amdgpu_bo_free(b->bo);
+err_high:
+	amdgpu_cs_ctx_free(b->high);
+err_low:
+	amdgpu_cs_ctx_free(b->low);
+	return r;
+}
+
+static void prio_bench_fini(struct prio_bench *b)
+{
+	amdgpu_bo_list_destroy(b->list);
+	amdgpu_bo_cpu_unmap(b->bo);
+	amdgpu_bo_va_op(b->bo, 0, 4096, b->mc_address, 0, AMDGPU_VA_OP_UNMAP);
+	amdgpu_va_range_free(b->va);
+	amdgpu_bo_free(b->bo);
+	amdgpu_cs_ctx_free(b->high);
+	amdgpu_cs_ctx_free(b->low);
+}
+
+static int prio_submit(struct prio_bench *b, amdgpu_context_handle context,
+		       unsigned offset, struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_cs_ib_info ib = {
+		.ib_mc_address = b->mc_address + offset * 4,
+		.size = PRIO_IB_SIZE,
+	};
+	struct amdgpu_cs_request req = {
+		.ip_type = b->ip_type,
+		.ring = b->ring,
+		.resources = b->list,
+		.number_of_ibs = 1,
+		.ibs = &ib,
+	};
+	int r;
+
+	r = amdgpu_cs_submit(context, 0, &req, 1);
+	if (r)
+		return r;
+
+	memset(fence, 0, sizeof(*fence));
+	fence->context = context;
+	fence->ip_type = b->ip_type;
+	fence->ring = b->ring;
+	fence->fence = req.seq_no;
+	return 0;
+}
+
+/* One sample, with the low priority IB released once the high one started
+ * or after the hold time. */
+static int prio_sample(struct prio_bench *b, uint64_t *start_ns,
+		       uint64_t *complete_ns)
+{
+	struct amdgpu_cs_fence low, high;
+	uint64_t submit, release, now;
+	bool released = false;
+	uint32_t expired;
+	int r;
+
+	b->ptr[PRIO_GATE] = 0;
+	b->ptr[PRIO_START] = 0;
+	r = prio_submit(b, b->low, PRIO_LOW_IB, &low);
+	if (r)
+		return r;
+	/* Let the low priority IB reach the ring. */
+	usleep(1000);
+
+	submit = bench_now();
+	release = submit + PRIO_HOLD_MS * 1000000ull;
+	r = prio_submit(b, b->high, PRIO_HIGH_IB, &high);
+	if (r) {
+		b->ptr[PRIO_GATE] = 1;
+		goto out;
+	}
+
+	for (;;) {
+		now = bench_now();
+		if (b->ptr[PRIO_START])
+			break;
+		if (!released && now >= release) {
+			b->ptr[PRIO_GATE] = 1;
+			released = true;
+		}
+		if (now - submit > 1000000000ull) {
+			r = -ETIME;
+			break;
+		}
+		sched_yield();
+	}
+	*start_ns = now - submit;
+	b->ptr[PRIO_GATE] = 1;
+
+	if (!r)
+		r = amdgpu_cs_query_fence_status(&high, AMDGPU_TIMEOUT_INFINITE,
+						 0, &expired);
+	*complete_ns = bench_now() - submit;
+
+out:
+	amdgpu_cs_query_fence_status(&low, AMDGPU_TIMEOUT_INFINITE, 0,
+				     &expired);
+	return r;
+}
+
+static void bench_priority_ring(unsigned ip_type, const char *ip_name,
+				uint32_t ring, int32_t priority,
+				const char *prio_name)
+{
+	unsigned count = iterations < PRIO_MAX_SAMPLES ? iterations :
+			 PRIO_MAX_SAMPLES;
+	uint64_t *start, *complete;
+	struct prio_bench b;
+	char params[96];
+	unsigned i = 0;
+	int r = -ENOMEM;
+
+	snprintf(params, sizeof(params),
+		 "\"ip\": \"%s\", \"ring\": %u, \"priority\": \"%s\"",
+		 ip_name, ring, prio_name);
+
+	start = calloc(count, sizeof(*start));
+	complete = calloc(count, sizeof(*complete));
+	if (!start || !complete)
+		goto out;
+
+	r = prio_bench_init(&b, ip_type, ring, priority);
+	if (r)
+		goto out;
+	for (i = 0; i < count && !r; i++)
+		r = prio_sample(&b, &start[i], &complete[i]);
+	prio_bench_fini(&b);
+
+out:
+	bench_report_latency("priority_submit_to_start", params, start,
+			     r ? 0 : count, r);
+	bench_report_latency("priority_submit_to_complete", params, complete,
+			     r ? 0 : count, r);
+	free(complete);
+	free(start);
+}
+
+static void bench_priority(void)
+{
+	static const struct {
+		unsigned type;
+		const char *name;
+	} ips[] = {
+		{ AMDGPU_HW_IP_GFX, "gfx" },
+		{ AMDGPU_HW_IP_COMPUTE, "compute" },
+		{ AMDGPU_HW_IP_DMA, "sdma" },
+	};
+	static const struct {
+		int32_t priority;
+		const char *name;
+	} prios[] = {
+		{ AMDGPU_CTX_PRIORITY_NORMAL, "normal" },
+		{ AMDGPU_CTX_PRIORITY_HIGH, "high" },
+		{ AMDGPU_CTX_PRIORITY_VERY_HIGH, "very_high" },
+	};
+	struct drm_amdgpu_info_hw_ip info;
+	unsigned i, j;
+	uint32_t ring;
+
+	if (!bench_enabled("priority_submit"))
+		return;
+
+	for (i = 0; i < sizeof(ips) / sizeof(ips[0]); i++) {
+		/* The SDMA packets above are those of CIK and later. */
+		if (ips[i].type == AMDGPU_HW_IP_DMA &&
+		    gpu_info.family_id == AMDGPU_FAMILY_SI)
+			continue;
+		if (amdgpu_query_hw_ip_info(device_handle, ips[i].type, 0,
+					    &info))
+			continue;
+
+		for (ring = 0; ring < 32; ring++) {
+			if (!(info.available_rings & (1u << ring)))
+				continue;
+			for (j = 0; j < sizeof(prios) / sizeof(prios[0]); j++)
+				bench_priority_ring(ips[i].type, ips[i].name,
+						    ring, prios[j].priority,
+						    prios[j].name);
+		}
+	}
+}
+
+/*
+ * VCN decode sessions
+ *
+ * Each thread creates a session on one of the decode rings, decodes the
+ * frame of decode_messages.h over and over again like the VCN tests do
+ * once, and checks the last picture. The frames of all sessions over the
+ * wall time give the throughput, and each frame its submit to fence
+ * latency and the CPU time of its amdgpu_cs_submit().
+ */
+
+#define VCN_DEC_DPB_SIZE	15923584
+#define VCN_DEC_DT_SIZE		737280
+
+struct vcn_dec_regs {
+	uint32_t data0;
+	uint32_t data1;
+	uint32_t cmd;
+	uint32_t nop;
+	uint32_t cntl;
+};
+
+struct vcn_dec_params {
+	struct vcn_dec_regs reg;
+	uint32_t rings;
+	/* iterations samples per thread */
+	uint64_t *latency;
+	uint64_t *submit;
+	/* The error of a thread, which invalidates the samples. */
+	int r;
+};
+
+struct vcn_dec_session {
+	uint32_t handle;
+	uint32_t ring;
+	amdgpu_context_handle context;
+	amdgpu_bo_handle bo[2];
+	amdgpu_va_handle va[2];
+	uint64_t addr[2];
+	uint64_t size[2];
+	void *cpu[2];
+	amdgpu_bo_list_handle list;
+};
+
+/* The registers of the VCN tests, false without VCN decode. */
+static bool vcn_dec_get_regs(struct vcn_dec_regs *reg)
+{
+	static const struct vcn_dec_regs vcn1 = {
+		0x81c4, 0x81c5, 0x81c3, 0x81ff, 0x81c6
+	};
+	static const struct vcn_dec_regs vcn2 = {
+		0x504, 0x505, 0x503, 0x53f, 0x506
+	};
+	static const struct vcn_dec_regs vcn25 = {
+		0x10, 0x11, 0xf, 0x29, 0x26d
+	};
+	uint32_t rev = gpu_info.chip_rev, id = gpu_info.chip_external_rev;
+
+	switch (gpu_info.family_id) {
+	case AMDGPU_FAMILY_RV:
+		*reg = id >= rev + 0x91 ? vcn2 : vcn1;
+		return true;
+	case AMDGPU_FAMILY_NV:
+		*reg = id == rev + 0x28 || id == rev + 0x32 ||
+		       id == rev + 0x3c ? vcn25 : vcn2;
+		return true;
+	case AMDGPU_FAMILY_AI:
+		/* Arcturus */
+		*reg = vcn25;
+		return id - rev >= 0x32;
+	default:
+		return false;
+	}
+}
+
+static int vcn_dec_buffer(struct vcn_dec_session *s, unsigned i,
+			  uint64_t size)
+{
+	int r;
+
+	s->size[i] = ALIGN(size, 4096);
+	r = bench_bo_alloc(s->size[i], AMDGPU_GEM_DOMAIN_GTT, 0, &s->bo[i]);
+	if (r)
+		return r;
+	r = amdgpu_va_range_alloc(device_handle, amdgpu_gpu_va_range_general,
+				  s->size[i], 4096, 0, &s->addr[i], &s->va[i],
+				  0);
+	if (r)
+		goto err_bo;
+	r = amdgpu_bo_va_op(s->bo[i], 0, s->size[i], s->addr[i], 0,
+			    AMDGPU_VA_OP_MAP);
+	if (r)
+		goto err_va;
+	r = amdgpu_bo_cpu_map(s->bo[i], &s->cpu[i]);
+	if (r)
+		goto err_unmap;
+	memset(s->cpu[i], 0, s->size[i]);
+	return 0;
+
+err_unmap:
+	amdgpu_bo_va_op(s->bo[i], 0, s->size[i], s->addr[i], 0,
+			AMDGPU_VA_OP_UNMAP);
+err_va:
+	amdgpu_va_range_free(s->va[i]);
+err_bo:
+	amdgpu_bo_free(s->bo[i]);
+	s->bo[i] = NULL;
+	return r;
+}
+
+static void vcn_dec_session_fini(struct vcn_dec_session *s)
+{
+	unsigned i;
+
+	if (s->list)
+		amdgpu_bo_list_destroy(s->list);
+	for (i = 0; i < 2; i++) {
+		if (!s->bo[i])
+			continue;
+		amdgpu_bo_cpu_unmap(s->bo[i]);
+		amdgpu_bo_va_op(s->bo[i], 0, s->size[i], s->addr[i], 0,
+				AMDGPU_VA_OP_UNMAP);
+		amdgpu_va_range_free(s->va[i]);
+		amdgpu_bo_free(s->bo[i]);
+	}
+	if (s->context)
+		amdgpu_cs_ctx_free(s->context);
+}
+
+/* Buffer 0 holds the IB, buffer 1 the message and the decode buffers. */
+static int vcn_dec_session_init(struct vcn_dec_session *s, unsigned index,
+				uint32_t ring)
+{
+	uint64_t size;
+	int r;
+
+	memset(s, 0, sizeof(*s));
+	s->handle = 0x40440003 + (index << 8);
+	s->ring = ring;
+
+	size = 3 * 4096 + ALIGN(sizeof(uvd_bitstream), 4096) +
+	       ALIGN(VCN_DEC_DPB_SIZE, 4096) + VCN_DEC_DT_SIZE;
+	r = amdgpu_cs_ctx_create(device_handle, &s->context);
+	if (!r)
+		r = vcn_dec_buffer(s, 0, 4096);
+	if (!r)
+		r = vcn_dec_buffer(s, 1, size);
+	if (!r)
+		r = amdgpu_bo_list_create(device_handle, 2, s->bo, NULL,
+					  &s->list);
+	return r;
+}
+
+/* Copy a message of the session at the start of buffer 1. */
+static void vcn_dec_msg(struct vcn_dec_session *s, const uint8_t *msg,
+			size_t size)
+{
+	uint8_t *cpu = s->cpu[1];
+
+	memcpy(cpu, msg, size);
+	/* The stream handle follows the header, type and flags dwords. */
+	memcpy(cpu + 16, &s->handle, sizeof(s->handle));
+}
+
+static unsigned vcn_dec_cmd(const struct vcn_dec_regs *reg, uint32_t *ib,
+			    unsigned len, uint64_t addr, unsigned cmd)
+{
+	ib[len++] = reg->data0;
+	ib[len++] = addr;
+	ib[len++] = reg->data1;
+	ib[len++] = addr >> 32;
+	ib[len++] = reg->cmd;
+	ib[len++] = cmd << 1;
+	return len;
+}
+
+static unsigned vcn_dec_pad(const struct vcn_dec_regs *reg, uint32_t *ib,
+			    unsigned len)
+{
+	while (len % 16) {
+		ib[len++] = reg->nop;
+		ib[len++] = 0;
+	}
+	return len;
+}
+
+static int vcn_dec_submit(struct vcn_dec_session *s, unsigned ndw,
+			  uint64_t *submit_ns, uint64_t *latency_ns)
+{
+	struct amdgpu_cs_ib_info ib = {
+		.ib_mc_address = s->addr[0],
+		.size = ndw,
+	};
+	struct amdgpu_cs_request req = {
+		.ip_type = AMDGPU_HW_IP_VCN_DEC,
+		.ring = s->ring,
+		.resources = s->list,
+		.number_of_ibs = 1,
+		.ibs = &ib,
+	};
+	struct amdgpu_cs_fence fence = {
+		.context = s->context,
+		.ip_type = AMDGPU_HW_IP_VCN_DEC,
+		.ring = s->ring,
+	};
+	uint64_t start, submitted;
+	uint32_t expired;
+	int r;
+
+	start = bench_now();
+	r = amdgpu_cs_submit(s->context, 0, &req, 1);
+	submitted = bench_now();
+	if (r)
+		return r;
+
+	fence.fence = req.seq_no;
+	r = amdgpu_cs_query_fence_status(&fence, AMDGPU_TIMEOUT_INFINITE, 0,
+					 &expired);
+	if (submit_ns)
+		*submit_ns = submitted - start;
+	if (latency_ns)
+		*latency_ns = bench_now() - start;
+	return r;
+}
+
+/* Create or destroy the session. */
+static int vcn_dec_session_msg(struct vcn_dec_session *s,
+			       const struct vcn_dec_regs *reg,
+			       const uint8_t *msg, size_t size)
+{
+	unsigned len;
+
+	vcn_dec_msg(s, msg, size);
+	len = vcn_dec_cmd(reg, s->cpu[0], 0, s->addr[1], 0);
+	len = vcn_dec_pad(reg, s->cpu[0], len);
+	return vcn_dec_submit(s, len, NULL, NULL);
+}
+
+/* Write the decode message and IB, and return the IB size. */
+static unsigned vcn_dec_frame(struct vcn_dec_session *s,
+			      const struct vcn_dec_regs *reg)
+{
+	uint64_t msg = s->addr[1], fb = msg + 4096, it = fb + 4096;
+	uint64_t bs = it + 4096, dpb, ctx, dt;
+	uint8_t *cpu = s->cpu[1];
+	uint32_t *ib = s->cpu[0];
+	unsigned len = 0;
+
+	dpb = ALIGN(bs + sizeof(uvd_bitstream), 4096);
+	ctx = ALIGN(dpb + 0x006B9400, 4096);
+	dt = ALIGN(dpb + VCN_DEC_DPB_SIZE, 4096);
+
+	vcn_dec_msg(s, vcn_dec_decode_msg, sizeof(vcn_dec_decode_msg));
+	memcpy(cpu + sizeof(vcn_dec_decode_msg), avc_decode_msg,
+	       sizeof(avc_decode_msg));
+	memcpy(cpu + 4096, feedback_msg, sizeof(feedback_msg));
+	memcpy(cpu + 2 * 4096, uvd_it_scaling_table,
+	       sizeof(uvd_it_scaling_table));
+	memcpy(cpu + 3 * 4096, uvd_bitstream, sizeof(uvd_bitstream));
+
+	len = vcn_dec_cmd(reg, ib, len, msg, 0x0);
+	len = vcn_dec_cmd(reg, ib, len, dpb, 0x1);
+	len = vcn_dec_cmd(reg, ib, len, dt, 0x2);
+	len = vcn_dec_cmd(reg, ib, len, fb, 0x3);
+	len = vcn_dec_cmd(reg, ib, len, bs, 0x100);
+	len = vcn_dec_cmd(reg, ib, len, it, 0x204);
+	len = vcn_dec_cmd(reg, ib, len, ctx, 0x206);
+	ib[len++] = reg->cntl;
+	ib[len++] = 0x1;
+	return vcn_dec_pad(reg, ib, len);
+}
+
+static bool vcn_dec_check(struct vcn_dec_session *s)
+{
+	const uint8_t *dt = (const uint8_t *)s->cpu[1] + 3 * 4096 +
+			    ALIGN(sizeof(uvd_bitstream), 4096) +
+			    ALIGN(VCN_DEC_DPB_SIZE, 4096);
+	uint64_t sum = 0;
+	unsigned i;
+
+	for (i = 0; i < VCN_DEC_DT_SIZE; i++)
+		sum += dt[i];
+	return sum == SUM_DECODE;
+}
+
+static void *vcn_dec_loop(struct bench_thread *t)
+{
+	struct vcn_dec_params *p = t->arg;
+	uint64_t *latency = p->latency + (uint64_t)t->index * iterations;
+	uint64_t *submit = p->submit + (uint64_t)t->index * iterations;
+	struct vcn_dec_session s;
+	uint32_t ring;
+	unsigned ndw, i;
+
+	/* Spread the sessions over the rings, one per instance. */
+	for (ring = 0, i = t->index % __builtin_popcount(p->rings); ;
+	     ring++) {
+		if ((p->rings & (1u << ring)) && !i--)
+			break;
+	}
+
+	t->r = vcn_dec_session_init(&s, t->index, ring);
+	if (!t->r)
+		t->r = vcn_dec_session_msg(&s, &p->reg, vcn_dec_create_msg,
+					   sizeof(vcn_dec_create_msg));
+	if (t->r)
+		goto out;
+
+	ndw = vcn_dec_frame(&s, &p->reg);
+	for (i = 0; i < iterations && !t->r; i++) {
+		t->r = vcn_dec_submit(&s, ndw, &submit[i], &latency[i]);
+		if (!t->r)
+			t->ops++;
+	}
+	if (!t->r && !vcn_dec_check(&s))
+		t->r = -EIO;
+
+	vcn_dec_session_msg(&s, &p->reg, vcn_dec_destroy_msg,
+			    sizeof(vcn_dec_destroy_msg));
+out:
+	vcn_dec_session_fini(&s);
+	if (t->r)
+		__atomic_store_n(&p->r, t->r, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+static void bench_vcn_dec(void)
+{
+	struct drm_amdgpu_info_hw_ip info;
+	struct vcn_dec_params p;
+	uint64_t count = (uint64_t)num_threads * iterations;
+	char params[64];
+
+	if (!bench_enabled("vcn_decode"))
+		return;
+
+	memset(&p, 0, sizeof(p));
+	if (!vcn_dec_get_regs(&p.reg) ||
+	    amdgpu_query_hw_ip_info(device_handle, AMDGPU_HW_IP_VCN_DEC, 0,
+				    &info) || !info.available_rings) {
+		bench_report("vcn_decode", NULL, 0, 0, -ENODEV);
+		return;
+	}
+	p.rings = info.available_rings;
+
+	p.latency = calloc(count, sizeof(*p.latency));
+	p.submit = calloc(count, sizeof(*p.submit));
+	if (!p.latency || !p.submit) {
+		bench_report("vcn_decode", NULL, 0, 0, -ENOMEM);
+		goto out;
+	}
+
+	snprintf(params, sizeof(params), "\"rings\": %u",
+		 __builtin_popcount(p.rings));
+	bench_run("vcn_decode", params, vcn_dec_loop, &p);
+	bench_report_latency("vcn_decode_frame_latency", params, p.latency,
+			     p.r ? 0 : count, p.r);
+	bench_report_latency("vcn_decode_submit_cpu", params, p.submit,
+			     p.r ? 0 : count, p.r);
+out:
+	free(p.submit);
+	free(p.latency);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-d device] [-t threads] [-i iterations] [-b filter]\n"
+		"\t-d device\tDRM render node, /dev/dri/renderD128 by default\n"
+		"\t-t threads\tthreads running each benchmark, 1 by default\n"
+		"\t-i iterations\toperations per thread, 1000 by default\n"
+		"\t-b filter\tonly run the benchmarks with filter in their name\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	const char *device = "/dev/dri/renderD128";
+	uint32_t major, minor;
+	int c, fd, r;
+
+	while ((c = getopt(argc, argv, "d:t:i:b:h")) != -1) {
+		switch (c) {
+		case 'd':
+			device = optarg;
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 'b':
+			filter = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (num_threads < 1 || num_threads > BENCH_MAX_THREADS ||
+	    iterations < 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	fd = open(device, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %s\n", device,
+			strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	device_fd = fd;
+	r = amdgpu_device_initialize(fd, &major, &minor, &device_handle);
+	if (r) {
+		fprintf(stderr, "failed to initialize the device: %d\n", r);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	amdgpu_query_gpu_info(device_handle, &gpu_info);
+
+	printf("{\n  \"device\": \"%s\",\n  \"family\": %u,\n"
+	       "  \"drm_version\": \"%u.%u\",\n  \"iterations\": %u,\n"
+	       "  \"results\": [", device, gpu_info.family_id, major, minor,
+	       iterations);
+
+	bench_bo_alloc_free();
+	bench_va_alloc_free();
+	bench_cpu_map();
+	bench_bo_import();
+	bench_cs();
+	bench_find_bo();
+	bench_syncobj();
+	bench_priority();
+	bench_vcn_dec();
+
+	printf("\n  ]\n}\n");
+
+	amdgpu_device_deinitialize(device_handle);
+	close(fd);
+	return EXIT_SUCCESS;
+}
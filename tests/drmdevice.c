@@ -21,16 +21,225 @@
  *
  */
 
+#include <dirent.h>
+#include <dlfcn.h>
 #include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <xf86drm.h>
 
+/*
+ * The file system calls libdrm makes are interposed to count them and, with
+ * -r or -g, to redirect /sys and /dev into a synthetic tree, where the
+ * regular files standing for the device nodes are reported as DRM character
+ * devices. Counting relies on libdrm calling the exported libc symbols,
+ * which glibc 2.33 and later provide for stat() and fstat().
+ */
+enum {
+    CALL_OPEN,
+    CALL_READ,
+    CALL_STAT,
+    CALL_FSTAT,
+    CALL_READLINK,
+    CALL_REALPATH,
+    CALL_FOPEN,
+    CALL_OPENDIR,
+    CALL_COUNT
+};
+
+static const char *call_names[CALL_COUNT] = {
+    "open", "read", "stat", "fstat", "readlink", "realpath", "fopen", "opendir",
+};
+
+static unsigned long calls[CALL_COUNT];
+
+static const char *fake_root;
+
+#define MAX_FAKE_FDS 1024
+static dev_t fake_fds[MAX_FAKE_FDS];
+
+#define DRM_MAJOR 226
+
+static void *real_function(const char *name)
+{
+    void *func = dlsym(RTLD_NEXT, name);
+
+    if (!func) {
+        fprintf(stderr, "cannot find %s: %s\n", name, dlerror());
+        abort();
+    }
+    return func;
+}
+
+static const char *redirect(const char *path, char *buf)
+{
+    if (!fake_root || !path ||
+        (strncmp(path, "/sys/", 5) && strncmp(path, "/dev/", 5)))
+        return path;
+
+    snprintf(buf, PATH_MAX, "%s%s", fake_root, path);
+    return buf;
+}
+
+/* The device number of a node of the synthetic tree, 0 for other files. */
+static dev_t fake_rdev(const char *path)
+{
+    unsigned int minor;
+
+    if (!fake_root || !path || strncmp(path, "/dev/dri/", 9))
+        return 0;
+
+    if (sscanf(path + 9, "card%u", &minor) != 1 &&
+        sscanf(path + 9, "controlD%u", &minor) != 1 &&
+        sscanf(path + 9, "renderD%u", &minor) != 1)
+        return 0;
+
+    return makedev(DRM_MAJOR, minor);
+}
+
+static void fake_stat(struct stat *st, dev_t rdev)
+{
+    st->st_mode = (st->st_mode & ~S_IFMT) | S_IFCHR;
+    st->st_rdev = rdev;
+}
+
+int open(const char *path, int flags, ...)
+{
+    static int (*real)(const char *, int, ...);
+    char buf[PATH_MAX];
+    mode_t mode = 0;
+    va_list ap;
+    int fd;
+
+    if (flags & O_CREAT) {
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+
+    if (!real)
+        real = real_function("open");
+
+    calls[CALL_OPEN]++;
+    fd = real(redirect(path, buf), flags, mode);
+    if (fd >= 0 && fd < MAX_FAKE_FDS)
+        fake_fds[fd] = fake_rdev(path);
+    return fd;
+}
+
+int close(int fd)
+{
+    static int (*real)(int);
+
+    if (!real)
+        real = real_function("close");
+
+    if (fd >= 0 && fd < MAX_FAKE_FDS)
+        fake_fds[fd] = 0;
+    return real(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    static ssize_t (*real)(int, void *, size_t);
+
+    if (!real)
+        real = real_function("read");
+
+    calls[CALL_READ]++;
+    return real(fd, buf, count);
+}
+
+int stat(const char *path, struct stat *st)
+{
+    static int (*real)(const char *, struct stat *);
+    char buf[PATH_MAX];
+    dev_t rdev;
+    int ret;
+
+    if (!real)
+        real = real_function("stat");
+
+    calls[CALL_STAT]++;
+    ret = real(redirect(path, buf), st);
+    if (!ret && (rdev = fake_rdev(path)))
+        fake_stat(st, rdev);
+    return ret;
+}
+
+int fstat(int fd, struct stat *st)
+{
+    static int (*real)(int, struct stat *);
+    int ret;
+
+    if (!real)
+        real = real_function("fstat");
+
+    calls[CALL_FSTAT]++;
+    ret = real(fd, st);
+    if (!ret && fd >= 0 && fd < MAX_FAKE_FDS && fake_fds[fd])
+        fake_stat(st, fake_fds[fd]);
+    return ret;
+}
+
+ssize_t readlink(const char *path, char *link, size_t size)
+{
+    static ssize_t (*real)(const char *, char *, size_t);
+    char buf[PATH_MAX];
+
+    if (!real)
+        real = real_function("readlink");
+
+    calls[CALL_READLINK]++;
+    return real(redirect(path, buf), link, size);
+}
+
+char *realpath(const char *path, char *resolved)
+{
+    static char *(*real)(const char *, char *);
+    char buf[PATH_MAX];
+
+    if (!real)
+        real = real_function("realpath");
+
+    calls[CALL_REALPATH]++;
+    return real(redirect(path, buf), resolved);
+}
+
+FILE *fopen(const char *path, const char *mode)
+{
+    static FILE *(*real)(const char *, const char *);
+    char buf[PATH_MAX];
+
+    if (!real)
+        real = real_function("fopen");
+
+    calls[CALL_FOPEN]++;
+    return real(redirect(path, buf), mode);
+}
+
+DIR *opendir(const char *path)
+{
+    static DIR *(*real)(const char *);
+    char buf[PATH_MAX];
+
+    if (!real)
+        real = real_function("opendir");
+
+    calls[CALL_OPENDIR]++;
+    return real(redirect(path, buf));
+}
+
 
 static void
 print_device_info(drmDevicePtr device, int i, bool print_revision)
@@ -104,12 +313,347 @@ print_device_info(drmDevicePtr device, int i, bool print_revision)
     printf("\n");
 }
 
+static void DRM_PRINTFLIKE(2, 3)
+tree_path(char *path, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(path, PATH_MAX, fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * Create in a new directory the /dev/dri and /sys entries libdrm looks at
+ * for num_devices PCI devices, each with a primary and a render node. The
+ * primary node minors stop at 63, so do the devices.
+ */
+static char *
+create_tree(int num_devices)
+{
+    static const char *dirs[] = { "/dev", "/dev/dri", "/sys", "/sys/dev",
+                                  "/sys/dev/char", "/sys/devices",
+                                  "/sys/devices/pci0000:00" };
+    char tmpl[] = "/tmp/drmdevice.XXXXXX";
+    char path[PATH_MAX], slot[16], pci[PATH_MAX], target[PATH_MAX];
+    unsigned char config[64] = { 0 };
+    char *root;
+    FILE *fp;
+    int i, n, fd;
+
+    root = mkdtemp(tmpl);
+    if (!root)
+        return NULL;
+    root = strdup(root);
+    if (!root)
+        return NULL;
+
+    for (i = 0; i < (int)(sizeof(dirs) / sizeof(dirs[0])); i++) {
+        tree_path(path, "%s%s", root, dirs[i]);
+        if (mkdir(path, 0755))
+            goto fail;
+    }
+
+    for (i = 0; i < num_devices; i++) {
+        const struct { const char *name; int minor; } nodes[] = {
+            { "card", i }, { "renderD", 128 + i },
+        };
+
+        snprintf(slot, sizeof(slot), "0000:%02x:%02x.0", i / 32, i % 32);
+        tree_path(pci, "%s/sys/devices/pci0000:00/%s", root, slot);
+        if (mkdir(pci, 0755))
+            goto fail;
+
+        tree_path(path, "%s/subsystem", pci);
+        if (symlink("../../../bus/pci", path))
+            goto fail;
+
+#define WRITE_FILE(name, ...) do { \
+        tree_path(path, "%s/%s", pci, name); \
+        fp = fopen(path, "w"); \
+        if (!fp) \
+            goto fail; \
+        fprintf(fp, __VA_ARGS__); \
+        fclose(fp); \
+    } while (0)
+
+        WRITE_FILE("uevent", "DRIVER=fake\nPCI_SLOT_NAME=%s\n", slot);
+        WRITE_FILE("vendor", "0x1234\n");
+        WRITE_FILE("device", "0x%04x\n", 0x1000 + i);
+        WRITE_FILE("subsystem_vendor", "0x1234\n");
+        WRITE_FILE("subsystem_device", "0x%04x\n", i);
+        WRITE_FILE("revision", "0x01\n");
+#undef WRITE_FILE
+
+        tree_path(path, "%s/drm", pci);
+        if (mkdir(path, 0755))
+            goto fail;
+
+        config[0] = 0x34;
+        config[1] = 0x12;
+        config[2] = i & 0xff;
+        config[3] = 0x10 + (i >> 8);
+        config[8] = 0x01;
+        tree_path(path, "%s/config", pci);
+        fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            goto fail;
+        n = write(fd, config, sizeof(config));
+        close(fd);
+        if (n != (int)sizeof(config))
+            goto fail;
+
+        for (unsigned j = 0; j < sizeof(nodes) / sizeof(nodes[0]); j++) {
+            tree_path(path, "%s/dev/dri/%s%d", root,
+                      nodes[j].name, nodes[j].minor);
+            fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd < 0)
+                goto fail;
+            close(fd);
+
+            tree_path(path, "%s/drm/%s%d", pci, nodes[j].name,
+                      nodes[j].minor);
+            if (mkdir(path, 0755))
+                goto fail;
+
+            strncat(path, "/uevent", sizeof(path) - strlen(path) - 1);
+            fp = fopen(path, "w");
+            if (!fp)
+                goto fail;
+            fprintf(fp, "MAJOR=%d\nMINOR=%d\nDEVNAME=dri/%s%d\n", DRM_MAJOR,
+                    nodes[j].minor, nodes[j].name, nodes[j].minor);
+            fclose(fp);
+
+            tree_path(path, "%s/drm/%s%d/device", pci,
+                      nodes[j].name, nodes[j].minor);
+            if (symlink("../..", path))
+                goto fail;
+
+            tree_path(path, "%s/sys/dev/char/%d:%d", root,
+                      DRM_MAJOR, nodes[j].minor);
+            tree_path(target, "../../devices/pci0000:00/%s/drm/%s%d",
+                      slot, nodes[j].name, nodes[j].minor);
+            if (symlink(target, path))
+                goto fail;
+        }
+    }
+
+    return root;
+
+fail:
+    fprintf(stderr, "Failed to create %s - %s (%d)\n", path, strerror(errno),
+            errno);
+    free(root);
+    return NULL;
+}
+
+static int
+remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+static void
+remove_tree(const char *root)
+{
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static uint64_t
+get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+print_bench_header(void)
+{
+    printf("%-26s %8s %10s", "call", "calls", "avg us");
+    for (int i = 0; i < CALL_COUNT; i++)
+        printf(" %8s", call_names[i]);
+    printf("\n");
+}
+
+/* The time and the file system calls per call, from the counters at start. */
+static void
+print_bench(const char *name, unsigned int count, uint64_t start_ns,
+            const unsigned long *start_calls)
+{
+    uint64_t ns = get_time_ns() - start_ns;
+
+    printf("%-26s %8u %10.2f", name, count, ns / 1000.0 / count);
+    for (int i = 0; i < CALL_COUNT; i++)
+        printf(" %8.1f", (double)(calls[i] - start_calls[i]) / count);
+    printf("\n");
+}
+
+/*
+ * Time the first and the following iterations calls of each enumeration
+ * entry point, the first call filling the libdrm device cache.
+ */
+static int
+run_bench(unsigned int iterations)
+{
+    drmDevicePtr devices[256];
+    drmDevicePtr device;
+    unsigned long start_calls[CALL_COUNT];
+    uint64_t start;
+    unsigned int i;
+    int fd = -1, num, node;
+    char *name;
+
+    memcpy(start_calls, calls, sizeof(calls));
+    start = get_time_ns();
+    num = drmGetDevices2(0, devices, 256);
+    print_bench("drmGetDevices2 first", 1, start, start_calls);
+    if (num <= 0) {
+        printf("drmGetDevices2() has not found any devices (errno=%d)\n", -num);
+        return 77;
+    }
+    printf("--- Devices reported %d ---\n", num);
+
+    for (node = DRM_NODE_RENDER; node >= 0 && fd < 0; node--) {
+        if (devices[0]->available_nodes & 1 << node)
+            fd = open(devices[0]->nodes[node], O_RDONLY | O_CLOEXEC, 0);
+    }
+    drmFreeDevices(devices, num);
+
+    memcpy(start_calls, calls, sizeof(calls));
+    start = get_time_ns();
+    for (i = 0; i < iterations; i++) {
+        num = drmGetDevices2(0, devices, 256);
+        if (num > 0)
+            drmFreeDevices(devices, num);
+    }
+    print_bench("drmGetDevices2", iterations, start, start_calls);
+
+    memcpy(start_calls, calls, sizeof(calls));
+    start = get_time_ns();
+    for (i = 0; i < iterations; i++)
+        drmGetDevices2(0, NULL, 0);
+    print_bench("drmGetDevices2 count", iterations, start, start_calls);
+
+    if (fd < 0) {
+        printf("Failed to open a node of device[0] - %s (%d)\n",
+               strerror(errno), errno);
+        return 0;
+    }
+
+    memcpy(start_calls, calls, sizeof(calls));
+    start = get_time_ns();
+    for (i = 0; i < iterations; i++) {
+        if (drmGetDevice2(fd, 0, &device) == 0)
+            drmFreeDevice(&device);
+    }
+    print_bench("drmGetDevice2", iterations, start, start_calls);
+
+    memcpy(start_calls, calls, sizeof(calls));
+    start = get_time_ns();
+    for (i = 0; i < iterations; i++) {
+        if (drmGetDevice2(fd, DRM_DEVICE_GET_PCI_REVISION, &device) == 0)
+            drmFreeDevice(&device);
+    }
+    print_bench("drmGetDevice2 revision", iterations, start, start_calls);
+
+    memcpy(start_calls, calls, sizeof(calls));
+    start = get_time_ns();
+    for (i = 0; i < iterations; i++) {
+        name = drmGetDeviceNameFromFd2(fd);
+        free(name);
+    }
+    print_bench("drmGetDeviceNameFromFd2", iterations, start, start_calls);
+
+    close(fd);
+    return 0;
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-b iterations] [-r root | -g count[,count...]]\n\n", name);
+    fprintf(stderr, "\t-b iterations\tbenchmark the device enumeration calls\n");
+    fprintf(stderr, "\t-r root\t\tlook up /dev and /sys under root\n");
+    fprintf(stderr, "\t-g count\tbenchmark synthetic trees of count PCI devices\n");
+    exit(EXIT_FAILURE);
+}
+
+static int
+bench_synthetic(const char *counts, unsigned int iterations)
+{
+    const char *arg = counts;
+    char *end, *root;
+    long count;
+    int ret = 0;
+
+    while (*arg) {
+        count = strtol(arg, &end, 10);
+        if (end == arg || count <= 0 || count > 64 || (*end && *end != ',')) {
+            fprintf(stderr, "invalid device count in %s\n", counts);
+            return -1;
+        }
+        arg = *end ? end + 1 : end;
+
+        root = create_tree(count);
+        if (!root)
+            return -1;
+
+        printf("--- Synthetic tree of %ld devices, %u iterations ---\n",
+               count, iterations);
+        print_bench_header();
+        fake_root = root;
+        ret = run_bench(iterations);
+        fake_root = NULL;
+
+        remove_tree(root);
+        free(root);
+        if (ret)
+            break;
+    }
+    return ret;
+}
+
 int
-main(void)
+main(int argc, char **argv)
 {
     drmDevicePtr *devices;
     drmDevicePtr device;
     int fd, ret, max_devices;
+    unsigned int iterations = 0;
+    const char *synthetic = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:g:r:")) != -1) {
+        switch (opt) {
+        case 'b':
+            iterations = strtoul(optarg, NULL, 10);
+            if (!iterations)
+                usage(argv[0]);
+            break;
+        case 'g':
+            synthetic = optarg;
+            break;
+        case 'r':
+            fake_root = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (synthetic) {
+        if (fake_root)
+            usage(argv[0]);
+        return bench_synthetic(synthetic, iterations ? iterations : 1000);
+    }
+
+    if (iterations) {
+        printf("--- Benchmarking %u iterations ---\n", iterations);
+        print_bench_header();
+        return run_bench(iterations);
+    }
 
     printf("--- Checking the number of DRM device available ---\n");
     max_devices = drmGetDevices2(0, NULL, 0);
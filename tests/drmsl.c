@@ -38,11 +38,22 @@
  *
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
 
 #include "xf86drm.h"
+#include "table_bench.h"
+
+static const struct table_bench_ops skip_list_ops = {
+    .name = "sl",
+    .create = drmSLCreate,
+    .destroy = drmSLDestroy,
+    .insert = drmSLInsert,
+    .lookup = drmSLLookup,
+    .delete = drmSLDelete,
+};
 
 static void print(void* list)
 {
@@ -106,6 +117,216 @@ static double do_time(int size, int iter)
     return usec;
 }
 
+static double elapsed_usec(const struct timeval *start,
+                           const struct timeval *stop)
+{
+    return (double)(stop->tv_sec * 1000000 + stop->tv_usec
+		    - start->tv_sec * 1000000 - start->tv_usec);
+}
+
+static int compare_keys(const void *a, const void *b)
+{
+    unsigned long ka = *(const unsigned long *)a;
+    unsigned long kb = *(const unsigned long *)b;
+
+    return ka < kb ? -1 : ka > kb;
+}
+
+/* Compare building the list one key at a time against the bulk entry
+ * point, and random against in-order lookups and a full walk. */
+static void do_bulk_time(int size)
+{
+    static unsigned long keys[100000];
+    void           *list, *bulk;
+    void           *ranstate;
+    void           *value;
+    unsigned long  key;
+    struct timeval start, stop;
+    double         insert, build, random, ordered, walk;
+    int            i, n;
+
+    ranstate = drmRandomCreate(54321);
+    for (i = 0; i < size; i++)
+	keys[i] = drmRandom(ranstate);
+    drmRandomDestroy(ranstate);
+
+    list = drmSLCreate();
+    gettimeofday(&start, NULL);
+    for (i = 0; i < size; i++)
+	drmSLInsert(list, keys[i], NULL);
+    gettimeofday(&stop, NULL);
+    insert = elapsed_usec(&start, &stop) / size;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < size; i++) {
+	if (drmSLLookup(list, keys[i], &value))
+	    printf("Error %lu %d\n", keys[i], i);
+    }
+    gettimeofday(&stop, NULL);
+    random = elapsed_usec(&start, &stop) / size;
+
+    qsort(keys, size, sizeof(keys[0]), compare_keys);
+    for (i = 1, n = 1; i < size; i++)
+	if (keys[i] != keys[n - 1])
+	    keys[n++] = keys[i];
+
+    bulk = drmSLCreate();
+    gettimeofday(&start, NULL);
+    if (drmSLBulkInsert(bulk, keys, NULL, n) != n) {
+	fprintf(stderr, "Bulk insert of %d keys failed\n", n);
+	exit(1);
+    }
+    gettimeofday(&stop, NULL);
+    build = elapsed_usec(&start, &stop) / n;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+	if (drmSLLookup(bulk, keys[i], &value))
+	    printf("Error %lu %d\n", keys[i], i);
+    }
+    gettimeofday(&stop, NULL);
+    ordered = elapsed_usec(&start, &stop) / n;
+
+    i = 0;
+    gettimeofday(&start, NULL);
+    if (drmSLFirst(list, &key, &value)) {
+	do {
+	    if (key != keys[i]) {
+		fprintf(stderr, "Walk mismatch at %d: %lu != %lu\n",
+			i, key, keys[i]);
+		exit(1);
+	    }
+	    i++;
+	} while (drmSLNext(list, &key, &value));
+    }
+    gettimeofday(&stop, NULL);
+    walk = elapsed_usec(&start, &stop) / n;
+    if (i != n) {
+	fprintf(stderr, "Walked %d of %d keys\n", i, n);
+	exit(1);
+    }
+
+    printf("%d keys: insert %0.3f, bulk build %0.3f, random lookup %0.3f, "
+	   "ordered lookup %0.3f, walk %0.3f microseconds/key\n",
+	   size, insert, build, random, ordered, walk);
+
+    drmSLDestroy(bulk);
+    drmSLDestroy(list);
+}
+
+/* Delete every other key, then check lookups, seeks and the walk. */
+static void check_delete(int size)
+{
+    void          *list;
+    void          *value;
+    unsigned long key, expected;
+    int           i;
+
+    list = drmSLCreate();
+    for (i = 0; i < size; i++)
+	drmSLInsert(list, (unsigned long)i * 2, (void *)(unsigned long)(i + 1));
+    for (i = 0; i < size; i += 2)
+	drmSLDelete(list, (unsigned long)i * 2);
+
+    for (i = 0; i < size; i++) {
+	int found = !drmSLLookup(list, (unsigned long)i * 2, &value);
+
+	if (found != (i & 1) ||
+	    (found && value != (void *)(unsigned long)(i + 1))) {
+	    fprintf(stderr, "Lookup of %d after delete failed\n", i * 2);
+	    exit(1);
+	}
+    }
+
+    if (drmSLSeek(list, 4, &key, &value) != 1 || key != 6) {
+	fprintf(stderr, "Seek to 4 returned %lu, expected 6\n", key);
+	exit(1);
+    }
+    for (expected = 10; drmSLNext(list, &key, &value); expected += 4) {
+	if (key != expected) {
+	    fprintf(stderr, "Seek walk returned %lu, expected %lu\n",
+		    key, expected);
+	    exit(1);
+	}
+	if (key == 18) {	/* Modify the list mid-walk */
+	    drmSLDelete(list, 22);
+	    expected += 4;
+	}
+    }
+
+    drmSLDestroy(list);
+}
+
+/* Look up the first, last and missing keys, before, between and after the
+ * stored ones, of a list of odd keys either inserted or bulk built. */
+static void check_lookup_list(void *list, int size, const char *how)
+{
+    void          *value;
+    unsigned long key;
+    int           i;
+
+    for (i = 0; i < size; i++) {
+	key = (unsigned long)i * 2 + 1;
+	if (drmSLLookup(list, key, &value) ||
+	    value != (void *)(unsigned long)(i + 1)) {
+	    fprintf(stderr, "%s: lookup of %lu failed\n", how, key);
+	    exit(1);
+	}
+	if (!drmSLLookup(list, key - 1, &value) || value) {
+	    fprintf(stderr, "%s: lookup of missing %lu succeeded\n", how,
+		    key - 1);
+	    exit(1);
+	}
+    }
+    if (!drmSLLookup(list, (unsigned long)size * 2 + 1, &value) || value ||
+	!drmSLLookup(list, ULONG_MAX, &value) || value) {
+	fprintf(stderr, "%s: lookup past the last key succeeded\n", how);
+	exit(1);
+    }
+
+				/* Duplicates are refused, keeping the value */
+    if (drmSLInsert(list, 1, NULL) != 1 ||
+	drmSLInsert(list, (unsigned long)size * 2 - 1, NULL) != 1 ||
+	drmSLLookup(list, 1, &value) || value != (void *)1UL ||
+	drmSLLookup(list, (unsigned long)size * 2 - 1, &value) ||
+	value != (void *)(unsigned long)size) {
+	fprintf(stderr, "%s: duplicate insert changed the list\n", how);
+	exit(1);
+    }
+}
+
+static void check_lookup(int size)
+{
+    static unsigned long keys[10000];
+    static void          *values[10000];
+    void                 *list;
+    void                 *value;
+    int                  i;
+
+    list = drmSLCreate();
+    if (!drmSLLookup(list, 0, &value) || value) {
+	fprintf(stderr, "Lookup in an empty list succeeded\n");
+	exit(1);
+    }
+    for (i = size - 1; i >= 0; i--)
+	drmSLInsert(list, (unsigned long)i * 2 + 1,
+		    (void *)(unsigned long)(i + 1));
+    check_lookup_list(list, size, "insert");
+    drmSLDestroy(list);
+
+    for (i = 0; i < size; i++) {
+	keys[i]   = (unsigned long)i * 2 + 1;
+	values[i] = (void *)(unsigned long)(i + 1);
+    }
+    list = drmSLCreate();
+    if (drmSLBulkInsert(list, keys, values, size) != size) {
+	fprintf(stderr, "Bulk insert of %d keys failed\n", size);
+	exit(1);
+    }
+    check_lookup_list(list, size, "bulk");
+    drmSLDestroy(list);
+}
+
 static void print_neighbors(void *list, unsigned long key,
                             unsigned long expected_prev,
                             unsigned long expected_next)
@@ -133,10 +354,15 @@ static void print_neighbors(void *list, unsigned long key,
     }
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
     void*    list;
     double   usec, usec2, usec3, usec4;
+    unsigned int max_count;
+
+    max_count = table_bench_parse_args(argc, argv, argv[0]);
+    if (max_count)
+	return table_bench(&skip_list_ops, max_count);
 
     list = drmSLCreate();
     printf( "list at %p\n", list);
@@ -180,5 +406,13 @@ int main(void)
     printf("Table size increased by %0.2f, search time increased by %0.2f\n",
 	   100000.0/100.0, usec4 / usec);
 
+    check_delete(10000);
+    check_lookup(1);
+    check_lookup(64);
+    check_lookup(1000);
+
+    do_bulk_time(1000);
+    do_bulk_time(100000);
+
     return 0;
 }
@@ -38,6 +38,7 @@
 #include "cmdstream.xml.h"
 
 #include "write_bmp.h"
+#include "etnaviv_bench.h"
 
 static inline void etna_emit_load_state(struct etna_cmd_stream *stream,
 		const uint16_t offset, const uint16_t count)
@@ -181,12 +182,15 @@ int main(int argc, char *argv[])
 	struct etna_cmd_stream *stream;
 
 	drmVersionPtr version;
+	unsigned iterations;
 	int fd, ret = 0;
 	uint64_t feat;
 	int core = 0;
 
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s /dev/dri/<device> [<etna.bmp>]\n", argv[0]);
+	iterations = etna_bench_parse_args(argc, argv, 2);
+	if (argc < 2 || (argc > 2 && !iterations && !strcmp(argv[2], "-b"))) {
+		fprintf(stderr, "Usage: %s /dev/dri/<device> [<etna.bmp> | -b [iterations]]\n",
+			argv[0]);
 		return 1;
 	}
 
@@ -196,7 +200,7 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	version = drmGetVersion(fd);
+	version = iterations ? NULL : drmGetVersion(fd);
 	if (version) {
 		printf("Version: %d.%d.%d\n", version->version_major,
 		       version->version_minor, version->version_patchlevel);
@@ -263,7 +267,34 @@ int main(int argc, char *argv[])
 
 	etna_cmd_stream_finish(stream);
 
-	if (argc > 2)
+	if (iterations) {
+		uint64_t start, stream_ns = 0, flush_ns = 0;
+		char params[48];
+		unsigned i;
+
+		/* The same clear, flushed without waiting for each one. */
+		for (i = 0; i < iterations; i++) {
+			start = etna_bench_now();
+			gen_cmd_stream(stream, bmp, width, height);
+			stream_ns += etna_bench_now() - start;
+
+			start = etna_bench_now();
+			etna_cmd_stream_flush(stream);
+			flush_ns += etna_bench_now() - start;
+		}
+		start = etna_bench_now();
+		etna_cmd_stream_finish(stream);
+		flush_ns += etna_bench_now() - start;
+
+		snprintf(params, sizeof(params), "\"width\": %d, \"height\": %d",
+			 width, height);
+		etna_bench_start("etnaviv_2d", iterations);
+		etna_bench_report("2d_clear_stream", params, iterations,
+				  stream_ns);
+		etna_bench_report("2d_clear", params, iterations,
+				  stream_ns + flush_ns);
+		etna_bench_end();
+	} else if (argc > 2)
 		bmp_dump32(etna_bo_map(bmp), width, height, false, argv[2]);
 
 	if (etna_check_image(etna_bo_map(bmp), width, height))
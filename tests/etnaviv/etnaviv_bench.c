@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2016 Etnaviv Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "etnaviv_bench.h"
+
+static bool etna_bench_first;
+
+uint64_t etna_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+unsigned etna_bench_parse_args(int argc, char **argv, int index)
+{
+	unsigned long iterations = ETNA_BENCH_DEFAULT_ITERATIONS;
+	char *end;
+
+	if (argc <= index || strcmp(argv[index], "-b"))
+		return 0;
+
+	if (argc > index + 1) {
+		iterations = strtoul(argv[index + 1], &end, 10);
+		if (*end || !iterations || iterations > 100000000)
+			return 0;
+	}
+	return iterations;
+}
+
+void etna_bench_start(const char *test, unsigned iterations)
+{
+	printf("{\n  \"test\": \"%s\",\n  \"iterations\": %u,\n"
+	       "  \"results\": [", test, iterations);
+	etna_bench_first = true;
+}
+
+void etna_bench_report(const char *name, const char *params,
+		uint64_t ops, uint64_t ns)
+{
+	printf("%s\n    {\"name\": \"%s\"%s%s, \"ops\": %" PRIu64
+	       ", \"ns\": %" PRIu64 ", \"ns_per_op\": %.1f, "
+	       "\"ops_per_sec\": %.0f}", etna_bench_first ? "" : ",", name,
+	       params ? ", " : "", params ? params : "", ops, ns,
+	       ops ? (double)ns / ops : 0.0, ns ? ops * 1e9 / ns : 0.0);
+	etna_bench_first = false;
+	fflush(stdout);
+}
+
+void etna_bench_end(void)
+{
+	printf("\n  ]\n}\n");
+}
+
+struct etna_gpu *etna_bench_2d_gpu(struct etna_device *dev)
+{
+	struct etna_gpu *gpu;
+	uint64_t feat;
+	unsigned core;
+
+	for (core = 0; (gpu = etna_gpu_new(dev, core)); core++) {
+		if (!etna_gpu_get_param(gpu, ETNA_GPU_FEATURES_0, &feat) &&
+		    (feat & (1 << 9)))
+			return gpu;
+		etna_gpu_del(gpu);
+	}
+
+	return NULL;
+}
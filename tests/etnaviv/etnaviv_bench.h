@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 Etnaviv Project
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Benchmark modes of the etnaviv tests, which print their results as a
+ * JSON object with one entry per measurement:
+ *
+ *   {"name": ..., <params>, "ops": ..., "ns": ..., "ns_per_op": ...,
+ *    "ops_per_sec": ...}
+ */
+
+#ifndef ETNAVIV_BENCH_H
+#define ETNAVIV_BENCH_H
+
+#include <stdint.h>
+
+#include "etnaviv_drmif.h"
+
+#define ETNA_BENCH_DEFAULT_ITERATIONS 1000
+
+uint64_t etna_bench_now(void);
+
+/* The iterations of "-b [iterations]" at argv[index], 0 without it. */
+unsigned etna_bench_parse_args(int argc, char **argv, int index);
+
+void etna_bench_start(const char *test, unsigned iterations);
+void etna_bench_report(const char *name, const char *params,
+		uint64_t ops, uint64_t ns);
+void etna_bench_end(void);
+
+/* The first core able to do 2D, NULL if none. */
+struct etna_gpu *etna_bench_2d_gpu(struct etna_device *dev);
+
+#endif
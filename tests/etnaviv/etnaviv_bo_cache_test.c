@@ -36,6 +36,8 @@
 #include "etnaviv_drmif.h"
 #include "etnaviv_drm.h"
 
+#include "etnaviv_bench.h"
+
 static void test_cache(struct etna_device *dev)
 {
 	struct etna_bo *bo, *tmp;
@@ -78,17 +80,72 @@ static void test_size_rounding(struct etna_device *dev)
 	printf("ok\n");
 }
 
+/* etna_bo_new()/etna_bo_del() pairs, with the cache and with a cache which
+ * frees the buffers right away. */
+static void bench_bo_new_del(struct etna_device *dev, unsigned iterations)
+{
+	static const uint32_t sizes[] = { 4096, 65536, 1048576 };
+	char params[64];
+	unsigned cached, s, i;
+
+	for (cached = 0; cached < 2; cached++) {
+		etna_device_set_bo_cache(dev, 2, 64 * 1024 * 1024, 0,
+				cached ? 1000 : 0);
+
+		for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			uint64_t start;
+
+			start = etna_bench_now();
+			for (i = 0; i < iterations; i++) {
+				struct etna_bo *bo = etna_bo_new(dev, sizes[s],
+						ETNA_BO_UNCACHED);
+				assert(bo);
+				etna_bo_del(bo);
+			}
+
+			snprintf(params, sizeof(params),
+				 "\"size\": %u, \"cache\": %s", sizes[s],
+				 cached ? "true" : "false");
+			etna_bench_report("bo_new_del", params, iterations,
+					  etna_bench_now() - start);
+		}
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	struct etna_device *dev;
 
 	drmVersionPtr version;
+	unsigned iterations;
 	int fd, ret = 0;
 
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s /dev/dri/<device> [-b [iterations]]\n",
+			argv[0]);
+		return 1;
+	}
+
 	fd = open(argv[1], O_RDWR);
 	if (fd < 0)
 		return 1;
 
+	iterations = etna_bench_parse_args(argc, argv, 2);
+	if (iterations) {
+		dev = etna_device_new(fd);
+		if (!dev) {
+			ret = 2;
+			goto out;
+		}
+
+		etna_bench_start("etnaviv_bo_cache", iterations);
+		bench_bo_new_del(dev, iterations);
+		etna_bench_end();
+
+		etna_device_del(dev);
+		goto out;
+	}
+
 	version = drmGetVersion(fd);
 	if (version) {
 		printf("Version: %d.%d.%d\n", version->version_major,
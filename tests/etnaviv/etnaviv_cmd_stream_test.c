@@ -26,10 +26,19 @@
 
 #undef NDEBUG
 #include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "etnaviv_drmif.h"
+#include "etnaviv_drm.h"
+
+#include "state_2d.xml.h"
+#include "cmdstream.xml.h"
+
+#include "etnaviv_bench.h"
 
 static void test_avail()
 {
@@ -113,11 +122,118 @@ static void test_offset()
 	printf("ok\n");
 }
 
-int main(int argc, char *argv[])
+/* Loads the address of every bo into a 2D state, nothing is drawn. The
+ * relocs and the flushes are timed apart, as the number of bo's grows. */
+static int bench_reloc_flush(struct etna_device *dev, unsigned iterations)
 {
-	test_avail();
-	test_emit();
-	test_offset();
+	static const unsigned counts[] = { 16, 256, 4096 };
+	struct etna_cmd_stream *stream;
+	struct etna_pipe *pipe;
+	struct etna_gpu *gpu;
+	struct etna_bo **bos;
+	char params[32];
+	unsigned c, i, j;
+
+	gpu = etna_bench_2d_gpu(dev);
+	if (!gpu) {
+		fprintf(stderr, "no 2D capable core\n");
+		return 3;
+	}
+
+	pipe = etna_pipe_new(gpu, ETNA_PIPE_2D);
+	assert(pipe);
+	stream = etna_cmd_stream_new(pipe, 0x4000, NULL, NULL);
+	assert(stream);
+	bos = calloc(counts[2], sizeof(*bos));
+	assert(bos);
+	for (i = 0; i < counts[2]; i++) {
+		bos[i] = etna_bo_new(dev, 4096, ETNA_BO_UNCACHED);
+		assert(bos[i]);
+	}
+
+	for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+		uint64_t reloc_ns = 0, flush_ns = 0, start;
+
+		for (i = 0; i < iterations; i++) {
+			start = etna_bench_now();
+			for (j = 0; j < counts[c]; j++) {
+				etna_cmd_stream_reserve(stream, 2);
+				etna_cmd_stream_emit(stream,
+					VIV_FE_LOAD_STATE_HEADER_OP_LOAD_STATE |
+					VIV_FE_LOAD_STATE_HEADER_OFFSET(VIVS_DE_DEST_ADDRESS >> 2) |
+					VIV_FE_LOAD_STATE_HEADER_COUNT(1));
+				etna_cmd_stream_reloc(stream, &(struct etna_reloc){
+					.bo = bos[j],
+					.flags = ETNA_RELOC_READ,
+					.offset = 0,
+				});
+			}
+			reloc_ns += etna_bench_now() - start;
+
+			start = etna_bench_now();
+			etna_cmd_stream_flush(stream);
+			flush_ns += etna_bench_now() - start;
+		}
+		etna_cmd_stream_finish(stream);
+
+		snprintf(params, sizeof(params), "\"bos\": %u", counts[c]);
+		etna_bench_report("cmd_stream_reloc", params,
+				  (uint64_t)iterations * counts[c], reloc_ns);
+		etna_bench_report("cmd_stream_flush", params, iterations,
+				  flush_ns);
+	}
+
+	for (i = 0; i < counts[2]; i++)
+		etna_bo_del(bos[i]);
+	free(bos);
+	etna_cmd_stream_del(stream);
+	etna_pipe_del(pipe);
+	etna_gpu_del(gpu);
 
 	return 0;
 }
+
+int main(int argc, char *argv[])
+{
+	struct etna_device *dev;
+	unsigned iterations;
+	int fd, ret;
+
+	if (argc == 1) {
+		test_avail();
+		test_emit();
+		test_offset();
+
+		return 0;
+	}
+
+	iterations = ETNA_BENCH_DEFAULT_ITERATIONS;
+	if (argc == 4)
+		iterations = strtoul(argv[3], NULL, 10);
+	if (argc < 3 || argc > 4 || strcmp(argv[1], "-b") || !iterations) {
+		fprintf(stderr, "Usage: %s [-b /dev/dri/<device> [iterations]]\n",
+			argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[2], O_RDWR);
+	if (fd < 0) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	dev = etna_device_new(fd);
+	if (!dev) {
+		close(fd);
+		return 2;
+	}
+
+	etna_bench_start("etnaviv_cmd_stream", iterations);
+	ret = bench_reloc_flush(dev, iterations);
+	etna_bench_end();
+
+	etna_device_del(dev);
+	close(fd);
+
+	return ret;
+}
@@ -23,9 +23,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <getopt.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <xf86drm.h>
 
@@ -208,12 +210,360 @@ static int fimg2d_perf_multi(struct exynos_bo *bo, struct g2d_context *ctx,
 	return ret;
 }
 
+/* Operations of the op matrix, all from a src image of the thread into its
+ * dst image, the scaled ones up from half the size. */
+struct fimg2d_perf_op {
+	const char *name;
+	int (*run)(struct g2d_context *ctx, struct g2d_image *src,
+		struct g2d_image *dst, unsigned x, unsigned y, unsigned w, unsigned h);
+};
+
+static int perf_copy(struct g2d_context *ctx, struct g2d_image *src,
+		struct g2d_image *dst, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	return g2d_copy(ctx, src, dst, 0, 0, x, y, w, h);
+}
+
+static int perf_scale(struct g2d_context *ctx, struct g2d_image *src,
+		struct g2d_image *dst, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	return g2d_copy_with_scale(ctx, src, dst, 0, 0, (w + 1) / 2, (h + 1) / 2,
+		x, y, w, h, 0);
+}
+
+static int perf_blend(struct g2d_context *ctx, struct g2d_image *src,
+		struct g2d_image *dst, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	return g2d_blend(ctx, src, dst, 0, 0, x, y, w, h, G2D_OP_OVER);
+}
+
+static int perf_scale_blend(struct g2d_context *ctx, struct g2d_image *src,
+		struct g2d_image *dst, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	return g2d_scale_and_blend(ctx, src, dst, 0, 0, (w + 1) / 2, (h + 1) / 2,
+		x, y, w, h, G2D_OP_OVER);
+}
+
+static const struct fimg2d_perf_op perf_ops[] = {
+	{ "copy", perf_copy },
+	{ "scale", perf_scale },
+	{ "blend", perf_blend },
+	{ "scale_and_blend", perf_scale_blend },
+};
+
+static const unsigned perf_sizes[] = { 16, 64, 256, 1024 };
+
+/* exec: g2d_exec() after every operation, batch: g2d_exec() after a batch,
+ * async: g2d_exec_async() after a batch, with up to PERF_ASYNC_DEPTH
+ * batches in flight. */
+enum fimg2d_perf_mode {
+	PERF_MODE_EXEC,
+	PERF_MODE_BATCH,
+	PERF_MODE_ASYNC,
+	PERF_MODE_NR
+};
+
+static const char *perf_mode_names[PERF_MODE_NR] = { "exec", "batch", "async" };
+
+#define PERF_ASYNC_DEPTH	4
+#define PERF_MAX_BUF_SIZE	1024
+
+/* A thread of the op matrix, with a DRM fd of its own since the G2D events
+ * of a context are read from its fd. */
+struct fimg2d_perf_thread {
+	pthread_t thread;
+	int fd;
+	struct exynos_device *dev;
+	struct g2d_context *ctx;
+	struct exynos_bo *src_bo, *dst_bo;
+	struct g2d_image src, dst;
+	unsigned int seed;
+
+	/* what to run */
+	const struct fimg2d_perf_op *op;
+	enum fimg2d_perf_mode mode;
+	unsigned size, iterations, batch;
+
+	/* results, latencies are per submission */
+	unsigned long long start, end;
+	unsigned long long *lat;
+	unsigned lat_nr;
+	unsigned ops;
+	int ret;
+
+	unsigned long long submitted[PERF_ASYNC_DEPTH];
+};
+
+static unsigned long long perf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void perf_async_done(struct g2d_context *ctx, uint32_t token, void *data)
+{
+	struct fimg2d_perf_thread *th = data;
+
+	th->lat[th->lat_nr++] = perf_now() - th->submitted[token % PERF_ASYNC_DEPTH];
+}
+
+static int perf_queue(struct fimg2d_perf_thread *th)
+{
+	unsigned x, y, size = th->size;
+
+	x = rand_r(&th->seed) % (th->dst.width - size + 1);
+	y = rand_r(&th->seed) % (th->dst.height - size + 1);
+
+	return th->op->run(th->ctx, &th->src, &th->dst, x, y, size, size);
+}
+
+static void *perf_thread_run(void *arg)
+{
+	struct fimg2d_perf_thread *th = arg;
+	unsigned batch = th->mode == PERF_MODE_EXEC ? 1 : th->batch;
+	unsigned submissions = (th->iterations + batch - 1) / batch;
+	uint32_t tokens[PERF_ASYNC_DEPTH], token = 0;
+	unsigned i, j, inflight = 0;
+	int ret = 0;
+
+	th->lat_nr = 0;
+	th->ops = 0;
+	th->start = perf_now();
+
+	for (i = 0; i < submissions; ++i) {
+		unsigned long long t;
+
+		for (j = 0; ret == 0 && j < batch; ++j)
+			ret = perf_queue(th);
+		if (ret != 0)
+			break;
+
+		t = perf_now();
+		if (th->mode != PERF_MODE_ASYNC) {
+			ret = g2d_exec(th->ctx);
+			if (ret != 0)
+				break;
+			th->lat[th->lat_nr++] = perf_now() - t;
+		} else {
+			if (inflight == PERF_ASYNC_DEPTH) {
+				ret = g2d_wait(th->ctx, tokens[i % PERF_ASYNC_DEPTH]);
+				if (ret != 0)
+					break;
+				inflight--;
+			}
+			ret = g2d_exec_async(th->ctx, perf_async_done, th, &token);
+			if (ret != 0)
+				break;
+			th->submitted[token % PERF_ASYNC_DEPTH] = t;
+			tokens[i % PERF_ASYNC_DEPTH] = token;
+			inflight++;
+		}
+		th->ops += batch;
+	}
+
+	if (ret == 0 && inflight)
+		ret = g2d_wait(th->ctx, token);
+
+	th->end = perf_now();
+	th->ret = ret;
+	return NULL;
+}
+
+static int perf_cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void perf_thread_fini(struct fimg2d_perf_thread *th)
+{
+	free(th->lat);
+	if (th->dst_bo)
+		exynos_bo_destroy(th->dst_bo);
+	if (th->src_bo)
+		exynos_bo_destroy(th->src_bo);
+	if (th->ctx)
+		g2d_fini(th->ctx);
+	if (th->dev)
+		exynos_device_destroy(th->dev);
+	if (th->fd >= 0)
+		drmClose(th->fd);
+}
+
+static int perf_thread_init(struct fimg2d_perf_thread *th, unsigned index,
+			unsigned buf_width, unsigned buf_height, unsigned iterations)
+{
+	struct g2d_image *imgs[2] = { &th->src, &th->dst };
+	struct exynos_bo **bos[2] = { &th->src_bo, &th->dst_bo };
+	unsigned i;
+
+	memset(th, 0, sizeof(*th));
+	th->seed = index + 1;
+
+	th->fd = drmOpen("exynos", NULL);
+	if (th->fd < 0)
+		return -1;
+	th->dev = exynos_device_create(th->fd);
+	if (th->dev == NULL)
+		return -2;
+	th->ctx = g2d_init(th->fd);
+	if (th->ctx == NULL)
+		return -3;
+
+	for (i = 0; i < 2; ++i) {
+		*bos[i] = exynos_bo_create(th->dev, buf_width * buf_height * 4, 0);
+		if (*bos[i] == NULL)
+			return -4;
+
+		imgs[i]->width = buf_width;
+		imgs[i]->height = buf_height;
+		imgs[i]->stride = buf_width * 4;
+		imgs[i]->color_mode = G2D_COLOR_FMT_ARGB8888 | G2D_ORDER_AXRGB;
+		imgs[i]->buf_type = G2D_IMGBUF_GEM;
+		imgs[i]->bo[0] = (*bos[i])->handle;
+	}
+
+	th->lat = calloc(iterations, sizeof(*th->lat));
+	if (th->lat == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/* Runs one entry of the op matrix on every thread at once. */
+static int perf_matrix_run(struct fimg2d_perf_thread *threads, unsigned nr_threads)
+{
+	unsigned long long start = ~0ULL, end = 0, *lat, ns;
+	unsigned i, lat_nr = 0, ops = 0, size = threads[0].size;
+	int ret = 0;
+
+	for (i = 0; i < nr_threads; ++i) {
+		if (pthread_create(&threads[i].thread, NULL, perf_thread_run,
+				   &threads[i])) {
+			fprintf(stderr, "error: failed to create thread\n");
+			nr_threads = i;
+			ret = -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < nr_threads; ++i) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].ret != 0)
+			ret = threads[i].ret;
+		if (threads[i].start < start)
+			start = threads[i].start;
+		if (threads[i].end > end)
+			end = threads[i].end;
+		lat_nr += threads[i].lat_nr;
+		ops += threads[i].ops;
+	}
+
+	if (ret != 0) {
+		fprintf(stderr, "error: %s %ux%u %s failed (%d)\n",
+			threads[0].op->name, size, size,
+			perf_mode_names[threads[0].mode], ret);
+		return ret;
+	}
+
+	lat = malloc(lat_nr * sizeof(*lat));
+	if (lat == NULL)
+		return -ENOMEM;
+	for (i = 0, lat_nr = 0; i < nr_threads; ++i) {
+		memcpy(lat + lat_nr, threads[i].lat,
+		       threads[i].lat_nr * sizeof(*lat));
+		lat_nr += threads[i].lat_nr;
+	}
+	qsort(lat, lat_nr, sizeof(*lat), perf_cmp_ull);
+
+	ns = end > start ? end - start : 1;
+	printf("%-15s %4ux%-4u %-5s %10.0f ops/s %9.1f MPix/s"
+	       "  usecs p50 = %llu, p90 = %llu, p99 = %llu\n",
+	       threads[0].op->name, size, size, perf_mode_names[threads[0].mode],
+	       ops * 1e9 / ns, (double)ops * size * size * 1e3 / ns,
+	       lat[lat_nr / 2] / 1000, lat[lat_nr * 9 / 10] / 1000,
+	       lat[lat_nr * 99 / 100] / 1000);
+
+	free(lat);
+	return 0;
+}
+
+static int fimg2d_perf_ops(unsigned buf_width, unsigned buf_height,
+			unsigned iterations, unsigned batch, unsigned nr_threads)
+{
+	struct fimg2d_perf_thread *threads;
+	unsigned i, o, s, m;
+	int ret = 0;
+
+	if (buf_width > PERF_MAX_BUF_SIZE)
+		buf_width = PERF_MAX_BUF_SIZE;
+	if (buf_height > PERF_MAX_BUF_SIZE)
+		buf_height = PERF_MAX_BUF_SIZE;
+	if (batch == 0)
+		batch = 1;
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (threads == NULL) {
+		fprintf(stderr, "error: failed to allocate threads.\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_threads; ++i) {
+		ret = perf_thread_init(&threads[i], i, buf_width, buf_height,
+				       iterations);
+		if (ret != 0) {
+			fprintf(stderr, "error: failed to set up thread %u (%d)\n",
+				i, ret);
+			nr_threads = i + 1;
+			goto out;
+		}
+	}
+
+	printf("starting G2D operation performance test\n");
+	printf("buffer width = %u, buffer height = %u, iterations = %u, "
+	       "batch size = %u, threads = %u\n", buf_width, buf_height,
+	       iterations, batch, nr_threads);
+
+	for (o = 0; o < sizeof(perf_ops) / sizeof(perf_ops[0]); ++o) {
+		for (s = 0; s < sizeof(perf_sizes) / sizeof(perf_sizes[0]); ++s) {
+			if (perf_sizes[s] > buf_width || perf_sizes[s] > buf_height)
+				continue;
+
+			for (m = 0; m < PERF_MODE_NR; ++m) {
+				for (i = 0; i < nr_threads; ++i) {
+					threads[i].op = &perf_ops[o];
+					threads[i].size = perf_sizes[s];
+					threads[i].mode = m;
+					threads[i].iterations = iterations;
+					threads[i].batch = batch;
+				}
+
+				ret = perf_matrix_run(threads, nr_threads);
+				if (ret != 0)
+					goto out;
+			}
+		}
+	}
+
+out:
+	for (i = 0; i < nr_threads; ++i)
+		perf_thread_fini(&threads[i]);
+	free(threads);
+
+	return ret;
+}
+
 static void usage(const char *name)
 {
-	fprintf(stderr, "usage: %s [-ibwh]\n\n", name);
+	fprintf(stderr, "usage: %s [-ibtwh]\n\n", name);
 
 	fprintf(stderr, "\t-i <number of iterations>\n");
-	fprintf(stderr, "\t-b <size of a batch> (default = 3)\n\n");
+	fprintf(stderr, "\t-b <size of a batch> (default = 3)\n");
+	fprintf(stderr, "\t-t <number of threads for the operation test> (default = 1)\n\n");
 
 	fprintf(stderr, "\t-w <buffer width> (default = 4096)\n");
 	fprintf(stderr, "\t-h <buffer height> (default = 4096)\n\n");
@@ -231,13 +581,13 @@ int main(int argc, char **argv)
 	struct g2d_context *ctx;
 	struct exynos_bo *bo;
 
-	unsigned int iters = 0, batch = 3;
+	unsigned int iters = 0, batch = 3, threads = 1;
 	unsigned int bufw = 4096, bufh = 4096;
 
 	ret = 0;
 	parsefail = 0;
 
-	while ((c = getopt(argc, argv, "i:b:w:h:M")) != -1) {
+	while ((c = getopt(argc, argv, "i:b:t:w:h:M")) != -1) {
 		switch (c) {
 		case 'i':
 			if (sscanf(optarg, "%u", &iters) != 1)
@@ -247,6 +597,10 @@ int main(int argc, char **argv)
 			if (sscanf(optarg, "%u", &batch) != 1)
 				parsefail = 1;
 			break;
+		case 't':
+			if (sscanf(optarg, "%u", &threads) != 1 || threads == 0)
+				parsefail = 1;
+			break;
 		case 'w':
 			if (sscanf(optarg, "%u", &bufw) != 1)
 				parsefail = 1;
@@ -311,6 +665,9 @@ int main(int argc, char **argv)
 	if (ret == 0)
 		ret = fimg2d_perf_multi(bo, ctx, bufw, bufh, iters, batch);
 
+	if (ret == 0)
+		ret = fimg2d_perf_ops(bufw, bufh, iters, batch, threads);
+
 	exynos_bo_destroy(bo);
 
 bo_fail:
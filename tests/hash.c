@@ -73,6 +73,16 @@
 
 #include "xf86drm.h"
 #include "xf86drmHash.h"
+#include "table_bench.h"
+
+static const struct table_bench_ops hash_ops = {
+    .name = "hash",
+    .create = drmHashCreate,
+    .destroy = drmHashDestroy,
+    .insert = drmHashInsert,
+    .lookup = drmHashLookup,
+    .delete = drmHashDelete,
+};
 
 #define DIST_LIMIT 10
 static int dist[DIST_LIMIT];
@@ -84,15 +94,6 @@ static void clear_dist(void) {
         dist[i] = 0;
 }
 
-static int count_entries(HashBucketPtr bucket)
-{
-    int count = 0;
-
-    for (; bucket; bucket = bucket->next)
-        ++count;
-    return count;
-}
-
 static void update_dist(int count)
 {
     if (count >= DIST_LIMIT)
@@ -101,21 +102,30 @@ static void update_dist(int count)
         ++dist[count];
 }
 
+/* Histogram of the lengths of runs of occupied buckets, which bound the
+ * number of probes a lookup needs. */
 static void compute_dist(HashTablePtr table)
 {
-    int           i;
-    HashBucketPtr bucket;
+    unsigned long i;
+    int           run = 0;
 
-    printf("Entries = %ld, hits = %ld, partials = %ld, misses = %ld\n",
-          table->entries, table->hits, table->partials, table->misses);
+    printf("Entries = %ld, size = %ld, hits = %ld, partials = %ld, misses = %ld\n",
+          table->entries, table->size, table->hits, table->partials,
+          table->misses);
     clear_dist();
-    for (i = 0; i < HASH_SIZE; i++) {
-        bucket = table->buckets[i];
-        update_dist(count_entries(bucket));
+    for (i = 0; i < table->size; i++) {
+        if (table->buckets[i].state != HASH_BUCKET_EMPTY) {
+            ++run;
+        } else if (run) {
+            update_dist(run);
+            run = 0;
+        }
     }
-    for (i = 0; i < DIST_LIMIT; i++) {
+    if (run)
+        update_dist(run);
+    for (i = 1; i < DIST_LIMIT; i++) {
         if (i != DIST_LIMIT-1)
-            printf("%5d %10d\n", i, dist[i]);
+            printf("%5lu %10d\n", i, dist[i]);
         else
             printf("other %10d\n", dist[i]);
     }
@@ -152,11 +162,16 @@ static int check_table(HashTablePtr table,
     return retcode;
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
     HashTablePtr  table;
     unsigned long i;
     int           ret = 0;
+    unsigned int  max_count;
+
+    max_count = table_bench_parse_args(argc, argv, argv[0]);
+    if (max_count)
+        return table_bench(&hash_ops, max_count);
 
     printf("\n***** 256 consecutive integers ****\n");
     table = drmHashCreate();
@@ -213,5 +228,28 @@ int main(void)
     compute_dist(table);
     drmHashDestroy(table);
 
+    printf("\n***** 20000 handles, interleaved deletes ****\n");
+    table = drmHashCreate();
+    for (i = 1; i <= 20000; i++)
+        drmHashInsert(table, i, (void *)(i << 16 | i));
+    for (i = 2; i <= 20000; i += 2)
+        drmHashDelete(table, i);
+    for (i = 1; i <= 20000; i += 2)
+        ret |= check_table(table, i, (void *)(i << 16 | i));
+    for (i = 2; i <= 20000; i += 2) {
+        void *value;
+
+        if (drmHashLookup(table, i, &value) != 1) {
+            printf("Deleted key %lu still present\n", i);
+            ret = -1;
+        }
+    }
+    for (i = 2; i <= 20000; i += 2)
+        drmHashInsert(table, i, (void *)(i << 16 | i));
+    for (i = 1; i <= 20000; i++)
+        ret |= check_table(table, i, (void *)(i << 16 | i));
+    compute_dist(table);
+    drmHashDestroy(table);
+
     return ret;
 }
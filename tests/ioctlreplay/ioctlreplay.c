@@ -0,0 +1,339 @@
+/*
+ * Copyright © 2021 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Summarizes a file written by drmIoctlRecordStart(), or by a process run
+ * with LIBDRM_IOCTL_RECORD=<file>, and optionally replays the queries it
+ * recorded with their arguments on a device.
+ *
+ * Only queries whose arguments hold no pointers the kernel follows, and
+ * whose whole argument was recorded, are replayed: nothing is created,
+ * changed or destroyed on the device.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "xf86drm.h"
+
+#define IOCTL(name) { DRM_IOCTL_##name, #name }
+
+static const struct {
+	unsigned long request;
+	const char *name;
+} ioctl_names[] = {
+	IOCTL(VERSION), IOCTL(GET_UNIQUE), IOCTL(GET_MAGIC),
+	IOCTL(GET_CLIENT), IOCTL(SET_VERSION), IOCTL(GEM_CLOSE),
+	IOCTL(GEM_FLINK), IOCTL(GEM_OPEN), IOCTL(GET_CAP),
+	IOCTL(SET_CLIENT_CAP), IOCTL(AUTH_MAGIC), IOCTL(SET_MASTER),
+	IOCTL(DROP_MASTER), IOCTL(PRIME_HANDLE_TO_FD),
+	IOCTL(PRIME_FD_TO_HANDLE), IOCTL(WAIT_VBLANK),
+	IOCTL(CRTC_GET_SEQUENCE), IOCTL(CRTC_QUEUE_SEQUENCE),
+	IOCTL(MODE_GETRESOURCES), IOCTL(MODE_GETCRTC), IOCTL(MODE_SETCRTC),
+	IOCTL(MODE_CURSOR), IOCTL(MODE_GETGAMMA), IOCTL(MODE_SETGAMMA),
+	IOCTL(MODE_GETENCODER), IOCTL(MODE_GETCONNECTOR),
+	IOCTL(MODE_GETPROPERTY), IOCTL(MODE_SETPROPERTY),
+	IOCTL(MODE_GETPROPBLOB), IOCTL(MODE_GETFB), IOCTL(MODE_ADDFB),
+	IOCTL(MODE_RMFB), IOCTL(MODE_PAGE_FLIP), IOCTL(MODE_DIRTYFB),
+	IOCTL(MODE_CREATE_DUMB), IOCTL(MODE_MAP_DUMB),
+	IOCTL(MODE_DESTROY_DUMB), IOCTL(MODE_GETPLANERESOURCES),
+	IOCTL(MODE_GETPLANE), IOCTL(MODE_SETPLANE), IOCTL(MODE_ADDFB2),
+	IOCTL(MODE_OBJ_GETPROPERTIES), IOCTL(MODE_OBJ_SETPROPERTY),
+	IOCTL(MODE_CURSOR2), IOCTL(MODE_ATOMIC), IOCTL(MODE_CREATEPROPBLOB),
+	IOCTL(MODE_DESTROYPROPBLOB), IOCTL(SYNCOBJ_CREATE),
+	IOCTL(SYNCOBJ_DESTROY), IOCTL(SYNCOBJ_HANDLE_TO_FD),
+	IOCTL(SYNCOBJ_FD_TO_HANDLE), IOCTL(SYNCOBJ_WAIT),
+	IOCTL(SYNCOBJ_RESET), IOCTL(SYNCOBJ_SIGNAL),
+	IOCTL(MODE_CREATE_LEASE), IOCTL(MODE_LIST_LESSEES),
+	IOCTL(MODE_GET_LEASE), IOCTL(MODE_REVOKE_LEASE),
+	IOCTL(SYNCOBJ_TIMELINE_WAIT), IOCTL(SYNCOBJ_QUERY),
+	IOCTL(SYNCOBJ_TRANSFER), IOCTL(SYNCOBJ_TIMELINE_SIGNAL),
+	IOCTL(MODE_GETFB2),
+};
+
+/* Queries that are safe to issue again with a recorded argument. */
+static const unsigned long replayable[] = {
+	DRM_IOCTL_GET_CAP,
+	DRM_IOCTL_CRTC_GET_SEQUENCE,
+	DRM_IOCTL_MODE_GETCRTC,
+	DRM_IOCTL_MODE_GETENCODER,
+};
+
+struct summary {
+	uint64_t request;
+	uint64_t count;
+	uint64_t errors;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t replayed;
+	uint64_t replay_ns;
+};
+
+static const char *ioctl_name(uint64_t request, char *buf, size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(ioctl_names) / sizeof(ioctl_names[0]); i++) {
+		if (ioctl_names[i].request == request)
+			return ioctl_names[i].name;
+	}
+
+	if (DRM_IOCTL_NR(request) >= DRM_COMMAND_BASE &&
+	    DRM_IOCTL_NR(request) < DRM_COMMAND_END)
+		snprintf(buf, size, "DRIVER_0x%02x",
+			 (unsigned int)(DRM_IOCTL_NR(request) - DRM_COMMAND_BASE));
+	else
+		snprintf(buf, size, "0x%08" PRIx64, request);
+	return buf;
+}
+
+static bool is_replayable(const drmIoctlRecord *record)
+{
+	unsigned int i;
+
+	if (!record->arg_size || record->payload_size != record->arg_size)
+		return false;
+
+	for (i = 0; i < sizeof(replayable) / sizeof(replayable[0]); i++) {
+		if (replayable[i] == record->request)
+			return true;
+	}
+	return false;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct summary *find_summary(struct summary *summaries,
+				    unsigned int *count, uint64_t request)
+{
+	unsigned int i;
+
+	for (i = 0; i < *count; i++) {
+		if (summaries[i].request == request)
+			return &summaries[i];
+	}
+
+	memset(&summaries[i], 0, sizeof(summaries[i]));
+	summaries[i].request = request;
+	(*count)++;
+	return &summaries[i];
+}
+
+static int compare_total(const void *a, const void *b)
+{
+	const struct summary *sa = a, *sb = b;
+
+	if (sa->total_ns != sb->total_ns)
+		return sa->total_ns < sb->total_ns ? 1 : -1;
+	return 0;
+}
+
+/* Issues the query of the record \p loops times, returns the ns per call. */
+static uint64_t replay(int fd, const drmIoctlRecord *record, unsigned int loops)
+{
+	union {
+		struct drm_mode_crtc crtc;
+		uint8_t bytes[4096];
+	} arg;
+	uint64_t start, ns = 0;
+	unsigned int i;
+
+	if (record->arg_size > sizeof(arg))
+		return 0;
+
+	for (i = 0; i < loops; i++) {
+		memcpy(&arg, record + 1, record->arg_size);
+		/* GETCRTC ignores them, but don't hand out a stale pointer. */
+		if (record->request == DRM_IOCTL_MODE_GETCRTC) {
+			arg.crtc.set_connectors_ptr = 0;
+			arg.crtc.count_connectors = 0;
+		}
+
+		start = now_ns();
+		drmIoctl(fd, record->request, &arg);
+		ns += now_ns() - start;
+	}
+
+	return ns / loops;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-r device] [-n loops] [-t top] file\n\n"
+		"\t-r device\treplay the recorded queries on device\n"
+		"\t-n loops\ttimes each query is replayed (default 100)\n"
+		"\t-t top\t\tioctls listed (default 20)\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *device = NULL;
+	unsigned int loops = 100, top = 20;
+	const drmIoctlRecordHeader *header;
+	struct summary *summaries;
+	unsigned int num_summaries = 0, i;
+	uint64_t first, index, records = 0, span_ns = 0, last_ns = 0;
+	struct stat st;
+	char name[32];
+	int opt, fd, dev_fd = -1;
+
+	while ((opt = getopt(argc, argv, "r:n:t:")) != -1) {
+		switch (opt) {
+		case 'r':
+			device = optarg;
+			break;
+		case 'n':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			top = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !loops)
+		usage(argv[0]);
+
+	fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "cannot open %s: %s\n", argv[optind],
+			strerror(errno));
+		return 1;
+	}
+
+	if ((size_t)st.st_size < sizeof(*header)) {
+		fprintf(stderr, "%s: not an ioctl recording\n", argv[optind]);
+		return 1;
+	}
+
+	header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		fprintf(stderr, "cannot map %s: %s\n", argv[optind],
+			strerror(errno));
+		return 1;
+	}
+
+	if (header->magic != DRM_IOCTL_RECORD_MAGIC ||
+	    header->version != DRM_IOCTL_RECORD_VERSION ||
+	    header->record_size < sizeof(drmIoctlRecord) ||
+	    (uint64_t)header->num_records * header->record_size >
+	    st.st_size - sizeof(*header)) {
+		fprintf(stderr, "%s: not an ioctl recording\n", argv[optind]);
+		return 1;
+	}
+
+	if (device) {
+		dev_fd = open(device, O_RDWR | O_CLOEXEC);
+		if (dev_fd < 0) {
+			fprintf(stderr, "cannot open %s: %s\n", device,
+				strerror(errno));
+			return 1;
+		}
+	}
+
+	summaries = calloc(header->num_records, sizeof(*summaries));
+	if (!summaries)
+		return 1;
+
+	/* Oldest record still in the ring first. */
+	first = header->head > header->num_records ?
+		header->head - header->num_records : 0;
+	for (index = first; index < header->head; index++) {
+		const drmIoctlRecord *record = (const drmIoctlRecord *)
+			((const char *)(header + 1) +
+			 (index % header->num_records) * header->record_size);
+		struct summary *summary;
+
+		/* Overwritten or still being written. */
+		if (record->seq != index + 1 ||
+		    record->payload_size > header->record_size - sizeof(*record))
+			continue;
+
+		summary = find_summary(summaries, &num_summaries,
+				       record->request);
+		summary->count++;
+		if (record->result)
+			summary->errors++;
+		summary->total_ns += record->duration_ns;
+		if (record->duration_ns > summary->max_ns)
+			summary->max_ns = record->duration_ns;
+
+		if (dev_fd >= 0 && is_replayable(record)) {
+			summary->replayed++;
+			summary->replay_ns += replay(dev_fd, record, loops);
+		}
+
+		if (!records++)
+			span_ns = record->timestamp_ns;
+		last_ns = record->timestamp_ns + record->duration_ns;
+	}
+	span_ns = records ? last_ns - span_ns : 0;
+
+	printf("%" PRIu64 " records of %" PRIu64 " over %" PRIu64 " ms\n",
+	       records, header->head, span_ns / 1000000);
+
+	qsort(summaries, num_summaries, sizeof(*summaries), compare_total);
+	printf("%-28s %10s %8s %12s %10s %10s", "ioctl", "count", "errors",
+	       "total(us)", "avg(ns)", "max(ns)");
+	if (dev_fd >= 0)
+		printf(" %10s %10s", "replayed", "replay(ns)");
+	printf("\n");
+
+	for (i = 0; i < num_summaries && i < top; i++) {
+		struct summary *summary = &summaries[i];
+
+		printf("%-28s %10" PRIu64 " %8" PRIu64 " %12" PRIu64 " %10" PRIu64
+		       " %10" PRIu64,
+		       ioctl_name(summary->request, name, sizeof(name)),
+		       summary->count, summary->errors, summary->total_ns / 1000,
+		       summary->total_ns / summary->count, summary->max_ns);
+		if (dev_fd >= 0 && summary->replayed)
+			printf(" %10" PRIu64 " %10" PRIu64, summary->replayed,
+			       summary->replay_ns / summary->replayed);
+		printf("\n");
+	}
+
+	if (dev_fd >= 0)
+		close(dev_fd);
+	free(summaries);
+	munmap((void *)header, st.st_size);
+	return 0;
+}
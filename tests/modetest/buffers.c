@@ -26,11 +26,19 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#if HAVE_LINUX_UDMABUF_H && HAVE_MEMFD_CREATE
+#include <linux/udmabuf.h>
+#define HAVE_UDMABUF 1
+#endif
 
 #include "drm.h"
 #include "drm_fourcc.h"
@@ -48,6 +56,30 @@ struct bo
 	size_t offset;
 	size_t pitch;
 	unsigned handle;
+
+	/* the imported buffers' dma-buf, and what it was made from: */
+	bool imported;
+	int dmabuf_fd;
+	int memfd;
+	struct bo *src;
+};
+
+enum bo_source_type {
+	BO_SOURCE_UDMABUF,
+	BO_SOURCE_PRIME,
+	BO_SOURCE_FD,
+};
+
+struct bo_source {
+	enum bo_source_type type;
+	/* /dev/udmabuf, or the exporting device: */
+	int fd;
+
+	/* the dma-bufs handed over, used in order, and their layout: */
+	int *fds;
+	unsigned int num_fds, next_fd;
+	unsigned int pitch;
+	uint64_t modifier;
 };
 
 /* -----------------------------------------------------------------------------
@@ -121,19 +153,9 @@ static void bo_unmap(struct bo *bo)
 	bo->ptr = NULL;
 }
 
-struct bo *
-bo_create(int fd, unsigned int format,
-	  unsigned int width, unsigned int height,
-	  unsigned int handles[4], unsigned int pitches[4],
-	  unsigned int offsets[4], enum util_fill_pattern pattern)
+/* The bits per pixel of the first plane, 0 for the unsupported formats. */
+static unsigned int format_bpp(unsigned int format)
 {
-	unsigned int virtual_height;
-	struct bo *bo;
-	unsigned int bpp;
-	void *planes[3] = { 0, };
-	void *virtual;
-	int ret;
-
 	switch (format) {
 	case DRM_FORMAT_C8:
 	case DRM_FORMAT_NV12:
@@ -142,8 +164,7 @@ bo_create(int fd, unsigned int format,
 	case DRM_FORMAT_NV61:
 	case DRM_FORMAT_YUV420:
 	case DRM_FORMAT_YVU420:
-		bpp = 8;
-		break;
+		return 8;
 
 	case DRM_FORMAT_ARGB4444:
 	case DRM_FORMAT_XRGB4444:
@@ -167,13 +188,11 @@ bo_create(int fd, unsigned int format,
 	case DRM_FORMAT_VYUY:
 	case DRM_FORMAT_YUYV:
 	case DRM_FORMAT_YVYU:
-		bpp = 16;
-		break;
+		return 16;
 
 	case DRM_FORMAT_BGR888:
 	case DRM_FORMAT_RGB888:
-		bpp = 24;
-		break;
+		return 24;
 
 	case DRM_FORMAT_ARGB8888:
 	case DRM_FORMAT_XRGB8888:
@@ -191,51 +210,44 @@ bo_create(int fd, unsigned int format,
 	case DRM_FORMAT_RGBX1010102:
 	case DRM_FORMAT_BGRA1010102:
 	case DRM_FORMAT_BGRX1010102:
-		bpp = 32;
-		break;
+		return 32;
 
 	case DRM_FORMAT_XRGB16161616F:
 	case DRM_FORMAT_XBGR16161616F:
 	case DRM_FORMAT_ARGB16161616F:
 	case DRM_FORMAT_ABGR16161616F:
-		bpp = 64;
-		break;
+		return 64;
 
 	default:
-		fprintf(stderr, "unsupported format 0x%08x\n",  format);
-		return NULL;
+		return 0;
 	}
+}
 
+/* The height of the buffer holding all the planes, at the first's pitch. */
+static unsigned int format_virtual_height(unsigned int format,
+					  unsigned int height)
+{
 	switch (format) {
 	case DRM_FORMAT_NV12:
 	case DRM_FORMAT_NV21:
 	case DRM_FORMAT_YUV420:
 	case DRM_FORMAT_YVU420:
-		virtual_height = height * 3 / 2;
-		break;
+		return height * 3 / 2;
 
 	case DRM_FORMAT_NV16:
 	case DRM_FORMAT_NV61:
-		virtual_height = height * 2;
-		break;
+		return height * 2;
 
 	default:
-		virtual_height = height;
-		break;
-	}
-
-	bo = bo_create_dumb(fd, width, virtual_height, bpp);
-	if (!bo)
-		return NULL;
-
-	ret = bo_map(bo, &virtual);
-	if (ret) {
-		fprintf(stderr, "failed to map buffer: %s\n",
-			strerror(-errno));
-		bo_destroy(bo);
-		return NULL;
+		return height;
 	}
+}
 
+static void
+format_planes(unsigned int format, unsigned int height, unsigned int handle,
+	      unsigned int pitch, void *virtual, unsigned int handles[4],
+	      unsigned int pitches[4], unsigned int offsets[4], void *planes[3])
+{
 	/* just testing a limited # of formats to test single
 	 * and multi-planar path.. would be nice to add more..
 	 */
@@ -245,8 +257,8 @@ bo_create(int fd, unsigned int format,
 	case DRM_FORMAT_YUYV:
 	case DRM_FORMAT_YVYU:
 		offsets[0] = 0;
-		handles[0] = bo->handle;
-		pitches[0] = bo->pitch;
+		handles[0] = handle;
+		pitches[0] = pitch;
 
 		planes[0] = virtual;
 		break;
@@ -256,11 +268,11 @@ bo_create(int fd, unsigned int format,
 	case DRM_FORMAT_NV16:
 	case DRM_FORMAT_NV61:
 		offsets[0] = 0;
-		handles[0] = bo->handle;
-		pitches[0] = bo->pitch;
+		handles[0] = handle;
+		pitches[0] = pitch;
 		pitches[1] = pitches[0];
 		offsets[1] = pitches[0] * height;
-		handles[1] = bo->handle;
+		handles[1] = handle;
 
 		planes[0] = virtual;
 		planes[1] = virtual + offsets[1];
@@ -269,14 +281,14 @@ bo_create(int fd, unsigned int format,
 	case DRM_FORMAT_YUV420:
 	case DRM_FORMAT_YVU420:
 		offsets[0] = 0;
-		handles[0] = bo->handle;
-		pitches[0] = bo->pitch;
+		handles[0] = handle;
+		pitches[0] = pitch;
 		pitches[1] = pitches[0] / 2;
 		offsets[1] = pitches[0] * height;
-		handles[1] = bo->handle;
+		handles[1] = handle;
 		pitches[2] = pitches[1];
 		offsets[2] = offsets[1] + pitches[1] * height / 2;
-		handles[2] = bo->handle;
+		handles[2] = handle;
 
 		planes[0] = virtual;
 		planes[1] = virtual + offsets[1];
@@ -325,12 +337,48 @@ bo_create(int fd, unsigned int format,
 	case DRM_FORMAT_ARGB16161616F:
 	case DRM_FORMAT_ABGR16161616F:
 		offsets[0] = 0;
-		handles[0] = bo->handle;
-		pitches[0] = bo->pitch;
+		handles[0] = handle;
+		pitches[0] = pitch;
 
 		planes[0] = virtual;
 		break;
 	}
+}
+
+struct bo *
+bo_create(int fd, unsigned int format,
+	  unsigned int width, unsigned int height,
+	  unsigned int handles[4], unsigned int pitches[4],
+	  unsigned int offsets[4], enum util_fill_pattern pattern)
+{
+	unsigned int virtual_height;
+	struct bo *bo;
+	unsigned int bpp;
+	void *planes[3] = { 0, };
+	void *virtual;
+	int ret;
+
+	bpp = format_bpp(format);
+	if (!bpp) {
+		fprintf(stderr, "unsupported format 0x%08x\n",  format);
+		return NULL;
+	}
+	virtual_height = format_virtual_height(format, height);
+
+	bo = bo_create_dumb(fd, width, virtual_height, bpp);
+	if (!bo)
+		return NULL;
+
+	ret = bo_map(bo, &virtual);
+	if (ret) {
+		fprintf(stderr, "failed to map buffer: %s\n",
+			strerror(-errno));
+		bo_destroy(bo);
+		return NULL;
+	}
+
+	format_planes(format, height, bo->handle, bo->pitch, virtual,
+		      handles, pitches, offsets, planes);
 
 	util_fill_pattern(format, pattern, planes, width, height, pitches[0]);
 	bo_unmap(bo);
@@ -338,11 +386,289 @@ bo_create(int fd, unsigned int format,
 	return bo;
 }
 
+/* -----------------------------------------------------------------------------
+ * Imported buffers
+ */
+
+struct bo_source *bo_source_parse(const char *arg)
+{
+	struct bo_source *source;
+	const char *p;
+	char *end;
+
+	source = calloc(1, sizeof(*source));
+	if (!source) {
+		fprintf(stderr, "failed to allocate buffer source\n");
+		return NULL;
+	}
+	source->fd = -1;
+	source->modifier = DRM_FORMAT_MOD_INVALID;
+
+	if (!strcmp(arg, "udmabuf")) {
+#if HAVE_UDMABUF
+		source->type = BO_SOURCE_UDMABUF;
+		source->fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+		if (source->fd < 0) {
+			fprintf(stderr, "failed to open /dev/udmabuf: %s\n",
+				strerror(errno));
+			goto fail;
+		}
+		return source;
+#else
+		fprintf(stderr, "udmabuf is not supported by this build\n");
+		goto fail;
+#endif
+	}
+
+	if (!strncmp(arg, "prime:", 6)) {
+		source->type = BO_SOURCE_PRIME;
+		source->fd = open(arg + 6, O_RDWR | O_CLOEXEC);
+		if (source->fd < 0) {
+			fprintf(stderr, "failed to open %s: %s\n", arg + 6,
+				strerror(errno));
+			goto fail;
+		}
+		return source;
+	}
+
+	if (strncmp(arg, "fd:", 3))
+		goto invalid;
+
+	source->type = BO_SOURCE_FD;
+	for (p = arg + 3; ; p = end + 1) {
+		int *fds = realloc(source->fds,
+				   (source->num_fds + 1) * sizeof(*fds));
+
+		if (!fds) {
+			fprintf(stderr, "failed to allocate buffer source\n");
+			goto fail;
+		}
+		source->fds = fds;
+		fds[source->num_fds++] = strtol(p, &end, 10);
+		if (end == p || fds[source->num_fds - 1] < 0)
+			goto invalid;
+		if (*end != ',')
+			break;
+	}
+
+	if (*end != ':')
+		goto invalid;
+	p = end + 1;
+	source->pitch = strtoul(p, &end, 10);
+	if (end == p || !source->pitch)
+		goto invalid;
+
+	if (*end == ':') {
+		p = end + 1;
+		source->modifier = strtoull(p, &end, 0);
+		if (end == p)
+			goto invalid;
+	}
+	if (*end)
+		goto invalid;
+
+	return source;
+
+invalid:
+	fprintf(stderr, "invalid buffer source %s\n", arg);
+fail:
+	bo_source_destroy(source);
+	return NULL;
+}
+
+void bo_source_destroy(struct bo_source *source)
+{
+	if (!source)
+		return;
+
+	if (source->fd >= 0)
+		close(source->fd);
+	free(source->fds);
+	free(source);
+}
+
+#if HAVE_UDMABUF
+static int bo_create_udmabuf(struct bo_source *source, struct bo *bo,
+			     size_t pitch, unsigned int height, void **out)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct udmabuf_create create;
+	void *map;
+
+	bo->size = (pitch * height + page_size - 1) & ~(page_size - 1);
+
+	/* udmabuf wants the memfd to be sealed against shrinking. */
+	bo->memfd = memfd_create("modetest", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (bo->memfd < 0 || ftruncate(bo->memfd, bo->size) ||
+	    fcntl(bo->memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+		fprintf(stderr, "failed to create memfd: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	memset(&create, 0, sizeof(create));
+	create.memfd = bo->memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.size = bo->size;
+
+	bo->dmabuf_fd = ioctl(source->fd, UDMABUF_CREATE, &create);
+	if (bo->dmabuf_fd < 0) {
+		fprintf(stderr, "failed to create udmabuf: %s\n",
+			strerror(errno));
+		return -errno;
+	}
+
+	map = mmap(NULL, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   bo->memfd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	bo->ptr = map;
+	*out = map;
+
+	return 0;
+}
+#endif
+
+/*
+ * Import a buffer of the source into the device. The udmabuf and PRIME ones
+ * are allocated linear, with the same layout as the dumb buffers, and filled
+ * with the pattern. The dma-bufs handed over by fd are imported as they are,
+ * with the pitch and the modifier of the source, and the following planes
+ * right after the first like in the dumb buffers.
+ *
+ * The modifier is DRM_FORMAT_MOD_INVALID when the layout is implicit.
+ */
+struct bo *
+bo_import(int fd, struct bo_source *source, unsigned int format,
+	  unsigned int width, unsigned int height,
+	  unsigned int handles[4], unsigned int pitches[4],
+	  unsigned int offsets[4], uint64_t *modifier,
+	  enum util_fill_pattern pattern)
+{
+	unsigned int virtual_height, bpp;
+	void *planes[3] = { 0, };
+	void *virtual = NULL;
+	size_t pitch = 0;
+	struct bo *bo;
+	int ret = 0;
+
+	bpp = format_bpp(format);
+	if (!bpp) {
+		fprintf(stderr, "unsupported format 0x%08x\n",  format);
+		return NULL;
+	}
+	virtual_height = format_virtual_height(format, height);
+
+	bo = calloc(1, sizeof(*bo));
+	if (bo == NULL) {
+		fprintf(stderr, "failed to allocate buffer object\n");
+		return NULL;
+	}
+	bo->fd = fd;
+	bo->imported = true;
+	bo->dmabuf_fd = -1;
+	bo->memfd = -1;
+	*modifier = DRM_FORMAT_MOD_INVALID;
+
+	switch (source->type) {
+	case BO_SOURCE_UDMABUF:
+#if HAVE_UDMABUF
+		/* Scanout engines commonly want the pitch 256 bytes aligned. */
+		pitch = (width * bpp / 8 + 255) & ~255;
+		ret = bo_create_udmabuf(source, bo, pitch, virtual_height,
+					&virtual);
+#endif
+		break;
+
+	case BO_SOURCE_PRIME:
+		bo->src = bo_create_dumb(source->fd, width, virtual_height, bpp);
+		if (!bo->src) {
+			ret = -ENOMEM;
+			break;
+		}
+		pitch = bo->src->pitch;
+
+		ret = drmPrimeHandleToFD(source->fd, bo->src->handle,
+					 DRM_CLOEXEC, &bo->dmabuf_fd);
+		if (ret) {
+			fprintf(stderr, "failed to export buffer: %s\n",
+				strerror(errno));
+			break;
+		}
+
+		ret = bo_map(bo->src, &virtual);
+		if (ret)
+			fprintf(stderr, "failed to map buffer: %s\n",
+				strerror(-errno));
+		break;
+
+	case BO_SOURCE_FD:
+		if (source->next_fd == source->num_fds) {
+			fprintf(stderr, "no dma-buf left for the buffer\n");
+			ret = -ENOENT;
+			break;
+		}
+		pitch = source->pitch;
+		*modifier = source->modifier;
+		break;
+	}
+	if (ret)
+		goto fail;
+
+	ret = drmPrimeFDToHandle(fd, source->type == BO_SOURCE_FD ?
+				 source->fds[source->next_fd] : bo->dmabuf_fd,
+				 &bo->handle);
+	if (ret) {
+		fprintf(stderr, "failed to import dma-buf: %s\n",
+			strerror(errno));
+		goto fail;
+	}
+	if (source->type == BO_SOURCE_FD)
+		source->next_fd++;
+	bo->pitch = pitch;
+
+	format_planes(format, height, bo->handle, pitch, virtual,
+		      handles, pitches, offsets, planes);
+
+	if (virtual) {
+		util_fill_pattern(format, pattern, planes, width, height,
+				  pitches[0]);
+		bo_unmap(bo->src ? bo->src : bo);
+	}
+
+	return bo;
+
+fail:
+	bo_destroy(bo);
+	return NULL;
+}
+
 void bo_destroy(struct bo *bo)
 {
 	struct drm_mode_destroy_dumb arg;
 	int ret;
 
+	if (bo->imported) {
+		struct drm_gem_close close_arg;
+
+		memset(&close_arg, 0, sizeof(close_arg));
+		close_arg.handle = bo->handle;
+		if (bo->handle)
+			drmIoctl(bo->fd, DRM_IOCTL_GEM_CLOSE, &close_arg);
+
+		bo_unmap(bo);
+		if (bo->dmabuf_fd >= 0)
+			close(bo->dmabuf_fd);
+		if (bo->memfd >= 0)
+			close(bo->memfd);
+		if (bo->src) {
+			bo_unmap(bo->src);
+			bo_destroy(bo->src);
+		}
+		free(bo);
+		return;
+	}
+
 	memset(&arg, 0, sizeof(arg));
 	arg.handle = bo->handle;
 
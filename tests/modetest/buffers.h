@@ -27,14 +27,29 @@
 #ifndef __BUFFERS_H__
 #define __BUFFERS_H__
 
+#include <stdint.h>
+
 #include "util/pattern.h"
 
 struct bo;
+struct bo_source;
 
 struct bo *bo_create(int fd, unsigned int format,
 		   unsigned int width, unsigned int height,
 		   unsigned int handles[4], unsigned int pitches[4],
 		   unsigned int offsets[4], enum util_fill_pattern pattern);
+struct bo *bo_import(int fd, struct bo_source *source, unsigned int format,
+		     unsigned int width, unsigned int height,
+		     unsigned int handles[4], unsigned int pitches[4],
+		     unsigned int offsets[4], uint64_t *modifier,
+		     enum util_fill_pattern pattern);
 void bo_destroy(struct bo *bo);
 
+/*
+ * The dma-bufs to import: "udmabuf", "prime:<device>", or
+ * "fd:<fd>[,<fd>...]:<pitch>[:<modifier>]" for the ones handed over.
+ */
+struct bo_source *bo_source_parse(const char *arg);
+void bo_source_destroy(struct bo_source *source);
+
 #endif
@@ -51,6 +51,7 @@
 #include <errno.h>
 #include <poll.h>
 #include <sys/time.h>
+#include <time.h>
 #if HAVE_SYS_SELECT_H
 #include <sys/select.h>
 #endif
@@ -128,6 +129,9 @@ struct device {
 
 	int use_atomic;
 	drmModeAtomicReq *req;
+
+	/* where the -P plane buffers are imported from, if not dumb: */
+	struct bo_source *import;
 };
 
 static inline int64_t U642I64(uint64_t val)
@@ -1180,6 +1184,45 @@ bo_fb_create(int fd, unsigned int fourcc, const uint32_t w, const uint32_t h,
 	return 0;
 }
 
+static int
+plane_fb_create(struct device *dev, unsigned int fourcc, const uint32_t w,
+		const uint32_t h, enum util_fill_pattern pat,
+		struct bo **out_bo, unsigned int *out_fb_id)
+{
+	uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+	uint64_t modifiers[4] = {0}, modifier;
+	unsigned int fb_id, i;
+	struct bo *bo;
+	int ret;
+
+	if (!dev->import)
+		return bo_fb_create(dev->fd, fourcc, w, h, pat, out_bo, out_fb_id);
+
+	bo = bo_import(dev->fd, dev->import, fourcc, w, h, handles, pitches,
+		       offsets, &modifier, pat);
+	if (bo == NULL)
+		return -1;
+
+	if (modifier != DRM_FORMAT_MOD_INVALID) {
+		for (i = 0; i < 4 && handles[i]; i++)
+			modifiers[i] = modifier;
+		ret = drmModeAddFB2WithModifiers(dev->fd, w, h, fourcc, handles,
+						 pitches, offsets, modifiers,
+						 &fb_id, DRM_MODE_FB_MODIFIERS);
+	} else {
+		ret = drmModeAddFB2(dev->fd, w, h, fourcc, handles, pitches,
+				    offsets, &fb_id, 0);
+	}
+	if (ret) {
+		fprintf(stderr, "failed to add fb (%ux%u): %s\n", w, h, strerror(errno));
+		bo_destroy(bo);
+		return -1;
+	}
+	*out_bo = bo;
+	*out_fb_id = fb_id;
+	return 0;
+}
+
 static int atomic_set_plane(struct device *dev, struct plane_arg *p,
 							int pattern, bool update)
 {
@@ -1205,8 +1248,8 @@ static int atomic_set_plane(struct device *dev, struct plane_arg *p,
 	p->old_bo = p->bo;
 
 	if (!plane_bo) {
-		if (bo_fb_create(dev->fd, p->fourcc, p->w, p->h,
-                         pattern, &plane_bo, &p->fb_id))
+		if (plane_fb_create(dev, p->fourcc, p->w, p->h,
+                            pattern, &plane_bo, &p->fb_id))
 			return -1;
 	}
 
@@ -1287,8 +1330,8 @@ static int set_plane(struct device *dev, struct plane_arg *p)
 		p->w, p->h, p->format_str, plane_id);
 
 	/* just use single plane format for now.. */
-	if (bo_fb_create(dev->fd, p->fourcc, p->w, p->h,
-	                 secondary_fill, &p->bo, &p->fb_id))
+	if (plane_fb_create(dev, p->fourcc, p->w, p->h,
+	                    secondary_fill, &p->bo, &p->fb_id))
 		return -1;
 
 	crtc_w = p->w * p->scale;
@@ -1831,6 +1874,682 @@ err_rmfb:
 	bo_destroy(other_bo);
 }
 
+/* -------------------------------------------------------------------------- */
+/* Page flip benchmark */
+
+#define FLIP_BENCH_MAX_BUFFERS	8
+#define FLIP_BENCH_MAX_OVERLAYS	4
+#define LATENCY_HIST_BUCKETS	21
+
+struct flip_bench_args {
+	unsigned int frames;
+	unsigned int num_buffers;
+	bool async;
+};
+
+struct flip_bench {
+	struct device *dev;
+	struct pipe_arg *pipe;
+	const struct flip_bench_args *args;
+
+	struct bo *bo[FLIP_BENCH_MAX_BUFFERS];
+	unsigned int fb_id[FLIP_BENCH_MAX_BUFFERS];
+	unsigned int current;
+	uint32_t plane_id;
+
+	/*
+	 * In atomic mode, the -P planes of the CRTC are flipped instead of
+	 * the primary plane. Their first buffer is the one of the plane_arg.
+	 */
+	struct plane_arg *overlay[FLIP_BENCH_MAX_OVERLAYS];
+	struct bo *overlay_bo[FLIP_BENCH_MAX_OVERLAYS][FLIP_BENCH_MAX_BUFFERS];
+	unsigned int overlay_fb_id[FLIP_BENCH_MAX_OVERLAYS][FLIP_BENCH_MAX_BUFFERS];
+	unsigned int num_overlays;
+
+	uint64_t start_ns, end_ns, submit_ns;
+	unsigned int last_frame;
+	unsigned int flips, missed;
+	bool done;
+
+	/* Submission to the event read, and vblank to the event read. */
+	uint64_t *latency;
+	uint64_t *delivery;
+};
+
+static bool flip_bench_monotonic;
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int flip_bench_submit(struct flip_bench *b)
+{
+	struct device *dev = b->dev;
+	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT;
+	unsigned int fb_id, i;
+	int ret;
+
+	b->current = (b->current + 1) % b->args->num_buffers;
+	fb_id = b->fb_id[b->current];
+	if (b->args->async)
+		flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+
+	b->submit_ns = get_time_ns();
+	if (!dev->use_atomic) {
+		ret = drmModePageFlip(dev->fd, b->pipe->crtc_id, fb_id, flags, b);
+	} else {
+		drmModeAtomicFree(dev->req);
+		dev->req = drmModeAtomicAlloc();
+		if (!b->num_overlays)
+			add_property(dev, b->plane_id, "FB_ID", fb_id);
+		for (i = 0; i < b->num_overlays; i++)
+			add_property(dev, b->overlay[i]->plane_id, "FB_ID",
+				     b->overlay_fb_id[i][b->current]);
+		ret = drmModeAtomicCommit(dev->fd, dev->req,
+					  flags | DRM_MODE_ATOMIC_NONBLOCK, b);
+	}
+	if (ret)
+		fprintf(stderr, "failed to flip CRTC %u: %s\n",
+			b->pipe->crtc_id, strerror(errno));
+	return ret;
+}
+
+static void
+flip_bench_handler(int fd, unsigned int frame,
+		   unsigned int sec, unsigned int usec, void *data)
+{
+	struct flip_bench *b = data;
+	uint64_t now = get_time_ns();
+	uint64_t vblank_ns = sec * 1000000000ull + usec * 1000ull;
+
+	/* The flip pending when the run was stopped. */
+	if (b->done)
+		return;
+
+	b->latency[b->flips] = now - b->submit_ns;
+	b->delivery[b->flips] = flip_bench_monotonic && now > vblank_ns ?
+				now - vblank_ns : 0;
+
+	/* Async flips do not wait for a vblank, so none is missed. */
+	if (b->flips && !b->args->async && frame - b->last_frame > 1)
+		b->missed += frame - b->last_frame - 1;
+	b->last_frame = frame;
+
+	if (++b->flips == b->args->frames) {
+		b->end_ns = now;
+		b->done = true;
+		return;
+	}
+
+	if (flip_bench_submit(b)) {
+		b->end_ns = now;
+		b->done = true;
+	}
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_latency_stats(const char *name, uint64_t *samples,
+				unsigned int count)
+{
+	unsigned int hist[LATENCY_HIST_BUCKETS] = { 0 };
+	unsigned int i, bucket, max = 0;
+	uint64_t us;
+
+	if (!count)
+		return;
+
+	qsort(samples, count, sizeof(*samples), compare_u64);
+
+	printf("  %s (us): min %.1f p50 %.1f p90 %.1f p99 %.1f max %.1f\n",
+	       name, samples[0] / 1000.0, samples[count / 2] / 1000.0,
+	       samples[count * 9 / 10] / 1000.0,
+	       samples[count * 99 / 100] / 1000.0, samples[count - 1] / 1000.0);
+
+	/* Power of two buckets, the last for everything above. */
+	for (i = 0; i < count; i++) {
+		us = samples[i] / 1000;
+		for (bucket = 0; us > 1 && bucket < LATENCY_HIST_BUCKETS - 1;
+		     bucket++)
+			us >>= 1;
+		hist[bucket]++;
+		if (hist[bucket] > max)
+			max = hist[bucket];
+	}
+
+	for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		printf("    %s%8u us %8u |%.*s\n",
+		       i == LATENCY_HIST_BUCKETS - 1 ? ">=" : "< ",
+		       1u << i, hist[i], (int)(hist[i] * 50 / max),
+		       "##################################################");
+	}
+}
+
+static void flip_bench_report(struct flip_bench *b)
+{
+	struct pipe_arg *pipe = b->pipe;
+	double t = (b->end_ns - b->start_ns) / 1e9;
+	unsigned int i;
+
+	printf("CRTC %u %s-%.2fHz: %u flips in %.3fs, %.2f flips/s, "
+	       "%u missed vblanks\n", pipe->crtc_id, pipe->mode->name,
+	       mode_vrefresh(pipe->mode), b->flips, t, t ? b->flips / t : 0,
+	       b->missed);
+	for (i = 0; i < b->num_overlays; i++)
+		printf("  plane %u: %ux%u@%s\n", b->overlay[i]->plane_id,
+		       b->overlay[i]->w, b->overlay[i]->h,
+		       b->overlay[i]->format_str);
+	print_latency_stats("submit to event", b->latency, b->flips);
+	if (flip_bench_monotonic)
+		print_latency_stats("vblank to event", b->delivery, b->flips);
+}
+
+static int flip_bench_init_overlays(struct device *dev,
+				    struct plane_arg *planes,
+				    unsigned int plane_count,
+				    struct flip_bench *b)
+{
+	struct plane_arg *p;
+	unsigned int i, j;
+
+	for (i = 0; i < plane_count; i++) {
+		p = &planes[i];
+		if (p->crtc_id != b->pipe->crtc_id || !p->fb_id)
+			continue;
+		if (b->num_overlays == FLIP_BENCH_MAX_OVERLAYS) {
+			fprintf(stderr, "too many planes on CRTC %u\n",
+				p->crtc_id);
+			return -1;
+		}
+
+		b->overlay[b->num_overlays] = p;
+		b->overlay_fb_id[b->num_overlays][0] = p->fb_id;
+		for (j = 1; j < b->args->num_buffers; j++) {
+			if (plane_fb_create(dev, p->fourcc, p->w, p->h,
+					    j & 1 ? primary_fill : secondary_fill,
+					    &b->overlay_bo[b->num_overlays][j],
+					    &b->overlay_fb_id[b->num_overlays][j]))
+				return -1;
+		}
+		b->num_overlays++;
+	}
+
+	return 0;
+}
+
+static int flip_bench_init(struct device *dev, struct pipe_arg *pipe,
+			   struct plane_arg *planes, unsigned int plane_count,
+			   const struct flip_bench_args *args,
+			   struct flip_bench *b)
+{
+	unsigned int w, h, i, num_buffers;
+	struct plane *plane;
+
+	b->dev = dev;
+	b->pipe = pipe;
+	b->args = args;
+	b->latency = calloc(args->frames, sizeof(*b->latency));
+	b->delivery = calloc(args->frames, sizeof(*b->delivery));
+	if (!b->latency || !b->delivery)
+		return -ENOMEM;
+
+	/* Legacy flips keep the offset into the fb spanning all pipes. */
+	if (dev->use_atomic) {
+		w = pipe->mode->hdisplay;
+		h = pipe->mode->vdisplay;
+	} else {
+		w = dev->mode.width;
+		h = dev->mode.height;
+	}
+
+	if (dev->use_atomic &&
+	    flip_bench_init_overlays(dev, planes, plane_count, b))
+		return -1;
+
+	/* The primary plane only shows the first buffer below overlays. */
+	num_buffers = b->num_overlays ? 1 : args->num_buffers;
+	for (i = 0; i < num_buffers; i++) {
+		if (bo_fb_create(dev->fd, pipe->fourcc, w, h,
+				 i & 1 ? secondary_fill : primary_fill,
+				 &b->bo[i], &b->fb_id[i]))
+			return -1;
+	}
+
+	if (!dev->use_atomic)
+		return 0;
+
+	plane = get_primary_plane_by_crtc(dev, pipe->crtc);
+	if (!plane) {
+		fprintf(stderr, "no primary plane for CRTC %u\n", pipe->crtc_id);
+		return -1;
+	}
+	b->plane_id = plane->plane->plane_id;
+
+	/* Shown by the modeset commit. */
+	add_property(dev, b->plane_id, "FB_ID", b->fb_id[0]);
+	add_property(dev, b->plane_id, "CRTC_ID", pipe->crtc_id);
+	add_property(dev, b->plane_id, "SRC_X", 0);
+	add_property(dev, b->plane_id, "SRC_Y", 0);
+	add_property(dev, b->plane_id, "SRC_W", w << 16);
+	add_property(dev, b->plane_id, "SRC_H", h << 16);
+	add_property(dev, b->plane_id, "CRTC_X", 0);
+	add_property(dev, b->plane_id, "CRTC_Y", 0);
+	add_property(dev, b->plane_id, "CRTC_W", w);
+	add_property(dev, b->plane_id, "CRTC_H", h);
+
+	return 0;
+}
+
+static void flip_bench_fini(struct flip_bench *b)
+{
+	unsigned int i, j;
+
+	if (!b->dev)
+		return;
+
+	for (i = 0; i < FLIP_BENCH_MAX_BUFFERS; i++) {
+		if (b->fb_id[i])
+			drmModeRmFB(b->dev->fd, b->fb_id[i]);
+		if (b->bo[i])
+			bo_destroy(b->bo[i]);
+		for (j = 0; j < b->num_overlays; j++) {
+			if (!b->overlay_bo[j][i])
+				continue;
+			drmModeRmFB(b->dev->fd, b->overlay_fb_id[j][i]);
+			bo_destroy(b->overlay_bo[j][i]);
+		}
+	}
+	free(b->latency);
+	free(b->delivery);
+}
+
+static struct flip_bench *
+flip_bench_setup(struct device *dev, struct pipe_arg *pipes, unsigned int count,
+		 struct plane_arg *planes, unsigned int plane_count,
+		 const struct flip_bench_args *args)
+{
+	struct flip_bench *benches;
+	unsigned int i;
+
+	benches = calloc(count, sizeof(*benches));
+	if (!benches) {
+		fprintf(stderr, "memory allocation failed\n");
+		return NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		/* The pipes that failed to set a mode are skipped. */
+		if (pipes[i].mode == NULL) {
+			benches[i].done = true;
+			continue;
+		}
+
+		if (flip_bench_init(dev, &pipes[i], planes, plane_count, args,
+				    &benches[i])) {
+			fprintf(stderr, "failed to set up the benchmark\n");
+			for (i++; i--;)
+				flip_bench_fini(&benches[i]);
+			free(benches);
+			return NULL;
+		}
+	}
+
+	return benches;
+}
+
+/* Detach the atomic planes of the benchmark, in the teardown request. */
+static void flip_bench_clear(struct device *dev, struct flip_bench *benches,
+			     unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; benches && i < count; i++) {
+		if (!benches[i].plane_id)
+			continue;
+		add_property(dev, benches[i].plane_id, "FB_ID", 0);
+		add_property(dev, benches[i].plane_id, "CRTC_ID", 0);
+	}
+}
+
+static void flip_bench_teardown(struct flip_bench *benches, unsigned int count)
+{
+	unsigned int i;
+
+	if (!benches)
+		return;
+
+	for (i = 0; i < count; i++)
+		flip_bench_fini(&benches[i]);
+	free(benches);
+}
+
+/*
+ * Flip through the buffers on all CRTCs at once until each did the frames,
+ * or a key is pressed. In atomic mode, flip_bench_init() adds the primary
+ * planes to the modeset request, which must be committed before the run,
+ * and the -P planes set on a CRTC are flipped in place of its primary.
+ */
+static void flip_bench_run(struct device *dev, struct flip_bench *benches,
+			   unsigned int count)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = 0, .events = POLLIN },
+		{ .fd = dev->fd, .events = POLLIN },
+	};
+	drmEventContext evctx;
+	unsigned int i, running = 0;
+	uint64_t cap = 0;
+
+	flip_bench_monotonic = !drmGetCap(dev->fd, DRM_CAP_TIMESTAMP_MONOTONIC,
+					  &cap) && cap;
+
+	for (i = 0; i < count; i++) {
+		if (benches[i].done)
+			continue;
+		benches[i].start_ns = get_time_ns();
+		if (flip_bench_submit(&benches[i])) {
+			benches[i].end_ns = benches[i].start_ns;
+			benches[i].done = true;
+		} else {
+			running++;
+		}
+	}
+
+	memset(&evctx, 0, sizeof evctx);
+	evctx.version = 2;
+	evctx.page_flip_handler = flip_bench_handler;
+
+	while (running) {
+		if (poll(pfd, 2, 3000) <= 0) {
+			fprintf(stderr, "timed out waiting for flips\n");
+			break;
+		}
+		if (pfd[0].revents)
+			break;
+
+		drmHandleEvent(dev->fd, &evctx);
+
+		for (running = 0, i = 0; i < count; i++)
+			running += !benches[i].done;
+	}
+
+	/* Leave no flip pending on the buffers about to be freed. */
+	for (i = 0; i < count; i++) {
+		if (!benches[i].done) {
+			benches[i].end_ns = get_time_ns();
+			benches[i].done = true;
+			if (poll(&pfd[1], 1, 1000) > 0)
+				drmHandleEvent(dev->fd, &evctx);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (benches[i].pipe)
+			flip_bench_report(&benches[i]);
+	}
+}
+
+static int parse_flip_bench(struct flip_bench_args *args, const char *arg)
+{
+	char *end;
+
+	args->frames = strtoul(arg, &end, 10);
+	args->num_buffers = 2;
+	args->async = false;
+
+	if (*end == ':' && isdigit(end[1]))
+		args->num_buffers = strtoul(end + 1, &end, 10);
+	if (*end == ':' && !strcmp(end + 1, "async")) {
+		args->async = true;
+		end += strlen(end);
+	}
+
+	if (*end || !args->frames || args->num_buffers < 2 ||
+	    args->num_buffers > FLIP_BENCH_MAX_BUFFERS)
+		return -EINVAL;
+
+	return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+/* Atomic commit stress */
+
+struct atomic_stress_args {
+	unsigned int commits;
+	bool test_only;
+};
+
+struct stress_plane {
+	struct plane *plane;
+	struct pipe_arg *pipe;
+	bool primary;
+	struct bo *bo;
+	unsigned int fb_id;
+};
+
+static uint64_t get_plane_type(struct plane *plane)
+{
+	uint32_t i;
+
+	for (i = 0; plane->props && i < plane->props->count_props; i++) {
+		if (plane->props_info[i] &&
+		    !strcmp(plane->props_info[i]->name, "type"))
+			return plane->props->prop_values[i];
+	}
+	return DRM_PLANE_TYPE_OVERLAY;
+}
+
+/* The primary and overlay planes each pipe may use, one pipe per plane. */
+static struct stress_plane *
+atomic_stress_planes(struct device *dev, struct pipe_arg *pipes,
+		     unsigned int count, unsigned int *num_planes)
+{
+	struct stress_plane *planes;
+	struct plane *plane;
+	uint32_t i, j, n = 0;
+	uint64_t type;
+	bool taken;
+
+	/* Zero terminated. */
+	planes = calloc(dev->resources->count_planes + 1, sizeof(*planes));
+	if (!planes)
+		return NULL;
+
+	for (i = 0; i < count; i++) {
+		struct pipe_arg *pipe = &pipes[i];
+		struct plane *primary;
+
+		if (pipe->mode == NULL)
+			continue;
+
+		primary = get_primary_plane_by_crtc(dev, pipe->crtc);
+
+		for (j = 0; j < dev->resources->count_planes; j++) {
+			plane = &dev->resources->planes[j];
+			if (!plane->plane ||
+			    !(plane->plane->possible_crtcs &
+			      get_crtc_mask(dev, pipe->crtc)) ||
+			    !format_support(plane->plane, pipe->fourcc))
+				continue;
+
+			type = get_plane_type(plane);
+			if (type == DRM_PLANE_TYPE_CURSOR ||
+			    (type == DRM_PLANE_TYPE_PRIMARY && plane != primary))
+				continue;
+
+			for (taken = false, n = 0; planes[n].plane; n++)
+				taken |= planes[n].plane == plane;
+			if (taken)
+				continue;
+
+			planes[n].plane = plane;
+			planes[n].pipe = pipe;
+			planes[n].primary = type == DRM_PLANE_TYPE_PRIMARY;
+		}
+	}
+
+	for (n = 0; planes[n].plane; n++)
+		;
+	*num_planes = n;
+	return planes;
+}
+
+static unsigned int stress_rand(unsigned int *seed, unsigned int max)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 8) % max;
+}
+
+/* A random rectangle of the plane within the mode, or the plane off. */
+static void atomic_stress_plane(struct device *dev, struct stress_plane *sp,
+				unsigned int *seed)
+{
+	uint32_t plane_id = sp->plane->plane->plane_id;
+	drmModeModeInfo *mode = sp->pipe->mode;
+	unsigned int w, h, x, y;
+	unsigned int min_w = mode->hdisplay < 64 ? mode->hdisplay : 64;
+	unsigned int min_h = mode->vdisplay < 64 ? mode->vdisplay : 64;
+
+	if (!sp->primary && !stress_rand(seed, 4)) {
+		add_property(dev, plane_id, "FB_ID", 0);
+		add_property(dev, plane_id, "CRTC_ID", 0);
+		return;
+	}
+
+	/* Drivers often require the primary plane to cover the CRTC. */
+	if (sp->primary) {
+		w = mode->hdisplay;
+		h = mode->vdisplay;
+		x = y = 0;
+	} else {
+		w = min_w + stress_rand(seed, mode->hdisplay - min_w + 1);
+		h = min_h + stress_rand(seed, mode->vdisplay - min_h + 1);
+		x = stress_rand(seed, mode->hdisplay - w + 1);
+		y = stress_rand(seed, mode->vdisplay - h + 1);
+	}
+
+	add_property(dev, plane_id, "FB_ID", sp->fb_id);
+	add_property(dev, plane_id, "CRTC_ID", sp->pipe->crtc_id);
+	add_property(dev, plane_id, "SRC_X", 0);
+	add_property(dev, plane_id, "SRC_Y", 0);
+	add_property(dev, plane_id, "SRC_W", w << 16);
+	add_property(dev, plane_id, "SRC_H", h << 16);
+	add_property(dev, plane_id, "CRTC_X", x);
+	add_property(dev, plane_id, "CRTC_Y", y);
+	add_property(dev, plane_id, "CRTC_W", w);
+	add_property(dev, plane_id, "CRTC_H", h);
+}
+
+/*
+ * Commit random configurations of the planes of the -s CRTCs as fast as
+ * the driver takes them, either for real or TEST_ONLY, and report the
+ * rate, the commits rejected and the latency of a commit.
+ */
+static void atomic_stress(struct device *dev, struct pipe_arg *pipes,
+			  unsigned int count,
+			  const struct atomic_stress_args *args)
+{
+	uint32_t flags = args->test_only ? DRM_MODE_ATOMIC_TEST_ONLY : 0;
+	struct stress_plane *planes;
+	unsigned int num_planes = 0, seed = 1, rejected = 0, done, i;
+	uint64_t *latency, start, t;
+	int ret;
+
+	planes = atomic_stress_planes(dev, pipes, count, &num_planes);
+	latency = calloc(args->commits, sizeof(*latency));
+	if (!planes || !latency || !num_planes) {
+		fprintf(stderr, "no plane to stress\n");
+		goto out;
+	}
+
+	for (i = 0; i < num_planes; i++) {
+		drmModeModeInfo *mode = planes[i].pipe->mode;
+
+		if (bo_fb_create(dev->fd, planes[i].pipe->fourcc,
+				 mode->hdisplay, mode->vdisplay,
+				 planes[i].primary ? primary_fill : secondary_fill,
+				 &planes[i].bo, &planes[i].fb_id))
+			goto out;
+	}
+
+	printf("stressing %u planes with %u %scommits\n", num_planes,
+	       args->commits, args->test_only ? "TEST_ONLY " : "");
+
+	start = get_time_ns();
+	for (done = 0; done < args->commits; done++) {
+		drmModeAtomicFree(dev->req);
+		dev->req = drmModeAtomicAlloc();
+		for (i = 0; i < num_planes; i++)
+			atomic_stress_plane(dev, &planes[i], &seed);
+
+		t = get_time_ns();
+		ret = drmModeAtomicCommit(dev->fd, dev->req, flags, NULL);
+		latency[done] = get_time_ns() - t;
+		if (ret)
+			rejected++;
+	}
+	t = get_time_ns() - start;
+
+	printf("%u commits in %.3fs, %.1f commits/s, %u rejected (%.1f%%)\n",
+	       done, t / 1e9, t ? done * 1e9 / t : 0, rejected,
+	       done ? rejected * 100.0 / done : 0);
+	print_latency_stats("commit", latency, done);
+
+	/* Leave the overlays off and the primary planes showing a buffer. */
+	if (!args->test_only) {
+		drmModeAtomicFree(dev->req);
+		dev->req = drmModeAtomicAlloc();
+		for (i = 0; i < num_planes; i++) {
+			if (planes[i].primary)
+				continue;
+			add_property(dev, planes[i].plane->plane->plane_id,
+				     "FB_ID", 0);
+			add_property(dev, planes[i].plane->plane->plane_id,
+				     "CRTC_ID", 0);
+		}
+		drmModeAtomicCommit(dev->fd, dev->req, 0, NULL);
+	}
+
+out:
+	for (i = 0; planes && i < num_planes; i++) {
+		if (planes[i].fb_id)
+			drmModeRmFB(dev->fd, planes[i].fb_id);
+		if (planes[i].bo)
+			bo_destroy(planes[i].bo);
+	}
+	free(planes);
+	free(latency);
+}
+
+static int parse_atomic_stress(struct atomic_stress_args *args, const char *arg)
+{
+	char *end;
+
+	args->commits = strtoul(arg, &end, 10);
+	args->test_only = false;
+
+	if (*end == ':' && !strcmp(end + 1, "test")) {
+		args->test_only = true;
+		end += strlen(end);
+	}
+
+	if (*end || !args->commits)
+		return -EINVAL;
+
+	return 0;
+}
+
 #define min(a, b)	((a) < (b) ? (a) : (b))
 
 static int parse_connector(struct pipe_arg *pipe, const char *arg)
@@ -1990,7 +2709,7 @@ static void parse_fill_patterns(char *arg)
 
 static void usage(char *name)
 {
-	fprintf(stderr, "usage: %s [-acDdefMPpsCvrw]\n", name);
+	fprintf(stderr, "usage: %s [-aAbcDdefiMPpsCvrw]\n", name);
 
 	fprintf(stderr, "\n Query options:\n\n");
 	fprintf(stderr, "\t-c\tlist connectors\n");
@@ -2000,12 +2719,15 @@ static void usage(char *name)
 
 	fprintf(stderr, "\n Test options:\n\n");
 	fprintf(stderr, "\t-P <plane_id>@<crtc_id>:<w>x<h>[+<x>+<y>][*<scale>][@<format>]\tset a plane\n");
+	fprintf(stderr, "\t-i udmabuf|prime:<device>|fd:<fd>[,<fd>...]:<pitch>[:<modifier>]\timport the -P plane buffers as dma-bufs\n");
 	fprintf(stderr, "\t-s <connector_id>[,<connector_id>][@<crtc_id>]:[#<mode index>]<mode>[-<vrefresh>][@<format>]\tset a mode\n");
 	fprintf(stderr, "\t-C\ttest hw cursor\n");
 	fprintf(stderr, "\t-v\ttest vsynced page flipping\n");
+	fprintf(stderr, "\t-b <frames>[:<buffers>][:async]\tbenchmark page flips on the -s CRTCs, or on their -P planes with -a\n");
 	fprintf(stderr, "\t-r\tset the preferred mode for all connectors\n");
 	fprintf(stderr, "\t-w <obj_id>:<prop_name>:<value>\tset property\n");
 	fprintf(stderr, "\t-a \tuse atomic API\n");
+	fprintf(stderr, "\t-A <commits>[:test]\tstress atomic commits of random plane configurations on the -s CRTCs\n");
 	fprintf(stderr, "\t-F pattern1,pattern2\tspecify fill patterns\n");
 
 	fprintf(stderr, "\n Generic options:\n\n");
@@ -2017,7 +2739,7 @@ static void usage(char *name)
 	exit(0);
 }
 
-static char optstr[] = "acdD:efF:M:P:ps:Cvrw:";
+static char optstr[] = "aA:b:cdD:efF:i:M:P:ps:Cvrw:";
 
 int main(int argc, char **argv)
 {
@@ -2027,6 +2749,11 @@ int main(int argc, char **argv)
 	int encoders = 0, connectors = 0, crtcs = 0, planes = 0, framebuffers = 0;
 	int drop_master = 0;
 	int test_vsync = 0;
+	int test_flip_bench = 0;
+	struct flip_bench_args flip_bench_args;
+	struct flip_bench *benches = NULL;
+	int test_atomic_stress = 0;
+	struct atomic_stress_args atomic_stress_args = { 0 };
 	int test_cursor = 0;
 	int set_preferred = 0;
 	int use_atomic = 0;
@@ -2053,6 +2780,16 @@ int main(int argc, char **argv)
 			/* Preserve the default behaviour of dumping all information. */
 			args--;
 			break;
+		case 'A':
+			if (parse_atomic_stress(&atomic_stress_args, optarg) < 0)
+				usage(argv[0]);
+			test_atomic_stress = 1;
+			break;
+		case 'b':
+			if (parse_flip_bench(&flip_bench_args, optarg) < 0)
+				usage(argv[0]);
+			test_flip_bench = 1;
+			break;
 		case 'c':
 			connectors = 1;
 			break;
@@ -2073,6 +2810,13 @@ int main(int argc, char **argv)
 		case 'F':
 			parse_fill_patterns(optarg);
 			break;
+		case 'i':
+			dev.import = bo_source_parse(optarg);
+			if (!dev.import)
+				return 1;
+			/* Preserve the default behaviour of dumping all information. */
+			args--;
+			break;
 		case 'M':
 			module = optarg;
 			/* Preserve the default behaviour of dumping all information. */
@@ -2143,10 +2887,18 @@ int main(int argc, char **argv)
 	if (!args)
 		encoders = connectors = crtcs = planes = framebuffers = 1;
 
-	if (test_vsync && !count) {
+	if ((test_vsync || test_flip_bench) && !count) {
 		fprintf(stderr, "page flipping requires at least one -s option.\n");
 		return -1;
 	}
+	if (test_atomic_stress && (!use_atomic || !count)) {
+		fprintf(stderr, "atomic stress requires -a and at least one -s option.\n");
+		return -1;
+	}
+	if (test_vsync && test_flip_bench) {
+		fprintf(stderr, "cannot use -v (page flipping) with -b (benchmark)\n");
+		return -1;
+	}
 	if (set_preferred && count) {
 		fprintf(stderr, "cannot use -r (preferred) when -s (mode) is set\n");
 		return -1;
@@ -2192,7 +2944,8 @@ int main(int argc, char **argv)
 	if (dev.use_atomic) {
 		dev.req = drmModeAtomicAlloc();
 
-		if (set_preferred || (count && plane_count)) {
+		if (set_preferred ||
+		    (count && (plane_count || test_flip_bench || test_atomic_stress))) {
 			uint64_t cap = 0;
 
 			ret = drmGetCap(dev.fd, DRM_CAP_DUMB_BUFFER, &cap);
@@ -2207,6 +2960,11 @@ int main(int argc, char **argv)
 			if (plane_count)
 				atomic_set_planes(&dev, plane_args, plane_count, false);
 
+			if (test_flip_bench)
+				benches = flip_bench_setup(&dev, pipe_args, count,
+							   plane_args, plane_count,
+							   &flip_bench_args);
+
 			ret = drmModeAtomicCommit(dev.fd, dev.req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
 			if (ret) {
 				fprintf(stderr, "Atomic Commit failed [1]\n");
@@ -2216,6 +2974,12 @@ int main(int argc, char **argv)
 			if (test_vsync)
 				atomic_test_page_flip(&dev, pipe_args, plane_args, plane_count);
 
+			if (benches)
+				flip_bench_run(&dev, benches, count);
+
+			if (test_atomic_stress)
+				atomic_stress(&dev, pipe_args, count, &atomic_stress_args);
+
 			if (drop_master)
 				drmDropMaster(dev.fd);
 
@@ -2231,6 +2995,8 @@ int main(int argc, char **argv)
 			if (count)
 				atomic_clear_mode(&dev, pipe_args, count);
 
+			flip_bench_clear(&dev, benches, count);
+
 			ret = drmModeAtomicCommit(dev.fd, dev.req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL);
 			if (ret)
 				fprintf(stderr, "Atomic Commit failed\n");
@@ -2262,6 +3028,14 @@ int main(int argc, char **argv)
 			if (test_vsync)
 				test_page_flip(&dev, pipe_args, count);
 
+			if (test_flip_bench) {
+				benches = flip_bench_setup(&dev, pipe_args, count,
+							   plane_args, plane_count,
+							   &flip_bench_args);
+				if (benches)
+					flip_bench_run(&dev, benches, count);
+			}
+
 			if (drop_master)
 				drmDropMaster(dev.fd);
 
@@ -2278,6 +3052,8 @@ int main(int argc, char **argv)
 		}
 	}
 
+	flip_bench_teardown(benches, count);
+	bo_source_destroy(dev.import);
 	free_resources(dev.resources);
 	drmClose(dev.fd);
 
@@ -0,0 +1,150 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Benchmark of the test patterns modetest and the other KMS tests fill
+ * their frame buffers with, drawn in memory so no device is needed.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drm_fourcc.h>
+
+#include "util/bench.h"
+#include "util/common.h"
+#include "util/pattern.h"
+
+struct pattern_bench {
+	uint32_t format;
+	enum util_fill_pattern pattern;
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	void *planes[3];
+};
+
+static void fill(void *data)
+{
+	struct pattern_bench *b = data;
+
+	util_fill_pattern(b->format, b->pattern, b->planes, b->width,
+			  b->height, b->stride);
+}
+
+/* The planes of the format, one after the other in mem. */
+static void setup(struct pattern_bench *b, uint8_t *mem)
+{
+	unsigned int cpp;
+
+	switch (b->format) {
+	case DRM_FORMAT_NV12:
+		b->stride = b->width;
+		b->planes[0] = mem;
+		b->planes[1] = mem + b->stride * b->height;
+		b->planes[2] = NULL;
+		return;
+	case DRM_FORMAT_YUYV:
+	case DRM_FORMAT_RGB565:
+		cpp = 2;
+		break;
+	default:
+		cpp = 4;
+		break;
+	}
+
+	b->stride = b->width * cpp;
+	b->planes[0] = mem;
+	b->planes[1] = b->planes[2] = NULL;
+}
+
+int main(int argc, char **argv)
+{
+	static const uint32_t formats[] = {
+		DRM_FORMAT_XRGB8888, DRM_FORMAT_RGB565, DRM_FORMAT_YUYV,
+		DRM_FORMAT_NV12,
+	};
+	static const struct {
+		const char *name;
+		enum util_fill_pattern pattern;
+	} patterns[] = {
+		{ "tiles", UTIL_PATTERN_TILES },
+		{ "smpte", UTIL_PATTERN_SMPTE },
+		{ "plain", UTIL_PATTERN_PLAIN },
+	};
+	static const unsigned int sizes[][2] = {
+		{ 640, 480 }, { 1920, 1080 },
+	};
+	struct util_bench_config config;
+	struct pattern_bench b;
+	struct util_bench *bench;
+	char params[96];
+	unsigned int f, p, s;
+	uint8_t *mem;
+	int opt, ret = 0;
+
+	util_bench_config_init(&config);
+	config.iterations = 20;
+
+	while ((opt = getopt(argc, argv, "B:")) != -1) {
+		if (opt != 'B' || util_bench_parse_option(&config, optarg)) {
+			fprintf(stderr, "usage: %s [-B option=value]...\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	/* 4 bytes per pixel is the most any of the formats takes. */
+	mem = malloc(sizes[ARRAY_SIZE(sizes) - 1][0] *
+		     sizes[ARRAY_SIZE(sizes) - 1][1] * 4);
+	bench = util_bench_begin(&config, "pattern");
+	if (!mem || !bench) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	for (s = 0; s < ARRAY_SIZE(sizes); s++) {
+		for (f = 0; f < ARRAY_SIZE(formats); f++) {
+			for (p = 0; p < ARRAY_SIZE(patterns); p++) {
+				b.format = formats[f];
+				b.pattern = patterns[p].pattern;
+				b.width = sizes[s][0];
+				b.height = sizes[s][1];
+				setup(&b, mem);
+
+				snprintf(params, sizeof(params),
+					 "format=%4.4s,pattern=%s,width=%u,height=%u",
+					 (const char *)&formats[f],
+					 patterns[p].name, b.width, b.height);
+				/* one op per pixel: */
+				ret |= util_bench_run(bench, "fill", params, fill,
+						      &b, b.width * b.height);
+			}
+		}
+	}
+
+	util_bench_end(bench);
+	free(mem);
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * The cache of drmPrimeFDToHandleCached() across a device closed and opened
+ * again on the same fd number: the DMA-BUF imported on the first one must
+ * not come back with the GEM handle it had there.
+ *
+ * Needs a KMS device for its dumb buffers, and is skipped without one.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <xf86drm.h>
+
+static int open_primary(void)
+{
+    drmDevicePtr devices[16];
+    int i, num, fd = -1;
+
+    num = drmGetDevices2(0, devices, 16);
+    for (i = 0; i < num && fd < 0; i++) {
+        if (devices[i]->available_nodes & 1 << DRM_NODE_PRIMARY)
+            fd = open(devices[i]->nodes[DRM_NODE_PRIMARY],
+                      O_RDWR | O_CLOEXEC, 0);
+    }
+    if (num > 0)
+        drmFreeDevices(devices, num);
+
+    return fd;
+}
+
+static int create_dumb(int fd, uint32_t *handle)
+{
+    struct drm_mode_create_dumb create;
+
+    memset(&create, 0, sizeof(create));
+    create.width = 64;
+    create.height = 64;
+    create.bpp = 32;
+    if (drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create))
+        return -errno;
+
+    *handle = create.handle;
+    return 0;
+}
+
+/* Open the device again on the fd number it had. */
+static int reopen(int fd)
+{
+    int new_fd = open_primary();
+
+    if (new_fd < 0 || new_fd == fd)
+        return new_fd;
+
+    if (dup2(new_fd, fd) < 0) {
+        close(new_fd);
+        return -1;
+    }
+    close(new_fd);
+    return fd;
+}
+
+int main(void)
+{
+    uint32_t first, second, cached, handle;
+    int fd, prime_fd;
+
+    fd = open_primary();
+    if (fd < 0) {
+        printf("no KMS device, skipping\n");
+        return 77;
+    }
+
+    /* The exported buffer is not the first one of the fd, so that its
+     * handle differs from what it gets on the new one. */
+    if (create_dumb(fd, &first) || create_dumb(fd, &second) ||
+        drmPrimeHandleToFD(fd, second, DRM_CLOEXEC, &prime_fd)) {
+        printf("no dumb buffers or PRIME export, skipping\n");
+        close(fd);
+        return 77;
+    }
+
+    if (drmPrimeFDToHandleCached(fd, prime_fd, &cached) || cached != second) {
+        printf("import on the exporting fd: %u, expected %u\n", cached, second);
+        return 1;
+    }
+
+    /* drmClose() drops the caches of the fd, as the drivers do before they
+     * close theirs. */
+    drmClose(fd);
+    if (reopen(fd) != fd) {
+        printf("failed to open the device again on fd %d\n", fd);
+        return 1;
+    }
+
+    if (drmPrimeFDToHandleCached(fd, prime_fd, &cached) ||
+        drmPrimeFDToHandle(fd, prime_fd, &handle)) {
+        printf("import on the new fd failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (cached != handle) {
+        printf("import on the new fd: %u, expected %u\n", cached, handle);
+        return 1;
+    }
+
+    /* A second import is a cache hit, of the same handle. */
+    if (drmPrimeFDToHandleCached(fd, prime_fd, &cached) || cached != handle) {
+        printf("cached import on the new fd: %u, expected %u\n", cached,
+               handle);
+        return 1;
+    }
+
+    close(prime_fd);
+    drmClose(fd);
+    return 0;
+}
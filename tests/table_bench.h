@@ -0,0 +1,327 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Benchmark of the key to value tables, the hash table and the skip list,
+ * shared by tests/hash.c and tests/drmsl.c.
+ *
+ * Each key distribution and table size runs the insert, lookup hit, lookup
+ * miss, mixed (80% lookups, 10% deletes, 10% inserts) and delete phases, and
+ * prints the ns per operation, and the cache misses per operation when
+ * perf_event_open() lets the process count them.
+ */
+
+#ifndef TABLE_BENCH_H
+#define TABLE_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+struct table_bench_ops {
+    const char *name;
+    void *(*create)(void);
+    int (*destroy)(void *table);
+    int (*insert)(void *table, unsigned long key, void *value);
+    int (*lookup)(void *table, unsigned long key, void **value);
+    int (*delete)(void *table, unsigned long key);
+};
+
+enum table_bench_keys {
+    /* 0, 1, 2, ...  */
+    TABLE_BENCH_SEQUENTIAL,
+    /* Distinct keys spread over all but the top bit. */
+    TABLE_BENCH_RANDOM,
+    /* Small integers from 1 with the holes freed handles leave, as the GEM
+     * handles of a process. */
+    TABLE_BENCH_HANDLES,
+    TABLE_BENCH_KEYS_COUNT
+};
+
+static const char *table_bench_keys_names[TABLE_BENCH_KEYS_COUNT] = {
+    "sequential", "random", "handles",
+};
+
+#define TABLE_BENCH_KEY_MASK (~0UL >> 1)
+
+/* The misses stay clear of the keys of every distribution. */
+#define TABLE_BENCH_MISS_OFFSET (~TABLE_BENCH_KEY_MASK)
+
+static uint64_t table_bench_rand(uint64_t *state)
+{
+    /* xorshift64* */
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+static void table_bench_fill(unsigned long *keys, unsigned int count,
+                             enum table_bench_keys dist, uint64_t *state)
+{
+    unsigned long handle = 0;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        switch (dist) {
+        case TABLE_BENCH_SEQUENTIAL:
+            keys[i] = i;
+            break;
+        case TABLE_BENCH_RANDOM:
+            /* Both steps are bijective on the masked bits, so the keys
+             * never collide. */
+            keys[i] = ((unsigned long)i * 0x9e3779b1UL) & TABLE_BENCH_KEY_MASK;
+            keys[i] ^= keys[i] >> 13;
+            break;
+        case TABLE_BENCH_HANDLES:
+            handle += 1 + (table_bench_rand(state) % 8 ? 0 :
+                           table_bench_rand(state) % 4);
+            keys[i] = handle;
+            break;
+        case TABLE_BENCH_KEYS_COUNT:
+            break;
+        }
+    }
+}
+
+static void table_bench_shuffle(unsigned long *keys, unsigned int count,
+                                uint64_t *state)
+{
+    unsigned long tmp;
+    unsigned int i, j;
+
+    for (i = count - 1; i > 0; i--) {
+        j = table_bench_rand(state) % (i + 1);
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+static uint64_t table_bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* A counter of the cache misses of the process, -1 if none. */
+static int table_bench_open_counter(void)
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+struct table_bench_phase {
+    uint64_t start_ns;
+    int counter;
+};
+
+static void table_bench_begin(struct table_bench_phase *phase, int counter)
+{
+    phase->counter = counter;
+#ifdef __linux__
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    phase->start_ns = table_bench_now();
+}
+
+static void table_bench_end(struct table_bench_phase *phase, const char *name,
+                            unsigned int ops)
+{
+    uint64_t ns = table_bench_now() - phase->start_ns;
+    uint64_t misses = 0;
+
+    printf(" %s %7.1f", name, (double)ns / ops);
+
+#ifdef __linux__
+    if (phase->counter >= 0) {
+        ioctl(phase->counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(phase->counter, &misses, sizeof(misses)) == sizeof(misses)) {
+            printf(" (%5.2f miss)", (double)misses / ops);
+            return;
+        }
+    }
+#endif
+    (void)misses;
+}
+
+/* Returns non-zero if a table lost or made up an entry. */
+static int table_bench_run(const struct table_bench_ops *ops,
+                           enum table_bench_keys dist, unsigned int count,
+                           int counter)
+{
+    struct table_bench_phase phase;
+    uint64_t state = 0x9e3779b97f4a7c15ULL + count;
+    unsigned long *keys, *order;
+    unsigned int i, j, live, errors = 0;
+    void *table, *value;
+
+    keys = malloc(count * sizeof(*keys));
+    order = malloc(count * sizeof(*order));
+    table = ops->create();
+    if (!keys || !order || !table) {
+        fprintf(stderr, "out of memory for %u entries\n", count);
+        exit(1);
+    }
+
+    table_bench_fill(keys, count, dist, &state);
+    memcpy(order, keys, count * sizeof(*keys));
+    table_bench_shuffle(order, count, &state);
+
+    printf("%-5s %-10s %8u:", ops->name, table_bench_keys_names[dist], count);
+
+    table_bench_begin(&phase, counter);
+    for (i = 0; i < count; i++)
+        errors += ops->insert(table, keys[i], (void *)keys[i]) != 0;
+    table_bench_end(&phase, "insert", count);
+
+    table_bench_begin(&phase, counter);
+    for (i = 0; i < count; i++)
+        errors += ops->lookup(table, order[i], &value) != 0;
+    table_bench_end(&phase, "hit", count);
+
+    table_bench_begin(&phase, counter);
+    for (i = 0; i < count; i++)
+        errors += ops->lookup(table, order[i] + TABLE_BENCH_MISS_OFFSET,
+                              &value) == 0;
+    table_bench_end(&phase, "miss", count);
+
+    /* order[0, live) is in the table, order[live, count) is not. */
+    live = count;
+    table_bench_begin(&phase, counter);
+    for (i = 0; i < count; i++) {
+        uint64_t r = table_bench_rand(&state);
+        unsigned long key;
+
+        switch (r % 10) {
+        case 8:
+            if (live > 1) {
+                j = (r >> 8) % live;
+                key = order[j];
+                order[j] = order[--live];
+                order[live] = key;
+                errors += ops->delete(table, key) != 0;
+                break;
+            }
+            /* fallthrough */
+        case 9:
+            if (live < count) {
+                errors += ops->insert(table, order[live],
+                                      (void *)order[live]) != 0;
+                live++;
+                break;
+            }
+            /* fallthrough */
+        default:
+            errors += ops->lookup(table, order[(r >> 8) % live], &value) != 0;
+            break;
+        }
+    }
+    table_bench_end(&phase, "mixed", count);
+
+    table_bench_begin(&phase, counter);
+    for (i = 0; i < live; i++)
+        errors += ops->delete(table, order[i]) != 0;
+    table_bench_end(&phase, "delete", live);
+
+    printf(" ns/op\n");
+    if (errors)
+        fprintf(stderr, "%s %s %u: %u operations failed\n", ops->name,
+                table_bench_keys_names[dist], count, errors);
+
+    ops->destroy(table);
+    free(order);
+    free(keys);
+    return errors != 0;
+}
+
+/* Every distribution from 1k entries to max_count, ten times more each. */
+static int table_bench(const struct table_bench_ops *ops, unsigned int max_count)
+{
+    int counter = table_bench_open_counter();
+    unsigned int count;
+    int dist, ret = 0;
+
+    if (counter < 0)
+        printf("cache misses not counted, perf_event_open() failed\n");
+
+    for (dist = 0; dist < TABLE_BENCH_KEYS_COUNT; dist++) {
+        for (count = 1000; count <= max_count; count *= 10)
+            ret |= table_bench_run(ops, dist, count, counter);
+    }
+
+    if (counter >= 0)
+        close(counter);
+    return ret;
+}
+
+static unsigned int table_bench_parse_args(int argc, char **argv,
+                                           const char *name)
+{
+    unsigned long max_count = 1000000;
+    char *end;
+
+    if (argc == 1)
+        return 0;
+
+    if (strcmp(argv[1], "-b") || argc > 3)
+        goto usage;
+
+    if (argc == 3) {
+        max_count = strtoul(argv[2], &end, 10);
+        if (*end || max_count < 1000 || max_count > 100000000)
+            goto usage;
+    }
+    return max_count;
+
+usage:
+    fprintf(stderr, "usage: %s [-b [max_entries]]\n", name);
+    exit(1);
+}
+
+#endif
@@ -0,0 +1,487 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "common.h"
+#include "bench.h"
+
+enum util_bench_counter {
+	UTIL_BENCH_CYCLES,
+	UTIL_BENCH_CACHE_MISSES,
+	UTIL_BENCH_CONTEXT_SWITCHES,
+	UTIL_BENCH_COUNTERS
+};
+
+struct util_bench {
+	struct util_bench_config config;
+	const char *suite;
+	unsigned int results;
+	int counters[UTIL_BENCH_COUNTERS];
+};
+
+uint64_t util_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int parse_format(const char *name, enum util_bench_format *format)
+{
+	static const char *const names[] = {
+		[UTIL_BENCH_FORMAT_TEXT] = "text",
+		[UTIL_BENCH_FORMAT_JSON] = "json",
+		[UTIL_BENCH_FORMAT_CSV] = "csv",
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		if (!strcmp(name, names[i])) {
+			*format = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int parse_uint(const char *value, unsigned long *result)
+{
+	char *end;
+
+	*result = strtoul(value, &end, 10);
+	return *value && !*end ? 0 : -1;
+}
+
+static int set_option(struct util_bench_config *config, const char *name,
+		      size_t len, const char *value)
+{
+	unsigned long n;
+
+	if (len == 6 && !strncmp(name, "format", len))
+		return parse_format(value, &config->format);
+
+	if (parse_uint(value, &n))
+		return -1;
+
+	if (len == 6 && !strncmp(name, "warmup", len))
+		config->warmup = n;
+	else if (len == 10 && !strncmp(name, "iterations", len) && n)
+		config->iterations = n;
+	else if (len == 6 && !strncmp(name, "min_ms", len))
+		config->min_ns = n * 1000000ull;
+	else if (len == 8 && !strncmp(name, "counters", len))
+		config->counters = n != 0;
+	else
+		return -1;
+
+	return 0;
+}
+
+void util_bench_config_init(struct util_bench_config *config)
+{
+	static const char *const names[] = {
+		"warmup", "iterations", "min_ms", "format", "counters",
+	};
+	char var[32];
+	unsigned int i, j;
+	const char *value;
+
+	config->warmup = 10;
+	config->iterations = 100;
+	config->min_ns = 0;
+	config->format = UTIL_BENCH_FORMAT_TEXT;
+	config->counters = true;
+	config->out = stdout;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		snprintf(var, sizeof(var), "LIBDRM_BENCH_%s", names[i]);
+		for (j = 0; var[j]; j++)
+			var[j] = toupper((unsigned char)var[j]);
+
+		value = getenv(var);
+		if (value && set_option(config, names[i], strlen(names[i]),
+					value))
+			fprintf(stderr, "invalid %s: %s\n", var, value);
+	}
+}
+
+int util_bench_parse_option(struct util_bench_config *config,
+			    const char *option)
+{
+	const char *value = strchr(option, '=');
+
+	if (!value)
+		return -1;
+
+	return set_option(config, option, value - option, value + 1);
+}
+
+static int open_counter(uint32_t type, uint64_t config, bool user_only)
+{
+#ifdef __linux__
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = user_only;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static void counters_start(struct util_bench *bench)
+{
+#ifdef __linux__
+	unsigned int i;
+
+	for (i = 0; i < UTIL_BENCH_COUNTERS; i++) {
+		if (bench->counters[i] < 0)
+			continue;
+		ioctl(bench->counters[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(bench->counters[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+/* The counts, -1 for the counters not opened. */
+static void counters_stop(struct util_bench *bench,
+			  int64_t values[UTIL_BENCH_COUNTERS])
+{
+	unsigned int i;
+	uint64_t value;
+
+	for (i = 0; i < UTIL_BENCH_COUNTERS; i++) {
+		values[i] = -1;
+		if (bench->counters[i] < 0)
+			continue;
+#ifdef __linux__
+		ioctl(bench->counters[i], PERF_EVENT_IOC_DISABLE, 0);
+#endif
+		if (read(bench->counters[i], &value, sizeof(value)) ==
+		    sizeof(value))
+			values[i] = value;
+	}
+}
+
+struct util_bench *util_bench_begin(const struct util_bench_config *config,
+				    const char *suite)
+{
+	struct util_bench *bench = calloc(1, sizeof(*bench));
+	unsigned int i;
+
+	if (!bench)
+		return NULL;
+
+	bench->config = *config;
+	bench->suite = suite;
+	for (i = 0; i < UTIL_BENCH_COUNTERS; i++)
+		bench->counters[i] = -1;
+
+#ifdef __linux__
+	if (config->counters) {
+		bench->counters[UTIL_BENCH_CYCLES] =
+			open_counter(PERF_TYPE_HARDWARE,
+				     PERF_COUNT_HW_CPU_CYCLES, true);
+		bench->counters[UTIL_BENCH_CACHE_MISSES] =
+			open_counter(PERF_TYPE_HARDWARE,
+				     PERF_COUNT_HW_CACHE_MISSES, true);
+		/* switches are done by the kernel: */
+		bench->counters[UTIL_BENCH_CONTEXT_SWITCHES] =
+			open_counter(PERF_TYPE_SOFTWARE,
+				     PERF_COUNT_SW_CONTEXT_SWITCHES, false);
+	}
+#endif
+
+	switch (config->format) {
+	case UTIL_BENCH_FORMAT_JSON:
+		fprintf(config->out, "{\n  \"suite\": \"%s\",\n  \"results\": [",
+			suite);
+		break;
+	case UTIL_BENCH_FORMAT_CSV:
+		fprintf(config->out, "suite,name,params,samples,ops,ns,"
+			"ns_per_op,ops_per_sec,min_ns,p50_ns,p90_ns,p99_ns,"
+			"p999_ns,max_ns,cycles,cache_misses,"
+			"context_switches\n");
+		break;
+	case UTIL_BENCH_FORMAT_TEXT:
+		break;
+	}
+
+	return bench;
+}
+
+void util_bench_end(struct util_bench *bench)
+{
+	unsigned int i;
+
+	if (!bench)
+		return;
+
+	if (bench->config.format == UTIL_BENCH_FORMAT_JSON)
+		fprintf(bench->config.out, "\n  ]\n}\n");
+	fflush(bench->config.out);
+
+	for (i = 0; i < UTIL_BENCH_COUNTERS; i++) {
+		if (bench->counters[i] >= 0)
+			close(bench->counters[i]);
+	}
+	free(bench);
+}
+
+int util_bench_sample(struct util_bench_samples *samples, uint64_t ns)
+{
+	uint64_t *grown;
+
+	if (samples->count == samples->max) {
+		samples->max = samples->max ? samples->max * 2 : 1024;
+		grown = realloc(samples->ns, samples->max * sizeof(*grown));
+		if (!grown) {
+			samples->max = samples->count;
+			return -1;
+		}
+		samples->ns = grown;
+	}
+
+	samples->ns[samples->count++] = ns;
+	return 0;
+}
+
+void util_bench_samples_fini(struct util_bench_samples *samples)
+{
+	free(samples->ns);
+	memset(samples, 0, sizeof(*samples));
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* The nearest rank percentile of the sorted samples. */
+static uint64_t percentile(const uint64_t *sorted, unsigned int count,
+			   unsigned int per_mille)
+{
+	uint64_t rank = ((uint64_t)count * per_mille + 999) / 1000;
+
+	return sorted[rank ? rank - 1 : 0];
+}
+
+/* Sorts the samples. */
+void util_bench_stats(struct util_bench_samples *samples, uint64_t ops,
+		      struct util_bench_stats *stats)
+{
+	unsigned int i, bucket;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->cycles = stats->cache_misses = stats->context_switches = -1;
+	stats->samples = samples->count;
+	stats->ops = ops;
+	if (!samples->count)
+		return;
+
+	qsort(samples->ns, samples->count, sizeof(*samples->ns), compare_u64);
+	for (i = 0; i < samples->count; i++) {
+		stats->total_ns += samples->ns[i];
+		bucket = samples->ns[i] ? 63 - __builtin_clzll(samples->ns[i]) : 0;
+		stats->histogram[bucket]++;
+	}
+
+	stats->min_ns = samples->ns[0];
+	stats->max_ns = samples->ns[samples->count - 1];
+	stats->p50_ns = percentile(samples->ns, samples->count, 500);
+	stats->p90_ns = percentile(samples->ns, samples->count, 900);
+	stats->p99_ns = percentile(samples->ns, samples->count, 990);
+	stats->p999_ns = percentile(samples->ns, samples->count, 999);
+}
+
+int util_bench_run(struct util_bench *bench, const char *name,
+		   const char *params, util_bench_func func, void *data,
+		   uint64_t ops)
+{
+	const struct util_bench_config *config = &bench->config;
+	struct util_bench_samples samples = { 0 };
+	struct util_bench_stats stats;
+	int64_t counts[UTIL_BENCH_COUNTERS];
+	uint64_t start, end, begin;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < config->warmup; i++)
+		func(data);
+
+	counters_start(bench);
+	begin = util_bench_now();
+	for (i = 0; ; i++) {
+		start = util_bench_now();
+		func(data);
+		end = util_bench_now();
+
+		if (util_bench_sample(&samples, end - start)) {
+			ret = -1;
+			break;
+		}
+		if (i + 1 >= config->iterations && end - begin >= config->min_ns)
+			break;
+	}
+	counters_stop(bench, counts);
+
+	util_bench_stats(&samples, ops * samples.count, &stats);
+	stats.cycles = counts[UTIL_BENCH_CYCLES];
+	stats.cache_misses = counts[UTIL_BENCH_CACHE_MISSES];
+	stats.context_switches = counts[UTIL_BENCH_CONTEXT_SWITCHES];
+	util_bench_report(bench, name, params, &stats);
+	util_bench_samples_fini(&samples);
+
+	return ret;
+}
+
+static void report_json_params(FILE *out, const char *params)
+{
+	const char *p = params, *eq, *end;
+	char *num_end;
+
+	fprintf(out, ", \"params\": {");
+	while (p && *p) {
+		end = strchr(p, ',');
+		if (!end)
+			end = p + strlen(p);
+		eq = memchr(p, '=', end - p);
+		if (eq) {
+			strtod(eq + 1, &num_end);
+			fprintf(out, "%s\"%.*s\": ", p == params ? "" : ", ",
+				(int)(eq - p), p);
+			if (num_end == end && eq + 1 != end)
+				fprintf(out, "%.*s", (int)(end - eq - 1), eq + 1);
+			else
+				fprintf(out, "\"%.*s\"", (int)(end - eq - 1),
+					eq + 1);
+		}
+		p = *end ? end + 1 : end;
+	}
+	fprintf(out, "}");
+}
+
+static void report_json(struct util_bench *bench, const char *name,
+			const char *params, const struct util_bench_stats *s,
+			double ns_per_op, double ops_per_sec)
+{
+	FILE *out = bench->config.out;
+	unsigned int i;
+	bool first = true;
+
+	fprintf(out, "%s\n    {\"name\": \"%s\"", bench->results ? "," : "",
+		name);
+	report_json_params(out, params);
+	fprintf(out, ", \"samples\": %u, \"ops\": %" PRIu64 ", \"ns\": %"
+		PRIu64 ", \"ns_per_op\": %.1f, \"ops_per_sec\": %.0f, "
+		"\"min_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64
+		", \"p90_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+		", \"p999_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64,
+		s->samples, s->ops, s->total_ns, ns_per_op, ops_per_sec,
+		s->min_ns, s->p50_ns, s->p90_ns, s->p99_ns, s->p999_ns,
+		s->max_ns);
+
+	if (s->cycles >= 0)
+		fprintf(out, ", \"cycles_per_op\": %.1f",
+			s->ops ? (double)s->cycles / s->ops : 0.0);
+	if (s->cache_misses >= 0)
+		fprintf(out, ", \"cache_misses_per_op\": %.3f",
+			s->ops ? (double)s->cache_misses / s->ops : 0.0);
+	if (s->context_switches >= 0)
+		fprintf(out, ", \"context_switches\": %" PRId64,
+			s->context_switches);
+
+	fprintf(out, ", \"histogram\": [");
+	for (i = 0; i < UTIL_BENCH_HISTOGRAM_BUCKETS; i++) {
+		if (!s->histogram[i])
+			continue;
+		fprintf(out, "%s[%" PRIu64 ", %u]", first ? "" : ", ",
+			(uint64_t)1 << i, s->histogram[i]);
+		first = false;
+	}
+	fprintf(out, "]}");
+}
+
+void util_bench_report(struct util_bench *bench, const char *name,
+		       const char *params, const struct util_bench_stats *s)
+{
+	FILE *out = bench->config.out;
+	double ns_per_op = s->ops ? (double)s->total_ns / s->ops : 0.0;
+	double ops_per_sec = s->total_ns ? s->ops * 1e9 / s->total_ns : 0.0;
+
+	if (!params)
+		params = "";
+
+	switch (bench->config.format) {
+	case UTIL_BENCH_FORMAT_JSON:
+		report_json(bench, name, params, s, ns_per_op, ops_per_sec);
+		break;
+	case UTIL_BENCH_FORMAT_CSV:
+		fprintf(out, "%s,%s,\"%s\",%u,%" PRIu64 ",%" PRIu64 ",%.1f,%.0f,"
+			"%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%"
+			PRIu64 ",%" PRIu64 ",%" PRId64 ",%" PRId64 ",%" PRId64
+			"\n", bench->suite, name, params, s->samples, s->ops,
+			s->total_ns, ns_per_op, ops_per_sec, s->min_ns,
+			s->p50_ns, s->p90_ns, s->p99_ns, s->p999_ns, s->max_ns,
+			s->cycles, s->cache_misses, s->context_switches);
+		break;
+	case UTIL_BENCH_FORMAT_TEXT:
+		fprintf(out, "%s %s %s: %.1f ns/op, %.0f ops/s, p50 %" PRIu64
+			" p99 %" PRIu64 " max %" PRIu64 " ns", bench->suite,
+			name, params, ns_per_op, ops_per_sec, s->p50_ns,
+			s->p99_ns, s->max_ns);
+		if (s->cycles >= 0 && s->ops)
+			fprintf(out, ", %.1f cycles/op",
+				(double)s->cycles / s->ops);
+		if (s->cache_misses >= 0 && s->ops)
+			fprintf(out, ", %.3f misses/op",
+				(double)s->cache_misses / s->ops);
+		if (s->context_switches >= 0)
+			fprintf(out, ", %" PRId64 " switches",
+				s->context_switches);
+		fprintf(out, "\n");
+		break;
+	}
+
+	bench->results++;
+	fflush(out);
+}
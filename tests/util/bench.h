@@ -0,0 +1,117 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef UTIL_BENCH_H
+#define UTIL_BENCH_H
+
+/*
+ * Benchmark harness of the tests.
+ *
+ * A run calls the measured function for the warmup iterations, then times
+ * each of the timed ones with CLOCK_MONOTONIC, until both the iteration
+ * count and the minimum duration are reached.  The per iteration times
+ * give the percentiles and a log2 histogram, and the cycles, cache misses
+ * and context switches are counted over the timed iterations when
+ * perf_event_open() is allowed.
+ *
+ * The defaults come from LIBDRM_BENCH_WARMUP, LIBDRM_BENCH_ITERATIONS,
+ * LIBDRM_BENCH_MIN_MS, LIBDRM_BENCH_FORMAT (text, json or csv) and
+ * LIBDRM_BENCH_COUNTERS (0 or 1), which util_bench_parse_option() takes
+ * as name=value too, in lower case without the prefix.
+ *
+ * The params of a result are "name=value" pairs separated by commas.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define UTIL_BENCH_HISTOGRAM_BUCKETS	64
+
+enum util_bench_format {
+	UTIL_BENCH_FORMAT_TEXT,
+	UTIL_BENCH_FORMAT_JSON,
+	UTIL_BENCH_FORMAT_CSV,
+};
+
+struct util_bench_config {
+	unsigned int warmup;
+	unsigned int iterations;
+	uint64_t min_ns;
+	enum util_bench_format format;
+	bool counters;
+	FILE *out;
+};
+
+struct util_bench_samples {
+	uint64_t *ns;
+	unsigned int count;
+	unsigned int max;
+};
+
+struct util_bench_stats {
+	unsigned int samples;
+	/* the operations of all the samples: */
+	uint64_t ops;
+	uint64_t total_ns;
+	uint64_t min_ns;
+	uint64_t p50_ns;
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	uint64_t max_ns;
+	/* samples of [2^i, 2^(i+1)) ns: */
+	unsigned int histogram[UTIL_BENCH_HISTOGRAM_BUCKETS];
+
+	/* -1 when not counted: */
+	int64_t cycles;
+	int64_t cache_misses;
+	int64_t context_switches;
+};
+
+struct util_bench;
+
+typedef void (*util_bench_func)(void *data);
+
+uint64_t util_bench_now(void);
+
+void util_bench_config_init(struct util_bench_config *config);
+int util_bench_parse_option(struct util_bench_config *config,
+			    const char *option);
+
+/* Starts the report of a suite, NULL when out of memory. */
+struct util_bench *util_bench_begin(const struct util_bench_config *config,
+				    const char *suite);
+void util_bench_end(struct util_bench *bench);
+
+/* Measures func, doing ops operations per call. */
+int util_bench_run(struct util_bench *bench, const char *name,
+		   const char *params, util_bench_func func, void *data,
+		   uint64_t ops);
+
+/* For the loops driven by events, the samples are timed by the caller. */
+int util_bench_sample(struct util_bench_samples *samples, uint64_t ns);
+void util_bench_samples_fini(struct util_bench_samples *samples);
+void util_bench_stats(struct util_bench_samples *samples, uint64_t ops,
+		      struct util_bench_stats *stats);
+void util_bench_report(struct util_bench *bench, const char *name,
+		       const char *params, const struct util_bench_stats *stats);
+
+#endif /* UTIL_BENCH_H */
@@ -23,10 +23,13 @@
  * IN THE SOFTWARE.
  */
 
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <drm_fourcc.h>
 
@@ -156,6 +159,10 @@ static uint16_t uint16_div_64k_to_half(uint16_t v)
 	 shiftcolor16(&(rgb)->blue, uint16_div_64k_to_half((b) << 6)) | \
 	 shiftcolor16(&(rgb)->alpha, uint16_div_64k_to_half((a) << 6)))
 
+/*
+ * The rows of each band of the SMPTE pattern, and of each half of the
+ * gradient, are the same: the first row is filled and copied to the others.
+ */
 static void fill_smpte_yuv_planar(const struct util_yuv_info *yuv,
 				  unsigned char *y_mem, unsigned char *u_mem,
 				  unsigned char *v_mem, unsigned int width,
@@ -197,18 +204,33 @@ static void fill_smpte_yuv_planar(const struct util_yuv_info *yuv,
 
 	/* Luma */
 	for (y = 0; y < height * 6 / 9; ++y) {
+		if (y > 0) {
+			memcpy(y_mem, y_mem - stride, width * 1);
+			y_mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			y_mem[x] = colors_top[x * 7 / width].y;
 		y_mem += stride;
 	}
 
 	for (; y < height * 7 / 9; ++y) {
+		if (y > height * 6 / 9) {
+			memcpy(y_mem, y_mem - stride, width * 1);
+			y_mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			y_mem[x] = colors_middle[x * 7 / width].y;
 		y_mem += stride;
 	}
 
 	for (; y < height; ++y) {
+		if (y > height * 7 / 9) {
+			memcpy(y_mem, y_mem - stride, width * 1);
+			y_mem += stride;
+			continue;
+		}
 		for (x = 0; x < width * 5 / 7; ++x)
 			y_mem[x] = colors_bottom[x * 4 / (width * 5 / 7)].y;
 		for (; x < width * 6 / 7; ++x)
@@ -260,7 +282,7 @@ static void fill_smpte_yuv_planar(const struct util_yuv_info *yuv,
 	}
 }
 
-static void fill_smpte_yuv_packed(const struct util_yuv_info *yuv, void *mem,
+static void fill_smpte_yuv_packed(const struct util_yuv_info *yuv, unsigned char *mem,
 				  unsigned int width, unsigned int height,
 				  unsigned int stride)
 {
@@ -359,7 +381,7 @@ static void fill_smpte_yuv_packed(const struct util_yuv_info *yuv, void *mem,
 	}
 }
 
-static void fill_smpte_rgb16(const struct util_rgb_info *rgb, void *mem,
+static void fill_smpte_rgb16(const struct util_rgb_info *rgb, unsigned char *mem,
 			     unsigned int width, unsigned int height,
 			     unsigned int stride)
 {
@@ -395,18 +417,33 @@ static void fill_smpte_rgb16(const struct util_rgb_info *rgb, void *mem,
 	unsigned int y;
 
 	for (y = 0; y < height * 6 / 9; ++y) {
+		if (y > 0) {
+			memcpy(mem, mem - stride, width * sizeof(uint16_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			((uint16_t *)mem)[x] = colors_top[x * 7 / width];
 		mem += stride;
 	}
 
 	for (; y < height * 7 / 9; ++y) {
+		if (y > height * 6 / 9) {
+			memcpy(mem, mem - stride, width * sizeof(uint16_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			((uint16_t *)mem)[x] = colors_middle[x * 7 / width];
 		mem += stride;
 	}
 
 	for (; y < height; ++y) {
+		if (y > height * 7 / 9) {
+			memcpy(mem, mem - stride, width * sizeof(uint16_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width * 5 / 7; ++x)
 			((uint16_t *)mem)[x] =
 				colors_bottom[x * 4 / (width * 5 / 7)];
@@ -420,7 +457,7 @@ static void fill_smpte_rgb16(const struct util_rgb_info *rgb, void *mem,
 	}
 }
 
-static void fill_smpte_rgb24(const struct util_rgb_info *rgb, void *mem,
+static void fill_smpte_rgb24(const struct util_rgb_info *rgb, unsigned char *mem,
 			     unsigned int width, unsigned int height,
 			     unsigned int stride)
 {
@@ -456,6 +493,11 @@ static void fill_smpte_rgb24(const struct util_rgb_info *rgb, void *mem,
 	unsigned int y;
 
 	for (y = 0; y < height * 6 / 9; ++y) {
+		if (y > 0) {
+			memcpy(mem, mem - stride, width * sizeof(struct color_rgb24));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			((struct color_rgb24 *)mem)[x] =
 				colors_top[x * 7 / width];
@@ -463,6 +505,11 @@ static void fill_smpte_rgb24(const struct util_rgb_info *rgb, void *mem,
 	}
 
 	for (; y < height * 7 / 9; ++y) {
+		if (y > height * 6 / 9) {
+			memcpy(mem, mem - stride, width * sizeof(struct color_rgb24));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			((struct color_rgb24 *)mem)[x] =
 				colors_middle[x * 7 / width];
@@ -470,6 +517,11 @@ static void fill_smpte_rgb24(const struct util_rgb_info *rgb, void *mem,
 	}
 
 	for (; y < height; ++y) {
+		if (y > height * 7 / 9) {
+			memcpy(mem, mem - stride, width * sizeof(struct color_rgb24));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width * 5 / 7; ++x)
 			((struct color_rgb24 *)mem)[x] =
 				colors_bottom[x * 4 / (width * 5 / 7)];
@@ -483,7 +535,7 @@ static void fill_smpte_rgb24(const struct util_rgb_info *rgb, void *mem,
 	}
 }
 
-static void fill_smpte_rgb32(const struct util_rgb_info *rgb, void *mem,
+static void fill_smpte_rgb32(const struct util_rgb_info *rgb, unsigned char *mem,
 			     unsigned int width, unsigned int height,
 			     unsigned int stride)
 {
@@ -519,18 +571,33 @@ static void fill_smpte_rgb32(const struct util_rgb_info *rgb, void *mem,
 	unsigned int y;
 
 	for (y = 0; y < height * 6 / 9; ++y) {
+		if (y > 0) {
+			memcpy(mem, mem - stride, width * sizeof(uint32_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			((uint32_t *)mem)[x] = colors_top[x * 7 / width];
 		mem += stride;
 	}
 
 	for (; y < height * 7 / 9; ++y) {
+		if (y > height * 6 / 9) {
+			memcpy(mem, mem - stride, width * sizeof(uint32_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			((uint32_t *)mem)[x] = colors_middle[x * 7 / width];
 		mem += stride;
 	}
 
 	for (; y < height; ++y) {
+		if (y > height * 7 / 9) {
+			memcpy(mem, mem - stride, width * sizeof(uint32_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width * 5 / 7; ++x)
 			((uint32_t *)mem)[x] =
 				colors_bottom[x * 4 / (width * 5 / 7)];
@@ -544,7 +611,7 @@ static void fill_smpte_rgb32(const struct util_rgb_info *rgb, void *mem,
 	}
 }
 
-static void fill_smpte_rgb16fp(const struct util_rgb_info *rgb, void *mem,
+static void fill_smpte_rgb16fp(const struct util_rgb_info *rgb, unsigned char *mem,
 			       unsigned int width, unsigned int height,
 			       unsigned int stride)
 {
@@ -580,18 +647,33 @@ static void fill_smpte_rgb16fp(const struct util_rgb_info *rgb, void *mem,
 	unsigned int y;
 
 	for (y = 0; y < height * 6 / 9; ++y) {
+		if (y > 0) {
+			memcpy(mem, mem - stride, width * sizeof(uint64_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			((uint64_t *)mem)[x] = colors_top[x * 7 / width];
 		mem += stride;
 	}
 
 	for (; y < height * 7 / 9; ++y) {
+		if (y > height * 6 / 9) {
+			memcpy(mem, mem - stride, width * sizeof(uint64_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			((uint64_t *)mem)[x] = colors_middle[x * 7 / width];
 		mem += stride;
 	}
 
 	for (; y < height; ++y) {
+		if (y > height * 7 / 9) {
+			memcpy(mem, mem - stride, width * sizeof(uint64_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width * 5 / 7; ++x)
 			((uint64_t *)mem)[x] =
 				colors_bottom[x * 4 / (width * 5 / 7)];
@@ -605,25 +687,40 @@ static void fill_smpte_rgb16fp(const struct util_rgb_info *rgb, void *mem,
 	}
 }
 
-static void fill_smpte_c8(void *mem, unsigned int width, unsigned int height,
+static void fill_smpte_c8(unsigned char *mem, unsigned int width, unsigned int height,
 			  unsigned int stride)
 {
 	unsigned int x;
 	unsigned int y;
 
 	for (y = 0; y < height * 6 / 9; ++y) {
+		if (y > 0) {
+			memcpy(mem, mem - stride, width * sizeof(uint8_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			((uint8_t *)mem)[x] = x * 7 / width;
 		mem += stride;
 	}
 
 	for (; y < height * 7 / 9; ++y) {
+		if (y > height * 6 / 9) {
+			memcpy(mem, mem - stride, width * sizeof(uint8_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width; ++x)
 			((uint8_t *)mem)[x] = 7 + (x * 7 / width);
 		mem += stride;
 	}
 
 	for (; y < height; ++y) {
+		if (y > height * 7 / 9) {
+			memcpy(mem, mem - stride, width * sizeof(uint8_t));
+			mem += stride;
+			continue;
+		}
 		for (x = 0; x < width * 5 / 7; ++x)
 			((uint8_t *)mem)[x] =
 				14 + (x * 4 / (width * 5 / 7));
@@ -698,8 +795,8 @@ static void fill_smpte(const struct util_format_info *info, void *planes[3],
 	case DRM_FORMAT_NV21:
 	case DRM_FORMAT_NV16:
 	case DRM_FORMAT_NV61:
-		u = info->yuv.order & YUV_YCbCr ? planes[1] : planes[1] + 1;
-		v = info->yuv.order & YUV_YCrCb ? planes[1] : planes[1] + 1;
+		u = info->yuv.order & YUV_YCbCr ? planes[1] : (unsigned char *)planes[1] + 1;
+		v = info->yuv.order & YUV_YCrCb ? planes[1] : (unsigned char *)planes[1] + 1;
 		return fill_smpte_yuv_planar(&info->yuv, planes[0], u, v,
 					     width, height, stride);
 
@@ -839,30 +936,116 @@ static void make_pwetty(void *data, unsigned int width, unsigned int height,
 #endif
 }
 
-static void fill_tiles_yuv_planar(const struct util_format_info *info,
-				  unsigned char *y_mem, unsigned char *u_mem,
-				  unsigned char *v_mem, unsigned int width,
-				  unsigned int height, unsigned int stride)
+/*
+ * The tiles are filled by row bands, on several threads for the large
+ * buffers. The color of a pixel comes from div(x + y, width), stepped
+ * along the row, and is converted to the format once per tile.
+ */
+#define TILES_MAX_THREADS	8
+#define TILES_PARALLEL_PIXELS	(1920 * 1080)
+
+struct tiles_band {
+	const struct util_format_info *info;
+	void *planes[3];
+	unsigned int width;
+	unsigned int height;
+	unsigned int stride;
+	unsigned int y0, y1;
+	void (*fill)(const struct tiles_band *band);
+};
+
+static inline uint32_t tiles_rgb32(unsigned int quot, unsigned int rem)
+{
+	return 0x00130502 * (quot >> 6) + 0x000a1120 * (rem >> 6);
+}
+
+static void *fill_tiles_band_thread(void *data)
+{
+	struct tiles_band *band = data;
+
+	band->fill(band);
+	return NULL;
+}
+
+static void fill_tiles_bands(const struct tiles_band *tiles, unsigned int align)
 {
-	const struct util_yuv_info *yuv = &info->yuv;
+	struct tiles_band bands[TILES_MAX_THREADS];
+	pthread_t threads[TILES_MAX_THREADS];
+	bool started[TILES_MAX_THREADS] = { false };
+	unsigned int count = 1, rows, i;
+	long cpus;
+
+	if (tiles->width * tiles->height >= TILES_PARALLEL_PIXELS) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (cpus > 1)
+			count = cpus < TILES_MAX_THREADS ? cpus : TILES_MAX_THREADS;
+	}
+
+	/* Bands of whole chroma rows. */
+	rows = (tiles->height + count - 1) / count;
+	rows = (rows + align - 1) / align * align;
+
+	for (i = 0; i < count; i++) {
+		bands[i] = *tiles;
+		bands[i].y0 = i * rows < tiles->height ? i * rows : tiles->height;
+		bands[i].y1 = bands[i].y0 + rows < tiles->height ?
+			      bands[i].y0 + rows : tiles->height;
+		if (i && bands[i].y0 < bands[i].y1)
+			started[i] = !pthread_create(&threads[i], NULL,
+						     fill_tiles_band_thread,
+						     &bands[i]);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else if (bands[i].y0 < bands[i].y1)
+			bands[i].fill(&bands[i]);
+	}
+}
+
+static void fill_tiles_yuv_planar_band(const struct tiles_band *band)
+{
+	const struct util_yuv_info *yuv = &band->info->yuv;
+	unsigned int width = band->width;
+	unsigned int stride = band->stride;
 	unsigned int cs = yuv->chroma_stride;
 	unsigned int xsub = yuv->xsub;
 	unsigned int ysub = yuv->ysub;
+	unsigned char *y_mem = (unsigned char *)band->planes[0] + band->y0 * stride;
+	unsigned char *u_mem = (unsigned char *)band->planes[1] +
+			       band->y0 / ysub * stride * cs / xsub;
+	unsigned char *v_mem = (unsigned char *)band->planes[2] +
+			       band->y0 / ysub * stride * cs / xsub;
+	struct color_yuv color = { 0 };
+	uint32_t rgb32, last = 0;
+	unsigned int quot, rem;
 	unsigned int x;
 	unsigned int y;
 
-	for (y = 0; y < height; ++y) {
+	for (y = band->y0; y < band->y1; ++y) {
+		quot = y / width;
+		rem = y % width;
 		for (x = 0; x < width; ++x) {
-			div_t d = div(x+y, width);
-			uint32_t rgb32 = 0x00130502 * (d.quot >> 6)
-				       + 0x000a1120 * (d.rem >> 6);
-			struct color_yuv color =
-				MAKE_YUV_601((rgb32 >> 16) & 0xff,
-					     (rgb32 >> 8) & 0xff, rgb32 & 0xff);
+			rgb32 = tiles_rgb32(quot, rem);
+			if (!x || rgb32 != last) {
+				struct color_yuv c =
+					MAKE_YUV_601((rgb32 >> 16) & 0xff,
+						     (rgb32 >> 8) & 0xff,
+						     rgb32 & 0xff);
+
+				color = c;
+				last = rgb32;
+			}
 
 			y_mem[x] = color.y;
 			u_mem[x/xsub*cs] = color.u;
 			v_mem[x/xsub*cs] = color.v;
+
+			if (++rem == width) {
+				rem = 0;
+				quot++;
+			}
 		}
 
 		y_mem += stride;
@@ -873,31 +1056,64 @@ static void fill_tiles_yuv_planar(const struct util_format_info *info,
 	}
 }
 
-static void fill_tiles_yuv_packed(const struct util_format_info *info,
-				  void *mem, unsigned int width,
+static void fill_tiles_yuv_planar(const struct util_format_info *info,
+				  unsigned char *y_mem, unsigned char *u_mem,
+				  unsigned char *v_mem, unsigned int width,
 				  unsigned int height, unsigned int stride)
 {
-	const struct util_yuv_info *yuv = &info->yuv;
+	struct tiles_band tiles = {
+		.info = info,
+		.planes = { y_mem, u_mem, v_mem },
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.fill = fill_tiles_yuv_planar_band,
+	};
+
+	fill_tiles_bands(&tiles, info->yuv.ysub);
+}
+
+static void fill_tiles_yuv_packed_band(const struct tiles_band *band)
+{
+	const struct util_yuv_info *yuv = &band->info->yuv;
+	unsigned int width = band->width;
+	unsigned int stride = band->stride;
+	unsigned char *mem = (unsigned char *)band->planes[0] + band->y0 * stride;
 	unsigned char *y_mem = (yuv->order & YUV_YC) ? mem : mem + 1;
 	unsigned char *c_mem = (yuv->order & YUV_CY) ? mem : mem + 1;
 	unsigned int u = (yuv->order & YUV_YCrCb) ? 2 : 0;
 	unsigned int v = (yuv->order & YUV_YCbCr) ? 2 : 0;
+	struct color_yuv color = { 0 };
+	uint32_t rgb32, last = 0;
+	unsigned int quot, rem;
 	unsigned int x;
 	unsigned int y;
 
-	for (y = 0; y < height; ++y) {
+	for (y = band->y0; y < band->y1; ++y) {
+		quot = y / width;
+		rem = y % width;
 		for (x = 0; x < width; x += 2) {
-			div_t d = div(x+y, width);
-			uint32_t rgb32 = 0x00130502 * (d.quot >> 6)
-				       + 0x000a1120 * (d.rem >> 6);
-			struct color_yuv color =
-				MAKE_YUV_601((rgb32 >> 16) & 0xff,
-					     (rgb32 >> 8) & 0xff, rgb32 & 0xff);
+			rgb32 = tiles_rgb32(quot, rem);
+			if (!x || rgb32 != last) {
+				struct color_yuv c =
+					MAKE_YUV_601((rgb32 >> 16) & 0xff,
+						     (rgb32 >> 8) & 0xff,
+						     rgb32 & 0xff);
+
+				color = c;
+				last = rgb32;
+			}
 
 			y_mem[2*x] = color.y;
 			c_mem[2*x+u] = color.u;
 			y_mem[2*x+2] = color.y;
 			c_mem[2*x+v] = color.v;
+
+			rem += 2;
+			if (rem >= width) {
+				rem -= width;
+				quot++;
+			}
 		}
 
 		y_mem += stride;
@@ -905,106 +1121,230 @@ static void fill_tiles_yuv_packed(const struct util_format_info *info,
 	}
 }
 
-static void fill_tiles_rgb16(const struct util_format_info *info, void *mem,
-			     unsigned int width, unsigned int height,
-			     unsigned int stride)
+static void fill_tiles_yuv_packed(const struct util_format_info *info,
+				  unsigned char *mem, unsigned int width,
+				  unsigned int height, unsigned int stride)
 {
-	const struct util_rgb_info *rgb = &info->rgb;
-	void *mem_base = mem;
+	struct tiles_band tiles = {
+		.info = info,
+		.planes = { mem },
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.fill = fill_tiles_yuv_packed_band,
+	};
+
+	fill_tiles_bands(&tiles, 1);
+}
+
+static void fill_tiles_rgb16_band(const struct tiles_band *band)
+{
+	const struct util_rgb_info *rgb = &band->info->rgb;
+	unsigned int width = band->width;
+	unsigned char *mem = (unsigned char *)band->planes[0] + band->y0 * band->stride;
+	uint32_t rgb32, last = 0;
+	uint16_t color = 0;
+	unsigned int quot, rem;
 	unsigned int x, y;
 
-	for (y = 0; y < height; ++y) {
+	for (y = band->y0; y < band->y1; ++y) {
+		quot = y / width;
+		rem = y % width;
 		for (x = 0; x < width; ++x) {
-			div_t d = div(x+y, width);
-			uint32_t rgb32 = 0x00130502 * (d.quot >> 6)
-				       + 0x000a1120 * (d.rem >> 6);
-			uint16_t color =
-				MAKE_RGBA(rgb, (rgb32 >> 16) & 0xff,
-					  (rgb32 >> 8) & 0xff, rgb32 & 0xff,
-					  255);
+			rgb32 = tiles_rgb32(quot, rem);
+			if (!x || rgb32 != last) {
+				color = MAKE_RGBA(rgb, (rgb32 >> 16) & 0xff,
+						  (rgb32 >> 8) & 0xff,
+						  rgb32 & 0xff, 255);
+				last = rgb32;
+			}
 
 			((uint16_t *)mem)[x] = color;
+
+			if (++rem == width) {
+				rem = 0;
+				quot++;
+			}
 		}
-		mem += stride;
+		mem += band->stride;
 	}
-
-	make_pwetty(mem_base, width, height, stride, info->format);
 }
 
-static void fill_tiles_rgb24(const struct util_format_info *info, void *mem,
+static void fill_tiles_rgb16(const struct util_format_info *info, unsigned char *mem,
 			     unsigned int width, unsigned int height,
 			     unsigned int stride)
 {
-	const struct util_rgb_info *rgb = &info->rgb;
+	struct tiles_band tiles = {
+		.info = info,
+		.planes = { mem },
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.fill = fill_tiles_rgb16_band,
+	};
+
+	fill_tiles_bands(&tiles, 1);
+	make_pwetty(mem, width, height, stride, info->format);
+}
+
+static void fill_tiles_rgb24_band(const struct tiles_band *band)
+{
+	const struct util_rgb_info *rgb = &band->info->rgb;
+	unsigned int width = band->width;
+	unsigned char *mem = (unsigned char *)band->planes[0] + band->y0 * band->stride;
+	struct color_rgb24 color = { 0 };
+	uint32_t rgb32, last = 0;
+	unsigned int quot, rem;
 	unsigned int x, y;
 
-	for (y = 0; y < height; ++y) {
+	for (y = band->y0; y < band->y1; ++y) {
+		quot = y / width;
+		rem = y % width;
 		for (x = 0; x < width; ++x) {
-			div_t d = div(x+y, width);
-			uint32_t rgb32 = 0x00130502 * (d.quot >> 6)
-				       + 0x000a1120 * (d.rem >> 6);
-			struct color_rgb24 color =
-				MAKE_RGB24(rgb, (rgb32 >> 16) & 0xff,
-					   (rgb32 >> 8) & 0xff, rgb32 & 0xff);
+			rgb32 = tiles_rgb32(quot, rem);
+			if (!x || rgb32 != last) {
+				struct color_rgb24 c =
+					MAKE_RGB24(rgb, (rgb32 >> 16) & 0xff,
+						   (rgb32 >> 8) & 0xff,
+						   rgb32 & 0xff);
+
+				color = c;
+				last = rgb32;
+			}
 
 			((struct color_rgb24 *)mem)[x] = color;
+
+			if (++rem == width) {
+				rem = 0;
+				quot++;
+			}
 		}
-		mem += stride;
+		mem += band->stride;
 	}
 }
 
-static void fill_tiles_rgb32(const struct util_format_info *info, void *mem,
+static void fill_tiles_rgb24(const struct util_format_info *info, unsigned char *mem,
 			     unsigned int width, unsigned int height,
 			     unsigned int stride)
 {
-	const struct util_rgb_info *rgb = &info->rgb;
-	void *mem_base = mem;
+	struct tiles_band tiles = {
+		.info = info,
+		.planes = { mem },
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.fill = fill_tiles_rgb24_band,
+	};
+
+	fill_tiles_bands(&tiles, 1);
+}
+
+static void fill_tiles_rgb32_band(const struct tiles_band *band)
+{
+	const struct util_rgb_info *rgb = &band->info->rgb;
+	unsigned int width = band->width;
+	unsigned int height = band->height;
+	unsigned char *mem = (unsigned char *)band->planes[0] + band->y0 * band->stride;
+	uint32_t rgb32, alpha, last = 0, last_alpha = 0;
+	uint32_t color = 0;
+	unsigned int quot, rem;
 	unsigned int x, y;
 
-	for (y = 0; y < height; ++y) {
+	for (y = band->y0; y < band->y1; ++y) {
+		quot = y / width;
+		rem = y % width;
 		for (x = 0; x < width; ++x) {
-			div_t d = div(x+y, width);
-			uint32_t rgb32 = 0x00130502 * (d.quot >> 6)
-				       + 0x000a1120 * (d.rem >> 6);
-			uint32_t alpha = ((y < height/2) && (x < width/2)) ? 127 : 255;
-			uint32_t color =
-				MAKE_RGBA(rgb, (rgb32 >> 16) & 0xff,
-					  (rgb32 >> 8) & 0xff, rgb32 & 0xff,
-					  alpha);
+			rgb32 = tiles_rgb32(quot, rem);
+			alpha = ((y < height/2) && (x < width/2)) ? 127 : 255;
+			if (!x || rgb32 != last || alpha != last_alpha) {
+				color = MAKE_RGBA(rgb, (rgb32 >> 16) & 0xff,
+						  (rgb32 >> 8) & 0xff,
+						  rgb32 & 0xff, alpha);
+				last = rgb32;
+				last_alpha = alpha;
+			}
 
 			((uint32_t *)mem)[x] = color;
+
+			if (++rem == width) {
+				rem = 0;
+				quot++;
+			}
 		}
-		mem += stride;
+		mem += band->stride;
 	}
+}
+
+static void fill_tiles_rgb32(const struct util_format_info *info, unsigned char *mem,
+			     unsigned int width, unsigned int height,
+			     unsigned int stride)
+{
+	struct tiles_band tiles = {
+		.info = info,
+		.planes = { mem },
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.fill = fill_tiles_rgb32_band,
+	};
 
-	make_pwetty(mem_base, width, height, stride, info->format);
+	fill_tiles_bands(&tiles, 1);
+	make_pwetty(mem, width, height, stride, info->format);
 }
 
-static void fill_tiles_rgb16fp(const struct util_format_info *info, void *mem,
-			       unsigned int width, unsigned int height,
-			       unsigned int stride)
+static void fill_tiles_rgb16fp_band(const struct tiles_band *band)
 {
-	const struct util_rgb_info *rgb = &info->rgb;
+	const struct util_rgb_info *rgb = &band->info->rgb;
+	unsigned int width = band->width;
+	unsigned int height = band->height;
+	unsigned char *mem = (unsigned char *)band->planes[0] + band->y0 * band->stride;
+	uint32_t rgb32, alpha, last = 0, last_alpha = 0;
+	uint64_t color = 0;
+	unsigned int quot, rem;
 	unsigned int x, y;
 
 	/* TODO: Give this actual fp16 precision */
-	for (y = 0; y < height; ++y) {
+	for (y = band->y0; y < band->y1; ++y) {
+		quot = y / width;
+		rem = y % width;
 		for (x = 0; x < width; ++x) {
-			div_t d = div(x+y, width);
-			uint32_t rgb32 = 0x00130502 * (d.quot >> 6)
-				       + 0x000a1120 * (d.rem >> 6);
-			uint32_t alpha = ((y < height/2) && (x < width/2)) ? 127 : 255;
-			uint64_t color =
-				MAKE_RGBA8FP16(rgb, (rgb32 >> 16) & 0xff,
-					       (rgb32 >> 8) & 0xff, rgb32 & 0xff,
-					       alpha);
+			rgb32 = tiles_rgb32(quot, rem);
+			alpha = ((y < height/2) && (x < width/2)) ? 127 : 255;
+			if (!x || rgb32 != last || alpha != last_alpha) {
+				color = MAKE_RGBA8FP16(rgb, (rgb32 >> 16) & 0xff,
+						       (rgb32 >> 8) & 0xff,
+						       rgb32 & 0xff, alpha);
+				last = rgb32;
+				last_alpha = alpha;
+			}
 
 			((uint64_t *)mem)[x] = color;
+
+			if (++rem == width) {
+				rem = 0;
+				quot++;
+			}
 		}
-		mem += stride;
+		mem += band->stride;
 	}
 }
 
+static void fill_tiles_rgb16fp(const struct util_format_info *info, unsigned char *mem,
+			       unsigned int width, unsigned int height,
+			       unsigned int stride)
+{
+	struct tiles_band tiles = {
+		.info = info,
+		.planes = { mem },
+		.width = width,
+		.height = height,
+		.stride = stride,
+		.fill = fill_tiles_rgb16fp_band,
+	};
+
+	fill_tiles_bands(&tiles, 1);
+}
+
 static void fill_tiles(const struct util_format_info *info, void *planes[3],
 		       unsigned int width, unsigned int height,
 		       unsigned int stride)
@@ -1023,8 +1363,8 @@ static void fill_tiles(const struct util_format_info *info, void *planes[3],
 	case DRM_FORMAT_NV21:
 	case DRM_FORMAT_NV16:
 	case DRM_FORMAT_NV61:
-		u = info->yuv.order & YUV_YCbCr ? planes[1] : planes[1] + 1;
-		v = info->yuv.order & YUV_YCrCb ? planes[1] : planes[1] + 1;
+		u = info->yuv.order & YUV_YCbCr ? planes[1] : (unsigned char *)planes[1] + 1;
+		v = info->yuv.order & YUV_YCrCb ? planes[1] : (unsigned char *)planes[1] + 1;
 		return fill_tiles_yuv_planar(info, planes[0], u, v,
 					     width, height, stride);
 
@@ -1108,14 +1448,20 @@ static void fill_plain(const struct util_format_info *info, void *planes[3],
 }
 
 static void fill_gradient_rgb32(const struct util_rgb_info *rgb,
-				void *mem,
+				unsigned char *mem,
 				unsigned int width, unsigned int height,
 				unsigned int stride)
 {
 	unsigned int i, j;
 
 	for (i = 0; i < height / 2; i++) {
-		uint32_t *row = mem;
+		uint32_t *row = (uint32_t *)mem;
+
+		if (i > 0) {
+			memcpy(mem, mem - stride, width / 2 * 2 * sizeof(*row));
+			mem += stride;
+			continue;
+		}
 
 		for (j = 0; j < width / 2; j++) {
 			uint32_t value = MAKE_RGBA10(rgb, j & 0x3ff, j & 0x3ff, j & 0x3ff, 0);
@@ -1125,7 +1471,13 @@ static void fill_gradient_rgb32(const struct util_rgb_info *rgb,
 	}
 
 	for (; i < height; i++) {
-		uint32_t *row = mem;
+		uint32_t *row = (uint32_t *)mem;
+
+		if (i > height / 2) {
+			memcpy(mem, mem - stride, width / 2 * 2 * sizeof(*row));
+			mem += stride;
+			continue;
+		}
 
 		for (j = 0; j < width / 2; j++) {
 			uint32_t value = MAKE_RGBA10(rgb, j & 0x3fc, j & 0x3fc, j & 0x3fc, 0);
@@ -1136,14 +1488,20 @@ static void fill_gradient_rgb32(const struct util_rgb_info *rgb,
 }
 
 static void fill_gradient_rgb16fp(const struct util_rgb_info *rgb,
-				  void *mem,
+				  unsigned char *mem,
 				  unsigned int width, unsigned int height,
 				  unsigned int stride)
 {
 	unsigned int i, j;
 
 	for (i = 0; i < height / 2; i++) {
-		uint64_t *row = mem;
+		uint64_t *row = (uint64_t *)mem;
+
+		if (i > 0) {
+			memcpy(mem, mem - stride, width / 2 * 2 * sizeof(*row));
+			mem += stride;
+			continue;
+		}
 
 		for (j = 0; j < width / 2; j++) {
 			uint64_t value = MAKE_RGBA10FP16(rgb, j & 0x3ff, j & 0x3ff, j & 0x3ff, 0);
@@ -1153,7 +1511,13 @@ static void fill_gradient_rgb16fp(const struct util_rgb_info *rgb,
 	}
 
 	for (; i < height; i++) {
-		uint64_t *row = mem;
+		uint64_t *row = (uint64_t *)mem;
+
+		if (i > height / 2) {
+			memcpy(mem, mem - stride, width / 2 * 2 * sizeof(*row));
+			mem += stride;
+			continue;
+		}
 
 		for (j = 0; j < width / 2; j++) {
 			uint64_t value = MAKE_RGBA10FP16(rgb, j & 0x3fc, j & 0x3fc, j & 0x3fc, 0);
@@ -28,11 +28,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <poll.h>
 #include <sys/time.h>
+#include <time.h>
 #if HAVE_SYS_SELECT_H
 #include <sys/select.h>
 #endif
@@ -45,30 +48,111 @@
 
 extern char *optarg;
 extern int optind, opterr, optopt;
-static char optstr[] = "D:M:s";
+static char optstr[] = "D:M:sam:n:c:";
 
-int secondary = 0;
+#define HIST_BUCKETS 16
+
+enum vbl_path {
+	VBL_PATH_VBLANK,	/* drmWaitVBlank events */
+	VBL_PATH_SEQUENCE,	/* drmCrtcQueueSequence events */
+};
+
+static const char *const vbl_path_names[] = { "vblank", "sequence" };
+
+struct vbl_event {
+	uint64_t sequence;
+	uint64_t ns;
+	/* the event read, since the vblank */
+	uint64_t latency;
+};
 
 struct vbl_info {
+	enum vbl_path path;
+	unsigned int pipe;
+	uint32_t crtc_id;
+
 	unsigned int vbl_count;
 	struct timeval start;
+
+	struct vbl_event *events;
+	unsigned int num_events, max_events;
+	bool done;
 };
 
-static void vblank_handler(int fd, unsigned int frame, unsigned int sec,
-			   unsigned int usec, void *data)
+static unsigned int max_events;
+static FILE *csv;
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned int vblank_pipe_flags(unsigned int pipe)
+{
+	if (pipe == 1)
+		return DRM_VBLANK_SECONDARY;
+	return (pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+}
+
+static int queue_event(int fd, struct vbl_info *info)
 {
 	drmVBlank vbl;
+
+	if (info->path == VBL_PATH_SEQUENCE)
+		return drmCrtcQueueSequence(fd, info->crtc_id,
+					    DRM_CRTC_SEQUENCE_RELATIVE, 1,
+					    NULL, (uintptr_t)info);
+
+	vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT |
+			   vblank_pipe_flags(info->pipe);
+	vbl.request.sequence = 1;
+	vbl.request.signal = (unsigned long)info;
+
+	return drmWaitVBlank(fd, &vbl);
+}
+
+static void record_event(int fd, struct vbl_info *info, uint64_t sequence,
+			 uint64_t ns)
+{
+	struct vbl_event *ev, *events;
+	uint64_t now = get_time_ns();
 	struct timeval end;
-	struct vbl_info *info = data;
 	double t;
 
-	vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
-	if (secondary)
-		vbl.request.type |= DRM_VBLANK_SECONDARY;
-	vbl.request.sequence = 1;
-	vbl.request.signal = (unsigned long)data;
+	if (info->done)
+		return;
 
-	drmWaitVBlank(fd, &vbl);
+	if (info->num_events == info->max_events) {
+		info->max_events = info->max_events ? info->max_events * 2 : 1024;
+		events = realloc(info->events,
+				 info->max_events * sizeof(*info->events));
+		if (!events) {
+			fprintf(stderr, "memory allocation failed\n");
+			info->done = true;
+			return;
+		}
+		info->events = events;
+	}
+
+	ev = &info->events[info->num_events++];
+	ev->sequence = sequence;
+	ev->ns = ns;
+	ev->latency = now > ns ? now - ns : 0;
+
+	if (csv)
+		fprintf(csv, "%u,%u,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+			info->pipe, info->crtc_id, vbl_path_names[info->path], sequence, ns,
+			info->num_events > 1 ? ns - ev[-1].ns : 0, ev->latency);
+
+	if (max_events && info->num_events == max_events) {
+		info->done = true;
+		return;
+	}
+
+	queue_event(fd, info);
 
 	info->vbl_count++;
 
@@ -76,30 +160,174 @@ static void vblank_handler(int fd, unsigned int frame, unsigned int sec,
 		gettimeofday(&end, NULL);
 		t = end.tv_sec + end.tv_usec * 1e-6 -
 			(info->start.tv_sec + info->start.tv_usec * 1e-6);
-		fprintf(stderr, "freq: %.02fHz\n", info->vbl_count / t);
+		fprintf(stderr, "pipe %u %s freq: %.02fHz\n", info->pipe,
+			vbl_path_names[info->path], info->vbl_count / t);
 		info->vbl_count = 0;
 		info->start = end;
 	}
 }
 
+static void vblank_handler(int fd, unsigned int frame, unsigned int sec,
+			   unsigned int usec, void *data)
+{
+	record_event(fd, data, frame, sec * 1000000000ull + usec * 1000ull);
+}
+
+static void sequence_handler(int fd, uint64_t sequence, uint64_t ns,
+			     uint64_t user_data)
+{
+	record_event(fd, (struct vbl_info *)(uintptr_t)user_data, sequence, ns);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* min/avg/p99/max, and a histogram of the deviation from the median. */
+static void print_stats(const char *name, uint64_t *samples, unsigned int count)
+{
+	unsigned int hist[HIST_BUCKETS] = { 0 };
+	unsigned int i, bucket, max = 0;
+	uint64_t sum = 0, median, dev;
+
+	if (!count)
+		return;
+
+	qsort(samples, count, sizeof(*samples), compare_u64);
+	for (i = 0; i < count; i++)
+		sum += samples[i];
+	median = samples[count / 2];
+
+	printf("  %s (us): min %.1f avg %.1f p99 %.1f max %.1f\n", name,
+	       samples[0] / 1000.0, sum / 1000.0 / count,
+	       samples[count * 99 / 100] / 1000.0, samples[count - 1] / 1000.0);
+
+	for (i = 0; i < count; i++) {
+		dev = (samples[i] > median ? samples[i] - median :
+		       median - samples[i]) / 1000;
+		for (bucket = 0; dev && bucket < HIST_BUCKETS - 1; bucket++)
+			dev >>= 1;
+		hist[bucket]++;
+		if (hist[bucket] > max)
+			max = hist[bucket];
+	}
+
+	printf("    deviation from the median %.1f us:\n", median / 1000.0);
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		printf("    %s%6u us %8u |%.*s\n",
+		       i == HIST_BUCKETS - 1 ? ">=" : "< ", 1u << i, hist[i],
+		       (int)(hist[i] * 50 / max),
+		       "##################################################");
+	}
+}
+
+static void report(struct vbl_info *info)
+{
+	uint64_t *samples;
+	uint64_t missed = 0;
+	unsigned int i, n;
+
+	printf("pipe %u", info->pipe);
+	if (info->crtc_id)
+		printf(" (crtc %u)", info->crtc_id);
+	printf(" %s: %u events", vbl_path_names[info->path],
+	       info->num_events);
+
+	if (info->num_events < 2) {
+		printf("\n");
+		return;
+	}
+
+	/* legacy sequences are 32 bits */
+	for (i = 1; i < info->num_events; i++) {
+		n = (uint32_t)(info->events[i].sequence -
+			       info->events[i - 1].sequence);
+		if (n > 1)
+			missed += n - 1;
+	}
+	printf(", %" PRIu64 " vblanks skipped\n", missed);
+
+	samples = calloc(info->num_events, sizeof(*samples));
+	if (!samples)
+		return;
+
+	for (i = 1; i < info->num_events; i++)
+		samples[i - 1] = info->events[i].ns - info->events[i - 1].ns;
+	print_stats("timestamp delta", samples, info->num_events - 1);
+
+	for (i = 0; i < info->num_events; i++)
+		samples[i] = info->events[i].latency;
+	print_stats("vblank to event", samples, info->num_events);
+
+	free(samples);
+}
+
+/* The timestamps of both paths for the same vblanks of a crtc. */
+static void compare_paths(struct vbl_info *vbl, struct vbl_info *seq)
+{
+	uint64_t diff, max = 0, sum = 0;
+	unsigned int i = 0, j = 0, n = 0;
+	int32_t d;
+
+	while (i < vbl->num_events && j < seq->num_events) {
+		d = (int32_t)((uint32_t)vbl->events[i].sequence -
+			      (uint32_t)seq->events[j].sequence);
+		if (d < 0) {
+			i++;
+		} else if (d > 0) {
+			j++;
+		} else {
+			diff = vbl->events[i].ns > seq->events[j].ns ?
+			       vbl->events[i].ns - seq->events[j].ns :
+			       seq->events[j].ns - vbl->events[i].ns;
+			sum += diff;
+			if (diff > max)
+				max = diff;
+			n++;
+			i++;
+			j++;
+		}
+	}
+
+	printf("pipe %u vblank vs sequence: %u common vblanks", vbl->pipe, n);
+	if (n)
+		printf(", timestamp difference avg %.3f us max %.3f us",
+		       sum / 1000.0 / n, max / 1000.0);
+	printf("\n");
+}
+
 static void usage(char *name)
 {
-	fprintf(stderr, "usage: %s [-DMs]\n", name);
+	fprintf(stderr, "usage: %s [-DMsa] [-m PATH] [-n COUNT] [-c FILE]\n", name);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "options:\n");
 	fprintf(stderr, "  -D DEVICE  open the given device\n");
 	fprintf(stderr, "  -M MODULE  open the given module\n");
 	fprintf(stderr, "  -s         use secondary pipe\n");
+	fprintf(stderr, "  -a         use all active pipes at once\n");
+	fprintf(stderr, "  -m PATH    vblank, sequence or both, the events to wait for\n");
+	fprintf(stderr, "  -n COUNT   stop after COUNT events of each pipe\n");
+	fprintf(stderr, "  -c FILE    write every event to FILE as CSV\n");
 	exit(0);
 }
 
 int main(int argc, char **argv)
 {
-	const char *device = NULL, *module = NULL;
+	const char *device = NULL, *module = NULL, *csv_file = NULL;
 	int c, fd, ret;
+	unsigned int secondary = 0;
+	int all = 0;
+	bool paths[2] = { true, false };
 	drmVBlank vbl;
 	drmEventContext evctx;
-	struct vbl_info handler_info;
+	drmModeRes *res = NULL;
+	struct vbl_info *infos;
+	unsigned int num_pipes, num_infos = 0, i, j, running;
 
 	opterr = 0;
 	while ((c = getopt(argc, argv, optstr)) != -1) {
@@ -113,6 +341,23 @@ int main(int argc, char **argv)
 		case 's':
 			secondary = 1;
 			break;
+		case 'a':
+			all = 1;
+			break;
+		case 'm':
+			paths[VBL_PATH_VBLANK] = !strcmp(optarg, "vblank") ||
+						 !strcmp(optarg, "both");
+			paths[VBL_PATH_SEQUENCE] = !strcmp(optarg, "sequence") ||
+						   !strcmp(optarg, "both");
+			if (!paths[VBL_PATH_VBLANK] && !paths[VBL_PATH_SEQUENCE])
+				usage(argv[0]);
+			break;
+		case 'n':
+			max_events = atoi(optarg);
+			break;
+		case 'c':
+			csv_file = optarg;
+			break;
 		default:
 			usage(argv[0]);
 			break;
@@ -123,31 +368,75 @@ int main(int argc, char **argv)
 	if (fd < 0)
 		return 1;
 
-	/* Get current count first */
-	vbl.request.type = DRM_VBLANK_RELATIVE;
-	if (secondary)
-		vbl.request.type |= DRM_VBLANK_SECONDARY;
-	vbl.request.sequence = 0;
-	ret = drmWaitVBlank(fd, &vbl);
-	if (ret != 0) {
-		printf("drmWaitVBlank (relative) failed ret: %i\n", ret);
+	/* The crtc ids, for the sequence events and the active pipes. */
+	if (all || paths[VBL_PATH_SEQUENCE]) {
+		res = drmModeGetResources(fd);
+		if (!res) {
+			fprintf(stderr, "drmModeGetResources failed: %s\n",
+				strerror(errno));
+			return -1;
+		}
+	}
+	num_pipes = all ? res->count_crtcs : 1;
+
+	infos = calloc(num_pipes * 2, sizeof(*infos));
+	if (!infos) {
+		fprintf(stderr, "memory allocation failed\n");
 		return -1;
 	}
 
-	printf("starting count: %d\n", vbl.request.sequence);
+	if (csv_file) {
+		csv = fopen(csv_file, "w");
+		if (!csv) {
+			fprintf(stderr, "failed to open %s: %s\n", csv_file,
+				strerror(errno));
+			return -1;
+		}
+		fprintf(csv, "pipe,crtc,path,sequence,timestamp_ns,delta_ns,latency_ns\n");
+	}
 
-	handler_info.vbl_count = 0;
-	gettimeofday(&handler_info.start, NULL);
+	for (i = 0; i < num_pipes; i++) {
+		unsigned int pipe = all ? i : secondary;
 
-	/* Queue an event for frame + 1 */
-	vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
-	if (secondary)
-		vbl.request.type |= DRM_VBLANK_SECONDARY;
-	vbl.request.sequence = 1;
-	vbl.request.signal = (unsigned long)&handler_info;
-	ret = drmWaitVBlank(fd, &vbl);
-	if (ret != 0) {
-		printf("drmWaitVBlank (relative, event) failed ret: %i\n", ret);
+		/* Get current count first */
+		vbl.request.type = DRM_VBLANK_RELATIVE | vblank_pipe_flags(pipe);
+		vbl.request.sequence = 0;
+		ret = drmWaitVBlank(fd, &vbl);
+		if (ret != 0) {
+			/* a crtc off has no vblank */
+			if (all)
+				continue;
+			printf("drmWaitVBlank (relative) failed ret: %i\n", ret);
+			return -1;
+		}
+
+		printf("pipe %u starting count: %d\n", pipe, vbl.request.sequence);
+
+		for (j = 0; j < 2; j++) {
+			struct vbl_info *info = &infos[num_infos];
+
+			if (!paths[j])
+				continue;
+
+			info->path = j;
+			info->pipe = pipe;
+			if (res && pipe < (unsigned int)res->count_crtcs)
+				info->crtc_id = res->crtcs[pipe];
+			gettimeofday(&info->start, NULL);
+
+			/* Queue an event for frame + 1 */
+			ret = queue_event(fd, info);
+			if (ret != 0) {
+				printf("queueing a %s event on pipe %u failed ret: %i\n",
+				       vbl_path_names[j], pipe, ret);
+				return -1;
+			}
+			num_infos++;
+		}
+	}
+
+	if (!num_infos) {
+		fprintf(stderr, "no active pipe\n");
 		return -1;
 	}
 
@@ -156,9 +445,11 @@ int main(int argc, char **argv)
 	evctx.version = DRM_EVENT_CONTEXT_VERSION;
 	evctx.vblank_handler = vblank_handler;
 	evctx.page_flip_handler = NULL;
+	evctx.sequence_handler = sequence_handler;
 
 	/* Poll for events */
-	while (1) {
+	running = num_infos;
+	while (running) {
 		struct timeval timeout = { .tv_sec = 3, .tv_usec = 0 };
 		fd_set fds;
 
@@ -180,7 +471,26 @@ int main(int argc, char **argv)
 			printf("drmHandleEvent failed: %i\n", ret);
 			return -1;
 		}
+
+		for (running = 0, i = 0; i < num_infos; i++)
+			running += !infos[i].done;
+	}
+
+	for (i = 0; i < num_infos; i++)
+		report(&infos[i]);
+
+	/* both paths of a pipe are next to each other */
+	for (i = 0; i + 1 < num_infos; i++) {
+		if (infos[i].pipe == infos[i + 1].pipe)
+			compare_paths(&infos[i], &infos[i + 1]);
 	}
 
+	if (csv)
+		fclose(csv);
+	for (i = 0; i < num_infos; i++)
+		free(infos[i].events);
+	free(infos);
+	drmModeFreeResources(res);
+
 	return 0;
 }
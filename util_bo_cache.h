@@ -0,0 +1,379 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/**
+ * \file
+ * Size bucketed cache of freed buffer objects shared by the drivers.
+ *
+ * The driver embeds a struct util_bo_cache_entry in its buffer objects and
+ * keeps doing the driver specific parts, checking whether a cached buffer
+ * is idle or still has its pages, under its own lock. The cache keeps the
+ * buckets, the LRU order and the statistics, overall and per bucket.
+ * Setting LIBDRM_BO_CACHE_STATS in the environment has the drivers print
+ * the bucket statistics when the cache goes away with its device.
+ *
+ * Bucket sizes are the page counts 1 to 2 * N - 1 followed by N steps
+ * between each power of two, where N is the number of buckets per power of
+ * two, so the bucket of a size is computed rather than searched for.
+ */
+
+#ifndef _UTIL_BO_CACHE_H_
+#define _UTIL_BO_CACHE_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util_double_list.h"
+
+#define UTIL_BO_CACHE_PAGE_SIZE		4096
+/* Up to 8 buckets per power of two and 4 GiB per buffer. */
+#define UTIL_BO_CACHE_MAX_SHIFT		3
+#define UTIL_BO_CACHE_MAX_SIZE		(4ull * 1024 * 1024 * 1024)
+#define UTIL_BO_CACHE_MAX_BUCKETS	160
+
+#define UTIL_BO_CACHE_DEFAULT_MAX_SIZE	(64 * 1024 * 1024)
+#define UTIL_BO_CACHE_DEFAULT_MAX_AGE	1000000000ull
+
+/* Pass as the time to evict everything. */
+#define UTIL_BO_CACHE_PURGE		UINT64_MAX
+
+struct util_bo_cache;
+struct util_bo_cache_bucket;
+
+struct util_bo_cache_entry {
+	struct list_head bucket_link;
+	struct list_head lru_link;
+	/* The cache holding the buffer, NULL when not cached. */
+	struct util_bo_cache *cache;
+	struct util_bo_cache_bucket *bucket;
+	uint64_t size;
+	uint64_t free_time;
+};
+
+enum util_bo_cache_miss {
+	/* Nothing cached in the bucket. */
+	UTIL_BO_CACHE_MISS_EMPTY,
+	/* The cached buffers were still in use by the GPU. */
+	UTIL_BO_CACHE_MISS_BUSY,
+	/* None of the cached buffers had the flags asked for. */
+	UTIL_BO_CACHE_MISS_FLAGS,
+};
+
+struct util_bo_cache_bucket_stats {
+	/* Allocations of the bucket size, and those served from the cache. */
+	uint64_t allocs;
+	uint64_t hits;
+	/* Misses other than for an empty bucket. */
+	uint64_t busy_misses;
+	uint64_t flags_misses;
+	/* Buffers evicted for their age, and for the memory cap, a trim or
+	 * the cache going away. */
+	uint64_t expired;
+	uint64_t dropped;
+	/* Currently cached. */
+	uint64_t buffers;
+	uint64_t bytes;
+};
+
+struct util_bo_cache_bucket {
+	/* Entries by bucket_link, oldest first. */
+	struct list_head list;
+	uint64_t size;
+	struct util_bo_cache_bucket_stats stats;
+};
+
+struct util_bo_cache_stats {
+	/* Allocations served from the cache and not. */
+	uint64_t hits;
+	uint64_t misses;
+	/* Buffers dropped for their age or the memory cap. */
+	uint64_t evictions;
+	/* Currently cached. */
+	uint64_t buffers;
+	uint64_t bytes;
+};
+
+struct util_bo_cache {
+	struct util_bo_cache_bucket buckets[UTIL_BO_CACHE_MAX_BUCKETS];
+	unsigned num_buckets;
+	/* log2 of the buckets per power of two. */
+	unsigned shift;
+	/* 0 for no cap. */
+	uint64_t max_bytes;
+	uint64_t max_age;
+	/* Entries by lru_link, oldest first. */
+	struct list_head lru;
+	struct util_bo_cache_stats stats;
+};
+
+static inline uint64_t util_bo_cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline unsigned util_bo_cache_index(unsigned shift, uint64_t size)
+{
+	uint64_t pages = (size + UTIL_BO_CACHE_PAGE_SIZE - 1) /
+			 UTIL_BO_CACHE_PAGE_SIZE;
+	uint64_t steps = 1ull << shift, mantissa;
+	unsigned order;
+
+	if (pages < 2 * steps)
+		return pages ? pages - 1 : 0;
+
+	/* Round up to mantissa << order with steps <= mantissa < 2 * steps. */
+	order = 63 - __builtin_clzll(pages) - shift;
+	mantissa = (pages + (1ull << order) - 1) >> order;
+	if (mantissa == 2 * steps) {
+		mantissa = steps;
+		order++;
+	}
+	return 2 * steps - 1 + (order - 1) * steps + (mantissa - steps);
+}
+
+static inline uint64_t util_bo_cache_bucket_size(unsigned shift,
+						 unsigned index)
+{
+	uint64_t steps = 1ull << shift;
+	unsigned order;
+
+	if (index < 2 * steps - 1)
+		return (index + 1ull) * UTIL_BO_CACHE_PAGE_SIZE;
+
+	index -= 2 * steps - 1;
+	order = index / steps + 1;
+	return ((steps + index % steps) << order) * UTIL_BO_CACHE_PAGE_SIZE;
+}
+
+/**
+ * Set up an empty cache.
+ *
+ * \param shift     - log2 of the number of buckets per power of two,
+ *                    clamped to UTIL_BO_CACHE_MAX_SHIFT
+ * \param max_size  - Largest size cached, rounded up to the end of its power
+ *                    of two
+ * \param max_bytes - Total size cached before the oldest buffers are
+ *                    evicted, 0 for no limit
+ * \param max_age   - Nanoseconds a buffer stays cached
+ */
+static inline void util_bo_cache_init(struct util_bo_cache *cache,
+				      unsigned shift, uint64_t max_size,
+				      uint64_t max_bytes, uint64_t max_age)
+{
+	unsigned i, linear;
+
+	if (shift > UTIL_BO_CACHE_MAX_SHIFT)
+		shift = UTIL_BO_CACHE_MAX_SHIFT;
+	if (max_size > UTIL_BO_CACHE_MAX_SIZE)
+		max_size = UTIL_BO_CACHE_MAX_SIZE;
+
+	cache->shift = shift;
+	cache->num_buckets = util_bo_cache_index(shift, max_size) + 1;
+	linear = (2u << shift) - 1;
+	if (cache->num_buckets > linear)
+		cache->num_buckets += (linear - cache->num_buckets) &
+				      ((1u << shift) - 1);
+
+	for (i = 0; i < cache->num_buckets; i++) {
+		list_inithead(&cache->buckets[i].list);
+		cache->buckets[i].size = util_bo_cache_bucket_size(shift, i);
+		memset(&cache->buckets[i].stats, 0,
+		       sizeof(cache->buckets[i].stats));
+	}
+	cache->max_bytes = max_bytes;
+	cache->max_age = max_age;
+	list_inithead(&cache->lru);
+	memset(&cache->stats, 0, sizeof(cache->stats));
+}
+
+/* Bucket for buffers of the size, which allocations should be rounded up
+ * to. NULL when the size is too large to be cached. */
+static inline struct util_bo_cache_bucket *
+util_bo_cache_get_bucket(struct util_bo_cache *cache, uint64_t size)
+{
+	unsigned index = util_bo_cache_index(cache->shift, size);
+
+	if (index >= cache->num_buckets)
+		return NULL;
+	return &cache->buckets[index];
+}
+
+static inline void util_bo_cache_entry_init(struct util_bo_cache_entry *entry)
+{
+	list_inithead(&entry->bucket_link);
+	list_inithead(&entry->lru_link);
+	entry->cache = NULL;
+}
+
+static inline void util_bo_cache_add(struct util_bo_cache *cache,
+				     struct util_bo_cache_bucket *bucket,
+				     struct util_bo_cache_entry *entry,
+				     uint64_t now)
+{
+	entry->cache = cache;
+	entry->bucket = bucket;
+	entry->size = bucket->size;
+	entry->free_time = now;
+	list_addtail(&entry->bucket_link, &bucket->list);
+	list_addtail(&entry->lru_link, &cache->lru);
+	cache->stats.buffers++;
+	cache->stats.bytes += entry->size;
+	bucket->stats.buffers++;
+	bucket->stats.bytes += entry->size;
+}
+
+/* Take the entry out of its cache, if any. */
+static inline void util_bo_cache_remove(struct util_bo_cache_entry *entry)
+{
+	struct util_bo_cache *cache = entry->cache;
+
+	if (!cache)
+		return;
+
+	list_delinit(&entry->bucket_link);
+	list_delinit(&entry->lru_link);
+	entry->cache = NULL;
+	cache->stats.buffers--;
+	cache->stats.bytes -= entry->size;
+	entry->bucket->stats.buffers--;
+	entry->bucket->stats.bytes -= entry->size;
+}
+
+/* Take a buffer found in a bucket for reuse. */
+static inline void util_bo_cache_take(struct util_bo_cache_entry *entry)
+{
+	entry->cache->stats.hits++;
+	entry->bucket->stats.allocs++;
+	entry->bucket->stats.hits++;
+	util_bo_cache_remove(entry);
+}
+
+static inline void util_bo_cache_miss(struct util_bo_cache *cache)
+{
+	cache->stats.misses++;
+}
+
+/* A miss in the bucket, counted in its statistics for the reason. */
+static inline void util_bo_cache_bucket_miss(struct util_bo_cache *cache,
+					     struct util_bo_cache_bucket *bucket,
+					     enum util_bo_cache_miss reason)
+{
+	cache->stats.misses++;
+	bucket->stats.allocs++;
+	if (reason == UTIL_BO_CACHE_MISS_BUSY)
+		bucket->stats.busy_misses++;
+	else if (reason == UTIL_BO_CACHE_MISS_FLAGS)
+		bucket->stats.flags_misses++;
+}
+
+/**
+ * Take out the oldest entry if it is too old or the cache holds more than
+ * bytes, for the caller to free the buffer. Call until it returns NULL.
+ */
+static inline struct util_bo_cache_entry *
+util_bo_cache_evict_to(struct util_bo_cache *cache, uint64_t now,
+		       uint64_t bytes)
+{
+	struct util_bo_cache_entry *entry;
+	bool expired;
+
+	if (LIST_IS_EMPTY(&cache->lru))
+		return NULL;
+
+	entry = LIST_ENTRY(struct util_bo_cache_entry, cache->lru.next,
+			   lru_link);
+	expired = now - entry->free_time > cache->max_age;
+	if (!expired && cache->stats.bytes <= bytes)
+		return NULL;
+
+	if (expired && now != UTIL_BO_CACHE_PURGE)
+		entry->bucket->stats.expired++;
+	else
+		entry->bucket->stats.dropped++;
+	util_bo_cache_remove(entry);
+	cache->stats.evictions++;
+	return entry;
+}
+
+/* Same with the memory cap of the cache. */
+static inline struct util_bo_cache_entry *
+util_bo_cache_evict(struct util_bo_cache *cache, uint64_t now)
+{
+	return util_bo_cache_evict_to(cache, now, cache->max_bytes ?
+				      cache->max_bytes : UINT64_MAX);
+}
+
+/* What the cache should be trimmed down to for releasing level percent of
+ * the cached memory. */
+static inline uint64_t util_bo_cache_trim_bytes(struct util_bo_cache *cache,
+						unsigned level)
+{
+	if (level >= 100)
+		return 0;
+	return cache->stats.bytes - cache->stats.bytes / 100 * level;
+}
+
+/* Whether the statistics should be printed when the cache goes away. */
+static inline bool util_bo_cache_dump_enabled(void)
+{
+	return getenv("LIBDRM_BO_CACHE_STATS") != NULL;
+}
+
+/* Print the statistics of the buckets which saw any use to stderr. */
+static inline void util_bo_cache_dump(struct util_bo_cache *cache,
+				      const char *name)
+{
+	struct util_bo_cache_bucket_stats *s;
+	unsigned i;
+
+	fprintf(stderr, "%s bo cache: %" PRIu64 " hits, %" PRIu64 " misses, "
+		"%" PRIu64 " evictions, %" PRIu64 " buffers of %" PRIu64
+		" bytes cached\n", name, cache->stats.hits, cache->stats.misses,
+		cache->stats.evictions, cache->stats.buffers,
+		cache->stats.bytes);
+	fprintf(stderr, "%12s %10s %10s %10s %10s %10s %10s %8s %12s\n",
+		"size", "allocs", "hits", "busy", "flags", "expired",
+		"dropped", "buffers", "bytes");
+
+	for (i = 0; i < cache->num_buckets; i++) {
+		s = &cache->buckets[i].stats;
+		if (!s->allocs && !s->expired && !s->dropped && !s->buffers)
+			continue;
+		fprintf(stderr, "%12" PRIu64 " %10" PRIu64 " %10" PRIu64
+			" %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+			" %8" PRIu64 " %12" PRIu64 "\n",
+			cache->buckets[i].size, s->allocs, s->hits,
+			s->busy_misses, s->flags_misses, s->expired,
+			s->dropped, s->buffers, s->bytes);
+	}
+}
+
+#endif /* _UTIL_BO_CACHE_H_ */
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/**
+ * \file
+ * Accounting of the live buffer objects of a device by debug label and
+ * heap, shared by the drivers.
+ *
+ * The driver keeps the label index in its buffer objects and calls in
+ * under its own lock when a buffer is allocated, relabeled and freed or
+ * cached for reuse, so the cached buffers are left to the bo cache
+ * statistics. Label 0 holds the buffers never labeled, and the last one
+ * those of the labels past UTIL_BO_LABEL_MAX. Setting LIBDRM_BO_LABEL_STATS
+ * in the environment has the drivers print the labels when the device goes
+ * away.
+ */
+
+#ifndef _UTIL_BO_LABELS_H_
+#define _UTIL_BO_LABELS_H_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define UTIL_BO_LABEL_MAX		64
+#define UTIL_BO_LABEL_NAME_SIZE		32
+#define UTIL_BO_LABEL_MAX_HEAPS		4
+/* Allocation rates are measured over windows of at least a second. */
+#define UTIL_BO_LABEL_RATE_WINDOW	1000000000ull
+
+struct util_bo_label {
+	char name[UTIL_BO_LABEL_NAME_SIZE];
+	/* Live buffers, per heap. */
+	uint64_t buffers[UTIL_BO_LABEL_MAX_HEAPS];
+	uint64_t bytes[UTIL_BO_LABEL_MAX_HEAPS];
+	uint64_t peak_bytes;
+	/* Allocations since the device was created. */
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+	/* Bytes allocated per second over the last window, and the current
+	 * window. */
+	uint64_t alloc_rate;
+	uint64_t window_start;
+	uint64_t window_bytes;
+};
+
+struct util_bo_labels {
+	struct util_bo_label labels[UTIL_BO_LABEL_MAX];
+	unsigned num_labels;
+	unsigned num_heaps;
+};
+
+static inline uint64_t util_bo_labels_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void util_bo_labels_init(struct util_bo_labels *labels,
+				       unsigned num_heaps)
+{
+	memset(labels, 0, sizeof(*labels));
+	labels->num_heaps = num_heaps < UTIL_BO_LABEL_MAX_HEAPS ?
+			    num_heaps : UTIL_BO_LABEL_MAX_HEAPS;
+	strcpy(labels->labels[0].name, "unlabeled");
+	labels->num_labels = 1;
+}
+
+/* Index of the label of a name, added if new. NULL or "" is label 0. */
+static inline unsigned util_bo_labels_find(struct util_bo_labels *labels,
+					   const char *name)
+{
+	struct util_bo_label *label;
+	unsigned i;
+
+	if (!name || !name[0])
+		return 0;
+
+	for (i = 1; i < labels->num_labels; i++) {
+		if (!strncmp(labels->labels[i].name, name,
+			     UTIL_BO_LABEL_NAME_SIZE - 1))
+			return i;
+	}
+
+	if (i >= UTIL_BO_LABEL_MAX - 1) {
+		i = UTIL_BO_LABEL_MAX - 1;
+		if (labels->num_labels < UTIL_BO_LABEL_MAX) {
+			strcpy(labels->labels[i].name, "other");
+			labels->num_labels = UTIL_BO_LABEL_MAX;
+		}
+		return i;
+	}
+
+	label = &labels->labels[i];
+	memcpy(label->name, name, strnlen(name, UTIL_BO_LABEL_NAME_SIZE - 1));
+	labels->num_labels++;
+	return i;
+}
+
+static inline void util_bo_labels_add(struct util_bo_labels *labels,
+				      unsigned index, unsigned heap,
+				      uint64_t size)
+{
+	struct util_bo_label *label = &labels->labels[index];
+	uint64_t bytes = 0;
+	unsigned i;
+
+	label->buffers[heap]++;
+	label->bytes[heap] += size;
+	for (i = 0; i < labels->num_heaps; i++)
+		bytes += label->bytes[i];
+	if (bytes > label->peak_bytes)
+		label->peak_bytes = bytes;
+}
+
+static inline void util_bo_labels_remove(struct util_bo_labels *labels,
+					 unsigned index, unsigned heap,
+					 uint64_t size)
+{
+	struct util_bo_label *label = &labels->labels[index];
+
+	label->buffers[heap]--;
+	label->bytes[heap] -= size;
+}
+
+/* Account a buffer allocated, or taken back from the bo cache. */
+static inline void util_bo_labels_alloc(struct util_bo_labels *labels,
+					unsigned index, unsigned heap,
+					uint64_t size)
+{
+	struct util_bo_label *label = &labels->labels[index];
+	uint64_t now = util_bo_labels_now();
+
+	util_bo_labels_add(labels, index, heap, size);
+	label->allocs++;
+	label->alloc_bytes += size;
+
+	if (now - label->window_start >= UTIL_BO_LABEL_RATE_WINDOW) {
+		if (label->window_start)
+			label->alloc_rate = label->window_bytes *
+				1000000000ull / (now - label->window_start);
+		label->window_start = now;
+		label->window_bytes = 0;
+	}
+	label->window_bytes += size;
+}
+
+/* Moves a live buffer to another label. The allocation of a buffer not
+ * labeled yet moves along, since buffers get labeled right after being
+ * allocated. */
+static inline void util_bo_labels_move(struct util_bo_labels *labels,
+				       unsigned from, unsigned to,
+				       unsigned heap, uint64_t size)
+{
+	struct util_bo_label *label = &labels->labels[from];
+
+	if (from == to)
+		return;
+	util_bo_labels_remove(labels, from, heap, size);
+	if (from) {
+		util_bo_labels_add(labels, to, heap, size);
+		return;
+	}
+
+	label->allocs--;
+	label->alloc_bytes -= size;
+	label->window_bytes -= size < label->window_bytes ?
+			       size : label->window_bytes;
+	util_bo_labels_alloc(labels, to, heap, size);
+}
+
+/* Bytes per second of the label, 0 once it stopped allocating for a
+ * window. */
+static inline uint64_t util_bo_labels_rate(struct util_bo_labels *labels,
+					   unsigned index)
+{
+	struct util_bo_label *label = &labels->labels[index];
+
+	if (util_bo_labels_now() - label->window_start >=
+	    2 * UTIL_BO_LABEL_RATE_WINDOW)
+		return 0;
+	return label->alloc_rate;
+}
+
+/* Whether the labels should be printed when the device goes away. */
+static inline bool util_bo_labels_dump_enabled(void)
+{
+	return getenv("LIBDRM_BO_LABEL_STATS") != NULL;
+}
+
+static inline void util_bo_labels_dump_label(struct util_bo_labels *labels,
+					     unsigned index, FILE *file)
+{
+	struct util_bo_label *label = &labels->labels[index];
+	unsigned heap;
+
+	fprintf(file, "%-*s", UTIL_BO_LABEL_NAME_SIZE, label->name);
+	for (heap = 0; heap < labels->num_heaps; heap++)
+		fprintf(file, " %8" PRIu64 " %12" PRIu64, label->buffers[heap],
+			label->bytes[heap]);
+	fprintf(file, " %12" PRIu64 " %10" PRIu64 " %12" PRIu64 " %12" PRIu64
+		"\n", label->peak_bytes, label->allocs, label->alloc_bytes,
+		util_bo_labels_rate(labels, index));
+}
+
+/*
+ * Print the live bytes of the labels which saw any use, per heap, and the
+ * idle bytes the bo cache holds.
+ *
+ * \param heaps - Names of the labels->num_heaps heaps
+ */
+static inline void util_bo_labels_dump(struct util_bo_labels *labels,
+				       const char *const *heaps,
+				       uint64_t cached_bytes,
+				       const char *name, FILE *file)
+{
+	unsigned i, heap;
+
+	fprintf(file, "%s bo usage, %" PRIu64 " idle bytes cached:\n%-*s",
+		name, cached_bytes, UTIL_BO_LABEL_NAME_SIZE, "label");
+	for (heap = 0; heap < labels->num_heaps; heap++)
+		fprintf(file, " %8s %12s", "buffers", heaps[heap]);
+	fprintf(file, " %12s %10s %12s %12s\n", "peak", "allocs",
+		"alloc bytes", "bytes/s");
+
+	for (i = 0; i < labels->num_labels; i++) {
+		if (labels->labels[i].allocs || labels->labels[i].peak_bytes)
+			util_bo_labels_dump_label(labels, i, file);
+	}
+}
+
+#endif /* _UTIL_BO_LABELS_H_ */
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/**
+ * \file
+ * Growing the relocation, buffer and packet arrays the drivers build their
+ * submits in.
+ *
+ * The arrays at least double, so that a submit of n entries copies O(n)
+ * of them however it got there.  glibc serves the large blocks with
+ * mmap() and grows them with mremap() in realloc(), so the big arrays are
+ * moved by remapping their pages rather than copying them, and the parts
+ * of arrays past UTIL_GROW_HUGE_SIZE get asked to be backed by transparent
+ * huge pages, which take one fault where 4 KiB pages take 512.
+ */
+
+#ifndef _UTIL_GROW_H_
+#define _UTIL_GROW_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define UTIL_GROW_MIN		16
+#define UTIL_GROW_HUGE_SIZE	(2u << 20)
+
+/* Ask for the huge page aligned part of a large array to be backed by
+ * transparent huge pages, if the kernel has them. */
+static inline void util_grow_advise(void *ptr, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+	uintptr_t start, end;
+
+	if (size < UTIL_GROW_HUGE_SIZE)
+		return;
+
+	start = ((uintptr_t)ptr + UTIL_GROW_HUGE_SIZE - 1) &
+		~(uintptr_t)(UTIL_GROW_HUGE_SIZE - 1);
+	end = ((uintptr_t)ptr + size) & ~(uintptr_t)(UTIL_GROW_HUGE_SIZE - 1);
+	if (end > start)
+		madvise((void *)start, end - start, MADV_HUGEPAGE);
+#endif
+}
+
+/* Number of elements to grow an array of max to, to hold count. */
+static inline uint32_t util_grow_size(uint32_t max, uint32_t count)
+{
+	uint32_t size = max < UTIL_GROW_MIN ? UTIL_GROW_MIN : max;
+
+	while (size < count && size <= UINT32_MAX / 2)
+		size *= 2;
+	return size < count ? count : size;
+}
+
+/**
+ * Grow an array to hold at least count elements of elem_size bytes.
+ *
+ * \param max - The elements the array holds, updated
+ *
+ * \return the array, moved or not, or NULL if out of memory, leaving the
+ * array and max as they were
+ */
+static inline void *util_grow_array(void *ptr, uint32_t *max, uint32_t count,
+				    size_t elem_size)
+{
+	uint32_t size;
+	void *grown;
+
+	if (count <= *max)
+		return ptr;
+
+	size = util_grow_size(*max, count);
+	if (size > SIZE_MAX / elem_size)
+		return NULL;
+
+	grown = realloc(ptr, (size_t)size * elem_size);
+	if (!grown)
+		return NULL;
+
+	util_grow_advise(grown, (size_t)size * elem_size);
+	*max = size;
+	return grown;
+}
+
+#endif /* _UTIL_GROW_H_ */
@@ -0,0 +1,155 @@
+/*
+ * Copyright 2018 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * \file
+ * Table of pointers by GEM handle or flink name, shared by the drivers.
+ * Lookups take no lock.
+ */
+
+#ifndef _UTIL_HANDLE_TABLE_H_
+#define _UTIL_HANDLE_TABLE_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Keys are split into a page index and an index into the page, pages are
+ * allocated on demand so that sparse keys stay cheap. */
+#define HANDLE_TABLE_PAGE_SHIFT	9
+#define HANDLE_TABLE_PAGE_SIZE	(1u << HANDLE_TABLE_PAGE_SHIFT)
+
+struct handle_table_dir {
+	uint32_t			num_pages;
+	/* Smaller directory this one replaced. */
+	struct handle_table_dir		*retired;
+	void				**pages[];
+};
+
+/* Insertions and removals must be serialized by the caller, lookups may
+ * run concurrently with them. Pages and directories are only freed by
+ * handle_table_fini(), so a reader never sees freed memory. */
+struct handle_table {
+	struct handle_table_dir		*dir;
+};
+
+static inline struct handle_table_dir *
+handle_table_grow(struct handle_table *table, uint32_t page)
+{
+	struct handle_table_dir *old = table->dir, *dir;
+	uint32_t num_pages = old ? old->num_pages : 16;
+
+	while (num_pages <= page)
+		num_pages *= 2;
+
+	dir = calloc(1, sizeof(*dir) + num_pages * sizeof(dir->pages[0]));
+	if (!dir)
+		return NULL;
+
+	dir->num_pages = num_pages;
+	if (old) {
+		memcpy(dir->pages, old->pages,
+		       old->num_pages * sizeof(old->pages[0]));
+		/* Readers may still be walking the old directory. */
+		dir->retired = old;
+	}
+	__atomic_store_n(&table->dir, dir, __ATOMIC_RELEASE);
+	return dir;
+}
+
+static inline int handle_table_insert(struct handle_table *table,
+				      uint32_t key, void *value)
+{
+	uint32_t page = key >> HANDLE_TABLE_PAGE_SHIFT;
+	struct handle_table_dir *dir = table->dir;
+	void **values;
+
+	if (!dir || page >= dir->num_pages) {
+		dir = handle_table_grow(table, page);
+		if (!dir)
+			return -ENOMEM;
+	}
+
+	values = dir->pages[page];
+	if (!values) {
+		values = calloc(HANDLE_TABLE_PAGE_SIZE, sizeof(void *));
+		if (!values)
+			return -ENOMEM;
+		__atomic_store_n(&dir->pages[page], values, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&values[key & (HANDLE_TABLE_PAGE_SIZE - 1)], value,
+			 __ATOMIC_RELEASE);
+	return 0;
+}
+
+static inline void handle_table_remove(struct handle_table *table,
+				       uint32_t key)
+{
+	uint32_t page = key >> HANDLE_TABLE_PAGE_SHIFT;
+	struct handle_table_dir *dir = table->dir;
+
+	if (dir && page < dir->num_pages && dir->pages[page])
+		__atomic_store_n(&dir->pages[page][key & (HANDLE_TABLE_PAGE_SIZE - 1)],
+				 NULL, __ATOMIC_RELEASE);
+}
+
+static inline void *handle_table_lookup(struct handle_table *table,
+					uint32_t key)
+{
+	uint32_t page = key >> HANDLE_TABLE_PAGE_SHIFT;
+	struct handle_table_dir *dir;
+	void **values;
+
+	dir = __atomic_load_n(&table->dir, __ATOMIC_ACQUIRE);
+	if (!dir || page >= dir->num_pages)
+		return NULL;
+
+	values = __atomic_load_n(&dir->pages[page], __ATOMIC_ACQUIRE);
+	if (!values)
+		return NULL;
+
+	return __atomic_load_n(&values[key & (HANDLE_TABLE_PAGE_SIZE - 1)],
+			       __ATOMIC_ACQUIRE);
+}
+
+static inline void handle_table_fini(struct handle_table *table)
+{
+	struct handle_table_dir *dir = table->dir, *retired;
+	uint32_t i;
+
+	if (dir) {
+		for (i = 0; i < dir->num_pages; i++)
+			free(dir->pages[i]);
+	}
+
+	while (dir) {
+		retired = dir->retired;
+		free(dir);
+		dir = retired;
+	}
+	table->dir = NULL;
+}
+
+#endif /* _UTIL_HANDLE_TABLE_H_ */
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/**
+ * \file
+ * Thread calling back when the kernel reports memory pressure, for the
+ * drivers to trim their buffer caches.
+ *
+ * The pressure comes from a PSI trigger on /proc/pressure/memory, or when
+ * the kernel has no PSI, from the memory.events of the cgroup of the
+ * process. The callback runs on the thread, so it must not block on a lock
+ * held while the watcher is stopped, see util_mem_pressure_stopping().
+ *
+ * To be included by the one file of a driver starting and stopping the
+ * watcher.
+ */
+
+#ifndef _UTIL_MEM_PRESSURE_H_
+#define _UTIL_MEM_PRESSURE_H_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Levels passed to the callback, in percent of the cache to release. */
+#define UTIL_MEM_PRESSURE_SOME		50
+#define UTIL_MEM_PRESSURE_CRITICAL	100
+
+/* Tasks stalled on memory for 200 ms in 2 s, the smallest window that
+ * unprivileged processes may use. */
+#define UTIL_MEM_PRESSURE_PSI_TRIGGER	"some 200000 2000000"
+
+struct util_mem_pressure;
+
+typedef void (*util_mem_pressure_func)(struct util_mem_pressure *pressure,
+				       unsigned level);
+
+struct util_mem_pressure {
+	pthread_t thread;
+	/* The PSI trigger, or else memory.events. */
+	int fd;
+	bool psi;
+	/* Counts of memory.events last read. */
+	uint64_t high;
+	uint64_t max;
+	/* Written to stop the thread. */
+	int wake[2];
+	bool stop;
+	util_mem_pressure_func func;
+	void *data;
+};
+
+static inline bool
+util_mem_pressure_stopping(struct util_mem_pressure *pressure)
+{
+	return __atomic_load_n(&pressure->stop, __ATOMIC_ACQUIRE);
+}
+
+static int util_mem_pressure_open_psi(void)
+{
+	int fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+
+	if (write(fd, UTIL_MEM_PRESSURE_PSI_TRIGGER,
+		  strlen(UTIL_MEM_PRESSURE_PSI_TRIGGER) + 1) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int util_mem_pressure_open_cgroup(void)
+{
+	char line[512], path[600];
+	FILE *f;
+	int fd = -1;
+	size_t len;
+
+	f = fopen("/proc/self/cgroup", "re");
+	if (!f)
+		return -1;
+
+	/* The cgroup v2 hierarchy is the "0::" line. */
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "0::", 3))
+			continue;
+		len = strcspn(line + 3, "\n");
+		line[3 + len] = '\0';
+		snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.events",
+			 line + 3);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		break;
+	}
+	fclose(f);
+	return fd;
+}
+
+/* Level of the cgroup events since the last read, 0 if none. */
+static unsigned
+util_mem_pressure_read_events(struct util_mem_pressure *pressure)
+{
+	unsigned long long count;
+	uint64_t high = 0, max = 0;
+	unsigned level = 0;
+	char buf[256], *line;
+	ssize_t len;
+
+	len = pread(pressure->fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return 0;
+	buf[len] = '\0';
+
+	for (line = buf; line; line = strchr(line, '\n')) {
+		if (*line == '\n')
+			line++;
+		if (sscanf(line, "high %llu", &count) == 1)
+			high = count;
+		else if (sscanf(line, "max %llu", &count) == 1 ||
+			 sscanf(line, "oom %llu", &count) == 1)
+			max += count;
+	}
+
+	if (max != pressure->max)
+		level = UTIL_MEM_PRESSURE_CRITICAL;
+	else if (high != pressure->high)
+		level = UTIL_MEM_PRESSURE_SOME;
+	pressure->high = high;
+	pressure->max = max;
+	return level;
+}
+
+static void *util_mem_pressure_thread(void *data)
+{
+	struct util_mem_pressure *pressure = data;
+	struct pollfd fds[2] = {
+		{ .fd = pressure->fd, .events = POLLPRI },
+		{ .fd = pressure->wake[0], .events = POLLIN },
+	};
+	unsigned level;
+
+	while (!util_mem_pressure_stopping(pressure)) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents)
+			break;
+		if (!fds[0].revents)
+			continue;
+
+		if (pressure->psi) {
+			/* The trigger is gone with the PSI monitor. */
+			if (fds[0].revents & POLLERR)
+				break;
+			level = UTIL_MEM_PRESSURE_SOME;
+		} else {
+			level = util_mem_pressure_read_events(pressure);
+		}
+		if (level)
+			pressure->func(pressure, level);
+	}
+	return NULL;
+}
+
+/**
+ * Start watching the memory pressure.
+ *
+ * \return The watcher, or NULL with errno set, ENOTSUP when the kernel
+ *         reports neither PSI nor cgroup memory events.
+ */
+static struct util_mem_pressure *
+util_mem_pressure_start(util_mem_pressure_func func, void *data)
+{
+	struct util_mem_pressure *pressure;
+	int r;
+
+	pressure = calloc(1, sizeof(*pressure));
+	if (!pressure)
+		return NULL;
+
+	pressure->func = func;
+	pressure->data = data;
+	pressure->fd = util_mem_pressure_open_psi();
+	pressure->psi = pressure->fd >= 0;
+	if (!pressure->psi) {
+		pressure->fd = util_mem_pressure_open_cgroup();
+		if (pressure->fd < 0) {
+			free(pressure);
+			errno = ENOTSUP;
+			return NULL;
+		}
+		util_mem_pressure_read_events(pressure);
+	}
+
+	if (pipe(pressure->wake)) {
+		r = errno;
+		goto fail_fd;
+	}
+
+	r = pthread_create(&pressure->thread, NULL, util_mem_pressure_thread,
+			   pressure);
+	if (r)
+		goto fail_pipe;
+
+	return pressure;
+
+fail_pipe:
+	close(pressure->wake[0]);
+	close(pressure->wake[1]);
+fail_fd:
+	close(pressure->fd);
+	free(pressure);
+	errno = r;
+	return NULL;
+}
+
+/* Stop the thread, waiting for a running callback, and free the watcher. */
+static void util_mem_pressure_stop(struct util_mem_pressure *pressure)
+{
+	char c = 0;
+
+	__atomic_store_n(&pressure->stop, true, __ATOMIC_RELEASE);
+	while (write(pressure->wake[1], &c, 1) < 0 && errno == EINTR)
+		;
+	pthread_join(pressure->thread, NULL);
+
+	close(pressure->wake[0]);
+	close(pressure->wake[1]);
+	close(pressure->fd);
+	free(pressure);
+}
+
+#endif /* _UTIL_MEM_PRESSURE_H_ */
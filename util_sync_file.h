@@ -0,0 +1,134 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/**
+ * \file
+ * Waiting on several sync file fds at once, for the drivers' fence
+ * objects.  A sync file polls readable once its fence has signaled.
+ */
+
+#ifndef _UTIL_SYNC_FILE_H_
+#define _UTIL_SYNC_FILE_H_
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline uint64_t util_sync_file_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Whether the sync file has signaled, without waiting. */
+static inline int util_sync_file_signaled(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+/**
+ * Wait for all, or any, of the sync files to signal.
+ *
+ * \param fds        - The sync files, negative ones are skipped
+ * \param signaled   - Set for the fds that signaled, the others are left
+ *                     alone, so a caller may pre-set those already known
+ *                     to have signaled
+ * \param timeout_ns - UINT64_MAX to wait for ever
+ *
+ * \return 0, -ETIMEDOUT, or a negative errno.
+ */
+static inline int util_sync_file_wait(const int *fds, int *signaled,
+				      unsigned count, int wait_all,
+				      uint64_t timeout_ns)
+{
+	uint64_t now = util_sync_file_now();
+	uint64_t end = timeout_ns > UINT64_MAX - now ? UINT64_MAX :
+		       now + timeout_ns;
+	struct pollfd *pfds;
+	unsigned *index;
+	unsigned i, nfds;
+	int timeout, ret;
+
+	pfds = malloc(count * (sizeof(*pfds) + sizeof(*index)));
+	if (!pfds)
+		return -ENOMEM;
+	index = (unsigned *)&pfds[count];
+
+	for (;;) {
+		unsigned done = 0;
+
+		nfds = 0;
+		for (i = 0; i < count; i++) {
+			if (signaled[i]) {
+				done++;
+			} else if (fds[i] >= 0) {
+				pfds[nfds].fd = fds[i];
+				pfds[nfds].events = POLLIN;
+				pfds[nfds].revents = 0;
+				index[nfds++] = i;
+			}
+		}
+		if (wait_all ? done == count : done > 0) {
+			ret = 0;
+			break;
+		}
+		if (!nfds) {
+			/* nothing left that can signal */
+			ret = -EINVAL;
+			break;
+		}
+
+		now = util_sync_file_now();
+		if (now >= end) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+		if (end == UINT64_MAX || (end - now) / 1000000 >= INT_MAX)
+			timeout = -1;
+		else
+			timeout = (end - now + 999999) / 1000000;
+
+		ret = poll(pfds, nfds, timeout);
+		if (ret < 0 && errno != EINTR && errno != EAGAIN) {
+			ret = -errno;
+			break;
+		}
+
+		for (i = 0; i < nfds; i++) {
+			if (pfds[i].revents & POLLIN)
+				signaled[index[i]] = 1;
+		}
+	}
+
+	free(pfds);
+	return ret;
+}
+
+#endif /* _UTIL_SYNC_FILE_H_ */
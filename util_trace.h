@@ -0,0 +1,74 @@
+/*
+ * Copyright 2014 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+/**
+ * \file
+ * Trace markers of the drivers, around their submits and at the points of
+ * the life of their buffers, written by drmTraceBegin() and friends.
+ *
+ * The markers are off unless LIBDRM_TRACE_MARKERS is set in the
+ * environment. Each translation unit asks libdrm once and keeps the
+ * answer, so a disabled marker costs a load and a branch.
+ */
+
+#ifndef _UTIL_TRACE_H_
+#define _UTIL_TRACE_H_
+
+#include <stdbool.h>
+
+#include "xf86drm.h"
+
+static inline bool util_trace_enabled(void)
+{
+	/* -1 until libdrm was asked. */
+	static int enabled = -1;
+	int state = __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+
+	if (__builtin_expect(state < 0, 0)) {
+		state = drmTraceEnabled();
+		__atomic_store_n(&enabled, state, __ATOMIC_RELAXED);
+	}
+	return state;
+}
+
+/* UTIL_TRACE_BEGIN(name, format, ...), format may be NULL. */
+#define UTIL_TRACE_BEGIN(...) \
+	do { \
+		if (util_trace_enabled()) \
+			drmTraceBegin(__VA_ARGS__); \
+	} while (0)
+
+#define UTIL_TRACE_END() \
+	do { \
+		if (util_trace_enabled()) \
+			drmTraceEnd(); \
+	} while (0)
+
+/* UTIL_TRACE_EVENT(name, format, ...), an instant. */
+#define UTIL_TRACE_EVENT(...) \
+	do { \
+		if (util_trace_enabled()) \
+			drmTraceEvent(__VA_ARGS__); \
+	} while (0)
+
+#endif /* _UTIL_TRACE_H_ */
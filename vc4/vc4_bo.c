@@ -0,0 +1,348 @@
+/*
+ * Copyright © 2014 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "vc4_priv.h"
+
+drm_private void bo_del(struct vc4_bo *bo);
+
+/* set buffer name, and add to table, call w/ table_lock held: */
+static void set_name(struct vc4_bo *bo, uint32_t name)
+{
+	bo->name = name;
+	/* add ourself into the name table: */
+	if (handle_table_insert(&bo->dev->name_table, name, bo))
+		ERROR_MSG("out of memory for name %u", name);
+}
+
+/* Called under table_lock */
+drm_private void bo_del(struct vc4_bo *bo)
+{
+	if (bo->map)
+		drm_munmap(bo->map, bo->size);
+
+	if (bo->name)
+		handle_table_remove(&bo->dev->name_table, bo->name);
+
+	if (bo->handle) {
+		struct drm_gem_close req = {
+			.handle = bo->handle,
+		};
+
+		handle_table_remove(&bo->dev->handle_table, bo->handle);
+		drmPrimeCacheHandleClosed(bo->dev->fd, bo->handle);
+		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+	}
+
+	free(bo);
+}
+
+/* lookup a buffer from it's handle, call w/ table_lock held: */
+static struct vc4_bo *lookup_bo(struct handle_table *tbl, uint32_t handle)
+{
+	struct vc4_bo *bo = handle_table_lookup(tbl, handle);
+
+	if (bo) {
+		/* found, incr refcnt and return: */
+		bo = vc4_bo_ref(bo);
+
+		/* don't break the bucket if this bo was found in one */
+		util_bo_cache_remove(&bo->cache_entry);
+	}
+
+	return bo;
+}
+
+/* allocate a new buffer object, call w/ table_lock held */
+static struct vc4_bo *bo_from_handle(struct vc4_device *dev,
+		uint32_t size, uint32_t handle)
+{
+	struct vc4_bo *bo = calloc(sizeof(*bo), 1);
+
+	if (!bo) {
+		struct drm_gem_close req = {
+			.handle = handle,
+		};
+
+		drmPrimeCacheHandleClosed(dev->fd, handle);
+		drmIoctl(dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+
+		return NULL;
+	}
+
+	bo->dev = dev;
+	bo->size = size;
+	bo->handle = handle;
+	atomic_set(&bo->refcnt, 1);
+	util_bo_cache_entry_init(&bo->cache_entry);
+	/* add ourselves to the handle table: */
+	if (handle_table_insert(&dev->handle_table, handle, bo)) {
+		bo_del(bo);
+		return NULL;
+	}
+	/* the caller holds a ref too, so this one never is the first: */
+	vc4_device_ref(dev);
+
+	return bo;
+}
+
+drm_public struct vc4_bo *vc4_bo_new(struct vc4_device *dev, uint32_t size)
+{
+	struct drm_vc4_create_bo req = { 0 };
+	struct vc4_bo *bo;
+
+	bo = vc4_bo_cache_alloc(dev, &size);
+	if (bo)
+		return bo;
+
+	req.size = size;
+	if (drmIoctl(dev->fd, DRM_IOCTL_VC4_CREATE_BO, &req))
+		return NULL;
+
+	pthread_mutex_lock(&dev->table_lock);
+	bo = bo_from_handle(dev, size, req.handle);
+	if (bo)
+		bo->reuse = 1;
+	pthread_mutex_unlock(&dev->table_lock);
+
+	return bo;
+}
+
+drm_public struct vc4_bo *vc4_bo_new_shader(struct vc4_device *dev,
+		const void *code, uint32_t size)
+{
+	struct drm_vc4_create_shader_bo req = {
+		.size = size,
+		.data = VOID2U64(code),
+	};
+	struct vc4_bo *bo;
+
+	if (drmIoctl(dev->fd, DRM_IOCTL_VC4_CREATE_SHADER_BO, &req))
+		return NULL;
+
+	pthread_mutex_lock(&dev->table_lock);
+	bo = bo_from_handle(dev, size, req.handle);
+	pthread_mutex_unlock(&dev->table_lock);
+
+	return bo;
+}
+
+drm_public struct vc4_bo *vc4_bo_ref(struct vc4_bo *bo)
+{
+	atomic_inc(&bo->refcnt);
+
+	return bo;
+}
+
+/* import a buffer object from DRI2 name */
+drm_public struct vc4_bo *vc4_bo_from_name(struct vc4_device *dev,
+		uint32_t name)
+{
+	struct vc4_bo *bo;
+	struct drm_gem_open req = {
+		.name = name,
+	};
+
+	pthread_mutex_lock(&dev->table_lock);
+
+	/* check name table first, to see if bo is already open: */
+	bo = lookup_bo(&dev->name_table, name);
+	if (bo)
+		goto out_unlock;
+
+	if (drmIoctl(dev->fd, DRM_IOCTL_GEM_OPEN, &req)) {
+		ERROR_MSG("gem-open failed: %s", strerror(errno));
+		goto out_unlock;
+	}
+
+	bo = lookup_bo(&dev->handle_table, req.handle);
+	if (bo)
+		goto out_unlock;
+
+	bo = bo_from_handle(dev, req.size, req.handle);
+	if (bo)
+		set_name(bo, name);
+
+out_unlock:
+	pthread_mutex_unlock(&dev->table_lock);
+
+	return bo;
+}
+
+/* import a buffer from dmabuf fd, does not take ownership of the
+ * fd so caller should close() the fd when it is otherwise done
+ * with it (even if it is still using the 'struct vc4_bo *')
+ */
+drm_public struct vc4_bo *vc4_bo_from_dmabuf(struct vc4_device *dev, int fd)
+{
+	struct vc4_bo *bo;
+	uint32_t handle;
+	off_t size;
+
+	/* take the lock before calling drmPrimeFDToHandle to avoid
+	 * racing against vc4_bo_del, which might invalidate the
+	 * returned handle.
+	 */
+	pthread_mutex_lock(&dev->table_lock);
+
+	if (drmPrimeFDToHandleCached(dev->fd, fd, &handle)) {
+		pthread_mutex_unlock(&dev->table_lock);
+		return NULL;
+	}
+
+	bo = lookup_bo(&dev->handle_table, handle);
+	if (bo)
+		goto out_unlock;
+
+	/* lseek() to get bo size */
+	size = lseek(fd, 0, SEEK_END);
+	lseek(fd, 0, SEEK_CUR);
+
+	bo = bo_from_handle(dev, size, handle);
+
+out_unlock:
+	pthread_mutex_unlock(&dev->table_lock);
+
+	return bo;
+}
+
+/* destroy a buffer object */
+drm_public void vc4_bo_del(struct vc4_bo *bo)
+{
+	struct vc4_device *dev;
+
+	if (!bo)
+		return;
+
+	if (!atomic_dec_and_test(&bo->refcnt))
+		return;
+
+	dev = bo->dev;
+	pthread_mutex_lock(&dev->table_lock);
+	if (!bo->reuse || vc4_bo_cache_free(dev, bo))
+		bo_del(bo);
+	pthread_mutex_unlock(&dev->table_lock);
+
+	/* bo's in the bucket cache don't hold a ref to the dev either: */
+	vc4_device_del(dev);
+}
+
+/* get the global flink/DRI2 buffer name */
+drm_public int vc4_bo_get_name(struct vc4_bo *bo, uint32_t *name)
+{
+	if (!bo->name) {
+		struct drm_gem_flink req = {
+			.handle = bo->handle,
+		};
+		int ret;
+
+		ret = drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_FLINK, &req);
+		if (ret)
+			return ret;
+
+		pthread_mutex_lock(&bo->dev->table_lock);
+		set_name(bo, req.name);
+		pthread_mutex_unlock(&bo->dev->table_lock);
+		bo->reuse = 0;
+	}
+
+	*name = bo->name;
+
+	return 0;
+}
+
+drm_public uint32_t vc4_bo_handle(struct vc4_bo *bo)
+{
+	return bo->handle;
+}
+
+/* caller owns the dmabuf fd that is returned and is responsible
+ * to close() it when done
+ */
+drm_public int vc4_bo_dmabuf(struct vc4_bo *bo)
+{
+	int ret, prime_fd;
+
+	ret = drmPrimeHandleToFD(bo->dev->fd, bo->handle, DRM_CLOEXEC,
+				&prime_fd);
+	if (ret) {
+		ERROR_MSG("failed to get dmabuf fd: %d", ret);
+		return ret;
+	}
+
+	bo->reuse = 0;
+
+	return prime_fd;
+}
+
+drm_public uint32_t vc4_bo_size(struct vc4_bo *bo)
+{
+	return bo->size;
+}
+
+drm_public void *vc4_bo_map(struct vc4_bo *bo)
+{
+	if (!bo->map) {
+		struct drm_vc4_mmap_bo req = {
+			.handle = bo->handle,
+		};
+
+		if (drmIoctl(bo->dev->fd, DRM_IOCTL_VC4_MMAP_BO, &req)) {
+			ERROR_MSG("mmap offset failed: %s", strerror(errno));
+			return NULL;
+		}
+
+		bo->map = drm_mmap(0, bo->size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, bo->dev->fd, req.offset);
+		if (bo->map == MAP_FAILED) {
+			ERROR_MSG("mmap failed: %s", strerror(errno));
+			bo->map = NULL;
+		}
+	}
+
+	return bo->map;
+}
+
+/* The jobs of other processes are only known to the kernel, so the shared
+ * bo's are waited on by handle.
+ */
+drm_public int vc4_bo_wait(struct vc4_bo *bo, uint64_t timeout_ns)
+{
+	struct drm_vc4_wait_bo req = {
+		.handle = bo->handle,
+		.timeout_ns = timeout_ns,
+	};
+	uint64_t seqno;
+
+	if (bo->reuse) {
+		pthread_mutex_lock(&bo->dev->table_lock);
+		seqno = bo->seqno;
+		pthread_mutex_unlock(&bo->dev->table_lock);
+
+		return vc4_device_wait_seqno(bo->dev, seqno, timeout_ns);
+	}
+
+	if (drmIoctl(bo->dev->fd, DRM_IOCTL_VC4_WAIT_BO, &req))
+		return -errno;
+
+	return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright © 2014 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "vc4_priv.h"
+
+drm_private void bo_del(struct vc4_bo *bo);
+
+drm_private void vc4_bo_cache_init(struct util_bo_cache *cache)
+{
+	/* The buckets of freedreno: 3 other sizes between each power of
+	 * two, which cover the window sizes accurately enough without the
+	 * waste of power of two buckets.
+	 */
+	util_bo_cache_init(cache, 2, UTIL_BO_CACHE_DEFAULT_MAX_SIZE, 0,
+			   UTIL_BO_CACHE_DEFAULT_MAX_AGE);
+}
+
+/* Frees older cached buffers.  Called under table_lock */
+drm_private void vc4_bo_cache_cleanup(struct util_bo_cache *cache,
+		uint64_t now)
+{
+	struct util_bo_cache_entry *entry;
+
+	while ((entry = util_bo_cache_evict(cache, now)))
+		bo_del(LIST_ENTRY(struct vc4_bo, entry, cache_entry));
+}
+
+/* Frees older cached buffers and the oldest others until level percent of
+ * the cached memory is released.  Called under table_lock */
+static void vc4_bo_cache_trim(struct util_bo_cache *cache, unsigned level)
+{
+	uint64_t bytes = util_bo_cache_trim_bytes(cache, level);
+	uint64_t now = util_bo_cache_now();
+	struct util_bo_cache_entry *entry;
+
+	while ((entry = util_bo_cache_evict_to(cache, now, bytes)))
+		bo_del(LIST_ENTRY(struct vc4_bo, entry, cache_entry));
+}
+
+/* Whether the job of the bo's seqno is done, without an ioctl when a later
+ * one is known to be.  Called under table_lock */
+static int is_idle(struct vc4_bo *bo)
+{
+	struct vc4_device *dev = bo->dev;
+	struct drm_vc4_wait_seqno req = {
+		.seqno = bo->seqno,
+	};
+
+	if (vc4_device_seqno_done_locked(dev, bo->seqno))
+		return 1;
+
+	if (drmIoctl(dev->fd, DRM_IOCTL_VC4_WAIT_SEQNO, &req))
+		return 0;
+
+	dev->finished_seqno = bo->seqno;
+
+	return 1;
+}
+
+/* Returns whether the bo still has its pages */
+static int bo_madvise(struct vc4_bo *bo, uint32_t madv)
+{
+	struct drm_vc4_gem_madvise req = {
+		.handle = bo->handle,
+		.madv = madv,
+	};
+
+	if (!bo->dev->madvise)
+		return 1;
+
+	if (drmIoctl(bo->dev->fd, DRM_IOCTL_VC4_GEM_MADVISE, &req))
+		return 1;
+
+	return req.retained;
+}
+
+static struct vc4_bo *find_in_bucket(struct vc4_device *dev,
+		struct util_bo_cache_bucket *bucket)
+{
+	enum util_bo_cache_miss reason = UTIL_BO_CACHE_MISS_EMPTY;
+	struct vc4_bo *bo = NULL;
+
+	pthread_mutex_lock(&dev->table_lock);
+	if (!LIST_IS_EMPTY(&bucket->list)) {
+		bo = LIST_ENTRY(struct vc4_bo, bucket->list.next,
+				cache_entry.bucket_link);
+		/* if the oldest bo is still busy, the younger ones are too: */
+		if (is_idle(bo)) {
+			util_bo_cache_take(&bo->cache_entry);
+		} else {
+			bo = NULL;
+			reason = UTIL_BO_CACHE_MISS_BUSY;
+		}
+	}
+	if (!bo)
+		util_bo_cache_bucket_miss(&dev->bo_cache, bucket, reason);
+	pthread_mutex_unlock(&dev->table_lock);
+
+	return bo;
+}
+
+/* NOTE: size is potentially rounded up to bucket size: */
+drm_private struct vc4_bo *vc4_bo_cache_alloc(struct vc4_device *dev,
+		uint32_t *size)
+{
+	struct util_bo_cache_bucket *bucket;
+	struct vc4_bo *bo;
+
+	*size = ALIGN(*size, 4096);
+	bucket = util_bo_cache_get_bucket(&dev->bo_cache, *size);
+	if (!bucket)
+		return NULL;
+
+	/* see if we can be green and recycle: */
+	*size = bucket->size;
+	while ((bo = find_in_bucket(dev, bucket))) {
+		if (bo_madvise(bo, VC4_MADV_WILLNEED)) {
+			atomic_set(&bo->refcnt, 1);
+			vc4_device_ref(dev);
+			return bo;
+		}
+
+		/* we've lost the backing pages, delete and try again: */
+		pthread_mutex_lock(&dev->table_lock);
+		bo_del(bo);
+		pthread_mutex_unlock(&dev->table_lock);
+	}
+
+	return NULL;
+}
+
+/* Called under table_lock */
+drm_private int vc4_bo_cache_free(struct vc4_device *dev, struct vc4_bo *bo)
+{
+	struct util_bo_cache *cache = &dev->bo_cache;
+	struct util_bo_cache_bucket *bucket =
+		util_bo_cache_get_bucket(cache, bo->size);
+
+	/* see if we can be green and recycle, unless the buckets changed
+	 * since the bo was allocated: */
+	if (bucket && bucket->size == bo->size) {
+		uint64_t now = util_bo_cache_now();
+
+		bo_madvise(bo, VC4_MADV_DONTNEED);
+		util_bo_cache_add(cache, bucket, &bo->cache_entry, now);
+		vc4_bo_cache_cleanup(cache, now);
+
+		return 0;
+	}
+
+	return -1;
+}
+
+/* Changing the buckets needs an empty cache, so the cached buffers are
+ * dropped, as are the statistics. */
+drm_public void vc4_device_set_bo_cache(struct vc4_device *dev,
+		unsigned bucket_shift, uint64_t max_size, uint64_t max_bytes,
+		uint32_t max_age_ms)
+{
+	pthread_mutex_lock(&dev->table_lock);
+	vc4_bo_cache_cleanup(&dev->bo_cache, UTIL_BO_CACHE_PURGE);
+	util_bo_cache_init(&dev->bo_cache, bucket_shift, max_size, max_bytes,
+			   max_age_ms * 1000000ull);
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+drm_public void vc4_device_get_bo_cache_stats(struct vc4_device *dev,
+		uint64_t *hits, uint64_t *misses, uint64_t *evictions)
+{
+	pthread_mutex_lock(&dev->table_lock);
+	*hits = dev->bo_cache.stats.hits;
+	*misses = dev->bo_cache.stats.misses;
+	*evictions = dev->bo_cache.stats.evictions;
+	pthread_mutex_unlock(&dev->table_lock);
+}
+
+drm_public void vc4_device_trim_bo_cache(struct vc4_device *dev,
+		unsigned level)
+{
+	pthread_mutex_lock(&dev->table_lock);
+	vc4_bo_cache_trim(&dev->bo_cache, level);
+	pthread_mutex_unlock(&dev->table_lock);
+}
@@ -0,0 +1,419 @@
+/*
+ * Copyright © 2014 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Builder of the streams handed to the kernel: the binner control list,
+ * shader records and uniforms.
+ *
+ * The packets of the binner control list are laid out by the structs
+ * below, whose sizes are checked against vc4_packet.h at compile time, and
+ * emitted by the inline vc4_cl_<packet>() functions.  The addresses in
+ * packets are offsets in the bo's named by the GEM_HANDLES packet before
+ * them.  The VC4 is little-endian, as are the hosts it comes with.
+ *
+ * The emitters don't fail: a stream which runs out of memory stops
+ * growing and keeps the error for the flush to report.
+ */
+
+#ifndef VC4_CL_H
+#define VC4_CL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "vc4_packet.h"
+
+struct vc4_cl {
+	uint8_t *base;
+	uint8_t *next;
+	uint8_t *end;
+	/* -ENOMEM once an emit failed: */
+	int error;
+};
+
+/* Grows the stream for size more bytes, returns -ENOMEM on failure. */
+int vc4_cl_grow(struct vc4_cl *cl, uint32_t size);
+
+static inline uint32_t vc4_cl_offset(struct vc4_cl *cl)
+{
+	return cl->next - cl->base;
+}
+
+/* Room for size bytes at the end of the stream, NULL on failure. */
+static inline uint8_t *vc4_cl_reserve(struct vc4_cl *cl, uint32_t size)
+{
+	if ((uint32_t)(cl->end - cl->next) < size && vc4_cl_grow(cl, size))
+		return NULL;
+	return cl->next;
+}
+
+static inline void vc4_cl_emit(struct vc4_cl *cl, const void *data,
+		uint32_t size)
+{
+	uint8_t *p = vc4_cl_reserve(cl, size);
+
+	if (p) {
+		memcpy(p, data, size);
+		cl->next += size;
+	}
+}
+
+static inline void vc4_cl_u8(struct vc4_cl *cl, uint8_t value)
+{
+	vc4_cl_emit(cl, &value, sizeof(value));
+}
+
+static inline void vc4_cl_u16(struct vc4_cl *cl, uint16_t value)
+{
+	vc4_cl_emit(cl, &value, sizeof(value));
+}
+
+static inline void vc4_cl_u32(struct vc4_cl *cl, uint32_t value)
+{
+	vc4_cl_emit(cl, &value, sizeof(value));
+}
+
+static inline void vc4_cl_f(struct vc4_cl *cl, float value)
+{
+	vc4_cl_emit(cl, &value, sizeof(value));
+}
+
+/* packet layouts:
+ */
+
+#define VC4_CL_CHECK_SIZE(name, NAME, size) \
+	typedef char vc4_packet_##name##_size_check[ \
+		(size) == VC4_PACKET_##NAME##_SIZE ? 1 : -1]
+
+#define VC4_CL_PACKET(name, NAME) \
+	VC4_CL_CHECK_SIZE(name, NAME, sizeof(struct vc4_packet_##name))
+
+/* Packets with no fields. */
+#define VC4_CL_PACKET_EMPTY(name, NAME) \
+	VC4_CL_CHECK_SIZE(name, NAME, 1); \
+	static inline void vc4_cl_##name(struct vc4_cl *cl) \
+	{ \
+		vc4_cl_u8(cl, VC4_PACKET_##NAME); \
+	}
+
+VC4_CL_PACKET_EMPTY(halt, HALT)
+VC4_CL_PACKET_EMPTY(nop, NOP)
+VC4_CL_PACKET_EMPTY(flush, FLUSH)
+VC4_CL_PACKET_EMPTY(flush_all, FLUSH_ALL)
+VC4_CL_PACKET_EMPTY(start_tile_binning, START_TILE_BINNING)
+VC4_CL_PACKET_EMPTY(increment_semaphore, INCREMENT_SEMAPHORE)
+
+struct vc4_packet_gem_handles {
+	uint8_t opcode;
+	uint32_t hindex[2];
+} __attribute__((packed));
+VC4_CL_PACKET(gem_handles, GEM_HANDLES);
+
+struct vc4_packet_gl_indexed_primitive {
+	uint8_t opcode;
+	/* primitive mode | VC4_INDEX_BUFFER_U*: */
+	uint8_t mode;
+	uint32_t length;
+	/* in the first bo of the GEM_HANDLES before: */
+	uint32_t offset;
+	uint32_t max_index;
+} __attribute__((packed));
+VC4_CL_PACKET(gl_indexed_primitive, GL_INDEXED_PRIMITIVE);
+
+struct vc4_packet_gl_array_primitive {
+	uint8_t opcode;
+	uint8_t mode;
+	uint32_t length;
+	uint32_t first;
+} __attribute__((packed));
+VC4_CL_PACKET(gl_array_primitive, GL_ARRAY_PRIMITIVE);
+
+struct vc4_packet_primitive_list_format {
+	uint8_t opcode;
+	uint8_t format;
+};
+VC4_CL_PACKET(primitive_list_format, PRIMITIVE_LIST_FORMAT);
+
+struct vc4_packet_shader_state {
+	uint8_t opcode;
+	/* the number of attributes of the shader record, 0 for 8: */
+	uint32_t attributes;
+} __attribute__((packed));
+VC4_CL_CHECK_SIZE(gl_shader_state, GL_SHADER_STATE,
+		sizeof(struct vc4_packet_shader_state));
+VC4_CL_CHECK_SIZE(nv_shader_state, NV_SHADER_STATE,
+		sizeof(struct vc4_packet_shader_state));
+
+struct vc4_packet_configuration_bits {
+	uint8_t opcode;
+	uint8_t bits[3];
+};
+VC4_CL_PACKET(configuration_bits, CONFIGURATION_BITS);
+
+struct vc4_packet_flat_shade_flags {
+	uint8_t opcode;
+	uint32_t flags;
+} __attribute__((packed));
+VC4_CL_PACKET(flat_shade_flags, FLAT_SHADE_FLAGS);
+
+struct vc4_packet_float {
+	uint8_t opcode;
+	float value;
+} __attribute__((packed));
+VC4_CL_CHECK_SIZE(point_size, POINT_SIZE, sizeof(struct vc4_packet_float));
+VC4_CL_CHECK_SIZE(line_width, LINE_WIDTH, sizeof(struct vc4_packet_float));
+
+struct vc4_packet_rht_x_boundary {
+	uint8_t opcode;
+	int16_t boundary;
+} __attribute__((packed));
+VC4_CL_PACKET(rht_x_boundary, RHT_X_BOUNDARY);
+
+struct vc4_packet_depth_offset {
+	uint8_t opcode;
+	uint16_t factor;
+	uint16_t units;
+} __attribute__((packed));
+VC4_CL_PACKET(depth_offset, DEPTH_OFFSET);
+
+struct vc4_packet_clip_window {
+	uint8_t opcode;
+	uint16_t left;
+	uint16_t bottom;
+	uint16_t width;
+	uint16_t height;
+} __attribute__((packed));
+VC4_CL_PACKET(clip_window, CLIP_WINDOW);
+
+struct vc4_packet_viewport_offset {
+	uint8_t opcode;
+	/* 12.4 fixed point: */
+	int16_t x;
+	int16_t y;
+} __attribute__((packed));
+VC4_CL_PACKET(viewport_offset, VIEWPORT_OFFSET);
+
+struct vc4_packet_float_pair {
+	uint8_t opcode;
+	float value[2];
+} __attribute__((packed));
+VC4_CL_CHECK_SIZE(z_clipping, Z_CLIPPING,
+		sizeof(struct vc4_packet_float_pair));
+VC4_CL_CHECK_SIZE(clipper_xy_scaling, CLIPPER_XY_SCALING,
+		sizeof(struct vc4_packet_float_pair));
+VC4_CL_CHECK_SIZE(clipper_z_scaling, CLIPPER_Z_SCALING,
+		sizeof(struct vc4_packet_float_pair));
+
+struct vc4_packet_tile_binning_mode_config {
+	uint8_t opcode;
+	/* filled in by the kernel, which allocates them: */
+	uint32_t tile_alloc_address;
+	uint32_t tile_alloc_size;
+	uint32_t tile_state_address;
+	uint8_t width_in_tiles;
+	uint8_t height_in_tiles;
+	/* VC4_BIN_CONFIG_*: */
+	uint8_t flags;
+} __attribute__((packed));
+VC4_CL_PACKET(tile_binning_mode_config, TILE_BINNING_MODE_CONFIG);
+
+/* packet emitters:
+ */
+
+/* The bo's, by vc4_submit_bo_index(), of the addresses of the next packet. */
+static inline void vc4_cl_gem_handles(struct vc4_cl *cl, uint32_t hindex0,
+		uint32_t hindex1)
+{
+	struct vc4_packet_gem_handles p = {
+		VC4_PACKET_GEM_HANDLES, { hindex0, hindex1 },
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_gl_indexed_primitive(struct vc4_cl *cl,
+		uint8_t mode, uint32_t length, uint32_t offset,
+		uint32_t max_index)
+{
+	struct vc4_packet_gl_indexed_primitive p = {
+		VC4_PACKET_GL_INDEXED_PRIMITIVE, mode, length, offset,
+		max_index,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_gl_array_primitive(struct vc4_cl *cl,
+		uint8_t mode, uint32_t length, uint32_t first)
+{
+	struct vc4_packet_gl_array_primitive p = {
+		VC4_PACKET_GL_ARRAY_PRIMITIVE, mode, length, first,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_primitive_list_format(struct vc4_cl *cl,
+		uint8_t format)
+{
+	struct vc4_packet_primitive_list_format p = {
+		VC4_PACKET_PRIMITIVE_LIST_FORMAT, format,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+/* Uses the next shader record of the job. */
+static inline void vc4_cl_gl_shader_state(struct vc4_cl *cl,
+		uint32_t attributes)
+{
+	struct vc4_packet_shader_state p = {
+		VC4_PACKET_GL_SHADER_STATE, attributes & 0x7,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_nv_shader_state(struct vc4_cl *cl)
+{
+	struct vc4_packet_shader_state p = {
+		VC4_PACKET_NV_SHADER_STATE, 0,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+/* VC4_CONFIG_BITS_* of byte 0 to 2 in bits 0-7, 8-15 and 16-23. */
+static inline void vc4_cl_configuration_bits(struct vc4_cl *cl, uint32_t bits)
+{
+	struct vc4_packet_configuration_bits p = {
+		VC4_PACKET_CONFIGURATION_BITS,
+		{ bits & 0xff, (bits >> 8) & 0xff, (bits >> 16) & 0xff },
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_flat_shade_flags(struct vc4_cl *cl, uint32_t flags)
+{
+	struct vc4_packet_flat_shade_flags p = {
+		VC4_PACKET_FLAT_SHADE_FLAGS, flags,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_point_size(struct vc4_cl *cl, float size)
+{
+	struct vc4_packet_float p = { VC4_PACKET_POINT_SIZE, size };
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_line_width(struct vc4_cl *cl, float width)
+{
+	struct vc4_packet_float p = { VC4_PACKET_LINE_WIDTH, width };
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_rht_x_boundary(struct vc4_cl *cl, int16_t boundary)
+{
+	struct vc4_packet_rht_x_boundary p = {
+		VC4_PACKET_RHT_X_BOUNDARY, boundary,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_depth_offset(struct vc4_cl *cl, uint16_t factor,
+		uint16_t units)
+{
+	struct vc4_packet_depth_offset p = {
+		VC4_PACKET_DEPTH_OFFSET, factor, units,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_clip_window(struct vc4_cl *cl, uint16_t left,
+		uint16_t bottom, uint16_t width, uint16_t height)
+{
+	struct vc4_packet_clip_window p = {
+		VC4_PACKET_CLIP_WINDOW, left, bottom, width, height,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_viewport_offset(struct vc4_cl *cl, int16_t x,
+		int16_t y)
+{
+	struct vc4_packet_viewport_offset p = {
+		VC4_PACKET_VIEWPORT_OFFSET, x, y,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_z_clipping(struct vc4_cl *cl, float min, float max)
+{
+	struct vc4_packet_float_pair p = {
+		VC4_PACKET_Z_CLIPPING, { min, max },
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_clipper_xy_scaling(struct vc4_cl *cl, float x,
+		float y)
+{
+	struct vc4_packet_float_pair p = {
+		VC4_PACKET_CLIPPER_XY_SCALING, { x, y },
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_clipper_z_scaling(struct vc4_cl *cl, float scale,
+		float offset)
+{
+	struct vc4_packet_float_pair p = {
+		VC4_PACKET_CLIPPER_Z_SCALING, { scale, offset },
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+static inline void vc4_cl_tile_binning_mode_config(struct vc4_cl *cl,
+		uint8_t width_in_tiles, uint8_t height_in_tiles, uint8_t flags)
+{
+	struct vc4_packet_tile_binning_mode_config p = {
+		VC4_PACKET_TILE_BINNING_MODE_CONFIG, 0, 0, 0,
+		width_in_tiles, height_in_tiles, flags,
+	};
+
+	vc4_cl_emit(cl, &p, sizeof(p));
+}
+
+#endif /* VC4_CL_H */
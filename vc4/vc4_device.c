@@ -0,0 +1,146 @@
+/*
+ * Copyright © 2014 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "vc4_priv.h"
+
+drm_public struct vc4_device *vc4_device_new(int fd)
+{
+	struct vc4_device *dev = calloc(sizeof(*dev), 1);
+	uint64_t madvise = 0;
+
+	if (!dev)
+		return NULL;
+
+	atomic_set(&dev->refcnt, 1);
+	pthread_mutex_init(&dev->table_lock, NULL);
+	dev->fd = fd;
+	vc4_bo_cache_init(&dev->bo_cache);
+
+	if (!vc4_device_get_param(dev, DRM_VC4_PARAM_SUPPORTS_MADVISE,
+				  &madvise))
+		dev->madvise = madvise != 0;
+
+	return dev;
+}
+
+/* like vc4_device_new() but creates it's own private dup() of the fd
+ * which is close()d when the device is finalized. */
+drm_public struct vc4_device *vc4_device_new_dup(int fd)
+{
+	int dup_fd = dup(fd);
+	struct vc4_device *dev = vc4_device_new(dup_fd);
+
+	if (dev)
+		dev->closefd = 1;
+	else
+		close(dup_fd);
+
+	return dev;
+}
+
+drm_public struct vc4_device *vc4_device_ref(struct vc4_device *dev)
+{
+	atomic_inc(&dev->refcnt);
+
+	return dev;
+}
+
+/* The last ref may be the one of a bo, so it is dropped after releasing
+ * table_lock, which goes away with the device.
+ */
+drm_public void vc4_device_del(struct vc4_device *dev)
+{
+	if (!atomic_dec_and_test(&dev->refcnt))
+		return;
+
+	pthread_mutex_lock(&dev->table_lock);
+	if (util_bo_cache_dump_enabled())
+		util_bo_cache_dump(&dev->bo_cache, "vc4");
+	vc4_bo_cache_cleanup(&dev->bo_cache, UTIL_BO_CACHE_PURGE);
+	handle_table_fini(&dev->handle_table);
+	handle_table_fini(&dev->name_table);
+	pthread_mutex_unlock(&dev->table_lock);
+	pthread_mutex_destroy(&dev->table_lock);
+
+	if (dev->closefd) {
+		/* The fd number may be reused for another device. */
+		drmInvalidateMetadataCache(dev->fd);
+		close(dev->fd);
+	}
+
+	free(dev);
+}
+
+drm_public int vc4_device_fd(struct vc4_device *dev)
+{
+	return dev->fd;
+}
+
+drm_public int vc4_device_get_param(struct vc4_device *dev, uint32_t param,
+		uint64_t *value)
+{
+	struct drm_vc4_get_param req = {
+		.param = param,
+	};
+
+	if (drmIoctl(dev->fd, DRM_IOCTL_VC4_GET_PARAM, &req))
+		return -errno;
+
+	*value = req.value;
+
+	return 0;
+}
+
+/* Called under table_lock */
+drm_private int vc4_device_seqno_done_locked(struct vc4_device *dev,
+		uint64_t seqno)
+{
+	return seqno <= dev->finished_seqno;
+}
+
+drm_public int vc4_device_wait_seqno(struct vc4_device *dev, uint64_t seqno,
+		uint64_t timeout_ns)
+{
+	struct drm_vc4_wait_seqno req = {
+		.seqno = seqno,
+		.timeout_ns = timeout_ns,
+	};
+	int done;
+
+	pthread_mutex_lock(&dev->table_lock);
+	done = vc4_device_seqno_done_locked(dev, seqno);
+	pthread_mutex_unlock(&dev->table_lock);
+	if (done)
+		return 0;
+
+	if (drmIoctl(dev->fd, DRM_IOCTL_VC4_WAIT_SEQNO, &req))
+		return -errno;
+
+	/* the jobs are done in order, so all the earlier ones are too: */
+	pthread_mutex_lock(&dev->table_lock);
+	if (seqno > dev->finished_seqno)
+		dev->finished_seqno = seqno;
+	pthread_mutex_unlock(&dev->table_lock);
+
+	return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2014 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef VC4_DRMIF_H
+#define VC4_DRMIF_H
+
+#include <stdint.h>
+
+#include <xf86drm.h>
+
+#include "vc4_drm.h"
+#include "vc4_cl.h"
+
+struct vc4_device;
+struct vc4_bo;
+
+/* device functions:
+ */
+
+struct vc4_device *vc4_device_new(int fd);
+struct vc4_device *vc4_device_new_dup(int fd);
+struct vc4_device *vc4_device_ref(struct vc4_device *dev);
+void vc4_device_del(struct vc4_device *dev);
+int vc4_device_fd(struct vc4_device *dev);
+/* DRM_VC4_PARAM_*, returns -errno if the kernel does not know it. */
+int vc4_device_get_param(struct vc4_device *dev, uint32_t param,
+		uint64_t *value);
+
+/* Waits for the job of the seqno returned by vc4_submit_flush(), without
+ * an ioctl once a later one is known to be done.  A timeout of 0 only
+ * checks.  Returns 0 when done, -ETIME if not yet done.
+ */
+int vc4_device_wait_seqno(struct vc4_device *dev, uint64_t seqno,
+		uint64_t timeout_ns);
+
+/* Buffers freed to the cache go in 2^bucket_shift buckets per power of two
+ * up to max_size, and stay there for max_age_ms, or until the cache holds
+ * more than max_bytes (0 for no limit).  The cached buffers are dropped.
+ */
+void vc4_device_set_bo_cache(struct vc4_device *dev, unsigned bucket_shift,
+		uint64_t max_size, uint64_t max_bytes, uint32_t max_age_ms);
+void vc4_device_get_bo_cache_stats(struct vc4_device *dev, uint64_t *hits,
+		uint64_t *misses, uint64_t *evictions);
+/* Frees the cached buffers past their age, and the oldest others until
+ * level percent of the cached memory is released, 100 empties the cache.
+ */
+void vc4_device_trim_bo_cache(struct vc4_device *dev, unsigned level);
+
+/* buffer-object functions:
+ */
+
+struct vc4_bo *vc4_bo_new(struct vc4_device *dev, uint32_t size);
+/* Shaders are copied in by the kernel, which validates them, and can't be
+ * mapped.  They don't go through the bo cache.
+ */
+struct vc4_bo *vc4_bo_new_shader(struct vc4_device *dev, const void *code,
+		uint32_t size);
+struct vc4_bo *vc4_bo_from_name(struct vc4_device *dev, uint32_t name);
+struct vc4_bo *vc4_bo_from_dmabuf(struct vc4_device *dev, int fd);
+struct vc4_bo *vc4_bo_ref(struct vc4_bo *bo);
+void vc4_bo_del(struct vc4_bo *bo);
+int vc4_bo_get_name(struct vc4_bo *bo, uint32_t *name);
+uint32_t vc4_bo_handle(struct vc4_bo *bo);
+int vc4_bo_dmabuf(struct vc4_bo *bo);
+uint32_t vc4_bo_size(struct vc4_bo *bo);
+void *vc4_bo_map(struct vc4_bo *bo);
+/* Waits for the jobs using the bo, by its seqno for the bo's not shared
+ * with other processes.  Returns 0 when idle, -ETIME if still busy.
+ */
+int vc4_bo_wait(struct vc4_bo *bo, uint64_t timeout_ns);
+
+/* submit functions:
+ *
+ * A submit is one job of the binner and the renderer.  The draws add up in
+ * its three streams until vc4_submit_flush() hands them to the kernel,
+ * which validates them and generates the render control list from args.
+ * The streams keep their memory from one job to the next.
+ */
+
+struct vc4_submit {
+	/* binner control list, starting with the TILE_BINNING_MODE_CONFIG
+	 * and START_TILE_BINNING packets, and ending with FLUSH: */
+	struct vc4_cl bcl;
+	/* shader records, each preceded by the u32 indices of its bo's: */
+	struct vc4_cl shader_rec;
+	uint32_t shader_rec_count;
+	/* uniforms, each set preceded by the u32 indices of its textures: */
+	struct vc4_cl uniforms;
+
+	/* The render setup, flags and syncobjs of the job.  The bo handle
+	 * indices of the surfaces come from vc4_submit_bo_index(), ~0 for
+	 * none.  The streams, bo handles and seqno are filled in by the
+	 * flush.
+	 */
+	struct drm_vc4_submit_cl args;
+};
+
+struct vc4_submit *vc4_submit_new(struct vc4_device *dev);
+void vc4_submit_del(struct vc4_submit *submit);
+/* Index of the bo in the handles of the job, for the GEM_HANDLES packets,
+ * shader records, uniforms and surfaces.  The submit holds a reference
+ * until the flush.  Returns ~0 when out of memory.
+ */
+uint32_t vc4_submit_bo_index(struct vc4_submit *submit, struct vc4_bo *bo);
+/* Submits the job, if any, returning its seqno for vc4_device_wait_seqno()
+ * and resetting the submit for the next one.  The streams running out of
+ * memory is reported here, as -ENOMEM, and the job dropped.
+ */
+int vc4_submit_flush(struct vc4_submit *submit, uint64_t *seqno);
+/* Drops the job. */
+void vc4_submit_reset(struct vc4_submit *submit);
+
+#endif /* VC4_DRMIF_H */
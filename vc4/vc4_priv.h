@@ -0,0 +1,125 @@
+/*
+ * Copyright © 2014 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef VC4_PRIV_H
+#define VC4_PRIV_H
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include "libdrm_macros.h"
+#include "xf86drm.h"
+#include "xf86atomic.h"
+
+#include "util_bo_cache.h"
+#include "util_double_list.h"
+#include "util_handle_table.h"
+
+#include "vc4_drmif.h"
+
+struct vc4_device {
+	int fd;
+	atomic_t refcnt;
+
+	/* protects the tables, the bo cache, the seqnos and the bo's names: */
+	pthread_mutex_t table_lock;
+
+	/* tables to keep track of bo's, to avoid "evil-twin" vc4_bo objects:
+	 *
+	 *   handle_table: maps handle to vc4_bo
+	 *   name_table: maps flink name to vc4_bo
+	 */
+	struct handle_table handle_table, name_table;
+
+	struct util_bo_cache bo_cache;
+	/* the kernel can drop the pages of the cached bo's: */
+	int madvise;
+
+	/* the last seqno seen done, and the last one submitted: */
+	uint64_t finished_seqno;
+	uint64_t emitted_seqno;
+
+	int closefd;        /* call close(fd) upon destruction */
+};
+
+drm_private void vc4_bo_cache_init(struct util_bo_cache *cache);
+drm_private void vc4_bo_cache_cleanup(struct util_bo_cache *cache,
+		uint64_t now);
+drm_private struct vc4_bo *vc4_bo_cache_alloc(struct vc4_device *dev,
+		uint32_t *size);
+drm_private int vc4_bo_cache_free(struct vc4_device *dev, struct vc4_bo *bo);
+
+/* for where @table_lock is already held: */
+drm_private int vc4_device_seqno_done_locked(struct vc4_device *dev,
+		uint64_t seqno);
+
+/* a GEM buffer object allocated from the DRM device */
+struct vc4_bo {
+	struct vc4_device *dev;
+	void            *map;           /* userspace mmap'ing (if there is one) */
+	uint32_t        size;
+	uint32_t        handle;
+	uint32_t        name;           /* flink global handle (DRI2 name) */
+	atomic_t        refcnt;
+
+	/* seqno of the last job using the bo, under table_lock: */
+	uint64_t        seqno;
+
+	/* index of the bo in the submit it was last added to, only a hint
+	 * checked against the submit's table, see vc4_submit_bo_index(): */
+	uint32_t        submit_idx;
+
+	int reuse;
+	struct util_bo_cache_entry cache_entry;
+};
+
+struct vc4_submit_priv {
+	struct vc4_submit base;
+	struct vc4_device *dev;
+
+	/* should have matching entries in handles: */
+	struct vc4_bo **bos;
+	uint32_t *handles;
+	uint32_t nr_bos, max_bos;
+};
+
+static inline struct vc4_submit_priv *to_vc4_submit_priv(
+		struct vc4_submit *submit)
+{
+	return (struct vc4_submit_priv *)submit;
+}
+
+#define ALIGN(v,a) (((v) + (a) - 1) & ~((a) - 1))
+
+#define ERROR_MSG(fmt, ...) \
+		do { drmMsg("[E] " fmt " (%s:%d)\n", \
+				##__VA_ARGS__, __FUNCTION__, __LINE__); } while (0)
+
+#define VOID2U64(x) ((uint64_t)(unsigned long)(x))
+
+#endif /* VC4_PRIV_H */
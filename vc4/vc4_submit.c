@@ -0,0 +1,207 @@
+/*
+ * Copyright © 2014 Broadcom
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "vc4_priv.h"
+#include "util_grow.h"
+
+/* The streams start at a page, and at least double from there. */
+#define VC4_CL_MIN_SIZE 4096
+
+drm_public int vc4_cl_grow(struct vc4_cl *cl, uint32_t size)
+{
+	uint32_t offset = vc4_cl_offset(cl);
+	uint32_t max = cl->end - cl->base;
+	uint32_t count = offset + size;
+	uint8_t *base;
+
+	if (count < offset) {
+		cl->error = -ENOMEM;
+		return -ENOMEM;
+	}
+
+	base = util_grow_array(cl->base, &max, count < VC4_CL_MIN_SIZE ?
+			       VC4_CL_MIN_SIZE : count, 1);
+	if (!base) {
+		cl->error = -ENOMEM;
+		return -ENOMEM;
+	}
+
+	cl->base = base;
+	cl->next = base + offset;
+	cl->end = base + max;
+
+	return 0;
+}
+
+static void vc4_cl_reset(struct vc4_cl *cl)
+{
+	cl->next = cl->base;
+	cl->error = 0;
+}
+
+static void reset_args(struct drm_vc4_submit_cl *args)
+{
+	memset(args, 0, sizeof(*args));
+	args->color_read.hindex = ~0;
+	args->color_write.hindex = ~0;
+	args->zs_read.hindex = ~0;
+	args->zs_write.hindex = ~0;
+	args->msaa_color_write.hindex = ~0;
+	args->msaa_zs_write.hindex = ~0;
+}
+
+drm_public struct vc4_submit *vc4_submit_new(struct vc4_device *dev)
+{
+	struct vc4_submit_priv *priv = calloc(1, sizeof(*priv));
+
+	if (!priv)
+		return NULL;
+
+	priv->dev = vc4_device_ref(dev);
+	reset_args(&priv->base.args);
+
+	return &priv->base;
+}
+
+drm_public void vc4_submit_reset(struct vc4_submit *submit)
+{
+	struct vc4_submit_priv *priv = to_vc4_submit_priv(submit);
+	uint32_t i;
+
+	vc4_cl_reset(&submit->bcl);
+	vc4_cl_reset(&submit->shader_rec);
+	vc4_cl_reset(&submit->uniforms);
+	submit->shader_rec_count = 0;
+	reset_args(&submit->args);
+
+	for (i = 0; i < priv->nr_bos; i++)
+		vc4_bo_del(priv->bos[i]);
+	priv->nr_bos = 0;
+}
+
+drm_public void vc4_submit_del(struct vc4_submit *submit)
+{
+	struct vc4_submit_priv *priv = to_vc4_submit_priv(submit);
+
+	vc4_submit_reset(submit);
+	free(submit->bcl.base);
+	free(submit->shader_rec.base);
+	free(submit->uniforms.base);
+	free(priv->bos);
+	free(priv->handles);
+	vc4_device_del(priv->dev);
+	free(priv);
+}
+
+/* The index cached in the bo is right unless the bo is in several
+ * submits, which then find it in their table.
+ */
+drm_public uint32_t vc4_submit_bo_index(struct vc4_submit *submit,
+		struct vc4_bo *bo)
+{
+	struct vc4_submit_priv *priv = to_vc4_submit_priv(submit);
+	uint32_t idx = bo->submit_idx, max;
+	struct vc4_bo **bos;
+	uint32_t *handles;
+
+	if (idx < priv->nr_bos && priv->bos[idx] == bo)
+		return idx;
+
+	for (idx = 0; idx < priv->nr_bos; idx++) {
+		if (priv->bos[idx] == bo) {
+			bo->submit_idx = idx;
+			return idx;
+		}
+	}
+
+	max = priv->max_bos;
+	bos = util_grow_array(priv->bos, &max, idx + 1, sizeof(*bos));
+	if (!bos)
+		return ~0;
+	priv->bos = bos;
+	handles = util_grow_array(priv->handles, &priv->max_bos, idx + 1,
+				  sizeof(*handles));
+	if (!handles)
+		return ~0;
+	priv->handles = handles;
+
+	priv->bos[idx] = vc4_bo_ref(bo);
+	priv->handles[idx] = bo->handle;
+	priv->nr_bos++;
+	bo->submit_idx = idx;
+
+	return idx;
+}
+
+drm_public int vc4_submit_flush(struct vc4_submit *submit, uint64_t *seqno)
+{
+	struct vc4_submit_priv *priv = to_vc4_submit_priv(submit);
+	struct vc4_device *dev = priv->dev;
+	struct drm_vc4_submit_cl *args = &submit->args;
+	uint32_t i;
+	int ret = 0;
+
+	if (submit->bcl.error || submit->shader_rec.error ||
+	    submit->uniforms.error) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (submit->bcl.next == submit->bcl.base) {
+		pthread_mutex_lock(&dev->table_lock);
+		if (seqno)
+			*seqno = dev->emitted_seqno;
+		pthread_mutex_unlock(&dev->table_lock);
+		goto out;
+	}
+
+	args->bin_cl = VOID2U64(submit->bcl.base);
+	args->bin_cl_size = vc4_cl_offset(&submit->bcl);
+	args->shader_rec = VOID2U64(submit->shader_rec.base);
+	args->shader_rec_size = vc4_cl_offset(&submit->shader_rec);
+	args->shader_rec_count = submit->shader_rec_count;
+	args->uniforms = VOID2U64(submit->uniforms.base);
+	args->uniforms_size = vc4_cl_offset(&submit->uniforms);
+	args->bo_handles = VOID2U64(priv->handles);
+	args->bo_handle_count = priv->nr_bos;
+
+	if (drmIoctl(dev->fd, DRM_IOCTL_VC4_SUBMIT_CL, args)) {
+		ret = -errno;
+		ERROR_MSG("submit failed: %d (%s)", ret, strerror(errno));
+		goto out;
+	}
+
+	pthread_mutex_lock(&dev->table_lock);
+	for (i = 0; i < priv->nr_bos; i++)
+		priv->bos[i]->seqno = args->seqno;
+	dev->emitted_seqno = args->seqno;
+	pthread_mutex_unlock(&dev->table_lock);
+
+	if (seqno)
+		*seqno = args->seqno;
+
+out:
+	vc4_submit_reset(submit);
+
+	return ret;
+}
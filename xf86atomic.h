@@ -29,6 +29,11 @@
  * @file xf86atomics.h
  *
  * Private definitions for atomic operations
+ *
+ * atomic_inc() is what refcounts take a reference with, so it doesn't order
+ * the accesses around it, and atomic_dec_and_test() only orders them as
+ * dropping the last reference needs.  atomic_mb() is a full barrier for the
+ * callers which need more.
  */
 
 #ifndef LIBDRM_ATOMICS_H
@@ -44,12 +49,13 @@ typedef struct {
 
 # define atomic_read(x) ((x)->atomic)
 # define atomic_set(x, val) ((x)->atomic = (val))
-# define atomic_inc(x) ((void) __sync_fetch_and_add (&(x)->atomic, 1))
+# define atomic_inc(x) ((void) __atomic_fetch_add (&(x)->atomic, 1, __ATOMIC_RELAXED))
 # define atomic_inc_return(x) (__sync_add_and_fetch (&(x)->atomic, 1))
-# define atomic_dec_and_test(x) (__sync_add_and_fetch (&(x)->atomic, -1) == 0)
+# define atomic_dec_and_test(x) (__atomic_sub_fetch (&(x)->atomic, 1, __ATOMIC_ACQ_REL) == 0)
 # define atomic_add(x, v) ((void) __sync_add_and_fetch(&(x)->atomic, (v)))
 # define atomic_dec(x, v) ((void) __sync_sub_and_fetch(&(x)->atomic, (v)))
 # define atomic_cmpxchg(x, oldv, newv) __sync_val_compare_and_swap (&(x)->atomic, oldv, newv)
+# define atomic_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
 
 #endif
 
@@ -65,12 +71,13 @@ typedef struct {
 
 # define atomic_read(x) AO_load_full(&(x)->atomic)
 # define atomic_set(x, val) AO_store_full(&(x)->atomic, (val))
-# define atomic_inc(x) ((void) AO_fetch_and_add1_full(&(x)->atomic))
+# define atomic_inc(x) ((void) AO_fetch_and_add1(&(x)->atomic))
 # define atomic_inc_return(x) (AO_fetch_and_add1_full(&(x)->atomic) + 1)
 # define atomic_add(x, v) ((void) AO_fetch_and_add_full(&(x)->atomic, (v)))
 # define atomic_dec(x, v) ((void) AO_fetch_and_add_full(&(x)->atomic, -(v)))
 # define atomic_dec_and_test(x) (AO_fetch_and_sub1_full(&(x)->atomic) == 1)
 # define atomic_cmpxchg(x, oldv, newv) AO_compare_and_swap_full(&(x)->atomic, oldv, newv)
+# define atomic_mb() AO_nop_full()
 
 #endif
 
@@ -95,6 +102,11 @@ typedef struct { LIBDRM_ATOMIC_TYPE atomic; } atomic_t;
 # define atomic_add(x, v) (atomic_add_int(&(x)->atomic, (v)))
 # define atomic_dec(x, v) (atomic_add_int(&(x)->atomic, -(v)))
 # define atomic_cmpxchg(x, oldv, newv) atomic_cas_uint (&(x)->atomic, oldv, newv)
+#if defined(__NetBSD__)
+# define atomic_mb() membar_sync()
+#else
+# define atomic_mb() membar_enter()
+#endif
 
 #endif
 
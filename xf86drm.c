@@ -62,6 +62,8 @@
 #endif
 #include <math.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
 
 #if defined(__FreeBSD__)
 #include <sys/param.h>
@@ -80,6 +82,7 @@
 #include "drm_fourcc.h"
 
 #include "util_math.h"
+#include "libsync.h"
 
 #ifdef __DragonFly__
 #define DRM_MAJOR 145
@@ -125,6 +128,10 @@ static drmServerInfoPtr drm_server_info;
 
 static bool drmNodeIsDRM(int maj, int min);
 static char *drmGetMinorNameForFD(int fd, int type);
+static int drmGetCandidateMinors(int type, const char *name,
+                                 const char *busid, int minors[]);
+static void drmPrimeCacheDrop(int fd);
+static void drmMapStatsDrop(int fd);
 
 #define DRM_MODIFIER(v, f, f_name) \
        .modifier = DRM_FORMAT_MOD_##v ## _ ##f, \
@@ -537,36 +544,662 @@ drmMsg(const char *format, ...)
 }
 
 static void *drmHashTable = NULL; /* Context switch callbacks */
+static pthread_mutex_t drmHashLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* drmHashEntry is part of the public ABI, so the per-entry lock guarding
+ * the context tag table lives in a private wrapper. */
+typedef struct drmHashEntryPriv {
+    drmHashEntry    base;
+    pthread_mutex_t tagLock;
+} drmHashEntryPriv;
 
 drm_public void *drmGetHashTable(void)
 {
     return drmHashTable;
 }
 
+static drmAllocator drm_allocator; /* All NULL: use calloc()/free() */
+
+/**
+ * Install the allocator behind drmMalloc() and drmFree().
+ *
+ * \param allocator the allocation hooks, or NULL to restore calloc()/free().
+ * Both hooks must be set; \c alloc must return zero-filled memory.
+ *
+ * \return zero on success, or -EINVAL if \p allocator is incomplete.
+ *
+ * \note This must be called before any libdrm object is allocated, and the
+ * allocator must stay usable until every such object has been freed.
+ */
+drm_public int drmSetAllocator(const drmAllocator *allocator)
+{
+    if (!allocator) {
+        memclear(drm_allocator);
+        return 0;
+    }
+
+    if (!allocator->alloc || !allocator->free)
+        return -EINVAL;
+
+    drm_allocator = *allocator;
+    return 0;
+}
+
 drm_public void *drmMalloc(int size)
 {
+    if (drm_allocator.alloc)
+        return drm_allocator.alloc(size, drm_allocator.data);
     return calloc(1, size);
 }
 
 drm_public void drmFree(void *pt)
 {
+    if (drm_allocator.free) {
+        if (pt)
+            drm_allocator.free(pt, drm_allocator.data);
+        return;
+    }
     free(pt);
 }
 
+/*
+ * Optional per-fd, per-request ioctl accounting.
+ *
+ * Collection is off by default and costs a single flag check per ioctl.  It
+ * can be turned on at runtime with drmEnableIoctlStats(), or for the whole
+ * process by setting LIBDRM_IOCTL_STATS in the environment, in which case the
+ * gathered numbers are also dumped to stderr at exit.
+ *
+ * Entries live in a linearly probed table keyed by (fd, request), guarded by
+ * a single mutex that is only ever taken while collection is enabled.
+ */
+#define DRM_IOCTL_STATS_MIN_SIZE 64
+
+static pthread_once_t drm_ioctl_stats_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drm_ioctl_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int drm_ioctl_stats_enabled;
+static drmIoctlStats *drm_ioctl_stats;
+static unsigned int drm_ioctl_stats_size;
+static unsigned int drm_ioctl_stats_count;
+
+static uint64_t drmIoctlStatsTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned int drmIoctlStatsHash(int fd, unsigned long request)
+{
+    uint32_t h = (uint32_t)fd * 0x9e3779b1u ^ (uint32_t)request;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
+
+/* Must be called with drm_ioctl_stats_lock held. */
+static drmIoctlStats *drmIoctlStatsFind(int fd, unsigned long request)
+{
+    unsigned int mask, i;
+
+    if ((drm_ioctl_stats_count + 1) * 4 > drm_ioctl_stats_size * 3) {
+        unsigned int size = drm_ioctl_stats_size ? drm_ioctl_stats_size * 2 :
+                            DRM_IOCTL_STATS_MIN_SIZE;
+        drmIoctlStats *table = calloc(size, sizeof(*table));
+        unsigned int j;
+
+        if (!table)
+            return NULL;
+
+        for (j = 0; j < drm_ioctl_stats_size; j++) {
+            drmIoctlStats *old = &drm_ioctl_stats[j];
+
+            if (!old->count && !old->request)
+                continue;
+            i = drmIoctlStatsHash(old->fd, old->request) & (size - 1);
+            while (table[i].count || table[i].request)
+                i = (i + 1) & (size - 1);
+            table[i] = *old;
+        }
+        free(drm_ioctl_stats);
+        drm_ioctl_stats = table;
+        drm_ioctl_stats_size = size;
+    }
+
+    mask = drm_ioctl_stats_size - 1;
+    i = drmIoctlStatsHash(fd, request) & mask;
+    while (drm_ioctl_stats[i].count || drm_ioctl_stats[i].request) {
+        if (drm_ioctl_stats[i].fd == fd && drm_ioctl_stats[i].request == request)
+            return &drm_ioctl_stats[i];
+        i = (i + 1) & mask;
+    }
+
+    drm_ioctl_stats[i].fd = fd;
+    drm_ioctl_stats[i].request = request;
+    drm_ioctl_stats_count++;
+    return &drm_ioctl_stats[i];
+}
+
+static void drmIoctlStatsRecord(int fd, unsigned long request, int ret,
+                                unsigned int retries, uint64_t ns)
+{
+    drmIoctlStats *stats;
+
+    pthread_mutex_lock(&drm_ioctl_stats_lock);
+    stats = drmIoctlStatsFind(fd, request);
+    if (stats) {
+        stats->count++;
+        stats->retries += retries;
+        if (ret)
+            stats->errors++;
+        stats->total_ns += ns;
+        if (ns > stats->max_ns)
+            stats->max_ns = ns;
+    }
+    pthread_mutex_unlock(&drm_ioctl_stats_lock);
+}
+
+static void drmIoctlStatsDump(void)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&drm_ioctl_stats_lock);
+    fprintf(stderr, "libdrm: ioctl statistics\n");
+    fprintf(stderr, "%4s %10s %4s %10s %8s %8s %12s %12s %12s\n",
+            "fd", "request", "nr", "count", "retries", "errors",
+            "total(us)", "avg(us)", "max(us)");
+    for (i = 0; i < drm_ioctl_stats_size; i++) {
+        drmIoctlStats *stats = &drm_ioctl_stats[i];
+
+        if (!stats->count)
+            continue;
+        fprintf(stderr, "%4d 0x%08lx 0x%02x %10" PRIu64 " %8" PRIu64
+                " %8" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+                stats->fd, stats->request,
+                (unsigned int)DRM_IOCTL_NR(stats->request),
+                stats->count, stats->retries, stats->errors,
+                stats->total_ns / 1000, stats->total_ns / stats->count / 1000,
+                stats->max_ns / 1000);
+    }
+    pthread_mutex_unlock(&drm_ioctl_stats_lock);
+}
+
+/*
+ * Optional recording of every drmIoctl() call into a ring of fixed size
+ * records, in a file mapped shared so that the records survive a crash.
+ *
+ * Writers only take a slot with an atomic increment of the ring head.  The
+ * count of writers in flight lets drmIoctlRecordStop() unmap the ring only
+ * once the last of them is done with it.
+ */
+#define DRM_IOCTL_RECORD_MAX_REQUESTS 32
+
+#if defined(_IOC_SIZE)
+#define DRM_IOCTL_ARG_SIZE(request) _IOC_SIZE(request)
+#elif defined(IOCPARM_LEN)
+#define DRM_IOCTL_ARG_SIZE(request) IOCPARM_LEN(request)
+#else
+#define DRM_IOCTL_ARG_SIZE(request) 0
+#endif
+
+static pthread_mutex_t drm_ioctl_record_lock = PTHREAD_MUTEX_INITIALIZER;
+static int drm_ioctl_record_enabled;
+static unsigned int drm_ioctl_record_writers;
+static drmIoctlRecordHeader *drm_ioctl_record_header;
+static size_t drm_ioctl_record_map_size;
+static uint32_t drm_ioctl_record_payload_size;
+static unsigned long drm_ioctl_record_requests[DRM_IOCTL_RECORD_MAX_REQUESTS];
+static unsigned int drm_ioctl_record_num_requests;
+
+static drmIoctlRecord *drmIoctlRecordBegin(int fd, unsigned long request,
+                                           void *arg, uint64_t *seq)
+{
+    drmIoctlRecordHeader *header;
+    drmIoctlRecord *record;
+    uint32_t payload_size = 0;
+    uint64_t index;
+    unsigned int i;
+
+    __atomic_add_fetch(&drm_ioctl_record_writers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&drm_ioctl_record_enabled, __ATOMIC_SEQ_CST)) {
+        __atomic_sub_fetch(&drm_ioctl_record_writers, 1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    header = drm_ioctl_record_header;
+    index = __atomic_fetch_add(&header->head, 1, __ATOMIC_RELAXED);
+    record = (drmIoctlRecord *)((char *)(header + 1) +
+                                (size_t)(index % header->num_records) *
+                                header->record_size);
+
+    /* Readers skip the record until its sequence number is set. */
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    record->fd = fd;
+    record->request = request;
+    record->arg_size = DRM_IOCTL_ARG_SIZE(request);
+
+    if (arg && drm_ioctl_record_payload_size) {
+        payload_size = drm_ioctl_record_num_requests ? 0 : record->arg_size;
+        for (i = 0; i < drm_ioctl_record_num_requests; i++) {
+            if (drm_ioctl_record_requests[i] == request)
+                payload_size = record->arg_size;
+        }
+        payload_size = MIN2(payload_size, drm_ioctl_record_payload_size);
+        memcpy(record + 1, arg, payload_size);
+    }
+    record->payload_size = payload_size;
+    *seq = index + 1;
+
+    return record;
+}
+
+static void drmIoctlRecordEnd(drmIoctlRecord *record, uint64_t seq,
+                              int result, uint64_t start, uint64_t ns)
+{
+    record->timestamp_ns = start;
+    record->duration_ns = ns;
+    record->result = result;
+    __atomic_store_n(&record->seq, seq, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&drm_ioctl_record_writers, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Start recording every drmIoctl() call to a file.
+ *
+ * The file holds a drmIoctlRecordHeader followed by a ring of
+ * \p num_records records, each a drmIoctlRecord followed by up to
+ * \p payload_size bytes of the ioctl argument, as passed in.  Once the ring
+ * is full the oldest records are overwritten.  tests/ioctlreplay reads it.
+ *
+ * \param path file to create or truncate.
+ * \param num_records capacity of the ring.
+ * \param payload_size bytes of the arguments to record, zero for none.
+ * \param payload_requests ioctl requests to record the arguments of, NULL
+ *        for all of them.
+ * \param num_payload_requests number of entries of \p payload_requests.
+ *
+ * \return zero on success, -EBUSY if a recording runs already, or a
+ * negative errno value.
+ */
+drm_public int drmIoctlRecordStart(const char *path, uint32_t num_records,
+                                   uint32_t payload_size,
+                                   const unsigned long *payload_requests,
+                                   unsigned int num_payload_requests)
+{
+    drmIoctlRecordHeader *header;
+    uint32_t record_size;
+    size_t size;
+    int fd, ret = 0;
+
+    if (!path || !num_records ||
+        num_payload_requests > DRM_IOCTL_RECORD_MAX_REQUESTS ||
+        (num_payload_requests && !payload_requests))
+        return -EINVAL;
+
+    /* Arguments are at most _IOC_SIZEMASK bytes. */
+    payload_size = MIN2(payload_size, 1u << 14);
+    record_size = ALIGN(sizeof(drmIoctlRecord) + payload_size, 8);
+    if (num_records > (SIZE_MAX - sizeof(*header)) / record_size)
+        return -EINVAL;
+    size = sizeof(*header) + (size_t)num_records * record_size;
+
+    pthread_mutex_lock(&drm_ioctl_record_lock);
+    if (drm_ioctl_record_header) {
+        ret = -EBUSY;
+        goto out;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ret = -errno;
+        goto out;
+    }
+    if (ftruncate(fd, size)) {
+        ret = -errno;
+        close(fd);
+        goto out;
+    }
+    header = drm_mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        ret = -errno;
+        goto out;
+    }
+
+    header->magic = DRM_IOCTL_RECORD_MAGIC;
+    header->version = DRM_IOCTL_RECORD_VERSION;
+    header->record_size = record_size;
+    header->num_records = num_records;
+    header->head = 0;
+    header->start_ns = drmIoctlStatsTime();
+
+    drm_ioctl_record_header = header;
+    drm_ioctl_record_map_size = size;
+    drm_ioctl_record_payload_size = payload_size;
+    drm_ioctl_record_num_requests = num_payload_requests;
+    if (num_payload_requests)
+        memcpy(drm_ioctl_record_requests, payload_requests,
+               num_payload_requests * sizeof(*payload_requests));
+    __atomic_store_n(&drm_ioctl_record_enabled, 1, __ATOMIC_SEQ_CST);
+
+out:
+    pthread_mutex_unlock(&drm_ioctl_record_lock);
+    return ret;
+}
+
+/**
+ * Stop the recording started by drmIoctlRecordStart(), and unmap its file
+ * once the ioctls being recorded are done.
+ */
+drm_public void drmIoctlRecordStop(void)
+{
+    pthread_mutex_lock(&drm_ioctl_record_lock);
+    if (drm_ioctl_record_header) {
+        __atomic_store_n(&drm_ioctl_record_enabled, 0, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&drm_ioctl_record_writers, __ATOMIC_SEQ_CST))
+            sched_yield();
+        drm_munmap(drm_ioctl_record_header, drm_ioctl_record_map_size);
+        drm_ioctl_record_header = NULL;
+    }
+    pthread_mutex_unlock(&drm_ioctl_record_lock);
+}
+
+static void drmIoctlStatsInit(void)
+{
+    const char *path, *env;
+
+    if (getenv("LIBDRM_IOCTL_STATS")) {
+        drm_ioctl_stats_enabled = 1;
+        atexit(drmIoctlStatsDump);
+    }
+
+    path = getenv("LIBDRM_IOCTL_RECORD");
+    if (path && *path) {
+        uint32_t num_records = 65536, payload_size = 0;
+
+        if ((env = getenv("LIBDRM_IOCTL_RECORD_ENTRIES")))
+            num_records = strtoul(env, NULL, 0);
+        if ((env = getenv("LIBDRM_IOCTL_RECORD_PAYLOAD")))
+            payload_size = strtoul(env, NULL, 0);
+        if (drmIoctlRecordStart(path, num_records, payload_size, NULL, 0))
+            drmMsg("libdrm: cannot record ioctls to %s\n", path);
+    }
+}
+
+/**
+ * Enable or disable collection of ioctl statistics.
+ *
+ * \param enable non-zero to start accounting every drmIoctl() call, zero to
+ * stop.  Already gathered statistics are kept either way.
+ *
+ * \return the previous state.
+ */
+drm_public int drmEnableIoctlStats(int enable)
+{
+    int old;
+
+    pthread_once(&drm_ioctl_stats_once, drmIoctlStatsInit);
+    old = drm_ioctl_stats_enabled;
+    drm_ioctl_stats_enabled = !!enable;
+    return old;
+}
+
+/**
+ * Retrieve the gathered ioctl statistics.
+ *
+ * \param fd file descriptor to report on, or -1 for all of them.
+ * \param stats array to fill, or NULL to only count the entries.
+ * \param max_stats number of entries available in \p stats.
+ *
+ * \return the number of entries stored in \p stats, or the total number of
+ * matching entries when \p stats is NULL.
+ */
+drm_public int drmGetIoctlStats(int fd, drmIoctlStatsPtr stats, int max_stats)
+{
+    unsigned int i;
+    int n = 0;
+
+    if (stats && max_stats < 0)
+        return -EINVAL;
+
+    pthread_mutex_lock(&drm_ioctl_stats_lock);
+    for (i = 0; i < drm_ioctl_stats_size; i++) {
+        drmIoctlStats *entry = &drm_ioctl_stats[i];
+
+        if (!entry->count || (fd >= 0 && entry->fd != fd))
+            continue;
+        if (stats) {
+            if (n >= max_stats)
+                break;
+            stats[n] = *entry;
+        }
+        n++;
+    }
+    pthread_mutex_unlock(&drm_ioctl_stats_lock);
+
+    return n;
+}
+
+/**
+ * Clear the gathered ioctl statistics.
+ *
+ * \param fd file descriptor to clear, or -1 for all of them.
+ */
+drm_public void drmResetIoctlStats(int fd)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&drm_ioctl_stats_lock);
+    for (i = 0; i < drm_ioctl_stats_size; i++) {
+        drmIoctlStats *entry = &drm_ioctl_stats[i];
+
+        /* Keep the slot occupied so that probe chains stay intact. */
+        if (fd < 0 || entry->fd == fd) {
+            unsigned long request = entry->request;
+            int entry_fd = entry->fd;
+
+            memset(entry, 0, sizeof(*entry));
+            entry->fd = entry_fd;
+            entry->request = request;
+        }
+    }
+    pthread_mutex_unlock(&drm_ioctl_stats_lock);
+}
+
+/*
+ * Markers in the ftrace buffer, in the atrace format that Perfetto and
+ * systrace show as slices of the thread, for lining the submits and buffer
+ * operations of the drivers up with the kernel GPU scheduler events.  They
+ * are written when LIBDRM_TRACE_MARKERS is set in the environment and the
+ * trace_marker file can be opened.
+ */
+static int drm_trace_fd = -1;
+static pthread_once_t drm_trace_once = PTHREAD_ONCE_INIT;
+
+static void drmTraceInit(void)
+{
+    static const char *const paths[] = {
+        "/sys/kernel/tracing/trace_marker",
+        "/sys/kernel/debug/tracing/trace_marker",
+    };
+    unsigned int i;
+
+    if (!getenv("LIBDRM_TRACE_MARKERS"))
+        return;
+
+    for (i = 0; i < ARRAY_SIZE(paths) && drm_trace_fd < 0; i++)
+        drm_trace_fd = open(paths[i], O_WRONLY | O_CLOEXEC);
+    if (drm_trace_fd < 0)
+        drmMsg("libdrm: cannot open trace_marker, no trace markers\n");
+}
+
+/**
+ * Whether the trace markers are on.  The drivers check it once, through
+ * the UTIL_TRACE_* macros of util_trace.h.
+ */
+drm_public int drmTraceEnabled(void)
+{
+    pthread_once(&drm_trace_once, drmTraceInit);
+    return drm_trace_fd >= 0;
+}
+
+static void DRM_PRINTFLIKE(3, 0)
+drmTraceWrite(char type, const char *name, const char *format,
+              va_list args)
+{
+    char buf[256];
+    int ret, len;
+
+    len = snprintf(buf, sizeof(buf), "%c|%d|%s", type, getpid(), name);
+    if (format && *format && len < (int)sizeof(buf) - 1) {
+        buf[len++] = ' ';
+        ret = vsnprintf(buf + len, sizeof(buf) - len, format, args);
+        if (ret > 0)
+            len += ret;
+    }
+    if (len > (int)sizeof(buf) - 1)
+        len = sizeof(buf) - 1;
+
+    /* One write, so that the markers of threads don't interleave. */
+    ret = write(drm_trace_fd, buf, len);
+    (void)ret;
+}
+
+/**
+ * Open a slice on the thread, up to the matching drmTraceEnd().
+ *
+ * \param name name of the slice.
+ * \param format printf() format of the arguments shown after the name, or
+ *        NULL.
+ */
+drm_public void drmTraceBegin(const char *name, const char *format, ...)
+{
+    va_list args;
+
+    if (drm_trace_fd < 0)
+        return;
+
+    va_start(args, format);
+    drmTraceWrite('B', name, format, args);
+    va_end(args);
+}
+
+/**
+ * Close the last slice opened with drmTraceBegin() on the thread.
+ */
+drm_public void drmTraceEnd(void)
+{
+    char buf[32];
+    int ret, len;
+
+    if (drm_trace_fd < 0)
+        return;
+
+    len = snprintf(buf, sizeof(buf), "E|%d", getpid());
+    ret = write(drm_trace_fd, buf, len);
+    (void)ret;
+}
+
+/**
+ * Mark an instant, as an empty slice.
+ */
+drm_public void drmTraceEvent(const char *name, const char *format, ...)
+{
+    va_list args;
+
+    if (drm_trace_fd < 0)
+        return;
+
+    va_start(args, format);
+    drmTraceWrite('B', name, format, args);
+    va_end(args);
+    drmTraceEnd();
+}
+
 /**
  * Call ioctl, restarting if it is interrupted
  */
 drm_public int
 drmIoctl(int fd, unsigned long request, void *arg)
 {
-    int ret;
+    drmIoctlRecord *record = NULL;
+    unsigned int retries = 0;
+    uint64_t start, ns, seq;
+    int ret, err;
 
-    do {
-        ret = ioctl(fd, request, arg);
-    } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+    pthread_once(&drm_ioctl_stats_once, drmIoctlStatsInit);
+    if (!drm_ioctl_stats_enabled &&
+        !__atomic_load_n(&drm_ioctl_record_enabled, __ATOMIC_RELAXED)) {
+        do {
+            ret = ioctl(fd, request, arg);
+        } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+        return ret;
+    }
+
+    if (__atomic_load_n(&drm_ioctl_record_enabled, __ATOMIC_RELAXED))
+        record = drmIoctlRecordBegin(fd, request, arg, &seq);
+
+    start = drmIoctlStatsTime();
+    while ((ret = ioctl(fd, request, arg)) == -1 &&
+           (errno == EINTR || errno == EAGAIN))
+        retries++;
+
+    err = errno;
+    ns = drmIoctlStatsTime() - start;
+    if (drm_ioctl_stats_enabled)
+        drmIoctlStatsRecord(fd, request, ret, retries, ns);
+    if (record)
+        drmIoctlRecordEnd(record, seq, ret ? -err : 0, start, ns);
+    errno = err;
     return ret;
 }
 
+/**
+ * Issue a vector of independent ioctls on the same file descriptor.
+ *
+ * \param fd file descriptor.
+ * \param entries the requests; each entry's \c ret is set to zero or to a
+ *        negative errno value.
+ * \param count number of entries.
+ * \param flags DRM_IOCTL_BATCH_* flags. With DRM_IOCTL_BATCH_STOP_ON_ERROR
+ *        the entries following the first failure are not issued and get
+ *        -ECANCELED.
+ *
+ * \return zero if every request succeeded, otherwise the error of the first
+ * failing request.
+ *
+ * \internal
+ * DRM file descriptors do not implement io_uring passthrough commands, so
+ * the requests are issued one by one with drmIoctl(). This keeps callers
+ * ready for a single-submission backend without any behaviour change.
+ */
+drm_public int drmIoctlBatch(int fd, drmIoctlBatchEntryPtr entries,
+                             unsigned int count, uint32_t flags)
+{
+    int first_error = 0;
+    unsigned int i;
+
+    if (flags & ~DRM_IOCTL_BATCH_STOP_ON_ERROR)
+        return -EINVAL;
+
+    for (i = 0; i < count; i++) {
+        if (first_error && (flags & DRM_IOCTL_BATCH_STOP_ON_ERROR)) {
+            entries[i].ret = -ECANCELED;
+            continue;
+        }
+
+        entries[i].ret = drmIoctl(fd, entries[i].request, entries[i].arg) ?
+                         -errno : 0;
+        if (entries[i].ret && !first_error)
+            first_error = entries[i].ret;
+    }
+
+    return first_error;
+}
+
 static unsigned long drmGetKeyFromFd(int fd)
 {
     stat_t     st;
@@ -578,15 +1211,23 @@ static unsigned long drmGetKeyFromFd(int fd)
 
 drm_public drmHashEntry *drmGetEntry(int fd)
 {
-    unsigned long key = drmGetKeyFromFd(fd);
-    void          *value;
-    drmHashEntry  *entry;
+    unsigned long    key = drmGetKeyFromFd(fd);
+    void             *value;
+    drmHashEntryPriv *priv;
+    drmHashEntry     *entry;
 
+    pthread_mutex_lock(&drmHashLock);
     if (!drmHashTable)
         drmHashTable = drmHashCreate();
 
     if (drmHashLookup(drmHashTable, key, &value)) {
-        entry           = drmMalloc(sizeof(*entry));
+        priv = drmMalloc(sizeof(*priv));
+        if (!priv) {
+            pthread_mutex_unlock(&drmHashLock);
+            return NULL;
+        }
+        pthread_mutex_init(&priv->tagLock, NULL);
+        entry           = &priv->base;
         entry->fd       = fd;
         entry->f        = NULL;
         entry->tagTable = drmHashCreate();
@@ -594,6 +1235,7 @@ drm_public drmHashEntry *drmGetEntry(int fd)
     } else {
         entry = value;
     }
+    pthread_mutex_unlock(&drmHashLock);
     return entry;
 }
 
@@ -956,55 +1598,73 @@ static const char *drmGetMinorName(int type)
  * \return a file descriptor on success, or a negative value on error.
  *
  * \internal
- * This function attempts to open every possible minor (up to DRM_MAX_MINOR),
- * comparing the device bus ID with the one supplied.
+ * This function first opens the minors whose cached bus information matches
+ * \p busid, then every possible minor (up to DRM_MAX_MINOR) if none of them
+ * did, comparing the device bus ID with the one supplied.
  *
  * \sa drmOpenMinor() and drmGetBusid().
  */
-static int drmOpenByBusid(const char *busid, int type)
+static int drmOpenMinorByBusid(int minor, const char *busid, int type)
 {
-    int        i, pci_domain_ok = 1;
+    int        pci_domain_ok = 1;
     int        fd;
     const char *buf;
     drmSetVersion sv;
+
+    fd = drmOpenMinor(minor, 1, type);
+    drmMsg("drmOpenByBusid: drmOpenMinor returns %d\n", fd);
+    if (fd < 0)
+        return -1;
+
+    /* We need to try for 1.4 first for proper PCI domain support
+     * and if that fails, we know the kernel is busted
+     */
+    sv.drm_di_major = 1;
+    sv.drm_di_minor = 4;
+    sv.drm_dd_major = -1;        /* Don't care */
+    sv.drm_dd_minor = -1;        /* Don't care */
+    if (drmSetInterfaceVersion(fd, &sv)) {
+#ifndef __alpha__
+        pci_domain_ok = 0;
+#endif
+        sv.drm_di_major = 1;
+        sv.drm_di_minor = 1;
+        sv.drm_dd_major = -1;       /* Don't care */
+        sv.drm_dd_minor = -1;       /* Don't care */
+        drmMsg("drmOpenByBusid: Interface 1.4 failed, trying 1.1\n");
+        drmSetInterfaceVersion(fd, &sv);
+    }
+    buf = drmGetBusid(fd);
+    drmMsg("drmOpenByBusid: drmGetBusid reports %s\n", buf);
+    if (buf && drmMatchBusID(buf, busid, pci_domain_ok)) {
+        drmFreeBusid(buf);
+        return fd;
+    }
+    if (buf)
+        drmFreeBusid(buf);
+    close(fd);
+    return -1;
+}
+
+static int drmOpenByBusid(const char *busid, int type)
+{
+    int        minors[DRM_MAX_MINOR];
+    int        i, n, fd;
     int        base = drmGetMinorBase(type);
 
     if (base < 0)
         return -1;
 
     drmMsg("drmOpenByBusid: Searching for BusID %s\n", busid);
+    n = drmGetCandidateMinors(type, NULL, busid, minors);
+    for (i = 0; i < n; i++) {
+        if ((fd = drmOpenMinorByBusid(minors[i], busid, type)) >= 0)
+            return fd;
+    }
+
     for (i = base; i < base + DRM_MAX_MINOR; i++) {
-        fd = drmOpenMinor(i, 1, type);
-        drmMsg("drmOpenByBusid: drmOpenMinor returns %d\n", fd);
-        if (fd >= 0) {
-            /* We need to try for 1.4 first for proper PCI domain support
-             * and if that fails, we know the kernel is busted
-             */
-            sv.drm_di_major = 1;
-            sv.drm_di_minor = 4;
-            sv.drm_dd_major = -1;        /* Don't care */
-            sv.drm_dd_minor = -1;        /* Don't care */
-            if (drmSetInterfaceVersion(fd, &sv)) {
-#ifndef __alpha__
-                pci_domain_ok = 0;
-#endif
-                sv.drm_di_major = 1;
-                sv.drm_di_minor = 1;
-                sv.drm_dd_major = -1;       /* Don't care */
-                sv.drm_dd_minor = -1;       /* Don't care */
-                drmMsg("drmOpenByBusid: Interface 1.4 failed, trying 1.1\n");
-                drmSetInterfaceVersion(fd, &sv);
-            }
-            buf = drmGetBusid(fd);
-            drmMsg("drmOpenByBusid: drmGetBusid reports %s\n", buf);
-            if (buf && drmMatchBusID(buf, busid, pci_domain_ok)) {
-                drmFreeBusid(buf);
-                return fd;
-            }
-            if (buf)
-                drmFreeBusid(buf);
-            close(fd);
-        }
+        if ((fd = drmOpenMinorByBusid(i, busid, type)) >= 0)
+            return fd;
     }
     return -1;
 }
@@ -1021,16 +1681,45 @@ static int drmOpenByBusid(const char *busid, int type)
  * \internal
  * This function opens the first minor number that matches the driver name and
  * isn't already in use.  If it's in use it then it will already have a bus ID
- * assigned.
+ * assigned.  The minors whose kernel driver has the name are tried first, so
+ * that the others only have to be opened when none of them did.
  *
  * \sa drmOpenMinor(), drmGetVersion() and drmGetBusid().
  */
-static int drmOpenByName(const char *name, int type)
+static int drmOpenMinorByName(int minor, const char *name, int type)
 {
-    int           i;
     int           fd;
     drmVersionPtr version;
     char *        id;
+
+    if ((fd = drmOpenMinor(minor, 1, type)) < 0)
+        return -1;
+
+    if ((version = drmGetVersion(fd))) {
+        if (!strcmp(version->name, name)) {
+            drmFreeVersion(version);
+            id = drmGetBusid(fd);
+            drmMsg("drmGetBusid returned '%s'\n", id ? id : "NULL");
+            if (!id || !*id) {
+                if (id)
+                    drmFreeBusid(id);
+                return fd;
+            } else {
+                drmFreeBusid(id);
+            }
+        } else {
+            drmFreeVersion(version);
+        }
+    }
+    close(fd);
+    return -1;
+}
+
+static int drmOpenByName(const char *name, int type)
+{
+    int           minors[DRM_MAX_MINOR];
+    int           i, n;
+    int           fd;
     int           base = drmGetMinorBase(type);
 
     if (base < 0)
@@ -1040,26 +1729,15 @@ static int drmOpenByName(const char *name, int type)
      * Open the first minor number that matches the driver name and isn't
      * already in use.  If it's in use it will have a busid assigned already.
      */
+    n = drmGetCandidateMinors(type, name, NULL, minors);
+    for (i = 0; i < n; i++) {
+        if ((fd = drmOpenMinorByName(minors[i], name, type)) >= 0)
+            return fd;
+    }
+
     for (i = base; i < base + DRM_MAX_MINOR; i++) {
-        if ((fd = drmOpenMinor(i, 1, type)) >= 0) {
-            if ((version = drmGetVersion(fd))) {
-                if (!strcmp(version->name, name)) {
-                    drmFreeVersion(version);
-                    id = drmGetBusid(fd);
-                    drmMsg("drmGetBusid returned '%s'\n", id ? id : "NULL");
-                    if (!id || !*id) {
-                        if (id)
-                            drmFreeBusid(id);
-                        return fd;
-                    } else {
-                        drmFreeBusid(id);
-                    }
-                } else {
-                    drmFreeVersion(version);
-                }
-            }
-            close(fd);
-        }
+        if ((fd = drmOpenMinorByName(i, name, type)) >= 0)
+            return fd;
     }
 
 #ifdef __linux__
@@ -1207,6 +1885,22 @@ static void drmFreeKernelVersion(drm_version_t *v)
 }
 
 
+/* strdup() through drmMalloc(), so that the result can go to drmFree(). */
+static char *drmStrdup(const char *str)
+{
+    size_t len;
+    char *dup;
+
+    if (!str)
+        return NULL;
+
+    len = strlen(str) + 1;
+    dup = drmMalloc(len);
+    if (dup)
+        memcpy(dup, str, len);
+    return dup;
+}
+
 /**
  * Copy version information.
  *
@@ -1223,11 +1917,11 @@ static void drmCopyVersion(drmVersionPtr d, const drm_version_t *s)
     d->version_minor      = s->version_minor;
     d->version_patchlevel = s->version_patchlevel;
     d->name_len           = s->name_len;
-    d->name               = strdup(s->name);
+    d->name               = drmStrdup(s->name);
     d->date_len           = s->date_len;
-    d->date               = strdup(s->date);
+    d->date               = drmStrdup(s->date);
     d->desc_len           = s->desc_len;
-    d->desc               = strdup(s->desc);
+    d->desc               = drmStrdup(s->desc);
 }
 
 
@@ -1288,58 +1982,613 @@ drm_public drmVersionPtr drmGetVersion(int fd)
  *
  * \param fd file descriptor.
  *
- * \return version information.
+ * \return version information.
+ *
+ * \internal
+ * This function allocates and fills a drm_version structure with a hard coded
+ * version number.
+ */
+drm_public drmVersionPtr drmGetLibVersion(int fd)
+{
+    drm_version_t *version = drmMalloc(sizeof(*version));
+
+    /* Version history:
+     *   NOTE THIS MUST NOT GO ABOVE VERSION 1.X due to drivers needing it
+     *   revision 1.0.x = original DRM interface with no drmGetLibVersion
+     *                    entry point and many drm<Device> extensions
+     *   revision 1.1.x = added drmCommand entry points for device extensions
+     *                    added drmGetLibVersion to identify libdrm.a version
+     *   revision 1.2.x = added drmSetInterfaceVersion
+     *                    modified drmOpen to handle both busid and name
+     *   revision 1.3.x = added server + memory manager
+     */
+    version->version_major      = 1;
+    version->version_minor      = 3;
+    version->version_patchlevel = 0;
+
+    return (drmVersionPtr)version;
+}
+
+drm_public int drmGetCap(int fd, uint64_t capability, uint64_t *value)
+{
+    struct drm_get_cap cap;
+    int ret;
+
+    memclear(cap);
+    cap.capability = capability;
+
+    ret = drmIoctl(fd, DRM_IOCTL_GET_CAP, &cap);
+    if (ret)
+        return ret;
+
+    *value = cap.value;
+    return 0;
+}
+
+drm_public int drmSetClientCap(int fd, uint64_t capability, uint64_t value)
+{
+    struct drm_set_client_cap cap;
+
+    memclear(cap);
+    cap.capability = capability;
+    cap.value = value;
+
+    return drmIoctl(fd, DRM_IOCTL_SET_CLIENT_CAP, &cap);
+}
+
+/* Per-fd cache of driver metadata that cannot change while the fd is open. */
+#define DRM_METADATA_MAX_CAPS 32
+
+struct drm_metadata_cache {
+    drmVersionPtr version;
+    uint32_t      caps_valid;
+    uint64_t      caps[DRM_METADATA_MAX_CAPS];
+};
+
+static pthread_mutex_t drm_metadata_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *drm_metadata_caches; /* fd -> struct drm_metadata_cache */
+
+static bool drmCapIsImmutable(uint64_t capability)
+{
+    switch (capability) {
+    case DRM_CAP_DUMB_BUFFER:
+    case DRM_CAP_VBLANK_HIGH_CRTC:
+    case DRM_CAP_DUMB_PREFERRED_DEPTH:
+    case DRM_CAP_DUMB_PREFER_SHADOW:
+    case DRM_CAP_PRIME:
+    case DRM_CAP_TIMESTAMP_MONOTONIC:
+    case DRM_CAP_ASYNC_PAGE_FLIP:
+    case DRM_CAP_CURSOR_WIDTH:
+    case DRM_CAP_CURSOR_HEIGHT:
+    case DRM_CAP_ADDFB2_MODIFIERS:
+    case DRM_CAP_PAGE_FLIP_TARGET:
+    case DRM_CAP_CRTC_IN_VBLANK_EVENT:
+    case DRM_CAP_SYNCOBJ:
+    case DRM_CAP_SYNCOBJ_TIMELINE:
+        return capability < DRM_METADATA_MAX_CAPS;
+    default:
+        return false;
+    }
+}
+
+/* Must be called with drm_metadata_lock held. */
+static struct drm_metadata_cache *drmMetadataCacheGet(int fd)
+{
+    struct drm_metadata_cache *cache;
+    void *value;
+
+    if (!drm_metadata_caches) {
+        drm_metadata_caches = drmHashCreate();
+        if (!drm_metadata_caches)
+            return NULL;
+    }
+
+    if (!drmHashLookup(drm_metadata_caches, fd, &value))
+        return value;
+
+    cache = drmMalloc(sizeof(*cache));
+    if (!cache)
+        return NULL;
+
+    if (drmHashInsert(drm_metadata_caches, fd, cache)) {
+        drmFree(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+/**
+ * Query the driver version information through the per-fd metadata cache.
+ *
+ * \param fd file descriptor.
+ *
+ * \return pointer to a drmVersion structure owned by the cache, or NULL on
+ * failure. It must not be freed or modified, and stays valid until
+ * drmInvalidateMetadataCache() or drmClose() is called for \p fd.
+ *
+ * \internal
+ * Only the first call for a given fd issues the DRM_IOCTL_VERSION ioctls.
+ */
+drm_public const drmVersion *drmGetVersionCached(int fd)
+{
+    struct drm_metadata_cache *cache;
+    drmVersionPtr version;
+
+    pthread_mutex_lock(&drm_metadata_lock);
+    cache = drmMetadataCacheGet(fd);
+    version = cache ? cache->version : NULL;
+    pthread_mutex_unlock(&drm_metadata_lock);
+
+    if (version || !cache)
+        return version;
+
+    version = drmGetVersion(fd);
+    if (!version)
+        return NULL;
+
+    pthread_mutex_lock(&drm_metadata_lock);
+    cache = drmMetadataCacheGet(fd);
+    if (cache && !cache->version) {
+        cache->version = version;
+    } else {
+        drmFreeVersion(version);
+        version = cache ? cache->version : NULL;
+    }
+    pthread_mutex_unlock(&drm_metadata_lock);
+
+    return version;
+}
+
+/**
+ * Query a driver capability through the per-fd metadata cache.
+ *
+ * Capabilities which are fixed for the lifetime of the device, such as
+ * DRM_CAP_PRIME or DRM_CAP_TIMESTAMP_MONOTONIC, are only queried from the
+ * kernel once per fd; any other capability is passed through to drmGetCap().
+ *
+ * \param fd file descriptor.
+ * \param capability the DRM_CAP_* to query.
+ * \param value returns the capability value.
+ *
+ * \return zero on success, or the drmGetCap() error on failure.
+ */
+drm_public int drmGetCapCached(int fd, uint64_t capability, uint64_t *value)
+{
+    struct drm_metadata_cache *cache;
+    uint64_t val;
+    int ret;
+
+    if (!drmCapIsImmutable(capability))
+        return drmGetCap(fd, capability, value);
+
+    pthread_mutex_lock(&drm_metadata_lock);
+    cache = drmMetadataCacheGet(fd);
+    if (cache && (cache->caps_valid & (1u << capability))) {
+        *value = cache->caps[capability];
+        pthread_mutex_unlock(&drm_metadata_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&drm_metadata_lock);
+
+    ret = drmGetCap(fd, capability, &val);
+    if (ret)
+        return ret;
+
+    pthread_mutex_lock(&drm_metadata_lock);
+    cache = drmMetadataCacheGet(fd);
+    if (cache) {
+        cache->caps[capability] = val;
+        cache->caps_valid |= 1u << capability;
+    }
+    pthread_mutex_unlock(&drm_metadata_lock);
+
+    *value = val;
+    return 0;
+}
+
+/**
+ * Drop the cached metadata of a file descriptor.
+ *
+ * Must be called before the fd number is reused for another device when the
+ * fd was not closed through drmClose(). Pointers previously returned by
+ * drmGetVersionCached() for \p fd become invalid.
+ *
+ * \param fd file descriptor.
+ */
+drm_public void drmInvalidateMetadataCache(int fd)
+{
+    struct drm_metadata_cache *cache = NULL;
+    void *value;
+
+    pthread_mutex_lock(&drm_metadata_lock);
+    if (drm_metadata_caches && !drmHashLookup(drm_metadata_caches, fd, &value)) {
+        drmHashDelete(drm_metadata_caches, fd);
+        cache = value;
+    }
+    pthread_mutex_unlock(&drm_metadata_lock);
+
+    if (cache) {
+        drmFreeVersion(cache->version);
+        drmFree(cache);
+    }
+
+    drmPrimeCacheDrop(fd);
+    drmMapStatsDrop(fd);
+}
+
+/*
+ * Accounting of the mappings made through drm_mmap(), or reported with
+ * drmMapTrack() when the kernel creates them, per fd, per driver and for the
+ * process.  Mappings are found by address on drmMapUntrack(), and hold the
+ * stats of their fd and driver so that they can go after the fd.
+ */
+struct drm_map_owner {
+    drmMapStats stats;
+    struct drm_map_owner *next; /* drivers only */
+    char name[32];              /* drivers only */
+    bool detached;              /* fds only, freed with their last mapping */
+};
+
+struct drm_map_entry {
+    size_t size;
+    struct drm_map_owner *fd;
+    struct drm_map_owner *driver;
+};
+
+struct drm_map_threshold {
+    uint64_t bytes;
+    uint64_t count;
+    drmMapThresholdFunc func;
+    void *data;
+    bool crossed;
+    bool pending;
+    struct drm_map_threshold *next;
+};
+
+static pthread_mutex_t drm_map_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Held while calling the threshold callbacks. */
+static pthread_mutex_t drm_map_callback_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *drm_map_entries; /* address -> struct drm_map_entry */
+static void *drm_map_fds;     /* fd -> struct drm_map_owner */
+static struct drm_map_owner *drm_map_drivers;
+static drmMapStats drm_map_total;
+static struct drm_map_threshold *drm_map_thresholds;
+static bool drm_map_pending;
+
+static void drmMapStatsAdd(drmMapStats *stats, int64_t bytes, int64_t count)
+{
+    stats->bytes += bytes;
+    stats->count += count;
+    if (stats->bytes > stats->peak_bytes)
+        stats->peak_bytes = stats->bytes;
+    if (stats->count > stats->peak_count)
+        stats->peak_count = stats->count;
+}
+
+/* Must be called with drm_map_lock held. */
+static struct drm_map_owner *drmMapDriverGet(const char *name)
+{
+    struct drm_map_owner *driver;
+
+    for (driver = drm_map_drivers; driver; driver = driver->next) {
+        if (!strcmp(driver->name, name))
+            return driver;
+    }
+
+    driver = drmMalloc(sizeof(*driver));
+    if (!driver)
+        return NULL;
+    snprintf(driver->name, sizeof(driver->name), "%s", name);
+    driver->next = drm_map_drivers;
+    drm_map_drivers = driver;
+    return driver;
+}
+
+/* Must be called with drm_map_lock held. */
+static void drmMapThresholdsCheck(void)
+{
+    struct drm_map_threshold *threshold;
+    bool crossed;
+
+    for (threshold = drm_map_thresholds; threshold;
+         threshold = threshold->next) {
+        crossed = (threshold->bytes &&
+                   drm_map_total.bytes >= threshold->bytes) ||
+                  (threshold->count &&
+                   drm_map_total.count >= threshold->count);
+        if (crossed && !threshold->crossed) {
+            threshold->pending = true;
+            drm_map_pending = true;
+        }
+        threshold->crossed = crossed;
+    }
+}
+
+/* Calls the callbacks of the thresholds crossed, unless another thread, or
+ * this one further up, is already calling them and will pick them up. */
+static void drmMapThresholdsFire(void)
+{
+    struct drm_map_threshold *threshold;
+    drmMapThresholdFunc func;
+    uint64_t bytes, count;
+    void *data;
+
+    if (!__atomic_load_n(&drm_map_pending, __ATOMIC_RELAXED) ||
+        pthread_mutex_trylock(&drm_map_callback_lock))
+        return;
+
+    for (;;) {
+        pthread_mutex_lock(&drm_map_lock);
+        for (threshold = drm_map_thresholds; threshold;
+             threshold = threshold->next) {
+            if (threshold->pending)
+                break;
+        }
+        if (!threshold) {
+            drm_map_pending = false;
+            pthread_mutex_unlock(&drm_map_lock);
+            break;
+        }
+        threshold->pending = false;
+        func = threshold->func;
+        data = threshold->data;
+        bytes = drm_map_total.bytes;
+        count = drm_map_total.count;
+        pthread_mutex_unlock(&drm_map_lock);
+
+        func(bytes, count, data);
+    }
+
+    pthread_mutex_unlock(&drm_map_callback_lock);
+}
+
+/**
+ * Account a mapping of a device.
+ *
+ * drm_mmap() calls it for the mappings it makes.  Drivers call it for the
+ * mappings the kernel creates, such as those of DRM_IOCTL_I915_GEM_MMAP.
+ *
+ * \param fd file descriptor the mapping is of, or -1.
+ * \param addr address of the mapping.
+ * \param size size of the mapping.
+ */
+drm_public void drmMapTrack(int fd, void *addr, size_t size)
+{
+    const drmVersion *version = NULL;
+    struct drm_map_entry *entry;
+    struct drm_map_owner *owner = NULL;
+    void *value;
+
+    if (!addr || addr == MAP_FAILED)
+        return;
+
+    pthread_mutex_lock(&drm_map_lock);
+    if (fd >= 0 && drm_map_fds && !drmHashLookup(drm_map_fds, fd, &value))
+        owner = value;
+    pthread_mutex_unlock(&drm_map_lock);
+
+    /* First mapping of the fd, find its driver outside of the lock. */
+    if (fd >= 0 && !owner)
+        version = drmGetVersionCached(fd);
+
+    entry = drmMalloc(sizeof(*entry));
+    if (!entry)
+        return;
+    entry->size = size;
+
+    pthread_mutex_lock(&drm_map_lock);
+    if (!drm_map_entries)
+        drm_map_entries = drmHashCreate();
+    if (fd >= 0 && !drm_map_fds)
+        drm_map_fds = drmHashCreate();
+    if (!drm_map_entries || (fd >= 0 && !drm_map_fds))
+        goto fail;
+
+    if (fd >= 0 && drmHashLookup(drm_map_fds, fd, &value)) {
+        owner = drmMalloc(sizeof(*owner));
+        if (!owner)
+            goto fail;
+        owner->next = drmMapDriverGet(version && version->name ?
+                                      version->name : "unknown");
+        if (!owner->next || drmHashInsert(drm_map_fds, fd, owner)) {
+            drmFree(owner);
+            goto fail;
+        }
+        value = owner;
+    }
+    entry->fd = fd >= 0 ? value : NULL;
+    /* The driver of an fd is kept in its next pointer. */
+    entry->driver = entry->fd ? entry->fd->next : drmMapDriverGet("unknown");
+
+    if (!entry->driver || drmHashInsert(drm_map_entries, (unsigned long)addr,
+                                        entry))
+        goto fail;
+
+    if (entry->fd)
+        drmMapStatsAdd(&entry->fd->stats, size, 1);
+    drmMapStatsAdd(&entry->driver->stats, size, 1);
+    drmMapStatsAdd(&drm_map_total, size, 1);
+    drmMapThresholdsCheck();
+    pthread_mutex_unlock(&drm_map_lock);
+
+    drmMapThresholdsFire();
+    return;
+
+fail:
+    pthread_mutex_unlock(&drm_map_lock);
+    drmFree(entry);
+}
+
+/**
+ * Stop accounting a mapping, drm_munmap() calls it.  Addresses which are
+ * not accounted are ignored.
+ *
+ * \param addr address of the mapping.
+ */
+drm_public void drmMapUntrack(void *addr)
+{
+    struct drm_map_entry *entry = NULL;
+    struct drm_map_owner *fd = NULL;
+    void *value;
+
+    pthread_mutex_lock(&drm_map_lock);
+    if (drm_map_entries &&
+        !drmHashLookup(drm_map_entries, (unsigned long)addr, &value)) {
+        entry = value;
+        drmHashDelete(drm_map_entries, (unsigned long)addr);
+
+        if (entry->fd) {
+            drmMapStatsAdd(&entry->fd->stats, -(int64_t)entry->size, -1);
+            if (entry->fd->detached && !entry->fd->stats.count)
+                fd = entry->fd;
+        }
+        drmMapStatsAdd(&entry->driver->stats, -(int64_t)entry->size, -1);
+        drmMapStatsAdd(&drm_map_total, -(int64_t)entry->size, -1);
+        drmMapThresholdsCheck();
+    }
+    pthread_mutex_unlock(&drm_map_lock);
+
+    drmFree(fd);
+    drmFree(entry);
+}
+
+/* Forgets the stats of an fd about to be closed, on
+ * drmInvalidateMetadataCache(). */
+static void drmMapStatsDrop(int fd)
+{
+    struct drm_map_owner *owner = NULL;
+    void *value;
+
+    pthread_mutex_lock(&drm_map_lock);
+    if (drm_map_fds && !drmHashLookup(drm_map_fds, fd, &value)) {
+        drmHashDelete(drm_map_fds, fd);
+        owner = value;
+        owner->detached = true;
+        if (owner->stats.count)
+            owner = NULL;
+    }
+    pthread_mutex_unlock(&drm_map_lock);
+
+    drmFree(owner);
+}
+
+/**
+ * Get the accounting of the mappings of an fd, or of the process.
+ *
+ * \param fd file descriptor, or -1 for all the mappings.
+ * \param stats returns the bytes and count of mappings alive and their peak
+ *        values.
+ *
+ * \return zero on success, -ENOENT if \p fd never had any mapping.
+ */
+drm_public int drmGetMapStats(int fd, drmMapStatsPtr stats)
+{
+    void *value;
+    int ret = 0;
+
+    pthread_mutex_lock(&drm_map_lock);
+    if (fd < 0)
+        *stats = drm_map_total;
+    else if (drm_map_fds && !drmHashLookup(drm_map_fds, fd, &value))
+        *stats = ((struct drm_map_owner *)value)->stats;
+    else
+        ret = -ENOENT;
+    pthread_mutex_unlock(&drm_map_lock);
+
+    return ret;
+}
+
+/**
+ * Get the accounting of the mappings of the devices of a driver.
+ *
+ * \param driver driver name, as in drmVersion, or "unknown" for the
+ *        mappings which are not of a DRM device.
+ * \param stats returns the bytes and count of mappings alive and their peak
+ *        values.
  *
- * \internal
- * This function allocates and fills a drm_version structure with a hard coded
- * version number.
+ * \return zero on success, -ENOENT if the driver never had any mapping.
  */
-drm_public drmVersionPtr drmGetLibVersion(int fd)
+drm_public int drmGetDriverMapStats(const char *driver, drmMapStatsPtr stats)
 {
-    drm_version_t *version = drmMalloc(sizeof(*version));
+    struct drm_map_owner *owner;
+    int ret = -ENOENT;
 
-    /* Version history:
-     *   NOTE THIS MUST NOT GO ABOVE VERSION 1.X due to drivers needing it
-     *   revision 1.0.x = original DRM interface with no drmGetLibVersion
-     *                    entry point and many drm<Device> extensions
-     *   revision 1.1.x = added drmCommand entry points for device extensions
-     *                    added drmGetLibVersion to identify libdrm.a version
-     *   revision 1.2.x = added drmSetInterfaceVersion
-     *                    modified drmOpen to handle both busid and name
-     *   revision 1.3.x = added server + memory manager
-     */
-    version->version_major      = 1;
-    version->version_minor      = 3;
-    version->version_patchlevel = 0;
+    pthread_mutex_lock(&drm_map_lock);
+    for (owner = drm_map_drivers; owner; owner = owner->next) {
+        if (!strcmp(owner->name, driver)) {
+            *stats = owner->stats;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&drm_map_lock);
 
-    return (drmVersionPtr)version;
+    return ret;
 }
 
-drm_public int drmGetCap(int fd, uint64_t capability, uint64_t *value)
+/**
+ * Call back when the mappings of the process reach a number of bytes or of
+ * mappings, for the caches of mappings to release some.
+ *
+ * The callback runs once each time the mappings grow past a threshold, on
+ * the thread which made the mapping, possibly with locks of the driver held:
+ * it must not block on them, but may unmap.
+ *
+ * \param bytes threshold on the bytes mapped, zero for none.
+ * \param count threshold on the number of mappings, zero for none.
+ * \param func callback, given the bytes and number of mappings alive.
+ * \param data passed to \p func.
+ *
+ * \return zero on success, or a negative errno value.
+ */
+drm_public int drmAddMapThreshold(uint64_t bytes, uint64_t count,
+                                  drmMapThresholdFunc func, void *data)
 {
-    struct drm_get_cap cap;
-    int ret;
-
-    memclear(cap);
-    cap.capability = capability;
+    struct drm_map_threshold *threshold;
 
-    ret = drmIoctl(fd, DRM_IOCTL_GET_CAP, &cap);
-    if (ret)
-        return ret;
+    if (!func || (!bytes && !count))
+        return -EINVAL;
 
-    *value = cap.value;
+    threshold = drmMalloc(sizeof(*threshold));
+    if (!threshold)
+        return -ENOMEM;
+    threshold->bytes = bytes;
+    threshold->count = count;
+    threshold->func = func;
+    threshold->data = data;
+
+    pthread_mutex_lock(&drm_map_lock);
+    threshold->next = drm_map_thresholds;
+    drm_map_thresholds = threshold;
+    drmMapThresholdsCheck();
+    pthread_mutex_unlock(&drm_map_lock);
+
+    drmMapThresholdsFire();
     return 0;
 }
 
-drm_public int drmSetClientCap(int fd, uint64_t capability, uint64_t value)
+/**
+ * Remove a threshold added with drmAddMapThreshold(), once its callback is
+ * done running.  Must not be called from a threshold callback.
+ */
+drm_public void drmRemoveMapThreshold(drmMapThresholdFunc func, void *data)
 {
-    struct drm_set_client_cap cap;
+    struct drm_map_threshold **link, *threshold = NULL;
 
-    memclear(cap);
-    cap.capability = capability;
-    cap.value = value;
+    pthread_mutex_lock(&drm_map_callback_lock);
+    pthread_mutex_lock(&drm_map_lock);
+    for (link = &drm_map_thresholds; *link; link = &(*link)->next) {
+        if ((*link)->func == func && (*link)->data == data) {
+            threshold = *link;
+            *link = threshold->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&drm_map_lock);
+    pthread_mutex_unlock(&drm_map_callback_lock);
 
-    return drmIoctl(fd, DRM_IOCTL_SET_CLIENT_CAP, &cap);
+    drmFree(threshold);
 }
 
 /**
@@ -1622,16 +2871,27 @@ drm_public int drmFreeBufs(int fd, int count, int *list)
  */
 drm_public int drmClose(int fd)
 {
-    unsigned long key    = drmGetKeyFromFd(fd);
-    drmHashEntry  *entry = drmGetEntry(fd);
+    unsigned long    key = drmGetKeyFromFd(fd);
+    drmHashEntryPriv *priv = NULL;
+    void             *value;
 
-    drmHashDestroy(entry->tagTable);
-    entry->fd       = 0;
-    entry->f        = NULL;
-    entry->tagTable = NULL;
+    pthread_mutex_lock(&drmHashLock);
+    if (drmHashTable && !drmHashLookup(drmHashTable, key, &value)) {
+        drmHashDelete(drmHashTable, key);
+        priv = value;
+    }
+    pthread_mutex_unlock(&drmHashLock);
+
+    if (priv) {
+        drmHashDestroy(priv->base.tagTable);
+        priv->base.fd       = 0;
+        priv->base.f        = NULL;
+        priv->base.tagTable = NULL;
+        pthread_mutex_destroy(&priv->tagLock);
+        drmFree(priv);
+    }
 
-    drmHashDelete(drmHashTable, key);
-    drmFree(entry);
+    drmInvalidateMetadataCache(fd);
 
     return close(fd);
 }
@@ -2127,6 +3387,247 @@ drm_public int drmCrtcQueueSequence(int fd, uint32_t crtcId, uint32_t flags,
     return ret;
 }
 
+/*
+ * Vblank timing prediction.
+ *
+ * The predictor fits a line through the last DRM_VBLANK_HISTORY (sequence,
+ * timestamp) pairs, which tolerates missed vblanks and timestamp jitter.
+ * If the samples stray from the fit by more than 1/8th of a period the
+ * refresh rate is considered variable (VRR), in which case predictions
+ * give the earliest possible times, based on the shortest interval seen.
+ */
+#define DRM_VBLANK_HISTORY 32
+
+struct _drmVblankPredictor {
+    uint64_t     seq[DRM_VBLANK_HISTORY];
+    uint64_t     ns[DRM_VBLANK_HISTORY];
+    unsigned int count;
+    unsigned int next;
+
+    /* Fit: ns = base_ns + period * (seq - base_seq) */
+    uint64_t     base_seq;
+    double       base_ns;
+    double       period;
+    double       min_period;
+    int          variable;
+};
+
+drm_public drmVblankPredictorPtr drmVblankPredictorCreate(void)
+{
+    return calloc(1, sizeof(struct _drmVblankPredictor));
+}
+
+drm_public void drmVblankPredictorDestroy(drmVblankPredictorPtr pred)
+{
+    free(pred);
+}
+
+drm_public void drmVblankPredictorReset(drmVblankPredictorPtr pred)
+{
+    memset(pred, 0, sizeof(*pred));
+}
+
+static void drmVblankPredictorFit(drmVblankPredictorPtr pred)
+{
+    unsigned int first = (pred->next + DRM_VBLANK_HISTORY - pred->count) %
+                         DRM_VBLANK_HISTORY;
+    uint64_t seq0 = pred->seq[first], ns0 = pred->ns[first];
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, n = pred->count;
+    double slope, intercept, max_err = 0, min_period = 0;
+    unsigned int i, k;
+
+    for (k = 0; k < pred->count; k++) {
+        double x, y;
+
+        i = (first + k) % DRM_VBLANK_HISTORY;
+        x = (double)(pred->seq[i] - seq0);
+        y = (double)(pred->ns[i] - ns0);
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+
+        if (k) {
+            unsigned int p = (i + DRM_VBLANK_HISTORY - 1) % DRM_VBLANK_HISTORY;
+            double interval = (double)(pred->ns[i] - pred->ns[p]) /
+                              (double)(pred->seq[i] - pred->seq[p]);
+
+            if (!min_period || interval < min_period)
+                min_period = interval;
+        }
+    }
+
+    slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    intercept = (sy - slope * sx) / n;
+
+    for (k = 0; k < pred->count; k++) {
+        double err;
+
+        i = (first + k) % DRM_VBLANK_HISTORY;
+        err = (double)(pred->ns[i] - ns0) -
+              (intercept + slope * (double)(pred->seq[i] - seq0));
+        if (fabs(err) > max_err)
+            max_err = fabs(err);
+    }
+
+    pred->base_seq = seq0;
+    pred->base_ns = (double)ns0 + intercept;
+    pred->period = slope;
+    pred->min_period = min_period;
+    pred->variable = pred->count >= 4 && max_err > slope / 8;
+}
+
+/**
+ * Record a vblank, e.g. from the page flip or sequence event handlers.
+ *
+ * \param pred predictor of the CRTC.
+ * \param sequence vblank sequence number.
+ * \param ns CLOCK_MONOTONIC timestamp of the vblank in nanoseconds.
+ *
+ * Samples which don't move forward in both sequence and time are ignored.
+ */
+drm_public void drmVblankPredictorAddSample(drmVblankPredictorPtr pred,
+                                            uint64_t sequence, uint64_t ns)
+{
+    if (pred->count) {
+        unsigned int last = (pred->next + DRM_VBLANK_HISTORY - 1) %
+                            DRM_VBLANK_HISTORY;
+
+        if (sequence <= pred->seq[last] || ns <= pred->ns[last])
+            return;
+    }
+
+    pred->seq[pred->next] = sequence;
+    pred->ns[pred->next] = ns;
+    pred->next = (pred->next + 1) % DRM_VBLANK_HISTORY;
+    if (pred->count < DRM_VBLANK_HISTORY)
+        pred->count++;
+
+    if (pred->count >= 2)
+        drmVblankPredictorFit(pred);
+}
+
+static uint64_t drmVblankPredictorLastSeq(drmVblankPredictorPtr pred)
+{
+    return pred->seq[(pred->next + DRM_VBLANK_HISTORY - 1) % DRM_VBLANK_HISTORY];
+}
+
+static double drmVblankPredictorTime(drmVblankPredictorPtr pred,
+                                     uint64_t sequence)
+{
+    uint64_t last_seq = drmVblankPredictorLastSeq(pred);
+
+    if (pred->variable) {
+        uint64_t last_ns = pred->ns[(pred->next + DRM_VBLANK_HISTORY - 1) %
+                                    DRM_VBLANK_HISTORY];
+
+        return (double)last_ns + pred->min_period * (double)(sequence - last_seq);
+    }
+
+    return pred->base_ns + pred->period * (double)(sequence - pred->base_seq);
+}
+
+/**
+ * Predict the timestamps of the vblanks following the last recorded one.
+ *
+ * \param pred predictor of the CRTC.
+ * \param sequences optional array receiving the predicted sequence numbers.
+ * \param ns array receiving the predicted CLOCK_MONOTONIC times.
+ * \param count number of vblanks to predict.
+ *
+ * \return the number of predictions, -EAGAIN if fewer than two vblanks were
+ * recorded so far. A positive \p variable result of
+ * drmVblankPredictorGetPeriod() means these are the earliest possible times.
+ */
+drm_public int drmVblankPredictorPredict(drmVblankPredictorPtr pred,
+                                         uint64_t *sequences, uint64_t *ns,
+                                         int count)
+{
+    uint64_t last_seq;
+    int i;
+
+    if (pred->count < 2)
+        return -EAGAIN;
+
+    last_seq = drmVblankPredictorLastSeq(pred);
+    for (i = 0; i < count; i++) {
+        if (sequences)
+            sequences[i] = last_seq + i + 1;
+        ns[i] = (uint64_t)drmVblankPredictorTime(pred, last_seq + i + 1);
+    }
+    return count;
+}
+
+/**
+ * Get the estimated refresh period.
+ *
+ * \param pred predictor of the CRTC.
+ * \param period_ns returns the average vblank period in nanoseconds.
+ * \param variable optionally returns whether the refresh rate looks variable.
+ *
+ * \return zero on success, -EAGAIN without enough samples.
+ */
+drm_public int drmVblankPredictorGetPeriod(drmVblankPredictorPtr pred,
+                                           uint64_t *period_ns, int *variable)
+{
+    if (pred->count < 2)
+        return -EAGAIN;
+
+    *period_ns = (uint64_t)pred->period;
+    if (variable)
+        *variable = pred->variable;
+    return 0;
+}
+
+/**
+ * Find the first vblank predicted to happen at or after a deadline.
+ *
+ * \return zero on success, -EAGAIN without enough samples.
+ */
+drm_public int drmVblankPredictorSequenceAt(drmVblankPredictorPtr pred,
+                                            uint64_t ns, uint64_t *sequence)
+{
+    double period;
+    uint64_t seq;
+
+    if (pred->count < 2)
+        return -EAGAIN;
+
+    seq = drmVblankPredictorLastSeq(pred) + 1;
+    period = pred->variable ? pred->min_period : pred->period;
+    if ((double)ns > drmVblankPredictorTime(pred, seq) && period > 0)
+        seq += (uint64_t)ceil(((double)ns - drmVblankPredictorTime(pred, seq)) /
+                              period);
+    *sequence = seq;
+    return 0;
+}
+
+/**
+ * Queue a sequence event for the first vblank predicted at or after a
+ * CLOCK_MONOTONIC deadline, falling back to the next vblank if that one
+ * has already passed.
+ *
+ * \return zero on success, -EAGAIN if the predictor has too few samples,
+ * otherwise the drmCrtcQueueSequence() error as a negative errno.
+ */
+drm_public int drmCrtcQueueAtTime(int fd, uint32_t crtcId,
+                                  drmVblankPredictorPtr pred, uint64_t ns,
+                                  uint64_t *sequence_queued,
+                                  uint64_t user_data)
+{
+    uint64_t sequence;
+    int ret;
+
+    ret = drmVblankPredictorSequenceAt(pred, ns, &sequence);
+    if (ret)
+        return ret;
+
+    if (drmCrtcQueueSequence(fd, crtcId, DRM_CRTC_SEQUENCE_NEXT_ON_MISS,
+                             sequence, sequence_queued, user_data))
+        return -errno;
+    return 0;
+}
+
 /**
  * Acquire the AGP device.
  *
@@ -2692,28 +4193,50 @@ drm_public int drmGetInterruptFromBusID(int fd, int busnum, int devnum,
 
 drm_public int drmAddContextTag(int fd, drm_context_t context, void *tag)
 {
-    drmHashEntry  *entry = drmGetEntry(fd);
+    drmHashEntry     *entry = drmGetEntry(fd);
+    drmHashEntryPriv *priv = (drmHashEntryPriv *)entry;
+
+    if (!entry)
+        return -ENOMEM;
 
+    pthread_mutex_lock(&priv->tagLock);
     if (drmHashInsert(entry->tagTable, context, tag)) {
         drmHashDelete(entry->tagTable, context);
         drmHashInsert(entry->tagTable, context, tag);
     }
+    pthread_mutex_unlock(&priv->tagLock);
     return 0;
 }
 
 drm_public int drmDelContextTag(int fd, drm_context_t context)
 {
-    drmHashEntry  *entry = drmGetEntry(fd);
+    drmHashEntry     *entry = drmGetEntry(fd);
+    drmHashEntryPriv *priv = (drmHashEntryPriv *)entry;
+    int              ret;
+
+    if (!entry)
+        return -ENOMEM;
 
-    return drmHashDelete(entry->tagTable, context);
+    pthread_mutex_lock(&priv->tagLock);
+    ret = drmHashDelete(entry->tagTable, context);
+    pthread_mutex_unlock(&priv->tagLock);
+    return ret;
 }
 
 drm_public void *drmGetContextTag(int fd, drm_context_t context)
 {
-    drmHashEntry  *entry = drmGetEntry(fd);
-    void          *value;
+    drmHashEntry     *entry = drmGetEntry(fd);
+    drmHashEntryPriv *priv = (drmHashEntryPriv *)entry;
+    void             *value;
+    int              ret;
+
+    if (!entry)
+        return NULL;
 
-    if (drmHashLookup(entry->tagTable, context, &value))
+    pthread_mutex_lock(&priv->tagLock);
+    ret = drmHashLookup(entry->tagTable, context, &value);
+    pthread_mutex_unlock(&priv->tagLock);
+    if (ret)
         return NULL;
 
     return value;
@@ -3244,31 +4767,283 @@ drm_public int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags,
     struct drm_prime_handle args;
     int ret;
 
-    memclear(args);
-    args.fd = -1;
-    args.handle = handle;
-    args.flags = flags;
-    ret = drmIoctl(fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &args);
+    memclear(args);
+    args.fd = -1;
+    args.handle = handle;
+    args.flags = flags;
+    ret = drmIoctl(fd, DRM_IOCTL_PRIME_HANDLE_TO_FD, &args);
+    if (ret)
+        return ret;
+
+    *prime_fd = args.fd;
+    return 0;
+}
+
+drm_public int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle)
+{
+    struct drm_prime_handle args;
+    int ret;
+
+    memclear(args);
+    args.fd = prime_fd;
+    ret = drmIoctl(fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &args);
+    if (ret)
+        return ret;
+
+    *handle = args.handle;
+    return 0;
+}
+
+/* Per-fd cache of the GEM handles of imported DMA-BUFs. DMA-BUF inode
+ * numbers are not reused, and a GEM handle holds a reference on the DMA-BUF
+ * it was imported from, so an entry stays valid until its handle is closed.
+ * Files of other file systems can have the same inode number, so a DMA-BUF
+ * is known by its (st_dev, st_ino).
+ */
+struct drm_prime_entry {
+    dev_t         dev;
+    ino_t         ino;
+    uint32_t      handle;
+    /* Next entry of the same inode number, after the one in the hash. */
+    struct drm_prime_entry *next;
+};
+
+struct drm_prime_cache {
+    void *inodes;  /* DMA-BUF inode number -> struct drm_prime_entry */
+    void *handles; /* GEM handle -> struct drm_prime_entry */
+};
+
+static pthread_mutex_t drm_prime_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *drm_prime_caches; /* fd -> struct drm_prime_cache */
+
+/* Must be called with drm_prime_lock held. */
+static struct drm_prime_cache *drmPrimeCacheGet(int fd, bool create)
+{
+    struct drm_prime_cache *cache;
+    void *value;
+
+    if (!drm_prime_caches) {
+        if (!create)
+            return NULL;
+        drm_prime_caches = drmHashCreate();
+        if (!drm_prime_caches)
+            return NULL;
+    }
+
+    if (!drmHashLookup(drm_prime_caches, fd, &value))
+        return value;
+    if (!create)
+        return NULL;
+
+    cache = drmMalloc(sizeof(*cache));
+    if (!cache)
+        return NULL;
+
+    cache->inodes = drmHashCreate();
+    cache->handles = drmHashCreate();
+    if (!cache->inodes || !cache->handles ||
+        drmHashInsert(drm_prime_caches, fd, cache)) {
+        if (cache->inodes)
+            drmHashDestroy(cache->inodes);
+        if (cache->handles)
+            drmHashDestroy(cache->handles);
+        drmFree(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+/* Must be called with drm_prime_lock held. */
+static struct drm_prime_entry *drmPrimeCacheFind(struct drm_prime_cache *cache,
+                                                 const struct stat *sbuf)
+{
+    struct drm_prime_entry *entry;
+    void *value;
+
+    if (drmHashLookup(cache->inodes, sbuf->st_ino, &value))
+        return NULL;
+
+    for (entry = value; entry; entry = entry->next)
+        if (entry->dev == sbuf->st_dev && entry->ino == sbuf->st_ino)
+            return entry;
+
+    return NULL;
+}
+
+/* Must be called with drm_prime_lock held. */
+static void drmPrimeCacheRemove(struct drm_prime_cache *cache,
+                                struct drm_prime_entry *entry)
+{
+    struct drm_prime_entry *first, **prev, *next;
+    void *value;
+
+    drmHashDelete(cache->handles, entry->handle);
+
+    if (drmHashLookup(cache->inodes, entry->ino, &value))
+        goto out;
+    first = value;
+    if (first != entry) {
+        for (prev = &first->next; *prev; prev = &(*prev)->next) {
+            if (*prev == entry) {
+                *prev = entry->next;
+                break;
+            }
+        }
+        goto out;
+    }
+
+    /* The next entry of the inode number takes the place of the first. If
+     * that fails, the entries left out are dropped, they are only cached. */
+    drmHashDelete(cache->inodes, entry->ino);
+    next = entry->next;
+    if (next && drmHashInsert(cache->inodes, next->ino, next)) {
+        while (next) {
+            first = next;
+            next = next->next;
+            drmHashDelete(cache->handles, first->handle);
+            drmFree(first);
+        }
+    }
+out:
+    drmFree(entry);
+}
+
+/* Must be called with drm_prime_lock held. */
+static int drmPrimeCacheInsert(struct drm_prime_cache *cache,
+                               struct drm_prime_entry *entry)
+{
+    struct drm_prime_entry *first;
+    void *value;
+
+    if (drmHashInsert(cache->handles, entry->handle, entry))
+        return -1;
+
+    /* Another file system's file of the same inode number is already
+     * there, the entry goes after it. */
+    if (!drmHashLookup(cache->inodes, entry->ino, &value)) {
+        first = value;
+        entry->next = first->next;
+        first->next = entry;
+        return 0;
+    }
+
+    entry->next = NULL;
+    if (drmHashInsert(cache->inodes, entry->ino, entry)) {
+        drmHashDelete(cache->handles, entry->handle);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Drops the cache of an fd, on drmInvalidateMetadataCache(). */
+static void drmPrimeCacheDrop(int fd)
+{
+    struct drm_prime_cache *cache;
+    unsigned long key;
+    void *value;
+
+    pthread_mutex_lock(&drm_prime_lock);
+    cache = drmPrimeCacheGet(fd, false);
+    if (cache) {
+        drmHashDelete(drm_prime_caches, fd);
+        while (drmHashFirst(cache->handles, &key, &value) == 1)
+            drmPrimeCacheRemove(cache, value);
+        drmHashDestroy(cache->inodes);
+        drmHashDestroy(cache->handles);
+        drmFree(cache);
+    }
+    pthread_mutex_unlock(&drm_prime_lock);
+}
+
+/**
+ * Convert a DMA-BUF file descriptor to a GEM handle through a per-fd cache.
+ *
+ * Returns the handle drmPrimeFDToHandle() would return. A DMA-BUF imported
+ * before on \p fd is found by the inode of \p prime_fd, without an ioctl.
+ *
+ * Every GEM handle of \p fd, imported or not, must be reported to
+ * drmPrimeCacheHandleClosed() before it is closed, otherwise a later import
+ * of the same DMA-BUF returns the closed handle.
+ *
+ * \param fd file descriptor of the importing device.
+ * \param prime_fd DMA-BUF file descriptor.
+ * \param handle returns the GEM handle.
+ *
+ * \return zero on success, or a negative value on failure.
+ */
+drm_public int drmPrimeFDToHandleCached(int fd, int prime_fd,
+                                        uint32_t *handle)
+{
+    struct drm_prime_cache *cache;
+    struct drm_prime_entry *entry;
+    struct stat sbuf;
+    void *value;
+    int ret;
+
+    if (fstat(prime_fd, &sbuf))
+        return -1;
+
+    pthread_mutex_lock(&drm_prime_lock);
+    cache = drmPrimeCacheGet(fd, false);
+    entry = cache ? drmPrimeCacheFind(cache, &sbuf) : NULL;
+    if (entry) {
+        *handle = entry->handle;
+        pthread_mutex_unlock(&drm_prime_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&drm_prime_lock);
+
+    ret = drmPrimeFDToHandle(fd, prime_fd, handle);
     if (ret)
         return ret;
 
-    *prime_fd = args.fd;
+    pthread_mutex_lock(&drm_prime_lock);
+    cache = drmPrimeCacheGet(fd, true);
+    /* Another thread may have imported the same buffer meanwhile, it got
+     * the same handle. */
+    if (!cache || drmPrimeCacheFind(cache, &sbuf))
+        goto out;
+
+    /* A handle found under another DMA-BUF is stale. */
+    if (!drmHashLookup(cache->handles, *handle, &value))
+        drmPrimeCacheRemove(cache, value);
+
+    entry = drmMalloc(sizeof(*entry));
+    if (!entry)
+        goto out;
+    entry->dev = sbuf.st_dev;
+    entry->ino = sbuf.st_ino;
+    entry->handle = *handle;
+    if (drmPrimeCacheInsert(cache, entry))
+        drmFree(entry);
+out:
+    pthread_mutex_unlock(&drm_prime_lock);
+
     return 0;
 }
 
-drm_public int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle)
+/**
+ * Report a GEM handle about to be closed to the cache of
+ * drmPrimeFDToHandleCached().
+ *
+ * Cheap for handles which are not cached, so that it can be called for
+ * every handle.
+ *
+ * \param fd file descriptor of the device.
+ * \param handle GEM handle.
+ */
+drm_public void drmPrimeCacheHandleClosed(int fd, uint32_t handle)
 {
-    struct drm_prime_handle args;
-    int ret;
-
-    memclear(args);
-    args.fd = prime_fd;
-    ret = drmIoctl(fd, DRM_IOCTL_PRIME_FD_TO_HANDLE, &args);
-    if (ret)
-        return ret;
+    struct drm_prime_cache *cache;
+    void *value;
 
-    *handle = args.handle;
-    return 0;
+    pthread_mutex_lock(&drm_prime_lock);
+    cache = drmPrimeCacheGet(fd, false);
+    if (cache && !drmHashLookup(cache->handles, handle, &value))
+        drmPrimeCacheRemove(cache, value);
+    pthread_mutex_unlock(&drm_prime_lock);
 }
 
 static char *drmGetMinorNameForFD(int fd, int type)
@@ -4262,161 +6037,602 @@ static int drmProcessPlatformDevice(drmDevicePtr *device,
     if (ret < 0)
         goto free_device;
 
-    if (fetch_deviceinfo) {
-        ptr += sizeof(drmPlatformBusInfo);
-        dev->deviceinfo.platform = (drmPlatformDeviceInfoPtr)ptr;
+    if (fetch_deviceinfo) {
+        ptr += sizeof(drmPlatformBusInfo);
+        dev->deviceinfo.platform = (drmPlatformDeviceInfoPtr)ptr;
+
+        ret = drmParseOFDeviceInfo(maj, min, &dev->deviceinfo.platform->compatible);
+        if (ret < 0)
+            goto free_device;
+    }
+
+    *device = dev;
+
+    return 0;
+
+free_device:
+    free(dev);
+    return ret;
+}
+
+static int drmProcessHost1xDevice(drmDevicePtr *device,
+                                  const char *node, int node_type,
+                                  int maj, int min, bool fetch_deviceinfo,
+                                  uint32_t flags)
+{
+    drmDevicePtr dev;
+    char *ptr;
+    int ret;
+
+    dev = drmDeviceAlloc(node_type, node, sizeof(drmHost1xBusInfo),
+                         sizeof(drmHost1xDeviceInfo), &ptr);
+    if (!dev)
+        return -ENOMEM;
+
+    dev->bustype = DRM_BUS_HOST1X;
+
+    dev->businfo.host1x = (drmHost1xBusInfoPtr)ptr;
+
+    ret = drmParseOFBusInfo(maj, min, dev->businfo.host1x->fullname);
+    if (ret < 0)
+        goto free_device;
+
+    if (fetch_deviceinfo) {
+        ptr += sizeof(drmHost1xBusInfo);
+        dev->deviceinfo.host1x = (drmHost1xDeviceInfoPtr)ptr;
+
+        ret = drmParseOFDeviceInfo(maj, min, &dev->deviceinfo.host1x->compatible);
+        if (ret < 0)
+            goto free_device;
+    }
+
+    *device = dev;
+
+    return 0;
+
+free_device:
+    free(dev);
+    return ret;
+}
+
+static int
+process_device(drmDevicePtr *device, const char *d_name,
+               int req_subsystem_type,
+               bool fetch_deviceinfo, uint32_t flags)
+{
+    struct stat sbuf;
+    char node[PATH_MAX + 1];
+    int node_type, subsystem_type;
+    unsigned int maj, min;
+
+    node_type = drmGetNodeType(d_name);
+    if (node_type < 0)
+        return -1;
+
+    snprintf(node, PATH_MAX, "%s/%s", DRM_DIR_NAME, d_name);
+    if (stat(node, &sbuf))
+        return -1;
+
+    maj = major(sbuf.st_rdev);
+    min = minor(sbuf.st_rdev);
+
+    if (!drmNodeIsDRM(maj, min) || !S_ISCHR(sbuf.st_mode))
+        return -1;
+
+    subsystem_type = drmParseSubsystemType(maj, min);
+    if (req_subsystem_type != -1 && req_subsystem_type != subsystem_type)
+        return -1;
+
+    switch (subsystem_type) {
+    case DRM_BUS_PCI:
+    case DRM_BUS_VIRTIO:
+        return drmProcessPciDevice(device, node, node_type, maj, min,
+                                   fetch_deviceinfo, flags);
+    case DRM_BUS_USB:
+        return drmProcessUsbDevice(device, node, node_type, maj, min,
+                                   fetch_deviceinfo, flags);
+    case DRM_BUS_PLATFORM:
+        return drmProcessPlatformDevice(device, node, node_type, maj, min,
+                                        fetch_deviceinfo, flags);
+    case DRM_BUS_HOST1X:
+        return drmProcessHost1xDevice(device, node, node_type, maj, min,
+                                      fetch_deviceinfo, flags);
+    default:
+        return -1;
+   }
+}
+
+/* Check that the given flags are valid returning 0 on success */
+static int
+drm_device_validate_flags(uint32_t flags)
+{
+        return (flags & ~DRM_DEVICE_GET_PCI_REVISION);
+}
+
+/*
+ * The kernel drm core has a number of places that assume maximum of
+ * 3x64 devices nodes. That's 64 for each of primary, control and
+ * render nodes. Rounded it up to 256 for simplicity.
+ */
+#define MAX_DRM_NODES 256
+
+static char **drmDupCompatible(char **compatible)
+{
+    unsigned int i, count = 0;
+    char **dup;
+
+    while (compatible[count])
+        count++;
+
+    dup = calloc(count + 1, sizeof(*dup));
+    if (!dup)
+        return NULL;
+
+    for (i = 0; i < count; i++) {
+        dup[i] = strdup(compatible[i]);
+        if (!dup[i]) {
+            while (i--)
+                free(dup[i]);
+            free(dup);
+            return NULL;
+        }
+    }
+
+    return dup;
+}
+
+/* Deep copy a device, so that the copy can be released with drmFreeDevice() */
+static drmDevicePtr drmDeviceDup(drmDevicePtr src)
+{
+    size_t bus_size, device_size, max_node_length;
+    drmDevicePtr dev;
+    char **compatible = NULL;
+    unsigned int i;
+    char *ptr;
+
+    switch (src->bustype) {
+    case DRM_BUS_PCI:
+        bus_size = sizeof(drmPciBusInfo);
+        device_size = sizeof(drmPciDeviceInfo);
+        break;
+    case DRM_BUS_USB:
+        bus_size = sizeof(drmUsbBusInfo);
+        device_size = sizeof(drmUsbDeviceInfo);
+        break;
+    case DRM_BUS_PLATFORM:
+        bus_size = sizeof(drmPlatformBusInfo);
+        device_size = sizeof(drmPlatformDeviceInfo);
+        break;
+    case DRM_BUS_HOST1X:
+        bus_size = sizeof(drmHost1xBusInfo);
+        device_size = sizeof(drmHost1xDeviceInfo);
+        break;
+    default:
+        return NULL;
+    }
+
+    dev = drmDeviceAlloc(0, src->nodes[0], bus_size, device_size, &ptr);
+    if (!dev)
+        return NULL;
+
+    max_node_length = ALIGN(drmGetMaxNodeName(), sizeof(void *));
+    for (i = 0; i < DRM_NODE_MAX; i++)
+        memcpy(dev->nodes[i], src->nodes[i], max_node_length);
+
+    dev->available_nodes = src->available_nodes;
+    dev->bustype = src->bustype;
+
+    /* All bus/device info pointers alias the same storage */
+    dev->businfo.pci = (drmPciBusInfoPtr)ptr;
+    memcpy(ptr, src->businfo.pci, bus_size);
+
+    if (src->deviceinfo.pci) {
+        ptr += bus_size;
+        dev->deviceinfo.pci = (drmPciDeviceInfoPtr)ptr;
+        memcpy(ptr, src->deviceinfo.pci, device_size);
+
+        if (dev->bustype == DRM_BUS_PLATFORM)
+            compatible = src->deviceinfo.platform->compatible;
+        else if (dev->bustype == DRM_BUS_HOST1X)
+            compatible = src->deviceinfo.host1x->compatible;
+
+        if (compatible) {
+            compatible = drmDupCompatible(compatible);
+            if (!compatible) {
+                free(dev);
+                return NULL;
+            }
+
+            if (dev->bustype == DRM_BUS_PLATFORM)
+                dev->deviceinfo.platform->compatible = compatible;
+            else
+                dev->deviceinfo.host1x->compatible = compatible;
+        }
+    }
+
+    return dev;
+}
+
+/*
+ * Process-wide cache of the DRM_DIR_NAME contents.
+ *
+ * Every DRM node is parsed once and remembered by (st_rdev, st_ino), so that
+ * nodes which disappear and get recreated with the same minor are noticed.
+ * The node list is only walked again when the directory mtime changes, or
+ * after drmInvalidateDeviceCache(), and even then only new nodes hit sysfs.
+ * Nodes are folded into devices once per refresh rather than once per call.
+ */
+struct drm_device_cache_node {
+    dev_t rdev;
+    ino_t ino;
+    int folded;             /* index into drm_device_cache_variant.devices */
+    drmDevicePtr device;    /* single node device, as parsed */
+};
+
+/* The nodes and devices parsed with one set of flags. */
+struct drm_device_cache_variant {
+    bool valid;
+    dev_t dir_dev;
+    ino_t dir_ino;
+    struct timespec dir_mtime;
+    int num_nodes;
+    struct drm_device_cache_node nodes[MAX_DRM_NODES];
+    int num_devices;
+    drmDevicePtr devices[MAX_DRM_NODES];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    /* Without and with DRM_DEVICE_GET_PCI_REVISION, so that the callers
+     * which don't ask for the revision never pay for reading it. */
+    struct drm_device_cache_variant variants[2];
+} drm_device_cache = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static struct drm_device_cache_variant *drmDeviceCacheVariant(uint32_t flags)
+{
+    return &drm_device_cache.variants[!!(flags & DRM_DEVICE_GET_PCI_REVISION)];
+}
+
+/* Whether the variant is up to date with DRM_DIR_NAME, of status sbuf. */
+static bool drmDeviceCacheFresh(const struct drm_device_cache_variant *cache,
+                                const struct stat *sbuf)
+{
+    return cache->valid &&
+           cache->dir_dev == sbuf->st_dev &&
+           cache->dir_ino == sbuf->st_ino &&
+           cache->dir_mtime.tv_sec == sbuf->st_mtim.tv_sec &&
+           cache->dir_mtime.tv_nsec == sbuf->st_mtim.tv_nsec;
+}
+
+/* Must be called with drm_device_cache.lock held. */
+static void drmDeviceCacheFold(struct drm_device_cache_variant *cache)
+{
+    int i, j, node_type;
+
+    for (i = 0; i < cache->num_devices; i++)
+        drmFreeDevice(&cache->devices[i]);
+    cache->num_devices = 0;
+
+    for (i = 0; i < cache->num_nodes; i++) {
+        struct drm_device_cache_node *node = &cache->nodes[i];
+        drmDevicePtr dev;
+
+        for (j = 0; j < cache->num_devices; j++) {
+            if (drmDevicesEqual(cache->devices[j], node->device))
+                break;
+        }
+
+        node->folded = j;
+        if (j < cache->num_devices) {
+            dev = cache->devices[j];
+            node_type = log2_int(node->device->available_nodes);
+            dev->available_nodes |= node->device->available_nodes;
+            memcpy(dev->nodes[node_type], node->device->nodes[node_type],
+                   drmGetMaxNodeName());
+            continue;
+        }
+
+        dev = drmDeviceDup(node->device);
+        if (!dev) {
+            node->folded = -1;
+            continue;
+        }
+        cache->devices[cache->num_devices++] = dev;
+    }
+}
+
+/* Whether a DRM_DIR_NAME entry is a DRM node, returning its status. */
+static bool drmDeviceCacheIsNode(const char *name, struct stat *sbuf)
+{
+    char node[PATH_MAX + 1];
+
+    if (drmGetNodeType(name) < 0)
+        return false;
+
+    snprintf(node, PATH_MAX, "%s/%s", DRM_DIR_NAME, name);
+    return !stat(node, sbuf) && S_ISCHR(sbuf->st_mode) &&
+           drmNodeIsDRM(major(sbuf->st_rdev), minor(sbuf->st_rdev));
+}
+
+/*
+ * Bring the variant of flags of the cache up to date with DRM_DIR_NAME and
+ * return it in *out, must be called with drm_device_cache.lock held.
+ */
+static int drmDeviceCacheRefresh(uint32_t flags,
+                                 struct drm_device_cache_variant **out)
+{
+    struct drm_device_cache_variant *cache = drmDeviceCacheVariant(flags);
+    struct drm_device_cache_node nodes[MAX_DRM_NODES];
+    struct dirent *dent;
+    struct stat sbuf;
+    drmDevicePtr d;
+    DIR *sysdir;
+    int i, j, count = 0;
+
+    *out = cache;
+    if (stat(DRM_DIR_NAME, &sbuf))
+        return -errno;
+
+    if (drmDeviceCacheFresh(cache, &sbuf))
+        return 0;
+
+    sysdir = opendir(DRM_DIR_NAME);
+    if (!sysdir)
+        return -errno;
+
+    cache->dir_dev = sbuf.st_dev;
+    cache->dir_ino = sbuf.st_ino;
+    cache->dir_mtime = sbuf.st_mtim;
+
+    while ((dent = readdir(sysdir))) {
+        if (!drmDeviceCacheIsNode(dent->d_name, &sbuf))
+            continue;
+
+        if (count >= MAX_DRM_NODES) {
+            fprintf(stderr, "More than %d drm nodes detected. "
+                    "Please report a bug - that should not happen.\n"
+                    "Skipping extra nodes\n", MAX_DRM_NODES);
+            break;
+        }
+
+        /* Recycle what we already know about this node */
+        d = NULL;
+        for (j = 0; j < cache->num_nodes; j++) {
+            struct drm_device_cache_node *old = &cache->nodes[j];
+
+            if (old->device && old->rdev == sbuf.st_rdev &&
+                old->ino == sbuf.st_ino) {
+                d = old->device;
+                old->device = NULL;
+                break;
+            }
+        }
 
-        ret = drmParseOFDeviceInfo(maj, min, &dev->deviceinfo.platform->compatible);
-        if (ret < 0)
-            goto free_device;
+        if (!d && process_device(&d, dent->d_name, -1, true, flags))
+            continue;
+
+        nodes[count].rdev = sbuf.st_rdev;
+        nodes[count].ino = sbuf.st_ino;
+        nodes[count].device = d;
+        count++;
     }
+    closedir(sysdir);
 
-    *device = dev;
+    for (i = 0; i < cache->num_nodes; i++)
+        drmFreeDevice(&cache->nodes[i].device);
 
-    return 0;
+    memcpy(cache->nodes, nodes, count * sizeof(nodes[0]));
+    cache->num_nodes = count;
+    cache->valid = true;
 
-free_device:
-    free(dev);
-    return ret;
+    drmDeviceCacheFold(cache);
+
+    return 0;
 }
 
-static int drmProcessHost1xDevice(drmDevicePtr *device,
-                                  const char *node, int node_type,
-                                  int maj, int min, bool fetch_deviceinfo,
-                                  uint32_t flags)
+/*
+ * The number of devices of a variant of the cache that is up to date, or
+ * else of DRM nodes, which is at least the number of devices, without
+ * parsing them.  Must be called with drm_device_cache.lock held.
+ */
+static int drmDeviceCacheCount(void)
 {
-    drmDevicePtr dev;
-    char *ptr;
-    int ret;
+    struct dirent *dent;
+    struct stat sbuf;
+    DIR *sysdir;
+    int i, count = 0;
 
-    dev = drmDeviceAlloc(node_type, node, sizeof(drmHost1xBusInfo),
-                         sizeof(drmHost1xDeviceInfo), &ptr);
-    if (!dev)
-        return -ENOMEM;
+    if (stat(DRM_DIR_NAME, &sbuf))
+        return -errno;
 
-    dev->bustype = DRM_BUS_HOST1X;
+    for (i = 0; i < 2; i++) {
+        if (drmDeviceCacheFresh(&drm_device_cache.variants[i], &sbuf))
+            return drm_device_cache.variants[i].num_devices;
+    }
 
-    dev->businfo.host1x = (drmHost1xBusInfoPtr)ptr;
+    sysdir = opendir(DRM_DIR_NAME);
+    if (!sysdir)
+        return -errno;
 
-    ret = drmParseOFBusInfo(maj, min, dev->businfo.host1x->fullname);
-    if (ret < 0)
-        goto free_device;
+    while ((dent = readdir(sysdir)) && count < MAX_DRM_NODES) {
+        if (drmDeviceCacheIsNode(dent->d_name, &sbuf))
+            count++;
+    }
+    closedir(sysdir);
 
-    if (fetch_deviceinfo) {
-        ptr += sizeof(drmHost1xBusInfo);
-        dev->deviceinfo.host1x = (drmHost1xDeviceInfoPtr)ptr;
+    return count;
+}
 
-        ret = drmParseOFDeviceInfo(maj, min, &dev->deviceinfo.host1x->compatible);
-        if (ret < 0)
-            goto free_device;
-    }
+#ifdef __linux__
+/* Whether the kernel driver of the device is called like the DRM driver,
+ * platform drivers often append "-drm" to it. */
+static bool drmDriverNameMatches(int maj, int min, const char *name)
+{
+    char path[PATH_MAX + 1], link[PATH_MAX + 1];
+    const char *driver;
+    size_t len = strlen(name);
+    ssize_t n;
 
-    *device = dev;
+    snprintf(path, sizeof(path), "/sys/dev/char/%d:%d/device/driver", maj, min);
+    n = readlink(path, link, PATH_MAX);
+    if (n < 0)
+        return false;
+    link[n] = '\0';
 
-    return 0;
+    driver = strrchr(link, '/');
+    driver = driver ? driver + 1 : link;
 
-free_device:
-    free(dev);
-    return ret;
+    return strncmp(driver, name, len) == 0 &&
+           (driver[len] == '\0' || !strcmp(&driver[len], "-drm") ||
+            !strcmp(&driver[len], "_drm"));
 }
+#endif
 
-static int
-process_device(drmDevicePtr *device, const char *d_name,
-               int req_subsystem_type,
-               bool fetch_deviceinfo, uint32_t flags)
+/*
+ * Fill \p minors with the minors of the nodes of \p type in the device cache
+ * that may be of the driver \p name or at \p busid, in minor order, and
+ * return how many there are.  Only these have to be opened and queried first.
+ */
+static int drmGetCandidateMinors(int type, const char *name,
+                                 const char *busid, int minors[])
 {
-    struct stat sbuf;
-    char node[PATH_MAX + 1];
-    int node_type, subsystem_type;
-    unsigned int maj, min;
+    struct drm_device_cache_variant *cache;
+    int base = drmGetMinorBase(type);
+    int i, j, min, count = 0;
 
-    node_type = drmGetNodeType(d_name);
-    if (node_type < 0)
-        return -1;
+    pthread_mutex_lock(&drm_device_cache.lock);
+    if (drmDeviceCacheRefresh(0, &cache))
+        goto out;
 
-    snprintf(node, PATH_MAX, "%s/%s", DRM_DIR_NAME, d_name);
-    if (stat(node, &sbuf))
-        return -1;
+    for (i = 0; i < cache->num_nodes; i++) {
+        struct drm_device_cache_node *node = &cache->nodes[i];
+        drmDevicePtr dev = node->device;
 
-    maj = major(sbuf.st_rdev);
-    min = minor(sbuf.st_rdev);
+        min = minor(node->rdev);
+        if (!dev || !(dev->available_nodes & (1 << type)) ||
+            min < base || min >= base + DRM_MAX_MINOR)
+            continue;
 
-    if (!drmNodeIsDRM(maj, min) || !S_ISCHR(sbuf.st_mode))
-        return -1;
+        if (busid) {
+            char id[32];
 
-    subsystem_type = drmParseSubsystemType(maj, min);
-    if (req_subsystem_type != -1 && req_subsystem_type != subsystem_type)
-        return -1;
+            if (dev->bustype != DRM_BUS_PCI)
+                continue;
+            snprintf(id, sizeof(id), "pci:%04x:%02x:%02x.%u",
+                     dev->businfo.pci->domain, dev->businfo.pci->bus,
+                     dev->businfo.pci->dev, dev->businfo.pci->func);
+            if (!drmMatchBusID(id, busid, 1))
+                continue;
+        }
 
-    switch (subsystem_type) {
-    case DRM_BUS_PCI:
-    case DRM_BUS_VIRTIO:
-        return drmProcessPciDevice(device, node, node_type, maj, min,
-                                   fetch_deviceinfo, flags);
-    case DRM_BUS_USB:
-        return drmProcessUsbDevice(device, node, node_type, maj, min,
-                                   fetch_deviceinfo, flags);
-    case DRM_BUS_PLATFORM:
-        return drmProcessPlatformDevice(device, node, node_type, maj, min,
-                                        fetch_deviceinfo, flags);
-    case DRM_BUS_HOST1X:
-        return drmProcessHost1xDevice(device, node, node_type, maj, min,
-                                      fetch_deviceinfo, flags);
-    default:
-        return -1;
-   }
+#ifdef __linux__
+        if (name && !drmDriverNameMatches(major(node->rdev), min, name))
+            continue;
+#else
+        /* no way to know the driver without opening the node */
+        if (name)
+            continue;
+#endif
+
+        for (j = count; j > 0 && minors[j - 1] > min; j--)
+            minors[j] = minors[j - 1];
+        minors[j] = min;
+        count++;
+    }
+
+out:
+    pthread_mutex_unlock(&drm_device_cache.lock);
+    return count;
 }
 
-/* Consider devices located on the same bus as duplicate and fold the respective
- * entries into a single one.
+/**
+ * Drop the cached view of the DRM device nodes
  *
- * Note: this leaves "gaps" in the array, while preserving the length.
+ * drmGetDevice2() and drmGetDevices2() revalidate their cache whenever the
+ * DRM_DIR_NAME directory changes.  Callers that learn about device changes
+ * through other means, such as udev events reporting a changed PCI revision,
+ * can use this to force the next call to rescan.
  */
-static void drmFoldDuplicatedDevices(drmDevicePtr local_devices[], int count)
+drm_public void drmInvalidateDeviceCache(void)
 {
-    int node_type, i, j;
+    int i, v;
 
-    for (i = 0; i < count; i++) {
-        for (j = i + 1; j < count; j++) {
-            if (drmDevicesEqual(local_devices[i], local_devices[j])) {
-                local_devices[i]->available_nodes |= local_devices[j]->available_nodes;
-                node_type = log2_int(local_devices[j]->available_nodes);
-                memcpy(local_devices[i]->nodes[node_type],
-                       local_devices[j]->nodes[node_type], drmGetMaxNodeName());
-                drmFreeDevice(&local_devices[j]);
-            }
-        }
-    }
-}
+    pthread_mutex_lock(&drm_device_cache.lock);
+    for (v = 0; v < 2; v++) {
+        struct drm_device_cache_variant *cache = &drm_device_cache.variants[v];
 
-/* Check that the given flags are valid returning 0 on success */
-static int
-drm_device_validate_flags(uint32_t flags)
-{
-        return (flags & ~DRM_DEVICE_GET_PCI_REVISION);
+        for (i = 0; i < cache->num_nodes; i++)
+            drmFreeDevice(&cache->nodes[i].device);
+        for (i = 0; i < cache->num_devices; i++)
+            drmFreeDevice(&cache->devices[i]);
+        cache->num_nodes = 0;
+        cache->num_devices = 0;
+        cache->valid = false;
+    }
+    pthread_mutex_unlock(&drm_device_cache.lock);
 }
 
-static bool
-drm_device_has_rdev(drmDevicePtr device, dev_t find_rdev)
+#ifdef __linux__
+/*
+ * Describe the device of a single node without scanning DRM_DIR_NAME: only
+ * the node itself is parsed, its sibling nodes are found in the drm/
+ * directory of its sysfs device.
+ */
+static int drmGetDeviceFromNode(dev_t rdev, uint32_t flags,
+                                drmDevicePtr *device)
 {
+    char path[PATH_MAX + 1], own[NAME_MAX + 1] = "";
+    char siblings[DRM_NODE_MAX][PATH_MAX + 1];
+    struct dirent *dent;
     struct stat sbuf;
+    drmDevicePtr d;
+    DIR *dir;
+    int i, type, ret;
 
-    for (int i = 0; i < DRM_NODE_MAX; i++) {
-        if (device->available_nodes & 1 << i) {
-            if (stat(device->nodes[i], &sbuf) == 0 &&
-                sbuf.st_rdev == find_rdev)
-                return true;
-        }
+    memset(siblings, 0, sizeof(siblings));
+    snprintf(path, sizeof(path), "/sys/dev/char/%d:%d/device/drm",
+             major(rdev), minor(rdev));
+    dir = opendir(path);
+    if (!dir)
+        return -errno;
+
+    while ((dent = readdir(dir))) {
+        type = drmGetNodeType(dent->d_name);
+        if (type < 0 || strlen(dent->d_name) > NAME_MAX)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", DRM_DIR_NAME, dent->d_name);
+        if (stat(path, &sbuf) || !S_ISCHR(sbuf.st_mode) ||
+            !drmNodeIsDRM(major(sbuf.st_rdev), minor(sbuf.st_rdev)))
+            continue;
+
+        if (sbuf.st_rdev == rdev)
+            strcpy(own, dent->d_name);
+        else if ((int)strlen(path) < drmGetMaxNodeName())
+            strcpy(siblings[type], path);
     }
-    return false;
-}
+    closedir(dir);
 
-/*
- * The kernel drm core has a number of places that assume maximum of
- * 3x64 devices nodes. That's 64 for each of primary, control and
- * render nodes. Rounded it up to 256 for simplicity.
- */
-#define MAX_DRM_NODES 256
+    if (!own[0])
+        return -ENODEV;
+
+    ret = process_device(&d, own, -1, true, flags);
+    if (ret)
+        return ret < 0 ? ret : -ENODEV;
+
+    for (i = 0; i < DRM_NODE_MAX; i++) {
+        if (!siblings[i][0] || (d->available_nodes & (1 << i)))
+            continue;
+        memcpy(d->nodes[i], siblings[i], strlen(siblings[i]) + 1);
+        d->available_nodes |= 1 << i;
+    }
+
+    *device = d;
+    return 0;
+}
+#endif
 
 /**
  * Get information about the opened drm device
@@ -4484,15 +6700,10 @@ drm_public int drmGetDevice2(int fd, uint32_t flags, drmDevicePtr *device)
 
     return 0;
 #else
-    drmDevicePtr local_devices[MAX_DRM_NODES];
-    drmDevicePtr d;
-    DIR *sysdir;
-    struct dirent *dent;
+    struct drm_device_cache_variant *cache;
     struct stat sbuf;
-    int subsystem_type;
     int maj, min;
-    int ret, i, node_count;
-    dev_t find_rdev;
+    int ret, i;
 
     if (drm_device_validate_flags(flags))
         return -EINVAL;
@@ -4503,56 +6714,46 @@ drm_public int drmGetDevice2(int fd, uint32_t flags, drmDevicePtr *device)
     if (fstat(fd, &sbuf))
         return -errno;
 
-    find_rdev = sbuf.st_rdev;
     maj = major(sbuf.st_rdev);
     min = minor(sbuf.st_rdev);
 
     if (!drmNodeIsDRM(maj, min) || !S_ISCHR(sbuf.st_mode))
         return -EINVAL;
 
-    subsystem_type = drmParseSubsystemType(maj, min);
-    if (subsystem_type < 0)
-        return subsystem_type;
-
-    sysdir = opendir(DRM_DIR_NAME);
-    if (!sysdir)
-        return -errno;
-
-    i = 0;
-    while ((dent = readdir(sysdir))) {
-        ret = process_device(&d, dent->d_name, subsystem_type, true, flags);
-        if (ret)
-            continue;
+    ret = drmParseSubsystemType(maj, min);
+    if (ret < 0)
+        return ret;
 
-        if (i >= MAX_DRM_NODES) {
-            fprintf(stderr, "More than %d drm nodes detected. "
-                    "Please report a bug - that should not happen.\n"
-                    "Skipping extra nodes\n", MAX_DRM_NODES);
-            break;
-        }
-        local_devices[i] = d;
-        i++;
+    pthread_mutex_lock(&drm_device_cache.lock);
+#ifdef __linux__
+    /* Rather than filling the cache with every device for the sake of a
+     * single one, only look at that one. */
+    if (!drmDeviceCacheVariant(flags)->valid &&
+        !drmGetDeviceFromNode(sbuf.st_rdev, flags, device)) {
+        ret = 0;
+        goto out;
     }
-    node_count = i;
-
-    drmFoldDuplicatedDevices(local_devices, node_count);
+#endif
+    ret = drmDeviceCacheRefresh(flags, &cache);
+    if (ret)
+        goto out;
 
+    ret = -ENODEV;
     *device = NULL;
+    for (i = 0; i < cache->num_nodes; i++) {
+        struct drm_device_cache_node *node = &cache->nodes[i];
 
-    for (i = 0; i < node_count; i++) {
-        if (!local_devices[i])
+        if (node->rdev != sbuf.st_rdev || node->folded < 0)
             continue;
 
-        if (drm_device_has_rdev(local_devices[i], find_rdev))
-            *device = local_devices[i];
-        else
-            drmFreeDevice(&local_devices[i]);
+        *device = drmDeviceDup(cache->devices[node->folded]);
+        ret = *device ? 0 : -ENOMEM;
+        break;
     }
 
-    closedir(sysdir);
-    if (*device == NULL)
-        return -ENODEV;
-    return 0;
+out:
+    pthread_mutex_unlock(&drm_device_cache.lock);
+    return ret;
 #endif
 }
 
@@ -4580,6 +6781,8 @@ drm_public int drmGetDevice(int fd, drmDevicePtr *device)
  *
  * \return on error - negative error code,
  *         if devices is NULL - total number of devices available on the system,
+ *         or of DRM nodes when the devices have not been looked at since they
+ *         changed, which is never less than the number of devices,
  *         alternatively the number of devices stored in devices[], which is
  *         capped by the max_devices.
  *
@@ -4589,57 +6792,38 @@ drm_public int drmGetDevice(int fd, drmDevicePtr *device)
 drm_public int drmGetDevices2(uint32_t flags, drmDevicePtr devices[],
                               int max_devices)
 {
-    drmDevicePtr local_devices[MAX_DRM_NODES];
-    drmDevicePtr device;
-    DIR *sysdir;
-    struct dirent *dent;
-    int ret, i, node_count, device_count;
+    struct drm_device_cache_variant *cache;
+    int ret, i, device_count;
 
     if (drm_device_validate_flags(flags))
         return -EINVAL;
 
-    sysdir = opendir(DRM_DIR_NAME);
-    if (!sysdir)
-        return -errno;
+    pthread_mutex_lock(&drm_device_cache.lock);
+    /* Sizing the array needs no parsing. */
+    if (devices == NULL) {
+        ret = drmDeviceCacheCount();
+        goto out;
+    }
 
-    i = 0;
-    while ((dent = readdir(sysdir))) {
-        ret = process_device(&device, dent->d_name, -1, devices != NULL, flags);
-        if (ret)
-            continue;
+    ret = drmDeviceCacheRefresh(flags, &cache);
+    if (ret)
+        goto out;
 
-        if (i >= MAX_DRM_NODES) {
-            fprintf(stderr, "More than %d drm nodes detected. "
-                    "Please report a bug - that should not happen.\n"
-                    "Skipping extra nodes\n", MAX_DRM_NODES);
+    device_count = cache->num_devices;
+    ret = 0;
+    for (i = 0; i < device_count && ret < max_devices; i++) {
+        devices[ret] = drmDeviceDup(cache->devices[i]);
+        if (!devices[ret]) {
+            drmFreeDevices(devices, ret);
+            ret = -ENOMEM;
             break;
         }
-        local_devices[i] = device;
-        i++;
+        ret++;
     }
-    node_count = i;
 
-    drmFoldDuplicatedDevices(local_devices, node_count);
-
-    device_count = 0;
-    for (i = 0; i < node_count; i++) {
-        if (!local_devices[i])
-            continue;
-
-        if ((devices != NULL) && (device_count < max_devices))
-            devices[device_count] = local_devices[i];
-        else
-            drmFreeDevice(&local_devices[i]);
-
-        device_count++;
-    }
-
-    closedir(sysdir);
-
-    if (devices != NULL)
-        return MIN2(device_count, max_devices);
-
-    return device_count;
+out:
+    pthread_mutex_unlock(&drm_device_cache.lock);
+    return ret;
 }
 
 /**
@@ -4944,6 +7128,81 @@ drm_public int drmSyncobjTransfer(int fd,
     return ret;
 }
 
+/**
+ * Get a pollable file descriptor for a set of sync objects.
+ *
+ * The fences currently attached to the given handles (or timeline points)
+ * are exported as sync files and merged into a single one, which becomes
+ * readable (POLLIN) once all of them have signaled.  This allows waiting for
+ * sync objects from an event loop instead of blocking in drmSyncobjWait().
+ *
+ * \param fd file descriptor.
+ * \param handles array of sync object handles.
+ * \param points array of timeline points, or NULL if all objects are binary.
+ *        A zero point selects the binary fence of that handle.
+ * \param num_handles number of entries in \p handles (and \p points).
+ * \param wait_fd returns the sync file descriptor, to be closed by the caller.
+ *
+ * \return zero on success, or a negative errno value on failure.  The fences
+ * (and timeline points) must already have been submitted, otherwise -EINVAL
+ * or -ENOENT is returned.
+ */
+drm_public int drmSyncobjGetWaitFd(int fd, const uint32_t *handles,
+                                   const uint64_t *points,
+                                   unsigned num_handles, int *wait_fd)
+{
+    uint32_t tmp = 0;
+    int merged = -1;
+    int ret = 0;
+    unsigned i;
+
+    if (!handles || !num_handles || !wait_fd)
+        return -EINVAL;
+
+    for (i = 0; i < num_handles; i++) {
+        uint32_t handle = handles[i];
+        int sync_file;
+
+        if (points && points[i]) {
+            if (!tmp && drmSyncobjCreate(fd, 0, &tmp)) {
+                ret = -errno;
+                goto out;
+            }
+            if (drmSyncobjTransfer(fd, tmp, 0, handle, points[i], 0)) {
+                ret = -errno;
+                goto out;
+            }
+            handle = tmp;
+        }
+
+        if (drmSyncobjExportSyncFile(fd, handle, &sync_file)) {
+            ret = -errno;
+            goto out;
+        }
+
+        if (merged < 0) {
+            merged = sync_file;
+            continue;
+        }
+
+        if (sync_accumulate("drm_syncobj", &merged, sync_file))
+            ret = -errno;
+        close(sync_file);
+        if (ret)
+            goto out;
+    }
+
+    *wait_fd = merged;
+    merged = -1;
+
+out:
+    if (merged >= 0)
+        close(merged);
+    if (tmp)
+        drmSyncobjDestroy(fd, tmp);
+    return ret;
+}
+
 static char *
 drmGetFormatModifierFromSimpleTokens(uint64_t modifier)
 {
@@ -5006,3 +7265,24 @@ drmGetFormatModifierName(uint64_t modifier)
 
     return modifier_found;
 }
+
+/** Retrieves the layout of a format
+ *
+ * The table and its perfect hash are generated from drm_fourcc.h, so the
+ * lookup is a multiplication, a shift and a compare.
+ *
+ * \param format the fourcc code of the format
+ * \return the static description of the format, or NULL if unknown
+ */
+drm_public const drmFormatInfo *
+drmGetFormatInfo(uint32_t format)
+{
+    uint8_t index = drm_format_info_hash[DRM_FORMAT_INFO_HASH(format)];
+    const drmFormatInfo *info;
+
+    if (!index)
+        return NULL;
+
+    info = &drm_format_info_table[index - 1];
+    return info->format == format ? info : NULL;
+}
@@ -131,6 +131,17 @@ typedef struct drmHashEntry {
 } drmHashEntry;
 
 extern int drmIoctl(int fd, unsigned long request, void *arg);
+
+typedef struct _drmIoctlBatchEntry {
+    unsigned long request;
+    void          *arg;
+    int           ret;  /* Result: 0 or negative errno */
+} drmIoctlBatchEntry, *drmIoctlBatchEntryPtr;
+
+#define DRM_IOCTL_BATCH_STOP_ON_ERROR (1 << 0)
+
+extern int drmIoctlBatch(int fd, drmIoctlBatchEntryPtr entries,
+                         unsigned int count, uint32_t flags);
 extern void *drmGetHashTable(void);
 extern drmHashEntry *drmGetEntry(int fd);
 
@@ -610,6 +621,10 @@ extern drmVersionPtr drmGetVersion(int fd);
 extern drmVersionPtr drmGetLibVersion(int fd);
 extern int           drmGetCap(int fd, uint64_t capability, uint64_t *value);
 extern void          drmFreeVersion(drmVersionPtr);
+extern const drmVersion *drmGetVersionCached(int fd);
+extern int           drmGetCapCached(int fd, uint64_t capability,
+                                     uint64_t *value);
+extern void          drmInvalidateMetadataCache(int fd);
 extern int           drmGetMagic(int fd, drm_magic_t * magic);
 extern char          *drmGetBusid(int fd);
 extern int           drmGetInterruptFromBusID(int fd, int busnum, int devnum,
@@ -677,6 +692,24 @@ extern int           drmCrtcQueueSequence(int fd, uint32_t crtcId,
 					  uint32_t flags, uint64_t sequence,
 					  uint64_t *sequence_queued,
 					  uint64_t user_data);
+
+typedef struct _drmVblankPredictor drmVblankPredictor, *drmVblankPredictorPtr;
+
+extern drmVblankPredictorPtr drmVblankPredictorCreate(void);
+extern void drmVblankPredictorDestroy(drmVblankPredictorPtr pred);
+extern void drmVblankPredictorReset(drmVblankPredictorPtr pred);
+extern void drmVblankPredictorAddSample(drmVblankPredictorPtr pred,
+					uint64_t sequence, uint64_t ns);
+extern int drmVblankPredictorPredict(drmVblankPredictorPtr pred,
+				     uint64_t *sequences, uint64_t *ns,
+				     int count);
+extern int drmVblankPredictorGetPeriod(drmVblankPredictorPtr pred,
+				       uint64_t *period_ns, int *variable);
+extern int drmVblankPredictorSequenceAt(drmVblankPredictorPtr pred,
+					uint64_t ns, uint64_t *sequence);
+extern int drmCrtcQueueAtTime(int fd, uint32_t crtcId,
+			      drmVblankPredictorPtr pred, uint64_t ns,
+			      uint64_t *sequence_queued, uint64_t user_data);
 /* General user-level programmer's API: authenticated client and/or X */
 extern int           drmMap(int fd,
 			    drm_handle_t handle,
@@ -732,6 +765,14 @@ extern int           drmError(int err, const char *label);
 extern void          *drmMalloc(int size);
 extern void          drmFree(void *pt);
 
+typedef struct _drmAllocator {
+    void *(*alloc)(size_t size, void *data); /* Must zero the memory */
+    void (*free)(void *ptr, void *data);
+    void *data;
+} drmAllocator, *drmAllocatorPtr;
+
+extern int           drmSetAllocator(const drmAllocator *allocator);
+
 /* Hash table routines */
 extern void *drmHashCreate(void);
 extern int  drmHashDestroy(void *t);
@@ -756,6 +797,10 @@ extern int  drmSLInsert(void *l, unsigned long key, void *value);
 extern int  drmSLDelete(void *l, unsigned long key);
 extern int  drmSLNext(void *l, unsigned long *key, void **value);
 extern int  drmSLFirst(void *l, unsigned long *key, void **value);
+extern int  drmSLSeek(void *l, unsigned long key,
+		      unsigned long *found_key, void **value);
+extern int  drmSLBulkInsert(void *l, const unsigned long *keys,
+			    void * const *values, int count);
 extern void drmSLDump(void *l);
 extern int  drmSLLookupNeighbors(void *l, unsigned long key,
 				 unsigned long *prev_key, void **prev_value,
@@ -766,6 +811,77 @@ extern int drmOpenOnceWithType(const char *BusID, int *newlyopened, int type);
 extern void drmCloseOnce(int fd);
 extern void drmMsg(const char *format, ...) DRM_PRINTFLIKE(1, 2);
 
+/* ioctl accounting, see drmEnableIoctlStats() */
+typedef struct _drmIoctlStats {
+    int fd;
+    unsigned long request;
+    uint64_t count;    /* completed drmIoctl() calls */
+    uint64_t retries;  /* restarts due to EINTR/EAGAIN */
+    uint64_t errors;   /* calls that eventually failed */
+    uint64_t total_ns; /* cumulative latency, retries included */
+    uint64_t max_ns;   /* slowest single call */
+} drmIoctlStats, *drmIoctlStatsPtr;
+
+extern int drmEnableIoctlStats(int enable);
+extern int drmGetIoctlStats(int fd, drmIoctlStatsPtr stats, int max_stats);
+extern void drmResetIoctlStats(int fd);
+
+/* ioctl recording, see drmIoctlRecordStart() */
+#define DRM_IOCTL_RECORD_MAGIC   0x524d5244 /* "DRMR" */
+#define DRM_IOCTL_RECORD_VERSION 1
+
+typedef struct _drmIoctlRecordHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;  /* bytes per record, payload included */
+    uint32_t num_records;  /* capacity of the ring following the header */
+    uint64_t head;         /* records taken so far */
+    uint64_t start_ns;     /* CLOCK_MONOTONIC when the recording started */
+} drmIoctlRecordHeader;
+
+typedef struct _drmIoctlRecord {
+    uint64_t seq;          /* 1 + index of the record, 0 while written */
+    uint64_t timestamp_ns; /* CLOCK_MONOTONIC when the call was made */
+    uint64_t duration_ns;  /* retries included */
+    uint64_t request;
+    int32_t  fd;
+    int32_t  result;       /* 0 or a negative errno value */
+    uint32_t arg_size;     /* size encoded in the request */
+    uint32_t payload_size; /* bytes of the argument following the record */
+} drmIoctlRecord;
+
+/* mapping accounting, see drmMapTrack() */
+typedef struct _drmMapStats {
+    uint64_t bytes;      /* bytes mapped */
+    uint64_t count;      /* mappings alive */
+    uint64_t peak_bytes;
+    uint64_t peak_count;
+} drmMapStats, *drmMapStatsPtr;
+
+typedef void (*drmMapThresholdFunc)(uint64_t bytes, uint64_t count,
+                                    void *data);
+
+extern void drmMapTrack(int fd, void *addr, size_t size);
+extern void drmMapUntrack(void *addr);
+extern int drmGetMapStats(int fd, drmMapStatsPtr stats);
+extern int drmGetDriverMapStats(const char *driver, drmMapStatsPtr stats);
+extern int drmAddMapThreshold(uint64_t bytes, uint64_t count,
+                              drmMapThresholdFunc func, void *data);
+extern void drmRemoveMapThreshold(drmMapThresholdFunc func, void *data);
+
+extern int drmTraceEnabled(void);
+extern void drmTraceBegin(const char *name, const char *format, ...)
+    DRM_PRINTFLIKE(2, 3);
+extern void drmTraceEnd(void);
+extern void drmTraceEvent(const char *name, const char *format, ...)
+    DRM_PRINTFLIKE(2, 3);
+
+extern int drmIoctlRecordStart(const char *path, uint32_t num_records,
+                               uint32_t payload_size,
+                               const unsigned long *payload_requests,
+                               unsigned int num_payload_requests);
+extern void drmIoctlRecordStop(void);
+
 extern int drmSetMaster(int fd);
 extern int drmDropMaster(int fd);
 extern int drmIsMaster(int fd);
@@ -805,6 +921,10 @@ typedef struct _drmEventContext {
 
 extern int drmHandleEvent(int fd, drmEventContextPtr evctx);
 
+#define DRM_HANDLE_EVENTS_DRAIN (1 << 0)
+extern int drmHandleEvents2(int fd, drmEventContextPtr evctx,
+			    void *buffer, size_t size, uint32_t flags);
+
 extern char *drmGetDeviceNameFromFd(int fd);
 
 /* Improved version of drmGetDeviceNameFromFd which attributes for any type of
@@ -834,6 +954,14 @@ extern int drmGetNodeTypeFromFd(int fd);
 extern int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags, int *prime_fd);
 extern int drmPrimeFDToHandle(int fd, int prime_fd, uint32_t *handle);
 
+/* Same as drmPrimeFDToHandle, but DMA-BUFs imported before on the fd are
+ * found without an ioctl. Every GEM handle of the fd must be passed to
+ * drmPrimeCacheHandleClosed before it is closed. The cache is dropped by
+ * drmInvalidateMetadataCache and drmClose.
+ */
+extern int drmPrimeFDToHandleCached(int fd, int prime_fd, uint32_t *handle);
+extern void drmPrimeCacheHandleClosed(int fd, uint32_t handle);
+
 extern char *drmGetPrimaryDeviceNameFromFd(int fd);
 extern char *drmGetRenderDeviceNameFromFd(int fd);
 
@@ -915,6 +1043,8 @@ extern void drmFreeDevices(drmDevicePtr devices[], int count);
 extern int drmGetDevice2(int fd, uint32_t flags, drmDevicePtr *device);
 extern int drmGetDevices2(uint32_t flags, drmDevicePtr devices[], int max_devices);
 
+extern void drmInvalidateDeviceCache(void);
+
 extern int drmDevicesEqual(drmDevicePtr a, drmDevicePtr b);
 
 extern int drmSyncobjCreate(int fd, uint32_t flags, uint32_t *handle);
@@ -943,6 +1073,9 @@ extern int drmSyncobjTransfer(int fd,
 			      uint32_t dst_handle, uint64_t dst_point,
 			      uint32_t src_handle, uint64_t src_point,
 			      uint32_t flags);
+extern int drmSyncobjGetWaitFd(int fd, const uint32_t *handles,
+			       const uint64_t *points, unsigned num_handles,
+			       int *wait_fd);
 
 extern char *
 drmGetFormatModifierVendor(uint64_t modifier);
@@ -950,6 +1083,22 @@ drmGetFormatModifierVendor(uint64_t modifier);
 extern char *
 drmGetFormatModifierName(uint64_t modifier);
 
+/* The layout of a format, as the kernel's drm_format_info describes it. A
+ * cpp of 0 is a format packed in blocks of pixels. */
+typedef struct drmFormatInfo {
+	uint32_t format;
+	uint8_t depth;       /* 0 when not a legacy depth/bpp format */
+	uint8_t num_planes;
+	uint8_t cpp[4];
+	uint8_t hsub;
+	uint8_t vsub;
+	uint8_t has_alpha;
+	uint8_t is_yuv;
+} drmFormatInfo;
+
+extern const drmFormatInfo *
+drmGetFormatInfo(uint32_t format);
+
 #ifndef fourcc_mod_get_vendor
 #define fourcc_mod_get_vendor(modifier) \
        (((modifier) >> 56) & 0xff)
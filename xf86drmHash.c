@@ -27,48 +27,36 @@
  *
  * DESCRIPTION
  *
- * This file contains a straightforward implementation of a fixed-sized
- * hash table using self-organizing linked lists [Knuth73, pp. 398-399] for
- * collision resolution.  There are two potentially interesting things
- * about this implementation:
+ * This file contains a dynamically sized hash table using open addressing
+ * with linear probing [Knuth73, pp. 518-526] for collision resolution.
+ * There are a few potentially interesting things about this
+ * implementation:
  *
  * 1) The table is power-of-two sized.  Prime sized tables are more
  * traditional, but do not have a significant advantage over power-of-two
- * sized table, especially when double hashing is not used for collision
- * resolution.
+ * sized table, as long as the hash function mixes all of the key bits into
+ * the low order bits used for indexing.
  *
- * 2) The hash computation uses a table of random integers [Hanson97,
- * pp. 39-41].
+ * 2) The hash computation is a multiply/xor-shift integer finalizer, which
+ * needs no state and is both cheap and well distributed for the small,
+ * mostly consecutive integers (GEM handles, flink names, context ids) that
+ * get stored here.
  *
- * FUTURE ENHANCEMENTS
- *
- * With a table size of 512, the current implementation is sufficient for a
- * few hundred keys.  Since this is well above the expected size of the
- * tables for which this implementation was designed, the implementation of
- * dynamic hash tables was postponed until the need arises.  A common (and
- * naive) approach to dynamic hash table implementation simply creates a
- * new hash table when necessary, rehashes all the data into the new table,
- * and destroys the old table.  The approach in [Larson88] is superior in
- * two ways: 1) only a portion of the table is expanded when needed,
- * distributing the expansion cost over several insertions, and 2) portions
- * of the table can be locked, enabling a scalable thread-safe
- * implementation.
+ * 3) The table doubles in size whenever it gets more than 3/4 full, so
+ * probe sequences stay short no matter how many keys get inserted.
+ * Deleted slots are marked with a tombstone so that lookups of other keys
+ * keep working and iteration may safely delete the current key; they are
+ * reclaimed by the next insertion hitting them or by the next resize.
  *
  * REFERENCES
  *
- * [Hanson97] David R. Hanson.  C Interfaces and Implementations:
- * Techniques for Creating Reusable Software.  Reading, Massachusetts:
- * Addison-Wesley, 1997.
- *
  * [Knuth73] Donald E. Knuth. The Art of Computer Programming.  Volume 3:
  * Sorting and Searching.  Reading, Massachusetts: Addison-Wesley, 1973.
  *
- * [Larson88] Per-Ake Larson. "Dynamic Hash Tables".  CACM 31(4), April
- * 1988, pp. 446-457.
- *
  */
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "libdrm_macros.h"
@@ -79,27 +67,40 @@
 
 static unsigned long HashHash(unsigned long key)
 {
-    unsigned long        hash = 0;
-    unsigned long        tmp  = key;
-    static int           init = 0;
-    static unsigned long scatter[256];
-    int                  i;
-
-    if (!init) {
-	void *state;
-	state = drmRandomCreate(37);
-	for (i = 0; i < 256; i++) scatter[i] = drmRandom(state);
-	drmRandomDestroy(state);
-	++init;
-    }
+    uint64_t hash = key;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+
+    return (unsigned long)hash;
+}
 
-    while (tmp) {
-	hash = (hash << 1) + scatter[tmp & 0xff];
-	tmp >>= 8;
+static int HashResize(HashTablePtr table, unsigned long size)
+{
+    HashBucketPtr buckets, old = table->buckets;
+    unsigned long i, j, mask = size - 1;
+
+    buckets = drmMalloc(size * sizeof(*buckets));
+    if (!buckets) return -1;
+
+    for (i = 0; i < table->size; i++) {
+	if (old[i].state != HASH_BUCKET_USED) continue;
+	for (j = HashHash(old[i].key) & mask;
+	     buckets[j].state == HASH_BUCKET_USED;
+	     j = (j + 1) & mask)
+	    ;
+	buckets[j] = old[i];
     }
 
-    hash %= HASH_SIZE;
-    return hash;
+    drmFree(old);
+    table->buckets    = buckets;
+    table->size       = size;
+    table->tombstones = 0;
+    table->p0         = 0;
+    return 0;
 }
 
 drm_public void *drmHashCreate(void)
@@ -110,57 +111,53 @@ drm_public void *drmHashCreate(void)
     if (!table) return NULL;
     table->magic    = HASH_MAGIC;
 
+    if (HashResize(table, HASH_MIN_SIZE)) {
+	drmFree(table);
+	return NULL;
+    }
+
     return table;
 }
 
 drm_public int drmHashDestroy(void *t)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    HashBucketPtr bucket;
-    HashBucketPtr next;
-    int           i;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    for (i = 0; i < HASH_SIZE; i++) {
-	for (bucket = table->buckets[i]; bucket;) {
-	    next = bucket->next;
-	    drmFree(bucket);
-	    bucket = next;
-	}
-    }
+    drmFree(table->buckets);
     drmFree(table);
     return 0;
 }
 
-/* Find the bucket and organize the list so that this bucket is at the
-   top. */
+/* Find the bucket holding key.  If it is not found, and slot is non-NULL,
+   return the first bucket where key could be inserted through *slot. */
 
 static HashBucketPtr HashFind(HashTablePtr table,
-			      unsigned long key, unsigned long *h)
+			      unsigned long key, HashBucketPtr *slot)
 {
-    unsigned long hash = HashHash(key);
-    HashBucketPtr prev = NULL;
+    unsigned long mask = table->size - 1;
+    unsigned long i    = HashHash(key) & mask;
+    HashBucketPtr first = NULL;
     HashBucketPtr bucket;
 
-    if (h) *h = hash;
-
-    for (bucket = table->buckets[hash]; bucket; bucket = bucket->next) {
+    for (bucket = &table->buckets[i];
+	 bucket->state != HASH_BUCKET_EMPTY;
+	 i = (i + 1) & mask, bucket = &table->buckets[i]) {
+	if (bucket->state == HASH_BUCKET_DELETED) {
+	    if (!first) first = bucket;
+	    continue;
+	}
 	if (bucket->key == key) {
-	    if (prev) {
-				/* Organize */
-		prev->next           = bucket->next;
-		bucket->next         = table->buckets[hash];
-		table->buckets[hash] = bucket;
-		++table->partials;
-	    } else {
+	    if (bucket == &table->buckets[HashHash(key) & mask])
 		++table->hits;
-	    }
+	    else
+		++table->partials;
 	    return bucket;
 	}
-	prev = bucket;
     }
     ++table->misses;
+    if (slot) *slot = first ? first : bucket;
     return NULL;
 }
 
@@ -181,35 +178,45 @@ drm_public int drmHashInsert(void *t, unsigned long key, void *value)
 {
     HashTablePtr  table = (HashTablePtr)t;
     HashBucketPtr bucket;
-    unsigned long hash;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    if (HashFind(table, key, &hash)) return 1; /* Already in table */
+    if (HashFind(table, key, &bucket)) return 1; /* Already in table */
 
-    bucket               = drmMalloc(sizeof(*bucket));
-    if (!bucket) return -1;	/* Error */
-    bucket->key          = key;
-    bucket->value        = value;
-    bucket->next         = table->buckets[hash];
-    table->buckets[hash] = bucket;
+    if (bucket->state == HASH_BUCKET_EMPTY &&
+	(table->entries + table->tombstones + 1) * 4 > table->size * 3) {
+				/* Grow, or just drop the tombstones */
+	unsigned long size = table->size;
+
+	if ((table->entries + 1) * 2 > size) size *= 2;
+	if (HashResize(table, size)) return -1; /* Error */
+	HashFind(table, key, &bucket);
+	--table->misses;
+    }
+
+    if (bucket->state == HASH_BUCKET_DELETED) --table->tombstones;
+    bucket->key   = key;
+    bucket->value = value;
+    bucket->state = HASH_BUCKET_USED;
+    ++table->entries;
     return 0;			/* Added to table */
 }
 
 drm_public int drmHashDelete(void *t, unsigned long key)
 {
     HashTablePtr  table = (HashTablePtr)t;
-    unsigned long hash;
     HashBucketPtr bucket;
 
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
-    bucket = HashFind(table, key, &hash);
+    bucket = HashFind(table, key, NULL);
 
     if (!bucket) return 1;	/* Not found */
 
-    table->buckets[hash] = bucket->next;
-    drmFree(bucket);
+    bucket->state = HASH_BUCKET_DELETED;
+    bucket->value = NULL;
+    --table->entries;
+    ++table->tombstones;
     return 0;
 }
 
@@ -217,15 +224,14 @@ drm_public int drmHashNext(void *t, unsigned long *key, void **value)
 {
     HashTablePtr  table = (HashTablePtr)t;
 
-    while (table->p0 < HASH_SIZE) {
-	if (table->p1) {
-	    *key       = table->p1->key;
-	    *value     = table->p1->value;
-	    table->p1  = table->p1->next;
+    while (table->p0 < table->size) {
+	HashBucketPtr bucket = &table->buckets[table->p0++];
+
+	if (bucket->state == HASH_BUCKET_USED) {
+	    *key   = bucket->key;
+	    *value = bucket->value;
 	    return 1;
 	}
-	table->p1 = table->buckets[table->p0];
-	++table->p0;
     }
     return 0;
 }
@@ -237,6 +243,5 @@ drm_public int drmHashFirst(void *t, unsigned long *key, void **value)
     if (table->magic != HASH_MAGIC) return -1; /* Bad magic */
 
     table->p0 = 0;
-    table->p1 = table->buckets[0];
     return drmHashNext(table, key, value);
 }
@@ -24,24 +24,26 @@
  * Authors: Rickard E. (Rik) Faith <faith@valinux.com>
  */
 
-#define HASH_SIZE  512		/* Good for about 100 entries */
-				/* If you change this value, you probably
-                                   have to change the HashHash hashing
-                                   function! */
+#define HASH_MIN_SIZE  32	/* Initial number of buckets, power of two */
+
+#define HASH_BUCKET_EMPTY    0
+#define HASH_BUCKET_USED     1
+#define HASH_BUCKET_DELETED  2
 
 typedef struct HashBucket {
     unsigned long     key;
     void              *value;
-    struct HashBucket *next;
+    int               state;
 } HashBucket, *HashBucketPtr;
 
 typedef struct HashTable {
     unsigned long    magic;
     unsigned long    entries;
-    unsigned long    hits;	/* At top of linked list */
-    unsigned long    partials;	/* Not at top of linked list */
+    unsigned long    hits;	/* Found in the home bucket */
+    unsigned long    partials;	/* Found after probing */
     unsigned long    misses;	/* Not in table */
-    HashBucketPtr    buckets[HASH_SIZE];
-    int              p0;
-    HashBucketPtr    p1;
+    unsigned long    size;	/* Number of buckets, power of two */
+    unsigned long    tombstones; /* Deleted buckets */
+    HashBucketPtr    buckets;
+    unsigned long    p0;
 } HashTable, *HashTablePtr;
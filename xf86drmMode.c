@@ -33,6 +33,7 @@
  *
  */
 
+#include <fcntl.h>
 #include <limits.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -45,8 +46,13 @@
 #endif
 #include <stdio.h>
 #include <stdbool.h>
+#include <math.h>
 
 #include "libdrm_macros.h"
+#include "util_math.h"
+#include "util_grow.h"
+#include "util_sync_file.h"
+#include "util_trace.h"
 #include "xf86drmMode.h"
 #include "xf86drm.h"
 #include <drm.h>
@@ -54,6 +60,19 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#ifdef MAJOR_IN_MKDEV
+#include <sys/mkdev.h>
+#endif
+#ifdef MAJOR_IN_SYSMACROS
+#include <sys/sysmacros.h>
+#endif
+#ifdef __linux__
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#endif
 
 #define memclear(s) memset(&s, 0, sizeof(s))
 
@@ -87,6 +106,129 @@ static void* drmAllocCpy(char *array, int count, int entry_size)
 	return r;
 }
 
+/* FNV-1a, start with DRM_MODE_HASH_INIT */
+#define DRM_MODE_HASH_INIT 0xcbf29ce484222325ull
+
+static uint64_t drmModeHashData(uint64_t hash, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+/*
+ * Per-thread free lists for the small fixed-size objects handed out by the
+ * query helpers, so that repeatedly querying and freeing CRTCs, encoders
+ * and properties does not go back to the (possibly contended) allocator.
+ * Pooled objects are ordinary drmMalloc() memory.
+ */
+#define DRM_MODE_POOL_MAX 32 /* Objects kept per class and thread */
+
+enum drm_mode_pool_class {
+	DRM_MODE_POOL_CRTC,
+	DRM_MODE_POOL_ENCODER,
+	DRM_MODE_POOL_PROPERTY,
+	DRM_MODE_POOL_COUNT
+};
+
+static const size_t drm_mode_pool_sizes[DRM_MODE_POOL_COUNT] = {
+	[DRM_MODE_POOL_CRTC] = sizeof(drmModeCrtc),
+	[DRM_MODE_POOL_ENCODER] = sizeof(drmModeEncoder),
+	[DRM_MODE_POOL_PROPERTY] = sizeof(drmModePropertyRes),
+};
+
+struct drm_mode_pool_item {
+	struct drm_mode_pool_item *next;
+};
+
+struct drm_mode_pool {
+	struct drm_mode_pool_item *items[DRM_MODE_POOL_COUNT];
+	unsigned int count[DRM_MODE_POOL_COUNT];
+};
+
+static pthread_once_t drm_mode_pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t drm_mode_pool_key;
+static bool drm_mode_pool_enabled;
+
+static void drmModePoolDestroy(void *data)
+{
+	struct drm_mode_pool *pool = data;
+	struct drm_mode_pool_item *item;
+	int i;
+
+	for (i = 0; i < DRM_MODE_POOL_COUNT; i++) {
+		while ((item = pool->items[i])) {
+			pool->items[i] = item->next;
+			drmFree(item);
+		}
+	}
+	free(pool);
+}
+
+static void drmModePoolInit(void)
+{
+	drm_mode_pool_enabled = !getenv("LIBDRM_NO_OBJECT_POOL") &&
+		!pthread_key_create(&drm_mode_pool_key, drmModePoolDestroy);
+}
+
+static struct drm_mode_pool *drmModePoolGet(void)
+{
+	struct drm_mode_pool *pool;
+
+	pthread_once(&drm_mode_pool_once, drmModePoolInit);
+	if (!drm_mode_pool_enabled)
+		return NULL;
+
+	pool = pthread_getspecific(drm_mode_pool_key);
+	if (pool)
+		return pool;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool && pthread_setspecific(drm_mode_pool_key, pool)) {
+		free(pool);
+		pool = NULL;
+	}
+	return pool;
+}
+
+static void *drmModePoolAlloc(enum drm_mode_pool_class class)
+{
+	struct drm_mode_pool *pool = drmModePoolGet();
+	struct drm_mode_pool_item *item;
+
+	if (!pool || !pool->items[class])
+		return drmMalloc(drm_mode_pool_sizes[class]);
+
+	item = pool->items[class];
+	pool->items[class] = item->next;
+	pool->count[class]--;
+	memset(item, 0, drm_mode_pool_sizes[class]);
+	return item;
+}
+
+static void drmModePoolFree(enum drm_mode_pool_class class, void *ptr)
+{
+	struct drm_mode_pool *pool;
+	struct drm_mode_pool_item *item = ptr;
+
+	if (!ptr)
+		return;
+
+	pool = drmModePoolGet();
+	if (!pool || pool->count[class] >= DRM_MODE_POOL_MAX) {
+		drmFree(ptr);
+		return;
+	}
+
+	item->next = pool->items[class];
+	pool->items[class] = item;
+	pool->count[class]++;
+}
+
 /*
  * A couple of free functions.
  */
@@ -122,10 +264,7 @@ drm_public void drmModeFreeFB(drmModeFBPtr ptr)
 
 drm_public void drmModeFreeCrtc(drmModeCrtcPtr ptr)
 {
-	if (!ptr)
-		return;
-
-	drmFree(ptr);
+	drmModePoolFree(DRM_MODE_POOL_CRTC, ptr);
 }
 
 drm_public void drmModeFreeConnector(drmModeConnectorPtr ptr)
@@ -142,7 +281,7 @@ drm_public void drmModeFreeConnector(drmModeConnectorPtr ptr)
 
 drm_public void drmModeFreeEncoder(drmModeEncoderPtr ptr)
 {
-	drmFree(ptr);
+	drmModePoolFree(DRM_MODE_POOL_ENCODER, ptr);
 }
 
 /*
@@ -313,8 +452,336 @@ drm_public int drmModeAddFB2(int fd, uint32_t width, uint32_t height,
 					  buf_id, flags);
 }
 
+/*
+ * Framebuffer cache, see drmModeAddFB2Cached().
+ */
+#define DRM_FB_CACHE_MAX_IDLE 16 /* Released framebuffers kept per fd */
+
+struct drm_fb_cache_entry {
+	struct drm_fb_cache_entry *next;	/* Same key hash */
+	struct drm_fb_cache_entry *idle_prev, *idle_next;
+	struct drm_mode_fb_cmd2 cmd;		/* fb_id is not part of the key */
+	unsigned long hash;
+	uint32_t refs;
+};
+
+struct drm_fb_cache {
+	void *by_key;	/* key hash -> struct drm_fb_cache_entry chain */
+	void *by_id;	/* fb id -> struct drm_fb_cache_entry */
+	struct drm_fb_cache_entry idle;	/* Released entries, oldest last */
+	drmModeFBCacheStats stats;
+};
+
+static pthread_mutex_t drm_fb_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *drm_fb_caches; /* fd -> struct drm_fb_cache */
+
+static struct drm_fb_cache *drmModeFBCacheGet(int fd, bool create)
+{
+	struct drm_fb_cache *cache;
+	void *value;
+
+	if (!drm_fb_caches) {
+		if (!create)
+			return NULL;
+		drm_fb_caches = drmHashCreate();
+		if (!drm_fb_caches)
+			return NULL;
+	}
+
+	if (!drmHashLookup(drm_fb_caches, fd, &value))
+		return value;
+	if (!create)
+		return NULL;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->idle.idle_prev = cache->idle.idle_next = &cache->idle;
+	cache->by_key = drmHashCreate();
+	cache->by_id = drmHashCreate();
+	if (!cache->by_key || !cache->by_id ||
+	    drmHashInsert(drm_fb_caches, fd, cache)) {
+		if (cache->by_key)
+			drmHashDestroy(cache->by_key);
+		if (cache->by_id)
+			drmHashDestroy(cache->by_id);
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+static void drmModeFBCacheIdleRemove(struct drm_fb_cache *cache,
+				     struct drm_fb_cache_entry *entry)
+{
+	entry->idle_prev->idle_next = entry->idle_next;
+	entry->idle_next->idle_prev = entry->idle_prev;
+	entry->idle_prev = entry->idle_next = NULL;
+	cache->stats.idle--;
+}
+
+/* Drop an entry from the cache, and its framebuffer too if it is idle and
+ * rmfb is set. */
+static void drmModeFBCacheRemove(int fd, struct drm_fb_cache *cache,
+				 struct drm_fb_cache_entry *entry, bool rmfb)
+{
+	struct drm_fb_cache_entry *head;
+	void *value;
+
+	drmHashDelete(cache->by_id, entry->cmd.fb_id);
+	if (!drmHashLookup(cache->by_key, entry->hash, &value)) {
+		head = value;
+		if (head == entry) {
+			drmHashDelete(cache->by_key, entry->hash);
+			if (entry->next)
+				drmHashInsert(cache->by_key, entry->hash,
+					      entry->next);
+		} else {
+			for (; head->next; head = head->next) {
+				if (head->next == entry) {
+					head->next = entry->next;
+					break;
+				}
+			}
+		}
+	}
+
+	if (!entry->refs) {
+		drmModeFBCacheIdleRemove(cache, entry);
+		if (rmfb)
+			drmIoctl(fd, DRM_IOCTL_MODE_RMFB, &entry->cmd.fb_id);
+	}
+	cache->stats.entries--;
+	if (rmfb)
+		cache->stats.evictions++;
+	free(entry);
+}
+
+drm_public int drmModeAddFB2Cached(int fd, uint32_t width, uint32_t height,
+				   uint32_t pixel_format,
+				   const uint32_t bo_handles[4],
+				   const uint32_t pitches[4],
+				   const uint32_t offsets[4],
+				   const uint64_t modifier[4], uint32_t *buf_id,
+				   uint32_t flags)
+{
+	struct drm_fb_cache_entry *entry, *head = NULL;
+	struct drm_fb_cache *cache;
+	struct drm_mode_fb_cmd2 key;
+	unsigned long hash;
+	void *value;
+	int ret;
+
+	memclear(key);
+	key.width  = width;
+	key.height = height;
+	key.pixel_format = pixel_format;
+	key.flags = flags;
+	memcpy(key.handles, bo_handles, 4 * sizeof(bo_handles[0]));
+	memcpy(key.pitches, pitches, 4 * sizeof(pitches[0]));
+	memcpy(key.offsets, offsets, 4 * sizeof(offsets[0]));
+	if (modifier)
+		memcpy(key.modifier, modifier, 4 * sizeof(modifier[0]));
+	hash = drmModeHashData(DRM_MODE_HASH_INIT, &key, sizeof(key));
+
+	pthread_mutex_lock(&drm_fb_cache_lock);
+	cache = drmModeFBCacheGet(fd, true);
+	if (!cache) {
+		pthread_mutex_unlock(&drm_fb_cache_lock);
+		return drmModeAddFB2WithModifiers(fd, width, height,
+						  pixel_format, bo_handles,
+						  pitches, offsets, modifier,
+						  buf_id, flags);
+	}
+
+	if (!drmHashLookup(cache->by_key, hash, &value))
+		head = value;
+
+	for (entry = head; entry; entry = entry->next) {
+		struct drm_mode_fb_cmd2 cmd = entry->cmd;
+
+		cmd.fb_id = 0;
+		if (!memcmp(&cmd, &key, sizeof(key))) {
+			if (!entry->refs++)
+				drmModeFBCacheIdleRemove(cache, entry);
+			cache->stats.hits++;
+			*buf_id = entry->cmd.fb_id;
+			pthread_mutex_unlock(&drm_fb_cache_lock);
+			return 0;
+		}
+	}
+
+	cache->stats.misses++;
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_ADDFB2, &key);
+	if (ret)
+		goto out;
+	*buf_id = key.fb_id;
+
+	/* Without bookkeeping the framebuffer is simply not cached. */
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		goto out;
+
+	entry->cmd = key;
+	entry->hash = hash;
+	entry->refs = 1;
+	if (drmHashInsert(cache->by_id, key.fb_id, entry)) {
+		free(entry);
+		goto out;
+	}
+
+	if (head) {
+		entry->next = head->next;
+		head->next = entry;
+	} else if (drmHashInsert(cache->by_key, hash, entry)) {
+		drmHashDelete(cache->by_id, key.fb_id);
+		free(entry);
+		goto out;
+	}
+	cache->stats.entries++;
+
+out:
+	pthread_mutex_unlock(&drm_fb_cache_lock);
+	return ret;
+}
+
+/**
+ * Release a framebuffer obtained from drmModeAddFB2Cached(). It is kept
+ * for reuse, evicting the oldest released framebuffer if too many are.
+ * Framebuffers unknown to the cache are removed right away.
+ */
+drm_public int drmModeReleaseFBCached(int fd, uint32_t buf_id)
+{
+	struct drm_fb_cache_entry *entry;
+	struct drm_fb_cache *cache;
+	void *value;
+
+	pthread_mutex_lock(&drm_fb_cache_lock);
+	cache = drmModeFBCacheGet(fd, false);
+	if (!cache || drmHashLookup(cache->by_id, buf_id, &value)) {
+		pthread_mutex_unlock(&drm_fb_cache_lock);
+		return DRM_IOCTL(fd, DRM_IOCTL_MODE_RMFB, &buf_id);
+	}
+
+	entry = value;
+	if (entry->refs && !--entry->refs) {
+		entry->idle_next = cache->idle.idle_next;
+		entry->idle_prev = &cache->idle;
+		entry->idle_next->idle_prev = entry;
+		cache->idle.idle_next = entry;
+		if (++cache->stats.idle > DRM_FB_CACHE_MAX_IDLE)
+			drmModeFBCacheRemove(fd, cache, cache->idle.idle_prev,
+					     true);
+	}
+	pthread_mutex_unlock(&drm_fb_cache_lock);
+	return 0;
+}
+
+/**
+ * Evict every cached framebuffer using a GEM handle, before it is closed.
+ * Released framebuffers are removed, the ones still in use are forgotten
+ * and removed by their final drmModeReleaseFBCached().
+ *
+ * \return the number of framebuffers evicted.
+ */
+drm_public int drmModeFBCacheEvictHandle(int fd, uint32_t bo_handle)
+{
+	struct drm_fb_cache_entry **victims = NULL, **tmp;
+	struct drm_fb_cache *cache;
+	unsigned long key;
+	void *value;
+	int count = 0, size = 0, i, j;
+
+	pthread_mutex_lock(&drm_fb_cache_lock);
+	cache = drmModeFBCacheGet(fd, false);
+	if (cache && drmHashFirst(cache->by_id, &key, &value) == 1) {
+		do {
+			struct drm_fb_cache_entry *entry = value;
+
+			for (j = 0; j < 4; j++)
+				if (entry->cmd.handles[j] == bo_handle)
+					break;
+			if (j == 4)
+				continue;
+
+			if (count == size) {
+				size = size ? size * 2 : 8;
+				tmp = realloc(victims, size * sizeof(*victims));
+				if (!tmp)
+					break;
+				victims = tmp;
+			}
+			victims[count++] = entry;
+		} while (drmHashNext(cache->by_id, &key, &value));
+	}
+
+	/* The table must not change while it is being walked. */
+	for (i = 0; i < count; i++)
+		drmModeFBCacheRemove(fd, cache, victims[i], true);
+	pthread_mutex_unlock(&drm_fb_cache_lock);
+
+	free(victims);
+	return count;
+}
+
+/**
+ * Remove all released framebuffers of fd and forget the ones in use.
+ */
+drm_public void drmModeFBCacheFlush(int fd)
+{
+	struct drm_fb_cache_entry *entry;
+	struct drm_fb_cache *cache;
+	unsigned long key;
+	void *value;
+
+	pthread_mutex_lock(&drm_fb_cache_lock);
+	cache = drmModeFBCacheGet(fd, false);
+	if (cache) {
+		drmHashDelete(drm_fb_caches, fd);
+		if (drmHashFirst(cache->by_id, &key, &value) == 1) {
+			do {
+				entry = value;
+				if (!entry->refs)
+					drmIoctl(fd, DRM_IOCTL_MODE_RMFB,
+						 &entry->cmd.fb_id);
+				free(entry);
+			} while (drmHashNext(cache->by_id, &key, &value));
+		}
+		drmHashDestroy(cache->by_id);
+		drmHashDestroy(cache->by_key);
+		free(cache);
+	}
+	pthread_mutex_unlock(&drm_fb_cache_lock);
+}
+
+drm_public int drmModeFBCacheGetStats(int fd, drmModeFBCacheStatsPtr stats)
+{
+	struct drm_fb_cache *cache;
+
+	pthread_mutex_lock(&drm_fb_cache_lock);
+	cache = drmModeFBCacheGet(fd, false);
+	if (cache)
+		*stats = cache->stats;
+	else
+		memset(stats, 0, sizeof(*stats));
+	pthread_mutex_unlock(&drm_fb_cache_lock);
+	return 0;
+}
+
 drm_public int drmModeRmFB(int fd, uint32_t bufferId)
 {
+	struct drm_fb_cache *cache;
+	void *value;
+
+	/* Don't let the cache hand out a removed framebuffer. */
+	pthread_mutex_lock(&drm_fb_cache_lock);
+	cache = drmModeFBCacheGet(fd, false);
+	if (cache && !drmHashLookup(cache->by_id, bufferId, &value))
+		drmModeFBCacheRemove(fd, cache, value, false);
+	pthread_mutex_unlock(&drm_fb_cache_lock);
+
 	return DRM_IOCTL(fd, DRM_IOCTL_MODE_RMFB, &bufferId);
 }
 
@@ -375,7 +842,7 @@ drm_public drmModeCrtcPtr drmModeGetCrtc(int fd, uint32_t crtcId)
 	 * return
 	 */
 
-	if (!(r = drmMalloc(sizeof(*r))))
+	if (!(r = drmModePoolAlloc(DRM_MODE_POOL_CRTC)))
 		return 0;
 
 	r->crtc_id         = crtc.crtc_id;
@@ -477,7 +944,7 @@ drm_public drmModeEncoderPtr drmModeGetEncoder(int fd, uint32_t encoder_id)
 	if (drmIoctl(fd, DRM_IOCTL_MODE_GETENCODER, &enc))
 		return 0;
 
-	if (!(r = drmMalloc(sizeof(*r))))
+	if (!(r = drmModePoolAlloc(DRM_MODE_POOL_ENCODER)))
 		return 0;
 
 	r->encoder_id = enc.encoder_id;
@@ -608,132 +1075,624 @@ drm_public drmModeConnectorPtr drmModeGetConnectorCurrent(int fd, uint32_t conne
 	return _drmModeGetConnector(fd, connector_id, 0);
 }
 
-drm_public int drmModeAttachMode(int fd, uint32_t connector_id, drmModeModeInfoPtr mode_info)
+/* Initial capacities when there is no previous probe to size from. */
+#define DRM_CONNECTOR_DEFAULT_PROPS    32
+#define DRM_CONNECTOR_DEFAULT_ENCODERS 4
+#define DRM_CONNECTOR_DEFAULT_MODES    32
+
+struct drm_connector_arrays {
+	uint32_t *props;
+	uint64_t *prop_values;
+	uint32_t *encoders;
+	struct drm_mode_modeinfo *modes;
+	uint32_t cap_props, cap_encoders, cap_modes;
+};
+
+/* Make room for at least the given number of elements in each array.  The
+ * previous contents are not preserved, the kernel refills them anyway.  The
+ * arrays end up in the returned connector, so they come from drmMalloc(). */
+static int drmModeConnectorReserve(struct drm_connector_arrays *a,
+				   uint32_t props, uint32_t encoders,
+				   uint32_t modes)
 {
-	struct drm_mode_mode_cmd res;
+	if (props > a->cap_props || !a->props) {
+		props = MAX2(props, 1);
+		drmFree(a->props);
+		drmFree(a->prop_values);
+		a->props = drmMalloc(props * sizeof(*a->props));
+		a->prop_values = drmMalloc(props * sizeof(*a->prop_values));
+		a->cap_props = props;
+		if (!a->props || !a->prop_values)
+			return -ENOMEM;
+	}
 
-	memclear(res);
-	memcpy(&res.mode, mode_info, sizeof(struct drm_mode_modeinfo));
-	res.connector_id = connector_id;
+	if (encoders > a->cap_encoders || !a->encoders) {
+		encoders = MAX2(encoders, 1);
+		drmFree(a->encoders);
+		a->encoders = drmMalloc(encoders * sizeof(*a->encoders));
+		a->cap_encoders = encoders;
+		if (!a->encoders)
+			return -ENOMEM;
+	}
 
-	return DRM_IOCTL(fd, DRM_IOCTL_MODE_ATTACHMODE, &res);
+	if (modes > a->cap_modes) {
+		drmFree(a->modes);
+		a->modes = drmMalloc(modes * sizeof(*a->modes));
+		a->cap_modes = modes;
+		if (!a->modes)
+			return -ENOMEM;
+	}
+
+	return 0;
 }
 
-drm_public int drmModeDetachMode(int fd, uint32_t connector_id, drmModeModeInfoPtr mode_info)
+drm_public drmModeConnectorPtr drmModeGetConnector2(int fd,
+						    uint32_t connector_id,
+						    drmModeConnectorPtr prev,
+						    uint32_t flags)
 {
-	struct drm_mode_mode_cmd res;
+	struct drm_connector_arrays a = { 0 };
+	struct drm_mode_get_connector conn;
+	struct drm_mode_modeinfo stack_mode;
+	bool want_modes = !(flags & DRM_MODE_GET_CONNECTOR_NO_MODES);
+	bool probe = flags & DRM_MODE_GET_CONNECTOR_PROBE;
+	drmModeConnectorPtr r;
 
-	memclear(res);
-	memcpy(&res.mode, mode_info, sizeof(struct drm_mode_modeinfo));
-	res.connector_id = connector_id;
+	if (flags & ~(DRM_MODE_GET_CONNECTOR_PROBE |
+		      DRM_MODE_GET_CONNECTOR_NO_MODES))
+		return NULL;
 
-	return DRM_IOCTL(fd, DRM_IOCTL_MODE_DETACHMODE, &res);
-}
+	if (drmModeConnectorReserve(&a,
+				    prev ? prev->count_props : DRM_CONNECTOR_DEFAULT_PROPS,
+				    prev ? prev->count_encoders : DRM_CONNECTOR_DEFAULT_ENCODERS,
+				    !want_modes ? 0 :
+				    prev ? prev->count_modes : DRM_CONNECTOR_DEFAULT_MODES))
+		goto err;
+
+	for (;;) {
+		memclear(conn);
+		conn.connector_id = connector_id;
+		conn.count_props = a.cap_props;
+		conn.props_ptr = VOID2U64(a.props);
+		conn.prop_values_ptr = VOID2U64(a.prop_values);
+		conn.count_encoders = a.cap_encoders;
+		conn.encoders_ptr = VOID2U64(a.encoders);
+
+		/* A zero mode count is what asks the kernel to probe, and
+		 * the probed modes can only be fetched by a second call. */
+		if (probe) {
+			conn.count_modes = 0;
+		} else if (want_modes && a.cap_modes) {
+			conn.count_modes = a.cap_modes;
+			conn.modes_ptr = VOID2U64(a.modes);
+		} else {
+			conn.count_modes = 1;
+			conn.modes_ptr = VOID2U64(&stack_mode);
+		}
 
-drm_public drmModePropertyPtr drmModeGetProperty(int fd, uint32_t property_id)
-{
-	struct drm_mode_get_property prop;
-	drmModePropertyPtr r;
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn))
+			goto err;
+
+		if (probe) {
+			probe = false;
+			if (want_modes && conn.count_modes) {
+				/* Fetch the freshly probed modes. */
+				if (drmModeConnectorReserve(&a, conn.count_props,
+							    conn.count_encoders,
+							    conn.count_modes))
+					goto err;
+				continue;
+			}
+		}
 
-	memclear(prop);
-	prop.prop_id = property_id;
+		/* The kernel silently skips arrays that are too small. */
+		if (conn.count_props <= a.cap_props &&
+		    conn.count_encoders <= a.cap_encoders &&
+		    (!want_modes || conn.count_modes <= a.cap_modes))
+			break;
 
-	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPROPERTY, &prop))
-		return 0;
+		if (drmModeConnectorReserve(&a, conn.count_props,
+					    conn.count_encoders,
+					    want_modes ? conn.count_modes : 0))
+			goto err;
+	}
 
-	if (prop.count_values)
-		prop.values_ptr = VOID2U64(drmMalloc(prop.count_values * sizeof(uint64_t)));
+	r = drmMalloc(sizeof(*r));
+	if (!r)
+		goto err;
 
-	if (prop.count_enum_blobs && (prop.flags & (DRM_MODE_PROP_ENUM | DRM_MODE_PROP_BITMASK)))
-		prop.enum_blob_ptr = VOID2U64(drmMalloc(prop.count_enum_blobs * sizeof(struct drm_mode_property_enum)));
+	r->connector_id = conn.connector_id;
+	r->encoder_id = conn.encoder_id;
+	r->connection   = conn.connection;
+	r->mmWidth      = conn.mm_width;
+	r->mmHeight     = conn.mm_height;
+	/* convert subpixel from kernel to userspace */
+	r->subpixel     = conn.subpixel + 1;
+	r->count_props  = conn.count_props;
+	r->props        = a.props;
+	r->prop_values  = a.prop_values;
+	r->count_encoders = conn.count_encoders;
+	r->encoders     = a.encoders;
+	r->count_modes  = want_modes ? conn.count_modes : 0;
+	r->modes        = (drmModeModeInfoPtr)a.modes;
+	r->connector_type  = conn.connector_type;
+	r->connector_type_id = conn.connector_type_id;
 
-	if (prop.count_enum_blobs && (prop.flags & DRM_MODE_PROP_BLOB)) {
-		prop.values_ptr = VOID2U64(drmMalloc(prop.count_enum_blobs * sizeof(uint32_t)));
-		prop.enum_blob_ptr = VOID2U64(drmMalloc(prop.count_enum_blobs * sizeof(uint32_t)));
-	}
+	return r;
 
-	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPROPERTY, &prop)) {
-		r = NULL;
-		goto err_allocs;
-	}
+err:
+	drmFree(a.props);
+	drmFree(a.prop_values);
+	drmFree(a.encoders);
+	drmFree(a.modes);
+	return NULL;
+}
 
-	if (!(r = drmMalloc(sizeof(*r))))
-		goto err_allocs;
+/*
+ * Persistent connector cache, see drmModeConnectorCacheOpen().
+ */
+#define DRM_CONNECTOR_CACHE_MAGIC	0x4343444d	/* "MDCC" */
+#define DRM_CONNECTOR_CACHE_VERSION	1
+#define DRM_CONNECTOR_CACHE_MAX_MODES	1024	/* Sanity check of the file */
 
-	r->prop_id = prop.prop_id;
-	r->count_values = prop.count_values;
+struct drm_connector_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t pad;
+};
 
-	r->flags = prop.flags;
-	if (prop.count_values)
-		r->values = drmAllocCpy(U642VOID(prop.values_ptr), prop.count_values, sizeof(uint64_t));
-	if (prop.flags & (DRM_MODE_PROP_ENUM | DRM_MODE_PROP_BITMASK)) {
-		r->count_enums = prop.count_enum_blobs;
-		r->enums = drmAllocCpy(U642VOID(prop.enum_blob_ptr), prop.count_enum_blobs, sizeof(struct drm_mode_property_enum));
-	} else if (prop.flags & DRM_MODE_PROP_BLOB) {
-		r->values = drmAllocCpy(U642VOID(prop.values_ptr), prop.count_enum_blobs, sizeof(uint32_t));
-		r->blob_ids = drmAllocCpy(U642VOID(prop.enum_blob_ptr), prop.count_enum_blobs, sizeof(uint32_t));
-		r->count_blobs = prop.count_enum_blobs;
-	}
-	strncpy(r->name, prop.name, DRM_PROP_NAME_LEN);
-	r->name[DRM_PROP_NAME_LEN-1] = 0;
+/* Followed by the modes in the file. */
+struct drm_connector_cache_record {
+	uint64_t device;	/* Hash of the bus of the device */
+	uint32_t connector_type;
+	uint32_t connector_type_id;
+	uint64_t edid;		/* Hash of the EDID, 0 without one */
+	uint32_t connection;
+	uint32_t mm_width;
+	uint32_t mm_height;
+	uint32_t subpixel;
+	uint32_t count_modes;
+	uint32_t pad;
+};
 
-err_allocs:
-	drmFree(U642VOID(prop.values_ptr));
-	drmFree(U642VOID(prop.enum_blob_ptr));
+struct drm_connector_cache_entry {
+	struct drm_connector_cache_entry *next;
+	struct drm_connector_cache_record record;
+	struct drm_mode_modeinfo *modes;
+};
 
-	return r;
-}
+struct _drmModeConnectorCache {
+	int fd;
+	char *path;
+	uint64_t device;
+	bool dirty;
+	struct drm_connector_cache_entry *entries;
+};
 
-drm_public void drmModeFreeProperty(drmModePropertyPtr ptr)
+static int drmModeConnectorCacheDevice(int fd, uint64_t *device)
 {
-	if (!ptr)
-		return;
+	char bus[DRM_PLATFORM_DEVICE_NAME_LEN + 16];
+	drmDevicePtr dev;
+
+	if (drmGetDevice2(fd, 0, &dev))
+		return -ENODEV;
+
+	switch (dev->bustype) {
+	case DRM_BUS_PCI:
+		snprintf(bus, sizeof(bus), "pci:%04x:%02x:%02x.%u",
+			 dev->businfo.pci->domain, dev->businfo.pci->bus,
+			 dev->businfo.pci->dev, dev->businfo.pci->func);
+		break;
+	case DRM_BUS_USB:
+		snprintf(bus, sizeof(bus), "usb:%03u:%03u",
+			 dev->businfo.usb->bus, dev->businfo.usb->dev);
+		break;
+	case DRM_BUS_PLATFORM:
+		snprintf(bus, sizeof(bus), "platform:%s",
+			 dev->businfo.platform->fullname);
+		break;
+	case DRM_BUS_HOST1X:
+		snprintf(bus, sizeof(bus), "host1x:%s",
+			 dev->businfo.host1x->fullname);
+		break;
+	default:
+		drmFreeDevice(&dev);
+		return -ENODEV;
+	}
+	drmFreeDevice(&dev);
 
-	drmFree(ptr->values);
-	drmFree(ptr->enums);
-	drmFree(ptr->blob_ids);
-	drmFree(ptr);
+	*device = drmModeHashData(DRM_MODE_HASH_INIT, bus, strlen(bus));
+	return 0;
 }
 
-drm_public drmModePropertyBlobPtr drmModeGetPropertyBlob(int fd,
-														 uint32_t blob_id)
+static void drmModeConnectorCacheFreeEntries(drmModeConnectorCachePtr cache)
+{
+	struct drm_connector_cache_entry *entry, *next;
+
+	for (entry = cache->entries; entry; entry = next) {
+		next = entry->next;
+		free(entry->modes);
+		free(entry);
+	}
+	cache->entries = NULL;
+}
+
+/* Read the entries of the file, dropping them all if it is invalid. */
+static void drmModeConnectorCacheLoad(drmModeConnectorCachePtr cache)
+{
+	struct drm_connector_cache_header header;
+	struct drm_connector_cache_entry *entry, **tail = &cache->entries;
+	uint32_t i;
+	FILE *file;
+
+	file = fopen(cache->path, "rbe");
+	if (!file)
+		return;
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    header.magic != DRM_CONNECTOR_CACHE_MAGIC ||
+	    header.version != DRM_CONNECTOR_CACHE_VERSION)
+		goto out;
+
+	for (i = 0; i < header.count; i++) {
+		entry = calloc(1, sizeof(*entry));
+		if (!entry)
+			goto invalid;
+		*tail = entry;
+		tail = &entry->next;
+
+		if (fread(&entry->record, sizeof(entry->record), 1, file) != 1 ||
+		    entry->record.count_modes > DRM_CONNECTOR_CACHE_MAX_MODES)
+			goto invalid;
+		if (!entry->record.count_modes)
+			continue;
+
+		entry->modes = calloc(entry->record.count_modes,
+				      sizeof(*entry->modes));
+		if (!entry->modes ||
+		    fread(entry->modes, sizeof(*entry->modes),
+			  entry->record.count_modes, file) !=
+		    entry->record.count_modes)
+			goto invalid;
+	}
+	goto out;
+
+invalid:
+	drmModeConnectorCacheFreeEntries(cache);
+out:
+	fclose(file);
+}
+
+drm_public drmModeConnectorCachePtr drmModeConnectorCacheOpen(int fd,
+							      const char *path)
+{
+	drmModeConnectorCachePtr cache;
+	int ret;
+
+	if (!path) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	ret = drmModeConnectorCacheDevice(fd, &cache->device);
+	if (ret) {
+		free(cache);
+		errno = -ret;
+		return NULL;
+	}
+
+	cache->fd = fd;
+	cache->path = strdup(path);
+	if (!cache->path) {
+		free(cache);
+		return NULL;
+	}
+
+	drmModeConnectorCacheLoad(cache);
+	return cache;
+}
+
+drm_public void drmModeConnectorCacheClose(drmModeConnectorCachePtr cache)
+{
+	if (!cache)
+		return;
+
+	drmModeConnectorCacheFreeEntries(cache);
+	free(cache->path);
+	free(cache);
+}
+
+static struct drm_connector_cache_entry *
+drmModeConnectorCacheFind(drmModeConnectorCachePtr cache,
+			  drmModeConnectorPtr connector)
+{
+	struct drm_connector_cache_entry *entry;
+
+	for (entry = cache->entries; entry; entry = entry->next) {
+		if (entry->record.device == cache->device &&
+		    entry->record.connector_type == connector->connector_type &&
+		    entry->record.connector_type_id == connector->connector_type_id)
+			return entry;
+	}
+	return NULL;
+}
+
+/* Hash of the EDID blob of the connector, 0 without one. */
+static uint64_t drmModeConnectorCacheEdid(int fd, drmModeConnectorPtr connector)
 {
-	struct drm_mode_get_blob blob;
-	drmModePropertyBlobPtr r;
+	drmModePropertyBlobPtr blob;
+	uint64_t hash = 0;
+	uint32_t prop_id;
+	int i;
+
+	if (drmModeObjectGetPropertyId(fd, connector->connector_id, "EDID",
+				       &prop_id, NULL))
+		return 0;
+
+	for (i = 0; i < connector->count_props; i++) {
+		if (connector->props[i] != prop_id)
+			continue;
+		if (!connector->prop_values[i])
+			break;
+		blob = drmModeGetPropertyBlob(fd, connector->prop_values[i]);
+		if (blob) {
+			hash = drmModeHashData(DRM_MODE_HASH_INIT, blob->data,
+					       blob->length);
+			drmModeFreePropertyBlob(blob);
+		}
+		break;
+	}
+	return hash;
+}
 
-	memclear(blob);
-	blob.blob_id = blob_id;
+drm_public drmModeConnectorPtr
+drmModeConnectorCacheGet(drmModeConnectorCachePtr cache, uint32_t connector_id,
+			 uint32_t *flags)
+{
+	struct drm_connector_cache_entry *entry;
+	drmModeConnectorPtr connector;
+	drmModeModeInfoPtr modes;
+	uint64_t edid;
+
+	if (flags)
+		*flags = 0;
+	if (!cache)
+		return NULL;
 
-	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPROPBLOB, &blob))
+	connector = drmModeGetConnectorCurrent(cache->fd, connector_id);
+	if (!connector)
 		return NULL;
 
-	if (blob.length)
-		blob.data = VOID2U64(drmMalloc(blob.length));
+	entry = drmModeConnectorCacheFind(cache, connector);
+	if (!entry)
+		return connector;
+
+	/* Not probed yet, unless the EDID shows another monitor */
+	edid = drmModeConnectorCacheEdid(cache->fd, connector);
+	if (edid && edid != entry->record.edid)
+		return connector;
+	if (flags && edid)
+		*flags |= DRM_MODE_CONNECTOR_CACHE_EDID_MATCH;
+
+	/* The kernel only has modes once probed, they are the current ones */
+	if (connector->count_modes)
+		return connector;
+
+	if (entry->record.count_modes) {
+		modes = drmAllocCpy((char *)entry->modes,
+				    entry->record.count_modes,
+				    sizeof(*modes));
+		if (!modes)
+			return connector;
+		drmFree(connector->modes);
+		connector->modes = modes;
+		connector->count_modes = entry->record.count_modes;
+	}
+	if (connector->connection == DRM_MODE_UNKNOWNCONNECTION)
+		connector->connection = entry->record.connection;
+	connector->mmWidth = entry->record.mm_width;
+	connector->mmHeight = entry->record.mm_height;
+	connector->subpixel = entry->record.subpixel;
+	if (flags)
+		*flags |= DRM_MODE_CONNECTOR_CACHE_HIT;
+	return connector;
+}
+
+drm_public int drmModeConnectorCacheUpdate(drmModeConnectorCachePtr cache,
+					   drmModeConnectorPtr connector)
+{
+	struct drm_connector_cache_record record;
+	struct drm_connector_cache_entry *entry;
+	struct drm_mode_modeinfo *modes = NULL;
+	size_t size;
+
+	if (!cache || !connector || connector->count_modes < 0 ||
+	    connector->count_modes > DRM_CONNECTOR_CACHE_MAX_MODES)
+		return -EINVAL;
+
+	memclear(record);
+	record.device = cache->device;
+	record.connector_type = connector->connector_type;
+	record.connector_type_id = connector->connector_type_id;
+	record.edid = drmModeConnectorCacheEdid(cache->fd, connector);
+	record.connection = connector->connection;
+	record.mm_width = connector->mmWidth;
+	record.mm_height = connector->mmHeight;
+	record.subpixel = connector->subpixel;
+	record.count_modes = connector->count_modes;
+	size = record.count_modes * sizeof(*modes);
+
+	entry = drmModeConnectorCacheFind(cache, connector);
+	if (entry && !memcmp(&entry->record, &record, sizeof(record)) &&
+	    (!size || !memcmp(entry->modes, connector->modes, size)))
+		return 0;
+
+	if (size) {
+		modes = malloc(size);
+		if (!modes)
+			return -ENOMEM;
+		memcpy(modes, connector->modes, size);
+	}
+
+	if (!entry) {
+		entry = calloc(1, sizeof(*entry));
+		if (!entry) {
+			free(modes);
+			return -ENOMEM;
+		}
+		entry->next = cache->entries;
+		cache->entries = entry;
+	}
+
+	free(entry->modes);
+	entry->record = record;
+	entry->modes = modes;
+	cache->dirty = true;
+	return 0;
+}
+
+drm_public int drmModeConnectorCacheSave(drmModeConnectorCachePtr cache)
+{
+	struct drm_connector_cache_header header;
+	struct drm_connector_cache_entry *entry;
+	char *tmp;
+	FILE *file;
+	int ret = 0;
+
+	if (!cache)
+		return -EINVAL;
+	if (!cache->dirty)
+		return 0;
+
+	memclear(header);
+	header.magic = DRM_CONNECTOR_CACHE_MAGIC;
+	header.version = DRM_CONNECTOR_CACHE_VERSION;
+	for (entry = cache->entries; entry; entry = entry->next)
+		header.count++;
+
+	if (asprintf(&tmp, "%s.%d.tmp", cache->path, getpid()) < 0)
+		return -ENOMEM;
+
+	file = fopen(tmp, "wbe");
+	if (!file) {
+		ret = -errno;
+		free(tmp);
+		return ret;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		ret = -EIO;
+	for (entry = cache->entries; !ret && entry; entry = entry->next) {
+		if (fwrite(&entry->record, sizeof(entry->record), 1, file) != 1 ||
+		    fwrite(entry->modes, sizeof(*entry->modes),
+			   entry->record.count_modes, file) !=
+		    entry->record.count_modes)
+			ret = -EIO;
+	}
+	if (fclose(file) && !ret)
+		ret = -EIO;
+
+	/* Readers see either the previous file or the whole new one */
+	if (!ret && rename(tmp, cache->path))
+		ret = -errno;
+	if (ret)
+		unlink(tmp);
+	else
+		cache->dirty = false;
+	free(tmp);
+	return ret;
+}
+
+drm_public int drmModeAttachMode(int fd, uint32_t connector_id, drmModeModeInfoPtr mode_info)
+{
+	struct drm_mode_mode_cmd res;
+
+	memclear(res);
+	memcpy(&res.mode, mode_info, sizeof(struct drm_mode_modeinfo));
+	res.connector_id = connector_id;
+
+	return DRM_IOCTL(fd, DRM_IOCTL_MODE_ATTACHMODE, &res);
+}
+
+drm_public int drmModeDetachMode(int fd, uint32_t connector_id, drmModeModeInfoPtr mode_info)
+{
+	struct drm_mode_mode_cmd res;
+
+	memclear(res);
+	memcpy(&res.mode, mode_info, sizeof(struct drm_mode_modeinfo));
+	res.connector_id = connector_id;
+
+	return DRM_IOCTL(fd, DRM_IOCTL_MODE_DETACHMODE, &res);
+}
+
+drm_public drmModePropertyPtr drmModeGetProperty(int fd, uint32_t property_id)
+{
+	struct drm_mode_get_property prop;
+	drmModePropertyPtr r;
+
+	memclear(prop);
+	prop.prop_id = property_id;
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPROPERTY, &prop))
+		return 0;
+
+	if (prop.count_values)
+		prop.values_ptr = VOID2U64(drmMalloc(prop.count_values * sizeof(uint64_t)));
+
+	if (prop.count_enum_blobs && (prop.flags & (DRM_MODE_PROP_ENUM | DRM_MODE_PROP_BITMASK)))
+		prop.enum_blob_ptr = VOID2U64(drmMalloc(prop.count_enum_blobs * sizeof(struct drm_mode_property_enum)));
+
+	if (prop.count_enum_blobs && (prop.flags & DRM_MODE_PROP_BLOB)) {
+		prop.values_ptr = VOID2U64(drmMalloc(prop.count_enum_blobs * sizeof(uint32_t)));
+		prop.enum_blob_ptr = VOID2U64(drmMalloc(prop.count_enum_blobs * sizeof(uint32_t)));
+	}
 
-	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPROPBLOB, &blob)) {
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPROPERTY, &prop)) {
 		r = NULL;
 		goto err_allocs;
 	}
 
-	if (!(r = drmMalloc(sizeof(*r))))
+	if (!(r = drmModePoolAlloc(DRM_MODE_POOL_PROPERTY)))
 		goto err_allocs;
 
-	r->id = blob.blob_id;
-	r->length = blob.length;
-	r->data = drmAllocCpy(U642VOID(blob.data), 1, blob.length);
+	r->prop_id = prop.prop_id;
+	r->count_values = prop.count_values;
+
+	r->flags = prop.flags;
+	if (prop.count_values)
+		r->values = drmAllocCpy(U642VOID(prop.values_ptr), prop.count_values, sizeof(uint64_t));
+	if (prop.flags & (DRM_MODE_PROP_ENUM | DRM_MODE_PROP_BITMASK)) {
+		r->count_enums = prop.count_enum_blobs;
+		r->enums = drmAllocCpy(U642VOID(prop.enum_blob_ptr), prop.count_enum_blobs, sizeof(struct drm_mode_property_enum));
+	} else if (prop.flags & DRM_MODE_PROP_BLOB) {
+		r->values = drmAllocCpy(U642VOID(prop.values_ptr), prop.count_enum_blobs, sizeof(uint32_t));
+		r->blob_ids = drmAllocCpy(U642VOID(prop.enum_blob_ptr), prop.count_enum_blobs, sizeof(uint32_t));
+		r->count_blobs = prop.count_enum_blobs;
+	}
+	strncpy(r->name, prop.name, DRM_PROP_NAME_LEN);
+	r->name[DRM_PROP_NAME_LEN-1] = 0;
 
 err_allocs:
-	drmFree(U642VOID(blob.data));
+	drmFree(U642VOID(prop.values_ptr));
+	drmFree(U642VOID(prop.enum_blob_ptr));
+
 	return r;
 }
 
-drm_public void drmModeFreePropertyBlob(drmModePropertyBlobPtr ptr)
+drm_public void drmModeFreeProperty(drmModePropertyPtr ptr)
 {
 	if (!ptr)
 		return;
 
-	drmFree(ptr->data);
-	drmFree(ptr);
+	drmFree(ptr->values);
+	drmFree(ptr->enums);
+	drmFree(ptr->blob_ids);
+	drmModePoolFree(DRM_MODE_POOL_PROPERTY, ptr);
 }
 
 drm_public int drmModeConnectorSetProperty(int fd, uint32_t connector_id,
@@ -888,72 +1847,173 @@ drm_public int drmModeCrtcSetGamma(int fd, uint32_t crtc_id, uint32_t size,
 	return DRM_IOCTL(fd, DRM_IOCTL_MODE_SETGAMMA, &l);
 }
 
-drm_public int drmHandleEvent(int fd, drmEventContextPtr evctx)
+static void drmDispatchEvent(int fd, drmEventContextPtr evctx,
+			     struct drm_event *e)
 {
-	char buffer[1024];
-	int len, i;
-	struct drm_event *e;
 	struct drm_event_vblank *vblank;
 	struct drm_event_crtc_sequence *seq;
 	void *user_data;
 
+	switch (e->type) {
+	case DRM_EVENT_VBLANK:
+		if (evctx->version < 1 ||
+		    evctx->vblank_handler == NULL)
+			break;
+		vblank = (struct drm_event_vblank *) e;
+		evctx->vblank_handler(fd,
+				      vblank->sequence,
+				      vblank->tv_sec,
+				      vblank->tv_usec,
+				      U642VOID (vblank->user_data));
+		break;
+	case DRM_EVENT_FLIP_COMPLETE:
+		vblank = (struct drm_event_vblank *) e;
+		user_data = U642VOID (vblank->user_data);
+
+		if (evctx->version >= 3 && evctx->page_flip_handler2)
+			evctx->page_flip_handler2(fd,
+						 vblank->sequence,
+						 vblank->tv_sec,
+						 vblank->tv_usec,
+						 vblank->crtc_id,
+						 user_data);
+		else if (evctx->version >= 2 && evctx->page_flip_handler)
+			evctx->page_flip_handler(fd,
+						 vblank->sequence,
+						 vblank->tv_sec,
+						 vblank->tv_usec,
+						 user_data);
+		break;
+	case DRM_EVENT_CRTC_SEQUENCE:
+		seq = (struct drm_event_crtc_sequence *) e;
+		if (evctx->version >= 4 && evctx->sequence_handler)
+			evctx->sequence_handler(fd,
+						seq->sequence,
+						seq->time_ns,
+						seq->user_data);
+		break;
+	default:
+		break;
+	}
+}
+
+static void drmModeCommitQueueEvent(drmModeCommitQueuePtr queue,
+				    drmEventContextPtr evctx,
+				    struct drm_event_vblank *vblank);
+
+/* With a commit queue the page flip events go through it, and evctx may
+ * be NULL. */
+static int drmDispatchEvents(int fd, drmEventContextPtr evctx,
+			     drmModeCommitQueuePtr queue, char *buffer, int len)
+{
+	struct drm_event *e;
+	int i = 0, count = 0;
+
+	while (i + (int)sizeof *e <= len) {
+		e = (struct drm_event *)(buffer + i);
+		if (e->length < sizeof *e)
+			break;
+		if (queue && e->type == DRM_EVENT_FLIP_COMPLETE)
+			drmModeCommitQueueEvent(queue, evctx,
+						(struct drm_event_vblank *)e);
+		else if (evctx)
+			drmDispatchEvent(fd, evctx, e);
+		i += e->length;
+		count++;
+	}
+
+	return count;
+}
+
+drm_public int drmHandleEvent(int fd, drmEventContextPtr evctx)
+{
+	char buffer[1024];
+	int len;
+
 	/* The DRM read semantics guarantees that we always get only
 	 * complete events. */
 
 	len = read(fd, buffer, sizeof buffer);
 	if (len == 0)
 		return 0;
-	if (len < (int)sizeof *e)
+	if (len < (int)sizeof(struct drm_event))
 		return -1;
 
-	i = 0;
-	while (i < len) {
-		e = (struct drm_event *)(buffer + i);
-		switch (e->type) {
-		case DRM_EVENT_VBLANK:
-			if (evctx->version < 1 ||
-			    evctx->vblank_handler == NULL)
-				break;
-			vblank = (struct drm_event_vblank *) e;
-			evctx->vblank_handler(fd,
-					      vblank->sequence,
-					      vblank->tv_sec,
-					      vblank->tv_usec,
-					      U642VOID (vblank->user_data));
-			break;
-		case DRM_EVENT_FLIP_COMPLETE:
-			vblank = (struct drm_event_vblank *) e;
-			user_data = U642VOID (vblank->user_data);
-
-			if (evctx->version >= 3 && evctx->page_flip_handler2)
-				evctx->page_flip_handler2(fd,
-							 vblank->sequence,
-							 vblank->tv_sec,
-							 vblank->tv_usec,
-							 vblank->crtc_id,
-							 user_data);
-			else if (evctx->version >= 2 && evctx->page_flip_handler)
-				evctx->page_flip_handler(fd,
-							 vblank->sequence,
-							 vblank->tv_sec,
-							 vblank->tv_usec,
-							 user_data);
+	drmDispatchEvents(fd, evctx, NULL, buffer, len);
+
+	return 0;
+}
+
+/*
+ * Every event the kernel currently sends fits in this, so a read leaving at
+ * least that much room unused means the queue was empty at the time.
+ */
+#define DRM_EVENT_MAX_SIZE \
+	MAX2(sizeof(struct drm_event_vblank), \
+	     sizeof(struct drm_event_crtc_sequence))
+
+/**
+ * Read and dispatch pending DRM events in batches.
+ *
+ * \param fd file descriptor of the DRM device.
+ * \param evctx event handlers, as for drmHandleEvent().
+ * \param buffer where to read events into, or NULL to use a 4 KiB buffer on
+ *        the stack.
+ * \param size size of \p buffer in bytes.
+ * \param flags DRM_HANDLE_EVENTS_DRAIN to keep reading until no more events
+ *        are queued, instead of doing a single read.  Draining never blocks
+ *        once at least one read has returned events, even on a blocking fd.
+ *
+ * \return the number of events dispatched, or a negative errno.  A
+ * non-blocking fd without pending events returns 0.
+ */
+static int drmReadEvents(int fd, drmEventContextPtr evctx,
+			 drmModeCommitQueuePtr queue, void *buffer,
+			 size_t size, uint32_t flags)
+{
+	char stack_buffer[4096];
+	int len, count = 0;
+
+	if (flags & ~DRM_HANDLE_EVENTS_DRAIN)
+		return -EINVAL;
+
+	if (!buffer) {
+		buffer = stack_buffer;
+		size = sizeof(stack_buffer);
+	}
+
+	if (size < DRM_EVENT_MAX_SIZE)
+		return -EINVAL;
+	if (size > INT_MAX)
+		size = INT_MAX;
+
+	for (;;) {
+		len = read(fd, buffer, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && errno == EAGAIN)
 			break;
-		case DRM_EVENT_CRTC_SEQUENCE:
-			seq = (struct drm_event_crtc_sequence *) e;
-			if (evctx->version >= 4 && evctx->sequence_handler)
-				evctx->sequence_handler(fd,
-							seq->sequence,
-							seq->time_ns,
-							seq->user_data);
+		if (len < 0)
+			return count ? count : -errno;
+		if (len == 0)
 			break;
-		default:
+		if (len < (int)sizeof(struct drm_event))
+			return count ? count : -EINVAL;
+
+		count += drmDispatchEvents(fd, evctx, queue, buffer, len);
+
+		if (!(flags & DRM_HANDLE_EVENTS_DRAIN) ||
+		    size - len >= DRM_EVENT_MAX_SIZE)
 			break;
-		}
-		i += e->length;
 	}
 
-	return 0;
+	return count;
+}
+
+drm_public int drmHandleEvents2(int fd, drmEventContextPtr evctx,
+				void *buffer, size_t size, uint32_t flags)
+{
+	return drmReadEvents(fd, evctx, NULL, buffer, size, flags);
 }
 
 drm_public int drmModePageFlip(int fd, uint32_t crtc_id, uint32_t fb_id,
@@ -1210,48 +2270,719 @@ drm_public int drmModeObjectSetProperty(int fd, uint32_t object_id, uint32_t obj
 	return DRM_IOCTL(fd, DRM_IOCTL_MODE_OBJ_SETPROPERTY, &prop);
 }
 
-typedef struct _drmModeAtomicReqItem drmModeAtomicReqItem, *drmModeAtomicReqItemPtr;
+/*
+ * Per-fd cache of property names.
+ *
+ * Property IDs are shared between all objects of a type, so the name and
+ * flags of each property only ever need to be fetched once per fd, and they
+ * are fetched without the (potentially large) enum and blob payloads.  The
+ * list of properties attached to each object is fetched once per object.
+ * The contents of the blobs fetched by drmModeGetPropertyBlob() are kept too,
+ * as a blob never changes for as long as its id is alive.
+ * Everything is dropped by drmModeInvalidatePropertyCache(), which callers
+ * are expected to use on hotplug, as e.g. MST connectors come and go.  That
+ * also drops the EDID, PATH and TILE blobs the kernel replaced, whose ids
+ * it may hand out again.
+ */
+struct drm_prop_cache_object {
+	uint32_t count_props;
+	uint32_t props[];
+};
 
-struct _drmModeAtomicReqItem {
-	uint32_t object_id;
-	uint32_t property_id;
-	uint64_t value;
+struct drm_prop_cache_prop {
+	uint32_t flags;
+	char name[DRM_PROP_NAME_LEN];
 };
 
-struct _drmModeAtomicReq {
-	uint32_t cursor;
-	uint32_t size_items;
-	drmModeAtomicReqItemPtr items;
+/* Shared by the cache and the blobs handed out, under drm_prop_cache_lock. */
+struct drm_prop_cache_blob {
+	unsigned int refs;
+	uint32_t length;
+	char data[];
 };
 
-drm_public drmModeAtomicReqPtr drmModeAtomicAlloc(void)
-{
-	drmModeAtomicReqPtr req;
+/* What drmModeGetPropertyBlob() returns, its data that of cached. */
+struct drm_prop_blob {
+	drmModePropertyBlobRes base;
+	struct drm_prop_cache_blob *cached;
+};
 
-	req = drmMalloc(sizeof *req);
-	if (!req)
-		return NULL;
+struct drm_prop_cache {
+	void *objects;  /* object id -> struct drm_prop_cache_object */
+	void *props;    /* property id -> struct drm_prop_cache_prop */
+	void *formats;  /* plane id -> struct _drmModeFormatModifiers */
+	void *blobs;    /* blob id -> struct drm_prop_cache_blob */
+};
 
-	req->items = NULL;
-	req->cursor = 0;
-	req->size_items = 0;
+static pthread_mutex_t drm_prop_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *drm_prop_caches; /* fd -> struct drm_prop_cache */
 
-	return req;
+static void drmModePropertyCacheBlobUnref(struct drm_prop_cache_blob *blob)
+{
+	if (!--blob->refs)
+		free(blob);
 }
 
-drm_public drmModeAtomicReqPtr drmModeAtomicDuplicate(drmModeAtomicReqPtr old)
+static void drmModePropertyCacheDestroy(struct drm_prop_cache *cache)
 {
-	drmModeAtomicReqPtr new;
-
-	if (!old)
-		return NULL;
+	unsigned long key;
+	void *value;
 
-	new = drmMalloc(sizeof *new);
-	if (!new)
-		return NULL;
+	if (drmHashFirst(cache->objects, &key, &value) == 1) {
+		do {
+			free(value);
+		} while (drmHashNext(cache->objects, &key, &value));
+	}
+	if (drmHashFirst(cache->props, &key, &value) == 1) {
+		do {
+			free(value);
+		} while (drmHashNext(cache->props, &key, &value));
+	}
+	if (drmHashFirst(cache->formats, &key, &value) == 1) {
+		do {
+			drmModeFormatModifiersFree(value);
+		} while (drmHashNext(cache->formats, &key, &value));
+	}
+	if (drmHashFirst(cache->blobs, &key, &value) == 1) {
+		do {
+			drmModePropertyCacheBlobUnref(value);
+		} while (drmHashNext(cache->blobs, &key, &value));
+	}
+	drmHashDestroy(cache->objects);
+	drmHashDestroy(cache->props);
+	drmHashDestroy(cache->formats);
+	drmHashDestroy(cache->blobs);
+	free(cache);
+}
 
-	new->cursor = old->cursor;
-	new->size_items = old->size_items;
+static struct drm_prop_cache *drmModePropertyCacheGet(int fd)
+{
+	struct drm_prop_cache *cache;
+	void *value;
+
+	if (!drm_prop_caches) {
+		drm_prop_caches = drmHashCreate();
+		if (!drm_prop_caches)
+			return NULL;
+	}
+
+	if (!drmHashLookup(drm_prop_caches, fd, &value))
+		return value;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->objects = drmHashCreate();
+	cache->props = drmHashCreate();
+	cache->formats = drmHashCreate();
+	cache->blobs = drmHashCreate();
+	if (!cache->objects || !cache->props || !cache->formats ||
+	    !cache->blobs || drmHashInsert(drm_prop_caches, fd, cache)) {
+		if (cache->objects)
+			drmHashDestroy(cache->objects);
+		if (cache->props)
+			drmHashDestroy(cache->props);
+		if (cache->formats)
+			drmHashDestroy(cache->formats);
+		if (cache->blobs)
+			drmHashDestroy(cache->blobs);
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+static struct drm_prop_cache_object *
+drmModePropertyCacheGetObject(int fd, struct drm_prop_cache *cache,
+			      uint32_t object_id)
+{
+	struct drm_mode_obj_get_properties properties;
+	struct drm_prop_cache_object *object;
+	uint32_t stack_props[64], *props = stack_props;
+	uint64_t stack_values[64], *values = stack_values;
+	uint32_t count = 64;
+	void *value;
+
+	if (!drmHashLookup(cache->objects, object_id, &value))
+		return value;
+
+	/* Usually done in a single ioctl, objects rarely have more than a
+	 * few dozen properties. */
+	for (;;) {
+		memclear(properties);
+		properties.obj_id = object_id;
+		properties.obj_type = DRM_MODE_OBJECT_ANY;
+		properties.count_props = count;
+		properties.props_ptr = VOID2U64(props);
+		properties.prop_values_ptr = VOID2U64(values);
+
+		if (drmIoctl(fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &properties))
+			goto err;
+
+		if (properties.count_props <= count)
+			break;
+
+		if (props != stack_props) {
+			free(props);
+			free(values);
+		}
+		count = properties.count_props;
+		props = malloc(count * sizeof(*props));
+		values = malloc(count * sizeof(*values));
+		if (!props || !values) {
+			errno = ENOMEM;
+			goto err;
+		}
+	}
+
+	object = malloc(sizeof(*object) +
+			properties.count_props * sizeof(object->props[0]));
+	if (!object) {
+		errno = ENOMEM;
+		goto err;
+	}
+
+	object->count_props = properties.count_props;
+	memcpy(object->props, props, object->count_props * sizeof(*props));
+	if (drmHashInsert(cache->objects, object_id, object)) {
+		free(object);
+		errno = ENOMEM;
+		goto err;
+	}
+
+	if (props != stack_props) {
+		free(props);
+		free(values);
+	}
+	return object;
+
+err:
+	if (props != stack_props) {
+		free(props);
+		free(values);
+	}
+	return NULL;
+}
+
+static struct drm_prop_cache_prop *
+drmModePropertyCacheGetProp(int fd, struct drm_prop_cache *cache,
+			    uint32_t prop_id)
+{
+	struct drm_mode_get_property get;
+	struct drm_prop_cache_prop *prop;
+	void *value;
+
+	if (!drmHashLookup(cache->props, prop_id, &value))
+		return value;
+
+	/* Zero counts make the kernel skip the enum and blob payloads. */
+	memclear(get);
+	get.prop_id = prop_id;
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPROPERTY, &get))
+		return NULL;
+
+	prop = malloc(sizeof(*prop));
+	if (!prop)
+		return NULL;
+
+	prop->flags = get.flags;
+	memcpy(prop->name, get.name, DRM_PROP_NAME_LEN);
+	prop->name[DRM_PROP_NAME_LEN - 1] = '\0';
+	if (drmHashInsert(cache->props, prop_id, prop)) {
+		free(prop);
+		return NULL;
+	}
+
+	return prop;
+}
+
+/**
+ * Look up a property of a KMS object by name.
+ *
+ * \param fd file descriptor of the DRM device.
+ * \param object_id the object (CRTC, connector, plane, ...) to look on.
+ * \param name property name, as in drmModePropertyRes::name.
+ * \param prop_id returns the property ID.
+ * \param flags returns the property flags, may be NULL.
+ *
+ * \return zero on success, -ENOENT if the object has no such property, or
+ * another negative errno.
+ *
+ * The results are cached per fd until drmModeInvalidatePropertyCache().
+ */
+drm_public int drmModeObjectGetPropertyId(int fd, uint32_t object_id,
+					  const char *name, uint32_t *prop_id,
+					  uint32_t *flags)
+{
+	struct drm_prop_cache_object *object;
+	struct drm_prop_cache_prop *prop;
+	struct drm_prop_cache *cache;
+	uint32_t i;
+	int ret = -ENOENT;
+
+	if (!name || !prop_id)
+		return -EINVAL;
+
+	pthread_mutex_lock(&drm_prop_cache_lock);
+
+	cache = drmModePropertyCacheGet(fd);
+	if (!cache) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	object = drmModePropertyCacheGetObject(fd, cache, object_id);
+	if (!object) {
+		ret = -errno;
+		goto out;
+	}
+
+	for (i = 0; i < object->count_props; i++) {
+		prop = drmModePropertyCacheGetProp(fd, cache, object->props[i]);
+		if (!prop || strcmp(prop->name, name))
+			continue;
+
+		*prop_id = object->props[i];
+		if (flags)
+			*flags = prop->flags;
+		ret = 0;
+		break;
+	}
+
+out:
+	pthread_mutex_unlock(&drm_prop_cache_lock);
+	return ret;
+}
+
+/**
+ * Drop all cached property information for \p fd.
+ */
+drm_public void drmModeInvalidatePropertyCache(int fd)
+{
+	void *value;
+
+	pthread_mutex_lock(&drm_prop_cache_lock);
+	if (drm_prop_caches && !drmHashLookup(drm_prop_caches, fd, &value)) {
+		drmHashDelete(drm_prop_caches, fd);
+		drmModePropertyCacheDestroy(value);
+	}
+	pthread_mutex_unlock(&drm_prop_cache_lock);
+}
+
+static struct drm_prop_cache_blob *drmModePropertyBlobFetch(int fd,
+							    uint32_t blob_id)
+{
+	struct drm_prop_cache_blob *blob;
+	struct drm_mode_get_blob get;
+
+	memclear(get);
+	get.blob_id = blob_id;
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPROPBLOB, &get))
+		return NULL;
+
+	/* Straight into the cache entry, rather than through a copy. */
+	blob = malloc(sizeof(*blob) + get.length);
+	if (!blob)
+		return NULL;
+	blob->refs = 1;
+	blob->length = get.length;
+	get.data = VOID2U64(blob->data);
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPROPBLOB, &get) ||
+	    get.length != blob->length) {
+		free(blob);
+		return NULL;
+	}
+
+	return blob;
+}
+
+/* Takes the reference of cached on success. */
+static drmModePropertyBlobPtr drmModePropertyBlobWrap(uint32_t blob_id,
+					struct drm_prop_cache_blob *cached)
+{
+	struct drm_prop_blob *r = drmMalloc(sizeof(*r));
+
+	if (!r) {
+		drmModePropertyCacheBlobUnref(cached);
+		return NULL;
+	}
+
+	r->base.id = blob_id;
+	r->base.length = cached->length;
+	r->base.data = cached->data;
+	r->cached = cached;
+	return &r->base;
+}
+
+drm_public drmModePropertyBlobPtr drmModeGetPropertyBlob(int fd,
+							 uint32_t blob_id)
+{
+	struct drm_prop_cache_blob *blob = NULL, *fetched;
+	struct drm_prop_cache *cache;
+	void *value;
+
+	pthread_mutex_lock(&drm_prop_cache_lock);
+	cache = drmModePropertyCacheGet(fd);
+	if (cache && !drmHashLookup(cache->blobs, blob_id, &value)) {
+		blob = value;
+		blob->refs++;
+	}
+	pthread_mutex_unlock(&drm_prop_cache_lock);
+	if (blob)
+		return drmModePropertyBlobWrap(blob_id, blob);
+
+	fetched = drmModePropertyBlobFetch(fd, blob_id);
+	if (!fetched)
+		return NULL;
+
+	pthread_mutex_lock(&drm_prop_cache_lock);
+	cache = drmModePropertyCacheGet(fd);
+	if (cache && !drmHashLookup(cache->blobs, blob_id, &value)) {
+		/* Another thread fetched it meanwhile. */
+		free(fetched);
+		blob = value;
+		blob->refs++;
+	} else {
+		/* Uncached without memory for the hash entry. */
+		blob = fetched;
+		if (cache && !drmHashInsert(cache->blobs, blob_id, blob))
+			blob->refs++;
+	}
+	pthread_mutex_unlock(&drm_prop_cache_lock);
+
+	return drmModePropertyBlobWrap(blob_id, blob);
+}
+
+drm_public void drmModeFreePropertyBlob(drmModePropertyBlobPtr ptr)
+{
+	struct drm_prop_blob *r = (struct drm_prop_blob *)ptr;
+
+	if (!ptr)
+		return;
+
+	pthread_mutex_lock(&drm_prop_cache_lock);
+	drmModePropertyCacheBlobUnref(r->cached);
+	pthread_mutex_unlock(&drm_prop_cache_lock);
+	drmFree(r);
+}
+
+/* The id of a blob destroyed through the fd may be reused right away. */
+static void drmModePropertyCacheForgetBlob(int fd, uint32_t blob_id)
+{
+	struct drm_prop_cache *cache;
+	void *value;
+
+	pthread_mutex_lock(&drm_prop_cache_lock);
+	if (drm_prop_caches && !drmHashLookup(drm_prop_caches, fd, &value)) {
+		cache = value;
+		if (!drmHashLookup(cache->blobs, blob_id, &value)) {
+			drmHashDelete(cache->blobs, blob_id);
+			drmModePropertyCacheBlobUnref(value);
+		}
+	}
+	pthread_mutex_unlock(&drm_prop_cache_lock);
+}
+
+/*
+ * Index of the (format, modifier) pairs of an IN_FORMATS blob: the pairs in
+ * iteration order, and an open addressing hash of their indices + 1.
+ */
+struct drm_format_modifier_pair {
+	uint64_t modifier;
+	uint32_t format;
+};
+
+struct _drmModeFormatModifiers {
+	uint32_t count;
+	uint32_t mask;		/* Hash slots - 1 */
+	struct drm_format_modifier_pair *pairs;
+	uint32_t *slots;
+};
+
+static uint32_t drmModeFormatModifierHash(uint32_t format, uint64_t modifier)
+{
+	uint64_t h = (modifier ^ ((uint64_t)format << 32 | format)) *
+		     0x9e3779b97f4a7c15ULL;
+
+	return h ^ (h >> 32);
+}
+
+static uint32_t *drmModeFormatModifiersFind(drmModeFormatModifiersPtr ptr,
+					    uint32_t format, uint64_t modifier)
+{
+	uint32_t i = drmModeFormatModifierHash(format, modifier) & ptr->mask;
+	struct drm_format_modifier_pair *pair;
+
+	for (;; i = (i + 1) & ptr->mask) {
+		if (!ptr->slots[i])
+			return &ptr->slots[i];
+
+		pair = &ptr->pairs[ptr->slots[i] - 1];
+		if (pair->format == format && pair->modifier == modifier)
+			return &ptr->slots[i];
+	}
+}
+
+drm_public drmModeFormatModifiersPtr
+drmModeFormatModifiersCreate(const void *data, uint32_t length)
+{
+	const struct drm_format_modifier_blob *blob = data;
+	const struct drm_format_modifier *mods;
+	const uint32_t *formats;
+	drmModeFormatModifiersPtr ptr;
+	uint32_t i, j, count = 0, slots = 16, *slot;
+	uint64_t bit;
+
+	if (!blob || length < sizeof(*blob) ||
+	    blob->formats_offset + (uint64_t)blob->count_formats *
+	    sizeof(*formats) > length ||
+	    blob->modifiers_offset + (uint64_t)blob->count_modifiers *
+	    sizeof(*mods) > length ||
+	    blob->formats_offset % sizeof(*formats) ||
+	    blob->modifiers_offset % sizeof(uint64_t)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	formats = (const uint32_t *)((const char *)data + blob->formats_offset);
+	mods = (const struct drm_format_modifier *)
+		((const char *)data + blob->modifiers_offset);
+
+	for (i = 0; i < blob->count_modifiers; i++)
+		count += __builtin_popcountll(mods[i].formats);
+
+	/* Keep the hash at most half full. */
+	while (slots < 2 * count)
+		slots *= 2;
+
+	ptr = calloc(1, sizeof(*ptr));
+	if (ptr) {
+		ptr->pairs = calloc(count ? count : 1, sizeof(*ptr->pairs));
+		ptr->slots = calloc(slots, sizeof(*ptr->slots));
+	}
+	if (!ptr || !ptr->pairs || !ptr->slots) {
+		drmModeFormatModifiersFree(ptr);
+		errno = ENOMEM;
+		return NULL;
+	}
+	ptr->mask = slots - 1;
+
+	for (i = 0; i < blob->count_formats; i++) {
+		for (j = 0; j < blob->count_modifiers; j++) {
+			if (i < mods[j].offset || i - mods[j].offset >= 64)
+				continue;
+
+			bit = 1ULL << (i - mods[j].offset);
+			if (!(mods[j].formats & bit))
+				continue;
+
+			slot = drmModeFormatModifiersFind(ptr, formats[i],
+							  mods[j].modifier);
+			if (*slot)
+				continue;
+
+			ptr->pairs[ptr->count].format = formats[i];
+			ptr->pairs[ptr->count].modifier = mods[j].modifier;
+			*slot = ++ptr->count;
+		}
+	}
+
+	return ptr;
+}
+
+drm_public void drmModeFormatModifiersFree(drmModeFormatModifiersPtr ptr)
+{
+	if (!ptr)
+		return;
+
+	free(ptr->pairs);
+	free(ptr->slots);
+	free(ptr);
+}
+
+drm_public int drmModeFormatModifiersSupported(drmModeFormatModifiersPtr ptr,
+					       uint32_t format,
+					       uint64_t modifier)
+{
+	return *drmModeFormatModifiersFind(ptr, format, modifier) != 0;
+}
+
+drm_public int drmModeFormatModifiersIterNext(drmModeFormatModifiersPtr ptr,
+					      drmModeFormatModifierIter *iter)
+{
+	if (iter->index >= ptr->count)
+		return 0;
+
+	iter->format = ptr->pairs[iter->index].format;
+	iter->modifier = ptr->pairs[iter->index].modifier;
+	iter->index++;
+	return 1;
+}
+
+static drmModeFormatModifiersPtr
+drmModeFormatModifiersFetch(int fd, uint32_t plane_id)
+{
+	drmModeObjectPropertiesPtr props;
+	drmModePropertyBlobPtr blob = NULL;
+	drmModeFormatModifiersPtr ptr;
+	uint32_t prop_id, i;
+	bool found = false;
+	int ret;
+
+	ret = drmModeObjectGetPropertyId(fd, plane_id, "IN_FORMATS", &prop_id,
+					 NULL);
+	if (ret) {
+		errno = -ret;
+		return NULL;
+	}
+
+	props = drmModeObjectGetProperties(fd, plane_id,
+					   DRM_MODE_OBJECT_PLANE);
+	if (!props)
+		return NULL;
+
+	for (i = 0; i < props->count_props; i++) {
+		if (props->props[i] == prop_id) {
+			blob = drmModeGetPropertyBlob(fd, props->prop_values[i]);
+			found = true;
+			break;
+		}
+	}
+	drmModeFreeObjectProperties(props);
+	if (!blob) {
+		if (!found)
+			errno = ENOENT;
+		return NULL;
+	}
+
+	ptr = drmModeFormatModifiersCreate(blob->data, blob->length);
+	drmModeFreePropertyBlob(blob);
+	return ptr;
+}
+
+drm_public drmModeFormatModifiersPtr
+drmModeGetPlaneFormatModifiers(int fd, uint32_t plane_id)
+{
+	drmModeFormatModifiersPtr ptr = NULL;
+	struct drm_prop_cache *cache;
+	void *value;
+
+	pthread_mutex_lock(&drm_prop_cache_lock);
+	cache = drmModePropertyCacheGet(fd);
+	if (cache && !drmHashLookup(cache->formats, plane_id, &value))
+		ptr = value;
+	pthread_mutex_unlock(&drm_prop_cache_lock);
+	if (!cache) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (ptr)
+		return ptr;
+
+	/* Fetched unlocked, the property id lookup takes the lock. */
+	ptr = drmModeFormatModifiersFetch(fd, plane_id);
+	if (!ptr)
+		return NULL;
+
+	pthread_mutex_lock(&drm_prop_cache_lock);
+	cache = drmModePropertyCacheGet(fd);
+	if (cache && !drmHashLookup(cache->formats, plane_id, &value)) {
+		/* Another thread indexed it meanwhile. */
+		drmModeFormatModifiersFree(ptr);
+		ptr = value;
+	} else if (!cache || drmHashInsert(cache->formats, plane_id, ptr)) {
+		drmModeFormatModifiersFree(ptr);
+		ptr = NULL;
+		errno = ENOMEM;
+	}
+	pthread_mutex_unlock(&drm_prop_cache_lock);
+	return ptr;
+}
+
+typedef struct _drmModeAtomicReqItem drmModeAtomicReqItem, *drmModeAtomicReqItemPtr;
+
+struct _drmModeAtomicReqItem {
+	uint32_t object_id;
+	uint32_t property_id;
+	uint64_t value;
+};
+
+struct _drmModeAtomicReqSortItem {
+	uint32_t object_id;
+	uint32_t property_id;
+	uint32_t seq;
+	uint64_t value;
+};
+
+struct _drmModeAtomicReq {
+	uint32_t cursor;
+	uint32_t size_items;
+	drmModeAtomicReqItemPtr items;
+
+	/* Set while items are in strictly increasing (object, property) order,
+	 * in which case the commit can skip sorting and de-duplicating. */
+	bool sorted;
+
+	/* The kernel arrays of drmModeAtomicPrepare(), kept across prepares.
+	 * drmModeAtomicCommit() builds its own per call, leaving req as is. */
+	uint32_t size_scratch;
+	struct _drmModeAtomicReqSortItem *scratch_items;
+	uint32_t *objs;
+	uint32_t *count_props;
+	uint32_t *props;
+	uint64_t *prop_values;
+
+	/* Set by drmModeAtomicPrepare() while the arrays above match the
+	 * items, slots giving the prop_values index of each item. */
+	bool prepared;
+	uint32_t prepared_objs;
+	uint32_t *slots;
+};
+
+static int item_cmp(const drmModeAtomicReqItem *first,
+		    const drmModeAtomicReqItem *second)
+{
+	if (first->object_id != second->object_id)
+		return first->object_id < second->object_id ? -1 : 1;
+	if (first->property_id != second->property_id)
+		return first->property_id < second->property_id ? -1 : 1;
+	return 0;
+}
+
+drm_public drmModeAtomicReqPtr drmModeAtomicAlloc(void)
+{
+	drmModeAtomicReqPtr req;
+
+	req = drmMalloc(sizeof *req);
+	if (!req)
+		return NULL;
+
+	req->items = NULL;
+	req->cursor = 0;
+	req->size_items = 0;
+	req->sorted = true;
+
+	return req;
+}
+
+drm_public drmModeAtomicReqPtr drmModeAtomicDuplicate(drmModeAtomicReqPtr old)
+{
+	drmModeAtomicReqPtr new;
+
+	if (!old)
+		return NULL;
+
+	new = drmMalloc(sizeof *new);
+	if (!new)
+		return NULL;
+
+	new->cursor = old->cursor;
+	new->size_items = old->size_items;
+	new->sorted = old->sorted;
 
 	if (old->size_items) {
 		new->items = drmMalloc(old->size_items * sizeof(*new->items));
@@ -1277,6 +3008,8 @@ drm_public int drmModeAtomicMerge(drmModeAtomicReqPtr base,
 	if (!augment || augment->cursor == 0)
 		return 0;
 
+	base->prepared = false;
+
 	if (base->cursor + augment->cursor >= base->size_items) {
 		drmModeAtomicReqItemPtr new;
 		int saved_size = base->size_items;
@@ -1291,6 +3024,11 @@ drm_public int drmModeAtomicMerge(drmModeAtomicReqPtr base,
 		base->items = new;
 	}
 
+	if (!augment->sorted ||
+	    (base->cursor &&
+	     item_cmp(&base->items[base->cursor - 1], &augment->items[0]) >= 0))
+		base->sorted = false;
+
 	memcpy(&base->items[base->cursor], augment->items,
 	       augment->cursor * sizeof(*augment->items));
 	base->cursor += augment->cursor;
@@ -1305,328 +3043,4299 @@ drm_public int drmModeAtomicGetCursor(drmModeAtomicReqPtr req)
 	return req->cursor;
 }
 
-drm_public void drmModeAtomicSetCursor(drmModeAtomicReqPtr req, int cursor)
+drm_public void drmModeAtomicSetCursor(drmModeAtomicReqPtr req, int cursor)
+{
+	if (req) {
+		/* A prefix of a sorted list is still sorted, and an empty
+		 * one trivially is. */
+		if (cursor == 0)
+			req->sorted = true;
+		else if ((uint32_t)cursor > req->cursor)
+			req->sorted = false;
+		req->cursor = cursor;
+		req->prepared = false;
+	}
+}
+
+drm_public int drmModeAtomicAddProperty(drmModeAtomicReqPtr req,
+                                        uint32_t object_id,
+                                        uint32_t property_id,
+                                        uint64_t value)
+{
+	if (!req)
+		return -EINVAL;
+
+	if (object_id == 0 || property_id == 0)
+		return -EINVAL;
+
+	req->prepared = false;
+
+	if (req->cursor >= req->size_items) {
+		drmModeAtomicReqItemPtr new;
+
+		new = util_grow_array(req->items, &req->size_items,
+				      req->cursor + 1, sizeof(*req->items));
+		if (!new)
+			return -ENOMEM;
+		req->items = new;
+	}
+
+	req->items[req->cursor].object_id = object_id;
+	req->items[req->cursor].property_id = property_id;
+	req->items[req->cursor].value = value;
+
+	if (req->sorted && req->cursor &&
+	    item_cmp(&req->items[req->cursor - 1], &req->items[req->cursor]) >= 0)
+		req->sorted = false;
+
+	req->cursor++;
+
+	return req->cursor;
+}
+
+/**
+ * Add a property to an atomic request, looking the property up by name.
+ *
+ * \return the new cursor on success, as drmModeAtomicAddProperty(), or a
+ * negative errno, -ENOENT if \p object_id has no property called \p name.
+ */
+drm_public int drmModeAtomicAddPropertyByName(drmModeAtomicReqPtr req, int fd,
+					      uint32_t object_id,
+					      const char *name, uint64_t value)
+{
+	uint32_t prop_id;
+	int ret;
+
+	if (!req)
+		return -EINVAL;
+
+	ret = drmModeObjectGetPropertyId(fd, object_id, name, &prop_id, NULL);
+	if (ret)
+		return ret;
+
+	return drmModeAtomicAddProperty(req, object_id, prop_id, value);
+}
+
+drm_public void drmModeAtomicFree(drmModeAtomicReqPtr req)
+{
+	if (!req)
+		return;
+
+	if (req->items)
+		drmFree(req->items);
+	free(req->scratch_items);
+	free(req->objs);
+	free(req->count_props);
+	free(req->props);
+	free(req->prop_values);
+	free(req->slots);
+	drmFree(req);
+}
+
+/* Sort by object ID, then by property ID, then by insertion order so that
+ * the value set last wins. */
+static int sort_req_list(const void *misc, const void *other)
+{
+	const struct _drmModeAtomicReqSortItem *first = misc;
+	const struct _drmModeAtomicReqSortItem *second = other;
+
+	if (first->object_id != second->object_id)
+		return first->object_id < second->object_id ? -1 : 1;
+	if (first->property_id != second->property_id)
+		return first->property_id < second->property_id ? -1 : 1;
+	return first->seq < second->seq ? -1 : first->seq > second->seq;
+}
+
+static int drmModeAtomicGrowScratch(drmModeAtomicReqPtr req, bool need_sort)
+{
+	uint32_t size = req->size_items;
+	void *ptr;
+
+#define GROW(field) \
+	ptr = realloc(req->field, size * sizeof(*req->field)); \
+	if (!ptr) \
+		return -ENOMEM; \
+	req->field = ptr;
+
+	if (size > req->size_scratch) {
+		GROW(objs);
+		GROW(count_props);
+		GROW(props);
+		GROW(prop_values);
+		free(req->scratch_items);
+		req->scratch_items = NULL;
+		req->size_scratch = size;
+	}
+
+	if (need_sort && !req->scratch_items) {
+		size = req->size_scratch;
+		GROW(scratch_items);
+	}
+#undef GROW
+
+	return 0;
+}
+
+/* The kernel arrays of a commit, and the room to sort the items in when
+ * they are not sorted already. */
+struct drm_atomic_arrays {
+	uint32_t *objs;
+	uint32_t *count_props;
+	uint32_t *props;
+	uint64_t *prop_values;
+	struct _drmModeAtomicReqSortItem *sort_items;
+};
+
+/* Arrays of count items in a single allocation, to be freed by the caller,
+ * or NULL. */
+static void *drmModeAtomicArraysAlloc(struct drm_atomic_arrays *arrays,
+				      uint32_t count, bool need_sort)
+{
+	size_t values_size = count * sizeof(*arrays->prop_values);
+	size_t sort_size = need_sort ? count * sizeof(*arrays->sort_items) : 0;
+	char *mem;
+
+	/* The 64-bit members first, keeping everything aligned */
+	mem = malloc(values_size + sort_size + 3 * count * sizeof(uint32_t));
+	if (!mem)
+		return NULL;
+
+	arrays->prop_values = (uint64_t *)mem;
+	arrays->sort_items = need_sort ?
+		(struct _drmModeAtomicReqSortItem *)(mem + values_size) : NULL;
+	arrays->objs = (uint32_t *)(mem + values_size + sort_size);
+	arrays->count_props = arrays->objs + count;
+	arrays->props = arrays->count_props + count;
+	return mem;
+}
+
+/* Fill the kernel arrays from the items, and slots if not NULL. Returns the
+ * number of objects. */
+static uint32_t drmModeAtomicBuild(const struct _drmModeAtomicReq *req,
+				   const struct drm_atomic_arrays *arrays,
+				   uint32_t *slots)
+{
+	uint32_t *objs = arrays->objs;
+	uint32_t *obj_props = arrays->count_props;
+	uint32_t *props = arrays->props;
+	uint64_t *prop_values = arrays->prop_values;
+	uint32_t count_props = 0;
+	uint32_t i;
+	int obj_idx = -1;
+
+	if (req->sorted) {
+		/* Already in order without duplicates, emit it as is. */
+		for (i = 0; i < req->cursor; i++) {
+			if (obj_idx < 0 ||
+			    req->items[i].object_id != objs[obj_idx]) {
+				obj_idx++;
+				objs[obj_idx] = req->items[i].object_id;
+				obj_props[obj_idx] = 0;
+			}
+
+			obj_props[obj_idx]++;
+			props[i] = req->items[i].property_id;
+			prop_values[i] = req->items[i].value;
+			if (slots)
+				slots[i] = i;
+		}
+	} else {
+		struct _drmModeAtomicReqSortItem *items = arrays->sort_items;
+
+		for (i = 0; i < req->cursor; i++) {
+			items[i].object_id = req->items[i].object_id;
+			items[i].property_id = req->items[i].property_id;
+			items[i].value = req->items[i].value;
+			items[i].seq = i;
+		}
+
+		qsort(items, req->cursor, sizeof(*items), sort_req_list);
+
+		/* Now the list is sorted, only keep the last of each run of
+		 * duplicate property sets. */
+		for (i = 0; i < req->cursor; i++) {
+			if (slots)
+				slots[items[i].seq] = count_props;
+			if (i + 1 < req->cursor &&
+			    items[i].object_id == items[i + 1].object_id &&
+			    items[i].property_id == items[i + 1].property_id)
+				continue;
+
+			if (obj_idx < 0 || items[i].object_id != objs[obj_idx]) {
+				obj_idx++;
+				objs[obj_idx] = items[i].object_id;
+				obj_props[obj_idx] = 0;
+			}
+
+			obj_props[obj_idx]++;
+			props[count_props] = items[i].property_id;
+			prop_values[count_props] = items[i].value;
+			count_props++;
+		}
+	}
+
+	return obj_idx + 1;
+}
+
+drm_public int drmModeAtomicPrepare(drmModeAtomicReqPtr req)
+{
+	struct drm_atomic_arrays arrays;
+	uint32_t *slots;
+	int ret;
+
+	if (!req)
+		return -EINVAL;
+
+	ret = drmModeAtomicGrowScratch(req, !req->sorted);
+	if (ret)
+		return ret;
+
+	slots = realloc(req->slots, (req->size_items ? req->size_items : 1) *
+			sizeof(*slots));
+	if (!slots)
+		return -ENOMEM;
+	req->slots = slots;
+
+	arrays.objs = req->objs;
+	arrays.count_props = req->count_props;
+	arrays.props = req->props;
+	arrays.prop_values = req->prop_values;
+	arrays.sort_items = req->scratch_items;
+	req->prepared_objs = drmModeAtomicBuild(req, &arrays, slots);
+	req->prepared = true;
+	return 0;
+}
+
+drm_public int drmModeAtomicPreparedSet(drmModeAtomicReqPtr req, uint32_t idx,
+					uint64_t value)
+{
+	if (!req || !req->prepared || idx >= req->cursor)
+		return -EINVAL;
+
+	req->items[idx].value = value;
+	req->prop_values[req->slots[idx]] = value;
+	return 0;
+}
+
+/* Requests up to this many items are built on the stack. */
+#define DRM_ATOMIC_STACK_ITEMS 32
+
+drm_public int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
+                                   uint32_t flags, void *user_data)
+{
+	struct {
+		uint32_t objs[DRM_ATOMIC_STACK_ITEMS];
+		uint32_t count_props[DRM_ATOMIC_STACK_ITEMS];
+		uint32_t props[DRM_ATOMIC_STACK_ITEMS];
+		uint64_t prop_values[DRM_ATOMIC_STACK_ITEMS];
+		struct _drmModeAtomicReqSortItem sort_items[DRM_ATOMIC_STACK_ITEMS];
+	} stack;
+	struct drm_atomic_arrays arrays;
+	struct drm_mode_atomic atomic;
+	void *heap = NULL;
+	int ret;
+
+	if (!req)
+		return -EINVAL;
+
+	if (req->cursor == 0)
+		return 0;
+
+	memclear(atomic);
+
+	/* Only read req, so that commits of the same request don't race. */
+	if (req->prepared) {
+		arrays.objs = req->objs;
+		arrays.count_props = req->count_props;
+		arrays.props = req->props;
+		arrays.prop_values = req->prop_values;
+		atomic.count_objs = req->prepared_objs;
+	} else {
+		if (req->cursor <= DRM_ATOMIC_STACK_ITEMS) {
+			arrays.objs = stack.objs;
+			arrays.count_props = stack.count_props;
+			arrays.props = stack.props;
+			arrays.prop_values = stack.prop_values;
+			arrays.sort_items = stack.sort_items;
+		} else {
+			heap = drmModeAtomicArraysAlloc(&arrays, req->cursor,
+							!req->sorted);
+			if (!heap) {
+				errno = ENOMEM;
+				return -1;
+			}
+		}
+		atomic.count_objs = drmModeAtomicBuild(req, &arrays, NULL);
+	}
+
+	atomic.flags = flags;
+	atomic.objs_ptr = VOID2U64(arrays.objs);
+	atomic.count_props_ptr = VOID2U64(arrays.count_props);
+	atomic.props_ptr = VOID2U64(arrays.props);
+	atomic.prop_values_ptr = VOID2U64(arrays.prop_values);
+	atomic.user_data = VOID2U64(user_data);
+
+	UTIL_TRACE_BEGIN("drmModeAtomicCommit", "flags=0x%x objs=%u", flags,
+			 atomic.count_objs);
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_ATOMIC, &atomic);
+	UTIL_TRACE_END();
+
+	free(heap);
+	return ret;
+}
+
+/*
+ * TEST_ONLY search over alternative property sets, see
+ * drmModeAtomicTestChoices().
+ */
+#define DRM_ATOMIC_SEARCH_MAX_MEMO_BITS 64
+
+struct drm_atomic_search {
+	int fd;
+	drmModeAtomicReqPtr req;
+	const drmModeAtomicChoice *choices;
+	int count_choices;
+	uint32_t flags;
+	void *user_data;
+
+	int *current;		/* Option picked per choice, -1 for none */
+	int *best;
+	int best_count;
+	int tests;
+	int max_tests;
+
+	/* Failed combinations as bitmasks of (choice, option) pairs; any
+	 * superset of a failed combination is assumed to fail as well. */
+	int *first_bit;		/* Bit of option 0 of each choice */
+	bool memo;
+	uint64_t *failed;
+	int count_failed, size_failed;
+};
+
+static bool drmAtomicSearchKnownBad(struct drm_atomic_search *s, uint64_t mask)
+{
+	int i;
+
+	for (i = 0; i < s->count_failed; i++)
+		if ((mask & s->failed[i]) == s->failed[i])
+			return true;
+	return false;
+}
+
+static void drmAtomicSearchRecordBad(struct drm_atomic_search *s, uint64_t mask)
+{
+	if (s->count_failed == s->size_failed) {
+		int size = s->size_failed ? s->size_failed * 2 : 16;
+		uint64_t *failed = realloc(s->failed, size * sizeof(*failed));
+
+		if (!failed)
+			return;
+		s->failed = failed;
+		s->size_failed = size;
+	}
+	s->failed[s->count_failed++] = mask;
+}
+
+static int drmAtomicSearch(struct drm_atomic_search *s, int i, uint64_t mask,
+			   int assigned)
+{
+	const drmModeAtomicChoice *choice;
+	uint32_t cursor;
+	bool sorted;
+	int o, ret;
+
+	if (assigned + (s->count_choices - i) <= s->best_count)
+		return 0; /* Can't beat what we have */
+
+	if (i == s->count_choices) {
+		s->best_count = assigned;
+		memcpy(s->best, s->current, s->count_choices * sizeof(*s->best));
+		return 0;
+	}
+
+	choice = &s->choices[i];
+	cursor = s->req->cursor;
+	sorted = s->req->sorted;
+
+	for (o = 0; o < choice->count_options; o++) {
+		uint64_t bit = s->memo ? 1ull << (s->first_bit[i] + o) : 0;
+
+		if (s->tests >= s->max_tests)
+			break;
+		if (s->memo && drmAtomicSearchKnownBad(s, mask | bit))
+			continue;
+
+		ret = drmModeAtomicMerge(s->req, choice->options[o]);
+		if (ret)
+			return ret;
+
+		ret = drmModeAtomicCommit(s->fd, s->req,
+					  s->flags | DRM_MODE_ATOMIC_TEST_ONLY,
+					  s->user_data);
+		s->tests++;
+		if (!ret) {
+			s->current[i] = o;
+			ret = drmAtomicSearch(s, i + 1, mask | bit, assigned + 1);
+			s->current[i] = -1;
+			if (ret)
+				return ret;
+		} else if (ret == -ENOMEM) {
+			return ret;
+		} else if (s->memo) {
+			drmAtomicSearchRecordBad(s, mask | bit);
+		}
+
+		s->req->cursor = cursor;
+		s->req->sorted = sorted;
+
+		if (s->best_count == s->count_choices)
+			return 0; /* Everything fits */
+	}
+
+	/* Leave this choice out. */
+	return drmAtomicSearch(s, i + 1, mask, assigned);
+}
+
+drm_public int drmModeAtomicTestChoices(int fd, drmModeAtomicReqPtr req,
+					const drmModeAtomicChoice *choices,
+					int count_choices, int *selected,
+					int max_tests, uint32_t flags,
+					void *user_data)
+{
+	struct drm_atomic_search s;
+	uint32_t cursor;
+	bool sorted;
+	int i, bits = 0, ret;
+
+	if (!req || count_choices < 0 || (count_choices && (!choices || !selected)))
+		return -EINVAL;
+
+	cursor = req->cursor;
+	sorted = req->sorted;
+
+	for (i = 0; i < count_choices; i++)
+		selected[i] = -1;
+
+	ret = drmModeAtomicCommit(fd, req, flags | DRM_MODE_ATOMIC_TEST_ONLY,
+				  user_data);
+	if (ret || !count_choices)
+		return ret;
+
+	memset(&s, 0, sizeof(s));
+	s.fd = fd;
+	s.req = req;
+	s.choices = choices;
+	s.count_choices = count_choices;
+	s.flags = flags;
+	s.user_data = user_data;
+	s.max_tests = max_tests > 0 ? max_tests : INT_MAX;
+	s.current = malloc(count_choices * sizeof(*s.current));
+	s.best = malloc(count_choices * sizeof(*s.best));
+	s.first_bit = malloc(count_choices * sizeof(*s.first_bit));
+	if (!s.current || !s.best || !s.first_bit) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < count_choices; i++) {
+		s.current[i] = s.best[i] = -1;
+		s.first_bit[i] = bits;
+		bits += choices[i].count_options;
+	}
+	s.memo = bits <= DRM_ATOMIC_SEARCH_MAX_MEMO_BITS;
+
+	ret = drmAtomicSearch(&s, 0, 0, 0);
+	if (ret)
+		goto out;
+
+	/* Leave the request with the best combination appended. */
+	for (i = 0; i < count_choices; i++) {
+		if (s.best[i] < 0)
+			continue;
+		ret = drmModeAtomicMerge(req, choices[i].options[s.best[i]]);
+		if (ret)
+			goto out;
+	}
+
+	memcpy(selected, s.best, count_choices * sizeof(*selected));
+	ret = s.best_count;
+
+out:
+	if (ret < 0) {
+		req->cursor = cursor;
+		req->sorted = sorted;
+	}
+	free(s.current);
+	free(s.best);
+	free(s.first_bit);
+	free(s.failed);
+	return ret;
+}
+
+/*
+ * Nonblocking commit queue, see drmModeCommitQueueCreate().
+ */
+struct drm_commit_queue_crtc {
+	struct drm_commit_queue_crtc *next;
+	uint32_t crtc_id;
+	bool in_flight;
+	void *in_flight_data;
+	drmModeAtomicReqPtr pending;	/* Merged commits not committed yet */
+	uint32_t pending_flags;
+	void *pending_data;
+};
+
+struct _drmModeCommitQueue {
+	int fd;
+	drmModeCommitQueueHandler handler;
+	struct drm_commit_queue_crtc *crtcs;
+};
+
+drm_public drmModeCommitQueuePtr
+drmModeCommitQueueCreate(int fd, drmModeCommitQueueHandler handler)
+{
+	drmModeCommitQueuePtr queue;
+
+	if (!handler)
+		return NULL;
+
+	queue = calloc(1, sizeof(*queue));
+	if (!queue)
+		return NULL;
+
+	queue->fd = fd;
+	queue->handler = handler;
+	return queue;
+}
+
+drm_public void drmModeCommitQueueDestroy(drmModeCommitQueuePtr queue)
+{
+	struct drm_commit_queue_crtc *crtc, *next;
+
+	if (!queue)
+		return;
+
+	for (crtc = queue->crtcs; crtc; crtc = next) {
+		next = crtc->next;
+		if (crtc->pending) {
+			queue->handler(queue->fd, crtc->crtc_id, -ECANCELED,
+				       0, 0, 0, crtc->pending_data);
+			drmModeAtomicFree(crtc->pending);
+		}
+		free(crtc);
+	}
+	free(queue);
+}
+
+static struct drm_commit_queue_crtc *
+drmModeCommitQueueGetCrtc(drmModeCommitQueuePtr queue, uint32_t crtc_id)
+{
+	struct drm_commit_queue_crtc *crtc;
+
+	for (crtc = queue->crtcs; crtc; crtc = crtc->next) {
+		if (crtc->crtc_id == crtc_id)
+			return crtc;
+	}
+
+	crtc = calloc(1, sizeof(*crtc));
+	if (!crtc)
+		return NULL;
+
+	crtc->crtc_id = crtc_id;
+	crtc->next = queue->crtcs;
+	queue->crtcs = crtc;
+	return crtc;
+}
+
+/* Commit with the CRTC as the event data, returns 0 or a negative errno. */
+static int drmModeCommitQueueCommit(drmModeCommitQueuePtr queue,
+				    struct drm_commit_queue_crtc *crtc,
+				    drmModeAtomicReqPtr req, uint32_t flags)
+{
+	flags |= DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+	if (drmModeAtomicCommit(queue->fd, req, flags, crtc))
+		return -errno;
+	return 0;
+}
+
+/* Commit the pending state of a CRTC without a commit in flight. */
+static void drmModeCommitQueueFlush(drmModeCommitQueuePtr queue,
+				    struct drm_commit_queue_crtc *crtc)
+{
+	int ret;
+
+	if (!crtc->pending || crtc->in_flight)
+		return;
+
+	ret = drmModeCommitQueueCommit(queue, crtc, crtc->pending,
+				       crtc->pending_flags);
+	if (ret == -EBUSY)
+		return; /* Not ours in flight, retried on its event */
+
+	drmModeAtomicFree(crtc->pending);
+	crtc->pending = NULL;
+	if (ret) {
+		queue->handler(queue->fd, crtc->crtc_id, ret, 0, 0, 0,
+			       crtc->pending_data);
+		return;
+	}
+
+	crtc->in_flight = true;
+	crtc->in_flight_data = crtc->pending_data;
+}
+
+drm_public int drmModeCommitQueueSubmit(drmModeCommitQueuePtr queue,
+					uint32_t crtc_id,
+					drmModeAtomicReqPtr req,
+					uint32_t flags, void *user_data)
+{
+	struct drm_commit_queue_crtc *crtc;
+	void *superseded;
+	int ret;
+
+	if (!queue || !req)
+		return -EINVAL;
+
+	crtc = drmModeCommitQueueGetCrtc(queue, crtc_id);
+	if (!crtc)
+		return -ENOMEM;
+
+	if (crtc->pending) {
+		ret = drmModeAtomicMerge(crtc->pending, req);
+		if (ret)
+			return ret;
+
+		superseded = crtc->pending_data;
+		crtc->pending_flags |= flags;
+		crtc->pending_data = user_data;
+		queue->handler(queue->fd, crtc_id, -ECANCELED, 0, 0, 0,
+			       superseded);
+		return 0;
+	}
+
+	if (!crtc->in_flight) {
+		ret = drmModeCommitQueueCommit(queue, crtc, req, flags);
+		if (!ret) {
+			crtc->in_flight = true;
+			crtc->in_flight_data = user_data;
+			return 0;
+		}
+		if (ret != -EBUSY)
+			return ret;
+	}
+
+	crtc->pending = drmModeAtomicDuplicate(req);
+	if (!crtc->pending)
+		return -ENOMEM;
+	crtc->pending_flags = flags;
+	crtc->pending_data = user_data;
+	return 0;
+}
+
+/* Page flip event of a commit of the queue, or of another commit. */
+static void drmModeCommitQueueEvent(drmModeCommitQueuePtr queue,
+				    drmEventContextPtr evctx,
+				    struct drm_event_vblank *vblank)
+{
+	void *user_data = U642VOID(vblank->user_data);
+	struct drm_commit_queue_crtc *crtc;
+
+	for (crtc = queue->crtcs; crtc; crtc = crtc->next) {
+		if (crtc == user_data)
+			break;
+	}
+
+	if (crtc) {
+		/* Skip the events of other CRTCs the commit touched. */
+		if (crtc->crtc_id != vblank->crtc_id || !crtc->in_flight)
+			return;
+
+		crtc->in_flight = false;
+		queue->handler(queue->fd, crtc->crtc_id, 0, vblank->sequence,
+			       vblank->tv_sec, vblank->tv_usec,
+			       crtc->in_flight_data);
+		drmModeCommitQueueFlush(queue, crtc);
+		return;
+	}
+
+	if (evctx)
+		drmDispatchEvent(queue->fd, evctx, &vblank->base);
+
+	/* The flip that made the pending state fail with EBUSY is done. */
+	for (crtc = queue->crtcs; crtc; crtc = crtc->next) {
+		if (crtc->crtc_id == vblank->crtc_id) {
+			drmModeCommitQueueFlush(queue, crtc);
+			break;
+		}
+	}
+}
+
+drm_public int drmModeCommitQueueHandleEvents(drmModeCommitQueuePtr queue,
+					      drmEventContextPtr evctx,
+					      uint32_t flags)
+{
+	if (!queue)
+		return -EINVAL;
+
+	return drmReadEvents(queue->fd, evctx, queue, NULL, 0, flags);
+}
+
+drm_public int drmModeCommitQueueInFlight(drmModeCommitQueuePtr queue)
+{
+	struct drm_commit_queue_crtc *crtc;
+	int count = 0;
+
+	if (!queue)
+		return -EINVAL;
+
+	for (crtc = queue->crtcs; crtc; crtc = crtc->next)
+		count += crtc->in_flight;
+	return count;
+}
+
+/*
+ * Explicit synchronization of atomic commits, see
+ * drmModeAtomicFencesCreate().
+ */
+struct drm_atomic_out_fence {
+	uint32_t crtc_id;
+	uint32_t handle;
+	uint64_t point;
+	int32_t fence_fd;	/* Written by the kernel through OUT_FENCE_PTR */
+};
+
+struct _drmModeAtomicFences {
+	int fd;
+	uint32_t tmp_syncobj;	/* Binary syncobj for the timeline points */
+	int *in_fds;		/* Sync files made for the acquire fences */
+	uint32_t count_in_fds;
+	uint32_t max_in_fds;
+	int count_out;
+	struct drm_atomic_out_fence out[DRM_MODE_ATOMIC_FENCES_MAX_CRTCS];
+};
+
+drm_public drmModeAtomicFencesPtr drmModeAtomicFencesCreate(int fd)
+{
+	drmModeAtomicFencesPtr fences;
+
+	fences = calloc(1, sizeof(*fences));
+	if (!fences)
+		return NULL;
+
+	fences->fd = fd;
+	return fences;
+}
+
+static void drmModeAtomicFencesCloseOut(drmModeAtomicFencesPtr fences)
+{
+	int i;
+
+	for (i = 0; i < fences->count_out; i++) {
+		if (fences->out[i].fence_fd >= 0)
+			close(fences->out[i].fence_fd);
+		fences->out[i].fence_fd = -1;
+	}
+}
+
+drm_public void drmModeAtomicFencesReset(drmModeAtomicFencesPtr fences)
+{
+	uint32_t i;
+
+	if (!fences)
+		return;
+
+	for (i = 0; i < fences->count_in_fds; i++)
+		close(fences->in_fds[i]);
+	fences->count_in_fds = 0;
+	drmModeAtomicFencesCloseOut(fences);
+	fences->count_out = 0;
+}
+
+drm_public void drmModeAtomicFencesDestroy(drmModeAtomicFencesPtr fences)
+{
+	if (!fences)
+		return;
+
+	drmModeAtomicFencesReset(fences);
+	if (fences->tmp_syncobj)
+		drmSyncobjDestroy(fences->fd, fences->tmp_syncobj);
+	free(fences->in_fds);
+	free(fences);
+}
+
+static int drmModeAtomicFencesTmpSyncobj(drmModeAtomicFencesPtr fences)
+{
+	if (fences->tmp_syncobj)
+		return 0;
+	return drmSyncobjCreate(fences->fd, 0, &fences->tmp_syncobj) ?
+		-errno : 0;
+}
+
+drm_public int drmModeAtomicFencesAddInFence(drmModeAtomicFencesPtr fences,
+					     drmModeAtomicReqPtr req,
+					     uint32_t plane_id, int sync_file)
+{
+	int ret;
+
+	if (!fences || sync_file < 0)
+		return -EINVAL;
+
+	ret = drmModeAtomicAddPropertyByName(req, fences->fd, plane_id,
+					     "IN_FENCE_FD", sync_file);
+	return ret < 0 ? ret : 0;
+}
+
+drm_public int drmModeAtomicFencesAddInSyncobj(drmModeAtomicFencesPtr fences,
+					       drmModeAtomicReqPtr req,
+					       uint32_t plane_id,
+					       uint32_t handle, uint64_t point)
+{
+	uint32_t binary = handle;
+	int *in_fds, sync_file, ret;
+
+	if (!fences)
+		return -EINVAL;
+
+	in_fds = util_grow_array(fences->in_fds, &fences->max_in_fds,
+				 fences->count_in_fds + 1, sizeof(int));
+	if (!in_fds)
+		return -ENOMEM;
+	fences->in_fds = in_fds;
+
+	/* Only a binary syncobj exports a sync file */
+	if (point) {
+		ret = drmModeAtomicFencesTmpSyncobj(fences);
+		if (ret)
+			return ret;
+		binary = fences->tmp_syncobj;
+		if (drmSyncobjTransfer(fences->fd, binary, 0, handle, point, 0))
+			return -errno;
+	}
+	if (drmSyncobjExportSyncFile(fences->fd, binary, &sync_file))
+		return -errno;
+
+	ret = drmModeAtomicAddPropertyByName(req, fences->fd, plane_id,
+					     "IN_FENCE_FD", sync_file);
+	if (ret < 0) {
+		close(sync_file);
+		return ret;
+	}
+	fences->in_fds[fences->count_in_fds++] = sync_file;
+	return 0;
+}
+
+drm_public int drmModeAtomicFencesAddOutSyncobj(drmModeAtomicFencesPtr fences,
+						drmModeAtomicReqPtr req,
+						uint32_t crtc_id,
+						uint32_t handle, uint64_t point)
+{
+	struct drm_atomic_out_fence *out;
+	int i, ret;
+
+	if (!fences || !handle)
+		return -EINVAL;
+
+	for (i = 0; i < fences->count_out; i++) {
+		if (fences->out[i].crtc_id == crtc_id)
+			break;
+	}
+	if (i == DRM_MODE_ATOMIC_FENCES_MAX_CRTCS)
+		return -ENOSPC;
+
+	out = &fences->out[i];
+	ret = drmModeAtomicAddPropertyByName(req, fences->fd, crtc_id,
+					     "OUT_FENCE_PTR", VOID2U64(&out->fence_fd));
+	if (ret < 0)
+		return ret;
+
+	/* Added again, the last syncobj point wins as the property does */
+	out->crtc_id = crtc_id;
+	out->handle = handle;
+	out->point = point;
+	out->fence_fd = -1;
+	if (i == fences->count_out)
+		fences->count_out++;
+	return 0;
+}
+
+static int drmModeAtomicFencesImport(drmModeAtomicFencesPtr fences,
+				     struct drm_atomic_out_fence *out)
+{
+	int ret;
+
+	if (!out->point)
+		return drmSyncobjImportSyncFile(fences->fd, out->handle,
+						out->fence_fd) ? -errno : 0;
+
+	ret = drmModeAtomicFencesTmpSyncobj(fences);
+	if (ret)
+		return ret;
+	if (drmSyncobjImportSyncFile(fences->fd, fences->tmp_syncobj,
+				     out->fence_fd) ||
+	    drmSyncobjTransfer(fences->fd, out->handle, out->point,
+			       fences->tmp_syncobj, 0, 0))
+		return -errno;
+	return 0;
+}
+
+drm_public int drmModeAtomicFencesCommit(drmModeAtomicFencesPtr fences,
+					 drmModeAtomicReqPtr req,
+					 uint32_t flags, void *user_data)
+{
+	bool committed;
+	int i, ret, err;
+
+	if (!fences)
+		return -EINVAL;
+
+	ret = drmModeAtomicCommit(fences->fd, req, flags, user_data);
+	if (ret == -1)
+		ret = -errno;
+
+	/* Nothing to import from a test, the fences stay for the commit */
+	if (flags & DRM_MODE_ATOMIC_TEST_ONLY) {
+		drmModeAtomicFencesCloseOut(fences);
+		return ret;
+	}
+
+	committed = ret == 0;
+	for (i = 0; committed && i < fences->count_out; i++) {
+		if (fences->out[i].fence_fd < 0)
+			continue;
+		err = drmModeAtomicFencesImport(fences, &fences->out[i]);
+		if (err && !ret)
+			ret = err;
+	}
+	drmModeAtomicFencesReset(fences);
+	return ret;
+}
+
+/*
+ * Writeback capture ring, see drmModeWritebackCreate().
+ */
+enum drm_writeback_state {
+	DRM_WRITEBACK_FREE,
+	DRM_WRITEBACK_ATTACHED,	/* Added to a request, fence once committed */
+	DRM_WRITEBACK_HELD,	/* Captured, in use by the caller */
+};
+
+struct drm_writeback_slot {
+	drmModeWritebackFrame frame;
+	enum drm_writeback_state state;
+	uint64_t seq;		/* Attach order */
+	int32_t fence;		/* Written by the kernel at commit */
+};
+
+struct _drmModeWriteback {
+	int fd;
+	uint32_t connector_id;
+	uint32_t crtc_id_prop, fb_id_prop, fence_ptr_prop;
+	uint64_t seq;
+	int count;
+	struct drm_writeback_slot slots[];
+};
+
+static void drmModeUnexportFB2(int fds[4], int num_planes)
+{
+	int i, j;
+
+	for (i = 0; i < num_planes; i++) {
+		for (j = 0; j < i; j++) {
+			if (fds[j] == fds[i])
+				break;
+		}
+		if (j == i)
+			close(fds[i]);
+	}
+}
+
+/*
+ * Export the planes of a framebuffer as dma-bufs into fds, planes of the same
+ * buffer sharing one, and return its description without the GEM handles,
+ * which are closed. Returns NULL with errno set on failure.
+ */
+static drmModeFB2Ptr drmModeExportFB2(int fd, uint32_t fb_id, int fds[4],
+				      int *num_planes)
+{
+	struct drm_gem_close close_req;
+	drmModeFB2Ptr fb;
+	int i, j, ret = 0;
+
+	*num_planes = 0;
+	fb = drmModeGetFB2(fd, fb_id);
+	if (!fb)
+		return NULL;
+
+	for (i = 0; i < 4 && fb->handles[i]; i++) {
+		for (j = 0; j < i; j++) {
+			if (fb->handles[j] == fb->handles[i])
+				break;
+		}
+		if (j < i) {
+			fds[i] = fds[j];
+		} else if (drmPrimeHandleToFD(fd, fb->handles[i], DRM_CLOEXEC,
+					      &fds[i])) {
+			ret = -errno;
+			break;
+		}
+		*num_planes = i + 1;
+	}
+
+	/* Without the privileges for them, GETFB2 gives no handles. */
+	if (!ret && !*num_planes)
+		ret = -EACCES;
+
+	for (i = 0; i < 4 && fb->handles[i]; i++) {
+		for (j = 0; j < i; j++) {
+			if (fb->handles[j] == fb->handles[i])
+				break;
+		}
+		if (j == i) {
+			memclear(close_req);
+			close_req.handle = fb->handles[i];
+			drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &close_req);
+		}
+	}
+	for (i = 0; i < 4; i++)
+		fb->handles[i] = 0;
+
+	if (ret) {
+		drmModeUnexportFB2(fds, *num_planes);
+		*num_planes = 0;
+		drmModeFreeFB2(fb);
+		errno = -ret;
+		return NULL;
+	}
+
+	return fb;
+}
+
+/* Export the planes of a framebuffer as dma-bufs, returns 0 or -errno. */
+static int drmModeWritebackExport(int fd, drmModeWritebackFramePtr frame)
+{
+	drmModeFB2Ptr fb;
+	int i;
+
+	fb = drmModeExportFB2(fd, frame->fb_id, frame->fds, &frame->num_planes);
+	if (!fb)
+		return -errno;
+
+	frame->width = fb->width;
+	frame->height = fb->height;
+	frame->pixel_format = fb->pixel_format;
+	frame->modifier = fb->modifier;
+	for (i = 0; i < frame->num_planes; i++) {
+		frame->pitches[i] = fb->pitches[i];
+		frame->offsets[i] = fb->offsets[i];
+	}
+
+	drmModeFreeFB2(fb);
+	return 0;
+}
+
+static void drmModeWritebackUnexport(drmModeWritebackFramePtr frame)
+{
+	drmModeUnexportFB2(frame->fds, frame->num_planes);
+	frame->num_planes = 0;
+}
+
+drm_public drmModeWritebackPtr drmModeWritebackCreate(int fd,
+						      uint32_t connector_id,
+						      const uint32_t *fb_ids,
+						      int count)
+{
+	drmModeWritebackPtr wb;
+	int i, ret;
+
+	if (!fb_ids || count <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	wb = calloc(1, sizeof(*wb) + count * sizeof(wb->slots[0]));
+	if (!wb)
+		return NULL;
+
+	wb->fd = fd;
+	wb->connector_id = connector_id;
+
+	ret = drmModeObjectGetPropertyId(fd, connector_id, "CRTC_ID",
+					 &wb->crtc_id_prop, NULL);
+	if (!ret)
+		ret = drmModeObjectGetPropertyId(fd, connector_id,
+						 "WRITEBACK_FB_ID",
+						 &wb->fb_id_prop, NULL);
+	if (!ret)
+		ret = drmModeObjectGetPropertyId(fd, connector_id,
+						 "WRITEBACK_OUT_FENCE_PTR",
+						 &wb->fence_ptr_prop, NULL);
+
+	for (i = 0; !ret && i < count; i++) {
+		wb->slots[i].frame.fb_id = fb_ids[i];
+		wb->slots[i].fence = -1;
+		ret = drmModeWritebackExport(fd, &wb->slots[i].frame);
+		if (!ret)
+			wb->count++;
+	}
+
+	if (ret) {
+		drmModeWritebackDestroy(wb);
+		errno = -ret;
+		return NULL;
+	}
+
+	return wb;
+}
+
+drm_public void drmModeWritebackDestroy(drmModeWritebackPtr wb)
+{
+	int i;
+
+	if (!wb)
+		return;
+
+	for (i = 0; i < wb->count; i++) {
+		if (wb->slots[i].fence >= 0)
+			close(wb->slots[i].fence);
+		drmModeWritebackUnexport(&wb->slots[i].frame);
+	}
+	free(wb);
+}
+
+drm_public int drmModeWritebackAttach(drmModeWritebackPtr wb,
+				      drmModeAtomicReqPtr req,
+				      uint32_t crtc_id)
+{
+	struct drm_writeback_slot *slot = NULL;
+	uint32_t cursor;
+	int i, ret;
+
+	if (!wb || !req)
+		return -EINVAL;
+
+	for (i = 0; i < wb->count; i++) {
+		if (wb->slots[i].state == DRM_WRITEBACK_FREE) {
+			slot = &wb->slots[i];
+			break;
+		}
+	}
+	if (!slot)
+		return -EBUSY;
+
+	cursor = req->cursor;
+	ret = drmModeAtomicAddProperty(req, wb->connector_id,
+				       wb->crtc_id_prop, crtc_id);
+	if (ret >= 0)
+		ret = drmModeAtomicAddProperty(req, wb->connector_id,
+					       wb->fb_id_prop,
+					       slot->frame.fb_id);
+	if (ret >= 0)
+		ret = drmModeAtomicAddProperty(req, wb->connector_id,
+					       wb->fence_ptr_prop,
+					       VOID2U64(&slot->fence));
+	if (ret < 0) {
+		drmModeAtomicSetCursor(req, cursor);
+		return ret;
+	}
+
+	slot->state = DRM_WRITEBACK_ATTACHED;
+	slot->seq = wb->seq++;
+	slot->fence = -1;
+	return i;
+}
+
+drm_public void drmModeWritebackCancel(drmModeWritebackPtr wb, int index)
+{
+	if (!wb || index < 0 || index >= wb->count ||
+	    wb->slots[index].state != DRM_WRITEBACK_ATTACHED)
+		return;
+
+	if (wb->slots[index].fence >= 0)
+		close(wb->slots[index].fence);
+	wb->slots[index].fence = -1;
+	wb->slots[index].state = DRM_WRITEBACK_FREE;
+}
+
+drm_public int drmModeWritebackGetFence(drmModeWritebackPtr wb, int index)
+{
+	if (!wb || index < 0 || index >= wb->count ||
+	    wb->slots[index].state != DRM_WRITEBACK_ATTACHED)
+		return -1;
+
+	return wb->slots[index].fence;
+}
+
+drm_public int drmModeWritebackAcquire(drmModeWritebackPtr wb, int timeout_ms,
+				       drmModeWritebackFramePtr *frame)
+{
+	struct drm_writeback_slot *slot = NULL;
+	int i, signaled = 0, ret;
+
+	if (!wb || !frame)
+		return -EINVAL;
+
+	for (i = 0; i < wb->count; i++) {
+		if (wb->slots[i].state == DRM_WRITEBACK_ATTACHED &&
+		    (!slot || wb->slots[i].seq < slot->seq))
+			slot = &wb->slots[i];
+	}
+	if (!slot || slot->fence < 0)
+		return -ENOENT;
+
+	ret = util_sync_file_wait(&slot->fence, &signaled, 1, 1,
+				  timeout_ms < 0 ? UINT64_MAX :
+				  timeout_ms * 1000000ull);
+	if (ret)
+		return ret;
+
+	close(slot->fence);
+	slot->fence = -1;
+	slot->state = DRM_WRITEBACK_HELD;
+	*frame = &slot->frame;
+	return slot - wb->slots;
+}
+
+drm_public int drmModeWritebackRelease(drmModeWritebackPtr wb, int index)
+{
+	if (!wb || index < 0 || index >= wb->count ||
+	    wb->slots[index].state != DRM_WRITEBACK_HELD)
+		return -EINVAL;
+
+	wb->slots[index].state = DRM_WRITEBACK_FREE;
+	return 0;
+}
+
+/*
+ * Screen capture, see drmModeCaptureCreate().
+ */
+#define DRM_CAPTURE_CACHE_SIZE	8
+
+/* From linux/dma-buf.h, which not all the supported kernels have. */
+struct drm_dma_buf_export_sync_file {
+	uint32_t flags;
+	int32_t fd;
+};
+#define DRM_DMA_BUF_SYNC_READ	(1 << 0)
+#define DRM_DMA_BUF_IOCTL_EXPORT_SYNC_FILE \
+	_IOWR('b', 2, struct drm_dma_buf_export_sync_file)
+
+struct drm_capture_entry {
+	drmModeCaptureFrame frame;
+	void *maps[4];		/* Per dma-buf, at the index of its first plane */
+	size_t map_sizes[4];
+	uint64_t last_use;
+	int held;
+};
+
+struct _drmModeCapture {
+	int fd;
+	uint32_t crtc_id;
+	uint32_t flags;
+	uint32_t fb_id;		/* From drmModeCaptureSetFB() */
+	uint64_t use;
+	struct drm_capture_entry entries[DRM_CAPTURE_CACHE_SIZE];
+};
+
+static void drmModeCaptureEvict(struct drm_capture_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (entry->maps[i])
+			drm_munmap(entry->maps[i], entry->map_sizes[i]);
+	}
+	if (entry->frame.fence >= 0)
+		close(entry->frame.fence);
+	drmModeUnexportFB2(entry->frame.fds, entry->frame.num_planes);
+
+	memset(entry, 0, sizeof(*entry));
+	entry->frame.fence = -1;
+}
+
+static int drmModeCaptureExport(drmModeCapturePtr cap,
+				struct drm_capture_entry *entry, uint32_t fb_id)
+{
+	drmModeCaptureFramePtr frame = &entry->frame;
+	drmModeFB2Ptr fb;
+	off_t size;
+	void *map;
+	int i, j;
+
+	fb = drmModeExportFB2(cap->fd, fb_id, frame->fds, &frame->num_planes);
+	if (!fb)
+		return -errno;
+
+	frame->fb_id = fb_id;
+	frame->width = fb->width;
+	frame->height = fb->height;
+	frame->pixel_format = fb->pixel_format;
+	frame->modifier = fb->modifier;
+	for (i = 0; i < frame->num_planes; i++) {
+		frame->pitches[i] = fb->pitches[i];
+		frame->offsets[i] = fb->offsets[i];
+	}
+	drmModeFreeFB2(fb);
+
+	if (!(cap->flags & DRM_MODE_CAPTURE_MAP))
+		return 0;
+
+	for (i = 0; i < frame->num_planes; i++) {
+		for (j = 0; j < i; j++) {
+			if (frame->fds[j] == frame->fds[i])
+				break;
+		}
+		if (j == i) {
+			size = lseek(frame->fds[i], 0, SEEK_END);
+			map = size > 0 ? drm_mmap(NULL, size, PROT_READ,
+						  MAP_SHARED, frame->fds[i], 0) :
+					 MAP_FAILED;
+			if (map == MAP_FAILED) {
+				drmModeCaptureEvict(entry);
+				return size > 0 ? -errno : -EINVAL;
+			}
+			entry->maps[i] = map;
+			entry->map_sizes[i] = size;
+		}
+		frame->map[i] = (char *)entry->maps[j] + frame->offsets[i];
+	}
+
+	return 0;
+}
+
+drm_public drmModeCapturePtr drmModeCaptureCreate(int fd, uint32_t crtc_id,
+						  uint32_t flags)
+{
+	drmModeCapturePtr cap;
+	int i;
+
+	if (flags & ~DRM_MODE_CAPTURE_MAP) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	cap = calloc(1, sizeof(*cap));
+	if (!cap)
+		return NULL;
+
+	cap->fd = fd;
+	cap->crtc_id = crtc_id;
+	cap->flags = flags;
+	for (i = 0; i < DRM_CAPTURE_CACHE_SIZE; i++)
+		cap->entries[i].frame.fence = -1;
+
+	return cap;
+}
+
+drm_public void drmModeCaptureDestroy(drmModeCapturePtr cap)
+{
+	int i;
+
+	if (!cap)
+		return;
+
+	for (i = 0; i < DRM_CAPTURE_CACHE_SIZE; i++) {
+		if (cap->entries[i].frame.fb_id)
+			drmModeCaptureEvict(&cap->entries[i]);
+	}
+	free(cap);
+}
+
+drm_public void drmModeCaptureSetFB(drmModeCapturePtr cap, uint32_t fb_id)
+{
+	if (cap)
+		cap->fb_id = fb_id;
+}
+
+drm_public int drmModeCaptureAcquire(drmModeCapturePtr cap,
+				     drmModeCaptureFramePtr *frame)
+{
+	struct drm_capture_entry *entry = NULL, *victim = NULL;
+	struct drm_dma_buf_export_sync_file sync;
+	struct drm_mode_crtc crtc;
+	uint32_t fb_id;
+	int i, ret;
+
+	if (!cap || !frame)
+		return -EINVAL;
+
+	/* With atomic drivers, this is the primary plane's current state. */
+	fb_id = cap->fb_id;
+	if (!fb_id) {
+		memclear(crtc);
+		crtc.crtc_id = cap->crtc_id;
+		if (drmIoctl(cap->fd, DRM_IOCTL_MODE_GETCRTC, &crtc))
+			return -errno;
+		fb_id = crtc.fb_id;
+	}
+	if (!fb_id)
+		return -ENOENT;
+
+	/* The free entries have no last use, so they go first. */
+	for (i = 0; i < DRM_CAPTURE_CACHE_SIZE; i++) {
+		struct drm_capture_entry *e = &cap->entries[i];
+
+		if (e->frame.fb_id == fb_id) {
+			entry = e;
+			break;
+		}
+		if (!e->held && (!victim || e->last_use < victim->last_use))
+			victim = e;
+	}
+
+	if (!entry) {
+		if (!victim)
+			return -EBUSY;
+		if (victim->frame.fb_id)
+			drmModeCaptureEvict(victim);
+		ret = drmModeCaptureExport(cap, victim, fb_id);
+		if (ret)
+			return ret;
+		entry = victim;
+	}
+
+	/*
+	 * The fences a reader waits for, i.e. those of the rendering. Frames
+	 * held already keep theirs, which the caller may be waiting on.
+	 */
+	if (!entry->held) {
+		memclear(sync);
+		sync.flags = DRM_DMA_BUF_SYNC_READ;
+		if (!ioctl(entry->frame.fds[0],
+			   DRM_DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &sync))
+			entry->frame.fence = sync.fd;
+	}
+
+	entry->held++;
+	entry->last_use = ++cap->use;
+	*frame = &entry->frame;
+	return entry - cap->entries;
+}
+
+drm_public int drmModeCaptureRelease(drmModeCapturePtr cap, int index)
+{
+	struct drm_capture_entry *entry;
+
+	if (!cap || index < 0 || index >= DRM_CAPTURE_CACHE_SIZE ||
+	    !cap->entries[index].held)
+		return -EINVAL;
+
+	entry = &cap->entries[index];
+	if (--entry->held == 0 && entry->frame.fence >= 0) {
+		close(entry->frame.fence);
+		entry->frame.fence = -1;
+	}
+	return 0;
+}
+
+drm_public int drmModeCaptureInvalidate(drmModeCapturePtr cap, uint32_t fb_id)
+{
+	int i;
+
+	if (!cap || !fb_id)
+		return -EINVAL;
+
+	for (i = 0; i < DRM_CAPTURE_CACHE_SIZE; i++) {
+		if (cap->entries[i].frame.fb_id != fb_id)
+			continue;
+		if (cap->entries[i].held)
+			return -EBUSY;
+		drmModeCaptureEvict(&cap->entries[i]);
+		return 0;
+	}
+	return -ENOENT;
+}
+
+drm_public int
+drmModeCreatePropertyBlob(int fd, const void *data, size_t length,
+                                     uint32_t *id)
+{
+	struct drm_mode_create_blob create;
+	int ret;
+
+	if (length >= 0xffffffff)
+		return -ERANGE;
+
+	memclear(create);
+
+	create.length = length;
+	create.data = (uintptr_t) data;
+	create.blob_id = 0;
+	*id = 0;
+
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_CREATEPROPBLOB, &create);
+	if (ret != 0)
+		return ret;
+
+	*id = create.blob_id;
+	return 0;
+}
+
+/*
+ * Shared property blobs: identical payloads created through
+ * drmModeCreatePropertyBlobShared() map to one refcounted kernel blob.
+ */
+struct drm_blob_cache_entry {
+	struct drm_blob_cache_entry *next;	/* Same content hash */
+	uint32_t id;
+	uint32_t refs;
+	unsigned long hash;
+	size_t length;
+	uint8_t data[];
+};
+
+struct drm_blob_cache {
+	void *by_hash;	/* content hash -> struct drm_blob_cache_entry chain */
+	void *by_id;	/* blob id -> struct drm_blob_cache_entry */
+};
+
+static pthread_mutex_t drm_blob_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *drm_blob_caches; /* fd -> struct drm_blob_cache */
+
+static struct drm_blob_cache *drmModeBlobCacheGet(int fd, bool create)
+{
+	struct drm_blob_cache *cache;
+	void *value;
+
+	if (!drm_blob_caches) {
+		if (!create)
+			return NULL;
+		drm_blob_caches = drmHashCreate();
+		if (!drm_blob_caches)
+			return NULL;
+	}
+
+	if (!drmHashLookup(drm_blob_caches, fd, &value))
+		return value;
+	if (!create)
+		return NULL;
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+
+	cache->by_hash = drmHashCreate();
+	cache->by_id = drmHashCreate();
+	if (!cache->by_hash || !cache->by_id ||
+	    drmHashInsert(drm_blob_caches, fd, cache)) {
+		if (cache->by_hash)
+			drmHashDestroy(cache->by_hash);
+		if (cache->by_id)
+			drmHashDestroy(cache->by_id);
+		free(cache);
+		return NULL;
+	}
+
+	return cache;
+}
+
+/* Unlink an entry from the content hash chains, the caller frees it. */
+static void drmModeBlobCacheUnlink(struct drm_blob_cache *cache,
+				   struct drm_blob_cache_entry *entry)
+{
+	struct drm_blob_cache_entry *head;
+	void *value;
+
+	drmHashDelete(cache->by_id, entry->id);
+	if (drmHashLookup(cache->by_hash, entry->hash, &value))
+		return;
+
+	head = value;
+	if (head == entry) {
+		drmHashDelete(cache->by_hash, entry->hash);
+		if (entry->next)
+			drmHashInsert(cache->by_hash, entry->hash, entry->next);
+		return;
+	}
+
+	for (; head->next; head = head->next) {
+		if (head->next == entry) {
+			head->next = entry->next;
+			return;
+		}
+	}
+}
+
+drm_public int
+drmModeCreatePropertyBlobShared(int fd, const void *data, size_t length,
+				uint32_t *id)
+{
+	struct drm_blob_cache_entry *entry, *head = NULL;
+	struct drm_blob_cache *cache;
+	unsigned long hash;
+	void *value;
+	int ret;
+
+	if (length >= 0xffffffff)
+		return -ERANGE;
+
+	hash = drmModeHashData(DRM_MODE_HASH_INIT, data, length);
+
+	pthread_mutex_lock(&drm_blob_cache_lock);
+	cache = drmModeBlobCacheGet(fd, true);
+	if (!cache) {
+		pthread_mutex_unlock(&drm_blob_cache_lock);
+		return drmModeCreatePropertyBlob(fd, data, length, id);
+	}
+
+	if (!drmHashLookup(cache->by_hash, hash, &value))
+		head = value;
+
+	for (entry = head; entry; entry = entry->next) {
+		if (entry->length == length &&
+		    !memcmp(entry->data, data, length)) {
+			entry->refs++;
+			*id = entry->id;
+			pthread_mutex_unlock(&drm_blob_cache_lock);
+			return 0;
+		}
+	}
+
+	ret = drmModeCreatePropertyBlob(fd, data, length, id);
+	if (ret)
+		goto out;
+
+	/* Without bookkeeping the blob simply is not shared. */
+	entry = malloc(sizeof(*entry) + length);
+	if (!entry)
+		goto out;
+
+	entry->id = *id;
+	entry->refs = 1;
+	entry->hash = hash;
+	entry->length = length;
+	memcpy(entry->data, data, length);
+	if (drmHashInsert(cache->by_id, entry->id, entry)) {
+		free(entry);
+		goto out;
+	}
+
+	if (head) {
+		entry->next = head->next;
+		head->next = entry;
+	} else {
+		entry->next = NULL;
+		if (drmHashInsert(cache->by_hash, hash, entry)) {
+			drmHashDelete(cache->by_id, entry->id);
+			free(entry);
+		}
+	}
+
+out:
+	pthread_mutex_unlock(&drm_blob_cache_lock);
+	return ret;
+}
+
+drm_public void drmModeInvalidatePropertyBlobCache(int fd)
+{
+	struct drm_blob_cache *cache;
+	unsigned long key;
+	void *value;
+
+	pthread_mutex_lock(&drm_blob_cache_lock);
+	cache = drmModeBlobCacheGet(fd, false);
+	if (cache) {
+		drmHashDelete(drm_blob_caches, fd);
+		if (drmHashFirst(cache->by_id, &key, &value) == 1) {
+			do {
+				free(value);
+			} while (drmHashNext(cache->by_id, &key, &value));
+		}
+		drmHashDestroy(cache->by_id);
+		drmHashDestroy(cache->by_hash);
+		free(cache);
+	}
+	pthread_mutex_unlock(&drm_blob_cache_lock);
+}
+
+drm_public int
+drmModeDestroyPropertyBlob(int fd, uint32_t id)
+{
+	struct drm_mode_destroy_blob destroy;
+	struct drm_blob_cache *cache;
+	void *value;
+
+	pthread_mutex_lock(&drm_blob_cache_lock);
+	cache = drmModeBlobCacheGet(fd, false);
+	if (cache && !drmHashLookup(cache->by_id, id, &value)) {
+		struct drm_blob_cache_entry *entry = value;
+
+		if (--entry->refs) {
+			pthread_mutex_unlock(&drm_blob_cache_lock);
+			return 0;
+		}
+		drmModeBlobCacheUnlink(cache, entry);
+		free(entry);
+	}
+	pthread_mutex_unlock(&drm_blob_cache_lock);
+
+	drmModePropertyCacheForgetBlob(fd, id);
+
+	memclear(destroy);
+	destroy.blob_id = id;
+	return DRM_IOCTL(fd, DRM_IOCTL_MODE_DESTROYPROPBLOB, &destroy);
+}
+
+/*
+ * Cursor update coalescing, see drmModeCursorCreate().
+ */
+#define DRM_CURSOR_MOVED	(1 << 0)
+#define DRM_CURSOR_IMAGE	(1 << 1)
+
+/* Submissions between two vblank samples of the cursor's own predictor. */
+#define DRM_CURSOR_RESAMPLE	64
+
+static const char *const drm_cursor_props[] = {
+	"FB_ID", "CRTC_ID", "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H",
+	"SRC_X", "SRC_Y", "SRC_W", "SRC_H",
+};
+#define DRM_CURSOR_PROPS \
+	(sizeof(drm_cursor_props) / sizeof(drm_cursor_props[0]))
+
+struct _drmModeCursor {
+	int fd;
+	uint32_t crtc_id;
+	uint32_t plane_id;
+	uint32_t prop_ids[DRM_CURSOR_PROPS];
+	drmModeAtomicReqPtr req;
+
+	drmVblankPredictorPtr pred;
+	bool own_pred;
+	unsigned int submits;
+
+	uint32_t pending;
+	int32_t x, y;
+	uint32_t fb_id, bo_handle;
+	uint32_t width, height;
+	int32_t hot_x, hot_y;
+
+	/* Vblank the last update was submitted for, if any. */
+	bool submitted;
+	uint64_t last_seq;
+};
+
+drm_public drmModeCursorPtr drmModeCursorCreate(int fd, uint32_t crtc_id,
+						uint32_t plane_id,
+						drmVblankPredictorPtr pred)
+{
+	drmModeCursorPtr cursor;
+	unsigned i;
+
+	cursor = calloc(1, sizeof(*cursor));
+	if (!cursor)
+		return NULL;
+
+	cursor->fd = fd;
+	cursor->crtc_id = crtc_id;
+	cursor->plane_id = plane_id;
+	cursor->pred = pred;
+
+	if (plane_id) {
+		for (i = 0; i < DRM_CURSOR_PROPS; i++) {
+			if (drmModeObjectGetPropertyId(fd, plane_id,
+						       drm_cursor_props[i],
+						       &cursor->prop_ids[i],
+						       NULL))
+				goto fail;
+		}
+		cursor->req = drmModeAtomicAlloc();
+		if (!cursor->req)
+			goto fail;
+	}
+
+	if (!pred) {
+		cursor->pred = drmVblankPredictorCreate();
+		if (!cursor->pred)
+			goto fail;
+		cursor->own_pred = true;
+	}
+
+	return cursor;
+
+fail:
+	drmModeCursorDestroy(cursor);
+	return NULL;
+}
+
+drm_public void drmModeCursorDestroy(drmModeCursorPtr cursor)
+{
+	if (!cursor)
+		return;
+
+	if (cursor->own_pred)
+		drmVblankPredictorDestroy(cursor->pred);
+	drmModeAtomicFree(cursor->req);
+	free(cursor);
+}
+
+drm_public void drmModeCursorMove(drmModeCursorPtr cursor, int32_t x,
+				  int32_t y)
+{
+	if (!cursor || (cursor->x == x && cursor->y == y))
+		return;
+
+	cursor->x = x;
+	cursor->y = y;
+	cursor->pending |= DRM_CURSOR_MOVED;
+}
+
+drm_public void drmModeCursorSetImage(drmModeCursorPtr cursor, uint32_t fb_id,
+				      uint32_t bo_handle, uint32_t width,
+				      uint32_t height, int32_t hot_x,
+				      int32_t hot_y)
+{
+	if (!cursor)
+		return;
+
+	cursor->fb_id = fb_id;
+	cursor->bo_handle = bo_handle;
+	cursor->width = width;
+	cursor->height = height;
+	cursor->hot_x = hot_x;
+	cursor->hot_y = hot_y;
+	cursor->pending |= DRM_CURSOR_IMAGE;
+}
+
+/*
+ * When to submit the pending update, and the vblank it is for: a margin of
+ * a quarter period before the first vblank at least that far away, and
+ * after the one of the previous update. Without prediction, right away.
+ */
+static int drmModeCursorDeadline(drmModeCursorPtr cursor, uint64_t now,
+				 uint64_t *deadline, uint64_t *target)
+{
+	uint64_t period, margin, seq, ns;
+
+	*deadline = now;
+	*target = 0;
+	if (drmVblankPredictorGetPeriod(cursor->pred, &period, NULL) ||
+	    !period ||
+	    drmVblankPredictorPredict(cursor->pred, &seq, &ns, 1) < 0)
+		return -EAGAIN;
+
+	margin = period / 4;
+	if (drmVblankPredictorSequenceAt(cursor->pred, now + margin, target))
+		return -EAGAIN;
+	if (cursor->submitted && *target <= cursor->last_seq)
+		*target = cursor->last_seq + 1;
+
+	/* ns is the time of seq, the vblank after the last sampled one. */
+	ns += (*target - seq) * period;
+	*deadline = ns > now + margin ? ns - margin : now;
+	return 0;
+}
+
+drm_public int64_t drmModeCursorGetTimeout(drmModeCursorPtr cursor,
+					   uint64_t now_ns)
+{
+	uint64_t deadline, target;
+
+	if (!cursor || !cursor->pending)
+		return -1;
+
+	drmModeCursorDeadline(cursor, now_ns, &deadline, &target);
+	return deadline - now_ns;
+}
+
+static int drmModeCursorCommit(drmModeCursorPtr cursor)
+{
+	uint64_t values[DRM_CURSOR_PROPS] = {
+		cursor->fb_id, cursor->fb_id ? cursor->crtc_id : 0,
+		(uint64_t)(int64_t)cursor->x, (uint64_t)(int64_t)cursor->y,
+		cursor->width, cursor->height,
+		0, 0, (uint64_t)cursor->width << 16,
+		(uint64_t)cursor->height << 16,
+	};
+	unsigned i;
+
+	drmModeAtomicSetCursor(cursor->req, 0);
+	for (i = 0; i < DRM_CURSOR_PROPS; i++) {
+		if (drmModeAtomicAddProperty(cursor->req, cursor->plane_id,
+					     cursor->prop_ids[i],
+					     values[i]) < 0)
+			return -ENOMEM;
+	}
+
+	if (drmModeAtomicCommit(cursor->fd, cursor->req,
+				DRM_MODE_ATOMIC_NONBLOCK, NULL))
+		return -errno;
+	return 0;
+}
+
+static int drmModeCursorLegacy(drmModeCursorPtr cursor)
+{
+	int ret;
+
+	if (cursor->pending & DRM_CURSOR_IMAGE) {
+		ret = drmModeSetCursor2(cursor->fd, cursor->crtc_id,
+					cursor->bo_handle, cursor->width,
+					cursor->height, cursor->hot_x,
+					cursor->hot_y);
+		if (ret)
+			return ret;
+		cursor->pending &= ~DRM_CURSOR_IMAGE;
+	}
+
+	if (cursor->pending & DRM_CURSOR_MOVED)
+		return drmModeMoveCursor(cursor->fd, cursor->crtc_id,
+					 cursor->x, cursor->y);
+	return 0;
+}
+
+drm_public int drmModeCursorFlush(drmModeCursorPtr cursor, uint64_t now_ns)
+{
+	uint64_t deadline, target, seq, ns;
+	int predicted, ret;
+
+	if (!cursor)
+		return -EINVAL;
+	if (!cursor->pending)
+		return 0;
+
+	predicted = !drmModeCursorDeadline(cursor, now_ns, &deadline, &target);
+	if (now_ns < deadline)
+		return 0;
+
+	ret = cursor->plane_id ? drmModeCursorCommit(cursor) :
+				 drmModeCursorLegacy(cursor);
+
+	/* Even an update that failed takes the slot, not to spin on it. */
+	if (predicted) {
+		cursor->submitted = true;
+		cursor->last_seq = target;
+	}
+
+	/* The previous commit is still in flight, retry for the next vblank. */
+	if (ret == -EBUSY)
+		return 0;
+	if (ret)
+		return ret;
+	cursor->pending = 0;
+
+	if (cursor->own_pred &&
+	    (!predicted || ++cursor->submits % DRM_CURSOR_RESAMPLE == 0) &&
+	    !drmCrtcGetSequence(cursor->fd, cursor->crtc_id, &seq, &ns))
+		drmVblankPredictorAddSample(cursor->pred, seq, ns);
+
+	return 1;
+}
+
+/*
+ * Color management, see drmModeColorCreate().
+ */
+static uint16_t drmModeColorQuantize(double v)
+{
+	if (!(v > 0.0))
+		return 0;
+	if (v >= 1.0)
+		return 0xffff;
+	return v * 0xffff + 0.5;
+}
+
+drm_public void drmModeColorLutBuild(struct drm_color_lut *lut, uint32_t size,
+				     const double gamma[3], const double gain[3])
+{
+	static const double one[3] = { 1.0, 1.0, 1.0 };
+	double x, v[3];
+	uint32_t i;
+	int c, k;
+
+	if (!lut || !size)
+		return;
+	if (!gamma)
+		gamma = one;
+	if (!gain)
+		gain = one;
+
+	for (i = 0; i < size; i++) {
+		x = size > 1 ? (double)i / (size - 1) : 0.0;
+
+		/* The channels often share the curve, and only the gain differs. */
+		for (c = 0; c < 3; c++) {
+			for (k = 0; k < c; k++) {
+				if (gamma[k] == gamma[c])
+					break;
+			}
+			if (k < c)
+				v[c] = v[k];
+			else
+				v[c] = gamma[c] == 1.0 ? x : pow(x, gamma[c]);
+		}
+
+		lut[i].red = drmModeColorQuantize(gain[0] * v[0]);
+		lut[i].green = drmModeColorQuantize(gain[1] * v[1]);
+		lut[i].blue = drmModeColorQuantize(gain[2] * v[2]);
+		lut[i].reserved = 0;
+	}
+}
+
+static uint16_t drmModeColorLerp(uint16_t a, uint16_t b, uint32_t f)
+{
+	return ((uint32_t)a * (0x10000 - f) + (uint32_t)b * f + 0x8000) >> 16;
+}
+
+drm_public void drmModeColorLutResample(struct drm_color_lut *dst,
+					uint32_t dst_size,
+					const struct drm_color_lut *src,
+					uint32_t src_size)
+{
+	uint64_t pos;
+	uint32_t i, j, f;
+
+	if (!dst || !src || !src_size)
+		return;
+
+	for (i = 0; i < dst_size; i++) {
+		/* Position in src, in 16.16 fixed point. */
+		pos = dst_size > 1 ?
+		      ((uint64_t)i * (src_size - 1) << 16) / (dst_size - 1) : 0;
+		j = pos >> 16;
+		f = pos & 0xffff;
+
+		if (j >= src_size - 1) {
+			dst[i] = src[src_size - 1];
+			continue;
+		}
+		dst[i].red = drmModeColorLerp(src[j].red, src[j + 1].red, f);
+		dst[i].green = drmModeColorLerp(src[j].green, src[j + 1].green, f);
+		dst[i].blue = drmModeColorLerp(src[j].blue, src[j + 1].blue, f);
+		dst[i].reserved = 0;
+	}
+}
+
+drm_public void drmModeColorCtmBuild(struct drm_color_ctm *ctm,
+				     const double matrix[9])
+{
+	uint64_t sign;
+	double v;
+	int i;
+
+	for (i = 0; i < 9; i++) {
+		v = matrix[i];
+		sign = 0;
+		if (v < 0.0) {
+			sign = 1ull << 63;
+			v = -v;
+		}
+		ctm->matrix[i] = sign | (v < 2147483648.0 ?
+					 (uint64_t)(v * 4294967296.0 + 0.5) :
+					 (1ull << 63) - 1);
+	}
+}
+
+#define DRM_COLOR_CTM	2
+
+struct drm_color_prop {
+	uint32_t prop_id;
+	uint32_t blob_id;	/* Set on the CRTC, or to be */
+	bool owned;		/* blob_id is one of ours, shared */
+	bool dirty;		/* To add to the next request */
+};
+
+struct _drmModeColor {
+	int fd;
+	uint32_t crtc_id;
+	uint32_t lut_sizes[2];
+	struct drm_color_prop props[3];	/* Indexed by DRM_MODE_COLOR_*, CTM */
+	struct drm_color_lut *scratch;	/* For the resampling */
+};
+
+drm_public drmModeColorPtr drmModeColorCreate(int fd, uint32_t crtc_id)
+{
+	static const char *const names[] = {
+		"DEGAMMA_LUT", "GAMMA_LUT", "CTM",
+		"DEGAMMA_LUT_SIZE", "GAMMA_LUT_SIZE",
+	};
+	drmModeObjectPropertiesPtr props;
+	drmModeColorPtr color;
+	uint32_t prop_id;
+	unsigned i, j;
+
+	props = drmModeObjectGetProperties(fd, crtc_id, DRM_MODE_OBJECT_CRTC);
+	if (!props)
+		return NULL;
+
+	color = calloc(1, sizeof(*color));
+	if (!color) {
+		drmModeFreeObjectProperties(props);
+		return NULL;
+	}
+	color->fd = fd;
+	color->crtc_id = crtc_id;
+
+	/* The current blobs are not ours, they are only compared against. */
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (drmModeObjectGetPropertyId(fd, crtc_id, names[i], &prop_id,
+					       NULL))
+			continue;
+		for (j = 0; j < props->count_props; j++) {
+			if (props->props[j] == prop_id)
+				break;
+		}
+		if (j == props->count_props)
+			continue;
+
+		if (i < 3) {
+			color->props[i].prop_id = prop_id;
+			color->props[i].blob_id = props->prop_values[j];
+		} else {
+			color->lut_sizes[i - 3] = props->prop_values[j];
+		}
+	}
+
+	drmModeFreeObjectProperties(props);
+	return color;
+}
+
+drm_public void drmModeColorDestroy(drmModeColorPtr color)
+{
+	int i;
+
+	if (!color)
+		return;
+
+	/* The kernel keeps its own references to the blobs in use. */
+	for (i = 0; i < 3; i++) {
+		if (color->props[i].owned)
+			drmModeDestroyPropertyBlob(color->fd,
+						   color->props[i].blob_id);
+	}
+	free(color->scratch);
+	free(color);
+}
+
+drm_public uint32_t drmModeColorGetLutSize(drmModeColorPtr color, int lut)
+{
+	if (!color || (lut != DRM_MODE_COLOR_DEGAMMA_LUT &&
+		       lut != DRM_MODE_COLOR_GAMMA_LUT) ||
+	    !color->props[lut].prop_id)
+		return 0;
+
+	return color->lut_sizes[lut];
+}
+
+static int drmModeColorSetBlob(drmModeColorPtr color, int index,
+			       const void *data, size_t size)
+{
+	struct drm_color_prop *prop = &color->props[index];
+	uint32_t blob_id = 0;
+	int ret;
+
+	if (!prop->prop_id)
+		return -EOPNOTSUPP;
+
+	if (data) {
+		ret = drmModeCreatePropertyBlobShared(color->fd, data, size,
+						      &blob_id);
+		if (ret)
+			return ret;
+	}
+
+	/* The shared blob of the same content is the one already set. */
+	if (blob_id == prop->blob_id) {
+		if (blob_id && prop->owned)
+			drmModeDestroyPropertyBlob(color->fd, blob_id);
+		return 0;
+	}
+
+	if (prop->owned)
+		drmModeDestroyPropertyBlob(color->fd, prop->blob_id);
+	prop->blob_id = blob_id;
+	prop->owned = blob_id != 0;
+	prop->dirty = true;
+	return 1;
+}
+
+drm_public int drmModeColorSetLut(drmModeColorPtr color, int lut,
+				  const struct drm_color_lut *data,
+				  uint32_t size)
+{
+	uint32_t hw_size;
+
+	hw_size = drmModeColorGetLutSize(color, lut);
+	if (!hw_size)
+		return -EOPNOTSUPP;
+
+	if (data && size != hw_size) {
+		if (!color->scratch) {
+			color->scratch = malloc(MAX2(color->lut_sizes[0],
+						     color->lut_sizes[1]) *
+						sizeof(*color->scratch));
+			if (!color->scratch)
+				return -ENOMEM;
+		}
+		drmModeColorLutResample(color->scratch, hw_size, data, size);
+		data = color->scratch;
+	}
+
+	return drmModeColorSetBlob(color, lut, data,
+				   hw_size * sizeof(*data));
+}
+
+drm_public int drmModeColorSetCtm(drmModeColorPtr color,
+				  const struct drm_color_ctm *ctm)
+{
+	if (!color)
+		return -EINVAL;
+
+	return drmModeColorSetBlob(color, DRM_COLOR_CTM, ctm, sizeof(*ctm));
+}
+
+drm_public int drmModeColorAddProperties(drmModeColorPtr color,
+					 drmModeAtomicReqPtr req,
+					 uint32_t flags)
+{
+	struct drm_color_prop *prop;
+	int i, ret, count = 0;
+
+	if (!color || !req || (flags & ~DRM_MODE_COLOR_ADD_ALL))
+		return -EINVAL;
+
+	for (i = 0; i < 3; i++) {
+		prop = &color->props[i];
+		if (!prop->prop_id ||
+		    (!prop->dirty && !(flags & DRM_MODE_COLOR_ADD_ALL)))
+			continue;
+
+		ret = drmModeAtomicAddProperty(req, color->crtc_id,
+					       prop->prop_id, prop->blob_id);
+		if (ret < 0)
+			return ret;
+		prop->dirty = false;
+		count++;
+	}
+
+	return count;
+}
+
+drm_public int
+drmModeCreateLease(int fd, const uint32_t *objects, int num_objects, int flags,
+                   uint32_t *lessee_id)
+{
+	struct drm_mode_create_lease create;
+	int ret;
+
+	memclear(create);
+	create.object_ids = (uintptr_t) objects;
+	create.object_count = num_objects;
+	create.flags = flags;
+
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_CREATE_LEASE, &create);
+	if (ret == 0) {
+		*lessee_id = create.lessee_id;
+		return create.fd;
+	}
+	return -errno;
+}
+
+drm_public drmModeLesseeListPtr
+drmModeListLessees(int fd)
+{
+	struct drm_mode_list_lessees list;
+	uint32_t count;
+	drmModeLesseeListPtr ret;
+
+	memclear(list);
+
+	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_LIST_LESSEES, &list))
+		return NULL;
+
+	count = list.count_lessees;
+	ret = drmMalloc(sizeof (drmModeLesseeListRes) + count * sizeof (ret->lessees[0]));
+	if (!ret)
+		return NULL;
+
+	list.lessees_ptr = VOID2U64(&ret->lessees[0]);
+	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_LIST_LESSEES, &list)) {
+		drmFree(ret);
+		return NULL;
+	}
+
+	ret->count = count;
+	return ret;
+}
+
+drm_public drmModeObjectListPtr
+drmModeGetLease(int fd)
+{
+	struct drm_mode_get_lease get;
+	uint32_t count;
+	drmModeObjectListPtr ret;
+
+	memclear(get);
+
+	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_GET_LEASE, &get))
+		return NULL;
+
+	count = get.count_objects;
+	ret = drmMalloc(sizeof (drmModeObjectListRes) + count * sizeof (ret->objects[0]));
+	if (!ret)
+		return NULL;
+
+	get.objects_ptr = VOID2U64(&ret->objects[0]);
+	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_GET_LEASE, &get)) {
+		drmFree(ret);
+		return NULL;
+	}
+
+	ret->count = count;
+	return ret;
+}
+
+drm_public int
+drmModeRevokeLease(int fd, uint32_t lessee_id)
+{
+	struct drm_mode_revoke_lease revoke;
+	int ret;
+
+	memclear(revoke);
+
+	revoke.lessee_id = lessee_id;
+
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_REVOKE_LEASE, &revoke);
+	if (ret == 0)
+		return 0;
+	return -errno;
+}
+
+/*
+ * Lease manager, see drmModeLeaseManagerCreate().
+ */
+struct drm_lease {
+	struct drm_lease *next;
+	uint32_t lessee_id;
+	int fd;			/* -1 once handed out */
+	uint32_t connector_id;
+	uint32_t flags;
+	int count_objects;
+	uint32_t objects[];
+};
+
+struct _drmModeLeaseManager {
+	int fd;
+	drmModeTopologyPtr topology;
+	struct drm_lease *leases;
+};
+
+static bool drmModeLeaseManagerLeased(drmModeLeaseManagerPtr manager,
+				      uint32_t id)
+{
+	struct drm_lease *lease;
+	int i;
+
+	for (lease = manager->leases; lease; lease = lease->next) {
+		for (i = 0; i < lease->count_objects; i++) {
+			if (lease->objects[i] == id)
+				return true;
+		}
+	}
+	return false;
+}
+
+static int drmModeLeaseManagerPlaneType(drmModeLeaseManagerPtr manager,
+					uint32_t plane_id)
+{
+	drmModeTopologyObjectPtr obj;
+	uint32_t prop_id, i;
+
+	if (drmModeObjectGetPropertyId(manager->fd, plane_id, "type",
+				       &prop_id, NULL))
+		return -1;
+
+	obj = drmModeTopologyGetObject(manager->topology, plane_id);
+	for (i = 0; obj && i < obj->count_props; i++) {
+		if (obj->props[i] == prop_id)
+			return obj->prop_values[i];
+	}
+	return -1;
+}
+
+/* The CRTC for the connector: the one driving it if it can, then an idle
+ * one, then any one not leased. Returns its index or -1. */
+static int drmModeLeaseManagerPickCrtc(drmModeLeaseManagerPtr manager,
+				       drmModeConnectorPtr connector)
+{
+	drmModeTopologyPtr topo = manager->topology;
+	uint32_t possible = 0, current = 0, busy = 0;
+	drmModeEncoderPtr encoder;
+	int i, j, pass;
+
+	for (i = 0; i < topo->count_encoders; i++) {
+		encoder = &topo->encoders[i];
+		for (j = 0; j < connector->count_encoders; j++) {
+			if (connector->encoders[j] == encoder->encoder_id)
+				possible |= encoder->possible_crtcs;
+		}
+		if (encoder->encoder_id == connector->encoder_id)
+			current = encoder->crtc_id;
+	}
+
+	/* CRTCs driving other connectors. */
+	for (i = 0; i < topo->count_crtcs && i < 32; i++) {
+		for (j = 0; j < topo->count_encoders; j++) {
+			encoder = &topo->encoders[j];
+			if (encoder->crtc_id == topo->crtcs[i].crtc_id &&
+			    encoder->encoder_id != connector->encoder_id)
+				busy |= 1u << i;
+		}
+	}
+
+	for (pass = 0; pass < 3; pass++) {
+		for (i = 0; i < topo->count_crtcs && i < 32; i++) {
+			uint32_t crtc_id = topo->crtcs[i].crtc_id;
+
+			if (!(possible & (1u << i)) ||
+			    drmModeLeaseManagerLeased(manager, crtc_id))
+				continue;
+			if (pass == 0 && crtc_id != current)
+				continue;
+			if (pass == 1 && (busy & (1u << i)))
+				continue;
+			return i;
+		}
+	}
+	return -1;
+}
+
+drm_public int drmModeLeaseManagerGetObjects(drmModeLeaseManagerPtr manager,
+					     uint32_t connector_id,
+					     uint32_t flags,
+					     uint32_t *objects,
+					     int max_objects)
+{
+	drmModeTopologyPtr topo;
+	drmModeConnectorPtr connector = NULL;
+	drmModePlanePtr plane, primary = NULL, cursor = NULL;
+	uint32_t crtc_id;
+	int i, crtc, type, count = 0;
+
+	if (!manager || (max_objects && !objects) ||
+	    (flags & ~(DRM_MODE_LEASE_CURSOR | DRM_MODE_LEASE_OVERLAYS)))
+		return -EINVAL;
+
+	topo = manager->topology;
+	for (i = 0; i < topo->count_connectors; i++) {
+		if (topo->connectors[i].connector_id == connector_id)
+			connector = &topo->connectors[i];
+	}
+	if (!connector)
+		return -ENOENT;
+	if (drmModeLeaseManagerLeased(manager, connector_id))
+		return -EBUSY;
+
+	crtc = drmModeLeaseManagerPickCrtc(manager, connector);
+	if (crtc < 0)
+		return -EBUSY;
+	crtc_id = topo->crtcs[crtc].crtc_id;
+
+#define ADD(id) do { \
+		if (count < max_objects) \
+			objects[count] = (id); \
+		count++; \
+	} while (0)
+
+	ADD(connector_id);
+	ADD(crtc_id);
+
+	/* The primary plane on the CRTC is preferred. */
+	for (i = 0; i < topo->count_planes; i++) {
+		plane = &topo->planes[i];
+		if (!(plane->possible_crtcs & (1u << crtc)) ||
+		    drmModeLeaseManagerLeased(manager, plane->plane_id))
+			continue;
+
+		type = drmModeLeaseManagerPlaneType(manager, plane->plane_id);
+		if (type == DRM_PLANE_TYPE_PRIMARY &&
+		    (!primary || plane->crtc_id == crtc_id))
+			primary = plane;
+		else if (type == DRM_PLANE_TYPE_CURSOR &&
+			 (!cursor || plane->crtc_id == crtc_id))
+			cursor = plane;
+	}
+	if (!primary)
+		return -EBUSY;
+
+	ADD(primary->plane_id);
+	if ((flags & DRM_MODE_LEASE_CURSOR) && cursor)
+		ADD(cursor->plane_id);
+
+	if (flags & DRM_MODE_LEASE_OVERLAYS) {
+		for (i = 0; i < topo->count_planes; i++) {
+			plane = &topo->planes[i];
+			if (!(plane->possible_crtcs & (1u << crtc)) ||
+			    drmModeLeaseManagerLeased(manager, plane->plane_id))
+				continue;
+
+			type = drmModeLeaseManagerPlaneType(manager,
+							    plane->plane_id);
+			if (type == DRM_PLANE_TYPE_OVERLAY)
+				ADD(plane->plane_id);
+		}
+	}
+#undef ADD
+
+	return count;
+}
+
+drm_public drmModeLeaseManagerPtr drmModeLeaseManagerCreate(int fd)
+{
+	drmModeLeaseManagerPtr manager;
+
+	manager = calloc(1, sizeof(*manager));
+	if (!manager)
+		return NULL;
+
+	manager->fd = fd;
+	manager->topology = drmModeGetTopologySnapshot(fd, 0);
+	if (!manager->topology) {
+		free(manager);
+		return NULL;
+	}
+	return manager;
+}
+
+drm_public void drmModeLeaseManagerDestroy(drmModeLeaseManagerPtr manager)
+{
+	struct drm_lease *lease, *next;
+
+	if (!manager)
+		return;
+
+	for (lease = manager->leases; lease; lease = next) {
+		next = lease->next;
+		if (lease->fd >= 0) {
+			drmModeRevokeLease(manager->fd, lease->lessee_id);
+			close(lease->fd);
+		}
+		free(lease);
+	}
+	drmModeFreeTopologySnapshot(manager->topology);
+	free(manager);
+}
+
+drm_public int drmModeLeaseManagerRefresh(drmModeLeaseManagerPtr manager)
+{
+	drmModeTopologyPtr topology;
+
+	if (!manager)
+		return -EINVAL;
+
+	topology = drmModeGetTopologySnapshot(manager->fd, 0);
+	if (!topology)
+		return -errno;
+
+	drmModeFreeTopologySnapshot(manager->topology);
+	manager->topology = topology;
+	return 0;
+}
+
+static struct drm_lease *
+drmModeLeaseManagerCreateLease(drmModeLeaseManagerPtr manager,
+			       uint32_t connector_id, uint32_t flags, int *ret)
+{
+	struct drm_lease *lease;
+	int count;
+
+	count = drmModeLeaseManagerGetObjects(manager, connector_id, flags,
+					      NULL, 0);
+	if (count < 0) {
+		*ret = count;
+		return NULL;
+	}
+
+	lease = calloc(1, sizeof(*lease) + count * sizeof(lease->objects[0]));
+	if (!lease) {
+		*ret = -ENOMEM;
+		return NULL;
+	}
+
+	drmModeLeaseManagerGetObjects(manager, connector_id, flags,
+				      lease->objects, count);
+	lease->fd = drmModeCreateLease(manager->fd, lease->objects, count,
+				       O_CLOEXEC, &lease->lessee_id);
+	if (lease->fd < 0) {
+		*ret = lease->fd;
+		free(lease);
+		return NULL;
+	}
+
+	lease->connector_id = connector_id;
+	lease->flags = flags;
+	lease->count_objects = count;
+	lease->next = manager->leases;
+	manager->leases = lease;
+	return lease;
+}
+
+drm_public int drmModeLeaseManagerPrepare(drmModeLeaseManagerPtr manager,
+					  uint32_t connector_id,
+					  uint32_t flags)
+{
+	int ret = 0;
+
+	if (!manager)
+		return -EINVAL;
+
+	drmModeLeaseManagerCreateLease(manager, connector_id, flags, &ret);
+	return ret;
+}
+
+drm_public int drmModeLeaseManagerAcquire(drmModeLeaseManagerPtr manager,
+					  uint32_t connector_id,
+					  uint32_t flags,
+					  uint32_t *lessee_id)
+{
+	struct drm_lease *lease;
+	int fd, ret = 0;
+
+	if (!manager || !lessee_id)
+		return -EINVAL;
+
+	for (lease = manager->leases; lease; lease = lease->next) {
+		if (lease->fd >= 0 && lease->connector_id == connector_id &&
+		    lease->flags == flags)
+			break;
+	}
+
+	if (!lease)
+		lease = drmModeLeaseManagerCreateLease(manager, connector_id,
+						       flags, &ret);
+	if (!lease)
+		return ret;
+
+	fd = lease->fd;
+	lease->fd = -1;
+	*lessee_id = lease->lessee_id;
+	return fd;
+}
+
+drm_public int drmModeLeaseManagerRevoke(drmModeLeaseManagerPtr manager,
+					 uint32_t lessee_id)
+{
+	struct drm_lease **link, *lease;
+	int ret;
+
+	if (!manager)
+		return -EINVAL;
+
+	for (link = &manager->leases; (lease = *link); link = &lease->next) {
+		if (lease->lessee_id == lessee_id)
+			break;
+	}
+	if (!lease)
+		return -ENOENT;
+
+	ret = drmModeRevokeLease(manager->fd, lessee_id);
+	if (ret && ret != -ENOENT)
+		return ret;
+
+	*link = lease->next;
+	if (lease->fd >= 0)
+		close(lease->fd);
+	free(lease);
+	return 0;
+}
+
+drm_public drmModeFB2Ptr
+drmModeGetFB2(int fd, uint32_t fb_id)
+{
+	struct drm_mode_fb_cmd2 get = {
+		.fb_id = fb_id,
+	};
+	drmModeFB2Ptr ret;
+	int err;
+
+	err = DRM_IOCTL(fd, DRM_IOCTL_MODE_GETFB2, &get);
+	if (err != 0)
+		return NULL;
+
+	ret = drmMalloc(sizeof(drmModeFB2));
+	if (!ret)
+		return NULL;
+
+	ret->fb_id = fb_id;
+	ret->width = get.width;
+	ret->height = get.height;
+	ret->pixel_format = get.pixel_format;
+	ret->flags = get.flags;
+	ret->modifier = get.modifier[0];
+	memcpy(ret->handles, get.handles, sizeof(uint32_t) * 4);
+	memcpy(ret->pitches, get.pitches, sizeof(uint32_t) * 4);
+	memcpy(ret->offsets, get.offsets, sizeof(uint32_t) * 4);
+
+	return ret;
+}
+
+drm_public void drmModeFreeFB2(drmModeFB2Ptr ptr)
+{
+	drmFree(ptr);
+}
+
+/*
+ * Topology snapshots
+ *
+ * A snapshot lives in a chain of bump-allocated chunks; the first chunk is
+ * sized from the object counts so that a typical snapshot is one block.
+ */
+#define DRM_TOPOLOGY_BYTES_PER_OBJECT 2048
+
+struct drm_arena_chunk {
+	struct drm_arena_chunk *next;
+	size_t size;
+	size_t used;
+	uint64_t data[];
+};
+
+static void *drmArenaAlloc(struct drm_arena_chunk **arena, size_t size,
+			   size_t hint)
+{
+	struct drm_arena_chunk *chunk = *arena;
+	void *ptr;
+
+	if (!size)
+		return NULL;
+
+	size = ALIGN(size, sizeof(uint64_t));
+	if (!chunk || chunk->size - chunk->used < size) {
+		size_t chunk_size = chunk ? chunk->size * 2 : hint;
+
+		chunk_size = MAX2(chunk_size, size);
+		chunk = drmMalloc(sizeof(*chunk) + chunk_size);
+		if (!chunk)
+			return NULL;
+		chunk->next = *arena;
+		chunk->size = chunk_size;
+		*arena = chunk;
+	}
+
+	ptr = (char *)chunk->data + chunk->used;
+	chunk->used += size;
+	return ptr;
+}
+
+static void drmArenaFree(struct drm_arena_chunk *arena)
+{
+	struct drm_arena_chunk *next;
+
+	for (; arena; arena = next) {
+		next = arena->next;
+		drmFree(arena);
+	}
+}
+
+static int drmTopologyGetResources(int fd, struct drm_arena_chunk **arena,
+				   struct drm_mode_card_res *res)
+{
+	struct drm_mode_card_res counts;
+
+	for (;;) {
+		memclear(*res);
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETRESOURCES, res))
+			return -errno;
+
+		counts = *res;
+		res->count_fbs = 0;
+		res->crtc_id_ptr = VOID2U64(drmArenaAlloc(arena,
+			res->count_crtcs * sizeof(uint32_t), 4096));
+		res->connector_id_ptr = VOID2U64(drmArenaAlloc(arena,
+			res->count_connectors * sizeof(uint32_t), 4096));
+		res->encoder_id_ptr = VOID2U64(drmArenaAlloc(arena,
+			res->count_encoders * sizeof(uint32_t), 4096));
+		if ((res->count_crtcs && !res->crtc_id_ptr) ||
+		    (res->count_connectors && !res->connector_id_ptr) ||
+		    (res->count_encoders && !res->encoder_id_ptr))
+			return -ENOMEM;
+
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETRESOURCES, res))
+			return -errno;
+
+		/* Objects may have been hotplugged in between, retry then. */
+		if (counts.count_crtcs >= res->count_crtcs &&
+		    counts.count_connectors >= res->count_connectors &&
+		    counts.count_encoders >= res->count_encoders)
+			return 0;
+	}
+}
+
+static int drmTopologyGetPlaneIds(int fd, struct drm_arena_chunk **arena,
+				  struct drm_mode_get_plane_res *res)
+{
+	uint32_t count;
+
+	for (;;) {
+		memclear(*res);
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETPLANERESOURCES, res)) {
+			/* No plane support, report the CRTCs only. */
+			memclear(*res);
+			return 0;
+		}
+
+		count = res->count_planes;
+		res->plane_id_ptr = VOID2U64(drmArenaAlloc(arena,
+			count * sizeof(uint32_t), 4096));
+		if (count && !res->plane_id_ptr)
+			return -ENOMEM;
+
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETPLANERESOURCES, res))
+			return -errno;
+
+		if (count >= res->count_planes)
+			return 0;
+	}
+}
+
+static int drmTopologyGetCrtc(int fd, uint32_t crtc_id, drmModeCrtcPtr r)
+{
+	struct drm_mode_crtc crtc;
+
+	memclear(crtc);
+	crtc.crtc_id = crtc_id;
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETCRTC, &crtc))
+		return -errno;
+
+	r->crtc_id    = crtc.crtc_id;
+	r->x          = crtc.x;
+	r->y          = crtc.y;
+	r->mode_valid = crtc.mode_valid;
+	if (r->mode_valid) {
+		memcpy(&r->mode, &crtc.mode, sizeof(struct drm_mode_modeinfo));
+		r->width  = crtc.mode.hdisplay;
+		r->height = crtc.mode.vdisplay;
+	}
+	r->buffer_id  = crtc.fb_id;
+	r->gamma_size = crtc.gamma_size;
+	return 0;
+}
+
+static int drmTopologyGetEncoder(int fd, uint32_t encoder_id,
+				 drmModeEncoderPtr r)
+{
+	struct drm_mode_get_encoder enc;
+
+	memclear(enc);
+	enc.encoder_id = encoder_id;
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETENCODER, &enc))
+		return -errno;
+
+	r->encoder_id      = enc.encoder_id;
+	r->crtc_id         = enc.crtc_id;
+	r->encoder_type    = enc.encoder_type;
+	r->possible_crtcs  = enc.possible_crtcs;
+	r->possible_clones = enc.possible_clones;
+	return 0;
+}
+
+static int drmTopologyGetConnector(int fd, struct drm_arena_chunk **arena,
+				   size_t hint, uint32_t connector_id,
+				   bool probe, drmModeConnectorPtr r)
+{
+	struct drm_mode_get_connector conn, counts;
+	struct drm_mode_modeinfo stack_mode;
+
+	memclear(conn);
+	conn.connector_id = connector_id;
+	if (!probe) {
+		conn.count_modes = 1;
+		conn.modes_ptr = VOID2U64(&stack_mode);
+	}
+
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn))
+		return -errno;
+
+	for (;;) {
+		counts = conn;
+
+		conn.props_ptr = VOID2U64(drmArenaAlloc(arena,
+			conn.count_props * sizeof(uint32_t), hint));
+		conn.prop_values_ptr = VOID2U64(drmArenaAlloc(arena,
+			conn.count_props * sizeof(uint64_t), hint));
+		conn.encoders_ptr = VOID2U64(drmArenaAlloc(arena,
+			conn.count_encoders * sizeof(uint32_t), hint));
+		if (conn.count_modes) {
+			conn.modes_ptr = VOID2U64(drmArenaAlloc(arena,
+				conn.count_modes * sizeof(struct drm_mode_modeinfo),
+				hint));
+		} else {
+			conn.count_modes = 1;
+			conn.modes_ptr = VOID2U64(&stack_mode);
+		}
+		if ((conn.count_props &&
+		     (!conn.props_ptr || !conn.prop_values_ptr)) ||
+		    (conn.count_encoders && !conn.encoders_ptr) ||
+		    !conn.modes_ptr)
+			return -ENOMEM;
+
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn))
+			return -errno;
+
+		/* The kernel silently skips arrays that are too small. */
+		if (counts.count_props >= conn.count_props &&
+		    counts.count_modes >= conn.count_modes &&
+		    counts.count_encoders >= conn.count_encoders)
+			break;
+	}
+
+	r->connector_id      = conn.connector_id;
+	r->encoder_id        = conn.encoder_id;
+	r->connection        = conn.connection;
+	r->mmWidth           = conn.mm_width;
+	r->mmHeight          = conn.mm_height;
+	/* convert subpixel from kernel to userspace */
+	r->subpixel          = conn.subpixel + 1;
+	r->count_props       = conn.count_props;
+	r->props             = U642VOID(conn.props_ptr);
+	r->prop_values       = U642VOID(conn.prop_values_ptr);
+	r->count_encoders    = conn.count_encoders;
+	r->encoders          = U642VOID(conn.encoders_ptr);
+	r->count_modes       = conn.count_modes;
+	r->modes             = conn.count_modes ? U642VOID(conn.modes_ptr) : NULL;
+	r->connector_type    = conn.connector_type;
+	r->connector_type_id = conn.connector_type_id;
+	return 0;
+}
+
+static int drmTopologyGetPlane(int fd, struct drm_arena_chunk **arena,
+			       size_t hint, uint32_t plane_id,
+			       drmModePlanePtr r)
+{
+	struct drm_mode_get_plane ovr;
+	uint32_t count;
+
+	memclear(ovr);
+	ovr.plane_id = plane_id;
+	if (drmIoctl(fd, DRM_IOCTL_MODE_GETPLANE, &ovr))
+		return -errno;
+
+	do {
+		count = ovr.count_format_types;
+		ovr.format_type_ptr = VOID2U64(drmArenaAlloc(arena,
+			count * sizeof(uint32_t), hint));
+		if (count && !ovr.format_type_ptr)
+			return -ENOMEM;
+
+		if (drmIoctl(fd, DRM_IOCTL_MODE_GETPLANE, &ovr))
+			return -errno;
+	} while (count < ovr.count_format_types);
+
+	r->count_formats  = ovr.count_format_types;
+	r->formats        = U642VOID(ovr.format_type_ptr);
+	r->plane_id       = ovr.plane_id;
+	r->crtc_id        = ovr.crtc_id;
+	r->fb_id          = ovr.fb_id;
+	r->possible_crtcs = ovr.possible_crtcs;
+	r->gamma_size     = ovr.gamma_size;
+	return 0;
+}
+
+static int drmTopologyGetProperties(int fd, struct drm_arena_chunk **arena,
+				    size_t hint, drmModeTopologyObjectPtr obj)
+{
+	struct drm_mode_obj_get_properties properties;
+	uint32_t count;
+
+	memclear(properties);
+	properties.obj_id = obj->id;
+	properties.obj_type = obj->type;
+	if (drmIoctl(fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &properties))
+		return 0; /* Treat as an object without properties */
+
+	do {
+		count = properties.count_props;
+		properties.props_ptr = VOID2U64(drmArenaAlloc(arena,
+			count * sizeof(uint32_t), hint));
+		properties.prop_values_ptr = VOID2U64(drmArenaAlloc(arena,
+			count * sizeof(uint64_t), hint));
+		if (count && (!properties.props_ptr ||
+			      !properties.prop_values_ptr))
+			return -ENOMEM;
+
+		if (drmIoctl(fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &properties))
+			return 0;
+	} while (count < properties.count_props);
+
+	obj->count_props = properties.count_props;
+	obj->props = U642VOID(properties.props_ptr);
+	obj->prop_values = U642VOID(properties.prop_values_ptr);
+	return 0;
+}
+
+static void drmTopologyHashObject(drmModeTopologyObjectPtr obj)
+{
+	uint64_t hash = DRM_MODE_HASH_INIT;
+
+	switch (obj->type) {
+	case DRM_MODE_OBJECT_CRTC:
+		hash = drmModeHashData(hash, obj->object, sizeof(drmModeCrtc));
+		break;
+	case DRM_MODE_OBJECT_ENCODER:
+		hash = drmModeHashData(hash, obj->object, sizeof(drmModeEncoder));
+		break;
+	case DRM_MODE_OBJECT_CONNECTOR:
+	{
+		drmModeConnector conn;
+
+		memcpy(&conn, obj->object, sizeof(conn));
+		hash = drmModeHashData(hash, conn.modes,
+				       conn.count_modes * sizeof(*conn.modes));
+		hash = drmModeHashData(hash, conn.encoders,
+				       conn.count_encoders * sizeof(*conn.encoders));
+		conn.modes = NULL;
+		conn.props = NULL;
+		conn.prop_values = NULL;
+		conn.encoders = NULL;
+		hash = drmModeHashData(hash, &conn, sizeof(conn));
+		break;
+	}
+	case DRM_MODE_OBJECT_PLANE:
+	{
+		drmModePlane plane;
+
+		memcpy(&plane, obj->object, sizeof(plane));
+		hash = drmModeHashData(hash, plane.formats,
+				       plane.count_formats * sizeof(*plane.formats));
+		plane.formats = NULL;
+		hash = drmModeHashData(hash, &plane, sizeof(plane));
+		break;
+	}
+	}
+
+	hash = drmModeHashData(hash, obj->props,
+			       obj->count_props * sizeof(*obj->props));
+	hash = drmModeHashData(hash, obj->prop_values,
+			       obj->count_props * sizeof(*obj->prop_values));
+	obj->hash = hash;
+}
+
+static int drmTopologyObjectCmp(const void *a, const void *b)
+{
+	const drmModeTopologyObject *oa = a, *ob = b;
+
+	return oa->id < ob->id ? -1 : oa->id > ob->id;
+}
+
+drm_public drmModeTopologyPtr drmModeGetTopologySnapshot(int fd, uint32_t flags)
+{
+	struct drm_arena_chunk *arena = NULL;
+	struct drm_mode_card_res res;
+	struct drm_mode_get_plane_res plane_res;
+	drmModeTopologyPtr topo;
+	drmModeTopologyObjectPtr obj;
+	uint32_t *ids;
+	size_t hint;
+	int count, ret, i;
+
+	if (flags & ~(DRM_MODE_TOPOLOGY_PROBE | DRM_MODE_TOPOLOGY_NO_PROPERTIES))
+		return NULL;
+
+	if (drmTopologyGetResources(fd, &arena, &res) ||
+	    drmTopologyGetPlaneIds(fd, &arena, &plane_res))
+		goto err;
+
+	count = res.count_crtcs + res.count_encoders + res.count_connectors +
+		plane_res.count_planes;
+	hint = (size_t)MAX2(count, 1) * DRM_TOPOLOGY_BYTES_PER_OBJECT;
+
+	topo = drmArenaAlloc(&arena, sizeof(*topo), hint);
+	if (!topo)
+		goto err;
+	topo->min_width  = res.min_width;
+	topo->max_width  = res.max_width;
+	topo->min_height = res.min_height;
+	topo->max_height = res.max_height;
+	topo->crtcs = drmArenaAlloc(&arena,
+		res.count_crtcs * sizeof(*topo->crtcs), hint);
+	topo->encoders = drmArenaAlloc(&arena,
+		res.count_encoders * sizeof(*topo->encoders), hint);
+	topo->connectors = drmArenaAlloc(&arena,
+		res.count_connectors * sizeof(*topo->connectors), hint);
+	topo->planes = drmArenaAlloc(&arena,
+		plane_res.count_planes * sizeof(*topo->planes), hint);
+	topo->objects = drmArenaAlloc(&arena,
+		count * sizeof(*topo->objects), hint);
+	if ((res.count_crtcs && !topo->crtcs) ||
+	    (res.count_encoders && !topo->encoders) ||
+	    (res.count_connectors && !topo->connectors) ||
+	    (plane_res.count_planes && !topo->planes) ||
+	    (count && !topo->objects))
+		goto err;
+
+	/* Objects which disappeared since GETRESOURCES are left out. */
+	obj = topo->objects;
+	ids = U642VOID(res.crtc_id_ptr);
+	for (i = 0; i < (int)res.count_crtcs; i++) {
+		drmModeCrtcPtr crtc = &topo->crtcs[topo->count_crtcs];
+
+		ret = drmTopologyGetCrtc(fd, ids[i], crtc);
+		if (ret == -ENOENT)
+			continue;
+		if (ret)
+			goto err;
+		topo->count_crtcs++;
+		obj->id = crtc->crtc_id;
+		obj->type = DRM_MODE_OBJECT_CRTC;
+		obj->object = crtc;
+		obj++;
+	}
+
+	ids = U642VOID(res.encoder_id_ptr);
+	for (i = 0; i < (int)res.count_encoders; i++) {
+		drmModeEncoderPtr encoder = &topo->encoders[topo->count_encoders];
+
+		ret = drmTopologyGetEncoder(fd, ids[i], encoder);
+		if (ret == -ENOENT)
+			continue;
+		if (ret)
+			goto err;
+		topo->count_encoders++;
+		obj->id = encoder->encoder_id;
+		obj->type = DRM_MODE_OBJECT_ENCODER;
+		obj->object = encoder;
+		obj++;
+	}
+
+	ids = U642VOID(res.connector_id_ptr);
+	for (i = 0; i < (int)res.count_connectors; i++) {
+		drmModeConnectorPtr connector =
+			&topo->connectors[topo->count_connectors];
+
+		ret = drmTopologyGetConnector(fd, &arena, hint, ids[i],
+					      flags & DRM_MODE_TOPOLOGY_PROBE,
+					      connector);
+		if (ret == -ENOENT)
+			continue;
+		if (ret)
+			goto err;
+		topo->count_connectors++;
+		obj->id = connector->connector_id;
+		obj->type = DRM_MODE_OBJECT_CONNECTOR;
+		obj->object = connector;
+		if (!(flags & DRM_MODE_TOPOLOGY_NO_PROPERTIES)) {
+			/* GETCONNECTOR already returned the properties. */
+			obj->count_props = connector->count_props;
+			obj->props = connector->props;
+			obj->prop_values = connector->prop_values;
+		}
+		obj++;
+	}
+
+	ids = U642VOID(plane_res.plane_id_ptr);
+	for (i = 0; i < (int)plane_res.count_planes; i++) {
+		drmModePlanePtr plane = &topo->planes[topo->count_planes];
+
+		ret = drmTopologyGetPlane(fd, &arena, hint, ids[i], plane);
+		if (ret == -ENOENT)
+			continue;
+		if (ret)
+			goto err;
+		topo->count_planes++;
+		obj->id = plane->plane_id;
+		obj->type = DRM_MODE_OBJECT_PLANE;
+		obj->object = plane;
+		obj++;
+	}
+
+	topo->count_objects = obj - topo->objects;
+	for (i = 0; i < topo->count_objects; i++) {
+		obj = &topo->objects[i];
+		if (!(flags & DRM_MODE_TOPOLOGY_NO_PROPERTIES) &&
+		    (obj->type == DRM_MODE_OBJECT_CRTC ||
+		     obj->type == DRM_MODE_OBJECT_PLANE) &&
+		    drmTopologyGetProperties(fd, &arena, hint, obj))
+			goto err;
+		drmTopologyHashObject(obj);
+	}
+
+	qsort(topo->objects, topo->count_objects, sizeof(*topo->objects),
+	      drmTopologyObjectCmp);
+
+	topo->arena = arena;
+	return topo;
+
+err:
+	drmArenaFree(arena);
+	return NULL;
+}
+
+drm_public void drmModeFreeTopologySnapshot(drmModeTopologyPtr topology)
+{
+	if (!topology)
+		return;
+
+	drmArenaFree(topology->arena);
+}
+
+drm_public drmModeTopologyObjectPtr
+drmModeTopologyGetObject(drmModeTopologyPtr topology, uint32_t id)
+{
+	drmModeTopologyObject key = { .id = id };
+
+	if (!topology || !topology->count_objects)
+		return NULL;
+
+	return bsearch(&key, topology->objects, topology->count_objects,
+		       sizeof(*topology->objects), drmTopologyObjectCmp);
+}
+
+drm_public int drmModeTopologyDiff(drmModeTopologyPtr prev,
+				   drmModeTopologyPtr cur,
+				   drmModeTopologyChangePtr changes,
+				   int max_changes)
+{
+	int count_prev = prev ? prev->count_objects : 0;
+	int count_cur = cur ? cur->count_objects : 0;
+	int i = 0, j = 0, n = 0;
+
+	while (i < count_prev || j < count_cur) {
+		drmModeTopologyObjectPtr a = i < count_prev ? &prev->objects[i] : NULL;
+		drmModeTopologyObjectPtr b = j < count_cur ? &cur->objects[j] : NULL;
+		drmModeTopologyObjectPtr obj;
+		uint32_t change;
+
+		if (b && (!a || b->id < a->id)) {
+			obj = b;
+			change = DRM_MODE_TOPOLOGY_ADDED;
+			j++;
+		} else if (a && (!b || a->id < b->id)) {
+			obj = a;
+			change = DRM_MODE_TOPOLOGY_REMOVED;
+			i++;
+		} else {
+			i++;
+			j++;
+			if (a->type == b->type && a->hash == b->hash)
+				continue;
+			obj = b;
+			change = DRM_MODE_TOPOLOGY_CHANGED;
+		}
+
+		if (n < max_changes) {
+			changes[n].id = obj->id;
+			changes[n].type = obj->type;
+			changes[n].change = change;
+		}
+		n++;
+	}
+
+	return n;
+}
+
+/* Threads of drmModeProbeConnectors() unless the caller picks a number. */
+#define DRM_PROBE_DEFAULT_WORKERS 8
+
+struct drm_probe_result {
+	uint32_t connector_id;
+	drmModeConnectorPtr connector;
+	int error;
+};
+
+struct drm_probe_pool {
+	int fd;
+	const uint32_t *ids;
+	int count;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	/* signaled for every result */
+	int next;		/* first id no worker took */
+	int done;
+	struct drm_probe_result *results;	/* in completion order */
+};
+
+static void drmModeProbeOne(int fd, uint32_t connector_id,
+			    struct drm_probe_result *r)
+{
+	r->connector_id = connector_id;
+	r->connector = drmModeGetConnector2(fd, connector_id, NULL,
+					    DRM_MODE_GET_CONNECTOR_PROBE);
+	r->error = r->connector ? 0 : errno ? errno : EIO;
+}
+
+static void *drmModeProbeWorker(void *arg)
+{
+	struct drm_probe_pool *pool = arg;
+	struct drm_probe_result r;
+	int i;
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->next < pool->count) {
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		drmModeProbeOne(pool->fd, pool->ids[i], &r);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->results[pool->done++] = r;
+		pthread_cond_signal(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+drm_public int drmModeProbeConnectors(int fd, const uint32_t *connector_ids,
+				      int count, int max_workers,
+				      drmModeProbeHandler handler,
+				      void *user_data)
+{
+	struct drm_probe_pool pool;
+	struct drm_probe_result r;
+	pthread_t *threads;
+	sigset_t all, old;
+	int i, nthreads = 0, reported = 0, probed = 0;
+
+	if (count < 0 || (count && !connector_ids) || max_workers < 0 ||
+	    !handler)
+		return -EINVAL;
+
+	if (!max_workers)
+		max_workers = DRM_PROBE_DEFAULT_WORKERS;
+	if (max_workers > count)
+		max_workers = count;
+	/* A single probe gains nothing from a thread. */
+	if (max_workers <= 1)
+		goto serial;
+
+	pool.results = drmMalloc(count * sizeof(*pool.results));
+	threads = drmMalloc(max_workers * sizeof(*threads));
+	if (!pool.results || !threads)
+		goto serial_free;
+
+	pool.fd = fd;
+	pool.ids = connector_ids;
+	pool.count = count;
+	pool.next = 0;
+	pool.done = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+
+	/* The signals of the process are for the threads of the caller. */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 0; i < max_workers; i++) {
+		if (pthread_create(&threads[nthreads], NULL,
+				   drmModeProbeWorker, &pool))
+			break;
+		nthreads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (!nthreads) {
+		pthread_cond_destroy(&pool.cond);
+		pthread_mutex_destroy(&pool.lock);
+		goto serial_free;
+	}
+
+	/* Hand each result over as soon as its probe completes, the other
+	 * probes going on meanwhile. */
+	pthread_mutex_lock(&pool.lock);
+	while (reported < count) {
+		while (reported == pool.done)
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		r = pool.results[reported++];
+		pthread_mutex_unlock(&pool.lock);
+
+		probed += !r.error;
+		handler(user_data, r.connector_id, r.connector, r.error);
+
+		pthread_mutex_lock(&pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.lock);
+	drmFree(threads);
+	drmFree(pool.results);
+	return probed;
+
+serial_free:
+	drmFree(threads);
+	drmFree(pool.results);
+serial:
+	for (i = 0; i < count; i++) {
+		drmModeProbeOne(fd, connector_ids[i], &r);
+		probed += !r.error;
+		handler(user_data, r.connector_id, r.connector, r.error);
+	}
+	return probed;
+}
+
+#define DRM_HOTPLUG_MAX_HINTS 32
+
+struct _drmModeHotplugListener {
+	int fd;
+	int sock;
+	unsigned int minor;
+	uint32_t flags;
+	void *connectors;	/* connector id -> drmModeConnectorPtr */
+};
+
+static bool drmModeConnectorEqual(drmModeConnectorPtr a, drmModeConnectorPtr b)
+{
+	if (a->connection != b->connection || a->encoder_id != b->encoder_id ||
+	    a->mmWidth != b->mmWidth || a->mmHeight != b->mmHeight ||
+	    a->subpixel != b->subpixel ||
+	    a->count_modes != b->count_modes ||
+	    a->count_props != b->count_props ||
+	    a->count_encoders != b->count_encoders)
+		return false;
+
+	/* Empty arrays may be NULL, which memcmp() does not accept. */
+	return (!a->count_modes ||
+		!memcmp(a->modes, b->modes, a->count_modes * sizeof(*a->modes))) &&
+	       (!a->count_props ||
+		(!memcmp(a->props, b->props, a->count_props * sizeof(*a->props)) &&
+		 !memcmp(a->prop_values, b->prop_values,
+			 a->count_props * sizeof(*a->prop_values)))) &&
+	       (!a->count_encoders ||
+		!memcmp(a->encoders, b->encoders,
+			a->count_encoders * sizeof(*a->encoders)));
+}
+
+static int drmModeHotplugRemove(drmModeHotplugListenerPtr listener,
+				uint32_t connector_id,
+				drmModeHotplugHandler handler, void *data)
+{
+	void *value;
+
+	if (drmHashLookup(listener->connectors, connector_id, &value))
+		return 0;
+
+	drmHashDelete(listener->connectors, connector_id);
+	if (handler)
+		handler(data, value, NULL);
+	drmModeFreeConnector(value);
+	return 1;
+}
+
+static drmModeConnectorPtr
+drmModeHotplugLookup(drmModeHotplugListenerPtr listener, uint32_t connector_id)
+{
+	void *value;
+
+	if (drmHashLookup(listener->connectors, connector_id, &value))
+		return NULL;
+	return value;
+}
+
+/* Store the new state of a connector, taking cur, and report it if it
+ * changed. Returns 1 if the handler was called, 0 if nothing changed and a
+ * negative errno on failure.
+ */
+static int drmModeHotplugUpdate(drmModeHotplugListenerPtr listener,
+				uint32_t connector_id, drmModeConnectorPtr cur,
+				drmModeHotplugHandler handler, void *data)
+{
+	drmModeConnectorPtr old = drmModeHotplugLookup(listener, connector_id);
+
+	if (old && drmModeConnectorEqual(old, cur)) {
+		drmModeFreeConnector(cur);
+		return 0;
+	}
+
+	if (old)
+		drmHashDelete(listener->connectors, connector_id);
+	if (drmHashInsert(listener->connectors, connector_id, cur)) {
+		drmModeFreeConnector(cur);
+		drmModeFreeConnector(old);
+		return -ENOMEM;
+	}
+
+	if (handler)
+		handler(data, old, cur);
+	drmModeFreeConnector(old);
+	return 1;
+}
+
+/* Re-read one connector without probing it and report it if it changed,
+ * as drmModeHotplugUpdate(). A newly connected sink is left for the caller
+ * to probe instead, setting *probe.
+ */
+static int drmModeHotplugRefresh(drmModeHotplugListenerPtr listener,
+				 uint32_t connector_id, bool *probe,
+				 drmModeHotplugHandler handler, void *data)
+{
+	drmModeConnectorPtr old = drmModeHotplugLookup(listener, connector_id);
+	drmModeConnectorPtr cur;
+
+	*probe = false;
+	cur = drmModeGetConnector2(listener->fd, connector_id, old, 0);
+	if (!cur) {
+		/* The connector went away, e.g. an MST branch was unplugged. */
+		if (errno == ENOENT)
+			return drmModeHotplugRemove(listener, connector_id,
+						    handler, data);
+		return -errno;
+	}
+
+	/* Only a newly connected sink is worth the EDID read of a probe. */
+	if ((listener->flags & DRM_MODE_HOTPLUG_PROBE_NEW) &&
+	    cur->connection == DRM_MODE_CONNECTED &&
+	    (!old || old->connection != DRM_MODE_CONNECTED)) {
+		drmModeFreeConnector(cur);
+		*probe = true;
+		return 0;
+	}
+
+	return drmModeHotplugUpdate(listener, connector_id, cur, handler,
+				    data);
+}
+
+struct drm_hotplug_probe {
+	drmModeHotplugListenerPtr listener;
+	drmModeHotplugHandler handler;
+	void *data;
+	int count;
+	int ret;
+};
+
+static void drmModeHotplugProbed(void *user_data, uint32_t connector_id,
+				 drmModeConnectorPtr cur, int error)
+{
+	struct drm_hotplug_probe *p = user_data;
+	int n;
+
+	/* A failed probe still leaves what the kernel knows, unprobed. */
+	if (!cur)
+		cur = drmModeGetConnector2(p->listener->fd, connector_id,
+					   drmModeHotplugLookup(p->listener,
+								connector_id),
+					   0);
+	if (!cur) {
+		if (errno == ENOENT)
+			n = drmModeHotplugRemove(p->listener, connector_id,
+						 p->handler, p->data);
+		else
+			n = -(error ? error : errno);
+	} else {
+		n = drmModeHotplugUpdate(p->listener, connector_id, cur,
+					 p->handler, p->data);
+	}
+
+	if (n < 0) {
+		if (!p->ret)
+			p->ret = n;
+	} else {
+		p->count += n;
+	}
+}
+
+/* Refresh a set of connectors, probing the newly connected ones alongside
+ * each other. Returns the number of changes reported or a negative errno.
+ */
+static int drmModeHotplugRefreshSet(drmModeHotplugListenerPtr listener,
+				    const uint32_t *ids, int count,
+				    drmModeHotplugHandler handler, void *data)
+{
+	struct drm_hotplug_probe p = { listener, handler, data, 0, 0 };
+	uint32_t *probe_ids = NULL;
+	bool probe;
+	int i, n, nprobe = 0;
+
+	if (count && (listener->flags & DRM_MODE_HOTPLUG_PROBE_NEW)) {
+		probe_ids = drmMalloc(count * sizeof(*probe_ids));
+		if (!probe_ids)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < count; i++) {
+		n = drmModeHotplugRefresh(listener, ids[i], &probe, handler,
+					  data);
+		if (n < 0) {
+			drmFree(probe_ids);
+			return n;
+		}
+		p.count += n;
+		if (probe)
+			probe_ids[nprobe++] = ids[i];
+	}
+
+	if (nprobe) {
+		n = drmModeProbeConnectors(listener->fd, probe_ids, nprobe, 0,
+					   drmModeHotplugProbed, &p);
+		if (n < 0 && !p.ret)
+			p.ret = n;
+	}
+
+	drmFree(probe_ids);
+	return p.ret ? p.ret : p.count;
+}
+
+static int drmModeHotplugRefreshAll(drmModeHotplugListenerPtr listener,
+				    drmModeHotplugHandler handler, void *data)
+{
+	drmModeResPtr res;
+	unsigned long key;
+	uint32_t *gone = NULL;
+	void *value;
+	int i, j, n, ngone = 0, count = 0, ret = 0;
+
+	res = drmModeGetResources(listener->fd);
+	if (!res)
+		return -errno;
+
+	n = drmModeHotplugRefreshSet(listener, res->connectors,
+				     res->count_connectors, handler, data);
+	if (n < 0) {
+		ret = n;
+		goto out;
+	}
+	count += n;
+
+	/* Whatever is cached but no longer listed has been removed; collect
+	 * the ids first as the hash cannot be modified while walking it. */
+	for (i = 0; i < 2; i++) {
+		ngone = 0;
+		if (drmHashFirst(listener->connectors, &key, &value) != 1)
+			break;
+		do {
+			for (j = 0; j < res->count_connectors; j++)
+				if (res->connectors[j] == key)
+					break;
+			if (j < res->count_connectors)
+				continue;
+			if (gone)
+				gone[ngone] = key;
+			ngone++;
+		} while (drmHashNext(listener->connectors, &key, &value));
+
+		if (!ngone || gone)
+			break;
+		gone = drmMalloc(ngone * sizeof(*gone));
+		if (!gone) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (i = 0; gone && i < ngone; i++)
+		count += drmModeHotplugRemove(listener, gone[i], handler, data);
+
+out:
+	drmFree(gone);
+	drmModeFreeResources(res);
+	return ret ? ret : count;
+}
+
+drm_public drmModeHotplugListenerPtr
+drmModeHotplugListenerCreate(int fd, uint32_t flags)
+{
+#ifdef __linux__
+	drmModeHotplugListenerPtr listener;
+	struct sockaddr_nl addr;
+	struct stat sbuf;
+	int ret;
+
+	if (flags & ~DRM_MODE_HOTPLUG_PROBE_NEW) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (fstat(fd, &sbuf))
+		return NULL;
+	if (!S_ISCHR(sbuf.st_mode)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	listener = drmMalloc(sizeof(*listener));
+	if (!listener)
+		return NULL;
+	listener->fd = fd;
+	listener->sock = -1;
+	listener->minor = minor(sbuf.st_rdev);
+	listener->flags = flags;
+
+	listener->connectors = drmHashCreate();
+	if (!listener->connectors) {
+		drmFree(listener);
+		return NULL;
+	}
+
+	/* Kernel uevents are multicast on group 1; unlike the udev ones on
+	 * group 2 they do not depend on a udev daemon re-broadcasting them. */
+	listener->sock = socket(AF_NETLINK,
+				SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+				NETLINK_KOBJECT_UEVENT);
+	if (listener->sock < 0)
+		goto err;
+
+	memclear(addr);
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+	if (bind(listener->sock, (void *)&addr, sizeof(addr)))
+		goto err;
+
+	/* Bind before reading the initial state so no event is missed. */
+	ret = drmModeHotplugRefreshAll(listener, NULL, NULL);
+	if (ret < 0) {
+		errno = -ret;
+		goto err;
+	}
+
+	return listener;
+
+err:
+	ret = errno;
+	drmModeHotplugListenerDestroy(listener);
+	errno = ret;
+	return NULL;
+#else
+	errno = ENOSYS;
+	return NULL;
+#endif
+}
+
+drm_public void drmModeHotplugListenerDestroy(drmModeHotplugListenerPtr listener)
+{
+	unsigned long key;
+	void *value;
+
+	if (!listener)
+		return;
+
+	if (listener->sock >= 0)
+		close(listener->sock);
+	if (drmHashFirst(listener->connectors, &key, &value) == 1) {
+		do {
+			drmModeFreeConnector(value);
+		} while (drmHashNext(listener->connectors, &key, &value));
+	}
+	drmHashDestroy(listener->connectors);
+	drmFree(listener);
+}
+
+drm_public int drmModeHotplugListenerGetFd(drmModeHotplugListenerPtr listener)
+{
+	return listener ? listener->sock : -EINVAL;
+}
+
+drm_public drmModeConnectorPtr
+drmModeHotplugListenerGetConnector(drmModeHotplugListenerPtr listener,
+				   uint32_t connector_id)
+{
+	void *value;
+
+	if (!listener ||
+	    drmHashLookup(listener->connectors, connector_id, &value))
+		return NULL;
+	return value;
+}
+
+#ifdef __linux__
+/* Parse one kernel uevent. Returns false if it is not a hotplug event of
+ * our device, otherwise sets *connector_id to the CONNECTOR= hint or 0. */
+static bool drmModeHotplugParse(drmModeHotplugListenerPtr listener,
+				const char *buf, size_t len,
+				uint32_t *connector_id)
 {
-	if (req)
-		req->cursor = cursor;
+	const char *s, *end = buf + len;
+	bool drm = false, hotplug = false, ours = false;
+	unsigned long val;
+
+	*connector_id = 0;
+	for (s = buf; s < end; s += strlen(s) + 1) {
+		if (!strcmp(s, "SUBSYSTEM=drm"))
+			drm = true;
+		else if (!strcmp(s, "HOTPLUG=1"))
+			hotplug = true;
+		else if (!strncmp(s, "MINOR=", 6))
+			ours = strtoul(s + 6, NULL, 10) == listener->minor;
+		else if (!strncmp(s, "CONNECTOR=", 10)) {
+			val = strtoul(s + 10, NULL, 10);
+			*connector_id = val <= UINT32_MAX ? val : 0;
+		}
+		/* PROPERTY= (e.g. content protection or link status) needs no
+		 * special care: refreshing the connector re-reads its values. */
+	}
+
+	return drm && hotplug && ours;
 }
+#endif
 
-drm_public int drmModeAtomicAddProperty(drmModeAtomicReqPtr req,
-                                        uint32_t object_id,
-                                        uint32_t property_id,
-                                        uint64_t value)
+drm_public int drmModeHotplugListenerDispatch(drmModeHotplugListenerPtr listener,
+					      drmModeHotplugHandler handler,
+					      void *user_data)
 {
-	if (!req)
+#ifdef __linux__
+	uint32_t hints[DRM_HOTPLUG_MAX_HINTS];
+	uint32_t connector_id;
+	struct sockaddr_nl addr;
+	socklen_t addrlen;
+	char buf[8192];
+	bool full = false;
+	int i, nhints = 0;
+	ssize_t len;
+
+	if (!listener)
 		return -EINVAL;
 
-	if (object_id == 0 || property_id == 0)
-		return -EINVAL;
+	for (;;) {
+		addrlen = sizeof(addr);
+		len = recvfrom(listener->sock, buf, sizeof(buf) - 1,
+			       MSG_DONTWAIT, (void *)&addr, &addrlen);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			/* The socket overflowed and events were lost. */
+			if (errno == ENOBUFS) {
+				full = true;
+				continue;
+			}
+			return -errno;
+		}
 
-	if (req->cursor >= req->size_items) {
-		const uint32_t item_size_inc = getpagesize() / sizeof(*req->items);
-		drmModeAtomicReqItemPtr new;
+		/* Only trust messages sent by the kernel itself. */
+		if (addrlen != sizeof(addr) || addr.nl_pid != 0)
+			continue;
 
-		req->size_items += item_size_inc;
-		new = realloc(req->items, req->size_items * sizeof(*req->items));
-		if (!new) {
-			req->size_items -= item_size_inc;
-			return -ENOMEM;
+		buf[len] = '\0';
+		if (!drmModeHotplugParse(listener, buf, len, &connector_id))
+			continue;
+
+		if (!connector_id) {
+			full = true;
+			continue;
 		}
-		req->items = new;
+		for (i = 0; i < nhints; i++)
+			if (hints[i] == connector_id)
+				break;
+		if (i < nhints)
+			continue;
+		if (nhints == DRM_HOTPLUG_MAX_HINTS)
+			full = true;
+		else
+			hints[nhints++] = connector_id;
 	}
 
-	req->items[req->cursor].object_id = object_id;
-	req->items[req->cursor].property_id = property_id;
-	req->items[req->cursor].value = value;
-	req->cursor++;
+	if (full)
+		return drmModeHotplugRefreshAll(listener, handler, user_data);
 
-	return req->cursor;
+	return drmModeHotplugRefreshSet(listener, hints, nhints, handler,
+					user_data);
+#else
+	return -ENOSYS;
+#endif
 }
 
-drm_public void drmModeAtomicFree(drmModeAtomicReqPtr req)
+/* How far ahead in the list a rectangle looks for a merge partner when the
+ * result has to be capped, trading merge quality against quadratic cost. */
+#define DRM_DAMAGE_MERGE_WINDOW 16
+
+struct _drmModeDamage {
+	int32_t width;
+	int32_t height;
+	bool full;
+	bool dirty;
+
+	drmModeRectPtr rects;	/* as added, clipped */
+	int count;
+	int cap;
+
+	drmModeRectPtr region;	/* banded, non-overlapping */
+	int region_count;
+	int region_cap;
+	int32_t *edges;
+	drmModeRectPtr band;
+	drmModeRectPtr scratch;
+	int scratch_cap;
+};
+
+drm_public drmModeDamagePtr drmModeDamageCreate(int32_t width, int32_t height)
 {
-	if (!req)
-		return;
+	drmModeDamagePtr damage;
 
-	if (req->items)
-		drmFree(req->items);
-	drmFree(req);
+	if (width <= 0 || height <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	damage = drmMalloc(sizeof(*damage));
+	if (!damage)
+		return NULL;
+	damage->width = width;
+	damage->height = height;
+	return damage;
 }
 
-static int sort_req_list(const void *misc, const void *other)
+drm_public void drmModeDamageDestroy(drmModeDamagePtr damage)
 {
-	const drmModeAtomicReqItem *first = misc;
-	const drmModeAtomicReqItem *second = other;
+	if (!damage)
+		return;
 
-	if (first->object_id < second->object_id)
-		return -1;
-	else if (first->object_id > second->object_id)
-		return 1;
-	else
-		return second->property_id - first->property_id;
+	drmFree(damage->rects);
+	drmFree(damage->region);
+	drmFree(damage->edges);
+	drmFree(damage->band);
+	drmFree(damage->scratch);
+	drmFree(damage);
 }
 
-drm_public int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
-                                   uint32_t flags, void *user_data)
+drm_public void drmModeDamageReset(drmModeDamagePtr damage)
 {
-	drmModeAtomicReqPtr sorted;
-	struct drm_mode_atomic atomic;
-	uint32_t *objs_ptr = NULL;
-	uint32_t *count_props_ptr = NULL;
-	uint32_t *props_ptr = NULL;
-	uint64_t *prop_values_ptr = NULL;
-	uint32_t last_obj_id = 0;
-	uint32_t i;
-	int obj_idx = -1;
-	int ret = -1;
+	damage->count = 0;
+	damage->full = false;
+	damage->dirty = true;
+}
 
-	if (!req)
-		return -EINVAL;
+static int drmModeDamageGrow(drmModeRectPtr *rects, int *cap, int count)
+{
+	drmModeRectPtr grown;
+	int new_cap;
 
-	if (req->cursor == 0)
+	if (count <= *cap)
 		return 0;
 
-	sorted = drmModeAtomicDuplicate(req);
-	if (sorted == NULL)
+	new_cap = MAX2(*cap * 2, MAX2(count, 16));
+	grown = drmMalloc(new_cap * sizeof(*grown));
+	if (!grown)
 		return -ENOMEM;
+	if (*cap)
+		memcpy(grown, *rects, *cap * sizeof(*grown));
+	drmFree(*rects);
+	*rects = grown;
+	*cap = new_cap;
+	return 0;
+}
 
-	memclear(atomic);
+drm_public int drmModeDamageAddRects(drmModeDamagePtr damage,
+				     const drmModeRect *rects, int count)
+{
+	drmModeRect r;
+	int i, ret;
 
-	/* Sort the list by object ID, then by property ID. */
-	qsort(sorted->items, sorted->cursor, sizeof(*sorted->items),
-	      sort_req_list);
+	if (count < 0)
+		return -EINVAL;
 
-	/* Now the list is sorted, eliminate duplicate property sets. */
-	for (i = 0; i < sorted->cursor; i++) {
-		if (sorted->items[i].object_id != last_obj_id) {
-			atomic.count_objs++;
-			last_obj_id = sorted->items[i].object_id;
-		}
+	/* Nothing can be added to a full damage, this also keeps the common
+	 * case of clients damaging everything all the time cheap. */
+	if (damage->full)
+		return 0;
 
-		if (i == sorted->cursor - 1)
-			continue;
+	ret = drmModeDamageGrow(&damage->rects, &damage->cap,
+				damage->count + count);
+	if (ret)
+		return ret;
 
-		if (sorted->items[i].object_id != sorted->items[i + 1].object_id ||
-		    sorted->items[i].property_id != sorted->items[i + 1].property_id)
+	for (i = 0; i < count; i++) {
+		r.x1 = MAX2(rects[i].x1, 0);
+		r.y1 = MAX2(rects[i].y1, 0);
+		r.x2 = MIN2(rects[i].x2, damage->width);
+		r.y2 = MIN2(rects[i].y2, damage->height);
+		if (r.x1 >= r.x2 || r.y1 >= r.y2)
 			continue;
 
-		memmove(&sorted->items[i], &sorted->items[i + 1],
-			(sorted->cursor - i - 1) * sizeof(*sorted->items));
-		sorted->cursor--;
+		if (r.x1 == 0 && r.y1 == 0 &&
+		    r.x2 == damage->width && r.y2 == damage->height) {
+			damage->rects[0] = r;
+			damage->count = 1;
+			damage->full = true;
+			break;
+		}
+		damage->rects[damage->count++] = r;
 	}
 
-	objs_ptr = drmMalloc(atomic.count_objs * sizeof objs_ptr[0]);
-	if (!objs_ptr) {
-		errno = ENOMEM;
-		goto out;
-	}
+	damage->dirty = true;
+	return 0;
+}
 
-	count_props_ptr = drmMalloc(atomic.count_objs * sizeof count_props_ptr[0]);
-	if (!count_props_ptr) {
-		errno = ENOMEM;
-		goto out;
-	}
+drm_public int drmModeDamageAddRect(drmModeDamagePtr damage,
+				    int32_t x1, int32_t y1,
+				    int32_t x2, int32_t y2)
+{
+	drmModeRect r = { x1, y1, x2, y2 };
 
-	props_ptr = drmMalloc(sorted->cursor * sizeof props_ptr[0]);
-	if (!props_ptr) {
-		errno = ENOMEM;
-		goto out;
-	}
+	return drmModeDamageAddRects(damage, &r, 1);
+}
 
-	prop_values_ptr = drmMalloc(sorted->cursor * sizeof prop_values_ptr[0]);
-	if (!prop_values_ptr) {
-		errno = ENOMEM;
-		goto out;
-	}
+static int drmModeDamageCompareInt(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
 
-	for (i = 0, last_obj_id = 0; i < sorted->cursor; i++) {
-		if (sorted->items[i].object_id != last_obj_id) {
-			obj_idx++;
-			objs_ptr[obj_idx] = sorted->items[i].object_id;
-			last_obj_id = objs_ptr[obj_idx];
-		}
+	return x < y ? -1 : x > y;
+}
+
+static int drmModeDamageCompareX(const void *a, const void *b)
+{
+	const drmModeRect *r = a, *s = b;
 
-		count_props_ptr[obj_idx]++;
-		props_ptr[i] = sorted->items[i].property_id;
-		prop_values_ptr[i] = sorted->items[i].value;
+	return r->x1 < s->x1 ? -1 : r->x1 > s->x1;
+}
 
+/*
+ * Split the plane into horizontal bands at every top and bottom edge, take
+ * the union of the spans crossing each band and extend the rectangles of
+ * the band above instead of starting new ones when the spans are the same.
+ * The result is the classic y-x banded region: no two rectangles overlap,
+ * touching spans are joined and the rectangles are sorted top to bottom.
+ */
+static int drmModeDamageBand(drmModeDamagePtr damage)
+{
+	int32_t *edges;
+	int i, j, k, nedges = 0, nband, prev = 0, nprev = 0, ret;
+
+	damage->region_count = 0;
+	if (damage->count <= 1) {
+		ret = drmModeDamageGrow(&damage->region, &damage->region_cap, 1);
+		if (ret)
+			return ret;
+		if (damage->count)
+			damage->region[damage->region_count++] = damage->rects[0];
+		return 0;
 	}
 
-	atomic.flags = flags;
-	atomic.objs_ptr = VOID2U64(objs_ptr);
-	atomic.count_props_ptr = VOID2U64(count_props_ptr);
-	atomic.props_ptr = VOID2U64(props_ptr);
-	atomic.prop_values_ptr = VOID2U64(prop_values_ptr);
-	atomic.user_data = VOID2U64(user_data);
+	drmFree(damage->edges);
+	drmFree(damage->band);
+	damage->edges = drmMalloc(2 * damage->count * sizeof(*damage->edges));
+	damage->band = drmMalloc(damage->count * sizeof(*damage->band));
+	if (!damage->edges || !damage->band)
+		return -ENOMEM;
+	edges = damage->edges;
 
-	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_ATOMIC, &atomic);
+	for (i = 0; i < damage->count; i++) {
+		edges[nedges++] = damage->rects[i].y1;
+		edges[nedges++] = damage->rects[i].y2;
+	}
+	qsort(edges, nedges, sizeof(*edges), drmModeDamageCompareInt);
+	for (i = 1, j = 0; i < nedges; i++)
+		if (edges[i] != edges[j])
+			edges[++j] = edges[i];
+	nedges = j + 1;
 
-out:
-	drmFree(objs_ptr);
-	drmFree(count_props_ptr);
-	drmFree(props_ptr);
-	drmFree(prop_values_ptr);
-	drmModeAtomicFree(sorted);
+	/* With the input sorted by x1 the spans of a band come out sorted. */
+	qsort(damage->rects, damage->count, sizeof(*damage->rects),
+	      drmModeDamageCompareX);
 
-	return ret;
-}
+	for (k = 0; k + 1 < nedges; k++) {
+		int32_t top = edges[k], bottom = edges[k + 1];
 
-drm_public int
-drmModeCreatePropertyBlob(int fd, const void *data, size_t length,
-                                     uint32_t *id)
-{
-	struct drm_mode_create_blob create;
-	int ret;
+		nband = 0;
+		for (i = 0; i < damage->count; i++) {
+			drmModeRectPtr r = &damage->rects[i];
 
-	if (length >= 0xffffffff)
-		return -ERANGE;
+			if (r->y1 > top || r->y2 < bottom)
+				continue;
+			if (nband && r->x1 <= damage->band[nband - 1].x2) {
+				damage->band[nband - 1].x2 =
+					MAX2(damage->band[nband - 1].x2, r->x2);
+				continue;
+			}
+			damage->band[nband].x1 = r->x1;
+			damage->band[nband].x2 = r->x2;
+			damage->band[nband].y1 = top;
+			damage->band[nband].y2 = bottom;
+			nband++;
+		}
 
-	memclear(create);
+		if (!nband) {
+			nprev = 0;
+			continue;
+		}
 
-	create.length = length;
-	create.data = (uintptr_t) data;
-	create.blob_id = 0;
-	*id = 0;
+		/* Same spans as the band right above: grow that one down. */
+		if (nprev == nband && damage->region[prev].y2 == top) {
+			for (i = 0; i < nband; i++)
+				if (damage->region[prev + i].x1 != damage->band[i].x1 ||
+				    damage->region[prev + i].x2 != damage->band[i].x2)
+					break;
+			if (i == nband) {
+				for (i = 0; i < nband; i++)
+					damage->region[prev + i].y2 = bottom;
+				continue;
+			}
+		}
 
-	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_CREATEPROPBLOB, &create);
-	if (ret != 0)
-		return ret;
+		ret = drmModeDamageGrow(&damage->region, &damage->region_cap,
+					damage->region_count + nband);
+		if (ret)
+			return ret;
+		prev = damage->region_count;
+		nprev = nband;
+		memcpy(&damage->region[prev], damage->band,
+		       nband * sizeof(*damage->band));
+		damage->region_count += nband;
+	}
 
-	*id = create.blob_id;
 	return 0;
 }
 
-drm_public int
-drmModeDestroyPropertyBlob(int fd, uint32_t id)
+static int64_t drmModeRectArea(const drmModeRect *r)
 {
-	struct drm_mode_destroy_blob destroy;
+	return (int64_t)(r->x2 - r->x1) * (r->y2 - r->y1);
+}
 
-	memclear(destroy);
-	destroy.blob_id = id;
-	return DRM_IOCTL(fd, DRM_IOCTL_MODE_DESTROYPROPBLOB, &destroy);
+static bool drmModeRectContains(const drmModeRect *r, const drmModeRect *s)
+{
+	return r->x1 <= s->x1 && r->y1 <= s->y1 &&
+	       r->x2 >= s->x2 && r->y2 >= s->y2;
 }
 
-drm_public int
-drmModeCreateLease(int fd, const uint32_t *objects, int num_objects, int flags,
-                   uint32_t *lessee_id)
+/*
+ * Bring the region down to max_rects by repeatedly replacing the pair of
+ * nearby rectangles whose bounding box adds the fewest undamaged pixels by
+ * that bounding box. Rectangles swallowed by a merge are dropped.
+ */
+static int drmModeDamageCap(drmModeRectPtr rects, int count, int max_rects)
 {
-	struct drm_mode_create_lease create;
-	int ret;
+	int i, j, best_i, best_j, end;
+	int64_t waste, best;
+	drmModeRect u;
+
+	while (count > max_rects) {
+		best = INT64_MAX;
+		best_i = 0;
+		best_j = 1;
+		for (i = 0; i < count - 1; i++) {
+			end = MIN2(count, i + 1 + DRM_DAMAGE_MERGE_WINDOW);
+			for (j = i + 1; j < end; j++) {
+				u.x1 = MIN2(rects[i].x1, rects[j].x1);
+				u.y1 = MIN2(rects[i].y1, rects[j].y1);
+				u.x2 = MAX2(rects[i].x2, rects[j].x2);
+				u.y2 = MAX2(rects[i].y2, rects[j].y2);
+				waste = drmModeRectArea(&u) -
+					drmModeRectArea(&rects[i]) -
+					drmModeRectArea(&rects[j]);
+				if (waste < best) {
+					best = waste;
+					best_i = i;
+					best_j = j;
+				}
+			}
+		}
 
-	memclear(create);
-	create.object_ids = (uintptr_t) objects;
-	create.object_count = num_objects;
-	create.flags = flags;
+		u.x1 = MIN2(rects[best_i].x1, rects[best_j].x1);
+		u.y1 = MIN2(rects[best_i].y1, rects[best_j].y1);
+		u.x2 = MAX2(rects[best_i].x2, rects[best_j].x2);
+		u.y2 = MAX2(rects[best_i].y2, rects[best_j].y2);
+		rects[best_i] = u;
 
-	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_CREATE_LEASE, &create);
-	if (ret == 0) {
-		*lessee_id = create.lessee_id;
-		return create.fd;
+		for (i = 0, j = 0; i < count; i++) {
+			if (i != best_i && (i == best_j ||
+					    drmModeRectContains(&u, &rects[i])))
+				continue;
+			rects[j++] = rects[i];
+		}
+		count = j;
 	}
-	return -errno;
+
+	return count;
 }
 
-drm_public drmModeLesseeListPtr
-drmModeListLessees(int fd)
+drm_public int drmModeDamageGetRects(drmModeDamagePtr damage,
+				     drmModeRectPtr rects, int max_rects)
 {
-	struct drm_mode_list_lessees list;
-	uint32_t count;
-	drmModeLesseeListPtr ret;
-
-	memclear(list);
+	int ret;
 
-	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_LIST_LESSEES, &list))
-		return NULL;
+	if (max_rects < 0 || (max_rects && !rects))
+		return -EINVAL;
 
-	count = list.count_lessees;
-	ret = drmMalloc(sizeof (drmModeLesseeListRes) + count * sizeof (ret->lessees[0]));
-	if (!ret)
-		return NULL;
+	if (damage->dirty) {
+		ret = drmModeDamageBand(damage);
+		if (ret)
+			return ret;
+		damage->dirty = false;
+	}
 
-	list.lessees_ptr = VOID2U64(&ret->lessees[0]);
-	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_LIST_LESSEES, &list)) {
-		drmFree(ret);
-		return NULL;
+	if (!max_rects || damage->region_count <= max_rects) {
+		if (max_rects && damage->region_count)
+			memcpy(rects, damage->region,
+			       damage->region_count * sizeof(*rects));
+		return damage->region_count;
 	}
 
-	ret->count = count;
+	ret = drmModeDamageGrow(&damage->scratch, &damage->scratch_cap,
+				damage->region_count);
+	if (ret)
+		return ret;
+	memcpy(damage->scratch, damage->region,
+	       damage->region_count * sizeof(*rects));
+	ret = drmModeDamageCap(damage->scratch, damage->region_count, max_rects);
+	memcpy(rects, damage->scratch, ret * sizeof(*rects));
 	return ret;
 }
 
-drm_public drmModeObjectListPtr
-drmModeGetLease(int fd)
+static drmModeRectPtr drmModeDamageFetch(drmModeDamagePtr damage,
+					 int max_rects, int *count)
 {
-	struct drm_mode_get_lease get;
-	uint32_t count;
-	drmModeObjectListPtr ret;
-
-	memclear(get);
-
-	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_GET_LEASE, &get))
-		return NULL;
+	drmModeRectPtr rects;
+	int n;
 
-	count = get.count_objects;
-	ret = drmMalloc(sizeof (drmModeObjectListRes) + count * sizeof (ret->objects[0]));
-	if (!ret)
+	n = drmModeDamageGetRects(damage, NULL, 0);
+	if (n < 0) {
+		*count = n;
 		return NULL;
+	}
+	if (max_rects > 0)
+		n = MIN2(n, max_rects);
 
-	get.objects_ptr = VOID2U64(&ret->objects[0]);
-	if (DRM_IOCTL(fd, DRM_IOCTL_MODE_GET_LEASE, &get)) {
-		drmFree(ret);
+	rects = drmMalloc(MAX2(n, 1) * sizeof(*rects));
+	if (!rects) {
+		*count = -ENOMEM;
 		return NULL;
 	}
-
-	ret->count = count;
-	return ret;
+	*count = drmModeDamageGetRects(damage, rects, n);
+	return rects;
 }
 
-drm_public int
-drmModeRevokeLease(int fd, uint32_t lessee_id)
+drm_public int drmModeDamageDirtyFB(int fd, uint32_t bufferId,
+				    drmModeDamagePtr damage, int max_clips)
 {
-	struct drm_mode_revoke_lease revoke;
-	int ret;
-
-	memclear(revoke);
+	drmModeRectPtr rects;
+	drmModeClipPtr clips;
+	int i, n, ret;
+
+	rects = drmModeDamageFetch(damage, max_clips, &n);
+	if (!rects)
+		return n;
+
+	/* Zero clips would ask for a full flush instead of none. */
+	if (n <= 0) {
+		drmFree(rects);
+		return n;
+	}
 
-	revoke.lessee_id = lessee_id;
+	/* drm_clip_rect is 16 bit, which the frame buffer size rules out
+	 * overflowing for any real device. */
+	clips = drmMalloc(n * sizeof(*clips));
+	if (!clips) {
+		drmFree(rects);
+		return -ENOMEM;
+	}
+	for (i = 0; i < n; i++) {
+		clips[i].x1 = MIN2(rects[i].x1, UINT16_MAX);
+		clips[i].y1 = MIN2(rects[i].y1, UINT16_MAX);
+		clips[i].x2 = MIN2(rects[i].x2, UINT16_MAX);
+		clips[i].y2 = MIN2(rects[i].y2, UINT16_MAX);
+	}
 
-	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_REVOKE_LEASE, &revoke);
-	if (ret == 0)
-		return 0;
-	return -errno;
+	ret = drmModeDirtyFB(fd, bufferId, clips, n);
+	drmFree(clips);
+	drmFree(rects);
+	return ret;
 }
 
-drm_public drmModeFB2Ptr
-drmModeGetFB2(int fd, uint32_t fb_id)
+drm_public int drmModeDamageCreateBlob(int fd, drmModeDamagePtr damage,
+				       int max_rects, uint32_t *blob_id)
 {
-	struct drm_mode_fb_cmd2 get = {
-		.fb_id = fb_id,
-	};
-	drmModeFB2Ptr ret;
-	int err;
-
-	err = DRM_IOCTL(fd, DRM_IOCTL_MODE_GETFB2, &get);
-	if (err != 0)
-		return NULL;
+	drmModeRectPtr rects;
+	int n, ret;
 
-	ret = drmMalloc(sizeof(drmModeFB2));
-	if (!ret)
-		return NULL;
+	*blob_id = 0;
 
-	ret->fb_id = fb_id;
-	ret->width = get.width;
-	ret->height = get.height;
-	ret->pixel_format = get.pixel_format;
-	ret->flags = get.flags;
-	ret->modifier = get.modifier[0];
-	memcpy(ret->handles, get.handles, sizeof(uint32_t) * 4);
-	memcpy(ret->pitches, get.pitches, sizeof(uint32_t) * 4);
-	memcpy(ret->offsets, get.offsets, sizeof(uint32_t) * 4);
+	/* FB_DAMAGE_CLIPS without a blob already means the whole plane. */
+	if (damage->full)
+		return 1;
 
-	return ret;
-}
+	rects = drmModeDamageFetch(damage, max_rects, &n);
+	if (!rects)
+		return n;
+	if (n <= 0) {
+		drmFree(rects);
+		return n;
+	}
 
-drm_public void drmModeFreeFB2(drmModeFB2Ptr ptr)
-{
-	drmFree(ptr);
+	ret = drmModeCreatePropertyBlob(fd, rects, n * sizeof(*rects), blob_id);
+	drmFree(rects);
+	return ret ? ret : n;
 }
@@ -310,6 +310,35 @@ int drmModeAddFB2WithModifiers(int fd, uint32_t width, uint32_t height,
  */
 extern int drmModeRmFB(int fd, uint32_t bufferId);
 
+/*
+ * Framebuffer cache. drmModeAddFB2Cached() returns the framebuffer of an
+ * identical (handles, pitches, offsets, format, modifiers, size, flags)
+ * request made earlier on the same fd instead of creating a new one.
+ * Framebuffers released with drmModeReleaseFBCached() stay cached for
+ * reuse until they are evicted; drmModeFBCacheEvictHandle() must be called
+ * before closing a GEM handle used by cached framebuffers, as the handle
+ * number may be reused for another buffer.
+ */
+typedef struct _drmModeFBCacheStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint32_t entries;	/* Cached framebuffers */
+	uint32_t idle;		/* ... of which released */
+} drmModeFBCacheStats, *drmModeFBCacheStatsPtr;
+
+extern int drmModeAddFB2Cached(int fd, uint32_t width, uint32_t height,
+			       uint32_t pixel_format,
+			       const uint32_t bo_handles[4],
+			       const uint32_t pitches[4],
+			       const uint32_t offsets[4],
+			       const uint64_t modifier[4], uint32_t *buf_id,
+			       uint32_t flags);
+extern int drmModeReleaseFBCached(int fd, uint32_t buf_id);
+extern int drmModeFBCacheEvictHandle(int fd, uint32_t bo_handle);
+extern void drmModeFBCacheFlush(int fd);
+extern int drmModeFBCacheGetStats(int fd, drmModeFBCacheStatsPtr stats);
+
 /**
  * Mark a region of a framebuffer as dirty.
  */
@@ -376,6 +405,68 @@ extern drmModeConnectorPtr drmModeGetConnector(int fd,
 extern drmModeConnectorPtr drmModeGetConnectorCurrent(int fd,
 						      uint32_t connector_id);
 
+#define DRM_MODE_GET_CONNECTOR_PROBE    (1 << 0) /* as drmModeGetConnector */
+#define DRM_MODE_GET_CONNECTOR_NO_MODES (1 << 1) /* count_modes will be 0 */
+
+/**
+ * Retrieve information about the connector connector_id, using the counts of
+ * a previous result for the same connector, if any, to size the arrays up
+ * front. Without DRM_MODE_GET_CONNECTOR_PROBE this takes a single ioctl
+ * unless the counts grew, with it one probing ioctl plus one to fetch the
+ * modes, unless DRM_MODE_GET_CONNECTOR_NO_MODES is given too. prev is not
+ * modified and still has to be freed by the caller.
+ */
+extern drmModeConnectorPtr drmModeGetConnector2(int fd, uint32_t connector_id,
+						drmModeConnectorPtr prev,
+						uint32_t flags);
+
+/**
+ * Persistent cache of what probing the connectors found, to start from
+ * without probing them.
+ *
+ * The entries are keyed by the bus of the device and the type and type id
+ * of the connector, and hold the connection, physical size, subpixel order
+ * and modes of the last probe, with the hash of its EDID. The properties
+ * aren't kept, reading them doesn't probe. The file is read by
+ * drmModeConnectorCacheOpen() and replaced by drmModeConnectorCacheSave(),
+ * keeping the entries of the other devices it holds.
+ */
+typedef struct _drmModeConnectorCache *drmModeConnectorCachePtr;
+
+#define DRM_MODE_CONNECTOR_CACHE_HIT        (1 << 0) /* cached modes used */
+#define DRM_MODE_CONNECTOR_CACHE_EDID_MATCH (1 << 1) /* of the kernel's EDID */
+
+/**
+ * Open the cache of the device of fd stored at path, a missing or invalid
+ * file giving an empty cache. Returns NULL and sets errno on failure.
+ */
+extern drmModeConnectorCachePtr drmModeConnectorCacheOpen(int fd,
+							  const char *path);
+extern void drmModeConnectorCacheClose(drmModeConnectorCachePtr cache);
+
+/**
+ * Retrieve the connector as drmModeGetConnectorCurrent(), completed with
+ * the cached probe when the kernel has no modes for it and the EDID it
+ * has, if any, is the cached one. flags, if not NULL, is set to the
+ * DRM_MODE_CONNECTOR_CACHE_* flags. The connector should still be probed
+ * away from the startup path, and the cache updated with it.
+ */
+extern drmModeConnectorPtr
+drmModeConnectorCacheGet(drmModeConnectorCachePtr cache, uint32_t connector_id,
+			 uint32_t *flags);
+
+/**
+ * Record a probed connector. Returns 0 or a negative errno.
+ */
+extern int drmModeConnectorCacheUpdate(drmModeConnectorCachePtr cache,
+				       drmModeConnectorPtr connector);
+
+/**
+ * Write the cache if it was updated, through a temporary file renamed over
+ * the previous one. Returns 0 or a negative errno.
+ */
+extern int drmModeConnectorCacheSave(drmModeConnectorCachePtr cache);
+
 /**
  * Attaches the given mode to an connector.
  */
@@ -390,6 +481,12 @@ extern int drmModeDetachMode(int fd, uint32_t connectorId, drmModeModeInfoPtr mo
 extern drmModePropertyPtr drmModeGetProperty(int fd, uint32_t propertyId);
 extern void drmModeFreeProperty(drmModePropertyPtr ptr);
 
+/**
+ * The contents of a blob are fetched once per id and fd, and cached until
+ * drmModeInvalidatePropertyCache(fd) or until the blob is destroyed through
+ * drmModeDestroyPropertyBlob() on fd. The data of the returned blob is
+ * shared with the cache and must not be written.
+ */
 extern drmModePropertyBlobPtr drmModeGetPropertyBlob(int fd, uint32_t blob_id);
 extern void drmModeFreePropertyBlob(drmModePropertyBlobPtr ptr);
 extern int drmModeConnectorSetProperty(int fd, uint32_t connector_id, uint32_t property_id,
@@ -423,6 +520,55 @@ extern int drmModeObjectSetProperty(int fd, uint32_t object_id,
 				    uint32_t object_type, uint32_t property_id,
 				    uint64_t value);
 
+extern int drmModeObjectGetPropertyId(int fd, uint32_t object_id,
+				      const char *name, uint32_t *prop_id,
+				      uint32_t *flags);
+extern void drmModeInvalidatePropertyCache(int fd);
+
+/**
+ * Index of the (format, modifier) pairs of an IN_FORMATS blob.
+ *
+ * The blob is parsed once into a hash of its pairs, so that checking a pair
+ * doesn't search the blob.
+ */
+typedef struct _drmModeFormatModifiers *drmModeFormatModifiersPtr;
+
+typedef struct _drmModeFormatModifierIter {
+	uint32_t index;		/* Zero to start the iteration */
+	uint32_t format;
+	uint64_t modifier;
+} drmModeFormatModifierIter;
+
+/**
+ * Index a struct drm_format_modifier_blob of length bytes. Returns NULL and
+ * sets errno if the blob is malformed or on allocation failure.
+ */
+extern drmModeFormatModifiersPtr
+drmModeFormatModifiersCreate(const void *data, uint32_t length);
+extern void drmModeFormatModifiersFree(drmModeFormatModifiersPtr ptr);
+
+/**
+ * Index of the IN_FORMATS blob of a plane. It is made once per plane and fd
+ * and owned by the property cache: it must not be freed, and stays valid
+ * until drmModeInvalidatePropertyCache(fd). Returns NULL and sets errno on
+ * failure, to ENOENT if the plane has no IN_FORMATS property.
+ */
+extern drmModeFormatModifiersPtr
+drmModeGetPlaneFormatModifiers(int fd, uint32_t plane_id);
+
+/**
+ * Whether the pair is in the index.
+ */
+extern int drmModeFormatModifiersSupported(drmModeFormatModifiersPtr ptr,
+					   uint32_t format, uint64_t modifier);
+
+/**
+ * Fill iter with the next pair, in the order of the blob formats and then
+ * of the modifiers of each format. Returns 0 once all pairs were returned.
+ */
+extern int drmModeFormatModifiersIterNext(drmModeFormatModifiersPtr ptr,
+					  drmModeFormatModifierIter *iter);
+
 
 typedef struct _drmModeAtomicReq drmModeAtomicReq, *drmModeAtomicReqPtr;
 
@@ -437,15 +583,413 @@ extern int drmModeAtomicAddProperty(drmModeAtomicReqPtr req,
 				    uint32_t object_id,
 				    uint32_t property_id,
 				    uint64_t value);
+extern int drmModeAtomicAddPropertyByName(drmModeAtomicReqPtr req, int fd,
+					  uint32_t object_id,
+					  const char *name, uint64_t value);
 extern int drmModeAtomicCommit(int fd,
 			       drmModeAtomicReqPtr req,
 			       uint32_t flags,
 			       void *user_data);
 
+/**
+ * Build the kernel arrays of req once, so that drmModeAtomicCommit() only
+ * issues the ioctl for as long as the request is only changed through
+ * drmModeAtomicPreparedSet(). Adding or merging properties or moving the
+ * cursor drops the prepared arrays, and the next commit builds them again.
+ * drmModeAtomicCommit() only reads req, so several threads may commit the
+ * same request, but not while it is prepared or set.
+ */
+extern int drmModeAtomicPrepare(drmModeAtomicReqPtr req);
+
+/**
+ * Set the value of the property added at index idx to a prepared request,
+ * idx being the cursor drmModeAtomicAddProperty() returned for it minus one.
+ * Returns -EINVAL if req is not prepared or idx is past the cursor.
+ */
+extern int drmModeAtomicPreparedSet(drmModeAtomicReqPtr req, uint32_t idx,
+				    uint64_t value);
+
+typedef struct _drmModeAtomicChoice {
+	int count_options;
+	drmModeAtomicReqPtr *options;	/* Alternatives, preferred first */
+} drmModeAtomicChoice, *drmModeAtomicChoicePtr;
+
+/**
+ * Find the largest set of choices which passes a TEST_ONLY commit on top of
+ * req, e.g. which layers can be promoted to which planes.
+ *
+ * Each choice lists alternative property sets (for instance one per
+ * candidate plane) of which at most one is applied. The search prefers
+ * earlier choices and options, skips combinations containing one that
+ * already failed, and stops after max_tests test commits (unlimited if
+ * max_tests <= 0). On success req has the best combination appended,
+ * selected[i] holds the option picked for choice i or -1, and the number of
+ * choices satisfied is returned. A negative errno is returned if req itself
+ * fails the test.
+ */
+extern int drmModeAtomicTestChoices(int fd, drmModeAtomicReqPtr req,
+				    const drmModeAtomicChoice *choices,
+				    int count_choices, int *selected,
+				    int max_tests, uint32_t flags,
+				    void *user_data);
+
+/**
+ * Queue of nonblocking atomic commits, with at most one commit in flight per
+ * CRTC.
+ *
+ * A commit submitted while the CRTC has one in flight is kept pending, and
+ * the commits submitted after it are merged into it, the values set last
+ * winning, until the page flip event of the commit in flight lets the
+ * queue commit it. Submitting never blocks and never fails with EBUSY.
+ *
+ * The handler is called once for each submitted commit, with status 0 and
+ * the page flip event data once it completed, -ECANCELED when a commit
+ * merged after it superseded its values, or the negative errno of a
+ * failed commit of the pending state.
+ */
+typedef struct _drmModeCommitQueue *drmModeCommitQueuePtr;
+struct _drmEventContext;
+
+typedef void (*drmModeCommitQueueHandler)(int fd, uint32_t crtc_id,
+					  int status, unsigned int sequence,
+					  unsigned int tv_sec,
+					  unsigned int tv_usec,
+					  void *user_data);
+
+extern drmModeCommitQueuePtr
+drmModeCommitQueueCreate(int fd, drmModeCommitQueueHandler handler);
+
+/**
+ * Free the queue, cancelling the pending commits. It must not have commits
+ * in flight any more, see drmModeCommitQueueInFlight().
+ */
+extern void drmModeCommitQueueDestroy(drmModeCommitQueuePtr queue);
+
+/**
+ * Commit req, which must only change the state of crtc_id, or keep it for
+ * later if a commit is in flight on the CRTC. DRM_MODE_ATOMIC_NONBLOCK and
+ * DRM_MODE_PAGE_FLIP_EVENT are added to flags. req is copied and may be
+ * reused right away. Returns 0 or the negative errno of a failed commit.
+ */
+extern int drmModeCommitQueueSubmit(drmModeCommitQueuePtr queue,
+				    uint32_t crtc_id, drmModeAtomicReqPtr req,
+				    uint32_t flags, void *user_data);
+
+/**
+ * Dispatch the pending DRM events as drmHandleEvents2(), passing the page
+ * flip events of the queue's commits to the queue and all other events to
+ * evctx, which may be NULL.
+ */
+extern int drmModeCommitQueueHandleEvents(drmModeCommitQueuePtr queue,
+					  struct _drmEventContext *evctx,
+					  uint32_t flags);
+
+/**
+ * Number of CRTCs with a commit of the queue in flight.
+ */
+extern int drmModeCommitQueueInFlight(drmModeCommitQueuePtr queue);
+
+/**
+ * Explicit synchronization of atomic commits.
+ *
+ * The acquire fences of the planes are set as their IN_FENCE_FD, from a
+ * sync file or a syncobj point, and the release fences the CRTCs give
+ * through OUT_FENCE_PTR are imported into syncobj points by the commit.
+ * The commit also closes the sync files made for the acquire fences and
+ * drops what was added, unless it is a DRM_MODE_ATOMIC_TEST_ONLY one, so
+ * that the same object serves the next commit.
+ */
+typedef struct _drmModeAtomicFences *drmModeAtomicFencesPtr;
+
+#define DRM_MODE_ATOMIC_FENCES_MAX_CRTCS	32
+
+extern drmModeAtomicFencesPtr drmModeAtomicFencesCreate(int fd);
+extern void drmModeAtomicFencesDestroy(drmModeAtomicFencesPtr fences);
+
+/**
+ * Set the acquire fence of plane_id in req to sync_file, which stays owned
+ * by the caller and must stay open until the commit.
+ */
+extern int drmModeAtomicFencesAddInFence(drmModeAtomicFencesPtr fences,
+					 drmModeAtomicReqPtr req,
+					 uint32_t plane_id, int sync_file);
+
+/**
+ * Set the acquire fence of plane_id in req to the fence of a point of the
+ * syncobj, 0 for a binary syncobj, which must already have been submitted.
+ */
+extern int drmModeAtomicFencesAddInSyncobj(drmModeAtomicFencesPtr fences,
+					   drmModeAtomicReqPtr req,
+					   uint32_t plane_id, uint32_t handle,
+					   uint64_t point);
+
+/**
+ * Request the release fence of crtc_id in req, to be imported into a point
+ * of the syncobj, 0 for a binary syncobj, once committed. Up to
+ * DRM_MODE_ATOMIC_FENCES_MAX_CRTCS CRTCs can be added.
+ */
+extern int drmModeAtomicFencesAddOutSyncobj(drmModeAtomicFencesPtr fences,
+					    drmModeAtomicReqPtr req,
+					    uint32_t crtc_id, uint32_t handle,
+					    uint64_t point);
+
+/**
+ * Commit req as drmModeAtomicCommit(), then import the release fences.
+ * Returns 0, the negative errno of the commit, or else of the first import
+ * failing.
+ */
+extern int drmModeAtomicFencesCommit(drmModeAtomicFencesPtr fences,
+				     drmModeAtomicReqPtr req, uint32_t flags,
+				     void *user_data);
+
+/**
+ * Drop the fences added, closing the sync files made, e.g. when the
+ * request is given up after a failed test.
+ */
+extern void drmModeAtomicFencesReset(drmModeAtomicFencesPtr fences);
+
+/**
+ * Ring of framebuffers captured by a writeback connector.
+ *
+ * Each framebuffer of the ring is exported once as dma-bufs, so that the
+ * captured frames can be passed on without copies. A framebuffer is
+ * attached to an atomic commit, waited for through its out fence, handed
+ * to the caller, and reused once released.
+ */
+typedef struct _drmModeWriteback *drmModeWritebackPtr;
+
+typedef struct _drmModeWritebackFrame {
+	uint32_t fb_id;
+	uint32_t width, height;
+	uint32_t pixel_format;
+	uint64_t modifier;
+	int num_planes;
+	int fds[4];		/* dma-bufs, owned by the ring */
+	uint32_t pitches[4];
+	uint32_t offsets[4];
+} drmModeWritebackFrame, *drmModeWritebackFramePtr;
+
+/**
+ * Create a ring of the count framebuffers fb_ids for connector_id. The
+ * framebuffers stay owned by the caller and must outlive the ring.
+ */
+extern drmModeWritebackPtr drmModeWritebackCreate(int fd,
+						  uint32_t connector_id,
+						  const uint32_t *fb_ids,
+						  int count);
+extern void drmModeWritebackDestroy(drmModeWritebackPtr wb);
+
+/**
+ * Add the properties capturing the output of crtc_id into the next free
+ * framebuffer to req. Returns the index of the frame, or -EBUSY if all
+ * framebuffers are attached or held. drmModeWritebackCancel() must be
+ * called if req is not committed successfully.
+ */
+extern int drmModeWritebackAttach(drmModeWritebackPtr wb,
+				  drmModeAtomicReqPtr req, uint32_t crtc_id);
+extern void drmModeWritebackCancel(drmModeWritebackPtr wb, int index);
+
+/**
+ * Out fence of an attached frame once its commit was done, to poll for the
+ * capture to complete, or -1.
+ */
+extern int drmModeWritebackGetFence(drmModeWritebackPtr wb, int index);
+
+/**
+ * Wait up to timeout_ms (-1 for ever) for the oldest attached frame to be
+ * captured, and hold it until drmModeWritebackRelease(). Returns its index,
+ * -ENOENT if no frame was committed, or -ETIMEDOUT.
+ */
+extern int drmModeWritebackAcquire(drmModeWritebackPtr wb, int timeout_ms,
+				   drmModeWritebackFramePtr *frame);
+extern int drmModeWritebackRelease(drmModeWritebackPtr wb, int index);
+
+/**
+ * Capture of the framebuffers scanned out by a CRTC, without writeback.
+ *
+ * The planes of each framebuffer seen are exported as dma-bufs, and mapped
+ * if asked, once, and cached by framebuffer id: a swapchain flipping
+ * through the same framebuffers costs a single GETCRTC per frame. Since
+ * framebuffer ids get reused once removed, drmModeCaptureInvalidate() must
+ * be called for the framebuffers known to be gone.
+ */
+typedef struct _drmModeCapture *drmModeCapturePtr;
+
+#define DRM_MODE_CAPTURE_MAP	(1 << 0)	/* Map the planes read-only */
+
+typedef struct _drmModeCaptureFrame {
+	uint32_t fb_id;
+	uint32_t width, height;
+	uint32_t pixel_format;
+	uint64_t modifier;
+	int num_planes;
+	int fds[4];		/* dma-bufs, owned by the capture */
+	uint32_t pitches[4];
+	uint32_t offsets[4];
+	const void *map[4];	/* The planes with DRM_MODE_CAPTURE_MAP */
+
+	/*
+	 * sync_file signaled once the frame is fully written, owned by the
+	 * capture, or -1 if the kernel cannot export it: then poll() the fds
+	 * for POLLIN instead.
+	 */
+	int fence;
+} drmModeCaptureFrame, *drmModeCaptureFramePtr;
+
+extern drmModeCapturePtr drmModeCaptureCreate(int fd, uint32_t crtc_id,
+					      uint32_t flags);
+extern void drmModeCaptureDestroy(drmModeCapturePtr cap);
+
+/**
+ * Set the framebuffer to capture next, for callers that know it from their
+ * own page flips. With 0, it is queried from the CRTC again.
+ */
+extern void drmModeCaptureSetFB(drmModeCapturePtr cap, uint32_t fb_id);
+
+/**
+ * Hold the frame currently scanned out until drmModeCaptureRelease().
+ * Returns its index, -ENOENT if the CRTC shows no framebuffer, or -EBUSY if
+ * all the cached frames are held.
+ */
+extern int drmModeCaptureAcquire(drmModeCapturePtr cap,
+				 drmModeCaptureFramePtr *frame);
+extern int drmModeCaptureRelease(drmModeCapturePtr cap, int index);
+
+/**
+ * Drop the cached exports of a framebuffer, returns -EBUSY if it is held.
+ */
+extern int drmModeCaptureInvalidate(drmModeCapturePtr cap, uint32_t fb_id);
+
+/**
+ * Cursor updates coalesced to at most one per vblank.
+ *
+ * Moves and image changes are only recorded, and submitted by
+ * drmModeCursorFlush() a quarter of a refresh period before the next vblank
+ * no update was submitted for yet, as told by the vblank predictor. Until
+ * the predictor has a period, updates are submitted right away.
+ *
+ * With a plane_id, updates are nonblocking atomic commits of the cursor
+ * plane; one hitting a commit still in flight is retried for the next
+ * vblank. Without, they go through drmModeSetCursor2() and
+ * drmModeMoveCursor(), which the kernel applies asynchronously.
+ */
+typedef struct _drmModeCursor *drmModeCursorPtr;
+
+struct _drmVblankPredictor;
+
+/**
+ * Create the cursor of crtc_id. pred, fed with the vblanks of the CRTC by
+ * the caller, must outlive the cursor; with NULL, the cursor samples the
+ * vblanks itself with drmCrtcGetSequence() now and then.
+ */
+extern drmModeCursorPtr drmModeCursorCreate(int fd, uint32_t crtc_id,
+					    uint32_t plane_id,
+					    struct _drmVblankPredictor *pred);
+extern void drmModeCursorDestroy(drmModeCursorPtr cursor);
+
+/** Record the position of the top-left corner of the cursor image. */
+extern void drmModeCursorMove(drmModeCursorPtr cursor, int32_t x, int32_t y);
+
+/**
+ * Record the cursor image: fb_id for the atomic cursors, bo_handle for the
+ * legacy ones, 0 hiding the cursor.
+ */
+extern void drmModeCursorSetImage(drmModeCursorPtr cursor, uint32_t fb_id,
+				  uint32_t bo_handle, uint32_t width,
+				  uint32_t height, int32_t hot_x,
+				  int32_t hot_y);
+
+/**
+ * Nanoseconds from the CLOCK_MONOTONIC now_ns to the next submission, or -1
+ * if nothing is pending.
+ */
+extern int64_t drmModeCursorGetTimeout(drmModeCursorPtr cursor,
+				       uint64_t now_ns);
+
+/**
+ * Submit the recorded update if its time has come. Returns 1 if an update
+ * was submitted, 0 if none was due, or -errno.
+ */
+extern int drmModeCursorFlush(drmModeCursorPtr cursor, uint64_t now_ns);
+
 extern int drmModeCreatePropertyBlob(int fd, const void *data, size_t size,
 				     uint32_t *id);
 extern int drmModeDestroyPropertyBlob(int fd, uint32_t id);
 
+/**
+ * Create a property blob, sharing the blob of an identical payload
+ * previously created through this function on the same fd.
+ *
+ * Shared blobs are refcounted: drmModeDestroyPropertyBlob() only destroys
+ * the kernel object once every creator has released it. Blob ids stay
+ * stable for repeated payloads, which keeps atomic commits from flagging
+ * an unchanged MODE_ID, GAMMA_LUT or CTM as modified.
+ */
+extern int drmModeCreatePropertyBlobShared(int fd, const void *data,
+					   size_t size, uint32_t *id);
+/**
+ * Forget the shared blob bookkeeping of fd, e.g. before the fd number is
+ * reused. The kernel blobs themselves are not destroyed.
+ */
+extern void drmModeInvalidatePropertyBlobCache(int fd);
+
+/**
+ * Build a LUT of size entries of gain * x^gamma per red, green and blue
+ * channel, x going from 0.0 to 1.0. NULL gamma or gain stand for 1.0.
+ */
+extern void drmModeColorLutBuild(struct drm_color_lut *lut, uint32_t size,
+				 const double gamma[3], const double gain[3]);
+/**
+ * Interpolate src linearly to the dst_size entries of dst, e.g. to the size
+ * the hardware takes.
+ */
+extern void drmModeColorLutResample(struct drm_color_lut *dst,
+				    uint32_t dst_size,
+				    const struct drm_color_lut *src,
+				    uint32_t src_size);
+/** Convert a row-major 3x3 matrix to the S31.32 sign-magnitude CTM. */
+extern void drmModeColorCtmBuild(struct drm_color_ctm *ctm,
+				 const double matrix[9]);
+
+/**
+ * Color management state of a CRTC: DEGAMMA_LUT, CTM and GAMMA_LUT.
+ *
+ * The LUTs and the matrix set are turned into shared blobs (see
+ * drmModeCreatePropertyBlobShared()), so that setting the same quantized
+ * content again finds the blob already set and changes nothing: animations
+ * only commit the frames that actually change the hardware state.
+ */
+typedef struct _drmModeColor *drmModeColorPtr;
+
+#define DRM_MODE_COLOR_DEGAMMA_LUT	0
+#define DRM_MODE_COLOR_GAMMA_LUT	1
+
+#define DRM_MODE_COLOR_ADD_ALL		(1 << 0)
+
+extern drmModeColorPtr drmModeColorCreate(int fd, uint32_t crtc_id);
+extern void drmModeColorDestroy(drmModeColorPtr color);
+
+/** Entries of the LUT in the hardware, 0 if the CRTC has no such LUT. */
+extern uint32_t drmModeColorGetLutSize(drmModeColorPtr color, int lut);
+
+/**
+ * Set a LUT, resampled to the hardware size if size differs, or clear it
+ * with NULL. Returns 1 if that changes the state, 0 if not, or -errno.
+ */
+extern int drmModeColorSetLut(drmModeColorPtr color, int lut,
+			      const struct drm_color_lut *data, uint32_t size);
+/** Same as drmModeColorSetLut() for the CTM. */
+extern int drmModeColorSetCtm(drmModeColorPtr color,
+			      const struct drm_color_ctm *ctm);
+
+/**
+ * Add the properties changed since the previous call to req, or all of them
+ * with DRM_MODE_COLOR_ADD_ALL, e.g. after a failed commit. Returns the
+ * number of properties added, 0 when the commit can be skipped, or -errno.
+ */
+extern int drmModeColorAddProperties(drmModeColorPtr color,
+				     drmModeAtomicReqPtr req, uint32_t flags);
+
 /*
  * DRM mode lease APIs. These create and manage new drm_masters with
  * access to a subset of the available DRM resources
@@ -469,6 +1013,262 @@ extern drmModeObjectListPtr drmModeGetLease(int fd);
 
 extern int drmModeRevokeLease(int fd, uint32_t lessee_id);
 
+/**
+ * Lease manager, handing out leases of single outputs.
+ *
+ * The lease of a connector holds the connector, a CRTC that can drive it,
+ * preferably the one already driving it, and a primary plane of the CRTC,
+ * plus its cursor plane and free overlay planes on request. Objects leased
+ * through the manager are not picked again until revoked. Leases may be
+ * created ahead of time with drmModeLeaseManagerPrepare(), so that
+ * drmModeLeaseManagerAcquire() only has to hand the fd out.
+ */
+typedef struct _drmModeLeaseManager *drmModeLeaseManagerPtr;
+
+#define DRM_MODE_LEASE_CURSOR	(1 << 0) /* Add a cursor plane */
+#define DRM_MODE_LEASE_OVERLAYS	(1 << 1) /* Add the free overlay planes */
+
+/**
+ * Create a manager for the master fd, working from a snapshot of the KMS
+ * topology, see drmModeLeaseManagerRefresh().
+ */
+extern drmModeLeaseManagerPtr drmModeLeaseManagerCreate(int fd);
+
+/**
+ * Revoke the prepared leases and free the manager. The leases handed out
+ * are left alone.
+ */
+extern void drmModeLeaseManagerDestroy(drmModeLeaseManagerPtr manager);
+
+/**
+ * Take a new snapshot of the topology, after a hotplug.
+ */
+extern int drmModeLeaseManagerRefresh(drmModeLeaseManagerPtr manager);
+
+/**
+ * Fill objects with up to max_objects ids of the lease of connector_id,
+ * without creating it, and return how many it needs, or a negative errno,
+ * -EBUSY if no CRTC or primary plane is left for the connector.
+ */
+extern int drmModeLeaseManagerGetObjects(drmModeLeaseManagerPtr manager,
+					 uint32_t connector_id, uint32_t flags,
+					 uint32_t *objects, int max_objects);
+
+/**
+ * Create a lease of connector_id and keep it for drmModeLeaseManagerAcquire().
+ */
+extern int drmModeLeaseManagerPrepare(drmModeLeaseManagerPtr manager,
+				      uint32_t connector_id, uint32_t flags);
+
+/**
+ * Hand out the lease of connector_id: the one prepared with the same flags,
+ * or a new one. Returns the lease fd, which belongs to the caller, or a
+ * negative errno.
+ */
+extern int drmModeLeaseManagerAcquire(drmModeLeaseManagerPtr manager,
+				      uint32_t connector_id, uint32_t flags,
+				      uint32_t *lessee_id);
+
+/**
+ * Revoke a lease of the manager, making its objects available again.
+ */
+extern int drmModeLeaseManagerRevoke(drmModeLeaseManagerPtr manager,
+				     uint32_t lessee_id);
+
+/*
+ * KMS topology snapshots. All the CRTCs, encoders, connectors and planes of
+ * a device, with their properties, fetched in one call into a single
+ * allocation arena.
+ */
+
+#define DRM_MODE_TOPOLOGY_PROBE		(1 << 0) /* Probe connectors */
+#define DRM_MODE_TOPOLOGY_NO_PROPERTIES	(1 << 1) /* Skip object properties */
+
+typedef struct _drmModeTopologyObject {
+	uint32_t id;
+	uint32_t type;		/* DRM_MODE_OBJECT_* */
+	uint32_t count_props;
+	uint32_t *props;
+	uint64_t *prop_values;
+	uint64_t hash;		/* Fingerprint of the object state */
+	void *object;		/* drmModeCrtcPtr, drmModeEncoderPtr, ... */
+} drmModeTopologyObject, *drmModeTopologyObjectPtr;
+
+typedef struct _drmModeTopology {
+	uint32_t min_width, max_width;
+	uint32_t min_height, max_height;
+
+	int count_crtcs;
+	drmModeCrtcPtr crtcs;
+	int count_encoders;
+	drmModeEncoderPtr encoders;
+	int count_connectors;
+	drmModeConnectorPtr connectors;
+	int count_planes;
+	drmModePlanePtr planes;
+
+	int count_objects;
+	drmModeTopologyObjectPtr objects;	/* Sorted by id */
+
+	void *arena;
+} drmModeTopology, *drmModeTopologyPtr;
+
+#define DRM_MODE_TOPOLOGY_ADDED		1
+#define DRM_MODE_TOPOLOGY_REMOVED	2
+#define DRM_MODE_TOPOLOGY_CHANGED	3
+
+typedef struct _drmModeTopologyChange {
+	uint32_t id;
+	uint32_t type;		/* DRM_MODE_OBJECT_* */
+	uint32_t change;	/* DRM_MODE_TOPOLOGY_ADDED, ... */
+} drmModeTopologyChange, *drmModeTopologyChangePtr;
+
+/**
+ * Fetch a snapshot of the whole KMS topology.
+ *
+ * Every pointer in the returned snapshot, including the arrays of the
+ * embedded connectors and planes, belongs to the snapshot and is released
+ * by drmModeFreeTopologySnapshot(); the individual drmModeFree* helpers must
+ * not be used on them. Connectors are not probed unless
+ * DRM_MODE_TOPOLOGY_PROBE is given.
+ */
+extern drmModeTopologyPtr drmModeGetTopologySnapshot(int fd, uint32_t flags);
+extern void drmModeFreeTopologySnapshot(drmModeTopologyPtr topology);
+
+/**
+ * Look up an object of a snapshot by id, or NULL if it is not part of it.
+ */
+extern drmModeTopologyObjectPtr
+drmModeTopologyGetObject(drmModeTopologyPtr topology, uint32_t id);
+
+/**
+ * Compare two snapshots of the same device.
+ *
+ * Fills up to max_changes entries with the objects added, removed or
+ * modified (state or property values) between prev and cur, in id order,
+ * and returns the total number of changes, which may exceed max_changes.
+ */
+extern int drmModeTopologyDiff(drmModeTopologyPtr prev, drmModeTopologyPtr cur,
+			       drmModeTopologyChangePtr changes,
+			       int max_changes);
+
+/**
+ * Called by drmModeProbeConnectors() for each connector as its probe
+ * completes. connector belongs to the caller and is NULL if the probe
+ * failed, error being its errno value.
+ */
+typedef void (*drmModeProbeHandler)(void *user_data, uint32_t connector_id,
+				    drmModeConnectorPtr connector, int error);
+
+/**
+ * Probe count connectors, as drmModeGetConnector(), on up to max_workers
+ * threads at once, 0 for a default, so that the DDC/AUX transfers of one
+ * don't wait for the others where the kernel allows it.
+ *
+ * handler is called from the calling thread in the order the probes
+ * complete, while the others go on, and the call returns once all have
+ * been reported. Returns the number of successful probes or a negative
+ * errno value. Probes run one after the other if no thread can be started.
+ */
+extern int drmModeProbeConnectors(int fd, const uint32_t *connector_ids,
+				  int count, int max_workers,
+				  drmModeProbeHandler handler, void *user_data);
+
+typedef struct _drmModeHotplugListener *drmModeHotplugListenerPtr;
+
+/**
+ * Called for every connector whose state changed. old is NULL for a new
+ * connector and cur is NULL for a removed one. Both belong to the listener:
+ * old is freed once the handler returns, cur stays valid until the next
+ * change of the same connector.
+ */
+typedef void (*drmModeHotplugHandler)(void *user_data,
+				      drmModeConnectorPtr old,
+				      drmModeConnectorPtr cur);
+
+#define DRM_MODE_HOTPLUG_PROBE_NEW (1 << 0) /* probe newly connected sinks */
+
+/**
+ * Listen for hotplug uevents of the KMS device fd (Linux only).
+ *
+ * The listener keeps the current state of every connector and, on a
+ * hotplug event, re-reads only the connector named by the CONNECTOR= hint
+ * without probing it, or all connectors if the event carries no hint.
+ * With DRM_MODE_HOTPLUG_PROBE_NEW a connector that became connected is
+ * probed once so that its modes are up to date; those of one event are
+ * probed together with drmModeProbeConnectors() and reported after the
+ * other changes, as their probes complete.
+ */
+extern drmModeHotplugListenerPtr drmModeHotplugListenerCreate(int fd,
+							      uint32_t flags);
+extern void drmModeHotplugListenerDestroy(drmModeHotplugListenerPtr listener);
+
+/**
+ * Non-blocking fd to poll for readability before calling
+ * drmModeHotplugListenerDispatch().
+ */
+extern int drmModeHotplugListenerGetFd(drmModeHotplugListenerPtr listener);
+
+/**
+ * Last known state of a connector, or NULL if it does not exist.
+ */
+extern drmModeConnectorPtr
+drmModeHotplugListenerGetConnector(drmModeHotplugListenerPtr listener,
+				   uint32_t connector_id);
+
+/**
+ * Process the pending uevents and call handler for each connector that
+ * changed. Returns the number of changes or a negative errno value.
+ */
+extern int drmModeHotplugListenerDispatch(drmModeHotplugListenerPtr listener,
+					  drmModeHotplugHandler handler,
+					  void *user_data);
+
+typedef struct drm_mode_rect drmModeRect, *drmModeRectPtr;
+typedef struct _drmModeDamage *drmModeDamagePtr;
+
+/**
+ * Accumulate the damage of a width x height frame buffer.
+ *
+ * Rectangles are clipped to the frame buffer and may overlap; they are
+ * only coalesced into a minimal banded set of non-overlapping rectangles
+ * when the damage is read back.
+ */
+extern drmModeDamagePtr drmModeDamageCreate(int32_t width, int32_t height);
+extern void drmModeDamageDestroy(drmModeDamagePtr damage);
+extern void drmModeDamageReset(drmModeDamagePtr damage);
+extern int drmModeDamageAddRect(drmModeDamagePtr damage,
+				int32_t x1, int32_t y1, int32_t x2, int32_t y2);
+extern int drmModeDamageAddRects(drmModeDamagePtr damage,
+				 const drmModeRect *rects, int count);
+
+/**
+ * Copy the coalesced damage to rects and return the number of rectangles.
+ *
+ * If the damage needs more than max_rects rectangles, nearby rectangles are
+ * merged into their bounding boxes, picking the merges that add the least
+ * undamaged area, until it fits. With max_rects 0 only the number of
+ * rectangles is returned.
+ */
+extern int drmModeDamageGetRects(drmModeDamagePtr damage,
+				 drmModeRectPtr rects, int max_rects);
+
+/**
+ * Flush the damage with drmModeDirtyFB(), using at most max_clips clip
+ * rectangles (0 for no limit). Nothing is sent for an empty damage.
+ */
+extern int drmModeDamageDirtyFB(int fd, uint32_t bufferId,
+				drmModeDamagePtr damage, int max_clips);
+
+/**
+ * Create a FB_DAMAGE_CLIPS blob of at most max_rects rectangles (0 for no
+ * limit). Returns the number of rectangles, 0 for an empty damage, or a
+ * negative errno value. *blob_id is 0 if no blob was needed, which is also
+ * the case when the whole frame buffer is damaged.
+ */
+extern int drmModeDamageCreateBlob(int fd, drmModeDamagePtr damage,
+				   int max_rects, uint32_t *blob_id);
+
 #if defined(__cplusplus)
 }
 #endif
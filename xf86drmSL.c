@@ -27,202 +27,372 @@
  *
  * DESCRIPTION
  *
- * This file contains a straightforward skip list implementation.n
+ * This file contains the ordered map behind the drmSL* "skip list" API.
+ * Despite the name, the entries are kept in sorted blocks of contiguous
+ * keys and values, indexed by a directory holding the first key of every
+ * block.  A lookup is a binary search over the directory followed by a
+ * binary search inside a single block, so it touches a couple of cache
+ * lines instead of chasing one heap node per level, and in-order walks
+ * are a linear scan.
  *
  * FUTURE ENHANCEMENTS
  *
  * REFERENCES
  *
  * [Pugh90] William Pugh.  Skip Lists: A Probabilistic Alternative to
- * Balanced Trees. CACM 33(6), June 1990, pp. 668-676.
+ * Balanced Trees. CACM 33(6), June 1990, pp. 668-676.  (The original
+ * implementation of this interface.)
  *
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 
 #include "libdrm_macros.h"
 #include "xf86drm.h"
 
 #define SL_LIST_MAGIC  0xfacade00LU
-#define SL_ENTRY_MAGIC 0x00fab1edLU
+#define SL_BLOCK_MAGIC 0x00fab1edLU
 #define SL_FREED_MAGIC 0xdecea5edLU
-#define SL_MAX_LEVEL   16
-#define SL_RANDOM_SEED 0xc01055a1LU
+#define SL_BLOCK_SIZE  64	/* Entries per block */
+#define SL_BULK_FILL   48	/* Entries per block when bulk building */
 
-#define SL_RANDOM_DECL        static void *state = NULL
-#define SL_RANDOM_INIT(seed)  if (!state) state = drmRandomCreate(seed)
-#define SL_RANDOM             drmRandom(state)
-
-typedef struct SLEntry {
-    unsigned long     magic;	   /* SL_ENTRY_MAGIC */
-    unsigned long     key;
-    void              *value;
-    int               levels;
-    struct SLEntry    *forward[1]; /* variable sized array */
-} SLEntry, *SLEntryPtr;
+typedef struct SLBlock {
+    unsigned long     magic;	/* SL_BLOCK_MAGIC */
+    int               count;
+    unsigned long     keys[SL_BLOCK_SIZE];
+    void              *values[SL_BLOCK_SIZE];
+} SLBlock, *SLBlockPtr;
 
 typedef struct SkipList {
     unsigned long    magic;	/* SL_LIST_MAGIC */
-    int              level;
     int              count;
-    SLEntryPtr       head;
-    SLEntryPtr       p0;	/* Position for iteration */
+    int              nblocks;
+    int              size;	/* Allocated directory slots */
+    SLBlockPtr       *blocks;
+    unsigned long    *first;	/* First key of each block */
+    unsigned int     serial;	/* Bumped on every modification */
+
+				/* Iteration state */
+    int              p0_block;
+    int              p0_slot;
+    unsigned long    p0_key;	/* Lower bound of the next key returned */
+    unsigned int     p0_serial;
+    int              p0_done;
 } SkipList, *SkipListPtr;
 
-static SLEntryPtr SLCreateEntry(int max_level, unsigned long key, void *value)
+static SLBlockPtr SLCreateBlock(void)
+{
+    SLBlockPtr block;
+
+    block        = drmMalloc(sizeof(*block));
+    if (!block) return NULL;
+    block->magic = SL_BLOCK_MAGIC;
+    block->count = 0;
+
+    return block;
+}
+
+static void SLFreeBlock(SLBlockPtr block)
+{
+    block->magic = SL_FREED_MAGIC;
+    drmFree(block);
+}
+
+static int SLDirInsert(SkipListPtr list, int idx, SLBlockPtr block)
+{
+    if (list->nblocks == list->size) {
+	int            size = list->size ? list->size * 2 : 8;
+	SLBlockPtr     *blocks;
+	unsigned long  *first;
+
+	blocks = realloc(list->blocks, size * sizeof(*blocks));
+	if (!blocks) return -1;
+	list->blocks = blocks;
+	first = realloc(list->first, size * sizeof(*first));
+	if (!first) return -1;
+	list->first = first;
+	list->size  = size;
+    }
+
+    memmove(&list->blocks[idx + 1], &list->blocks[idx],
+	    (list->nblocks - idx) * sizeof(list->blocks[0]));
+    memmove(&list->first[idx + 1], &list->first[idx],
+	    (list->nblocks - idx) * sizeof(list->first[0]));
+    list->blocks[idx] = block;
+    list->first[idx]  = block->count ? block->keys[0] : 0;
+    ++list->nblocks;
+    return 0;
+}
+
+static void SLDirRemove(SkipListPtr list, int idx)
+{
+    SLFreeBlock(list->blocks[idx]);
+    --list->nblocks;
+    memmove(&list->blocks[idx], &list->blocks[idx + 1],
+	    (list->nblocks - idx) * sizeof(list->blocks[0]));
+    memmove(&list->first[idx], &list->first[idx + 1],
+	    (list->nblocks - idx) * sizeof(list->first[0]));
+}
+
+/* Index of the last block whose first key is <= key, or 0. */
+static int SLFindBlock(SkipListPtr list, unsigned long key)
+{
+    int lo = 0, hi = list->nblocks;
+
+    while (hi - lo > 1) {
+	int mid = (lo + hi) / 2;
+
+	if (list->first[mid] <= key) lo = mid;
+	else                         hi = mid;
+    }
+    return lo;
+}
+
+/* Index of the first key >= key in the block. */
+static int SLFindSlot(SLBlockPtr block, unsigned long key)
 {
-    SLEntryPtr entry;
-    
-    if (max_level < 0 || max_level > SL_MAX_LEVEL) max_level = SL_MAX_LEVEL;
-
-    entry         = drmMalloc(sizeof(*entry)
-			     + (max_level + 1) * sizeof(entry->forward[0]));
-    if (!entry) return NULL;
-    entry->magic  = SL_ENTRY_MAGIC;
-    entry->key    = key;
-    entry->value  = value;
-    entry->levels = max_level + 1;
-
-    return entry;
+    int lo = 0, hi = block->count;
+
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+
+	if (block->keys[mid] < key) lo = mid + 1;
+	else                        hi = mid;
+    }
+    return lo;
 }
 
-static int SLRandomLevel(void)
+/* Position of the first entry with a key >= key; *block == nblocks at end. */
+static void SLLocate(SkipListPtr list, unsigned long key, int *block, int *slot)
 {
-    int level = 1;
-    SL_RANDOM_DECL;
+    int b, s;
 
-    SL_RANDOM_INIT(SL_RANDOM_SEED);
-    
-    while ((SL_RANDOM & 0x01) && level < SL_MAX_LEVEL) ++level;
-    return level;
+    if (!list->nblocks) {
+	*block = *slot = 0;
+	return;
+    }
+
+    b = SLFindBlock(list, key);
+    s = SLFindSlot(list->blocks[b], key);
+    if (s == list->blocks[b]->count) {
+	++b;
+	s = 0;
+    }
+    *block = b;
+    *slot  = s;
 }
 
 drm_public void *drmSLCreate(void)
 {
     SkipListPtr  list;
-    int          i;
 
     list           = drmMalloc(sizeof(*list));
     if (!list) return NULL;
     list->magic    = SL_LIST_MAGIC;
-    list->level    = 0;
-    list->head     = SLCreateEntry(SL_MAX_LEVEL, 0, NULL);
     list->count    = 0;
+    list->nblocks  = 0;
+    list->size     = 0;
+    list->blocks   = NULL;
+    list->first    = NULL;
+    list->serial   = 0;
+    list->p0_done  = 1;
 
-    for (i = 0; i <= SL_MAX_LEVEL; i++) list->head->forward[i] = NULL;
-    
     return list;
 }
 
 drm_public int drmSLDestroy(void *l)
 {
     SkipListPtr   list  = (SkipListPtr)l;
-    SLEntryPtr    entry;
-    SLEntryPtr    next;
+    int           i;
 
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
 
-    for (entry = list->head; entry; entry = next) {
-	if (entry->magic != SL_ENTRY_MAGIC) return -1; /* Bad magic */
-	next         = entry->forward[0];
-	entry->magic = SL_FREED_MAGIC;
-	drmFree(entry);
+    for (i = 0; i < list->nblocks; i++) {
+	if (list->blocks[i]->magic != SL_BLOCK_MAGIC) return -1; /* Bad magic */
+	SLFreeBlock(list->blocks[i]);
     }
 
+    free(list->blocks);
+    free(list->first);
     list->magic = SL_FREED_MAGIC;
     drmFree(list);
     return 0;
 }
 
-static SLEntryPtr SLLocate(void *l, unsigned long key, SLEntryPtr *update)
+drm_public int drmSLInsert(void *l, unsigned long key, void *value)
 {
     SkipListPtr   list  = (SkipListPtr)l;
-    SLEntryPtr    entry;
-    int           i;
+    SLBlockPtr    block;
+    int           b, s;
 
-    if (list->magic != SL_LIST_MAGIC) return NULL;
+    if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
 
-    for (i = list->level, entry = list->head; i >= 0; i--) {
-	while (entry->forward[i] && entry->forward[i]->key < key)
-	    entry = entry->forward[i];
-	update[i] = entry;
+    if (!list->nblocks) {
+	block = SLCreateBlock();
+	if (!block) return -1;
+	if (SLDirInsert(list, 0, block)) {
+	    SLFreeBlock(block);
+	    return -1;
+	}
     }
 
-    return entry->forward[0];
+    b     = SLFindBlock(list, key);
+    block = list->blocks[b];
+    s     = SLFindSlot(block, key);
+
+    if (s < block->count && block->keys[s] == key) return 1; /* Already in list */
+
+    if (block->count == SL_BLOCK_SIZE) {
+				/* Split, moving the upper half to a new block */
+	SLBlockPtr split = SLCreateBlock();
+	int        half  = SL_BLOCK_SIZE / 2;
+
+	if (!split) return -1;
+	memcpy(split->keys, &block->keys[half],
+	       (SL_BLOCK_SIZE - half) * sizeof(block->keys[0]));
+	memcpy(split->values, &block->values[half],
+	       (SL_BLOCK_SIZE - half) * sizeof(block->values[0]));
+	split->count = SL_BLOCK_SIZE - half;
+	if (SLDirInsert(list, b + 1, split)) {
+	    SLFreeBlock(split);
+	    return -1;
+	}
+	block->count = half;
+
+	if (s > half) {
+	    ++b;
+	    s    -= half;
+	    block = split;
+	}
+    }
+
+    memmove(&block->keys[s + 1], &block->keys[s],
+	    (block->count - s) * sizeof(block->keys[0]));
+    memmove(&block->values[s + 1], &block->values[s],
+	    (block->count - s) * sizeof(block->values[0]));
+    block->keys[s]   = key;
+    block->values[s] = value;
+    ++block->count;
+    list->first[b]   = block->keys[0];
+
+    ++list->count;
+    ++list->serial;
+    return 0;			/* Added to table */
 }
 
-drm_public int drmSLInsert(void *l, unsigned long key, void *value)
+/* Insert count entries at once.  When the list is empty and the keys are
+ * strictly increasing the blocks are filled directly, otherwise this falls
+ * back to drmSLInsert().  Returns the number of entries added, or -1. */
+drm_public int drmSLBulkInsert(void *l, const unsigned long *keys,
+                               void * const *values, int count)
 {
     SkipListPtr   list  = (SkipListPtr)l;
-    SLEntryPtr    entry;
-    SLEntryPtr    update[SL_MAX_LEVEL + 1];
-    int           level;
+    SLBlockPtr    block = NULL;
+    int           added = 0;
     int           i;
 
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
 
-    entry = SLLocate(list, key, update);
-
-    if (entry && entry->key == key) return 1; /* Already in list */
+    for (i = 1; i < count; i++)
+	if (keys[i - 1] >= keys[i]) break;
 
+    if (list->count || i < count) {
+	for (i = 0; i < count; i++) {
+	    int ret = drmSLInsert(list, keys[i], values ? values[i] : NULL);
 
-    level = SLRandomLevel();
-    if (level > list->level) {
-	level = ++list->level;
-	update[level] = list->head;
+	    if (ret < 0) return -1;
+	    if (!ret) ++added;
+	}
+	return added;
     }
 
-    entry = SLCreateEntry(level, key, value);
-
-				/* Fix up forward pointers */
-    for (i = 0; i <= level; i++) {
-	entry->forward[i]     = update[i]->forward[i];
-	update[i]->forward[i] = entry;
+    for (i = 0; i < count; i++) {
+	if (!block || block->count == SL_BULK_FILL) {
+	    block = SLCreateBlock();
+	    if (!block) return -1;
+	    if (SLDirInsert(list, list->nblocks, block)) {
+		SLFreeBlock(block);
+		return -1;
+	    }
+	    list->first[list->nblocks - 1] = keys[i];
+	}
+	block->keys[block->count]   = keys[i];
+	block->values[block->count] = values ? values[i] : NULL;
+	++block->count;
+	++list->count;
+	++added;
     }
 
-    ++list->count;
-    return 0;			/* Added to table */
+    ++list->serial;
+    return added;
 }
 
 drm_public int drmSLDelete(void *l, unsigned long key)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    update[SL_MAX_LEVEL + 1];
-    SLEntryPtr    entry;
-    int           i;
+    SLBlockPtr    block;
+    int           b, s;
 
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
 
-    entry = SLLocate(list, key, update);
-
-    if (!entry || entry->key != key) return 1; /* Not found */
-
-				/* Fix up forward pointers */
-    for (i = 0; i <= list->level; i++) {
-	if (update[i]->forward[i] == entry)
-	    update[i]->forward[i] = entry->forward[i];
+    if (!list->nblocks) return 1; /* Not found */
+
+    b     = SLFindBlock(list, key);
+    block = list->blocks[b];
+    s     = SLFindSlot(block, key);
+
+    if (s == block->count || block->keys[s] != key) return 1; /* Not found */
+
+    --block->count;
+    memmove(&block->keys[s], &block->keys[s + 1],
+	    (block->count - s) * sizeof(block->keys[0]));
+    memmove(&block->values[s], &block->values[s + 1],
+	    (block->count - s) * sizeof(block->values[0]));
+
+    if (!block->count) {
+	SLDirRemove(list, b);
+    } else {
+	list->first[b] = block->keys[0];
+				/* Merge sparse neighbours */
+	if (b + 1 < list->nblocks &&
+	    block->count + list->blocks[b + 1]->count <= SL_BLOCK_SIZE / 2) {
+	    SLBlockPtr next = list->blocks[b + 1];
+
+	    memcpy(&block->keys[block->count], next->keys,
+		   next->count * sizeof(next->keys[0]));
+	    memcpy(&block->values[block->count], next->values,
+		   next->count * sizeof(next->values[0]));
+	    block->count += next->count;
+	    SLDirRemove(list, b + 1);
+	}
     }
 
-    entry->magic = SL_FREED_MAGIC;
-    drmFree(entry);
-
-    while (list->level && !list->head->forward[list->level]) --list->level;
     --list->count;
+    ++list->serial;
     return 0;
 }
 
+/*
+ * Returns 0 and the value stored with key, or -1 and NULL if key is not in
+ * the list, as before.  The skip list returned its internal entry instead of
+ * the value, there is no such entry in the blocks and nothing depended on it.
+ */
 drm_public int drmSLLookup(void *l, unsigned long key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    update[SL_MAX_LEVEL + 1];
-    SLEntryPtr    entry;
-
-    entry = SLLocate(list, key, update);
-
-    if (entry && entry->key == key) {
-	*value = entry;
-	return 0;
+    SLBlockPtr    block;
+    int           s;
+
+    if (list->magic == SL_LIST_MAGIC && list->nblocks) {
+	block = list->blocks[SLFindBlock(list, key)];
+	s     = SLFindSlot(block, key);
+	if (s < block->count && block->keys[s] == key) {
+	    *value = block->values[s];
+	    return 0;
+	}
     }
     *value = NULL;
     return -1;
@@ -233,23 +403,33 @@ drm_public int drmSLLookupNeighbors(void *l, unsigned long key,
                                     unsigned long *next_key, void **next_value)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    update[SL_MAX_LEVEL + 1] = {0};
     int           retcode = 0;
-
-    SLLocate(list, key, update);
+    int           b, s;
 
     *prev_key   = *next_key   = key;
     *prev_value = *next_value = NULL;
 
-    if (update[0]) {
-	*prev_key   = update[0]->key;
-	*prev_value = update[0]->value;
+    if (list->magic != SL_LIST_MAGIC) return 0;
+
+    SLLocate(list, key, &b, &s);
+
+				/* The list head acts as a <0, NULL> entry */
+    *prev_key = 0;
+    if (s > 0) {
+	*prev_key   = list->blocks[b]->keys[s - 1];
+	*prev_value = list->blocks[b]->values[s - 1];
+    } else if (b > 0) {
+	SLBlockPtr prev = list->blocks[b - 1];
+
+	*prev_key   = prev->keys[prev->count - 1];
+	*prev_value = prev->values[prev->count - 1];
+    }
+    ++retcode;
+
+    if (b < list->nblocks) {
+	*next_key   = list->blocks[b]->keys[s];
+	*next_value = list->blocks[b]->values[s];
 	++retcode;
-	if (update[0]->forward[0]) {
-	    *next_key   = update[0]->forward[0]->key;
-	    *next_value = update[0]->forward[0]->value;
-	    ++retcode;
-	}
     }
     return retcode;
 }
@@ -257,63 +437,81 @@ drm_public int drmSLLookupNeighbors(void *l, unsigned long key,
 drm_public int drmSLNext(void *l, unsigned long *key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    entry;
-    
+    SLBlockPtr    block;
+
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
 
-    entry    = list->p0;
+    if (list->p0_done) return 0;
 
-    if (entry) {
-	list->p0 = entry->forward[0];
-	*key     = entry->key;
-	*value   = entry->value;
-	return 1;
+    if (list->p0_serial != list->serial) {
+				/* Modified since the last call, find our place */
+	SLLocate(list, list->p0_key, &list->p0_block, &list->p0_slot);
+	list->p0_serial = list->serial;
     }
-    list->p0 = NULL;
-    return 0;
+
+    if (list->p0_block >= list->nblocks) {
+	list->p0_done = 1;
+	return 0;
+    }
+
+    block  = list->blocks[list->p0_block];
+    *key   = block->keys[list->p0_slot];
+    *value = block->values[list->p0_slot];
+
+    if (++list->p0_slot == block->count) {
+	++list->p0_block;
+	list->p0_slot = 0;
+    }
+    list->p0_key  = *key + 1;
+    list->p0_done = *key == ULONG_MAX;
+    return 1;
 }
 
-drm_public int drmSLFirst(void *l, unsigned long *key, void **value)
+/* Start an iteration at the first entry whose key is >= key, without
+ * walking the preceding entries. */
+drm_public int drmSLSeek(void *l, unsigned long key,
+                         unsigned long *found_key, void **value)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    
+
     if (list->magic != SL_LIST_MAGIC) return -1; /* Bad magic */
-    
-    list->p0 = list->head->forward[0];
-    return drmSLNext(list, key, value);
+
+    SLLocate(list, key, &list->p0_block, &list->p0_slot);
+    list->p0_key    = key;
+    list->p0_serial = list->serial;
+    list->p0_done   = 0;
+    return drmSLNext(list, found_key, value);
+}
+
+drm_public int drmSLFirst(void *l, unsigned long *key, void **value)
+{
+    return drmSLSeek(l, 0, key, value);
 }
 
 /* Dump internal data structures for debugging. */
 drm_public void drmSLDump(void *l)
 {
     SkipListPtr   list = (SkipListPtr)l;
-    SLEntryPtr    entry;
-    int           i;
-    
+    SLBlockPtr    block;
+    int           i, j;
+
     if (list->magic != SL_LIST_MAGIC) {
 	printf("Bad magic: 0x%08lx (expected 0x%08lx)\n",
 	       list->magic, SL_LIST_MAGIC);
 	return;
     }
 
-    printf("Level = %d, count = %d\n", list->level, list->count);
-    for (entry = list->head; entry; entry = entry->forward[0]) {
-	if (entry->magic != SL_ENTRY_MAGIC) {
+    printf("Blocks = %d, count = %d\n", list->nblocks, list->count);
+    for (i = 0; i < list->nblocks; i++) {
+	block = list->blocks[i];
+	if (block->magic != SL_BLOCK_MAGIC) {
 	    printf("Bad magic: 0x%08lx (expected 0x%08lx)\n",
-		   list->magic, SL_ENTRY_MAGIC);
-	}
-	printf("\nEntry %p <0x%08lx, %p> has %2d levels\n",
-	       entry, entry->key, entry->value, entry->levels);
-	for (i = 0; i < entry->levels; i++) {
-	    if (entry->forward[i]) {
-		printf("   %2d: %p <0x%08lx, %p>\n",
-		       i,
-		       entry->forward[i],
-		       entry->forward[i]->key,
-		       entry->forward[i]->value);
-	    } else {
-		printf("   %2d: %p\n", i, entry->forward[i]);
-	    }
+		   block->magic, SL_BLOCK_MAGIC);
 	}
+	printf("\nBlock %p first 0x%08lx has %2d entries\n",
+	       block, list->first[i], block->count);
+	for (j = 0; j < block->count; j++)
+	    printf("   %2d: <0x%08lx, %p>\n",
+		   j, block->keys[j], block->values[j]);
     }
 }